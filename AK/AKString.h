@@ -3,6 +3,7 @@
 #include "ByteBuffer.h"
 #include "RetainPtr.h"
 #include "StringImpl.h"
+#include "StringView.h"
 #include "Traits.h"
 #include "Vector.h"
 #include "kstdio.h"
@@ -34,6 +35,11 @@ public:
     {
     }
 
+    explicit String(const StringView& view)
+        : m_impl(view.is_null() ? nullptr : StringImpl::create(view.characters(), view.length()))
+    {
+    }
+
     String(const StringImpl& impl)
         : m_impl(const_cast<StringImpl&>(impl))
     {
@@ -65,8 +71,12 @@ public:
         return m_impl->to_uppercase();
     }
 
-    Vector<String> split(char separator) const;
+    // With an |inline_capacity|, that many parts come back without the Vector going to the heap.
+    template<int inline_capacity = 0>
+    Vector<String, inline_capacity> split(char separator) const;
     String substring(ssize_t start, ssize_t length) const;
+    StringView view() const { return { characters(), length() }; }
+    StringView substring_view(ssize_t start, ssize_t length) const { return view().substring_view(start, length); }
 
     bool is_null() const { return !m_impl; }
     bool is_empty() const { return length() == 0; }
@@ -110,6 +120,37 @@ private:
     RetainPtr<StringImpl> m_impl;
 };
 
+template<int inline_capacity>
+Vector<String, inline_capacity> String::split(const char separator) const
+{
+    if (is_empty())
+        return { };
+
+    Vector<String, inline_capacity> v;
+    ssize_t substart = 0;
+    for (ssize_t i = 0; i < length(); ++i) {
+        char ch = characters()[i];
+        if (ch == separator) {
+            ssize_t sublen = i - substart;
+            if (sublen != 0)
+                v.append(substring(substart, sublen));
+            substart = i + 1;
+        }
+    }
+    ssize_t taillen = length() - substart;
+    if (taillen != 0)
+        v.append(substring(substart, taillen));
+    if (characters()[length() - 1] == separator)
+        v.append(empty());
+    return v;
+}
+
+inline StringView::StringView(const String& string)
+    : m_characters(string.characters())
+    , m_length(string.length())
+{
+}
+
 template<>
 struct Traits<String> {
     static unsigned hash(const String& s) { return s.impl() ? s.impl()->hash() : 0; }
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "Assertions.h"
+#include "StdLibExtras.h"
+#include "Types.h"
+#include "kmalloc.h"
+
+namespace AK {
+
+// Hands out memory by bumping a pointer through big chunks, and takes all of it back at once.
+// Nothing is ever freed or destroyed on its own, so it's for temporaries that all die together,
+// like everything one frame or one request needs. Whatever has a destructor has to be destroyed by hand.
+class ArenaAllocator {
+public:
+    explicit ArenaAllocator(size_t chunk_size = 16 * KB)
+        : m_chunk_size(chunk_size)
+    {
+    }
+
+    ~ArenaAllocator() { free_chunks_until(nullptr); }
+
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    void* allocate(size_t size, size_t alignment = sizeof(void*))
+    {
+        ASSERT(alignment && !(alignment & (alignment - 1)));
+        if (m_current) {
+            size_t offset = align_offset(*m_current, alignment);
+            if (offset + size <= m_current->size) {
+                m_current->used = offset + size;
+                return m_current->data() + offset;
+            }
+        }
+        return allocate_in_new_chunk(size, alignment);
+    }
+
+    // Uninitialized room for |count| T's.
+    template<typename T>
+    T* allocate_array(int count)
+    {
+        return (T*)allocate(sizeof(T) * count, alignof(T));
+    }
+
+    template<typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    }
+
+    // |count| default-constructed T's.
+    template<typename T>
+    T* make_array(int count)
+    {
+        T* array = allocate_array<T>(count);
+        for (int i = 0; i < count; ++i)
+            new (&array[i]) T();
+        return array;
+    }
+
+    // Where the arena is up to, to go back to with rewind().
+    struct Mark {
+        void* chunk { nullptr };
+        size_t used { 0 };
+    };
+    Mark mark() const { return { m_current, m_current ? m_current->used : 0 }; }
+
+    // Takes back everything allocated since |mark|. Going back to empty keeps one chunk,
+    // as big as all of them were together, so the next round of the same size fits in it.
+    void rewind(const Mark& mark)
+    {
+        if (!mark.chunk) {
+            reset();
+            return;
+        }
+        free_chunks_until((Chunk*)mark.chunk);
+        m_current->used = mark.used;
+    }
+
+    void reset()
+    {
+        if (!m_current)
+            return;
+        if (!m_current->previous) {
+            m_current->used = 0;
+            return;
+        }
+        size_t total_size = 0;
+        for (auto* chunk = m_current; chunk; chunk = chunk->previous)
+            total_size += chunk->size;
+        free_chunks_until(nullptr);
+        m_current = create_chunk(total_size, nullptr);
+    }
+
+    size_t bytes_used() const
+    {
+        size_t used = 0;
+        for (auto* chunk = m_current; chunk; chunk = chunk->previous)
+            used += chunk->used;
+        return used;
+    }
+
+private:
+    struct Chunk {
+        Chunk* previous { nullptr };
+        size_t size { 0 };
+        size_t used { 0 };
+        byte* data() { return (byte*)(this + 1); }
+    };
+
+    static size_t align_offset(Chunk& chunk, size_t alignment)
+    {
+        size_t address = (size_t)(chunk.data() + chunk.used);
+        return chunk.used + (((address + alignment - 1) & ~(alignment - 1)) - address);
+    }
+
+    static Chunk* create_chunk(size_t size, Chunk* previous)
+    {
+        auto* chunk = (Chunk*)kmalloc(sizeof(Chunk) + size);
+        new (chunk) Chunk;
+        chunk->previous = previous;
+        chunk->size = size;
+        return chunk;
+    }
+
+    void* allocate_in_new_chunk(size_t size, size_t alignment)
+    {
+        // Anything bigger than a chunk gets one of its own.
+        m_current = create_chunk(max(m_chunk_size, size + alignment), m_current);
+        size_t offset = align_offset(*m_current, alignment);
+        m_current->used = offset + size;
+        return m_current->data() + offset;
+    }
+
+    void free_chunks_until(Chunk* last_kept)
+    {
+        while (m_current != last_kept) {
+            ASSERT(m_current);
+            auto* previous = m_current->previous;
+            kfree(m_current);
+            m_current = previous;
+        }
+    }
+
+    size_t m_chunk_size { 0 };
+    Chunk* m_current { nullptr };
+};
+
+// Takes back everything allocated from the arena while it was alive.
+class ArenaScope {
+public:
+    explicit ArenaScope(ArenaAllocator& arena)
+        : m_arena(arena)
+        , m_mark(arena.mark())
+    {
+    }
+    ~ArenaScope() { m_arena.rewind(m_mark); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    ArenaAllocator& m_arena;
+    ArenaAllocator::Mark m_mark;
+};
+
+}
+
+using AK::ArenaAllocator;
+using AK::ArenaScope;
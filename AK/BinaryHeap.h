@@ -0,0 +1,91 @@
+#pragma once
+
+#include <AK/StdLibExtras.h>
+#include <AK/Vector.h>
+
+namespace AK {
+
+// A min-heap: values come out in order of their keys, smallest first. Keys are compared with operator<.
+template<typename K, typename V>
+class BinaryHeap {
+public:
+    BinaryHeap() { }
+
+    bool is_empty() const { return m_elements.is_empty(); }
+    int size() const { return m_elements.size(); }
+    void clear() { m_elements.clear(); }
+
+    void insert(const K& key, V&& value)
+    {
+        m_elements.append({ key, move(value) });
+        heapify_up(size() - 1);
+    }
+
+    void insert(const K& key, const V& value)
+    {
+        m_elements.append({ key, value });
+        heapify_up(size() - 1);
+    }
+
+    const K& peek_min_key() const
+    {
+        ASSERT(!is_empty());
+        return m_elements[0].key;
+    }
+
+    const V& peek_min() const
+    {
+        ASSERT(!is_empty());
+        return m_elements[0].value;
+    }
+
+    V pop_min()
+    {
+        ASSERT(!is_empty());
+        swap(m_elements[0], m_elements.last());
+        auto node = m_elements.take_last();
+        if (!is_empty())
+            heapify_down(0);
+        return move(node.value);
+    }
+
+private:
+    struct Node {
+        K key;
+        V value;
+    };
+
+    void heapify_up(int index)
+    {
+        while (index) {
+            int parent = (index - 1) / 2;
+            if (!(m_elements[index].key < m_elements[parent].key))
+                return;
+            swap(m_elements[index], m_elements[parent]);
+            index = parent;
+        }
+    }
+
+    void heapify_down(int index)
+    {
+        for (;;) {
+            int smallest = index;
+            int left = index * 2 + 1;
+            int right = left + 1;
+            if (left < size() && m_elements[left].key < m_elements[smallest].key)
+                smallest = left;
+            if (right < size() && m_elements[right].key < m_elements[smallest].key)
+                smallest = right;
+            if (smallest == index)
+                return;
+            swap(m_elements[index], m_elements[smallest]);
+            index = smallest;
+        }
+    }
+
+    Vector<Node> m_elements;
+};
+
+}
+
+using AK::BinaryHeap;
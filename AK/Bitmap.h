@@ -42,10 +42,86 @@ public:
             m_data[index / 8] &= static_cast<byte>(~(1u << (index % 8)));
     }
 
+    // Sets (or clears) the bits [start, start + length), whole bytes at a time where it can.
+    void set_range(int start, int length, bool value) const
+    {
+        ASSERT(start >= 0 && length >= 0 && start + length <= m_size);
+        int end = start + length;
+        for (; start < end && start % 8; ++start)
+            set(start, value);
+        int whole_bytes_end = end & ~7;
+        if (start < whole_bytes_end) {
+            memset(m_data + start / 8, value ? 0xff : 0x00, (whole_bytes_end - start) / 8);
+            start = whole_bytes_end;
+        }
+        for (; start < end; ++start)
+            set(start, value);
+    }
+
+    // These all return size() when there's no such bit.
+    int find_first_set() const { return find_next(0, true); }
+    int find_first_unset() const { return find_next(0, false); }
+    int find_next_set(int from) const { return find_next(from, true); }
+    int find_next_unset(int from) const { return find_next(from, false); }
+
+    // The first run of at least min_length unset bits at or after from, or -1.
+    int find_first_unset_run(int min_length, int from = 0) const
+    {
+        ASSERT(min_length > 0);
+        for (int start = find_next_unset(from); start < m_size;) {
+            int end = min_length == 1 ? start + 1 : find_next_set(start);
+            if (end - start >= min_length)
+                return start;
+            start = find_next_unset(end);
+        }
+        return -1;
+    }
+
+    // Returns the length of the longest run of unset bits, and puts where it starts in start (-1 if there's none).
+    int find_longest_unset_run(int& start) const
+    {
+        int longest = 0;
+        start = -1;
+        for (int run_start = find_first_unset(); run_start < m_size;) {
+            int run_end = find_next_set(run_start);
+            if (run_end - run_start > longest) {
+                longest = run_end - run_start;
+                start = run_start;
+            }
+            run_start = find_next_unset(run_end);
+        }
+        return longest;
+    }
+
     byte* data() { return m_data; }
     const byte* data() const { return m_data; }
 
 private:
+    // Looks at 32 bits at a time and lets bsf find the bit, only the tail past the last whole word goes bit by bit.
+    int find_next(int from, bool value) const
+    {
+        ASSERT(from >= 0);
+        int index = from;
+        while (index < m_size) {
+            int word_start = index & ~31;
+            if (word_start + 32 > m_size)
+                break;
+            dword word;
+            __builtin_memcpy(&word, m_data + word_start / 8, sizeof(word));
+            if (!value)
+                word = ~word;
+            word &= ~0u << (index - word_start);
+            if (word)
+                return word_start + __builtin_ctz(word);
+            index = word_start + 32;
+        }
+        for (; index < m_size; ++index) {
+            if (get(index) == value)
+                return index;
+        }
+        return m_size;
+    }
+
     explicit Bitmap(int size, bool default_value)
         : m_size(size)
         , m_owned(true)
@@ -15,8 +15,9 @@ bool FileSystemPath::canonicalize(bool resolve_symbolic_links)
 {
     // FIXME: Implement "resolve_symbolic_links"
     (void) resolve_symbolic_links;
-    auto parts = m_string.split('/');
-    Vector<String> canonical_parts;
+    // Only the parts that make it into the canonical path get copied, once they're known.
+    auto parts = m_string.view().split_view<16>('/');
+    Vector<StringView, 16> canonical_parts;
 
     for (auto& part : parts) {
         if (part == ".")
@@ -30,17 +31,21 @@ bool FileSystemPath::canonicalize(bool resolve_symbolic_links)
             canonical_parts.append(part);
     }
     if (canonical_parts.is_empty()) {
+        m_parts.clear();
         m_string = m_basename = "/";
         return true;
     }
 
-    m_basename = canonical_parts.last();
     StringBuilder builder;
+    Vector<String> new_parts;
+    new_parts.ensure_capacity(canonical_parts.size());
     for (auto& cpart : canonical_parts) {
         builder.append('/');
-        builder.append(cpart);
+        builder.append(cpart.characters(), cpart.length());
+        new_parts.unchecked_append(String(cpart));
     }
-    m_parts = move(canonical_parts);
+    m_basename = new_parts.last();
+    m_parts = move(new_parts);
     m_string = builder.to_string();
     return true;
 }
@@ -0,0 +1,99 @@
+#include "FlyString.h"
+#include "HashTable.h"
+
+#ifdef KERNEL
+#include <Kernel/i386.h>
+#endif
+
+namespace AK {
+
+// Looked up by the characters, not the pointer. The ones in the table always have an |impl|,
+// while one that's only being looked for can be just a view.
+struct FlyStringKey {
+    FlyStringKey(StringImpl& impl)
+        : impl(&impl)
+        , view(impl.characters(), impl.length())
+    {
+    }
+    FlyStringKey(const StringView& view)
+        : view(view)
+    {
+    }
+
+    StringImpl* impl { nullptr };
+    StringView view;
+
+    bool operator==(const FlyStringKey& other) const
+    {
+        if (impl && impl == other.impl)
+            return true;
+        return view == other.view;
+    }
+};
+
+template<>
+struct Traits<FlyStringKey> {
+    // StringImpl keeps its hash around, and it's the same one a view has.
+    static unsigned hash(const FlyStringKey& key) { return key.impl ? key.impl->hash() : key.view.hash(); }
+    static void dump(const FlyStringKey& key) { Traits<StringView>::dump(key.view); }
+};
+
+static HashTable<FlyStringKey>& fly_impls()
+{
+    static HashTable<FlyStringKey>* table;
+    if (!table)
+        table = new HashTable<FlyStringKey>;
+    return *table;
+}
+
+FlyString::FlyString(const String& string)
+{
+    if (string.is_null())
+        return;
+    auto* impl = const_cast<StringImpl*>(string.impl());
+    if (impl->is_fly()) {
+        m_string = string;
+        return;
+    }
+#ifdef KERNEL
+    // Strings are made and dropped by everyone, interrupts included.
+    InterruptDisabler disabler;
+#endif
+    auto& table = fly_impls();
+    auto it = table.find({ *impl });
+    if (it != table.end()) {
+        m_string = *(*it).impl;
+        return;
+    }
+    impl->set_fly({ }, true);
+    table.set({ *impl });
+    m_string = string;
+}
+
+FlyString::FlyString(const StringView& view)
+{
+    if (view.is_null())
+        return;
+    {
+#ifdef KERNEL
+        InterruptDisabler disabler;
+#endif
+        auto& table = fly_impls();
+        auto it = table.find({ view });
+        if (it != table.end()) {
+            m_string = *(*it).impl;
+            return;
+        }
+    }
+    *this = FlyString(String(view));
+}
+
+void FlyString::did_destroy_impl(Badge<StringImpl>, StringImpl& impl)
+{
+#ifdef KERNEL
+    InterruptDisabler disabler;
+#endif
+    fly_impls().remove({ impl });
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "AKString.h"
+#include "Badge.h"
+
+namespace AK {
+
+// A String that's been interned: there's only ever one StringImpl with the same characters among them,
+// so comparing two FlyStrings is comparing two pointers. Making one costs a lookup in the table of them,
+// so it's for names that get compared over and over, while the String it came from can be anything.
+// An interned StringImpl leaves the table when the last String or FlyString holding it goes away.
+class FlyString {
+public:
+    FlyString() { }
+    FlyString(const String&);
+    // Only makes a String out of |view| if there's no FlyString with those characters already.
+    explicit FlyString(const StringView&);
+    FlyString(const char* cstring)
+        : FlyString(String(cstring))
+    {
+    }
+
+    bool is_null() const { return m_string.is_null(); }
+    bool is_empty() const { return m_string.is_empty(); }
+    ssize_t length() const { return m_string.length(); }
+    const char* characters() const { return m_string.characters(); }
+    const String& string() const { return m_string; }
+    const StringImpl* impl() const { return m_string.impl(); }
+
+    bool operator==(const FlyString& other) const { return m_string.impl() == other.m_string.impl(); }
+    bool operator!=(const FlyString& other) const { return !(*this == other); }
+    bool operator==(const String& other) const { return m_string == other; }
+    bool operator!=(const String& other) const { return !(*this == other); }
+    bool operator==(const StringView& other) const { return other == m_string; }
+    bool operator!=(const StringView& other) const { return !(*this == other); }
+
+    static void did_destroy_impl(Badge<StringImpl>, StringImpl&);
+
+private:
+    String m_string;
+};
+
+template<>
+struct Traits<FlyString> {
+    static unsigned hash(const FlyString& s) { return s.impl() ? s.impl()->hash() : 0; }
+    static void dump(const FlyString& s) { kprintf("%s", s.characters()); }
+};
+
+}
+
+using AK::FlyString;
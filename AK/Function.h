@@ -26,29 +26,49 @@
 #pragma once
 
 #include "Assertions.h"
-#include "OwnPtr.h"
 #include "StdLibExtras.h"
+#include "Types.h"
+#include "kmalloc.h"
 
 namespace AK {
 
 template<typename> class Function;
 
+// Callables that fit in a few pointers, like most lambdas, are kept in the Function itself instead of on the heap.
 template <typename Out, typename... In>
 class Function<Out(In...)> {
 public:
     Function() = default;
     Function(std::nullptr_t) { }
+    ~Function() { clear(); }
+
+    Function(const Function&) = delete;
+    Function& operator=(const Function&) = delete;
+
+    Function(Function&& other)
+    {
+        take_from(other);
+    }
+
+    Function& operator=(Function&& other)
+    {
+        if (this != &other) {
+            clear();
+            take_from(other);
+        }
+        return *this;
+    }
 
     template<typename CallableType, class = typename EnableIf<!(IsPointer<CallableType>::value && IsFunction<typename RemovePointer<CallableType>::Type>::value) && IsRvalueReference<CallableType&&>::value>::Type>
     Function(CallableType&& callable)
-        : m_callable_wrapper(make<CallableWrapper<CallableType>>(move(callable)))
     {
+        init_with_callable<CallableType>(move(callable));
     }
 
     template<typename FunctionType, class = typename EnableIf<IsPointer<FunctionType>::value && IsFunction<typename RemovePointer<FunctionType>::Type>::value>::Type>
     Function(FunctionType f)
-        : m_callable_wrapper(make<CallableWrapper<FunctionType>>(move(f)))
     {
+        init_with_callable<FunctionType>(move(f));
     }
 
     Out operator()(In... in) const
@@ -62,20 +82,22 @@ public:
     template<typename CallableType, class = typename EnableIf<!(IsPointer<CallableType>::value && IsFunction<typename RemovePointer<CallableType>::Type>::value) && IsRvalueReference<CallableType&&>::value>::Type>
     Function& operator=(CallableType&& callable)
     {
-        m_callable_wrapper = make<CallableWrapper<CallableType>>(move(callable));
+        clear();
+        init_with_callable<CallableType>(move(callable));
         return *this;
     }
 
     template<typename FunctionType, class = typename EnableIf<IsPointer<FunctionType>::value && IsFunction<typename RemovePointer<FunctionType>::Type>::value>::Type>
     Function& operator=(FunctionType f)
     {
-        m_callable_wrapper = make<CallableWrapper<FunctionType>>(move(f));
+        clear();
+        init_with_callable<FunctionType>(move(f));
         return *this;
     }
 
     Function& operator=(std::nullptr_t)
     {
-        m_callable_wrapper = nullptr;
+        clear();
         return *this;
     }
 
@@ -84,6 +106,8 @@ private:
     public:
         virtual ~CallableWrapperBase() { }
         virtual Out call(In...) const = 0;
+        // Moves the callable into |destination|, which is another Function's inline storage.
+        virtual CallableWrapperBase* move_into(void* destination) = 0;
     };
 
     template<typename CallableType>
@@ -98,15 +122,88 @@ private:
         CallableWrapper& operator=(const CallableWrapper&) = delete;
 
         Out call(In... in) const final override { return m_callable(forward<In>(in)...); }
+        CallableWrapperBase* move_into(void* destination) final override { return new (destination) CallableWrapper(move(m_callable)); }
 
     private:
         CallableType m_callable;
     };
 
-    OwnPtr<CallableWrapperBase> m_callable_wrapper;
+    // Room for the vtable pointer and four pointers' worth of captures.
+    static constexpr size_t inline_capacity = 5 * sizeof(void*);
+    static constexpr size_t inline_alignment = 8;
+
+    template<typename CallableType>
+    void init_with_callable(CallableType&& callable)
+    {
+        typedef CallableWrapper<CallableType> WrapperType;
+        if constexpr (sizeof(WrapperType) <= inline_capacity && alignof(WrapperType) <= inline_alignment) {
+            m_callable_wrapper = new (m_inline_storage) WrapperType(move(callable));
+            m_is_inline = true;
+        } else {
+            m_callable_wrapper = new WrapperType(move(callable));
+        }
+    }
+
+    void clear()
+    {
+        if (!m_callable_wrapper)
+            return;
+        if (m_is_inline)
+            m_callable_wrapper->~CallableWrapperBase();
+        else
+            delete m_callable_wrapper;
+        m_callable_wrapper = nullptr;
+        m_is_inline = false;
+    }
+
+    void take_from(Function& other)
+    {
+        if (!other.m_callable_wrapper)
+            return;
+        if (other.m_is_inline) {
+            m_callable_wrapper = other.m_callable_wrapper->move_into(m_inline_storage);
+            m_is_inline = true;
+            other.clear();
+            return;
+        }
+        m_callable_wrapper = other.m_callable_wrapper;
+        other.m_callable_wrapper = nullptr;
+    }
+
+    CallableWrapperBase* m_callable_wrapper { nullptr };
+    bool m_is_inline { false };
+    alignas(inline_alignment) byte m_inline_storage[inline_capacity];
+};
+
+template<typename> class FunctionRef;
+
+// Calls something it doesn't own, without keeping a copy of it anywhere, for callbacks that are done
+// with before the call that takes them returns. A lambda passed straight in lives until then.
+template<typename Out, typename... In>
+class FunctionRef<Out(In...)> {
+public:
+    template<typename CallableType, class = typename EnableIf<!IsSame<typename RemoveCV<typename RemoveReference<CallableType>::Type>::Type, FunctionRef>::value>::Type>
+    FunctionRef(CallableType&& callable)
+        : m_callable(const_cast<void*>(static_cast<const void*>(&callable)))
+        , m_call(&call_callable<typename RemoveReference<CallableType>::Type>)
+    {
+    }
+
+    Out operator()(In... in) const { return m_call(m_callable, forward<In>(in)...); }
+
+private:
+    template<typename CallableType>
+    static Out call_callable(void* callable, In... in)
+    {
+        return (*static_cast<CallableType*>(callable))(forward<In>(in)...);
+    }
+
+    void* m_callable { nullptr };
+    Out (*m_call)(void*, In...) { nullptr };
 };
 
 }
 
 using AK::Function;
+using AK::FunctionRef;
 
@@ -13,7 +13,7 @@ private:
         K key;
         V value;
 
-        bool operator==(const Entry& other)
+        bool operator==(const Entry& other) const
         {
             return key == other.key;
         }
@@ -50,6 +50,7 @@ public:
     unsigned size() const { return m_table.size(); }
     unsigned capacity() const { return m_table.capacity(); }
     void clear() { m_table.clear(); }
+    void reserve(unsigned size) { m_table.reserve(size); }
 
     void set(const K&, const V&);
     void set(const K&, V&&);
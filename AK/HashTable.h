@@ -1,9 +1,9 @@
 #pragma once
 
 #include "Assertions.h"
-#include "DoublyLinkedList.h"
 #include "Traits.h"
 #include "StdLibExtras.h"
+#include "kmalloc.h"
 #include "kstdio.h"
 
 //#define HASHTABLE_DEBUG
@@ -12,34 +12,48 @@ namespace AK {
 
 template<typename T, typename = Traits<T>> class HashTable;
 
+// Open addressing with linear probing, kept in Robin Hood order: a value that's further from where its hash
+// says it goes takes the slot of one that's closer, so lookups can stop as soon as they're further along
+// than what they find. Removal shifts the values after it back one slot instead of leaving tombstones.
+// Every slot keeps its value's hash, so probing compares hashes before values and growing never rehashes.
+// NOTE: Adding or removing anything can move other values around, so don't hold on to references across it.
 template<typename T, typename TraitsForT>
 class HashTable {
 private:
-    struct Bucket {
-        DoublyLinkedList<T> chain;
+    struct Slot {
+        // With the top bit always set while the slot is in use, and zero when it's empty.
+        unsigned hash;
+        alignas(T) byte storage[sizeof(T)];
+
+        bool is_used() const { return hash; }
+        T& value() { return *reinterpret_cast<T*>(storage); }
+        const T& value() const { return *reinterpret_cast<const T*>(storage); }
     };
 
+    static constexpr unsigned used_bit = 0x80000000;
+    static constexpr unsigned minimum_capacity = 8;
+
 public:
     HashTable() { }
     explicit HashTable(HashTable&& other)
-        : m_buckets(other.m_buckets)
+        : m_slots(other.m_slots)
         , m_size(other.m_size)
         , m_capacity(other.m_capacity)
     {
         other.m_size = 0;
         other.m_capacity = 0;
-        other.m_buckets = nullptr;
+        other.m_slots = nullptr;
     }
     HashTable& operator=(HashTable&& other)
     {
         if (this != &other) {
             clear();
-            m_buckets = other.m_buckets;
+            m_slots = other.m_slots;
             m_size = other.m_size;
             m_capacity = other.m_capacity;
             other.m_size = 0;
             other.m_capacity = 0;
-            other.m_buckets = nullptr;
+            other.m_slots = nullptr;
         }
         return *this;
     }
@@ -53,164 +67,80 @@ public:
     void set(T&&);
     bool contains(const T&) const;
     void clear();
+    // Makes room for |size| values in all, so that getting there doesn't grow the table again and again.
+    void reserve(unsigned size);
 
     void dump() const;
 
     class Iterator {
     public:
-        bool operator!=(const Iterator& other) const
-        {
-            if (m_is_end && other.m_is_end)
-                return false;
-            return &m_table != &other.m_table
-                || m_is_end != other.m_is_end
-                || m_bucket_index != other.m_bucket_index
-                || m_bucket_iterator != other.m_bucket_iterator;
-        }
+        bool operator!=(const Iterator& other) const { return m_table != other.m_table || m_index != other.m_index; }
         bool operator==(const Iterator& other) const { return !(*this != other); }
-        T& operator*()
-        {
-#ifdef HASHTABLE_DEBUG
-            kprintf("retrieve { bucket_index: %u, is_end: %u }\n", m_bucket_index, m_is_end);
-#endif
-            return *m_bucket_iterator;
-        }
-        T* operator->() { return m_bucket_iterator.operator->(); }
+        T& operator*() { return m_table->m_slots[m_index].value(); }
+        T* operator->() { return &m_table->m_slots[m_index].value(); }
         Iterator& operator++()
         {
-            skip_to_next();
+            ++m_index;
+            skip_to_used();
             return *this;
         }
 
-        void skip_to_next()
-        {
-#ifdef HASHTABLE_DEBUG
-            unsigned pass = 0;
-#endif
-            while (!m_is_end) {
-#ifdef HASHTABLE_DEBUG
-                ++pass;
-                kprintf("skip_to_next pass %u, m_bucket_index=%u\n", pass, m_bucket_index);
-#endif
-                if (m_bucket_iterator.is_end()) {
-                    ++m_bucket_index;
-                    if (m_bucket_index >= m_table.capacity()) {
-                        m_is_end = true;
-                        return;
-                    }
-                    m_bucket_iterator = m_table.m_buckets[m_bucket_index].chain.begin();
-                } else {
-                    ++m_bucket_iterator;
-                }
-                if (!m_bucket_iterator.is_end())
-                    return;
-            }
-        }
     private:
         friend class HashTable;
-        explicit Iterator(HashTable& table, bool is_end, typename DoublyLinkedList<T>::Iterator bucket_iterator = DoublyLinkedList<T>::Iterator::universal_end(), unsigned bucket_index = 0)
-            : m_table(table)
-            , m_bucket_index(bucket_index)
-            , m_is_end(is_end)
-            , m_bucket_iterator(bucket_iterator)
+        Iterator(HashTable& table, unsigned index)
+            : m_table(&table)
+            , m_index(index)
         {
-            if (!is_end && !m_table.is_empty() && !(m_bucket_iterator != DoublyLinkedList<T>::Iterator::universal_end())) {
-#ifdef HASHTABLE_DEBUG
-                kprintf("bucket iterator init!\n");
-#endif
-                m_bucket_iterator = m_table.m_buckets[0].chain.begin();
-                if (m_bucket_iterator.is_end())
-                    skip_to_next();
-            }
+            skip_to_used();
         }
 
-        HashTable& m_table;
-        unsigned m_bucket_index { 0 };
-        bool m_is_end { false };
-        typename DoublyLinkedList<T>::Iterator m_bucket_iterator;
+        void skip_to_used()
+        {
+            while (m_index < m_table->m_capacity && !m_table->m_slots[m_index].is_used())
+                ++m_index;
+        }
+
+        HashTable* m_table { nullptr };
+        unsigned m_index { 0 };
     };
 
-    Iterator begin() { return Iterator(*this, is_empty()); }
-    Iterator end() { return Iterator(*this, true); }
+    Iterator begin() { return Iterator(*this, 0); }
+    Iterator end() { return Iterator(*this, m_capacity); }
 
     class ConstIterator {
     public:
-        bool operator!=(const ConstIterator& other) const
-        {
-            if (m_is_end && other.m_is_end)
-                return false;
-            return &m_table != &other.m_table
-                || m_is_end != other.m_is_end
-                || m_bucket_index != other.m_bucket_index
-                || m_bucket_iterator != other.m_bucket_iterator;
-        }
+        bool operator!=(const ConstIterator& other) const { return m_table != other.m_table || m_index != other.m_index; }
         bool operator==(const ConstIterator& other) const { return !(*this != other); }
-        const T& operator*() const
-        {
-#ifdef HASHTABLE_DEBUG
-            kprintf("retrieve { bucket_index: %u, is_end: %u }\n", m_bucket_index, m_is_end);
-#endif
-            return *m_bucket_iterator;
-        }
-        const T* operator->() const { return m_bucket_iterator.operator->(); }
+        const T& operator*() const { return m_table->m_slots[m_index].value(); }
+        const T* operator->() const { return &m_table->m_slots[m_index].value(); }
         ConstIterator& operator++()
         {
-            skip_to_next();
+            ++m_index;
+            skip_to_used();
             return *this;
         }
 
-        void skip_to_next()
-        {
-#ifdef HASHTABLE_DEBUG
-            unsigned pass = 0;
-#endif
-            while (!m_is_end) {
-#ifdef HASHTABLE_DEBUG
-                ++pass;
-                kprintf("skip_to_next pass %u, m_bucket_index=%u\n", pass, m_bucket_index);
-#endif
-                if (m_bucket_iterator.is_end()) {
-                    ++m_bucket_index;
-                    if (m_bucket_index >= m_table.capacity()) {
-                        m_is_end = true;
-                        return;
-                    }
-                    const DoublyLinkedList<T>& chain = m_table.m_buckets[m_bucket_index].chain;
-                    m_bucket_iterator = chain.begin();
-                } else {
-                    ++m_bucket_iterator;
-                }
-                if (!m_bucket_iterator.is_end())
-                    return;
-            }
-        }
     private:
         friend class HashTable;
-        ConstIterator(const HashTable& table, bool is_end, typename DoublyLinkedList<T>::ConstIterator bucket_iterator = DoublyLinkedList<T>::ConstIterator::universal_end(), unsigned bucket_index = 0)
-            : m_table(table)
-            , m_bucket_index(bucket_index)
-            , m_is_end(is_end)
-            , m_bucket_iterator(bucket_iterator)
+        ConstIterator(const HashTable& table, unsigned index)
+            : m_table(&table)
+            , m_index(index)
         {
-            if (!is_end && !m_table.is_empty() && !(m_bucket_iterator != DoublyLinkedList<T>::ConstIterator::universal_end())) {
-#ifdef HASHTABLE_DEBUG
-                kprintf("const bucket iterator init!\n");
-#endif
-                const DoublyLinkedList<T>& chain = m_table.m_buckets[0].chain;
-                m_bucket_iterator = chain.begin();
-                if (m_bucket_iterator.is_end())
-                    skip_to_next();
-            }
+            skip_to_used();
+        }
+
+        void skip_to_used()
+        {
+            while (m_index < m_table->m_capacity && !m_table->m_slots[m_index].is_used())
+                ++m_index;
         }
 
-        const HashTable& m_table;
-        unsigned m_bucket_index { 0 };
-        bool m_is_end { false };
-        typename DoublyLinkedList<T>::ConstIterator m_bucket_iterator;
+        const HashTable* m_table { nullptr };
+        unsigned m_index { 0 };
     };
 
-    ConstIterator begin() const { return ConstIterator(*this, is_empty()); }
-    ConstIterator end() const { return ConstIterator(*this, true); }
+    ConstIterator begin() const { return ConstIterator(*this, 0); }
+    ConstIterator end() const { return ConstIterator(*this, m_capacity); }
 
     Iterator find(const T&);
     ConstIterator find(const T&) const;
@@ -225,122 +155,156 @@ public:
     void remove(Iterator);
 
 private:
-    Bucket& lookup(const T&, unsigned* bucket_index = nullptr);
-    const Bucket& lookup(const T&, unsigned* bucket_index = nullptr) const;
+    static unsigned slot_hash(const T& value) { return TraitsForT::hash(value) | used_bit; }
+    unsigned mask() const { return m_capacity - 1; }
+    // How far the value in slot |index| is from the slot its hash says it goes in.
+    unsigned probe_distance(unsigned hash, unsigned index) const { return (index - hash) & mask(); }
+
+    // Returns the index of the slot |value| is in, or m_capacity if it isn't.
+    unsigned lookup(const T&, unsigned hash) const;
+    void insert(unsigned hash, T&&);
     void rehash(unsigned capacity);
-    void insert(const T&);
-    void insert(T&&);
-
-    Bucket* m_buckets { nullptr };
+    void grow_if_full();
 
+    Slot* m_slots { nullptr };
     unsigned m_size { 0 };
     unsigned m_capacity { 0 };
 };
 
 template<typename T, typename TraitsForT>
-void HashTable<T, TraitsForT>::set(T&& value)
+unsigned HashTable<T, TraitsForT>::lookup(const T& value, unsigned hash) const
 {
     if (!m_capacity)
-        rehash(1);
-    auto& bucket = lookup(value);
-    for (auto& e : bucket.chain) {
-        if (e == value) {
-            e = move(value);
+        return m_capacity;
+    unsigned index = hash & mask();
+    for (unsigned distance = 0;; ++distance) {
+        auto& slot = m_slots[index];
+        // Anything that went here would have taken this slot.
+        if (!slot.is_used() || probe_distance(slot.hash, index) < distance)
+            return m_capacity;
+        if (slot.hash == hash && slot.value() == value)
+            return index;
+        index = (index + 1) & mask();
+    }
+}
+
+// Puts |value|, which isn't in the table already, where it goes. There has to be room for it.
+template<typename T, typename TraitsForT>
+void HashTable<T, TraitsForT>::insert(unsigned hash, T&& value)
+{
+    unsigned index = hash & mask();
+    unsigned distance = 0;
+    for (;;) {
+        auto& slot = m_slots[index];
+        if (!slot.is_used()) {
+            slot.hash = hash;
+            new (slot.storage) T(move(value));
             return;
         }
+        unsigned existing_distance = probe_distance(slot.hash, index);
+        if (existing_distance < distance) {
+            // Take from the rich: this one goes here, and the one that was here goes on looking.
+            swap(slot.hash, hash);
+            swap(slot.value(), value);
+            distance = existing_distance;
+        }
+        index = (index + 1) & mask();
+        ++distance;
     }
-    if (size() >= capacity()) {
-        rehash(size() + 1);
-        insert(move(value));
-    } else {
-        bucket.chain.append(move(value));
+}
+
+template<typename T, typename TraitsForT>
+void HashTable<T, TraitsForT>::grow_if_full()
+{
+    // Probes stay short as long as it's no more than three quarters full.
+    if ((m_size + 1) * 4 > m_capacity * 3)
+        rehash(max(m_capacity * 2, minimum_capacity));
+}
+
+template<typename T, typename TraitsForT>
+void HashTable<T, TraitsForT>::set(T&& value)
+{
+    unsigned hash = slot_hash(value);
+    unsigned index = lookup(value, hash);
+    if (index != m_capacity) {
+        m_slots[index].value() = move(value);
+        return;
     }
-    m_size++;
+    grow_if_full();
+    insert(hash, move(value));
+    ++m_size;
 }
 
 template<typename T, typename TraitsForT>
 void HashTable<T, TraitsForT>::set(const T& value)
 {
-    if (!m_capacity)
-        rehash(1);
-    auto& bucket = lookup(value);
-    for (auto& e : bucket.chain) {
-        if (e == value) {
-            e = move(value);
-            return;
-        }
+    unsigned hash = slot_hash(value);
+    unsigned index = lookup(value, hash);
+    if (index != m_capacity) {
+        m_slots[index].value() = value;
+        return;
     }
-    if (size() >= capacity()) {
-        rehash(size() + 1);
-        insert(value);
-    } else {
-        bucket.chain.append(value);
-    }
-    m_size++;
+    grow_if_full();
+    T copy(value);
+    insert(hash, move(copy));
+    ++m_size;
 }
 
+template<typename T, typename TraitsForT>
+void HashTable<T, TraitsForT>::reserve(unsigned size)
+{
+    unsigned capacity = max(m_capacity, minimum_capacity);
+    while (size * 4 > capacity * 3)
+        capacity *= 2;
+    if (capacity != m_capacity)
+        rehash(capacity);
+}
 
 template<typename T, typename TraitsForT>
 void HashTable<T, TraitsForT>::rehash(unsigned new_capacity)
 {
-    new_capacity *= 2;
 #ifdef HASHTABLE_DEBUG
-    kprintf("rehash to %u buckets\n", new_capacity);
+    kprintf("rehash to %u slots\n", new_capacity);
 #endif
-    auto* new_buckets = new Bucket[new_capacity];
-    auto* old_buckets = m_buckets;
+    auto* old_slots = m_slots;
     unsigned old_capacity = m_capacity;
-    m_buckets = new_buckets;
+    m_slots = (Slot*)kmalloc(sizeof(Slot) * new_capacity);
     m_capacity = new_capacity;
+    for (unsigned i = 0; i < new_capacity; ++i)
+        m_slots[i].hash = 0;
 
-#ifdef HASHTABLE_DEBUG
-    kprintf("reinsert %u buckets\n", old_capacity);
-#endif
     for (unsigned i = 0; i < old_capacity; ++i) {
-        for (auto& value : old_buckets[i].chain) {
-            insert(move(value));
-        }
+        auto& slot = old_slots[i];
+        if (!slot.is_used())
+            continue;
+        insert(slot.hash, move(slot.value()));
+        slot.value().~T();
     }
-
-    delete [] old_buckets;
+    if (old_slots)
+        kfree(old_slots);
 }
 
 template<typename T, typename TraitsForT>
 void HashTable<T, TraitsForT>::clear()
 {
-    if (m_buckets) {
-        delete [] m_buckets;
-        m_buckets = nullptr;
+    if (m_slots) {
+        for (unsigned i = 0; i < m_capacity; ++i) {
+            if (m_slots[i].is_used())
+                m_slots[i].value().~T();
+        }
+        kfree(m_slots);
+        m_slots = nullptr;
     }
     m_capacity = 0;
     m_size = 0;
 }
 
-template<typename T, typename TraitsForT>
-void HashTable<T, TraitsForT>::insert(T&& value)
-{
-    auto& bucket = lookup(value);
-    bucket.chain.append(move(value));
-}
-
-template<typename T, typename TraitsForT>
-void HashTable<T, TraitsForT>::insert(const T& value)
-{
-    auto& bucket = lookup(value);
-    bucket.chain.append(value);
-}
-
 template<typename T, typename TraitsForT>
 bool HashTable<T, TraitsForT>::contains(const T& value) const
 {
     if (is_empty())
         return false;
-    auto& bucket = lookup(value);
-    for (auto& e : bucket.chain) {
-        if (e == value)
-            return true;
-    }
-    return false;
+    return lookup(value, slot_hash(value)) != m_capacity;
 }
 
 template<typename T, typename TraitsForT>
@@ -348,12 +312,7 @@ auto HashTable<T, TraitsForT>::find(const T& value) -> Iterator
 {
     if (is_empty())
         return end();
-    unsigned bucket_index;
-    auto& bucket = lookup(value, &bucket_index);
-    auto bucket_iterator = bucket.chain.find(value);
-    if (bucket_iterator != bucket.chain.end())
-        return Iterator(*this, false, bucket_iterator, bucket_index);
-    return end();
+    return Iterator(*this, lookup(value, slot_hash(value)));
 }
 
 template<typename T, typename TraitsForT>
@@ -361,66 +320,47 @@ auto HashTable<T, TraitsForT>::find(const T& value) const -> ConstIterator
 {
     if (is_empty())
         return end();
-    unsigned bucket_index;
-    auto& bucket = lookup(value, &bucket_index);
-    auto bucket_iterator = bucket.chain.find(value);
-    if (bucket_iterator != bucket.chain.end())
-        return ConstIterator(*this, false, bucket_iterator, bucket_index);
-    return end();
+    return ConstIterator(*this, lookup(value, slot_hash(value)));
 }
 
 template<typename T, typename TraitsForT>
 void HashTable<T, TraitsForT>::remove(Iterator it)
 {
     ASSERT(!is_empty());
-    m_buckets[it.m_bucket_index].chain.remove(it.m_bucket_iterator);
+    ASSERT(it.m_table == this && it.m_index < m_capacity && m_slots[it.m_index].is_used());
+    unsigned index = it.m_index;
+    m_slots[index].value().~T();
+    m_slots[index].hash = 0;
+    // Everything after it that isn't where it'd rather be moves one closer.
+    for (;;) {
+        unsigned next_index = (index + 1) & mask();
+        auto& next = m_slots[next_index];
+        if (!next.is_used() || !probe_distance(next.hash, next_index))
+            break;
+        auto& slot = m_slots[index];
+        slot.hash = next.hash;
+        new (slot.storage) T(move(next.value()));
+        next.value().~T();
+        next.hash = 0;
+        index = next_index;
+    }
     --m_size;
 }
 
-template<typename T, typename TraitsForT>
-typename HashTable<T, TraitsForT>::Bucket& HashTable<T, TraitsForT>::lookup(const T& value, unsigned* bucket_index)
-{
-    unsigned hash = TraitsForT::hash(value);
-#ifdef HASHTABLE_DEBUG
-    kprintf("hash for ");
-    TraitsForT::dump(value);
-    kprintf(" is %u\n", hash);
-#endif
-    if (bucket_index)
-        *bucket_index = hash % m_capacity;
-    return m_buckets[hash % m_capacity];
-}
-
-template<typename T, typename TraitsForT>
-const typename HashTable<T, TraitsForT>::Bucket& HashTable<T, TraitsForT>::lookup(const T& value, unsigned* bucket_index) const
-{
-    unsigned hash = TraitsForT::hash(value);
-#ifdef HASHTABLE_DEBUG
-    kprintf("hash for ");
-    TraitsForT::dump(value);
-    kprintf(" is %u\n", hash);
-#endif
-    if (bucket_index)
-        *bucket_index = hash % m_capacity;
-    return m_buckets[hash % m_capacity];
-}
-
 template<typename T, typename TraitsForT>
 void HashTable<T, TraitsForT>::dump() const
 {
-    kprintf("HashTable{%p} m_size=%u, m_capacity=%u, m_buckets=%p\n", this, m_size, m_capacity, m_buckets);
+    kprintf("HashTable{%p} m_size=%u, m_capacity=%u, m_slots=%p\n", this, m_size, m_capacity, m_slots);
     for (unsigned i = 0; i < m_capacity; ++i) {
-        auto& bucket = m_buckets[i];
-        kprintf("Bucket %u\n", i);
-        for (auto& e : bucket.chain) {
-            kprintf("  > ");
-            TraitsForT::dump(e);
-            kprintf("\n");
-        }
+        auto& slot = m_slots[i];
+        if (!slot.is_used())
+            continue;
+        kprintf("Slot %u (%u away)\n  > ", i, probe_distance(slot.hash, i));
+        TraitsForT::dump(slot.value());
+        kprintf("\n");
     }
 }
 
 }
 
 using AK::HashTable;
-
@@ -16,6 +16,7 @@ public:
 
     size_t size() const { return m_map.size(); }
     size_t capacity() const { return m_capacity; }
+    size_t eviction_count() const { return m_eviction_count; }
 
     void set_capacity(size_t capacity)
     {
@@ -50,6 +51,47 @@ public:
             remove_last();
     }
 
+    void remove(const K& key)
+    {
+        auto it = m_map.find(key);
+        if (it == m_map.end())
+            return;
+        V* entry = (*it).value;
+        m_entries.remove(entry);
+        m_map.remove(key);
+        delete entry;
+    }
+
+    template<typename Callback>
+    void remove_all_matching(Callback callback)
+    {
+        for (V* entry = m_entries.head(); entry;) {
+            V* next = entry->next();
+            if (callback(*entry)) {
+                m_entries.remove(entry);
+                m_map.remove(entry->m_key);
+                delete entry;
+            }
+            entry = next;
+        }
+    }
+
+    // Throws out up to count of the least recently used entries. Returns how many went.
+    size_t shrink(size_t count)
+    {
+        size_t removed = 0;
+        while (removed < count && size()) {
+            remove_last();
+            ++removed;
+        }
+        return removed;
+    }
+
+    void clear()
+    {
+        remove_all_matching([] (auto&) { return true; });
+    }
+
 private:
     void remove_last()
     {
@@ -58,11 +100,13 @@ private:
         m_entries.remove(entry);
         m_map.remove(entry->m_key);
         delete entry;
+        ++m_eviction_count;
     }
 
     InlineLinkedList<V> m_entries;
     HashMap<K, V*> m_map;
     size_t m_capacity { 16 };
+    size_t m_eviction_count { 0 };
 };
 
 }
@@ -0,0 +1,334 @@
+#pragma once
+
+#include "Assertions.h"
+#include "Types.h"
+
+namespace AK {
+
+template<typename K, typename T, K (T::*key_of)() const> class IntrusiveRedBlackTree;
+
+// What a T needs to be in an IntrusiveRedBlackTree: the links live in the T itself, so going in and out
+// of the tree never allocates. A T can be in one tree at a time.
+template<typename T> class RedBlackTreeNode {
+private:
+    template<typename K, typename U, K (U::*)() const> friend class IntrusiveRedBlackTree;
+
+    T* m_tree_parent { nullptr };
+    T* m_tree_left { nullptr };
+    T* m_tree_right { nullptr };
+    bool m_tree_is_red { false };
+};
+
+// A balanced search tree of T's, ordered by (t.*key_of)(). Equal keys are allowed, they go one after another.
+// Nothing is owned, the tree only links together what's put in it, and whoever put it there takes it out.
+template<typename K, typename T, K (T::*key_of)() const>
+class IntrusiveRedBlackTree {
+public:
+    IntrusiveRedBlackTree() { }
+    IntrusiveRedBlackTree(IntrusiveRedBlackTree&& other)
+        : m_root(other.m_root)
+        , m_size(other.m_size)
+    {
+        other.m_root = nullptr;
+        other.m_size = 0;
+    }
+    IntrusiveRedBlackTree& operator=(IntrusiveRedBlackTree&& other)
+    {
+        if (this != &other) {
+            m_root = other.m_root;
+            m_size = other.m_size;
+            other.m_root = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+    IntrusiveRedBlackTree(const IntrusiveRedBlackTree&) = delete;
+    IntrusiveRedBlackTree& operator=(const IntrusiveRedBlackTree&) = delete;
+
+    bool is_empty() const { return !m_root; }
+    int size() const { return m_size; }
+
+    // Forgets everything, without touching the nodes.
+    void clear()
+    {
+        m_root = nullptr;
+        m_size = 0;
+    }
+
+    void insert(T&);
+    void remove(T&);
+
+    T* find(const K&) const;
+    // The last one with a key no bigger than |key|, like the region an address might be in.
+    T* find_largest_not_above(const K& key) const;
+
+    // In key order.
+    T* first() const { return m_root ? leftmost(m_root) : nullptr; }
+    static T* next(T&);
+
+private:
+    typedef RedBlackTreeNode<T> Node;
+    static Node& node(T* t) { return *t; }
+    static K key(const T* t) { return (t->*key_of)(); }
+    static bool is_red(T* t) { return t && node(t).m_tree_is_red; }
+    static T* leftmost(T* t)
+    {
+        while (node(t).m_tree_left)
+            t = node(t).m_tree_left;
+        return t;
+    }
+
+    void rotate_left(T*);
+    void rotate_right(T*);
+    void replace_child(T* parent, T* old_child, T* new_child);
+    void fix_after_insert(T*);
+    void fix_after_remove(T* child, T* parent);
+
+    T* m_root { nullptr };
+    int m_size { 0 };
+};
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline void IntrusiveRedBlackTree<K, T, key_of>::replace_child(T* parent, T* old_child, T* new_child)
+{
+    if (!parent)
+        m_root = new_child;
+    else if (node(parent).m_tree_left == old_child)
+        node(parent).m_tree_left = new_child;
+    else
+        node(parent).m_tree_right = new_child;
+    if (new_child)
+        node(new_child).m_tree_parent = parent;
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline void IntrusiveRedBlackTree<K, T, key_of>::rotate_left(T* t)
+{
+    T* pivot = node(t).m_tree_right;
+    ASSERT(pivot);
+    replace_child(node(t).m_tree_parent, t, pivot);
+    node(t).m_tree_right = node(pivot).m_tree_left;
+    if (node(t).m_tree_right)
+        node(node(t).m_tree_right).m_tree_parent = t;
+    node(pivot).m_tree_left = t;
+    node(t).m_tree_parent = pivot;
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline void IntrusiveRedBlackTree<K, T, key_of>::rotate_right(T* t)
+{
+    T* pivot = node(t).m_tree_left;
+    ASSERT(pivot);
+    replace_child(node(t).m_tree_parent, t, pivot);
+    node(t).m_tree_left = node(pivot).m_tree_right;
+    if (node(t).m_tree_left)
+        node(node(t).m_tree_left).m_tree_parent = t;
+    node(pivot).m_tree_right = t;
+    node(t).m_tree_parent = pivot;
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline void IntrusiveRedBlackTree<K, T, key_of>::insert(T& value)
+{
+    T* t = &value;
+    T* parent = nullptr;
+    bool goes_left = false;
+    for (T* at = m_root; at;) {
+        parent = at;
+        goes_left = key(t) < key(at);
+        at = goes_left ? node(at).m_tree_left : node(at).m_tree_right;
+    }
+    node(t).m_tree_parent = parent;
+    node(t).m_tree_left = nullptr;
+    node(t).m_tree_right = nullptr;
+    node(t).m_tree_is_red = true;
+    if (!parent)
+        m_root = t;
+    else if (goes_left)
+        node(parent).m_tree_left = t;
+    else
+        node(parent).m_tree_right = t;
+    ++m_size;
+    fix_after_insert(t);
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline void IntrusiveRedBlackTree<K, T, key_of>::fix_after_insert(T* t)
+{
+    while (is_red(node(t).m_tree_parent)) {
+        T* parent = node(t).m_tree_parent;
+        // A red parent is never the root, so there's a grandparent.
+        T* grandparent = node(parent).m_tree_parent;
+        bool parent_is_left = node(grandparent).m_tree_left == parent;
+        T* uncle = parent_is_left ? node(grandparent).m_tree_right : node(grandparent).m_tree_left;
+        if (is_red(uncle)) {
+            node(parent).m_tree_is_red = false;
+            node(uncle).m_tree_is_red = false;
+            node(grandparent).m_tree_is_red = true;
+            t = grandparent;
+            continue;
+        }
+        if (parent_is_left) {
+            if (t == node(parent).m_tree_right) {
+                rotate_left(parent);
+                t = parent;
+                parent = node(t).m_tree_parent;
+            }
+            rotate_right(grandparent);
+        } else {
+            if (t == node(parent).m_tree_left) {
+                rotate_right(parent);
+                t = parent;
+                parent = node(t).m_tree_parent;
+            }
+            rotate_left(grandparent);
+        }
+        node(parent).m_tree_is_red = false;
+        node(grandparent).m_tree_is_red = true;
+        break;
+    }
+    node(m_root).m_tree_is_red = false;
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline void IntrusiveRedBlackTree<K, T, key_of>::remove(T& value)
+{
+    T* t = &value;
+    ASSERT(m_size);
+    T* child;
+    T* child_parent;
+    bool removed_red;
+    if (!node(t).m_tree_left || !node(t).m_tree_right) {
+        child = node(t).m_tree_left ? node(t).m_tree_left : node(t).m_tree_right;
+        child_parent = node(t).m_tree_parent;
+        removed_red = node(t).m_tree_is_red;
+        replace_child(child_parent, t, child);
+    } else {
+        // Two children: the next one in order takes its place, and it's that one's old spot that goes away.
+        T* successor = leftmost(node(t).m_tree_right);
+        removed_red = node(successor).m_tree_is_red;
+        child = node(successor).m_tree_right;
+        if (node(successor).m_tree_parent == t) {
+            child_parent = successor;
+        } else {
+            child_parent = node(successor).m_tree_parent;
+            replace_child(child_parent, successor, child);
+            node(successor).m_tree_right = node(t).m_tree_right;
+            node(node(successor).m_tree_right).m_tree_parent = successor;
+        }
+        replace_child(node(t).m_tree_parent, t, successor);
+        node(successor).m_tree_left = node(t).m_tree_left;
+        node(node(successor).m_tree_left).m_tree_parent = successor;
+        node(successor).m_tree_is_red = node(t).m_tree_is_red;
+    }
+    node(t).m_tree_parent = nullptr;
+    node(t).m_tree_left = nullptr;
+    node(t).m_tree_right = nullptr;
+    --m_size;
+    if (!removed_red)
+        fix_after_remove(child, child_parent);
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline void IntrusiveRedBlackTree<K, T, key_of>::fix_after_remove(T* t, T* parent)
+{
+    // |t| is one black short, and may be null with only |parent| to say where it is.
+    while (t != m_root && !is_red(t)) {
+        if (t == node(parent).m_tree_left) {
+            T* sibling = node(parent).m_tree_right;
+            if (is_red(sibling)) {
+                node(sibling).m_tree_is_red = false;
+                node(parent).m_tree_is_red = true;
+                rotate_left(parent);
+                sibling = node(parent).m_tree_right;
+            }
+            if (!is_red(node(sibling).m_tree_left) && !is_red(node(sibling).m_tree_right)) {
+                node(sibling).m_tree_is_red = true;
+                t = parent;
+                parent = node(t).m_tree_parent;
+                continue;
+            }
+            if (!is_red(node(sibling).m_tree_right)) {
+                node(node(sibling).m_tree_left).m_tree_is_red = false;
+                node(sibling).m_tree_is_red = true;
+                rotate_right(sibling);
+                sibling = node(parent).m_tree_right;
+            }
+            node(sibling).m_tree_is_red = node(parent).m_tree_is_red;
+            node(parent).m_tree_is_red = false;
+            node(node(sibling).m_tree_right).m_tree_is_red = false;
+            rotate_left(parent);
+        } else {
+            T* sibling = node(parent).m_tree_left;
+            if (is_red(sibling)) {
+                node(sibling).m_tree_is_red = false;
+                node(parent).m_tree_is_red = true;
+                rotate_right(parent);
+                sibling = node(parent).m_tree_left;
+            }
+            if (!is_red(node(sibling).m_tree_left) && !is_red(node(sibling).m_tree_right)) {
+                node(sibling).m_tree_is_red = true;
+                t = parent;
+                parent = node(t).m_tree_parent;
+                continue;
+            }
+            if (!is_red(node(sibling).m_tree_left)) {
+                node(node(sibling).m_tree_right).m_tree_is_red = false;
+                node(sibling).m_tree_is_red = true;
+                rotate_left(sibling);
+                sibling = node(parent).m_tree_left;
+            }
+            node(sibling).m_tree_is_red = node(parent).m_tree_is_red;
+            node(parent).m_tree_is_red = false;
+            node(node(sibling).m_tree_left).m_tree_is_red = false;
+            rotate_right(parent);
+        }
+        t = m_root;
+        break;
+    }
+    if (t)
+        node(t).m_tree_is_red = false;
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline T* IntrusiveRedBlackTree<K, T, key_of>::find(const K& k) const
+{
+    T* found = find_largest_not_above(k);
+    if (found && key(found) == k)
+        return found;
+    return nullptr;
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline T* IntrusiveRedBlackTree<K, T, key_of>::find_largest_not_above(const K& k) const
+{
+    T* best = nullptr;
+    for (T* at = m_root; at;) {
+        if (k < key(at)) {
+            at = node(at).m_tree_left;
+        } else {
+            best = at;
+            at = node(at).m_tree_right;
+        }
+    }
+    return best;
+}
+
+template<typename K, typename T, K (T::*key_of)() const>
+inline T* IntrusiveRedBlackTree<K, T, key_of>::next(T& value)
+{
+    T* t = &value;
+    if (node(t).m_tree_right)
+        return leftmost(node(t).m_tree_right);
+    T* parent = node(t).m_tree_parent;
+    while (parent && t == node(parent).m_tree_right) {
+        t = parent;
+        parent = node(t).m_tree_parent;
+    }
+    return parent;
+}
+
+}
+
+using AK::IntrusiveRedBlackTree;
+using AK::RedBlackTreeNode;
@@ -1,48 +1,132 @@
 #include "MappedFile.h"
+#include "StdLibExtras.h"
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <cstdio>
+#include <unistd.h>
+#include <stdio.h>
+
+//#define DEBUG_MAPPED_FILE
 
 namespace AK {
 
-MappedFile::MappedFile(String&& file_name)
-    : m_file_name(std::move(file_name))
+MappedFile::MappedFile(const String& file_name, AccessPattern access_pattern, Populate populate)
+    : m_file_name(file_name)
+    , m_access_pattern(access_pattern)
+    , m_populate(populate == Populate::Yes)
 {
-    m_file_length = 1024;
-    m_fd = open(m_file_name.characters(), O_RDONLY);
-    
-    if (m_fd != -1) {
-        struct stat st;
-        fstat(m_fd, &st);
-        m_file_length = st.st_size;
-        m_map = mmap(nullptr, m_file_length, PROT_READ, MAP_SHARED, m_fd, 0);
-
-        if (m_map == MAP_FAILED)
-            perror("");
+    int fd = open(m_file_name.characters(), O_RDONLY);
+    if (fd < 0) {
+#ifdef DEBUG_MAPPED_FILE
+        perror("open");
+#endif
+        return;
     }
 
-    printf("MappedFile{%s} := { m_fd=%d, m_file_length=%zu, m_map=%p }\n", m_file_name.characters(), m_fd, m_file_length, m_map);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !st.st_size) {
+        close(fd);
+        return;
+    }
+    m_file_length = st.st_size;
+    if (m_file_length > max_window_size) {
+        m_fd = fd;
+        map_window(0);
+        return;
+    }
+    map(fd, 0, m_file_length);
+    // The mapping keeps the file around by itself.
+    close(fd);
+}
+
+bool MappedFile::map(int fd, size_t offset, size_t length)
+{
+    ASSERT(!is_valid());
+    m_map = mmap(nullptr, length, PROT_READ, MAP_SHARED | (m_populate ? MAP_POPULATE : 0), fd, offset);
+    if (m_map == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    m_window_offset = offset;
+    m_window_length = length;
+    if (m_access_pattern != AccessPattern::Normal)
+        madvise(m_map, length, m_access_pattern == AccessPattern::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+#ifdef DEBUG_MAPPED_FILE
+    dbgprintf("MappedFile{%s} := { m_file_length=%u, window=%u+%u, m_map=%p }\n", m_file_name.characters(), m_file_length, m_window_offset, m_window_length, m_map);
+#endif
+    return true;
+}
+
+bool MappedFile::map_window(size_t offset)
+{
+    if (!is_windowed())
+        return offset == 0 && is_valid();
+    if (offset >= m_file_length)
+        return false;
+    // mmap() wants a page aligned offset.
+    offset &= ~(size_t)4095;
+    if (is_valid() && offset == m_window_offset)
+        return true;
+    if (is_valid()) {
+        int rc = munmap(m_map, m_window_length);
+        ASSERT(rc == 0);
+        m_map = (void*)-1;
+    }
+    return map(m_fd, offset, min(max_window_size, m_file_length - offset));
 }
 
 MappedFile::~MappedFile()
 {
-    if (m_map != (void*)-1) {
-        ASSERT(m_fd != -1);
-        munmap(m_map, m_file_length);
+    unmap();
+}
+
+void MappedFile::unmap()
+{
+    if (is_valid()) {
+        int rc = munmap(m_map, m_window_length);
+        ASSERT(rc == 0);
     }
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+    m_file_length = 0;
+    m_window_offset = 0;
+    m_window_length = 0;
+    m_map = (void*)-1;
 }
 
 MappedFile::MappedFile(MappedFile&& other)
-    : m_file_name(std::move(other.m_file_name))
+    : m_file_name(move(other.m_file_name))
     , m_file_length(other.m_file_length)
+    , m_access_pattern(other.m_access_pattern)
+    , m_populate(other.m_populate)
     , m_fd(other.m_fd)
+    , m_window_offset(other.m_window_offset)
+    , m_window_length(other.m_window_length)
     , m_map(other.m_map)
 {
     other.m_file_length = 0;
     other.m_fd = -1;
+    other.m_window_offset = 0;
+    other.m_window_length = 0;
     other.m_map = (void*)-1;
 }
 
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+    if (this == &other)
+        return *this;
+    unmap();
+    swap(m_file_name, other.m_file_name);
+    swap(m_file_length, other.m_file_length);
+    swap(m_access_pattern, other.m_access_pattern);
+    swap(m_populate, other.m_populate);
+    swap(m_fd, other.m_fd);
+    swap(m_window_offset, other.m_window_offset);
+    swap(m_window_length, other.m_window_length);
+    swap(m_map, other.m_map);
+    return *this;
 }
 
+}
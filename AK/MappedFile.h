@@ -4,27 +4,53 @@
 
 namespace AK {
 
+// A whole file mapped read-only and shared, so every process mapping it uses the same pages.
+// Files bigger than max_window_size only get a window of them mapped at a time, see map_window().
 class MappedFile {
 public:
+    // Passed on to the kernel with madvise(), it decides how much each page fault reads in around itself.
+    enum class AccessPattern { Normal, Sequential, Random };
+    // Prefault everything when mapping, instead of a fault at a time as it's touched.
+    enum class Populate { No, Yes };
+
+    static constexpr size_t max_window_size = 64 * MB;
+
     MappedFile() { }
-    explicit MappedFile(String&& file_name);
+    explicit MappedFile(const String& file_name, AccessPattern = AccessPattern::Normal, Populate = Populate::No);
     MappedFile(MappedFile&&);
+    MappedFile& operator=(MappedFile&&);
     ~MappedFile();
 
     bool is_valid() const { return m_map != (void*)-1; }
 
+    // These are about the window, which is all of the file unless it's windowed.
     void* pointer() { return m_map; }
     const void* pointer() const { return m_map; }
+    size_t window_offset() const { return m_window_offset; }
+    size_t window_length() const { return m_window_length; }
+
     size_t file_length() const { return m_file_length; }
+    bool is_windowed() const { return m_fd >= 0; }
+
+    // Maps the window starting at offset, or the page it's in. Returns false if that didn't work, and then
+    // nothing is mapped.
+    bool map_window(size_t offset);
 
 private:
+    void unmap();
+    bool map(int fd, size_t offset, size_t length);
+
     String m_file_name;
     size_t m_file_length { 0 };
+    AccessPattern m_access_pattern { AccessPattern::Normal };
+    bool m_populate { false };
+    // Kept open only for windowed files, to map other windows from.
     int m_fd { -1 };
+    size_t m_window_offset { 0 };
+    size_t m_window_length { 0 };
     void* m_map { (void*)-1 };
 };
 
 }
 
 using AK::MappedFile;
-
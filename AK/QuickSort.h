@@ -1,33 +1,129 @@
 #pragma once
 
+#include <AK/StdLibExtras.h>
+
 namespace AK {
 
-template<typename IteratorType, typename LessThan>
-IteratorType partition(IteratorType first, IteratorType last, LessThan less_than)
-{
-    auto pivot = last;
-    auto smallest = first - 1;
-    auto it = first;
-    for (; it < last; ++it) {
-        if (less_than(*it, *pivot)) {
-            ++smallest;
-            swap(*it, *smallest);
-        }
+// An introsort over positions [first, last): quicksort with a median-of-three pivot, heap sort once
+// partitioning has gone on for too long, which is what bad pivots look like, and insertion sort for the
+// small ranges left at the end. |less_than(a, b)| compares the elements at positions |a| and |b|, and
+// |swap_elements(a, b)| swaps them, so this works for anything that can be indexed.
+static const int intro_sort_insertion_threshold = 16;
+
+template<typename LessThan, typename SwapElements>
+void intro_sort_insertion(int first, int last, LessThan& less_than, SwapElements& swap_elements)
+{
+    for (int i = first + 1; i < last; ++i) {
+        for (int j = i; j > first && less_than(j, j - 1); --j)
+            swap_elements(j, j - 1);
     }
-    swap(*(smallest + 1), *last);
-    return smallest + 1;
 }
 
-template<typename IteratorType, typename LessThan>
-void quick_sort_impl(IteratorType begin, IteratorType first, IteratorType last, LessThan less_than)
+template<typename LessThan, typename SwapElements>
+void intro_sort_sift_down(int first, int root, int count, LessThan& less_than, SwapElements& swap_elements)
 {
-    if (first < last) {
-        auto pivot = partition(first, last, less_than);
-        quick_sort_impl(begin, first, pivot - 1, less_than);
-        quick_sort_impl(begin, pivot + 1, last, less_than);
+    for (;;) {
+        int child = 2 * root + 1;
+        if (child >= count)
+            return;
+        if (child + 1 < count && less_than(first + child, first + child + 1))
+            ++child;
+        if (!less_than(first + root, first + child))
+            return;
+        swap_elements(first + root, first + child);
+        root = child;
     }
 }
 
+template<typename LessThan, typename SwapElements>
+void intro_sort_heap(int first, int last, LessThan& less_than, SwapElements& swap_elements)
+{
+    int count = last - first;
+    for (int root = count / 2 - 1; root >= 0; --root)
+        intro_sort_sift_down(first, root, count, less_than, swap_elements);
+    for (int end = count - 1; end > 0; --end) {
+        swap_elements(first, first + end);
+        intro_sort_sift_down(first, 0, end, less_than, swap_elements);
+    }
+}
+
+// Puts the median of |a|, |b| and |c| at |first|.
+template<typename LessThan, typename SwapElements>
+void intro_sort_move_median_to_first(int first, int a, int b, int c, LessThan& less_than, SwapElements& swap_elements)
+{
+    if (less_than(a, b)) {
+        if (less_than(b, c))
+            swap_elements(first, b);
+        else if (less_than(a, c))
+            swap_elements(first, c);
+        else
+            swap_elements(first, a);
+    } else if (less_than(a, c)) {
+        swap_elements(first, a);
+    } else if (less_than(b, c)) {
+        swap_elements(first, c);
+    } else {
+        swap_elements(first, b);
+    }
+}
+
+// Partitions [first + 1, last) around the pivot at |first|, which stays put. Both scans stop at an element
+// equal to the pivot, so runs of equal keys split down the middle instead of all to one side.
+template<typename LessThan, typename SwapElements>
+int intro_sort_partition(int first, int last, LessThan& less_than, SwapElements& swap_elements)
+{
+    int pivot = first;
+    int low = first + 1;
+    int high = last;
+    for (;;) {
+        // The median of three leaves something on either side to stop these.
+        while (less_than(low, pivot))
+            ++low;
+        --high;
+        while (less_than(pivot, high))
+            --high;
+        if (low >= high)
+            return low;
+        swap_elements(low, high);
+        ++low;
+    }
+}
+
+template<typename LessThan, typename SwapElements>
+void intro_sort_loop(int first, int last, int depth_limit, LessThan& less_than, SwapElements& swap_elements)
+{
+    while (last - first > intro_sort_insertion_threshold) {
+        if (!depth_limit) {
+            intro_sort_heap(first, last, less_than, swap_elements);
+            return;
+        }
+        --depth_limit;
+        int middle = first + (last - first) / 2;
+        intro_sort_move_median_to_first(first, first + 1, middle, last - 1, less_than, swap_elements);
+        int cut = intro_sort_partition(first, last, less_than, swap_elements);
+        // Recursing only into the smaller side keeps the stack to log(n) deep.
+        if (cut - first < last - cut) {
+            intro_sort_loop(first, cut, depth_limit, less_than, swap_elements);
+            first = cut;
+        } else {
+            intro_sort_loop(cut, last, depth_limit, less_than, swap_elements);
+            last = cut;
+        }
+    }
+    intro_sort_insertion(first, last, less_than, swap_elements);
+}
+
+template<typename LessThan, typename SwapElements>
+void intro_sort(int first, int last, LessThan less_than, SwapElements swap_elements)
+{
+    if (last - first < 2)
+        return;
+    int depth_limit = 0;
+    for (int count = last - first; count > 1; count >>= 1)
+        depth_limit += 2;
+    intro_sort_loop(first, last, depth_limit, less_than, swap_elements);
+}
+
 template<typename T>
 bool is_less_than(const T& a, const T& b)
 {
@@ -37,11 +133,12 @@ bool is_less_than(const T& a, const T& b)
 template<typename IteratorType, typename LessThan>
 void quick_sort(IteratorType begin, IteratorType end, LessThan less_than = is_less_than)
 {
-    if (begin == end)
-        return;
-    quick_sort_impl(begin, begin, end - 1, less_than);
+    intro_sort(0, end - begin,
+        [&] (int a, int b) { return less_than(*(begin + a), *(begin + b)); },
+        [&] (int a, int b) { swap(*(begin + a), *(begin + b)); });
 }
 
 }
 
+using AK::intro_sort;
 using AK::quick_sort;
@@ -29,51 +29,81 @@ constexpr auto call_one_retain_left_if_present(...) -> FalseType
     return { };
 }
 
+// Retain counts are atomic by default, since anything retained may be shared between threads (or CPUs).
+// Taking a retain needs no ordering, only dropping one does: everything done to the object before the last
+// release has to be seen by whoever ends up destroying it. Objects that never leave one thread can opt out.
+enum class RetainCountMode {
+    Atomic,
+    NonAtomic,
+};
+
+template<RetainCountMode mode>
 class RetainableBase {
 public:
     void retain()
     {
-        ASSERT(m_retain_count);
-        ++m_retain_count;
+        if constexpr (mode == RetainCountMode::Atomic) {
+            int old_retain_count = __atomic_fetch_add(&m_retain_count, 1, __ATOMIC_RELAXED);
+            ASSERT(old_retain_count);
+        } else {
+            ASSERT(m_retain_count);
+            ++m_retain_count;
+        }
     }
 
     int retain_count() const
     {
-        return m_retain_count;
+        if constexpr (mode == RetainCountMode::Atomic)
+            return __atomic_load_n(&m_retain_count, __ATOMIC_RELAXED);
+        else
+            return m_retain_count;
     }
 
 protected:
     RetainableBase() { }
     ~RetainableBase()
     {
-        ASSERT(!m_retain_count);
+        ASSERT(!retain_count());
     }
 
-    void release_base()
+    // Returns how many retains are left.
+    int release_base()
     {
-        ASSERT(m_retain_count);
-        --m_retain_count;
+        if constexpr (mode == RetainCountMode::Atomic) {
+            int new_retain_count = __atomic_sub_fetch(&m_retain_count, 1, __ATOMIC_ACQ_REL);
+            ASSERT(new_retain_count >= 0);
+            return new_retain_count;
+        } else {
+            ASSERT(m_retain_count);
+            return --m_retain_count;
+        }
     }
 
     int m_retain_count { 1 };
 };
 
-template<typename T>
-class Retainable : public RetainableBase {
+template<typename T, RetainCountMode mode = RetainCountMode::Atomic>
+class Retainable : public RetainableBase<mode> {
 public:
     void release()
     {
-        release_base();
-        if (m_retain_count == 0) {
+        int new_retain_count = this->release_base();
+        if (new_retain_count == 0) {
             call_will_be_destroyed_if_present(static_cast<T*>(this));
             delete static_cast<T*>(this);
-        } else if (m_retain_count == 1) {
+        } else if (new_retain_count == 1) {
             call_one_retain_left_if_present(static_cast<T*>(this));
         }
     }
 };
 
+// For objects that only ever live on one thread, and don't need to pay for atomics.
+template<typename T>
+using SingleThreadedRetainable = Retainable<T, RetainCountMode::NonAtomic>;
+
 }
 
 using AK::Retainable;
+using AK::RetainCountMode;
+using AK::SingleThreadedRetainable;
 
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Assertions.h"
+#include "Types.h"
+
+namespace AK {
+
+// A fixed ring for exactly one producer and one consumer, which never have to lock each other out:
+// the producer only moves the tail and the consumer only moves the head. Like an interrupt handler
+// feeding whoever reads a device, or one thread feeding another.
+// When it's full, what's being added is dropped, since only the consumer may touch what's queued.
+template<typename T, int Capacity>
+class SPSCQueue {
+    static_assert(Capacity > 0 && !(Capacity & (Capacity - 1)), "SPSCQueue capacity must be a power of two");
+public:
+    SPSCQueue() { }
+
+    int capacity() const { return Capacity; }
+
+    // Only exact from the producer or the consumer, anyone else may see it a little out of date.
+    int size() const { return __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE); }
+    bool is_empty() const { return !size(); }
+
+    // Producer only.
+    bool try_enqueue(const T& value)
+    {
+        unsigned tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+        if (tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) == (unsigned)Capacity)
+            return false;
+        m_elements[tail & (Capacity - 1)] = value;
+        // The element has to be there before the consumer can see it is.
+        __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Consumer only.
+    bool try_dequeue(T& value)
+    {
+        unsigned head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+        if (head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+            return false;
+        value = m_elements[head & (Capacity - 1)];
+        // And it has to be read out before the producer can see its slot is free.
+        __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    T m_elements[Capacity];
+    // Both keep counting up and wrap around, it's only their difference that matters.
+    unsigned m_head { 0 };
+    unsigned m_tail { 0 };
+};
+
+}
+
+using AK::SPSCQueue;
@@ -52,6 +52,204 @@ void* mmx_memcpy(void* dest, const void* src, size_t len)
     return dest;
 }
 
+bool g_cpu_has_sse2;
+bool g_cpu_has_sep;
+
+void detect_cpu_features()
+{
+    dword eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    g_cpu_has_sse2 = edx & (1 << 26);
+    // The first Pentium Pros say they have sysenter, but don't.
+    dword family = (eax >> 8) & 0xf;
+    dword model = (eax >> 4) & 0xf;
+    dword stepping = eax & 0xf;
+    g_cpu_has_sep = (edx & (1 << 11)) && !(family == 6 && model < 3 && stepping < 3);
+}
+
+struct [[gnu::aligned(16)]] SSEChunk {
+    byte bytes[16];
+};
+
+struct SSEUnalignedChunk {
+    byte bytes[16];
+};
+
+static const SSEChunk s_zero_chunk = { };
+
+static inline SSEChunk make_pattern(int c)
+{
+    SSEChunk pattern;
+    for (int i = 0; i < 16; ++i)
+        pattern.bytes[i] = c;
+    return pattern;
+}
+
+// Each bit says whether that byte of |chunk| is the same as in |pattern|.
+static inline dword sse2_equal_mask(const SSEChunk& chunk, const SSEChunk& pattern)
+{
+    dword mask;
+    asm("movdqa %1, %%xmm0\n"
+        "pcmpeqb %2, %%xmm0\n"
+        "pmovmskb %%xmm0, %0\n"
+        : "=r"(mask)
+        : "m"(pattern), "m"(chunk)
+        : "xmm0");
+    return mask;
+}
+
+// Everything below 16 bytes is left to the rep movsb on either side.
+void* sse2_memcpy(void* dest, const void* src, size_t len)
+{
+    auto* dest_ptr = (byte*)dest;
+    auto* src_ptr = (const byte*)src;
+
+    // Stores are aligned, loads go wherever the source is.
+    if ((dword)dest_ptr & 15) {
+        dword prologue = min(len, (size_t)(16 - ((dword)dest_ptr & 15)));
+        len -= prologue;
+        asm volatile(
+            "rep movsb\n"
+            : "=S"(src_ptr), "=D"(dest_ptr), "=c"(prologue)
+            : "0"(src_ptr), "1"(dest_ptr), "2"(prologue)
+            : "memory"
+        );
+    }
+    for (dword i = len / 64; i; --i) {
+        asm volatile(
+            "movdqu (%0), %%xmm0\n"
+            "movdqu 16(%0), %%xmm1\n"
+            "movdqu 32(%0), %%xmm2\n"
+            "movdqu 48(%0), %%xmm3\n"
+            "movdqa %%xmm0, (%1)\n"
+            "movdqa %%xmm1, 16(%1)\n"
+            "movdqa %%xmm2, 32(%1)\n"
+            "movdqa %%xmm3, 48(%1)\n"
+            :: "r"(src_ptr), "r"(dest_ptr)
+            : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+        src_ptr += 64;
+        dest_ptr += 64;
+    }
+    len %= 64;
+    asm volatile(
+        "rep movsb\n"
+        : "=S"(src_ptr), "=D"(dest_ptr), "=c"(len)
+        : "0"(src_ptr), "1"(dest_ptr), "2"(len)
+        : "memory"
+    );
+    return dest;
+}
+
+int sse2_memcmp(const void* v1, const void* v2, size_t n)
+{
+    auto* s1 = (const byte*)v1;
+    auto* s2 = (const byte*)v2;
+    for (; n >= 16; n -= 16, s1 += 16, s2 += 16) {
+        dword equal_mask;
+        asm("movdqu %1, %%xmm0\n"
+            "movdqu %2, %%xmm1\n"
+            "pcmpeqb %%xmm1, %%xmm0\n"
+            "pmovmskb %%xmm0, %0\n"
+            : "=r"(equal_mask)
+            : "m"(*(const SSEUnalignedChunk*)s1), "m"(*(const SSEUnalignedChunk*)s2)
+            : "xmm0", "xmm1");
+        if (equal_mask != 0xffff) {
+            int i = __builtin_ctz(~equal_mask);
+            return s1[i] < s2[i] ? -1 : 1;
+        }
+    }
+    while (n-- > 0) {
+        if (*s1++ != *s2++)
+            return s1[-1] < s2[-1] ? -1 : 1;
+    }
+    return 0;
+}
+
+// An aligned chunk never crosses into another page, so reading all of the one a byte is in is always safe.
+const void* sse2_memchr(const void* ptr, int c, size_t size)
+{
+    if (!size)
+        return nullptr;
+    auto pattern = make_pattern(c);
+    dword misalignment = (dword)ptr & 15;
+    auto* chunk = (const SSEChunk*)((const byte*)ptr - misalignment);
+    // How much of the range is left from where the chunk starts.
+    size_t remaining = size > (size_t)-1 - 16 ? (size_t)-1 : size + misalignment;
+    dword mask = sse2_equal_mask(*chunk, pattern) & (0xffff << misalignment);
+    for (;;) {
+        if (remaining < 16)
+            mask &= (1 << remaining) - 1;
+        if (mask)
+            return chunk->bytes + __builtin_ctz(mask);
+        if (remaining <= 16)
+            return nullptr;
+        remaining -= 16;
+        ++chunk;
+        mask = sse2_equal_mask(*chunk, pattern);
+    }
+}
+
+size_t sse2_strlen(const char* str)
+{
+    dword misalignment = (dword)str & 15;
+    auto* chunk = (const SSEChunk*)(str - misalignment);
+    dword mask = sse2_equal_mask(*chunk, s_zero_chunk) & (0xffff << misalignment);
+    while (!mask) {
+        ++chunk;
+        mask = sse2_equal_mask(*chunk, s_zero_chunk);
+    }
+    return (const char*)chunk->bytes + __builtin_ctz(mask) - str;
+}
+
+const char* sse2_strchr(const char* str, int c)
+{
+    auto pattern = make_pattern(c);
+    dword misalignment = (dword)str & 15;
+    auto* chunk = (const SSEChunk*)(str - misalignment);
+    dword mask = (sse2_equal_mask(*chunk, pattern) | sse2_equal_mask(*chunk, s_zero_chunk)) & (0xffff << misalignment);
+    while (!mask) {
+        ++chunk;
+        mask = sse2_equal_mask(*chunk, pattern) | sse2_equal_mask(*chunk, s_zero_chunk);
+    }
+    // Either it's there, or that's the end of the string.
+    auto* found = (const char*)chunk->bytes + __builtin_ctz(mask);
+    return *found == (char)c ? found : nullptr;
+}
+
+int sse2_strcmp(const char* s1, const char* s2)
+{
+    for (;;) {
+        // The two strings are rarely aligned the same way, so it's sixteen at a time while neither read
+        // could go into the next page, and a byte at a time past the points where one could.
+        if (((dword)s1 & 4095) <= 4080 && ((dword)s2 & 4095) <= 4080) {
+            dword equal_mask;
+            dword zero_mask;
+            asm("movdqu %2, %%xmm0\n"
+                "movdqu %3, %%xmm1\n"
+                "pxor %%xmm2, %%xmm2\n"
+                "pcmpeqb %%xmm0, %%xmm2\n"
+                "pcmpeqb %%xmm1, %%xmm0\n"
+                "pmovmskb %%xmm0, %0\n"
+                "pmovmskb %%xmm2, %1\n"
+                : "=r"(equal_mask), "=r"(zero_mask)
+                : "m"(*(const SSEUnalignedChunk*)s1), "m"(*(const SSEUnalignedChunk*)s2)
+                : "xmm0", "xmm1", "xmm2");
+            dword stop_mask = (~equal_mask & 0xffff) | zero_mask;
+            if (stop_mask) {
+                int i = __builtin_ctz(stop_mask);
+                return (byte)s1[i] - (byte)s2[i];
+            }
+            s1 += 16;
+            s2 += 16;
+            continue;
+        }
+        if (*s1 != *s2 || !*s1)
+            return (byte)*s1 - (byte)*s2;
+        ++s1;
+        ++s2;
+    }
+}
+
 #ifdef KERNEL
 
 static inline uint32_t divq(uint64_t n, uint32_t d)
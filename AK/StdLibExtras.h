@@ -11,6 +11,19 @@
 
 extern "C" void* mmx_memcpy(void* to, const void* from, size_t);
 
+// SSE2 versions of the memory and string routines, for the kernel and LibC to pick from if the CPU has it.
+// They use xmm0-xmm3 without saving them. Reads never go past the end of the page the string ends in.
+extern "C" bool g_cpu_has_sse2;
+// The kernel takes syscalls through sysenter as well as int 0x82 when this is set, and LibC uses it.
+extern "C" bool g_cpu_has_sep;
+extern "C" void detect_cpu_features();
+extern "C" void* sse2_memcpy(void* to, const void* from, size_t);
+extern "C" int sse2_memcmp(const void*, const void*, size_t);
+extern "C" const void* sse2_memchr(const void*, int c, size_t);
+extern "C" size_t sse2_strlen(const char*);
+extern "C" int sse2_strcmp(const char*, const char*);
+extern "C" const char* sse2_strchr(const char*, int c);
+
 [[gnu::always_inline]] inline void fast_dword_copy(dword* dest, const dword* src, size_t count)
 {
     if (count >= 256) {
@@ -172,6 +185,10 @@ template<class Ret, class... Args> struct IsFunction<Ret(Args...,...) const vola
 template<class T> struct IsRvalueReference : FalseType { };
 template<class T> struct IsRvalueReference<T&&> : TrueType { };
 
+template<class T> struct RemoveReference { typedef T Type; };
+template<class T> struct RemoveReference<T&> { typedef T Type; };
+template<class T> struct RemoveReference<T&&> { typedef T Type; };
+
 template<class T> struct RemovePointer { typedef T Type; };
 template<class T> struct RemovePointer<T*> { typedef T Type; };
 template<class T> struct RemovePointer<T* const> { typedef T Type; };
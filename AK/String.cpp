@@ -13,9 +13,16 @@ bool String::operator==(const String& other) const
     if (!other.m_impl)
         return false;
 
+    if (m_impl == other.m_impl)
+        return true;
+
     if (length() != other.length())
         return false;
-    
+
+    // Whichever hashes are already known are as good as a comparison when they differ.
+    if (m_impl->has_hash() && other.m_impl->has_hash() && m_impl->hash() != other.m_impl->hash())
+        return false;
+
     return !memcmp(characters(), other.characters(), length());
 }
 
@@ -61,30 +68,6 @@ String String::substring(ssize_t start, ssize_t length) const
     return new_impl;
 }
 
-Vector<String> String::split(const char separator) const
-{
-    if (is_empty())
-        return { };
-
-    Vector<String> v;
-    ssize_t substart = 0;
-    for (ssize_t i = 0; i < length(); ++i) {
-        char ch = characters()[i];
-        if (ch == separator) {
-            ssize_t sublen = i - substart;
-            if (sublen != 0)
-                v.append(substring(substart, sublen));
-            substart = i + 1;
-        }
-    }
-    ssize_t taillen = length() - substart;
-    if (taillen != 0)
-        v.append(substring(substart, taillen));
-    if (characters()[length() - 1] == separator)
-        v.append(empty());
-    return v;
-}
-
 ByteBuffer String::to_byte_buffer() const
 {
     if (!m_impl)
@@ -5,24 +5,63 @@
 
 namespace AK {
 
+// Shorter than this, a String gets its own exact copy, which costs less than the slack it'd keep otherwise.
+static const ssize_t minimum_length_to_hand_over = 128;
+
+void StringBuilder::grow(ssize_t capacity)
+{
+    auto* new_buffer = (char*)kmalloc(capacity + 1);
+    if (m_buffer) {
+        memcpy(new_buffer, m_buffer, m_length);
+        kfree(m_buffer);
+    }
+    m_buffer = new_buffer;
+    m_capacity = capacity;
+}
+
 inline void StringBuilder::will_append(ssize_t size)
 {
-    if ((m_length + size) > m_buffer.size())
-        m_buffer.grow(max((ssize_t)16, m_buffer.size() * 2 + size));
+    if ((m_length + size) > m_capacity)
+        grow(max((ssize_t)16, m_capacity * 2 + size));
 }
 
 StringBuilder::StringBuilder(ssize_t initial_capacity)
 {
-    m_buffer.grow(initial_capacity);
+    grow(initial_capacity);
+}
+
+StringBuilder::~StringBuilder()
+{
+    if (m_buffer)
+        kfree(m_buffer);
+}
+
+void StringBuilder::reserve(ssize_t capacity)
+{
+    if (capacity > m_capacity)
+        grow(capacity);
+}
+
+void StringBuilder::append_unchecked(const char* characters, ssize_t length)
+{
+    ASSERT(m_length + length <= m_capacity);
+    memcpy(m_buffer + m_length, characters, length);
+    m_length += length;
 }
 
 void StringBuilder::append(const String& str)
 {
-    if (str.is_empty())
-        return;
-    will_append(str.length());
-    memcpy(m_buffer.pointer() + m_length, str.characters(), str.length());
-    m_length += str.length();
+    append(str.characters(), str.length());
+}
+
+void StringBuilder::append(const StringView& view)
+{
+    append(view.characters(), view.length());
+}
+
+void StringBuilder::append(const char* cstring)
+{
+    append(cstring, strlen(cstring));
 }
 
 void StringBuilder::append(const char* characters, ssize_t length)
@@ -30,21 +69,19 @@ void StringBuilder::append(const char* characters, ssize_t length)
     if (!length)
         return;
     will_append(length);
-    memcpy(m_buffer.pointer() + m_length, characters, length);
-    m_length += length;
+    append_unchecked(characters, length);
 }
 
 void StringBuilder::append(char ch)
 {
     will_append(1);
-    m_buffer.pointer()[m_length] = ch;
-    m_length += 1;
+    append_unchecked(ch);
 }
 
 void StringBuilder::appendvf(const char* fmt, va_list ap)
 {
-    printf_internal([this] (char*&, char ch) {
-        append(ch);
+    printf_chunked([this] (char*&, const char* characters, size_t length) {
+        append(characters, length);
     }, nullptr, fmt, ap);
 }
 
@@ -58,16 +95,31 @@ void StringBuilder::appendf(const char* fmt, ...)
 
 ByteBuffer StringBuilder::to_byte_buffer()
 {
-    m_buffer.trim(m_length);
-    return move(m_buffer);
+    if (!m_buffer)
+        return { };
+    auto buffer = ByteBuffer::adopt(m_buffer, m_length);
+    m_buffer = nullptr;
+    m_length = 0;
+    m_capacity = 0;
+    return buffer;
 }
 
 String StringBuilder::to_string()
 {
-    auto string = String((const char*)m_buffer.pointer(), m_length);
-    m_buffer.clear();
+    if (!m_buffer)
+        return { };
+    String string;
+    if (m_length < minimum_length_to_hand_over || m_length < m_capacity / 2) {
+        string = String(m_buffer, m_length);
+        kfree(m_buffer);
+    } else {
+        m_buffer[m_length] = '\0';
+        string = StringImpl::adopt_buffer(m_buffer, m_length);
+    }
+    m_buffer = nullptr;
+    m_length = 0;
+    m_capacity = 0;
     return string;
 }
 
 }
-
@@ -9,25 +9,48 @@ namespace AK {
 class StringBuilder {
 public:
     explicit StringBuilder(ssize_t initial_capacity = 16);
-    ~StringBuilder() { }
+    ~StringBuilder();
+
+    StringBuilder(const StringBuilder&) = delete;
+    StringBuilder& operator=(const StringBuilder&) = delete;
+
+    // Makes room for |capacity| characters in all, so that appending up to there won't grow the buffer.
+    void reserve(ssize_t capacity);
 
     void append(const String&);
+    void append(const StringView&);
+    void append(const char*);
     void append(char);
     void append(const char*, ssize_t);
     void appendf(const char*, ...);
     void appendvf(const char*, va_list);
 
+    // For when there's been a reserve() with room for it already.
+    void append_unchecked(char ch)
+    {
+        ASSERT(m_length < m_capacity);
+        m_buffer[m_length++] = ch;
+    }
+    void append_unchecked(const char*, ssize_t);
+
+    ssize_t length() const { return m_length; }
+    bool is_empty() const { return !m_length; }
+
+    // These hand the buffer over instead of copying it, when that doesn't waste too much of it.
+    // Either leaves the builder empty.
     String to_string();
     ByteBuffer to_byte_buffer();
 
 private:
     void will_append(ssize_t);
+    void grow(ssize_t capacity);
 
-    ByteBuffer m_buffer;
+    // With one more byte than |m_capacity|, for the null terminator a String wants.
+    char* m_buffer { nullptr };
     ssize_t m_length { 0 };
+    ssize_t m_capacity { 0 };
 };
 
 }
 
 using AK::StringBuilder;
-
@@ -2,6 +2,7 @@
 #include "StdLibExtras.h"
 #include "kmalloc.h"
 #include "HashTable.h"
+#include "FlyString.h"
 
 //#define DEBUG_STRINGIMPL
 
@@ -30,6 +31,20 @@ StringImpl& StringImpl::the_empty_stringimpl()
     return *s_the_empty_stringimpl;
 }
 
+static StringImpl* s_single_character_stringimpls[256];
+
+// Lots of strings are a single character, like "/" and "." and one-letter names, so those are shared.
+StringImpl& StringImpl::the_single_character_stringimpl(char ch)
+{
+    auto*& impl = s_single_character_stringimpls[(byte)ch];
+    if (!impl) {
+        char* buffer;
+        impl = &create_uninitialized(1, buffer).leak_ref();
+        buffer[0] = ch;
+    }
+    return *impl;
+}
+
 StringImpl::StringImpl(ConstructWithInlineBufferTag, ssize_t length)
     : m_length(length)
     , m_characters(m_inline_buffer)
@@ -42,14 +57,35 @@ StringImpl::StringImpl(ConstructWithInlineBufferTag, ssize_t length)
 #endif
 }
 
+StringImpl::StringImpl(ConstructAdoptingBufferTag, char* buffer, ssize_t length)
+    : m_length(length)
+    , m_owns_buffer(true)
+    , m_characters(buffer)
+{
+#ifdef DEBUG_STRINGIMPL
+    if (!g_all_live_stringimpls)
+        g_all_live_stringimpls = new HashTable<StringImpl*>;
+    ++g_stringimpl_count;
+    g_all_live_stringimpls->set(this);
+#endif
+}
+
 StringImpl::~StringImpl()
 {
+    if (m_owns_buffer)
+        kfree(const_cast<char*>(m_characters));
 #ifdef DEBUG_STRINGIMPL
     --g_stringimpl_count;
     g_all_live_stringimpls->remove(this);
 #endif
 }
 
+void StringImpl::will_be_destroyed()
+{
+    if (m_is_fly)
+        FlyString::did_destroy_impl({ }, *this);
+}
+
 static inline ssize_t allocation_size_for_stringimpl(ssize_t length)
 {
     return sizeof(StringImpl) + (sizeof(char) * length) + sizeof(char);
@@ -66,17 +102,29 @@ Retained<StringImpl> StringImpl::create_uninitialized(ssize_t length, char*& buf
     return new_stringimpl;
 }
 
+Retained<StringImpl> StringImpl::adopt_buffer(char* buffer, ssize_t length)
+{
+    ASSERT(length);
+    ASSERT(!buffer[length]);
+    void* slot = kmalloc(sizeof(StringImpl));
+    ASSERT(slot);
+    return adopt(*new (slot) StringImpl(ConstructAdoptingBuffer, buffer, length));
+}
+
 RetainPtr<StringImpl> StringImpl::create(const char* cstring, ssize_t length, ShouldChomp shouldChomp)
 {
     if (!cstring)
         return nullptr;
 
-    if (!*cstring)
+    if (!length)
         return the_empty_stringimpl();
 
-    if (!length)
+    if (!*cstring)
         return the_empty_stringimpl();
 
+    if (length == 1 && !(shouldChomp && *cstring == '\n'))
+        return the_single_character_stringimpl(*cstring);
+
     char* buffer;
     auto new_stringimpl = create_uninitialized(length, buffer);
     memcpy(buffer, cstring, length * sizeof(char));
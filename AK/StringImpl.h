@@ -1,11 +1,14 @@
 #pragma once
 
+#include "Badge.h"
 #include "Retainable.h"
 #include "RetainPtr.h"
 #include "Types.h"
 
 namespace AK {
 
+class FlyString;
+
 enum ShouldChomp { NoChomp, Chomp };
 
 class StringImpl : public Retainable<StringImpl> {
@@ -13,6 +16,8 @@ public:
     static Retained<StringImpl> create_uninitialized(ssize_t length, char*& buffer);
     static RetainPtr<StringImpl> create(const char* cstring, ShouldChomp = NoChomp);
     static RetainPtr<StringImpl> create(const char* cstring, ssize_t length, ShouldChomp = NoChomp);
+    // Takes over |buffer|, which came from kmalloc() and has a null terminator after |length| characters.
+    static Retained<StringImpl> adopt_buffer(char* buffer, ssize_t length);
     Retained<StringImpl> to_lowercase() const;
     Retained<StringImpl> to_uppercase() const;
 
@@ -30,6 +35,13 @@ public:
             compute_hash();
         return m_hash;
     }
+    bool has_hash() const { return m_hasHash; }
+
+    // Whether it's the one in FlyString's table with these characters.
+    bool is_fly() const { return m_is_fly; }
+    void set_fly(Badge<FlyString>, bool is_fly) { m_is_fly = is_fly; }
+
+    void will_be_destroyed();
 
 private:
     enum ConstructTheEmptyStringImplTag { ConstructTheEmptyStringImpl };
@@ -38,10 +50,16 @@ private:
     enum ConstructWithInlineBufferTag { ConstructWithInlineBuffer };
     StringImpl(ConstructWithInlineBufferTag, ssize_t length);
 
+    enum ConstructAdoptingBufferTag { ConstructAdoptingBuffer };
+    StringImpl(ConstructAdoptingBufferTag, char* buffer, ssize_t length);
+
     void compute_hash() const;
+    static StringImpl& the_single_character_stringimpl(char);
 
     ssize_t m_length { 0 };
     mutable bool m_hasHash { false };
+    bool m_is_fly { false };
+    bool m_owns_buffer { false };
     const char* m_characters { nullptr };
     mutable unsigned m_hash { 0 };
     char m_inline_buffer[0];
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "StdLibExtras.h"
+#include "StringImpl.h"
+#include "Traits.h"
+#include "Vector.h"
+
+namespace AK {
+
+class String;
+
+// Characters that belong to someone else, like a String or a buffer, which has to outlive the view.
+// They're not null terminated unless what they came from happens to be.
+class StringView {
+public:
+    StringView() { }
+    StringView(const char* characters, ssize_t length)
+        : m_characters(characters)
+        , m_length(length)
+    {
+    }
+    StringView(const char* cstring)
+        : m_characters(cstring)
+        , m_length(cstring ? strlen(cstring) : 0)
+    {
+    }
+    StringView(const String&);
+
+    bool is_null() const { return !m_characters; }
+    bool is_empty() const { return !m_length; }
+    ssize_t length() const { return m_length; }
+    const char* characters() const { return m_characters; }
+    char operator[](ssize_t i) const { ASSERT(i >= 0 && i < m_length); return m_characters[i]; }
+
+    StringView substring_view(ssize_t start, ssize_t length) const
+    {
+        ASSERT(start >= 0 && length >= 0 && start + length <= m_length);
+        return { m_characters + start, length };
+    }
+
+    // Like String::split(), but the parts point into this instead of being copied.
+    template<int inline_capacity = 0>
+    Vector<StringView, inline_capacity> split_view(char separator) const;
+
+    // The same as String's, so either can be used to look the other up.
+    unsigned hash() const { return string_hash(m_characters, m_length); }
+
+    bool operator==(const StringView& other) const
+    {
+        if (is_null())
+            return other.is_null();
+        if (other.is_null())
+            return false;
+        if (m_length != other.m_length)
+            return false;
+        return !memcmp(m_characters, other.m_characters, m_length);
+    }
+    bool operator!=(const StringView& other) const { return !(*this == other); }
+    bool operator==(const char* cstring) const { return *this == StringView(cstring); }
+    bool operator!=(const char* cstring) const { return !(*this == cstring); }
+
+private:
+    const char* m_characters { nullptr };
+    ssize_t m_length { 0 };
+};
+
+template<int inline_capacity>
+Vector<StringView, inline_capacity> StringView::split_view(const char separator) const
+{
+    if (is_empty())
+        return { };
+
+    Vector<StringView, inline_capacity> v;
+    ssize_t substart = 0;
+    for (ssize_t i = 0; i < m_length; ++i) {
+        if (m_characters[i] == separator) {
+            ssize_t sublen = i - substart;
+            if (sublen != 0)
+                v.append(substring_view(substart, sublen));
+            substart = i + 1;
+        }
+    }
+    ssize_t taillen = m_length - substart;
+    if (taillen != 0)
+        v.append(substring_view(substart, taillen));
+    if (m_characters[m_length - 1] == separator)
+        v.append({ m_characters + m_length, 0 });
+    return v;
+}
+
+template<>
+struct Traits<StringView> {
+    static unsigned hash(const StringView& s) { return s.hash(); }
+    static void dump(const StringView& s) { kprintf("%s", s.length() ? s.characters() : ""); }
+};
+
+}
+
+using AK::StringView;
@@ -0,0 +1,152 @@
+#include "ThreadPool.h"
+#include <unistd.h>
+
+//#define THREAD_POOL_DEBUG
+
+namespace AK {
+
+static pthread_key_t s_worker_index_key;
+
+ThreadPool& ThreadPool::the()
+{
+    static ThreadPool* s_the;
+    static pthread_mutex_t s_the_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&s_the_lock);
+    if (!s_the)
+        s_the = new ThreadPool;
+    pthread_mutex_unlock(&s_the_lock);
+    return *s_the;
+}
+
+ThreadPool::ThreadPool()
+{
+    pthread_mutex_init(&m_lock, nullptr);
+    pthread_cond_init(&m_state_changed, nullptr);
+    pthread_key_create(&s_worker_index_key, nullptr);
+    for (int i = 0; i < max_workers; ++i)
+        pthread_mutex_init(&m_workers[i].lock, nullptr);
+
+    long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+    int worker_count = min(max(processor_count, 1l) - 1, (long)max_workers);
+    for (int i = 0; i < worker_count; ++i) {
+        pthread_t thread;
+        // The index rides along as the argument, one past so it's never null.
+        if (pthread_create(&thread, nullptr, worker_main, (void*)(i + 1)))
+            break;
+        pthread_detach(thread);
+        ++m_worker_count;
+    }
+#ifdef THREAD_POOL_DEBUG
+    dbgprintf("ThreadPool: %d workers\n", m_worker_count);
+#endif
+}
+
+void* ThreadPool::worker_main(void* argument)
+{
+    int index = (int)argument - 1;
+    pthread_setspecific(s_worker_index_key, argument);
+    auto& pool = ThreadPool::the();
+    for (;;) {
+        Job job;
+        if (pool.take_job(index, job)) {
+            pool.run_job(job);
+            continue;
+        }
+        pthread_mutex_lock(&pool.m_lock);
+        while (!__atomic_load_n(&pool.m_queued_job_count, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&pool.m_state_changed, &pool.m_lock);
+        pthread_mutex_unlock(&pool.m_lock);
+    }
+}
+
+// A worker goes for the newest job in its own deque, then for the oldest in everyone else's.
+bool ThreadPool::take_job(int worker_index, Job& job)
+{
+    if (!__atomic_load_n(&m_queued_job_count, __ATOMIC_ACQUIRE))
+        return false;
+    if (worker_index >= 0) {
+        auto& worker = m_workers[worker_index];
+        pthread_mutex_lock(&worker.lock);
+        bool found = !worker.jobs.is_empty();
+        if (found)
+            job = worker.jobs.take_last();
+        pthread_mutex_unlock(&worker.lock);
+        if (found) {
+            __atomic_sub_fetch(&m_queued_job_count, 1, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+    for (int i = 0; i < m_worker_count; ++i) {
+        int victim_index = (worker_index + 1 + i) % m_worker_count;
+        if (victim_index == worker_index)
+            continue;
+        auto& victim = m_workers[victim_index];
+        pthread_mutex_lock(&victim.lock);
+        bool found = !victim.jobs.is_empty();
+        if (found)
+            job = victim.jobs.take_first();
+        pthread_mutex_unlock(&victim.lock);
+        if (found) {
+            __atomic_sub_fetch(&m_queued_job_count, 1, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_job(const Job& job)
+{
+    auto* batch = job.batch;
+    batch->function(batch->context, job.index);
+    // The batch lives on its owner's stack, and can be gone as soon as this hits zero.
+    if (__atomic_sub_fetch(&batch->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&m_lock);
+        pthread_cond_broadcast(&m_state_changed);
+        pthread_mutex_unlock(&m_lock);
+    }
+}
+
+void ThreadPool::run_impl(int count, void (*function)(void*, int), void* context)
+{
+    if (count <= 0)
+        return;
+    if (!m_worker_count || count == 1) {
+        for (int i = 0; i < count; ++i)
+            function(context, i);
+        return;
+    }
+
+    Batch batch;
+    batch.function = function;
+    batch.context = context;
+    batch.remaining = count;
+
+    // Spread them around, so every worker has some of its own to start on.
+    int first_worker = __atomic_fetch_add(&m_next_worker, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < count; ++i) {
+        auto& worker = m_workers[(first_worker + i) % m_worker_count];
+        pthread_mutex_lock(&worker.lock);
+        worker.jobs.append({ &batch, i });
+        pthread_mutex_unlock(&worker.lock);
+    }
+    __atomic_add_fetch(&m_queued_job_count, count, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&m_lock);
+    pthread_cond_broadcast(&m_state_changed);
+    pthread_mutex_unlock(&m_lock);
+
+    int worker_index = (int)pthread_getspecific(s_worker_index_key) - 1;
+    while (__atomic_load_n(&batch.remaining, __ATOMIC_ACQUIRE)) {
+        Job job;
+        if (take_job(worker_index, job)) {
+            run_job(job);
+            continue;
+        }
+        // Everything's been taken, and someone else is still finishing up.
+        pthread_mutex_lock(&m_lock);
+        while (__atomic_load_n(&batch.remaining, __ATOMIC_ACQUIRE) && !__atomic_load_n(&m_queued_job_count, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&m_state_changed, &m_lock);
+        pthread_mutex_unlock(&m_lock);
+    }
+}
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#ifdef KERNEL
+#error "AK::ThreadPool is for userland only."
+#endif
+
+#include "QuickSort.h"
+#include "StdLibExtras.h"
+#include "Vector.h"
+#include <pthread.h>
+
+namespace AK {
+
+// One worker thread for each processor but the one we're on, each with a deque of jobs of its own.
+// Workers take their newest job first, and when they run out, steal the oldest from someone else.
+// Whoever hands out a batch of jobs works on it too while waiting for it to finish, so batches can
+// be handed out from inside other batches without anyone getting stuck.
+class ThreadPool {
+public:
+    static ThreadPool& the();
+
+    // How many threads can work on a batch at once, counting the one that hands it out.
+    int concurrency() const { return m_worker_count + 1; }
+
+    // Calls |callback(i)| for every i in [0, count), on whichever threads get to them first,
+    // and returns once they've all returned.
+    template<typename Callback>
+    void run(int count, Callback& callback)
+    {
+        run_impl(count, [] (void* context, int index) { (*(Callback*)context)(index); }, &callback);
+    }
+
+private:
+    ThreadPool();
+
+    struct Batch {
+        void (*function)(void*, int) { nullptr };
+        void* context { nullptr };
+        int remaining { 0 };
+    };
+
+    struct Job {
+        Batch* batch { nullptr };
+        int index { 0 };
+    };
+
+    struct Worker {
+        pthread_mutex_t lock;
+        Vector<Job> jobs;
+    };
+
+    static const int max_workers = 15;
+
+    static void* worker_main(void*);
+    void run_impl(int count, void (*function)(void*, int), void* context);
+    bool take_job(int worker_index, Job&);
+    void run_job(const Job&);
+
+    int m_worker_count { 0 };
+    Worker m_workers[max_workers];
+    // How many jobs are sitting in all the deques together.
+    int m_queued_job_count { 0 };
+    int m_next_worker { 0 };
+    // Taken only to sleep on, or to wake up whoever might be sleeping.
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_state_changed;
+};
+
+// Calls |callback(i)| for every i in [first, last), in chunks of at least |grain| on as many threads as there are.
+template<typename Callback>
+void parallel_for(int first, int last, Callback callback, int grain = 1)
+{
+    int count = last - first;
+    if (count <= 0)
+        return;
+    auto& pool = ThreadPool::the();
+    // A few chunks for every thread, so that one slow chunk doesn't hold everyone up.
+    int chunk_count = min(pool.concurrency() * 4, (count + grain - 1) / max(grain, 1));
+    if (chunk_count <= 1) {
+        for (int i = first; i < last; ++i)
+            callback(i);
+        return;
+    }
+    auto run_chunk = [&] (int chunk) {
+        int chunk_first = first + (int)((long long)count * chunk / chunk_count);
+        int chunk_last = first + (int)((long long)count * (chunk + 1) / chunk_count);
+        for (int i = chunk_first; i < chunk_last; ++i)
+            callback(i);
+    };
+    pool.run(chunk_count, run_chunk);
+}
+
+// Sorts each thread's share of |items| on that thread, then merges the sorted runs together in pairs,
+// each round of merges in parallel too. Below a few thousand items it's not worth the threads.
+// T has to be default constructible, for the scratch space the merges go into.
+template<typename T, typename LessThan>
+void parallel_sort(Vector<T>& items, LessThan less_than)
+{
+    int size = items.size();
+    int run_count = ThreadPool::the().concurrency();
+    if (run_count == 1 || size < 4096) {
+        quick_sort(items.begin(), items.end(), less_than);
+        return;
+    }
+
+    Vector<int> bounds;
+    for (int i = 0; i <= run_count; ++i)
+        bounds.append((int)((long long)size * i / run_count));
+    T* from = items.data();
+    parallel_for(0, run_count, [&] (int run) {
+        int first = bounds[run];
+        intro_sort(first, bounds[run + 1],
+            [&] (int a, int b) { return less_than(from[a], from[b]); },
+            [&] (int a, int b) { swap(from[a], from[b]); });
+    });
+
+    Vector<T> scratch;
+    scratch.resize(size);
+    T* to = scratch.data();
+    while (bounds.size() > 2) {
+        int pair_count = bounds.size() / 2;
+        parallel_for(0, pair_count, [&] (int pair) {
+            int first = bounds[pair * 2];
+            int middle = bounds[min(pair * 2 + 1, bounds.size() - 1)];
+            int last = bounds[min(pair * 2 + 2, bounds.size() - 1)];
+            int i = first;
+            int j = middle;
+            int k = first;
+            // Ties go to the left run, as in any merge.
+            while (i < middle && j < last)
+                to[k++] = move(less_than(from[j], from[i]) ? from[j++] : from[i++]);
+            while (i < middle)
+                to[k++] = move(from[i++]);
+            while (j < last)
+                to[k++] = move(from[j++]);
+        });
+        Vector<int> merged_bounds;
+        for (int i = 0; i < bounds.size(); i += 2)
+            merged_bounds.append(bounds[i]);
+        if (merged_bounds.last() != size)
+            merged_bounds.append(size);
+        bounds = move(merged_bounds);
+        swap(from, to);
+    }
+    if (from != items.data()) {
+        for (int i = 0; i < size; ++i)
+            items[i] = move(from[i]);
+    }
+}
+
+}
+
+using AK::ThreadPool;
+using AK::parallel_for;
+using AK::parallel_sort;
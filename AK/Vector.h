@@ -1,71 +1,35 @@
 #pragma once
 
 #include "Assertions.h"
-#include "OwnPtr.h"
+#include "StdLibExtras.h"
 #include "kmalloc.h"
 
 namespace AK {
 
-template<typename T> class Vector;
+// Only looks at T when there's something inline, so a plain Vector can be declared with T still incomplete.
+template<typename T, int inline_capacity>
+struct VectorInlineStorage {
+    static constexpr unsigned size = sizeof(T) * inline_capacity;
+    static constexpr unsigned alignment = alignof(T);
+};
 
 template<typename T>
-class VectorImpl {
-public:
-    ~VectorImpl()
-    {
-        for (int i = 0; i < m_size; ++i)
-            at(i).~T();
-    }
-    static OwnPtr<VectorImpl> create(int capacity)
-    {
-        int size = sizeof(VectorImpl) + sizeof(T) * capacity;
-        void* slot = kmalloc(size);
-        new (slot) VectorImpl(capacity);
-        return OwnPtr<VectorImpl>((VectorImpl*)slot);
-    }
-
-    int size() const { return m_size; }
-    int capacity() const { return m_capacity; }
-
-    T& at(int i) { ASSERT(i < m_size); return *slot(i); }
-    const T& at(int i) const { ASSERT(i < m_size); return *slot(i); }
-
-    void remove(int index)
-    {
-        ASSERT(index < m_size);
-        at(index).~T();
-        for (int i = index + 1; i < m_size; ++i) {
-            new (slot(i - 1)) T(move(at(i)));
-            at(i).~T();
-        }
-
-        --m_size;
-    }
-
-private:
-    friend class Vector<T>;
-
-    VectorImpl(int capacity) : m_capacity(capacity) { }
-
-    T* tail() { return reinterpret_cast<T*>(this + 1); }
-    T* slot(int i) { return &tail()[i]; }
-
-    const T* tail() const { return reinterpret_cast<const T*>(this + 1); }
-    const T* slot(int i) const { return &tail()[i]; }
-
-    int m_size { 0 };
-    int m_capacity;
+struct VectorInlineStorage<T, 0> {
+    static constexpr unsigned size = 0;
+    static constexpr unsigned alignment = 1;
 };
 
-template<typename T>
+// With an |inline_capacity|, that many elements fit in the Vector itself before it goes to the heap,
+// which is what a short-lived one on the stack usually wants.
+template<typename T, int inline_capacity = 0>
 class Vector {
 public:
     Vector() { }
     ~Vector() { clear(); }
 
     Vector(Vector&& other)
-        : m_impl(move(other.m_impl))
     {
+        take_from(other);
     }
 
     Vector(const Vector& other)
@@ -77,23 +41,28 @@ public:
 
     Vector& operator=(Vector&& other)
     {
-        if (this != &other)
-            m_impl = move(other.m_impl);
+        if (this != &other) {
+            clear();
+            take_from(other);
+        }
         return *this;
     }
 
     void clear()
     {
-        m_impl = nullptr;
+        clear_with_capacity();
+        if (m_outline_buffer) {
+            kfree(m_outline_buffer);
+            m_outline_buffer = nullptr;
+        }
+        m_capacity = inline_capacity;
     }
 
     void clear_with_capacity()
     {
-        if (!m_impl)
-            return;
-        for (int i = 0; i < size(); ++i)
+        for (int i = 0; i < m_size; ++i)
             at(i).~T();
-        m_impl->m_size = 0;
+        m_size = 0;
     }
 
     bool contains_slow(const T& value) const
@@ -106,14 +75,24 @@ public:
     }
 
     bool is_empty() const { return size() == 0; }
-    int size() const { return m_impl ? m_impl->size() : 0; }
-    int capacity() const { return m_impl ? m_impl->capacity() : 0; }
+    int size() const { return m_size; }
+    int capacity() const { return m_capacity; }
 
-    T* data() { return m_impl ? m_impl->slot(0) : nullptr; }
-    const T* data() const { return m_impl ? m_impl->slot(0) : nullptr; }
+    T* data()
+    {
+        if (inline_capacity > 0 && !m_outline_buffer)
+            return inline_buffer();
+        return m_outline_buffer;
+    }
+    const T* data() const
+    {
+        if (inline_capacity > 0 && !m_outline_buffer)
+            return inline_buffer();
+        return m_outline_buffer;
+    }
 
-    const T& at(int i) const { return m_impl->at(i); }
-    T& at(int i) { return m_impl->at(i); }
+    const T& at(int i) const { ASSERT(i >= 0 && i < m_size); return data()[i]; }
+    T& at(int i) { ASSERT(i >= 0 && i < m_size); return data()[i]; }
 
     const T& operator[](int i) const { return at(i); }
     T& operator[](int i) { return at(i); }
@@ -129,7 +108,7 @@ public:
         ASSERT(!is_empty());
         T value = move(last());
         last().~T();
-        --m_impl->m_size;
+        --m_size;
         return value;
     }
 
@@ -143,7 +122,17 @@ public:
 
     void remove(int index)
     {
-        m_impl->remove(index);
+        ASSERT(index < m_size);
+        at(index).~T();
+        if (is_trivially_relocatable()) {
+            memmove(slot(index), slot(index + 1), (m_size - index - 1) * sizeof(T));
+        } else {
+            for (int i = index + 1; i < m_size; ++i) {
+                new (slot(i - 1)) T(move(at(i)));
+                at(i).~T();
+            }
+        }
+        --m_size;
     }
 
     void insert(int index, T&& value)
@@ -152,15 +141,20 @@ public:
         if (index == size())
             return append(move(value));
         ensure_capacity(size() + 1);
-        ++m_impl->m_size;
-        for (int i = size() - 1; i > index; --i) {
-            new (m_impl->slot(i)) T(move(m_impl->at(i - 1)));
-            m_impl->at(i - 1).~T();
+        if (is_trivially_relocatable()) {
+            memmove(slot(index + 1), slot(index), (m_size - index) * sizeof(T));
+            ++m_size;
+        } else {
+            ++m_size;
+            for (int i = size() - 1; i > index; --i) {
+                new (slot(i)) T(move(at(i - 1)));
+                at(i - 1).~T();
+            }
         }
-        new (m_impl->slot(index)) T(move(value));
+        new (slot(index)) T(move(value));
     }
 
-    Vector& operator=(const Vector<T>& other)
+    Vector& operator=(const Vector& other)
     {
         if (this != &other) {
             clear();
@@ -171,13 +165,13 @@ public:
         return *this;
     }
 
-    void append(Vector<T>&& other)
+    void append(Vector&& other)
     {
-        if (!m_impl) {
-            m_impl = move(other.m_impl);
+        if (is_empty()) {
+            *this = move(other);
             return;
         }
-        Vector<T> tmp = move(other);
+        Vector tmp = move(other);
         ensure_capacity(size() + tmp.size());
         for (auto&& v : tmp) {
             unchecked_append(move(v));
@@ -198,28 +192,29 @@ public:
     void unchecked_append(T&& value)
     {
         ASSERT((size() + 1) <= capacity());
-        new (m_impl->slot(m_impl->m_size)) T(move(value));
-        ++m_impl->m_size;
+        new (slot(m_size)) T(move(value));
+        ++m_size;
     }
 
     void unchecked_append(const T& value)
     {
-        new (m_impl->slot(m_impl->m_size)) T(value);
-        ++m_impl->m_size;
+        ASSERT((size() + 1) <= capacity());
+        new (slot(m_size)) T(value);
+        ++m_size;
     }
 
     void append(T&& value)
     {
         ensure_capacity(size() + 1);
-        new (m_impl->slot(m_impl->m_size)) T(move(value));
-        ++m_impl->m_size;
+        new (slot(m_size)) T(move(value));
+        ++m_size;
     }
 
     void append(const T& value)
     {
         ensure_capacity(size() + 1);
-        new (m_impl->slot(m_impl->m_size)) T(value);
-        ++m_impl->m_size;
+        new (slot(m_size)) T(value);
+        ++m_size;
     }
 
     void append(const T* values, int count)
@@ -227,9 +222,13 @@ public:
         if (!count)
             return;
         ensure_capacity(size() + count);
-        for (int i = 0; i < count; ++i)
-            new (m_impl->slot(m_impl->m_size + i)) T(values[i]);
-        m_impl->m_size += count;
+        if (is_trivially_relocatable()) {
+            memcpy(slot(m_size), values, count * sizeof(T));
+        } else {
+            for (int i = 0; i < count; ++i)
+                new (slot(m_size + i)) T(values[i]);
+        }
+        m_size += count;
     }
 
     void ensure_capacity(int neededCapacity)
@@ -237,15 +236,12 @@ public:
         if (capacity() >= neededCapacity)
             return;
         int new_capacity = padded_capacity(neededCapacity);
-        auto new_impl = VectorImpl<T>::create(new_capacity);
-        if (m_impl) {
-            new_impl->m_size = m_impl->m_size;
-            for (int i = 0; i < size(); ++i) {
-                new (new_impl->slot(i)) T(move(m_impl->at(i)));
-                m_impl->at(i).~T();
-            }
-        }
-        m_impl = move(new_impl);
+        auto* new_buffer = (T*)kmalloc(new_capacity * sizeof(T));
+        relocate(new_buffer, data(), m_size);
+        if (m_outline_buffer)
+            kfree(m_outline_buffer);
+        m_outline_buffer = new_buffer;
+        m_capacity = new_capacity;
     }
 
     void resize(int new_size)
@@ -261,12 +257,12 @@ public:
         if (new_size > size()) {
             ensure_capacity(new_size);
             for (int i = size(); i < new_size; ++i)
-                new (m_impl->slot(i)) T;
+                new (slot(i)) T;
         } else {
             for (int i = new_size; i < size(); ++i)
-                m_impl->at(i).~T();
+                at(i).~T();
         }
-        m_impl->m_size = new_size;
+        m_size = new_size;
     }
 
     class Iterator {
@@ -277,6 +273,7 @@ public:
         Iterator& operator++() { ++m_index; return *this; }
         Iterator operator-(int value) { return { m_vector, m_index - value }; }
         Iterator operator+(int value) { return { m_vector, m_index + value }; }
+        int operator-(const Iterator& other) const { return m_index - other.m_index; }
         T& operator*() { return m_vector[m_index]; }
     private:
         friend class Vector;
@@ -296,6 +293,7 @@ public:
         ConstIterator& operator++() { ++m_index; return *this; }
         ConstIterator operator-(int value) { return { m_vector, m_index - value }; }
         ConstIterator operator+(int value) { return { m_vector, m_index + value }; }
+        int operator-(const ConstIterator& other) const { return m_index - other.m_index; }
         const T& operator*() const { return m_vector[m_index]; }
     private:
         friend class Vector;
@@ -313,7 +311,48 @@ private:
         return max(int(4), capacity + (capacity / 4) + 4);
     }
 
-    OwnPtr<VectorImpl<T>> m_impl;
+    // Whether moving an element is as good as copying its bytes, and leaves nothing behind to destroy.
+    static constexpr bool is_trivially_relocatable() { return __is_trivially_copyable(T); }
+
+    // Moves |count| elements from |source| to |destination|, which don't overlap, ending the old ones.
+    static void relocate(T* destination, T* source, int count)
+    {
+        if (!count)
+            return;
+        if (is_trivially_relocatable()) {
+            memcpy(destination, source, count * sizeof(T));
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            new (&destination[i]) T(move(source[i]));
+            source[i].~T();
+        }
+    }
+
+    // Leaves |other| empty, taking its heap buffer if it has one, or moving its inline elements over.
+    void take_from(Vector& other)
+    {
+        if (other.m_outline_buffer) {
+            m_outline_buffer = other.m_outline_buffer;
+            m_capacity = other.m_capacity;
+            other.m_outline_buffer = nullptr;
+            other.m_capacity = inline_capacity;
+        } else {
+            relocate(inline_buffer(), other.inline_buffer(), other.m_size);
+        }
+        m_size = other.m_size;
+        other.m_size = 0;
+    }
+
+    T* slot(int i) { return &data()[i]; }
+
+    T* inline_buffer() { return reinterpret_cast<T*>(m_inline_buffer_storage); }
+    const T* inline_buffer() const { return reinterpret_cast<const T*>(m_inline_buffer_storage); }
+
+    T* m_outline_buffer { nullptr };
+    int m_size { 0 };
+    int m_capacity { inline_capacity };
+    alignas(VectorInlineStorage<T, inline_capacity>::alignment) unsigned char m_inline_buffer_storage[VectorInlineStorage<T, inline_capacity>::size];
 };
 
 }
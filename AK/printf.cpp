@@ -13,295 +13,325 @@ typedef long long unsigned int qword;
 
 static constexpr const char* h = "0123456789abcdef";
 
-template<typename PutChFunc, typename T>
-[[gnu::always_inline]] inline int print_hex(PutChFunc putch, char*& bufptr, T number, byte fields)
-{
-    int ret = 0;
-    byte shr_count = fields * 4;
-    while (shr_count) {
-        shr_count -= 4;
-        putch(bufptr, h[(number >> shr_count) & 0x0F]);
-        ++ret;
+// "00" through "99", so decimal conversion needs one division for every two digits.
+static constexpr const char* printf_digit_pairs = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+// Everything is formatted into a buffer on the stack and handed to |write| a chunk at a time,
+// rather than a character at a time.
+template<typename WriteFunc>
+class PrintfChunker {
+public:
+    PrintfChunker(WriteFunc write, char*& bufptr)
+        : m_write(write)
+        , m_bufptr(bufptr)
+    {
     }
-    return ret;
-}
 
-template<typename PutChFunc>
-[[gnu::always_inline]] inline int print_number(PutChFunc putch, char*& bufptr, dword number, bool leftPad, bool zeroPad, dword fieldWidth)
-{
-    dword divisor = 1000000000;
-    char ch;
-    char padding = 1;
-    char buf[16];
-    char* p = buf;
-
-    for (;;) {
-        ch = '0' + (number / divisor);
-        number %= divisor;
-        if (ch != '0')
-            padding = 0;
-        if (!padding || divisor == 1)
-            *(p++) = ch;
-        if (divisor == 1)
-            break;
-        divisor /= 10;
+    void append(char ch)
+    {
+        if (m_size == capacity)
+            flush();
+        m_data[m_size++] = ch;
+        ++m_total;
     }
 
-    size_t numlen = p - buf;
-    if (!fieldWidth || fieldWidth < numlen)
-        fieldWidth = numlen;
-    if (!leftPad) {
-        for (unsigned i = 0; i < fieldWidth - numlen; ++i) {
-            putch(bufptr, zeroPad ? '0' : ' ');
+    void append(const char* chars, size_t length)
+    {
+        m_total += length;
+        while (length) {
+            if (m_size == capacity)
+                flush();
+            size_t count = capacity - m_size < length ? capacity - m_size : length;
+            for (size_t i = 0; i < count; ++i)
+                m_data[m_size + i] = chars[i];
+            m_size += count;
+            chars += count;
+            length -= count;
         }
     }
-    for (unsigned i = 0; i < numlen; ++i) {
-        putch(bufptr, buf[i]);
-    }
-    if (leftPad) {
-        for (unsigned i = 0; i < fieldWidth - numlen; ++i) {
-            putch(bufptr, ' ');
-        }
-    }
-
-    return fieldWidth;
-}
 
-template<typename PutChFunc>
-[[gnu::always_inline]] inline int print_qword(PutChFunc putch, char*& bufptr, qword number, bool leftPad, bool zeroPad, dword fieldWidth)
-{
-    qword divisor = 10000000000000000000LLU;
-    char ch;
-    char padding = 1;
-    char buf[16];
-    char* p = buf;
-
-    for (;;) {
-        ch = '0' + (number / divisor);
-        number %= divisor;
-        if (ch != '0')
-            padding = 0;
-        if (!padding || divisor == 1)
-            *(p++) = ch;
-        if (divisor == 1)
-            break;
-        divisor /= 10;
+    void append_repeated(char ch, size_t count)
+    {
+        for (; count; --count)
+            append(ch);
     }
 
-    size_t numlen = p - buf;
-    if (!fieldWidth || fieldWidth < numlen)
-        fieldWidth = numlen;
-    if (!leftPad) {
-        for (unsigned i = 0; i < fieldWidth - numlen; ++i) {
-            putch(bufptr, zeroPad ? '0' : ' ');
-        }
+    void flush()
+    {
+        if (!m_size)
+            return;
+        m_write(m_bufptr, m_data, m_size);
+        m_size = 0;
     }
-    for (unsigned i = 0; i < numlen; ++i) {
-        putch(bufptr, buf[i]);
+
+    int total() const { return m_total; }
+
+private:
+    static const size_t capacity = 128;
+
+    WriteFunc m_write;
+    char*& m_bufptr;
+    char m_data[capacity];
+    size_t m_size { 0 };
+    int m_total { 0 };
+};
+
+struct PrintfSpec {
+    bool left_justify { false };
+    bool zero_pad { false };
+    bool alternate_form { false };
+    unsigned width { 0 };
+    // How many digits at least, or how much of a string at most.
+    int precision { -1 };
+    unsigned long_qualifiers { 0 };
+};
+
+// These write the digits backwards, ending at |end|, and return where they start.
+[[gnu::always_inline]] inline char* format_decimal(char* end, dword number)
+{
+    while (number >= 100) {
+        const char* pair = &printf_digit_pairs[(number % 100) * 2];
+        number /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
     }
-    if (leftPad) {
-        for (unsigned i = 0; i < fieldWidth - numlen; ++i) {
-            putch(bufptr, ' ');
-        }
+    if (number >= 10) {
+        *--end = printf_digit_pairs[number * 2 + 1];
+        *--end = printf_digit_pairs[number * 2];
+    } else {
+        *--end = '0' + number;
     }
-
-    return fieldWidth;
+    return end;
 }
 
-template<typename PutChFunc>
-[[gnu::always_inline]] inline int print_octal_number(PutChFunc putch, char*& bufptr, dword number, bool leftPad, bool zeroPad, dword fieldWidth)
+inline char* format_decimal(char* end, qword number)
 {
-    dword divisor = 134217728;
-    char ch;
-    char padding = 1;
-    char buf[32];
-    char* p = buf;
-
-    for (;;) {
-        ch = '0' + (number / divisor);
-        number %= divisor;
-        if (ch != '0')
-            padding = 0;
-        if (!padding || divisor == 1)
-            *(p++) = ch;
-        if (divisor == 1)
-            break;
-        divisor /= 8;
-    }
-
-    size_t numlen = p - buf;
-    if (!fieldWidth || fieldWidth < numlen)
-        fieldWidth = numlen;
-    if (!leftPad) {
-        for (unsigned i = 0; i < fieldWidth - numlen; ++i) {
-            putch(bufptr, zeroPad ? '0' : ' ');
-        }
-    }
-    for (unsigned i = 0; i < numlen; ++i) {
-        putch(bufptr, buf[i]);
-    }
-    if (leftPad) {
-        for (unsigned i = 0; i < fieldWidth - numlen; ++i) {
-            putch(bufptr, ' ');
-        }
+    // Dividing 64-bit numbers is slow on i386, so it's done only to split off nine digits at a time.
+    while (number > 0xffffffff) {
+        char* group_end = end - 9;
+        char* start = format_decimal(end, (dword)(number % 1000000000));
+        while (start > group_end)
+            *--start = '0';
+        number /= 1000000000;
+        end = group_end;
     }
+    return format_decimal(end, (dword)number);
+}
 
-    return fieldWidth;
+template<typename T>
+[[gnu::always_inline]] inline char* format_hex(char* end, T number, int min_digits)
+{
+    char* p = end;
+    do {
+        *--p = h[number & 0xf];
+        number >>= 4;
+    } while (number);
+    while (end - p < min_digits)
+        *--p = '0';
+    return p;
 }
 
-template<typename PutChFunc>
-[[gnu::always_inline]] inline int print_string(PutChFunc putch, char*& bufptr, const char* str, bool leftPad, dword fieldWidth)
+[[gnu::always_inline]] inline char* format_octal(char* end, dword number)
 {
-    size_t len = strlen(str);
-    if (!fieldWidth || fieldWidth < len)
-        fieldWidth = len;
-    if (!leftPad) {
-        for (unsigned i = 0; i < fieldWidth - len; ++i)
-            putch(bufptr, ' ');
-    }
-    for (unsigned i = 0; i < len; ++i) {
-        putch(bufptr, str[i]);
-    }
-    if (leftPad) {
-        for (unsigned i = 0; i < fieldWidth - len; ++i)
-            putch(bufptr, ' ');
-    }
-    return fieldWidth;
+    do {
+        *--end = '0' + (number & 7);
+        number >>= 3;
+    } while (number);
+    return end;
 }
 
+// Lays out |prefix| (a sign or "0x") and the digits from |digits| to |end| in the field.
+template<typename Chunker>
+inline void print_formatted_number(Chunker& out, const PrintfSpec& spec, const char* prefix, const char* digits, const char* end)
+{
+    size_t digit_count = end - digits;
+    size_t prefix_length = strlen(prefix);
+    size_t precision_zeros = spec.precision > 0 && (size_t)spec.precision > digit_count ? spec.precision - digit_count : 0;
+    size_t length = prefix_length + precision_zeros + digit_count;
+    size_t padding = spec.width > length ? spec.width - length : 0;
+
+    bool pads_with_zeros = spec.zero_pad && !spec.left_justify && spec.precision < 0;
+    if (!spec.left_justify && !pads_with_zeros)
+        out.append_repeated(' ', padding);
+    out.append(prefix, prefix_length);
+    if (pads_with_zeros)
+        out.append_repeated('0', padding);
+    out.append_repeated('0', precision_zeros);
+    out.append(digits, digit_count);
+    if (spec.left_justify)
+        out.append_repeated(' ', padding);
+}
 
-template<typename PutChFunc>
-[[gnu::always_inline]] inline int print_signed_number(PutChFunc putch, char*& bufptr, int number, bool leftPad, bool zeroPad, dword fieldWidth)
+template<typename Chunker>
+inline void print_string(Chunker& out, const PrintfSpec& spec, const char* str)
 {
-    if (number < 0) {
-        putch(bufptr, '-');
-        return print_number(putch, bufptr, 0 - number, leftPad, zeroPad, fieldWidth) + 1;
+    size_t length = 0;
+    if (spec.precision >= 0) {
+        while (length < (size_t)spec.precision && str[length])
+            ++length;
+    } else {
+        length = strlen(str);
     }
-    return print_number(putch, bufptr, number, leftPad, zeroPad, fieldWidth);
+    size_t padding = spec.width > length ? spec.width - length : 0;
+    if (!spec.left_justify)
+        out.append_repeated(' ', padding);
+    out.append(str, length);
+    if (spec.left_justify)
+        out.append_repeated(' ', padding);
 }
 
-template<typename PutChFunc>
-[[gnu::always_inline]] inline int printf_internal(PutChFunc putch, char* buffer, const char*& fmt, char*& ap)
+// |write| is called as write(bufptr, characters, length), with |bufptr| starting out as |buffer|.
+template<typename WriteFunc>
+inline int printf_chunked(WriteFunc write, char* buffer, const char*& fmt, char*& ap)
 {
-    const char *p;
-
-    int ret = 0;
     char* bufptr = buffer;
-
-    for (p = fmt; *p; ++p) {
-        bool leftPad = false;
-        bool zeroPad = false;
-        unsigned fieldWidth = 0;
-        unsigned long_qualifiers = 0;
-        bool alternate_form = 0;
-        if (*p == '%' && *(p + 1)) {
-one_more:
-            ++p;
-            if (*p == ' ') {
-                leftPad = true;
-                if (*(p + 1))
-                    goto one_more;
-            }
-            if (!zeroPad && !fieldWidth && *p == '0') {
-                zeroPad = true;
-                if (*(p + 1))
-                    goto one_more;
-            }
-            if (*p >= '0' && *p <= '9') {
-                fieldWidth *= 10;
-                fieldWidth += *p - '0';
-                if (*(p + 1))
-                    goto one_more;
-            }
-            if (*p == 'l') {
-                ++long_qualifiers;
-                if (*(p + 1))
-                    goto one_more;
+    PrintfChunker<WriteFunc> out(write, bufptr);
+    // Enough for a qword in octal, or in decimal with a sign.
+    char digits[24];
+    char* end = digits + sizeof(digits);
+
+    for (const char* p = fmt; *p;) {
+        if (*p != '%' || !p[1]) {
+            const char* run = p;
+            while (*p && (*p != '%' || !p[1]))
+                ++p;
+            out.append(run, p - run);
+            continue;
+        }
+        ++p;
+
+        PrintfSpec spec;
+        for (;; ++p) {
+            // A space means left-justified here, which is how it's always been.
+            if (*p == '-' || *p == ' ')
+                spec.left_justify = true;
+            else if (*p == '0')
+                spec.zero_pad = true;
+            else if (*p == '#')
+                spec.alternate_form = true;
+            else
+                break;
+        }
+        if (*p == '*') {
+            int width = va_arg(ap, int);
+            if (width < 0) {
+                spec.left_justify = true;
+                width = -width;
             }
-            if (*p == '#') {
-                alternate_form = true;
-                if (*(p + 1))
-                    goto one_more;
+            spec.width = width;
+            ++p;
+        } else {
+            for (; *p >= '0' && *p <= '9'; ++p)
+                spec.width = spec.width * 10 + (*p - '0');
+        }
+        if (*p == '.') {
+            ++p;
+            spec.precision = 0;
+            if (*p == '*') {
+                spec.precision = va_arg(ap, int);
+                ++p;
+            } else {
+                for (; *p >= '0' && *p <= '9'; ++p)
+                    spec.precision = spec.precision * 10 + (*p - '0');
             }
-            switch( *p )
-            {
-                case 's':
-                    {
-                        const char* sp = va_arg(ap, const char*);
-                        ret += print_string(putch, bufptr, sp ? sp : "(null)", leftPad, fieldWidth);
-                    }
-                    break;
-
-                case 'd':
-                    ret += print_signed_number(putch, bufptr, va_arg(ap, int), leftPad, zeroPad, fieldWidth);
-                    break;
-
-                case 'u':
-                    ret += print_number(putch, bufptr, va_arg(ap, dword), leftPad, zeroPad, fieldWidth);
-                    break;
-
-                case 'Q':
-                    ret += print_qword(putch, bufptr, va_arg(ap, qword), leftPad, zeroPad, fieldWidth);
-                    break;
-
-                case 'q':
-                    ret += print_hex(putch, bufptr, va_arg(ap, qword), 16);
-                    break;
-
-                case 'f':
-                    // FIXME: Print as float!
-                    ret += print_number(putch, bufptr, (int)va_arg(ap, double), leftPad, zeroPad, fieldWidth);
-                    break;
-
-                case 'o':
-                    if (alternate_form) {
-                        putch(bufptr, '0');
-                        ++ret;
-                    }
-                    ret += print_octal_number(putch, bufptr, va_arg(ap, dword), leftPad, zeroPad, fieldWidth);
-                    break;
-
-                case 'x':
-                    if (alternate_form) {
-                        putch(bufptr, '0');
-                        putch(bufptr, 'x');
-                        ret += 2;
-                    }
-                    ret += print_hex(putch, bufptr, va_arg(ap, dword), 8);
-                    break;
-
-                case 'w':
-                    ret += print_hex(putch, bufptr, va_arg(ap, int), 4);
-                    break;
-
-                case 'b':
-                    ret += print_hex(putch, bufptr, va_arg(ap, int), 2);
-                    break;
-
-                case 'c':
-                    putch(bufptr, (char)va_arg(ap, int));
-                    ++ret;
-                    break;
-
-                case '%':
-                    putch(bufptr, '%');
-                    ++ret;
-                    break;
-
-                case 'p':
-                    putch(bufptr, '0');
-                    putch(bufptr, 'x');
-                    ret += 2;
-                    ret += print_hex(putch, bufptr, va_arg(ap, dword), 8);
-                    break;
+        }
+        for (;; ++p) {
+            if (*p == 'l')
+                ++spec.long_qualifiers;
+            else if (*p != 'h' && *p != 'z')
+                break;
+        }
+        if (!*p)
+            break;
+
+        bool is_qword = spec.long_qualifiers >= 2;
+        switch (*p++) {
+        case 's': {
+            const char* sp = va_arg(ap, const char*);
+            print_string(out, spec, sp ? sp : "(null)");
+            break;
+        }
+        case 'd':
+        case 'i': {
+            const char* sign = "";
+            char* start;
+            if (is_qword) {
+                long long number = va_arg(ap, long long);
+                if (number < 0)
+                    sign = "-";
+                start = format_decimal(end, number < 0 ? 0 - (qword)number : (qword)number);
+            } else {
+                int number = va_arg(ap, int);
+                if (number < 0)
+                    sign = "-";
+                start = format_decimal(end, number < 0 ? 0 - (dword)number : (dword)number);
             }
+            print_formatted_number(out, spec, sign, start, end);
+            break;
         }
-        else {
-            putch(bufptr, *p);
-            ++ret;
+        case 'u':
+            if (is_qword)
+                print_formatted_number(out, spec, "", format_decimal(end, va_arg(ap, qword)), end);
+            else
+                print_formatted_number(out, spec, "", format_decimal(end, va_arg(ap, dword)), end);
+            break;
+
+        case 'Q':
+            print_formatted_number(out, spec, "", format_decimal(end, va_arg(ap, qword)), end);
+            break;
+
+        case 'q':
+            out.append(format_hex(end, va_arg(ap, qword), 16), 16);
+            break;
+
+        case 'f':
+            // FIXME: Print as float!
+            print_formatted_number(out, spec, "", format_decimal(end, (dword)(int)va_arg(ap, double)), end);
+            break;
+
+        case 'o':
+            print_formatted_number(out, spec, spec.alternate_form ? "0" : "", format_octal(end, va_arg(ap, dword)), end);
+            break;
+
+        case 'x': {
+            // Without a width or precision, it's all the digits there are room for.
+            int min_digits = (spec.width || spec.precision >= 0) ? 1 : (is_qword ? 16 : 8);
+            char* start = is_qword ? format_hex(end, va_arg(ap, qword), min_digits) : format_hex(end, va_arg(ap, dword), min_digits);
+            print_formatted_number(out, spec, spec.alternate_form ? "0x" : "", start, end);
+            break;
+        }
+        case 'w':
+            out.append(format_hex(end, (word)va_arg(ap, int), 4), 4);
+            break;
+
+        case 'b':
+            out.append(format_hex(end, (byte)va_arg(ap, int), 2), 2);
+            break;
+
+        case 'c': {
+            char ch = (char)va_arg(ap, int);
+            print_formatted_number(out, spec, "", &ch, &ch + 1);
+            break;
+        }
+        case '%':
+            out.append('%');
+            break;
+
+        case 'p':
+            out.append("0x", 2);
+            out.append(format_hex(end, va_arg(ap, dword), 8), 8);
+            break;
         }
     }
-    return ret;
+    out.flush();
+    return out.total();
 }
 
-
+template<typename PutChFunc>
+inline int printf_internal(PutChFunc putch, char* buffer, const char*& fmt, char*& ap)
+{
+    return printf_chunked([&putch] (char*& bufptr, const char* chars, size_t length) {
+        for (size_t i = 0; i < length; ++i)
+            putch(bufptr, chars[i]);
+    }, buffer, fmt, ap);
+}
@@ -2,49 +2,64 @@
 #include <dirent.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
 #include <grp.h>
 #include <pwd.h>
 #include <AK/FileSystemPath.h>
 #include <AK/StringBuilder.h>
 #include <SharedGraphics/GraphicsBitmap.h>
+#include <SharedGraphics/ImageDecoder.h>
 #include <LibGUI/GPainter.h>
 #include <LibGUI/GLock.h>
+#include <LibGUI/GElapsedTimer.h>
 
-static GLockable<HashMap<String, RetainPtr<GraphicsBitmap>>>& thumbnail_cache()
+struct Thumbnail {
+    RetainPtr<GraphicsBitmap> bitmap;
+    time_t mtime { 0 };
+    bool is_pending { true };
+};
+
+static GLockable<HashMap<String, Thumbnail>>& thumbnail_cache()
 {
-    static GLockable<HashMap<String, RetainPtr<GraphicsBitmap>>>* s_map;
+    static GLockable<HashMap<String, Thumbnail>>* s_map;
     if (!s_map)
-        s_map = new GLockable<HashMap<String, RetainPtr<GraphicsBitmap>>>();
+        s_map = new GLockable<HashMap<String, Thumbnail>>();
     return *s_map;
 }
 
+static const Size thumbnail_size { 32, 32 };
+
 int thumbnail_thread(void* model_ptr)
 {
     auto& model = *(DirectoryModel*)model_ptr;
     for (;;) {
         sleep(1);
         Vector<String> to_generate;
+        Vector<time_t> mtimes;
         {
             LOCKER(thumbnail_cache().lock());
             for (auto& it : thumbnail_cache().resource()) {
-                if (it.value)
+                if (!it.value.is_pending)
                     continue;
                 to_generate.append(it.key);
+                mtimes.append(it.value.mtime);
             }
         }
         if (to_generate.is_empty())
             continue;
         for (int i = 0; i < to_generate.size(); ++i) {
             auto& path = to_generate[i];
-            auto png_bitmap = GraphicsBitmap::load_from_file(path);
-            if (!png_bitmap)
-                continue;
-            auto thumbnail = GraphicsBitmap::create(png_bitmap->format(), { 32, 32 });
-            Painter painter(*thumbnail);
-            painter.draw_scaled_bitmap(thumbnail->rect(), *png_bitmap, png_bitmap->rect());
+            // ImageDecoder keeps them in the shared store, so they outlive the process.
+            auto thumbnail = ImageDecoder::decode(path, thumbnail_size);
             {
                 LOCKER(thumbnail_cache().lock());
-                thumbnail_cache().resource().set(path, move(thumbnail));
+                auto it = thumbnail_cache().resource().find(path);
+                // The file may have changed again while we were at it; then it's pending once more.
+                if (it != thumbnail_cache().resource().end() && (*it).value.mtime == mtimes[i]) {
+                    (*it).value.bitmap = move(thumbnail);
+                    (*it).value.is_pending = false;
+                }
             }
             if (model.on_thumbnail_progress)
                 model.on_thumbnail_progress(i + 1, to_generate.size());
@@ -73,10 +88,16 @@ DirectoryModel::DirectoryModel()
     while (auto* group = getgrent())
         m_group_names.set(group->gr_gid, group->gr_name);
     endgrent();
+
+    m_load_timer.set_interval(0);
+    m_load_timer.on_timeout = [this] {
+        load_more_entries();
+    };
 }
 
 DirectoryModel::~DirectoryModel()
 {
+    stop_loading();
 }
 
 int DirectoryModel::row_count(const GModelIndex&) const
@@ -127,20 +148,28 @@ GIcon DirectoryModel::icon_for(const Entry& entry) const
         return m_socket_icon;
     if (entry.mode & S_IXUSR)
         return m_executable_icon;
-    if (entry.name.to_lowercase().ends_with(".png")) {
-        if (!entry.thumbnail) {
+    if (entry.is_png) {
+        if (entry.thumbnail_icon)
+            return GIcon(*entry.thumbnail_icon);
+        RetainPtr<GraphicsBitmap> thumbnail;
+        {
             auto path = entry.full_path(*this);
             LOCKER(thumbnail_cache().lock());
             auto it = thumbnail_cache().resource().find(path);
-            if (it != thumbnail_cache().resource().end()) {
-                entry.thumbnail = (*it).value.copy_ref();
-            } else {
-                thumbnail_cache().resource().set(path, nullptr);
+            if (it == thumbnail_cache().resource().end() || (*it).value.mtime != entry.mtime) {
+                Thumbnail pending;
+                pending.mtime = entry.mtime;
+                thumbnail_cache().resource().set(path, move(pending));
+            } else if ((*it).value.bitmap) {
+                thumbnail = (*it).value.bitmap.copy_ref();
             }
         }
-        if (!entry.thumbnail)
+        if (!thumbnail)
             return m_filetype_image_icon;
-        return GIcon(m_filetype_image_icon.bitmap_for_size(16), *entry.thumbnail);
+        // Put together once, then handed out for every paint.
+        GIcon icon(m_filetype_image_icon.bitmap_for_size(16), move(thumbnail));
+        entry.thumbnail_icon = const_cast<GIconImpl*>(&icon.impl());
+        return icon;
     }
     return m_file_icon;
 }
@@ -232,44 +261,98 @@ GVariant DirectoryModel::data(const GModelIndex& index, Role role) const
     return { };
 }
 
-void DirectoryModel::update()
-{
-    DIR* dirp = opendir(m_path.characters());
-    if (!dirp) {
-        perror("opendir");
-        exit(1);
-    }
-    m_directories.clear();
-    m_files.clear();
+// How long one slice of a directory may keep the event loop from everything else.
+static const int load_slice_in_ms = 10;
 
-    m_bytes_in_files = 0;
-    while (auto* de = readdir(dirp)) {
+// Reads on from m_loading_directory until it's done or the slice is used up. Returns true when it's done.
+bool DirectoryModel::read_entries(Vector<Entry>& directories, Vector<Entry>& files)
+{
+    GElapsedTimer slice_timer;
+    slice_timer.start();
+    struct stat st;
+    for (int entries_read = 1;; ++entries_read) {
+        // readdir_with_stat() gets a whole buffer of entries and their metadata per syscall.
+        auto* de = readdir_with_stat(m_loading_directory, &st);
+        if (!de)
+            return true;
         Entry entry;
         entry.name = de->d_name;
         if (entry.name == "." || entry.name == "..")
             continue;
-        struct stat st;
-        int rc = lstat(String::format("%s/%s", m_path.characters(), de->d_name).characters(), &st);
-        if (rc < 0) {
-            perror("lstat");
-            continue;
-        }
         entry.size = st.st_size;
         entry.mode = st.st_mode;
         entry.uid = st.st_uid;
         entry.gid = st.st_gid;
         entry.inode = st.st_ino;
-        auto& entries = S_ISDIR(st.st_mode) ? m_directories : m_files;
-        entries.append(move(entry));
-
+        entry.mtime = st.st_mtime;
+        entry.is_png = S_ISREG(entry.mode) && entry.name.to_lowercase().ends_with(".png");
         if (S_ISREG(entry.mode))
             m_bytes_in_files += st.st_size;
+        auto& entries = S_ISDIR(st.st_mode) ? directories : files;
+        entries.append(move(entry));
+
+        if (!(entries_read % 64) && slice_timer.elapsed() >= load_slice_in_ms)
+            return false;
     }
-    closedir(dirp);
+}
 
+void DirectoryModel::stop_loading()
+{
+    m_load_timer.stop();
+    if (m_loading_directory) {
+        closedir(m_loading_directory);
+        m_loading_directory = nullptr;
+    }
+}
+
+void DirectoryModel::update()
+{
+    stop_loading();
+    m_loading_directory = opendir(m_path.characters());
+    if (!m_loading_directory) {
+        perror("opendir");
+        exit(1);
+    }
+    m_directories.clear();
+    m_files.clear();
+    m_bytes_in_files = 0;
+
+    bool done = read_entries(m_directories, m_files);
+    if (done)
+        stop_loading();
+    else
+        m_load_timer.start();
     did_update();
 }
 
+void DirectoryModel::load_more_entries()
+{
+    // A timer event may still have been queued when loading stopped.
+    if (!m_loading_directory)
+        return;
+    Vector<Entry> directories;
+    Vector<Entry> files;
+    if (read_entries(directories, files))
+        stop_loading();
+
+    // Directories come first, so they go in at the end of the directories and files at the very end.
+    if (!directories.is_empty()) {
+        int first_row = m_directories.size();
+        for (auto& entry : directories)
+            m_directories.append(move(entry));
+        did_insert_rows(first_row, directories.size());
+    }
+    if (!files.is_empty()) {
+        int first_row = row_count();
+        for (auto& entry : files)
+            m_files.append(move(entry));
+        did_insert_rows(first_row, files.size());
+    }
+    // Let the views know the listing is complete even if the last slice came up empty.
+    if (!m_loading_directory && directories.is_empty() && files.is_empty())
+        did_update();
+}
+
 void DirectoryModel::open(const String& a_path)
 {
     FileSystemPath canonical_path(a_path);
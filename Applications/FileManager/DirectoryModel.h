@@ -1,8 +1,10 @@
 #pragma once
 
 #include <LibGUI/GModel.h>
+#include <LibGUI/GTimer.h>
 #include <AK/HashMap.h>
 #include <sys/stat.h>
+#include <dirent.h>
 
 class DirectoryModel final : public GModel {
     friend int thumbnail_thread(void*);
@@ -32,6 +34,7 @@ public:
     String path() const { return m_path; }
     void open(const String& path);
     size_t bytes_in_files() const { return m_bytes_in_files; }
+    bool is_loading() const { return m_loading_directory; }
 
     Function<void(int done, int total)> on_thumbnail_progress;
 
@@ -48,7 +51,9 @@ private:
         uid_t uid { 0 };
         uid_t gid { 0 };
         ino_t inode { 0 };
-        mutable RetainPtr<GraphicsBitmap> thumbnail;
+        time_t mtime { 0 };
+        bool is_png { false };
+        mutable RetainPtr<GIconImpl> thumbnail_icon;
         bool is_directory() const { return S_ISDIR(mode); }
         bool is_executable() const { return mode & S_IXUSR; }
         String full_path(const DirectoryModel& model) const { return String::format("%s/%s", model.path().characters(), name.characters()); }
@@ -62,10 +67,18 @@ private:
     }
     GIcon icon_for(const Entry& entry) const;
 
+    bool read_entries(Vector<Entry>& directories, Vector<Entry>& files);
+    void load_more_entries();
+    void stop_loading();
+
     String m_path;
     Vector<Entry> m_files;
     Vector<Entry> m_directories;
-    size_t m_bytes_in_files;
+    size_t m_bytes_in_files { 0 };
+
+    // Big directories are read a slice at a time from the event loop, so their entries show up as they come in.
+    DIR* m_loading_directory { nullptr };
+    GTimer m_load_timer;
 
     GIcon m_directory_icon;
     GIcon m_file_icon;
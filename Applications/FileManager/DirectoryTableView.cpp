@@ -16,16 +16,19 @@ DirectoryView::DirectoryView(GWidget* parent)
 
     m_item_view->set_model_column(DirectoryModel::Column::Name);
 
-    m_item_view->on_model_notification = [this] (const GModelNotification& notification) {
-        if (notification.type() == GModelNotification::Type::ModelUpdated) {
-            set_status_message(String::format("%d item%s (%u byte%s)",
-                                              model().row_count(),
-                                              model().row_count() != 1 ? "s" : "",
-                                              model().bytes_in_files(),
-                                              model().bytes_in_files() != 1 ? "s" : ""));
+    // Entries keep streaming in after a directory is opened, so keep the status current on every change.
+    m_item_view->on_model_notification = [this] (const GModelNotification&) {
+        set_status_message(String::format("%d item%s (%u byte%s)%s",
+                                          model().row_count(),
+                                          model().row_count() != 1 ? "s" : "",
+                                          model().bytes_in_files(),
+                                          model().bytes_in_files() != 1 ? "s" : "",
+                                          model().is_loading() ? "..." : ""));
 
+        if (model().path() != m_reported_path) {
+            m_reported_path = model().path();
             if (on_path_change)
-                on_path_change(model().path());
+                on_path_change(m_reported_path);
         }
     };
 
@@ -32,6 +32,7 @@ private:
     void set_status_message(const String&);
 
     ViewMode m_view_mode { Invalid };
+    String m_reported_path;
 
     Retained<DirectoryModel> m_model;
 
@@ -1,6 +1,7 @@
 #include "FontEditor.h"
 #include <LibGUI/GPainter.h>
 #include <LibGUI/GButton.h>
+#include <LibGUI/GFontDatabase.h>
 #include <LibGUI/GLabel.h>
 #include <LibGUI/GTextBox.h>
 #include <LibGUI/GCheckBox.h>
@@ -46,7 +47,8 @@ FontEditorWidget::FontEditorWidget(const String& path, RetainPtr<Font>&& edited_
     save_button->set_relative_rect({ 5, 270, 100, 20 });
     save_button->on_click = [this] (GButton&) {
         dbgprintf("write to file: '%s'\n", m_path.characters());
-        m_edited_font->write_to_file(m_path);
+        if (m_edited_font->write_to_file(m_path))
+            GFontDatabase::did_change_font_files();
     };
 
     auto* quit_button = new GButton(this);
@@ -23,21 +23,47 @@ Retained<IRCChannel> IRCChannel::create(IRCClient& client, const String& name)
     return adopt(*new IRCChannel(client, name));
 }
 
-void IRCChannel::add_member(const String& name, char prefix)
+// Returns true if |name| wasn't a member before.
+bool IRCChannel::add_or_update_member(const FlyString& name, char prefix)
 {
-    for (auto& member : m_members) {
-        if (member.name == name) {
-            member.prefix = prefix;
-            return;
-        }
+    auto it = m_member_indices.find(name);
+    if (it != m_member_indices.end()) {
+        m_members[(*it).value].prefix = prefix;
+        return false;
     }
+    m_member_indices.set(name, m_members.size());
     m_members.append({ name, prefix });
-    m_member_model->update();
+    return true;
+}
+
+void IRCChannel::add_member(const String& name, char prefix)
+{
+    if (add_or_update_member(name, prefix))
+        m_member_model->update();
+}
+
+void IRCChannel::add_members(const Vector<StringView, 64>& names)
+{
+    for (auto& name : names) {
+        if (name.is_empty())
+            continue;
+        char prefix = 0;
+        if (m_client.is_nick_prefix(name[0]))
+            prefix = name[0];
+        add_or_update_member(FlyString(name), prefix);
+    }
 }
 
 void IRCChannel::remove_member(const String& name)
 {
-    m_members.remove_first_matching([&] (auto& member) { return name == member.name; });
+    auto it = m_member_indices.find(name);
+    if (it == m_member_indices.end())
+        return;
+    int index = (*it).value;
+    m_member_indices.remove(it);
+    m_members.remove(index);
+    for (int i = index; i < m_members.size(); ++i)
+        m_member_indices.set(m_members[i].name, i);
 }
 
 void IRCChannel::add_message(char prefix, const String& name, const String& text, Color color)
@@ -78,6 +104,7 @@ void IRCChannel::handle_part(const String& nick, const String& hostmask)
     if (nick == m_client.nickname()) {
         m_open = false;
         m_members.clear();
+        m_member_indices.clear();
     } else {
         remove_member(nick);
     }
@@ -95,12 +122,14 @@ void IRCChannel::handle_topic(const String& nick, const String& topic)
 
 void IRCChannel::notify_nick_changed(const String& old_nick, const String& new_nick)
 {
-    for (auto& member : m_members) {
-        if (member.name == old_nick) {
-            member.name = new_nick;
-            add_message(String::format("~ %s changed nickname to %s", old_nick.characters(), new_nick.characters()), Color::MidMagenta);
-            m_member_model->update();
-            return;
-        }
-    }
+    auto it = m_member_indices.find(old_nick);
+    if (it == m_member_indices.end())
+        return;
+    int index = (*it).value;
+    m_member_indices.remove(it);
+    FlyString fly_new_nick = new_nick;
+    m_members[index].name = fly_new_nick;
+    m_member_indices.set(fly_new_nick, index);
+    add_message(String::format("~ %s changed nickname to %s", old_nick.characters(), new_nick.characters()), Color::MidMagenta);
+    m_member_model->update();
 }
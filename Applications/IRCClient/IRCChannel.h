@@ -1,6 +1,8 @@
 #pragma once
 
 #include <AK/AKString.h>
+#include <AK/FlyString.h>
+#include <AK/HashMap.h>
 #include <AK/CircularQueue.h>
 #include <AK/Vector.h>
 #include <AK/Retainable.h>
@@ -11,7 +13,7 @@ class IRCClient;
 class IRCChannelMemberListModel;
 class IRCWindow;
 
-class IRCChannel : public Retainable<IRCChannel> {
+class IRCChannel : public SingleThreadedRetainable<IRCChannel> {
 public:
     static Retained<IRCChannel> create(IRCClient&, const String&);
     ~IRCChannel();
@@ -22,6 +24,8 @@ public:
     String name() const { return m_name; }
 
     void add_member(const String& name, char prefix);
+    // Adds everyone in a NAMES reply. The member model isn't updated, that's for when all the replies are in.
+    void add_members(const Vector<StringView, 64>& names);
     void remove_member(const String& name);
 
     void add_message(char prefix, const String& name, const String& text, Color = Color::Black);
@@ -38,7 +42,7 @@ public:
     const IRCChannelMemberListModel* member_model() const { return m_member_model.ptr(); }
 
     int member_count() const { return m_members.size(); }
-    String member_at(int i) { return m_members[i].name; }
+    String member_at(int i) { return m_members[i].name.string(); }
 
     void handle_join(const String& nick, const String& hostmask);
     void handle_part(const String& nick, const String& hostmask);
@@ -58,10 +62,15 @@ private:
     String m_name;
     String m_topic;
     struct Member {
-        String name;
+        // Interned, since looking someone up compares against everyone in the channel.
+        FlyString name;
         char prefix { 0 };
     };
+    bool add_or_update_member(const FlyString& name, char prefix);
+
     Vector<Member> m_members;
+    // Where each member is in m_members.
+    HashMap<FlyString, int> m_member_indices;
     bool m_open { false };
 
     Retained<IRCLogBuffer> m_log;
@@ -1,5 +1,6 @@
 #include "IRCClient.h"
 #include "IRCChannel.h"
+#include "IRCChannelMemberListModel.h"
 #include "IRCQuery.h"
 #include "IRCLogBuffer.h"
 #include "IRCWindow.h"
@@ -9,7 +10,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #define IRC_DEBUG
@@ -46,107 +49,110 @@ bool IRCClient::connect()
     if (m_socket->is_connected())
         ASSERT_NOT_REACHED();
 
+    m_socket->on_connected = [this] {
+        m_notifier = make<GNotifier>(m_socket->fd(), GNotifier::Read);
+        m_notifier->on_ready_to_read = [this] (GNotifier&) { receive_from_server(); };
+        if (on_connect)
+            on_connect();
+    };
+    m_socket->on_connection_failed = [this] (int error) {
+        printf("IRCClient: Connecting to %s:%d failed: %s\n", m_hostname.characters(), m_port, strerror(error));
+        if (on_disconnect)
+            on_disconnect();
+    };
+
     IPv4Address ipv4_address(127, 0, 0, 1);
     bool success = m_socket->connect(GSocketAddress(ipv4_address), m_port);
     if (!success)
         return false;
 
-    m_notifier = make<GNotifier>(m_socket->fd(), GNotifier::Read);
-    m_notifier->on_ready_to_read = [this] (GNotifier&) { receive_from_server(); };
-
+    // These wait in the socket's send queue until it's connected.
     send_user();
     send_nick();
-
-    if (on_connect)
-        on_connect();
     return true;
 }
 
 void IRCClient::receive_from_server()
 {
-    while (m_socket->can_read_line()) {
-        auto line = m_socket->read_line(4096);
-        if (line.is_null()) {
-            if (!m_socket->is_connected()) {
-                printf("IRCClient: Connection closed!\n");
-                exit(1);
-            }
-            ASSERT_NOT_REACHED();
-        }
-        process_line(move(line));
+    // Everything goes into one buffer, and each line is parsed right where it lies in it.
+    static const int read_size = 16384;
+    // Lines are at most 512 bytes by the RFC, so anything this long without a newline is garbage.
+    static const int max_line_length = 65536;
+    if (m_receive_buffer.size() < m_receive_buffer_used + read_size)
+        m_receive_buffer.resize(m_receive_buffer_used + read_size);
+    ssize_t nread = read(m_socket->fd(), m_receive_buffer.data() + m_receive_buffer_used, read_size);
+    if (nread < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return;
+        perror("read");
+        exit(1);
+    }
+    if (nread == 0) {
+        printf("IRCClient: Connection closed!\n");
+        exit(1);
+    }
+    m_receive_buffer_used += nread;
+
+    const char* data = m_receive_buffer.data();
+    int line_start = 0;
+    for (;;) {
+        auto* newline = (const char*)memchr(data + line_start, '\n', m_receive_buffer_used - line_start);
+        if (!newline)
+            break;
+        int line_end = newline - data;
+        int length = line_end - line_start;
+        if (length && data[line_end - 1] == '\r')
+            --length;
+        process_line({ data + line_start, length });
+        line_start = line_end + 1;
+    }
+
+    // What's left is the start of a line that's still on its way.
+    if (!line_start && m_receive_buffer_used >= max_line_length) {
+        printf("IRCClient: Dropping a %d byte line without an end\n", m_receive_buffer_used);
+        m_receive_buffer_used = 0;
+        return;
+    }
+    if (line_start) {
+        memmove(m_receive_buffer.data(), data + line_start, m_receive_buffer_used - line_start);
+        m_receive_buffer_used -= line_start;
     }
 }
 
-void IRCClient::process_line(ByteBuffer&& line)
+void IRCClient::process_line(const StringView& line)
 {
     Message msg;
-    Vector<char> prefix;
-    Vector<char> command;
-    Vector<char> current_parameter;
-    enum {
-        Start,
-        InPrefix,
-        InCommand,
-        InStartOfParameter,
-        InParameter,
-        InTrailingParameter,
-    } state = Start;
-
-    for (int i = 0; i < line.size(); ++i) {
-        char ch = line[i];
-        if (ch == '\r')
-            continue;
-        if (ch == '\n')
+    const char* p = line.characters();
+    const char* end = p + line.length();
+    auto take_word = [&] {
+        const char* start = p;
+        while (p < end && *p != ' ')
+            ++p;
+        StringView word(start, p - start);
+        while (p < end && *p == ' ')
+            ++p;
+        return word;
+    };
+
+    if (p < end && *p == ':') {
+        ++p;
+        msg.prefix = take_word();
+        int nick_length = 0;
+        while (nick_length < msg.prefix.length() && msg.prefix[nick_length] != '!')
+            ++nick_length;
+        msg.nick = msg.prefix.substring_view(0, nick_length);
+    }
+    msg.command = take_word();
+    while (p < end) {
+        if (*p == ':') {
+            ++p;
+            if (p < end)
+                msg.arguments.append({ p, end - p });
             break;
-        switch (state) {
-        case Start:
-            if (ch == ':') {
-                state = InPrefix;
-                continue;
-            }
-            state = InCommand;
-            [[fallthrough]];
-        case InCommand:
-            if (ch == ' ') {
-                state = InStartOfParameter;
-                continue;
-            }
-            command.append(ch);
-            continue;
-        case InPrefix:
-            if (ch == ' ') {
-                state = InCommand;
-                continue;
-            }
-            prefix.append(ch);
-            continue;
-        case InStartOfParameter:
-            if (ch == ':') {
-                state = InTrailingParameter;
-                continue;
-            }
-            state = InParameter;
-            [[fallthrough]];
-        case InParameter:
-            if (ch == ' ') {
-                if (!current_parameter.is_empty())
-                    msg.arguments.append(String(current_parameter.data(), current_parameter.size()));
-                current_parameter.clear_with_capacity();
-                state = InStartOfParameter;
-                continue;
-            }
-            current_parameter.append(ch);
-            continue;
-        case InTrailingParameter:
-            current_parameter.append(ch);
-            continue;
         }
+        msg.arguments.append(take_word());
     }
-    if (!current_parameter.is_empty())
-        msg.arguments.append(String(current_parameter.data(), current_parameter.size()));
-    msg.prefix = String(prefix.data(), prefix.size());
-    msg.command = String(command.data(), command.size());
-    handle(msg, String(m_line_buffer.data(), m_line_buffer.size()));
+    handle(msg, line);
 }
 
 void IRCClient::send(const String& text)
@@ -188,26 +194,38 @@ void IRCClient::send_whois(const String& nick)
     send(String::format("WHOIS %s\r\n", nick.characters()));
 }
 
-void IRCClient::handle(const Message& msg, const String&)
+// Replies from the server are three digit numbers.
+static bool parse_numeric(const StringView& command, int& numeric)
+{
+    if (command.length() != 3)
+        return false;
+    numeric = 0;
+    for (int i = 0; i < 3; ++i) {
+        if (command[i] < '0' || command[i] > '9')
+            return false;
+        numeric = numeric * 10 + command[i] - '0';
+    }
+    return true;
+}
+
+void IRCClient::handle(const Message& msg, const StringView&)
 {
 #ifdef IRC_DEBUG
-    printf("IRCClient::execute: prefix='%s', command='%s', arguments=%d\n",
-        msg.prefix.characters(),
-        msg.command.characters(),
+    printf("IRCClient::execute: prefix='%.*s', command='%.*s', arguments=%d\n",
+        (int)msg.prefix.length(), msg.prefix.characters(),
+        (int)msg.command.length(), msg.command.characters(),
         msg.arguments.size()
     );
 
     int i = 0;
     for (auto& arg : msg.arguments) {
-        printf("    [%d]: %s\n", i, arg.characters());
+        printf("    [%d]: %.*s\n", i, (int)arg.length(), arg.characters());
         ++i;
     }
 #endif
 
-    bool is_numeric;
-    int numeric = msg.command.to_uint(is_numeric);
-
-    if (is_numeric) {
+    int numeric;
+    if (parse_numeric(msg.command, numeric)) {
         switch (numeric) {
         case RPL_WHOISCHANNELS: return handle_rpl_whoischannels(msg);
         case RPL_ENDOFWHOIS: return handle_rpl_endofwhois(msg);
@@ -241,7 +259,7 @@ void IRCClient::handle(const Message& msg, const String&)
         return handle_nick(msg);
 
     if (msg.arguments.size() >= 2)
-        add_server_message(String::format("[%s] %s", msg.command.characters(), msg.arguments[1].characters()));
+        add_server_message(String::format("[%.*s] %.*s", (int)msg.command.length(), msg.command.characters(), (int)msg.arguments[1].length(), msg.arguments[1].characters()));
 }
 
 void IRCClient::add_server_message(const String& text)
@@ -298,34 +316,33 @@ void IRCClient::handle_privmsg(const Message& msg)
 {
     if (msg.arguments.size() < 2)
         return;
-    if (msg.prefix.is_empty())
-        return;
-    auto parts = msg.prefix.split('!');
-    auto sender_nick = parts[0];
+    auto sender_nick_view = msg.nick;
     auto target = msg.arguments[0];
 
 #ifdef IRC_DEBUG
-    printf("handle_privmsg: sender_nick='%s', target='%s'\n", sender_nick.characters(), target.characters());
+    printf("handle_privmsg: sender_nick='%.*s', target='%.*s'\n", (int)sender_nick_view.length(), sender_nick_view.characters(), (int)target.length(), target.characters());
 #endif
 
-    if (sender_nick.is_empty())
+    if (sender_nick_view.is_empty())
         return;
 
     char sender_prefix = 0;
-    if (is_nick_prefix(sender_nick[0])) {
-        sender_prefix = sender_nick[0];
-        sender_nick = sender_nick.substring(1, sender_nick.length() - 1);
+    if (is_nick_prefix(sender_nick_view[0])) {
+        sender_prefix = sender_nick_view[0];
+        sender_nick_view = sender_nick_view.substring_view(1, sender_nick_view.length() - 1);
     }
+    String sender_nick(sender_nick_view);
+    String text(msg.arguments[1]);
 
     {
-        auto it = m_channels.find(target);
+        auto it = m_channels.find(String(target));
         if (it != m_channels.end()) {
-            (*it).value->add_message(sender_prefix, sender_nick, msg.arguments[1]);
+            (*it).value->add_message(sender_prefix, sender_nick, text);
             return;
         }
     }
     auto& query = ensure_query(sender_nick);
-    query.add_message(sender_prefix, sender_nick, msg.arguments[1]);
+    query.add_message(sender_prefix, sender_nick, text);
 }
 
 IRCQuery& IRCClient::ensure_query(const String& name)
@@ -352,45 +369,38 @@ IRCChannel& IRCClient::ensure_channel(const String& name)
 
 void IRCClient::handle_ping(const Message& msg)
 {
-    if (msg.arguments.size() < 0)
+    if (msg.arguments.size() < 1)
         return;
     m_log->add_message(0, "", "Ping? Pong!");
-    send_pong(msg.arguments[0]);
+    send_pong(String(msg.arguments[0]));
 }
 
 void IRCClient::handle_join(const Message& msg)
 {
     if (msg.arguments.size() != 1)
         return;
-    auto prefix_parts = msg.prefix.split('!');
-    if (prefix_parts.size() < 1)
+    if (msg.nick.is_empty())
         return;
-    auto nick = prefix_parts[0];
-    auto& channel_name = msg.arguments[0];
-    ensure_channel(channel_name).handle_join(nick, msg.prefix);
+    ensure_channel(String(msg.arguments[0])).handle_join(String(msg.nick), String(msg.prefix));
 }
 
 void IRCClient::handle_part(const Message& msg)
 {
     if (msg.arguments.size() < 1)
         return;
-    auto prefix_parts = msg.prefix.split('!');
-    if (prefix_parts.size() < 1)
+    if (msg.nick.is_empty())
         return;
-    auto nick = prefix_parts[0];
-    auto& channel_name = msg.arguments[0];
-    ensure_channel(channel_name).handle_part(nick, msg.prefix);
+    ensure_channel(String(msg.arguments[0])).handle_part(String(msg.nick), String(msg.prefix));
 }
 
 void IRCClient::handle_nick(const Message& msg)
 {
-    auto prefix_parts = msg.prefix.split('!');
-    if (prefix_parts.size() < 1)
+    if (msg.nick.is_empty())
         return;
-    auto old_nick = prefix_parts[0];
     if (msg.arguments.size() != 1)
         return;
-    auto& new_nick = msg.arguments[0];
+    String old_nick(msg.nick);
+    String new_nick(msg.arguments[0]);
     if (old_nick == m_nickname)
         m_nickname = new_nick;
     add_server_message(String::format("~ %s changed nickname to %s", old_nick.characters(), new_nick.characters()));
@@ -405,21 +415,16 @@ void IRCClient::handle_topic(const Message& msg)
 {
     if (msg.arguments.size() != 2)
         return;
-    auto prefix_parts = msg.prefix.split('!');
-    if (prefix_parts.size() < 1)
+    if (msg.nick.is_empty())
         return;
-    auto nick = prefix_parts[0];
-    auto& channel_name = msg.arguments[0];
-    ensure_channel(channel_name).handle_topic(nick, msg.arguments[1]);
+    ensure_channel(String(msg.arguments[0])).handle_topic(String(msg.nick), String(msg.arguments[1]));
 }
 
 void IRCClient::handle_rpl_topic(const Message& msg)
 {
     if (msg.arguments.size() < 3)
         return;
-    auto& channel_name = msg.arguments[1];
-    auto& topic = msg.arguments[2];
-    ensure_channel(channel_name).handle_topic({ }, topic);
+    ensure_channel(String(msg.arguments[1])).handle_topic({ }, String(msg.arguments[2]));
     // FIXME: Handle RPL_TOPICWHOTIME so we can know who set it and when.
 }
 
@@ -427,21 +432,18 @@ void IRCClient::handle_rpl_namreply(const Message& msg)
 {
     if (msg.arguments.size() < 4)
         return;
-    auto& channel_name = msg.arguments[2];
-    auto& channel = ensure_channel(channel_name);
-    auto members = msg.arguments[3].split(' ');
-    for (auto& member : members) {
-        if (member.is_empty())
-            continue;
-        char prefix = 0;
-        if (is_nick_prefix(member[0]))
-            prefix = member[0];
-        channel.add_member(member, prefix);
-    }
+    // Busy channels come in many of these, the member list is updated once they're all in.
+    auto& channel = ensure_channel(String(msg.arguments[2]));
+    channel.add_members(msg.arguments[3].split_view<64>(' '));
 }
 
-void IRCClient::handle_rpl_endofnames(const Message&)
+void IRCClient::handle_rpl_endofnames(const Message& msg)
 {
+    if (msg.arguments.size() < 2)
+        return;
+    auto it = m_channels.find(String(msg.arguments[1]));
+    if (it != m_channels.end())
+        (*it).value->member_model()->update();
 }
 
 void IRCClient::handle_rpl_endofwhois(const Message&)
@@ -453,7 +455,7 @@ void IRCClient::handle_rpl_whoisoperator(const Message& msg)
 {
     if (msg.arguments.size() < 2)
         return;
-    auto& nick = msg.arguments[1];
+    String nick(msg.arguments[1]);
     add_server_message(String::format("* %s is an IRC operator", nick.characters()));
 }
 
@@ -461,8 +463,8 @@ void IRCClient::handle_rpl_whoisserver(const Message& msg)
 {
     if (msg.arguments.size() < 3)
         return;
-    auto& nick = msg.arguments[1];
-    auto& server = msg.arguments[2];
+    String nick(msg.arguments[1]);
+    String server(msg.arguments[2]);
     add_server_message(String::format("* %s is using server %s", nick.characters(), server.characters()));
 }
 
@@ -470,12 +472,10 @@ void IRCClient::handle_rpl_whoisuser(const Message& msg)
 {
     if (msg.arguments.size() < 6)
         return;
-    auto& nick = msg.arguments[1];
-    auto& username = msg.arguments[2];
-    auto& host = msg.arguments[3];
-    auto& asterisk = msg.arguments[4];
-    auto& realname = msg.arguments[5];
-    (void)asterisk;
+    String nick(msg.arguments[1]);
+    String username(msg.arguments[2]);
+    String host(msg.arguments[3]);
+    String realname(msg.arguments[5]);
     add_server_message(String::format("* %s is %s@%s, real name: %s",
         nick.characters(),
         username.characters(),
@@ -488,8 +488,8 @@ void IRCClient::handle_rpl_whoisidle(const Message& msg)
 {
     if (msg.arguments.size() < 3)
         return;
-    auto& nick = msg.arguments[1];
-    auto& secs = msg.arguments[2];
+    String nick(msg.arguments[1]);
+    String secs(msg.arguments[2]);
     add_server_message(String::format("* %s is %s seconds idle", nick.characters(), secs.characters()));
 }
 
@@ -497,8 +497,8 @@ void IRCClient::handle_rpl_whoischannels(const Message& msg)
 {
     if (msg.arguments.size() < 3)
         return;
-    auto& nick = msg.arguments[1];
-    auto& channel_list = msg.arguments[2];
+    String nick(msg.arguments[1]);
+    String channel_list(msg.arguments[2]);
     add_server_message(String::format("* %s is in channels %s", nick.characters(), channel_list.characters()));
 }
 
@@ -506,9 +506,9 @@ void IRCClient::handle_rpl_topicwhotime(const Message& msg)
 {
     if (msg.arguments.size() < 4)
         return;
-    auto& channel_name = msg.arguments[1];
-    auto& nick = msg.arguments[2];
-    auto setat = msg.arguments[3];
+    String channel_name(msg.arguments[1]);
+    String nick(msg.arguments[2]);
+    String setat(msg.arguments[3]);
     bool ok;
     time_t setat_time = setat.to_uint(ok);
     if (ok) {
@@ -74,10 +74,13 @@ public:
     const char* class_name() const override { return "IRCClient"; }
 
 private:
+    // Views into the receive buffer, so they're only good while the message is being handled.
     struct Message {
-        String prefix;
-        String command;
-        Vector<String> arguments;
+        StringView prefix;
+        // Who the message is from: the prefix up to the '!'.
+        StringView nick;
+        StringView command;
+        Vector<StringView, 16> arguments;
     };
 
     void receive_from_server();
@@ -87,7 +90,7 @@ private:
     void send_pong(const String& server);
     void send_privmsg(const String& target, const String&);
     void send_whois(const String&);
-    void process_line(ByteBuffer&&);
+    void process_line(const StringView&);
     void handle_join(const Message&);
     void handle_part(const Message&);
     void handle_ping(const Message&);
@@ -104,7 +107,7 @@ private:
     void handle_rpl_namreply(const Message&);
     void handle_privmsg(const Message&);
     void handle_nick(const Message&);
-    void handle(const Message&, const String& verbatim);
+    void handle(const Message&, const StringView& verbatim);
     void handle_user_command(const String&);
 
     String m_hostname;
@@ -113,7 +116,8 @@ private:
     GTCPSocket* m_socket { nullptr };
 
     String m_nickname;
-    Vector<char> m_line_buffer;
+    Vector<char> m_receive_buffer;
+    int m_receive_buffer_used { 0 };
     OwnPtr<GNotifier> m_notifier;
     HashMap<String, RetainPtr<IRCChannel>> m_channels;
     HashMap<String, RetainPtr<IRCQuery>> m_queries;
@@ -1,7 +1,20 @@
 #include "IRCLogBuffer.h"
 #include "IRCLogBufferModel.h"
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+// Each message is one of these, followed by the sender's and then the text's characters.
+struct PackedMessageHeader {
+    time_t timestamp;
+    RGBA32 color;
+    dword sender_length;
+    dword text_length;
+    char prefix;
+};
 
 Retained<IRCLogBuffer> IRCLogBuffer::create()
 {
@@ -15,23 +28,122 @@ IRCLogBuffer::IRCLogBuffer()
 
 IRCLogBuffer::~IRCLogBuffer()
 {
+    if (m_spill_fd >= 0)
+        close(m_spill_fd);
+}
+
+void IRCLogBuffer::append(char prefix, const String& sender, const String& text, Color color)
+{
+    if (m_chunks.is_empty() || m_chunks.last().offsets.size() == messages_per_chunk) {
+        m_chunks.append(Chunk());
+        if (m_chunks.size() - m_first_chunk_in_memory > chunks_kept_in_memory && !m_spilling_failed)
+            spill_chunk(m_chunks[m_first_chunk_in_memory]);
+    }
+    auto& chunk = m_chunks.last();
+
+    PackedMessageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timestamp = time(nullptr);
+    header.color = color.value();
+    header.sender_length = sender.length();
+    header.text_length = text.length();
+    header.prefix = prefix;
+
+    chunk.offsets.append(chunk.data_size);
+    int size = sizeof(header) + header.sender_length + header.text_length;
+    chunk.data.resize(chunk.data_size + size);
+    byte* p = chunk.data.data() + chunk.data_size;
+    memcpy(p, &header, sizeof(header));
+    memcpy(p + sizeof(header), sender.characters(), header.sender_length);
+    memcpy(p + sizeof(header) + header.sender_length, text.characters(), header.text_length);
+    chunk.data_size += size;
+    ++m_count;
+}
+
+void IRCLogBuffer::spill_chunk(Chunk& chunk)
+{
+    if (m_spill_fd < 0) {
+        // Not /tmp, that's in memory too. The file is unlinked right away, so it goes away with us.
+        const char* directory = getenv("HOME");
+        if (!directory)
+            directory = "/tmp";
+        auto path = String::format("%s/.irc-log-%d-%p", directory, getpid(), this);
+        m_spill_fd = open(path.characters(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (m_spill_fd < 0) {
+            perror("IRCLogBuffer: open");
+            m_spilling_failed = true;
+            return;
+        }
+        unlink(path.characters());
+    }
+    ssize_t nwritten = pwrite(m_spill_fd, chunk.data.data(), chunk.data_size, m_spill_file_size);
+    if (nwritten != chunk.data_size) {
+        perror("IRCLogBuffer: pwrite");
+        // Everything just stays in memory, like it would if there were no file.
+        m_spilling_failed = true;
+        return;
+    }
+    chunk.file_offset = m_spill_file_size;
+    m_spill_file_size += chunk.data_size;
+    chunk.data.clear();
+    ++m_first_chunk_in_memory;
+}
+
+const byte* IRCLogBuffer::chunk_data(int chunk_index) const
+{
+    auto& chunk = m_chunks[chunk_index];
+    if (chunk_index >= m_first_chunk_in_memory)
+        return chunk.data.data();
+    if (m_loaded_chunk_index != chunk_index) {
+        m_loaded_chunk_data.resize(chunk.data_size);
+        ssize_t nread = pread(m_spill_fd, m_loaded_chunk_data.data(), chunk.data_size, chunk.file_offset);
+        if (nread != chunk.data_size) {
+            perror("IRCLogBuffer: pread");
+            m_loaded_chunk_index = -1;
+            return nullptr;
+        }
+        m_loaded_chunk_index = chunk_index;
+    }
+    return m_loaded_chunk_data.data();
+}
+
+IRCLogBuffer::Message IRCLogBuffer::at(int index) const
+{
+    ASSERT(index >= 0 && index < m_count);
+    int chunk_index = index / messages_per_chunk;
+    auto* data = chunk_data(chunk_index);
+    if (!data)
+        return { 0, '\0', String(), "(lost to a read error)", Color::Red };
+    const byte* p = data + m_chunks[chunk_index].offsets[index % messages_per_chunk];
+    PackedMessageHeader header;
+    memcpy(&header, p, sizeof(header));
+    const char* characters = (const char*)p + sizeof(header);
+    Message message;
+    message.timestamp = header.timestamp;
+    message.prefix = header.prefix;
+    if (header.sender_length)
+        message.sender = String(characters, header.sender_length);
+    message.text = String(characters + header.sender_length, header.text_length);
+    message.color = Color::from_rgba(header.color);
+    return message;
 }
 
 void IRCLogBuffer::add_message(char prefix, const String& name, const String& text, Color color)
 {
-    m_messages.enqueue({ time(nullptr), prefix, name, text, color });
-    m_model->update();
+    append(prefix, name, text, color);
+    m_model->did_add_message();
 }
 
 void IRCLogBuffer::add_message(const String& text, Color color)
 {
-    m_messages.enqueue({ time(nullptr), '\0', String(), text, color });
-    m_model->update();
+    append('\0', String(), text, color);
+    m_model->did_add_message();
 }
 
 void IRCLogBuffer::dump() const
 {
-    for (auto& message : m_messages) {
+    for (int i = 0; i < m_count; ++i) {
+        auto message = at(i);
         printf("%u <%c%8s> %s\n", message.timestamp, message.prefix, message.sender.characters(), message.text.characters());
     }
 }
@@ -1,14 +1,16 @@
 #pragma once
 
 #include <AK/AKString.h>
-#include <AK/CircularQueue.h>
 #include <AK/Retainable.h>
 #include <AK/RetainPtr.h>
+#include <AK/Vector.h>
 #include <SharedGraphics/Color.h>
 
 class IRCLogBufferModel;
 
-class IRCLogBuffer : public Retainable<IRCLogBuffer> {
+// Keeps every message there's been, packed into chunks. Only the newest chunks stay in memory,
+// older ones go to a scratch file and are read back when someone scrolls up to them.
+class IRCLogBuffer : public SingleThreadedRetainable<IRCLogBuffer> {
 public:
     static Retained<IRCLogBuffer> create();
     ~IRCLogBuffer();
@@ -21,8 +23,9 @@ public:
         Color color { Color::Black };
     };
 
-    int count() const { return m_messages.size(); }
-    const Message& at(int index) const { return m_messages.at(index); }
+    int count() const { return m_count; }
+    // Unpacked from wherever it's kept, so it's a copy.
+    Message at(int index) const;
     void add_message(char prefix, const String& name, const String& text, Color = Color::Black);
     void add_message(const String& text, Color = Color::Black);
     void dump() const;
@@ -32,6 +35,34 @@ public:
 
 private:
     IRCLogBuffer();
+
+    static const int messages_per_chunk = 512;
+    static const int chunks_kept_in_memory = 4;
+
+    struct Chunk {
+        // The packed messages, empty once the chunk has been written out.
+        Vector<byte> data;
+        // Where each message starts in |data|.
+        Vector<int> offsets;
+        int data_size { 0 };
+        off_t file_offset { -1 };
+    };
+
+    void append(char prefix, const String& sender, const String& text, Color);
+    void spill_chunk(Chunk&);
+    const byte* chunk_data(int chunk_index) const;
+
     Retained<IRCLogBufferModel> m_model;
-    CircularQueue<Message, 1000> m_messages;
+    Vector<Chunk> m_chunks;
+    int m_count { 0 };
+    // The oldest chunk that's still in memory.
+    int m_first_chunk_in_memory { 0 };
+
+    int m_spill_fd { -1 };
+    off_t m_spill_file_size { 0 };
+    bool m_spilling_failed { false };
+
+    // The last chunk read back from the file, since a view asks for a screenful of rows from the same chunk.
+    mutable int m_loaded_chunk_index { -1 };
+    mutable Vector<byte> m_loaded_chunk_data;
 };
@@ -46,7 +46,7 @@ GModel::ColumnMetadata IRCLogBufferModel::column_metadata(int column) const
 GVariant IRCLogBufferModel::data(const GModelIndex& index, Role role) const
 {
     if (role == Role::Display) {
-        auto& entry = m_log_buffer->at(index.row());
+        auto entry = m_log_buffer->at(index.row());
         switch (index.column()) {
         case Column::Timestamp: {
             auto* tm = localtime(&entry.timestamp);
@@ -73,6 +73,11 @@ void IRCLogBufferModel::update()
     did_update();
 }
 
+void IRCLogBufferModel::did_add_message()
+{
+    did_insert_rows(row_count({ }) - 1, 1);
+}
+
 void IRCLogBufferModel::activate(const GModelIndex&)
 {
 }
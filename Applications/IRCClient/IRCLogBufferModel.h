@@ -24,6 +24,8 @@ public:
     virtual void update() override;
     virtual void activate(const GModelIndex&) override;
 
+    void did_add_message();
+
 private:
     explicit IRCLogBufferModel(Retained<IRCLogBuffer>&&);
 
@@ -1,5 +1,6 @@
 #include "ProcessModel.h"
 #include <LibGUI/GFile.h>
+#include <Kernel/ProcessSnapshot.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <pwd.h>
@@ -23,7 +24,7 @@ ProcessModel::~ProcessModel()
 
 int ProcessModel::row_count(const GModelIndex&) const
 {
-    return m_processes.size();
+    return m_pids.size();
 }
 
 int ProcessModel::column_count(const GModelIndex&) const
@@ -73,10 +74,23 @@ GVariant ProcessModel::data(const GModelIndex& index, Role role) const
     ASSERT(is_valid(index));
 
     auto it = m_processes.find(m_pids[index.row()]);
+    return process_data(*(*it).value, index.column(), role);
+}
+
+void ProcessModel::fetch_row(int row, Role role, Vector<GVariant>& values) const
+{
+    // One lookup for the whole row, instead of one per cell.
+    auto it = m_processes.find(m_pids[row]);
     auto& process = *(*it).value;
+    values.clear_with_capacity();
+    for (int column = 0; column < Column::__Count; ++column)
+        values.append(process_data(process, column, role));
+}
 
+GVariant ProcessModel::process_data(const Process& process, int column, Role role) const
+{
     if (role == Role::Sort) {
-        switch (index.column()) {
+        switch (column) {
         case Column::Icon: return 0;
         case Column::PID: return process.current_state.pid;
         case Column::State: return process.current_state.state;
@@ -100,7 +114,7 @@ GVariant ProcessModel::data(const GModelIndex& index, Role role) const
     }
 
     if (role == Role::Display) {
-        switch (index.column()) {
+        switch (column) {
         case Column::Icon: return *m_generic_process_icon;
         case Column::PID: return process.current_state.pid;
         case Column::State: return process.current_state.state;
@@ -125,9 +139,16 @@ GVariant ProcessModel::data(const GModelIndex& index, Role role) const
 
 void ProcessModel::update()
 {
-    GFile file("/proc/all");
+    GFile file("/proc/all.bin");
     if (!file.open(GIODevice::ReadOnly)) {
-        fprintf(stderr, "ProcessManager: Failed to open /proc/all: %s\n", file.error_string());
+        fprintf(stderr, "ProcessManager: Failed to open /proc/all.bin: %s\n", file.error_string());
+        exit(1);
+        return;
+    }
+    auto buffer = file.read_all();
+    auto& header = *(const ProcessSnapshotHeader*)buffer.pointer();
+    if (buffer.size() < (ssize_t)sizeof(header) || header.version != process_snapshot_version) {
+        fprintf(stderr, "ProcessManager: /proc/all.bin is not in a format I know\n");
         exit(1);
         return;
     }
@@ -136,68 +157,94 @@ void ProcessModel::update()
     for (auto& it : m_processes)
         last_sum_nsched += it.value->current_state.nsched;
 
+    // The same processes as last time, with the same names: only their counters need looking at.
+    bool same_processes = !m_processes.is_empty() && header.generation == m_process_list_generation && header.process_count == (dword)m_processes.size();
+    m_process_list_generation = header.generation;
+
     HashTable<pid_t> live_pids;
     unsigned sum_nsched = 0;
-    for (;;) {
-        auto line = file.read_line(1024);
-        if (line.is_empty())
-            break;
-        auto parts = String((const char*)line.pointer(), line.size() - 1, Chomp).split(',');
-        if (parts.size() < 17)
-            break;
-        bool ok;
-        pid_t pid = parts[0].to_uint(ok);
-        ASSERT(ok);
-        unsigned nsched = parts[1].to_uint(ok);
-        ASSERT(ok);
-        ProcessState state;
-        state.pid = pid;
-        state.nsched = nsched;
-        unsigned uid = parts[5].to_uint(ok);
-        ASSERT(ok);
-        {
-            auto it = m_usernames.find((uid_t)uid);
-            if (it != m_usernames.end())
-                state.user = String::format("%s", (*it).value.characters());
-            else
-                state.user = String::format("%u", uid);
+    const byte* record = buffer.pointer() + sizeof(header);
+    for (dword i = 0; i < header.process_count; ++i, record += header.entry_size) {
+        auto& entry = *(const ProcessSnapshotEntry*)record;
+        sum_nsched += entry.times_scheduled;
+        auto it = m_processes.find(entry.pid);
+        if (it == m_processes.end()) {
+            ASSERT(!same_processes);
+            m_processes.set(entry.pid, make<Process>());
+            it = m_processes.find(entry.pid);
         }
-        state.priority = parts[16];
-        state.state = parts[7];
-        state.name = parts[11];
-        state.linear = parts[12].to_uint(ok);
-        ASSERT(ok);
-        state.physical = parts[13].to_uint(ok);
-        ASSERT(ok);
-        sum_nsched += nsched;
-        {
-            auto it = m_processes.find(pid);
-            if (it == m_processes.end())
-                m_processes.set(pid, make<Process>());
+        auto& process = *(*it).value;
+        process.previous_state = process.current_state;
+        auto& state = process.current_state;
+        state.pid = entry.pid;
+        state.nsched = entry.times_scheduled;
+        state.priority = entry.priority;
+        state.state = entry.state;
+        state.linear = entry.amount_virtual;
+        state.physical = entry.amount_resident;
+        if (!same_processes) {
+            auto jt = m_usernames.find((uid_t)entry.uid);
+            if (jt != m_usernames.end())
+                state.user = (*jt).value;
+            else
+                state.user = String::format("%u", entry.uid);
+            state.name = entry.name;
+            live_pids.set(entry.pid);
         }
-        auto it = m_processes.find(pid);
-        ASSERT(it != m_processes.end());
-        (*it).value->previous_state = (*it).value->current_state;
-        (*it).value->current_state = state;
+    }
 
-        live_pids.set(pid);
+    // Rows stay put for as long as their process lives, so views only hear about the rows that actually changed.
+    if (!same_processes) {
+        for (int row = m_pids.size() - 1; row >= 0; --row) {
+            pid_t pid = m_pids[row];
+            if (live_pids.contains(pid))
+                continue;
+            m_pids.remove(row);
+            m_processes.remove(pid);
+            did_remove_rows(row, 1);
+        }
     }
 
-    m_pids.clear();
-    Vector<pid_t> pids_to_remove;
+    HashTable<pid_t> known_pids;
+    for (auto pid : m_pids)
+        known_pids.set(pid);
+    int first_new_row = m_pids.size();
     for (auto& it : m_processes) {
-        if (!live_pids.contains(it.key)) {
-            pids_to_remove.append(it.key);
-            continue;
-        }
+        if (!known_pids.contains(it.key))
+            m_pids.append(it.key);
+    }
 
-        auto& process = *it.value;
-        dword nsched_diff = process.current_state.nsched - process.previous_state.nsched;
-        process.current_state.cpu_percent = ((float)nsched_diff * 100) / (float)(sum_nsched - last_sum_nsched);
-        m_pids.append(it.key);
+    int first_changed_row = -1;
+    for (int row = 0; row < first_new_row; ++row) {
+        auto& process = *(*m_processes.find(m_pids[row])).value;
+        if (!update_cpu_percent_and_compare(process, sum_nsched - last_sum_nsched)) {
+            if (first_changed_row != -1)
+                did_update_rows(first_changed_row, row - first_changed_row);
+            first_changed_row = -1;
+        } else if (first_changed_row == -1) {
+            first_changed_row = row;
+        }
     }
-    for (auto pid : pids_to_remove)
-        m_processes.remove(pid);
+    if (first_changed_row != -1)
+        did_update_rows(first_changed_row, first_new_row - first_changed_row);
+
+    for (int row = first_new_row; row < m_pids.size(); ++row)
+        update_cpu_percent_and_compare(*(*m_processes.find(m_pids[row])).value, sum_nsched - last_sum_nsched);
+    did_insert_rows(first_new_row, m_pids.size() - first_new_row);
+}
 
-    did_update();
+// Returns true if anything shown about the process changed.
+bool ProcessModel::update_cpu_percent_and_compare(Process& process, unsigned nsched_since_last_update)
+{
+    auto& current = process.current_state;
+    auto& previous = process.previous_state;
+    dword nsched_diff = current.nsched - previous.nsched;
+    current.cpu_percent = ((float)nsched_diff * 100) / (float)nsched_since_last_update;
+    return current.cpu_percent != previous.cpu_percent
+        || current.state != previous.state
+        || current.priority != previous.priority
+        || current.name != previous.name
+        || current.user != previous.user
+        || current.linear != previous.linear
+        || current.physical != previous.physical;
 }
@@ -2,6 +2,7 @@
 
 #include <AK/AKString.h>
 #include <AK/HashMap.h>
+#include <AK/OwnPtr.h>
 #include <AK/Vector.h>
 #include <LibGUI/GModel.h>
 #include <unistd.h>
@@ -29,6 +30,7 @@ public:
     virtual String column_name(int column) const override;
     virtual ColumnMetadata column_metadata(int column) const override;
     virtual GVariant data(const GModelIndex&, Role = Role::Display) const override;
+    virtual void fetch_row(int row, Role, Vector<GVariant>&) const override;
     virtual void update() override;
 
 private:
@@ -51,9 +53,13 @@ private:
         ProcessState previous_state;
     };
 
+    bool update_cpu_percent_and_compare(Process&, unsigned nsched_since_last_update);
+    GVariant process_data(const Process&, int column, Role) const;
+
     HashMap<uid_t, String> m_usernames;
     HashMap<pid_t, OwnPtr<Process>> m_processes;
     Vector<pid_t> m_pids;
+    dword m_process_list_generation { 0 };
     RetainPtr<GraphicsBitmap> m_generic_process_icon;
     RetainPtr<GraphicsBitmap> m_high_priority_icon;
     RetainPtr<GraphicsBitmap> m_low_priority_icon;
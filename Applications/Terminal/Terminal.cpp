@@ -14,9 +14,25 @@
 #include <LibGUI/GWindow.h>
 #include <Kernel/KeyCode.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 
 //#define TERMINAL_DEBUG
 
+// Output is painted at most this often, however fast it comes in.
+static const int frame_interval_ms = 1000 / 60;
+
+// Reading stops after this much so a flood can't keep us from painting or taking keys.
+static const int max_read_per_wakeup = 64 * KB;
+
+static bool has_more_to_read(int fd)
+{
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    struct timeval timeout { 0, 0 };
+    return select(fd + 1, &rfds, nullptr, nullptr, &timeout) > 0;
+}
+
 Terminal::Terminal(int ptm_fd)
     : m_ptm_fd(ptm_fd)
     , m_notifier(ptm_fd, GNotifier::Read)
@@ -28,25 +44,35 @@ Terminal::Terminal(int ptm_fd)
     };
 
     set_font(Font::default_fixed_width_font());
-    m_notifier.on_ready_to_read = [this] (GNotifier& notifier) {
-        byte buffer[BUFSIZ];
-        ssize_t nread = read(notifier.fd(), buffer, sizeof(buffer));
-        if (nread < 0) {
-            dbgprintf("Terminal read error: %s\n", strerror(errno));
-            perror("read(ptm)");
-            GApplication::the().quit(1);
-            return;
-        }
-        if (nread == 0) {
-            dbgprintf("Terminal: EOF on master pty, closing.\n");
-            GApplication::the().quit(0);
-            return;
-        }
-        for (ssize_t i = 0; i < nread; ++i)
-            on_char(buffer[i]);
+    m_flush_timer.set_single_shot(true);
+    m_flush_timer.on_timeout = [this] {
+        m_last_flush.start();
         flush_dirty_lines();
     };
 
+    m_notifier.on_ready_to_read = [this] (GNotifier& notifier) {
+        // The master's buffer is 16 KB, so this usually empties it in one go.
+        static byte buffer[16 * KB];
+        int total_read = 0;
+        do {
+            ssize_t nread = read(notifier.fd(), buffer, sizeof(buffer));
+            if (nread < 0) {
+                dbgprintf("Terminal read error: %s\n", strerror(errno));
+                perror("read(ptm)");
+                GApplication::the().quit(1);
+                return;
+            }
+            if (nread == 0) {
+                dbgprintf("Terminal: EOF on master pty, closing.\n");
+                GApplication::the().quit(0);
+                return;
+            }
+            on_input(buffer, nread);
+            total_read += nread;
+        } while (total_read < max_read_per_wakeup && has_more_to_read(notifier.fd()));
+        schedule_flush();
+    };
+
     m_line_height = font().glyph_height() + m_line_spacing;
 
     set_size(80, 25);
@@ -66,6 +92,25 @@ Terminal::Line::~Line()
     delete [] attributes;
 }
 
+// Keeps what fits of the line, padding it out with blanks.
+void Terminal::Line::set_length(word new_length)
+{
+    if (new_length == length)
+        return;
+    auto* new_characters = new byte[new_length];
+    auto* new_attributes = new Attribute[new_length];
+    word kept = min(length, new_length);
+    memcpy(new_characters, characters, kept);
+    memset(new_characters + kept, ' ', new_length - kept);
+    for (word i = 0; i < kept; ++i)
+        new_attributes[i] = attributes[i];
+    delete [] characters;
+    delete [] attributes;
+    characters = new_characters;
+    attributes = new_attributes;
+    length = new_length;
+}
+
 void Terminal::Line::clear(Attribute attribute)
 {
     if (dirty) {
@@ -88,9 +133,6 @@ void Terminal::Line::clear(Attribute attribute)
 
 Terminal::~Terminal()
 {
-    for (int i = 0; i < m_rows; ++i)
-        delete m_lines[i];
-    delete [] m_lines;
     free(m_horizontal_tabs);
 }
 
@@ -136,7 +178,7 @@ static inline Color lookup_color(unsigned color)
     return Color::from_rgb(xterm_colors[color]);
 }
 
-void Terminal::escape$m(const Vector<unsigned>& params)
+void Terminal::escape$m(const ParamVector& params)
 {
     if (params.size() == 3 && params[1] == 5) {
         if (params[0] == 38) {
@@ -183,25 +225,25 @@ void Terminal::escape$m(const Vector<unsigned>& params)
     }
 }
 
-void Terminal::escape$s(const Vector<unsigned>&)
+void Terminal::escape$s(const ParamVector&)
 {
     m_saved_cursor_row = m_cursor_row;
     m_saved_cursor_column = m_cursor_column;
 }
 
-void Terminal::escape$u(const Vector<unsigned>&)
+void Terminal::escape$u(const ParamVector&)
 {
     set_cursor(m_saved_cursor_row, m_saved_cursor_column);
 }
 
-void Terminal::escape$t(const Vector<unsigned>& params)
+void Terminal::escape$t(const ParamVector& params)
 {
     if (params.size() < 1)
         return;
     dbgprintf("FIXME: escape$t: Ps: %u\n", params[0]);
 }
 
-void Terminal::escape$r(const Vector<unsigned>& params)
+void Terminal::escape$r(const ParamVector& params)
 {
     unsigned top = 1;
     unsigned bottom = m_rows;
@@ -212,7 +254,7 @@ void Terminal::escape$r(const Vector<unsigned>& params)
     dbgprintf("FIXME: escape$r: Set scrolling region: %u-%u\n", top, bottom);
 }
 
-void Terminal::escape$H(const Vector<unsigned>& params)
+void Terminal::escape$H(const ParamVector& params)
 {
     unsigned row = 1;
     unsigned col = 1;
@@ -223,7 +265,7 @@ void Terminal::escape$H(const Vector<unsigned>& params)
     set_cursor(row - 1, col - 1);
 }
 
-void Terminal::escape$A(const Vector<unsigned>& params)
+void Terminal::escape$A(const ParamVector& params)
 {
     int num = 1;
     if (params.size() >= 1)
@@ -236,7 +278,7 @@ void Terminal::escape$A(const Vector<unsigned>& params)
     set_cursor(new_row, m_cursor_column);
 }
 
-void Terminal::escape$B(const Vector<unsigned>& params)
+void Terminal::escape$B(const ParamVector& params)
 {
     int num = 1;
     if (params.size() >= 1)
@@ -249,7 +291,7 @@ void Terminal::escape$B(const Vector<unsigned>& params)
     set_cursor(new_row, m_cursor_column);
 }
 
-void Terminal::escape$C(const Vector<unsigned>& params)
+void Terminal::escape$C(const ParamVector& params)
 {
     int num = 1;
     if (params.size() >= 1)
@@ -262,7 +304,7 @@ void Terminal::escape$C(const Vector<unsigned>& params)
     set_cursor(m_cursor_row, new_column);
 }
 
-void Terminal::escape$D(const Vector<unsigned>& params)
+void Terminal::escape$D(const ParamVector& params)
 {
     int num = 1;
     if (params.size() >= 1)
@@ -275,7 +317,7 @@ void Terminal::escape$D(const Vector<unsigned>& params)
     set_cursor(m_cursor_row, new_column);
 }
 
-void Terminal::escape$G(const Vector<unsigned>& params)
+void Terminal::escape$G(const ParamVector& params)
 {
     int new_column = 1;
     if (params.size() >= 1)
@@ -285,7 +327,7 @@ void Terminal::escape$G(const Vector<unsigned>& params)
     set_cursor(m_cursor_row, new_column);
 }
 
-void Terminal::escape$d(const Vector<unsigned>& params)
+void Terminal::escape$d(const ParamVector& params)
 {
     int new_row = 1;
     if (params.size() >= 1)
@@ -295,7 +337,7 @@ void Terminal::escape$d(const Vector<unsigned>& params)
     set_cursor(new_row, m_cursor_column);
 }
 
-void Terminal::escape$X(const Vector<unsigned>& params)
+void Terminal::escape$X(const ParamVector& params)
 {
     // Erase characters (without moving cursor)
     int num = 1;
@@ -309,7 +351,7 @@ void Terminal::escape$X(const Vector<unsigned>& params)
     }
 }
 
-void Terminal::escape$K(const Vector<unsigned>& params)
+void Terminal::escape$K(const ParamVector& params)
 {
     int mode = 0;
     if (params.size() >= 1)
@@ -336,7 +378,7 @@ void Terminal::escape$K(const Vector<unsigned>& params)
     }
 }
 
-void Terminal::escape$J(const Vector<unsigned>& params)
+void Terminal::escape$J(const ParamVector& params)
 {
     int mode = 0;
     if (params.size() >= 1)
@@ -361,7 +403,7 @@ void Terminal::escape$J(const Vector<unsigned>& params)
         clear();
         break;
     case 3:
-        // FIXME: <esc>[3J should also clear the scrollback buffer.
+        clear_history();
         clear();
         break;
     default:
@@ -370,7 +412,7 @@ void Terminal::escape$J(const Vector<unsigned>& params)
     }
 }
 
-void Terminal::escape$M(const Vector<unsigned>& params)
+void Terminal::escape$M(const ParamVector& params)
 {
     int count = 1;
     if (params.size() >= 1)
@@ -413,19 +455,30 @@ void Terminal::execute_xterm_command()
 void Terminal::execute_escape_sequence(byte final)
 {
     m_final = final;
-    auto paramparts = String((const char*)m_parameters.data(), m_parameters.size()).split(';');
-    Vector<unsigned> params;
-    for (auto& parampart : paramparts) {
-        bool ok;
-        unsigned value = parse_uint(parampart, ok);
-        if (!ok) {
+    // Parsed in place: empty parameters are skipped, except a trailing one, which is 0.
+    ParamVector params;
+    unsigned value = 0;
+    bool has_digits = false;
+    for (int i = 0; i < m_parameters.size(); ++i) {
+        byte ch = m_parameters[i];
+        if (ch == ';') {
+            if (has_digits)
+                params.append(value);
+            value = 0;
+            has_digits = false;
+            continue;
+        }
+        if (ch < '0' || ch > '9') {
             m_parameters.clear_with_capacity();
             m_intermediates.clear_with_capacity();
             // FIXME: Should we do something else?
             return;
         }
-        params.append(value);
+        value = value * 10 + (ch - '0');
+        has_digits = true;
     }
+    if (has_digits || (!m_parameters.is_empty() && m_parameters.last() == ';'))
+        params.append(value);
     switch (final) {
     case 'A': escape$A(params); break;
     case 'B': escape$B(params); break;
@@ -467,14 +520,79 @@ void Terminal::scroll_up()
 {
     // NOTE: We have to invalidate the cursor first.
     invalidate_cursor();
-    delete m_lines[0];
-    for (word row = 1; row < rows(); ++row)
-        m_lines[row - 1] = m_lines[row];
-    m_lines[m_rows - 1] = new Line(m_columns);
+    auto& top_line = m_lines[m_first_line];
+    OwnPtr<Line> new_line;
+    if (!m_max_history_size) {
+        new_line = move(top_line);
+    } else if (m_history.size() < m_max_history_size) {
+        m_history.append(move(top_line));
+    } else {
+        new_line = move(m_history[m_history_start]);
+        m_history[m_history_start] = move(top_line);
+        m_history_start = (m_history_start + 1) % m_history.size();
+    }
+    if (new_line) {
+        new_line->set_length(m_columns);
+        new_line->clear(Attribute());
+    } else {
+        new_line = make<Line>(m_columns);
+    }
+    new_line->dirty = true;
+    m_lines[m_first_line] = move(new_line);
+    m_first_line = (m_first_line + 1) % m_rows;
+
+    if (m_scroll_offset) {
+        // Stay on the same history lines while the output goes on underneath.
+        m_scroll_offset = min(m_scroll_offset + 1, history_size());
+        force_repaint();
+        return;
+    }
     ++m_rows_to_scroll_backing_store;
     m_need_full_flush = true;
 }
 
+Terminal::Line& Terminal::visible_line(int row)
+{
+    int index = history_size() - m_scroll_offset + row;
+    if (index >= history_size())
+        return line(index - history_size());
+    auto& line = history_line(index);
+    // It may have scrolled off before the terminal was resized.
+    line.set_length(m_columns);
+    return line;
+}
+
+void Terminal::scroll_view(int delta)
+{
+    int new_offset = max(0, min(m_scroll_offset + delta, history_size()));
+    if (new_offset == m_scroll_offset)
+        return;
+    m_scroll_offset = new_offset;
+    m_rows_to_scroll_backing_store = 0;
+    force_repaint();
+}
+
+void Terminal::clear_history()
+{
+    m_history.clear();
+    m_history_start = 0;
+    scroll_view(-m_scroll_offset);
+}
+
+void Terminal::set_max_history_size(int size)
+{
+    // Keep the newest lines that still fit, in order.
+    Vector<OwnPtr<Line>> history;
+    int kept = min(size, history_size());
+    for (int i = history_size() - kept; i < history_size(); ++i)
+        history.append(move(m_history[(m_history_start + i) % m_history.size()]));
+    m_history = move(history);
+    m_history_start = 0;
+    m_max_history_size = size;
+    if (m_scroll_offset > history_size())
+        scroll_view(history_size() - m_scroll_offset);
+}
+
 void Terminal::set_cursor(unsigned a_row, unsigned a_column)
 {
     unsigned row = min(a_row, m_rows - 1u);
@@ -503,6 +621,55 @@ void Terminal::put_character_at(unsigned row, unsigned column, byte ch)
     line.dirty = true;
 }
 
+void Terminal::on_input(const byte* characters, int length)
+{
+    int i = 0;
+    while (i < length) {
+        if (m_escape_state == Normal) {
+            int count = put_printable_run(characters + i, length - i);
+            if (count) {
+                i += count;
+                continue;
+            }
+        }
+        on_char(characters[i++]);
+    }
+}
+
+// Plain characters that fit on the cursor's line need only be stored, with one cursor move after them.
+// The last column, where on_char() wraps, and everything else is left to on_char().
+int Terminal::put_printable_run(const byte* characters, int length)
+{
+    auto& line = this->line(m_cursor_row);
+    unsigned column = m_cursor_column;
+    int count = 0;
+    for (; count < length && column + 1 < m_columns && characters[count] >= ' '; ++count, ++column) {
+        byte ch = characters[count];
+        if (line.characters[column] == ch && line.attributes[column] == m_current_attribute)
+            continue;
+        line.characters[column] = ch;
+        line.attributes[column] = m_current_attribute;
+        line.dirty = true;
+    }
+    if (count)
+        set_cursor(m_cursor_row, column);
+    return count;
+}
+
+void Terminal::schedule_flush()
+{
+    if (m_flush_timer.is_active())
+        return;
+    int elapsed = m_last_flush.elapsed();
+    if (elapsed < frame_interval_ms) {
+        // Whatever else comes in before then is painted along with this.
+        m_flush_timer.start(frame_interval_ms - elapsed);
+        return;
+    }
+    m_last_flush.start();
+    flush_dirty_lines();
+}
+
 void Terminal::on_char(byte ch)
 {
 #ifdef TERMINAL_DEBUG
@@ -655,12 +822,6 @@ void Terminal::set_size(word columns, word rows)
     if (columns == m_columns && rows == m_rows)
         return;
 
-    if (m_lines) {
-        for (size_t i = 0; i < m_rows; ++i)
-            delete m_lines[i];
-        delete m_lines;
-    }
-
     m_columns = columns;
     m_rows = rows;
 
@@ -677,9 +838,11 @@ void Terminal::set_size(word columns, word rows)
     // Rightmost column is always last tab on line.
     m_horizontal_tabs[columns - 1] = 1;
 
-    m_lines = new Line*[rows];
+    m_lines.clear();
+    m_first_line = 0;
     for (size_t i = 0; i < rows; ++i)
-        m_lines[i] = new Line(columns);
+        m_lines.append(make<Line>(columns));
+    m_scroll_offset = min(m_scroll_offset, history_size());
 
     m_pixel_width = m_columns * font().glyph_width('x') + m_inset * 2;
     m_pixel_height = (m_rows * (font().glyph_height() + m_line_spacing)) + (m_inset * 2) - m_line_spacing;
@@ -752,6 +915,14 @@ void Terminal::keydown_event(GKeyEvent& event)
             ch = 0x1c;
         }
     }
+    if (event.shift() && (event.key() == KeyCode::Key_PageUp || event.key() == KeyCode::Key_PageDown)) {
+        int page = max(1, m_rows / 2);
+        scroll_view(event.key() == KeyCode::Key_PageUp ? page : -page);
+        return;
+    }
+    // Typing goes back to the live screen.
+    scroll_view(-m_scroll_offset);
+
     switch (event.key()) {
     case KeyCode::Key_Up:
         write(m_ptm_fd, "\033[A", 3);
@@ -796,8 +967,9 @@ void Terminal::paint_event(GPaintEvent&)
 
     invalidate_cursor();
 
+    int visible_cursor_row = m_cursor_row + m_scroll_offset;
     for (word row = 0; row < m_rows; ++row) {
-        auto& line = this->line(row);
+        auto& line = visible_line(row);
         if (!line.dirty)
             continue;
         line.dirty = false;
@@ -806,7 +978,7 @@ void Terminal::paint_event(GPaintEvent&)
             painter.fill_rect(row_rect(row), lookup_color(line.attributes[0].background_color).with_alpha(255 * m_opacity));
         }
         for (word column = 0; column < m_columns; ++column) {
-            bool should_reverse_fill_for_cursor = m_cursor_blink_state && m_in_active_window && row == m_cursor_row && column == m_cursor_column;
+            bool should_reverse_fill_for_cursor = m_cursor_blink_state && m_in_active_window && row == visible_cursor_row && column == m_cursor_column;
             auto& attribute = line.attributes[column];
             char ch = line.characters[column];
             auto character_rect = glyph_rect(row, column);
@@ -820,8 +992,8 @@ void Terminal::paint_event(GPaintEvent&)
         }
     }
 
-    if (!m_in_active_window) {
-        auto cell_rect = glyph_rect(m_cursor_row, m_cursor_column).inflated(0, m_line_spacing);
+    if (!m_in_active_window && visible_cursor_row < m_rows) {
+        auto cell_rect = glyph_rect(visible_cursor_row, m_cursor_column).inflated(0, m_line_spacing);
         painter.draw_rect(cell_rect, lookup_color(line(m_cursor_row).attributes[m_cursor_column].foreground_color));
     }
 
@@ -851,7 +1023,7 @@ void Terminal::flush_dirty_lines()
     }
     Rect rect;
     for (int i = 0; i < m_rows; ++i) {
-        if (line(i).dirty)
+        if (visible_line(i).dirty)
             rect = rect.united(row_rect(i));
     }
     update(rect);
@@ -860,7 +1032,7 @@ void Terminal::flush_dirty_lines()
 void Terminal::force_repaint()
 {
     for (int i = 0; i < m_rows; ++i)
-        line(i).dirty = true;
+        visible_line(i).dirty = true;
     update();
 }
 
@@ -8,6 +8,7 @@
 #include <LibGUI/GWidget.h>
 #include <LibGUI/GNotifier.h>
 #include <LibGUI/GTimer.h>
+#include <LibGUI/GElapsedTimer.h>
 
 class Font;
 
@@ -18,12 +19,18 @@ public:
 
     void create_window();
     void on_char(byte);
+    void on_input(const byte*, int length);
 
     void flush_dirty_lines();
     void force_repaint();
 
     void apply_size_increments_to_window(GWindow&);
 
+    // How many lines that scrolled off the top are kept around to scroll back to.
+    int max_history_size() const { return m_max_history_size; }
+    void set_max_history_size(int);
+    int history_size() const { return m_history.size(); }
+
 private:
     virtual void event(GEvent&) override;
     virtual void paint_event(GPaintEvent&) override;
@@ -32,9 +39,13 @@ private:
     virtual const char* class_name() const override { return "Terminal"; }
 
     void scroll_up();
+    void scroll_view(int delta);
+    void clear_history();
     void newline();
     void set_cursor(unsigned row, unsigned column);
     void put_character_at(unsigned row, unsigned column, byte ch);
+    int put_printable_run(const byte*, int length);
+    void schedule_flush();
     void invalidate_cursor();
     void set_window_title(String&&);
 
@@ -42,22 +53,25 @@ private:
     void unimplemented_escape();
     void unimplemented_xterm_escape();
 
-    void escape$A(const Vector<unsigned>&);
-    void escape$B(const Vector<unsigned>&);
-    void escape$C(const Vector<unsigned>&);
-    void escape$D(const Vector<unsigned>&);
-    void escape$H(const Vector<unsigned>&);
-    void escape$J(const Vector<unsigned>&);
-    void escape$K(const Vector<unsigned>&);
-    void escape$M(const Vector<unsigned>&);
-    void escape$G(const Vector<unsigned>&);
-    void escape$X(const Vector<unsigned>&);
-    void escape$d(const Vector<unsigned>&);
-    void escape$m(const Vector<unsigned>&);
-    void escape$s(const Vector<unsigned>&);
-    void escape$u(const Vector<unsigned>&);
-    void escape$t(const Vector<unsigned>&);
-    void escape$r(const Vector<unsigned>&);
+    // Escape sequences seldom take more than a few parameters.
+    typedef Vector<unsigned, 4> ParamVector;
+
+    void escape$A(const ParamVector&);
+    void escape$B(const ParamVector&);
+    void escape$C(const ParamVector&);
+    void escape$D(const ParamVector&);
+    void escape$H(const ParamVector&);
+    void escape$J(const ParamVector&);
+    void escape$K(const ParamVector&);
+    void escape$M(const ParamVector&);
+    void escape$G(const ParamVector&);
+    void escape$X(const ParamVector&);
+    void escape$d(const ParamVector&);
+    void escape$m(const ParamVector&);
+    void escape$s(const ParamVector&);
+    void escape$u(const ParamVector&);
+    void escape$t(const ParamVector&);
+    void escape$r(const ParamVector&);
 
     void clear();
 
@@ -93,15 +107,28 @@ private:
         explicit Line(word columns);
         ~Line();
         void clear(Attribute);
+        void set_length(word);
         bool has_only_one_background_color() const;
         byte* characters { nullptr };
         Attribute* attributes { nullptr };
         bool dirty { false };
         word length { 0 };
     };
-    Line& line(size_t index) { ASSERT(index < m_rows); return *m_lines[index]; }
-
-    Line** m_lines { nullptr };
+    Line& line(size_t index) { ASSERT(index < m_rows); return *m_lines[(m_first_line + index) % m_rows]; }
+    Line& history_line(int index) { return *m_history[(m_history_start + index) % m_history.size()]; }
+    // What's shown in a row, which is a history line while the view is scrolled back.
+    Line& visible_line(int row);
+
+    // The screen is a ring of lines starting at m_first_line, so scrolling moves the start instead of every line.
+    Vector<OwnPtr<Line>> m_lines;
+    int m_first_line { 0 };
+
+    // Lines that scrolled off the top, also a ring once it's full, oldest at m_history_start.
+    // Lines move here from the screen as they are, and the oldest go back to the bottom of the screen as new ones.
+    Vector<OwnPtr<Line>> m_history;
+    int m_history_start { 0 };
+    int m_max_history_size { 1000 };
+    int m_scroll_offset { 0 };
 
     word m_columns { 0 };
     word m_rows { 0 };
@@ -161,4 +188,8 @@ private:
     int m_glyph_width { 0 };
 
     GTimer m_cursor_blink_timer;
+
+    // Painting is held back to frame_interval_ms apart, with the scrolling in between done in one blit.
+    GTimer m_flush_timer;
+    GElapsedTimer m_last_flush;
 };
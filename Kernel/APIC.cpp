@@ -0,0 +1,91 @@
+#include <Kernel/APIC.h>
+#include <Kernel/MemoryManager.h>
+#include <Kernel/i386.h>
+#include <Kernel/kstdio.h>
+
+//#define APIC_DEBUG
+
+#define IA32_APIC_BASE_MSR       0x1b
+#define APIC_BASE_ENABLE         (1 << 11)
+
+#define APIC_REG_ID              0x20
+#define APIC_REG_TPR             0x80
+#define APIC_REG_EOI             0xb0
+#define APIC_REG_SPURIOUS        0xf0
+#define APIC_REG_LVT_LINT0       0x350
+#define APIC_REG_LVT_LINT1       0x360
+
+#define APIC_SOFTWARE_ENABLE     (1 << 8)
+#define APIC_DELIVERY_NMI        (4 << 8)
+#define APIC_DELIVERY_EXTINT     (7 << 8)
+#define APIC_SPURIOUS_VECTOR     0xff
+
+extern "C" void apic_spurious_entry();
+asm(
+    ".globl apic_spurious_entry\n"
+    "apic_spurious_entry: \n"
+    "    iret\n"
+);
+
+namespace APIC {
+
+static dword s_base;
+static byte s_id;
+
+static inline volatile dword& reg(dword offset)
+{
+    return *(volatile dword*)(s_base + offset);
+}
+
+void initialize()
+{
+    if (!(CPUID(1).edx() & (1 << 9))) {
+        kprintf("APIC: Not present\n");
+        return;
+    }
+    qword base_msr = read_msr(IA32_APIC_BASE_MSR);
+    if (!(base_msr & APIC_BASE_ENABLE)) {
+        kprintf("APIC: Disabled by the firmware\n");
+        return;
+    }
+    dword base = base_msr & 0xfffff000;
+    // Mapped where it is, like other MMIO. This has to happen before any other page directory is made,
+    // they only copy the kernel's PDEs.
+    MM.map_for_kernel(LinearAddress(base), PhysicalAddress(base));
+    s_base = base;
+    s_id = reg(APIC_REG_ID) >> 24;
+
+    register_interrupt_handler(APIC_SPURIOUS_VECTOR, apic_spurious_entry);
+    // Virtual wire mode: the PIC's interrupts come in through LINT0, NMIs through LINT1.
+    // Software enabling the APIC leaves these masked otherwise.
+    reg(APIC_REG_LVT_LINT0) = APIC_DELIVERY_EXTINT;
+    reg(APIC_REG_LVT_LINT1) = APIC_DELIVERY_NMI;
+    reg(APIC_REG_TPR) = 0;
+    reg(APIC_REG_SPURIOUS) = APIC_SOFTWARE_ENABLE | APIC_SPURIOUS_VECTOR;
+    kprintf("APIC: Local APIC id %u at P%x\n", s_id, s_base);
+}
+
+bool is_enabled()
+{
+    return s_base;
+}
+
+dword msi_address()
+{
+    ASSERT(is_enabled());
+    // Fixed delivery to the one processor we run on.
+    return 0xfee00000 | (s_id << 12);
+}
+
+dword msi_data(byte vector)
+{
+    // Edge triggered, fixed delivery.
+    return vector;
+}
+
+void eoi()
+{
+    reg(APIC_REG_EOI) = 0;
+}
+
+}
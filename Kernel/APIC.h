@@ -0,0 +1,17 @@
+#pragma once
+
+#include <AK/Types.h>
+
+// The bootstrap processor's local APIC, for message signaled interrupts. The legacy PIC keeps delivering
+// everything else through LINT0, like it did with the APIC left the way the firmware had it.
+namespace APIC {
+
+void initialize();
+
+bool is_enabled();
+// Where a PCI device writes an MSI to get it delivered to us, and what to write for a given vector.
+dword msi_address();
+dword msi_data(byte vector);
+void eoi();
+
+}
@@ -0,0 +1,183 @@
+#include <Kernel/ARPCache.h>
+#include <Kernel/NetworkAdapter.h>
+#include <Kernel/i8253.h>
+#include <Kernel/system.h>
+#include <AK/StdLibExtras.h>
+
+//#define ARP_DEBUG
+
+const dword ARPCache::entry_lifetime = 60 * TICKS_PER_SECOND;
+const dword ARPCache::request_interval = TICKS_PER_SECOND;
+
+// Past this many, addresses nobody has heard of in a while get forgotten.
+static const int max_entries = 256;
+
+ARPCache& ARPCache::the()
+{
+    static ARPCache* s_the;
+    if (!s_the)
+        s_the = new ARPCache;
+    return *s_the;
+}
+
+ARPCache::Entry& ARPCache::ensure_entry(const IPv4Address& address)
+{
+    auto it = m_entries.find(address);
+    if (it != m_entries.end())
+        return *(*it).value;
+
+    if (m_entries.size() >= max_entries) {
+        Vector<IPv4Address> expired;
+        for (auto& entry_it : m_entries) {
+            auto& entry = *entry_it.value;
+            dword last_used = max(entry.updated_at, entry.last_request_at);
+            if (!entry.pending_frame_count && system.uptime - last_used >= 2 * entry_lifetime)
+                expired.append(entry_it.key);
+        }
+        for (auto& key : expired)
+            m_entries.remove(key);
+    }
+
+    auto entry = make<Entry>();
+    auto& entry_ref = *entry;
+    m_entries.set(address, move(entry));
+    return entry_ref;
+}
+
+bool ARPCache::should_request(const Entry& entry) const
+{
+    if (entry.requests_sent >= max_requests)
+        return false;
+    return !entry.requests_sent || system.uptime - entry.last_request_at >= request_interval;
+}
+
+void ARPCache::send(NetworkAdapter& adapter, const IPv4Address& next_hop, Retained<PacketBuffer>&& frame)
+{
+    bool is_resolved;
+    bool should_send_request;
+    MACAddress mac_address;
+    {
+        LOCKER(m_lock);
+        auto& entry = ensure_entry(next_hop);
+        bool gave_up = entry.requests_sent >= max_requests && system.uptime - entry.last_request_at >= request_interval;
+        if (entry.is_resolved && system.uptime - entry.updated_at >= entry_lifetime && gave_up) {
+            // It went quiet and never answered when asked again, so it's not there anymore.
+            entry.is_resolved = false;
+            entry.requests_sent = 0;
+        }
+        if (!entry.is_resolved && gave_up) {
+            // Nobody's answered. Whatever was waiting goes, and the asking starts over.
+            entry.pending_frames.clear();
+            entry.pending_frame_count = 0;
+            entry.requests_sent = 0;
+        }
+
+        is_resolved = entry.is_resolved;
+        if (is_resolved) {
+            mac_address = entry.mac_address;
+            // Past its lifetime it's still used, while it's asked about again in case it moved.
+            should_send_request = system.uptime - entry.updated_at >= entry_lifetime && should_request(entry);
+        } else {
+            if (entry.pending_frame_count == max_pending_frames) {
+                entry.pending_frames.take_first();
+                --entry.pending_frame_count;
+            }
+            entry.pending_frames.append(move(frame));
+            ++entry.pending_frame_count;
+            should_send_request = should_request(entry);
+        }
+        if (should_send_request) {
+            entry.last_request_at = system.uptime;
+            ++entry.requests_sent;
+        }
+    }
+
+    if (should_send_request)
+        send_request(adapter, next_hop);
+    if (is_resolved)
+        adapter.send_ipv4_frame(mac_address, *frame);
+}
+
+void ARPCache::update(const IPv4Address& address, const MACAddress& mac_address, SinglyLinkedList<Retained<PacketBuffer>>& resolved_frames)
+{
+    auto& entry = ensure_entry(address);
+    entry.mac_address = mac_address;
+    entry.is_resolved = true;
+    entry.updated_at = system.uptime;
+    entry.requests_sent = 0;
+    while (!entry.pending_frames.is_empty())
+        resolved_frames.append(entry.pending_frames.take_first());
+    entry.pending_frame_count = 0;
+}
+
+void ARPCache::did_receive(NetworkAdapter& adapter, const ARPPacket& packet)
+{
+    auto& sender = packet.sender_protocol_address();
+    bool is_for_us = packet.target_protocol_address() == adapter.ipv4_address();
+
+    if (sender == adapter.ipv4_address()) {
+        if (!(packet.sender_hardware_address() == adapter.mac_address())) {
+            kprintf("ARPCache: %s says it has our address (%s)!\n",
+                packet.sender_hardware_address().to_string().characters(),
+                sender.to_string().characters());
+        }
+        return;
+    }
+
+    // As RFC 826 has it, whoever we know about is always updated, which is how a gratuitous ARP moves an address,
+    // but only those talking to us get added. A sender without an address is probing for the one it wants.
+    // FIXME: Protect against ARP spamming.
+    SinglyLinkedList<Retained<PacketBuffer>> resolved_frames;
+    if (!sender.is_zero()) {
+        LOCKER(m_lock);
+        if (is_for_us || m_entries.contains(sender))
+            update(sender, packet.sender_hardware_address(), resolved_frames);
+#ifdef ARP_DEBUG
+        dump();
+#endif
+    }
+
+    for (auto& frame : resolved_frames)
+        adapter.send_ipv4_frame(packet.sender_hardware_address(), *frame);
+
+    if (is_for_us && packet.operation() == ARPOperation::Request) {
+        ARPPacket response;
+        response.set_operation(ARPOperation::Response);
+        response.set_target_hardware_address(packet.sender_hardware_address());
+        response.set_target_protocol_address(sender);
+        response.set_sender_hardware_address(adapter.mac_address());
+        response.set_sender_protocol_address(adapter.ipv4_address());
+        adapter.send(packet.sender_hardware_address(), response);
+    }
+}
+
+void ARPCache::send_request(NetworkAdapter& adapter, const IPv4Address& address)
+{
+#ifdef ARP_DEBUG
+    kprintf("ARPCache: Who has %s?\n", address.to_string().characters());
+#endif
+    ARPPacket request;
+    request.set_operation(ARPOperation::Request);
+    request.set_sender_hardware_address(adapter.mac_address());
+    request.set_sender_protocol_address(adapter.ipv4_address());
+    request.set_target_protocol_address(address);
+    adapter.send(MACAddress::broadcast(), request);
+}
+
+void ARPCache::announce(NetworkAdapter& adapter)
+{
+    send_request(adapter, adapter.ipv4_address());
+}
+
+void ARPCache::dump()
+{
+    LOCKER(m_lock);
+    kprintf("ARP cache (%d entries):\n", m_entries.size());
+    for (auto& it : m_entries) {
+        auto& entry = *it.value;
+        if (entry.is_resolved)
+            kprintf("%s :: %s (%u ticks old)\n", it.key.to_string().characters(), entry.mac_address.to_string().characters(), system.uptime - entry.updated_at);
+        else
+            kprintf("%s :: incomplete (%d waiting)\n", it.key.to_string().characters(), entry.pending_frame_count);
+    }
+}
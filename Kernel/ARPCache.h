@@ -0,0 +1,57 @@
+#pragma once
+
+#include <AK/HashMap.h>
+#include <AK/OwnPtr.h>
+#include <AK/SinglyLinkedList.h>
+#include <Kernel/ARP.h>
+#include <Kernel/Lock.h>
+#include <Kernel/PacketBuffer.h>
+
+class NetworkAdapter;
+
+// Who has which IPv4 address on the link, as learned from ARP.
+// Sending to someone not in here yet doesn't wait: the packets are held while a request goes out, and sent
+// once the answer comes in. Entries are good for a while, and then get asked about again while still in use.
+// Nothing runs on a timer, everything is done as it's sent to or heard from.
+class ARPCache {
+public:
+    static ARPCache& the();
+
+    // Sends |frame|, which starts with its IPv4 header, to |next_hop| now or once it's known where that is.
+    void send(NetworkAdapter&, const IPv4Address& next_hop, Retained<PacketBuffer>&& frame);
+
+    // Learns what |packet| has to say, and answers it if it's asking for |adapter|.
+    void did_receive(NetworkAdapter&, const ARPPacket&);
+
+    // Tells everyone on the link that |adapter| has its address, in case they had someone else down for it.
+    void announce(NetworkAdapter&);
+
+    void dump();
+
+private:
+    ARPCache() { }
+
+    struct Entry {
+        MACAddress mac_address;
+        bool is_resolved { false };
+        // When the address was last heard from, or asked about while unresolved, in ticks.
+        dword updated_at { 0 };
+        dword last_request_at { 0 };
+        int requests_sent { 0 };
+        SinglyLinkedList<Retained<PacketBuffer>> pending_frames;
+        int pending_frame_count { 0 };
+    };
+
+    static const dword entry_lifetime;
+    static const dword request_interval;
+    static const int max_requests = 3;
+    static const int max_pending_frames = 16;
+
+    Entry& ensure_entry(const IPv4Address&);
+    bool should_request(const Entry&) const;
+    void update(const IPv4Address&, const MACAddress&, SinglyLinkedList<Retained<PacketBuffer>>& resolved_frames);
+    static void send_request(NetworkAdapter&, const IPv4Address&);
+
+    Lock m_lock { "ARPCache" };
+    HashMap<IPv4Address, OwnPtr<Entry>> m_entries;
+};
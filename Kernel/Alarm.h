@@ -1,9 +1,17 @@
 #pragma once
 
+#include <Kernel/WaitQueue.h>
+
 class Alarm {
 public:
     Alarm() { }
     virtual ~Alarm() { }
 
     virtual bool is_ringing() const = 0;
+
+    // Woken by the owner whenever is_ringing() may have changed.
+    WaitQueue& wait_queue() { return m_wait_queue; }
+
+private:
+    WaitQueue m_wait_queue;
 };
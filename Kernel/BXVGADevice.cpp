@@ -27,6 +27,7 @@
 struct BXVGAResolution {
     int width;
     int height;
+    int bpp;
 };
 
 static BXVGADevice* s_the;
@@ -49,16 +50,17 @@ void BXVGADevice::set_register(word index, word data)
     IO::out16(VBE_DISPI_IOPORT_DATA, data);
 }
 
-void BXVGADevice::set_resolution(int width, int height)
+void BXVGADevice::set_resolution(int width, int height, int bpp)
 {
     m_framebuffer_size = { width, height };
+    m_framebuffer_bpp = bpp;
 
     set_register(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
     set_register(VBE_DISPI_INDEX_XRES, (word)width);
     set_register(VBE_DISPI_INDEX_YRES, (word)height);
     set_register(VBE_DISPI_INDEX_VIRT_WIDTH, (word)width);
     set_register(VBE_DISPI_INDEX_VIRT_HEIGHT, (word)height * 2);
-    set_register(VBE_DISPI_INDEX_BPP, 32);
+    set_register(VBE_DISPI_INDEX_BPP, (word)bpp);
     set_register(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
     set_register(VBE_DISPI_INDEX_BANK, 0);
 }
@@ -115,7 +117,9 @@ int BXVGADevice::ioctl(Process& process, unsigned request, unsigned arg)
         auto* resolution = (const BXVGAResolution*)arg;
         if (!process.validate_read_typed(resolution))
             return -EFAULT;
-        set_resolution(resolution->width, resolution->height);
+        if (resolution->bpp != 16 && resolution->bpp != 32)
+            return -EINVAL;
+        set_resolution(resolution->width, resolution->height, resolution->bpp);
         return 0;
     }
     default:
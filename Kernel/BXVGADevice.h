@@ -14,14 +14,15 @@ public:
     BXVGADevice();
 
     PhysicalAddress framebuffer_address() const { return m_framebuffer_address; }
-    void set_resolution(int width, int height);
+    void set_resolution(int width, int height, int bpp);
     void set_y_offset(int);
 
     virtual int ioctl(Process&, unsigned request, unsigned arg) override;
     virtual Region* mmap(Process&, LinearAddress preferred_laddr, size_t offset, size_t) override;
 
-    size_t framebuffer_size_in_bytes() const { return m_framebuffer_size.area() * sizeof(dword) * 2; }
+    size_t framebuffer_size_in_bytes() const { return m_framebuffer_size.area() * (m_framebuffer_bpp / 8) * 2; }
     Size framebuffer_size() const { return m_framebuffer_size; }
+    int framebuffer_bpp() const { return m_framebuffer_bpp; }
 
 private:
     virtual const char* class_name() const override { return "BXVGA"; }
@@ -35,4 +36,5 @@ private:
 
     PhysicalAddress m_framebuffer_address;
     Size m_framebuffer_size;
+    int m_framebuffer_bpp { 32 };
 };
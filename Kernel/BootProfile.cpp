@@ -0,0 +1,54 @@
+#include <Kernel/BootProfile.h>
+#include <Kernel/Process.h>
+#include <Kernel/i8253.h>
+#include <AK/StringBuilder.h>
+
+namespace BootProfile {
+
+// Marking is over once userland is up, so a fixed number of them is plenty. More are dropped.
+static const int max_marks = 48;
+
+struct Mark {
+    const char* phase;
+    int tid;
+    dword microseconds;
+};
+
+static Mark s_marks[max_marks];
+static int s_mark_count;
+
+void mark(const char* phase)
+{
+    InterruptDisabler disabler;
+    if (s_mark_count == max_marks)
+        return;
+    dword microseconds = PIT::seconds_since_boot() * 1000000 + PIT::ticks_this_second() * (1000000 / TICKS_PER_SECOND) + PIT::microseconds_since_last_tick();
+    s_marks[s_mark_count++] = { phase, current ? current->tid() : 0, microseconds };
+}
+
+ByteBuffer report()
+{
+    InterruptDisabler disabler;
+    StringBuilder builder;
+    builder.appendf("  AT(ms)  TOOK(ms)  TID  PHASE\n");
+    for (int i = 0; i < s_mark_count; ++i) {
+        auto& mark = s_marks[i];
+        const Mark* previous = nullptr;
+        for (int j = i - 1; j >= 0 && !previous; --j) {
+            if (s_marks[j].tid == mark.tid)
+                previous = &s_marks[j];
+        }
+        builder.appendf("% 4u.%03u  ", mark.microseconds / 1000, mark.microseconds % 1000);
+        // A thread's first phase started whenever it was spawned, which isn't recorded.
+        if (previous) {
+            dword took = mark.microseconds - previous->microseconds;
+            builder.appendf("% 4u.%03u", took / 1000, took % 1000);
+        } else {
+            builder.appendf("       -");
+        }
+        builder.appendf("  % 3d  %s\n", mark.tid, mark.phase);
+    }
+    return builder.to_byte_buffer();
+}
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <AK/ByteBuffer.h>
+
+// Timestamps for the phases of booting, so it's easy to see where the time before the desktop goes.
+// Boot is spread over several kernel processes, so each phase is timed from the last one its own thread marked.
+// /proc/boot lists them in the order they finished.
+namespace BootProfile {
+
+// Call when a phase has just finished. The name has to stay around (a literal), it's only pointed to.
+void mark(const char* phase);
+
+ByteBuffer report();
+
+}
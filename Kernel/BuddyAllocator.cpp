@@ -0,0 +1,76 @@
+#include <Kernel/BuddyAllocator.h>
+#include <Kernel/MemoryManager.h>
+
+void BuddyAllocator::initialize(PhysicalPage* pages, size_t page_count)
+{
+    m_pages = pages;
+    m_page_count = page_count;
+    // Carve the range into the biggest aligned blocks that fit.
+    size_t index = 0;
+    while (index < page_count) {
+        int order = max_order;
+        while (order > 0 && ((index & ((1u << order) - 1)) || index + (1u << order) > page_count))
+            --order;
+        add_free_block(index, order);
+        m_free_page_count += 1u << order;
+        index += 1u << order;
+    }
+}
+
+void BuddyAllocator::add_free_block(size_t index, int order)
+{
+    auto& page = m_pages[index];
+    page.m_buddy_order = order;
+    m_free_lists[order].prepend(&page);
+}
+
+int BuddyAllocator::order_for_page_count(size_t page_count)
+{
+    int order = 0;
+    while ((1u << order) < page_count)
+        ++order;
+    return order;
+}
+
+PhysicalPage* BuddyAllocator::allocate(int order)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(order >= 0 && order <= max_order);
+    for (int block_order = order; block_order <= max_order; ++block_order) {
+        auto* block = m_free_lists[block_order].remove_head();
+        if (!block)
+            continue;
+        block->m_buddy_order = -1;
+        // Split it down to size, the upper halves go back on the free lists.
+        size_t index = block - m_pages;
+        while (block_order > order) {
+            --block_order;
+            add_free_block(index + (1u << block_order), block_order);
+        }
+        m_free_page_count -= 1u << order;
+        return block;
+    }
+    return nullptr;
+}
+
+void BuddyAllocator::deallocate(PhysicalPage& page, int order)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(page.m_buddy_order == -1);
+    size_t index = &page - m_pages;
+    ASSERT(index < m_page_count);
+    m_free_page_count += 1u << order;
+    while (order < max_order) {
+        size_t buddy_index = index ^ (1u << order);
+        if (buddy_index >= m_page_count)
+            break;
+        auto& buddy = m_pages[buddy_index];
+        if (buddy.m_buddy_order != order)
+            break;
+        m_free_lists[order].remove(&buddy);
+        buddy.m_buddy_order = -1;
+        index &= ~(1u << order);
+        ++order;
+    }
+    add_free_block(index, order);
+}
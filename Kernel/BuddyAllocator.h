@@ -0,0 +1,34 @@
+#pragma once
+
+#include <AK/InlineLinkedList.h>
+#include <AK/Types.h>
+
+class PhysicalPage;
+
+// Hands out naturally aligned blocks of 2^order physically contiguous pages from one array of PhysicalPages.
+// Freed blocks merge with their buddies again, so big contiguous ranges don't get chipped away for good.
+class BuddyAllocator {
+public:
+    static const int max_order = 10;
+
+    BuddyAllocator() { }
+
+    void initialize(PhysicalPage* pages, size_t page_count);
+
+    // Returns the first page of the block, or nullptr if there's no free block that big.
+    PhysicalPage* allocate(int order);
+    void deallocate(PhysicalPage&, int order);
+
+    size_t free_page_count() const { return m_free_page_count; }
+    size_t free_block_count(int order) const { return m_free_lists[order].size_slow(); }
+
+    static int order_for_page_count(size_t);
+
+private:
+    void add_free_block(size_t index, int order);
+
+    PhysicalPage* m_pages { nullptr };
+    size_t m_page_count { 0 };
+    size_t m_free_page_count { 0 };
+    InlineLinkedList<PhysicalPage> m_free_lists[max_order + 1];
+};
@@ -0,0 +1,153 @@
+#include <Kernel/CompressedSwap.h>
+#include <Kernel/LZ4.h>
+#include <Kernel/MemoryManager.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/i386.h>
+
+//#define COMPRESSED_SWAP_DEBUG
+
+// Pages that don't shrink to at least this aren't worth the CPU it takes to get them back.
+static const int max_compressed_size = 3 * PAGE_SIZE / 4;
+// Blob offsets within a pool page are rounded up to this, which keeps the copies aligned.
+static const int blob_alignment = 32;
+
+CompressedSwap& CompressedSwap::the()
+{
+    static CompressedSwap* s_the;
+    if (!s_the)
+        s_the = new CompressedSwap;
+    return *s_the;
+}
+
+CompressedSwap::CompressedSwap()
+{
+    // The pool never grows past a quarter of RAM, so there's always plenty left for the pages it frees up.
+    m_max_pool_page_count = MM.ram_size() / PAGE_SIZE / 4;
+}
+
+CompressedSwap::Entry& CompressedSwap::entry(dword slot)
+{
+    ASSERT(is_compressed_slot(slot));
+    dword index = (slot & ~slot_flag) - 1;
+    ASSERT(index < (dword)m_entries.size());
+    ASSERT(m_entries[index].retain_count);
+    return m_entries[index];
+}
+
+dword CompressedSwap::allocate_entry(const Entry& new_entry)
+{
+    dword index;
+    if (!m_free_entries.is_empty()) {
+        index = m_free_entries.take_last();
+        m_entries[index] = new_entry;
+    } else {
+        index = m_entries.size();
+        m_entries.append(new_entry);
+    }
+    ++m_stored_page_count;
+    return slot_flag | (index + 1);
+}
+
+bool CompressedSwap::allocate_space(word size, word& pool_index, word& offset)
+{
+    if (m_current_pool_index < 0 || m_current_offset + size > PAGE_SIZE) {
+        int full_pool_index = m_current_pool_index;
+        m_current_pool_index = -1;
+        // Everything in it may be gone already, with nobody left to free it.
+        if (full_pool_index >= 0 && !m_pool[full_pool_index].live_count)
+            release_space(full_pool_index);
+        if (m_pool_page_count >= m_max_pool_page_count)
+            return false;
+        auto page = MM.allocate_physical_page(MemoryManager::ShouldZeroFill::No);
+        if (!page)
+            return false;
+        word index;
+        if (!m_free_pool_indices.is_empty()) {
+            index = m_free_pool_indices.take_last();
+        } else {
+            index = m_pool.size();
+            m_pool.append(PoolPage());
+        }
+        m_pool[index].page = move(page);
+        m_pool[index].live_count = 0;
+        ++m_pool_page_count;
+        m_current_pool_index = index;
+        m_current_offset = 0;
+    }
+    pool_index = m_current_pool_index;
+    offset = m_current_offset;
+    m_current_offset += (size + blob_alignment - 1) & ~(blob_alignment - 1);
+    ++m_pool[pool_index].live_count;
+    return true;
+}
+
+// Drops one blob's hold on a pool page. The page being filled is kept even when it's empty.
+void CompressedSwap::release_space(word pool_index)
+{
+    auto& pool_page = m_pool[pool_index];
+    if (pool_page.live_count)
+        --pool_page.live_count;
+    if (pool_page.live_count || pool_index == m_current_pool_index)
+        return;
+    pool_page.page = nullptr;
+    m_free_pool_indices.append(pool_index);
+    --m_pool_page_count;
+}
+
+dword CompressedSwap::store(const byte* page)
+{
+    InterruptDisabler disabler;
+    auto* dwords = (const dword*)page;
+    bool same_filled = true;
+    for (size_t i = 1; i < PAGE_SIZE / sizeof(dword); ++i) {
+        if (dwords[i] != dwords[0]) {
+            same_filled = false;
+            break;
+        }
+    }
+    if (same_filled)
+        return allocate_entry({ 0, 0, 0, 1, dwords[0] });
+
+    static byte buffer[max_compressed_size];
+    int size = LZ4::compress(page, PAGE_SIZE, buffer, sizeof(buffer));
+    if (!size)
+        return 0;
+    word pool_index;
+    word offset;
+    if (!allocate_space(size, pool_index, offset))
+        return 0;
+    memcpy(MM.physmap(*m_pool[pool_index].page) + offset, buffer, size);
+#ifdef COMPRESSED_SWAP_DEBUG
+    dbgprintf("CompressedSwap: Stored a page in %d bytes at pool page %u + %u\n", size, pool_index, offset);
+#endif
+    return allocate_entry({ pool_index, offset, (word)size, 1, 0 });
+}
+
+bool CompressedSwap::load(dword slot, byte* buffer)
+{
+    InterruptDisabler disabler;
+    auto& e = entry(slot);
+    if (!e.size) {
+        fast_dword_fill((dword*)buffer, e.fill_value, PAGE_SIZE / sizeof(dword));
+        return true;
+    }
+    return LZ4::decompress(MM.physmap(*m_pool[e.pool_index].page) + e.offset, e.size, buffer, PAGE_SIZE);
+}
+
+void CompressedSwap::retain_slot(dword slot)
+{
+    InterruptDisabler disabler;
+    ++entry(slot).retain_count;
+}
+
+void CompressedSwap::release_slot(dword slot)
+{
+    InterruptDisabler disabler;
+    auto& e = entry(slot);
+    if (--e.retain_count)
+        return;
+    if (e.size)
+        release_space(e.pool_index);
+    m_free_entries.append((slot & ~slot_flag) - 1);
+    --m_stored_page_count;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <AK/Assertions.h>
+#include <AK/RetainPtr.h>
+#include <AK/Types.h>
+#include <AK/Vector.h>
+
+class PhysicalPage;
+
+// A swap tier in RAM: cold anonymous pages are kept LZ4-compressed in a pool of physical pages, which takes no I/O
+// to fill and makes faulting them back in much cheaper than disk swap. It's tried first, SwapSpace takes what's left.
+// Pages of one repeated dword (mostly zeroes) take no pool space at all.
+// Slots are retained by every VMObject page that refers to them, like SwapSpace's, and have slot_flag set to tell them apart.
+class CompressedSwap {
+public:
+    static CompressedSwap& the();
+
+    static const dword slot_flag = 0x80000000;
+    static bool is_compressed_slot(dword slot) { return slot & slot_flag; }
+
+    // Returns a slot holding a copy of the page, or 0 if it doesn't compress well enough or the pool is full.
+    dword store(const byte* page);
+    // Decompresses the slot into buffer, which is one page. The slot stays retained.
+    bool load(dword slot, byte* buffer);
+    void retain_slot(dword);
+    void release_slot(dword);
+
+    size_t stored_page_count() const { return m_stored_page_count; }
+    size_t pool_page_count() const { return m_pool_page_count; }
+    size_t max_pool_page_count() const { return m_max_pool_page_count; }
+
+private:
+    CompressedSwap();
+
+    struct Entry {
+        word pool_index;
+        word offset;
+        word size; // 0 when the page is one repeated dword.
+        word retain_count;
+        dword fill_value;
+    };
+
+    struct PoolPage {
+        RetainPtr<PhysicalPage> page;
+        // Entries with data in this page. It goes back to the allocator when this drops to 0.
+        int live_count { 0 };
+    };
+
+    Entry& entry(dword slot);
+    dword allocate_entry(const Entry&);
+    bool allocate_space(word size, word& pool_index, word& offset);
+    void release_space(word pool_index);
+
+    Vector<Entry> m_entries;
+    Vector<dword> m_free_entries;
+    Vector<PoolPage> m_pool;
+    Vector<word> m_free_pool_indices;
+    // Blobs are carved from the current pool page until it's full, and never span pages.
+    int m_current_pool_index { -1 };
+    word m_current_offset { 0 };
+    size_t m_stored_page_count { 0 };
+    size_t m_pool_page_count { 0 };
+    size_t m_max_pool_page_count { 0 };
+};
@@ -41,8 +41,13 @@ ssize_t Console::write(Process&, const byte* data, ssize_t size)
         return 0;
     if (!m_implementation)
         return 0;
+#ifdef CONSOLE_OUT_TO_E9
+    for (ssize_t i = 0; i < size; ++i)
+        IO::out8(0xe9, data[i]);
+#endif
     for (ssize_t i = 0; i < size; ++i)
-        put_char(data[i]);
+        m_logbuffer.enqueue(data[i]);
+    m_implementation->on_sysconsole_receive(data, size);
     return size;
 }
 
@@ -54,7 +59,7 @@ void Console::put_char(char ch)
 #endif
     m_logbuffer.enqueue(ch);
     if (m_implementation)
-        m_implementation->on_sysconsole_receive(ch);
+        m_implementation->on_sysconsole_receive((const byte*)&ch, 1);
 }
 
 ConsoleImplementation::~ConsoleImplementation()
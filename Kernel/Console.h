@@ -7,7 +7,8 @@
 class ConsoleImplementation {
 public:
     virtual ~ConsoleImplementation();
-    virtual void on_sysconsole_receive(byte) = 0;
+    // Gets everything written in one go, so it can update the screen once for all of it.
+    virtual void on_sysconsole_receive(const byte*, ssize_t) = 0;
 };
 
 class Console final : public CharacterDevice {
@@ -4,6 +4,7 @@
 #include <AK/Types.h>
 #include "Limits.h"
 #include "FileDescriptor.h"
+#include <Kernel/WaitQueue.h>
 
 class Process;
 
@@ -38,6 +39,8 @@ public:
     virtual bool is_block_device() const { return false; }
     virtual bool is_character_device() const { return false; }
 
+    WaitQueue& wait_queue() { return m_wait_queue; }
+
 protected:
     Device(unsigned major, unsigned minor);
     void set_uid(uid_t uid) { m_uid = uid; }
@@ -48,4 +51,5 @@ private:
     unsigned m_minor { 0 };
     uid_t m_uid { 0 };
     gid_t m_gid { 0 };
+    WaitQueue m_wait_queue;
 };
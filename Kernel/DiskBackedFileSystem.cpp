@@ -1,6 +1,11 @@
 #include "DiskBackedFileSystem.h"
 #include "i386.h"
+#include "i8253.h"
+#include "system.h"
 #include <AK/InlineLRUCache.h>
+#include <AK/QuickSort.h>
+#include <Kernel/MemoryManager.h>
+#include <Kernel/ProcFS.h>
 #include <Kernel/Process.h>
 
 //#define DBFS_DEBUG
@@ -37,12 +42,98 @@ public:
     ByteBuffer m_buffer;
 };
 
-Lockable<InlineLRUCache<BlockIdentifier, CachedBlock>>& block_cache()
+// The block cache is split into shards by block hash, each with its own lock,
+// so that accesses to unrelated blocks don't serialize on a single lock.
+static const unsigned block_cache_shard_count = 8;
+
+// Writes are deferred: a written block sits in its shard's dirty map until syncd
+// flushes it (once it's old enough), until enough dirty blocks pile up, or until sync().
+// Dirty blocks are kept outside the LRU so that eviction never loses data.
+static const dword dirty_block_max_age = 3 * TICKS_PER_SECOND;
+
+struct DirtyBlock {
+    ByteBuffer buffer;
+    dword dirtied_at { 0 };
+    bool held { false };
+};
+
+struct BlockCacheShard {
+    Lock lock { "BlockCacheShard" };
+    InlineLRUCache<BlockIdentifier, CachedBlock> cache;
+    HashMap<BlockIdentifier, DirtyBlock> dirty_blocks;
+};
+
+static BlockCacheShard* s_block_cache_shards;
+static Lockable<unsigned>* s_block_cache_capacity;
+static volatile dword s_block_cache_hits;
+static volatile dword s_block_cache_misses;
+static volatile dword s_dirty_block_count;
+static volatile dword s_held_block_count;
+static Lock* s_flush_lock;
+
+static unsigned default_block_cache_capacity()
+{
+    // The cached blocks live on the kmalloc heap, so scale modestly with RAM: 2 blocks per MB.
+    return max(16u, min(512u, (unsigned)(MM.ram_size() / MB) * 2));
+}
+
+static void apply_block_cache_capacity()
+{
+    unsigned capacity;
+    {
+        LOCKER(s_block_cache_capacity->lock());
+        auto& requested_capacity = s_block_cache_capacity->resource();
+        requested_capacity = max(requested_capacity, block_cache_shard_count * 2);
+        capacity = requested_capacity;
+    }
+    for (unsigned i = 0; i < block_cache_shard_count; ++i) {
+        auto& shard = s_block_cache_shards[i];
+        LOCKER(shard.lock);
+        shard.cache.set_capacity(ceil_div(capacity, block_cache_shard_count));
+    }
+}
+
+static BlockCacheShard& block_cache_shard(const BlockIdentifier& block_id)
+{
+    if (!s_block_cache_shards) {
+        s_block_cache_shards = new BlockCacheShard[block_cache_shard_count];
+        s_block_cache_capacity = new Lockable<unsigned>(default_block_cache_capacity());
+        s_flush_lock = new Lock("BlockCacheFlush");
+        apply_block_cache_capacity();
+        ProcFS::the().add_sys_unsigned("block_cache_size", *s_block_cache_capacity, apply_block_cache_capacity);
+    }
+    return s_block_cache_shards[AK::Traits<BlockIdentifier>::hash(block_id) % block_cache_shard_count];
+}
+
+DiskBackedFS::BlockCacheStats DiskBackedFS::block_cache_stats()
+{
+    BlockCacheStats stats;
+    if (!s_block_cache_shards)
+        return stats;
+    stats.hits = s_block_cache_hits;
+    stats.misses = s_block_cache_misses;
+    stats.dirty = s_dirty_block_count;
+    for (unsigned i = 0; i < block_cache_shard_count; ++i) {
+        auto& shard = s_block_cache_shards[i];
+        LOCKER(shard.lock);
+        stats.capacity += shard.cache.capacity();
+        stats.size += shard.cache.size();
+        stats.evictions += shard.cache.eviction_count();
+    }
+    return stats;
+}
+
+unsigned DiskBackedFS::drop_cached_blocks(unsigned count)
 {
-    static Lockable<InlineLRUCache<BlockIdentifier, CachedBlock>>* s_cache;
-    if (!s_cache)
-        s_cache = new Lockable<InlineLRUCache<BlockIdentifier, CachedBlock>>;
-    return *s_cache;
+    if (!s_block_cache_shards)
+        return 0;
+    unsigned dropped = 0;
+    for (unsigned i = 0; i < block_cache_shard_count && dropped < count; ++i) {
+        auto& shard = s_block_cache_shards[i];
+        LOCKER(shard.lock);
+        dropped += shard.cache.shrink(min(count - dropped, ceil_div(count, block_cache_shard_count)));
+    }
+    return dropped;
 }
 
 DiskBackedFS::DiskBackedFS(Retained<DiskDevice>&& device)
@@ -54,20 +145,53 @@ DiskBackedFS::~DiskBackedFS()
 {
 }
 
+static unsigned dirty_block_limit()
+{
+    LOCKER(s_block_cache_capacity->lock());
+    return max(16u, s_block_cache_capacity->resource() / 2);
+}
+
+void DiskBackedFS::mark_block_dirty(unsigned index, const byte* data, bool held)
+{
+    BlockIdentifier block_id { fsid(), index };
+    // Take a private copy, callers are free to reuse their buffer after writing.
+    auto buffer = ByteBuffer::copy(data, block_size());
+    auto& shard = block_cache_shard(block_id);
+    LOCKER(shard.lock);
+    if (auto* cached_block = shard.cache.get(block_id))
+        cached_block->m_buffer = buffer;
+    auto it = shard.dirty_blocks.find(block_id);
+    if (it != shard.dirty_blocks.end()) {
+        // Keep the original timestamp so a constantly rewritten block still gets flushed.
+        (*it).value.buffer = move(buffer);
+        if (held && !(*it).value.held) {
+            (*it).value.held = true;
+            ++s_held_block_count;
+        }
+        return;
+    }
+    shard.dirty_blocks.set(block_id, { move(buffer), (dword)system.uptime, held });
+    ++s_dirty_block_count;
+    if (held)
+        ++s_held_block_count;
+}
+
+// Held blocks can't be flushed, so they don't count towards the limit.
+static bool too_many_dirty_blocks()
+{
+    return s_dirty_block_count - s_held_block_count >= dirty_block_limit();
+}
+
 bool DiskBackedFS::write_block(unsigned index, const ByteBuffer& data)
 {
 #ifdef DBFS_DEBUG
     kprintf("DiskBackedFileSystem::write_block %u, size=%u\n", index, data.size());
 #endif
     ASSERT(data.size() == block_size());
-
-    {
-        LOCKER(block_cache().lock());
-        if (auto* cached_block = block_cache().resource().get({ fsid(), index }))
-            cached_block->m_buffer = data;
-    }
-    DiskOffset base_offset = static_cast<DiskOffset>(index) * static_cast<DiskOffset>(block_size());
-    return device().write(base_offset, block_size(), data.pointer());
+    mark_block_dirty(index, data.pointer());
+    if (too_many_dirty_blocks())
+        flush_dirty_blocks(FlushMode::All);
+    return true;
 }
 
 bool DiskBackedFS::write_blocks(unsigned index, unsigned count, const ByteBuffer& data)
@@ -75,16 +199,132 @@ bool DiskBackedFS::write_blocks(unsigned index, unsigned count, const ByteBuffer
 #ifdef DBFS_DEBUG
     kprintf("DiskBackedFileSystem::write_blocks %u x%u\n", index, count);
 #endif
-    // FIXME: Maybe reorder this so we send out the write commands before updating cache?
-    {
-        LOCKER(block_cache().lock());
-        for (unsigned i = 0; i < count; ++i) {
-            if (auto* cached_block = block_cache().resource().get({ fsid(), index + i }))
-                cached_block->m_buffer = data.slice(i * block_size(), block_size());
+    ASSERT(data.size() >= (ssize_t)count * block_size());
+    for (unsigned i = 0; i < count; ++i)
+        mark_block_dirty(index + i, data.pointer() + i * block_size());
+    if (too_many_dirty_blocks())
+        flush_dirty_blocks(FlushMode::All);
+    return true;
+}
+
+bool DiskBackedFS::write_held_block(unsigned index, const ByteBuffer& data)
+{
+    ASSERT(data.size() == block_size());
+    mark_block_dirty(index, data.pointer(), true);
+    return true;
+}
+
+void DiskBackedFS::release_held_block(unsigned index)
+{
+    BlockIdentifier block_id { fsid(), index };
+    auto& shard = block_cache_shard(block_id);
+    LOCKER(shard.lock);
+    auto it = shard.dirty_blocks.find(block_id);
+    if (it == shard.dirty_blocks.end() || !(*it).value.held)
+        return;
+    (*it).value.held = false;
+    // It's only now that it may go to disk, so it's only now that it starts getting old.
+    (*it).value.dirtied_at = system.uptime;
+    --s_held_block_count;
+}
+
+struct PendingWrite {
+    BlockIdentifier block_id;
+    ByteBuffer buffer;
+};
+
+static void write_back(Vector<PendingWrite>&);
+
+void DiskBackedFS::flush_dirty_blocks(FlushMode mode)
+{
+    if (!s_block_cache_shards)
+        return;
+
+    LOCKER(*s_flush_lock);
+    Vector<PendingWrite> writes;
+    dword now = system.uptime;
+    for (unsigned i = 0; i < block_cache_shard_count; ++i) {
+        auto& shard = s_block_cache_shards[i];
+        LOCKER(shard.lock);
+        for (auto& it : shard.dirty_blocks) {
+            if (it.value.held)
+                continue;
+            if (mode == FlushMode::Expired && (now - it.value.dirtied_at) < dirty_block_max_age)
+                continue;
+            writes.append({ it.key, it.value.buffer });
         }
     }
-    DiskOffset base_offset = static_cast<DiskOffset>(index) * static_cast<DiskOffset>(block_size());
-    return device().write(base_offset, count * block_size(), data.pointer());
+    write_back(writes);
+}
+
+void DiskBackedFS::flush_blocks(const Vector<unsigned>& indices)
+{
+    Vector<PendingWrite> writes;
+    for (auto index : indices) {
+        BlockIdentifier block_id { fsid(), index };
+        auto& shard = block_cache_shard(block_id);
+        LOCKER(shard.lock);
+        auto it = shard.dirty_blocks.find(block_id);
+        if (it != shard.dirty_blocks.end() && !(*it).value.held)
+            writes.append({ block_id, (*it).value.buffer });
+    }
+    if (writes.is_empty())
+        return;
+    LOCKER(*s_flush_lock);
+    write_back(writes);
+}
+
+// The caller holds s_flush_lock.
+static void write_back(Vector<PendingWrite>& writes)
+{
+    if (writes.is_empty())
+        return;
+
+    // Sort by disk position so adjacent blocks can go out in a single request.
+    quick_sort(writes.begin(), writes.end(), [] (auto& a, auto& b) {
+        if (a.block_id.fsid != b.block_id.fsid)
+            return a.block_id.fsid < b.block_id.fsid;
+        return a.block_id.index < b.block_id.index;
+    });
+
+    for (int i = 0; i < writes.size();) {
+        auto* fs = static_cast<DiskBackedFS*>(FS::from_fsid(writes[i].block_id.fsid));
+        ASSERT(fs);
+        int run_length = 1;
+        while (i + run_length < writes.size()
+            && writes[i + run_length].block_id.fsid == writes[i].block_id.fsid
+            && writes[i + run_length].block_id.index == writes[i].block_id.index + run_length)
+            ++run_length;
+
+        DiskOffset base_offset = static_cast<DiskOffset>(writes[i].block_id.index) * static_cast<DiskOffset>(fs->block_size());
+        bool success;
+        if (run_length == 1) {
+            success = fs->device().write(base_offset, fs->block_size(), writes[i].buffer.pointer());
+        } else {
+            auto run = ByteBuffer::create_uninitialized(run_length * fs->block_size());
+            for (int j = 0; j < run_length; ++j)
+                memcpy(run.pointer() + j * fs->block_size(), writes[i + j].buffer.pointer(), fs->block_size());
+            success = fs->device().write(base_offset, run.size(), run.pointer());
+        }
+        if (!success) {
+            kprintf("DiskBackedFS: Failed to write back %u block(s) at %u, keeping them dirty\n", run_length, writes[i].block_id.index);
+            i += run_length;
+            continue;
+        }
+
+        for (int j = 0; j < run_length; ++j) {
+            auto& write = writes[i + j];
+            auto& shard = block_cache_shard(write.block_id);
+            LOCKER(shard.lock);
+            auto it = shard.dirty_blocks.find(write.block_id);
+            // Only clean the block if it wasn't redirtied while we were writing it.
+            if (it != shard.dirty_blocks.end() && (*it).value.buffer.pointer() == write.buffer.pointer()) {
+                shard.dirty_blocks.remove(it);
+                --s_dirty_block_count;
+            }
+        }
+        i += run_length;
+    }
 }
 
 ByteBuffer DiskBackedFS::read_block(unsigned index) const
@@ -92,11 +332,20 @@ ByteBuffer DiskBackedFS::read_block(unsigned index) const
 #ifdef DBFS_DEBUG
     kprintf("DiskBackedFileSystem::read_block %u\n", index);
 #endif
+    auto& shard = block_cache_shard({ fsid(), index });
     {
-        LOCKER(block_cache().lock());
-        if (auto* cached_block = block_cache().resource().get({ fsid(), index }))
+        LOCKER(shard.lock);
+        auto it = shard.dirty_blocks.find({ fsid(), index });
+        if (it != shard.dirty_blocks.end()) {
+            ++s_block_cache_hits;
+            return (*it).value.buffer;
+        }
+        if (auto* cached_block = shard.cache.get({ fsid(), index })) {
+            ++s_block_cache_hits;
             return cached_block->m_buffer;
+        }
     }
+    ++s_block_cache_misses;
 
     auto buffer = ByteBuffer::create_uninitialized(block_size());
     //kprintf("created block buffer with size %u\n", block_size());
@@ -106,8 +355,13 @@ ByteBuffer DiskBackedFS::read_block(unsigned index) const
     ASSERT(success);
     ASSERT(buffer.size() == block_size());
     {
-        LOCKER(block_cache().lock());
-        block_cache().resource().put({ fsid(), index }, CachedBlock({ fsid(), index }, buffer));
+        LOCKER(shard.lock);
+        // A write may have raced with our disk read, in which case the dirty copy wins.
+        auto it = shard.dirty_blocks.find({ fsid(), index });
+        if (it != shard.dirty_blocks.end())
+            return (*it).value.buffer;
+        if (!device().is_memory_backed())
+            shard.cache.put({ fsid(), index }, CachedBlock({ fsid(), index }, buffer));
     }
     return buffer;
 }
@@ -132,6 +386,51 @@ ByteBuffer DiskBackedFS::read_blocks(unsigned index, unsigned count) const
     return blocks;
 }
 
+bool DiskBackedFS::read_blocks_uncached(unsigned index, unsigned count, byte* buffer) const
+{
+#ifdef DBFS_DEBUG
+    kprintf("DiskBackedFileSystem::read_blocks_uncached %u x%u\n", index, count);
+#endif
+    DiskOffset base_offset = static_cast<DiskOffset>(index) * static_cast<DiskOffset>(block_size());
+    if (!device().read(base_offset, count * block_size(), buffer))
+        return false;
+    // Blocks with pending writes are newer in the cache than on disk.
+    for (unsigned i = 0; i < count; ++i) {
+        BlockIdentifier block_id { fsid(), index + i };
+        auto& shard = block_cache_shard(block_id);
+        LOCKER(shard.lock);
+        auto it = shard.dirty_blocks.find(block_id);
+        if (it != shard.dirty_blocks.end())
+            memcpy(buffer + i * block_size(), (*it).value.buffer.pointer(), block_size());
+    }
+    return true;
+}
+
+bool DiskBackedFS::write_blocks_uncached(unsigned index, unsigned count, const byte* data)
+{
+#ifdef DBFS_DEBUG
+    kprintf("DiskBackedFileSystem::write_blocks_uncached %u x%u\n", index, count);
+#endif
+    block_cache_shard({ fsid(), index });
+    // Keep write-back out of the way, so an older copy can't land on top of this one.
+    LOCKER(*s_flush_lock);
+    for (unsigned i = 0; i < count; ++i) {
+        BlockIdentifier block_id { fsid(), index + i };
+        auto& shard = block_cache_shard(block_id);
+        LOCKER(shard.lock);
+        shard.cache.remove(block_id);
+        auto it = shard.dirty_blocks.find(block_id);
+        if (it != shard.dirty_blocks.end()) {
+            if ((*it).value.held)
+                --s_held_block_count;
+            shard.dirty_blocks.remove(it);
+            --s_dirty_block_count;
+        }
+    }
+    DiskOffset base_offset = static_cast<DiskOffset>(index) * static_cast<DiskOffset>(block_size());
+    return device().write(base_offset, count * block_size(), data);
+}
+
 void DiskBackedFS::set_block_size(unsigned block_size)
 {
     if (block_size == m_block_size)
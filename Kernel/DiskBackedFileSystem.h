@@ -6,12 +6,29 @@
 class DiskBackedFS : public FS {
 public:
     virtual ~DiskBackedFS() override;
+    virtual bool is_disk_backed() const override { return true; }
 
     DiskDevice& device() { return *m_device; }
     const DiskDevice& device() const { return *m_device; }
 
     int block_size() const { return m_block_size; }
 
+    struct BlockCacheStats {
+        unsigned capacity { 0 };
+        unsigned size { 0 };
+        unsigned hits { 0 };
+        unsigned misses { 0 };
+        unsigned evictions { 0 };
+        unsigned dirty { 0 };
+    };
+    static BlockCacheStats block_cache_stats();
+
+    enum class FlushMode { Expired, All };
+    static void flush_dirty_blocks(FlushMode);
+
+    // Drops up to count clean blocks from the cache, for when the kernel heap runs low. Returns how many were dropped.
+    static unsigned drop_cached_blocks(unsigned count);
+
 protected:
     explicit DiskBackedFS(Retained<DiskDevice>&&);
 
@@ -19,11 +36,23 @@ protected:
 
     ByteBuffer read_block(unsigned index) const;
     ByteBuffer read_blocks(unsigned index, unsigned count) const;
+    bool read_blocks_uncached(unsigned index, unsigned count, byte* buffer) const;
+    bool write_blocks_uncached(unsigned index, unsigned count, const byte* data);
 
     bool write_block(unsigned index, const ByteBuffer&);
     bool write_blocks(unsigned index, unsigned count, const ByteBuffer&);
 
+    // Like write_block(), but the block isn't written back until it's released.
+    // A journal holds the blocks of a transaction until the transaction has been committed.
+    bool write_held_block(unsigned index, const ByteBuffer&);
+    void release_held_block(unsigned index);
+
+    // Writes back whichever of these blocks are dirty, for fsync().
+    void flush_blocks(const Vector<unsigned>& indices);
+
 private:
+    void mark_block_dirty(unsigned index, const byte*, bool held = false);
+
     int m_block_size { 0 };
     Retained<DiskDevice> m_device;
 };
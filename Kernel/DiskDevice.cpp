@@ -1,4 +1,18 @@
 #include "DiskDevice.h"
+#include "Scheduler.h"
+#include "i8253.h"
+#include "system.h"
+#include <AK/ByteBuffer.h>
+#include <Kernel/Process.h>
+#include <Kernel/Tracing.h>
+
+//#define DISK_QUEUE_DEBUG
+
+// Requests older than this are dispatched ahead of the elevator order.
+static const dword request_deadline = TICKS_PER_SECOND / 2;
+
+// Upper bound on how many blocks a merged run may cover.
+static const dword max_merged_blocks = 128;
 
 DiskDevice::DiskDevice()
 {
@@ -8,21 +22,39 @@ DiskDevice::~DiskDevice()
 {
 }
 
-bool DiskDevice::read(DiskOffset offset, unsigned length, byte* out) const
+bool DiskDevice::read_blocks(unsigned index, unsigned count, byte* out) const
 {
-    ASSERT((offset % block_size()) == 0);
-    ASSERT((length % block_size()) == 0);
-    dword first_block = offset / block_size();
-    dword end_block = (offset + length) / block_size();
-    byte* outptr = out;
-    for (unsigned bi = first_block; bi < end_block; ++bi) {
-        if (!read_block(bi, outptr))
+    for (unsigned i = 0; i < count; ++i) {
+        if (!read_block(index + i, out))
             return false;
-        outptr += block_size();
+        out += block_size();
     }
     return true;
 }
 
+bool DiskDevice::write_blocks(unsigned index, unsigned count, const byte* in)
+{
+    for (unsigned i = 0; i < count; ++i) {
+        if (!write_block(index + i, in))
+            return false;
+        in += block_size();
+    }
+    return true;
+}
+
+bool DiskDevice::read(DiskOffset offset, unsigned length, byte* out) const
+{
+    ASSERT((offset % block_size()) == 0);
+    ASSERT((length % block_size()) == 0);
+    if (is_memory_backed())
+        return read_blocks(offset / block_size(), length / block_size(), out);
+    Request request;
+    request.index = offset / block_size();
+    request.count = length / block_size();
+    request.buffer = out;
+    return submit(request);
+}
+
 bool DiskDevice::write(DiskOffset offset, unsigned length, const byte* in)
 {
     ASSERT((offset % block_size()) == 0);
@@ -31,12 +63,163 @@ bool DiskDevice::write(DiskOffset offset, unsigned length, const byte* in)
     dword end_block = (offset + length) / block_size();
     ASSERT(first_block <= 0xffffffff);
     ASSERT(end_block <= 0xffffffff);
-    const byte* inptr = in;
-    for (unsigned bi = first_block; bi < end_block; ++bi) {
-        if (!write_block(bi, inptr))
-            return false;
-        inptr += block_size();
+    if (is_memory_backed())
+        return write_blocks(first_block, end_block - first_block, in);
+    Request request;
+    request.index = first_block;
+    request.count = end_block - first_block;
+    request.buffer = const_cast<byte*>(in);
+    request.is_write = true;
+    return submit(request);
+}
+
+bool DiskDevice::submit(Request& request) const
+{
+    if (!request.count)
+        return true;
+    TRACE(DiskSubmit, request.index, request.count, request.is_write);
+    // Billed to whoever asked, which for write-back is syncd rather than whoever dirtied the blocks.
+    if (current) {
+        if (request.is_write)
+            current->statistics().disk_bytes_written += request.count * block_size();
+        else
+            current->statistics().disk_bytes_read += request.count * block_size();
+    }
+
+    bool should_dispatch = false;
+    {
+        LOCKER(m_queue_lock);
+        request.queued_at = system.uptime;
+        m_queue.append(&request);
+        if (m_dispatcher_count < max_concurrent_transfers()) {
+            ++m_dispatcher_count;
+            should_dispatch = true;
+        }
+    }
+
+    if (should_dispatch)
+        dispatch_requests();
+
+    // FIXME: Block the thread instead of polling.
+    while (!request.completed)
+        Scheduler::yield();
+    memory_barrier();
+    TRACE(DiskComplete, request.index, request.count, request.success);
+    return request.success;
+}
+
+DiskDevice::Request* DiskDevice::take_next_request() const
+{
+    ASSERT(!m_queue.is_empty());
+    int chosen = -1;
+
+    // Bounded latency: anything that has waited past the deadline goes first.
+    dword now = system.uptime;
+    for (int i = 0; i < m_queue.size(); ++i) {
+        if (now - m_queue[i]->queued_at >= request_deadline) {
+            if (chosen == -1 || m_queue[i]->queued_at < m_queue[chosen]->queued_at)
+                chosen = i;
+        }
+    }
+
+    // C-LOOK: the lowest index at or beyond the head, otherwise wrap to the lowest index.
+    if (chosen == -1) {
+        int lowest = -1;
+        for (int i = 0; i < m_queue.size(); ++i) {
+            dword index = m_queue[i]->index;
+            if (index >= m_head_position && (chosen == -1 || index < m_queue[chosen]->index))
+                chosen = i;
+            if (lowest == -1 || index < m_queue[lowest]->index)
+                lowest = i;
+        }
+        if (chosen == -1)
+            chosen = lowest;
+    }
+
+    auto* request = m_queue[chosen];
+    m_queue.remove(chosen);
+    return request;
+}
+
+void DiskDevice::dispatch_requests() const
+{
+    for (;;) {
+        Vector<Request*> run;
+        {
+            LOCKER(m_queue_lock);
+            if (m_queue.is_empty()) {
+                --m_dispatcher_count;
+                return;
+            }
+            run.append(take_next_request());
+
+            // Pull in queued requests that continue the run in the same direction.
+            dword run_end = run[0]->index + run[0]->count;
+            dword run_blocks = run[0]->count;
+            for (bool merged = true; merged;) {
+                merged = false;
+                for (int i = 0; i < m_queue.size(); ++i) {
+                    auto& candidate = *m_queue[i];
+                    if (candidate.is_write != run[0]->is_write || candidate.index != run_end)
+                        continue;
+                    if (run_blocks + candidate.count > max_merged_blocks)
+                        continue;
+                    run.append(&candidate);
+                    run_end += candidate.count;
+                    run_blocks += candidate.count;
+                    m_queue.remove(i);
+                    merged = true;
+                    break;
+                }
+            }
+            m_head_position = run_end;
+        }
+        perform(run);
+    }
+}
+
+void DiskDevice::perform(Vector<Request*>& run) const
+{
+    auto& first = *run[0];
+    bool success;
+
+    if (run.size() == 1) {
+        if (first.is_write)
+            success = const_cast<DiskDevice&>(*this).write_blocks(first.index, first.count, first.buffer);
+        else
+            success = read_blocks(first.index, first.count, first.buffer);
+    } else {
+        dword total_blocks = 0;
+        for (auto* request : run)
+            total_blocks += request->count;
+#ifdef DISK_QUEUE_DEBUG
+        kprintf("DiskDevice: merged %u requests into %u blocks @ %u (%s)\n", run.size(), total_blocks, first.index, first.is_write ? "write" : "read");
+#endif
+        auto buffer = ByteBuffer::create_uninitialized(total_blocks * block_size());
+        if (first.is_write) {
+            byte* out = buffer.pointer();
+            for (auto* request : run) {
+                memcpy(out, request->buffer, request->count * block_size());
+                out += request->count * block_size();
+            }
+            success = const_cast<DiskDevice&>(*this).write_blocks(first.index, total_blocks, buffer.pointer());
+        } else {
+            success = read_blocks(first.index, total_blocks, buffer.pointer());
+            if (success) {
+                const byte* in = buffer.pointer();
+                for (auto* request : run) {
+                    memcpy(request->buffer, in, request->count * block_size());
+                    in += request->count * block_size();
+                }
+            }
+        }
+    }
+
+    // Once completed is set the submitter may return and take its Request with it.
+    for (auto* request : run) {
+        request->success = success;
+        memory_barrier();
+        request->completed = true;
     }
-    return true;
 }
 
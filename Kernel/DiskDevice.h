@@ -2,6 +2,8 @@
 
 #include <AK/Retainable.h>
 #include <AK/Types.h>
+#include <AK/Vector.h>
+#include <Kernel/Lock.h>
 
 // FIXME: Support 64-bit DiskOffset
 typedef dword DiskOffset;
@@ -13,11 +15,44 @@ public:
     virtual unsigned block_size() const = 0;
     virtual bool read_block(unsigned index, byte*) const = 0;
     virtual bool write_block(unsigned index, const byte*) = 0;
+    virtual bool read_blocks(unsigned index, unsigned count, byte*) const;
+    virtual bool write_blocks(unsigned index, unsigned count, const byte*);
     virtual const char* class_name() const = 0;
+    // For devices whose blocks are already in memory, like an image mapped in. They skip the request queue,
+    // and the block cache doesn't keep copies of what's read from them, since reading it again costs no more.
+    virtual bool is_memory_backed() const { return false; }
     bool read(DiskOffset, unsigned length, byte*) const;
     bool write(DiskOffset, unsigned length, const byte*);
 
 protected:
     DiskDevice();
+
+    // How many runs may be in read_blocks()/write_blocks() at once, each from a thread of its own.
+    // Devices that can keep several transfers in flight say how many, the rest take them one at a time.
+    virtual int max_concurrent_transfers() const { return 1; }
+
+private:
+    // Every read()/write() becomes a Request. Whichever caller finds a dispatcher slot free
+    // dispatches for everyone, in C-LOOK order with a deadline for starved requests,
+    // merging runs of adjacent requests in the same direction into one transfer.
+    struct Request {
+        dword index { 0 };
+        dword count { 0 };
+        byte* buffer { nullptr };
+        bool is_write { false };
+        dword queued_at { 0 };
+        bool success { false };
+        volatile bool completed { false };
+    };
+
+    bool submit(Request&) const;
+    void dispatch_requests() const;
+    Request* take_next_request() const;
+    void perform(Vector<Request*>& run) const;
+
+    mutable Lock m_queue_lock { "DiskDevice::queue" };
+    mutable Vector<Request*> m_queue;
+    mutable int m_dispatcher_count { 0 };
+    mutable dword m_head_position { 0 };
 };
 
@@ -1,12 +1,16 @@
 #include <Kernel/E1000NetworkAdapter.h>
 #include <Kernel/PCI.h>
 #include <Kernel/IO.h>
+#include <Kernel/Process.h>
 
 #define REG_CTRL        0x0000
 #define REG_STATUS      0x0008
 #define REG_EEPROM      0x0014
 #define REG_CTRL_EXT    0x0018
+#define REG_ICR         0x00C0 // Interrupt Cause Read
+#define REG_ITR         0x00C4 // Interrupt Throttling
 #define REG_IMASK       0x00D0
+#define REG_IMC         0x00D8 // Interrupt Mask Clear
 #define REG_RCTRL       0x0100
 #define REG_RXDESCLO    0x2800
 #define REG_RXDESCHI    0x2804
@@ -24,6 +28,7 @@
 #define REG_RADV        0x282C // RX Int. Absolute Delay Timer
 #define REG_RSRPD       0x2C00 // RX Small Packet Detect Interrupt
 #define REG_TIPG        0x0410 // Transmit Inter Packet Gap
+#define REG_RXCSUM      0x5000 // RX Checksum Control
 #define ECTRL_SLU        0x40        //set link up
 #define RCTL_EN                         (1 << 1)    // Receiver Enable
 #define RCTL_SBP                        (1 << 2)    // Store Bad Packets
@@ -47,6 +52,28 @@
 #define RCTL_PMCF                       (1 << 23)   // Pass MAC Control Frames
 #define RCTL_SECRC                      (1 << 26)   // Strip Ethernet CRC
 
+#define RXCSUM_IPOFL                    (1 << 8)    // IP Checksum Offload Enable
+#define RXCSUM_TUOFL                    (1 << 9)    // TCP/UDP Checksum Offload Enable
+
+// Interrupt Causes
+
+#define ICR_TXDW                        (1 << 0)    // Transmit Descriptor Written Back
+#define ICR_TXQE                        (1 << 1)    // Transmit Queue Empty
+#define ICR_LSC                         (1 << 2)    // Link Status Change
+#define ICR_RXDMT0                      (1 << 4)    // Receive Descriptor Minimum Threshold
+#define ICR_RXO                         (1 << 6)    // Receiver Overrun
+#define ICR_RXT0                        (1 << 7)    // Receiver Timer Interrupt
+
+// Everything about receiving is left to polling while it's masked.
+#define RX_INTERRUPT_CAUSES             (ICR_RXDMT0 | ICR_RXO | ICR_RXT0)
+
+// Receive Status and Errors
+
+#define RSTA_DD                         (1 << 0)    // Descriptor Done
+#define RSTA_IXSM                       (1 << 2)    // Ignore Checksum Indication
+#define RSTA_TCPCS                      (1 << 5)    // TCP/UDP Checksum Calculated
+#define RERR_TCPE                       (1 << 5)    // TCP/UDP Checksum Error
+
 // Buffer Sizes
 #define RCTL_BSIZE_256                  (3 << 16)
 #define RCTL_BSIZE_512                  (2 << 16)
@@ -80,7 +107,7 @@
 #define TSTA_LC                         (1 << 2)    // Late Collision
 #define LSTA_TU                         (1 << 3)    // Transmit Underrun
 
-OwnPtr<E1000NetworkAdapter> E1000NetworkAdapter::autodetect()
+OwnPtr<E1000NetworkAdapter> E1000NetworkAdapter::autodetect(const E1000Configuration& configuration)
 {
     static const PCI::ID qemu_bochs_vbox_id = { 0x8086, 0x100e };
     PCI::Address found_address;
@@ -93,7 +120,7 @@ OwnPtr<E1000NetworkAdapter> E1000NetworkAdapter::autodetect()
     if (found_address.is_null())
         return nullptr;
     byte irq = PCI::get_interrupt_line(found_address);
-    return make<E1000NetworkAdapter>(found_address, irq);
+    return make<E1000NetworkAdapter>(found_address, irq, configuration);
 }
 
 static E1000NetworkAdapter* s_the;
@@ -102,10 +129,16 @@ E1000NetworkAdapter* E1000NetworkAdapter::the()
     return s_the;
 }
 
-E1000NetworkAdapter::E1000NetworkAdapter(PCI::Address pci_address, byte irq)
-    : IRQHandler(irq)
+E1000NetworkAdapter::E1000NetworkAdapter(PCI::Address pci_address, byte irq, const E1000Configuration& configuration)
+    : NetworkAdapter("e1000")
+    , IRQHandler(irq)
     , m_pci_address(pci_address)
+    , m_rx_descriptor_count(configuration.rx_descriptor_count)
+    , m_tx_descriptor_count(configuration.tx_descriptor_count)
 {
+    ASSERT(m_rx_descriptor_count >= 8 && m_rx_descriptor_count <= 4096 && !(m_rx_descriptor_count % 8));
+    ASSERT(m_tx_descriptor_count >= 8 && m_tx_descriptor_count <= 4096 && !(m_tx_descriptor_count % 8));
+    ASSERT(configuration.max_interrupts_per_second > 0);
     s_the = this;
     kprintf("E1000: Found at PCI address %b:%b:%b\n", pci_address.bus(), pci_address.slot(), pci_address.function());
 
@@ -135,10 +168,17 @@ E1000NetworkAdapter::E1000NetworkAdapter(PCI::Address pci_address, byte irq)
     initialize_rx_descriptors();
     initialize_tx_descriptors();
 
+    // The throttling interval is counted in 256 ns units.
+    dword interval = 1000000000 / (configuration.max_interrupts_per_second * 256);
+    out32(REG_ITR, min(interval, (dword)0xffff));
+    kprintf("E1000: %d rx and %d tx descriptors, up to %d interrupts/s\n", m_rx_descriptor_count, m_tx_descriptor_count, configuration.max_interrupts_per_second);
+
     out32(REG_IMASK, 0x1f6dc);
     out32(REG_IMASK, 0xff & ~4);
-    in32(0xc0);
+    in32(REG_ICR);
 
+    if (use_message_signaled_interrupts(m_pci_address))
+        kprintf("E1000: Using message signaled interrupts\n");
     enable_irq();
 }
 
@@ -150,16 +190,19 @@ void E1000NetworkAdapter::handle_irq()
 {
     out32(REG_IMASK, 0x1);
 
-    dword status = in32(0xc0);
-    if (status & 4) {
+    dword status = in32(REG_ICR);
+    if (status & ICR_LSC) {
         dword flags = in32(REG_CTRL);
         out32(REG_CTRL, flags | ECTRL_SLU);
     }
-    if (status & 0x10) {
-        // Threshold OK?
+    if (status & (ICR_TXDW | ICR_TXQE)) {
+        // Transmit descriptors written back, or the transmit queue ran empty.
+        reclaim_tx_descriptors();
     }
-    if (status & 0x80) {
-        receive();
+    if (status & RX_INTERRUPT_CAUSES) {
+        // Stay quiet about received packets until the network task has caught up with them.
+        out32(REG_IMC, RX_INTERRUPT_CAUSES);
+        schedule_poll();
     }
 }
 
@@ -214,44 +257,50 @@ void E1000NetworkAdapter::read_mac_address()
 
 void E1000NetworkAdapter::initialize_rx_descriptors()
 {
-    auto ptr = (dword)kmalloc_eternal(sizeof(e1000_rx_desc) * number_of_rx_descriptors + 16);
+    auto ptr = (dword)kmalloc_eternal(sizeof(e1000_rx_desc) * m_rx_descriptor_count + 16);
     // Make sure it's 16-byte aligned.
     if (ptr % 16)
         ptr = (ptr + 16) - (ptr % 16);
     m_rx_descriptors = (e1000_rx_desc*)ptr;
-    for (int i = 0; i < number_of_rx_descriptors; ++i) {
+    // Long packets aren't enabled, so no frame is bigger than a buffer.
+    for (int i = 0; i < m_rx_descriptor_count; ++i) {
         auto& descriptor = m_rx_descriptors[i];
-        descriptor.addr = (qword)kmalloc_eternal(8192 + 16);
+        descriptor.addr = (qword)(dword)kmalloc_eternal(rx_buffer_size);
         descriptor.status = 0;
     }
 
     out32(REG_RXDESCLO, ptr);
     out32(REG_RXDESCHI, 0);
-    out32(REG_RXDESCLEN, number_of_rx_descriptors * sizeof(e1000_rx_desc));
+    out32(REG_RXDESCLEN, m_rx_descriptor_count * sizeof(e1000_rx_desc));
     out32(REG_RXDESCHEAD, 0);
-    out32(REG_RXDESCTAIL, number_of_rx_descriptors - 1);
+    m_rx_tail = m_rx_descriptor_count - 1;
+    out32(REG_RXDESCTAIL, m_rx_tail);
 
-    out32(REG_RCTRL, RCTL_EN| RCTL_SBP| RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC  | RCTL_BSIZE_8192);
+    out32(REG_RXCSUM, in32(REG_RXCSUM) | RXCSUM_IPOFL | RXCSUM_TUOFL);
+    out32(REG_RCTRL, RCTL_EN| RCTL_SBP| RCTL_UPE | RCTL_MPE | RCTL_LBM_NONE | RTCL_RDMTS_HALF | RCTL_BAM | RCTL_SECRC  | RCTL_BSIZE_2048);
 }
 
 void E1000NetworkAdapter::initialize_tx_descriptors()
 {
-    auto ptr = (dword)kmalloc_eternal(sizeof(e1000_tx_desc) * number_of_tx_descriptors + 16);
+    auto ptr = (dword)kmalloc_eternal(sizeof(e1000_tx_desc) * m_tx_descriptor_count + 16);
     // Make sure it's 16-byte aligned.
     if (ptr % 16)
         ptr = (ptr + 16) - (ptr % 16);
     m_tx_descriptors = (e1000_tx_desc*)ptr;
-    for (int i = 0; i < number_of_tx_descriptors; ++i) {
+    m_tx_packets.resize(m_tx_descriptor_count);
+    for (int i = 0; i < m_tx_descriptor_count; ++i) {
         auto& descriptor = m_tx_descriptors[i];
-        descriptor.addr = (qword)kmalloc_eternal(8192 + 16);
+        descriptor.addr = 0;
         descriptor.cmd = 0;
     }
 
     out32(REG_TXDESCLO, ptr);
     out32(REG_TXDESCHI, 0);
-    out32(REG_TXDESCLEN, number_of_tx_descriptors * sizeof(e1000_tx_desc));
+    out32(REG_TXDESCLEN, m_tx_descriptor_count * sizeof(e1000_tx_desc));
     out32(REG_TXDESCHEAD, 0);
     out32(REG_TXDESCTAIL, 0);
+    m_tx_clean = 0;
+    m_tx_next = 0;
 
     out32(REG_TCTRL, in32(REG_TCTRL) | TCTL_EN | TCTL_PSP);
     out32(REG_TIPG, 0x0060200A);
@@ -308,47 +357,106 @@ dword E1000NetworkAdapter::in32(word address)
     return IO::in32(m_io_base + address);
 }
 
-void E1000NetworkAdapter::send_raw(const byte* data, int length)
+void E1000NetworkAdapter::fill_tx_descriptor(PacketBuffer& packet)
 {
-    dword tx_current = in32(REG_TXDESCTAIL);
-#ifdef E1000_DEBUG
-    kprintf("E1000: Sending packet (%d bytes)\n", length);
-#endif
-    auto& descriptor = m_tx_descriptors[tx_current];
-    ASSERT(length <= 8192);
-    memcpy((void*)descriptor.addr, data, length);
-    descriptor.length = length;
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(has_free_tx_descriptor());
+    auto& descriptor = m_tx_descriptors[m_tx_next];
+    // The kernel heap is identity mapped, so the buffer's address is where the NIC finds it too.
+    descriptor.addr = (qword)(dword)packet.data();
+    descriptor.length = packet.size();
+    m_tx_packets[m_tx_next] = packet;
     descriptor.status = 0;
     descriptor.cmd = CMD_EOP | CMD_IFCS | CMD_RS;
+    descriptor.css = 0;
+    descriptor.cso = 0;
+    if (packet.has_offloaded_checksum()) {
+        descriptor.css = packet.checksum_start();
+        descriptor.cso = packet.checksum_field();
+        descriptor.cmd |= CMD_IC;
+    }
 #ifdef E1000_DEBUG
-    kprintf("E1000: Using tx descriptor %d (head is at %d)\n", tx_current, in32(REG_TXDESCHEAD));
+    kprintf("E1000: Using tx descriptor %d (head is at %d)\n", m_tx_next, in32(REG_TXDESCHEAD));
 #endif
-    tx_current = (tx_current + 1) % number_of_tx_descriptors;
-    out32(REG_TXDESCTAIL, tx_current);
-    while (!descriptor.status)
-        ;
+    m_tx_next = (m_tx_next + 1) % m_tx_descriptor_count;
+    out32(REG_TXDESCTAIL, m_tx_next);
+}
+
+// Takes back the descriptors the NIC is done sending, and fills them with whatever was queued up.
+void E1000NetworkAdapter::reclaim_tx_descriptors()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    while (m_tx_clean != m_tx_next && (m_tx_descriptors[m_tx_clean].status & TSTA_DD)) {
+        m_tx_packets[m_tx_clean] = nullptr;
+        m_tx_clean = (m_tx_clean + 1) % m_tx_descriptor_count;
+    }
+
+    bool dequeued_any = false;
+    while (!m_tx_queue.is_empty() && has_free_tx_descriptor()) {
+        auto packet = m_tx_queue.take_first();
+        --m_tx_queue_size;
+        fill_tx_descriptor(*packet);
+        dequeued_any = true;
+    }
+    if (dequeued_any)
+        m_tx_queue_alarm.wait_queue().wake_all();
+}
+
+void E1000NetworkAdapter::send_raw(PacketBuffer& packet)
+{
 #ifdef E1000_DEBUG
-    kprintf("E1000: Sent packet, status is now %b!\n", descriptor.status);
+    kprintf("E1000: Sending packet (%d bytes)\n", packet.size());
 #endif
+    ASSERT(packet.size() <= 8192);
+    for (;;) {
+        {
+            InterruptDisabler disabler;
+            reclaim_tx_descriptors();
+            // Going around the queue would send packets out of order.
+            if (m_tx_queue.is_empty() && has_free_tx_descriptor()) {
+                fill_tx_descriptor(packet);
+                return;
+            }
+            if (m_tx_queue_size < max_queued_tx_packets) {
+                m_tx_queue.append(packet);
+                ++m_tx_queue_size;
+                return;
+            }
+        }
+        // Throttle whoever's sending this fast until the NIC has caught up some.
+        current->snooze_until(m_tx_queue_alarm);
+    }
 }
 
-void E1000NetworkAdapter::receive()
+int E1000NetworkAdapter::receive_packets(int budget)
 {
-    dword rx_current;
-    for (;;) {
-        rx_current = in32(REG_RXDESCTAIL);
-        if (rx_current == in32(REG_RXDESCHEAD))
-            return;
-        rx_current = (rx_current + 1) % number_of_rx_descriptors;
-        if (!(m_rx_descriptors[rx_current].status & 1))
+    int received = 0;
+    while (received < budget) {
+        int rx_current = (m_rx_tail + 1) % m_rx_descriptor_count;
+        auto& descriptor = m_rx_descriptors[rx_current];
+        // The NIC never fills the descriptor at the tail, so this stops before catching up with the head.
+        if (!(descriptor.status & RSTA_DD))
             break;
-        auto* buffer = (byte*)m_rx_descriptors[rx_current].addr;
-        word length = m_rx_descriptors[rx_current].length;
+        auto* buffer = (byte*)(dword)descriptor.addr;
+        word length = descriptor.length;
+        // Whatever it has no checksum for, or got wrong, is checked again by whoever it's for.
+        bool checksum_verified = !(descriptor.status & RSTA_IXSM) && (descriptor.status & RSTA_TCPCS) && !(descriptor.errors & RERR_TCPE);
 #ifdef E1000_DEBUG
         kprintf("E1000: Received 1 packet @ %p (%u) bytes!\n", buffer, length);
 #endif
-        did_receive(buffer, length);
-        m_rx_descriptors[rx_current].status = 0;
-        out32(REG_RXDESCTAIL, rx_current);
+        did_receive(buffer, length, checksum_verified);
+        descriptor.status = 0;
+        m_rx_tail = rx_current;
+        ++received;
     }
+    // All of them go back to the NIC at once.
+    if (received)
+        out32(REG_RXDESCTAIL, m_rx_tail);
+    return received;
+}
+
+void E1000NetworkAdapter::enable_receive_interrupts()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    out32(REG_IMASK, RX_INTERRUPT_CAUSES);
 }
@@ -5,19 +5,39 @@
 #include <Kernel/MemoryManager.h>
 #include <Kernel/IRQHandler.h>
 #include <AK/OwnPtr.h>
+#include <AK/SinglyLinkedList.h>
+#include <AK/Vector.h>
+
+struct E1000Configuration {
+    // Each has to be a multiple of 8, since the rings are sized in 128 byte chunks.
+    int rx_descriptor_count { 64 };
+    int tx_descriptor_count { 32 };
+    // The most times a second it interrupts, however much comes in. Above that, packets are picked up by polling.
+    int max_interrupts_per_second { 8000 };
+};
 
 class E1000NetworkAdapter final : public NetworkAdapter, public IRQHandler {
 public:
     static E1000NetworkAdapter* the();
 
-    static OwnPtr<E1000NetworkAdapter> autodetect();
+    static OwnPtr<E1000NetworkAdapter> autodetect(const E1000Configuration& = { });
 
-    E1000NetworkAdapter(PCI::Address, byte irq);
+    E1000NetworkAdapter(PCI::Address, byte irq, const E1000Configuration&);
     virtual ~E1000NetworkAdapter() override;
 
-    virtual void send_raw(const byte*, int) override;
+    virtual void send_raw(PacketBuffer&) override;
+    virtual bool can_offload_checksums() const override { return true; }
 
 private:
+    // Rings for senders waiting on a full transmit queue, once there's room again.
+    class TransmitQueueAlarm final : public Alarm {
+    public:
+        explicit TransmitQueueAlarm(E1000NetworkAdapter& adapter) : m_adapter(adapter) { }
+        virtual bool is_ringing() const override { return m_adapter.m_tx_queue_size < max_queued_tx_packets; }
+    private:
+        E1000NetworkAdapter& m_adapter;
+    };
+
     virtual void handle_irq() override;
     virtual const char* class_name() const override { return "E1000NetworkAdapter"; }
 
@@ -57,7 +77,12 @@ private:
     word in16(word address);
     dword in32(word address);
 
-    void receive();
+    virtual int receive_packets(int budget) override;
+    virtual void enable_receive_interrupts() override;
+
+    bool has_free_tx_descriptor() const { return (m_tx_next + 1) % m_tx_descriptor_count != m_tx_clean; }
+    void fill_tx_descriptor(PacketBuffer&);
+    void reclaim_tx_descriptors();
 
     PCI::Address m_pci_address;
     word m_io_base { 0 };
@@ -66,9 +91,24 @@ private:
     bool m_has_eeprom { false };
     bool m_use_mmio { false };
 
-    static const int number_of_rx_descriptors = 32;
-    static const int number_of_tx_descriptors = 8;
+    static const int rx_buffer_size = 2048;
+    static const int max_queued_tx_packets = 64;
 
+    int m_rx_descriptor_count { 0 };
+    int m_tx_descriptor_count { 0 };
     e1000_rx_desc* m_rx_descriptors;
     e1000_tx_desc* m_tx_descriptors;
+
+    // The last descriptor handed back to the NIC, the one after it is the next to come in.
+    int m_rx_tail { 0 };
+
+    // The NIC owns the descriptors from m_tx_clean up to m_tx_next (the tail), one is always left empty.
+    int m_tx_clean { 0 };
+    int m_tx_next { 0 };
+    // The NIC reads each packet right out of its buffer, so it's kept alive until its descriptor comes back.
+    Vector<RetainPtr<PacketBuffer>> m_tx_packets;
+    // Packets waiting for a descriptor, handed to the NIC as it finishes with the ones before.
+    SinglyLinkedList<Retained<PacketBuffer>> m_tx_queue;
+    int m_tx_queue_size { 0 };
+    TransmitQueueAlarm m_tx_queue_alarm { *this };
 };
@@ -1,6 +1,9 @@
 #include "ELFImage.h"
 #include <AK/kstdio.h>
 
+// What lookups come back with when there's nothing to find.
+static const Elf32_Sym s_null_symbol { };
+
 ELFImage::ELFImage(const byte* buffer)
     : m_buffer(buffer)
 {
@@ -34,6 +37,9 @@ const char* ELFImage::section_index_to_string(unsigned index)
 
 unsigned ELFImage::symbol_count() const
 {
+    // Stripped images don't have one.
+    if (!m_symbol_table_section_index)
+        return 0;
     return section(m_symbol_table_section_index).entry_count();
 }
 
@@ -88,6 +94,16 @@ unsigned ELFImage::program_header_count() const
     return header().e_phnum;
 }
 
+const char* ELFImage::interpreter() const
+{
+    for (unsigned i = 0; i < program_header_count(); ++i) {
+        auto& program_header = program_header_internal(i);
+        if (program_header.p_type == PT_INTERP && program_header.p_filesz > 1)
+            return raw_data(program_header.p_offset);
+    }
+    return nullptr;
+}
+
 bool ELFImage::parse()
 {
     // We only support i386.
@@ -96,17 +112,17 @@ bool ELFImage::parse()
         return false;
     }
 
-    // First locate the string tables.
+    // First locate the symbol table and the hash tables.
     for (unsigned i = 0; i < section_count(); ++i) {
         auto& sh = section_header(i);
         if (sh.sh_type == SHT_SYMTAB) {
             ASSERT(!m_symbol_table_section_index);
             m_symbol_table_section_index = i;
         }
-        if (sh.sh_type == SHT_STRTAB && i != header().e_shstrndx) {
-            ASSERT(!m_string_table_section_index);
-            m_string_table_section_index = i;
-        }
+        if (sh.sh_type == SHT_HASH)
+            m_hash_section_index = i;
+        if (sh.sh_type == SHT_GNU_HASH)
+            m_gnu_hash_section_index = i;
     }
 
 #ifdef SUPPORT_RELOCATIONS
@@ -127,14 +143,6 @@ const char* ELFImage::section_header_table_string(unsigned offset) const
     return raw_data(sh.sh_offset + offset);
 }
 
-const char* ELFImage::table_string(unsigned offset) const
-{
-    auto& sh = section_header(m_string_table_section_index);
-    if (sh.sh_type != SHT_STRTAB)
-        return nullptr;
-    return raw_data(sh.sh_offset + offset);
-}
-
 const char* ELFImage::raw_data(unsigned offset) const
 {
     return reinterpret_cast<const char*>(m_buffer) + offset;
@@ -160,8 +168,111 @@ const Elf32_Shdr& ELFImage::section_header(unsigned index) const
 const ELFImage::Symbol ELFImage::symbol(unsigned index) const
 {
     ASSERT(index < symbol_count());
-    auto* raw_syms = reinterpret_cast<const Elf32_Sym*>(raw_data(section(m_symbol_table_section_index).offset()));
-    return Symbol(*this, index, raw_syms[index]);
+    return symbol_in_table(m_symbol_table_section_index, index);
+}
+
+const ELFImage::Symbol ELFImage::symbol_in_table(unsigned symbol_table_section_index, unsigned index) const
+{
+    // Dynamically linked images have both .strtab and .dynstr, every symbol table says which one is its own.
+    auto& table = section_header(symbol_table_section_index);
+    ASSERT(table.sh_entsize && index < table.sh_size / table.sh_entsize);
+    auto* raw_syms = reinterpret_cast<const Elf32_Sym*>(raw_data(table.sh_offset));
+    return Symbol(*this, index, raw_syms[index], raw_data(section_header(table.sh_link).sh_offset));
+}
+
+const ELFImage::Symbol ELFImage::null_symbol() const
+{
+    return Symbol(*this, 0, s_null_symbol, "");
+}
+
+static dword elf_hash(const char* name)
+{
+    dword hash = 0;
+    while (*name) {
+        hash = (hash << 4) + (byte)*name++;
+        dword high = hash & 0xf0000000;
+        if (high)
+            hash ^= high >> 24;
+        hash &= ~high;
+    }
+    return hash;
+}
+
+static dword gnu_hash(const char* name)
+{
+    dword hash = 5381;
+    while (*name)
+        hash = hash * 33 + (byte)*name++;
+    return hash;
+}
+
+const ELFImage::Symbol ELFImage::lookup_symbol(const char* name) const
+{
+    if (m_gnu_hash_section_index)
+        return lookup_symbol_with_gnu_hash(name);
+    if (m_hash_section_index)
+        return lookup_symbol_with_hash(name);
+    for (unsigned i = 1; i < symbol_count(); ++i) {
+        auto symbol = this->symbol(i);
+        if (!symbol.is_undefined() && !strcmp(symbol.name(), name))
+            return symbol;
+    }
+    return null_symbol();
+}
+
+const ELFImage::Symbol ELFImage::lookup_symbol_with_hash(const char* name) const
+{
+    // { bucket count, chain count, buckets..., chains... }, a chain per bucket, linked by symbol index.
+    auto& hash_section = section_header(m_hash_section_index);
+    auto* table = reinterpret_cast<const dword*>(raw_data(hash_section.sh_offset));
+    dword bucket_count = table[0];
+    if (!bucket_count)
+        return null_symbol();
+    auto* buckets = table + 2;
+    auto* chains = buckets + bucket_count;
+    for (dword index = buckets[elf_hash(name) % bucket_count]; index != STN_UNDEF; index = chains[index]) {
+        auto symbol = symbol_in_table(hash_section.sh_link, index);
+        if (!symbol.is_undefined() && !strcmp(symbol.name(), name))
+            return symbol;
+    }
+    return null_symbol();
+}
+
+const ELFImage::Symbol ELFImage::lookup_symbol_with_gnu_hash(const char* name) const
+{
+    // { bucket count, first hashed symbol, bloom word count, bloom shift, bloom words..., buckets..., hashes... }
+    // The hashed symbols are sorted by bucket, and each bucket points at the first of its run.
+    auto& hash_section = section_header(m_gnu_hash_section_index);
+    auto* table = reinterpret_cast<const dword*>(raw_data(hash_section.sh_offset));
+    dword bucket_count = table[0];
+    dword first_hashed_symbol = table[1];
+    dword bloom_size = table[2];
+    dword bloom_shift = table[3];
+    if (!bucket_count || !bloom_size)
+        return null_symbol();
+    auto* bloom = table + 4;
+    auto* buckets = bloom + bloom_size;
+    auto* hashes = buckets + bucket_count;
+
+    dword hash = gnu_hash(name);
+    // The Bloom filter turns away most names that aren't there without touching a single symbol.
+    dword bloom_word = bloom[(hash / 32) % bloom_size];
+    dword bloom_mask = (1u << (hash % 32)) | (1u << ((hash >> bloom_shift) % 32));
+    if ((bloom_word & bloom_mask) != bloom_mask)
+        return null_symbol();
+
+    // The stored hashes have their low bit replaced with "last in this bucket".
+    for (dword index = buckets[hash % bucket_count]; index >= first_hashed_symbol; ++index) {
+        dword chain_hash = hashes[index - first_hashed_symbol];
+        if ((chain_hash | 1) == (hash | 1)) {
+            auto symbol = symbol_in_table(hash_section.sh_link, index);
+            if (!symbol.is_undefined() && !strcmp(symbol.name(), name))
+                return symbol;
+        }
+        if (chain_hash & 1)
+            break;
+    }
+    return null_symbol();
 }
 
 const ELFImage::Section ELFImage::section(unsigned index) const
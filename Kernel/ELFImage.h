@@ -3,8 +3,9 @@
 #include <AK/OwnPtr.h>
 #include <AK/HashMap.h>
 #include <AK/AKString.h>
+#include <AK/Types.h>
+#include <Kernel/LinearAddress.h>
 #include "elf.h"
-#include "types.h"
 
 class ELFImage {
 public:
@@ -21,26 +22,30 @@ public:
 
     class Symbol {
     public:
-        Symbol(const ELFImage& image, unsigned index, const Elf32_Sym& sym)
+        Symbol(const ELFImage& image, unsigned index, const Elf32_Sym& sym, const char* string_table)
             : m_image(image)
             , m_sym(sym)
+            , m_string_table(string_table)
             , m_index(index)
         {
         }
 
         ~Symbol() { }
 
-        const char* name() const { return m_image.table_string(m_sym.st_name); }
+        const char* name() const { return m_string_table + m_sym.st_name; }
         unsigned section_index() const { return m_sym.st_shndx; }
         unsigned value() const { return m_sym.st_value; }
         unsigned size() const { return m_sym.st_size; }
         unsigned index() const { return m_index; }
         unsigned type() const { return ELF32_ST_TYPE(m_sym.st_info); }
+        unsigned bind() const { return ELF32_ST_BIND(m_sym.st_info); }
+        bool is_undefined() const { return m_sym.st_shndx == SHN_UNDEF; }
         const Section section() const { return m_image.section(section_index()); }
 
     private:
         const ELFImage& m_image;
         const Elf32_Sym& m_sym;
+        const char* m_string_table { nullptr };
         const unsigned m_index;
     };
 
@@ -155,9 +160,19 @@ public:
     // FIXME: I don't love this API.
     const Section lookup_section(const char* name) const;
 
+    // Finds a defined symbol through .gnu.hash or .hash when the image has one, and only then by going through
+    // the whole symbol table. The hash tables only cover the dynamic symbols (.dynsym), which is where a hit
+    // comes from, so its index() is into that table.
+    // NOTE: Returns the null symbol (index 0) if there's no such symbol.
+    const Symbol lookup_symbol(const char* name) const;
+
     bool is_executable() const { return header().e_type == ET_EXEC; }
     bool is_relocatable() const { return header().e_type == ET_REL; }
 
+    dword program_header_table_offset() const { return header().e_phoff; }
+    // The PT_INTERP path, if this image wants to be started through a dynamic loader.
+    const char* interpreter() const;
+
     LinearAddress entry() const { return LinearAddress(header().e_entry); }
 
 private:
@@ -166,9 +181,12 @@ private:
     const Elf32_Ehdr& header() const;
     const Elf32_Shdr& section_header(unsigned) const;
     const Elf32_Phdr& program_header_internal(unsigned) const;
-    const char* table_string(unsigned offset) const;
     const char* section_header_table_string(unsigned offset) const;
     const char* section_index_to_string(unsigned index);
+    const Symbol symbol_in_table(unsigned symbol_table_section_index, unsigned index) const;
+    const Symbol null_symbol() const;
+    const Symbol lookup_symbol_with_hash(const char* name) const;
+    const Symbol lookup_symbol_with_gnu_hash(const char* name) const;
 
     const byte* m_buffer { nullptr };
 #ifdef SUPPORT_RELOCATIONS
@@ -176,7 +194,8 @@ private:
 #endif
     bool m_valid { false };
     unsigned m_symbol_table_section_index { 0 };
-    unsigned m_string_table_section_index { 0 };
+    unsigned m_hash_section_index { 0 };
+    unsigned m_gnu_hash_section_index { 0 };
 };
 
 template<typename F>
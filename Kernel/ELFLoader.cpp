@@ -1,4 +1,5 @@
 #include "ELFLoader.h"
+#include "i386.h"
 #include <AK/kstdio.h>
 
 //#define ELFLOADER_DEBUG
@@ -45,8 +46,8 @@ bool ELFLoader::layout()
         kprintf("PH: L%x %u r:%u w:%u\n", program_header.laddr().get(), program_header.size_in_memory(), program_header.is_readable(), program_header.is_writable());
 #endif
         if (program_header.is_writable()) {
-            allocate_section(program_header.laddr(), program_header.size_in_memory(), program_header.alignment(), program_header.is_readable(), program_header.is_writable());
-            memcpy(program_header.laddr().as_ptr(), program_header.raw_data(), program_header.size_in_image());
+            if (!layout_writable_segment(program_header))
+                failed = true;
         } else {
             map_section(program_header.laddr(), program_header.size_in_memory(), program_header.alignment(), program_header.offset(), program_header.is_readable(), program_header.is_writable());
         }
@@ -54,6 +55,41 @@ bool ELFLoader::layout()
     return !failed;
 }
 
+bool ELFLoader::layout_writable_segment(const ELFImage::ProgramHeader& program_header)
+{
+    auto laddr = program_header.laddr();
+    size_t size_in_image = program_header.size_in_image();
+    size_t size_in_memory = program_header.size_in_memory();
+
+    // The file contents can only be mapped if they sit at the same offset within a page in both places.
+    if ((laddr.get() & ~PAGE_MASK) != (program_header.offset() & ~PAGE_MASK)) {
+        if (!allocate_section(laddr, size_in_memory, program_header.alignment(), program_header.is_readable(), true))
+            return false;
+        memcpy(laddr.as_ptr(), program_header.raw_data(), size_in_image);
+        return true;
+    }
+
+    // Whole pages of initialized data are mapped copy-on-write. The page where the file contents end
+    // and the rest of .bss get fresh zero pages, with the leftover file bytes copied in.
+    dword file_end = laddr.get() + size_in_image;
+    dword mapped_end = file_end & PAGE_MASK;
+    if (mapped_end > laddr.get()) {
+        if (!map_section(laddr, mapped_end - laddr.get(), program_header.alignment(), program_header.offset(), program_header.is_readable(), true))
+            return false;
+    } else {
+        mapped_end = laddr.get() & PAGE_MASK;
+    }
+    dword memory_end = laddr.get() + size_in_memory;
+    if (memory_end > mapped_end) {
+        if (!allocate_section(LinearAddress(mapped_end), memory_end - mapped_end, program_header.alignment(), program_header.is_readable(), true))
+            return false;
+        dword copy_start = max(mapped_end, laddr.get());
+        if (file_end > copy_start)
+            memcpy((void*)copy_start, program_header.raw_data() + (copy_start - laddr.get()), file_end - copy_start);
+    }
+    return true;
+}
+
 #ifdef SUPPORT_RELOCATIONS
 void* ELFLoader::lookup(const ELFImage::Symbol& symbol)
 {
@@ -144,23 +180,17 @@ bool ELFLoader::perform_relocations()
 
 char* ELFLoader::symbol_ptr(const char* name)
 {
-    char* found_ptr = nullptr;
-    m_image.for_each_symbol([&] (const ELFImage::Symbol symbol) {
-        if (symbol.type() != STT_FUNC)
-            return true;
-        if (strcmp(symbol.name(), name))
-            return true;
-        if (m_image.is_executable())
-            found_ptr = (char*)symbol.value();
+    auto symbol = m_image.lookup_symbol(name);
+    if (!symbol.index() || symbol.type() != STT_FUNC)
+        return nullptr;
+    if (m_image.is_executable())
+        return (char*)symbol.value();
 #ifdef SUPPORT_RELOCATIONS
-        else if (m_image.is_relocatable())
-            found_ptr = area_for_section(symbol.section()) + symbol.value();
+    if (m_image.is_relocatable())
+        return area_for_section(symbol.section()) + symbol.value();
 #endif
-        else
-            ASSERT_NOT_REACHED();
-        return false;
-    });
-    return found_ptr;
+    ASSERT_NOT_REACHED();
+    return nullptr;
 }
 
 bool ELFLoader::allocate_section(LinearAddress laddr, size_t size, size_t alignment, bool is_readable, bool is_writable)
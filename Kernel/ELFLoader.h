@@ -18,9 +18,11 @@ public:
     bool allocate_section(LinearAddress, size_t, size_t alignment, bool is_readable, bool is_writable);
     bool map_section(LinearAddress, size_t, size_t alignment, size_t offset_in_image, bool is_readable, bool is_writable);
     LinearAddress entry() const { return m_image.entry(); }
+    const ELFImage& image() const { return m_image; }
 
 private:
     bool layout();
+    bool layout_writable_segment(const ELFImage::ProgramHeader&);
     bool perform_relocations();
     void* lookup(const ELFImage::Symbol&);
     char* area_for_section(const ELFImage::Section&);
@@ -0,0 +1,155 @@
+#include <Kernel/EPoll.h>
+#include <Kernel/FileDescriptor.h>
+#include <Kernel/Process.h>
+#include <LibC/errno_numbers.h>
+
+//#define EPOLL_DEBUG
+
+Retained<EPoll> EPoll::create()
+{
+    return adopt(*new EPoll);
+}
+
+EPoll::~EPoll()
+{
+    // The entries unlink themselves from us, do it while we're still in one piece.
+    m_entries.clear();
+}
+
+EPoll::Entry::Entry(EPoll& epoll, int fd, FileDescriptor& descriptor, const epoll_event& event)
+    : m_epoll(epoll)
+    , m_fd(fd)
+    , m_descriptor(descriptor.make_weak_ptr())
+    , m_wait_queue(descriptor.wait_queue())
+    , m_event(event)
+{
+    if (m_wait_queue)
+        m_wait_queue->add_watcher(*this);
+}
+
+EPoll::Entry::~Entry()
+{
+    if (m_wait_queue)
+        m_wait_queue->remove_watcher(*this);
+    m_epoll.unmark_pending(*this);
+}
+
+void EPoll::Entry::wait_queue_did_wake(WaitQueue&)
+{
+    m_epoll.mark_pending(*this);
+}
+
+void EPoll::Entry::wait_queue_did_go_away(WaitQueue&)
+{
+    // Whatever we were watching is gone, have the next epoll_wait() notice and drop us.
+    m_wait_queue = nullptr;
+    m_epoll.mark_pending(*this);
+}
+
+void EPoll::mark_pending(Entry& entry)
+{
+    InterruptDisabler disabler;
+    if (entry.m_pending)
+        return;
+    entry.m_pending = true;
+    m_pending_entries.append(&entry);
+    m_wait_queue.wake_all();
+}
+
+void EPoll::unmark_pending(Entry& entry)
+{
+    InterruptDisabler disabler;
+    if (!entry.m_pending)
+        return;
+    entry.m_pending = false;
+    m_pending_entries.remove(&entry);
+}
+
+KResult EPoll::add(int fd, FileDescriptor& descriptor, const epoll_event& event)
+{
+    LOCKER(m_lock);
+    auto it = m_entries.find(fd);
+    if (it != m_entries.end()) {
+        if ((*it).value->m_descriptor.ptr() == &descriptor)
+            return KResult(-EEXIST);
+        // The fd was closed and reused since it was added, the old entry is stale.
+        m_entries.remove(it);
+    }
+    auto entry = make<Entry>(*this, fd, descriptor, event);
+    auto& new_entry = *entry;
+    m_entries.set(fd, move(entry));
+    // It may well be ready already.
+    mark_pending(new_entry);
+    return KSuccess;
+}
+
+KResult EPoll::modify(int fd, const epoll_event& event)
+{
+    LOCKER(m_lock);
+    auto it = m_entries.find(fd);
+    if (it == m_entries.end())
+        return KResult(-ENOENT);
+    auto& entry = *(*it).value;
+    entry.m_event = event;
+    mark_pending(entry);
+    return KSuccess;
+}
+
+KResult EPoll::remove(int fd)
+{
+    LOCKER(m_lock);
+    auto it = m_entries.find(fd);
+    if (it == m_entries.end())
+        return KResult(-ENOENT);
+    m_entries.remove(it);
+    return KSuccess;
+}
+
+void EPoll::collect_events(Process& process, Vector<epoll_event>& events, int max_events)
+{
+    LOCKER(m_lock);
+    Vector<Entry*> stale_entries;
+    {
+        InterruptDisabler disabler;
+        // Entries we report stay pending, behind everyone else, so one busy descriptor can't starve the rest.
+        InlineLinkedList<Entry> still_pending;
+        while (events.size() < max_events) {
+            auto* entry = m_pending_entries.remove_head();
+            if (!entry)
+                break;
+            entry->m_pending = false;
+            auto* descriptor = entry->m_descriptor.ptr();
+            if (!descriptor || !entry->m_wait_queue || process.file_descriptor(entry->m_fd) != descriptor) {
+                stale_entries.append(entry);
+                continue;
+            }
+            dword ready = 0;
+            if ((entry->m_event.events & EPOLLIN) && descriptor->can_read(process))
+                ready |= EPOLLIN;
+            if ((entry->m_event.events & EPOLLOUT) && descriptor->can_write(process))
+                ready |= EPOLLOUT;
+            if (!ready)
+                continue;
+            events.append({ ready, entry->m_event.data });
+            if (entry->m_event.events & EPOLLONESHOT) {
+                // Disarmed until the next EPOLL_CTL_MOD.
+                entry->m_event.events &= ~(EPOLLIN | EPOLLOUT);
+                continue;
+            }
+            if (entry->m_event.events & EPOLLET)
+                continue;
+            entry->m_pending = true;
+            still_pending.append(entry);
+        }
+        m_pending_entries.append(still_pending);
+    }
+    for (auto* entry : stale_entries) {
+        auto it = m_entries.find(entry->m_fd);
+        if (it == m_entries.end() || (*it).value.ptr() != entry)
+            continue;
+#ifdef EPOLL_DEBUG
+        dbgprintf("EPoll{%p}: Dropping stale entry for fd %d\n", this, entry->m_fd);
+#endif
+        m_entries.remove(it);
+    }
+}
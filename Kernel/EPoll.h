@@ -0,0 +1,70 @@
+#pragma once
+
+#include <AK/HashMap.h>
+#include <AK/InlineLinkedList.h>
+#include <AK/OwnPtr.h>
+#include <AK/Retainable.h>
+#include <AK/RetainPtr.h>
+#include <AK/Vector.h>
+#include <AK/WeakPtr.h>
+#include <Kernel/KResult.h>
+#include <Kernel/Lock.h>
+#include <Kernel/UnixTypes.h>
+#include <Kernel/WaitQueue.h>
+
+class FileDescriptor;
+class Process;
+
+// A persistent set of descriptors to watch, made by epoll_create().
+// Each watched descriptor's wait queue tells us when it wakes, and only those are re-checked by epoll_wait().
+// That makes waiting O(ready descriptors) instead of O(watched descriptors) like select() and poll().
+class EPoll : public Retainable<EPoll> {
+public:
+    static Retained<EPoll> create();
+    ~EPoll();
+
+    KResult add(int fd, FileDescriptor&, const epoll_event&);
+    KResult modify(int fd, const epoll_event&);
+    KResult remove(int fd);
+
+    // Appends up to max_events events. Readiness is level-triggered unless asked otherwise,
+    // so descriptors that are still ready get reported again next time.
+    void collect_events(Process&, Vector<epoll_event>&, int max_events);
+
+    // Someone may be ready. Used when an epoll descriptor itself is select()'ed or read-polled.
+    bool has_pending_entries() const { return !m_pending_entries.is_empty(); }
+
+    WaitQueue& wait_queue() { return m_wait_queue; }
+
+private:
+    EPoll() { }
+
+    class Entry : public WaitQueueWatcher, public InlineLinkedListNode<Entry> {
+    public:
+        Entry(EPoll&, int fd, FileDescriptor&, const epoll_event&);
+        virtual ~Entry() override;
+
+        virtual void wait_queue_did_wake(WaitQueue&) override;
+        virtual void wait_queue_did_go_away(WaitQueue&) override;
+
+        EPoll& m_epoll;
+        int m_fd { -1 };
+        WeakPtr<FileDescriptor> m_descriptor;
+        WaitQueue* m_wait_queue { nullptr };
+        epoll_event m_event;
+        bool m_pending { false };
+
+        // For m_pending_entries.
+        Entry* m_prev { nullptr };
+        Entry* m_next { nullptr };
+    };
+
+    void mark_pending(Entry&);
+    void unmark_pending(Entry&);
+
+    // Guards m_entries. IRQ handlers only ever touch the pending list, under an InterruptDisabler.
+    Lock m_lock { "EPoll" };
+    HashMap<int, OwnPtr<Entry>> m_entries;
+    InlineLinkedList<Entry> m_pending_entries;
+    WaitQueue m_wait_queue;
+};
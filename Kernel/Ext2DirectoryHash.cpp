@@ -0,0 +1,153 @@
+#include "Ext2DirectoryHash.h"
+#include "ext2_fs.h"
+
+namespace Ext2DirectoryHash {
+
+static dword rotate_left(dword value, unsigned shift)
+{
+    return (value << shift) | (value >> (32 - shift));
+}
+
+static dword legacy_hash(const char* name, int length, bool is_unsigned)
+{
+    dword hash0 = 0x12a3fe2d;
+    dword hash1 = 0x37abe8f9;
+    for (int i = 0; i < length; ++i) {
+        int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        dword hash = hash1 + (hash0 ^ (dword)(c * 7152373));
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+// Packs the name into 32-bit words the way the on-disk format expects, padding with the length.
+static void name_to_words(const char* name, int length, dword* words, int word_count, bool is_unsigned)
+{
+    dword pad = (dword)length | ((dword)length << 8);
+    pad |= pad << 16;
+    dword value = pad;
+    if (length > word_count * 4)
+        length = word_count * 4;
+    for (int i = 0; i < length; ++i) {
+        int c = is_unsigned ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+        value = (dword)c + (value << 8);
+        if ((i % 4) == 3) {
+            *words++ = value;
+            value = pad;
+            --word_count;
+        }
+    }
+    if (--word_count >= 0)
+        *words++ = value;
+    while (--word_count >= 0)
+        *words++ = pad;
+}
+
+static void half_md4_transform(dword* buffer, const dword* in)
+{
+    dword a = buffer[0];
+    dword b = buffer[1];
+    dword c = buffer[2];
+    dword d = buffer[3];
+
+    auto f = [] (dword x, dword y, dword z) { return z ^ (x & (y ^ z)); };
+    auto g = [] (dword x, dword y, dword z) { return (x & y) + ((x ^ y) & z); };
+    auto h = [] (dword x, dword y, dword z) { return x ^ y ^ z; };
+#define ROUND(func, a, b, c, d, x, s) a = rotate_left(a + func(b, c, d) + (x), s)
+
+    ROUND(f, a, b, c, d, in[0], 3);
+    ROUND(f, d, a, b, c, in[1], 7);
+    ROUND(f, c, d, a, b, in[2], 11);
+    ROUND(f, b, c, d, a, in[3], 19);
+    ROUND(f, a, b, c, d, in[4], 3);
+    ROUND(f, d, a, b, c, in[5], 7);
+    ROUND(f, c, d, a, b, in[6], 11);
+    ROUND(f, b, c, d, a, in[7], 19);
+
+    const dword k2 = 0x5a827999;
+    ROUND(g, a, b, c, d, in[1] + k2, 3);
+    ROUND(g, d, a, b, c, in[3] + k2, 5);
+    ROUND(g, c, d, a, b, in[5] + k2, 9);
+    ROUND(g, b, c, d, a, in[7] + k2, 13);
+    ROUND(g, a, b, c, d, in[0] + k2, 3);
+    ROUND(g, d, a, b, c, in[2] + k2, 5);
+    ROUND(g, c, d, a, b, in[4] + k2, 9);
+    ROUND(g, b, c, d, a, in[6] + k2, 13);
+
+    const dword k3 = 0x6ed9eba1;
+    ROUND(h, a, b, c, d, in[3] + k3, 3);
+    ROUND(h, d, a, b, c, in[7] + k3, 9);
+    ROUND(h, c, d, a, b, in[2] + k3, 11);
+    ROUND(h, b, c, d, a, in[6] + k3, 15);
+    ROUND(h, a, b, c, d, in[1] + k3, 3);
+    ROUND(h, d, a, b, c, in[5] + k3, 9);
+    ROUND(h, c, d, a, b, in[0] + k3, 11);
+    ROUND(h, b, c, d, a, in[4] + k3, 15);
+#undef ROUND
+
+    buffer[0] += a;
+    buffer[1] += b;
+    buffer[2] += c;
+    buffer[3] += d;
+}
+
+static void tea_transform(dword* buffer, const dword* in)
+{
+    dword sum = 0;
+    dword b0 = buffer[0];
+    dword b1 = buffer[1];
+    for (int n = 0; n < 16; ++n) {
+        sum += 0x9e3779b9;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    buffer[0] += b0;
+    buffer[1] += b1;
+}
+
+dword hash(const char* name, int length, byte hash_version, const dword* seed)
+{
+    dword buffer[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    if (seed && (seed[0] || seed[1] || seed[2] || seed[3])) {
+        for (int i = 0; i < 4; ++i)
+            buffer[i] = seed[i];
+    }
+
+    dword result;
+    dword in[8];
+    switch (hash_version) {
+    case EXT2_HASH_LEGACY:
+    case EXT2_HASH_LEGACY_UNSIGNED:
+        result = legacy_hash(name, length, hash_version == EXT2_HASH_LEGACY_UNSIGNED);
+        break;
+    case EXT2_HASH_HALF_MD4:
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+        for (const char* p = name; length > 0; length -= 32, p += 32) {
+            name_to_words(p, length, in, 8, hash_version == EXT2_HASH_HALF_MD4_UNSIGNED);
+            half_md4_transform(buffer, in);
+        }
+        result = buffer[1];
+        break;
+    case EXT2_HASH_TEA:
+    case EXT2_HASH_TEA_UNSIGNED:
+        for (const char* p = name; length > 0; length -= 16, p += 16) {
+            name_to_words(p, length, in, 4, hash_version == EXT2_HASH_TEA_UNSIGNED);
+            tea_transform(buffer, in);
+        }
+        result = buffer[0];
+        break;
+    default:
+        return 0;
+    }
+
+    // The low bit is reserved for marking hash collisions that continue into the next leaf.
+    result &= ~1u;
+    if (result == (0x7fffffffu << 1))
+        result = (0x7fffffffu - 1) << 1;
+    return result;
+}
+
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <AK/Types.h>
+
+// The name hashes used by ext2/3 htree directory indexes, as selected by dx_root_info.hash_version.
+namespace Ext2DirectoryHash {
+
+dword hash(const char* name, int length, byte hash_version, const dword* seed);
+
+}
@@ -2,18 +2,21 @@
 #include "ext2_fs.h"
 #include "UnixTypes.h"
 #include "RTC.h"
+#include "Ext2DirectoryHash.h"
 #include <AK/Bitmap.h>
 #include <AK/StdLibExtras.h>
 #include <AK/kmalloc.h>
 #include <AK/ktime.h>
 #include <AK/kstdio.h>
 #include <AK/BufferStream.h>
+#include <AK/QuickSort.h>
 #include <LibC/errno_numbers.h>
 #include <Kernel/Process.h>
 
 //#define EXT2_DEBUG
 
 static const ssize_t max_inline_symlink_length = 60;
+static const unsigned max_unused_inodes = 512;
 
 Retained<Ext2FS> Ext2FS::create(Retained<DiskDevice>&& device)
 {
@@ -43,6 +46,15 @@ ByteBuffer Ext2FS::read_super_block() const
 bool Ext2FS::write_super_block(const ext2_super_block& sb)
 {
     LOCKER(m_lock);
+    if (m_journal) {
+        // The superblock is the 1024 bytes at 1024, so it goes through the journal as part of whichever block holds it.
+        unsigned block_index = 1024 / block_size();
+        auto block = read_block(block_index);
+        ASSERT(block);
+        auto copy = ByteBuffer::copy(block.pointer(), block.size());
+        memcpy(copy.offset_pointer(1024 % block_size()), &sb, 1024);
+        return write_metadata_block(block_index, copy);
+    }
     const byte* raw = (const byte*)&sb;
     bool success;
     success = device().write_block(2, raw);
@@ -116,6 +128,9 @@ bool Ext2FS::initialize()
     // Preheat the BGD cache.
     group_descriptor(0);
 
+    if (!initialize_journal())
+        return false;
+
 #ifdef EXT2_DEBUG
     for (unsigned i = 1; i <= m_block_group_count; ++i) {
         auto& group = group_descriptor(i);
@@ -160,173 +175,212 @@ ByteBuffer Ext2FS::read_block_containing_inode(unsigned inode, unsigned& block_i
     return read_block(block_index);
 }
 
-Ext2FS::BlockListShape Ext2FS::compute_block_list_shape(unsigned blocks)
+// The i_block slots for the singly, doubly and triply indirect trees, by depth.
+static const unsigned indirect_block_slots[] = { EXT2_IND_BLOCK, EXT2_DIND_BLOCK, EXT2_TIND_BLOCK };
+
+// Stores one entry of a direct block or block array, keeping i_blocks in step with what's allocated.
+static inline void set_block_entry(__u32& entry, unsigned block_index, ext2_inode& e2inode, unsigned sectors_per_block)
 {
-    BlockListShape shape;
-    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
-    unsigned blocks_remaining = blocks;
-    shape.direct_blocks = min((unsigned)EXT2_NDIR_BLOCKS, blocks_remaining);
-    blocks_remaining -= shape.direct_blocks;
-    if (!blocks_remaining)
-        return shape;
-    shape.indirect_blocks = min(blocks_remaining, entries_per_block);
-    blocks_remaining -= shape.indirect_blocks;
-    shape.meta_blocks += 1;
-    if (!blocks_remaining)
-        return shape;
-    ASSERT_NOT_REACHED();
-    // FIXME: Support dind/tind blocks.
-    shape.doubly_indirect_blocks = min(blocks_remaining, entries_per_block * entries_per_block);
-    blocks_remaining -= shape.doubly_indirect_blocks;
-    if (!blocks_remaining)
-        return shape;
-    shape.triply_indirect_blocks = min(blocks_remaining, entries_per_block * entries_per_block * entries_per_block);
-    blocks_remaining -= shape.triply_indirect_blocks;
-    // FIXME: What do we do for files >= 16GB?
-    ASSERT(!blocks_remaining);
-    return shape;
+    if (!entry && block_index)
+        e2inode.i_blocks += sectors_per_block;
+    else if (entry && !block_index)
+        e2inode.i_blocks -= sectors_per_block;
+    entry = block_index;
 }
 
-bool Ext2FS::write_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2inode, const Vector<BlockIndex>& blocks)
+bool Ext2FS::update_block_array(InodeIndex inode_index, ext2_inode& e2inode, BlockIndex& array_block, unsigned depth, unsigned base, const Vector<BlockIndex>& blocks, unsigned first, unsigned end)
 {
-    LOCKER(m_lock);
-
-    // NOTE: There is a mismatch between i_blocks and blocks.size() since i_blocks includes meta blocks and blocks.size() does not.
-    auto old_block_count = ceil_div(e2inode.i_size, block_size());
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    const unsigned sectors_per_block = block_size() / 512;
+    unsigned entries_per_child = 1;
+    for (unsigned i = 1; i < depth; ++i)
+        entries_per_child *= entries_per_block;
+
+    ByteBuffer contents;
+    if (!array_block) {
+        // A hole needs no array until something goes in it. Put the array right after the last block it holds.
+        BlockIndex goal = 0;
+        for (unsigned i = first; i < end; ++i) {
+            if (blocks[i])
+                goal = blocks[i] + 1;
+        }
+        if (!goal)
+            return true;
+        auto new_blocks = allocate_blocks(group_index_from_block_index(goal), 1, goal);
+        if (new_blocks.is_empty())
+            new_blocks = allocate_blocks(group_index_from_inode(inode_index), 1);
+        if (new_blocks.is_empty()) {
+            kprintf("Ext2FS: update_block_array: couldn't allocate a meta block for inode %u\n", inode_index);
+            return false;
+        }
+        array_block = new_blocks[0];
+        set_block_allocation_state(array_block, true);
+        e2inode.i_blocks += sectors_per_block;
+        contents = ByteBuffer::create_zeroed(block_size());
+    } else {
+        auto block = read_block(array_block);
+        if (!block)
+            return false;
+        contents = ByteBuffer::copy(block.pointer(), block.size());
+    }
 
-    auto old_shape = compute_block_list_shape(old_block_count);
-    auto new_shape = compute_block_list_shape(blocks.size());
+    auto* entries = reinterpret_cast<__u32*>(contents.pointer());
+    if (depth == 1) {
+        for (unsigned i = first; i < end; ++i)
+            set_block_entry(entries[i - base], blocks[i], e2inode, sectors_per_block);
+    } else {
+        unsigned last_child = (end - 1 - base) / entries_per_child;
+        for (unsigned child = (first - base) / entries_per_child; child <= last_child; ++child) {
+            unsigned child_base = base + child * entries_per_child;
+            BlockIndex child_block = entries[child];
+            if (!update_block_array(inode_index, e2inode, child_block, depth - 1, child_base, blocks, max(first, child_base), min(end, child_base + entries_per_child)))
+                return false;
+            entries[child] = child_block;
+        }
+    }
 
-    Vector<BlockIndex> new_meta_blocks;
-    if (new_shape.meta_blocks > old_shape.meta_blocks) {
-        new_meta_blocks = allocate_blocks(group_index_from_inode(inode_index), new_shape.meta_blocks - old_shape.meta_blocks);
-        for (auto block_index : new_meta_blocks)
-            set_block_allocation_state(block_index, true);
+    // Punching holes can leave an array with nothing in it, and then it goes too.
+    bool is_empty = true;
+    for (unsigned i = 0; i < entries_per_block && is_empty; ++i)
+        is_empty = !entries[i];
+    if (is_empty) {
+        set_block_allocation_state(array_block, false);
+        e2inode.i_blocks -= sectors_per_block;
+        array_block = 0;
+        return true;
     }
+    return write_metadata_block(array_block, contents);
+}
 
-    e2inode.i_blocks = (blocks.size() + new_shape.meta_blocks) * (block_size() / 512);
+bool Ext2FS::write_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2inode, const Vector<BlockIndex>& blocks, unsigned first, unsigned end)
+{
+    LOCKER(m_lock);
+    ASSERT(first <= end && end <= (unsigned)blocks.size());
+    const unsigned sectors_per_block = block_size() / 512;
 
-    bool inode_dirty = false;
+    // Only the entries for blocks [first, end) are written, so appending touches the i_block array
+    // or a single path of indirect blocks, and nothing else. i_blocks counts the data and meta blocks
+    // that are actually there, holes take none. The caller is responsible for writing out the inode itself.
+    for (unsigned i = first; i < min(end, (unsigned)EXT2_NDIR_BLOCKS); ++i)
+        set_block_entry(e2inode.i_block[i], blocks[i], e2inode, sectors_per_block);
 
-    unsigned output_block_index = 0;
-    unsigned remaining_blocks = blocks.size();
-    for (unsigned i = 0; i < new_shape.direct_blocks; ++i) {
-        if (e2inode.i_block[i] != blocks[output_block_index])
-            inode_dirty = true;
-        e2inode.i_block[i] = blocks[output_block_index];
-        ++output_block_index;
-        --remaining_blocks;
-    }
-    if (inode_dirty) {
-        dbgprintf("Ext2FS: Writing %u direct block(s) to i_block array of inode %u\n", min(EXT2_NDIR_BLOCKS, blocks.size()), inode_index);
-        write_ext2_inode(inode_index, e2inode);
-        inode_dirty = false;
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    unsigned base = EXT2_NDIR_BLOCKS;
+    unsigned span = entries_per_block;
+    for (unsigned depth = 1; depth <= 3 && base < end; ++depth) {
+        if (first < base + span) {
+            BlockIndex root = e2inode.i_block[indirect_block_slots[depth - 1]];
+            if (!update_block_array(inode_index, e2inode, root, depth, base, blocks, max(first, base), min(end, base + span)))
+                return false;
+            e2inode.i_block[indirect_block_slots[depth - 1]] = root;
+        }
+        base += span;
+        span *= entries_per_block;
     }
+    // FIXME: What do we do for files >= 16GB?
+    ASSERT(end <= base);
+    return true;
+}
 
-    if (!remaining_blocks)
+bool Ext2FS::punch_block_list_for_inode(InodeIndex inode_index, ext2_inode& e2inode, Vector<BlockIndex>& blocks, unsigned first, unsigned end)
+{
+    LOCKER(m_lock);
+    bool freed_any = false;
+    for (unsigned i = first; i < end; ++i) {
+        if (!blocks[i])
+            continue;
+        set_block_allocation_state(blocks[i], false);
+        blocks[i] = 0;
+        freed_any = true;
+    }
+    if (!freed_any)
         return true;
+    return write_block_list_for_inode(inode_index, e2inode, blocks, first, end);
+}
 
-    if (!e2inode.i_block[EXT2_IND_BLOCK]) {
-        BlockIndex new_indirect_block = new_meta_blocks.take_last();
-        if (e2inode.i_block[EXT2_IND_BLOCK] != new_indirect_block)
-            inode_dirty = true;
-        e2inode.i_block[EXT2_IND_BLOCK] = new_indirect_block;
-        if (inode_dirty) {
-            dbgprintf("Ext2FS: Adding the indirect block to i_block array of inode %u\n", inode_index);
-            write_ext2_inode(inode_index, e2inode);
-            inode_dirty = false;
-        }
+Vector<Ext2FS::BlockIndex> Ext2FS::allocate_data_blocks(InodeIndex inode_index, unsigned count, BlockIndex goal)
+{
+    LOCKER(m_lock);
+    GroupIndex goal_group = goal ? group_index_from_block_index(goal) : group_index_from_inode(inode_index);
+    auto blocks = allocate_blocks(goal_group, count, goal, inode_index);
+    if ((unsigned)blocks.size() != count && goal)
+        blocks = allocate_blocks(group_index_from_inode(inode_index), count, 0, inode_index);
+    if ((unsigned)blocks.size() == count) {
+        for (auto block_index : blocks)
+            set_block_allocation_state(block_index, true);
+        return blocks;
     }
 
-    if (old_shape.indirect_blocks == new_shape.indirect_blocks) {
-        // No need to update the singly indirect block array.
-        remaining_blocks -= new_shape.indirect_blocks;
-    } else {
-        auto block_contents = ByteBuffer::create_uninitialized(block_size());
-        BufferStream stream(block_contents);
-        ASSERT(new_shape.indirect_blocks <= EXT2_ADDR_PER_BLOCK(&super_block()));
-        for (unsigned i = 0; i < new_shape.indirect_blocks; ++i) {
-            stream << blocks[output_block_index++];
-            --remaining_blocks;
+    // Too many for any one group, so take what each has, starting from the goal's.
+    blocks.clear();
+    for (unsigned i = 0; i < m_block_group_count && (unsigned)blocks.size() < count; ++i) {
+        GroupIndex group = (goal_group - 1 + i) % m_block_group_count + 1;
+        unsigned wanted = min(count - (unsigned)blocks.size(), (unsigned)group_descriptor(group).bg_free_blocks_count);
+        for (auto block_index : allocate_blocks(group, wanted, i ? 0 : goal, inode_index)) {
+            set_block_allocation_state(block_index, true);
+            blocks.append(block_index);
         }
-        stream.fill_to_end(0);
-        bool success = write_block(e2inode.i_block[EXT2_IND_BLOCK], block_contents);
-        ASSERT(success);
     }
+    if ((unsigned)blocks.size() == count)
+        return blocks;
+    for (auto block_index : blocks)
+        set_block_allocation_state(block_index, false);
+    return { };
+}
 
-    if (!remaining_blocks)
-        return true;
-
-    // FIXME: Implement!
-    ASSERT_NOT_REACHED();
+void Ext2FS::collect_block_array(BlockIndex array_block, unsigned depth, unsigned count, bool include_block_list_blocks, Vector<unsigned>& list) const
+{
+    if (!array_block) {
+        if (!include_block_list_blocks) {
+            for (unsigned i = 0; i < count; ++i)
+                list.append(0);
+        }
+        return;
+    }
+    if (include_block_list_blocks)
+        list.append(array_block);
+    auto block = read_block(array_block);
+    ASSERT(block);
+    auto* entries = reinterpret_cast<const __u32*>(block.pointer());
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    unsigned entries_per_child = 1;
+    for (unsigned i = 1; i < depth; ++i)
+        entries_per_child *= entries_per_block;
+    for (unsigned child = 0; count; ++child) {
+        unsigned child_count = min(count, entries_per_child);
+        if (depth > 1)
+            collect_block_array(entries[child], depth - 1, child_count, include_block_list_blocks, list);
+        else if (entries[child] || !include_block_list_blocks)
+            list.append(entries[child]);
+        count -= child_count;
+    }
 }
 
 Vector<unsigned> Ext2FS::block_list_for_inode(const ext2_inode& e2inode, bool include_block_list_blocks) const
 {
     LOCKER(m_lock);
-    unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    // Fast symlinks keep their target in i_block itself.
+    if (::is_symlink(e2inode.i_mode) && !e2inode.i_blocks)
+        return { };
 
-    // NOTE: i_blocks is number of 512-byte blocks, not number of fs-blocks.
-    unsigned block_count = e2inode.i_blocks / (block_size() / 512);
-    unsigned blocksRemaining = block_count;
+    unsigned block_count = ceil_div((unsigned)e2inode.i_size, block_size());
     Vector<unsigned> list;
-    if (include_block_list_blocks) {
-        // This seems like an excessive over-estimate but w/e.
-        list.ensure_capacity(blocksRemaining * 2);
-    } else {
-        list.ensure_capacity(blocksRemaining);
-    }
+    list.ensure_capacity(include_block_list_blocks ? e2inode.i_blocks / (block_size() / 512) : block_count);
 
     unsigned direct_count = min(block_count, (unsigned)EXT2_NDIR_BLOCKS);
     for (unsigned i = 0; i < direct_count; ++i) {
-        list.unchecked_append(e2inode.i_block[i]);
-        --blocksRemaining;
-    }
-
-    if (!blocksRemaining)
-        return list;
-
-    auto process_block_array = [&] (unsigned array_block_index, auto&& callback) {
-        if (include_block_list_blocks)
-            callback(array_block_index);
-        auto array_block = read_block(array_block_index);
-        ASSERT(array_block);
-        auto* array = reinterpret_cast<const __u32*>(array_block.pointer());
-        unsigned count = min(blocksRemaining, entries_per_block);
-        for (unsigned i = 0; i < count; ++i) {
-            if (!array[i]) {
-                blocksRemaining = 0;
-                return;
-            }
-            callback(array[i]);
-            --blocksRemaining;
-        }
-    };
-
-    process_block_array(e2inode.i_block[EXT2_IND_BLOCK], [&] (unsigned entry) {
-        list.unchecked_append(entry);
-    });
-
-    if (!blocksRemaining)
-        return list;
-
-    process_block_array(e2inode.i_block[EXT2_DIND_BLOCK], [&] (unsigned entry) {
-        process_block_array(entry, [&] (unsigned entry) {
-            list.unchecked_append(entry);
-        });
-    });
-
-    if (!blocksRemaining)
-        return list;
-
-    process_block_array(e2inode.i_block[EXT2_TIND_BLOCK], [&] (unsigned entry) {
-        process_block_array(entry, [&] (unsigned entry) {
-            process_block_array(entry, [&] (unsigned entry) {
-                list.unchecked_append(entry);
-            });
-        });
-    });
+        if (e2inode.i_block[i] || !include_block_list_blocks)
+            list.append(e2inode.i_block[i]);
+    }
 
+    const unsigned entries_per_block = EXT2_ADDR_PER_BLOCK(&super_block());
+    unsigned base = EXT2_NDIR_BLOCKS;
+    unsigned span = entries_per_block;
+    for (unsigned depth = 1; depth <= 3 && base < block_count; ++depth) {
+        collect_block_array(e2inode.i_block[indirect_block_slots[depth - 1]], depth, min(block_count - base, span), include_block_list_blocks, list);
+        base += span;
+        span *= entries_per_block;
+    }
     return list;
 }
 
@@ -345,6 +399,7 @@ void Ext2FS::free_inode(Ext2FSInode& inode)
 
     for (auto block_index : block_list)
         set_block_allocation_state(block_index, false);
+    m_block_reservations.remove(inode.index());
 
     set_inode_allocation_state(inode.index(), false);
 
@@ -352,7 +407,7 @@ void Ext2FS::free_inode(Ext2FSInode& inode)
         auto& bgd = const_cast<ext2_group_desc&>(group_descriptor(group_index_from_inode(inode.index())));
         --bgd.bg_used_dirs_count;
         dbgprintf("Ext2FS: decremented bg_used_dirs_count %u -> %u\n", bgd.bg_used_dirs_count - 1, bgd.bg_used_dirs_count);
-        flush_block_group_descriptor_table();
+        m_group_descriptor_table_dirty = true;
     }
 }
 
@@ -361,7 +416,152 @@ void Ext2FS::flush_block_group_descriptor_table()
     LOCKER(m_lock);
     unsigned blocks_to_write = ceil_div(m_block_group_count * (unsigned)sizeof(ext2_group_desc), block_size());
     unsigned first_block_of_bgdt = block_size() == 1024 ? 2 : 1;
-    write_blocks(first_block_of_bgdt, blocks_to_write, m_cached_group_descriptor_table);
+    if (!m_journal) {
+        write_blocks(first_block_of_bgdt, blocks_to_write, m_cached_group_descriptor_table);
+        return;
+    }
+    for (unsigned i = 0; i < blocks_to_write; ++i)
+        write_metadata_block(first_block_of_bgdt + i, ByteBuffer::copy(m_cached_group_descriptor_table.offset_pointer(i * block_size()), block_size()));
+}
+
+ByteBuffer Ext2FS::cached_bitmap_block(BlockIndex index) const
+{
+    LOCKER(m_lock);
+    auto it = m_cached_bitmap_blocks.find(index);
+    if (it != m_cached_bitmap_blocks.end())
+        return (*it).value.buffer;
+    auto block = read_block(index);
+    ASSERT(block);
+    // Take a private copy, so changes stay out of the block cache until they're flushed.
+    auto buffer = ByteBuffer::copy(block.pointer(), block.size());
+    m_cached_bitmap_blocks.set(index, { buffer, false });
+    return buffer;
+}
+
+void Ext2FS::mark_bitmap_block_dirty(BlockIndex index)
+{
+    auto it = m_cached_bitmap_blocks.find(index);
+    ASSERT(it != m_cached_bitmap_blocks.end());
+    if (!(*it).value.dirty)
+        ++m_dirty_bitmap_block_count;
+    (*it).value.dirty = true;
+}
+
+void Ext2FS::flush_writes()
+{
+    LOCKER(m_lock);
+    if (m_journal)
+        commit_journal();
+    else
+        flush_allocation_state();
+}
+
+void Ext2FS::flush_allocation_state()
+{
+    LOCKER(m_lock);
+    for (auto& it : m_cached_bitmap_blocks) {
+        if (!it.value.dirty)
+            continue;
+        bool success = write_metadata_block(it.key, it.value.buffer);
+        ASSERT(success);
+        it.value.dirty = false;
+    }
+    m_dirty_bitmap_block_count = 0;
+    if (m_group_descriptor_table_dirty) {
+        flush_block_group_descriptor_table();
+        m_group_descriptor_table_dirty = false;
+    }
+    if (m_super_block_dirty) {
+        write_super_block(super_block());
+        m_super_block_dirty = false;
+    }
+}
+
+bool Ext2FS::initialize_journal()
+{
+    auto& super_block = this->super_block();
+    if (!(super_block.s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL))
+        return true;
+    bool needs_recovery = super_block.s_feature_incompat & EXT3_FEATURE_INCOMPAT_RECOVER;
+    if ((super_block.s_feature_incompat & EXT3_FEATURE_INCOMPAT_JOURNAL_DEV) || !super_block.s_journal_inum) {
+        kprintf("ext2fs: journal on another device isn't supported, mounting without it%s\n", needs_recovery ? " (it needs recovery!)" : "");
+        return true;
+    }
+
+    unsigned block_index;
+    unsigned offset;
+    auto block = read_block_containing_inode(super_block.s_journal_inum, block_index, offset);
+    if (!block)
+        return false;
+    ext2_inode journal_inode;
+    memcpy(&journal_inode, block.offset_pointer(offset), sizeof(ext2_inode));
+    m_journal = Ext2Journal::create(*this, block_list_for_inode(journal_inode));
+    if (!m_journal || !m_journal->replay()) {
+        kprintf("ext2fs: couldn't use the journal in inode %u, mounting without it%s\n", super_block.s_journal_inum, needs_recovery ? " (it needs recovery!)" : "");
+        m_journal = nullptr;
+        return true;
+    }
+
+    // The replay may have rewritten anything read so far.
+    m_cached_super_block.clear();
+    m_cached_group_descriptor_table.clear();
+    m_cached_bitmap_blocks.clear();
+    group_descriptor(0);
+
+    // Other systems replay the journal too, as long as the file system says it might need that.
+    auto& mutable_super_block = const_cast<ext2_super_block&>(this->super_block());
+    mutable_super_block.s_feature_incompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+    m_super_block_dirty = true;
+    kprintf("ext2fs: journaling metadata in inode %u\n", mutable_super_block.s_journal_inum);
+    return true;
+}
+
+bool Ext2FS::write_metadata_block(BlockIndex index, const ByteBuffer& block)
+{
+    LOCKER(m_lock);
+    if (!m_journal)
+        return write_block(index, block);
+    // An operation isn't split across transactions unless the journal is too small for it, in which case it's committed early.
+    // Whatever a commit adds of allocation state has to fit as well.
+    unsigned blocks_to_write = ceil_div(m_block_group_count * (unsigned)sizeof(ext2_group_desc), block_size());
+    if (!m_committing && !m_journal->has_room_for(1 + m_dirty_bitmap_block_count + blocks_to_write + 1))
+        commit_journal();
+    return m_journal->write_block(index, block);
+}
+
+// Gets everything the inode's metadata depends on to the disk. With a journal that's a commit,
+// without one it's the inode's own blocks, its block list blocks and the allocation state.
+void Ext2FS::sync_inode_metadata(InodeIndex inode, const ext2_inode& e2inode)
+{
+    LOCKER(m_lock);
+    if (m_journal) {
+        commit_journal();
+        return;
+    }
+    flush_allocation_state();
+    auto blocks = block_list_for_inode(e2inode, true);
+    unsigned block_index;
+    unsigned offset;
+    if (read_block_containing_inode(inode, block_index, offset))
+        blocks.append(block_index);
+    for (auto& it : m_cached_bitmap_blocks)
+        blocks.append(it.key);
+    unsigned first_block_of_bgdt = block_size() == 1024 ? 2 : 1;
+    unsigned bgdt_block_count = ceil_div(m_block_group_count * (unsigned)sizeof(ext2_group_desc), block_size());
+    for (unsigned i = 0; i < bgdt_block_count; ++i)
+        blocks.append(first_block_of_bgdt + i);
+    flush_blocks(blocks);
+}
+
+void Ext2FS::commit_journal()
+{
+    LOCKER(m_lock);
+    ASSERT(m_journal);
+    m_committing = true;
+    flush_allocation_state();
+    m_committing = false;
+    if (!m_journal->commit())
+        kprintf("ext2fs: journal commit failed\n");
 }
 
 Ext2FSInode::Ext2FSInode(Ext2FS& fs, unsigned index)
@@ -427,8 +627,11 @@ RetainPtr<Inode> Ext2FS::get_inode(InodeIdentifier inode) const
 
     {
         auto it = m_inode_cache.find(inode.index());
-        if (it != m_inode_cache.end())
+        if (it != m_inode_cache.end()) {
+            if ((*it).value)
+                const_cast<Ext2FS&>(*this).inode_became_used(*(*it).value);
             return (*it).value;
+        }
     }
 
     if (!get_inode_allocation_state(inode.index())) {
@@ -443,15 +646,18 @@ RetainPtr<Inode> Ext2FS::get_inode(InodeIdentifier inode) const
         return { };
 
     auto it = m_inode_cache.find(inode.index());
-    if (it != m_inode_cache.end())
+    if (it != m_inode_cache.end()) {
+        if ((*it).value)
+            const_cast<Ext2FS&>(*this).inode_became_used(*(*it).value);
         return (*it).value;
+    }
     auto new_inode = adopt(*new Ext2FSInode(const_cast<Ext2FS&>(*this), inode.index()));
     memcpy(&new_inode->m_raw_inode, reinterpret_cast<ext2_inode*>(block.offset_pointer(offset)), sizeof(ext2_inode));
     m_inode_cache.set(inode.index(), new_inode.copy_ref());
     return new_inode;
 }
 
-ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, byte* buffer, FileDescriptor*) const
+ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, byte* buffer, FileDescriptor* descriptor) const
 {
     Locker inode_locker(m_lock);
     ASSERT(offset >= 0);
@@ -468,54 +674,172 @@ ssize_t Ext2FSInode::read_bytes(off_t offset, ssize_t count, byte* buffer, FileD
 
     Locker fs_locker(fs().m_lock);
 
-    if (m_block_list.is_empty()) {
-        auto block_list = fs().block_list_for_inode(m_raw_inode);
-        if (m_block_list.size() != block_list.size())
-            m_block_list = move(block_list);
-    }
-
+    ensure_block_list();
     if (m_block_list.is_empty()) {
         kprintf("ext2fs: read_bytes: empty block list for inode %u\n", index());
         return -EIO;
     }
 
-    const size_t block_size = fs().block_size();
+#ifdef EXT2_DEBUG
+    kprintf("Ext2FS: Reading up to %u bytes %d bytes into inode %u:%u to %p\n", count, offset, identifier().fsid(), identifier().index(), buffer);
+#endif
 
-    dword first_block_logical_index = offset / block_size;
-    dword last_block_logical_index = (offset + count) / block_size;
-    if (last_block_logical_index >= m_block_list.size())
-        last_block_logical_index = m_block_list.size() - 1;
+    if (descriptor && descriptor->is_direct() && !(offset % fs().block_size()) && !(count % fs().block_size()))
+        return read_bytes_direct(offset, count, buffer);
 
-    dword offset_into_first_block = offset % block_size;
+    return read_bytes_through_page_cache(offset, count, buffer, descriptor);
+}
 
-    ssize_t nread = 0;
+// Direct transfers go through a kernel buffer of this size at most. The disk queue may carry out
+// a request on another thread, in another address space, so it can't be handed the caller's buffer.
+static const unsigned max_direct_transfer_size = 64 * KB;
+
+ssize_t Ext2FSInode::read_bytes_direct(off_t offset, ssize_t count, byte* buffer) const
+{
+    if (offset >= (off_t)size())
+        return 0;
+    size_t block_size = fs().block_size();
     size_t remaining_count = min((off_t)count, (off_t)size() - offset);
-    byte* out = buffer;
+    unsigned logical_block = offset / block_size;
+    unsigned end_block = min((unsigned)m_block_list.size(), (unsigned)ceil_div(offset + remaining_count, block_size));
+    auto bounce = ByteBuffer::create_uninitialized(max_direct_transfer_size);
+    ssize_t nread = 0;
+    while (remaining_count && logical_block < end_block) {
+        if (!m_block_list[logical_block]) {
+            size_t bytes_from_hole = min(block_size, remaining_count);
+            memset(buffer + nread, 0, bytes_from_hole);
+            nread += bytes_from_hole;
+            remaining_count -= bytes_from_hole;
+            ++logical_block;
+            continue;
+        }
+        unsigned run_length = 1;
+        while (logical_block + run_length < end_block
+            && (run_length + 1) * block_size <= max_direct_transfer_size
+            && m_block_list[logical_block + run_length] == m_block_list[logical_block] + run_length)
+            ++run_length;
+        if (!fs().read_blocks_uncached(m_block_list[logical_block], run_length, bounce.pointer()))
+            return nread ? nread : -EIO;
+        size_t bytes_from_run = min(run_length * block_size, remaining_count);
+        memcpy(buffer + nread, bounce.pointer(), bytes_from_run);
+        nread += bytes_from_run;
+        remaining_count -= bytes_from_run;
+        logical_block += run_length;
+    }
+    return nread;
+}
 
-#ifdef EXT2_DEBUG
-    kprintf("Ext2FS: Reading up to %u bytes %d bytes into inode %u:%u to %p\n", count, offset, identifier().fsid(), identifier().index(), buffer);
-    //kprintf("ok let's do it, read(%u, %u) -> blocks %u thru %u, oifb: %u\n", offset, count, first_block_logical_index, last_block_logical_index, offset_into_first_block);
-#endif
+bool Ext2FSInode::write_blocks_direct(unsigned first_logical_block, unsigned count, const byte* data)
+{
+    size_t block_size = fs().block_size();
+    auto bounce = ByteBuffer::create_uninitialized(max_direct_transfer_size);
+    unsigned end_block = first_logical_block + count;
+    ASSERT(end_block <= (unsigned)m_block_list.size());
+    for (unsigned logical_block = first_logical_block; logical_block < end_block;) {
+        // Holes were left for blocks of nothing but zeroes.
+        if (!m_block_list[logical_block]) {
+            ++logical_block;
+            continue;
+        }
+        unsigned run_length = 1;
+        while (logical_block + run_length < end_block
+            && (run_length + 1) * block_size <= max_direct_transfer_size
+            && m_block_list[logical_block + run_length] == m_block_list[logical_block] + run_length)
+            ++run_length;
+        memcpy(bounce.pointer(), data + (logical_block - first_logical_block) * block_size, run_length * block_size);
+        if (!fs().write_blocks_uncached(m_block_list[logical_block], run_length, bounce.pointer()))
+            return false;
+        logical_block += run_length;
+    }
+    return true;
+}
 
-    for (dword bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; ++bi) {
-        auto block = fs().read_block(m_block_list[bi]);
-        if (!block) {
-            kprintf("ext2fs: read_bytes: read_block(%u) failed (lbi: %u)\n", m_block_list[bi], bi);
+void Ext2FSInode::ensure_block_list() const
+{
+    if (!m_block_list.is_empty())
+        return;
+    auto block_list = fs().block_list_for_inode(m_raw_inode);
+    if (m_block_list.size() != block_list.size())
+        m_block_list = move(block_list);
+}
+
+ssize_t Ext2FSInode::read_pages_uncached(unsigned first_page_index, unsigned page_count, byte* buffer) const
+{
+    Locker inode_locker(m_lock);
+    Locker fs_locker(fs().m_lock);
+
+    const size_t block_size = fs().block_size();
+    if (block_size > PAGE_SIZE)
+        return -ENOTIMPL;
+
+    off_t offset = first_page_index * PAGE_SIZE;
+    if (offset >= (off_t)size())
+        return 0;
+    size_t bytes_to_read = min((size_t)(page_count * PAGE_SIZE), size() - offset);
+
+    ensure_block_list();
+    dword first_block_logical_index = offset / block_size;
+    dword block_count = ceil_div(bytes_to_read, block_size);
+    if (first_block_logical_index + block_count > m_block_list.size()) {
+        kprintf("ext2fs: read_pages_uncached: pages %u+%u of inode %u are beyond the block list\n", first_page_index, page_count, index());
+        return -EIO;
+    }
+
+    // Read runs of physically contiguous blocks with a single device request.
+    for (dword i = 0; i < block_count;) {
+        unsigned first_block = m_block_list[first_block_logical_index + i];
+        // Holes read as zeroes, without going to the disk.
+        if (!first_block) {
+            memset(buffer + i * block_size, 0, block_size);
+            ++i;
+            continue;
+        }
+        dword run_length = 1;
+        while (i + run_length < block_count && m_block_list[first_block_logical_index + i + run_length] == first_block + run_length)
+            ++run_length;
+        if (!fs().read_blocks_uncached(first_block, run_length, buffer + i * block_size)) {
+            kprintf("ext2fs: read_pages_uncached: read_blocks_uncached(%u, %u) failed\n", first_block, run_length);
             return -EIO;
         }
+        i += run_length;
+    }
+    return bytes_to_read;
+}
 
-        dword offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
-        dword num_bytes_to_copy = min(block_size - offset_into_block, remaining_count);
-        memcpy(out, block.pointer() + offset_into_block, num_bytes_to_copy);
-        remaining_count -= num_bytes_to_copy;
-        nread += num_bytes_to_copy;
-        out += num_bytes_to_copy;
+Vector<DiskOffset> Ext2FSInode::page_offsets_on_disk() const
+{
+    Locker inode_locker(m_lock);
+    Locker fs_locker(fs().m_lock);
+
+    const unsigned block_size = fs().block_size();
+    if (block_size > PAGE_SIZE)
+        return { };
+    const unsigned blocks_per_page = PAGE_SIZE / block_size;
+
+    ensure_block_list();
+    unsigned page_count = min((size_t)m_block_list.size() / blocks_per_page, size() / PAGE_SIZE);
+    Vector<DiskOffset> offsets;
+    offsets.ensure_capacity(page_count);
+    for (unsigned page_index = 0; page_index < page_count; ++page_index) {
+        unsigned first_block = m_block_list[page_index * blocks_per_page];
+        bool is_contiguous = first_block;
+        for (unsigned i = 1; i < blocks_per_page && is_contiguous; ++i)
+            is_contiguous = m_block_list[page_index * blocks_per_page + i] == first_block + i;
+        offsets.append(is_contiguous ? (DiskOffset)first_block * block_size : 0);
     }
+    return offsets;
+}
 
-    return nread;
+static bool is_all_zeroes(const byte* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i])
+            return false;
+    }
+    return true;
 }
 
-ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const byte* data, FileDescriptor*)
+ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const byte* data, FileDescriptor* descriptor)
 {
     ASSERT(offset >= 0);
     ASSERT(count >= 0);
@@ -539,26 +863,51 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const byte* data,
     const ssize_t block_size = fs().block_size();
     size_t old_size = size();
     size_t new_size = max(static_cast<size_t>(offset) + count, size());
-
-    unsigned blocks_needed_before = ceil_div(size(), block_size);
     unsigned blocks_needed_after = ceil_div(new_size, block_size);
 
-    auto block_list = fs().block_list_for_inode(m_raw_inode);
-    if (blocks_needed_after > blocks_needed_before) {
-        auto new_blocks = fs().allocate_blocks(fs().group_index_from_inode(index()), blocks_needed_after - blocks_needed_before);
-        for (auto new_block_index : new_blocks)
-            fs().set_block_allocation_state(new_block_index, true);
-        block_list.append(move(new_blocks));
-    } else if (blocks_needed_after < blocks_needed_before) {
-        // FIXME: Implement block list shrinking!
-        ASSERT_NOT_REACHED();
-    }
+    // Work on the cached block list directly, so writing doesn't walk the indirect blocks again.
+    ensure_block_list();
+    auto& block_list = m_block_list;
+    unsigned old_block_count = block_list.size();
+    // Growing the file leaves a hole, only the blocks this write lands in get allocated.
+    while ((unsigned)block_list.size() < blocks_needed_after)
+        block_list.append(0);
 
     dword first_block_logical_index = offset / block_size;
     dword last_block_logical_index = (offset + count) / block_size;
     if (last_block_logical_index >= block_list.size())
         last_block_logical_index = block_list.size() - 1;
 
+    // The holes this write lands in, except where it only puts zeroes, which is what a hole reads as already.
+    Vector<unsigned> filled_holes;
+    for (dword bi = first_block_logical_index; count && bi <= last_block_logical_index; ++bi) {
+        if (block_list[bi])
+            continue;
+        off_t block_start = bi * block_size;
+        off_t write_start = max(offset, block_start);
+        off_t write_end = min(offset + count, block_start + block_size);
+        if (write_start >= write_end)
+            continue;
+        if (!is_directory() && is_all_zeroes(data + (write_start - offset), write_end - write_start))
+            continue;
+        filled_holes.append(bi);
+    }
+    if (!filled_holes.is_empty()) {
+        // Aim for the block right after the one before, so the file stays contiguous.
+        unsigned first_hole = filled_holes.first();
+        unsigned goal = first_hole && block_list[first_hole - 1] ? block_list[first_hole - 1] + 1 : 0;
+        auto new_blocks = fs().allocate_data_blocks(index(), filled_holes.size(), goal);
+        if (new_blocks.is_empty()) {
+            block_list.resize(old_block_count);
+            return -ENOSPC;
+        }
+        for (int i = 0; i < filled_holes.size(); ++i)
+            block_list[filled_holes[i]] = new_blocks[i];
+        // Appending: keep the next few blocks aside so the next append lands next to this one.
+        if (offset >= (off_t)old_size)
+            fs().reserve_blocks_after(index(), new_blocks.last());
+    }
+
     dword offset_into_first_block = offset % block_size;
 
     dword last_logical_block_index_in_file = size() / block_size;
@@ -571,17 +920,45 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const byte* data,
     dbgprintf("Ext2FSInode::write_bytes: Writing %u bytes %d bytes into inode %u:%u from %p\n", count, offset, fsid(), index(), data);
 #endif
 
+    // Whole blocks written through an O_DIRECT descriptor go straight to the disk. Directories are always journaled.
+    if (descriptor && descriptor->is_direct() && !is_directory() && !(offset % block_size) && !(count % block_size) && count) {
+        if (!write_blocks_direct(first_block_logical_index, count / block_size, data))
+            return -EIO;
+        nwritten = count;
+        remaining_count = 0;
+    }
+
     auto buffer_block = ByteBuffer::create_uninitialized(block_size);
+    int next_filled_hole = 0;
     for (dword bi = first_block_logical_index; remaining_count && bi <= last_block_logical_index; ++bi) {
         size_t offset_into_block = (bi == first_block_logical_index) ? offset_into_first_block : 0;
         size_t num_bytes_to_copy = min((size_t)block_size - offset_into_block, remaining_count);
+        bool is_filled_hole = next_filled_hole < filled_holes.size() && filled_holes[next_filled_hole] == bi;
+        if (is_filled_hole)
+            ++next_filled_hole;
+
+        // Only zeroes for a hole, which stays one.
+        if (!block_list[bi]) {
+            remaining_count -= num_bytes_to_copy;
+            nwritten += num_bytes_to_copy;
+            in += num_bytes_to_copy;
+            continue;
+        }
 
         ByteBuffer block;
         if (offset_into_block != 0 || num_bytes_to_copy != block_size) {
-            block = fs().read_block(block_list[bi]);
-            if (!block) {
-                kprintf("Ext2FSInode::write_bytes: read_block(%u) failed (lbi: %u)\n", block_list[bi], bi);
-                return -EIO;
+            if (is_filled_hole) {
+                // What's on the disk there is whatever the block held before, the rest of a hole is zeroes.
+                block = ByteBuffer::create_zeroed(block_size);
+            } else {
+                block = fs().read_block(block_list[bi]);
+                if (!block) {
+                    kprintf("Ext2FSInode::write_bytes: read_block(%u) failed (lbi: %u)\n", block_list[bi], bi);
+                    return -EIO;
+                }
+                // Directory blocks are journaled, and mustn't change in the block cache before that.
+                if (is_directory())
+                    block = ByteBuffer::copy(block.pointer(), block.size());
             }
         } else
             block = buffer_block;
@@ -598,7 +975,8 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const byte* data,
 #ifdef EXT2_DEBUG
         dbgprintf("Ext2FSInode::write_bytes: writing block %u (offset_into_block: %u)\n", block_list[bi], offset_into_block);
 #endif
-        bool success = fs().write_block(block_list[bi], block);
+        // Directories are metadata, file contents aren't.
+        bool success = is_directory() ? fs().write_metadata_block(block_list[bi], block) : fs().write_block(block_list[bi], block);
         if (!success) {
             kprintf("Ext2FSInode::write_bytes: write_block(%u) failed (lbi: %u)\n", block_list[bi], bi);
             ASSERT_NOT_REACHED();
@@ -609,8 +987,13 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const byte* data,
         in += num_bytes_to_copy;
     }
 
-    bool success = fs().write_block_list_for_inode(index(), m_raw_inode, block_list);
-    ASSERT(success);
+    if (!filled_holes.is_empty()) {
+        bool success = fs().write_block_list_for_inode(index(), m_raw_inode, block_list, filled_holes.first(), filled_holes.last() + 1);
+        ASSERT(success);
+        m_allocation_unsynced = true;
+    }
+    if (old_size != new_size)
+        m_allocation_unsynced = true;
 
     m_raw_inode.i_size = new_size;
     fs().write_ext2_inode(index(), m_raw_inode);
@@ -618,16 +1001,13 @@ ssize_t Ext2FSInode::write_bytes(off_t offset, ssize_t count, const byte* data,
     dbgprintf("Ext2FSInode::write_bytes: after write, i_size=%u, i_blocks=%u (%u blocks in list)\n", m_raw_inode.i_size, m_raw_inode.i_blocks, block_list.size());
 #endif
 
-    // NOTE: Make sure the cached block list is up to date!
-    m_block_list = move(block_list);
-
     if (old_size != new_size)
         inode_size_changed(old_size, new_size);
     inode_contents_changed(offset, count, data);
     return nwritten;
 }
 
-bool Ext2FSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntry&)> callback) const
+bool Ext2FSInode::traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)> callback) const
 {
     LOCKER(m_lock);
     ASSERT(metadata().is_directory());
@@ -653,6 +1033,409 @@ bool Ext2FSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntry&)
     return true;
 }
 
+bool Ext2FS::supports_directory_index() const
+{
+    return super_block().s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX;
+}
+
+byte Ext2FS::directory_hash_version(byte on_disk_hash_version) const
+{
+    // The signed/unsigned flavor of a hash is a filesystem-wide choice, not a per-directory one.
+    if (on_disk_hash_version <= EXT2_HASH_TEA && (super_block().s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+        return on_disk_hash_version + 3;
+    return on_disk_hash_version;
+}
+
+// Layout of the htree root block: fake "." and ".." entries, dx_root_info, then the dx entries.
+static const unsigned dx_root_info_offset = 24;
+// Interior index blocks start with an empty directory entry spanning the whole block.
+static const unsigned dx_node_entries_offset = 8;
+
+static ext2_dx_countlimit& dx_countlimit(ByteBuffer& block, unsigned entries_offset)
+{
+    return *reinterpret_cast<ext2_dx_countlimit*>(block.offset_pointer(entries_offset));
+}
+
+static ext2_dx_entry* dx_entries(ByteBuffer& block, unsigned entries_offset)
+{
+    return reinterpret_cast<ext2_dx_entry*>(block.offset_pointer(entries_offset));
+}
+
+static ext2_dir_entry_2& directory_entry_at(ByteBuffer& block, unsigned offset)
+{
+    return *reinterpret_cast<ext2_dir_entry_2*>(block.offset_pointer(offset));
+}
+
+bool Ext2FSInode::is_indexed_directory() const
+{
+    return (m_raw_inode.i_flags & EXT2_INDEX_FL) && fs().supports_directory_index();
+}
+
+ByteBuffer Ext2FSInode::read_directory_block(unsigned logical_block) const
+{
+    ensure_block_list();
+    if (logical_block >= (unsigned)m_block_list.size())
+        return { };
+    auto block = fs().read_block(m_block_list[logical_block]);
+    if (!block)
+        return { };
+    // The block cache hands out its own buffer, so take a private copy before editing it.
+    return ByteBuffer::copy(block.pointer(), block.size());
+}
+
+bool Ext2FSInode::write_directory_block(unsigned logical_block, const ByteBuffer& block)
+{
+    ensure_block_list();
+    ASSERT(logical_block < (unsigned)m_block_list.size());
+    if (!fs().write_metadata_block(m_block_list[logical_block], block))
+        return false;
+    inode_contents_changed(logical_block * fs().block_size(), block.size(), block.pointer());
+    return true;
+}
+
+bool Ext2FSInode::append_directory_block(const ByteBuffer& block)
+{
+    ssize_t nwritten = write_bytes(size(), block.size(), block.pointer(), nullptr);
+    return nwritten == block.size();
+}
+
+bool Ext2FSInode::find_entry_in_directory_block(const ByteBuffer& buffer, const String& name, DirectoryEntryLocation& location) const
+{
+    unsigned offset = 0;
+    int previous_offset = -1;
+    while (offset + 8 <= (unsigned)buffer.size()) {
+        auto& entry = *reinterpret_cast<const ext2_dir_entry_2*>(buffer.pointer() + offset);
+        if (entry.rec_len < 8)
+            break;
+        if (entry.inode && entry.name_len == name.length() && !memcmp(entry.name, name.characters(), name.length())) {
+            location.found = true;
+            location.offset = offset;
+            location.previous_offset = previous_offset;
+            return true;
+        }
+        previous_offset = offset;
+        offset += entry.rec_len;
+    }
+    return false;
+}
+
+bool Ext2FSInode::probe_directory_index(const String& name, dword& hash, Vector<DirectoryIndexFrame>& frames, unsigned& leaf_block) const
+{
+    auto root = read_directory_block(0);
+    if (!root)
+        return false;
+    auto& info = *reinterpret_cast<const ext2_dx_root_info*>(root.offset_pointer(dx_root_info_offset));
+    if (info.reserved_zero || info.info_length != 8 || info.indirect_levels > 1 || info.hash_version > EXT2_HASH_TEA) {
+        kprintf("Ext2FS: Unsupported htree root in directory inode %u\n", index());
+        return false;
+    }
+    hash = Ext2DirectoryHash::hash(name.characters(), name.length(), fs().directory_hash_version(info.hash_version), fs().super_block().s_hash_seed);
+
+    DirectoryIndexFrame frame;
+    frame.block = 0;
+    frame.buffer = move(root);
+    frame.entries_offset = dx_root_info_offset + info.info_length;
+    for (unsigned level = 0;; ++level) {
+        auto& countlimit = dx_countlimit(frame.buffer, frame.entries_offset);
+        auto* entries = dx_entries(frame.buffer, frame.entries_offset);
+        if (!countlimit.count || countlimit.count > countlimit.limit)
+            return false;
+        // Find the last entry whose hash is <= ours. Entry 0 has no hash and covers everything below entry 1.
+        int low = 1;
+        int high = countlimit.count - 1;
+        while (low <= high) {
+            int middle = low + (high - low) / 2;
+            if (entries[middle].hash > hash)
+                high = middle - 1;
+            else
+                low = middle + 1;
+        }
+        frame.position = low - 1;
+        unsigned next_block = entries[frame.position].block & 0x00ffffff;
+        frames.append(frame);
+        if (level == info.indirect_levels) {
+            leaf_block = next_block;
+            return true;
+        }
+        frame = DirectoryIndexFrame();
+        frame.block = next_block;
+        frame.buffer = read_directory_block(next_block);
+        frame.entries_offset = dx_node_entries_offset;
+        if (!frame.buffer)
+            return false;
+    }
+}
+
+Ext2FSInode::DirectoryEntryLocation Ext2FSInode::find_directory_entry(const String& name) const
+{
+    DirectoryEntryLocation location;
+    if (is_indexed_directory()) {
+        dword hash;
+        Vector<DirectoryIndexFrame> frames;
+        unsigned leaf_block;
+        if (probe_directory_index(name, hash, frames, leaf_block)) {
+            auto& frame = frames.last();
+            auto& countlimit = dx_countlimit(frame.buffer, frame.entries_offset);
+            auto* entries = dx_entries(frame.buffer, frame.entries_offset);
+            for (unsigned position = frame.position;;) {
+                auto block = read_directory_block(leaf_block);
+                if (block && find_entry_in_directory_block(block, name, location)) {
+                    location.block = leaf_block;
+                    return location;
+                }
+                // A run of colliding hashes may continue into the next leaf, marked by the low bit.
+                ++position;
+                if (position >= countlimit.count || !(entries[position].hash & 1) || (entries[position].hash & ~1u) != hash)
+                    return location;
+                leaf_block = entries[position].block & 0x00ffffff;
+            }
+        }
+    }
+
+    unsigned block_count = size() / fs().block_size();
+    for (unsigned logical_block = 0; logical_block < block_count; ++logical_block) {
+        auto block = read_directory_block(logical_block);
+        if (block && find_entry_in_directory_block(block, name, location)) {
+            location.block = logical_block;
+            return location;
+        }
+    }
+    return location;
+}
+
+// Fits a new entry into the slack of an existing one, if there's room anywhere in the block.
+static bool insert_entry_into_directory_block(ByteBuffer& buffer, InodeIdentifier child_id, const String& name, byte file_type)
+{
+    unsigned needed_length = EXT2_DIR_REC_LEN(name.length());
+    unsigned offset = 0;
+    while (offset + 8 <= (unsigned)buffer.size()) {
+        auto& entry = directory_entry_at(buffer, offset);
+        if (entry.rec_len < 8)
+            return false;
+        unsigned used_length = entry.inode ? EXT2_DIR_REC_LEN(entry.name_len) : 0;
+        if (entry.rec_len >= used_length + needed_length) {
+            auto* target = &entry;
+            if (used_length) {
+                target = reinterpret_cast<ext2_dir_entry_2*>(buffer.offset_pointer(offset + used_length));
+                target->rec_len = entry.rec_len - used_length;
+                entry.rec_len = used_length;
+            }
+            target->inode = child_id.index();
+            target->name_len = name.length();
+            target->file_type = file_type;
+            memcpy(target->name, name.characters(), name.length());
+            return true;
+        }
+        offset += entry.rec_len;
+    }
+    return false;
+}
+
+bool Ext2FSInode::add_child_linearly(InodeIdentifier child_id, const String& name, byte file_type)
+{
+    const unsigned block_size = fs().block_size();
+    unsigned block_count = size() / block_size;
+    for (unsigned logical_block = 0; logical_block < block_count; ++logical_block) {
+        auto block = read_directory_block(logical_block);
+        if (!block)
+            return false;
+        if (insert_entry_into_directory_block(block, child_id, name, file_type))
+            return write_directory_block(logical_block, block);
+    }
+
+    // The directory is outgrowing its first block, which is when it's cheapest to index it.
+    if (block_count == 1 && fs().supports_directory_index() && create_directory_index()) {
+        if (add_child_to_directory_index(child_id, name, file_type))
+            return true;
+        drop_directory_index();
+    }
+
+    auto block = ByteBuffer::create_zeroed(block_size);
+    auto& entry = directory_entry_at(block, 0);
+    entry.inode = child_id.index();
+    entry.rec_len = block_size;
+    entry.name_len = name.length();
+    entry.file_type = file_type;
+    memcpy(entry.name, name.characters(), name.length());
+    return append_directory_block(block);
+}
+
+struct HashedDirectoryEntry {
+    dword hash;
+    unsigned offset;
+};
+
+// Packs entries from `source` into `block`, in order, with the last one padded out to the end of the block.
+static void pack_directory_entries(ByteBuffer& block, ByteBuffer& source, const HashedDirectoryEntry* entries, unsigned count)
+{
+    unsigned offset = 0;
+    ext2_dir_entry_2* last = nullptr;
+    for (unsigned i = 0; i < count; ++i) {
+        auto& entry = directory_entry_at(source, entries[i].offset);
+        unsigned length = EXT2_DIR_REC_LEN(entry.name_len);
+        last = reinterpret_cast<ext2_dir_entry_2*>(block.offset_pointer(offset));
+        memcpy(last, &entry, 8 + entry.name_len);
+        last->rec_len = length;
+        offset += length;
+    }
+    if (last)
+        last->rec_len += block.size() - offset;
+    else
+        directory_entry_at(block, 0).rec_len = block.size();
+}
+
+bool Ext2FSInode::add_child_to_directory_index(InodeIdentifier child_id, const String& name, byte file_type)
+{
+    dword hash;
+    Vector<DirectoryIndexFrame> frames;
+    unsigned leaf_block;
+    if (!probe_directory_index(name, hash, frames, leaf_block))
+        return false;
+
+    auto leaf = read_directory_block(leaf_block);
+    if (!leaf)
+        return false;
+    if (insert_entry_into_directory_block(leaf, child_id, name, file_type))
+        return write_directory_block(leaf_block, leaf);
+
+    // The leaf is full, so split it in two by hash and add the upper half to the index.
+    auto& frame = frames.last();
+    auto& countlimit = dx_countlimit(frame.buffer, frame.entries_offset);
+    if (countlimit.count >= countlimit.limit) {
+        // FIXME: Split index nodes as well, or grow the tree by a level.
+        return false;
+    }
+
+    auto& info = *reinterpret_cast<const ext2_dx_root_info*>(frames[0].buffer.offset_pointer(dx_root_info_offset));
+    byte hash_version = fs().directory_hash_version(info.hash_version);
+    Vector<HashedDirectoryEntry> entries;
+    for (unsigned offset = 0; offset + 8 <= (unsigned)leaf.size();) {
+        auto& entry = directory_entry_at(leaf, offset);
+        if (entry.rec_len < 8)
+            return false;
+        if (entry.inode)
+            entries.append({ Ext2DirectoryHash::hash(entry.name, entry.name_len, hash_version, fs().super_block().s_hash_seed), offset });
+        offset += entry.rec_len;
+    }
+    if (entries.size() < 2)
+        return false;
+    quick_sort(entries.begin(), entries.end(), [] (auto& a, auto& b) { return a.hash < b.hash; });
+
+    // Entries with the same hash must stay together, so nudge the split point off any run of them.
+    int split = entries.size() / 2;
+    while (split < entries.size() && entries[split].hash == entries[split - 1].hash)
+        ++split;
+    if (split == entries.size()) {
+        split = entries.size() / 2;
+        while (split > 0 && entries[split].hash == entries[split - 1].hash)
+            --split;
+    }
+    if (split == 0)
+        return false;
+    dword split_hash = entries[split].hash;
+
+    const unsigned block_size = fs().block_size();
+    auto lower = ByteBuffer::create_zeroed(block_size);
+    auto upper = ByteBuffer::create_zeroed(block_size);
+    pack_directory_entries(lower, leaf, entries.data(), split);
+    pack_directory_entries(upper, leaf, entries.data() + split, entries.size() - split);
+    if (!insert_entry_into_directory_block(hash < split_hash ? lower : upper, child_id, name, file_type))
+        return false;
+
+    unsigned new_leaf_block = size() / block_size;
+    if (!append_directory_block(upper))
+        return false;
+    if (!write_directory_block(leaf_block, lower))
+        return false;
+
+    auto* dx = dx_entries(frame.buffer, frame.entries_offset);
+    for (unsigned i = countlimit.count; i > frame.position + 1; --i)
+        dx[i] = dx[i - 1];
+    dx[frame.position + 1].hash = split_hash;
+    dx[frame.position + 1].block = new_leaf_block;
+    ++countlimit.count;
+    return write_directory_block(frame.block, frame.buffer);
+}
+
+bool Ext2FSInode::create_directory_index()
+{
+    const unsigned block_size = fs().block_size();
+    if (size() != block_size)
+        return false;
+    auto block = read_directory_block(0);
+    if (!block)
+        return false;
+
+    auto& dot = directory_entry_at(block, 0);
+    if (dot.name_len != 1 || dot.name[0] != '.' || dot.rec_len + 8u > block_size)
+        return false;
+    auto& dot_dot = directory_entry_at(block, dot.rec_len);
+    if (dot_dot.name_len != 2 || dot_dot.name[0] != '.' || dot_dot.name[1] != '.')
+        return false;
+
+    byte on_disk_hash_version = fs().super_block().s_def_hash_version;
+    if (on_disk_hash_version > EXT2_HASH_TEA)
+        on_disk_hash_version = EXT2_HASH_HALF_MD4;
+    byte hash_version = fs().directory_hash_version(on_disk_hash_version);
+
+    Vector<HashedDirectoryEntry> entries;
+    for (unsigned offset = dot.rec_len + dot_dot.rec_len; offset + 8 <= block_size;) {
+        auto& entry = directory_entry_at(block, offset);
+        if (entry.rec_len < 8)
+            return false;
+        if (entry.inode)
+            entries.append({ Ext2DirectoryHash::hash(entry.name, entry.name_len, hash_version, fs().super_block().s_hash_seed), offset });
+        offset += entry.rec_len;
+    }
+    quick_sort(entries.begin(), entries.end(), [] (auto& a, auto& b) { return a.hash < b.hash; });
+
+    // Everything but "." and ".." fit in this block before, so it all fits in one leaf now.
+    auto leaf = ByteBuffer::create_zeroed(block_size);
+    pack_directory_entries(leaf, block, entries.data(), entries.size());
+
+    auto root = ByteBuffer::create_zeroed(block_size);
+    auto& root_dot = directory_entry_at(root, 0);
+    root_dot.inode = dot.inode;
+    root_dot.rec_len = 12;
+    root_dot.name_len = 1;
+    root_dot.file_type = dot.file_type;
+    root_dot.name[0] = '.';
+    auto& root_dot_dot = directory_entry_at(root, 12);
+    root_dot_dot.inode = dot_dot.inode;
+    root_dot_dot.rec_len = block_size - 12;
+    root_dot_dot.name_len = 2;
+    root_dot_dot.file_type = dot_dot.file_type;
+    root_dot_dot.name[0] = '.';
+    root_dot_dot.name[1] = '.';
+    auto& info = *reinterpret_cast<ext2_dx_root_info*>(root.offset_pointer(dx_root_info_offset));
+    info.hash_version = on_disk_hash_version;
+    info.info_length = 8;
+    unsigned entries_offset = dx_root_info_offset + info.info_length;
+    auto& countlimit = dx_countlimit(root, entries_offset);
+    countlimit.limit = (block_size - entries_offset) / sizeof(ext2_dx_entry);
+    countlimit.count = 1;
+    dx_entries(root, entries_offset)[0].block = 1;
+
+    if (!append_directory_block(leaf))
+        return false;
+    if (!write_directory_block(0, root))
+        return false;
+    m_raw_inode.i_flags |= EXT2_INDEX_FL;
+    fs().write_ext2_inode(index(), m_raw_inode);
+#ifdef EXT2_DEBUG
+    dbgprintf("Ext2FS: Indexed directory inode %u (%u entries)\n", index(), entries.size());
+#endif
+    return true;
+}
+
+void Ext2FSInode::drop_directory_index()
+{
+    // Index blocks look like empty directory blocks, so the directory stays valid for linear scans.
+    kprintf("Ext2FS: Dropping htree index of directory inode %u\n", index());
+    m_raw_inode.i_flags &= ~EXT2_INDEX_FL;
+    fs().write_ext2_inode(index(), m_raw_inode);
+}
+
 KResult Ext2FSInode::add_child(InodeIdentifier child_id, const String& name, byte file_type)
 {
     LOCKER(m_lock);
@@ -662,28 +1445,34 @@ KResult Ext2FSInode::add_child(InodeIdentifier child_id, const String& name, byt
     dbgprintf("Ext2FS: Adding inode %u with name '%s' to directory %u\n", child_id.index(), name.characters(), index());
 //#endif
 
-    Vector<FS::DirectoryEntry> entries;
-    bool name_already_exists = false;
-    traverse_as_directory([&] (auto& entry) {
-        if (!strcmp(entry.name, name.characters())) {
-            name_already_exists = true;
-            return false;
-        }
-        entries.append(entry);
-        return true;
-    });
+    bool name_already_exists;
+    if (!m_lookup_cache.is_empty())
+        name_already_exists = m_lookup_cache.contains(name);
+    else
+        name_already_exists = find_directory_entry(name).found;
     if (name_already_exists) {
         kprintf("Ext2FS: Name '%s' already exists in directory inode %u\n", name.characters(), index());
         return KResult(-EEXIST);
     }
 
+    bool success = false;
+    if (is_indexed_directory()) {
+        success = add_child_to_directory_index(child_id, name, file_type);
+        if (!success)
+            drop_directory_index();
+    }
+    if (!success)
+        success = add_child_linearly(child_id, name, file_type);
+    if (!success)
+        return KResult(-EIO);
+    did_modify_directory();
+
     auto child_inode = fs().get_inode(child_id);
     if (child_inode)
         child_inode->increment_link_count();
 
-    entries.append({ name.characters(), name.length(), child_id, file_type });
-    bool success = fs().write_directory_inode(index(), move(entries));
-    if (success)
+    // An empty lookup cache means "not populated yet", so don't seed it with a single entry.
+    if (!m_lookup_cache.is_empty())
         m_lookup_cache.set(name, child_id.index());
     return KSuccess;
 }
@@ -696,30 +1485,27 @@ KResult Ext2FSInode::remove_child(const String& name)
 #endif
     ASSERT(is_directory());
 
-    unsigned child_inode_index;
-    auto it = m_lookup_cache.find(name);
-    if (it == m_lookup_cache.end())
+    auto location = find_directory_entry(name);
+    if (!location.found)
         return KResult(-ENOENT);
-    child_inode_index = (*it).value;
-
-    InodeIdentifier child_id { fsid(), child_inode_index };
 
 //#ifdef EXT2_DEBUG
     dbgprintf("Ext2FS: Removing '%s' in directory %u\n", name.characters(), index());
 //#endif
 
-    Vector<FS::DirectoryEntry> entries;
-    traverse_as_directory([&] (auto& entry) {
-        if (strcmp(entry.name, name.characters()) != 0)
-            entries.append(entry);
-        return true;
-    });
-
-    bool success = fs().write_directory_inode(index(), move(entries));
-    if (!success) {
-        // FIXME: Plumb error from write_directory_inode().
+    auto block = read_directory_block(location.block);
+    if (!block)
         return KResult(-EIO);
-    }
+    auto& entry = directory_entry_at(block, location.offset);
+    InodeIdentifier child_id { fsid(), entry.inode };
+    // Fold the record into its predecessor, or just mark it unused if it's first in the block.
+    if (location.previous_offset >= 0)
+        directory_entry_at(block, location.previous_offset).rec_len += entry.rec_len;
+    else
+        entry.inode = 0;
+    if (!write_directory_block(location.block, block))
+        return KResult(-EIO);
+    did_modify_directory();
 
     m_lookup_cache.remove(name);
 
@@ -841,8 +1627,7 @@ void Ext2FS::traverse_inode_bitmap(unsigned group_index, F callback) const
     unsigned bits_per_block = block_size() * 8;
 
     for (unsigned i = 0; i < block_count; ++i) {
-        auto block = read_block(bgd.bg_inode_bitmap + i);
-        ASSERT(block);
+        auto block = cached_bitmap_block(bgd.bg_inode_bitmap + i);
         bool should_continue = callback(first_inode_in_group + i * (i * bits_per_block) + 1, Bitmap::wrap(block.pointer(), inodes_in_group));
         if (!should_continue)
             break;
@@ -861,8 +1646,7 @@ void Ext2FS::traverse_block_bitmap(unsigned group_index, F callback) const
     unsigned bits_per_block = block_size() * 8;
 
     for (unsigned i = 0; i < block_count; ++i) {
-        auto block = read_block(bgd.bg_block_bitmap + i);
-        ASSERT(block);
+        auto block = cached_bitmap_block(bgd.bg_block_bitmap + i);
         bool should_continue = callback(first_block_in_group + (i * bits_per_block) + 1, Bitmap::wrap(block.pointer(), blocks_in_group));
         if (!should_continue)
             break;
@@ -874,19 +1658,54 @@ bool Ext2FS::write_ext2_inode(unsigned inode, const ext2_inode& e2inode)
     LOCKER(m_lock);
     unsigned block_index;
     unsigned offset;
-    auto block = read_block_containing_inode(inode, block_index, offset);
-    if (!block)
+    auto cached_block = read_block_containing_inode(inode, block_index, offset);
+    if (!cached_block)
         return false;
+    // The block cache hands out its own buffer, so take a private copy before editing it.
+    auto block = ByteBuffer::copy(cached_block.pointer(), cached_block.size());
     memcpy(reinterpret_cast<ext2_inode*>(block.offset_pointer(offset)), &e2inode, inode_size());
-    bool success = write_block(block_index, block);
+    bool success = write_metadata_block(block_index, block);
     ASSERT(success);
     return success;
 }
 
-Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(unsigned group, unsigned count)
+// How many blocks past the end of an appended-to file we keep reserved for it.
+static const unsigned block_reservation_window = 16;
+
+bool Ext2FS::is_block_reserved(BlockIndex block_index, InodeIndex for_inode) const
+{
+    for (auto& it : m_block_reservations) {
+        if (it.key == for_inode)
+            continue;
+        if (block_index >= it.value.first && block_index < it.value.first + it.value.count)
+            return true;
+    }
+    return false;
+}
+
+void Ext2FS::reserve_blocks_after(InodeIndex inode_index, BlockIndex last_block)
+{
+    LOCKER(m_lock);
+    if (last_block + 1 >= super_block().s_blocks_count) {
+        m_block_reservations.remove(inode_index);
+        return;
+    }
+    BlockReservation reservation;
+    reservation.first = last_block + 1;
+    reservation.count = min(block_reservation_window, super_block().s_blocks_count - reservation.first);
+    m_block_reservations.set(inode_index, reservation);
+}
+
+void Ext2FS::drop_block_reservation(InodeIndex inode_index)
+{
+    LOCKER(m_lock);
+    m_block_reservations.remove(inode_index);
+}
+
+Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(unsigned group, unsigned count, BlockIndex goal, InodeIndex for_inode)
 {
     LOCKER(m_lock);
-    dbgprintf("Ext2FS: allocate_blocks(group: %u, count: %u)\n", group, count);
+    dbgprintf("Ext2FS: allocate_blocks(group: %u, count: %u, goal: %u)\n", group, count, goal);
     if (count == 0)
         return { };
 
@@ -896,22 +1715,74 @@ Vector<Ext2FS::BlockIndex> Ext2FS::allocate_blocks(unsigned group, unsigned coun
         return { };
     }
 
-    // FIXME: Implement a scan that finds consecutive blocks if possible.
+    // NOTE: A group's bitmap always fits in one block, since blocks_per_group <= block_size * 8.
+    unsigned blocks_in_group = min(blocks_per_group(), super_block().s_blocks_count);
+    unsigned first_block_in_group = (group - 1) * blocks_per_group() + 1;
+    auto bitmap_block = cached_bitmap_block(bgd.bg_block_bitmap);
+    auto bitmap = Bitmap::wrap(bitmap_block.pointer(), blocks_in_group);
+
+    Vector<bool> taken;
+    taken.resize(blocks_in_group);
+    for (unsigned i = 0; i < blocks_in_group; ++i)
+        taken[i] = false;
+    bool respect_reservations = true;
+    auto is_free = [&] (unsigned bit) {
+        if (bitmap.get(bit) || taken[bit])
+            return false;
+        return !respect_reservations || !is_block_reserved(first_block_in_group + bit, for_inode);
+    };
+
     Vector<BlockIndex> blocks;
-    traverse_block_bitmap(group, [&blocks, count] (unsigned first_block_in_bitmap, const Bitmap& bitmap) {
-        for (int i = 0; i < bitmap.size(); ++i) {
-            if (!bitmap.get(i)) {
-                blocks.append(first_block_in_bitmap + i);
-                if (blocks.size() == count)
-                    return false;
+    auto take = [&] (unsigned bit) {
+        taken[bit] = true;
+        blocks.append(first_block_in_group + bit);
+    };
+
+    unsigned goal_bit = 0;
+    if (goal >= first_block_in_group && goal < first_block_in_group + blocks_in_group)
+        goal_bit = goal - first_block_in_group;
+
+    // First, keep the file contiguous by extending straight from the goal.
+    if (goal) {
+        for (unsigned bit = goal_bit; bit < blocks_in_group && blocks.size() < count && is_free(bit); ++bit)
+            take(bit);
+    }
+
+    // Then look for a single free run that fits everything that's left, starting at the goal.
+    if (blocks.size() < count) {
+        unsigned wanted = count - blocks.size();
+        for (unsigned scanned = 0; scanned < blocks_in_group;) {
+            unsigned bit = (goal_bit + scanned) % blocks_in_group;
+            unsigned run = 0;
+            while (run < wanted && bit + run < blocks_in_group && is_free(bit + run))
+                ++run;
+            if (run == wanted) {
+                for (unsigned i = 0; i < run; ++i)
+                    take(bit + i);
+                break;
             }
+            scanned += run + 1;
         }
-        return true;
-    });
+    }
+
+    // Finally, settle for whatever is free, and dip into other files' reservations if we must.
+    for (int pass = 0; pass < 2 && blocks.size() < count; ++pass) {
+        respect_reservations = pass == 0;
+        for (unsigned scanned = 0; scanned < blocks_in_group && blocks.size() < count; ++scanned) {
+            unsigned bit = (goal_bit + scanned) % blocks_in_group;
+            if (is_free(bit))
+                take(bit);
+        }
+    }
+
+    quick_sort(blocks.begin(), blocks.end(), [] (BlockIndex a, BlockIndex b) { return a < b; });
+
+#ifdef EXT2_DEBUG
     dbgprintf("Ext2FS: allocate_block found these blocks:\n");
     for (auto& bi : blocks) {
         dbgprintf("  > %u\n", bi);
     }
+#endif
 
     return blocks;
 }
@@ -950,13 +1821,11 @@ unsigned Ext2FS::allocate_inode(unsigned preferred_group, unsigned expected_size
 
     unsigned first_free_inode_in_group = 0;
     traverse_inode_bitmap(groupIndex, [&first_free_inode_in_group] (unsigned firstInodeInBitmap, const Bitmap& bitmap) {
-        for (int i = 0; i < bitmap.size(); ++i) {
-            if (!bitmap.get(i)) {
-                first_free_inode_in_group = firstInodeInBitmap + i;
-                return false;
-            }
-        }
-        return true;
+        int first_free = bitmap.find_first_unset();
+        if (first_free == bitmap.size())
+            return true;
+        first_free_inode_in_group = firstInodeInBitmap + first_free;
+        return false;
     });
 
     if (!first_free_inode_in_group) {
@@ -999,13 +1868,12 @@ bool Ext2FS::get_inode_allocation_state(InodeIndex index) const
     unsigned inodes_per_bitmap_block = block_size() * 8;
     unsigned bitmap_block_index = (index_in_group - 1) / inodes_per_bitmap_block;
     unsigned bit_index = (index_in_group - 1) % inodes_per_bitmap_block;
-    auto block = read_block(bgd.bg_inode_bitmap + bitmap_block_index);
-    ASSERT(block);
+    auto block = cached_bitmap_block(bgd.bg_inode_bitmap + bitmap_block_index);
     auto bitmap = Bitmap::wrap(block.pointer(), inodes_per_bitmap_block);
     return bitmap.get(bit_index);
 }
 
-bool Ext2FS::set_inode_allocation_state(unsigned index, bool newState)
+bool Ext2FS::set_inode_allocation_state(unsigned index, bool new_state)
 {
     LOCKER(m_lock);
     unsigned group_index = group_index_from_inode(index);
@@ -1014,86 +1882,68 @@ bool Ext2FS::set_inode_allocation_state(unsigned index, bool newState)
     unsigned inodes_per_bitmap_block = block_size() * 8;
     unsigned bitmap_block_index = (index_in_group - 1) / inodes_per_bitmap_block;
     unsigned bit_index = (index_in_group - 1) % inodes_per_bitmap_block;
-    auto block = read_block(bgd.bg_inode_bitmap + bitmap_block_index);
-    ASSERT(block);
+    auto block = cached_bitmap_block(bgd.bg_inode_bitmap + bitmap_block_index);
     auto bitmap = Bitmap::wrap(block.pointer(), inodes_per_bitmap_block);
     bool current_state = bitmap.get(bit_index);
-    dbgprintf("Ext2FS: set_inode_allocation_state(%u) %u -> %u\n", index, current_state, newState);
+#ifdef EXT2_DEBUG
+    dbgprintf("Ext2FS: set_inode_allocation_state(%u) %u -> %u\n", index, current_state, new_state);
+#endif
 
-    if (current_state == newState)
+    if (current_state == new_state)
         return true;
 
-    bitmap.set(bit_index, newState);
-    bool success = write_block(bgd.bg_inode_bitmap + bitmap_block_index, block);
-    ASSERT(success);
+    bitmap.set(bit_index, new_state);
+    mark_bitmap_block_dirty(bgd.bg_inode_bitmap + bitmap_block_index);
 
-    // Update superblock
     auto& sb = *reinterpret_cast<ext2_super_block*>(m_cached_super_block.pointer());
-    dbgprintf("Ext2FS: superblock free inode count %u -> %u\n", sb.s_free_inodes_count, sb.s_free_inodes_count - 1);
-    if (newState)
-        --sb.s_free_inodes_count;
-    else
-        ++sb.s_free_inodes_count;
-    write_super_block(sb);
-
-    // Update BGD
     auto& mutable_bgd = const_cast<ext2_group_desc&>(bgd);
-    if (newState)
+    if (new_state) {
+        --sb.s_free_inodes_count;
         --mutable_bgd.bg_free_inodes_count;
-    else
+    } else {
+        ++sb.s_free_inodes_count;
         ++mutable_bgd.bg_free_inodes_count;
-    dbgprintf("Ext2FS: group free inode count %u -> %u\n", bgd.bg_free_inodes_count, bgd.bg_free_inodes_count - 1);
-
-    flush_block_group_descriptor_table();
+    }
+    m_super_block_dirty = true;
+    m_group_descriptor_table_dirty = true;
     return true;
 }
 
 bool Ext2FS::set_block_allocation_state(BlockIndex block_index, bool new_state)
 {
     LOCKER(m_lock);
-    dbgprintf("Ext2FS: set_block_allocation_state(block=%u, state=%u)\n", block_index, new_state);
     unsigned group_index = group_index_from_block_index(block_index);
     auto& bgd = group_descriptor(group_index);
     BlockIndex index_in_group = block_index - ((group_index - 1) * blocks_per_group());
     unsigned blocks_per_bitmap_block = block_size() * 8;
     unsigned bitmap_block_index = (index_in_group - 1) / blocks_per_bitmap_block;
     unsigned bit_index = (index_in_group - 1) % blocks_per_bitmap_block;
-    dbgprintf("  index_in_group: %u\n", index_in_group);
-    dbgprintf("  blocks_per_bitmap_block: %u\n", blocks_per_bitmap_block);
-    dbgprintf("  bitmap_block_index: %u\n", bitmap_block_index);
-    dbgprintf("  bit_index: %u\n", bit_index);
-    dbgprintf("  read_block(%u + %u = %u)\n", bgd.bg_block_bitmap, bitmap_block_index, bgd.bg_block_bitmap + bitmap_block_index);
-    auto block = read_block(bgd.bg_block_bitmap + bitmap_block_index);
-    ASSERT(block);
+    auto block = cached_bitmap_block(bgd.bg_block_bitmap + bitmap_block_index);
     auto bitmap = Bitmap::wrap(block.pointer(), blocks_per_bitmap_block);
     bool current_state = bitmap.get(bit_index);
-    dbgprintf("Ext2FS:      block %u state: %u -> %u\n", block_index, current_state, new_state);
+#ifdef EXT2_DEBUG
+    dbgprintf("Ext2FS: set_block_allocation_state(%u) %u -> %u\n", block_index, current_state, new_state);
+#endif
 
     if (current_state == new_state)
         return true;
 
     bitmap.set(bit_index, new_state);
-    bool success = write_block(bgd.bg_block_bitmap + bitmap_block_index, block);
-    ASSERT(success);
+    mark_bitmap_block_dirty(bgd.bg_block_bitmap + bitmap_block_index);
+    if (!new_state && m_journal)
+        m_journal->revoke_block(block_index);
 
-    // Update superblock
     auto& sb = *reinterpret_cast<ext2_super_block*>(m_cached_super_block.pointer());
-    dbgprintf("Ext2FS: superblock free block count %u -> %u\n", sb.s_free_blocks_count, sb.s_free_blocks_count - 1);
-    if (new_state)
-        --sb.s_free_blocks_count;
-    else
-        ++sb.s_free_blocks_count;
-    write_super_block(sb);
-
-    // Update BGD
     auto& mutable_bgd = const_cast<ext2_group_desc&>(bgd);
-    if (new_state)
+    if (new_state) {
+        --sb.s_free_blocks_count;
         --mutable_bgd.bg_free_blocks_count;
-    else
+    } else {
+        ++sb.s_free_blocks_count;
         ++mutable_bgd.bg_free_blocks_count;
-    dbgprintf("Ext2FS: group free block count %u -> %u\n", bgd.bg_free_blocks_count, bgd.bg_free_blocks_count - 1);
-
-    flush_block_group_descriptor_table();
+    }
+    m_super_block_dirty = true;
+    m_group_descriptor_table_dirty = true;
     return true;
 }
 
@@ -1131,7 +1981,7 @@ RetainPtr<Inode> Ext2FS::create_directory(InodeIdentifier parent_id, const Strin
     ++bgd.bg_used_dirs_count;
     dbgprintf("Ext2FS: incremented bg_used_dirs_count %u -> %u\n", bgd.bg_used_dirs_count - 1, bgd.bg_used_dirs_count);
 
-    flush_block_group_descriptor_table();
+    m_group_descriptor_table_dirty = true;
 
     error = 0;
     return inode;
@@ -1213,7 +2063,7 @@ RetainPtr<Inode> Ext2FS::create_inode(InodeIdentifier parent_id, const String& n
     e2inode.i_dtime = 0;
     e2inode.i_links_count = initial_links_count;
 
-    success = write_block_list_for_inode(inode_id, e2inode, blocks);
+    success = write_block_list_for_inode(inode_id, e2inode, blocks, 0, blocks.size());
     ASSERT(success);
 
     dbgprintf("Ext2FS: writing initial metadata for inode %u\n", inode_id);
@@ -1222,7 +2072,7 @@ RetainPtr<Inode> Ext2FS::create_inode(InodeIdentifier parent_id, const String& n
     ASSERT(success);
 
     // We might have cached the fact that this inode didn't exist. Wipe the slate.
-    m_inode_cache.remove(inode_id);
+    uncache_inode(inode_id);
 
     return get_inode({ fsid(), inode_id });
 }
@@ -1277,8 +2127,18 @@ void Ext2FSInode::populate_lookup_cache() const
 InodeIdentifier Ext2FSInode::lookup(const String& name)
 {
     ASSERT(is_directory());
-    populate_lookup_cache();
     LOCKER(m_lock);
+    // Large indexed directories can answer a single lookup without reading every block.
+    if (m_lookup_cache.is_empty() && is_indexed_directory()) {
+        auto location = find_directory_entry(name);
+        if (!location.found)
+            return { };
+        auto block = read_directory_block(location.block);
+        if (!block)
+            return { };
+        return { fsid(), directory_entry_at(block, location.offset).inode };
+    }
+    populate_lookup_cache();
     auto it = m_lookup_cache.find(name);
     if (it != m_lookup_cache.end())
         return { fsid(), (*it).value };
@@ -1300,7 +2160,8 @@ String Ext2FSInode::reverse_lookup(InodeIdentifier child_id)
 
 void Ext2FSInode::one_retain_left()
 {
-    // FIXME: I would like to not live forever, but uncached Ext2FS is fucking painful right now.
+    // Only park inodes whose last reference is the cache's; uncached ones are on their way out.
+    fs().inode_became_unused(*this);
 }
 
 int Ext2FSInode::set_atime(time_t t)
@@ -1323,6 +2184,15 @@ int Ext2FSInode::set_ctime(time_t t)
     return 0;
 }
 
+// Entries coming and going is what a directory's mtime is about, it's how others can tell it's changed.
+void Ext2FSInode::did_modify_directory()
+{
+    timeval now;
+    kgettimeofday(now);
+    m_raw_inode.i_mtime = now.tv_sec;
+    set_metadata_dirty(true);
+}
+
 int Ext2FSInode::set_mtime(time_t t)
 {
     LOCKER(m_lock);
@@ -1359,7 +2229,65 @@ int Ext2FSInode::decrement_link_count()
 void Ext2FS::uncache_inode(InodeIndex index)
 {
     LOCKER(m_lock);
-    m_inode_cache.remove(index);
+    auto it = m_inode_cache.find(index);
+    if (it == m_inode_cache.end())
+        return;
+    if ((*it).value)
+        inode_became_used(*(*it).value);
+    m_inode_cache.remove(it);
+}
+
+void Ext2FS::inode_became_used(Ext2FSInode& inode)
+{
+    LOCKER(m_lock);
+    if (!inode.m_unused)
+        return;
+    m_unused_inodes.remove(&inode);
+    inode.m_unused = false;
+    --m_unused_inode_count;
+}
+
+void Ext2FS::inode_became_unused(Ext2FSInode& inode)
+{
+    LOCKER(m_lock);
+    auto it = m_inode_cache.find(inode.index());
+    if (it == m_inode_cache.end() || (*it).value.ptr() != &inode)
+        return;
+
+    if (inode.m_unused)
+        m_unused_inodes.remove(&inode);
+    else
+        ++m_unused_inode_count;
+    m_unused_inodes.prepend(&inode);
+    inode.m_unused = true;
+    evict_unused_inodes(max_unused_inodes);
+}
+
+void Ext2FS::release_unused_inodes()
+{
+    LOCKER(m_lock);
+    evict_unused_inodes(0);
+}
+
+// The caller holds m_lock.
+void Ext2FS::evict_unused_inodes(unsigned keep_count)
+{
+    while (m_unused_inode_count > keep_count) {
+        auto* victim = m_unused_inodes.tail();
+        ASSERT(victim);
+        m_unused_inodes.remove(victim);
+        victim->m_unused = false;
+        --m_unused_inode_count;
+        // Someone picked up a reference without going through get_inode() (e.g sync.)
+        // It'll come back here when they let go.
+        if (victim->retain_count() > 1)
+            continue;
+#ifdef EXT2_DEBUG
+        dbgprintf("Ext2FS: Evicting unused inode %u\n", victim->index());
+#endif
+        // Dropping the cache's reference destroys the inode, which flushes dirty metadata first.
+        m_inode_cache.remove(victim->index());
+    }
 }
 
 size_t Ext2FSInode::directory_entry_count() const
@@ -1391,13 +2319,170 @@ KResult Ext2FSInode::chown(uid_t uid, gid_t gid)
     return KSuccess;
 }
 
+// Zeroes [from, to) of a block in place. Holes are zeroes already.
+bool Ext2FSInode::zero_block_range(unsigned logical_block, size_t from, size_t to)
+{
+    unsigned block_index = m_block_list[logical_block];
+    if (!block_index || from >= to)
+        return true;
+    auto block = fs().read_block(block_index);
+    if (!block)
+        return false;
+    memset(block.pointer() + from, 0, to - from);
+    return fs().write_block(block_index, block);
+}
+
 KResult Ext2FSInode::truncate(int size)
 {
     LOCKER(m_lock);
     if (m_raw_inode.i_size == size)
         return KSuccess;
+    size_t old_size = m_raw_inode.i_size;
+    if (!(is_symlink() && old_size < max_inline_symlink_length)) {
+        LOCKER(fs().m_lock);
+        ensure_block_list();
+        const size_t block_size = fs().block_size();
+        unsigned new_block_count = ceil_div((size_t)size, block_size);
+        if (new_block_count < (unsigned)m_block_list.size()) {
+            if (!fs().punch_block_list_for_inode(index(), m_raw_inode, m_block_list, new_block_count, m_block_list.size()))
+                return KResult(-EIO);
+            m_block_list.resize(new_block_count);
+        }
+        // The tail of the new last block shows if the file grows again, and growing only adds a hole after it.
+        if ((size_t)size < old_size && size % block_size && !zero_block_range(new_block_count - 1, size % block_size, block_size))
+            return KResult(-EIO);
+        while ((unsigned)m_block_list.size() < new_block_count)
+            m_block_list.append(0);
+    }
     m_raw_inode.i_size = size;
     set_metadata_dirty(true);
+    m_allocation_unsynced = true;
+    fs().drop_block_reservation(index());
+    inode_size_changed(old_size, size);
+    return KSuccess;
+}
+
+KResult Ext2FSInode::fallocate(int mode, off_t offset, off_t length)
+{
+    Locker inode_locker(m_lock);
+    Locker fs_locker(fs().m_lock);
+    if (offset < 0 || length <= 0)
+        return KResult(-EINVAL);
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE))
+        return KResult(-EOPNOTSUPP);
+    if ((qword)offset + (qword)length > 0x7fffffff)
+        return KResult(-EFBIG);
+    if (!metadata().is_regular_file())
+        return KResult(-ENODEV);
+    if (mode & FALLOC_FL_PUNCH_HOLE) {
+        if (!(mode & FALLOC_FL_KEEP_SIZE))
+            return KResult(-EOPNOTSUPP);
+        return punch_hole(offset, length);
+    }
+
+    const size_t block_size = fs().block_size();
+    size_t old_size = size();
+    // Blocks past the end can only be represented by making the file that big, so KEEP_SIZE stops at the end.
+    size_t end = offset + length;
+    if (mode & FALLOC_FL_KEEP_SIZE)
+        end = min(end, old_size);
+    size_t new_size = max(end, old_size);
+
+    ensure_block_list();
+    unsigned old_block_count = m_block_list.size();
+    while ((unsigned)m_block_list.size() < ceil_div(new_size, block_size))
+        m_block_list.append(0);
+
+    Vector<unsigned> holes;
+    for (unsigned bi = offset / block_size; bi < ceil_div(end, block_size); ++bi) {
+        if (!m_block_list[bi])
+            holes.append(bi);
+    }
+    if (!holes.is_empty()) {
+        unsigned first_hole = holes.first();
+        unsigned goal = first_hole && m_block_list[first_hole - 1] ? m_block_list[first_hole - 1] + 1 : 0;
+        auto new_blocks = fs().allocate_data_blocks(index(), holes.size(), goal);
+        if (new_blocks.is_empty()) {
+            m_block_list.resize(old_block_count);
+            return KResult(-ENOSPC);
+        }
+        // ext2 has no unwritten extents, so the new blocks have to be zeroed on the disk to read back as zeroes.
+        // They're written around the block cache, in runs as long as the blocks are contiguous.
+        auto zeroes = ByteBuffer::create_zeroed(max_direct_transfer_size);
+        unsigned max_run_length = max_direct_transfer_size / block_size;
+        for (int i = 0; i < new_blocks.size();) {
+            unsigned run_length = 1;
+            while (i + run_length < (unsigned)new_blocks.size() && run_length < max_run_length && new_blocks[i + run_length] == new_blocks[i] + run_length)
+                ++run_length;
+            if (!fs().write_blocks_uncached(new_blocks[i], run_length, zeroes.pointer())) {
+                for (auto block_index : new_blocks)
+                    fs().set_block_allocation_state(block_index, false);
+                m_block_list.resize(old_block_count);
+                return KResult(-EIO);
+            }
+            i += run_length;
+        }
+        for (int i = 0; i < holes.size(); ++i)
+            m_block_list[holes[i]] = new_blocks[i];
+        if (!fs().write_block_list_for_inode(index(), m_raw_inode, m_block_list, holes.first(), holes.last() + 1))
+            return KResult(-EIO);
+        m_allocation_unsynced = true;
+    }
+
+    if (new_size != old_size) {
+        m_raw_inode.i_size = new_size;
+        m_allocation_unsynced = true;
+    }
+    fs().write_ext2_inode(index(), m_raw_inode);
+    if (new_size != old_size)
+        inode_size_changed(old_size, new_size);
+    return KSuccess;
+}
+
+// Called with both locks held. Whole blocks in the range are freed, the partial ones at either end are zeroed.
+KResult Ext2FSInode::punch_hole(off_t offset, off_t length)
+{
+    if ((size_t)offset >= size())
+        return KSuccess;
+    const size_t block_size = fs().block_size();
+    size_t end = min((size_t)(offset + length), size());
+    ensure_block_list();
+
+    // A block that runs past the end of the file is whole as far as anyone can tell.
+    unsigned first_whole_block = ceil_div((size_t)offset, block_size);
+    unsigned end_whole_block = end == size() ? m_block_list.size() : end / block_size;
+    if (first_whole_block > end_whole_block) {
+        // It's all inside one block.
+        if (!zero_block_range(offset / block_size, offset % block_size, end - (offset / block_size) * block_size))
+            return KResult(-EIO);
+    } else {
+        if (offset % block_size && !zero_block_range(offset / block_size, offset % block_size, block_size))
+            return KResult(-EIO);
+        if (end_whole_block < (unsigned)m_block_list.size() && end % block_size && !zero_block_range(end_whole_block, 0, end % block_size))
+            return KResult(-EIO);
+        if (!fs().punch_block_list_for_inode(index(), m_raw_inode, m_block_list, first_whole_block, end_whole_block))
+            return KResult(-EIO);
+        m_allocation_unsynced = true;
+        fs().write_ext2_inode(index(), m_raw_inode);
+    }
+    inode_contents_changed(offset, end - offset, nullptr);
+    return KSuccess;
+}
+
+KResult Ext2FSInode::fsync(SyncMode mode)
+{
+    Locker inode_locker(m_lock);
+    Locker fs_locker(fs().m_lock);
+    // Directory contents are metadata, so syncing one is syncing metadata.
+    bool needs_metadata = mode == SyncMode::All || m_allocation_unsynced || is_directory();
+    if (needs_metadata && is_metadata_dirty())
+        flush_metadata();
+    ensure_block_list();
+    fs().flush_blocks(m_block_list);
+    if (needs_metadata) {
+        fs().sync_inode_metadata(index(), m_raw_inode);
+        m_allocation_unsynced = false;
+    }
     return KSuccess;
 }
 
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "DiskBackedFileSystem.h"
+#include "Ext2Journal.h"
 #include "UnixTypes.h"
+#include <AK/InlineLinkedList.h>
 #include <AK/OwnPtr.h>
 #include "ext2_fs.h"
 
@@ -11,8 +13,9 @@ struct ext2_super_block;
 
 class Ext2FS;
 
-class Ext2FSInode final : public Inode {
+class Ext2FSInode final : public Inode, public InlineLinkedListNode<Ext2FSInode> {
     friend class Ext2FS;
+    friend class InlineLinkedListNode<Ext2FSInode>;
 public:
     virtual ~Ext2FSInode() override;
 
@@ -26,7 +29,7 @@ private:
     // ^Inode
     virtual ssize_t read_bytes(off_t, ssize_t, byte* buffer, FileDescriptor*) const override;
     virtual InodeMetadata metadata() const override;
-    virtual bool traverse_as_directory(Function<bool(const FS::DirectoryEntry&)>) const override;
+    virtual bool traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)>) const override;
     virtual InodeIdentifier lookup(const String& name) override;
     virtual String reverse_lookup(InodeIdentifier) override;
     virtual void flush_metadata() override;
@@ -43,8 +46,48 @@ private:
     virtual KResult chmod(mode_t) override;
     virtual KResult chown(uid_t, gid_t) override;
     virtual KResult truncate(int) override;
+    virtual KResult fallocate(int mode, off_t offset, off_t length) override;
+    virtual KResult fsync(SyncMode) override;
+    virtual ssize_t read_pages_uncached(unsigned first_page_index, unsigned page_count, byte* buffer) const override;
+    virtual Vector<DiskOffset> page_offsets_on_disk() const override;
 
     void populate_lookup_cache() const;
+    void ensure_block_list() const;
+
+    // O_DIRECT transfers of whole blocks, between the disk and the caller without going through the caches.
+    ssize_t read_bytes_direct(off_t, ssize_t, byte* buffer) const;
+    bool write_blocks_direct(unsigned first_logical_block, unsigned count, const byte* data);
+
+    KResult punch_hole(off_t offset, off_t length);
+    bool zero_block_range(unsigned logical_block, size_t from, size_t to);
+
+    // Directory entries are edited in place in the block that holds them.
+    // Indexed (htree) directories find that block through the hash index.
+    struct DirectoryEntryLocation {
+        bool found { false };
+        unsigned block { 0 };
+        unsigned offset { 0 };
+        int previous_offset { -1 };
+    };
+    struct DirectoryIndexFrame {
+        unsigned block { 0 };
+        ByteBuffer buffer;
+        unsigned entries_offset { 0 };
+        unsigned position { 0 };
+    };
+    bool is_indexed_directory() const;
+    ByteBuffer read_directory_block(unsigned logical_block) const;
+    bool write_directory_block(unsigned logical_block, const ByteBuffer&);
+    bool append_directory_block(const ByteBuffer&);
+    bool find_entry_in_directory_block(const ByteBuffer&, const String& name, DirectoryEntryLocation&) const;
+    DirectoryEntryLocation find_directory_entry(const String& name) const;
+    bool probe_directory_index(const String& name, dword& hash, Vector<DirectoryIndexFrame>&, unsigned& leaf_block) const;
+    bool add_child_to_directory_index(InodeIdentifier child_id, const String& name, byte file_type);
+    // Called with the lock held, whenever an entry has been added or removed.
+    void did_modify_directory();
+    bool add_child_linearly(InodeIdentifier child_id, const String& name, byte file_type);
+    bool create_directory_index();
+    void drop_directory_index();
 
     Ext2FS& fs();
     const Ext2FS& fs() const;
@@ -54,20 +97,32 @@ private:
     mutable HashMap<String, unsigned> m_lookup_cache;
     ext2_inode m_raw_inode;
     mutable InodeIdentifier m_parent_id;
+    // The size or the block list changed since the last fsync(), so even fdatasync() has to write metadata.
+    bool m_allocation_unsynced { false };
+
+    // Links in Ext2FS's list of unused inodes.
+    Ext2FSInode* m_prev { nullptr };
+    Ext2FSInode* m_next { nullptr };
+    bool m_unused { false };
 };
 
 class Ext2FS final : public DiskBackedFS {
     friend class Ext2FSInode;
+    friend class Ext2Journal;
 public:
     static Retained <Ext2FS> create(Retained<DiskDevice>&&);
     virtual ~Ext2FS() override;
     virtual bool initialize() override;
+    virtual bool supports_lookup_caching() const override { return true; }
 
     virtual unsigned total_block_count() const override;
     virtual unsigned free_block_count() const override;
     virtual unsigned total_inode_count() const override;
     virtual unsigned free_inode_count() const override;
 
+    virtual void release_unused_inodes() override;
+    virtual void flush_writes() override;
+
 private:
     typedef unsigned BlockIndex;
     typedef unsigned GroupIndex;
@@ -77,6 +132,8 @@ private:
     const ext2_super_block& super_block() const;
     const ext2_group_desc& group_descriptor(unsigned groupIndex) const;
     void flush_block_group_descriptor_table();
+    ByteBuffer cached_bitmap_block(BlockIndex) const;
+    void mark_bitmap_block_dirty(BlockIndex);
     unsigned first_block_of_group(unsigned groupIndex) const;
     unsigned inodes_per_block() const;
     unsigned inodes_per_group() const;
@@ -89,19 +146,41 @@ private:
     ByteBuffer read_super_block() const;
     bool write_super_block(const ext2_super_block&);
 
+    bool initialize_journal();
+    // Inode tables, block lists, directories, bitmaps, group descriptors and the superblock go through the journal, if there is one.
+    bool write_metadata_block(BlockIndex, const ByteBuffer&);
+    void commit_journal();
+    void flush_allocation_state();
+    void sync_inode_metadata(InodeIndex, const ext2_inode&);
+
     virtual const char* class_name() const override;
     virtual InodeIdentifier root_inode() const override;
     virtual RetainPtr<Inode> create_inode(InodeIdentifier parentInode, const String& name, mode_t, unsigned size, int& error) override;
     virtual RetainPtr<Inode> create_directory(InodeIdentifier parentInode, const String& name, mode_t, int& error) override;
     virtual RetainPtr<Inode> get_inode(InodeIdentifier) const override;
 
+    bool supports_directory_index() const;
+    byte directory_hash_version(byte on_disk_hash_version) const;
+
     unsigned allocate_inode(unsigned preferredGroup, unsigned expectedSize);
-    Vector<BlockIndex> allocate_blocks(unsigned group, unsigned count);
+    Vector<BlockIndex> allocate_blocks(unsigned group, unsigned count, BlockIndex goal = 0, InodeIndex for_inode = 0);
+    bool is_block_reserved(BlockIndex, InodeIndex for_inode) const;
+    void reserve_blocks_after(InodeIndex, BlockIndex last_block);
+    void drop_block_reservation(InodeIndex);
     unsigned group_index_from_inode(unsigned) const;
     GroupIndex group_index_from_block_index(BlockIndex) const;
 
+    // One entry per block of the file, 0 for holes. With include_block_list_blocks, the indirect blocks too, and no holes.
     Vector<unsigned> block_list_for_inode(const ext2_inode&, bool include_block_list_blocks = false) const;
-    bool write_block_list_for_inode(InodeIndex, ext2_inode&, const Vector<BlockIndex>&);
+    void collect_block_array(BlockIndex array_block, unsigned depth, unsigned count, bool include_block_list_blocks, Vector<unsigned>&) const;
+    // Stores the entries for blocks [first, end), allocating indirect blocks as they're needed and freeing them once empty.
+    bool write_block_list_for_inode(InodeIndex, ext2_inode&, const Vector<BlockIndex>&, unsigned first, unsigned end);
+    bool update_block_array(InodeIndex, ext2_inode&, BlockIndex& array_block, unsigned depth, unsigned base, const Vector<BlockIndex>&, unsigned first, unsigned end);
+    // Frees the blocks [first, end) and leaves holes in their place.
+    bool punch_block_list_for_inode(InodeIndex, ext2_inode&, Vector<BlockIndex>&, unsigned first, unsigned end);
+    // Allocates and marks count blocks for the inode's data, spilling over into other groups if one can't fit them all.
+    // Returns none at all if there isn't room for every one.
+    Vector<BlockIndex> allocate_data_blocks(InodeIndex, unsigned count, BlockIndex goal);
 
     void dump_block_bitmap(unsigned groupIndex) const;
     void dump_inode_bitmap(unsigned groupIndex) const;
@@ -116,24 +195,44 @@ private:
     bool set_block_allocation_state(BlockIndex, bool);
 
     void uncache_inode(InodeIndex);
+    void inode_became_unused(Ext2FSInode&);
+    void inode_became_used(Ext2FSInode&);
     void free_inode(Ext2FSInode&);
 
-    struct BlockListShape {
-        unsigned direct_blocks { 0 };
-        unsigned indirect_blocks { 0 };
-        unsigned doubly_indirect_blocks { 0 };
-        unsigned triply_indirect_blocks { 0 };
-        unsigned meta_blocks { 0 };
+    // A reservation window keeps the blocks following an appended-to file free for
+    // that file's next allocation. It only lives in memory, nothing is marked on disk.
+    struct BlockReservation {
+        BlockIndex first { 0 };
+        unsigned count { 0 };
     };
 
-    BlockListShape compute_block_list_shape(unsigned blocks);
-
     unsigned m_block_group_count { 0 };
 
     mutable ByteBuffer m_cached_super_block;
     mutable ByteBuffer m_cached_group_descriptor_table;
 
+    // Allocation bitmaps stay in memory once read, and are changed there. Those, the free counts in the
+    // superblock and the group descriptors only go to disk in flush_writes(), not on every allocation.
+    struct CachedBitmapBlock {
+        ByteBuffer buffer;
+        bool dirty { false };
+    };
+    mutable HashMap<BlockIndex, CachedBitmapBlock> m_cached_bitmap_blocks;
+    unsigned m_dirty_bitmap_block_count { 0 };
+    bool m_super_block_dirty { false };
+    bool m_group_descriptor_table_dirty { false };
+
+    OwnPtr<Ext2Journal> m_journal;
+    bool m_committing { false };
+
     mutable HashMap<BlockIndex, RetainPtr<Ext2FSInode>> m_inode_cache;
+
+    // Inodes only the cache still refers to, most recently released first.
+    // They keep their parsed ext2_inode until they fall off the end.
+    mutable InlineLinkedList<Ext2FSInode> m_unused_inodes;
+    mutable unsigned m_unused_inode_count { 0 };
+    void evict_unused_inodes(unsigned keep_count);
+    HashMap<InodeIndex, BlockReservation> m_block_reservations;
 };
 
 inline Ext2FS& Ext2FSInode::fs()
@@ -0,0 +1,444 @@
+#include "Ext2Journal.h"
+#include "Ext2FileSystem.h"
+#include <AK/StdLibExtras.h>
+#include <AK/kstdio.h>
+#include <Kernel/NetworkOrdered.h>
+
+//#define EXT2_JOURNAL_DEBUG
+
+// Everything in the journal is big-endian.
+static const dword journal_magic = 0xc03b3998;
+
+enum JournalBlockType : dword {
+    Descriptor = 1,
+    Commit = 2,
+    SuperBlockV1 = 3,
+    SuperBlockV2 = 4,
+    Revoke = 5,
+};
+
+static const dword journal_feature_compat_checksum = 0x1;
+static const dword journal_feature_incompat_revoke = 0x1;
+
+static const dword tag_flag_escaped = 0x1;
+static const dword tag_flag_same_uuid = 0x2;
+static const dword tag_flag_last_tag = 0x8;
+
+struct [[gnu::packed]] JournalHeader {
+    NetworkOrdered<dword> magic;
+    NetworkOrdered<dword> block_type;
+    NetworkOrdered<dword> sequence;
+};
+
+struct [[gnu::packed]] JournalSuperBlock {
+    JournalHeader header;
+    NetworkOrdered<dword> block_size;
+    NetworkOrdered<dword> max_length;
+    NetworkOrdered<dword> first;
+    // The first transaction still in the log, or 0 in start if there's nothing to replay.
+    NetworkOrdered<dword> sequence;
+    NetworkOrdered<dword> start;
+    NetworkOrdered<dword> error;
+    // Only in version 2 superblocks.
+    NetworkOrdered<dword> feature_compat;
+    NetworkOrdered<dword> feature_incompat;
+    NetworkOrdered<dword> feature_ro_compat;
+    byte uuid[16];
+};
+
+// A descriptor block is a header followed by one tag per block that follows it in the log.
+// The first tag is followed by the journal's UUID, later ones say they have the same one.
+struct [[gnu::packed]] JournalBlockTag {
+    NetworkOrdered<dword> block;
+    NetworkOrdered<dword> flags;
+};
+
+// A revoke block is a header followed by block numbers, byte_count bytes in all.
+struct [[gnu::packed]] JournalRevokeHeader {
+    JournalHeader header;
+    NetworkOrdered<dword> byte_count;
+};
+
+static void initialize_header(byte* block, JournalBlockType block_type, dword sequence)
+{
+    auto& header = *reinterpret_cast<JournalHeader*>(block);
+    header.magic = journal_magic;
+    header.block_type = block_type;
+    header.sequence = sequence;
+}
+
+OwnPtr<Ext2Journal> Ext2Journal::create(Ext2FS& fs, const Vector<unsigned>& journal_blocks)
+{
+    auto journal = OwnPtr<Ext2Journal>(new Ext2Journal(fs, journal_blocks));
+    if (!journal->load_super_block())
+        return nullptr;
+    return journal;
+}
+
+Ext2Journal::Ext2Journal(Ext2FS& fs, const Vector<unsigned>& journal_blocks)
+    : m_fs(fs)
+    , m_journal_blocks(journal_blocks)
+    , m_block_size(fs.block_size())
+{
+}
+
+Ext2Journal::~Ext2Journal()
+{
+}
+
+bool Ext2Journal::load_super_block()
+{
+    if (m_journal_blocks.is_empty())
+        return false;
+    m_super_block = ByteBuffer::create_uninitialized(m_block_size);
+    if (!m_fs.device().read(m_journal_blocks[0] * m_block_size, m_block_size, m_super_block.pointer()))
+        return false;
+    auto& super_block = *reinterpret_cast<const JournalSuperBlock*>(m_super_block.pointer());
+    if (super_block.header.magic != journal_magic) {
+        kprintf("Ext2Journal: bad magic %x\n", (dword)super_block.header.magic);
+        return false;
+    }
+    if (super_block.header.block_type != SuperBlockV1 && super_block.header.block_type != SuperBlockV2) {
+        kprintf("Ext2Journal: unknown superblock type %u\n", (dword)super_block.header.block_type);
+        return false;
+    }
+    if (super_block.header.block_type == SuperBlockV2) {
+        // Block checksums and 64-bit block numbers are ext4 things, all we know besides the basics is revoking.
+        if ((super_block.feature_incompat & ~journal_feature_incompat_revoke) || (super_block.feature_compat & journal_feature_compat_checksum)) {
+            kprintf("Ext2Journal: unsupported features (compat %x, incompat %x)\n", (dword)super_block.feature_compat, (dword)super_block.feature_incompat);
+            return false;
+        }
+        memcpy(m_uuid, super_block.uuid, sizeof(m_uuid));
+    } else {
+        memset(m_uuid, 0, sizeof(m_uuid));
+    }
+    m_first = super_block.first;
+    m_max_length = super_block.max_length;
+    if (super_block.block_size != m_block_size || m_max_length > (unsigned)m_journal_blocks.size() || !m_first || m_first >= m_max_length) {
+        kprintf("Ext2Journal: bad geometry (block size %u, length %u, first %u, %u blocks)\n", (dword)super_block.block_size, m_max_length, m_first, m_journal_blocks.size());
+        return false;
+    }
+    // It takes at least a descriptor, a block and a commit, twice over.
+    if (m_max_length - m_first < 6) {
+        kprintf("Ext2Journal: too small (%u blocks)\n", m_max_length);
+        return false;
+    }
+    m_tail = super_block.start;
+    m_tail_sequence = super_block.sequence;
+    if (m_tail && (m_tail < m_first || m_tail >= m_max_length)) {
+        kprintf("Ext2Journal: log starts outside the journal (%u)\n", m_tail);
+        return false;
+    }
+#ifdef EXT2_JOURNAL_DEBUG
+    kprintf("Ext2Journal: %u blocks, first %u, start %u, sequence %u\n", m_max_length, m_first, m_tail, m_tail_sequence);
+#endif
+    return true;
+}
+
+bool Ext2Journal::write_super_block(unsigned start, dword sequence)
+{
+    auto& super_block = *reinterpret_cast<JournalSuperBlock*>(m_super_block.pointer());
+    super_block.start = start;
+    super_block.sequence = sequence;
+    if (!m_fs.device().write(m_journal_blocks[0] * m_block_size, m_block_size, m_super_block.pointer())) {
+        kprintf("Ext2Journal: failed to write the superblock\n");
+        return false;
+    }
+    m_tail = start;
+    m_tail_sequence = sequence;
+    return true;
+}
+
+unsigned Ext2Journal::next_position(unsigned position, unsigned count) const
+{
+    return m_first + (position - m_first + count) % (m_max_length - m_first);
+}
+
+bool Ext2Journal::read_log_block(unsigned position, byte* buffer) const
+{
+    return m_fs.device().read(m_journal_blocks[position] * m_block_size, m_block_size, buffer);
+}
+
+bool Ext2Journal::write_log_blocks(unsigned position, unsigned count, const byte* data)
+{
+    // The journal is usually contiguous on disk, so this is usually a single write, or two if the log wraps.
+    while (count) {
+        unsigned run_length = 1;
+        while (run_length < count
+            && position + run_length < m_max_length
+            && m_journal_blocks[position + run_length] == m_journal_blocks[position] + run_length)
+            ++run_length;
+        if (!m_fs.device().write(m_journal_blocks[position] * m_block_size, run_length * m_block_size, data))
+            return false;
+        data += run_length * m_block_size;
+        count -= run_length;
+        position = next_position(position, run_length);
+    }
+    return true;
+}
+
+unsigned Ext2Journal::tags_per_descriptor_block() const
+{
+    // Counting every tag as if it carried a UUID.
+    return (m_block_size - sizeof(JournalHeader)) / (sizeof(JournalBlockTag) + sizeof(m_uuid));
+}
+
+unsigned Ext2Journal::revokes_per_revoke_block() const
+{
+    return (m_block_size - sizeof(JournalRevokeHeader)) / sizeof(dword);
+}
+
+unsigned Ext2Journal::log_blocks_needed(unsigned block_count, unsigned revoke_count) const
+{
+    return block_count + ceil_div(block_count, tags_per_descriptor_block()) + ceil_div(revoke_count, revokes_per_revoke_block()) + 1;
+}
+
+bool Ext2Journal::has_room_for(unsigned block_count) const
+{
+    // Half the log at most, so there's always room for one transaction after the last one committed.
+    unsigned revoke_count = m_transaction_revokes.size() + block_count;
+    return log_blocks_needed(m_transaction_blocks.size() + block_count, revoke_count) <= (m_max_length - m_first) / 2;
+}
+
+// Walks the committed transactions from the tail. The first pass finds where they end,
+// the second gathers revoke records, and the third copies blocks home unless a later transaction revoked them.
+bool Ext2Journal::walk_log(ReplayPass pass, dword& end_sequence, HashMap<unsigned, dword>& revoked, unsigned& replayed_count)
+{
+    auto block = ByteBuffer::create_uninitialized(m_block_size);
+    auto data = ByteBuffer::create_uninitialized(m_block_size);
+    unsigned position = m_tail;
+    dword sequence = m_tail_sequence;
+    for (unsigned walked = 0; walked < m_max_length - m_first;) {
+        if (pass != ReplayPass::Scan && sequence == end_sequence)
+            break;
+        if (!read_log_block(position, block.pointer()))
+            return false;
+        auto& header = *reinterpret_cast<const JournalHeader*>(block.pointer());
+        if (header.magic != journal_magic || header.sequence != sequence)
+            break;
+        position = next_position(position);
+        ++walked;
+
+        if (header.block_type == Descriptor) {
+            unsigned offset = sizeof(JournalHeader);
+            while (offset + sizeof(JournalBlockTag) <= m_block_size) {
+                auto& tag = *reinterpret_cast<const JournalBlockTag*>(block.pointer() + offset);
+                dword flags = tag.flags;
+                offset += sizeof(JournalBlockTag);
+                if (!(flags & tag_flag_same_uuid))
+                    offset += sizeof(m_uuid);
+                if (pass == ReplayPass::Replay) {
+                    auto it = revoked.find(tag.block);
+                    if (it == revoked.end() || (*it).value < sequence) {
+                        if (!read_log_block(position, data.pointer()))
+                            return false;
+                        if (flags & tag_flag_escaped)
+                            reinterpret_cast<JournalHeader*>(data.pointer())->magic = journal_magic;
+                        m_fs.write_block(tag.block, data);
+                        ++replayed_count;
+                    }
+                }
+                position = next_position(position);
+                ++walked;
+                if (flags & tag_flag_last_tag)
+                    break;
+            }
+            continue;
+        }
+        if (header.block_type == Revoke) {
+            if (pass == ReplayPass::Revoke) {
+                auto& revoke_header = *reinterpret_cast<const JournalRevokeHeader*>(block.pointer());
+                unsigned byte_count = min((unsigned)revoke_header.byte_count, m_block_size);
+                for (unsigned offset = sizeof(JournalRevokeHeader); offset + sizeof(dword) <= byte_count; offset += sizeof(dword)) {
+                    unsigned revoked_block = *reinterpret_cast<const NetworkOrdered<dword>*>(block.pointer() + offset);
+                    auto it = revoked.find(revoked_block);
+                    if (it == revoked.end() || (*it).value < sequence)
+                        revoked.set(revoked_block, sequence);
+                }
+            }
+            continue;
+        }
+        if (header.block_type == Commit) {
+            ++sequence;
+            if (pass == ReplayPass::Scan)
+                end_sequence = sequence;
+            continue;
+        }
+        break;
+    }
+    return true;
+}
+
+bool Ext2Journal::replay()
+{
+    if (!m_tail) {
+        m_head = m_first;
+        m_sequence = m_tail_sequence;
+        return true;
+    }
+
+    dword end_sequence = m_tail_sequence;
+    HashMap<unsigned, dword> revoked;
+    unsigned replayed_count = 0;
+    if (!walk_log(ReplayPass::Scan, end_sequence, revoked, replayed_count)
+        || !walk_log(ReplayPass::Revoke, end_sequence, revoked, replayed_count)
+        || !walk_log(ReplayPass::Replay, end_sequence, revoked, replayed_count)) {
+        kprintf("Ext2Journal: failed to read the log\n");
+        return false;
+    }
+    kprintf("Ext2Journal: replayed %u block(s) from %u transaction(s)\n", replayed_count, end_sequence - m_tail_sequence);
+
+    // Everything has to be back in place before the log can be forgotten.
+    DiskBackedFS::flush_dirty_blocks(DiskBackedFS::FlushMode::All);
+    m_head = m_first;
+    m_sequence = end_sequence;
+    return write_super_block(0, end_sequence);
+}
+
+bool Ext2Journal::write_block(unsigned index, const ByteBuffer& data)
+{
+    if (!m_transaction_block_set.contains(index)) {
+        m_transaction_block_set.set(index);
+        m_transaction_blocks.append(index);
+    }
+    // Journaled again after being freed, so the new copy must be replayed.
+    if (m_transaction_revoke_set.contains(index)) {
+        m_transaction_revoke_set.remove(index);
+        for (int i = 0; i < m_transaction_revokes.size(); ++i) {
+            if (m_transaction_revokes[i] == index) {
+                m_transaction_revokes.remove(i);
+                break;
+            }
+        }
+    }
+    return m_fs.write_held_block(index, data);
+}
+
+void Ext2Journal::revoke_block(unsigned index)
+{
+    if (m_transaction_block_set.contains(index)) {
+        m_transaction_block_set.remove(index);
+        for (int i = 0; i < m_transaction_blocks.size(); ++i) {
+            if (m_transaction_blocks[i] == index) {
+                m_transaction_blocks.remove(i);
+                break;
+            }
+        }
+        m_fs.release_held_block(index);
+    }
+    // Only a copy that's already in the log can come back.
+    if (m_logged_blocks.find(index) == m_logged_blocks.end() || m_transaction_revoke_set.contains(index))
+        return;
+    m_transaction_revoke_set.set(index);
+    m_transaction_revokes.append(index);
+}
+
+bool Ext2Journal::commit()
+{
+    if (m_transaction_blocks.is_empty() && m_transaction_revokes.is_empty())
+        return true;
+
+    // Write back everything that isn't held first: in ordered mode file data reaches the disk before the metadata
+    // that points at it, and it's also what checkpoints earlier transactions, so the log space behind them can be reused.
+    DiskBackedFS::flush_dirty_blocks(DiskBackedFS::FlushMode::All);
+
+    unsigned log_block_count = log_blocks_needed(m_transaction_blocks.size(), m_transaction_revokes.size());
+    unsigned capacity = m_max_length - m_first;
+    ASSERT(log_block_count <= capacity / 2);
+    if (m_tail) {
+        unsigned used = (m_head + capacity - m_tail) % capacity;
+        if (used + log_block_count > capacity) {
+            // Everything before the last commit is on disk now, or is in this transaction.
+            if (!write_super_block(m_last_commit, m_last_commit_sequence))
+                return false;
+            Vector<unsigned> checkpointed_blocks;
+            for (auto& it : m_logged_blocks) {
+                if (it.value < m_last_commit_sequence)
+                    checkpointed_blocks.append(it.key);
+            }
+            for (auto block : checkpointed_blocks)
+                m_logged_blocks.remove(block);
+        }
+    }
+
+    auto log = ByteBuffer::create_zeroed(log_block_count * m_block_size);
+    unsigned log_blocks_used = 0;
+    auto next_log_block = [&] {
+        ASSERT(log_blocks_used < log_block_count);
+        return log.pointer() + log_blocks_used++ * m_block_size;
+    };
+
+    for (int i = 0; i < m_transaction_blocks.size();) {
+        byte* descriptor = next_log_block();
+        initialize_header(descriptor, Descriptor, m_sequence);
+        unsigned offset = sizeof(JournalHeader);
+        JournalBlockTag* last_tag = nullptr;
+        while (i < m_transaction_blocks.size() && offset + sizeof(JournalBlockTag) + (last_tag ? 0 : sizeof(m_uuid)) <= m_block_size) {
+            auto block = m_fs.read_block(m_transaction_blocks[i]);
+            ASSERT(block);
+            byte* copy = next_log_block();
+            memcpy(copy, block.pointer(), m_block_size);
+            dword flags = last_tag ? tag_flag_same_uuid : 0;
+            // A block that looks like a journal block is stored without its magic.
+            auto& copy_header = *reinterpret_cast<JournalHeader*>(copy);
+            if (copy_header.magic == journal_magic) {
+                copy_header.magic = 0;
+                flags |= tag_flag_escaped;
+            }
+            auto* tag = reinterpret_cast<JournalBlockTag*>(descriptor + offset);
+            tag->block = m_transaction_blocks[i];
+            tag->flags = flags;
+            offset += sizeof(JournalBlockTag);
+            if (!last_tag) {
+                memcpy(descriptor + offset, m_uuid, sizeof(m_uuid));
+                offset += sizeof(m_uuid);
+            }
+            last_tag = tag;
+            ++i;
+        }
+        ASSERT(last_tag);
+        last_tag->flags = last_tag->flags | tag_flag_last_tag;
+    }
+
+    for (int i = 0; i < m_transaction_revokes.size();) {
+        byte* revoke_block = next_log_block();
+        initialize_header(revoke_block, Revoke, m_sequence);
+        unsigned offset = sizeof(JournalRevokeHeader);
+        for (; i < m_transaction_revokes.size() && offset + sizeof(dword) <= m_block_size; ++i, offset += sizeof(dword))
+            *reinterpret_cast<NetworkOrdered<dword>*>(revoke_block + offset) = m_transaction_revokes[i];
+        reinterpret_cast<JournalRevokeHeader*>(revoke_block)->byte_count = offset;
+    }
+
+    initialize_header(next_log_block(), Commit, m_sequence);
+
+    // The commit block only goes out once everything before it is on disk, or a replay could find it with garbage in front.
+    unsigned transaction_start = m_head;
+    if (!write_log_blocks(m_head, log_blocks_used - 1, log.pointer())
+        || !write_log_blocks(next_position(m_head, log_blocks_used - 1), 1, log.pointer() + (log_blocks_used - 1) * m_block_size)) {
+        kprintf("Ext2Journal: failed to write transaction %u\n", m_sequence);
+        return false;
+    }
+    m_head = next_position(m_head, log_blocks_used);
+    if (!m_tail && !write_super_block(transaction_start, m_sequence))
+        return false;
+
+#ifdef EXT2_JOURNAL_DEBUG
+    kprintf("Ext2Journal: committed transaction %u, %u block(s) and %u revoke(s) in %u log block(s)\n", m_sequence, m_transaction_blocks.size(), m_transaction_revokes.size(), log_blocks_used);
+#endif
+
+    // Committed, so the blocks may go to disk now.
+    for (auto index : m_transaction_blocks) {
+        m_logged_blocks.set(index, m_sequence);
+        m_fs.release_held_block(index);
+    }
+    for (auto index : m_transaction_revokes)
+        m_logged_blocks.remove(index);
+    m_last_commit = transaction_start;
+    m_last_commit_sequence = m_sequence;
+    ++m_sequence;
+    m_transaction_blocks.clear();
+    m_transaction_block_set.clear();
+    m_transaction_revokes.clear();
+    m_transaction_revoke_set.clear();
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <AK/ByteBuffer.h>
+#include <AK/HashMap.h>
+#include <AK/HashTable.h>
+#include <AK/OwnPtr.h>
+#include <AK/Vector.h>
+
+class Ext2FS;
+
+// An ext3-compatible (JBD) metadata journal, kept in the file system's journal inode.
+//
+// Metadata blocks written during a transaction are held in the block cache instead of going to disk.
+// A commit first writes back everything that isn't held (file data, so data always reaches the disk
+// before the metadata pointing at it, and the blocks of earlier transactions), then appends copies of
+// the transaction's blocks to the log followed by a commit block, and only then lets them go to disk.
+// After a crash, replay() copies every committed transaction still in the log back into place.
+class Ext2Journal {
+public:
+    static OwnPtr<Ext2Journal> create(Ext2FS&, const Vector<unsigned>& journal_blocks);
+    ~Ext2Journal();
+
+    // Puts back what was committed but may not have reached its home location. Call before anything else reads the file system.
+    bool replay();
+
+    // Adds a metadata block to the running transaction.
+    bool write_block(unsigned index, const ByteBuffer&);
+    // Whether the running transaction can take this many more blocks.
+    bool has_room_for(unsigned block_count) const;
+    // A freed block mustn't be put back by a replay after it's been reused for file data.
+    void revoke_block(unsigned index);
+
+    bool commit();
+
+private:
+    Ext2Journal(Ext2FS&, const Vector<unsigned>& journal_blocks);
+
+    bool load_super_block();
+    bool write_super_block(unsigned start, dword sequence);
+    bool read_log_block(unsigned position, byte*) const;
+    bool write_log_blocks(unsigned position, unsigned count, const byte*);
+    unsigned next_position(unsigned position, unsigned count = 1) const;
+    unsigned log_blocks_needed(unsigned block_count, unsigned revoke_count) const;
+    unsigned tags_per_descriptor_block() const;
+    unsigned revokes_per_revoke_block() const;
+
+    enum class ReplayPass { Scan, Revoke, Replay };
+    bool walk_log(ReplayPass, dword& end_sequence, HashMap<unsigned, dword>& revoked, unsigned& replayed_count);
+
+    Ext2FS& m_fs;
+    // Where each block of the journal inode is on disk.
+    Vector<unsigned> m_journal_blocks;
+    ByteBuffer m_super_block;
+    unsigned m_block_size { 0 };
+    unsigned m_first { 0 };
+    unsigned m_max_length { 0 };
+    byte m_uuid[16];
+
+    // The oldest transaction the journal superblock points at, and where the next one goes.
+    unsigned m_tail { 0 };
+    dword m_tail_sequence { 0 };
+    unsigned m_head { 0 };
+    dword m_sequence { 0 };
+    unsigned m_last_commit { 0 };
+    dword m_last_commit_sequence { 0 };
+
+    Vector<unsigned> m_transaction_blocks;
+    HashTable<unsigned> m_transaction_block_set;
+    Vector<unsigned> m_transaction_revokes;
+    HashTable<unsigned> m_transaction_revoke_set;
+
+    // Blocks with a copy in a committed transaction that's still in the log, and that transaction's sequence.
+    HashMap<unsigned, dword> m_logged_blocks;
+};
@@ -10,6 +10,7 @@ Retained<FIFO> FIFO::create()
 
 FIFO::FIFO()
 {
+    m_buffer.set_wait_queue(m_wait_queue);
 }
 
 void FIFO::open(Direction direction)
@@ -25,6 +26,7 @@ void FIFO::open(Direction direction)
         kprintf("open writer (%u)\n", m_writers);
 #endif
     }
+    m_wait_queue.wake_all();
 }
 
 void FIFO::close(Direction direction)
@@ -42,6 +44,7 @@ void FIFO::close(Direction direction)
         ASSERT(m_writers);
         --m_writers;
     }
+    m_wait_queue.wake_all();
 }
 
 bool FIFO::can_read() const
@@ -51,7 +54,7 @@ bool FIFO::can_read() const
 
 bool FIFO::can_write() const
 {
-    return m_buffer.bytes_in_write_buffer() < 4096;
+    return m_buffer.can_write();
 }
 
 ssize_t FIFO::read(byte* buffer, ssize_t size)
@@ -1,9 +1,10 @@
 #pragma once
 
-#include "DoubleBuffer.h"
+#include "RingBuffer.h"
 #include <AK/Retainable.h>
 #include <AK/RetainPtr.h>
 #include <Kernel/UnixTypes.h>
+#include <Kernel/WaitQueue.h>
 
 class FIFO : public Retainable<FIFO> {
 public:
@@ -22,10 +23,13 @@ public:
     bool can_read() const;
     bool can_write() const;
 
+    WaitQueue& wait_queue() { return m_wait_queue; }
+
 private:
     FIFO();
 
     unsigned m_writers { 0 };
     unsigned m_readers { 0 };
-    DoubleBuffer m_buffer;
+    RingBuffer m_buffer { 16 * KB };
+    WaitQueue m_wait_queue;
 };
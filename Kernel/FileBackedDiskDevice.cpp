@@ -2,10 +2,12 @@
 
 #include "FileBackedDiskDevice.h"
 #include <cstring>
-#include <sys/stat.h>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 //#define FBBD_DEBUG
-#define IGNORE_FILE_LENGTH // Useful for e.g /dev/hda2
 
 RetainPtr<FileBackedDiskDevice> FileBackedDiskDevice::create(String&& image_path, unsigned block_size)
 {
@@ -16,15 +18,33 @@ FileBackedDiskDevice::FileBackedDiskDevice(String&& image_path, unsigned block_s
     : m_image_path(move(image_path))
     , m_block_size(block_size)
 {
-    struct stat st;
-    int result = stat(m_image_path.characters(), &st);
-    ASSERT(result != -1);
-    m_file_length = st.st_size;
-    m_file = fopen(m_image_path.characters(), "r+");
+    m_fd = open(m_image_path.characters(), O_RDWR);
+    if (m_fd < 0) {
+        perror("open");
+        return;
+    }
+    // Seeking to the end works for block devices (e.g /dev/hda2) too, where stat() says the size is 0.
+    m_length = lseek(m_fd, 0, SEEK_END);
+    if (m_length <= 0)
+        return;
+    void* data = mmap(nullptr, m_length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    m_data = (byte*)data;
+    // Filesystems are read all over the place, so there's no point in the host reading ahead.
+    madvise(m_data, m_length, MADV_RANDOM);
 }
 
 FileBackedDiskDevice::~FileBackedDiskDevice()
 {
+    if (m_data) {
+        sync();
+        munmap(m_data, m_length);
+    }
+    if (m_fd >= 0)
+        close(m_fd);
 }
 
 unsigned FileBackedDiskDevice::block_size() const
@@ -32,51 +52,52 @@ unsigned FileBackedDiskDevice::block_size() const
     return m_block_size;
 }
 
+bool FileBackedDiskDevice::is_in_range(unsigned index, unsigned count) const
+{
+    off_t end = ((off_t)index + count) * m_block_size;
+    return m_data && end <= m_length;
+}
+
 bool FileBackedDiskDevice::read_block(unsigned index, byte* out) const
 {
-    DiskOffset offset = index * m_block_size;
-    return read_internal(offset, block_size(), out);
+    return read_blocks(index, 1, out);
 }
 
 bool FileBackedDiskDevice::write_block(unsigned index, const byte* data)
 {
-    DiskOffset offset = index * m_block_size;
-    return write_internal(offset, block_size(), data);
+    return write_blocks(index, 1, data);
 }
 
-bool FileBackedDiskDevice::read_internal(DiskOffset offset, unsigned length, byte* out) const
+bool FileBackedDiskDevice::read_blocks(unsigned index, unsigned count, byte* out) const
 {
-#ifndef IGNORE_FILE_LENGTH
-    if (offset + length >= m_file_length)
-        return false;
-#endif
 #ifdef FBBD_DEBUG
-    printf("[FileBackedDiskDevice] Read device @ offset %llx, length %u\n", offset, length);
+    printf("[FileBackedDiskDevice] Read device @ block %u, count %u\n", index, count);
 #endif
-    fseeko(m_file, offset, SEEK_SET);
-    unsigned nread = fread(out, sizeof(byte), length, m_file);
-    ASSERT(nread == length);
+    if (!is_in_range(index, count))
+        return false;
+    memcpy(out, m_data + (off_t)index * m_block_size, count * m_block_size);
     return true;
 }
 
-bool FileBackedDiskDevice::write_internal(DiskOffset offset, unsigned length, const byte* data)
+bool FileBackedDiskDevice::write_blocks(unsigned index, unsigned count, const byte* data)
 {
-#ifndef IGNORE_FILE_LENGTH
-    if (offset + length >= m_file_length)
-        return false;
-#endif
 #ifdef FBBD_DEBUG
-    printf("[FileBackedDiskDevice] Write device @ offset %llx, length %u\n", offset, length);
+    printf("[FileBackedDiskDevice] Write device @ block %u, count %u\n", index, count);
 #endif
-    fseeko(m_file, offset, SEEK_SET);
-    // size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream);
-    unsigned nwritten = fwrite(data, sizeof(byte), length, m_file);
-    ASSERT(nwritten == length);
+    if (!is_in_range(index, count))
+        return false;
+    memcpy(m_data + (off_t)index * m_block_size, data, count * m_block_size);
     return true;
 }
 
+bool FileBackedDiskDevice::sync()
+{
+    if (!m_data)
+        return false;
+    return msync(m_data, m_length, MS_SYNC) == 0;
+}
+
 const char* FileBackedDiskDevice::class_name() const
 {
     return "FileBackedDiskDevice";
 }
-
@@ -4,30 +4,36 @@
 #include <AK/RetainPtr.h>
 #include <AK/AKString.h>
 #include <AK/Types.h>
-#include <stdio.h>
 
+// A disk image on the host, mapped in whole. Blocks are copied straight out of (and into) the mapping,
+// so the host's page cache is the only cache the image has besides the filesystem's dirty blocks.
 class FileBackedDiskDevice final : public DiskDevice {
 public:
     static RetainPtr<FileBackedDiskDevice> create(String&& image_path, unsigned block_size);
     virtual ~FileBackedDiskDevice() override;
 
-    bool is_valid() const { return m_file; }
+    bool is_valid() const { return m_data; }
 
     virtual unsigned block_size() const override;
     virtual bool read_block(unsigned index, byte* out) const override;
     virtual bool write_block(unsigned index, const byte*) override;
+    virtual bool read_blocks(unsigned index, unsigned count, byte* out) const override;
+    virtual bool write_blocks(unsigned index, unsigned count, const byte*) override;
+    virtual bool is_memory_backed() const override { return true; }
+
+    // Pushes what's been written out to the image.
+    bool sync();
 
 private:
     virtual const char* class_name() const override;
 
-    bool read_internal(DiskOffset, unsigned length, byte* out) const;
-    bool write_internal(DiskOffset, unsigned length, const byte* data);
+    bool is_in_range(unsigned index, unsigned count) const;
 
     FileBackedDiskDevice(String&& imagePath, unsigned block_size);
 
     String m_image_path;
-    FILE* m_file { nullptr };
-    DiskOffset m_file_length { 0 };
+    int m_fd { -1 };
+    byte* m_data { nullptr };
+    off_t m_length { 0 };
     unsigned m_block_size { 0 };
 };
-
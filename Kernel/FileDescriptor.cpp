@@ -22,6 +22,11 @@ Retained<FileDescriptor> FileDescriptor::create(RetainPtr<Device>&& device)
     return adopt(*new FileDescriptor(move(device)));
 }
 
+Retained<FileDescriptor> FileDescriptor::create(RetainPtr<EPoll>&& epoll)
+{
+    return adopt(*new FileDescriptor(move(epoll)));
+}
+
 Retained<FileDescriptor> FileDescriptor::create(RetainPtr<Socket>&& socket, SocketRole role)
 {
     return adopt(*new FileDescriptor(move(socket), role));
@@ -47,6 +52,11 @@ FileDescriptor::FileDescriptor(RetainPtr<Device>&& device)
 {
 }
 
+FileDescriptor::FileDescriptor(RetainPtr<EPoll>&& epoll)
+    : m_epoll(move(epoll))
+{
+}
+
 FileDescriptor::FileDescriptor(RetainPtr<Socket>&& socket, SocketRole role)
     : m_socket(move(socket))
 {
@@ -97,6 +107,8 @@ Retained<FileDescriptor> FileDescriptor::clone()
         } else if (m_socket) {
             descriptor = FileDescriptor::create(m_socket.copy_ref(), m_socket_role);
             descriptor->m_inode = m_inode.copy_ref();
+        } else if (m_epoll) {
+            descriptor = FileDescriptor::create(m_epoll.copy_ref());
         } else {
             descriptor = FileDescriptor::create(m_inode.copy_ref());
         }
@@ -115,16 +127,8 @@ bool addition_would_overflow(off_t a, off_t b)
     return (ua + b) > maxFileOffset;
 }
 
-KResult FileDescriptor::fstat(stat& buffer)
+static void fill_stat_from_metadata(const InodeMetadata& metadata, stat& buffer)
 {
-    ASSERT(!is_fifo());
-    if (!m_inode && !m_device)
-        return KResult(-EBADF);
-
-    auto metadata = this->metadata();
-    if (!metadata.is_valid())
-        return KResult(-EIO);
-
     buffer.st_rdev = encoded_device(metadata.major_device, metadata.minor_device);
     buffer.st_ino = metadata.inode.index();
     buffer.st_mode = metadata.mode;
@@ -138,6 +142,19 @@ KResult FileDescriptor::fstat(stat& buffer)
     buffer.st_atime = metadata.atime;
     buffer.st_mtime = metadata.mtime;
     buffer.st_ctime = metadata.ctime;
+}
+
+KResult FileDescriptor::fstat(stat& buffer)
+{
+    ASSERT(!is_fifo());
+    if (!m_inode && !m_device)
+        return KResult(-EBADF);
+
+    auto metadata = this->metadata();
+    if (!metadata.is_valid())
+        return KResult(-EIO);
+
+    fill_stat_from_metadata(metadata, buffer);
     return KSuccess;
 }
 
@@ -148,6 +165,22 @@ KResult FileDescriptor::fchmod(mode_t mode)
     return VFS::the().chmod(*m_inode, mode);
 }
 
+KResult FileDescriptor::fsync(Inode::SyncMode mode)
+{
+    if (!m_inode)
+        return KResult(-EINVAL);
+    return m_inode->fsync(mode);
+}
+
+KResult FileDescriptor::fallocate(int mode, off_t offset, off_t length)
+{
+    if (!m_inode)
+        return KResult(-ESPIPE);
+    if (is_directory())
+        return KResult(-EISDIR);
+    return m_inode->fallocate(mode, offset, length);
+}
+
 off_t FileDescriptor::seek(off_t offset, int whence)
 {
     ASSERT(!is_fifo());
@@ -182,6 +215,9 @@ off_t FileDescriptor::seek(off_t offset, int whence)
         return -EINVAL;
     }
 
+    // Going back to the start is how a reader asks a synthetic file for fresh contents.
+    if (!newOffset)
+        m_generator_cache.clear();
     m_current_offset = newOffset;
     return m_current_offset;
 }
@@ -197,7 +233,9 @@ ssize_t FileDescriptor::read(Process& process, byte* buffer, ssize_t count)
         return m_device->read(process, buffer, count);
     }
     if (m_socket)
-        return m_socket->read(m_socket_role, buffer, count);
+        return m_socket->read(m_socket_role, buffer, count, m_is_blocking ? 0 : MSG_DONTWAIT);
+    if (m_epoll)
+        return -EINVAL;
     ASSERT(inode());
     ssize_t nread = inode()->read_bytes(m_current_offset, count, buffer, this);
     m_current_offset += nread;
@@ -215,13 +253,38 @@ ssize_t FileDescriptor::write(Process& process, const byte* data, ssize_t size)
         return m_device->write(process, data, size);
     }
     if (m_socket)
-        return m_socket->write(m_socket_role, data, size);
+        return m_socket->write(m_socket_role, data, size, m_is_blocking ? 0 : MSG_DONTWAIT);
+    if (m_epoll)
+        return -EINVAL;
     ASSERT(m_inode);
     ssize_t nwritten = m_inode->write_bytes(m_current_offset, size, data, this);
     m_current_offset += nwritten;
     return nwritten;
 }
 
+bool FileDescriptor::is_seekable() const
+{
+    return m_inode && !m_device && !m_socket && !is_fifo();
+}
+
+ssize_t FileDescriptor::read_at(off_t offset, byte* buffer, ssize_t count)
+{
+    if (!is_seekable())
+        return -ESPIPE;
+    if (offset < 0)
+        return -EINVAL;
+    return m_inode->read_bytes(offset, count, buffer, this);
+}
+
+ssize_t FileDescriptor::write_at(off_t offset, const byte* data, ssize_t size)
+{
+    if (!is_seekable())
+        return -ESPIPE;
+    if (offset < 0)
+        return -EINVAL;
+    return m_inode->write_bytes(offset, size, data, this);
+}
+
 bool FileDescriptor::can_write(Process& process)
 {
     if (is_fifo()) {
@@ -232,6 +295,8 @@ bool FileDescriptor::can_write(Process& process)
         return m_device->can_write(process);
     if (m_socket)
         return m_socket->can_write(m_socket_role);
+    if (m_epoll)
+        return false;
     return true;
 }
 
@@ -245,9 +310,24 @@ bool FileDescriptor::can_read(Process& process)
         return m_device->can_read(process);
     if (m_socket)
         return m_socket->can_read(m_socket_role);
+    if (m_epoll)
+        return m_epoll->has_pending_entries();
     return true;
 }
 
+WaitQueue* FileDescriptor::wait_queue()
+{
+    if (is_fifo())
+        return &m_fifo->wait_queue();
+    if (m_device)
+        return &m_device->wait_queue();
+    if (m_socket)
+        return &m_socket->wait_queue();
+    if (m_epoll)
+        return &m_epoll->wait_queue();
+    return nullptr;
+}
+
 ByteBuffer FileDescriptor::read_entire_file(Process& process)
 {
     ASSERT(!is_fifo());
@@ -298,6 +378,62 @@ ssize_t FileDescriptor::get_dir_entries(byte* buffer, ssize_t size)
     return stream.offset();
 }
 
+// Like get_dir_entries(), but each entry is preceded by what lstat() would say about it.
+// Entries are handed out in as many calls as it takes, with the current offset counting
+// entries already returned. Returns 0 once the directory is exhausted.
+ssize_t FileDescriptor::get_dir_entries_with_stat(byte* buffer, ssize_t size)
+{
+    auto metadata = this->metadata();
+    if (!metadata.is_valid())
+        return -EIO;
+    if (!metadata.is_directory())
+        return -ENOTDIR;
+
+    struct Entry {
+        String name;
+        InodeIdentifier inode;
+        byte file_type;
+    };
+    Vector<Entry> entries;
+    off_t index = 0;
+    VFS::the().traverse_directory_inode(*m_inode, [&] (auto& entry) {
+        if (index++ >= m_current_offset)
+            entries.append({ String(entry.name, entry.name_length), entry.inode, entry.file_type });
+        return true;
+    });
+
+    ssize_t nwritten = 0;
+    for (auto& entry : entries) {
+        ssize_t entry_size = sizeof(stat) + sizeof(byte) + sizeof(dword) + entry.name.length();
+        if (nwritten + entry_size > size)
+            break;
+
+        stat entry_stat;
+        memset(&entry_stat, 0, sizeof(entry_stat));
+        auto inode = VFS::the().get_inode(entry.inode);
+        if (inode)
+            fill_stat_from_metadata(inode->metadata(), entry_stat);
+        else
+            entry_stat.st_ino = entry.inode.index();
+
+        byte* ptr = buffer + nwritten;
+        memcpy(ptr, &entry_stat, sizeof(stat));
+        ptr += sizeof(stat);
+        *ptr++ = entry.file_type;
+        dword name_length = entry.name.length();
+        memcpy(ptr, &name_length, sizeof(dword));
+        ptr += sizeof(dword);
+        memcpy(ptr, entry.name.characters(), name_length);
+
+        nwritten += entry_size;
+        ++m_current_offset;
+    }
+
+    if (!nwritten && !entries.is_empty())
+        return -EINVAL;
+    return nwritten;
+}
+
 bool FileDescriptor::is_tty() const
 {
     return m_device && m_device->is_tty();
@@ -368,6 +504,8 @@ KResultOr<String> FileDescriptor::absolute_path()
         return String::format("device:%u,%u (%s)", m_device->major(), m_device->minor(), m_device->class_name());
     if (is_socket())
         return String::format("socket:%x (role: %s)", m_socket.ptr(), to_string(m_socket_role));
+    if (is_epoll())
+        return String::format("epoll:%x", m_epoll.ptr());
     ASSERT(m_inode);
     return VFS::the().absolute_path(*m_inode);
 }
@@ -396,7 +534,7 @@ bool FileDescriptor::supports_mmap() const
     return false;
 }
 
-Region* FileDescriptor::mmap(Process& process, LinearAddress laddr, size_t offset, size_t size, int prot)
+Region* FileDescriptor::mmap(Process& process, LinearAddress laddr, size_t offset, size_t size, int prot, int flags)
 {
     ASSERT(supports_mmap());
 
@@ -413,11 +551,13 @@ Region* FileDescriptor::mmap(Process& process, LinearAddress laddr, size_t offse
     region_name = "Memory-mapped file";
 #endif
     InterruptDisabler disabler;
-    // FIXME: Implement mapping at a client-specified address. Most of the support is already in plcae.
-    ASSERT(laddr.as_ptr() == nullptr);
-    auto* region = process.allocate_file_backed_region(LinearAddress(), size, inode(), move(region_name), prot & PROT_READ, prot & PROT_WRITE);
-    region->page_in();
-    return region;
+    // Writable private mappings get their own VMO so their writes never reach the file or other mappers.
+    // Everything else shares the inode's VMO, and so its pages.
+    bool is_private_and_writable = !(flags & MAP_SHARED) && (prot & PROT_WRITE);
+    auto vmo = is_private_and_writable ? VMObject::create_private_file_backed(inode()) : VMObject::create_file_backed(inode());
+    if ((offset & ~PAGE_MASK) || offset + PAGE_ROUND_UP(size) > vmo->size())
+        return nullptr;
+    return process.allocate_region_with_vmo(laddr, size, move(vmo), offset, move(region_name), prot & PROT_READ, prot & PROT_WRITE);
 }
 
 bool FileDescriptor::is_block_device() const
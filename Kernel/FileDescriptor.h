@@ -7,6 +7,8 @@
 #include <AK/CircularQueue.h>
 #include <AK/Retainable.h>
 #include <AK/Badge.h>
+#include <AK/Weakable.h>
+#include <Kernel/EPoll.h>
 #include <Kernel/Socket.h>
 
 class TTY;
@@ -15,12 +17,13 @@ class Process;
 class Region;
 class CharacterDevice;
 
-class FileDescriptor : public Retainable<FileDescriptor> {
+class FileDescriptor : public Retainable<FileDescriptor>, public Weakable<FileDescriptor> {
 public:
 
     static Retained<FileDescriptor> create(RetainPtr<Socket>&&, SocketRole = SocketRole::None);
     static Retained<FileDescriptor> create(RetainPtr<Inode>&&);
     static Retained<FileDescriptor> create(RetainPtr<Device>&&);
+    static Retained<FileDescriptor> create(RetainPtr<EPoll>&&);
     static Retained<FileDescriptor> create_pipe_writer(FIFO&);
     static Retained<FileDescriptor> create_pipe_reader(FIFO&);
     ~FileDescriptor();
@@ -32,14 +35,23 @@ public:
     off_t seek(off_t, int whence);
     ssize_t read(Process&, byte*, ssize_t);
     ssize_t write(Process&, const byte* data, ssize_t);
+    ssize_t read_at(off_t, byte*, ssize_t);
+    ssize_t write_at(off_t, const byte* data, ssize_t);
+    bool is_seekable() const;
     KResult fstat(stat&);
 
     KResult fchmod(mode_t);
+    KResult fsync(Inode::SyncMode);
+    KResult fallocate(int mode, off_t offset, off_t length);
 
     bool can_read(Process&);
     bool can_write(Process&);
 
+    // The wait queue that's woken when can_read() or can_write() may have changed, if there is one.
+    WaitQueue* wait_queue();
+
     ssize_t get_dir_entries(byte* buffer, ssize_t);
+    ssize_t get_dir_entries_with_stat(byte* buffer, ssize_t);
 
     ByteBuffer read_entire_file(Process&);
 
@@ -69,18 +81,23 @@ public:
     const Inode* inode() const { return m_inode.ptr(); }
 
     bool supports_mmap() const;
-    Region* mmap(Process&, LinearAddress, size_t offset, size_t, int prot);
+    Region* mmap(Process&, LinearAddress, size_t offset, size_t, int prot, int flags);
 
     bool is_blocking() const { return m_is_blocking; }
     void set_blocking(bool b) { m_is_blocking = b; }
 
     dword file_flags() const { return m_file_flags; }
     void set_file_flags(dword flags) { m_file_flags = flags; }
+    // O_DIRECT: reads and writes skip the caches where the file system can manage it.
+    bool is_direct() const { return m_file_flags & O_DIRECT; }
 
     bool is_socket() const { return m_socket; }
     Socket* socket() { return m_socket.ptr(); }
     const Socket* socket() const { return m_socket.ptr(); }
 
+    bool is_epoll() const { return m_epoll; }
+    EPoll* epoll() { return m_epoll.ptr(); }
+
     bool is_fifo() const { return m_fifo; }
     FIFO::Direction fifo_direction() { return m_fifo_direction; }
 
@@ -91,17 +108,35 @@ public:
     SocketRole socket_role() const { return m_socket_role; }
     void set_socket_role(SocketRole);
 
+    // Sequential access tracking for Inode read-ahead.
+    struct ReadAheadState {
+        off_t next_offset { 0 };
+        unsigned window { 0 };
+        unsigned end_page { 0 };
+    };
+    ReadAheadState& read_ahead_state() { return m_read_ahead_state; }
+
+    // What's been moved through the descriptor by the read and write syscalls, for /proc/<pid>/stats.
+    qword bytes_read() const { return m_bytes_read; }
+    qword bytes_written() const { return m_bytes_written; }
+    void did_read(ssize_t nread) { if (nread > 0) m_bytes_read += nread; }
+    void did_write(ssize_t nwritten) { if (nwritten > 0) m_bytes_written += nwritten; }
+
 private:
     friend class VFS;
     FileDescriptor(RetainPtr<Socket>&&, SocketRole);
     explicit FileDescriptor(RetainPtr<Inode>&&);
     explicit FileDescriptor(RetainPtr<Device>&&);
+    explicit FileDescriptor(RetainPtr<EPoll>&&);
     FileDescriptor(FIFO&, FIFO::Direction);
 
     RetainPtr<Inode> m_inode;
     RetainPtr<Device> m_device;
 
     off_t m_current_offset { 0 };
+    ReadAheadState m_read_ahead_state;
+    qword m_bytes_read { 0 };
+    qword m_bytes_written { 0 };
 
     ByteBuffer m_generator_cache;
 
@@ -111,6 +146,8 @@ private:
     RetainPtr<Socket> m_socket;
     SocketRole m_socket_role { SocketRole::None };
 
+    RetainPtr<EPoll> m_epoll;
+
     RetainPtr<FIFO> m_fifo;
     FIFO::Direction m_fifo_direction { FIFO::Neither };
 
@@ -4,11 +4,13 @@
 #include <LibC/errno_numbers.h>
 #include "FileSystem.h"
 #include "MemoryManager.h"
+#include <Kernel/FileDescriptor.h>
 #include <Kernel/LocalSocket.h>
 
 static dword s_lastFileSystemID;
 static HashMap<dword, FS*>* s_fs_map;
 static HashTable<Inode*>* s_inode_set;
+static unsigned s_page_cache_page_count;
 
 static HashMap<dword, FS*>& all_fses()
 {
@@ -96,6 +98,9 @@ Inode::Inode(FS& fs, unsigned index)
 
 Inode::~Inode()
 {
+    InterruptDisabler disabler;
+    if (!m_page_cache_pinned)
+        s_page_cache_page_count -= m_page_cache.size();
     all_inodes().remove(this);
 }
 
@@ -107,16 +112,27 @@ void Inode::will_be_destroyed()
 
 void Inode::inode_contents_changed(off_t offset, ssize_t size, const byte* data)
 {
+    if (size > 0)
+        uncache_pages(offset / PAGE_SIZE, (offset + size - 1) / PAGE_SIZE);
     if (m_vmo)
         m_vmo->inode_contents_changed(Badge<Inode>(), offset, size, data);
 }
 
 void Inode::inode_size_changed(size_t old_size, size_t new_size)
 {
+    // The page straddling the old end of file has zero padding that may now be stale.
+    size_t first_stale_page = min(old_size, new_size) / PAGE_SIZE;
+    size_t last_stale_page = max(old_size, new_size) / PAGE_SIZE;
+    uncache_pages(first_stale_page, last_stale_page);
     if (m_vmo)
         m_vmo->inode_size_changed(Badge<Inode>(), old_size, new_size);
 }
 
+KResult Inode::fallocate(int, off_t, off_t)
+{
+    return KResult(-EOPNOTSUPP);
+}
+
 int Inode::set_atime(time_t)
 {
     return -ENOTIMPL;
@@ -157,6 +173,35 @@ void FS::sync()
         ASSERT(inode->is_metadata_dirty());
         inode->flush_metadata();
     }
+
+    Vector<Retained<FS>> fses;
+    {
+        InterruptDisabler disabler;
+        for (auto& it : all_fses())
+            fses.append(*it.value);
+    }
+    for (auto& fs : fses)
+        fs->flush_writes();
+}
+
+KResult Inode::fsync(SyncMode mode)
+{
+    // Nothing is cached on the way to disk, unless the file system overrides this.
+    if (mode == SyncMode::All && is_metadata_dirty())
+        flush_metadata();
+    return KSuccess;
+}
+
+void FS::release_unused_inodes_everywhere()
+{
+    Vector<Retained<FS>> fses;
+    {
+        InterruptDisabler disabler;
+        for (auto& it : all_fses())
+            fses.append(*it.value);
+    }
+    for (auto& fs : fses)
+        fs->release_unused_inodes();
 }
 
 void Inode::set_vmo(VMObject& vmo)
@@ -164,6 +209,232 @@ void Inode::set_vmo(VMObject& vmo)
     m_vmo = vmo.make_weak_ptr();
 }
 
+unsigned Inode::page_cache_page_count()
+{
+    return s_page_cache_page_count;
+}
+
+static unsigned page_cache_page_limit()
+{
+    // Let the page cache grow to a quarter of physical memory before evicting.
+    return (MM.ram_size() / PAGE_SIZE) / 4;
+}
+
+ssize_t Inode::read_pages_uncached(unsigned, unsigned, byte*) const
+{
+    return -ENOTIMPL;
+}
+
+RetainPtr<PhysicalPage> Inode::cached_page(unsigned page_index) const
+{
+    unsigned generation;
+    {
+        InterruptDisabler disabler;
+        auto it = m_page_cache.find(page_index);
+        if (it != m_page_cache.end())
+            return (*it).value;
+        generation = m_page_cache_generation;
+    }
+    if (m_page_cache_pinned)
+        return pinned_page(page_index);
+
+    auto buffer = ByteBuffer::create_uninitialized(PAGE_SIZE);
+    ssize_t nread = read_pages_uncached(page_index, 1, buffer.pointer());
+    if (nread < 0)
+        return nullptr;
+    ASSERT(nread <= PAGE_SIZE);
+    memset(buffer.pointer() + nread, 0, PAGE_SIZE - nread);
+    return add_to_page_cache(page_index, buffer.pointer(), generation);
+}
+
+RetainPtr<PhysicalPage> Inode::cached_page_if_present(unsigned page_index) const
+{
+    InterruptDisabler disabler;
+    auto it = m_page_cache.find(page_index);
+    if (it == m_page_cache.end())
+        return nullptr;
+    return (*it).value;
+}
+
+RetainPtr<PhysicalPage> Inode::add_to_page_cache(unsigned page_index, const byte* data, unsigned generation) const
+{
+    if (s_page_cache_page_count >= page_cache_page_limit())
+        evict_page_cache_pages(32);
+
+    InterruptDisabler disabler;
+    // Someone may have populated this page while we were blocked on I/O.
+    auto it = m_page_cache.find(page_index);
+    if (it != m_page_cache.end())
+        return (*it).value;
+
+    auto page = MM.allocate_physical_page(MemoryManager::ShouldZeroFill::No);
+    if (!page)
+        return nullptr;
+    memcpy(MM.physmap(*page), data, PAGE_SIZE);
+    // If the contents changed while we were reading, hand out the page but don't cache it.
+    if (generation == m_page_cache_generation) {
+        m_page_cache.set(page_index, page.copy_ref());
+        ++s_page_cache_page_count;
+    }
+    return page;
+}
+
+RetainPtr<PhysicalPage> Inode::pinned_page(unsigned page_index) const
+{
+    ASSERT(m_page_cache_pinned);
+    InterruptDisabler disabler;
+    auto it = m_page_cache.find(page_index);
+    if (it != m_page_cache.end())
+        return (*it).value;
+    auto page = MM.allocate_physical_page(MemoryManager::ShouldZeroFill::Yes);
+    if (!page)
+        return nullptr;
+    m_page_cache.set(page_index, page.copy_ref());
+    return page;
+}
+
+void Inode::remove_pinned_pages(unsigned first_page_index)
+{
+    ASSERT(m_page_cache_pinned);
+    InterruptDisabler disabler;
+    Vector<unsigned> pages_to_remove;
+    for (auto& it : m_page_cache) {
+        if (it.key >= first_page_index)
+            pages_to_remove.append(it.key);
+    }
+    for (auto page_index : pages_to_remove)
+        m_page_cache.remove(page_index);
+}
+
+// Read-ahead starts at this many pages once a descriptor reads sequentially, and doubles up to the max.
+static const unsigned min_read_ahead_pages = 4;
+static const unsigned max_read_ahead_pages = 32;
+
+void Inode::update_read_ahead(FileDescriptor& descriptor, off_t offset, size_t count) const
+{
+    auto& state = descriptor.read_ahead_state();
+    bool is_sequential = offset == state.next_offset;
+    state.next_offset = offset + count;
+    if (!is_sequential) {
+        state.window = 0;
+        state.end_page = 0;
+        return;
+    }
+    state.window = state.window ? min(state.window * 2, max_read_ahead_pages) : min_read_ahead_pages;
+
+    unsigned first_page_index = offset / PAGE_SIZE;
+    unsigned last_page_index = (offset + count - 1) / PAGE_SIZE;
+    // Only go back to the disk once the reader gets within half a window of what we've already fetched.
+    if (state.end_page > last_page_index + state.window / 2)
+        return;
+    unsigned start = max(state.end_page, first_page_index);
+    unsigned end = last_page_index + 1 + state.window;
+    read_ahead(start, end - start);
+    state.end_page = end;
+}
+
+void Inode::read_ahead(unsigned first_page_index, unsigned page_count) const
+{
+    unsigned pages_in_file = ceil_div(size(), (size_t)PAGE_SIZE);
+    unsigned end_page_index = min(first_page_index + page_count, pages_in_file);
+
+    for (unsigned page_index = first_page_index; page_index < end_page_index;) {
+        // Find the next run of pages we don't have yet, and fetch it with one request.
+        unsigned generation;
+        unsigned run_length = 0;
+        {
+            InterruptDisabler disabler;
+            while (page_index < end_page_index && m_page_cache.contains(page_index))
+                ++page_index;
+            while (page_index + run_length < end_page_index && !m_page_cache.contains(page_index + run_length))
+                ++run_length;
+            generation = m_page_cache_generation;
+        }
+        if (!run_length)
+            return;
+
+        auto buffer = ByteBuffer::create_uninitialized(run_length * PAGE_SIZE);
+        ssize_t nread = read_pages_uncached(page_index, run_length, buffer.pointer());
+        if (nread <= 0)
+            return;
+        memset(buffer.pointer() + nread, 0, run_length * PAGE_SIZE - nread);
+        unsigned pages_read = ceil_div((size_t)nread, (size_t)PAGE_SIZE);
+        for (unsigned i = 0; i < pages_read; ++i) {
+            if (!add_to_page_cache(page_index + i, buffer.pointer() + i * PAGE_SIZE, generation))
+                return;
+        }
+        page_index += run_length;
+    }
+}
+
+ssize_t Inode::read_bytes_through_page_cache(off_t offset, ssize_t count, byte* buffer, FileDescriptor* descriptor) const
+{
+    ASSERT(offset >= 0);
+    if (offset >= (off_t)size())
+        return 0;
+    size_t remaining_count = min((off_t)count, (off_t)size() - offset);
+    ssize_t nread = 0;
+
+    if (descriptor && remaining_count)
+        update_read_ahead(*descriptor, offset, remaining_count);
+
+    while (remaining_count) {
+        unsigned page_index = offset / PAGE_SIZE;
+        size_t offset_in_page = offset % PAGE_SIZE;
+        auto page = cached_page(page_index);
+        if (!page)
+            return nread ? nread : -EIO;
+        size_t bytes_from_page = min((size_t)PAGE_SIZE - offset_in_page, remaining_count);
+        // The destination may be unpaged userspace memory, that's fine since we hold a reference to the page.
+        memcpy(buffer + nread, MM.physmap(*page) + offset_in_page, bytes_from_page);
+        offset += bytes_from_page;
+        nread += bytes_from_page;
+        remaining_count -= bytes_from_page;
+    }
+    return nread;
+}
+
+void Inode::uncache_pages(unsigned first_page_index, unsigned last_page_index)
+{
+    InterruptDisabler disabler;
+    ++m_page_cache_generation;
+    if (m_page_cache_pinned || m_page_cache.is_empty())
+        return;
+    Vector<unsigned> pages_to_remove;
+    for (auto& it : m_page_cache) {
+        if (it.key >= first_page_index && it.key <= last_page_index)
+            pages_to_remove.append(it.key);
+    }
+    for (auto page_index : pages_to_remove)
+        m_page_cache.remove(page_index);
+    s_page_cache_page_count -= pages_to_remove.size();
+}
+
+unsigned Inode::evict_page_cache_pages(unsigned count)
+{
+    InterruptDisabler disabler;
+    unsigned evicted = 0;
+    for (auto* inode : all_inodes()) {
+        if (inode->m_page_cache_pinned)
+            continue;
+        Vector<unsigned> pages_to_remove;
+        for (auto& it : inode->m_page_cache) {
+            // Pages that are mapped into some VMObject stay put, evicting them wouldn't free anything.
+            if (it.value->retain_count() == 1)
+                pages_to_remove.append(it.key);
+            if (evicted + pages_to_remove.size() >= count)
+                break;
+        }
+        for (auto page_index : pages_to_remove)
+            inode->m_page_cache.remove(page_index);
+        s_page_cache_page_count -= pages_to_remove.size();
+        evicted += pages_to_remove.size();
+        if (evicted >= count)
+            break;
+    }
+    return evicted;
+}
+
 bool Inode::bind_socket(LocalSocket& socket)
 {
     ASSERT(!m_socket);
@@ -22,6 +22,7 @@ static const dword mepoch = 476763780;
 class Inode;
 class FileDescriptor;
 class LocalSocket;
+class PhysicalPage;
 class VMObject;
 
 class FS : public Retainable<FS> {
@@ -32,18 +33,30 @@ public:
     unsigned fsid() const { return m_fsid; }
     static FS* from_fsid(dword);
     static void sync();
+    // Asks every file system to let go of inodes it's only keeping around in case they're needed again.
+    static void release_unused_inodes_everywhere();
 
     virtual bool initialize() = 0;
     virtual const char* class_name() const = 0;
     virtual InodeIdentifier root_inode() const = 0;
 
     bool is_readonly() const { return m_readonly; }
+    virtual bool is_disk_backed() const { return false; }
+
+    // Directories whose contents only change through VFS operations can have their lookups cached by the VFS.
+    // Synthetic filesystems that come up with entries on the fly must leave this off.
+    virtual bool supports_lookup_caching() const { return false; }
 
     virtual unsigned total_block_count() const { return 0; }
     virtual unsigned free_block_count() const { return 0; }
     virtual unsigned total_inode_count() const { return 0; }
     virtual unsigned free_inode_count() const { return 0; }
 
+    virtual void release_unused_inodes() { }
+
+    // Writes out whatever the file system keeps changed in memory on its own, like allocation state. Called by sync().
+    virtual void flush_writes() { }
+
     struct DirectoryEntry {
         DirectoryEntry(const char* name, InodeIdentifier, byte file_type);
         DirectoryEntry(const char* name, size_t name_length, InodeIdentifier, byte file_type);
@@ -93,7 +106,7 @@ public:
     ByteBuffer read_entire(FileDescriptor* = nullptr) const;
 
     virtual ssize_t read_bytes(off_t, ssize_t, byte* buffer, FileDescriptor*) const = 0;
-    virtual bool traverse_as_directory(Function<bool(const FS::DirectoryEntry&)>) const = 0;
+    virtual bool traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)>) const = 0;
     virtual InodeIdentifier lookup(const String& name) = 0;
     virtual String reverse_lookup(InodeIdentifier) = 0;
     virtual ssize_t write_bytes(off_t, ssize_t, const byte* data, FileDescriptor*) = 0;
@@ -104,6 +117,12 @@ public:
     virtual KResult chmod(mode_t) = 0;
     virtual KResult chown(uid_t, gid_t) = 0;
     virtual KResult truncate(int) { return KSuccess; }
+    // Allocates the blocks for a range up front, or with FALLOC_FL_PUNCH_HOLE frees them (fallocate.)
+    virtual KResult fallocate(int mode, off_t offset, off_t length);
+
+    // Data only writes back the contents, and whatever metadata it takes to find them (fdatasync.)
+    enum class SyncMode { Data, All };
+    virtual KResult fsync(SyncMode);
 
     LocalSocket* socket() { return m_socket.ptr(); }
     const LocalSocket* socket() const { return m_socket.ptr(); }
@@ -126,18 +145,53 @@ public:
     VMObject* vmo() { return m_vmo.ptr(); }
     const VMObject* vmo() const { return m_vmo.ptr(); }
 
+    // The page cache holds file contents in physical pages, shared by read_bytes() and file-backed VMObjects.
+    // Returns null if this inode doesn't support page caching (see read_pages_uncached()) or on I/O error.
+    RetainPtr<PhysicalPage> cached_page(unsigned page_index) const;
+    // Like cached_page(), but never goes to the disk. Null if the page isn't cached right now.
+    RetainPtr<PhysicalPage> cached_page_if_present(unsigned page_index) const;
+    // Brings a range of pages into the page cache, reading each run of missing pages with one request.
+    void read_ahead(unsigned first_page_index, unsigned page_count) const;
+    static unsigned page_cache_page_count();
+    // Drops up to count cached pages that nobody else is using. Returns how many were dropped.
+    static unsigned evict_page_cache_pages(unsigned count);
+
 protected:
     Inode(FS& fs, unsigned index);
     void set_metadata_dirty(bool b) { m_metadata_dirty = b; }
     void inode_contents_changed(off_t, ssize_t, const byte*);
     void inode_size_changed(size_t old_size, size_t new_size);
 
+    ssize_t read_bytes_through_page_cache(off_t, ssize_t, byte* buffer, FileDescriptor*) const;
+    virtual ssize_t read_pages_uncached(unsigned first_page_index, unsigned page_count, byte* buffer) const;
+
+public:
+    // Where each page of the file starts on the file system's disk, for swapping to it without going through
+    // the file system. Pages that aren't one contiguous run of blocks get 0. Empty if the file system can't tell.
+    virtual Vector<DiskOffset> page_offsets_on_disk() const { return { }; }
+
+protected:
+    void uncache_pages(unsigned first_page_index, unsigned last_page_index);
+
+    // A pinned page cache is where the file system keeps the contents, there's nothing behind it (TmpFS.)
+    // Its pages are never evicted or uncached, and a page that isn't there is a hole.
+    void set_page_cache_pinned() { m_page_cache_pinned = true; }
+    // Returns the page, putting a zeroed one in if it's a hole.
+    RetainPtr<PhysicalPage> pinned_page(unsigned page_index) const;
+    void remove_pinned_pages(unsigned first_page_index);
+
     mutable Lock m_lock;
 
 private:
+    RetainPtr<PhysicalPage> add_to_page_cache(unsigned page_index, const byte* data, unsigned generation) const;
+    void update_read_ahead(FileDescriptor&, off_t, size_t) const;
+
     FS& m_fs;
     unsigned m_index { 0 };
     WeakPtr<VMObject> m_vmo;
+    mutable HashMap<unsigned, RetainPtr<PhysicalPage>> m_page_cache;
+    unsigned m_page_cache_generation { 0 };
+    bool m_page_cache_pinned { false };
     RetainPtr<LocalSocket> m_socket;
     bool m_metadata_dirty { false };
 };
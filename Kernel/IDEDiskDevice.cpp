@@ -5,6 +5,7 @@
 #include "IO.h"
 #include "Scheduler.h"
 #include "PIC.h"
+#include "i386.h"
 #include <Kernel/Lock.h>
 
 //#define DISK_DEBUG
@@ -15,10 +16,31 @@
 #define IDE0_STATUS      0x1F7
 #define IDE0_COMMAND     0x1F7
 
+// Bus master register offsets, relative to BAR4 of the IDE controller.
+#define BM_COMMAND       0
+#define BM_STATUS        2
+#define BM_PRDT          4
+
+#define BM_COMMAND_START (1 << 0)
+#define BM_COMMAND_READ  (1 << 3)
+#define BM_STATUS_ERROR  (1 << 1)
+#define BM_STATUS_IRQ    (1 << 2)
+
 enum IDECommand : byte {
     IDENTIFY_DRIVE = 0xEC,
     READ_SECTORS = 0x21,
+    READ_SECTORS_EXT = 0x24,
     WRITE_SECTORS = 0x30,
+    WRITE_SECTORS_EXT = 0x34,
+    READ_MULTIPLE = 0xC4,
+    READ_MULTIPLE_EXT = 0x29,
+    WRITE_MULTIPLE = 0xC5,
+    WRITE_MULTIPLE_EXT = 0x39,
+    SET_MULTIPLE_MODE = 0xC6,
+    READ_DMA = 0xC8,
+    READ_DMA_EXT = 0x25,
+    WRITE_DMA = 0xCA,
+    WRITE_DMA_EXT = 0x35,
 };
 
 enum IDEStatus : byte {
@@ -101,6 +123,8 @@ bool IDEDiskDevice::wait_for_irq()
 void IDEDiskDevice::handle_irq()
 {
     byte status = IO::in8(0x1f7);
+    if (m_bus_master_base)
+        IO::out8(m_bus_master_base + BM_STATUS, IO::in8(m_bus_master_base + BM_STATUS) | BM_STATUS_IRQ);
     if (status & ERR) {
         print_ide_status(status);
         m_device_error = IO::in8(0x1f1);
@@ -155,14 +179,79 @@ void IDEDiskDevice::initialize()
     m_cylinders = wbufbase[1];
     m_heads = wbufbase[3];
     m_sectors_per_track = wbufbase[6];
+    m_total_sectors = m_cylinders * m_heads * m_sectors_per_track;
+
+    if (wbufbase[49] & (1 << 9)) {
+        m_addressing = Addressing::LBA28;
+        m_total_sectors = wbufbase[60] | ((dword)wbufbase[61] << 16);
+    }
+    if ((wbufbase[83] & (1 << 10)) && (wbufbase[86] & (1 << 10))) {
+        m_addressing = Addressing::LBA48;
+        // FIXME: Sector indices are 32-bit for now, so anything past 2TB is out of reach.
+        if (wbufbase[102] || wbufbase[103])
+            m_total_sectors = 0xffffffff;
+        else
+            m_total_sectors = wbufbase[100] | ((dword)wbufbase[101] << 16);
+    }
 
     kprintf(
-        "IDEDiskDevice: Master=\"%s\", C/H/Spt=%u/%u/%u\n",
+        "IDEDiskDevice: Master=\"%s\", C/H/Spt=%u/%u/%u, %s, %u sectors\n",
         bbuf.pointer() + 54,
         m_cylinders,
         m_heads,
-        m_sectors_per_track
+        m_sectors_per_track,
+        m_addressing == Addressing::LBA48 ? "LBA48" : m_addressing == Addressing::LBA28 ? "LBA28" : "CHS",
+        m_total_sectors
     );
+
+    initialize_multiple_mode(LSB(wbufbase[47]));
+    initialize_dma();
+}
+
+void IDEDiskDevice::initialize_multiple_mode(byte max_sectors_per_multiple)
+{
+    if (max_sectors_per_multiple <= 1)
+        return;
+
+    while (IO::in8(IDE0_STATUS) & BUSY);
+    m_interrupted = false;
+    IO::out8(0x1F2, max_sectors_per_multiple);
+    IO::out8(IDE0_COMMAND, SET_MULTIPLE_MODE);
+    wait_for_irq();
+    if (m_device_error) {
+        kprintf("IDEDiskDevice: SET MULTIPLE MODE %u rejected\n", max_sectors_per_multiple);
+        return;
+    }
+    m_sectors_per_multiple = max_sectors_per_multiple;
+    kprintf("IDEDiskDevice: %u sectors per READ/WRITE MULTIPLE\n", m_sectors_per_multiple);
+}
+
+void IDEDiskDevice::initialize_dma()
+{
+    static const PCI::ID piix3_ide_id = { 0x8086, 0x7010 };
+    static const PCI::ID piix4_ide_id = { 0x8086, 0x7111 };
+    PCI::enumerate_all([this] (const PCI::Address& address, PCI::ID id) {
+        if (id == piix3_ide_id || id == piix4_ide_id)
+            m_pci_address = address;
+    });
+    if (m_pci_address.is_null()) {
+        kprintf("IDEDiskDevice: No PIIX IDE controller found, using PIO\n");
+        return;
+    }
+
+    m_bus_master_base = PCI::get_BAR4(m_pci_address) & 0xfffc;
+    if (!m_bus_master_base) {
+        kprintf("IDEDiskDevice: IDE controller has no bus master BAR, using PIO\n");
+        return;
+    }
+    PCI::enable_bus_mastering(m_pci_address);
+
+    // Kernel memory below 4MB is identity mapped, so these addresses are physical.
+    // A PRD region may not straddle a 64KB boundary, so the buffer is described one page per entry.
+    m_prdt = (PhysicalRegionDescriptor*)kmalloc_aligned(sizeof(PhysicalRegionDescriptor) * (dma_buffer_size / PAGE_SIZE), 64);
+    m_dma_buffer = (byte*)kmalloc_page_aligned(dma_buffer_size);
+
+    kprintf("IDEDiskDevice: Using bus master DMA, I/O base %w\n", m_bus_master_base);
 }
 
 IDEDiskDevice::CHS IDEDiskDevice::lba_to_chs(dword lba) const
@@ -174,63 +263,246 @@ IDEDiskDevice::CHS IDEDiskDevice::lba_to_chs(dword lba) const
     return chs;
 }
 
-bool IDEDiskDevice::read_sectors(dword start_sector, word count, byte* outbuf)
+dword IDEDiskDevice::max_sectors_per_command() const
+{
+    if (m_bus_master_base)
+        return dma_buffer_size / 512;
+    if (m_addressing == Addressing::LBA48)
+        return 65535;
+    return 256;
+}
+
+void IDEDiskDevice::program_address(dword start_sector, dword count)
+{
+    while (IO::in8(IDE0_STATUS) & BUSY);
+
+#ifdef DISK_DEBUG
+    kprintf("IDEDiskDevice: Transferring %u sector(s) @ LBA %u\n", count, start_sector);
+#endif
+
+    IO::out8(0x3F6, 0x08);
+
+    if (m_addressing == Addressing::LBA48) {
+        // The high-order bytes go in first; each register is a two-deep FIFO.
+        IO::out8(0x1F6, 0x40); /* 0x50 for 2nd device */
+        IO::out8(0x1F2, MSB(count));
+        IO::out8(0x1F3, (start_sector >> 24) & 0xff);
+        IO::out8(0x1F4, 0);
+        IO::out8(0x1F5, 0);
+        IO::out8(0x1F2, LSB(count));
+        IO::out8(0x1F3, start_sector & 0xff);
+        IO::out8(0x1F4, (start_sector >> 8) & 0xff);
+        IO::out8(0x1F5, (start_sector >> 16) & 0xff);
+        return;
+    }
+
+    IO::out8(0x1F2, count == 256 ? 0 : LSB(count));
+
+    if (m_addressing == Addressing::LBA28) {
+        IO::out8(0x1F3, start_sector & 0xff);
+        IO::out8(0x1F4, (start_sector >> 8) & 0xff);
+        IO::out8(0x1F5, (start_sector >> 16) & 0xff);
+        IO::out8(0x1F6, 0xE0 | ((start_sector >> 24) & 0x0f)); /* 0xF0 for 2nd device */
+        return;
+    }
+
+    auto chs = lba_to_chs(start_sector);
+    IO::out8(0x1F3, chs.sector);
+    IO::out8(0x1F4, LSB(chs.cylinder));
+    IO::out8(0x1F5, MSB(chs.cylinder));
+    IO::out8(0x1F6, 0xA0 | chs.head); /* 0xB0 for 2nd device */
+}
+
+bool IDEDiskDevice::read_blocks(unsigned index, unsigned count, byte* out) const
+{
+    return const_cast<IDEDiskDevice&>(*this).read_sectors(index, count, out);
+}
+
+bool IDEDiskDevice::write_blocks(unsigned index, unsigned count, const byte* data)
+{
+    return write_sectors(index, count, data);
+}
+
+bool IDEDiskDevice::read_sectors(dword start_sector, dword count, byte* outbuf)
 {
     LOCKER(m_lock);
+    dword max_sectors = max_sectors_per_command();
+    while (count) {
+        dword sectors = min(count, max_sectors);
+        bool success = m_bus_master_base
+            ? read_sectors_with_dma(start_sector, sectors, outbuf)
+            : read_sectors_with_pio(start_sector, sectors, outbuf);
+        if (!success)
+            return false;
+        outbuf += sectors * 512;
+        start_sector += sectors;
+        count -= sectors;
+    }
+    return true;
+}
+
+bool IDEDiskDevice::write_sectors(dword start_sector, dword count, const byte* data)
+{
+    LOCKER(m_lock);
+    dword max_sectors = max_sectors_per_command();
+    while (count) {
+        dword sectors = min(count, max_sectors);
+        bool success = m_bus_master_base
+            ? write_sectors_with_dma(start_sector, sectors, data)
+            : write_sectors_with_pio(start_sector, sectors, data);
+        if (!success)
+            return false;
+        data += sectors * 512;
+        start_sector += sectors;
+        count -= sectors;
+    }
+    return true;
+}
+
+void IDEDiskDevice::prepare_dma(dword count, bool is_read)
+{
+    dword remaining = count * 512;
+    for (unsigned i = 0; i < dma_buffer_size / PAGE_SIZE; ++i) {
+        auto& prd = m_prdt[i];
+        prd.offset = (dword)(m_dma_buffer + i * PAGE_SIZE);
+        prd.size = min(remaining, (dword)PAGE_SIZE);
+        remaining -= prd.size;
+        prd.end_of_table = remaining ? 0 : 0x8000;
+        if (!remaining)
+            break;
+    }
+    IO::out32(m_bus_master_base + BM_PRDT, (dword)m_prdt);
+    IO::out8(m_bus_master_base + BM_COMMAND, is_read ? BM_COMMAND_READ : 0);
+    IO::out8(m_bus_master_base + BM_STATUS, IO::in8(m_bus_master_base + BM_STATUS) | BM_STATUS_ERROR | BM_STATUS_IRQ);
+}
+
+bool IDEDiskDevice::finish_dma()
+{
+    IO::out8(m_bus_master_base + BM_COMMAND, 0);
+    byte bm_status = IO::in8(m_bus_master_base + BM_STATUS);
+    if (m_device_error || (bm_status & BM_STATUS_ERROR)) {
+        kprintf("IDEDiskDevice: DMA transfer failed, bus master status %b\n", bm_status);
+        return false;
+    }
+    return true;
+}
+
+bool IDEDiskDevice::read_sectors_with_dma(dword start_sector, dword count, byte* outbuf)
+{
 #ifdef DISK_DEBUG
-    dbgprintf("%s: Disk::read_sectors request (%u sector(s) @ %u)\n",
+    dbgprintf("%s: Disk::read_sectors_with_dma request (%u sector(s) @ %u)\n",
             current->process().name().characters(),
             count,
             start_sector);
 #endif
     disable_irq();
+    prepare_dma(count, true);
 
-    auto chs = lba_to_chs(start_sector);
+    program_address(start_sector, count);
+    while (!(IO::in8(IDE0_STATUS) & DRDY));
 
-    while (IO::in8(IDE0_STATUS) & BUSY);
+    IO::out8(IDE0_COMMAND, m_addressing == Addressing::LBA48 ? READ_DMA_EXT : READ_DMA);
+    m_interrupted = false;
+    IO::out8(m_bus_master_base + BM_COMMAND, BM_COMMAND_READ | BM_COMMAND_START);
+    enable_irq();
+    wait_for_irq();
+
+    if (!finish_dma())
+        return false;
 
+    memcpy(outbuf, m_dma_buffer, count * 512);
+    return true;
+}
+
+bool IDEDiskDevice::write_sectors_with_dma(dword start_sector, dword count, const byte* data)
+{
 #ifdef DISK_DEBUG
-    kprintf("IDEDiskDevice: Reading %u sector(s) @ LBA %u (%u/%u/%u)\n", count, start_sector, chs.cylinder, chs.head, chs.sector);
+    dbgprintf("%s(%u): IDEDiskDevice::write_sectors_with_dma request (%u sector(s) @ %u)\n",
+            current->process().name().characters(),
+            current->pid(),
+            count,
+            start_sector);
 #endif
+    memcpy(m_dma_buffer, data, count * 512);
+    disable_irq();
+    prepare_dma(count, false);
 
-    IO::out8(0x1F2, count == 256 ? 0 : LSB(count));
-    IO::out8(0x1F3, chs.sector);
-    IO::out8(0x1F4, LSB(chs.cylinder));
-    IO::out8(0x1F5, MSB(chs.cylinder));
+    program_address(start_sector, count);
+    while (!(IO::in8(IDE0_STATUS) & DRDY));
 
-    IO::out8(0x1F6, 0xA0 | chs.head); /* 0xB0 for 2nd device */
+    IO::out8(IDE0_COMMAND, m_addressing == Addressing::LBA48 ? WRITE_DMA_EXT : WRITE_DMA);
+    m_interrupted = false;
+    IO::out8(m_bus_master_base + BM_COMMAND, BM_COMMAND_START);
+    enable_irq();
+    wait_for_irq();
 
-    IO::out8(0x3F6, 0x08);
+    return finish_dma();
+}
+
+byte IDEDiskDevice::pio_read_command() const
+{
+    bool lba48 = m_addressing == Addressing::LBA48;
+    if (m_sectors_per_multiple > 1)
+        return lba48 ? READ_MULTIPLE_EXT : READ_MULTIPLE;
+    return lba48 ? READ_SECTORS_EXT : READ_SECTORS;
+}
+
+byte IDEDiskDevice::pio_write_command() const
+{
+    bool lba48 = m_addressing == Addressing::LBA48;
+    if (m_sectors_per_multiple > 1)
+        return lba48 ? WRITE_MULTIPLE_EXT : WRITE_MULTIPLE;
+    return lba48 ? WRITE_SECTORS_EXT : WRITE_SECTORS;
+}
+
+bool IDEDiskDevice::read_sectors_with_pio(dword start_sector, dword count, byte* outbuf)
+{
+#ifdef DISK_DEBUG
+    dbgprintf("%s: Disk::read_sectors_with_pio request (%u sector(s) @ %u)\n",
+            current->process().name().characters(),
+            count,
+            start_sector);
+#endif
+    disable_irq();
+
+    program_address(start_sector, count);
     while (!(IO::in8(IDE0_STATUS) & DRDY));
 
-    IO::out8(IDE0_COMMAND, READ_SECTORS);
     m_interrupted = false;
+    IO::out8(IDE0_COMMAND, pio_read_command());
     enable_irq();
-    wait_for_irq();
 
-    if (m_device_error)
-        return false;
+    // The drive raises one interrupt per DRQ block, which is m_sectors_per_multiple sectors.
+    while (count) {
+        wait_for_irq();
+        m_interrupted = false;
 
-    byte status = IO::in8(0x1f7);
-    if (status & DRQ) {
+        if (m_device_error)
+            return false;
+
+        dword sectors = min(count, (dword)m_sectors_per_multiple);
+        byte status = IO::in8(0x1f7);
+        if (!(status & DRQ))
+            return false;
 #ifdef DISK_DEBUG
-        kprintf("Retrieving %u bytes (status=%b), outbuf=%p...\n", count * 512, status, outbuf);
+        kprintf("Retrieving %u bytes (status=%b), outbuf=%p...\n", sectors * 512, status, outbuf);
 #endif
-        for (dword i = 0; i < (count * 512); i += 2) {
+        for (dword i = 0; i < (sectors * 512); i += 2) {
             word w = IO::in16(IDE0_DATA);
             outbuf[i] = LSB(w);
             outbuf[i+1] = MSB(w);
         }
+        outbuf += sectors * 512;
+        count -= sectors;
     }
 
     return true;
 }
 
-bool IDEDiskDevice::write_sectors(dword start_sector, word count, const byte* data)
+bool IDEDiskDevice::write_sectors_with_pio(dword start_sector, dword count, const byte* data)
 {
-    LOCKER(m_lock);
 #ifdef DISK_DEBUG
-    dbgprintf("%s(%u): IDEDiskDevice::write_sectors request (%u sector(s) @ %u)\n",
+    dbgprintf("%s(%u): IDEDiskDevice::write_sectors_with_pio request (%u sector(s) @ %u)\n",
             current->process().name().characters(),
             current->pid(),
             count,
@@ -238,37 +510,29 @@ bool IDEDiskDevice::write_sectors(dword start_sector, word count, const byte* da
 #endif
     disable_irq();
 
-    auto chs = lba_to_chs(start_sector);
+    program_address(start_sector, count);
 
-    while (IO::in8(IDE0_STATUS) & BUSY);
+    IO::out8(IDE0_COMMAND, pio_write_command());
 
-    //dbgprintf("IDEDiskDevice: Writing %u sector(s) @ LBA %u (%u/%u/%u)\n", count, start_sector, chs.cylinder, chs.head, chs.sector);
+    // The first block is requested without an interrupt; every block after that, and completion, raise one.
+    while (count) {
+        while (!(IO::in8(IDE0_STATUS) & DRQ));
 
-    IO::out8(0x1F2, count == 256 ? 0 : LSB(count));
-    IO::out8(0x1F3, chs.sector);
-    IO::out8(0x1F4, LSB(chs.cylinder));
-    IO::out8(0x1F5, MSB(chs.cylinder));
-
-    IO::out8(0x1F6, 0xA0 | chs.head); /* 0xB0 for 2nd device */
-
-    IO::out8(0x3F6, 0x08);
-
-    IO::out8(IDE0_COMMAND, WRITE_SECTORS);
-
-    while (!(IO::in8(IDE0_STATUS) & DRQ));
-
-    byte status = IO::in8(0x1f7);
-    if (status & DRQ) {
-        //dbgprintf("Sending %u bytes (status=%b), data=%p...\n", count * 512, status, data);
+        dword sectors = min(count, (dword)m_sectors_per_multiple);
+        //dbgprintf("Sending %u bytes, data=%p...\n", sectors * 512, data);
         auto* data_as_words = (const word*)data;
-        for (dword i = 0; i < (count * 512) / 2; ++i) {
+        m_interrupted = false;
+        for (dword i = 0; i < (sectors * 512) / 2; ++i) {
             IO::out16(IDE0_DATA, data_as_words[i]);
         }
-    }
+        enable_irq();
+        wait_for_irq();
 
-    m_interrupted = false;
-    enable_irq();
-    wait_for_irq();
+        if (m_device_error)
+            return false;
+        data += sectors * 512;
+        count -= sectors;
+    }
 
-    return !m_device_error;
+    return true;
 }
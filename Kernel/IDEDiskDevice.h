@@ -3,6 +3,7 @@
 #include <Kernel/Lock.h>
 #include <AK/RetainPtr.h>
 #include <Kernel/DiskDevice.h>
+#include <Kernel/PCI.h>
 #include "IRQHandler.h"
 
 class IDEDiskDevice final : public IRQHandler, public DiskDevice {
@@ -14,6 +15,8 @@ public:
     virtual unsigned block_size() const override;
     virtual bool read_block(unsigned index, byte*) const override;
     virtual bool write_block(unsigned index, const byte*) override;
+    virtual bool read_blocks(unsigned index, unsigned count, byte*) const override;
+    virtual bool write_blocks(unsigned index, unsigned count, const byte*) override;
 
 protected:
     IDEDiskDevice();
@@ -32,15 +35,49 @@ private:
     };
     CHS lba_to_chs(dword) const;
 
+    // Physical Region Descriptor, as consumed by the PIIX bus master.
+    struct PhysicalRegionDescriptor {
+        dword offset;
+        word size { 0 };
+        word end_of_table { 0 };
+    };
+
+    enum class Addressing {
+        CHS,
+        LBA28,
+        LBA48,
+    };
+
+    static const dword dma_buffer_size = 16384;
+
     void initialize();
+    void initialize_multiple_mode(byte max_sectors_per_multiple);
+    void initialize_dma();
     bool wait_for_irq();
-    bool read_sectors(dword start_sector, word count, byte* buffer);
-    bool write_sectors(dword start_sector, word count, const byte* data);
+    dword max_sectors_per_command() const;
+    void program_address(dword start_sector, dword count);
+    byte pio_read_command() const;
+    byte pio_write_command() const;
+    void prepare_dma(dword count, bool is_read);
+    bool finish_dma();
+    bool read_sectors(dword start_sector, dword count, byte* buffer);
+    bool write_sectors(dword start_sector, dword count, const byte* data);
+    bool read_sectors_with_dma(dword start_sector, dword count, byte* buffer);
+    bool write_sectors_with_dma(dword start_sector, dword count, const byte* data);
+    bool read_sectors_with_pio(dword start_sector, dword count, byte* buffer);
+    bool write_sectors_with_pio(dword start_sector, dword count, const byte* data);
 
     Lock m_lock;
+    PCI::Address m_pci_address;
+    word m_bus_master_base { 0 };
+    PhysicalRegionDescriptor* m_prdt { nullptr };
+    byte* m_dma_buffer { nullptr };
     word m_cylinders { 0 };
     word m_heads { 0 };
     word m_sectors_per_track { 0 };
+    dword m_total_sectors { 0 };
+    Addressing m_addressing { Addressing::CHS };
+    byte m_sectors_per_multiple { 1 };
     volatile bool m_interrupted { false };
     volatile byte m_device_error { 0 };
 
@@ -9,7 +9,9 @@
 #include <Kernel/TCP.h>
 #include <Kernel/UDP.h>
 #include <Kernel/ARP.h>
+#include <Kernel/ARPCache.h>
 #include <LibC/errno_numbers.h>
+#include <LibC/sys/ioctl_numbers.h>
 
 #define IPV4_SOCKET_DEBUG
 
@@ -47,9 +49,12 @@ IPv4Socket::~IPv4Socket()
 bool IPv4Socket::get_address(sockaddr* address, socklen_t* address_size)
 {
     // FIXME: Look into what fallback behavior we should have here.
-    if (*address_size != sizeof(sockaddr_in))
+    if (*address_size < sizeof(sockaddr_in))
         return false;
-    memcpy(address, &m_destination_address, sizeof(sockaddr_in));
+    auto& ia = *(sockaddr_in*)address;
+    ia.sin_family = AF_INET;
+    ia.sin_port = htons(m_destination_port);
+    memcpy(&ia.sin_addr, &m_destination_address, sizeof(IPv4Address));
     *address_size = sizeof(sockaddr_in);
     return true;
 }
@@ -61,13 +66,33 @@ KResult IPv4Socket::bind(const sockaddr* address, socklen_t address_size)
         return KResult(-EINVAL);
     if (address->sa_family != AF_INET)
         return KResult(-EINVAL);
+    if (m_bound || m_source_port)
+        return KResult(-EINVAL);
 
-    ASSERT_NOT_REACHED();
+    auto& ia = *(const sockaddr_in*)address;
+    // Binding to an address just checks that it's ours, as whatever is sent goes where the routes say.
+    IPv4Address local_address((const byte*)&ia.sin_addr.s_addr);
+    if (local_address != IPv4Address(0, 0, 0, 0) && !NetworkAdapter::from_ipv4_address(local_address))
+        return KResult(-EADDRNOTAVAIL);
+
+    word port = ntohs(ia.sin_port);
+    if (!port) {
+        int rc = allocate_source_port_if_needed();
+        if (rc < 0)
+            return KResult(rc);
+    } else {
+        auto result = protocol_bind(port);
+        if (result.is_error())
+            return result;
+        m_source_port = port;
+    }
+    m_source_address = local_address;
+    m_bound = true;
+    return KSuccess;
 }
 
-KResult IPv4Socket::connect(const sockaddr* address, socklen_t address_size)
+KResult IPv4Socket::connect(const sockaddr* address, socklen_t address_size, ShouldBlock should_block)
 {
-    ASSERT(!m_bound);
     if (address_size != sizeof(sockaddr_in))
         return KResult(-EINVAL);
     if (address->sa_family != AF_INET)
@@ -76,8 +101,128 @@ KResult IPv4Socket::connect(const sockaddr* address, socklen_t address_size)
     auto& ia = *(const sockaddr_in*)address;
     m_destination_address = IPv4Address((const byte*)&ia.sin_addr.s_addr);
     m_destination_port = ntohs(ia.sin_port);
+    auto route = route_to(m_destination_address);
+    if (!route.is_valid())
+        return KResult(-ENETUNREACH);
+    // Connected, it's known which address the peer sees us as from here on.
+    if (m_source_address.is_zero())
+        m_source_address = route.source;
+
+    return protocol_connect(should_block);
+}
+
+static bool get_ipv4_address(const sockaddr& address, IPv4Address& ipv4_address)
+{
+    if (address.sa_family != AF_INET)
+        return false;
+    ipv4_address = IPv4Address((const byte*)&((const sockaddr_in&)address).sin_addr.s_addr);
+    return true;
+}
+
+static void set_ipv4_address(sockaddr& address, const IPv4Address& ipv4_address)
+{
+    auto& ia = (sockaddr_in&)address;
+    memset(&ia, 0, sizeof(sockaddr_in));
+    ia.sin_family = AF_INET;
+    memcpy(&ia.sin_addr, &ipv4_address, sizeof(IPv4Address));
+}
+
+static NetworkAdapter* adapter_from_name(const char* name, size_t max_length)
+{
+    size_t length = 0;
+    while (length < max_length && name[length])
+        ++length;
+    return NetworkAdapter::from_name(String(name, length));
+}
+
+static int interface_ioctl(Process& process, unsigned request, ifreq* request_data)
+{
+    bool is_set = request == SIOCSIFADDR || request == SIOCSIFNETMASK || request == SIOCSIFMTU;
+    if (!process.validate_read_typed(request_data) || (!is_set && !process.validate_write_typed(request_data)))
+        return -EFAULT;
+    if (is_set && !process.is_superuser())
+        return -EPERM;
+    auto* adapter = adapter_from_name(request_data->ifr_name, IFNAMSIZ);
+    if (!adapter)
+        return -ENODEV;
+
+    IPv4Address address;
+    switch (request) {
+    case SIOCGIFADDR:
+        set_ipv4_address(request_data->ifr_addr, adapter->ipv4_address());
+        return 0;
+    case SIOCGIFNETMASK:
+        set_ipv4_address(request_data->ifr_netmask, adapter->ipv4_netmask());
+        return 0;
+    case SIOCGIFMTU:
+        request_data->ifr_mtu = adapter->mtu();
+        return 0;
+    case SIOCSIFADDR:
+        if (!get_ipv4_address(request_data->ifr_addr, address))
+            return -EAFNOSUPPORT;
+        adapter->set_ipv4_address(address);
+        if (adapter->needs_arp() && !address.is_zero())
+            ARPCache::the().announce(*adapter);
+        return 0;
+    case SIOCSIFNETMASK:
+        if (!get_ipv4_address(request_data->ifr_netmask, address))
+            return -EAFNOSUPPORT;
+        adapter->set_ipv4_netmask(address);
+        return 0;
+    case SIOCSIFMTU:
+        // Every IPv4 host has to be able to take 68 bytes in one go.
+        if (request_data->ifr_mtu < 68 || request_data->ifr_mtu > adapter->max_mtu())
+            return -EINVAL;
+        adapter->set_mtu(request_data->ifr_mtu);
+        return 0;
+    }
+    ASSERT_NOT_REACHED();
+}
 
-    return protocol_connect();
+static int route_ioctl(Process& process, unsigned request, const rtentry* entry)
+{
+    if (!process.validate_read_typed(entry))
+        return -EFAULT;
+    if (!process.is_superuser())
+        return -EPERM;
+
+    Route route;
+    if (!get_ipv4_address(entry->rt_dst, route.destination) || !get_ipv4_address(entry->rt_genmask, route.netmask))
+        return -EAFNOSUPPORT;
+    if (request == SIOCDELRT)
+        return remove_route(route.destination, route.netmask);
+
+    if (entry->rt_flags & RTF_GATEWAY) {
+        if (!get_ipv4_address(entry->rt_gateway, route.gateway))
+            return -EAFNOSUPPORT;
+    }
+    if (entry->rt_flags & RTF_MTU)
+        route.mtu = entry->rt_mtu;
+    if (entry->rt_dev) {
+        if (!process.validate_read_str(entry->rt_dev))
+            return -EFAULT;
+        route.adapter = adapter_from_name(entry->rt_dev, IFNAMSIZ);
+        if (!route.adapter)
+            return -ENODEV;
+    }
+    return add_route(route);
+}
+
+int IPv4Socket::ioctl(Process& process, unsigned request, unsigned arg)
+{
+    switch (request) {
+    case SIOCGIFADDR:
+    case SIOCSIFADDR:
+    case SIOCGIFNETMASK:
+    case SIOCSIFNETMASK:
+    case SIOCGIFMTU:
+    case SIOCSIFMTU:
+        return interface_ioctl(process, request, (ifreq*)arg);
+    case SIOCADDRT:
+    case SIOCDELRT:
+        return route_ioctl(process, request, (const rtentry*)arg);
+    }
+    return -ENOTTY;
 }
 
 void IPv4Socket::attach_fd(SocketRole)
@@ -97,14 +242,14 @@ bool IPv4Socket::can_read(SocketRole) const
     return m_can_read;
 }
 
-ssize_t IPv4Socket::read(SocketRole, byte* buffer, ssize_t size)
+ssize_t IPv4Socket::read(SocketRole, byte* buffer, ssize_t size, int flags)
 {
-    return recvfrom(buffer, size, 0, nullptr, 0);
+    return recvfrom(buffer, size, flags, nullptr, 0);
 }
 
-ssize_t IPv4Socket::write(SocketRole, const byte* data, ssize_t size)
+ssize_t IPv4Socket::write(SocketRole, const byte* data, ssize_t size, int flags)
 {
-    return sendto(data, size, 0, nullptr, 0);
+    return sendto(data, size, flags, nullptr, 0);
 }
 
 bool IPv4Socket::can_write(SocketRole) const
@@ -128,12 +273,6 @@ ssize_t IPv4Socket::sendto(const void* data, size_t data_length, int flags, cons
     (void)flags;
     if (addr && addr_length != sizeof(sockaddr_in))
         return -EINVAL;
-    // FIXME: Find the adapter some better way!
-    auto* adapter = NetworkAdapter::from_ipv4_address(IPv4Address(192, 168, 5, 2));
-    if (!adapter) {
-        // FIXME: Figure out which error code to return.
-        ASSERT_NOT_REACHED();
-    }
 
     if (addr) {
         if (addr->sa_family != AF_INET) {
@@ -153,85 +292,165 @@ ssize_t IPv4Socket::sendto(const void* data, size_t data_length, int flags, cons
     kprintf("sendto: destination=%s:%u\n", m_destination_address.to_string().characters(), m_destination_port);
 
     if (type() == SOCK_RAW) {
-        adapter->send_ipv4(MACAddress(), m_destination_address, (IPv4Protocol)protocol(), ByteBuffer::copy(data, data_length));
+        auto route = route_to(m_destination_address);
+        if (!route.is_valid())
+            return -ENETUNREACH;
+        if (sizeof(IPv4Packet) + data_length > (size_t)route.mtu)
+            return -EMSGSIZE;
+        route.adapter->send_ipv4(source_address_for(route), route.next_hop, m_destination_address, (IPv4Protocol)protocol(), PacketBuffer::copy(data, data_length));
         return data_length;
     }
 
-    return protocol_send(data, data_length);
+    return protocol_send(data, data_length, flags);
 }
 
-ssize_t IPv4Socket::recvfrom(void* buffer, size_t buffer_length, int flags, sockaddr* addr, socklen_t* addr_length)
+// Takes the next datagram off the receive queue, with the socket locked.
+RetainPtr<PacketBuffer> IPv4Socket::take_received_packet()
 {
-    (void)flags;
-    if (addr_length && *addr_length < sizeof(sockaddr_in))
-        return -EINVAL;
-
-#ifdef IPV4_SOCKET_DEBUG
-    kprintf("recvfrom: type=%d, source_port=%u\n", type(), source_port());
-#endif
+    if (m_receive_queue.is_empty())
+        return nullptr;
+    auto packet = m_receive_queue.take_first();
+    m_receive_queue_size -= packet->size();
+    --m_receive_queue_count;
+    m_can_read = !m_receive_queue.is_empty();
+    return move(packet);
+}
 
-    ByteBuffer packet_buffer;
+KResultOr<Retained<PacketBuffer>> IPv4Socket::dequeue_received_packet(bool should_block)
+{
     {
         LOCKER(lock());
-        if (!m_receive_queue.is_empty()) {
-            packet_buffer = m_receive_queue.take_first();
-            m_can_read = !m_receive_queue.is_empty();
+        if (auto packet = take_received_packet()) {
 #ifdef IPV4_SOCKET_DEBUG
-            kprintf("IPv4Socket(%p): recvfrom without blocking %d bytes, packets in queue: %d\n", this, packet_buffer.size(), m_receive_queue.size_slow());
+            kprintf("IPv4Socket(%p): recvfrom without blocking %d bytes, packets in queue: %d\n", this, packet->size(), m_receive_queue_count);
 #endif
+            return Retained<PacketBuffer>(*packet);
         }
     }
-    if (packet_buffer.is_null()) {
-        if (protocol_is_disconnected()) {
-            kprintf("IPv4Socket{%p} is protocol-disconnected, returning 0 in recvfrom!\n", this);
-            return 0;
-        }
+    if (protocol_is_disconnected()) {
+        kprintf("IPv4Socket{%p} is protocol-disconnected, returning 0 in recvfrom!\n", this);
+        return KResult(KSuccess);
+    }
+    if (!should_block)
+        return KResult(-EAGAIN);
 
-        current->set_blocked_socket(this);
-        load_receive_deadline();
-        current->block(Thread::BlockedReceive);
+    current->set_blocked_socket(this);
+    load_receive_deadline();
+    current->block(Thread::BlockedReceive);
 
-        LOCKER(lock());
-        if (!m_can_read) {
-            // Unblocked due to timeout.
-            return -EAGAIN;
-        }
-        ASSERT(m_can_read);
-        ASSERT(!m_receive_queue.is_empty());
-        packet_buffer = m_receive_queue.take_first();
-        m_can_read = !m_receive_queue.is_empty();
+    LOCKER(lock());
+    auto packet = take_received_packet();
+    if (!packet) {
+        // Unblocked due to timeout.
+        return KResult(-EAGAIN);
+    }
 #ifdef IPV4_SOCKET_DEBUG
-        kprintf("IPv4Socket(%p): recvfrom with blocking %d bytes, packets in queue: %d\n", this, packet_buffer.size(), m_receive_queue.size_slow());
+    kprintf("IPv4Socket(%p): recvfrom with blocking %d bytes, packets in queue: %d\n", this, packet->size(), m_receive_queue_count);
 #endif
-    }
-    ASSERT(!packet_buffer.is_null());
-    auto& ipv4_packet = *(const IPv4Packet*)(packet_buffer.pointer());
+    return Retained<PacketBuffer>(*packet);
+}
+
+bool IPv4Socket::protocol_payload(const PacketBuffer& packet, const byte*& payload, size_t& payload_size, word& source_port) const
+{
+    auto& ipv4_packet = *(const IPv4Packet*)packet.data();
+    payload = (const byte*)ipv4_packet.payload();
+    payload_size = ipv4_packet.payload_size();
+    source_port = 0;
+    return true;
+}
+
+int IPv4Socket::copy_out_datagram(const PacketBuffer& packet, const iovec* iov, int iov_count, sockaddr* addr, socklen_t* addr_length, bool& truncated)
+{
+    const byte* payload;
+    size_t payload_size;
+    word source_port;
+    truncated = false;
+    if (!protocol_payload(packet, payload, payload_size, source_port))
+        return -EINVAL;
 
     if (addr) {
+        auto& ipv4_packet = *(const IPv4Packet*)packet.data();
         auto& ia = *(sockaddr_in*)addr;
-        memcpy(&ia.sin_addr, &m_destination_address, sizeof(IPv4Address));
+        memset(&ia, 0, sizeof(sockaddr_in));
         ia.sin_family = AF_INET;
+        ia.sin_port = htons(source_port);
+        memcpy(&ia.sin_addr, &ipv4_packet.source(), sizeof(IPv4Address));
         ASSERT(addr_length);
         *addr_length = sizeof(sockaddr_in);
     }
 
-    if (type() == SOCK_RAW) {
-        ASSERT(buffer_length >= ipv4_packet.payload_size());
-        memcpy(buffer, ipv4_packet.payload(), ipv4_packet.payload_size());
-        return ipv4_packet.payload_size();
+    size_t copied = 0;
+    for (int i = 0; i < iov_count && copied < payload_size; ++i) {
+        size_t chunk_size = min(iov[i].iov_len, payload_size - copied);
+        memcpy(iov[i].iov_base, payload + copied, chunk_size);
+        copied += chunk_size;
     }
+    // Whatever didn't fit is gone, as the next read gets the next datagram.
+    truncated = copied < payload_size;
+    return copied;
+}
+
+ssize_t IPv4Socket::recvfrom(void* buffer, size_t buffer_length, int flags, sockaddr* addr, socklen_t* addr_length)
+{
+    if (addr_length && *addr_length < sizeof(sockaddr_in))
+        return -EINVAL;
+
+#ifdef IPV4_SOCKET_DEBUG
+    kprintf("recvfrom: type=%d, source_port=%u\n", type(), source_port());
+#endif
 
-    return protocol_receive(packet_buffer, buffer, buffer_length, flags, addr, addr_length);
+    auto packet_or_error = dequeue_received_packet(!(flags & MSG_DONTWAIT));
+    if (packet_or_error.is_error())
+        return packet_or_error.error();
+    iovec iov { buffer, buffer_length };
+    bool truncated;
+    return copy_out_datagram(*packet_or_error.value(), &iov, 1, addr, addr_length, truncated);
 }
 
-void IPv4Socket::did_receive(ByteBuffer&& packet)
+int IPv4Socket::recvmmsg(SocketRole, mmsghdr* messages, int count, int flags)
+{
+    if (type() == SOCK_STREAM)
+        return -EOPNOTSUPP;
+    int received = 0;
+    while (received < count) {
+        auto& message = messages[received].msg_hdr;
+        if (message.msg_name && message.msg_namelen < sizeof(sockaddr_in))
+            return received ? received : -EINVAL;
+        // Only the first one is waited for, the rest are whatever came in with it.
+        auto packet_or_error = dequeue_received_packet(!received && !(flags & MSG_DONTWAIT));
+        if (packet_or_error.is_error())
+            return received ? received : (int)packet_or_error.error();
+        bool truncated;
+        int rc = copy_out_datagram(*packet_or_error.value(), message.msg_iov, message.msg_iovlen, (sockaddr*)message.msg_name, message.msg_name ? &message.msg_namelen : nullptr, truncated);
+        if (rc < 0)
+            return received ? received : rc;
+        message.msg_controllen = 0;
+        message.msg_flags = truncated ? MSG_TRUNC : 0;
+        messages[received].msg_len = rc;
+        ++received;
+    }
+    return received;
+}
+
+void IPv4Socket::did_receive(PacketBuffer& packet)
 {
     LOCKER(lock());
     auto packet_size = packet.size();
-    m_receive_queue.append(move(packet));
+    // One datagram always fits, however big it is, so a small buffer can still get anything at all.
+    if (m_receive_queue_count && m_receive_queue_size + packet_size > receive_buffer_size()) {
+        ++m_receive_drops;
+#ifdef IPV4_SOCKET_DEBUG
+        kprintf("IPv4Socket(%p): Receive buffer full, dropping %d bytes (%u dropped so far)\n", this, packet_size, m_receive_drops);
+#endif
+        return;
+    }
+    m_receive_queue.append(packet);
+    m_receive_queue_size += packet_size;
+    ++m_receive_queue_count;
     m_can_read = true;
     m_bytes_received += packet_size;
+    wait_queue().wake_all();
 #ifdef IPV4_SOCKET_DEBUG
-    kprintf("IPv4Socket(%p): did_receive %d bytes, total_received=%u, packets in queue: %d\n", this, packet_size, m_bytes_received, m_receive_queue.size_slow());
+    kprintf("IPv4Socket(%p): did_receive %d bytes, total_received=%u, packets in queue: %d\n", this, packet_size, m_bytes_received, m_receive_queue_count);
 #endif
 }
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <Kernel/Socket.h>
-#include <Kernel/DoubleBuffer.h>
 #include <Kernel/IPv4.h>
+#include <Kernel/IPv4SocketTable.h>
 #include <AK/HashMap.h>
 #include <Kernel/Lock.h>
+#include <Kernel/PacketBuffer.h>
+#include <Kernel/Routing.h>
 #include <AK/SinglyLinkedList.h>
 
 class IPv4SocketHandle;
@@ -21,49 +23,72 @@ public:
     static Lockable<HashTable<IPv4Socket*>>& all_sockets();
 
     virtual KResult bind(const sockaddr*, socklen_t) override;
-    virtual KResult connect(const sockaddr*, socklen_t) override;
+    virtual KResult connect(const sockaddr*, socklen_t, ShouldBlock) override;
     virtual bool get_address(sockaddr*, socklen_t*) override;
     virtual void attach_fd(SocketRole) override;
     virtual void detach_fd(SocketRole) override;
     virtual bool can_read(SocketRole) const override;
-    virtual ssize_t read(SocketRole, byte*, ssize_t) override;
-    virtual ssize_t write(SocketRole, const byte*, ssize_t) override;
+    virtual ssize_t read(SocketRole, byte*, ssize_t, int flags) override;
+    virtual ssize_t write(SocketRole, const byte*, ssize_t, int flags) override;
     virtual bool can_write(SocketRole) const override;
     virtual ssize_t sendto(const void*, size_t, int, const sockaddr*, socklen_t) override;
     virtual ssize_t recvfrom(void*, size_t, int flags, sockaddr*, socklen_t*) override;
-
-    void did_receive(ByteBuffer&&);
-
-    const IPv4Address& source_address() const;
+    virtual int recvmmsg(SocketRole, mmsghdr*, int count, int flags) override;
+    // Gets and sets how the adapters and routes are configured, which any AF_INET socket can do.
+    virtual int ioctl(Process&, unsigned request, unsigned arg) override;
+    virtual dword receive_drops() const override { return m_receive_drops; }
+
+    // |packet| starts with the IPv4 header. It's kept, not copied, so it mustn't change after this.
+    // It's dropped if the receive buffer is full.
+    void did_receive(PacketBuffer& packet);
+
+    const IPv4Address& source_address() const { return m_source_address; }
+    void set_source_address(const IPv4Address& address) { m_source_address = address; }
+    // What a packet sent by |route| goes out from: the address we're bound to, or else the route's.
+    IPv4Address source_address_for(const RoutingDecision& route) const { return m_source_address.is_zero() ? route.source : m_source_address; }
     word source_port() const { return m_source_port; }
     void set_source_port(word port) { m_source_port = port; }
 
     const IPv4Address& destination_address() const { return m_destination_address; }
     word destination_port() const { return m_destination_port; }
+    void set_destination_address(const IPv4Address& address) { m_destination_address = address; }
     void set_destination_port(word port) { m_destination_port = port; }
 
+    IPv4SocketTuple tuple() const { return { m_source_address, m_source_port, m_destination_address, m_destination_port }; }
+
 protected:
     IPv4Socket(int type, int protocol);
 
     int allocate_source_port_if_needed();
-
-    virtual int protocol_receive(const ByteBuffer&, void*, size_t, int, sockaddr*, socklen_t*) { return -ENOTIMPL; }
-    virtual int protocol_send(const void*, int) { return -ENOTIMPL; }
-    virtual KResult protocol_connect() { return KSuccess; }
+    int attached_fds() const { return m_attached_fds; }
+
+    // Finds what's in a received packet for whoever reads it, and which port it came from.
+    // By default, that's everything after the IPv4 header.
+    virtual bool protocol_payload(const PacketBuffer&, const byte*& payload, size_t& payload_size, word& source_port) const;
+    virtual int protocol_send(const void*, int, int flags) { (void)flags; return -ENOTIMPL; }
+    virtual KResult protocol_connect(ShouldBlock) { return KSuccess; }
+    // Claims |port| as this socket's own, or fails with EADDRINUSE.
+    virtual KResult protocol_bind(word) { return KSuccess; }
     virtual int protocol_allocate_source_port() { return 0; }
     virtual bool protocol_is_disconnected() const { return false; }
 
 private:
     virtual bool is_ipv4() const override { return true; }
 
+    KResultOr<Retained<PacketBuffer>> dequeue_received_packet(bool should_block);
+    RetainPtr<PacketBuffer> take_received_packet();
+    // Copies the payload of |packet| out to |iov|, cutting it short if it doesn't fit, and fills in who it's from.
+    int copy_out_datagram(const PacketBuffer& packet, const iovec*, int iov_count, sockaddr*, socklen_t*, bool& truncated);
+
     bool m_bound { false };
     int m_attached_fds { 0 };
+    IPv4Address m_source_address;
     IPv4Address m_destination_address;
 
-    DoubleBuffer m_for_client;
-    DoubleBuffer m_for_server;
-
-    SinglyLinkedList<ByteBuffer> m_receive_queue;
+    SinglyLinkedList<Retained<PacketBuffer>> m_receive_queue;
+    int m_receive_queue_size { 0 };
+    int m_receive_queue_count { 0 };
+    dword m_receive_drops { 0 };
 
     word m_source_port { 0 };
     word m_destination_port { 0 };
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <AK/HashMap.h>
+#include <AK/RetainPtr.h>
+#include <AK/Vector.h>
+#include <Kernel/IPv4.h>
+#include <Kernel/RandomDevice.h>
+#include <Kernel/i386.h>
+#include <LibC/errno_numbers.h>
+
+// Both ends of a connection.
+struct IPv4SocketTuple {
+    IPv4Address local_address;
+    word local_port { 0 };
+    IPv4Address peer_address;
+    word peer_port { 0 };
+
+    bool operator==(const IPv4SocketTuple& other) const
+    {
+        return local_port == other.local_port && peer_port == other.peer_port && local_address == other.local_address && peer_address == other.peer_address;
+    }
+};
+
+namespace AK {
+
+template<>
+struct Traits<IPv4SocketTuple> {
+    static unsigned hash(const IPv4SocketTuple& tuple)
+    {
+        unsigned ports = (dword)tuple.local_port << 16 | tuple.peer_port;
+        return pair_int_hash(ports, pair_int_hash(Traits<IPv4Address>::hash(tuple.local_address), Traits<IPv4Address>::hash(tuple.peer_address)));
+    }
+    static void dump(const IPv4SocketTuple& tuple)
+    {
+        kprintf("%s:%u <-> %s:%u", tuple.local_address.to_string().characters(), tuple.local_port, tuple.peer_address.to_string().characters(), tuple.peer_port);
+    }
+};
+
+}
+
+// The sockets of one protocol, by the connection they're on and by the port they have.
+// A packet goes to the socket connected to its sender if there is one, or else to whoever has the port, like a listener.
+// Every packet looks one up, so instead of a lock that can make the network task wait, the tables are only ever touched
+// with interrupts disabled. There's just the one CPU, and nothing in here takes long.
+template<typename SocketType>
+class IPv4SocketTable {
+public:
+    // Gets null for a socket that's already being destroyed, as it's still in here until its destructor takes it out.
+    RetainPtr<SocketType> find(const IPv4SocketTuple& tuple) const
+    {
+        InterruptDisabler disabler;
+        SocketType* socket = nullptr;
+        auto it = m_by_tuple.find(tuple);
+        if (it != m_by_tuple.end()) {
+            socket = (*it).value;
+        } else {
+            auto port_it = m_by_port.find(tuple.local_port);
+            if (port_it != m_by_port.end())
+                socket = (*port_it).value;
+        }
+        if (!socket || !socket->retain_count())
+            return nullptr;
+        return socket;
+    }
+
+    bool claim_port(word port, SocketType& socket)
+    {
+        InterruptDisabler disabler;
+        if (m_by_port.contains(port))
+            return false;
+        m_by_port.set(port, &socket);
+        return true;
+    }
+
+    // Returns the port, or -EADDRINUSE if they're all taken.
+    int claim_ephemeral_port(SocketType& socket)
+    {
+        static const word first_ephemeral_port = 32768;
+        static const word last_ephemeral_port = 60999;
+        static const word ephemeral_port_range_size = last_ephemeral_port - first_ephemeral_port;
+        word first_scan_port = first_ephemeral_port + (word)(RandomDevice::random_percentage() * ephemeral_port_range_size);
+
+        for (word port = first_scan_port;;) {
+            if (claim_port(port, socket))
+                return port;
+            ++port;
+            if (port > last_ephemeral_port)
+                port = first_ephemeral_port;
+            if (port == first_scan_port)
+                break;
+        }
+        return -EADDRINUSE;
+    }
+
+    void add_connection(const IPv4SocketTuple& tuple, SocketType& socket)
+    {
+        InterruptDisabler disabler;
+        m_by_tuple.set(tuple, &socket);
+    }
+
+    // Takes |socket| out under |port|, where it's in there as itself, and its connection.
+    // That's normally under |tuple|, but a datagram socket can have sent somewhere else since.
+    void remove(word port, const IPv4SocketTuple& tuple, SocketType& socket)
+    {
+        InterruptDisabler disabler;
+        auto port_it = m_by_port.find(port);
+        if (port_it != m_by_port.end() && (*port_it).value == &socket)
+            m_by_port.remove(port);
+        auto it = m_by_tuple.find(tuple);
+        if (it != m_by_tuple.end() && (*it).value == &socket) {
+            m_by_tuple.remove(tuple);
+            return;
+        }
+        for (auto& entry : m_by_tuple) {
+            if (entry.value == &socket) {
+                auto key = entry.key;
+                m_by_tuple.remove(key);
+                return;
+            }
+        }
+    }
+
+    // Every socket in here once, even if it has both a port and a connection.
+    Vector<RetainPtr<SocketType>> all() const
+    {
+        InterruptDisabler disabler;
+        Vector<RetainPtr<SocketType>> sockets;
+        for (auto& it : m_by_port) {
+            if (it.value->retain_count())
+                sockets.append(it.value);
+        }
+        for (auto& it : m_by_tuple) {
+            if (m_by_port.get(it.key.local_port) == it.value)
+                continue;
+            if (it.value->retain_count())
+                sockets.append(it.value);
+        }
+        return sockets;
+    }
+
+private:
+    HashMap<word, SocketType*> m_by_port;
+    HashMap<IPv4SocketTuple, SocketType*> m_by_tuple;
+};
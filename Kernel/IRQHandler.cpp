@@ -1,6 +1,7 @@
 #include "IRQHandler.h"
 #include "i386.h"
 #include "PIC.h"
+#include <Kernel/APIC.h>
 
 IRQHandler::IRQHandler(byte irq)
     : m_irq_number(irq)
@@ -10,16 +11,50 @@ IRQHandler::IRQHandler(byte irq)
 
 IRQHandler::~IRQHandler()
 {
+    if (m_msi_vector) {
+        PCI::disable_message_signaled_interrupts(m_pci_address);
+        unregister_msi_handler(m_msi_vector, *this);
+        return;
+    }
     unregister_irq_handler(m_irq_number, *this);
 }
 
 void IRQHandler::enable_irq()
 {
+    if (m_msi_vector) {
+        PCI::set_message_signaled_interrupts_masked(m_pci_address, false);
+        return;
+    }
     PIC::enable(m_irq_number);
 }
 
 void IRQHandler::disable_irq()
 {
+    if (m_msi_vector) {
+        PCI::set_message_signaled_interrupts_masked(m_pci_address, true);
+        return;
+    }
     PIC::disable(m_irq_number);
 }
 
+bool IRQHandler::use_message_signaled_interrupts(PCI::Address address)
+{
+    ASSERT(!m_msi_vector);
+    if (!APIC::is_enabled())
+        return false;
+    byte vector = register_msi_handler(*this);
+    if (!vector)
+        return false;
+    InterruptDisabler disabler;
+    if (!PCI::enable_message_signaled_interrupts(address, APIC::msi_address(), APIC::msi_data(vector))) {
+        unregister_msi_handler(vector, *this);
+        return false;
+    }
+    // Until the driver enables it, like the line it had.
+    PCI::set_message_signaled_interrupts_masked(address, true);
+    PIC::disable(m_irq_number);
+    unregister_irq_handler(m_irq_number, *this);
+    m_msi_vector = vector;
+    m_pci_address = address;
+    return true;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <AK/Types.h>
+#include <Kernel/PCI.h>
 
 class IRQHandler {
 public:
@@ -12,10 +13,16 @@ public:
     void enable_irq();
     void disable_irq();
 
+    // Moves a PCI device over from its (possibly shared) interrupt line to a vector of its own, delivered by the
+    // local APIC with no PIC to ask or acknowledge. Returns false and leaves things as they were if it can't.
+    bool use_message_signaled_interrupts(PCI::Address);
+    bool is_using_message_signaled_interrupts() const { return m_msi_vector; }
+
 protected:
     explicit IRQHandler(byte irq);
 
 private:
     byte m_irq_number { 0 };
+    byte m_msi_vector { 0 };
+    PCI::Address m_pci_address;
 };
-
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <AK/SPSCQueue.h>
+#include <Kernel/Process.h>
+
+// What keyboard and mouse interrupts leave for read(). Each event gets stamped with when it came in, on the
+// gettimeofday() clock, so a reader can tell how old it is and which motion goes together.
+// One read() hands over as many whole events as fit, so a reader can take everything pending in one go.
+template<typename Event, int Capacity>
+class InputEventQueue {
+public:
+    bool is_empty() const { return m_queue.is_empty(); }
+    int size() const { return m_queue.size(); }
+
+    // Interrupt handlers only. Returns false, and drops the event, if the reader has fallen that far behind.
+    bool enqueue(Event& event)
+    {
+        timeval now;
+        kgettimeofday(now);
+        event.timestamp = (qword)now.tv_sec * 1000000 + now.tv_usec;
+        return m_queue.try_enqueue(event);
+    }
+
+    ssize_t read(byte* buffer, ssize_t size)
+    {
+        ssize_t nread = 0;
+        // Don't return partial events.
+        while (size - nread >= (ssize_t)sizeof(Event)) {
+            Event event;
+            if (!m_queue.try_dequeue(event))
+                break;
+            memcpy(buffer + nread, &event, sizeof(Event));
+            nread += sizeof(Event);
+        }
+        return nread;
+    }
+
+private:
+    SPSCQueue<Event, Capacity> m_queue;
+};
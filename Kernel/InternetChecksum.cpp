@@ -0,0 +1,117 @@
+#include <Kernel/InternetChecksum.h>
+#include <Kernel/StdLib.h>
+
+static inline word fold_sum(qword sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+static inline word swap_bytes(word value)
+{
+    return value << 8 | value >> 8;
+}
+
+static inline qword sum_tail(const byte* data, size_t size)
+{
+    qword sum = 0;
+    for (; size >= 4; data += 4, size -= 4)
+        sum += *(const dword*)data;
+    if (size >= 2) {
+        sum += *(const word*)data;
+        data += 2;
+        size -= 2;
+    }
+    // A last odd byte is the first of a word padded with zero, the low one the way words are stored here.
+    if (size)
+        sum += *data;
+    return sum;
+}
+
+static qword sum_bytes(const byte* data, size_t size)
+{
+    qword sum = 0;
+    for (; size >= 32; data += 32, size -= 32) {
+        auto* d = (const dword*)data;
+        sum += d[0];
+        sum += d[1];
+        sum += d[2];
+        sum += d[3];
+        sum += d[4];
+        sum += d[5];
+        sum += d[6];
+        sum += d[7];
+    }
+    return sum + sum_tail(data, size);
+}
+
+static qword copy_and_sum_bytes(byte* destination, const byte* source, size_t size)
+{
+    qword sum = 0;
+    for (; size >= 16; source += 16, destination += 16, size -= 16) {
+        auto* s = (const dword*)source;
+        auto* d = (dword*)destination;
+        dword a = s[0];
+        dword b = s[1];
+        dword c = s[2];
+        dword e = s[3];
+        d[0] = a;
+        d[1] = b;
+        d[2] = c;
+        d[3] = e;
+        sum += a;
+        sum += b;
+        sum += c;
+        sum += e;
+    }
+    memcpy(destination, source, size);
+    return sum + sum_tail(source, size);
+}
+
+void InternetChecksum::add(const void* data, size_t size)
+{
+    word partial = fold_sum(sum_bytes((const byte*)data, size));
+    m_sum += m_odd ? swap_bytes(partial) : partial;
+    m_odd ^= size & 1;
+}
+
+void InternetChecksum::add_copy(void* destination, const void* source, size_t size)
+{
+    word partial = fold_sum(copy_and_sum_bytes((byte*)destination, (const byte*)source, size));
+    m_sum += m_odd ? swap_bytes(partial) : partial;
+    m_odd ^= size & 1;
+}
+
+void InternetChecksum::add_pseudo_header(const IPv4Address& source, const IPv4Address& destination, IPv4Protocol protocol, word segment_size)
+{
+    struct [[gnu::packed]] PseudoHeader {
+        IPv4Address source;
+        IPv4Address destination;
+        byte zero;
+        byte protocol;
+        NetworkOrdered<word> segment_size;
+    };
+    PseudoHeader pseudo_header { source, destination, 0, (byte)protocol, segment_size };
+    add(&pseudo_header, sizeof(pseudo_header));
+}
+
+word InternetChecksum::fold() const
+{
+    // Back from the way the words are stored to how they're sent.
+    return swap_bytes(fold_sum(m_sum));
+}
+
+NetworkOrdered<word> InternetChecksum::update(NetworkOrdered<word> checksum, NetworkOrdered<word> old_value, NetworkOrdered<word> new_value)
+{
+    // HC' = ~(~HC + ~m + m')
+    dword sum = (word)~(word)checksum + (dword)(word)~(word)old_value + (word)new_value;
+    return (word)~fold_sum(sum);
+}
+
+NetworkOrdered<word> internet_checksum(const void* data, size_t size)
+{
+    InternetChecksum checksum;
+    checksum.add(data, size);
+    return checksum.finish();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <AK/Types.h>
+#include <Kernel/IPv4.h>
+#include <Kernel/NetworkOrdered.h>
+
+// The ones' complement sum of 16 bit words that IPv4, ICMP, UDP and TCP checksum with (RFC 1071),
+// over as many pieces as a packet comes in. It's summed a dword at a time into 64 bits and only folded at the end.
+// Since the sum of byte swapped words is the byte swapped sum, the words are summed the way they're stored,
+// and nothing is swapped until then either.
+class InternetChecksum {
+public:
+    void add(const void*, size_t);
+    // Copies |size| bytes and sums them on the way, so they're only read the once.
+    void add_copy(void* destination, const void* source, size_t size);
+    // The pseudo header UDP and TCP checksums start with.
+    void add_pseudo_header(const IPv4Address& source, const IPv4Address& destination, IPv4Protocol, word segment_size);
+
+    // What goes in a checksum field. Comes out as 0 for data with the right checksum in it.
+    NetworkOrdered<word> finish() const { return (word)~fold(); }
+    // The sum itself, for a checksum field that hardware finishes summing.
+    NetworkOrdered<word> sum() const { return fold(); }
+
+    // The checksum after a 16 bit field it covers changes from |old_value| to |new_value|, without summing it all again (RFC 1624).
+    static NetworkOrdered<word> update(NetworkOrdered<word> checksum, NetworkOrdered<word> old_value, NetworkOrdered<word> new_value);
+
+private:
+    word fold() const;
+
+    qword m_sum { 0 };
+    // After an odd number of bytes, the next piece's words straddle the ones it was summed as.
+    bool m_odd { false };
+};
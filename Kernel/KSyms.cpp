@@ -8,66 +8,49 @@ dword ksym_highest_address;
 dword ksym_count;
 bool ksyms_ready;
 
-static byte parse_hex_digit(char nibble)
-{
-    if (nibble >= '0' && nibble <= '9')
-        return nibble - '0';
-    ASSERT(nibble >= 'a' && nibble <= 'f');
-    return 10 + (nibble - 'a');
-}
-
 const KSym* ksymbolicate(dword address)
 {
-    if (address < ksym_lowest_address || address > ksym_highest_address)
+    if (!ksyms_ready || address < ksym_lowest_address || address > ksym_highest_address)
         return nullptr;
-    for (unsigned i = 0; i < ksym_count; ++i) {
-        if (address < s_ksyms[i + 1].address)
-            return &s_ksyms[i];
+    // The last one starting at or before the address.
+    dword low = 0;
+    dword high = ksym_count;
+    while (low < high) {
+        dword middle = (low + high) / 2;
+        if (s_ksyms[middle].address <= address)
+            low = middle + 1;
+        else
+            high = middle;
     }
-    return nullptr;
+    return low ? &s_ksyms[low - 1] : nullptr;
 }
 
 static void load_ksyms_from_data(const ByteBuffer& buffer)
 {
-    auto* bufptr = (const char*)buffer.pointer();
-    auto* start_of_name = bufptr;
-    dword address = 0;
-
-    for (unsigned i = 0; i < 8; ++i)
-        ksym_count = (ksym_count << 4) | parse_hex_digit(*(bufptr++));
-    s_ksyms = static_cast<KSym*>(kmalloc_eternal(sizeof(KSym) * ksym_count));
-    ++bufptr; // skip newline
+    // See mkmap.sh for the layout. The entries are already sorted, and shaped like KSyms except that they have
+    // offsets into the names instead of pointers, so the whole file is kept and only those need fixing up.
+    static_assert(sizeof(KSym) == 2 * sizeof(dword), "KSym doesn't match the entries in kernel.map");
+    ASSERT(buffer.size() >= (ssize_t)sizeof(dword));
 
     kprintf("Loading ksyms...");
 
-    unsigned current_ksym_index = 0;
-
-    while (bufptr < buffer.end_pointer()) {
-        for (unsigned i = 0; i < 8; ++i)
-            address = (address << 4) | parse_hex_digit(*(bufptr++));
-        bufptr += 3;
-        start_of_name = bufptr;
-        while (*(++bufptr)) {
-            if (*bufptr == '\n') {
-                break;
-            }
-        }
-        auto& ksym = s_ksyms[current_ksym_index];
-        ksym.address = address;
-        char* name = static_cast<char*>(kmalloc_eternal((bufptr - start_of_name) + 1));
-        memcpy(name, start_of_name, bufptr - start_of_name);
-        name[bufptr - start_of_name] = '\0';
-        ksym.name = name;
-
-        if (ksym.address < ksym_lowest_address)
-            ksym_lowest_address = ksym.address;
-        if (ksym.address > ksym_highest_address)
-            ksym_highest_address = ksym.address;
+    auto* data = static_cast<byte*>(kmalloc_eternal(buffer.size()));
+    memcpy(data, buffer.pointer(), buffer.size());
+    ksym_count = *reinterpret_cast<const dword*>(data);
+    s_ksyms = reinterpret_cast<KSym*>(data + sizeof(dword));
+    auto* names = reinterpret_cast<const char*>(s_ksyms + ksym_count);
+    ASSERT((const byte*)names <= data + buffer.size());
 
-        ++bufptr;
-        ++current_ksym_index;
+    for (dword i = 0; i < ksym_count; ++i)
+        s_ksyms[i].name = names + reinterpret_cast<dword>(s_ksyms[i].name);
+    if (ksym_count) {
+        ksym_lowest_address = s_ksyms[0].address;
+        ksym_highest_address = s_ksyms[ksym_count - 1].address;
     }
+
     kprintf("ok\n");
+    // Backtraces can be taken while this is still going, don't let them see a half made table.
+    asm volatile("" ::: "memory");
     ksyms_ready = true;
 }
 
@@ -77,10 +60,9 @@ static void load_ksyms_from_data(const ByteBuffer& buffer)
         //hang();
         return;
     }
-    if (use_ksyms && !ksyms_ready) {
-        hang();
-        return;
-    }
+    // They're loaded alongside the rest of booting, until then there are only the bare addresses.
+    if (use_ksyms && !ksyms_ready)
+        use_ksyms = false;
     struct RecognizedSymbol {
         dword address;
         const KSym* ksym;
@@ -124,6 +124,8 @@ struct KeyEvent {
     KeyCode key { Key_Invalid };
     byte character { 0 };
     byte flags { 0 };
+    // When it came from the keyboard, in microseconds on the gettimeofday() clock.
+    qword timestamp { 0 };
     bool alt() const { return flags & Mod_Alt; }
     bool ctrl() const { return flags & Mod_Ctrl; }
     bool shift() const { return flags & Mod_Shift; }
@@ -127,9 +127,10 @@ void KeyboardDevice::key_state_changed(byte raw, bool pressed)
     event.flags = m_modifiers;
     if (pressed)
         event.flags |= Is_Press;
+    m_queue.enqueue(event);
     if (m_client)
         m_client->on_key_pressed(event);
-    m_queue.enqueue(event);
+    wait_queue().wake_all();
 }
 
 void KeyboardDevice::handle_irq()
@@ -204,18 +205,7 @@ bool KeyboardDevice::can_read(Process&) const
 
 ssize_t KeyboardDevice::read(Process&, byte* buffer, ssize_t size)
 {
-    ssize_t nread = 0;
-    while (nread < size) {
-        if (m_queue.is_empty())
-            break;
-        // Don't return partial data frames.
-        if ((size - nread) < (ssize_t)sizeof(Event))
-            break;
-        auto event = m_queue.dequeue();
-        memcpy(buffer, &event, sizeof(Event));
-        nread += sizeof(Event);
-    }
-    return nread;
+    return m_queue.read(buffer, size);
 }
 
 ssize_t KeyboardDevice::write(Process&, const byte*, ssize_t)
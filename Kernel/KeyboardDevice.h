@@ -2,8 +2,8 @@
 
 #include <AK/Types.h>
 #include <AK/DoublyLinkedList.h>
-#include <AK/CircularQueue.h>
 #include <Kernel/CharacterDevice.h>
+#include <Kernel/InputEventQueue.h>
 #include "IRQHandler.h"
 #include "KeyCode.h"
 
@@ -44,7 +44,8 @@ private:
     }
 
     KeyboardClient* m_client { nullptr };
-    CircularQueue<Event, 16> m_queue;
+    // Filled by the interrupt handler, emptied by read().
+    InputEventQueue<Event, 64> m_queue;
     byte m_modifiers { 0 };
 };
 
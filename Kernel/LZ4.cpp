@@ -0,0 +1,154 @@
+#include <Kernel/LZ4.h>
+#include <Kernel/StdLib.h>
+#include <AK/Assertions.h>
+#include <AK/StdLibExtras.h>
+
+namespace LZ4 {
+
+static const int min_match = 4;
+// A match can't start in the last 12 bytes, and the last 5 are always literals. Decoders count on both.
+static const int match_start_limit = 12;
+static const int last_literals = 5;
+static const int hash_bits = 12;
+
+static inline dword read32(const byte* p)
+{
+    dword value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline dword hash(dword sequence)
+{
+    return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+// Writes the 15-and-up part of a length, as a run of 255s and whatever is left.
+static inline bool write_length(byte*& out, byte* end, int length)
+{
+    for (; length >= 255; length -= 255) {
+        if (out >= end)
+            return false;
+        *out++ = 255;
+    }
+    if (out >= end)
+        return false;
+    *out++ = length;
+    return true;
+}
+
+static bool write_sequence(byte*& out, byte* end, const byte* literals, int literal_count, int offset, int match_length)
+{
+    if (out >= end)
+        return false;
+    byte* token = out++;
+    *token = min(literal_count, 15) << 4;
+    if (literal_count >= 15 && !write_length(out, end, literal_count - 15))
+        return false;
+    if (end - out < literal_count)
+        return false;
+    memcpy(out, literals, literal_count);
+    out += literal_count;
+    // The last sequence is literals only.
+    if (!match_length)
+        return true;
+    if (end - out < 2)
+        return false;
+    *out++ = offset & 0xff;
+    *out++ = offset >> 8;
+    int length_code = match_length - min_match;
+    *token |= min(length_code, 15);
+    if (length_code >= 15 && !write_length(out, end, length_code - 15))
+        return false;
+    return true;
+}
+
+int compress(const byte* source, int source_size, byte* destination, int destination_capacity)
+{
+    ASSERT(source_size < 65536);
+    // Positions plus one, so 0 can mean none. Big enough that it can't live on a kernel stack.
+    static word table[1 << hash_bits];
+    memset(table, 0, sizeof(table));
+
+    byte* out = destination;
+    byte* end = destination + destination_capacity;
+    int anchor = 0;
+    int position = 0;
+    int limit = source_size - match_start_limit;
+    int match_limit = source_size - last_literals;
+    while (position < limit) {
+        dword sequence = read32(source + position);
+        dword h = hash(sequence);
+        int candidate = (int)table[h] - 1;
+        table[h] = position + 1;
+        if (candidate < 0 || position - candidate > 65535 || read32(source + candidate) != sequence) {
+            ++position;
+            continue;
+        }
+        int length = min_match;
+        while (position + length < match_limit && source[candidate + length] == source[position + length])
+            ++length;
+        if (!write_sequence(out, end, source + anchor, position - anchor, position - candidate, length))
+            return 0;
+        position += length;
+        anchor = position;
+    }
+    if (!write_sequence(out, end, source + anchor, source_size - anchor, 0, 0))
+        return 0;
+    return out - destination;
+}
+
+// Reads the 15-and-up part of a length. Returns false if the input ends first.
+static inline bool read_length(const byte*& in, const byte* end, int& length)
+{
+    for (;;) {
+        if (in >= end)
+            return false;
+        byte value = *in++;
+        length += value;
+        if (value != 255)
+            return true;
+    }
+}
+
+bool decompress(const byte* source, int source_size, byte* destination, int destination_size)
+{
+    const byte* in = source;
+    const byte* in_end = source + source_size;
+    byte* out = destination;
+    byte* out_end = destination + destination_size;
+    while (in < in_end) {
+        byte token = *in++;
+        int literal_count = token >> 4;
+        if (literal_count == 15 && !read_length(in, in_end, literal_count))
+            return false;
+        if (in_end - in < literal_count || out_end - out < literal_count)
+            return false;
+        memcpy(out, in, literal_count);
+        in += literal_count;
+        out += literal_count;
+        // Only the last sequence ends after its literals.
+        if (in == in_end)
+            break;
+        if (in_end - in < 2)
+            return false;
+        int offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (!offset || offset > out - destination)
+            return false;
+        int length = token & 15;
+        if (length == 15 && !read_length(in, in_end, length))
+            return false;
+        length += min_match;
+        if (out_end - out < length)
+            return false;
+        // The match may overlap what it's writing, so byte by byte.
+        const byte* match = out - offset;
+        for (int i = 0; i < length; ++i)
+            out[i] = match[i];
+        out += length;
+    }
+    return out == out_end;
+}
+
+}
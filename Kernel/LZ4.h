@@ -0,0 +1,14 @@
+#pragma once
+
+#include <AK/Types.h>
+
+// The LZ4 block format, without the frame around it. Quick to compress and quicker to decompress,
+// for data that only lives in memory, like compressed swap.
+namespace LZ4 {
+
+// Returns the compressed size, or 0 if it doesn't fit in destination_capacity. Inputs must be under 64 kB.
+int compress(const byte* source, int source_size, byte* destination, int destination_capacity);
+// Returns false unless the input was well formed and decompressed to exactly destination_size bytes.
+bool decompress(const byte* source, int source_size, byte* destination, int destination_size);
+
+}
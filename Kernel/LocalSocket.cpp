@@ -3,6 +3,7 @@
 #include <Kernel/Process.h>
 #include <Kernel/VirtualFileSystem.h>
 #include <LibC/errno_numbers.h>
+#include <AK/ByteBuffer.h>
 
 //#define DEBUG_LOCAL_SOCKET
 
@@ -14,6 +15,8 @@ Retained<LocalSocket> LocalSocket::create(int type)
 LocalSocket::LocalSocket(int type)
     : Socket(AF_LOCAL, type, 0)
 {
+    m_for_client.set_wait_queue(wait_queue());
+    m_for_server.set_wait_queue(wait_queue());
 #ifdef DEBUG_LOCAL_SOCKET
     kprintf("%s(%u) LocalSocket{%p} created with type=%u\n", current->process().name().characters(), current->pid(), this, type);
 #endif
@@ -65,7 +68,7 @@ KResult LocalSocket::bind(const sockaddr* address, socklen_t address_size)
     return KSuccess;
 }
 
-KResult LocalSocket::connect(const sockaddr* address, socklen_t address_size)
+KResult LocalSocket::connect(const sockaddr* address, socklen_t address_size, ShouldBlock)
 {
     ASSERT(!m_bound);
     if (address_size != sizeof(sockaddr_un))
@@ -93,10 +96,13 @@ KResult LocalSocket::connect(const sockaddr* address, socklen_t address_size)
     m_address = local_address;
 
     auto peer = m_file->inode()->socket();
+    if (peer->type() != type())
+        return KResult(-EPROTOTYPE);
     auto result = peer->queue_connection_from(*this);
     if (result.is_error())
         return result;
 
+    // The server is on this machine and accepts right away, so this is waited for even without blocking.
     return current->wait_for_connect(*this);
 }
 
@@ -109,6 +115,7 @@ void LocalSocket::attach_fd(SocketRole role)
     } else if (role == SocketRole::Connecting) {
         ++m_connecting_fds_open;
     }
+    wait_queue().wake_all();
 }
 
 void LocalSocket::detach_fd(SocketRole role)
@@ -123,6 +130,16 @@ void LocalSocket::detach_fd(SocketRole role)
         ASSERT(m_connecting_fds_open);
         --m_connecting_fds_open;
     }
+    wait_queue().wake_all();
+}
+
+bool LocalSocket::has_peer(SocketRole role) const
+{
+    if (role == SocketRole::Accepted)
+        return m_connected_fds_open || m_connecting_fds_open;
+    if (role == SocketRole::Connected)
+        return m_accepted_fds_open;
+    ASSERT_NOT_REACHED();
 }
 
 bool LocalSocket::can_read(SocketRole role) const
@@ -130,32 +147,33 @@ bool LocalSocket::can_read(SocketRole role) const
     if (role == SocketRole::Listener)
         return can_accept();
     if (role == SocketRole::Accepted)
-        return (!m_connected_fds_open && !m_connecting_fds_open) || !m_for_server.is_empty();
+        return !has_peer(role) || !m_for_server.is_empty();
     if (role == SocketRole::Connected)
-        return !m_accepted_fds_open || !m_for_client.is_empty();
+        return !has_peer(role) || !m_for_client.is_empty();
     ASSERT_NOT_REACHED();
 }
 
-ssize_t LocalSocket::read(SocketRole role, byte* buffer, ssize_t size)
+ssize_t LocalSocket::read(SocketRole role, byte* buffer, ssize_t size, int)
 {
+    bool truncated;
     if (role == SocketRole::Accepted)
-        return m_for_server.read(buffer, size);
+        return is_seqpacket() ? m_for_server.read_message(buffer, size, truncated) : m_for_server.read(buffer, size);
     if (role == SocketRole::Connected)
-        return m_for_client.read(buffer, size);
+        return is_seqpacket() ? m_for_client.read_message(buffer, size, truncated) : m_for_client.read(buffer, size);
     ASSERT_NOT_REACHED();
 }
 
-ssize_t LocalSocket::write(SocketRole role, const byte* data, ssize_t size)
+ssize_t LocalSocket::write(SocketRole role, const byte* data, ssize_t size, int)
 {
     if (role == SocketRole::Accepted) {
         if (!m_accepted_fds_open)
             return -EPIPE;
-        return m_for_client.write(data, size);
+        return is_seqpacket() ? m_for_client.write_message(data, size) : m_for_client.write(data, size);
     }
     if (role == SocketRole::Connected) {
         if (!m_connected_fds_open && !m_connecting_fds_open)
             return -EPIPE;
-        return m_for_server.write(data, size);
+        return is_seqpacket() ? m_for_server.write_message(data, size) : m_for_server.write(data, size);
     }
     ASSERT_NOT_REACHED();
 }
@@ -163,9 +181,9 @@ ssize_t LocalSocket::write(SocketRole role, const byte* data, ssize_t size)
 bool LocalSocket::can_write(SocketRole role) const
 {
     if (role == SocketRole::Accepted)
-        return (!m_connected_fds_open && !m_connecting_fds_open) || m_for_client.bytes_in_write_buffer() < 4096;
+        return (!m_connected_fds_open && !m_connecting_fds_open) || m_for_client.can_write();
     if (role == SocketRole::Connected)
-        return !m_accepted_fds_open || m_for_server.bytes_in_write_buffer() < 4096;
+        return !m_accepted_fds_open || m_for_server.can_write();
     ASSERT_NOT_REACHED();
 }
 
@@ -178,3 +196,46 @@ ssize_t LocalSocket::recvfrom(void*, size_t, int flags, sockaddr*, socklen_t*)
 {
     ASSERT_NOT_REACHED();
 }
+
+int LocalSocket::recvmmsg(SocketRole role, mmsghdr* messages, int count, int)
+{
+    if (!is_seqpacket())
+        return -EOPNOTSUPP;
+    if (role != SocketRole::Accepted && role != SocketRole::Connected)
+        return -ENOTCONN;
+    auto& buffer = role == SocketRole::Accepted ? m_for_server : m_for_client;
+    // The caller has already waited for the first one if it wanted to, so this only takes what's there.
+    int received = 0;
+    while (received < count && !buffer.is_empty()) {
+        auto& message = messages[received].msg_hdr;
+        bool truncated;
+        ssize_t rc;
+        if (message.msg_iovlen == 1) {
+            rc = buffer.read_message((byte*)message.msg_iov[0].iov_base, message.msg_iov[0].iov_len, truncated);
+        } else {
+            size_t length = 0;
+            for (int i = 0; i < message.msg_iovlen; ++i)
+                length += message.msg_iov[i].iov_len;
+            auto staging = ByteBuffer::create_uninitialized(min(length, RingBuffer::max_message_size));
+            rc = buffer.read_message(staging.pointer(), staging.size(), truncated);
+            size_t offset = 0;
+            for (int i = 0; i < message.msg_iovlen && offset < (size_t)rc; ++i) {
+                size_t chunk = min(message.msg_iov[i].iov_len, (size_t)rc - offset);
+                memcpy(message.msg_iov[i].iov_base, staging.pointer() + offset, chunk);
+                offset += chunk;
+            }
+        }
+        if (rc < 0)
+            return received ? received : rc;
+        // There's only ever the one peer, so no address comes with the message.
+        if (message.msg_name)
+            message.msg_namelen = 0;
+        message.msg_controllen = 0;
+        message.msg_flags = truncated ? MSG_TRUNC : 0;
+        messages[received].msg_len = rc;
+        ++received;
+    }
+    if (!received && has_peer(role))
+        return -EAGAIN;
+    return received;
+}
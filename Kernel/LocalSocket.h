@@ -1,7 +1,7 @@
 #pragma once
 
 #include <Kernel/Socket.h>
-#include <Kernel/DoubleBuffer.h>
+#include <Kernel/RingBuffer.h>
 
 class FileDescriptor;
 
@@ -11,20 +11,24 @@ public:
     virtual ~LocalSocket() override;
 
     virtual KResult bind(const sockaddr*, socklen_t) override;
-    virtual KResult connect(const sockaddr*, socklen_t) override;
+    virtual KResult connect(const sockaddr*, socklen_t, ShouldBlock) override;
     virtual bool get_address(sockaddr*, socklen_t*) override;
     virtual void attach_fd(SocketRole) override;
     virtual void detach_fd(SocketRole) override;
     virtual bool can_read(SocketRole) const override;
-    virtual ssize_t read(SocketRole, byte*, ssize_t) override;
-    virtual ssize_t write(SocketRole, const byte*, ssize_t) override;
+    virtual ssize_t read(SocketRole, byte*, ssize_t, int flags) override;
+    virtual ssize_t write(SocketRole, const byte*, ssize_t, int flags) override;
     virtual bool can_write(SocketRole) const override;
     virtual ssize_t sendto(const void*, size_t, int, const sockaddr*, socklen_t) override;
     virtual ssize_t recvfrom(void*, size_t, int flags, sockaddr*, socklen_t*) override;
+    virtual int recvmmsg(SocketRole, mmsghdr*, int count, int flags) override;
 
 private:
     explicit LocalSocket(int type);
     virtual bool is_local() const override { return true; }
+    // Each write is one message, and each read takes one.
+    bool is_seqpacket() const { return type() == SOCK_SEQPACKET; }
+    bool has_peer(SocketRole) const;
 
     RetainPtr<FileDescriptor> m_file;
 
@@ -34,7 +38,7 @@ private:
     int m_connecting_fds_open { 0 };
     sockaddr_un m_address;
 
-    DoubleBuffer m_for_client;
-    DoubleBuffer m_for_server;
+    RingBuffer m_for_client { 16 * KB };
+    RingBuffer m_for_server { 16 * KB };
 };
 
@@ -0,0 +1,121 @@
+#include <Kernel/Lock.h>
+#include <Kernel/Process.h>
+#include <Kernel/system.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/Tracing.h>
+
+static const size_t max_lock_contention_stats = 64;
+static LockContentionStats s_lock_contention_stats[max_lock_contention_stats];
+static size_t s_lock_contention_stats_count;
+
+static LockContentionStats& contention_stats_for(const char* name)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (!name)
+        name = "(unnamed)";
+    for (size_t i = 0; i < s_lock_contention_stats_count; ++i) {
+        auto& stats = s_lock_contention_stats[i];
+        if (stats.name == name || !strcmp(stats.name, name))
+            return stats;
+    }
+    // Everyone past the end of the table shares its last entry.
+    if (s_lock_contention_stats_count == max_lock_contention_stats) {
+        auto& stats = s_lock_contention_stats[max_lock_contention_stats - 1];
+        stats.name = "(other)";
+        return stats;
+    }
+    auto& stats = s_lock_contention_stats[s_lock_contention_stats_count++];
+    stats.name = name;
+    return stats;
+}
+
+bool Lock::contention_stats(size_t index, LockContentionStats& stats)
+{
+    InterruptDisabler disabler;
+    if (index >= s_lock_contention_stats_count)
+        return false;
+    stats = s_lock_contention_stats[index];
+    return true;
+}
+
+void Lock::lock()
+{
+    if (!are_interrupts_enabled()) {
+        kprintf("Interrupts disabled when trying to take Lock{%s}\n", m_name);
+        hang();
+    }
+    ASSERT(!Scheduler::is_active());
+    InterruptDisabler disabler;
+    for (;;) {
+        if (!m_holder || m_holder == current) {
+            m_holder = current;
+            ++m_level;
+            return;
+        }
+        if (current->state() == Thread::Running)
+            break;
+        // We can't go to sleep from this state, so let the holder run and try again.
+        Scheduler::donate_to(m_holder, m_name);
+    }
+
+    // NOTE: There's only one CPU, so spinning would only burn the holder's time. Go straight to sleep.
+    auto& stats = contention_stats_for(m_name);
+    ++stats.contentions;
+    dword start_time = system.uptime;
+
+    current->m_blocked_lock = this;
+    current->m_next_lock_waiter = nullptr;
+    if (m_last_waiter)
+        m_last_waiter->m_next_lock_waiter = current;
+    else
+        m_first_waiter = current;
+    m_last_waiter = current;
+    current->block(Thread::BlockedLock);
+
+    // unlock() handed the lock straight to us.
+    ASSERT(m_holder == current);
+    ASSERT(m_level == 1);
+    stats.ticks_waited += system.uptime - start_time;
+    TRACE(LockContended, (dword)this, system.uptime - start_time);
+}
+
+void Lock::unlock()
+{
+    InterruptDisabler disabler;
+    ASSERT(m_holder == current);
+    ASSERT(m_level);
+    if (--m_level)
+        return;
+    auto* next = m_first_waiter;
+    if (!next) {
+        m_holder = nullptr;
+        return;
+    }
+    m_first_waiter = next->m_next_lock_waiter;
+    if (!m_first_waiter)
+        m_last_waiter = nullptr;
+    next->m_next_lock_waiter = nullptr;
+    next->m_blocked_lock = nullptr;
+    m_holder = next;
+    m_level = 1;
+    next->unblock();
+}
+
+void Lock::remove_waiter(Thread& thread)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    Thread* previous = nullptr;
+    for (auto* waiter = m_first_waiter; waiter; previous = waiter, waiter = waiter->m_next_lock_waiter) {
+        if (waiter != &thread)
+            continue;
+        if (previous)
+            previous->m_next_lock_waiter = waiter->m_next_lock_waiter;
+        else
+            m_first_waiter = waiter->m_next_lock_waiter;
+        if (m_last_waiter == waiter)
+            m_last_waiter = previous;
+        break;
+    }
+    thread.m_next_lock_waiter = nullptr;
+    thread.m_blocked_lock = nullptr;
+}
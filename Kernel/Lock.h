@@ -1,6 +1,7 @@
 #pragma once
 
 #include <AK/Assertions.h>
+#include <AK/StdLibExtras.h>
 #include <AK/Types.h>
 #include <Kernel/i386.h>
 #include <Kernel/Scheduler.h>
@@ -19,7 +20,15 @@ static inline dword CAS(volatile dword* mem, dword newval, dword oldval)
     return ret;
 }
 
+struct LockContentionStats {
+    const char* name { nullptr };
+    dword contentions { 0 };
+    dword ticks_waited { 0 };
+};
+
+// A recursive kernel mutex. Contended lockers sleep until unlock() hands the lock over to them, in FIFO order.
 class Lock {
+    friend class Thread;
 public:
     Lock(const char* name = nullptr) : m_name(name) { }
     ~Lock() { }
@@ -29,10 +38,16 @@ public:
 
     const char* name() const { return m_name; }
 
+    // Contention is accounted per lock name, for /proc/locks.
+    static bool contention_stats(size_t index, LockContentionStats&);
+
 private:
-    volatile dword m_lock { 0 };
+    void remove_waiter(Thread&);
+
     dword m_level { 0 };
     Thread* m_holder { nullptr };
+    Thread* m_first_waiter { nullptr };
+    Thread* m_last_waiter { nullptr };
     const char* m_name { nullptr };
 };
 
@@ -47,49 +62,6 @@ private:
     Lock& m_lock;
 };
 
-[[gnu::always_inline]] inline void Lock::lock()
-{
-    if (!are_interrupts_enabled()) {
-        kprintf("Interrupts disabled when trying to take Lock{%s}\n", m_name);
-        hang();
-    }
-    ASSERT(!Scheduler::is_active());
-    for (;;) {
-        if (CAS(&m_lock, 1, 0) == 0) {
-            if (!m_holder || m_holder == current) {
-                m_holder = current;
-                ++m_level;
-                memory_barrier();
-                m_lock = 0;
-                return;
-            }
-            m_lock = 0;
-        }
-        Scheduler::donate_to(m_holder, m_name);
-    }
-}
-
-inline void Lock::unlock()
-{
-    for (;;) {
-        if (CAS(&m_lock, 1, 0) == 0) {
-            ASSERT(m_holder == current);
-            ASSERT(m_level);
-            --m_level;
-            if (m_level) {
-                memory_barrier();
-                m_lock = 0;
-                return;
-            }
-            m_holder = nullptr;
-            memory_barrier();
-            m_lock = 0;
-            return;
-        }
-        Scheduler::donate_to(m_holder, m_name);
-    }
-}
-
 #define LOCKER(lock) Locker locker(lock)
 
 template<typename T>
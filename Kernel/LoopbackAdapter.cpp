@@ -0,0 +1,29 @@
+#include <Kernel/LoopbackAdapter.h>
+
+static LoopbackAdapter* s_the;
+
+LoopbackAdapter& LoopbackAdapter::the()
+{
+    if (!s_the)
+        s_the = new LoopbackAdapter;
+    return *s_the;
+}
+
+LoopbackAdapter::LoopbackAdapter()
+    : NetworkAdapter("loop")
+{
+    set_ipv4_address(IPv4Address(127, 0, 0, 1));
+    set_ipv4_netmask(IPv4Address(255, 0, 0, 0));
+    set_mtu(16384);
+}
+
+LoopbackAdapter::~LoopbackAdapter()
+{
+}
+
+void LoopbackAdapter::send_raw(PacketBuffer& frame)
+{
+    // Whoever sent it is done with it, so the very same buffer is what comes in.
+    frame.set_checksum_verified();
+    did_receive(Retained<PacketBuffer>(frame));
+}
@@ -7,13 +7,19 @@
 
 class [[gnu::packed]] MACAddress {
 public:
-    MACAddress() { }
+    MACAddress() { memset(m_data, 0, sizeof(m_data)); }
     MACAddress(const byte data[6])
     {
         memcpy(m_data, data, 6);
     }
     ~MACAddress() { }
 
+    static MACAddress broadcast()
+    {
+        static const byte data[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+        return MACAddress(data);
+    }
+
     byte operator[](int i) const
     {
         ASSERT(i >= 0 && i < 6);
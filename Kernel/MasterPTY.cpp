@@ -13,6 +13,7 @@ MasterPTY::MasterPTY(unsigned index)
     , m_slave(adopt(*new SlavePTY(*this, index)))
     , m_index(index)
 {
+    m_buffer.set_wait_queue(wait_queue());
     set_uid(current->process().uid());
     set_gid(current->process().gid());
 }
@@ -34,7 +35,12 @@ ssize_t MasterPTY::read(Process&, byte* buffer, ssize_t size)
 {
     if (!m_slave && m_buffer.is_empty())
         return 0;
-    return m_buffer.read(buffer, size);
+    bool slave_may_be_blocked = !m_buffer.can_write();
+    ssize_t nread = m_buffer.read(buffer, size);
+    // The slave only waits for room to write once it's run out.
+    if (m_slave && slave_may_be_blocked)
+        m_slave->wait_queue().wake_all();
+    return nread;
 }
 
 ssize_t MasterPTY::write(Process&, const byte* buffer, ssize_t size)
@@ -66,21 +72,21 @@ void MasterPTY::notify_slave_closed(Badge<SlavePTY>)
     // +1 retain for FileDescriptor::m_device
     if (m_slave->retain_count() == 2)
         m_slave = nullptr;
+    wait_queue().wake_all();
 }
 
 ssize_t MasterPTY::on_slave_write(const byte* data, ssize_t size)
 {
     if (m_closed)
         return -EIO;
-    m_buffer.write(data, size);
-    return size;
+    return m_buffer.write(data, size);
 }
 
 bool MasterPTY::can_write_from_slave() const
 {
     if (m_closed)
         return true;
-    return m_buffer.bytes_in_write_buffer() < 4096;
+    return m_buffer.can_write();
 }
 
 void MasterPTY::close()
@@ -2,7 +2,7 @@
 
 #include <AK/Badge.h>
 #include <Kernel/CharacterDevice.h>
-#include <Kernel/DoubleBuffer.h>
+#include <Kernel/RingBuffer.h>
 
 class SlavePTY;
 
@@ -32,5 +32,6 @@ private:
     RetainPtr<SlavePTY> m_slave;
     unsigned m_index;
     bool m_closed { false };
-    DoubleBuffer m_buffer;
+    // What the slave writes. Big, since that's where the output of whatever runs in the terminal piles up.
+    RingBuffer m_buffer { 64 * KB };
 };
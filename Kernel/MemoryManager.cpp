@@ -6,7 +6,12 @@
 #include "StdLib.h"
 #include "Process.h"
 #include <LibC/errno_numbers.h>
+#include <LibC/signal_numbers.h>
 #include "CMOS.h"
+#include <Kernel/DiskBackedFileSystem.h>
+#include <Kernel/SwapSpace.h>
+#include <Kernel/CompressedSwap.h>
+#include <Kernel/Tracing.h>
 
 //#define MM_DEBUG
 //#define PAGE_FAULT_DEBUG
@@ -88,7 +93,6 @@ void MemoryManager::initialize_paging()
 
     // Basic memory map:
     // 0      -> 512 kB         Kernel code. Root page directory & PDE 0.
-    // (last page before 1MB)   Used by quickmap_page().
     // 1 MB   -> 2 MB           kmalloc_eternal() space.
     // 2 MB   -> 3 MB           kmalloc() space.
     // 3 MB   -> 4 MB           Supervisor physical pages (available for allocation!)
@@ -97,21 +101,82 @@ void MemoryManager::initialize_paging()
         m_free_supervisor_physical_pages.append(PhysicalPage::create_eternal(PhysicalAddress(i), true));
 
     dbgprintf("MM: 4MB-%uMB available for allocation\n", m_ram_size / 1048576);
-    for (size_t i = (4 * MB); i < m_ram_size; i += PAGE_SIZE)
-        m_free_physical_pages.append(PhysicalPage::create_eternal(PhysicalAddress(i), false));
-    m_quickmap_addr = LinearAddress((1 * MB) - PAGE_SIZE);
+    // The user pages live in one array, so the buddy allocator can find a page's buddy by index.
+    size_t user_page_count = m_ram_size > (4 * MB) ? (m_ram_size - (4 * MB)) / PAGE_SIZE : 0;
+    auto* user_pages = (PhysicalPage*)kmalloc_eternal(sizeof(PhysicalPage) * user_page_count);
+    for (size_t i = 0; i < user_page_count; ++i) {
+        new (&user_pages[i]) PhysicalPage(PhysicalAddress((4 * MB) + i * PAGE_SIZE), false);
+        user_pages[i].m_retain_count = 0;
+    }
+    m_user_physical_allocator.initialize(user_pages, user_page_count);
+    m_low_watermark = max((size_t)32, user_page_count / 64);
+    m_high_watermark = m_low_watermark * 2;
+
+    // All of physical memory is also mapped at physmap_base, so the kernel can touch any physical page
+    // without remapping. This has to happen before any other page directory gets created,
+    // since they copy the kernel's PDEs for the 0xC0000000+ range.
+    ASSERT(m_ram_size <= physmap_size);
+#ifdef MM_DEBUG
+    dbgprintf("MM: Map physical memory at L%x\n", physmap_base);
+#endif
+    m_has_pse = CPUID(1).edx() & (1 << 3);
+    if (m_has_pse) {
+        asm volatile(
+            "movl %%cr4, %%eax\n"
+            "orl $0x10, %%eax\n"
+            "movl %%eax, %%cr4\n"
+            :::"%eax", "memory");
+    }
+    kprintf("MM: %s 4MB pages\n", m_has_pse ? "Using" : "No");
+
+    for (size_t paddr = 0; paddr < m_ram_size;) {
+        if (m_has_pse) {
+            PageDirectoryEntry pde(&kernel_page_directory().entries()[(physmap_base + paddr) >> 22]);
+            ASSERT(!pde.is_present());
+            pde.set_page_table_base(paddr);
+            pde.set_huge(true);
+            pde.set_global(true);
+            pde.set_user_allowed(false);
+            pde.set_present(true);
+            pde.set_writable(true);
+            paddr += 4 * MB;
+            continue;
+        }
+        auto pte = ensure_pte(kernel_page_directory(), LinearAddress(physmap_base + paddr));
+        pte.set_physical_page_base(paddr);
+        pte.set_global(true);
+        pte.set_user_allowed(false);
+        pte.set_present(true);
+        pte.set_writable(true);
+        paddr += PAGE_SIZE;
+    }
+
+    initialize_kernel_stacks();
+
 #ifdef MM_DEBUG
-    dbgprintf("MM: Quickmap will use P%x\n", m_quickmap_addr.get());
     dbgprintf("MM: Installing page directory\n");
 #endif
 
     asm volatile("movl %%eax, %%cr3"::"a"(kernel_page_directory().cr3()));
+    // Set CR0.WP as well, so kernel writes into copy-on-write user pages fault like userspace ones do.
     asm volatile(
         "movl %%cr0, %%eax\n"
-        "orl $0x80000001, %%eax\n"
+        "orl $0x80010001, %%eax\n"
         "movl %%eax, %%cr0\n"
         :::"%eax", "memory");
 
+    // Every address space shares the kernel's mappings, so they can stay in the TLB across context switches.
+    // That only works for the CR3 loads: anything changing a kernel mapping has to invlpg it, see map_for_kernel().
+    m_has_pge = CPUID(1).edx() & (1 << 13);
+    if (m_has_pge) {
+        asm volatile(
+            "movl %%cr4, %%eax\n"
+            "orl $0x80, %%eax\n"
+            "movl %%eax, %%cr4\n"
+            :::"%eax", "memory");
+    }
+    kprintf("MM: %s global pages\n", m_has_pge ? "Using" : "No");
+
 #ifdef MM_DEBUG
     dbgprintf("MM: Paging initialized.\n");
 #endif
@@ -149,6 +214,7 @@ auto MemoryManager::ensure_pte(PageDirectory& page_directory, LinearAddress ladd
     dword page_table_index = (laddr.get() >> 12) & 0x3ff;
 
     PageDirectoryEntry pde = PageDirectoryEntry(&page_directory.entries()[page_directory_index]);
+    ASSERT(!pde.is_huge());
     if (!pde.is_present()) {
 #ifdef MM_DEBUG
         dbgprintf("MM: PDE %u not present (requested for L%x), allocating\n", page_directory_index, laddr.get());
@@ -182,6 +248,53 @@ auto MemoryManager::ensure_pte(PageDirectory& page_directory, LinearAddress ladd
     return PageTableEntry(&pde.page_table_base()[page_table_index]);
 }
 
+bool MemoryManager::has_page_table(PageDirectory& page_directory, LinearAddress laddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    dword page_directory_index = (laddr.get() >> 22) & 0x3ff;
+    PageDirectoryEntry pde(&page_directory.entries()[page_directory_index]);
+    return pde.is_present() && !pde.is_huge();
+}
+
+// Maps the 4 MB starting at the given page of a physical range region with a single PDE, if PSE is
+// available and everything lines up. This saves a lot of TLB entries for big things like framebuffers.
+bool MemoryManager::try_map_huge_page(PageDirectory& page_directory, Region& region, LinearAddress laddr, unsigned page_index_in_region, bool user_allowed)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    static const unsigned pages_per_huge_page = (4 * MB) / PAGE_SIZE;
+    if (!m_has_pse || !region.vmo().is_physical_range())
+        return false;
+    if (page_index_in_region + pages_per_huge_page > region.page_count())
+        return false;
+    auto& physical_page = region.vmo().physical_pages()[region.first_page_index() + page_index_in_region];
+    if ((laddr.get() & (4 * MB - 1)) || (physical_page->paddr().get() & (4 * MB - 1)))
+        return false;
+    PageDirectoryEntry pde(&page_directory.entries()[laddr.get() >> 22]);
+    // Someone else already has a page table here.
+    if (pde.is_present() && !pde.is_huge())
+        return false;
+    pde.set_page_table_base(physical_page->paddr().get());
+    pde.set_huge(true);
+    pde.set_present(true);
+    pde.set_writable(region.is_writable());
+    pde.set_cache_disabled(!region.vmo().m_allow_cpu_caching);
+    pde.set_write_through(!region.vmo().m_allow_cpu_caching);
+    pde.set_user_allowed(user_allowed);
+    page_directory.flush(laddr);
+    return true;
+}
+
+bool MemoryManager::unmap_huge_page(PageDirectory& page_directory, LinearAddress laddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    PageDirectoryEntry pde(&page_directory.entries()[laddr.get() >> 22]);
+    if (!pde.is_present() || !pde.is_huge())
+        return false;
+    *pde.ptr() = 0;
+    page_directory.flush(laddr);
+    return true;
+}
+
 void MemoryManager::map_protected(LinearAddress laddr, size_t length)
 {
     InterruptDisabler disabler;
@@ -205,6 +318,8 @@ void MemoryManager::create_identity_mapping(PageDirectory& page_directory, Linea
         auto pte_address = laddr.offset(offset);
         auto pte = ensure_pte(page_directory, pte_address);
         pte.set_physical_page_base(pte_address.get());
+        // The bottom 4 MB are the same for everyone.
+        pte.set_global(true);
         pte.set_user_allowed(false);
         pte.set_present(true);
         pte.set_writable(true);
@@ -220,19 +335,17 @@ void MemoryManager::initialize()
 Region* MemoryManager::region_from_laddr(Process& process, LinearAddress laddr)
 {
     ASSERT_INTERRUPTS_DISABLED();
-
-    // FIXME: Use a binary search tree (maybe red/black?) or some other more appropriate data structure!
-    for (auto& region : process.m_regions) {
-        if (region->contains(laddr))
-            return region.ptr();
-    }
-    dbgprintf("%s(%u) Couldn't find region for L%x (CR3=%x)\n", process.name().characters(), process.pid(), laddr.get(), process.page_directory().cr3());
-    return nullptr;
+    return const_cast<Region*>(region_from_laddr(const_cast<const Process&>(process), laddr));
 }
 
 const Region* MemoryManager::region_from_laddr(const Process& process, LinearAddress laddr)
 {
-    // FIXME: Use a binary search tree (maybe red/black?) or some other more appropriate data structure!
+    // Regions aren't meant to overlap, so it's the one starting closest below the address or none of them.
+    if (auto* closest = process.m_region_tree.find_largest_not_above(laddr)) {
+        if (closest->contains(laddr))
+            return closest;
+    }
+    // FIXME: Nothing stops regions from being put on top of each other, so look at all of them before giving up.
     for (auto& region : process.m_regions) {
         if (region->contains(laddr))
             return region.ptr();
@@ -256,12 +369,16 @@ bool MemoryManager::zero_page(Region& region, unsigned page_index_in_region)
         remap_region_page(region, page_index_in_region, true);
         return true;
     }
+    if (dword slot = vmo.swap_slot(region.first_page_index() + page_index_in_region))
+        return swap_in(region, page_index_in_region, slot);
     auto physical_page = allocate_physical_page(ShouldZeroFill::Yes);
+    if (!physical_page)
+        return false;
 #ifdef PAGE_FAULT_DEBUG
     dbgprintf("      >> ZERO P%x\n", physical_page->paddr().get());
 #endif
     region.m_cow_map.set(page_index_in_region, false);
-    vmo.physical_pages()[page_index_in_region] = move(physical_page);
+    vmo_page = move(physical_page);
     remap_region_page(region, page_index_in_region, true);
     return true;
 }
@@ -270,7 +387,8 @@ bool MemoryManager::copy_on_write(Region& region, unsigned page_index_in_region)
 {
     ASSERT_INTERRUPTS_DISABLED();
     auto& vmo = region.vmo();
-    if (vmo.physical_pages()[page_index_in_region]->retain_count() == 1) {
+    auto& vmo_page = vmo.physical_pages()[region.first_page_index() + page_index_in_region];
+    if (vmo_page->retain_count() == 1) {
 #ifdef PAGE_FAULT_DEBUG
         dbgprintf("    >> It's a COW page but nobody is sharing it anymore. Remap r/w\n");
 #endif
@@ -282,16 +400,15 @@ bool MemoryManager::copy_on_write(Region& region, unsigned page_index_in_region)
 #ifdef PAGE_FAULT_DEBUG
     dbgprintf("    >> It's a COW page and it's time to COW!\n");
 #endif
-    auto physical_page_to_copy = move(vmo.physical_pages()[page_index_in_region]);
+    auto physical_page_to_copy = move(vmo_page);
     auto physical_page = allocate_physical_page(ShouldZeroFill::No);
-    byte* dest_ptr = quickmap_page(*physical_page);
-    const byte* src_ptr = region.laddr().offset(page_index_in_region * PAGE_SIZE).as_ptr();
+    if (!physical_page)
+        return false;
 #ifdef PAGE_FAULT_DEBUG
     dbgprintf("      >> COW P%x <- P%x\n", physical_page->paddr().get(), physical_page_to_copy->paddr().get());
 #endif
-    memcpy(dest_ptr, src_ptr, PAGE_SIZE);
-    vmo.physical_pages()[page_index_in_region] = move(physical_page);
-    unquickmap_page();
+    memcpy(physmap(*physical_page), physmap(*physical_page_to_copy), PAGE_SIZE);
+    vmo_page = move(physical_page);
     region.m_cow_map.set(page_index_in_region, false);
     remap_region_page(region, page_index_in_region, true);
     return true;
@@ -317,6 +434,20 @@ bool Region::page_in()
     return true;
 }
 
+// How many pages around a fault in a file-backed region get mapped in one go. Must be a power of two.
+static const unsigned fault_around_pages = 16;
+// A region that's read sequentially gets this many pages from the fault on, which is about to be needed anyway.
+static const unsigned sequential_fault_ahead_pages = 64;
+
+void MemoryManager::map_cached_page(Region& region, unsigned page_index_in_region)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    // Writes must not reach the page cache, make the page copy-on-write for this region.
+    if (region.is_writable() && !region.is_shared())
+        region.m_cow_map.set(page_index_in_region, true);
+    remap_region_page(region, page_index_in_region, true);
+}
+
 bool MemoryManager::page_in_from_inode(Region& region, unsigned page_index_in_region)
 {
     ASSERT(region.page_directory());
@@ -334,7 +465,8 @@ bool MemoryManager::page_in_from_inode(Region& region, unsigned page_index_in_re
 
     if (!vmo_page.is_null()) {
         dbgprintf("MM: page_in_from_inode() but page already present. Fine with me!\n");
-        remap_region_page(region, page_index_in_region, true);
+        // The page may have been brought in by someone else's fault around, treat it like a cached page.
+        map_cached_page(region, page_index_in_region);
         return true;
     }
 
@@ -342,29 +474,80 @@ bool MemoryManager::page_in_from_inode(Region& region, unsigned page_index_in_re
     dbgprintf("MM: page_in_from_inode ready to read from inode\n");
 #endif
     sti();
-    byte page_buffer[PAGE_SIZE];
     auto& inode = *vmo.inode();
-    auto nread = inode.read_bytes(vmo.inode_offset() + ((region.first_page_index() + page_index_in_region) * PAGE_SIZE), PAGE_SIZE, page_buffer, nullptr);
+    size_t offset_in_inode = vmo.inode_offset() + ((region.first_page_index() + page_index_in_region) * PAGE_SIZE);
+    if (!(offset_in_inode % PAGE_SIZE)) {
+        // Fault around: pull the surrounding window into the page cache with as few reads as possible,
+        // and map whatever of it is cached, so sequential access doesn't trap on every page.
+        unsigned window_start = page_index_in_region & ~(fault_around_pages - 1);
+        unsigned window_end = min(window_start + fault_around_pages, region.page_count());
+        if (region.access_pattern() == Region::AccessPattern::Sequential) {
+            window_start = page_index_in_region;
+            window_end = min(window_start + sequential_fault_ahead_pages, region.page_count());
+        } else if (region.access_pattern() == Region::AccessPattern::Random) {
+            // The neighbors are as likely to go unused as not, don't read them for nothing.
+            window_start = page_index_in_region;
+            window_end = page_index_in_region + 1;
+        }
+        unsigned first_inode_page_index = (offset_in_inode / PAGE_SIZE) - (page_index_in_region - window_start);
+        inode.read_ahead(first_inode_page_index, window_end - window_start);
+
+        // Share the physical page with the inode's page cache.
+        auto cached_page = inode.cached_page(offset_in_inode / PAGE_SIZE);
+        cli();
+        if (cached_page) {
+            vmo_page = move(cached_page);
+            map_cached_page(region, page_index_in_region);
+            for (unsigned i = window_start; i < window_end; ++i) {
+                auto& neighbor_page = vmo.physical_pages()[region.first_page_index() + i];
+                if (!neighbor_page.is_null())
+                    continue;
+                neighbor_page = inode.cached_page_if_present(first_inode_page_index + (i - window_start));
+                if (!neighbor_page.is_null())
+                    map_cached_page(region, i);
+            }
+            return true;
+        }
+        sti();
+    }
+    // Read straight into the new page through the physmap, before mapping it. The region may well be read-only.
+    auto physical_page = allocate_physical_page(ShouldZeroFill::No);
+    if (physical_page.is_null()) {
+        kprintf("MM: page_in_from_inode was unable to allocate a physical page\n");
+        return false;
+    }
+    byte* dest_ptr = physmap(*physical_page);
+    auto nread = inode.read_bytes(offset_in_inode, PAGE_SIZE, dest_ptr, nullptr);
     if (nread < 0) {
         kprintf("MM: page_in_from_inode had error (%d) while reading!\n", nread);
         return false;
     }
     if (nread < PAGE_SIZE) {
         // If we read less than a page, zero out the rest to avoid leaking uninitialized data.
-        memset(page_buffer + nread, 0, PAGE_SIZE - nread);
+        memset(dest_ptr + nread, 0, PAGE_SIZE - nread);
     }
     cli();
-    vmo_page = allocate_physical_page(ShouldZeroFill::No);
-    if (vmo_page.is_null()) {
-        kprintf("MM: page_in_from_inode was unable to allocate a physical page\n");
-        return false;
-    }
+    vmo_page = move(physical_page);
     remap_region_page(region, page_index_in_region, true);
-    byte* dest_ptr = region.laddr().offset(page_index_in_region * PAGE_SIZE).as_ptr();
-    memcpy(dest_ptr, page_buffer, PAGE_SIZE);
     return true;
 }
 
+// exec() of another process runs with that process's page directory active and faults in its regions.
+Process& MemoryManager::process_for_page_fault()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    dword cr3;
+    asm volatile("movl %%cr3, %%eax":"=a"(cr3));
+    auto& process = current->process();
+    if (process.page_directory().cr3() == cr3)
+        return process;
+    for (auto* other = g_processes->head(); other; other = other->next()) {
+        if (other->page_directory().cr3() == cr3)
+            return *other;
+    }
+    return process;
+}
+
 PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
 {
     ASSERT_INTERRUPTS_DISABLED();
@@ -372,8 +555,9 @@ PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
 #ifdef PAGE_FAULT_DEBUG
     dbgprintf("MM: handle_page_fault(%w) at L%x\n", fault.code(), fault.laddr().get());
 #endif
-    ASSERT(fault.laddr() != m_quickmap_addr);
-    auto* region = region_from_laddr(current->process(), fault.laddr());
+    ASSERT(fault.laddr().get() < physmap_base || fault.laddr().get() >= physmap_base + physmap_size);
+    TRACE(PageFault, fault.laddr().get(), fault.code());
+    auto* region = region_from_laddr(process_for_page_fault(), fault.laddr());
     if (!region) {
         kprintf("NP(error) fault at invalid address L%x\n", fault.laddr().get());
         return PageFaultResponse::ShouldCrash;
@@ -384,13 +568,17 @@ PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
 #ifdef PAGE_FAULT_DEBUG
             dbgprintf("NP(inode) fault in Region{%p}[%u]\n", region, page_index_in_region);
 #endif
-            page_in_from_inode(*region, page_index_in_region);
+            if (!page_in_from_inode(*region, page_index_in_region))
+                return out_of_memory_response();
+            ++current->statistics().inode_faults;
             return PageFaultResponse::Continue;
         } else {
 #ifdef PAGE_FAULT_DEBUG
             dbgprintf("NP(zero) fault in Region{%p}[%u]\n", region, page_index_in_region);
 #endif
-            zero_page(*region, page_index_in_region);
+            if (!zero_page(*region, page_index_in_region))
+                return out_of_memory_response();
+            ++current->statistics().zero_faults;
             return PageFaultResponse::Continue;
         }
     } else if (fault.is_protection_violation()) {
@@ -398,8 +586,9 @@ PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
 #ifdef PAGE_FAULT_DEBUG
             dbgprintf("PV(cow) fault in Region{%p}[%u]\n", region, page_index_in_region);
 #endif
-            bool success = copy_on_write(*region, page_index_in_region);
-            ASSERT(success);
+            if (!copy_on_write(*region, page_index_in_region))
+                return out_of_memory_response();
+            ++current->statistics().cow_faults;
             return PageFaultResponse::Continue;
         }
         kprintf("PV(error) fault in Region{%p}[%u] at L%x\n", region, page_index_in_region, fault.laddr().get());
@@ -413,23 +602,380 @@ PageFaultResponse MemoryManager::handle_page_fault(const PageFault& fault)
 RetainPtr<PhysicalPage> MemoryManager::allocate_physical_page(ShouldZeroFill should_zero_fill)
 {
     InterruptDisabler disabler;
-    if (1 > m_free_physical_pages.size()) {
-        kprintf("FUCK! No physical pages available.\n");
-        ASSERT_NOT_REACHED();
-        return { };
+    if (should_zero_fill == ShouldZeroFill::Yes && !m_zeroed_physical_pages.is_empty())
+        return m_zeroed_physical_pages.take_last();
+
+    auto* page = m_user_physical_allocator.allocate(0);
+    if (!page && !m_zeroed_physical_pages.is_empty())
+        return m_zeroed_physical_pages.take_last();
+    if (!page) {
+        // Don't wait for reclaimd, see if the caches have something for us right now.
+        if (reclaim_physical_pages(32))
+            page = m_user_physical_allocator.allocate(0);
+        if (!page) {
+            kprintf("MM: No physical pages available!\n");
+            return nullptr;
+        }
     }
+    if (free_physical_page_count() < m_low_watermark)
+        wake_reclaimer();
 #ifdef MM_DEBUG
-    dbgprintf("MM: allocate_physical_page vending P%x (%u remaining)\n", m_free_physical_pages.last()->paddr().get(), m_free_physical_pages.size());
+    dbgprintf("MM: allocate_physical_page vending P%x (%u remaining)\n", page->paddr().get(), free_physical_page_count());
 #endif
-    auto physical_page = m_free_physical_pages.take_last();
-    if (should_zero_fill == ShouldZeroFill::Yes) {
-        auto* ptr = (dword*)quickmap_page(*physical_page);
-        fast_dword_fill(ptr, 0, PAGE_SIZE / sizeof(dword));
-        unquickmap_page();
-    }
+    page->m_retain_count = 1;
+    auto physical_page = adopt(*page);
+    if (should_zero_fill == ShouldZeroFill::Yes)
+        fast_dword_fill((dword*)physmap(*physical_page), 0, PAGE_SIZE / sizeof(dword));
     return physical_page;
 }
 
+Vector<Retained<PhysicalPage>> MemoryManager::allocate_contiguous_physical_pages(size_t count)
+{
+    ASSERT(count);
+    int order = BuddyAllocator::order_for_page_count(count);
+    if (order > BuddyAllocator::max_order)
+        return { };
+    InterruptDisabler disabler;
+    auto* block = m_user_physical_allocator.allocate(order);
+    if (!block)
+        return { };
+    Vector<Retained<PhysicalPage>> pages;
+    pages.ensure_capacity(count);
+    for (size_t i = 0; i < count; ++i) {
+        block[i].m_retain_count = 1;
+        pages.append(adopt(block[i]));
+    }
+    // Give back the tail we rounded up for.
+    for (size_t i = count; i < (1u << order); ++i)
+        m_user_physical_allocator.deallocate(block[i], 0);
+    return pages;
+}
+
+// Enough for a few fresh stacks and heaps worth of zero-fill faults.
+static const int zeroed_page_pool_size = 256;
+
+bool MemoryManager::prezero_one_page()
+{
+    InterruptDisabler disabler;
+    if (m_zeroed_physical_pages.size() >= zeroed_page_pool_size)
+        return false;
+    // Keep a reserve for ShouldZeroFill::No allocations, zeroing those would be wasted effort.
+    if (m_user_physical_allocator.free_page_count() < zeroed_page_pool_size)
+        return false;
+    auto* page = m_user_physical_allocator.allocate(0);
+    ASSERT(page);
+    page->m_retain_count = 1;
+    auto physical_page = adopt(*page);
+    fast_dword_fill((dword*)physmap(*physical_page), 0, PAGE_SIZE / sizeof(dword));
+    m_zeroed_physical_pages.append(move(physical_page));
+    return true;
+}
+
+Vector<Region*> MemoryManager::regions_mapping(VMObject& vmo)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    Vector<Region*> regions;
+    for (auto* region : m_regions) {
+        if (&region->vmo() == &vmo && region->page_directory())
+            regions.append(region);
+    }
+    return regions;
+}
+
+// Calls back for every present PTE mapping the VMO's page_index'th page.
+template<typename Callback>
+void MemoryManager::for_each_mapping(const Vector<Region*>& regions, size_t page_index, Callback callback)
+{
+    for (auto* region : regions) {
+        if (page_index < region->first_page_index() || page_index > region->last_page_index())
+            continue;
+        auto laddr = region->laddr().offset((page_index - region->first_page_index()) * PAGE_SIZE);
+        if (!has_page_table(*region->page_directory(), laddr))
+            continue;
+        auto pte = ensure_pte(*region->page_directory(), laddr);
+        if (pte.is_present())
+            callback(*region, laddr, pte);
+    }
+}
+
+// This is our working set estimate: a page that was touched since the last time we looked is in it.
+// Looking clears the accessed bits, so pages need to stay untouched for a whole pass to get evicted.
+bool MemoryManager::test_and_clear_accessed(const Vector<Region*>& regions, size_t page_index)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    bool recently_used = false;
+    for_each_mapping(regions, page_index, [&] (Region& region, LinearAddress laddr, PageTableEntry& pte) {
+        if (!pte.is_accessed())
+            return;
+        pte.set_accessed(false);
+        region.page_directory()->flush(laddr);
+        recently_used = true;
+    });
+    return recently_used;
+}
+
+void MemoryManager::unmap_vmo_page(const Vector<Region*>& regions, size_t page_index)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    for_each_mapping(regions, page_index, [&] (Region& region, LinearAddress laddr, PageTableEntry& pte) {
+        pte.set_physical_page_base(0);
+        pte.set_present(false);
+        region.page_directory()->flush(laddr);
+    });
+}
+
+size_t MemoryManager::evict_clean_vmo_pages(size_t target)
+{
+    InterruptDisabler disabler;
+    size_t evicted = 0;
+    for (auto* vmo : m_vmos) {
+        if (evicted >= target)
+            break;
+        if (!vmo->inode() || (vmo->inode_offset() % PAGE_SIZE))
+            continue;
+        auto regions = regions_mapping(*vmo);
+        bool has_shared_writable_mapping = false;
+        for (auto* region : regions) {
+            // Writes through those land in the page cache page itself, and nothing writes them back.
+            if (region->is_shared() && region->is_writable())
+                has_shared_writable_mapping = true;
+        }
+        if (has_shared_writable_mapping)
+            continue;
+
+        auto& inode = *vmo->inode();
+        for (size_t i = 0; i < vmo->page_count() && evicted < target; ++i) {
+            auto& physical_page = vmo->physical_pages()[i];
+            if (!physical_page)
+                continue;
+            // Only pages that are still the page cache's copy are clean, we can't get anything else back.
+            auto cached_page = inode.cached_page_if_present(vmo->inode_offset() / PAGE_SIZE + i);
+            if (cached_page.ptr() != physical_page.ptr())
+                continue;
+            if (test_and_clear_accessed(regions, i))
+                continue;
+            unmap_vmo_page(regions, i);
+            physical_page = nullptr;
+            ++evicted;
+        }
+    }
+    return evicted;
+}
+
+size_t MemoryManager::reclaim_physical_pages(size_t target)
+{
+    size_t free_before = free_physical_page_count();
+    Inode::evict_page_cache_pages(target);
+    if (free_physical_page_count() - free_before < target) {
+        // The pages let go of here are still in the page cache, which can drop them now.
+        evict_clean_vmo_pages(target);
+        Inode::evict_page_cache_pages(target);
+    }
+    size_t free_after = free_physical_page_count();
+    return free_after > free_before ? free_after - free_before : 0;
+}
+
+void MemoryManager::retain_swap_slot(dword slot)
+{
+    if (CompressedSwap::is_compressed_slot(slot))
+        CompressedSwap::the().retain_slot(slot);
+    else
+        SwapSpace::the()->retain_slot(slot);
+}
+
+void MemoryManager::release_swap_slot(dword slot)
+{
+    if (CompressedSwap::is_compressed_slot(slot))
+        CompressedSwap::the().release_slot(slot);
+    else
+        SwapSpace::the()->release_slot(slot);
+}
+
+// Pages go to CompressedSwap if they compress and it has room, which costs no I/O. Otherwise to SwapSpace, if there is one.
+size_t MemoryManager::swap_out_pages(size_t target)
+{
+    auto* swap = SwapSpace::the();
+    auto& compressed_swap = CompressedSwap::the();
+    Vector<Retained<VMObject>> vmos;
+    {
+        InterruptDisabler disabler;
+        for (auto* vmo : m_vmos) {
+            if (vmo->is_anonymous() && !vmo->is_physical_range())
+                vmos.append(*vmo);
+        }
+    }
+
+    size_t swapped = 0;
+    for (auto& vmo : vmos) {
+        if (swapped >= target)
+            break;
+        // Holding the paging lock keeps faults from bringing a page back while it's being written out.
+        LOCKER(vmo->m_paging_lock);
+        for (size_t i = 0; i < vmo->page_count() && swapped < target; ++i) {
+            RetainPtr<PhysicalPage> physical_page;
+            dword slot;
+            {
+                InterruptDisabler disabler;
+                auto& vmo_page = vmo->physical_pages()[i];
+                // Pages still shared copy-on-write with another VMObject wouldn't be freed by swapping them.
+                if (!vmo_page || vmo_page->retain_count() != 1)
+                    continue;
+                auto regions = regions_mapping(*vmo);
+                if (test_and_clear_accessed(regions, i))
+                    continue;
+                // Unmapped first, so nothing can write to it while it's copied out.
+                unmap_vmo_page(regions, i);
+                slot = compressed_swap.store(physmap(*vmo_page));
+                if (!slot) {
+                    // The next fault will just map the page again.
+                    if (!swap)
+                        continue;
+                    slot = swap->allocate_slot();
+                    if (!slot)
+                        return swapped;
+                }
+                physical_page = vmo_page.copy_ref();
+            }
+            if (!CompressedSwap::is_compressed_slot(slot)) {
+                bool success = swap->write_page(slot, physmap(*physical_page));
+                if (!success) {
+                    kprintf("MM: Failed to write page to swap slot %u\n", slot);
+                    swap->release_slot(slot);
+                    return swapped;
+                }
+            }
+            InterruptDisabler disabler;
+            if (vmo->m_swap_slots.is_empty()) {
+                vmo->m_swap_slots.resize(vmo->page_count());
+                for (size_t j = 0; j < vmo->page_count(); ++j)
+                    vmo->m_swap_slots[j] = 0;
+            }
+            vmo->m_swap_slots[i] = slot;
+            vmo->physical_pages()[i] = nullptr;
+            ++swapped;
+        }
+    }
+    return swapped;
+}
+
+// Called from zero_page() with the VMObject's paging lock held.
+bool MemoryManager::swap_in(Region& region, unsigned page_index_in_region, dword slot)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto& vmo = region.vmo();
+    size_t page_index = region.first_page_index() + page_index_in_region;
+    auto physical_page = allocate_physical_page(ShouldZeroFill::No);
+    if (!physical_page)
+        return false;
+    bool success;
+    if (CompressedSwap::is_compressed_slot(slot)) {
+        success = CompressedSwap::the().load(slot, physmap(*physical_page));
+    } else {
+        sti();
+        success = SwapSpace::the()->read_page(slot, physmap(*physical_page));
+        cli();
+    }
+    if (!success) {
+        kprintf("MM: Failed to read page from swap slot %u\n", slot);
+        return false;
+    }
+#ifdef PAGE_FAULT_DEBUG
+    dbgprintf("      >> SWAP IN P%x <- slot %u\n", physical_page->paddr().get(), slot);
+#endif
+    vmo.m_swap_slots[page_index] = 0;
+    release_swap_slot(slot);
+    vmo.physical_pages()[page_index] = move(physical_page);
+    remap_region_page(region, page_index_in_region, true);
+    return true;
+}
+
+void MemoryManager::wake_reclaimer()
+{
+    InterruptDisabler disabler;
+    if (m_reclaimer && m_reclaimer->state() == Thread::BlockedSleep)
+        m_reclaimer->unblock();
+}
+
+void MemoryManager::kmalloc_is_running_low()
+{
+    if (s_the)
+        s_the->wake_reclaimer();
+}
+
+static bool kmalloc_is_below_watermark()
+{
+    return sum_free < (sum_alloc + sum_free) / 8;
+}
+
+void MemoryManager::reclaim_to_watermarks()
+{
+    if (kmalloc_is_below_watermark()) {
+        // Cached blocks and inodes live on the kmalloc heap.
+        DiskBackedFS::drop_cached_blocks(DiskBackedFS::block_cache_stats().size / 2);
+        FS::release_unused_inodes_everywhere();
+    }
+    if (free_physical_page_count() >= m_low_watermark)
+        return;
+    bool released_inodes = false;
+    bool swapped = false;
+    while (free_physical_page_count() < m_high_watermark) {
+        if (reclaim_physical_pages(32))
+            continue;
+        if (!released_inodes) {
+            // Unused inodes take their page cache with them.
+            FS::release_unused_inodes_everywhere();
+            released_inodes = true;
+            continue;
+        }
+        // Swap only once per round, so a page has to go untouched since the previous round to be picked.
+        if (swapped || !swap_out_pages(m_high_watermark - free_physical_page_count()))
+            break;
+        swapped = true;
+    }
+    dbgprintf("MM: reclaimd: %u physical pages free\n", free_physical_page_count());
+}
+
+// Picks the process with the most memory resident and sends it SIGKILL.
+// Returns false if there's nobody to kill, in which case the caller is on its own.
+bool MemoryManager::kill_for_memory()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    // Give the last victim a chance to die before picking another one.
+    if (m_oom_victim_pid) {
+        auto* previous_victim = Process::from_pid(m_oom_victim_pid);
+        if (previous_victim && !previous_victim->is_dead())
+            return true;
+    }
+    Process* victim = nullptr;
+    size_t victim_size = 0;
+    Process::for_each([&] (Process& process) {
+        if (process.is_ring0() || process.is_dead() || process.pid() == 1)
+            return true;
+        size_t size = process.amount_resident();
+        if (size > victim_size) {
+            victim = &process;
+            victim_size = size;
+        }
+        return true;
+    });
+    if (!victim)
+        return false;
+    kprintf("MM: Out of memory! Killing %s(%u) with %u kB resident\n", victim->name().characters(), victim->pid(), victim_size / 1024);
+    m_oom_victim_pid = victim->pid();
+    victim->send_signal(SIGKILL, nullptr);
+    return true;
+}
+
+PageFaultResponse MemoryManager::out_of_memory_response()
+{
+    if (!kill_for_memory())
+        return PageFaultResponse::ShouldCrash;
+    // If we're the one going away, there's no point in waiting for memory.
+    if (current->pid() == m_oom_victim_pid)
+        return PageFaultResponse::ShouldCrash;
+    return PageFaultResponse::OutOfMemory;
+}
+
 RetainPtr<PhysicalPage> MemoryManager::allocate_supervisor_physical_page()
 {
     InterruptDisabler disabler;
@@ -469,6 +1015,27 @@ void MemoryManager::flush_entire_tlb()
     );
 }
 
+void MemoryManager::defer_tlb_flush(LinearAddress laddr)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    // Past this many, reloading CR3 is cheaper than an invlpg each.
+    if (m_deferred_tlb_flush_count == max_deferred_tlb_flushes)
+        return;
+    m_deferred_tlb_flushes[m_deferred_tlb_flush_count++] = laddr;
+}
+
+void MemoryManager::flush_deferred_tlb()
+{
+    InterruptDisabler disabler;
+    if (m_deferred_tlb_flush_count == max_deferred_tlb_flushes) {
+        flush_entire_tlb();
+    } else {
+        for (int i = 0; i < m_deferred_tlb_flush_count; ++i)
+            flush_tlb(m_deferred_tlb_flushes[i]);
+    }
+    m_deferred_tlb_flush_count = 0;
+}
+
 void MemoryManager::flush_tlb(LinearAddress laddr)
 {
     asm volatile("invlpg %0": :"m" (*(char*)laddr.get()) : "memory");
@@ -478,48 +1045,83 @@ void MemoryManager::map_for_kernel(LinearAddress laddr, PhysicalAddress paddr)
 {
     auto pte = ensure_pte(kernel_page_directory(), laddr);
     pte.set_physical_page_base(paddr.get());
+    pte.set_global(true);
     pte.set_present(true);
     pte.set_writable(true);
     pte.set_user_allowed(false);
     flush_tlb(laddr);
 }
 
-byte* MemoryManager::quickmap_page(PhysicalPage& physical_page)
+static const dword kernel_stack_slot_size = PAGE_SIZE + kernel_stack_size;
+static const int kernel_stack_slot_count = kernel_stack_area_size / kernel_stack_slot_size;
+// How many freed stacks hang on to their pages, the rest give them back.
+static const int max_cached_kernel_stacks = 64;
+
+void MemoryManager::initialize_kernel_stacks()
+{
+    // The page tables have to be there before any other page directory gets created, they only copy the kernel's PDEs.
+    for (dword laddr = kernel_stack_area_base; laddr < kernel_stack_area_base + kernel_stack_area_size; laddr += 4 * MB)
+        ensure_pte(kernel_page_directory(), LinearAddress(laddr));
+    m_kernel_stack_slots = new KernelStackSlot[kernel_stack_slot_count];
+    m_free_kernel_stack_slots.ensure_capacity(kernel_stack_slot_count);
+    for (int i = kernel_stack_slot_count - 1; i >= 0; --i)
+        m_free_kernel_stack_slots.unchecked_append(i);
+}
+
+void* MemoryManager::allocate_kernel_stack()
 {
-    ASSERT_INTERRUPTS_DISABLED();
-    ASSERT(!m_quickmap_in_use);
-    m_quickmap_in_use = true;
-    auto page_laddr = m_quickmap_addr;
-    auto pte = ensure_pte(kernel_page_directory(), page_laddr);
-    pte.set_physical_page_base(physical_page.paddr().get());
-    pte.set_present(true);
-    pte.set_writable(true);
-    pte.set_user_allowed(false);
-    flush_tlb(page_laddr);
-    ASSERT((dword)pte.physical_page_base() == physical_page.paddr().get());
-#ifdef MM_DEBUG
-    dbgprintf("MM: >> quickmap_page L%x => P%x @ PTE=%p\n", page_laddr, physical_page.paddr().get(), pte.ptr());
-#endif
-    return page_laddr.as_ptr();
+    InterruptDisabler disabler;
+    if (m_free_kernel_stack_slots.is_empty())
+        return kmalloc(kernel_stack_size);
+    int index = m_free_kernel_stack_slots.take_last();
+    auto& slot = m_kernel_stack_slots[index];
+    dword stack_bottom = kernel_stack_area_base + index * kernel_stack_slot_size + PAGE_SIZE;
+    if (slot.pages[0]) {
+        --m_kernel_stacks_with_pages_cached;
+        return (void*)stack_bottom;
+    }
+    for (int i = 0; i < (int)(kernel_stack_size / PAGE_SIZE); ++i) {
+        slot.pages[i] = allocate_physical_page(ShouldZeroFill::No);
+        if (!slot.pages[i]) {
+            for (int j = 0; j < i; ++j) {
+                auto pte = ensure_pte(kernel_page_directory(), LinearAddress(stack_bottom + j * PAGE_SIZE));
+                pte.set_present(false);
+                flush_tlb(LinearAddress(stack_bottom + j * PAGE_SIZE));
+                slot.pages[j] = nullptr;
+            }
+            m_free_kernel_stack_slots.append(index);
+            return kmalloc(kernel_stack_size);
+        }
+        map_for_kernel(LinearAddress(stack_bottom + i * PAGE_SIZE), slot.pages[i]->paddr());
+    }
+    return (void*)stack_bottom;
 }
 
-void MemoryManager::unquickmap_page()
+void MemoryManager::deallocate_kernel_stack(void* stack)
 {
-    ASSERT_INTERRUPTS_DISABLED();
-    ASSERT(m_quickmap_in_use);
-    auto page_laddr = m_quickmap_addr;
-    auto pte = ensure_pte(kernel_page_directory(), page_laddr);
-#ifdef MM_DEBUG
-    auto old_physical_address = pte.physical_page_base();
-#endif
-    pte.set_physical_page_base(0);
-    pte.set_present(false);
-    pte.set_writable(false);
-    flush_tlb(page_laddr);
-#ifdef MM_DEBUG
-    dbgprintf("MM: >> unquickmap_page L%x =/> P%x\n", page_laddr, old_physical_address);
-#endif
-    m_quickmap_in_use = false;
+    dword stack_bottom = (dword)stack;
+    if (stack_bottom < kernel_stack_area_base || stack_bottom >= kernel_stack_area_base + kernel_stack_area_size) {
+        kfree(stack);
+        return;
+    }
+    InterruptDisabler disabler;
+    int index = (stack_bottom - kernel_stack_area_base) / kernel_stack_slot_size;
+    ASSERT(stack_bottom == kernel_stack_area_base + index * kernel_stack_slot_size + PAGE_SIZE);
+    if (m_kernel_stacks_with_pages_cached < max_cached_kernel_stacks) {
+        ++m_kernel_stacks_with_pages_cached;
+        m_free_kernel_stack_slots.append(index);
+        return;
+    }
+    auto& slot = m_kernel_stack_slots[index];
+    for (int i = 0; i < (int)(kernel_stack_size / PAGE_SIZE); ++i) {
+        auto laddr = LinearAddress(stack_bottom + i * PAGE_SIZE);
+        auto pte = ensure_pte(kernel_page_directory(), laddr);
+        pte.set_present(false);
+        flush_tlb(laddr);
+        slot.pages[i] = nullptr;
+    }
+    // Behind the ones that still have pages, so those get used first.
+    m_free_kernel_stack_slots.insert(0, int(index));
 }
 
 void MemoryManager::remap_region_page(Region& region, unsigned page_index_in_region, bool user_allowed)
@@ -528,7 +1130,7 @@ void MemoryManager::remap_region_page(Region& region, unsigned page_index_in_reg
     InterruptDisabler disabler;
     auto page_laddr = region.laddr().offset(page_index_in_region * PAGE_SIZE);
     auto pte = ensure_pte(*region.page_directory(), page_laddr);
-    auto& physical_page = region.vmo().physical_pages()[page_index_in_region];
+    auto& physical_page = region.vmo().physical_pages()[region.first_page_index() + page_index_in_region];
     ASSERT(physical_page);
     pte.set_physical_page_base(physical_page->paddr().get());
     pte.set_present(true); // FIXME: Maybe we should use the is_readable flag here?
@@ -562,6 +1164,10 @@ void MemoryManager::map_region_at_address(PageDirectory& page_directory, Region&
 #endif
     for (size_t i = 0; i < region.page_count(); ++i) {
         auto page_laddr = laddr.offset(i * PAGE_SIZE);
+        if (try_map_huge_page(page_directory, region, page_laddr, i, user_allowed)) {
+            i += (4 * MB) / PAGE_SIZE - 1;
+            continue;
+        }
         auto pte = ensure_pte(page_directory, page_laddr);
         auto& physical_page = vmo.physical_pages()[region.first_page_index() + i];
         if (physical_page) {
@@ -593,6 +1199,13 @@ bool MemoryManager::unmap_region(Region& region)
     InterruptDisabler disabler;
     for (size_t i = 0; i < region.page_count(); ++i) {
         auto laddr = region.laddr().offset(i * PAGE_SIZE);
+        if (unmap_huge_page(*region.page_directory(), laddr)) {
+            i += (4 * MB) / PAGE_SIZE - 1;
+            continue;
+        }
+        // Lazily mapped regions may never have had a page table built for them, don't build one now.
+        if (!has_page_table(*region.page_directory(), laddr))
+            continue;
         auto pte = ensure_pte(*region.page_directory(), laddr);
         pte.set_physical_page_base(0);
         pte.set_present(false);
@@ -614,6 +1227,34 @@ bool MemoryManager::map_region(Process& process, Region& region)
     return true;
 }
 
+// Give the region to the process without writing any page table entries. Its pages get mapped in
+// by the page fault handler the first time they're touched, so untouched memory costs nothing.
+bool MemoryManager::map_region_lazily(Process& process, Region& region)
+{
+    InterruptDisabler disabler;
+    region.set_page_directory(process.page_directory());
+    return true;
+}
+
+// Revoke write access to the region's mapped pages without flushing the TLB for each of them.
+// The caller is expected to flush once it's done with all its regions.
+void MemoryManager::write_protect_region(Region& region)
+{
+    ASSERT(region.page_directory());
+    InterruptDisabler disabler;
+    for (size_t i = 0; i < region.page_count(); ++i) {
+        auto page_laddr = region.laddr().offset(i * PAGE_SIZE);
+        if (!has_page_table(*region.page_directory(), page_laddr))
+            continue;
+        auto pte = ensure_pte(*region.page_directory(), page_laddr);
+        if (pte.is_present() && pte.is_writable()) {
+            pte.set_writable(false);
+            if (current && &current->process().page_directory() == region.page_directory())
+                defer_tlb_flush(page_laddr);
+        }
+    }
+}
+
 bool MemoryManager::validate_user_read(const Process& process, LinearAddress laddr) const
 {
     auto* region = region_from_laddr(process, laddr);
@@ -626,6 +1267,28 @@ bool MemoryManager::validate_user_write(const Process& process, LinearAddress la
     return region && region->is_writable();
 }
 
+bool MemoryManager::can_read_without_faulting(Process& process, LinearAddress laddr, size_t size)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(size);
+    if (laddr.get() + size < laddr.get())
+        return false;
+    dword first_page = laddr.get() & PAGE_MASK;
+    dword page_count = (((laddr.get() + size - 1) & PAGE_MASK) - first_page) / PAGE_SIZE + 1;
+    for (dword i = 0; i < page_count; ++i) {
+        dword page = first_page + i * PAGE_SIZE;
+        PageDirectoryEntry pde(&process.page_directory().entries()[page >> 22]);
+        if (!pde.is_present())
+            return false;
+        if (pde.is_huge())
+            continue;
+        PageTableEntry pte(&pde.page_table_base()[(page >> 12) & 0x3ff]);
+        if (!pte.is_present())
+            return false;
+    }
+    return true;
+}
+
 Retained<Region> Region::clone()
 {
     ASSERT(current);
@@ -649,12 +1312,44 @@ Retained<Region> Region::clone()
               laddr().get());
 #endif
     // Set up a COW region. The parent (this) region becomes COW as well!
+    // NOTE: The caller has to flush_deferred_tlb() before the parent touches this region again.
     for (size_t i = 0; i < page_count(); ++i)
         m_cow_map.set(i, true);
-    MM.remap_region(current->process().page_directory(), *this);
+    MM.write_protect_region(*this);
     return adopt(*new Region(laddr(), size(), m_vmo->clone(), m_offset_in_vmo, String(m_name), m_readable, m_writable, true));
 }
 
+Retained<Region> Region::move_to(LinearAddress laddr, size_t size)
+{
+    ASSERT(m_vmo->is_anonymous() && !m_vmo->is_physical_range());
+    ASSERT(!m_offset_in_vmo);
+    auto vmo = VMObject::create_anonymous(size);
+    vmo->set_name(m_name);
+    auto& old_vmo = *m_vmo;
+    size_t moved_page_count = min(old_vmo.page_count(), vmo->page_count());
+
+    // Holding the paging lock keeps the pages from being swapped out while they're moved.
+    LOCKER(old_vmo.m_paging_lock);
+    InterruptDisabler disabler;
+    for (size_t i = 0; i < moved_page_count; ++i)
+        vmo->m_physical_pages[i] = move(old_vmo.m_physical_pages[i]);
+    if (!old_vmo.m_swap_slots.is_empty()) {
+        vmo->m_swap_slots.resize(vmo->page_count());
+        for (size_t i = 0; i < vmo->page_count(); ++i)
+            vmo->m_swap_slots[i] = 0;
+        for (size_t i = 0; i < moved_page_count; ++i) {
+            vmo->m_swap_slots[i] = old_vmo.m_swap_slots[i];
+            old_vmo.m_swap_slots[i] = 0;
+        }
+    }
+
+    auto region = adopt(*new Region(laddr, size, move(vmo), 0, String(m_name), m_readable, m_writable));
+    // Pages still shared copy-on-write with a forked process stay that way.
+    for (size_t i = 0; i < moved_page_count; ++i)
+        region->m_cow_map.set(i, m_cow_map.get(i));
+    return region;
+}
+
 Region::Region(LinearAddress a, size_t s, String&& n, bool r, bool w, bool cow)
     : m_laddr(a)
     , m_size(s)
@@ -731,11 +1426,12 @@ void PhysicalPage::return_to_freelist()
 {
     ASSERT((paddr().get() & ~PAGE_MASK) == 0);
     InterruptDisabler disabler;
-    m_retain_count = 1;
-    if (m_supervisor)
+    if (m_supervisor) {
+        m_retain_count = 1;
         MM.m_free_supervisor_physical_pages.append(adopt(*this));
-    else
-        MM.m_free_physical_pages.append(adopt(*this));
+    } else {
+        MM.m_user_physical_allocator.deallocate(*this, 0);
+    }
 #ifdef MM_DEBUG
     dbgprintf("MM: P%x released to freelist\n", m_paddr.get());
 #endif
@@ -751,6 +1447,13 @@ Retained<VMObject> VMObject::create_file_backed(RetainPtr<Inode>&& inode)
     return vmo;
 }
 
+Retained<VMObject> VMObject::create_private_file_backed(RetainPtr<Inode>&& inode)
+{
+    auto vmo = adopt(*new VMObject(move(inode)));
+    vmo->m_private = true;
+    return vmo;
+}
+
 Retained<VMObject> VMObject::create_anonymous(size_t size)
 {
     size = ceil_div(size, PAGE_SIZE) * PAGE_SIZE;
@@ -762,6 +1465,7 @@ Retained<VMObject> VMObject::create_for_physical_range(PhysicalAddress paddr, si
     size = ceil_div(size, PAGE_SIZE) * PAGE_SIZE;
     auto vmo = adopt(*new VMObject(paddr, size));
     vmo->m_allow_cpu_caching = false;
+    vmo->m_physical_range = true;
     return vmo;
 }
 
@@ -775,9 +1479,15 @@ VMObject::VMObject(VMObject& other)
     , m_anonymous(other.m_anonymous)
     , m_inode_offset(other.m_inode_offset)
     , m_size(other.m_size)
+    , m_private(true)
     , m_inode(other.m_inode)
     , m_physical_pages(other.m_physical_pages)
+    , m_swap_slots(other.m_swap_slots)
 {
+    for (auto slot : m_swap_slots) {
+        if (slot)
+            MM.retain_swap_slot(slot);
+    }
     MM.register_vmo(*this);
 }
 
@@ -812,8 +1522,12 @@ VMObject::VMObject(RetainPtr<Inode>&& inode)
 
 VMObject::~VMObject()
 {
-    if (m_inode)
+    if (m_inode && !m_private)
         ASSERT(m_inode->vmo() == this);
+    for (auto slot : m_swap_slots) {
+        if (slot)
+            MM.release_swap_slot(slot);
+    }
     MM.unregister_vmo(*this);
 }
 
@@ -877,9 +1591,7 @@ void VMObject::inode_contents_changed(Badge<Inode>, off_t offset, ssize_t size,
         size_t page_index = to_page_index(current_offset);
         size_t bytes_to_copy = min(size, PAGE_SIZE - (current_offset & PAGE_MASK));
         if (m_physical_pages[page_index]) {
-            auto* ptr = MM.quickmap_page(*m_physical_pages[page_index]);
-            memcpy(ptr, data_ptr, bytes_to_copy);
-            MM.unquickmap_page();
+            memcpy(MM.physmap(*m_physical_pages[page_index]), data_ptr, bytes_to_copy);
         }
         current_offset += bytes_to_copy;
         data += bytes_to_copy;
@@ -889,9 +1601,7 @@ void VMObject::inode_contents_changed(Badge<Inode>, off_t offset, ssize_t size,
     for (size_t page_index = to_page_index(current_offset); page_index < m_physical_pages.size(); ++page_index) {
         size_t bytes_to_copy = PAGE_SIZE - (current_offset & PAGE_MASK);
         if (m_physical_pages[page_index]) {
-            auto* ptr = MM.quickmap_page(*m_physical_pages[page_index]);
-            memcpy(ptr, data_ptr, bytes_to_copy);
-            MM.unquickmap_page();
+            memcpy(MM.physmap(*m_physical_pages[page_index]), data_ptr, bytes_to_copy);
         }
         current_offset += bytes_to_copy;
         data += bytes_to_copy;
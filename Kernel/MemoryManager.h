@@ -8,37 +8,56 @@
 #include <AK/RetainPtr.h>
 #include <AK/Vector.h>
 #include <AK/HashTable.h>
+#include <AK/InlineLinkedList.h>
+#include <AK/IntrusiveRedBlackTree.h>
 #include <AK/AKString.h>
 #include <AK/Badge.h>
 #include <AK/Weakable.h>
 #include <Kernel/VirtualFileSystem.h>
+#include <Kernel/BuddyAllocator.h>
+#include <Kernel/i8253.h>
 
 #define PAGE_ROUND_UP(x) ((((dword)(x)) + PAGE_SIZE-1) & (~(PAGE_SIZE-1)))
 
+// All physical memory is mapped into the kernel half of every address space, starting here.
+static const dword physmap_base = 0xc0000000;
+static const dword physmap_size = 256 * MB;
+
+// Kernel stacks get their own part of the kernel half, right above the physmap.
+static const dword kernel_stack_area_base = physmap_base + physmap_size;
+static const dword kernel_stack_area_size = 8 * MB;
+static const dword kernel_stack_size = 16384;
+
 class SynthFSInode;
 
 enum class PageFaultResponse {
     ShouldCrash,
     Continue,
+    // No memory to resolve the fault with right now. The OOM killer is on it, retry after yielding.
+    OutOfMemory,
 };
 
-class PhysicalPage {
+class PhysicalPage : public InlineLinkedListNode<PhysicalPage> {
     friend class MemoryManager;
     friend class PageDirectory;
     friend class VMObject;
+    friend class BuddyAllocator;
+    friend class InlineLinkedListNode<PhysicalPage>;
 public:
     PhysicalAddress paddr() const { return m_paddr; }
 
+    // Atomic like Retainable's, pages get shared between address spaces and whoever is faulting them in.
     void retain()
     {
-        ASSERT(m_retain_count);
-        ++m_retain_count;
+        auto old_retain_count = __atomic_fetch_add(&m_retain_count, 1, __ATOMIC_RELAXED);
+        ASSERT(old_retain_count);
     }
 
     void release()
     {
-        ASSERT(m_retain_count);
-        if (!--m_retain_count) {
+        auto old_retain_count = __atomic_fetch_sub(&m_retain_count, 1, __ATOMIC_ACQ_REL);
+        ASSERT(old_retain_count);
+        if (old_retain_count == 1) {
             if (m_may_return_to_freelist)
                 return_to_freelist();
             else
@@ -49,7 +68,7 @@ public:
     static Retained<PhysicalPage> create_eternal(PhysicalAddress, bool supervisor);
     static Retained<PhysicalPage> create(PhysicalAddress, bool supervisor);
 
-    unsigned short retain_count() const { return m_retain_count; }
+    unsigned short retain_count() const { return __atomic_load_n(&m_retain_count, __ATOMIC_RELAXED); }
 
 private:
     PhysicalPage(PhysicalAddress paddr, bool supervisor, bool may_return_to_freelist = true);
@@ -60,7 +79,11 @@ private:
     unsigned short m_retain_count { 1 };
     bool m_may_return_to_freelist { true };
     bool m_supervisor { false };
+    // While the page heads a free block in a BuddyAllocator, this is the block's order. Otherwise -1.
+    signed char m_buddy_order { -1 };
     PhysicalAddress m_paddr;
+    PhysicalPage* m_prev { nullptr };
+    PhysicalPage* m_next { nullptr };
 };
 
 class PageDirectory : public Retainable<PageDirectory> {
@@ -85,14 +108,18 @@ private:
 
 class VMObject : public Retainable<VMObject>, public Weakable<VMObject> {
     friend class MemoryManager;
+    friend class Region;
 public:
     static Retained<VMObject> create_file_backed(RetainPtr<Inode>&&);
+    static Retained<VMObject> create_private_file_backed(RetainPtr<Inode>&&);
     static Retained<VMObject> create_anonymous(size_t);
     static Retained<VMObject> create_for_physical_range(PhysicalAddress, size_t);
     Retained<VMObject> clone();
 
     ~VMObject();
     bool is_anonymous() const { return m_anonymous; }
+    // Backed by a fixed range of physical memory (e.g a framebuffer) rather than allocated pages.
+    bool is_physical_range() const { return m_physical_range; }
 
     Inode* inode() { return m_inode.ptr(); }
     const Inode* inode() const { return m_inode.ptr(); }
@@ -110,6 +137,9 @@ public:
 
     size_t size() const { return m_size; }
 
+    // The SwapSpace or CompressedSwap slot holding the page_index'th page while it's swapped out, otherwise 0.
+    dword swap_slot(size_t page_index) const { return page_index < (size_t)m_swap_slots.size() ? m_swap_slots[page_index] : 0; }
+
 private:
     VMObject(RetainPtr<Inode>&&);
     explicit VMObject(VMObject&);
@@ -123,12 +153,17 @@ private:
     off_t m_inode_offset { 0 };
     size_t m_size { 0 };
     bool m_allow_cpu_caching { true };
+    bool m_physical_range { false };
+    // Private file-backed VMOs aren't the inode's VMO, and don't follow changes to it.
+    bool m_private { false };
     RetainPtr<Inode> m_inode;
     Vector<RetainPtr<PhysicalPage>> m_physical_pages;
+    // Empty until the first page gets swapped out.
+    Vector<dword> m_swap_slots;
     Lock m_paging_lock;
 };
 
-class Region : public Retainable<Region> {
+class Region : public Retainable<Region>, public RedBlackTreeNode<Region> {
     friend class MemoryManager;
 public:
     Region(LinearAddress, size_t, String&&, bool r, bool w, bool cow = false);
@@ -154,6 +189,9 @@ public:
     void set_is_bitmap(bool b) { m_is_bitmap = b; }
 
     Retained<Region> clone();
+    // The same anonymous memory as a new region at |laddr| of |size|, for mremap(). The pages are moved
+    // over rather than copied, anything past |size| is dropped, and this region is left with none.
+    Retained<Region> move_to(LinearAddress laddr, size_t size);
     bool contains(LinearAddress laddr) const
     {
         return laddr >= m_laddr && laddr < m_laddr.offset(size());
@@ -203,6 +241,11 @@ public:
 
     void set_writable(bool b) { m_writable = b; }
 
+    // What madvise() told us about how the region will be accessed. It decides how much a fault pulls in around itself.
+    enum class AccessPattern { Normal, Sequential, Random };
+    AccessPattern access_pattern() const { return m_access_pattern; }
+    void set_access_pattern(AccessPattern pattern) { m_access_pattern = pattern; }
+
 private:
     RetainPtr<PageDirectory> m_page_directory;
     LinearAddress m_laddr;
@@ -214,6 +257,7 @@ private:
     bool m_writable { true };
     bool m_shared { false };
     bool m_is_bitmap { false };
+    AccessPattern m_access_pattern { AccessPattern::Normal };
     Bitmap m_cow_map;
 };
 
@@ -221,10 +265,14 @@ private:
 
 class MemoryManager {
     AK_MAKE_ETERNAL
+    friend class Inode;
+    friend class TmpFSInode;
     friend class PageDirectory;
     friend class PhysicalPage;
     friend class Region;
     friend class VMObject;
+    friend class RingBuffer;
+    friend void PIT::initialize();
     friend ByteBuffer procfs$mm(InodeIdentifier);
     friend ByteBuffer procfs$memstat(InodeIdentifier);
 public:
@@ -235,6 +283,7 @@ public:
     PageFaultResponse handle_page_fault(const PageFault&);
 
     bool map_region(Process&, Region&);
+    bool map_region_lazily(Process&, Region&);
     bool unmap_region(Region&);
 
     void populate_page_directory(PageDirectory&);
@@ -244,21 +293,59 @@ public:
 
     bool validate_user_read(const Process&, LinearAddress) const;
     bool validate_user_write(const Process&, LinearAddress) const;
+    // Whether reading |size| bytes at |laddr| in |process| is sure not to fault right now, for those who look
+    // at memory where a fault can't be taken, like the profiler in the timer interrupt.
+    bool can_read_without_faulting(Process&, LinearAddress, size_t size);
 
     enum class ShouldZeroFill { No, Yes };
 
     RetainPtr<PhysicalPage> allocate_physical_page(ShouldZeroFill);
     RetainPtr<PhysicalPage> allocate_supervisor_physical_page();
 
+    // The physmap is always there, so this works from any context and needs no unmapping.
+    byte* physmap(PhysicalPage& physical_page) { return (byte*)(physmap_base + physical_page.paddr().get()); }
+
+    // Physically contiguous, and aligned to the allocation size rounded up to a power of two. For DMA and the like.
+    Vector<Retained<PhysicalPage>> allocate_contiguous_physical_pages(size_t count);
+
+    // Zeroes one free page ahead of time for a future zero-fill fault. Returns false if the pool is full already.
+    // The idle loop calls this when there's nothing better to do.
+    bool prezero_one_page();
+
+    size_t free_physical_page_count() const { return m_user_physical_allocator.free_page_count() + m_zeroed_physical_pages.size(); }
+
+    // Gets physical pages back from the page cache and clean file-backed mappings. Returns how many were freed.
+    size_t reclaim_physical_pages(size_t target);
+    // What reclaimd does: shrink the caches until physical memory and the kmalloc heap are back above their watermarks.
+    void reclaim_to_watermarks();
+    void set_reclaimer(Thread& thread) { m_reclaimer = &thread; }
+    static void kmalloc_is_running_low();
+
     void remap_region(PageDirectory&, Region&);
+    void write_protect_region(Region&);
+    // Reloads CR3, which keeps the global kernel mappings.
+    void flush_entire_tlb();
+    // Flushes a page now if only a few are pending, or all of the user mappings in flush_deferred_tlb() otherwise.
+    // For batches of changes to the current address space.
+    void defer_tlb_flush(LinearAddress);
+    void flush_deferred_tlb();
 
     size_t ram_size() const { return m_ram_size; }
 
+    // For VMObject page swap slots, from either SwapSpace or CompressedSwap.
+    void retain_swap_slot(dword);
+    void release_swap_slot(dword);
+
     int user_physical_pages_in_existence() const { return s_user_physical_pages_in_existence; }
     int super_physical_pages_in_existence() const { return s_super_physical_pages_in_existence; }
 
     void map_for_kernel(LinearAddress, PhysicalAddress);
 
+    // Each stack has an unmapped guard page below it, so running off the end faults instead of trashing a neighbour.
+    // Freed stacks keep their pages for the next thread. Falls back to kmalloc() once the stack area is used up.
+    void* allocate_kernel_stack();
+    void deallocate_kernel_stack(void*);
+
 private:
     MemoryManager();
     ~MemoryManager();
@@ -272,7 +359,7 @@ private:
     void remap_region_page(Region&, unsigned page_index_in_region, bool user_allowed);
 
     void initialize_paging();
-    void flush_entire_tlb();
+    void initialize_kernel_stacks();
     void flush_tlb(LinearAddress);
 
     RetainPtr<PhysicalPage> allocate_page_table(PageDirectory&, unsigned index);
@@ -284,14 +371,23 @@ private:
 
     static Region* region_from_laddr(Process&, LinearAddress);
     static const Region* region_from_laddr(const Process&, LinearAddress);
+    Process& process_for_page_fault();
 
     bool copy_on_write(Region&, unsigned page_index_in_region);
     bool page_in_from_inode(Region&, unsigned page_index_in_region);
+    size_t evict_clean_vmo_pages(size_t target);
+    size_t swap_out_pages(size_t target);
+    bool swap_in(Region&, unsigned page_index_in_region, dword slot);
+    Vector<Region*> regions_mapping(VMObject&);
+    template<typename Callback> void for_each_mapping(const Vector<Region*>&, size_t page_index_in_vmo, Callback);
+    bool test_and_clear_accessed(const Vector<Region*>&, size_t page_index_in_vmo);
+    void unmap_vmo_page(const Vector<Region*>&, size_t page_index_in_vmo);
+    void wake_reclaimer();
+    bool kill_for_memory();
+    PageFaultResponse out_of_memory_response();
+    void map_cached_page(Region&, unsigned page_index_in_region);
     bool zero_page(Region& region, unsigned page_index_in_region);
 
-    byte* quickmap_page(PhysicalPage&);
-    void unquickmap_page();
-
     PageDirectory& kernel_page_directory() { return *m_kernel_page_directory; }
 
     struct PageDirectoryEntry {
@@ -313,6 +409,8 @@ private:
             UserSupervisor = 1 << 2,
             WriteThrough = 1 << 3,
             CacheDisabled = 1 << 4,
+            Huge = 1 << 7,
+            Global = 1 << 8,
         };
 
         bool is_present() const { return raw() & Present; }
@@ -330,7 +428,14 @@ private:
         bool is_cache_disabled() const { return raw() & CacheDisabled; }
         void set_cache_disabled(bool b) { set_bit(CacheDisabled, b); }
 
-        void set_bit(byte bit, bool value)
+        // A 4 MB page (PSE), the entry maps memory directly instead of pointing to a page table.
+        bool is_huge() const { return raw() & Huge; }
+        void set_huge(bool b) { set_bit(Huge, b); }
+
+        // Only means something for huge pages, see PageTableEntry::set_global().
+        void set_global(bool b) { set_bit(Global, b); }
+
+        void set_bit(dword bit, bool value)
         {
             if (value)
                 *m_pde |= bit;
@@ -360,6 +465,8 @@ private:
             UserSupervisor = 1 << 2,
             WriteThrough = 1 << 3,
             CacheDisabled = 1 << 4,
+            Accessed = 1 << 5,
+            Global = 1 << 8,
         };
 
         bool is_present() const { return raw() & Present; }
@@ -377,7 +484,16 @@ private:
         bool is_cache_disabled() const { return raw() & CacheDisabled; }
         void set_cache_disabled(bool b) { set_bit(CacheDisabled, b); }
 
-        void set_bit(byte bit, bool value)
+        // Set by the CPU whenever the page is touched.
+        bool is_accessed() const { return raw() & Accessed; }
+        void set_accessed(bool b) { set_bit(Accessed, b); }
+
+        // With CR4.PGE, the TLB keeps these across CR3 loads. Only for mappings every page directory has,
+        // and changing one needs an invlpg.
+        bool is_global() const { return raw() & Global; }
+        void set_global(bool b) { set_bit(Global, b); }
+
+        void set_bit(dword bit, bool value)
         {
             if (value)
                 *m_pte |= bit;
@@ -392,20 +508,43 @@ private:
     static unsigned s_super_physical_pages_in_existence;
 
     PageTableEntry ensure_pte(PageDirectory&, LinearAddress);
+    bool has_page_table(PageDirectory&, LinearAddress);
+    bool try_map_huge_page(PageDirectory&, Region&, LinearAddress, unsigned page_index_in_region, bool user_allowed);
+    bool unmap_huge_page(PageDirectory&, LinearAddress);
 
     RetainPtr<PageDirectory> m_kernel_page_directory;
     dword* m_page_table_zero;
 
-    LinearAddress m_quickmap_addr;
 
-    Vector<Retained<PhysicalPage>> m_free_physical_pages;
+    BuddyAllocator m_user_physical_allocator;
+    // Free pages that have already been zeroed, see prezero_one_page().
+    Vector<Retained<PhysicalPage>> m_zeroed_physical_pages;
     Vector<Retained<PhysicalPage>> m_free_supervisor_physical_pages;
 
+    struct KernelStackSlot {
+        RetainPtr<PhysicalPage> pages[kernel_stack_size / PAGE_SIZE];
+    };
+    KernelStackSlot* m_kernel_stack_slots { nullptr };
+    // Most recently freed last, its pages are the likeliest to still be in the cache.
+    Vector<int> m_free_kernel_stack_slots;
+    int m_kernel_stacks_with_pages_cached { 0 };
+
     HashTable<VMObject*> m_vmos;
     HashTable<Region*> m_regions;
 
     size_t m_ram_size { 0 };
-    bool m_quickmap_in_use { false };
+    bool m_has_pse { false };
+    bool m_has_pge { false };
+
+    static const int max_deferred_tlb_flushes = 64;
+    LinearAddress m_deferred_tlb_flushes[max_deferred_tlb_flushes];
+    int m_deferred_tlb_flush_count { 0 };
+
+    // reclaimd gets woken when free pages drop below the low watermark, and works until they're above the high one.
+    size_t m_low_watermark { 0 };
+    size_t m_high_watermark { 0 };
+    Thread* m_reclaimer { nullptr };
+    pid_t m_oom_victim_pid { 0 };
 };
 
 struct ProcessPagingScope {
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <AK/Types.h>
+
 struct MousePacket {
     int dx { 0 };
     int dy { 0 };
     byte buttons;
+    // Microseconds on the gettimeofday() clock.
+    qword timestamp { 0 };
 };
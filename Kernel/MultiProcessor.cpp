@@ -0,0 +1,199 @@
+#include <Kernel/MultiProcessor.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/kstdio.h>
+#include <AK/Assertions.h>
+
+//#define MP_DEBUG
+
+namespace MultiProcessor {
+
+struct [[gnu::packed]] FloatingPointer {
+    char signature[4]; // "_MP_"
+    dword configuration_table;
+    byte length; // In 16-byte units.
+    byte specification_revision;
+    byte checksum;
+    byte default_configuration;
+    byte features[4];
+};
+
+struct [[gnu::packed]] ConfigurationTableHeader {
+    char signature[4]; // "PCMP"
+    word base_table_length;
+    byte specification_revision;
+    byte checksum;
+    char oem_id[8];
+    char product_id[12];
+    dword oem_table;
+    word oem_table_size;
+    word entry_count;
+    dword local_apic_address;
+    word extended_table_length;
+    byte extended_table_checksum;
+    byte reserved;
+};
+
+enum EntryType : byte {
+    Processor = 0,
+    Bus = 1,
+    IOAPIC = 2,
+    IOInterruptAssignment = 3,
+    LocalInterruptAssignment = 4,
+};
+
+struct [[gnu::packed]] ProcessorEntry {
+    byte type;
+    byte local_apic_id;
+    byte local_apic_version;
+    byte flags;
+    dword signature;
+    dword feature_flags;
+    dword reserved[2];
+};
+
+static const unsigned max_processors = 32;
+static ProcessorInfo s_processors[max_processors];
+static unsigned s_processor_count;
+static unsigned s_io_apic_count;
+static dword s_local_apic_address;
+static bool s_detected;
+
+static bool checksum_is_valid(const void* data, size_t size)
+{
+    auto* bytes = (const byte*)data;
+    byte sum = 0;
+    for (size_t i = 0; i < size; ++i)
+        sum += bytes[i];
+    return sum == 0;
+}
+
+static const FloatingPointer* find_floating_pointer(dword start, dword end)
+{
+    for (dword address = start; address + sizeof(FloatingPointer) <= end; address += 16) {
+        auto* pointer = (const FloatingPointer*)address;
+        if (memcmp(pointer->signature, "_MP_", 4))
+            continue;
+        if (pointer->length && checksum_is_valid(pointer, pointer->length * 16))
+            return pointer;
+    }
+    return nullptr;
+}
+
+static const FloatingPointer* find_floating_pointer()
+{
+    // NOTE: The spec also has us look in the first KB of the EBDA, but finding it means reading
+    //       the BIOS data area in the (unmapped) null page. The top KB of base memory is where it normally sits.
+    if (auto* pointer = find_floating_pointer(0x9fc00, 0xa0000))
+        return pointer;
+    return find_floating_pointer(0xf0000, 0x100000);
+}
+
+static void add_processor(byte local_apic_id, byte local_apic_version, bool is_bootstrap, bool is_enabled)
+{
+    if (s_processor_count == max_processors) {
+        kprintf("MP: Ignoring processor with local APIC id %u, too many processors\n", local_apic_id);
+        return;
+    }
+    auto& info = s_processors[s_processor_count++];
+    info.local_apic_id = local_apic_id;
+    info.local_apic_version = local_apic_version;
+    info.is_bootstrap = is_bootstrap;
+    info.is_enabled = is_enabled;
+}
+
+void detect()
+{
+    ASSERT(!s_detected);
+    auto* pointer = find_floating_pointer();
+    if (!pointer) {
+        kprintf("MP: No MP floating pointer structure, assuming a uniprocessor machine\n");
+        return;
+    }
+
+    if (pointer->default_configuration || !pointer->configuration_table) {
+        // The default configurations all have two processors, with local APIC ids 0 and 1.
+        s_local_apic_address = 0xfee00000;
+        add_processor(0, 0, true, true);
+        add_processor(1, 0, false, true);
+        s_io_apic_count = 1;
+        s_detected = true;
+        kprintf("MP: Default configuration %u, 2 processors\n", pointer->default_configuration);
+        return;
+    }
+
+    // FIXME: Tables above the identity mapped bottom 4 MB aren't reachable.
+    if (pointer->configuration_table >= 4 * MB) {
+        kprintf("MP: Configuration table at P%x is out of reach\n", pointer->configuration_table);
+        return;
+    }
+
+    auto& header = *(const ConfigurationTableHeader*)pointer->configuration_table;
+    if (memcmp(header.signature, "PCMP", 4) || !checksum_is_valid(&header, header.base_table_length)) {
+        kprintf("MP: Invalid configuration table at P%x\n", pointer->configuration_table);
+        return;
+    }
+
+    s_local_apic_address = header.local_apic_address;
+    auto* entry = (const byte*)(&header + 1);
+    auto* end = (const byte*)&header + header.base_table_length;
+    for (word i = 0; i < header.entry_count && entry < end; ++i) {
+        switch (*entry) {
+        case Processor: {
+            auto& processor = *(const ProcessorEntry*)entry;
+            add_processor(processor.local_apic_id, processor.local_apic_version, processor.flags & 0x2, processor.flags & 0x1);
+            entry += sizeof(ProcessorEntry);
+            break;
+        }
+        case IOAPIC:
+            ++s_io_apic_count;
+            entry += 8;
+            break;
+        case Bus:
+        case IOInterruptAssignment:
+        case LocalInterruptAssignment:
+            entry += 8;
+            break;
+        default:
+            kprintf("MP: Unknown configuration table entry type %u, ignoring the rest\n", *entry);
+            entry = end;
+            break;
+        }
+    }
+
+    s_detected = true;
+    kprintf("MP: %u processor(s), %u I/O APIC(s), local APIC at P%x\n", s_processor_count, s_io_apic_count, s_local_apic_address);
+#ifdef MP_DEBUG
+    for (unsigned i = 0; i < s_processor_count; ++i) {
+        auto& info = s_processors[i];
+        kprintf("MP: CPU %u: local APIC id %u, version %x%s%s\n", i, info.local_apic_id, info.local_apic_version, info.is_bootstrap ? ", bootstrap" : "", info.is_enabled ? "" : ", disabled");
+    }
+#endif
+}
+
+bool was_detected()
+{
+    return s_detected;
+}
+
+unsigned processor_count()
+{
+    return s_processor_count;
+}
+
+const ProcessorInfo& processor(unsigned index)
+{
+    ASSERT(index < s_processor_count);
+    return s_processors[index];
+}
+
+dword local_apic_address()
+{
+    return s_local_apic_address;
+}
+
+unsigned io_apic_count()
+{
+    return s_io_apic_count;
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <AK/Types.h>
+
+// Discovers the machine's processors from the Intel MultiProcessor Specification tables.
+// NOTE: Only the bootstrap processor is used. The others are left in the wait-for-SIPI state the firmware parked them in.
+namespace MultiProcessor {
+
+struct ProcessorInfo {
+    byte local_apic_id { 0 };
+    byte local_apic_version { 0 };
+    bool is_bootstrap { false };
+    bool is_enabled { false };
+};
+
+void detect();
+
+bool was_detected();
+// The number of processors found in the MP tables, 0 if there were none.
+unsigned processor_count();
+const ProcessorInfo& processor(unsigned index);
+dword local_apic_address();
+unsigned io_apic_count();
+
+}
@@ -1,10 +1,12 @@
 #include <Kernel/NetworkAdapter.h>
+#include <Kernel/ARPCache.h>
 #include <Kernel/StdLib.h>
 #include <Kernel/EthernetFrameHeader.h>
 #include <Kernel/kmalloc.h>
 #include <Kernel/EtherType.h>
 #include <AK/HashTable.h>
 #include <Kernel/Lock.h>
+#include <Kernel/Tracing.h>
 
 static Lockable<HashTable<NetworkAdapter*>>& all_adapters()
 {
@@ -24,8 +26,35 @@ NetworkAdapter* NetworkAdapter::from_ipv4_address(const IPv4Address& address)
     return nullptr;
 }
 
-NetworkAdapter::NetworkAdapter()
-    : m_packet_queue_alarm(*this)
+NetworkAdapter* NetworkAdapter::from_name(const String& name)
+{
+    LOCKER(all_adapters().lock());
+    for (auto* adapter : all_adapters().resource()) {
+        if (adapter->name() == name)
+            return adapter;
+    }
+    return nullptr;
+}
+
+Vector<NetworkAdapter*> NetworkAdapter::all()
+{
+    LOCKER(all_adapters().lock());
+    Vector<NetworkAdapter*> adapters;
+    for (auto* adapter : all_adapters().resource())
+        adapters.append(adapter);
+    return adapters;
+}
+
+Alarm& NetworkAdapter::packet_queue_alarm()
+{
+    static PacketQueueAlarm* s_alarm;
+    if (!s_alarm)
+        s_alarm = new PacketQueueAlarm;
+    return *s_alarm;
+}
+
+NetworkAdapter::NetworkAdapter(const String& name)
+    : m_name(name)
 {
     // FIXME: I wanna lock :(
     ASSERT_INTERRUPTS_DISABLED();
@@ -41,52 +70,117 @@ NetworkAdapter::~NetworkAdapter()
 
 void NetworkAdapter::send(const MACAddress& destination, const ARPPacket& packet)
 {
-    int size_in_bytes = sizeof(EthernetFrameHeader) + sizeof(ARPPacket);
-    auto buffer = ByteBuffer::create_zeroed(size_in_bytes);
-    auto* eth = (EthernetFrameHeader*)buffer.pointer();
-    eth->set_source(mac_address());
-    eth->set_destination(destination);
-    eth->set_ether_type(EtherType::ARP);
-    memcpy(eth->payload(), &packet, sizeof(ARPPacket));
-    send_raw((byte*)eth, size_in_bytes);
+    auto frame = PacketBuffer::copy(&packet, sizeof(ARPPacket));
+    auto& eth = *(EthernetFrameHeader*)frame->prepend(sizeof(EthernetFrameHeader));
+    eth.set_source(mac_address());
+    eth.set_destination(destination);
+    eth.set_ether_type(EtherType::ARP);
+    TRACE(PacketSent, frame->size());
+    send_raw(*frame);
 }
 
-void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& destination_ipv4, IPv4Protocol protocol, ByteBuffer&& payload)
+bool NetworkAdapter::is_on_link(const IPv4Address& address) const
 {
-    size_t size_in_bytes = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet) + payload.size();
-    auto buffer = ByteBuffer::create_zeroed(size_in_bytes);
-    auto& eth = *(EthernetFrameHeader*)buffer.pointer();
-    eth.set_source(mac_address());
-    eth.set_destination(destination_mac);
-    eth.set_ether_type(EtherType::IPv4);
-    auto& ipv4 = *(IPv4Packet*)eth.payload();
+    if (m_ipv4_address.is_zero())
+        return false;
+    return address.masked(m_ipv4_netmask) == m_ipv4_address.masked(m_ipv4_netmask);
+}
+
+static void prepend_ipv4_header(PacketBuffer& payload, const IPv4Address& source, const IPv4Address& destination, IPv4Protocol protocol)
+{
+    int payload_size = payload.size();
+    auto& ipv4 = *(IPv4Packet*)payload.prepend(sizeof(IPv4Packet));
     ipv4.set_version(4);
     ipv4.set_internet_header_length(5);
-    ipv4.set_source(ipv4_address());
-    ipv4.set_destination(destination_ipv4);
+    ipv4.set_source(source);
+    ipv4.set_destination(destination);
     ipv4.set_protocol((byte)protocol);
-    ipv4.set_length(sizeof(IPv4Packet) + payload.size());
+    ipv4.set_length(sizeof(IPv4Packet) + payload_size);
     ipv4.set_ident(1);
     ipv4.set_ttl(64);
     ipv4.set_checksum(ipv4.compute_checksum());
-    memcpy(ipv4.payload(), payload.pointer(), payload.size());
-    send_raw((const byte*)&eth, size_in_bytes);
 }
 
-void NetworkAdapter::did_receive(const byte* data, int length)
+void NetworkAdapter::send_ipv4(const IPv4Address& source, const IPv4Address& next_hop, const IPv4Address& destination, IPv4Protocol protocol, Retained<PacketBuffer>&& payload)
+{
+    prepend_ipv4_header(*payload, source, destination, protocol);
+    if (!needs_arp()) {
+        send_ipv4_frame(MACAddress(), *payload);
+        return;
+    }
+    if (destination == IPv4Address(255, 255, 255, 255)) {
+        send_ipv4_frame(MACAddress::broadcast(), *payload);
+        return;
+    }
+    ARPCache::the().send(*this, next_hop, move(payload));
+}
+
+void NetworkAdapter::send_ipv4(const MACAddress& destination_mac, const IPv4Address& source, const IPv4Address& destination_ipv4, IPv4Protocol protocol, Retained<PacketBuffer>&& payload)
+{
+    prepend_ipv4_header(*payload, source, destination_ipv4, protocol);
+    send_ipv4_frame(destination_mac, *payload);
+}
+
+void NetworkAdapter::send_ipv4_frame(const MACAddress& destination_mac, PacketBuffer& frame)
+{
+    auto& eth = *(EthernetFrameHeader*)frame.prepend(sizeof(EthernetFrameHeader));
+    eth.set_source(mac_address());
+    eth.set_destination(destination_mac);
+    eth.set_ether_type(EtherType::IPv4);
+    TRACE(PacketSent, frame.size());
+    send_raw(frame);
+}
+
+void NetworkAdapter::did_receive(const byte* data, int length, bool checksum_verified)
 {
     InterruptDisabler disabler;
-    m_packet_queue.append(ByteBuffer::copy(data, length));
+    TRACE(PacketReceived, length);
+    // This is the only copy a received packet gets before it's read out of a socket.
+    auto packet = PacketBuffer::copy(data, length, 0);
+    if (checksum_verified)
+        packet->set_checksum_verified();
+    m_packet_queue.append(move(packet));
+    packet_queue_alarm().wait_queue().wake_all();
 }
 
-ByteBuffer NetworkAdapter::dequeue_packet()
+void NetworkAdapter::did_receive(Retained<PacketBuffer>&& packet)
+{
+    InterruptDisabler disabler;
+    TRACE(PacketReceived, packet->size());
+    m_packet_queue.append(move(packet));
+    packet_queue_alarm().wait_queue().wake_all();
+}
+
+RetainPtr<PacketBuffer> NetworkAdapter::dequeue_packet()
 {
     InterruptDisabler disabler;
     if (m_packet_queue.is_empty())
-        return { };
+        return nullptr;
     return m_packet_queue.take_first();
 }
 
+void NetworkAdapter::schedule_poll()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_wants_poll = true;
+    packet_queue_alarm().wait_queue().wake_all();
+}
+
+int NetworkAdapter::poll(int budget)
+{
+    if (!m_wants_poll)
+        return 0;
+    int received = receive_packets(budget);
+    if (received < budget) {
+        // Anything that came in after the last look is still flagged in the cause register,
+        // so it interrupts right away once it's unmasked and nothing gets stuck in the ring.
+        InterruptDisabler disabler;
+        m_wants_poll = false;
+        enable_receive_interrupts();
+    }
+    return received;
+}
+
 void NetworkAdapter::set_ipv4_address(const IPv4Address& address)
 {
     m_ipv4_address = address;
@@ -94,5 +188,10 @@ void NetworkAdapter::set_ipv4_address(const IPv4Address& address)
 
 bool PacketQueueAlarm::is_ringing() const
 {
-    return m_adapter.has_queued_packets();
+    // Adapters only come and go with interrupts disabled, as the scheduler looks at them while it can't lock anything.
+    for (auto* adapter : all_adapters().resource()) {
+        if (adapter->has_queued_packets() || adapter->wants_poll())
+            return true;
+    }
+    return false;
 }
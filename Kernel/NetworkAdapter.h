@@ -1,54 +1,94 @@
 #pragma once
 
-#include <AK/ByteBuffer.h>
+#include <Kernel/PacketBuffer.h>
 #include <AK/SinglyLinkedList.h>
+#include <AK/AKString.h>
 #include <AK/Types.h>
+#include <AK/Vector.h>
 #include <Kernel/MACAddress.h>
 #include <Kernel/IPv4.h>
 #include <Kernel/ARP.h>
 #include <Kernel/ICMP.h>
 #include <Kernel/Alarm.h>
 
-class NetworkAdapter;
-
+// Rings while any adapter has packets for the network task, or wants to be polled.
 class PacketQueueAlarm final : public Alarm {
 public:
-    PacketQueueAlarm(NetworkAdapter& adapter) : m_adapter(adapter) { }
+    PacketQueueAlarm() { }
     virtual ~PacketQueueAlarm() override { }
     virtual bool is_ringing() const override;
-private:
-    NetworkAdapter& m_adapter;
 };
 
 class NetworkAdapter {
 public:
     static NetworkAdapter* from_ipv4_address(const IPv4Address&);
+    static NetworkAdapter* from_name(const String&);
+    static Vector<NetworkAdapter*> all();
     virtual ~NetworkAdapter();
 
     virtual const char* class_name() const = 0;
+    // What userland knows it by, like "e1000" or "loop".
+    const String& name() const { return m_name; }
     MACAddress mac_address() { return m_mac_address; }
     IPv4Address ipv4_address() const { return m_ipv4_address; }
+    IPv4Address ipv4_netmask() const { return m_ipv4_netmask; }
+    // The biggest IPv4 packet it can send in one go, up to max_mtu().
+    int mtu() const { return m_mtu; }
+    virtual int max_mtu() const { return 1500; }
 
     void set_ipv4_address(const IPv4Address&);
+    void set_ipv4_netmask(const IPv4Address& netmask) { m_ipv4_netmask = netmask; }
+    void set_mtu(int mtu) { m_mtu = mtu; }
+
+    // Whether |address| is on this adapter's link, by its address and netmask.
+    bool is_on_link(const IPv4Address&) const;
 
     void send(const MACAddress&, const ARPPacket&);
-    void send_ipv4(const MACAddress&, const IPv4Address&, IPv4Protocol, ByteBuffer&& payload);
+    // Puts the IPv4 and Ethernet headers in front of |payload|, which needs the room for them, and sends it
+    // to |next_hop| on the link, as decided by route_to(). Where that is on the link is looked up in the
+    // ARP cache, which holds on to the packet until that's known.
+    void send_ipv4(const IPv4Address& source, const IPv4Address& next_hop, const IPv4Address& destination, IPv4Protocol, Retained<PacketBuffer>&& payload);
+    // For answering someone who just sent us something, so it's known where they are.
+    void send_ipv4(const MACAddress&, const IPv4Address& source, const IPv4Address& destination, IPv4Protocol, Retained<PacketBuffer>&& payload);
+    // Sends |frame|, which starts with its IPv4 header, once its link address is known.
+    void send_ipv4_frame(const MACAddress&, PacketBuffer& frame);
 
-    ByteBuffer dequeue_packet();
+    RetainPtr<PacketBuffer> dequeue_packet();
 
-    Alarm& packet_queue_alarm() { return m_packet_queue_alarm; }
+    static Alarm& packet_queue_alarm();
 
     bool has_queued_packets() const { return !m_packet_queue.is_empty(); }
 
+    // Under heavy traffic an adapter stops interrupting for every packet it receives, and instead asks
+    // to be polled, see schedule_poll(). Each poll() takes up to |budget| packets off the hardware and
+    // returns how many there were. Once it comes back with fewer, the adapter interrupts again on the next one.
+    bool wants_poll() const { return m_wants_poll; }
+    int poll(int budget);
+
+    // Whether it can finish the UDP and TCP checksums of what it sends, see PacketBuffer::offload_checksum().
+    virtual bool can_offload_checksums() const { return false; }
+    // Whether the link has other hosts on it to find with ARP.
+    virtual bool needs_arp() const { return true; }
+
 protected:
-    NetworkAdapter();
+    explicit NetworkAdapter(const String& name);
     void set_mac_address(const MACAddress& mac_address) { m_mac_address = mac_address; }
-    virtual void send_raw(const byte*, int) = 0;
-    void did_receive(const byte*, int);
+    virtual void send_raw(PacketBuffer&) = 0;
+    void did_receive(const byte*, int, bool checksum_verified = false);
+    // For a packet that needs no copying, as it was made in here.
+    void did_receive(Retained<PacketBuffer>&&);
+
+    // Called from the interrupt handler with its receive interrupts masked, to have the network task poll instead.
+    void schedule_poll();
+    virtual int receive_packets(int budget) { (void)budget; return 0; }
+    virtual void enable_receive_interrupts() { }
 
 private:
     MACAddress m_mac_address;
     IPv4Address m_ipv4_address;
-    PacketQueueAlarm m_packet_queue_alarm;
-    SinglyLinkedList<ByteBuffer> m_packet_queue;
+    IPv4Address m_ipv4_netmask;
+    int m_mtu { 1500 };
+    String m_name;
+    SinglyLinkedList<Retained<PacketBuffer>> m_packet_queue;
+    bool m_wants_poll { false };
 };
@@ -1,77 +1,116 @@
-#include <Kernel/E1000NetworkAdapter.h>
+#include <Kernel/NetworkAdapter.h>
 #include <Kernel/EthernetFrameHeader.h>
 #include <Kernel/ARP.h>
+#include <Kernel/ARPCache.h>
 #include <Kernel/ICMP.h>
 #include <Kernel/UDP.h>
 #include <Kernel/TCP.h>
 #include <Kernel/IPv4.h>
+#include <Kernel/InternetChecksum.h>
 #include <Kernel/IPv4Socket.h>
 #include <Kernel/TCPSocket.h>
 #include <Kernel/UDPSocket.h>
 #include <Kernel/Process.h>
+#include <Kernel/Scheduler.h>
 #include <Kernel/EtherType.h>
 #include <Kernel/Lock.h>
+#include <Kernel/Routing.h>
+#include <Kernel/E1000NetworkAdapter.h>
+#include <Kernel/VirtIONetworkAdapter.h>
+#include <Kernel/BootProfile.h>
 
 //#define ETHERNET_DEBUG
-#define IPV4_DEBUG
+//#define IPV4_DEBUG
 //#define ICMP_DEBUG
 #define UDP_DEBUG
-#define TCP_DEBUG
+//#define TCP_DEBUG
 
-static void handle_arp(const EthernetFrameHeader&, int frame_size);
-static void handle_ipv4(const EthernetFrameHeader&, int frame_size);
-static void handle_icmp(const EthernetFrameHeader&, int frame_size);
-static void handle_udp(const EthernetFrameHeader&, int frame_size);
-static void handle_tcp(const EthernetFrameHeader&, int frame_size);
-
-Lockable<HashMap<IPv4Address, MACAddress>>& arp_table()
-{
-    static Lockable<HashMap<IPv4Address, MACAddress>>* the;
-    if (!the)
-        the = new Lockable<HashMap<IPv4Address, MACAddress>>;
-    return *the;
-}
+static void handle_frame(NetworkAdapter&, PacketBuffer&);
+static void handle_arp(NetworkAdapter&, const EthernetFrameHeader&, int frame_size);
+static void handle_ipv4(NetworkAdapter&, PacketBuffer&);
+static void handle_icmp(NetworkAdapter&, const EthernetFrameHeader&, PacketBuffer&);
+static void handle_udp(const EthernetFrameHeader&, PacketBuffer&);
+static void handle_tcp(const EthernetFrameHeader&, PacketBuffer&);
 
 void NetworkTask_main()
 {
-    auto* adapter_ptr = E1000NetworkAdapter::the();
-    ASSERT(adapter_ptr);
-    auto& adapter = *adapter_ptr;
-    adapter.set_ipv4_address(IPv4Address(192, 168, 5, 2));
+    // The adapters are found and reset here rather than in init(), so the rest of booting doesn't wait for them.
+    // This never returns, so they stay around.
+    auto e1000 = E1000NetworkAdapter::autodetect();
+    auto virtio_net = VirtIONetworkAdapter::autodetect();
+
+    // Whichever Ethernet adapter there is gets the address QEMU's user networking expects.
+    NetworkAdapter* ethernet_adapter = nullptr;
+    for (auto* adapter : NetworkAdapter::all()) {
+        if (adapter->needs_arp()) {
+            ethernet_adapter = adapter;
+            break;
+        }
+    }
+    if (ethernet_adapter) {
+        ethernet_adapter->set_ipv4_address(IPv4Address(192, 168, 5, 2));
+        ethernet_adapter->set_ipv4_netmask(IPv4Address(255, 255, 255, 0));
+        Route default_route;
+        default_route.gateway = IPv4Address(192, 168, 5, 1);
+        default_route.adapter = ethernet_adapter;
+        auto result = add_route(default_route);
+        ASSERT(!result.is_error());
+        ARPCache::the().announce(*ethernet_adapter);
+    }
+    BootProfile::mark("network");
+
+    // How many packets to take off an adapter at a time while it's being polled, before letting others run.
+    static const int receive_budget = 64;
+
+    // They're all set up before this runs, and none go away.
+    auto adapters = NetworkAdapter::all();
 
     kprintf("NetworkTask: Enter main loop.\n");
     for (;;) {
-        auto packet = adapter.dequeue_packet();
-        if (packet.is_null()) {
-            current->snooze_until(adapter.packet_queue_alarm());
-            continue;
+        bool used_whole_budget = false;
+        for (auto* adapter : adapters) {
+            if (adapter->wants_poll() && adapter->poll(receive_budget) == receive_budget)
+                used_whole_budget = true;
+            while (auto packet = adapter->dequeue_packet())
+                handle_frame(*adapter, *packet);
         }
-        if (packet.size() < (int)(sizeof(EthernetFrameHeader))) {
-            kprintf("NetworkTask: Packet is too small to be an Ethernet packet! (%d)\n", packet.size());
+        // After a full budget there's likely more where that came from, but others get a turn first.
+        if (used_whole_budget) {
+            Scheduler::yield();
             continue;
         }
-        auto& eth = *(const EthernetFrameHeader*)packet.pointer();
+        current->snooze_until(NetworkAdapter::packet_queue_alarm());
+    }
+}
+
+void handle_frame(NetworkAdapter& adapter, PacketBuffer& packet)
+{
+    if (packet.size() < (int)(sizeof(EthernetFrameHeader))) {
+        kprintf("NetworkTask: Packet is too small to be an Ethernet packet! (%d)\n", packet.size());
+        return;
+    }
+    auto& eth = *(const EthernetFrameHeader*)packet.data();
 #ifdef ETHERNET_DEBUG
-        kprintf("NetworkTask: From %s to %s, ether_type=%w, packet_length=%u\n",
-            eth.source().to_string().characters(),
-            eth.destination().to_string().characters(),
-            eth.ether_type(),
-            packet.size()
-        );
+    kprintf("NetworkTask: From %s to %s on %s, ether_type=%w, packet_length=%u\n",
+        eth.source().to_string().characters(),
+        eth.destination().to_string().characters(),
+        adapter.name().characters(),
+        eth.ether_type(),
+        packet.size()
+    );
 #endif
 
-        switch (eth.ether_type()) {
-        case EtherType::ARP:
-            handle_arp(eth, packet.size());
-            break;
-        case EtherType::IPv4:
-            handle_ipv4(eth, packet.size());
-            break;
-        }
+    switch (eth.ether_type()) {
+    case EtherType::ARP:
+        handle_arp(adapter, eth, packet.size());
+        break;
+    case EtherType::IPv4:
+        handle_ipv4(adapter, packet);
+        break;
     }
 }
 
-void handle_arp(const EthernetFrameHeader& eth, int frame_size)
+void handle_arp(NetworkAdapter& adapter, const EthernetFrameHeader& eth, int frame_size)
 {
     constexpr int minimum_arp_frame_size = sizeof(EthernetFrameHeader) + sizeof(ARPPacket);
     if (frame_size < minimum_arp_frame_size) {
@@ -104,46 +143,26 @@ void handle_arp(const EthernetFrameHeader& eth, int frame_size)
     );
 #endif
 
-    if (packet.operation() == ARPOperation::Request) {
-        // Who has this IP address?
-        if (auto* adapter = NetworkAdapter::from_ipv4_address(packet.target_protocol_address())) {
-            // We do!
-            kprintf("handle_arp: Responding to ARP request for my IPv4 address (%s)\n",
-                    adapter->ipv4_address().to_string().characters());
-            ARPPacket response;
-            response.set_operation(ARPOperation::Response);
-            response.set_target_hardware_address(packet.sender_hardware_address());
-            response.set_target_protocol_address(packet.sender_protocol_address());
-            response.set_sender_hardware_address(adapter->mac_address());
-            response.set_sender_protocol_address(adapter->ipv4_address());
-
-            adapter->send(packet.sender_hardware_address(), response);
-        }
-        return;
-    }
-
-    if (packet.operation() == ARPOperation::Response) {
-        // Someone has this IPv4 address. I guess we can try to remember that.
-        // FIXME: Protect against ARP spamming.
-        // FIXME: Support static ARP table entries.
-        LOCKER(arp_table().lock());
-        arp_table().resource().set(packet.sender_protocol_address(), packet.sender_hardware_address());
-
-        kprintf("ARP table (%d entries):\n", arp_table().resource().size());
-        for (auto& it : arp_table().resource()) {
-            kprintf("%s :: %s\n", it.value.to_string().characters(), it.key.to_string().characters());
-        }
-    }
+    ARPCache::the().did_receive(adapter, packet);
 }
 
-void handle_ipv4(const EthernetFrameHeader& eth, int frame_size)
+// From here on |frame| starts with the IPv4 header, and ends with the IPv4 packet, so sockets can keep it as it is.
+void handle_ipv4(NetworkAdapter& adapter, PacketBuffer& frame)
 {
     constexpr int minimum_ipv4_frame_size = sizeof(EthernetFrameHeader) + sizeof(IPv4Packet);
-    if (frame_size < minimum_ipv4_frame_size) {
-        kprintf("handle_ipv4: Frame too small (%d, need %d)\n", frame_size, minimum_ipv4_frame_size);
+    if (frame.size() < minimum_ipv4_frame_size) {
+        kprintf("handle_ipv4: Frame too small (%d, need %d)\n", frame.size(), minimum_ipv4_frame_size);
+        return;
+    }
+    auto& eth = *(const EthernetFrameHeader*)frame.data();
+    frame.pull(sizeof(EthernetFrameHeader));
+    auto& packet = *(const IPv4Packet*)frame.data();
+    if (packet.length() < sizeof(IPv4Packet) || packet.length() > frame.size()) {
+        kprintf("handle_ipv4: Bad length (%u, frame has %d)\n", packet.length(), frame.size());
         return;
     }
-    auto& packet = *static_cast<const IPv4Packet*>(eth.payload());
+    // Short frames are padded, and the padding isn't part of the packet.
+    frame.trim(packet.length());
 
 #ifdef IPV4_DEBUG
     kprintf("handle_ipv4: source=%s, target=%s\n",
@@ -154,21 +173,20 @@ void handle_ipv4(const EthernetFrameHeader& eth, int frame_size)
 
     switch ((IPv4Protocol)packet.protocol()) {
     case IPv4Protocol::ICMP:
-        return handle_icmp(eth, frame_size);
+        return handle_icmp(adapter, eth, frame);
     case IPv4Protocol::UDP:
-        return handle_udp(eth, frame_size);
+        return handle_udp(eth, frame);
     case IPv4Protocol::TCP:
-        return handle_tcp(eth, frame_size);
+        return handle_tcp(eth, frame);
     default:
         kprintf("handle_ipv4: Unhandled protocol %u\n", packet.protocol());
         break;
     }
 }
 
-void handle_icmp(const EthernetFrameHeader& eth, int frame_size)
+void handle_icmp(NetworkAdapter& adapter, const EthernetFrameHeader& eth, PacketBuffer& packet)
 {
-    (void)frame_size;
-    auto& ipv4_packet = *static_cast<const IPv4Packet*>(eth.payload());
+    auto& ipv4_packet = *(const IPv4Packet*)packet.data();
     auto& icmp_header = *static_cast<const ICMPHeader*>(ipv4_packet.payload());
 #ifdef ICMP_DEBUG
     kprintf("handle_icmp: source=%s, destination=%s, type=%b, code=%b\n",
@@ -185,12 +203,11 @@ void handle_icmp(const EthernetFrameHeader& eth, int frame_size)
             LOCKER(socket->lock());
             if (socket->protocol() != (unsigned)IPv4Protocol::ICMP)
                 continue;
-            socket->did_receive(ByteBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
+            socket->did_receive(packet);
         }
     }
 
-    auto* adapter = NetworkAdapter::from_ipv4_address(ipv4_packet.destination());
-    if (!adapter)
+    if (!NetworkAdapter::from_ipv4_address(ipv4_packet.destination()))
         return;
 
     if (icmp_header.type() == ICMPType::EchoRequest) {
@@ -201,31 +218,48 @@ void handle_icmp(const EthernetFrameHeader& eth, int frame_size)
                 (word)request.sequence_number
         );
         size_t icmp_packet_size = ipv4_packet.payload_size();
-        auto buffer = ByteBuffer::create_zeroed(icmp_packet_size);
-        auto& response = *(ICMPEchoPacket*)buffer.pointer();
+        if (icmp_packet_size < sizeof(ICMPEchoPacket))
+            return;
+        auto reply = PacketBuffer::copy(request.payload(), icmp_packet_size - sizeof(ICMPEchoPacket));
+        auto& response = *(ICMPEchoPacket*)reply->prepend(sizeof(ICMPEchoPacket));
         response.header.set_type(ICMPType::EchoReply);
         response.header.set_code(0);
         response.identifier = request.identifier;
         response.sequence_number = request.sequence_number;
-        if (size_t icmp_payload_size = icmp_packet_size - sizeof(ICMPEchoPacket))
-            memcpy(response.payload(), request.payload(), icmp_payload_size);
-        response.header.set_checksum(internet_checksum(&response, icmp_packet_size));
-        adapter->send_ipv4(eth.source(), ipv4_packet.source(), IPv4Protocol::ICMP, move(buffer));
+        // All that changes is the type and code, so the request's checksum only needs updating for those.
+        word old_type_and_code = (word)request.header.type() << 8 | request.header.code();
+        word new_type_and_code = (word)ICMPType::EchoReply << 8;
+        response.header.set_checksum(InternetChecksum::update(request.header.checksum(), old_type_and_code, new_type_and_code));
+        // It goes back the way it came, from the address it was sent to.
+        adapter.send_ipv4(eth.source(), ipv4_packet.destination(), ipv4_packet.source(), IPv4Protocol::ICMP, move(reply));
     }
 }
 
-void handle_udp(const EthernetFrameHeader& eth, int frame_size)
+void handle_udp(const EthernetFrameHeader& eth, PacketBuffer& packet)
 {
-    (void)frame_size;
-    auto& ipv4_packet = *static_cast<const IPv4Packet*>(eth.payload());
+    (void)eth;
+    auto& ipv4_packet = *(const IPv4Packet*)packet.data();
 
-    auto* adapter = NetworkAdapter::from_ipv4_address(ipv4_packet.destination());
-    if (!adapter) {
+    if (!NetworkAdapter::from_ipv4_address(ipv4_packet.destination())) {
         kprintf("handle_udp: this packet is not for me, it's for %s\n", ipv4_packet.destination().to_string().characters());
         return;
     }
 
     auto& udp_packet = *static_cast<const UDPPacket*>(ipv4_packet.payload());
+    if (ipv4_packet.payload_size() < sizeof(UDPPacket) || udp_packet.length() < sizeof(UDPPacket) || udp_packet.length() > ipv4_packet.payload_size()) {
+        kprintf("handle_udp: Bad length (%u, packet has %u)\n", udp_packet.length(), ipv4_packet.payload_size());
+        return;
+    }
+    // A sender can leave the checksum out, as 0.
+    if (udp_packet.checksum() && !packet.is_checksum_verified()) {
+        InternetChecksum checksum;
+        checksum.add_pseudo_header(ipv4_packet.source(), ipv4_packet.destination(), IPv4Protocol::UDP, udp_packet.length());
+        checksum.add(&udp_packet, udp_packet.length());
+        if (checksum.finish() != 0) {
+            kprintf("handle_udp: Bad checksum\n");
+            return;
+        }
+    }
 #ifdef UDP_DEBUG
     kprintf("handle_udp: source=%s:%u, destination=%s:%u length=%u\n",
         ipv4_packet.source().to_string().characters(),
@@ -236,7 +270,7 @@ void handle_udp(const EthernetFrameHeader& eth, int frame_size)
     );
 #endif
 
-    auto socket = UDPSocket::from_port(udp_packet.destination_port());
+    auto socket = UDPSocket::from_tuple({ ipv4_packet.destination(), udp_packet.destination_port(), ipv4_packet.source(), udp_packet.source_port() });
     if (!socket) {
         kprintf("handle_udp: No UDP socket for port %u\n", udp_packet.destination_port());
         return;
@@ -244,22 +278,29 @@ void handle_udp(const EthernetFrameHeader& eth, int frame_size)
 
     ASSERT(socket->type() == SOCK_DGRAM);
     ASSERT(socket->source_port() == udp_packet.destination_port());
-    socket->did_receive(ByteBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
+    socket->did_receive(packet);
 }
 
-void handle_tcp(const EthernetFrameHeader& eth, int frame_size)
+void handle_tcp(const EthernetFrameHeader& eth, PacketBuffer& packet)
 {
-    (void)frame_size;
-    auto& ipv4_packet = *static_cast<const IPv4Packet*>(eth.payload());
+    (void)eth;
+    auto& ipv4_packet = *(const IPv4Packet*)packet.data();
 
-    auto* adapter = NetworkAdapter::from_ipv4_address(ipv4_packet.destination());
-    if (!adapter) {
+    if (!NetworkAdapter::from_ipv4_address(ipv4_packet.destination())) {
         kprintf("handle_tcp: this packet is not for me, it's for %s\n", ipv4_packet.destination().to_string().characters());
         return;
     }
 
     auto& tcp_packet = *static_cast<const TCPPacket*>(ipv4_packet.payload());
+    if (ipv4_packet.payload_size() < sizeof(TCPPacket) || tcp_packet.header_size() < sizeof(TCPPacket) || tcp_packet.header_size() > ipv4_packet.payload_size()) {
+        kprintf("handle_tcp: Bad header size (%u, segment has %u)\n", tcp_packet.header_size(), ipv4_packet.payload_size());
+        return;
+    }
     size_t payload_size = ipv4_packet.payload_size() - tcp_packet.header_size();
+    if (!packet.is_checksum_verified() && TCPSocket::compute_tcp_checksum(ipv4_packet.source(), ipv4_packet.destination(), tcp_packet, payload_size) != 0) {
+        kprintf("handle_tcp: Bad checksum\n");
+        return;
+    }
 
 #ifdef TCP_DEBUG
     kprintf("handle_tcp: source=%s:%u, destination=%s:%u seq_no=%u, ack_no=%u, flags=%w (%s %s), window_size=%u, payload_size=%u\n",
@@ -277,7 +318,7 @@ void handle_tcp(const EthernetFrameHeader& eth, int frame_size)
     );
 #endif
 
-    auto socket = TCPSocket::from_port(tcp_packet.destination_port());
+    auto socket = TCPSocket::from_tuple({ ipv4_packet.destination(), tcp_packet.destination_port(), ipv4_packet.source(), tcp_packet.source_port() });
     if (!socket) {
         kprintf("handle_tcp: No TCP socket for port %u\n", tcp_packet.destination_port());
         return;
@@ -285,43 +326,5 @@ void handle_tcp(const EthernetFrameHeader& eth, int frame_size)
 
     ASSERT(socket->type() == SOCK_STREAM);
     ASSERT(socket->source_port() == tcp_packet.destination_port());
-
-    if (tcp_packet.ack_number() != socket->sequence_number()) {
-        kprintf("handle_tcp: ack/seq mismatch: got %u, wanted %u\n", tcp_packet.ack_number(), socket->sequence_number());
-        return;
-    }
-
-    if (tcp_packet.has_syn() && tcp_packet.has_ack()) {
-        socket->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
-        socket->send_tcp_packet(TCPFlags::ACK);
-        socket->set_connected(true);
-        kprintf("handle_tcp: Connection established!\n");
-        socket->set_state(TCPSocket::State::Connected);
-        return;
-    }
-
-    if (tcp_packet.has_fin()) {
-        kprintf("handle_tcp: Got FIN, payload_size=%u\n", payload_size);
-
-        if (payload_size != 0)
-            socket->did_receive(ByteBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
-
-        socket->set_ack_number(tcp_packet.sequence_number() + payload_size + 1);
-        socket->send_tcp_packet(TCPFlags::FIN | TCPFlags::ACK);
-        socket->set_state(TCPSocket::State::Disconnecting);
-        return;
-    }
-
-    socket->set_ack_number(tcp_packet.sequence_number() + payload_size);
-    kprintf("Got packet with ack_no=%u, seq_no=%u, payload_size=%u, acking it with new ack_no=%u, seq_no=%u\n",
-            tcp_packet.ack_number(),
-            tcp_packet.sequence_number(),
-            payload_size,
-            socket->ack_number(),
-            socket->sequence_number()
-            );
-    socket->send_tcp_packet(TCPFlags::ACK);
-
-    if (payload_size != 0)
-        socket->did_receive(ByteBuffer::copy(&ipv4_packet, sizeof(IPv4Packet) + ipv4_packet.payload_size()));
+    socket->receive_segment(ipv4_packet, tcp_packet, packet);
 }
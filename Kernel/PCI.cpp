@@ -1,5 +1,7 @@
 #include <Kernel/PCI.h>
 #include <Kernel/IO.h>
+#include <Kernel/i386.h>
+#include <Kernel/MemoryManager.h>
 
 #define PCI_VENDOR_ID            0x00 // word
 #define PCI_DEVICE_ID            0x02 // word
@@ -19,6 +21,7 @@
 #define PCI_BAR3                 0x1C // dword
 #define PCI_BAR4                 0x20 // dword
 #define PCI_BAR5                 0x24 // dword
+#define PCI_CAPABILITIES_POINTER 0x34 // byte
 #define PCI_INTERRUPT_LINE       0x3C // byte
 #define PCI_SECONDARY_BUS        0x19 // byte
 #define PCI_HEADER_TYPE_DEVICE   0
@@ -27,12 +30,27 @@
 #define PCI_ADDRESS_PORT         0xCF8
 #define PCI_VALUE_PORT           0xCFC
 #define PCI_NONE                 0xFFFF
+#define PCI_STATUS_CAPABILITIES  (1 << 4)
+#define PCI_COMMAND_INTX_DISABLE (1 << 10)
+#define PCI_CAPABILITY_MSI       0x05
+#define PCI_CAPABILITY_MSIX      0x11
+
+#define MSI_CONTROL_ENABLE       (1 << 0)
+#define MSI_CONTROL_MME_MASK     (7 << 4)
+#define MSI_CONTROL_64BIT        (1 << 7)
+#define MSI_CONTROL_MASKABLE     (1 << 8)
+#define MSIX_CONTROL_MASK_ALL    (1 << 14)
+#define MSIX_CONTROL_ENABLE      (1 << 15)
+#define MSIX_VECTOR_MASKED       (1 << 0)
 
 namespace PCI {
 
+// The address and value ports go together, so nobody else may get in between. Devices are probed
+// from more than one process at boot.
 template<typename T>
 T read_field(Address address, dword field)
 {
+    InterruptDisabler disabler;
     IO::out32(PCI_ADDRESS_PORT, address.io_address_for_field(field));
     if constexpr (sizeof(T) == 4)
         return IO::in32(PCI_VALUE_PORT);
@@ -45,6 +63,7 @@ T read_field(Address address, dword field)
 template<typename T>
 void write_field(Address address, dword field, T value)
 {
+    InterruptDisabler disabler;
     IO::out32(PCI_ADDRESS_PORT, address.io_address_for_field(field));
     if constexpr (sizeof(T) == 4)
         IO::out32(PCI_VALUE_PORT, value);
@@ -59,9 +78,9 @@ word read_type(Address address)
     return (read_field<byte>(address, PCI_CLASS) << 8u) | read_field<byte>(address, PCI_SUBCLASS);
 }
 
-void enumerate_bus(int type, byte bus, Function<void(Address, ID)>&);
+void enumerate_bus(int type, byte bus, FunctionRef<void(Address, ID)>);
 
-void enumerate_functions(int type, byte bus, byte slot, byte function, Function<void(Address, ID)>& callback)
+void enumerate_functions(int type, byte bus, byte slot, byte function, FunctionRef<void(Address, ID)> callback)
 {
     Address address(bus, slot, function);
     if (type == -1 || type == read_type(address))
@@ -74,7 +93,7 @@ void enumerate_functions(int type, byte bus, byte slot, byte function, Function<
     }
 }
 
-void enumerate_slot(int type, byte bus, byte slot, Function<void(Address, ID)>& callback)
+void enumerate_slot(int type, byte bus, byte slot, FunctionRef<void(Address, ID)> callback)
 {
     Address address(bus, slot, 0);
     if (read_field<word>(address, PCI_VENDOR_ID) == PCI_NONE)
@@ -89,7 +108,7 @@ void enumerate_slot(int type, byte bus, byte slot, Function<void(Address, ID)>&
     }
 }
 
-void enumerate_bus(int type, byte bus, Function<void(Address, ID)>& callback)
+void enumerate_bus(int type, byte bus, FunctionRef<void(Address, ID)> callback)
 {
     for (byte slot = 0; slot < 32; ++slot)
         enumerate_slot(type, bus, slot, callback);
@@ -111,7 +130,123 @@ void enable_bus_mastering(Address address)
     write_field<word>(address, PCI_COMMAND, value);
 }
 
-void enumerate_all(Function<void(Address, ID)> callback)
+// Returns where the capability is in the configuration space, or 0.
+static byte find_capability(Address address, byte id)
+{
+    if (!(read_field<word>(address, PCI_STATUS) & PCI_STATUS_CAPABILITIES))
+        return 0;
+    byte offset = read_field<byte>(address, PCI_CAPABILITIES_POINTER) & 0xfc;
+    // A broken list could go around in circles, there can't be more than this many in 256 bytes.
+    for (int i = 0; offset && i < 48; ++i) {
+        if (read_field<byte>(address, offset) == id)
+            return offset;
+        offset = read_field<byte>(address, offset + 1) & 0xfc;
+    }
+    return 0;
+}
+
+static void set_intx_disabled(Address address, bool disabled)
+{
+    auto command = read_field<word>(address, PCI_COMMAND);
+    if (disabled)
+        command |= PCI_COMMAND_INTX_DISABLE;
+    else
+        command &= ~PCI_COMMAND_INTX_DISABLE;
+    write_field<word>(address, PCI_COMMAND, command);
+}
+
+// The MSI-X table is in one of the device's memory BARs, mapped where it is like other MMIO.
+static volatile dword* map_msix_table(Address address, byte capability)
+{
+    dword table = read_field<dword>(address, capability + 4);
+    byte bar_index = table & 7;
+    if (bar_index > 5)
+        return nullptr;
+    dword bar = read_field<dword>(address, PCI_BAR0 + bar_index * 4);
+    if (bar & 1)
+        return nullptr;
+    dword table_address = (bar & ~0xf) + (table & ~7);
+    MM.map_for_kernel(LinearAddress(page_base_of(table_address)), PhysicalAddress(page_base_of(table_address)));
+    return (volatile dword*)table_address;
+}
+
+bool enable_message_signaled_interrupts(Address address, dword message_address, dword message_data)
+{
+    if (byte msi = find_capability(address, PCI_CAPABILITY_MSI)) {
+        auto control = read_field<word>(address, msi + 2);
+        // Just the one vector.
+        control &= ~(MSI_CONTROL_MME_MASK | MSI_CONTROL_ENABLE);
+        write_field<word>(address, msi + 2, control);
+        write_field<dword>(address, msi + 4, message_address);
+        byte data_offset = 8;
+        if (control & MSI_CONTROL_64BIT) {
+            write_field<dword>(address, msi + 8, 0);
+            data_offset = 12;
+        }
+        write_field<word>(address, msi + data_offset, message_data);
+        if (control & MSI_CONTROL_MASKABLE)
+            write_field<dword>(address, msi + data_offset + 4, 0);
+        set_intx_disabled(address, true);
+        write_field<word>(address, msi + 2, control | MSI_CONTROL_ENABLE);
+        return true;
+    }
+    if (byte msix = find_capability(address, PCI_CAPABILITY_MSIX)) {
+        auto control = read_field<word>(address, msix + 2);
+        // Everything stays masked while the table is set up. The other entries are masked out of reset.
+        write_field<word>(address, msix + 2, control | MSIX_CONTROL_ENABLE | MSIX_CONTROL_MASK_ALL);
+        auto* entry = map_msix_table(address, msix);
+        if (!entry) {
+            write_field<word>(address, msix + 2, control & ~MSIX_CONTROL_ENABLE);
+            return false;
+        }
+        entry[0] = message_address;
+        entry[1] = 0;
+        entry[2] = message_data;
+        entry[3] = 0;
+        set_intx_disabled(address, true);
+        write_field<word>(address, msix + 2, (control | MSIX_CONTROL_ENABLE) & ~MSIX_CONTROL_MASK_ALL);
+        return true;
+    }
+    return false;
+}
+
+void set_message_signaled_interrupts_masked(Address address, bool masked)
+{
+    if (byte msi = find_capability(address, PCI_CAPABILITY_MSI)) {
+        auto control = read_field<word>(address, msi + 2);
+        if (control & MSI_CONTROL_MASKABLE) {
+            byte mask_offset = (control & MSI_CONTROL_64BIT) ? 16 : 12;
+            write_field<dword>(address, msi + mask_offset, masked ? 1 : 0);
+            return;
+        }
+        // Without per-vector masking, all there is is turning it off. Whatever the device signals meanwhile is lost.
+        if (masked)
+            control &= ~MSI_CONTROL_ENABLE;
+        else
+            control |= MSI_CONTROL_ENABLE;
+        write_field<word>(address, msi + 2, control);
+        return;
+    }
+    if (byte msix = find_capability(address, PCI_CAPABILITY_MSIX)) {
+        auto control = read_field<word>(address, msix + 2);
+        if (masked)
+            control |= MSIX_CONTROL_MASK_ALL;
+        else
+            control &= ~MSIX_CONTROL_MASK_ALL;
+        write_field<word>(address, msix + 2, control);
+    }
+}
+
+void disable_message_signaled_interrupts(Address address)
+{
+    if (byte msi = find_capability(address, PCI_CAPABILITY_MSI))
+        write_field<word>(address, msi + 2, read_field<word>(address, msi + 2) & ~MSI_CONTROL_ENABLE);
+    if (byte msix = find_capability(address, PCI_CAPABILITY_MSIX))
+        write_field<word>(address, msix + 2, read_field<word>(address, msix + 2) & ~MSIX_CONTROL_ENABLE);
+    set_intx_disabled(address, false);
+}
+
+void enumerate_all(FunctionRef<void(Address, ID)> callback)
 {
     // Single PCI host controller.
     if ((read_field<byte>(Address(), PCI_HEADER_TYPE) & 0x80) == 0) {
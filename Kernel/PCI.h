@@ -39,7 +39,7 @@ private:
     byte m_function { 0 };
 };
 
-void enumerate_all(Function<void(Address, ID)>);
+void enumerate_all(FunctionRef<void(Address, ID)>);
 byte get_interrupt_line(Address);
 dword get_BAR0(Address);
 dword get_BAR1(Address);
@@ -49,4 +49,11 @@ dword get_BAR4(Address);
 dword get_BAR5(Address);
 void enable_bus_mastering(Address);
 
+// Has the device send its interrupts as writes of |data| to |address| instead of on its interrupt line.
+// MSI if it can, otherwise entry 0 of the MSI-X table. Returns false if it can do neither.
+bool enable_message_signaled_interrupts(Address, dword address, dword data);
+// After enabling them, masks and unmasks them again.
+void set_message_signaled_interrupts_masked(Address, bool);
+void disable_message_signaled_interrupts(Address);
+
 }
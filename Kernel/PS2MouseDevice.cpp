@@ -89,6 +89,7 @@ void PS2MouseDevice::parse_data_packet()
     packet.dy = y;
     packet.buttons = m_data[0] & 0x07;
     m_queue.enqueue(packet);
+    wait_queue().wake_all();
 }
 
 void PS2MouseDevice::wait_then_write(byte port, byte data)
@@ -167,18 +168,7 @@ bool PS2MouseDevice::can_read(Process&) const
 
 ssize_t PS2MouseDevice::read(Process&, byte* buffer, ssize_t size)
 {
-    ssize_t nread = 0;
-    while (nread < size) {
-        if (m_queue.is_empty())
-            break;
-        // Don't return partial data frames.
-        if ((size - nread) < (ssize_t)sizeof(MousePacket))
-            break;
-        auto packet = m_queue.dequeue();
-        memcpy(buffer, &packet, sizeof(MousePacket));
-        nread += sizeof(MousePacket);
-    }
-    return nread;
+    return m_queue.read(buffer, size);
 }
 
 ssize_t PS2MouseDevice::write(Process&, const byte*, ssize_t)
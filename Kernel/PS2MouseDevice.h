@@ -3,6 +3,7 @@
 #include <Kernel/CharacterDevice.h>
 #include <Kernel/MousePacket.h>
 #include <Kernel/IRQHandler.h>
+#include <Kernel/InputEventQueue.h>
 
 class PS2MouseDevice final : public IRQHandler, public CharacterDevice {
 public:
@@ -33,7 +34,8 @@ private:
     byte wait_then_read(byte port);
     void parse_data_packet();
 
-    CircularQueue<MousePacket, 100> m_queue;
+    // Filled by the interrupt handler, emptied by read().
+    InputEventQueue<MousePacket, 128> m_queue;
     byte m_data_state { 0 };
     byte m_data[3];
 };
@@ -0,0 +1,93 @@
+#include <Kernel/PacketBuffer.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/kmalloc.h>
+#include <Kernel/i386.h>
+
+// Packets are let go of from the network task and the sockets at a steady clip, and taken from IRQ handlers,
+// so there's no point in keeping more chunks around than a burst of them needs.
+static const int max_free_chunks = 32;
+
+struct FreeChunk {
+    FreeChunk* next;
+};
+
+static FreeChunk* s_free_chunks;
+static int s_free_chunk_count;
+
+static byte* take_chunk()
+{
+    InterruptDisabler disabler;
+    if (!s_free_chunks)
+        return (byte*)kmalloc(PacketBuffer::pool_chunk_size);
+    auto* chunk = s_free_chunks;
+    s_free_chunks = chunk->next;
+    --s_free_chunk_count;
+    return (byte*)chunk;
+}
+
+static void give_back_chunk(byte* storage)
+{
+    InterruptDisabler disabler;
+    if (s_free_chunk_count >= max_free_chunks) {
+        kfree(storage);
+        return;
+    }
+    auto* chunk = (FreeChunk*)storage;
+    chunk->next = s_free_chunks;
+    s_free_chunks = chunk;
+    ++s_free_chunk_count;
+}
+
+Retained<PacketBuffer> PacketBuffer::create(int size, int headroom)
+{
+    ASSERT(size >= 0 && headroom >= 0);
+    int capacity = headroom + size;
+    if (capacity <= pool_chunk_size)
+        return adopt(*new PacketBuffer(take_chunk(), true, size, headroom));
+    return adopt(*new PacketBuffer((byte*)kmalloc(capacity), false, size, headroom));
+}
+
+Retained<PacketBuffer> PacketBuffer::copy(const void* data, int size, int headroom)
+{
+    auto packet = create(size, headroom);
+    memcpy(packet->data(), data, size);
+    return packet;
+}
+
+PacketBuffer::PacketBuffer(byte* storage, bool pooled, int size, int headroom)
+    : m_storage(storage)
+    , m_pooled(pooled)
+    , m_offset(headroom)
+    , m_size(size)
+{
+}
+
+PacketBuffer::~PacketBuffer()
+{
+    if (m_pooled)
+        give_back_chunk(m_storage);
+    else
+        kfree(m_storage);
+}
+
+byte* PacketBuffer::prepend(int count)
+{
+    ASSERT(count <= m_offset);
+    m_offset -= count;
+    m_size += count;
+    memset(data(), 0, count);
+    return data();
+}
+
+void PacketBuffer::pull(int count)
+{
+    ASSERT(count <= m_size);
+    m_offset += count;
+    m_size -= count;
+}
+
+void PacketBuffer::trim(int size)
+{
+    ASSERT(size <= m_size);
+    m_size = size;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <AK/Retainable.h>
+#include <AK/Retained.h>
+#include <AK/Types.h>
+
+// A network packet with room in front of it. Going out, each layer puts its header in that room, in front of
+// what the layer above it built, so the payload is copied in once and never moved. Coming in, the packet is
+// filled once from the adapter, and every layer and socket it's for sees that same buffer.
+// Most packets fit in an Ethernet frame, so their storage comes from a pool of chunks that size.
+class PacketBuffer : public Retainable<PacketBuffer> {
+public:
+    // Enough for the Ethernet, IPv4 and TCP headers.
+    static const int default_headroom = 64;
+    static const int pool_chunk_size = 2048;
+
+    // The |size| bytes after the headroom are left as they were.
+    static Retained<PacketBuffer> create(int size, int headroom = default_headroom);
+    static Retained<PacketBuffer> copy(const void*, int size, int headroom = default_headroom);
+    ~PacketBuffer();
+
+    byte* data() { return m_storage + m_offset; }
+    const byte* data() const { return m_storage + m_offset; }
+    int size() const { return m_size; }
+    int headroom() const { return m_offset; }
+
+    // Grows the packet by |count| zeroed bytes at the front, and returns where it now begins.
+    byte* prepend(int count);
+    // Drops the first |count| bytes, a header that's been dealt with. They stay where they were.
+    void pull(int count);
+    void trim(int size);
+
+    // Going out, has the adapter sum from |start| to the end and put the checksum in the field at |field|,
+    // both counted from where the packet begins now. The field has to hold the sum of anything else it covers.
+    void offload_checksum(int start, int field)
+    {
+        m_checksum_start = m_offset + start;
+        m_checksum_field = m_offset + field;
+    }
+    bool has_offloaded_checksum() const { return m_checksum_field >= 0; }
+    int checksum_start() const { return m_checksum_start - m_offset; }
+    int checksum_field() const { return m_checksum_field - m_offset; }
+
+    // Coming in, the adapter has already checked the UDP or TCP checksum.
+    bool is_checksum_verified() const { return m_checksum_verified; }
+    void set_checksum_verified() { m_checksum_verified = true; }
+
+private:
+    PacketBuffer(byte* storage, bool pooled, int size, int headroom);
+
+    byte* m_storage { nullptr };
+    bool m_pooled { false };
+    int m_offset { 0 };
+    int m_size { 0 };
+    // From the start of the storage, so they stay put as headers go in front.
+    int m_checksum_start { -1 };
+    int m_checksum_field { -1 };
+    bool m_checksum_verified { false };
+};
@@ -9,6 +9,15 @@
 #include "Console.h"
 #include "Scheduler.h"
 #include <Kernel/PCI.h>
+#include <Kernel/ProcessSnapshot.h>
+#include <Kernel/DiskBackedFileSystem.h>
+#include <Kernel/MultiProcessor.h>
+#include <Kernel/SwapSpace.h>
+#include <Kernel/CompressedSwap.h>
+#include <Kernel/NetworkAdapter.h>
+#include <Kernel/Routing.h>
+#include <Kernel/Tracing.h>
+#include <Kernel/BootProfile.h>
 #include <AK/StringBuilder.h>
 #include <LibC/errno_numbers.h>
 
@@ -31,12 +40,19 @@ enum ProcFileType {
     FI_Root_df,
     FI_Root_kmalloc,
     FI_Root_all,
+    FI_Root_all_bin,
     FI_Root_memstat,
     FI_Root_summary,
     FI_Root_cpuinfo,
     FI_Root_inodes,
     FI_Root_dmesg,
     FI_Root_pci,
+    FI_Root_blockcache,
+    FI_Root_locks,
+    FI_Root_netadapters,
+    FI_Root_routes,
+    FI_Root_trace,
+    FI_Root_boot,
     FI_Root_self, // symlink
     FI_Root_sys, // directory
     __FI_Root_End,
@@ -49,6 +65,10 @@ enum ProcFileType {
     FI_PID_stack,
     FI_PID_regs,
     FI_PID_fds,
+    FI_PID_threads,
+    FI_PID_profile,
+    FI_PID_stats,
+    FI_PID_stats_bin,
     FI_PID_exe, // symlink
     FI_PID_cwd, // symlink
     FI_PID_fd, // directory
@@ -213,6 +233,29 @@ ByteBuffer procfs$pid_fd_entry(InodeIdentifier identifier)
     return result.value().to_byte_buffer();
 }
 
+ByteBuffer procfs$pid_threads(InodeIdentifier identifier)
+{
+    auto handle = ProcessInspectionHandle::from_pid(to_pid(identifier));
+    if (!handle)
+        return { };
+    auto& process = handle->process();
+    StringBuilder builder;
+    builder.appendf("TID  STATE      PRIORITY  BOOST  TICKS     NSCHED    BOOSTED   PREEMPTED\n");
+    process.for_each_thread([&] (Thread& thread) {
+        builder.appendf("% 3u  % 8s   % 6s    % 2d     % 8u  % 8u  % 8u  % 8u\n",
+            thread.tid(),
+            to_string(thread.state()),
+            to_string((Process::Priority)thread.effective_priority()),
+            thread.priority_boost(),
+            thread.ticks(),
+            thread.times_scheduled(),
+            thread.times_boosted(),
+            thread.times_preempted());
+        return IterationDecision::Continue;
+    });
+    return builder.to_byte_buffer();
+}
+
 ByteBuffer procfs$pid_vm(InodeIdentifier identifier)
 {
     auto handle = ProcessInspectionHandle::from_pid(to_pid(identifier));
@@ -220,21 +263,24 @@ ByteBuffer procfs$pid_vm(InodeIdentifier identifier)
         return { };
     auto& process = handle->process();
     StringBuilder builder;
+    builder.reserve(64 + process.regions().size() * 80);
     builder.appendf("BEGIN       END         SIZE      COMMIT     FLAGS  NAME\n");
     for (auto& region : process.regions()) {
-        StringBuilder flags_builder;
+        char flags[4];
+        int flag_count = 0;
         if (region->is_readable())
-            flags_builder.append('R');
+            flags[flag_count++] = 'R';
         if (region->is_writable())
-            flags_builder.append('W');
+            flags[flag_count++] = 'W';
         if (region->is_bitmap())
-            flags_builder.append('B');
+            flags[flag_count++] = 'B';
+        flags[flag_count] = '\0';
         builder.appendf("%x -- %x    %x  %x   % 4s   %s\n",
             region->laddr().get(),
             region->laddr().offset(region->size() - 1).get(),
             region->size(),
             region->amount_resident(),
-            flags_builder.to_string().characters(),
+            flags,
             region->name().characters());
     }
     return builder.to_byte_buffer();
@@ -249,6 +295,35 @@ ByteBuffer procfs$pci(InodeIdentifier)
     return builder.to_byte_buffer();
 }
 
+ByteBuffer procfs$netadapters(InodeIdentifier)
+{
+    StringBuilder builder;
+    for (auto* adapter : NetworkAdapter::all()) {
+        builder.appendf("%s %s %s/%s mtu %d\n",
+            adapter->name().characters(),
+            adapter->mac_address().to_string().characters(),
+            adapter->ipv4_address().to_string().characters(),
+            adapter->ipv4_netmask().to_string().characters(),
+            adapter->mtu());
+    }
+    return builder.to_byte_buffer();
+}
+
+ByteBuffer procfs$routes(InodeIdentifier)
+{
+    StringBuilder builder;
+    builder.appendf("DESTINATION      NETMASK          GATEWAY          ADAPTER  MTU\n");
+    for (auto& route : all_routes()) {
+        builder.appendf("%-16s %-16s %-16s %-8s %d\n",
+            route.destination.to_string().characters(),
+            route.netmask.to_string().characters(),
+            route.gateway.to_string().characters(),
+            route.adapter ? route.adapter->name().characters() : "*",
+            route.mtu);
+    }
+    return builder.to_byte_buffer();
+}
+
 ByteBuffer procfs$pid_vmo(InodeIdentifier identifier)
 {
     auto handle = ProcessInspectionHandle::from_pid(to_pid(identifier));
@@ -313,6 +388,121 @@ ByteBuffer procfs$pid_stack(InodeIdentifier identifier)
     return builder.to_byte_buffer();
 }
 
+// One sample per line: the uptime in ticks, the thread, and the stack from the innermost frame out, all in hex.
+ByteBuffer procfs$pid_profile(InodeIdentifier identifier)
+{
+    auto handle = ProcessInspectionHandle::from_pid(to_pid(identifier));
+    if (!handle)
+        return { };
+    auto& process = handle->process();
+    // The timer interrupt keeps adding to it, so it's copied out before anything slow happens.
+    Vector<ProfileBuffer::Sample> samples;
+    {
+        InterruptDisabler disabler;
+        if (!process.profile_buffer())
+            return { };
+        auto& queue = process.profile_buffer()->samples();
+        samples.ensure_capacity(queue.size());
+        for (int i = 0; i < queue.size(); ++i)
+            samples.unchecked_append(queue.at(i));
+    }
+    StringBuilder builder;
+    builder.reserve(samples.size() * 64);
+    for (auto& sample : samples) {
+        builder.appendf("%x %x", sample.timestamp, sample.tid);
+        for (int i = 0; i < sample.frame_count; ++i)
+            builder.appendf(" %x", sample.frames[i]);
+        builder.append('\n');
+    }
+    return builder.to_byte_buffer();
+}
+
+struct ProcessStatistics {
+    struct ThreadEntry {
+        int tid;
+        ThreadStatistics statistics;
+    };
+    struct FileDescriptorEntry {
+        int fd;
+        qword bytes_read;
+        qword bytes_written;
+    };
+    Vector<ThreadEntry> threads;
+    Vector<FileDescriptorEntry> file_descriptors;
+};
+
+static ProcessStatistics statistics_for(Process& process)
+{
+    ProcessStatistics statistics;
+    // The scheduler and interrupt handlers keep adding to it, so it's copied out all at once.
+    InterruptDisabler disabler;
+    process.for_each_thread([&] (Thread& thread) {
+        statistics.threads.append({ thread.tid(), thread.statistics() });
+        return IterationDecision::Continue;
+    });
+    for (int fd = 0; fd < process.max_open_file_descriptors(); ++fd) {
+        if (auto* descriptor = process.file_descriptor(fd))
+            statistics.file_descriptors.append({ fd, descriptor->bytes_read(), descriptor->bytes_written() });
+    }
+    return statistics;
+}
+
+ByteBuffer procfs$pid_stats(InodeIdentifier identifier)
+{
+    auto handle = ProcessInspectionHandle::from_pid(to_pid(identifier));
+    if (!handle)
+        return { };
+    auto statistics = statistics_for(handle->process());
+    StringBuilder builder;
+    builder.appendf("TID  USER_CYCLES     KERNEL_CYCLES   VOLSW     INVSW     ZERO_PF  COW_PF   INODE_PF  DISK_READ     DISK_WRITTEN\n");
+    for (auto& thread : statistics.threads) {
+        auto& stats = thread.statistics;
+        builder.appendf("% 3u  % 14Q  % 14Q  % 8u  % 8u  % 7u  % 7u  % 8u  % 12Q  % 12Q\n",
+            thread.tid,
+            stats.user_cycles,
+            stats.kernel_cycles,
+            stats.voluntary_switches,
+            stats.involuntary_switches,
+            stats.zero_faults,
+            stats.cow_faults,
+            stats.inode_faults,
+            stats.disk_bytes_read,
+            stats.disk_bytes_written);
+    }
+    builder.appendf("\nTID  COUNT     SYSCALL\n");
+    for (auto& thread : statistics.threads) {
+        for (int function = 0; function < Syscall::function_count; ++function) {
+            if (thread.statistics.syscalls[function])
+                builder.appendf("% 3u  % 8u  %s\n", thread.tid, thread.statistics.syscalls[function], Syscall::to_string((Syscall::Function)function));
+        }
+    }
+    builder.appendf("\nFD   BYTES_READ    BYTES_WRITTEN\n");
+    for (auto& entry : statistics.file_descriptors)
+        builder.appendf("% 3u  % 12Q  % 12Q\n", entry.fd, entry.bytes_read, entry.bytes_written);
+    return builder.to_byte_buffer();
+}
+
+// The same as stats, for programs: a header of three dwords (thread count, file descriptor count
+// and how many syscall counters a ThreadStatistics has), then the ThreadEntries, then the FileDescriptorEntries.
+ByteBuffer procfs$pid_stats_bin(InodeIdentifier identifier)
+{
+    auto handle = ProcessInspectionHandle::from_pid(to_pid(identifier));
+    if (!handle)
+        return { };
+    auto statistics = statistics_for(handle->process());
+    dword header[] = { (dword)statistics.threads.size(), (dword)statistics.file_descriptors.size(), (dword)Syscall::function_count };
+    size_t threads_size = statistics.threads.size() * sizeof(ProcessStatistics::ThreadEntry);
+    size_t file_descriptors_size = statistics.file_descriptors.size() * sizeof(ProcessStatistics::FileDescriptorEntry);
+    auto buffer = ByteBuffer::create_uninitialized(sizeof(header) + threads_size + file_descriptors_size);
+    byte* out = buffer.pointer();
+    memcpy(out, header, sizeof(header));
+    out += sizeof(header);
+    memcpy(out, statistics.threads.data(), threads_size);
+    out += threads_size;
+    memcpy(out, statistics.file_descriptors.data(), file_descriptors_size);
+    return buffer;
+}
+
 ByteBuffer procfs$pid_regs(InodeIdentifier identifier)
 {
     auto handle = ProcessInspectionHandle::from_pid(to_pid(identifier));
@@ -385,7 +575,13 @@ ByteBuffer procfs$mm(InodeIdentifier)
             vmo->name().characters());
     }
     builder.appendf("VMO count: %u\n", MM.m_vmos.size());
-    builder.appendf("Free physical pages: %u\n", MM.m_free_physical_pages.size());
+    builder.appendf("Free physical pages: %u (%u zeroed)\n", MM.free_physical_page_count(), MM.m_zeroed_physical_pages.size());
+    if (auto* swap = SwapSpace::the())
+        builder.appendf("Swap: %u / %u pages free\n", swap->free_slot_count(), swap->slot_count());
+    auto& compressed_swap = CompressedSwap::the();
+    builder.appendf("Compressed swap: %u pages in %u / %u pool pages\n", compressed_swap.stored_page_count(), compressed_swap.pool_page_count(), compressed_swap.max_pool_page_count());
+    for (int order = 0; order <= BuddyAllocator::max_order; ++order)
+        builder.appendf("Free %u-page blocks: %u\n", 1u << order, MM.m_user_physical_allocator.free_block_count(order));
     builder.appendf("Free supervisor physical pages: %u\n", MM.m_free_supervisor_physical_pages.size());
     return builder.to_byte_buffer();
 }
@@ -393,9 +589,11 @@ ByteBuffer procfs$mm(InodeIdentifier)
 ByteBuffer procfs$dmesg(InodeIdentifier)
 {
     InterruptDisabler disabler;
+    auto& logbuffer = Console::the().logbuffer();
     StringBuilder builder;
-    for (char ch : Console::the().logbuffer())
-        builder.append(ch);
+    builder.reserve(logbuffer.size());
+    for (char ch : logbuffer)
+        builder.append_unchecked(ch);
     return builder.to_byte_buffer();
 }
 
@@ -507,6 +705,15 @@ ByteBuffer procfs$cpuinfo(InodeIdentifier)
         copy_brand_string_part_to_buffer(2);
         builder.appendf("brandstr:  \"%s\"\n", buffer);
     }
+    {
+        unsigned enabled_count = 0;
+        for (unsigned i = 0; i < MultiProcessor::processor_count(); ++i) {
+            if (MultiProcessor::processor(i).is_enabled)
+                ++enabled_count;
+        }
+        // Without MP tables, all we know about is the one we're running on.
+        builder.appendf("cpus:      %u (1 in use)\n", max(enabled_count, 1u));
+    }
     return builder.to_byte_buffer();
 }
 
@@ -521,9 +728,54 @@ ByteBuffer procfs$kmalloc(InodeIdentifier)
         sum_alloc,
         sum_free
     );
+    KmallocSlabStats stats;
+    for (size_t i = 0; kmalloc_slab_stats(i, stats); ++i)
+        builder.appendf("slab %u:     %u pages, %u in use\n", stats.object_size, stats.page_count, stats.objects_in_use);
     return builder.to_byte_buffer();
 }
 
+ByteBuffer procfs$blockcache(InodeIdentifier)
+{
+    auto stats = DiskBackedFS::block_cache_stats();
+    StringBuilder builder;
+    builder.appendf(
+        "capacity:     %u\n"
+        "cached:       %u\n"
+        "hits:         %u\n"
+        "misses:       %u\n"
+        "evictions:    %u\n"
+        "dirty:        %u\n",
+        stats.capacity,
+        stats.size,
+        stats.hits,
+        stats.misses,
+        stats.evictions,
+        stats.dirty
+    );
+    return builder.to_byte_buffer();
+}
+
+ByteBuffer procfs$locks(InodeIdentifier)
+{
+    StringBuilder builder;
+    builder.appendf("CONTENDED  WAITED(ms)  NAME\n");
+    LockContentionStats stats;
+    for (size_t i = 0; Lock::contention_stats(i, stats); ++i)
+        builder.appendf("% 9u  % 10u  %s\n", stats.contentions, stats.ticks_waited, stats.name);
+    return builder.to_byte_buffer();
+}
+
+// Tracing::Records, as they are.
+ByteBuffer procfs$trace(InodeIdentifier)
+{
+    return Tracing::records();
+}
+
+ByteBuffer procfs$boot(InodeIdentifier)
+{
+    return BootProfile::report();
+}
+
 ByteBuffer procfs$summary(InodeIdentifier)
 {
     InterruptDisabler disabler;
@@ -555,8 +807,8 @@ ByteBuffer procfs$memstat(InodeIdentifier)
         kmalloc_sum_eternal,
         sum_alloc,
         sum_free,
-        MM.user_physical_pages_in_existence() - MM.m_free_physical_pages.size(),
-        MM.m_free_physical_pages.size(),
+        MM.user_physical_pages_in_existence() - MM.free_physical_page_count(),
+        MM.free_physical_page_count(),
         MM.super_physical_pages_in_existence() - MM.m_free_supervisor_physical_pages.size(),
         MM.m_free_supervisor_physical_pages.size()
     );
@@ -568,6 +820,8 @@ ByteBuffer procfs$all(InodeIdentifier)
     InterruptDisabler disabler;
     auto processes = Process::all_processes();
     StringBuilder builder;
+    // Each line is usually well under this.
+    builder.reserve((processes.size() + 1) * 128);
     auto build_process_line = [&builder] (Process* process) {
         builder.appendf("%u,%u,%u,%u,%u,%u,%u,%s,%u,%u,%s,%s,%u,%u,%u,%u,%s\n",
             process->pid(),
@@ -595,6 +849,49 @@ ByteBuffer procfs$all(InodeIdentifier)
     return builder.to_byte_buffer();
 }
 
+static void copy_snapshot_string(char* destination, size_t size, const char* source)
+{
+    strncpy(destination, source, size - 1);
+    destination[size - 1] = '\0';
+}
+
+ByteBuffer procfs$all_bin(InodeIdentifier)
+{
+    InterruptDisabler disabler;
+    auto processes = Process::all_processes();
+    auto buffer = ByteBuffer::create_zeroed(sizeof(ProcessSnapshotHeader) + (processes.size() + 1) * sizeof(ProcessSnapshotEntry));
+    auto& header = *(ProcessSnapshotHeader*)buffer.pointer();
+    header.version = process_snapshot_version;
+    header.entry_size = sizeof(ProcessSnapshotEntry);
+    header.process_count = processes.size() + 1;
+    header.generation = g_process_list_generation;
+    auto* entry = (ProcessSnapshotEntry*)(&header + 1);
+    auto add_process_entry = [&entry] (Process* process) {
+        entry->pid = process->pid();
+        entry->ppid = process->ppid();
+        entry->pgid = process->pgid();
+        entry->sid = process->sid();
+        entry->tty_pgid = process->tty() ? process->tty()->pgid() : 0;
+        entry->uid = process->uid();
+        entry->gid = process->gid();
+        entry->times_scheduled = process->main_thread().times_scheduled(); // FIXME(Thread): Bill all scheds to the process
+        entry->ticks = process->main_thread().ticks(); // FIXME(Thread): Bill all ticks to the process
+        entry->open_file_descriptors = process->number_of_open_file_descriptors();
+        entry->amount_virtual = process->amount_virtual();
+        entry->amount_resident = process->amount_resident();
+        entry->amount_shared = process->amount_shared();
+        copy_snapshot_string(entry->state, sizeof(entry->state), to_string(process->state()));
+        copy_snapshot_string(entry->priority, sizeof(entry->priority), to_string(process->priority()));
+        copy_snapshot_string(entry->tty, sizeof(entry->tty), process->tty() ? process->tty()->tty_name().characters() : "notty");
+        copy_snapshot_string(entry->name, sizeof(entry->name), process->name().characters());
+        ++entry;
+    };
+    add_process_entry(Scheduler::colonel());
+    for (auto* process : processes)
+        add_process_entry(process);
+    return buffer;
+}
+
 ByteBuffer procfs$inodes(InodeIdentifier)
 {
     extern HashTable<Inode*>& all_inodes();
@@ -617,6 +914,7 @@ struct SysVariableData final : public ProcFSInodeCustomData {
         Invalid,
         Boolean,
         String,
+        Unsigned,
     };
     Type type { Invalid };
     Function<void()> notify_callback;
@@ -699,6 +997,51 @@ static ssize_t write_sys_string(InodeIdentifier inode_id, const ByteBuffer& data
     return data.size();
 }
 
+static ByteBuffer read_sys_unsigned(InodeIdentifier inode_id)
+{
+    auto inode_ptr = ProcFS::the().get_inode(inode_id);
+    if (!inode_ptr)
+        return { };
+    auto& inode = static_cast<ProcFSInode&>(*inode_ptr);
+    ASSERT(inode.custom_data());
+    auto& custom_data = *static_cast<const SysVariableData*>(inode.custom_data());
+    ASSERT(custom_data.type == SysVariableData::Unsigned);
+    ASSERT(custom_data.address);
+    auto* lockable_unsigned = reinterpret_cast<Lockable<unsigned>*>(custom_data.address);
+    StringBuilder builder;
+    {
+        LOCKER(lockable_unsigned->lock());
+        builder.appendf("%u\n", lockable_unsigned->resource());
+    }
+    return builder.to_byte_buffer();
+}
+
+static ssize_t write_sys_unsigned(InodeIdentifier inode_id, const ByteBuffer& data)
+{
+    auto inode_ptr = ProcFS::the().get_inode(inode_id);
+    if (!inode_ptr)
+        return { };
+    auto& inode = static_cast<ProcFSInode&>(*inode_ptr);
+    ASSERT(inode.custom_data());
+    auto& custom_data = *static_cast<const SysVariableData*>(inode.custom_data());
+    ASSERT(custom_data.address);
+    ssize_t length = data.size();
+    while (length && (data[length - 1] == '\n' || data[length - 1] == ' '))
+        --length;
+    bool ok;
+    unsigned value = String((const char*)data.pointer(), length).to_uint(ok);
+    if (!ok)
+        return data.size();
+    {
+        auto* lockable_unsigned = reinterpret_cast<Lockable<unsigned>*>(custom_data.address);
+        LOCKER(lockable_unsigned->lock());
+        lockable_unsigned->resource() = value;
+    }
+    if (custom_data.notify_callback)
+        custom_data.notify_callback();
+    return data.size();
+}
+
 void ProcFS::add_sys_bool(String&& name, Lockable<bool>& var, Function<void()>&& notify_callback)
 {
     InterruptDisabler disabler;
@@ -727,6 +1070,20 @@ void ProcFS::add_sys_string(String&& name, Lockable<String>& var, Function<void(
     m_sys_entries.append({ strdup(name.characters()), name.length(), read_sys_string, write_sys_string, move(inode) });
 }
 
+void ProcFS::add_sys_unsigned(String&& name, Lockable<unsigned>& var, Function<void()>&& notify_callback)
+{
+    InterruptDisabler disabler;
+
+    unsigned index = m_sys_entries.size();
+    auto inode = adopt(*new ProcFSInode(*this, sys_var_to_identifier(fsid(), index).index()));
+    auto data = make<SysVariableData>();
+    data->type = SysVariableData::Unsigned;
+    data->notify_callback = move(notify_callback);
+    data->address = &var;
+    inode->set_custom_data(move(data));
+    m_sys_entries.append({ strdup(name.characters()), name.length(), read_sys_unsigned, write_sys_unsigned, move(inode) });
+}
+
 bool ProcFS::initialize()
 {
     return true;
@@ -878,6 +1235,8 @@ ssize_t ProcFSInode::read_bytes(off_t offset, ssize_t count, byte* buffer, FileD
 
     ASSERT(read_callback);
 
+    // What an open file reads is generated once, on its first read, and is kept until it's closed
+    // or seeked back to the start. Small reads at increasing offsets don't each generate it all again.
     ByteBuffer generated_data;
     if (!descriptor) {
         generated_data = (*read_callback)(identifier());
@@ -888,10 +1247,10 @@ ssize_t ProcFSInode::read_bytes(off_t offset, ssize_t count, byte* buffer, FileD
     }
 
     auto& data = generated_data;
+    if (offset >= data.size())
+        return 0;
     ssize_t nread = min(static_cast<off_t>(data.size() - offset), static_cast<off_t>(count));
     memcpy(buffer, data.pointer() + offset, nread);
-    if (nread == 0 && descriptor && descriptor->generator_cache())
-        descriptor->generator_cache().clear();
     return nread;
 }
 
@@ -900,7 +1259,7 @@ InodeIdentifier ProcFS::ProcFSDirectoryEntry::identifier(unsigned fsid) const
     return to_identifier(fsid, PDI_Root, 0, (ProcFileType)proc_file_type);
 }
 
-bool ProcFSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntry&)> callback) const
+bool ProcFSInode::traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)> callback) const
 {
 #ifdef PROCFS_DEBUG
     dbgprintf("ProcFS: traverse_as_directory %u\n", index());
@@ -1138,6 +1497,7 @@ ProcFS::ProcFS()
     m_entries[FI_Root_df] = { "df", FI_Root_df, procfs$df };
     m_entries[FI_Root_kmalloc] = { "kmalloc", FI_Root_kmalloc, procfs$kmalloc };
     m_entries[FI_Root_all] = { "all", FI_Root_all, procfs$all };
+    m_entries[FI_Root_all_bin] = { "all.bin", FI_Root_all_bin, procfs$all_bin };
     m_entries[FI_Root_memstat] = { "memstat", FI_Root_memstat, procfs$memstat };
     m_entries[FI_Root_summary] = { "summary", FI_Root_summary, procfs$summary };
     m_entries[FI_Root_cpuinfo] = { "cpuinfo", FI_Root_cpuinfo, procfs$cpuinfo};
@@ -1145,6 +1505,12 @@ ProcFS::ProcFS()
     m_entries[FI_Root_dmesg] = { "dmesg", FI_Root_dmesg, procfs$dmesg };
     m_entries[FI_Root_self] = { "self", FI_Root_self, procfs$self };
     m_entries[FI_Root_pci] = { "pci", FI_Root_pci, procfs$pci };
+    m_entries[FI_Root_blockcache] = { "blockcache", FI_Root_blockcache, procfs$blockcache };
+    m_entries[FI_Root_locks] = { "locks", FI_Root_locks, procfs$locks };
+    m_entries[FI_Root_netadapters] = { "netadapters", FI_Root_netadapters, procfs$netadapters };
+    m_entries[FI_Root_routes] = { "routes", FI_Root_routes, procfs$routes };
+    m_entries[FI_Root_trace] = { "trace", FI_Root_trace, procfs$trace };
+    m_entries[FI_Root_boot] = { "boot", FI_Root_boot, procfs$boot };
     m_entries[FI_Root_sys] = { "sys", FI_Root_sys };
 
     m_entries[FI_PID_vm] = { "vm", FI_PID_vm, procfs$pid_vm };
@@ -1152,6 +1518,10 @@ ProcFS::ProcFS()
     m_entries[FI_PID_stack] = { "stack", FI_PID_stack, procfs$pid_stack };
     m_entries[FI_PID_regs] = { "regs", FI_PID_regs, procfs$pid_regs };
     m_entries[FI_PID_fds] = { "fds", FI_PID_fds, procfs$pid_fds };
+    m_entries[FI_PID_threads] = { "threads", FI_PID_threads, procfs$pid_threads };
+    m_entries[FI_PID_profile] = { "profile", FI_PID_profile, procfs$pid_profile };
+    m_entries[FI_PID_stats] = { "stats", FI_PID_stats, procfs$pid_stats };
+    m_entries[FI_PID_stats_bin] = { "stats.bin", FI_PID_stats_bin, procfs$pid_stats_bin };
     m_entries[FI_PID_exe] = { "exe", FI_PID_exe, procfs$pid_exe };
     m_entries[FI_PID_cwd] = { "cwd", FI_PID_cwd, procfs$pid_cwd };
     m_entries[FI_PID_fd] = { "fd", FI_PID_fd };
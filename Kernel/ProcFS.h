@@ -28,6 +28,7 @@ public:
     void add_sys_file(String&&, Function<ByteBuffer(ProcFSInode&)>&& read_callback, Function<ssize_t(ProcFSInode&, const ByteBuffer&)>&& write_callback);
     void add_sys_bool(String&&, Lockable<bool>&, Function<void()>&& notify_callback = nullptr);
     void add_sys_string(String&&, Lockable<String>&, Function<void()>&& notify_callback = nullptr);
+    void add_sys_unsigned(String&&, Lockable<unsigned>&, Function<void()>&& notify_callback = nullptr);
 
 private:
     ProcFS();
@@ -78,7 +79,7 @@ private:
     // ^Inode
     virtual ssize_t read_bytes(off_t, ssize_t, byte* buffer, FileDescriptor*) const override;
     virtual InodeMetadata metadata() const override;
-    virtual bool traverse_as_directory(Function<bool(const FS::DirectoryEntry&)>) const override;
+    virtual bool traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)>) const override;
     virtual InodeIdentifier lookup(const String& name) override;
     virtual String reverse_lookup(InodeIdentifier) override;
     virtual void flush_metadata() override;
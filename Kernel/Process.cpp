@@ -25,6 +25,9 @@
 #include <Kernel/E1000NetworkAdapter.h>
 #include <Kernel/EthernetFrameHeader.h>
 #include <Kernel/ARP.h>
+#include <Kernel/MultiProcessor.h>
+#include <Kernel/TimePage.h>
+#include <Kernel/UserCopy.h>
 
 //#define DEBUG_IO
 //#define TASK_DEBUG
@@ -35,6 +38,7 @@
 
 static pid_t next_pid;
 InlineLinkedList<Process>* g_processes;
+dword g_process_list_generation;
 static String* s_hostname;
 static Lock* s_hostname_lock;
 
@@ -76,20 +80,60 @@ bool Process::in_group(gid_t gid) const
     return m_gids.contains(gid);
 }
 
+// Where regions without an address of their own start out going.
+static const dword first_allocated_region = 0x10000000;
+
+bool Process::range_is_free(LinearAddress laddr, size_t size) const
+{
+    ASSERT(size);
+    if (laddr.get() + size < laddr.get() || laddr.get() + size > physmap_base)
+        return false;
+    // Only the last region starting before the end can reach into the range.
+    auto* region = m_region_tree.find_largest_not_above(laddr.offset(size - 1));
+    return !region || region->laddr().get() + region->size() <= laddr.get();
+}
+
+// Regions go one after another from m_next_region, with an unmapped page after each to catch overruns,
+// which takes one lookup. Once that runs into something, or out of room, it's the first gap that fits.
+LinearAddress Process::allocate_range(size_t size, size_t alignment)
+{
+    auto align = [alignment] (dword address) { return (address + alignment - 1) & ~(alignment - 1); };
+    LinearAddress laddr(align(m_next_region.get()));
+    if (laddr.get() >= m_next_region.get() && range_is_free(laddr, size + PAGE_SIZE)) {
+        m_next_region = laddr.offset(size).offset(PAGE_SIZE);
+        return laddr;
+    }
+    dword candidate = align(first_allocated_region);
+    for (auto* region = m_region_tree.first(); region; region = m_region_tree.next(*region)) {
+        dword region_end = region->laddr().get() + region->size();
+        if (region_end <= candidate)
+            continue;
+        if (region->laddr().get() >= candidate && region->laddr().get() - candidate >= size + PAGE_SIZE)
+            return LinearAddress(candidate);
+        candidate = align(region_end + PAGE_SIZE);
+        if (candidate < region_end)
+            return { };
+    }
+    if (range_is_free(LinearAddress(candidate), size))
+        return LinearAddress(candidate);
+    return { };
+}
+
 Region* Process::allocate_region(LinearAddress laddr, size_t size, String&& name, bool is_readable, bool is_writable, bool commit)
 {
     size = PAGE_ROUND_UP(size);
     // FIXME: This needs sanity checks. What if this overlaps existing regions?
     if (laddr.is_null()) {
-        laddr = m_next_region;
-        m_next_region = m_next_region.offset(size).offset(PAGE_SIZE);
+        laddr = allocate_range(size);
+        if (laddr.is_null())
+            return nullptr;
     }
     laddr.mask(0xfffff000);
-    m_regions.append(adopt(*new Region(laddr, size, move(name), is_readable, is_writable)));
-    MM.map_region(*this, *m_regions.last());
+    auto& region = add_region(adopt(*new Region(laddr, size, move(name), is_readable, is_writable)));
+    MM.map_region(*this, region);
     if (commit)
-        m_regions.last()->commit();
-    return m_regions.last().ptr();
+        region.commit();
+    return &region;
 }
 
 Region* Process::allocate_file_backed_region(LinearAddress laddr, size_t size, RetainPtr<Inode>&& inode, String&& name, bool is_readable, bool is_writable)
@@ -97,13 +141,14 @@ Region* Process::allocate_file_backed_region(LinearAddress laddr, size_t size, R
     size = PAGE_ROUND_UP(size);
     // FIXME: This needs sanity checks. What if this overlaps existing regions?
     if (laddr.is_null()) {
-        laddr = m_next_region;
-        m_next_region = m_next_region.offset(size).offset(PAGE_SIZE);
+        laddr = allocate_range(size);
+        if (laddr.is_null())
+            return nullptr;
     }
     laddr.mask(0xfffff000);
-    m_regions.append(adopt(*new Region(laddr, size, move(inode), move(name), is_readable, is_writable)));
-    MM.map_region(*this, *m_regions.last());
-    return m_regions.last().ptr();
+    auto& region = add_region(adopt(*new Region(laddr, size, move(inode), move(name), is_readable, is_writable)));
+    MM.map_region(*this, region);
+    return &region;
 }
 
 Region* Process::allocate_region_with_vmo(LinearAddress laddr, size_t size, Retained<VMObject>&& vmo, size_t offset_in_vmo, String&& name, bool is_readable, bool is_writable)
@@ -111,15 +156,26 @@ Region* Process::allocate_region_with_vmo(LinearAddress laddr, size_t size, Reta
     size = PAGE_ROUND_UP(size);
     // FIXME: This needs sanity checks. What if this overlaps existing regions?
     if (laddr.is_null()) {
-        laddr = m_next_region;
-        m_next_region = m_next_region.offset(size).offset(PAGE_SIZE);
+        // Big physical ranges get 4 MB alignment, so they can be mapped with large pages.
+        bool wants_large_pages = vmo->is_physical_range() && size >= 4 * MB;
+        laddr = allocate_range(size, wants_large_pages ? 4 * MB : PAGE_SIZE);
+        if (laddr.is_null())
+            return nullptr;
     }
     laddr.mask(0xfffff000);
     offset_in_vmo &= PAGE_MASK;
     size = ceil_div(size, PAGE_SIZE) * PAGE_SIZE;
-    m_regions.append(adopt(*new Region(laddr, size, move(vmo), offset_in_vmo, move(name), is_readable, is_writable)));
-    MM.map_region(*this, *m_regions.last());
-    return m_regions.last().ptr();
+    auto& region = add_region(adopt(*new Region(laddr, size, move(vmo), offset_in_vmo, move(name), is_readable, is_writable)));
+    MM.map_region(*this, region);
+    return &region;
+}
+
+Region& Process::add_region(Retained<Region>&& region)
+{
+    InterruptDisabler disabler;
+    m_region_tree.insert(*region);
+    m_regions.append(move(region));
+    return *m_regions.last();
 }
 
 bool Process::deallocate_region(Region& region)
@@ -128,6 +184,7 @@ bool Process::deallocate_region(Region& region)
     for (int i = 0; i < m_regions.size(); ++i) {
         if (m_regions[i].ptr() == &region) {
             MM.unmap_region(region);
+            m_region_tree.remove(region);
             m_regions.remove(i);
             return true;
         }
@@ -138,10 +195,9 @@ bool Process::deallocate_region(Region& region)
 Region* Process::region_from_range(LinearAddress laddr, size_t size)
 {
     size = PAGE_ROUND_UP(size);
-    for (auto& region : m_regions) {
-        if (region->laddr() == laddr && region->size() == size)
-            return region.ptr();
-    }
+    auto* region = m_region_tree.find(laddr);
+    if (region && region->size() == size)
+        return region;
     return nullptr;
 }
 
@@ -156,6 +212,31 @@ int Process::sys$set_mmap_name(void* addr, size_t size, const char* name)
     return 0;
 }
 
+// Like set_mmap_name(), it takes a whole mapping at a time.
+int Process::sys$madvise(void* addr, size_t size, int advice)
+{
+    auto* region = region_from_range(LinearAddress((dword)addr), size);
+    if (!region)
+        return -EINVAL;
+    switch (advice) {
+    case MADV_NORMAL:
+        region->set_access_pattern(Region::AccessPattern::Normal);
+        return 0;
+    case MADV_SEQUENTIAL:
+        region->set_access_pattern(Region::AccessPattern::Sequential);
+        return 0;
+    case MADV_RANDOM:
+        region->set_access_pattern(Region::AccessPattern::Random);
+        return 0;
+    case MADV_WILLNEED:
+        // Anonymous memory would only be zero pages, there's nothing to get ahead of.
+        if (region->vmo().inode() && !region->page_in())
+            return -ENOMEM;
+        return 0;
+    }
+    return -EINVAL;
+}
+
 void* Process::sys$mmap(const Syscall::SC_mmap_params* params)
 {
     if (!validate_read(params, sizeof(Syscall::SC_mmap_params)))
@@ -170,6 +251,9 @@ void* Process::sys$mmap(const Syscall::SC_mmap_params* params)
         return (void*)-EINVAL;
     if ((dword)addr & ~PAGE_MASK)
         return (void*)-EINVAL;
+    // The kernel half of the address space (physmap and all) is shared by every process.
+    if ((dword)addr + size < (dword)addr || (dword)addr + size > physmap_base)
+        return (void*)-EINVAL;
     if (flags & MAP_ANONYMOUS) {
         auto* region = allocate_region(LinearAddress((dword)addr), size, "mmap", prot & PROT_READ, prot & PROT_WRITE, false);
         if (!region)
@@ -185,11 +269,15 @@ void* Process::sys$mmap(const Syscall::SC_mmap_params* params)
         return (void*)-EBADF;
     if (!descriptor->supports_mmap())
         return (void*)-ENODEV;
-    auto* region = descriptor->mmap(*this, LinearAddress((dword)addr), offset, size, prot);
+    auto* region = descriptor->mmap(*this, LinearAddress((dword)addr), offset, size, prot, flags);
     if (!region)
         return (void*)-ENOMEM;
     if (flags & MAP_SHARED)
         region->set_shared(true);
+    if ((flags & MAP_POPULATE) && region->vmo().inode() && !region->page_in()) {
+        deallocate_region(*region);
+        return (void*)-ENOMEM;
+    }
     return region->laddr().as_ptr();
 }
 
@@ -203,6 +291,42 @@ int Process::sys$munmap(void* addr, size_t size)
     return 0;
 }
 
+void* Process::sys$mremap(const Syscall::SC_mremap_params* params)
+{
+    if (!validate_read(params, sizeof(Syscall::SC_mremap_params)))
+        return (void*)-EFAULT;
+    void* old_address = (void*)params->old_address;
+    size_t old_size = params->old_size;
+    size_t new_size = PAGE_ROUND_UP(params->new_size);
+    int flags = params->flags;
+    if (!new_size || new_size >= physmap_base)
+        return (void*)-EINVAL;
+    if ((dword)old_address & ~PAGE_MASK)
+        return (void*)-EINVAL;
+    auto* region = region_from_range(LinearAddress((dword)old_address), old_size);
+    if (!region)
+        return (void*)-EINVAL;
+    if (new_size == region->size())
+        return old_address;
+    // Each region is put right after the one before, so there's never room to grow into where it is.
+    if (!(flags & MREMAP_MAYMOVE))
+        return (void*)-ENOMEM;
+    // Only memory nobody else can see can move out from under its address.
+    auto& vmo = region->vmo();
+    if (!vmo.is_anonymous() || vmo.is_physical_range() || region->is_shared())
+        return (void*)-EINVAL;
+    if (region->first_page_index() || vmo.page_count() != region->page_count())
+        return (void*)-EINVAL;
+
+    auto laddr = allocate_range(new_size);
+    if (laddr.is_null())
+        return (void*)-ENOMEM;
+    auto new_region = region->move_to(laddr, new_size);
+    deallocate_region(*region);
+    MM.map_region(*this, add_region(move(new_region)));
+    return laddr.as_ptr();
+}
+
 int Process::sys$gethostname(char* buffer, ssize_t size)
 {
     if (size < 0)
@@ -230,10 +354,12 @@ Process* Process::fork(RegisterDump& regs)
 #ifdef FORK_DEBUG
         dbgprintf("fork: cloning Region{%p} \"%s\" L%x\n", region.ptr(), region->name().characters(), region->laddr().get());
 #endif
-        auto cloned_region = region->clone();
-        child->m_regions.append(move(cloned_region));
-        MM.map_region(*child, *child->m_regions.last());
+        auto& cloned_region = child->add_region(region->clone());
+        // Most children exec() right away, so don't build page tables for memory they may never touch.
+        MM.map_region_lazily(*child, cloned_region);
     }
+    // Region::clone() write-protected our COW pages, flush just those unless there were lots of them.
+    MM.flush_deferred_tlb();
 
     for (auto gid : m_gids)
         child->m_gids.set(gid);
@@ -255,6 +381,9 @@ Process* Process::fork(RegisterDump& regs)
     child_tss.fs = regs.fs;
     child_tss.gs = regs.gs;
     child_tss.ss = regs.ss_if_crossRing;
+    // The child got its own copy of our thread pointer segment.
+    if (child->main_thread().thread_pointer_selector())
+        child_tss.gs = child->main_thread().thread_pointer_selector();
 
 #ifdef FORK_DEBUG
     dbgprintf("fork: child will begin executing at %w:%x with stack %w:%x, kstack %w:%x\n", child_tss.cs, child_tss.eip, child_tss.ss, child_tss.esp, child_tss.ss0, child_tss.esp0);
@@ -263,6 +392,7 @@ Process* Process::fork(RegisterDump& regs)
     {
         InterruptDisabler disabler;
         g_processes->prepend(child);
+        ++g_process_list_generation;
         system.nprocess++;
     }
 #ifdef TASK_DEBUG
@@ -281,6 +411,28 @@ pid_t Process::sys$fork(RegisterDump& regs)
     return child->pid();
 }
 
+// The text of an executable lives in its inode's VMO, which every process running it maps.
+// Keep the VMOs of the last few programs alive after they exit, so relaunching one maps its
+// already-resident text pages right away instead of faulting them back in one by one.
+static const int max_retained_executable_vmos = 16;
+
+static void retain_executable_vmo(VMObject& vmo)
+{
+    static Vector<RetainPtr<VMObject>>* s_vmos;
+    InterruptDisabler disabler;
+    if (!s_vmos)
+        s_vmos = new Vector<RetainPtr<VMObject>>;
+    for (int i = 0; i < s_vmos->size(); ++i) {
+        if ((*s_vmos)[i].ptr() == &vmo) {
+            s_vmos->remove(i);
+            break;
+        }
+    }
+    s_vmos->insert(0, &vmo);
+    if (s_vmos->size() > max_retained_executable_vmos)
+        s_vmos->take_last();
+}
+
 int Process::do_exec(String path, Vector<String> arguments, Vector<String> environment)
 {
     ASSERT(is_ring3());
@@ -289,7 +441,7 @@ int Process::do_exec(String path, Vector<String> arguments, Vector<String> envir
     // FIXME(Thread): Kill any threads the moment we commit to the exec().
     ASSERT(thread_count() == 1);
 
-    auto parts = path.split('/');
+    auto parts = path.view().split_view('/');
     if (parts.is_empty())
         return -ENOENT;
 
@@ -321,54 +473,101 @@ int Process::do_exec(String path, Vector<String> arguments, Vector<String> envir
 #else
     vmo->set_name("ELF image");
 #endif
+    retain_executable_vmo(*vmo);
     RetainPtr<Region> region = allocate_region_with_vmo(LinearAddress(), descriptor->metadata().size, vmo.copy_ref(), 0, "executable", true, false);
 
-    if (this != &current->process()) {
-        // FIXME: Don't force-load the entire executable at once, let the on-demand pager take care of it.
-        bool success = region->page_in();
-        ASSERT(success);
-    }
+    Vector<Elf32_auxv_t> auxiliary_values;
     {
         // Okay, here comes the sleight of hand, pay close attention..
         auto old_regions = move(m_regions);
-        m_regions.append(*region);
-        ELFLoader loader(region->laddr().as_ptr());
-        loader.map_section_hook = [&] (LinearAddress laddr, size_t size, size_t alignment, size_t offset_in_image, bool is_readable, bool is_writable, const String& name) {
-            ASSERT(size);
-            ASSERT(alignment == PAGE_SIZE);
-            size = ceil_div(size, PAGE_SIZE) * PAGE_SIZE;
-            (void) allocate_region_with_vmo(laddr, size, vmo.copy_ref(), offset_in_image, String(name), is_readable, is_writable);
-            return laddr.as_ptr();
+        auto old_region_tree = move(m_region_tree);
+        old_region_tree.remove(*region);
+        add_region(*region);
+
+        auto load_image = [&] (ELFLoader& loader, Inode& image_inode, VMObject& image_vmo) {
+            loader.map_section_hook = [&] (LinearAddress laddr, size_t size, size_t alignment, size_t offset_in_image, bool is_readable, bool is_writable, const String& name) {
+                ASSERT(size);
+                ASSERT(alignment == PAGE_SIZE);
+                size += laddr.get() & 0xfff;
+                size = ceil_div(size, PAGE_SIZE) * PAGE_SIZE;
+                // Read-only segments share the inode's VMO (and page cache) with everyone running this executable.
+                // Writable ones get a private VMO whose pages are copied from the page cache on first write.
+                auto segment_vmo = is_writable ? VMObject::create_private_file_backed(&image_inode) : Retained<VMObject>(image_vmo);
+                (void) allocate_region_with_vmo(laddr, size, move(segment_vmo), offset_in_image, String(name), is_readable, is_writable);
+                return laddr.as_ptr();
+            };
+            loader.alloc_section_hook = [&] (LinearAddress laddr, size_t size, size_t alignment, bool is_readable, bool is_writable, const String& name) {
+                ASSERT(size);
+                ASSERT(alignment == PAGE_SIZE);
+                size += laddr.get() & 0xfff;
+                laddr.mask(0xffff000);
+                size = ceil_div(size, PAGE_SIZE) * PAGE_SIZE;
+                (void) allocate_region(laddr, size, String(name), is_readable, is_writable);
+                return laddr.as_ptr();
+            };
+            return loader.load() && loader.entry().get();
         };
-        loader.alloc_section_hook = [&] (LinearAddress laddr, size_t size, size_t alignment, bool is_readable, bool is_writable, const String& name) {
-            ASSERT(size);
-            ASSERT(alignment == PAGE_SIZE);
-            size += laddr.get() & 0xfff;
-            laddr.mask(0xffff000);
-            size = ceil_div(size, PAGE_SIZE) * PAGE_SIZE;
-            (void) allocate_region(laddr, size, String(name), is_readable, is_writable);
-            return laddr.as_ptr();
-        };
-        bool success = loader.load();
-        if (!success || !loader.entry().get()) {
+
+        ELFLoader loader(region->laddr().as_ptr());
+        bool success = load_image(loader, *descriptor->inode(), *vmo);
+
+        // Dynamically linked programs start out in their interpreter (the dynamic loader), which is told
+        // where to find the program through the auxiliary vector.
+        if (success && loader.image().interpreter()) {
+            String interpreter_path = loader.image().interpreter();
+            auto interpreter_result = VFS::the().open(interpreter_path, 0, 0, cwd_inode());
+            if (interpreter_result.is_error() || !interpreter_result.value()->metadata().is_regular_file()) {
+                success = false;
+            } else {
+                auto interpreter_descriptor = interpreter_result.value();
+                auto interpreter_vmo = VMObject::create_file_backed(interpreter_descriptor->inode());
+                interpreter_vmo->set_name("ELF interpreter");
+                retain_executable_vmo(*interpreter_vmo);
+                auto* interpreter_region = allocate_region_with_vmo(LinearAddress(), interpreter_descriptor->metadata().size, interpreter_vmo.copy_ref(), 0, "interpreter", true, false);
+                ELFLoader interpreter_loader(interpreter_region->laddr().as_ptr());
+                success = load_image(interpreter_loader, *interpreter_descriptor->inode(), *interpreter_vmo);
+                if (success) {
+                    entry_eip = interpreter_loader.entry().get();
+                    auxiliary_values.append({ AT_PHDR, { region->laddr().get() + loader.image().program_header_table_offset() } });
+                    auxiliary_values.append({ AT_PHENT, { sizeof(Elf32_Phdr) } });
+                    auxiliary_values.append({ AT_PHNUM, { loader.image().program_header_count() } });
+                    auxiliary_values.append({ AT_PAGESZ, { PAGE_SIZE } });
+                    auxiliary_values.append({ AT_ENTRY, { loader.entry().get() } });
+                }
+            }
+        } else if (success) {
+            entry_eip = loader.entry().get();
+        }
+
+        if (!success) {
             m_page_directory = move(old_page_directory);
             // FIXME: RAII this somehow instead.
-            ASSERT(&current->process() == this);
-            MM.enter_process_paging_scope(*this);
+            if (&current->process() == this)
+                MM.enter_process_paging_scope(*this);
             m_regions = move(old_regions);
+            m_region_tree = move(old_region_tree);
+            m_region_tree.insert(*region);
             kprintf("do_exec: Failure loading %s\n", path.characters());
             return -ENOEXEC;
         }
 
-        entry_eip = loader.entry().get();
+        // Our shared buffer mappings went away with the old image's regions.
+        disown_all_shared_buffers();
+
+        if (auto* time_page_region = allocate_region_with_vmo(LinearAddress(), PAGE_SIZE, PIT::time_page_vmo(), 0, "TimePage", true, false))
+            auxiliary_values.append({ AT_TIME_PAGE, { time_page_region->laddr().get() } });
+        auxiliary_values.append({ AT_NULL, { 0 } });
     }
 
-    kfree(current->m_kernel_stack_for_signal_handler);
-    current->m_kernel_stack_for_signal_handler = nullptr;
-    current->m_signal_stack_user_region = nullptr;
-    current->set_default_signal_dispositions();
-    current->m_signal_mask = 0;
-    current->m_pending_signals = 0;
+    // NOTE: This isn't necessarily the current thread, posix_spawn() execs its not-yet-running child.
+    auto& thread = main_thread();
+    kfree(thread.m_kernel_stack_for_signal_handler);
+    thread.m_kernel_stack_for_signal_handler = nullptr;
+    thread.m_signal_stack_user_region = nullptr;
+    thread.set_default_signal_dispositions();
+    thread.m_signal_mask = 0;
+    thread.m_pending_signals = 0;
+    thread.clear_thread_pointer();
 
     for (int i = 0; i < m_fds.size(); ++i) {
         auto& daf = m_fds[i];
@@ -386,7 +585,8 @@ int Process::do_exec(String path, Vector<String> arguments, Vector<String> envir
 
     Scheduler::prepare_to_modify_tss(main_thread());
 
-    m_name = parts.take_last();
+    m_name = String(parts.last());
+    ++g_process_list_generation;
 
     // ss0 sp!!!!!!!!!
     dword old_esp0 = main_thread().m_tss.esp0;
@@ -401,7 +601,7 @@ int Process::do_exec(String path, Vector<String> arguments, Vector<String> envir
     main_thread().m_tss.gs = 0x23;
     main_thread().m_tss.ss = 0x23;
     main_thread().m_tss.cr3 = page_directory().cr3();
-    main_thread().make_userspace_stack_for_main_thread(move(arguments), move(environment));
+    main_thread().make_userspace_stack_for_main_thread(move(arguments), move(environment), auxiliary_values);
     main_thread().m_tss.ss0 = 0x10;
     main_thread().m_tss.esp0 = old_esp0;
     main_thread().m_tss.ss2 = m_pid;
@@ -442,34 +642,22 @@ int Process::sys$execve(const char* filename, const char** argv, const char** en
     //       On success, the kernel stack will be lost.
     if (!validate_read_str(filename))
         return -EFAULT;
-    if (argv) {
-        if (!validate_read_typed(argv))
-            return -EFAULT;
-        for (size_t i = 0; argv[i]; ++i) {
-            if (!validate_read_str(argv[i]))
-                return -EFAULT;
-        }
-    }
-    if (envp) {
-        if (!validate_read_typed(envp))
-            return -EFAULT;
-        for (size_t i = 0; envp[i]; ++i) {
-            if (!validate_read_str(envp[i]))
-                return -EFAULT;
-        }
-    }
+    if (argv && !validate_read_string_array(argv))
+        return -EFAULT;
+    if (envp && !validate_read_string_array(envp))
+        return -EFAULT;
 
     String path(filename);
     Vector<String> arguments;
     Vector<String> environment;
     {
-        auto parts = path.split('/');
+        auto parts = path.view().split_view('/');
         if (argv) {
             for (size_t i = 0; argv[i]; ++i) {
                 arguments.append(argv[i]);
             }
         } else {
-            arguments.append(parts.last());
+            arguments.append(String(parts.last()));
         }
 
         if (envp) {
@@ -483,12 +671,140 @@ int Process::sys$execve(const char* filename, const char** argv, const char** en
     return rc;
 }
 
+bool Process::validate_read_string_array(const char* const* strings)
+{
+    for (size_t i = 0;; ++i) {
+        if (!validate_read_typed(&strings[i]))
+            return false;
+        if (!strings[i])
+            return true;
+        if (!validate_read_str(strings[i]))
+            return false;
+    }
+}
+
+// Applies one posix_spawn() file action to this (not yet running) process's descriptor table.
+int Process::apply_spawn_file_action(const Syscall::SC_posix_spawn_file_action& action)
+{
+    if (action.fd < 0 || action.fd >= m_fds.size())
+        return -EBADF;
+    switch (action.type) {
+    case Syscall::SpawnFileActionType::Open: {
+        auto result = VFS::the().open(action.path, action.options, action.mode & ~umask(), cwd_inode());
+        if (result.is_error())
+            return result.error();
+        auto descriptor = result.value();
+        if (m_fds[action.fd])
+            m_fds[action.fd].descriptor->close();
+        m_fds[action.fd].set(move(descriptor), (action.options & O_CLOEXEC) ? FD_CLOEXEC : 0);
+        return 0;
+    }
+    case Syscall::SpawnFileActionType::Close:
+        if (!m_fds[action.fd])
+            return -EBADF;
+        m_fds[action.fd].descriptor->close();
+        m_fds[action.fd] = { };
+        return 0;
+    case Syscall::SpawnFileActionType::Dup2: {
+        auto* descriptor = file_descriptor(action.fd);
+        if (!descriptor)
+            return -EBADF;
+        if (action.new_fd < 0 || action.new_fd >= m_fds.size())
+            return -EBADF;
+        if (action.new_fd == action.fd)
+            return 0;
+        Retained<FileDescriptor> retained_descriptor(*descriptor);
+        if (m_fds[action.new_fd])
+            m_fds[action.new_fd].descriptor->close();
+        m_fds[action.new_fd].set(move(retained_descriptor));
+        return 0;
+    }
+    }
+    return -EINVAL;
+}
+
+// Creates a child that starts out running a new program, without ever duplicating our address space.
+// This is what fork()+exec() amounts to for most callers, minus the cost of cloning every region.
+pid_t Process::sys$posix_spawn(const Syscall::SC_posix_spawn_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    if (!validate_read_str(params->path))
+        return -EFAULT;
+    if (params->argv && !validate_read_string_array(params->argv))
+        return -EFAULT;
+    if (params->envp && !validate_read_string_array(params->envp))
+        return -EFAULT;
+    if (params->file_action_count < 0)
+        return -EINVAL;
+    if (params->file_action_count && !validate_read(params->file_actions, params->file_action_count * sizeof(Syscall::SC_posix_spawn_file_action)))
+        return -EFAULT;
+    for (int i = 0; i < params->file_action_count; ++i) {
+        auto& action = params->file_actions[i];
+        if (action.type == Syscall::SpawnFileActionType::Open && !validate_read_str(action.path))
+            return -EFAULT;
+    }
+
+    String path(params->path);
+    auto parts = path.view().split_view('/');
+    if (parts.is_empty())
+        return -ENOENT;
+    Vector<String> arguments;
+    Vector<String> environment;
+    if (params->argv) {
+        for (size_t i = 0; params->argv[i]; ++i)
+            arguments.append(params->argv[i]);
+    } else {
+        arguments.append(String(parts.last()));
+    }
+    if (params->envp) {
+        for (size_t i = 0; params->envp[i]; ++i)
+            environment.append(params->envp[i]);
+    }
+
+    // The child inherits what a forked child would (descriptors, ids, cwd, umask) but none of our regions.
+    auto* child = new Process(String(parts.last()), m_uid, m_gid, m_pid, m_ring, m_cwd.copy_ref(), m_executable.copy_ref(), m_tty, this);
+    child->m_euid = m_euid;
+    child->m_egid = m_egid;
+    for (auto gid : m_gids)
+        child->m_gids.set(gid);
+
+    for (int i = 0; i < params->file_action_count; ++i) {
+        int error = child->apply_spawn_file_action(params->file_actions[i]);
+        if (error < 0) {
+            delete child;
+            return error;
+        }
+    }
+    if (params->flags & POSIX_SPAWN_SETPGROUP)
+        child->m_pgid = params->pgroup ? params->pgroup : child->m_pid;
+
+    int error = child->exec(move(path), move(arguments), move(environment));
+    if (error < 0) {
+        delete child;
+        return error;
+    }
+    // exec() has put every signal back to its default disposition already, so there's nothing to do for POSIX_SPAWN_SETSIGDEF.
+    // Without POSIX_SPAWN_SETSIGMASK the child starts out with our mask, as POSIX asks.
+    child->main_thread().m_signal_mask = (params->flags & POSIX_SPAWN_SETSIGMASK) ? params->sigmask : current->m_signal_mask;
+
+    {
+        InterruptDisabler disabler;
+        g_processes->prepend(child);
+        ++g_process_list_generation;
+        system.nprocess++;
+    }
+#ifdef TASK_DEBUG
+    kprintf("Process %u (%s) spawned by %u @ %p\n", child->pid(), child->name().characters(), m_pid, child->main_thread().tss().eip);
+#endif
+    return child->pid();
+}
+
 Process* Process::create_user_process(const String& path, uid_t uid, gid_t gid, pid_t parent_pid, int& error, Vector<String>&& arguments, Vector<String>&& environment, TTY* tty)
 {
-    // FIXME: Don't split() the path twice (sys$spawn also does it...)
-    auto parts = path.split('/');
+    auto parts = path.view().split_view('/');
     if (arguments.is_empty()) {
-        arguments.append(parts.last());
+        arguments.append(String(parts.last()));
     }
     RetainPtr<Inode> cwd;
     {
@@ -500,7 +816,7 @@ Process* Process::create_user_process(const String& path, uid_t uid, gid_t gid,
     if (!cwd)
         cwd = VFS::the().root_inode();
 
-    auto* process = new Process(parts.take_last(), uid, gid, parent_pid, Ring3, move(cwd), nullptr, tty);
+    auto* process = new Process(String(parts.last()), uid, gid, parent_pid, Ring3, move(cwd), nullptr, tty);
 
     error = process->exec(path, move(arguments), move(environment));
     if (error != 0) {
@@ -511,6 +827,7 @@ Process* Process::create_user_process(const String& path, uid_t uid, gid_t gid,
     {
         InterruptDisabler disabler;
         g_processes->prepend(process);
+        ++g_process_list_generation;
         system.nprocess++;
     }
 #ifdef TASK_DEBUG
@@ -528,6 +845,7 @@ Process* Process::create_kernel_process(String&& name, void (*e)())
     if (process->pid() != 0) {
         InterruptDisabler disabler;
         g_processes->prepend(process);
+        ++g_process_list_generation;
         system.nprocess++;
 #ifdef TASK_DEBUG
         kprintf("Kernel process %u (%s) spawned @ %p\n", process->pid(), process->name().characters(), process->main_thread().tss().eip);
@@ -600,13 +918,14 @@ Process::Process(String&& name, uid_t uid, gid_t gid, pid_t ppid, RingLevel ring
     if (fork_parent)
         m_next_region = fork_parent->m_next_region;
     else
-        m_next_region = LinearAddress(0x10000000);
+        m_next_region = LinearAddress(first_allocated_region);
 
 
     if (fork_parent) {
         m_sid = fork_parent->m_sid;
         m_pgid = fork_parent->m_pgid;
         m_umask = fork_parent->m_umask;
+        m_cpu_affinity = fork_parent->m_cpu_affinity;
     }
 }
 
@@ -697,6 +1016,7 @@ void Process::create_signal_trampolines_if_needed()
 int Process::sys$restore_signal_mask(dword mask)
 {
     current->m_signal_mask = mask;
+    Scheduler::note_pending_signals();
     return 0;
 }
 
@@ -768,6 +1088,18 @@ ssize_t Process::sys$get_dir_entries(int fd, void* buffer, ssize_t size)
     return descriptor->get_dir_entries((byte*)buffer, size);
 }
 
+ssize_t Process::sys$get_dir_entries_with_stat(int fd, void* buffer, ssize_t size)
+{
+    if (size < 0)
+        return -EINVAL;
+    if (!validate_write(buffer, size))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(fd);
+    if (!descriptor)
+        return -EBADF;
+    return descriptor->get_dir_entries_with_stat((byte*)buffer, size);
+}
+
 int Process::sys$lseek(int fd, off_t offset, int whence)
 {
     auto* descriptor = file_descriptor(fd);
@@ -825,20 +1157,25 @@ ssize_t Process::sys$write(int fd, const byte* data, ssize_t size)
     auto* descriptor = file_descriptor(fd);
     if (!descriptor)
         return -EBADF;
+    return do_write(fd, *descriptor, data, size);
+}
+
+ssize_t Process::do_write(int fd, FileDescriptor& descriptor, const byte* data, ssize_t size)
+{
     ssize_t nwritten = 0;
-    if (descriptor->is_blocking()) {
+    if (descriptor.is_blocking()) {
         while (nwritten < (ssize_t)size) {
 #ifdef IO_DEBUG
             dbgprintf("while %u < %u\n", nwritten, size);
 #endif
-            if (!descriptor->can_write(*this)) {
+            if (!descriptor.can_write(*this)) {
 #ifdef IO_DEBUG
                 dbgprintf("block write on %d\n", fd);
 #endif
                 current->m_blocked_fd = fd;
                 current->block(Thread::State::BlockedWrite);
             }
-            ssize_t rc = descriptor->write(*this, (const byte*)data + nwritten, size - nwritten);
+            ssize_t rc = descriptor.write(*this, (const byte*)data + nwritten, size - nwritten);
 #ifdef IO_DEBUG
             dbgprintf("   -> write returned %d\n", rc);
 #endif
@@ -857,8 +1194,9 @@ ssize_t Process::sys$write(int fd, const byte* data, ssize_t size)
             nwritten += rc;
         }
     } else {
-        nwritten = descriptor->write(*this, (const byte*)data, size);
+        nwritten = descriptor.write(*this, (const byte*)data, size);
     }
+    descriptor.did_write(nwritten);
     if (current->has_unmasked_pending_signals()) {
         current->block(Thread::State::BlockedSignal);
         if (nwritten == 0)
@@ -867,6 +1205,67 @@ ssize_t Process::sys$write(int fd, const byte* data, ssize_t size)
     return nwritten;
 }
 
+// Moves data from an inode-backed descriptor to any writable one without a trip through userspace.
+// The source is read through its inode (and so the page cache) straight into a kernel bounce buffer.
+ssize_t Process::sys$sendfile(const Syscall::SC_sendfile_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    int out_fd = params->out_fd;
+    int in_fd = params->in_fd;
+    off_t* offset = (off_t*)params->offset;
+    size_t count = params->count;
+    if (offset && !validate_write_typed(offset))
+        return -EFAULT;
+    if ((ssize_t)count < 0)
+        return -EINVAL;
+    auto* in_descriptor = file_descriptor(in_fd);
+    auto* out_descriptor = file_descriptor(out_fd);
+    if (!in_descriptor || !out_descriptor)
+        return -EBADF;
+    if (in_descriptor->is_device() || in_descriptor->is_fifo() || in_descriptor->is_socket())
+        return -EINVAL;
+    auto* inode = in_descriptor->inode();
+    if (!inode || in_descriptor->is_directory())
+        return -EINVAL;
+
+    off_t in_offset = offset ? *offset : in_descriptor->seek(0, SEEK_CUR);
+    if (in_offset < 0)
+        return -EINVAL;
+
+    static const ssize_t sendfile_chunk_size = 65536;
+    auto buffer = ByteBuffer::create_uninitialized(min((ssize_t)count, sendfile_chunk_size));
+    ssize_t total = 0;
+    while (total < (ssize_t)count) {
+        ssize_t chunk = min((ssize_t)count - total, sendfile_chunk_size);
+        ssize_t nread = inode->read_bytes(in_offset, chunk, buffer.pointer(), in_descriptor);
+        if (nread < 0) {
+            if (total)
+                break;
+            return nread;
+        }
+        if (nread == 0)
+            break;
+        in_descriptor->did_read(nread);
+        ssize_t nwritten = do_write(out_fd, *out_descriptor, buffer.pointer(), nread);
+        if (nwritten < 0) {
+            if (total)
+                break;
+            return nwritten;
+        }
+        in_offset += nwritten;
+        total += nwritten;
+        if (nwritten < nread)
+            break;
+    }
+
+    if (offset)
+        *offset = in_offset;
+    else
+        in_descriptor->seek(in_offset, SEEK_SET);
+    return total;
+}
+
 ssize_t Process::sys$read(int fd, byte* buffer, ssize_t size)
 {
     if (size < 0)
@@ -879,15 +1278,148 @@ ssize_t Process::sys$read(int fd, byte* buffer, ssize_t size)
     auto* descriptor = file_descriptor(fd);
     if (!descriptor)
         return -EBADF;
-    if (descriptor->is_blocking()) {
-        if (!descriptor->can_read(*this)) {
+    return do_read(fd, *descriptor, buffer, size);
+}
+
+ssize_t Process::do_read(int fd, FileDescriptor& descriptor, byte* buffer, ssize_t size)
+{
+    if (descriptor.is_blocking()) {
+        if (!descriptor.can_read(*this)) {
             current->m_blocked_fd = fd;
             current->block(Thread::State::BlockedRead);
             if (current->m_was_interrupted_while_blocked)
                 return -EINTR;
         }
     }
-    return descriptor->read(*this, buffer, size);
+    ssize_t nread = descriptor.read(*this, buffer, size);
+    descriptor.did_read(nread);
+    return nread;
+}
+
+static const int max_iovecs = 1024;
+
+// Vectors totalling up to this much are gathered into (or scattered from) one kernel buffer,
+// so a single descriptor read/write sees the whole thing. Sockets and FIFOs care about that.
+static const ssize_t max_gathered_io_size = 65536;
+
+bool Process::validate_iovecs(const iovec* iov, int iov_count, bool for_writing, ssize_t& total_length)
+{
+    if (!validate_read_typed(iov, iov_count))
+        return false;
+    total_length = 0;
+    for (int i = 0; i < iov_count; ++i) {
+        if ((ssize_t)iov[i].iov_len < 0)
+            return false;
+        if (for_writing ? !validate_write(iov[i].iov_base, iov[i].iov_len) : !validate_read(iov[i].iov_base, iov[i].iov_len))
+            return false;
+        total_length += iov[i].iov_len;
+        if (total_length < 0)
+            return false;
+    }
+    return true;
+}
+
+ssize_t Process::sys$readv(int fd, const iovec* iov, int iov_count)
+{
+    if (iov_count < 0 || iov_count > max_iovecs)
+        return -EINVAL;
+    ssize_t total_length;
+    if (!validate_iovecs(iov, iov_count, true, total_length))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(fd);
+    if (!descriptor)
+        return -EBADF;
+
+    // Files can be read straight into each vector; for everything else one read should fill as many as it can.
+    if (descriptor->is_seekable() || total_length > max_gathered_io_size) {
+        ssize_t nread = 0;
+        for (int i = 0; i < iov_count; ++i) {
+            ssize_t rc = do_read(fd, *descriptor, (byte*)iov[i].iov_base, iov[i].iov_len);
+            if (rc < 0)
+                return nread ? nread : rc;
+            nread += rc;
+            if (rc < (ssize_t)iov[i].iov_len)
+                break;
+        }
+        return nread;
+    }
+
+    auto buffer = ByteBuffer::create_uninitialized(total_length);
+    ssize_t nread = do_read(fd, *descriptor, buffer.pointer(), total_length);
+    if (nread <= 0)
+        return nread;
+    ssize_t offset = 0;
+    for (int i = 0; i < iov_count && offset < nread; ++i) {
+        ssize_t chunk = min((ssize_t)iov[i].iov_len, nread - offset);
+        memcpy(iov[i].iov_base, buffer.pointer() + offset, chunk);
+        offset += chunk;
+    }
+    return nread;
+}
+
+ssize_t Process::sys$writev(int fd, const iovec* iov, int iov_count)
+{
+    if (iov_count < 0 || iov_count > max_iovecs)
+        return -EINVAL;
+    ssize_t total_length;
+    if (!validate_iovecs(iov, iov_count, false, total_length))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(fd);
+    if (!descriptor)
+        return -EBADF;
+
+    if (total_length > max_gathered_io_size) {
+        ssize_t nwritten = 0;
+        for (int i = 0; i < iov_count; ++i) {
+            ssize_t rc = do_write(fd, *descriptor, (const byte*)iov[i].iov_base, iov[i].iov_len);
+            if (rc < 0)
+                return nwritten ? nwritten : rc;
+            nwritten += rc;
+            if (rc < (ssize_t)iov[i].iov_len)
+                break;
+        }
+        return nwritten;
+    }
+
+    auto buffer = ByteBuffer::create_uninitialized(total_length);
+    ssize_t offset = 0;
+    for (int i = 0; i < iov_count; ++i) {
+        memcpy(buffer.pointer() + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    return do_write(fd, *descriptor, buffer.pointer(), total_length);
+}
+
+ssize_t Process::sys$pread(const Syscall::SC_pread_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    if (params->size < 0)
+        return -EINVAL;
+    if (!validate_write(params->buffer, params->size))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(params->fd);
+    if (!descriptor)
+        return -EBADF;
+    ssize_t nread = descriptor->read_at(params->offset, (byte*)params->buffer, params->size);
+    descriptor->did_read(nread);
+    return nread;
+}
+
+ssize_t Process::sys$pwrite(const Syscall::SC_pread_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    if (params->size < 0)
+        return -EINVAL;
+    if (!validate_read(params->buffer, params->size))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(params->fd);
+    if (!descriptor)
+        return -EBADF;
+    ssize_t nwritten = descriptor->write_at(params->offset, (const byte*)params->buffer, params->size);
+    descriptor->did_write(nwritten);
+    return nwritten;
 }
 
 int Process::sys$close(int fd)
@@ -962,7 +1494,7 @@ int Process::sys$fcntl(int fd, int cmd, dword arg)
     case F_GETFL:
         return descriptor->file_flags();
     case F_SETFL:
-        // FIXME: Support changing O_NONBLOCK
+        descriptor->set_blocking(!(arg & O_NONBLOCK));
         descriptor->set_file_flags(arg);
         break;
     default:
@@ -1077,6 +1609,8 @@ int Process::sys$open(const char* path, int options, mode_t mode)
         return -ENOTDIR; // FIXME: This should be handled by VFS::open.
     if (options & O_NONBLOCK)
         descriptor->set_blocking(false);
+    // Only the access mode and the status flags outlive the open.
+    descriptor->set_file_flags(options & (O_RDONLY | O_WRONLY | O_RDWR | O_APPEND | O_NONBLOCK | O_DIRECT));
 
     int fd = 0;
     for (; fd < (int)m_max_open_file_descriptors; ++fd) {
@@ -1236,15 +1770,29 @@ int Process::sys$sleep(unsigned seconds)
 
 void kgettimeofday(timeval& tv)
 {
-    tv.tv_sec = RTC::boot_time() + PIT::seconds_since_boot();
-    tv.tv_usec = PIT::ticks_this_second() * 1000;
+    InterruptDisabler disabler;
+    // Reading the TSC is a lot quicker than asking the PIT. That only works while it's ticking, though.
+    auto* time_page = PIT::time_page();
+    if (time_page && !PIT::is_tickless()) {
+        dword seconds;
+        dword microseconds;
+        if (read_time_page(*time_page, seconds, microseconds)) {
+            tv.tv_sec = seconds;
+            tv.tv_usec = microseconds;
+            return;
+        }
+    }
+    dword microseconds = PIT::ticks_this_second() * 1000 + PIT::microseconds_since_last_tick();
+    tv.tv_sec = RTC::boot_time() + PIT::seconds_since_boot() + microseconds / 1000000;
+    tv.tv_usec = microseconds % 1000000;
 }
 
-int Process::sys$gettimeofday(timeval* tv)
+int Process::sys$gettimeofday(timeval* user_tv)
 {
-    if (!validate_write_typed(tv))
+    timeval tv;
+    kgettimeofday(tv);
+    if (!copy_to_user(user_tv, tv))
         return -EFAULT;
-    kgettimeofday(*tv);
     return 0;
 }
 
@@ -1303,6 +1851,9 @@ int Process::reap(Process& process)
         dbgprintf("reap: %s(%u) {%s}\n", process.name().characters(), process.pid(), to_string(process.state()));
         ASSERT(process.is_dead());
         g_processes->remove(&process);
+        ++g_process_list_generation;
+        // Any dead children it had are unparented now, and can be reaped by the scheduler.
+        Scheduler::note_process_death();
     }
     delete &process;
     return exit_status;
@@ -1458,7 +2009,7 @@ bool Process::validate_write(void* address, ssize_t size) const
         if (!MM.validate_user_write(*this, last_address))
             return false;
     }
-    return MM.validate_user_write(*this, last_address);
+    return MM.validate_user_write(*this, first_address);
 }
 
 pid_t Process::sys$getsid(pid_t pid)
@@ -1540,6 +2091,8 @@ int Process::sys$ioctl(int fd, unsigned request, unsigned arg)
     auto* descriptor = file_descriptor(fd);
     if (!descriptor)
         return -EBADF;
+    if (descriptor->is_socket())
+        return descriptor->socket()->ioctl(*this, request, arg);
     if (!descriptor->is_device())
         return -ENOTTY;
     return descriptor->device()->ioctl(*this, request, arg);
@@ -1550,6 +2103,27 @@ int Process::sys$getdtablesize()
     return m_max_open_file_descriptors;
 }
 
+long Process::sys$sysconf(int name)
+{
+    switch (name) {
+    case _SC_NPROCESSORS_CONF: {
+        unsigned enabled_count = 0;
+        for (unsigned i = 0; i < MultiProcessor::processor_count(); ++i) {
+            if (MultiProcessor::processor(i).is_enabled)
+                ++enabled_count;
+        }
+        return max(enabled_count, 1u);
+    }
+    case _SC_NPROCESSORS_ONLN:
+        // Only the bootstrap processor runs anything.
+        return 1;
+    case _SC_PAGESIZE:
+        return PAGE_SIZE;
+    default:
+        return -EINVAL;
+    }
+}
+
 int Process::sys$dup(int old_fd)
 {
     auto* descriptor = file_descriptor(old_fd);
@@ -1600,6 +2174,8 @@ int Process::sys$sigprocmask(int how, const sigset_t* set, sigset_t* old_set)
         default:
             return -EINVAL;
         }
+        // Unmasking may have made an already pending signal deliverable.
+        Scheduler::note_pending_signals();
     }
     return 0;
 }
@@ -1690,29 +2266,26 @@ clock_t Process::sys$times(tms* times)
     return 0;
 }
 
-int Process::sys$select(const Syscall::SC_select_params* params)
+int Process::sys$select(const Syscall::SC_select_params* user_params)
 {
-    if (!validate_read_typed(params))
-        return -EFAULT;
-    if (params->writefds && !validate_read_typed(params->writefds))
+    Syscall::SC_select_params params;
+    if (!copy_from_user(params, user_params))
         return -EFAULT;
-    if (params->readfds && !validate_read_typed(params->readfds))
+    fd_set writefds;
+    fd_set readfds;
+    timeval timeout;
+    if (params.writefds && !copy_from_user(writefds, params.writefds))
         return -EFAULT;
-    if (params->exceptfds && !validate_read_typed(params->exceptfds))
+    if (params.readfds && !copy_from_user(readfds, params.readfds))
         return -EFAULT;
-    if (params->timeout && !validate_read_typed(params->timeout))
+    if (params.timeout && !copy_from_user(timeout, params.timeout))
         return -EFAULT;
-    int nfds = params->nfds;
-    fd_set* writefds = params->writefds;
-    fd_set* readfds = params->readfds;
-    fd_set* exceptfds = params->exceptfds;
-    auto* timeout = params->timeout;
+    int nfds = params.nfds;
 
     // FIXME: Implement exceptfds support.
-    (void)exceptfds;
 
-    if (timeout) {
-        current->m_select_timeout = *timeout;
+    if (params.timeout) {
+        current->m_select_timeout = timeout;
         current->m_select_has_timeout = true;
     } else {
         current->m_select_has_timeout = false;
@@ -1740,28 +2313,28 @@ int Process::sys$select(const Syscall::SC_select_params* params)
     };
 
     int error = 0;
-    error = transfer_fds(writefds, current->m_select_write_fds);
+    error = transfer_fds(params.writefds ? &writefds : nullptr, current->m_select_write_fds);
     if (error)
         return error;
-    error = transfer_fds(readfds, current->m_select_read_fds);
+    error = transfer_fds(params.readfds ? &readfds : nullptr, current->m_select_read_fds);
     if (error)
         return error;
-    error = transfer_fds(readfds, current->m_select_exceptional_fds);
+    error = transfer_fds(params.readfds ? &readfds : nullptr, current->m_select_exceptional_fds);
     if (error)
         return error;
 
 #ifdef DEBUG_IO
-    dbgprintf("%s<%u> selecting on (read:%u, write:%u), timeout=%p\n", name().characters(), pid(), current->m_select_read_fds.size(), current->m_select_write_fds.size(), timeout);
+    dbgprintf("%s<%u> selecting on (read:%u, write:%u), timeout=%p\n", name().characters(), pid(), current->m_select_read_fds.size(), current->m_select_write_fds.size(), params.timeout);
 #endif
 
-    if (!timeout || (timeout->tv_sec || timeout->tv_usec))
+    if (!params.timeout || (timeout.tv_sec || timeout.tv_usec))
         current->block(Thread::State::BlockedSelect);
 
     int markedfds = 0;
 
-    if (readfds) {
-        memset(readfds, 0, sizeof(fd_set));
-        auto bitmap = Bitmap::wrap((byte*)readfds, FD_SETSIZE);
+    if (params.readfds) {
+        memset(&readfds, 0, sizeof(fd_set));
+        auto bitmap = Bitmap::wrap((byte*)&readfds, FD_SETSIZE);
         for (int fd : current->m_select_read_fds) {
             auto* descriptor = file_descriptor(fd);
             if (!descriptor)
@@ -1771,11 +2344,13 @@ int Process::sys$select(const Syscall::SC_select_params* params)
                 ++markedfds;
             }
         }
+        if (!copy_to_user(params.readfds, readfds))
+            return -EFAULT;
     }
 
-    if (writefds) {
-        memset(writefds, 0, sizeof(fd_set));
-        auto bitmap = Bitmap::wrap((byte*)writefds, FD_SETSIZE);
+    if (params.writefds) {
+        memset(&writefds, 0, sizeof(fd_set));
+        auto bitmap = Bitmap::wrap((byte*)&writefds, FD_SETSIZE);
         for (int fd : current->m_select_write_fds) {
             auto* descriptor = file_descriptor(fd);
             if (!descriptor)
@@ -1785,6 +2360,8 @@ int Process::sys$select(const Syscall::SC_select_params* params)
                 ++markedfds;
             }
         }
+        if (!copy_to_user(params.writefds, writefds))
+            return -EFAULT;
     }
 
     // FIXME: Check for exceptional conditions.
@@ -1792,9 +2369,13 @@ int Process::sys$select(const Syscall::SC_select_params* params)
     return markedfds;
 }
 
-int Process::sys$poll(pollfd* fds, int nfds, int timeout)
+int Process::sys$poll(pollfd* user_fds, int nfds, int timeout)
 {
-    if (!validate_read_typed(fds))
+    if (nfds < 0 || nfds > max_open_file_descriptors())
+        return -EINVAL;
+    Vector<pollfd> fds;
+    fds.resize(nfds);
+    if (!copy_from_user(fds.data(), user_fds, nfds * sizeof(pollfd)))
         return -EFAULT;
 
     current->m_select_write_fds.clear_with_capacity();
@@ -1827,22 +2408,126 @@ int Process::sys$poll(pollfd* fds, int nfds, int timeout)
             ++fds_with_revents;
     }
 
+    if (!copy_to_user(user_fds, fds.data(), nfds * sizeof(pollfd)))
+        return -EFAULT;
     return fds_with_revents;
 }
 
-Inode& Process::cwd_inode()
+int Process::sys$epoll_create(int flags)
 {
-    // FIXME: This is retarded factoring.
-    if (!m_cwd)
-        m_cwd = VFS::the().root_inode();
-    return *m_cwd;
+    if (flags & ~EPOLL_CLOEXEC)
+        return -EINVAL;
+    if (number_of_open_file_descriptors() >= m_max_open_file_descriptors)
+        return -EMFILE;
+    int fd = alloc_fd();
+    auto epoll = EPoll::create();
+    m_fds[fd].set(FileDescriptor::create(*epoll), (flags & EPOLL_CLOEXEC) ? FD_CLOEXEC : 0);
+    return fd;
 }
 
-int Process::sys$link(const char* old_path, const char* new_path)
+int Process::sys$epoll_ctl(const Syscall::SC_epoll_ctl_params* params)
 {
-    if (!validate_read_str(old_path))
-        return -EFAULT;
-    if (!validate_read_str(new_path))
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    auto* epoll_descriptor = file_descriptor(params->epfd);
+    if (!epoll_descriptor)
+        return -EBADF;
+    if (!epoll_descriptor->is_epoll())
+        return -EINVAL;
+    auto& epoll = *epoll_descriptor->epoll();
+    if (params->op == EPOLL_CTL_DEL)
+        return epoll.remove(params->fd);
+
+    if (!validate_read_typed(params->event))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(params->fd);
+    if (!descriptor)
+        return -EBADF;
+    if (descriptor->epoll() == &epoll)
+        return -EINVAL;
+    switch (params->op) {
+    case EPOLL_CTL_ADD:
+        return epoll.add(params->fd, *descriptor, *params->event);
+    case EPOLL_CTL_MOD:
+        return epoll.modify(params->fd, *params->event);
+    default:
+        return -EINVAL;
+    }
+}
+
+int Process::sys$epoll_wait(const Syscall::SC_epoll_wait_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    int epfd = params->epfd;
+    int max_events = params->max_events;
+    auto* events = params->events;
+    int timeout = params->timeout;
+    if (max_events <= 0)
+        return -EINVAL;
+    if (!validate_write(events, max_events * sizeof(epoll_event)))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(epfd);
+    if (!descriptor)
+        return -EBADF;
+    if (!descriptor->is_epoll())
+        return -EINVAL;
+    // Keep it alive even if someone closes epfd while we're asleep.
+    Retained<EPoll> epoll = *descriptor->epoll();
+
+    timeval deadline;
+    if (timeout > 0) {
+        kgettimeofday(deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_usec += (timeout % 1000) * 1000;
+        if (deadline.tv_usec >= 1000000) {
+            ++deadline.tv_sec;
+            deadline.tv_usec -= 1000000;
+        }
+    }
+
+    Vector<epoll_event> ready_events;
+    for (;;) {
+        epoll->collect_events(*this, ready_events, max_events);
+        if (!ready_events.is_empty() || timeout == 0)
+            break;
+        if (timeout > 0) {
+            timeval now;
+            kgettimeofday(now);
+            if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_usec >= deadline.tv_usec))
+                break;
+        }
+        if (current->has_unmasked_pending_signals())
+            return -EINTR;
+        // Sleep the select() way, on the epoll descriptor alone. Its wait queue is woken when anything it watches may be ready.
+        current->m_select_read_fds.clear_with_capacity();
+        current->m_select_read_fds.append(epfd);
+        current->m_select_write_fds.clear_with_capacity();
+        current->m_select_has_timeout = timeout > 0;
+        if (timeout > 0)
+            current->m_select_timeout = deadline;
+        current->block(Thread::State::BlockedSelect);
+        // If epfd went away while we slept, there's nothing left to wait for.
+        if (file_descriptor(epfd) != descriptor)
+            return -EBADF;
+    }
+    memcpy(events, ready_events.data(), ready_events.size() * sizeof(epoll_event));
+    return ready_events.size();
+}
+
+Inode& Process::cwd_inode()
+{
+    // FIXME: This is retarded factoring.
+    if (!m_cwd)
+        m_cwd = VFS::the().root_inode();
+    return *m_cwd;
+}
+
+int Process::sys$link(const char* old_path, const char* new_path)
+{
+    if (!validate_read_str(old_path))
+        return -EFAULT;
+    if (!validate_read_str(new_path))
         return -EFAULT;
     return VFS::the().link(String(old_path), String(new_path), cwd_inode());
 }
@@ -1895,6 +2580,32 @@ int Process::sys$fchmod(int fd, mode_t mode)
     return descriptor->fchmod(mode);
 }
 
+int Process::sys$fsync(int fd)
+{
+    auto* descriptor = file_descriptor(fd);
+    if (!descriptor)
+        return -EBADF;
+    return descriptor->fsync(Inode::SyncMode::All);
+}
+
+int Process::sys$fdatasync(int fd)
+{
+    auto* descriptor = file_descriptor(fd);
+    if (!descriptor)
+        return -EBADF;
+    return descriptor->fsync(Inode::SyncMode::Data);
+}
+
+int Process::sys$fallocate(const Syscall::SC_fallocate_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(params->fd);
+    if (!descriptor)
+        return -EBADF;
+    return descriptor->fallocate(params->mode, params->offset, params->length);
+}
+
 int Process::sys$chown(const char* pathname, uid_t uid, gid_t gid)
 {
     if (!validate_read_str(pathname))
@@ -1910,6 +2621,9 @@ void Process::finalize()
     m_fds.clear();
     m_tty = nullptr;
     disown_all_shared_buffers();
+    // A zombie doesn't need its memory, and the OOM killer is counting on getting it back now.
+    m_region_tree.clear();
+    m_regions.clear();
     {
         InterruptDisabler disabler;
         if (auto* parent_process = Process::from_pid(m_ppid)) {
@@ -1924,6 +2638,7 @@ void Process::finalize()
     }
 
     m_dead = true;
+    Scheduler::note_process_death();
 }
 
 void Process::die()
@@ -2029,6 +2744,26 @@ int Process::sys$accept(int accepting_socket_fd, sockaddr* address, socklen_t* a
         return -EFAULT;
     if (!validate_write(address, *address_size))
         return -EFAULT;
+    auto* accepting_socket_descriptor = file_descriptor(accepting_socket_fd);
+    if (!accepting_socket_descriptor)
+        return -EBADF;
+    if (!accepting_socket_descriptor->is_socket())
+        return -ENOTSOCK;
+    RetainPtr<Socket> socket = accepting_socket_descriptor->socket();
+    while (!socket->can_accept()) {
+        if (!accepting_socket_descriptor->is_blocking())
+            return -EAGAIN;
+        // A listener is readable once there's a connection to accept, so otherwise it's not listening.
+        if (accepting_socket_descriptor->can_read(*this))
+            return -EINVAL;
+        current->m_blocked_fd = accepting_socket_fd;
+        current->block(Thread::State::BlockedRead);
+        if (current->m_was_interrupted_while_blocked)
+            return -EINTR;
+        accepting_socket_descriptor = file_descriptor(accepting_socket_fd);
+        if (!accepting_socket_descriptor || accepting_socket_descriptor->socket() != socket.ptr())
+            return -EBADF;
+    }
     if (number_of_open_file_descriptors() >= m_max_open_file_descriptors)
         return -EMFILE;
     int accepted_socket_fd = 0;
@@ -2036,18 +2771,9 @@ int Process::sys$accept(int accepting_socket_fd, sockaddr* address, socklen_t* a
         if (!m_fds[accepted_socket_fd])
             break;
     }
-    auto* accepting_socket_descriptor = file_descriptor(accepting_socket_fd);
-    if (!accepting_socket_descriptor)
-        return -EBADF;
-    if (!accepting_socket_descriptor->is_socket())
-        return -ENOTSOCK;
-    auto& socket = *accepting_socket_descriptor->socket();
-    if (!socket.can_accept()) {
-        ASSERT(!accepting_socket_descriptor->is_blocking());
+    auto accepted_socket = socket->accept();
+    if (!accepted_socket)
         return -EAGAIN;
-    }
-    auto accepted_socket = socket.accept();
-    ASSERT(accepted_socket);
     bool success = accepted_socket->get_address(address, address_size);
     ASSERT(success);
     auto accepted_socket_descriptor = FileDescriptor::create(move(accepted_socket), SocketRole::Accepted);
@@ -2078,7 +2804,12 @@ int Process::sys$connect(int sockfd, const sockaddr* address, socklen_t address_
         return -EISCONN;
     auto& socket = *descriptor->socket();
     descriptor->set_socket_role(SocketRole::Connecting);
-    auto result = socket.connect(address, address_size);
+    auto result = socket.connect(address, address_size, descriptor->is_blocking() ? ShouldBlock::Yes : ShouldBlock::No);
+    // It's connected as far as the descriptor goes, the socket says when it's ready.
+    if ((int)result == -EINPROGRESS) {
+        descriptor->set_socket_role(SocketRole::Connected);
+        return result;
+    }
     if (result.is_error()) {
         descriptor->set_socket_role(SocketRole::None);
         return result;
@@ -2108,8 +2839,21 @@ ssize_t Process::sys$sendto(const Syscall::SC_sendto_params* params)
         return -EBADF;
     if (!descriptor->is_socket())
         return -ENOTSOCK;
-    auto& socket = *descriptor->socket();
+    if (!descriptor->is_blocking())
+        flags |= MSG_DONTWAIT;
     kprintf("sendto %p (%u), flags=%u, addr: %p (%u)\n", data, data_length, flags, addr, addr_length);
+    return do_sendto(sockfd, *descriptor, data, data_length, flags, addr, addr_length);
+}
+
+ssize_t Process::do_sendto(int fd, FileDescriptor& descriptor, const void* data, size_t data_length, int flags, const sockaddr* addr, socklen_t addr_length)
+{
+    auto& socket = *descriptor.socket();
+    // A local socket only ever talks to the one it's connected to, and its end decides which way that goes.
+    if (socket.is_local()) {
+        if (addr)
+            return -EISCONN;
+        return do_write(fd, descriptor, (const byte*)data, data_length);
+    }
     return socket.sendto(data, data_length, flags, addr, addr_length);
 }
 
@@ -2141,10 +2885,111 @@ ssize_t Process::sys$recvfrom(const Syscall::SC_recvfrom_params* params)
     if (!descriptor->is_socket())
         return -ENOTSOCK;
     auto& socket = *descriptor->socket();
+    if (!descriptor->is_blocking())
+        flags |= MSG_DONTWAIT;
     kprintf("recvfrom %p (%u), flags=%u, addr: %p (%p)\n", buffer, buffer_length, flags, addr, addr_length);
+    if (socket.is_local())
+        return do_read(sockfd, *descriptor, (byte*)buffer, buffer_length);
     return socket.recvfrom(buffer, buffer_length, flags, addr, addr_length);
 }
 
+// Batches are kept to what a process could reasonably be waiting on at once.
+static const unsigned max_messages = 1024;
+
+bool Process::validate_messages(mmsghdr* messages, unsigned count, bool for_writing)
+{
+    if (!validate_write_typed(messages, count))
+        return false;
+    for (unsigned i = 0; i < count; ++i) {
+        auto& message = messages[i].msg_hdr;
+        if (message.msg_iovlen < 0 || message.msg_iovlen > max_iovecs)
+            return false;
+        ssize_t total_length;
+        if (!validate_iovecs(message.msg_iov, message.msg_iovlen, for_writing, total_length))
+            return false;
+        if (message.msg_name && (for_writing ? !validate_write(message.msg_name, message.msg_namelen) : !validate_read(message.msg_name, message.msg_namelen)))
+            return false;
+    }
+    return true;
+}
+
+int Process::sys$recvmmsg(const Syscall::SC_recvmmsg_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    auto* messages = (mmsghdr*)params->messages;
+    unsigned count = params->count;
+    // FIXME: Support a timeout of its own, besides SO_RCVTIMEO.
+    if (params->timeout)
+        return -EINVAL;
+    if (count > max_messages)
+        count = max_messages;
+    if (!validate_messages(messages, count, true))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(params->sockfd);
+    if (!descriptor)
+        return -EBADF;
+    if (!descriptor->is_socket())
+        return -ENOTSOCK;
+    if (!count)
+        return 0;
+    int flags = params->flags;
+    if (!descriptor->is_blocking())
+        flags |= MSG_DONTWAIT;
+    auto& socket = *descriptor->socket();
+    // What a local socket has to read depends on which end this is, so that's waited for through the descriptor, like read().
+    if (socket.is_local() && !(flags & MSG_DONTWAIT) && !descriptor->can_read(*this)) {
+        current->m_blocked_fd = params->sockfd;
+        current->block(Thread::State::BlockedRead);
+        if (current->m_was_interrupted_while_blocked)
+            return -EINTR;
+    }
+    return socket.recvmmsg(descriptor->socket_role(), messages, count, flags);
+}
+
+int Process::sys$sendmmsg(const Syscall::SC_sendmmsg_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    auto* messages = (mmsghdr*)params->messages;
+    unsigned count = min(params->count, max_messages);
+    if (!validate_messages(messages, count, false))
+        return -EFAULT;
+    auto* descriptor = file_descriptor(params->sockfd);
+    if (!descriptor)
+        return -EBADF;
+    if (!descriptor->is_socket())
+        return -ENOTSOCK;
+
+    int sent = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        auto& message = messages[i].msg_hdr;
+        ssize_t rc;
+        // Datagrams go out whole, so what's in more than one piece has to be put together first.
+        if (message.msg_iovlen == 1) {
+            rc = do_sendto(params->sockfd, *descriptor, message.msg_iov[0].iov_base, message.msg_iov[0].iov_len, params->flags, (const sockaddr*)message.msg_name, message.msg_namelen);
+        } else {
+            size_t length = 0;
+            for (int j = 0; j < message.msg_iovlen; ++j)
+                length += message.msg_iov[j].iov_len;
+            if (length > (size_t)max_gathered_io_size)
+                return sent ? sent : -EMSGSIZE;
+            auto buffer = ByteBuffer::create_uninitialized(length);
+            size_t offset = 0;
+            for (int j = 0; j < message.msg_iovlen; ++j) {
+                memcpy(buffer.pointer() + offset, message.msg_iov[j].iov_base, message.msg_iov[j].iov_len);
+                offset += message.msg_iov[j].iov_len;
+            }
+            rc = do_sendto(params->sockfd, *descriptor, buffer.pointer(), length, params->flags, (const sockaddr*)message.msg_name, message.msg_namelen);
+        }
+        if (rc < 0)
+            return sent ? sent : rc;
+        messages[i].msg_len = rc;
+        ++sent;
+    }
+    return sent;
+}
+
 int Process::sys$getsockopt(const Syscall::SC_getsockopt_params* params)
 {
     if (!validate_read_typed(params))
@@ -2190,100 +3035,101 @@ int Process::sys$setsockopt(const Syscall::SC_setsockopt_params* params)
 }
 
 struct SharedBuffer {
-    SharedBuffer(pid_t pid1, pid_t pid2, int size)
-        : m_pid1(pid1)
-        , m_pid2(pid2)
+    struct Reference {
+        pid_t pid;
+        unsigned count { 0 };
+        Region* region { nullptr };
+    };
+
+    SharedBuffer(pid_t creator_pid, int size)
+        : m_creator_pid(creator_pid)
         , m_vmo(VMObject::create_anonymous(size))
     {
-        ASSERT(pid1 != pid2);
+        m_references.append({ creator_pid, 0, nullptr });
     }
 
-    void* retain(Process& process)
+    Reference* reference_for(pid_t pid)
     {
-        if (m_pid1 == process.pid()) {
-            ++m_pid1_retain_count;
-            if (!m_pid1_region) {
-                m_pid1_region = process.allocate_region_with_vmo(LinearAddress(), size(), m_vmo.copy_ref(), 0, "SharedBuffer", true, m_pid1_writable);
-                m_pid1_region->set_shared(true);
-            }
-            return m_pid1_region->laddr().as_ptr();
-        } else if (m_pid2 == process.pid()) {
-            ++m_pid2_retain_count;
-            if (!m_pid2_region) {
-                m_pid2_region = process.allocate_region_with_vmo(LinearAddress(), size(), m_vmo.copy_ref(), 0, "SharedBuffer", true, m_pid2_writable);
-                m_pid2_region->set_shared(true);
-            }
-            return m_pid2_region->laddr().as_ptr();
+        for (auto& reference : m_references) {
+            if (reference.pid == pid)
+                return &reference;
         }
         return nullptr;
     }
 
-    void release(Process& process)
+    bool is_shared_with(pid_t pid) { return reference_for(pid); }
+
+    void share_with(pid_t pid)
     {
-        if (m_pid1 == process.pid()) {
-            ASSERT(m_pid1_retain_count);
-            --m_pid1_retain_count;
-            if (!m_pid1_retain_count) {
-                if (m_pid1_region)
-                    process.deallocate_region(*m_pid1_region);
-                m_pid1_region = nullptr;
-            }
-            destroy_if_unused();
-        } else if (m_pid2 == process.pid()) {
-            ASSERT(m_pid2_retain_count);
-            --m_pid2_retain_count;
-            if (!m_pid2_retain_count) {
-                if (m_pid2_region)
-                    process.deallocate_region(*m_pid2_region);
-                m_pid2_region = nullptr;
-            }
-            destroy_if_unused();
+        if (!is_shared_with(pid))
+            m_references.append({ pid, 0, nullptr });
+    }
+
+    void* retain(Process& process)
+    {
+        auto* reference = reference_for(process.pid());
+        if (!reference)
+            return nullptr;
+        ++reference->count;
+        if (!reference->region) {
+            // Only the creator ever gets to write, and only until the buffer is sealed.
+            bool writable = process.pid() == m_creator_pid && !m_sealed;
+            reference->region = process.allocate_region_with_vmo(LinearAddress(), size(), m_vmo.copy_ref(), 0, "SharedBuffer", true, writable);
+            reference->region->set_shared(true);
+        }
+        return reference->region->laddr().as_ptr();
+    }
+
+    bool release(Process& process)
+    {
+        auto* reference = reference_for(process.pid());
+        if (!reference || !reference->count)
+            return false;
+        if (--reference->count)
+            return true;
+        // The creator keeps its mapping of anything small enough to pool, the buffer may end up back there.
+        if (reference->region && !(process.pid() == m_creator_pid && is_poolable())) {
+            process.deallocate_region(*reference->region);
+            reference->region = nullptr;
         }
+        destroy_if_unused();
+        return true;
     }
 
     void disown(pid_t pid)
     {
-        if (m_pid1 == pid) {
-            m_pid1 = 0;
-            m_pid1_retain_count = 0;
-            destroy_if_unused();
-        } else if (m_pid2 == pid) {
-            m_pid2 = 0;
-            m_pid2_retain_count = 0;
-            destroy_if_unused();
+        for (int i = 0; i < m_references.size(); ++i) {
+            if (m_references[i].pid == pid) {
+                m_references.remove(i);
+                destroy_if_unused();
+                return;
+            }
         }
     }
 
-    pid_t pid1() const { return m_pid1; }
-    pid_t pid2() const { return m_pid2; }
-    unsigned pid1_retain_count() const { return m_pid1_retain_count; }
-    unsigned pid2_retain_count() const { return m_pid2_retain_count; }
+    pid_t creator_pid() const { return m_creator_pid; }
     size_t size() const { return m_vmo->size(); }
+    bool is_poolable() const { return size() <= max_pooled_shared_buffer_size; }
     void destroy_if_unused();
+    void recycle(pid_t peer_pid);
 
     void seal()
     {
-        m_pid1_writable = false;
-        m_pid2_writable = false;
-        if (m_pid1_region) {
-            m_pid1_region->set_writable(false);
-            MM.remap_region(*m_pid1_region->page_directory(), *m_pid1_region);
-        }
-        if (m_pid2_region) {
-            m_pid2_region->set_writable(false);
-            MM.remap_region(*m_pid2_region->page_directory(), *m_pid2_region);
+        m_sealed = true;
+        for (auto& reference : m_references) {
+            if (reference.region && reference.region->is_writable()) {
+                reference.region->set_writable(false);
+                MM.remap_region(*reference.region->page_directory(), *reference.region);
+            }
         }
     }
 
+    static const size_t max_pooled_shared_buffer_size = 4 * MB;
+
     int m_shared_buffer_id { -1 };
-    pid_t m_pid1;
-    pid_t m_pid2;
-    unsigned m_pid1_retain_count { 1 };
-    unsigned m_pid2_retain_count { 0 };
-    Region* m_pid1_region { nullptr };
-    Region* m_pid2_region { nullptr };
-    bool m_pid1_writable { false };
-    bool m_pid2_writable { false };
+    pid_t m_creator_pid;
+    bool m_sealed { false };
+    Vector<Reference, 2> m_references;
     Retained<VMObject> m_vmo;
 };
 
@@ -2296,17 +3142,86 @@ Lockable<HashMap<int, OwnPtr<SharedBuffer>>>& shared_buffers()
     return *map;
 }
 
+// Buffers everyone is done with, that their creator still has mapped (and faulted in). Creating a buffer takes one
+// of its own from here before making a new one. Oldest first, and guarded by the shared_buffers() lock.
+static Vector<OwnPtr<SharedBuffer>>& shared_buffer_pool()
+{
+    static Vector<OwnPtr<SharedBuffer>>* pool;
+    if (!pool)
+        pool = new Vector<OwnPtr<SharedBuffer>>;
+    return *pool;
+}
+
+static const int max_pooled_shared_buffers_per_process = 4;
+
 void SharedBuffer::destroy_if_unused()
 {
-    if (!m_pid1_retain_count && !m_pid2_retain_count) {
-        LOCKER(shared_buffers().lock());
+    for (auto& reference : m_references) {
+        if (reference.count)
+            return;
+    }
+    LOCKER(shared_buffers().lock());
 #ifdef SHARED_BUFFER_DEBUG
-        kprintf("Destroying unused SharedBuffer{%p} id: %d (pid1: %d, pid2: %d)\n", this, m_shared_buffer_id, m_pid1, m_pid2);
+    kprintf("Destroying unused SharedBuffer{%p} id: %d (creator: %d)\n", this, m_shared_buffer_id, m_creator_pid);
 #endif
-        size_t count_before = shared_buffers().resource().size();
-        shared_buffers().resource().remove(m_shared_buffer_id);
-        ASSERT(count_before != shared_buffers().resource().size());
+    auto it = shared_buffers().resource().find(m_shared_buffer_id);
+    ASSERT(it != shared_buffers().resource().end());
+    auto* creator = reference_for(m_creator_pid);
+    if (creator && creator->region) {
+        // The peers have unmapped it already, only the creator's mapping is left.
+        auto* region = creator->region;
+        m_references.clear();
+        m_references.append({ m_creator_pid, 0, region });
+        shared_buffer_pool().append(move((*it).value));
+    }
+    shared_buffers().resource().remove(it);
+}
+
+void SharedBuffer::recycle(pid_t peer_pid)
+{
+    auto& creator = m_references[0];
+    ASSERT(creator.pid == m_creator_pid && creator.region);
+    creator.count = 1;
+    m_references.append({ peer_pid, 0, nullptr });
+    if (m_sealed) {
+        m_sealed = false;
+        creator.region->set_writable(true);
+        MM.remap_region(*creator.region->page_directory(), *creator.region);
+    }
+}
+
+// Must be called with the shared_buffers() lock held, in the context of the process whose pool it is.
+static void trim_shared_buffer_pool(Process& process)
+{
+    auto& pool = shared_buffer_pool();
+    int count = 0;
+    for (int i = pool.size() - 1; i >= 0; --i) {
+        if (pool[i]->creator_pid() != process.pid())
+            continue;
+        if (++count <= max_pooled_shared_buffers_per_process)
+            continue;
+        process.deallocate_region(*pool[i]->m_references[0].region);
+        pool.remove(i);
+    }
+}
+
+// Takes the best fitting buffer out of the process's pool, one that's at least as big as needed but not wastefully so.
+static OwnPtr<SharedBuffer> take_pooled_shared_buffer(Process& process, size_t size)
+{
+    auto& pool = shared_buffer_pool();
+    int best_index = -1;
+    for (int i = 0; i < pool.size(); ++i) {
+        auto& candidate = *pool[i];
+        if (candidate.creator_pid() != process.pid() || candidate.size() < size || candidate.size() > size * 2)
+            continue;
+        if (best_index < 0 || candidate.size() < pool[best_index]->size())
+            best_index = i;
     }
+    if (best_index < 0)
+        return nullptr;
+    auto shared_buffer = move(pool[best_index]);
+    pool.remove(best_index);
+    return shared_buffer;
 }
 
 void Process::disown_all_shared_buffers()
@@ -2317,6 +3232,45 @@ void Process::disown_all_shared_buffers()
         buffers_to_disown.append(it.value.ptr());
     for (auto* shared_buffer : buffers_to_disown)
         shared_buffer->disown(m_pid);
+    // Our pooled mappings go away with the rest of our regions.
+    auto& pool = shared_buffer_pool();
+    for (int i = pool.size() - 1; i >= 0; --i) {
+        if (pool[i]->creator_pid() == m_pid)
+            pool.remove(i);
+    }
+}
+
+static bool is_valid_peer(pid_t peer_pid)
+{
+    if (peer_pid <= 0)
+        return false;
+    InterruptDisabler disabler;
+    return Process::from_pid(peer_pid);
+}
+
+// Must be called with the shared_buffers() lock held.
+SharedBuffer& Process::create_shared_buffer(pid_t peer_pid, int size)
+{
+    auto shared_buffer = take_pooled_shared_buffer(*this, size);
+    if (shared_buffer) {
+        shared_buffer->recycle(peer_pid);
+        // Still cheaper than new pages, and the new peer doesn't get to see what the last one did.
+        memset(shared_buffer->reference_for(m_pid)->region->laddr().as_ptr(), 0, shared_buffer->size());
+    } else {
+        shared_buffer = make<SharedBuffer>(m_pid, size);
+        ASSERT(shared_buffer->size() >= (size_t)size);
+        shared_buffer->share_with(peer_pid);
+        shared_buffer->retain(*this);
+    }
+    int shared_buffer_id = ++s_next_shared_buffer_id;
+    shared_buffer->m_shared_buffer_id = shared_buffer_id;
+#ifdef SHARED_BUFFER_DEBUG
+    kprintf("%s(%u): Created shared buffer %d (%u bytes, vmo is %u) for sharing with %d\n", name().characters(), pid(), shared_buffer_id, size, shared_buffer->size(), peer_pid);
+#endif
+    auto& result = *shared_buffer;
+    shared_buffers().resource().set(shared_buffer_id, move(shared_buffer));
+    trim_shared_buffer_pool(*this);
+    return result;
 }
 
 int Process::sys$create_shared_buffer(pid_t peer_pid, int size, void** buffer)
@@ -2328,25 +3282,40 @@ int Process::sys$create_shared_buffer(pid_t peer_pid, int size, void** buffer)
         return -EINVAL;
     if (!validate_write_typed(buffer))
         return -EFAULT;
-    {
-        InterruptDisabler disabler;
-        auto* peer = Process::from_pid(peer_pid);
-        if (!peer)
-            return -ESRCH;
-    }
+    if (!is_valid_peer(peer_pid))
+        return -ESRCH;
     LOCKER(shared_buffers().lock());
-    int shared_buffer_id = ++s_next_shared_buffer_id;
-    auto shared_buffer = make<SharedBuffer>(m_pid, peer_pid, size);
-    shared_buffer->m_shared_buffer_id = shared_buffer_id;
-    ASSERT(shared_buffer->size() >= size);
-    shared_buffer->m_pid1_region = allocate_region_with_vmo(LinearAddress(), shared_buffer->size(), shared_buffer->m_vmo.copy_ref(), 0, "SharedBuffer", true, true);
-    shared_buffer->m_pid1_region->set_shared(true);
-    *buffer = shared_buffer->m_pid1_region->laddr().as_ptr();
-#ifdef SHARED_BUFFER_DEBUG
-    kprintf("%s(%u): Created shared buffer %d (%u bytes, vmo is %u) for sharing with %d\n", name().characters(), pid(),shared_buffer_id, size, shared_buffer->size(), peer_pid);
-#endif
-    shared_buffers().resource().set(shared_buffer_id, move(shared_buffer));
-    return shared_buffer_id;
+    auto& shared_buffer = create_shared_buffer(peer_pid, size);
+    *buffer = shared_buffer.reference_for(m_pid)->region->laddr().as_ptr();
+    return shared_buffer.m_shared_buffer_id;
+}
+
+int Process::sys$create_sealed_shared_buffer(const Syscall::SC_create_sealed_shared_buffer_params* params)
+{
+    if (!validate_read_typed(params))
+        return -EFAULT;
+    pid_t peer_pid = params->peer_pid;
+    const void* data = params->data;
+    int size = params->size;
+    void** buffer = params->buffer;
+    if (!size || size < 0)
+        return -EINVAL;
+    if (!peer_pid || peer_pid < 0 || peer_pid == m_pid)
+        return -EINVAL;
+    if (!validate_read(data, size))
+        return -EFAULT;
+    if (buffer && !validate_write_typed(buffer))
+        return -EFAULT;
+    if (!is_valid_peer(peer_pid))
+        return -ESRCH;
+    LOCKER(shared_buffers().lock());
+    auto& shared_buffer = create_shared_buffer(peer_pid, PAGE_ROUND_UP(size));
+    auto* region = shared_buffer.reference_for(m_pid)->region;
+    memcpy(region->laddr().as_ptr(), data, size);
+    shared_buffer.seal();
+    if (buffer)
+        *buffer = region->laddr().as_ptr();
+    return shared_buffer.m_shared_buffer_id;
 }
 
 int Process::sys$release_shared_buffer(int shared_buffer_id)
@@ -2359,7 +3328,9 @@ int Process::sys$release_shared_buffer(int shared_buffer_id)
 #ifdef SHARED_BUFFER_DEBUG
     kprintf("%s(%u): Releasing shared buffer %d, buffer count: %u\n", name().characters(), pid(), shared_buffer_id, shared_buffers().resource().size());
 #endif
-    shared_buffer.release(*this);
+    if (!shared_buffer.release(*this))
+        return -EINVAL;
+    trim_shared_buffer_pool(*this);
     return 0;
 }
 
@@ -2370,7 +3341,7 @@ void* Process::sys$get_shared_buffer(int shared_buffer_id)
     if (it == shared_buffers().resource().end())
         return (void*)-EINVAL;
     auto& shared_buffer = *(*it).value;
-    if (shared_buffer.pid1() != m_pid && shared_buffer.pid2() != m_pid)
+    if (!shared_buffer.is_shared_with(m_pid))
         return (void*)-EINVAL;
 #ifdef SHARED_BUFFER_DEBUG
     kprintf("%s(%u): Retaining shared buffer %d, buffer count: %u\n", name().characters(), pid(), shared_buffer_id, shared_buffers().resource().size());
@@ -2378,6 +3349,24 @@ void* Process::sys$get_shared_buffer(int shared_buffer_id)
     return shared_buffer.retain(*this);
 }
 
+int Process::sys$share_buffer_with(int shared_buffer_id, pid_t peer_pid)
+{
+    if (!is_valid_peer(peer_pid))
+        return -ESRCH;
+    LOCKER(shared_buffers().lock());
+    auto it = shared_buffers().resource().find(shared_buffer_id);
+    if (it == shared_buffers().resource().end())
+        return -EINVAL;
+    auto& shared_buffer = *(*it).value;
+    if (!shared_buffer.is_shared_with(m_pid))
+        return -EINVAL;
+#ifdef SHARED_BUFFER_DEBUG
+    kprintf("%s(%u): Sharing shared buffer %d with %d\n", name().characters(), pid(), shared_buffer_id, peer_pid);
+#endif
+    shared_buffer.share_with(peer_pid);
+    return 0;
+}
+
 int Process::sys$seal_shared_buffer(int shared_buffer_id)
 {
     LOCKER(shared_buffers().lock());
@@ -2385,7 +3374,7 @@ int Process::sys$seal_shared_buffer(int shared_buffer_id)
     if (it == shared_buffers().resource().end())
         return -EINVAL;
     auto& shared_buffer = *(*it).value;
-    if (shared_buffer.pid1() != m_pid && shared_buffer.pid2() != m_pid)
+    if (!shared_buffer.is_shared_with(m_pid))
         return -EINVAL;
 #ifdef SHARED_BUFFER_DEBUG
     kprintf("%s(%u): Sealing shared buffer %d\n", name().characters(), pid(), shared_buffer_id);
@@ -2401,7 +3390,7 @@ int Process::sys$get_shared_buffer_size(int shared_buffer_id)
     if (it == shared_buffers().resource().end())
         return -EINVAL;
     auto& shared_buffer = *(*it).value;
-    if (shared_buffer.pid1() != m_pid && shared_buffer.pid2() != m_pid)
+    if (!shared_buffer.is_shared_with(m_pid))
         return -EINVAL;
 #ifdef SHARED_BUFFER_DEBUG
     kprintf("%s(%u): Get shared buffer %d size: %u\n", name().characters(), pid(), shared_buffer_id, shared_buffers().resource().size());
@@ -2437,6 +3426,16 @@ void Process::send_signal(byte signal, Process* sender)
     main_thread().send_signal(signal, sender);
 }
 
+void Process::set_priority(Priority priority)
+{
+    m_priority = priority;
+    // Runnable threads are queued by priority, move them over.
+    for_each_thread([] (Thread& thread) {
+        thread.priority_did_change();
+        return IterationDecision::Continue;
+    });
+}
+
 int Process::thread_count() const
 {
     int count = 0;
@@ -2459,6 +3458,33 @@ int Process::sys$create_thread(int(*entry)(void*), void* argument)
     thread->make_userspace_stack_for_secondary_thread(argument);
 
     thread->set_state(Thread::State::Runnable);
+    return thread->tid();
+}
+
+void Process::sys$exit_thread(int code)
+{
+    if (current == &main_thread()) {
+        // FIXME: The process should stay around until its other threads exit too.
+        sys$exit(code);
+        ASSERT_NOT_REACHED();
+    }
+    // We're on the kernel stack from here on, nobody needs the userspace one anymore.
+    current->deallocate_userspace_stack();
+
+    cli();
+    current->set_state(Thread::State::Dying);
+    if (!Scheduler::is_active())
+        Scheduler::pick_next_and_switch_now();
+    ASSERT_NOT_REACHED();
+}
+
+int Process::sys$set_thread_pointer(RegisterDump& regs, void* pointer)
+{
+    if (!validate_read(pointer, sizeof(void*)))
+        return -EFAULT;
+    current->set_thread_pointer((dword)pointer);
+    // The syscall return path reloads %gs from the register dump, not from the TSS.
+    regs.gs = current->thread_pointer_selector();
     return 0;
 }
 
@@ -2467,6 +3493,53 @@ int Process::sys$gettid()
     return current->tid();
 }
 
+int Process::sys$futex(int* userspace_address, int futex_op, int value)
+{
+    if (!validate_read_typed(userspace_address))
+        return -EFAULT;
+    auto address = (dword)userspace_address;
+    switch (futex_op) {
+    case FUTEX_WAIT: {
+        // Fault the page in now, we can't do that once interrupts are disabled.
+        (void)*(volatile int*)userspace_address;
+        // Nobody can change the value and wake us between the check and getting on the wait queue.
+        InterruptDisabler disabler;
+        if (*(volatile int*)userspace_address != value)
+            return -EAGAIN;
+        WaitQueue* wait_queue;
+        auto it = m_futex_queues.find(address);
+        if (it != m_futex_queues.end()) {
+            wait_queue = (*it).value.ptr();
+        } else {
+            auto new_wait_queue = make<WaitQueue>();
+            wait_queue = new_wait_queue.ptr();
+            m_futex_queues.set(address, move(new_wait_queue));
+        }
+        current->m_futex_queue = wait_queue;
+        current->block(Thread::State::BlockedFutex);
+        current->m_futex_queue = nullptr;
+        if (current->m_was_interrupted_while_blocked)
+            return -EINTR;
+        return 0;
+    }
+    case FUTEX_WAKE: {
+        InterruptDisabler disabler;
+        auto it = m_futex_queues.find(address);
+        if (it == m_futex_queues.end())
+            return 0;
+        auto& wait_queue = *(*it).value;
+        int woken = 0;
+        while (woken < value && wait_queue.wake_one())
+            ++woken;
+        if (wait_queue.is_empty())
+            m_futex_queues.remove(it);
+        return woken;
+    }
+    default:
+        return -EINVAL;
+    }
+}
+
 int Process::sys$donate(int tid)
 {
     if (tid < 0)
@@ -2485,3 +3558,66 @@ int Process::sys$donate(int tid)
     Scheduler::donate_to(beneficiary, "sys$donate");
     return 0;
 }
+
+int Process::sys$profiling_enable(pid_t pid)
+{
+    InterruptDisabler disabler;
+    auto* process = Process::from_pid(pid);
+    if (!process)
+        return -ESRCH;
+    if (!is_superuser() && m_euid != process->m_uid && m_uid != process->m_uid)
+        return -EPERM;
+    // Samples from the last time would be mistaken for new ones.
+    process->m_profile_buffer = make<ProfileBuffer>();
+    process->m_is_profiling = true;
+    return 0;
+}
+
+int Process::sys$profiling_disable(pid_t pid)
+{
+    InterruptDisabler disabler;
+    auto* process = Process::from_pid(pid);
+    if (!process)
+        return -ESRCH;
+    if (!is_superuser() && m_euid != process->m_uid && m_uid != process->m_uid)
+        return -EPERM;
+    if (!process->m_is_profiling)
+        return -EINVAL;
+    process->m_is_profiling = false;
+    return 0;
+}
+
+int Process::sys$sched_setaffinity(pid_t pid, size_t cpuset_size, const cpu_set_t* cpuset)
+{
+    if (cpuset_size < sizeof(cpu_set_t))
+        return -EINVAL;
+    if (!validate_read_typed(cpuset))
+        return -EFAULT;
+    // Processors that aren't running don't count, and a set with none of the others in it can't be run on.
+    dword cpus = cpuset->bits & Scheduler::online_cpus();
+    if (!cpus)
+        return -EINVAL;
+    InterruptDisabler disabler;
+    auto* process = pid ? Process::from_pid(pid) : this;
+    if (!process)
+        return -ESRCH;
+    if (!is_superuser() && m_euid != process->m_uid && m_uid != process->m_uid)
+        return -EPERM;
+    // Whatever CPU it's on now is in the set, since only the bootstrap processor runs anything, so nothing needs to move.
+    process->set_cpu_affinity(cpus);
+    return 0;
+}
+
+int Process::sys$sched_getaffinity(pid_t pid, size_t cpuset_size, cpu_set_t* cpuset)
+{
+    if (cpuset_size < sizeof(cpu_set_t))
+        return -EINVAL;
+    if (!validate_write_typed(cpuset))
+        return -EFAULT;
+    InterruptDisabler disabler;
+    auto* process = pid ? Process::from_pid(pid) : this;
+    if (!process)
+        return -ESRCH;
+    cpuset->bits = Scheduler::cpus_for(*process);
+    return 0;
+}
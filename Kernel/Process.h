@@ -10,13 +10,19 @@
 #include <AK/Vector.h>
 #include <AK/WeakPtr.h>
 #include <AK/Weakable.h>
+#include <AK/HashMap.h>
+#include <AK/OwnPtr.h>
 #include <Kernel/Thread.h>
 #include <Kernel/Lock.h>
+#include <Kernel/WaitQueue.h>
+#include <Kernel/MemoryManager.h>
+#include <Kernel/ProfileBuffer.h>
 
 class FileDescriptor;
 class PageDirectory;
 class Region;
 class VMObject;
+struct SharedBuffer;
 class Zone;
 class WSWindow;
 class GraphicsBitmap;
@@ -68,7 +74,7 @@ public:
 
     static Process* from_pid(pid_t);
 
-    void set_priority(Priority p) { m_priority = p; }
+    void set_priority(Priority);
     Priority priority() const { return m_priority; }
 
     const String& name() const { return m_name; }
@@ -99,6 +105,13 @@ public:
 
     int sys$gettid();
     int sys$donate(int tid);
+    int sys$profiling_enable(pid_t);
+    int sys$profiling_disable(pid_t);
+    int sys$fsync(int fd);
+    int sys$fdatasync(int fd);
+    int sys$fallocate(const Syscall::SC_fallocate_params*);
+    int sys$sched_setaffinity(pid_t, size_t, const cpu_set_t*);
+    int sys$sched_getaffinity(pid_t, size_t, cpu_set_t*);
     pid_t sys$setsid();
     pid_t sys$getsid(pid_t);
     int sys$setpgid(pid_t pid, pid_t pgid);
@@ -115,6 +128,11 @@ public:
     int sys$close(int fd);
     ssize_t sys$read(int fd, byte*, ssize_t);
     ssize_t sys$write(int fd, const byte*, ssize_t);
+    ssize_t sys$sendfile(const Syscall::SC_sendfile_params*);
+    ssize_t sys$readv(int fd, const iovec*, int iov_count);
+    ssize_t sys$writev(int fd, const iovec*, int iov_count);
+    ssize_t sys$pread(const Syscall::SC_pread_params*);
+    ssize_t sys$pwrite(const Syscall::SC_pread_params*);
     int sys$fstat(int fd, stat*);
     int sys$lstat(const char*, stat*);
     int sys$stat(const char*, stat*);
@@ -125,10 +143,13 @@ public:
     pid_t sys$waitpid(pid_t, int* wstatus, int options);
     void* sys$mmap(const Syscall::SC_mmap_params*);
     int sys$munmap(void*, size_t size);
+    void* sys$mremap(const Syscall::SC_mremap_params*);
     int sys$set_mmap_name(void*, size_t, const char*);
+    int sys$madvise(void*, size_t, int advice);
     int sys$select(const Syscall::SC_select_params*);
     int sys$poll(pollfd*, int nfds, int timeout);
     ssize_t sys$get_dir_entries(int fd, void*, ssize_t);
+    ssize_t sys$get_dir_entries_with_stat(int fd, void*, ssize_t);
     int sys$getcwd(char*, ssize_t);
     int sys$chdir(const char*);
     int sys$sleep(unsigned seconds);
@@ -141,8 +162,11 @@ public:
     int sys$ptsname_r(int fd, char*, ssize_t);
     pid_t sys$fork(RegisterDump&);
     int sys$execve(const char* filename, const char** argv, const char** envp);
+    pid_t sys$posix_spawn(const Syscall::SC_posix_spawn_params*);
+    int sys$futex(int* userspace_address, int futex_op, int value);
     int sys$isatty(int fd);
     int sys$getdtablesize();
+    long sys$sysconf(int name);
     int sys$dup(int oldfd);
     int sys$dup2(int oldfd, int newfd);
     int sys$sigaction(int signum, const sigaction* act, sigaction* old_act);
@@ -176,16 +200,25 @@ public:
     int sys$connect(int sockfd, const sockaddr*, socklen_t);
     ssize_t sys$sendto(const Syscall::SC_sendto_params*);
     ssize_t sys$recvfrom(const Syscall::SC_recvfrom_params*);
+    int sys$recvmmsg(const Syscall::SC_recvmmsg_params*);
+    int sys$sendmmsg(const Syscall::SC_sendmmsg_params*);
     int sys$getsockopt(const Syscall::SC_getsockopt_params*);
     int sys$setsockopt(const Syscall::SC_setsockopt_params*);
     int sys$restore_signal_mask(dword mask);
     int sys$create_thread(int(*)(void*), void*);
+    void sys$exit_thread(int code);
+    int sys$set_thread_pointer(RegisterDump&, void*);
+    int sys$epoll_create(int flags);
+    int sys$epoll_ctl(const Syscall::SC_epoll_ctl_params*);
+    int sys$epoll_wait(const Syscall::SC_epoll_wait_params*);
 
     int sys$create_shared_buffer(pid_t peer_pid, int, void** buffer);
     void* sys$get_shared_buffer(int shared_buffer_id);
     int sys$release_shared_buffer(int shared_buffer_id);
     int sys$seal_shared_buffer(int shared_buffer_id);
     int sys$get_shared_buffer_size(int shared_buffer_id);
+    int sys$create_sealed_shared_buffer(const Syscall::SC_create_sealed_shared_buffer_params*);
+    int sys$share_buffer_with(int shared_buffer_id, pid_t peer_pid);
 
     static void initialize();
 
@@ -216,6 +249,10 @@ public:
     Inode& cwd_inode();
     Inode* executable_inode() { return m_executable.ptr(); }
 
+    // Sampled on every timer tick while profiling is on. What was sampled stays around after it's turned off.
+    bool is_profiling() const { return m_is_profiling; }
+    ProfileBuffer* profile_buffer() { return m_profile_buffer.ptr(); }
+
     int number_of_open_file_descriptors() const;
     int max_open_file_descriptors() const { return m_max_open_file_descriptors; }
 
@@ -233,6 +270,10 @@ public:
     Region* allocate_region(LinearAddress, size_t, String&& name, bool is_readable = true, bool is_writable = true, bool commit = true);
     bool deallocate_region(Region& region);
 
+    // The processors this process was pinned to, or 0 if it goes wherever the scheduler likes.
+    dword cpu_affinity() const { return m_cpu_affinity; }
+    void set_cpu_affinity(dword cpus) { m_cpu_affinity = cpus; }
+
     void set_being_inspected(bool b) { m_being_inspected = b; }
     bool is_being_inspected() const { return m_being_inspected; }
 
@@ -249,9 +290,17 @@ private:
     Process(String&& name, uid_t, gid_t, pid_t ppid, RingLevel, RetainPtr<Inode>&& cwd = nullptr, RetainPtr<Inode>&& executable = nullptr, TTY* = nullptr, Process* fork_parent = nullptr);
 
     int do_exec(String path, Vector<String> arguments, Vector<String> environment);
+    ssize_t do_write(int fd, FileDescriptor&, const byte*, ssize_t);
+    ssize_t do_read(int fd, FileDescriptor&, byte*, ssize_t);
+    ssize_t do_sendto(int fd, FileDescriptor&, const void*, size_t, int flags, const sockaddr*, socklen_t);
+    bool validate_iovecs(const iovec*, int iov_count, bool for_writing, ssize_t& total_length);
+    bool validate_messages(mmsghdr*, unsigned count, bool for_writing);
+    bool validate_read_string_array(const char* const* strings);
+    int apply_spawn_file_action(const Syscall::SC_posix_spawn_file_action&);
 
     int alloc_fd();
     void disown_all_shared_buffers();
+    SharedBuffer& create_shared_buffer(pid_t peer_pid, int size);
 
     void create_signal_trampolines_if_needed();
 
@@ -273,6 +322,7 @@ private:
     pid_t m_pgid { 0 };
 
     Priority m_priority { NormalPriority };
+    dword m_cpu_affinity { 0 };
 
     struct FileDescriptorAndFlags {
         operator bool() const { return !!descriptor; }
@@ -295,8 +345,14 @@ private:
     TTY* m_tty { nullptr };
 
     Region* region_from_range(LinearAddress, size_t);
+    Region& add_region(Retained<Region>&&);
+    bool range_is_free(LinearAddress, size_t) const;
+    // Finds room for a region of |size| bytes that doesn't have to be anywhere in particular. Null if there's none.
+    LinearAddress allocate_range(size_t size, size_t alignment = PAGE_SIZE);
 
     Vector<Retained<Region>> m_regions;
+    // The same regions by address, for finding the one an address is in.
+    IntrusiveRedBlackTree<LinearAddress, Region, &Region::laddr> m_region_tree;
 
     // FIXME: Implement some kind of ASLR?
     LinearAddress m_next_region;
@@ -315,6 +371,12 @@ private:
     bool m_dead { false };
 
     int m_next_tid { 0 };
+
+    // Threads waiting in FUTEX_WAIT, by the address they're waiting on.
+    HashMap<dword, OwnPtr<WaitQueue>> m_futex_queues;
+
+    bool m_is_profiling { false };
+    OwnPtr<ProfileBuffer> m_profile_buffer;
 };
 
 class ProcessInspectionHandle {
@@ -352,6 +414,8 @@ private:
 extern const char* to_string(Process::Priority);
 
 extern InlineLinkedList<Process>* g_processes;
+// For /proc/all.bin readers to see whether the list has changed.
+extern dword g_process_list_generation;
 
 template<typename Callback>
 inline void Process::for_each(Callback callback)
@@ -385,14 +449,11 @@ inline void Process::for_each_thread(Callback callback) const
 {
     InterruptDisabler disabler;
     pid_t my_pid = pid();
-    for (auto* thread = g_threads->head(); thread;) {
-        auto* next_thread = thread->next();
-        if (thread->pid() == my_pid) {
-            if (callback(*thread) == IterationDecision::Abort)
-                break;
-        }
-        thread = next_thread;
-    }
+    Thread::for_each([&] (Thread& thread) {
+        if (thread.pid() == my_pid)
+            return callback(thread);
+        return IterationDecision::Continue;
+    });
 }
 
 template<typename Callback>
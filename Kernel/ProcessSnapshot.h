@@ -0,0 +1,39 @@
+#pragma once
+
+#include <AK/Types.h>
+
+// The layout of /proc/all.bin, the same as /proc/all without the formatting and parsing:
+// a ProcessSnapshotHeader, then process_count records of entry_size bytes each.
+// New fields only ever go at the end of ProcessSnapshotEntry, and readers step through
+// the records by entry_size, so an old reader keeps working on a newer kernel.
+
+static const dword process_snapshot_version = 1;
+
+struct ProcessSnapshotHeader {
+    dword version;
+    dword entry_size;
+    dword process_count;
+    // Goes up when a process is created, reaped or execs. If it hasn't moved since the last read,
+    // the processes are the same ones with the same names, only their counters have changed.
+    dword generation;
+};
+
+struct ProcessSnapshotEntry {
+    int pid;
+    int ppid;
+    int pgid;
+    int sid;
+    int tty_pgid;
+    dword uid;
+    dword gid;
+    dword times_scheduled;
+    dword ticks;
+    dword open_file_descriptors;
+    dword amount_virtual;
+    dword amount_resident;
+    dword amount_shared;
+    char state[16];
+    char priority[8];
+    char tty[16];
+    char name[32];
+};
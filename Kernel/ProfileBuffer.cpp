@@ -0,0 +1,25 @@
+#include <Kernel/ProfileBuffer.h>
+#include <Kernel/MemoryManager.h>
+#include <Kernel/Process.h>
+#include <Kernel/system.h>
+
+void ProfileBuffer::sample(Thread& thread, const RegisterDump& regs)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    Sample sample;
+    sample.timestamp = system.uptime;
+    sample.tid = thread.tid();
+    sample.frames[sample.frame_count++] = regs.eip;
+    // Whatever got interrupted may be halfway through setting up a frame, so nothing it points to is taken on faith.
+    dword ebp = regs.ebp;
+    while (sample.frame_count < max_stack_depth) {
+        if (!ebp || (ebp & 3) || !MM.can_read_without_faulting(thread.process(), LinearAddress(ebp), 2 * sizeof(dword)))
+            break;
+        auto* frame = (const dword*)ebp;
+        if (!frame[1])
+            break;
+        sample.frames[sample.frame_count++] = frame[1];
+        ebp = frame[0];
+    }
+    m_samples.enqueue(sample);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <AK/CircularQueue.h>
+#include <AK/Types.h>
+
+class Thread;
+struct RegisterDump;
+
+// The last so many samples of where a profiled process was, one for each timer tick it was running on.
+// A sample is the interrupted EIP and the return addresses up its frame pointer chain, through the kernel
+// and on into userspace if it was in a syscall. Read out through /proc/<pid>/profile.
+class ProfileBuffer {
+public:
+    static const int max_stack_depth = 16;
+    // Half a second of running, the kernel heap is small.
+    static const int capacity = 512;
+
+    struct Sample {
+        dword timestamp { 0 };
+        int tid { 0 };
+        int frame_count { 0 };
+        dword frames[max_stack_depth];
+    };
+
+    // From the timer interrupt, where there's no allocating and no faulting.
+    void sample(Thread&, const RegisterDump&);
+
+    const CircularQueue<Sample, capacity>& samples() const { return m_samples; }
+
+private:
+    CircularQueue<Sample, capacity> m_samples;
+};
@@ -0,0 +1,124 @@
+#include <Kernel/RingBuffer.h>
+#include <Kernel/MemoryManager.h>
+#include <Kernel/StdLib.h>
+#include <LibC/errno_numbers.h>
+
+RingBuffer::RingBuffer(size_t capacity)
+    : m_capacity(PAGE_ROUND_UP(capacity))
+{
+}
+
+RingBuffer::~RingBuffer()
+{
+}
+
+bool RingBuffer::ensure_storage()
+{
+    if (m_data)
+        return true;
+    m_pages = MM.allocate_contiguous_physical_pages(m_capacity / PAGE_SIZE);
+    if (m_pages.is_empty())
+        return false;
+    m_data = MM.physmap(*m_pages.first());
+    return true;
+}
+
+ssize_t RingBuffer::write(const byte* data, ssize_t size)
+{
+    if (!size)
+        return 0;
+    LOCKER(m_lock);
+    if (!ensure_storage())
+        return -ENOMEM;
+    size_t nwritten = min((size_t)size, space_for_writing());
+    size_t write_offset = (m_read_offset + m_used) % m_capacity;
+    size_t first_chunk = min(nwritten, m_capacity - write_offset);
+    memcpy(m_data + write_offset, data, first_chunk);
+    memcpy(m_data, data + first_chunk, nwritten - first_chunk);
+    m_used += nwritten;
+    if (m_wait_queue)
+        m_wait_queue->wake_all();
+    return nwritten;
+}
+
+ssize_t RingBuffer::read(byte* data, ssize_t size)
+{
+    if (!size)
+        return 0;
+    LOCKER(m_lock);
+    size_t nread = min((size_t)size, m_used);
+    if (!nread)
+        return 0;
+    size_t first_chunk = min(nread, m_capacity - m_read_offset);
+    memcpy(data, m_data + m_read_offset, first_chunk);
+    memcpy(data + first_chunk, m_data, nread - first_chunk);
+    m_read_offset = (m_read_offset + nread) % m_capacity;
+    m_used -= nread;
+    // Start over at the front when we drain, so the next writes are contiguous.
+    if (!m_used)
+        m_read_offset = 0;
+    if (m_wait_queue)
+        m_wait_queue->wake_all();
+    return nread;
+}
+
+ssize_t RingBuffer::peek(size_t offset, byte* data, ssize_t size)
+{
+    if (!size)
+        return 0;
+    LOCKER(m_lock);
+    if (offset >= m_used)
+        return 0;
+    size_t npeeked = min((size_t)size, m_used - offset);
+    size_t peek_offset = (m_read_offset + offset) % m_capacity;
+    size_t first_chunk = min(npeeked, m_capacity - peek_offset);
+    memcpy(data, m_data + peek_offset, first_chunk);
+    memcpy(data + first_chunk, m_data, npeeked - first_chunk);
+    return npeeked;
+}
+
+void RingBuffer::discard(size_t size)
+{
+    LOCKER(m_lock);
+    size = min(size, m_used);
+    if (!size)
+        return;
+    m_read_offset = (m_read_offset + size) % m_capacity;
+    m_used -= size;
+    if (!m_used)
+        m_read_offset = 0;
+    if (m_wait_queue)
+        m_wait_queue->wake_all();
+}
+
+ssize_t RingBuffer::write_message(const byte* data, ssize_t size)
+{
+    if ((size_t)size > max_message_size)
+        return -EMSGSIZE;
+    // Held throughout, so nobody sees the length without the bytes.
+    LOCKER(m_lock);
+    if (space_for_writing() < sizeof(dword) + size)
+        return -EAGAIN;
+    dword length = size;
+    ssize_t rc = write((const byte*)&length, sizeof(length));
+    if (rc < 0)
+        return rc;
+    write(data, size);
+    return size;
+}
+
+ssize_t RingBuffer::read_message(byte* data, ssize_t size, bool& truncated)
+{
+    LOCKER(m_lock);
+    truncated = false;
+    dword length;
+    if (peek(0, (byte*)&length, sizeof(length)) != sizeof(length))
+        return 0;
+    discard(sizeof(length));
+    ssize_t nread = read(data, min((size_t)size, (size_t)length));
+    if ((size_t)nread < length) {
+        discard(length - nread);
+        truncated = true;
+    }
+    return nread;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Kernel/Lock.h>
+#include <Kernel/WaitQueue.h>
+#include <AK/Retained.h>
+#include <AK/Types.h>
+#include <AK/Vector.h>
+
+class PhysicalPage;
+
+// A fixed-capacity byte queue for pipes, sockets and TTYs.
+// The storage is physically contiguous pages accessed through the physmap, allocated on the first write,
+// so idle buffers cost nothing and busy ones never reallocate or land on the kmalloc heap.
+class RingBuffer {
+public:
+    // Writes of up to this many bytes are atomic as long as can_write() said yes, just like PIPE_BUF.
+    static const size_t atomic_write_size = 4096;
+
+    explicit RingBuffer(size_t capacity);
+    ~RingBuffer();
+
+    // Copies in as much as there is room for, and returns how much that was. -ENOMEM if there's no storage.
+    ssize_t write(const byte*, ssize_t);
+    ssize_t read(byte*, ssize_t);
+    // Copies out up to |size| bytes starting |offset| bytes in, and leaves them where they are.
+    ssize_t peek(size_t offset, byte*, ssize_t);
+    // Drops up to |size| bytes from the front without reading them.
+    void discard(size_t size);
+
+    // For sockets that keep message boundaries: each message is stored as a dword length and then its bytes.
+    // Messages up to this size always fit once can_write() said yes.
+    static const size_t max_message_size = atomic_write_size - sizeof(dword);
+    // Stores all of the message or none of it: -EMSGSIZE if it's too big, -EAGAIN if there's no room right now.
+    ssize_t write_message(const byte*, ssize_t);
+    // Copies out as much of the next message as fits, and drops the rest of it, which sets |truncated|.
+    ssize_t read_message(byte*, ssize_t, bool& truncated);
+
+    bool is_empty() const { return !m_used; }
+    size_t capacity() const { return m_capacity; }
+    size_t used_bytes() const { return m_used; }
+    size_t space_for_writing() const { return m_capacity - m_used; }
+
+    // What writers should block on: there's room for at least one atomic write.
+    bool can_write() const { return space_for_writing() >= min(atomic_write_size, m_capacity); }
+
+    // Woken whenever data goes in or comes out.
+    void set_wait_queue(WaitQueue& wait_queue) { m_wait_queue = &wait_queue; }
+
+private:
+    bool ensure_storage();
+
+    byte* m_data { nullptr };
+    Vector<Retained<PhysicalPage>> m_pages;
+    size_t m_capacity { 0 };
+    size_t m_read_offset { 0 };
+    size_t m_used { 0 };
+    Lock m_lock { "RingBuffer" };
+    WaitQueue* m_wait_queue { nullptr };
+};
@@ -0,0 +1,151 @@
+#include <Kernel/Routing.h>
+#include <Kernel/LoopbackAdapter.h>
+#include <Kernel/Lock.h>
+#include <AK/StdLibExtras.h>
+#include <LibC/errno_numbers.h>
+
+//#define ROUTING_DEBUG
+
+static Lockable<Vector<Route>>& routes()
+{
+    static Lockable<Vector<Route>>* s_routes;
+    if (!s_routes)
+        s_routes = new Lockable<Vector<Route>>;
+    return *s_routes;
+}
+
+// How many bits |netmask| has set, which is how specific a route under it is.
+static int prefix_length(const IPv4Address& netmask)
+{
+    int length = 0;
+    for (int i = 0; i < 4; ++i) {
+        for (byte bits = netmask[i]; bits; bits <<= 1)
+            ++length;
+    }
+    return length;
+}
+
+static bool is_valid_netmask(const IPv4Address& netmask)
+{
+    dword bits = (dword)netmask[0] << 24 | (dword)netmask[1] << 16 | (dword)netmask[2] << 8 | netmask[3];
+    // Only ones, and then only zeroes, so what's left over after inverting is one less than a power of two.
+    dword host_bits = ~bits;
+    return !(host_bits & (host_bits + 1));
+}
+
+static NetworkAdapter* adapter_with_on_link(const Vector<NetworkAdapter*>& adapters, const IPv4Address& address)
+{
+    for (auto* adapter : adapters) {
+        if (adapter->is_on_link(address))
+            return adapter;
+    }
+    return nullptr;
+}
+
+RoutingDecision route_to(const IPv4Address& destination)
+{
+    RoutingDecision decision;
+
+    if (NetworkAdapter::from_ipv4_address(destination)) {
+        auto& loopback = LoopbackAdapter::the();
+        decision.adapter = &loopback;
+        decision.next_hop = destination;
+        decision.source = destination;
+        decision.mtu = loopback.mtu();
+        return decision;
+    }
+
+    auto adapters = NetworkAdapter::all();
+    int best_prefix_length = -1;
+    for (auto* adapter : adapters) {
+        if (!adapter->is_on_link(destination))
+            continue;
+        int length = prefix_length(adapter->ipv4_netmask());
+        if (length <= best_prefix_length)
+            continue;
+        best_prefix_length = length;
+        decision.adapter = adapter;
+        decision.next_hop = destination;
+        decision.mtu = adapter->mtu();
+    }
+
+    {
+        LOCKER(routes().lock());
+        for (auto& route : routes().resource()) {
+            if (destination.masked(route.netmask) != route.destination)
+                continue;
+            // On a tie, the adapter's own link wins over going through someone else.
+            int length = prefix_length(route.netmask);
+            if (length <= best_prefix_length)
+                continue;
+            auto* adapter = route.adapter;
+            if (!adapter)
+                adapter = adapter_with_on_link(adapters, route.gateway);
+            if (!adapter)
+                continue;
+            best_prefix_length = length;
+            decision.adapter = adapter;
+            decision.next_hop = route.gateway.is_zero() ? destination : route.gateway;
+            decision.mtu = route.mtu ? min(route.mtu, adapter->mtu()) : adapter->mtu();
+        }
+    }
+
+    if (decision.adapter)
+        decision.source = decision.adapter->ipv4_address();
+#ifdef ROUTING_DEBUG
+    kprintf("route_to: %s goes via %s on %s\n",
+        destination.to_string().characters(),
+        decision.next_hop.to_string().characters(),
+        decision.adapter ? decision.adapter->name().characters() : "nothing");
+#endif
+    return decision;
+}
+
+KResult add_route(const Route& route)
+{
+    if (!is_valid_netmask(route.netmask))
+        return KResult(-EINVAL);
+    if (route.destination.masked(route.netmask) != route.destination)
+        return KResult(-EINVAL);
+    if (route.mtu < 0 || (route.mtu && route.mtu < 68))
+        return KResult(-EINVAL);
+    if (route.gateway.is_zero() && !route.adapter)
+        return KResult(-EINVAL);
+    if (!route.gateway.is_zero()) {
+        // A gateway has to be somewhere we can send to directly.
+        if (route.adapter ? !route.adapter->is_on_link(route.gateway) : !adapter_with_on_link(NetworkAdapter::all(), route.gateway))
+            return KResult(-ENETUNREACH);
+    }
+
+    LOCKER(routes().lock());
+    for (auto& existing : routes().resource()) {
+        if (existing.destination == route.destination && existing.netmask == route.netmask) {
+            existing = route;
+            return KSuccess;
+        }
+    }
+    routes().resource().append(route);
+    return KSuccess;
+}
+
+KResult remove_route(const IPv4Address& destination, const IPv4Address& netmask)
+{
+    LOCKER(routes().lock());
+    auto& table = routes().resource();
+    for (int i = 0; i < table.size(); ++i) {
+        if (table[i].destination == destination && table[i].netmask == netmask) {
+            table.remove(i);
+            return KSuccess;
+        }
+    }
+    return KResult(-ESRCH);
+}
+
+Vector<Route> all_routes()
+{
+    LOCKER(routes().lock());
+    Vector<Route> copy;
+    for (auto& route : routes().resource())
+        copy.append(route);
+    return copy;
+}
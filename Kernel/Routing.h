@@ -0,0 +1,39 @@
+#pragma once
+
+#include <AK/Vector.h>
+#include <Kernel/IPv4.h>
+#include <Kernel/KResult.h>
+
+class NetworkAdapter;
+
+// A way to the hosts under |netmask| at |destination|, through |gateway|.
+// What's on an adapter's own link needs no route, as the adapter's address and netmask already say it's there.
+struct Route {
+    IPv4Address destination;
+    IPv4Address netmask;
+    IPv4Address gateway;
+    // Null to go through whichever adapter has the gateway on its link.
+    NetworkAdapter* adapter { nullptr };
+    // 0 for the adapter's own. Lower, for a path that can't take as much as the first hop can.
+    int mtu { 0 };
+};
+
+struct RoutingDecision {
+    NetworkAdapter* adapter { nullptr };
+    // Where on the adapter's link it goes first: the destination itself, or the gateway.
+    IPv4Address next_hop;
+    // What to send from, if nothing else was asked for.
+    IPv4Address source;
+    int mtu { 0 };
+
+    bool is_valid() const { return adapter; }
+};
+
+// Decides how to get to |destination|, by the most specific route there is to it. Our own addresses are
+// reached over the loopback adapter, whichever adapter they're on.
+RoutingDecision route_to(const IPv4Address& destination);
+
+// A route to the same destination and netmask as one already there replaces it.
+KResult add_route(const Route&);
+KResult remove_route(const IPv4Address& destination, const IPv4Address& netmask);
+Vector<Route> all_routes();
@@ -3,8 +3,11 @@
 #include "system.h"
 #include "RTC.h"
 #include "i8253.h"
+#include <AK/StdLibExtras.h>
 #include <AK/TemporaryChange.h>
 #include <Kernel/Alarm.h>
+#include <Kernel/ProcFS.h>
+#include <Kernel/Tracing.h>
 
 //#define LOG_EVERY_CONTEXT_SWITCH
 //#define SCHEDULER_DEBUG
@@ -40,115 +43,254 @@ bool Scheduler::is_active()
     return s_active;
 }
 
-bool Scheduler::pick_next()
+// How many passes in a row a priority level with runnable threads may be passed over for a higher one.
+static const int max_times_passed_over = 8;
+static int s_times_passed_over[(int)Process::HighPriority + 1];
+
+// /proc/sys/isolated_cpus: processors kept for the processes pinned to them.
+static Lockable<unsigned>* s_isolated_cpus;
+static dword s_general_cpus = 1;
+
+static bool s_process_died;
+static bool s_signals_pending;
+static dword s_next_wakeup_time = 0xffffffff;
+static bool s_has_io_deadline;
+static timeval s_next_io_deadline;
+static dword s_next_io_poll_time;
+
+bool Scheduler::has_woken_threads()
 {
-    ASSERT_INTERRUPTS_DISABLED();
-    ASSERT(!s_active);
+    return !Thread::queue(Thread::Queue::WokenOnIO).is_empty();
+}
 
-    TemporaryChange<bool> change(s_active, true);
+void Scheduler::note_process_death()
+{
+    s_process_died = true;
+}
 
-    ASSERT(s_active);
+void Scheduler::note_pending_signals()
+{
+    s_signals_pending = true;
+}
 
-    if (!current) {
-        // XXX: The first ever context_switch() goes to the idle process.
-        //      This to setup a reliable place we can return to.
-        return context_switch(s_colonel_process->main_thread());
-    }
+void Scheduler::note_wakeup_time(dword wakeup_time)
+{
+    if (wakeup_time < s_next_wakeup_time)
+        s_next_wakeup_time = wakeup_time;
+}
 
-    struct timeval now;
-    kgettimeofday(now);
-    auto now_sec = now.tv_sec;
-    auto now_usec = now.tv_usec;
+static bool is_before(const timeval& a, const timeval& b)
+{
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_usec < b.tv_usec);
+}
 
-    // Check and unblock threads whose wait conditions have been met.
-    Thread::for_each([&] (Thread& thread) {
-        auto& process = thread.process();
+static void note_io_deadline(const timeval& deadline)
+{
+    if (!s_has_io_deadline || is_before(deadline, s_next_io_deadline)) {
+        s_next_io_deadline = deadline;
+        s_has_io_deadline = true;
+    }
+}
 
-        if (thread.state() == Thread::BlockedSleep) {
-            if (thread.wakeup_time() <= system.uptime)
-                thread.unblock();
-            return IterationDecision::Continue;
+// Returns true if the thread is still blocked.
+bool Scheduler::check_blocked_on_io(Thread& thread, const timeval& now)
+{
+    auto& process = thread.process();
+    switch (thread.state()) {
+    case Thread::BlockedRead:
+        ASSERT(thread.m_blocked_fd != -1);
+        // FIXME: Block until the amount of data wanted is available.
+        if (process.m_fds[thread.m_blocked_fd].descriptor->can_read(process)) {
+            thread.unblock();
+            return false;
         }
-
-        if (thread.state() == Thread::BlockedWait) {
-            process.for_each_child([&] (Process& child) {
-                if (!child.is_dead())
-                    return true;
-                if (thread.waitee_pid() == -1 || thread.waitee_pid() == child.pid()) {
-                    thread.m_waitee_pid = child.pid();
-                    thread.unblock();
-                    return false;
-                }
-                return true;
-            });
-            return IterationDecision::Continue;
+        return true;
+    case Thread::BlockedWrite:
+        ASSERT(thread.m_blocked_fd != -1);
+        if (process.m_fds[thread.m_blocked_fd].descriptor->can_write(process)) {
+            thread.unblock();
+            return false;
         }
-
-        if (thread.state() == Thread::BlockedRead) {
-            ASSERT(thread.m_blocked_fd != -1);
-            // FIXME: Block until the amount of data wanted is available.
-            if (process.m_fds[thread.m_blocked_fd].descriptor->can_read(process))
-                thread.unblock();
-            return IterationDecision::Continue;
+        return true;
+    case Thread::BlockedConnect:
+        ASSERT(thread.m_blocked_socket);
+        if (thread.m_blocked_socket->is_connected() || thread.m_blocked_socket->has_failed_to_connect()) {
+            thread.unblock();
+            return false;
         }
-
-        if (thread.state() == Thread::BlockedWrite) {
-            ASSERT(thread.m_blocked_fd != -1);
-            if (process.m_fds[thread.m_blocked_fd].descriptor->can_write(process))
+        return true;
+    case Thread::BlockedReceive: {
+        ASSERT(thread.m_blocked_socket);
+        auto& socket = *thread.m_blocked_socket;
+        // FIXME: Block until the amount of data wanted is available.
+        bool timed_out = !is_before(now, socket.receive_deadline());
+        if (timed_out || socket.can_read(SocketRole::None)) {
+            thread.unblock();
+            thread.m_blocked_socket = nullptr;
+            return false;
+        }
+        note_io_deadline(socket.receive_deadline());
+        return true;
+    }
+    case Thread::BlockedSnoozing:
+        ASSERT(thread.m_snoozing_alarm);
+        if (thread.m_snoozing_alarm->is_ringing()) {
+            thread.m_snoozing_alarm = nullptr;
+            thread.unblock();
+            return false;
+        }
+        return true;
+    case Thread::BlockedFutex:
+        // FUTEX_WAKE takes us off the futex's wait queue.
+        if (thread.m_wait_queues.is_empty()) {
+            thread.unblock();
+            return false;
+        }
+        return true;
+    case Thread::BlockedSelect:
+        if (thread.m_select_has_timeout) {
+            if (!is_before(now, thread.m_select_timeout)) {
                 thread.unblock();
-            return IterationDecision::Continue;
+                return false;
+            }
         }
-
-        if (thread.state() == Thread::BlockedConnect) {
-            ASSERT(thread.m_blocked_socket);
-            if (thread.m_blocked_socket->is_connected())
+        for (int fd : thread.m_select_read_fds) {
+            if (process.m_fds[fd].descriptor->can_read(process)) {
                 thread.unblock();
-            return IterationDecision::Continue;
+                return false;
+            }
         }
-
-        if (thread.state() == Thread::BlockedReceive) {
-            ASSERT(thread.m_blocked_socket);
-            auto& socket = *thread.m_blocked_socket;
-            // FIXME: Block until the amount of data wanted is available.
-            bool timed_out = now_sec > socket.receive_deadline().tv_sec || (now_sec == socket.receive_deadline().tv_sec && now_usec >= socket.receive_deadline().tv_usec);
-            if (timed_out || socket.can_read(SocketRole::None)) {
+        for (int fd : thread.m_select_write_fds) {
+            if (process.m_fds[fd].descriptor->can_write(process)) {
                 thread.unblock();
-                thread.m_blocked_socket = nullptr;
-                return IterationDecision::Continue;
+                return false;
             }
-            return IterationDecision::Continue;
         }
+        if (thread.m_select_has_timeout)
+            note_io_deadline(thread.m_select_timeout);
+        return true;
+    default:
+        ASSERT_NOT_REACHED();
+    }
+}
 
-        if (thread.state() == Thread::BlockedSelect) {
-            if (thread.m_select_has_timeout) {
-                if (now_sec > thread.m_select_timeout.tv_sec || (now_sec == thread.m_select_timeout.tv_sec && now_usec >= thread.m_select_timeout.tv_usec)) {
-                    thread.unblock();
-                    return IterationDecision::Continue;
-                }
-            }
-            for (int fd : thread.m_select_read_fds) {
-                if (process.m_fds[fd].descriptor->can_read(process)) {
-                    thread.unblock();
-                    return IterationDecision::Continue;
-                }
-            }
-            for (int fd : thread.m_select_write_fds) {
-                if (process.m_fds[fd].descriptor->can_write(process)) {
-                    thread.unblock();
-                    return IterationDecision::Continue;
-                }
-            }
-            return IterationDecision::Continue;
+dword Scheduler::cpus_for(const Process& process)
+{
+    return process.cpu_affinity() ? process.cpu_affinity() : s_general_cpus;
+}
+
+static void apply_isolated_cpus()
+{
+    LOCKER(s_isolated_cpus->lock());
+    auto& isolated = s_isolated_cpus->resource();
+    isolated &= Scheduler::online_cpus();
+    // Everyone who isn't pinned needs somewhere to run.
+    if (isolated == Scheduler::online_cpus()) {
+        kprintf("Scheduler: Can't isolate every processor, leaving CPU 0 for general use\n");
+        isolated &= ~1u;
+    }
+    s_general_cpus = Scheduler::online_cpus() & ~isolated;
+}
+
+static Thread* pick_from_queue(Thread::Queue queue_id)
+{
+    auto& queue = Thread::queue(queue_id);
+    auto* first = queue.head();
+    if (!first)
+        return nullptr;
+    for (;;) {
+        // Move head to tail.
+        queue.append(queue.remove_head());
+        auto* thread = queue.tail();
+        auto& process = thread->process();
+        if (!process.is_being_inspected() && (Scheduler::cpus_for(process) & (1u << Scheduler::current_cpu())))
+            return thread;
+        if (queue.head() == first)
+            return nullptr;
+    }
+}
+
+// Runnable threads are picked by priority, round-robin within each priority.
+// Lower priorities get a turn after being passed over enough times in a row, so they can't starve.
+static Thread* pick_runnable_thread()
+{
+    int chosen_priority = -1;
+    for (int priority = Process::HighPriority; priority >= Process::LowPriority; --priority) {
+        if (Thread::queue((Thread::Queue)priority).is_empty()) {
+            s_times_passed_over[priority] = 0;
+            continue;
         }
+        if (chosen_priority == -1) {
+            chosen_priority = priority;
+            continue;
+        }
+        if (++s_times_passed_over[priority] >= max_times_passed_over)
+            chosen_priority = priority;
+    }
+    if (chosen_priority == -1)
+        return nullptr;
+    s_times_passed_over[chosen_priority] = 0;
+    if (auto* thread = pick_from_queue((Thread::Queue)chosen_priority))
+        return thread;
+    // Everyone at that priority is being inspected or belongs elsewhere, try the others.
+    for (int priority = Process::HighPriority; priority >= Process::LowPriority; --priority) {
+        if (auto* thread = pick_from_queue((Thread::Queue)priority))
+            return thread;
+    }
+    return nullptr;
+}
 
-        if (thread.state() == Thread::BlockedSnoozing) {
-            if (thread.m_snoozing_alarm->is_ringing()) {
-                thread.m_snoozing_alarm = nullptr;
-                thread.unblock();
-            }
-            return IterationDecision::Continue;
+// While idle, only tick again when the next sleeper, I/O deadline or safety-net poll is due.
+static void enter_tickless_idle_if_possible(const timeval& now)
+{
+    // Anything that needs looking at on every pass keeps us ticking.
+    if (!Thread::queue(Thread::Queue::Polled).is_empty() || Scheduler::has_woken_threads() || s_process_died || s_signals_pending)
+        return;
+    // Someone's runnable, they're just being inspected.
+    for (int priority = Process::LowPriority; priority <= Process::HighPriority; ++priority) {
+        if (!Thread::queue((Thread::Queue)priority).is_empty())
+            return;
+    }
+    dword next_tick = min(s_next_wakeup_time, s_next_io_poll_time);
+    if (s_has_io_deadline) {
+        if (!is_before(now, s_next_io_deadline))
+            return;
+        // Anything further out than the next safety-net poll doesn't matter.
+        int seconds = s_next_io_deadline.tv_sec - now.tv_sec;
+        if (seconds <= 1) {
+            int microseconds = seconds * 1000000 + (s_next_io_deadline.tv_usec - now.tv_usec);
+            next_tick = min(next_tick, system.uptime + ceil_div(microseconds, 1000));
         }
+    }
+    if (next_tick <= system.uptime)
+        return;
+    PIT::enter_tickless(next_tick - system.uptime);
+}
+
+bool Scheduler::pick_next()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(!s_active);
+
+    TemporaryChange<bool> change(s_active, true);
+
+    ASSERT(s_active);
+
+    if (!current) {
+        // XXX: The first ever context_switch() goes to the idle process.
+        //      This to setup a reliable place we can return to.
+        return context_switch(s_colonel_process->main_thread());
+    }
+
+    // Catch the clock up if we were idling without a tick.
+    PIT::leave_tickless();
 
+    struct timeval now;
+    kgettimeofday(now);
+
+    // Check and unblock threads whose wait conditions have been met.
+    // Only the queues where something may have changed since the last pass are looked at.
+    Thread::for_each_in_queue(Thread::Queue::Polled, [&] (Thread& thread) {
         if (thread.state() == Thread::Skip1SchedulerPass) {
             thread.set_state(Thread::Skip0SchedulerPasses);
             return IterationDecision::Continue;
@@ -169,76 +311,124 @@ bool Scheduler::pick_next()
         return IterationDecision::Continue;
     });
 
-    Process::for_each([&] (Process& process) {
-        if (process.is_dead()) {
-            if (current != &process.main_thread() && (!process.ppid() || !Process::from_pid(process.ppid()))) {
-                auto name = process.name();
-                auto pid = process.pid();
-                auto exit_status = Process::reap(process);
-                dbgprintf("reaped unparented process %s(%u), exit status: %u\n", name.characters(), pid, exit_status);
-            }
+    if (system.uptime >= s_next_wakeup_time) {
+        s_next_wakeup_time = 0xffffffff;
+        Thread::for_each_in_queue(Thread::Queue::Sleeping, [&] (Thread& thread) {
+            if (thread.wakeup_time() <= system.uptime)
+                thread.unblock();
+            else
+                note_wakeup_time(thread.wakeup_time());
+            return IterationDecision::Continue;
+        });
+    }
+
+    // Threads blocked on I/O are woken by the wait queues of whatever they're blocked on.
+    Thread::for_each_in_queue(Thread::Queue::WokenOnIO, [&] (Thread& thread) {
+        thread.m_has_pending_wakeup = false;
+        if (Scheduler::check_blocked_on_io(thread, now)) {
+            // Still blocked, back to the BlockedOnIO queue.
+            thread.set_state(thread.state());
         }
-        return true;
+        return IterationDecision::Continue;
     });
 
-    // Dispatch any pending signals.
-    // FIXME: Do we really need this to be a separate pass over the process list?
-    Thread::for_each_living([] (Thread& thread) {
-        if (!thread.has_unmasked_pending_signals())
-            return true;
-        // FIXME: It would be nice if the Scheduler didn't have to worry about who is "current"
-        //        For now, avoid dispatching signals to "current" and do it in a scheduling pass
-        //        while some other process is interrupted. Otherwise a mess will be made.
-        if (&thread == current)
-            return true;
-        // We know how to interrupt blocked processes, but if they are just executing
-        // at some random point in the kernel, let them continue. They'll be in userspace
-        // sooner or later and we can deliver the signal then.
-        // FIXME: Maybe we could check when returning from a syscall if there's a pending
-        //        signal and dispatch it then and there? Would that be doable without the
-        //        syscall effectively being "interrupted" despite having completed?
-        if (thread.in_kernel() && !thread.is_blocked() && !thread.is_stopped())
+    // Timeouts don't come with a wakeup. Also look at everyone once a second,
+    // in case something got unblocked without its wait queue being woken.
+    bool io_deadline_passed = s_has_io_deadline && !is_before(now, s_next_io_deadline);
+    if (io_deadline_passed || system.uptime >= s_next_io_poll_time) {
+        s_has_io_deadline = false;
+        s_next_io_poll_time = system.uptime + TICKS_PER_SECOND;
+        Thread::for_each_in_queue(Thread::Queue::BlockedOnIO, [&] (Thread& thread) {
+            Scheduler::check_blocked_on_io(thread, now);
+            return IterationDecision::Continue;
+        });
+    }
+
+    if (s_process_died) {
+        s_process_died = false;
+        Thread::for_each_in_queue(Thread::Queue::Waiting, [&] (Thread& thread) {
+            thread.process().for_each_child([&] (Process& child) {
+                if (!child.is_dead())
+                    return true;
+                if (thread.waitee_pid() == -1 || thread.waitee_pid() == child.pid()) {
+                    thread.m_waitee_pid = child.pid();
+                    thread.unblock();
+                    return false;
+                }
+                return true;
+            });
+            return IterationDecision::Continue;
+        });
+
+        Process::for_each([&] (Process& process) {
+            if (process.is_dead()) {
+                if (current != &process.main_thread() && (!process.ppid() || !Process::from_pid(process.ppid()))) {
+                    auto name = process.name();
+                    auto pid = process.pid();
+                    auto exit_status = Process::reap(process);
+                    dbgprintf("reaped unparented process %s(%u), exit status: %u\n", name.characters(), pid, exit_status);
+                } else if (current == &process.main_thread()) {
+                    // Try again next time.
+                    s_process_died = true;
+                }
+            }
             return true;
-        // NOTE: dispatch_one_pending_signal() may unblock the process.
-        bool was_blocked = thread.is_blocked();
-        if (thread.dispatch_one_pending_signal() == ShouldUnblockThread::No)
+        });
+    }
+
+    // Dispatch any pending signals.
+    if (s_signals_pending) {
+        s_signals_pending = false;
+        Thread::for_each_living([] (Thread& thread) {
+            if (!thread.has_unmasked_pending_signals())
+                return true;
+            // Anyone we skip below still has a signal coming, look again on the next pass.
+            s_signals_pending = true;
+            // FIXME: It would be nice if the Scheduler didn't have to worry about who is "current"
+            //        For now, avoid dispatching signals to "current" and do it in a scheduling pass
+            //        while some other process is interrupted. Otherwise a mess will be made.
+            if (&thread == current)
+                return true;
+            // We know how to interrupt blocked processes, but if they are just executing
+            // at some random point in the kernel, let them continue. They'll be in userspace
+            // sooner or later and we can deliver the signal then.
+            // FIXME: Maybe we could check when returning from a syscall if there's a pending
+            //        signal and dispatch it then and there? Would that be doable without the
+            //        syscall effectively being "interrupted" despite having completed?
+            if (thread.in_kernel() && !thread.is_blocked() && !thread.is_stopped())
+                return true;
+            // NOTE: dispatch_one_pending_signal() may unblock the process.
+            bool was_blocked = thread.is_blocked();
+            if (thread.dispatch_one_pending_signal() == ShouldUnblockThread::No)
+                return true;
+            if (was_blocked) {
+                dbgprintf("Unblock %s(%u) due to signal\n", thread.process().name().characters(), thread.pid());
+                thread.m_was_interrupted_while_blocked = true;
+                thread.unblock();
+            }
             return true;
-        if (was_blocked) {
-            dbgprintf("Unblock %s(%u) due to signal\n", thread.process().name().characters(), thread.pid());
-            thread.m_was_interrupted_while_blocked = true;
-            thread.unblock();
-        }
-        return true;
-    });
+        });
+    }
 
 #ifdef SCHEDULER_DEBUG
     dbgprintf("Scheduler choices:\n");
-    for (auto* thread = g_threads->head(); thread; thread = thread->next()) {
-        //if (process->state() == Thread::BlockedWait || process->state() == Thread::BlockedSleep)
-//            continue;
-        auto* process = &thread->process();
-        dbgprintf("[K%x] % 12s %s(%u:%u) @ %w:%x\n", process, to_string(thread->state()), process->name().characters(), process->pid(), thread->tid(), thread->tss().cs, thread->tss().eip);
-    }
+    Thread::for_each([] (Thread& thread) {
+        auto* process = &thread.process();
+        dbgprintf("[K%x] % 12s %s(%u:%u) @ %w:%x\n", process, to_string(thread.state()), process->name().characters(), process->pid(), thread.tid(), thread.tss().cs, thread.tss().eip);
+        return IterationDecision::Continue;
+    });
 #endif
 
-    auto* previous_head = g_threads->head();
-    for (;;) {
-        // Move head to tail.
-        g_threads->append(g_threads->remove_head());
-        auto* thread = g_threads->head();
-
-        if (!thread->process().is_being_inspected() && (thread->state() == Thread::Runnable || thread->state() == Thread::Running)) {
+    if (auto* thread = pick_runnable_thread()) {
 #ifdef SCHEDULER_DEBUG
-            kprintf("switch to %s(%u:%u) @ %w:%x\n", thread->process().name().characters(), thread->process().pid(), thread->tid(), thread->tss().cs, thread->tss().eip);
+        kprintf("switch to %s(%u:%u) @ %w:%x\n", thread->process().name().characters(), thread->process().pid(), thread->tid(), thread->tss().cs, thread->tss().eip);
 #endif
-            return context_switch(*thread);
-        }
-
-        if (thread == previous_head) {
-            // Back at process_head, nothing wants to run. Send in the colonel!
-            return context_switch(s_colonel_process->main_thread());
-        }
+        return context_switch(*thread);
     }
+
+    // Nothing wants to run. Send in the colonel!
+    enter_tickless_idle_if_possible(now);
+    return context_switch(s_colonel_process->main_thread());
 }
 
 bool Scheduler::donate_to(Thread* beneficiary, const char* reason)
@@ -249,7 +439,7 @@ bool Scheduler::donate_to(Thread* beneficiary, const char* reason)
         return yield();
     }
 
-    unsigned ticks_to_donate = min(ticks_left - 1, time_slice_for(beneficiary->process().priority()));
+    unsigned ticks_to_donate = min(ticks_left - 1, time_slice_for((Process::Priority)beneficiary->effective_priority()));
 #ifdef SCHEDULER_DEBUG
     dbgprintf("%s(%u:%u) donating %u ticks to %s(%u:%u), reason=%s\n", current->process().name().characters(), current->pid(), current->tid(), ticks_to_donate, beneficiary->process().name().characters(), beneficiary->pid(), beneficiary->tid(), reason);
 #endif
@@ -293,7 +483,7 @@ void Scheduler::switch_now()
 
 bool Scheduler::context_switch(Thread& thread)
 {
-    thread.set_ticks_left(time_slice_for(thread.process().priority()));
+    thread.set_ticks_left(time_slice_for((Process::Priority)thread.effective_priority()));
     thread.did_schedule();
 
     if (current == &thread)
@@ -302,8 +492,12 @@ bool Scheduler::context_switch(Thread& thread)
     if (current) {
         // If the last process hasn't blocked (still marked as running),
         // mark it as runnable for the next round.
-        if (current->state() == Thread::Running)
+        if (current->state() == Thread::Running) {
             current->set_state(Thread::Runnable);
+            ++current->statistics().involuntary_switches;
+        } else {
+            ++current->statistics().voluntary_switches;
+        }
 
 #ifdef LOG_EVERY_CONTEXT_SWITCH
         dbgprintf("Scheduler: %s(%u:%u) -> %s(%u:%u) %w:%x\n",
@@ -313,6 +507,11 @@ bool Scheduler::context_switch(Thread& thread)
 #endif
     }
 
+    TRACE(ContextSwitch, thread.tid(), thread.process().pid());
+    qword now = read_tsc();
+    if (current)
+        current->bill_cycles_until(now);
+    thread.m_cycles_billed_until = now;
     current = &thread;
     thread.set_state(Thread::Running);
 
@@ -384,6 +583,8 @@ void Scheduler::initialize()
     // Make sure the colonel uses a smallish time slice.
     s_colonel_process->set_priority(Process::LowPriority);
     load_task_register(s_redirection.selector);
+    s_isolated_cpus = new Lockable<unsigned>(0);
+    ProcFS::the().add_sys_unsigned("isolated_cpus", *s_isolated_cpus, apply_isolated_cpus);
 }
 
 void Scheduler::timer_tick(RegisterDump& regs)
@@ -391,11 +592,14 @@ void Scheduler::timer_tick(RegisterDump& regs)
     if (!current)
         return;
 
-    system.uptime++;
+    if (current->process().is_profiling())
+        current->process().profile_buffer()->sample(*current, regs);
 
     if (current->tick())
         return;
 
+    current->did_use_whole_time_slice();
+
     current->tss().gs = regs.gs;
     current->tss().fs = regs.fs;
     current->tss().es = regs.es;
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <AK/Assertions.h>
+#include <AK/Types.h>
 
 class Process;
 class Thread;
 struct RegisterDump;
+struct timeval;
 
 extern Thread* current;
 extern Thread* g_last_fpu_thread;
@@ -23,6 +25,21 @@ public:
     static void prepare_to_modify_tss(Thread&);
     static Process* colonel();
     static bool is_active();
+    static bool has_woken_threads();
+
+    // Sets of processors are bitmasks, bit N for processor N in the MP tables.
+    // Only the bootstrap processor runs threads so far, so that's the one that's online.
+    static dword online_cpus() { return 1; }
+    static unsigned current_cpu() { return 0; }
+    // Pinned processes run where they were pinned, isolated processors or not. Everyone else stays off the isolated ones.
+    static dword cpus_for(const Process&);
+
+    // Hints about what may have changed since the last pass, so pick_next() can skip the rest.
+    static void note_process_death();
+    static void note_pending_signals();
+    static void note_wakeup_time(dword);
+
 private:
     static void prepare_for_iret_to_new_process();
+    static bool check_blocked_on_io(Thread&, const timeval& now);
 };
@@ -31,8 +31,7 @@ String SlavePTY::tty_name() const
 
 void SlavePTY::on_master_write(const byte* buffer, ssize_t size)
 {
-    for (ssize_t i = 0; i < size; ++i)
-        emit(buffer[i]);
+    emit(buffer, size);
 }
 
 ssize_t SlavePTY::on_tty_write(const byte* data, ssize_t size)
@@ -10,6 +10,9 @@ KResultOr<Retained<Socket>> Socket::create(int domain, int type, int protocol)
     (void)protocol;
     switch (domain) {
     case AF_LOCAL:
+        // SOCK_SEQPACKET is a stream that keeps the boundaries between writes.
+        if ((type & SOCK_TYPE_MASK) != SOCK_STREAM && (type & SOCK_TYPE_MASK) != SOCK_SEQPACKET)
+            return KResult(-EPROTONOSUPPORT);
         return LocalSocket::create(type & SOCK_TYPE_MASK);
     case AF_INET:
         return IPv4Socket::create(type & SOCK_TYPE_MASK, protocol);
@@ -34,7 +37,7 @@ Socket::~Socket()
 KResult Socket::listen(int backlog)
 {
     LOCKER(m_lock);
-    if (m_type != SOCK_STREAM)
+    if (m_type != SOCK_STREAM && m_type != SOCK_SEQPACKET)
         return KResult(-EOPNOTSUPP);
     m_backlog = backlog;
     kprintf("Socket{%p} listening with backlog=%d\n", this, m_backlog);
@@ -48,7 +51,7 @@ RetainPtr<Socket> Socket::accept()
         return nullptr;
     auto client = m_pending.take_first();
     ASSERT(!client->is_connected());
-    client->m_connected = true;
+    client->set_connected(true);
     return client;
 }
 
@@ -58,9 +61,25 @@ KResult Socket::queue_connection_from(Socket& peer)
     if (m_pending.size() >= m_backlog)
         return KResult(-ECONNREFUSED);
     m_pending.append(peer);
+    m_wait_queue.wake_all();
     return KSuccess;
 }
 
+Vector<RetainPtr<Socket>> Socket::take_pending_connections()
+{
+    LOCKER(m_lock);
+    return move(m_pending);
+}
+
+void Socket::set_connected(bool connected)
+{
+    m_connected = connected;
+    m_wait_queue.wake_all();
+}
+
+static const int min_receive_buffer_size = 2 * KB;
+static const int max_receive_buffer_size = 1 * MB;
+
 KResult Socket::setsockopt(int level, int option, const void* value, socklen_t value_size)
 {
     ASSERT(level == SOL_SOCKET);
@@ -75,6 +94,11 @@ KResult Socket::setsockopt(int level, int option, const void* value, socklen_t v
             return KResult(-EINVAL);
         m_receive_timeout = *(const timeval*)value;
         return KSuccess;
+    case SO_RCVBUF:
+        if (value_size != sizeof(int))
+            return KResult(-EINVAL);
+        m_receive_buffer_size = max(min_receive_buffer_size, min(*(const int*)value, max_receive_buffer_size));
+        return KSuccess;
     default:
         kprintf("%s(%u): setsockopt() at SOL_SOCKET with unimplemented option %d\n", option);
         return KResult(-ENOPROTOOPT);
@@ -97,6 +121,24 @@ KResult Socket::getsockopt(int level, int option, void* value, socklen_t* value_
         *(timeval*)value = m_receive_timeout;
         *value_size = sizeof(timeval);
         return KSuccess;
+    case SO_RCVBUF:
+        if (*value_size < sizeof(int))
+            return KResult(-EINVAL);
+        *(int*)value = m_receive_buffer_size;
+        *value_size = sizeof(int);
+        return KSuccess;
+    case SO_RCVDROPS:
+        if (*value_size < sizeof(dword))
+            return KResult(-EINVAL);
+        *(dword*)value = receive_drops();
+        *value_size = sizeof(dword);
+        return KSuccess;
+    case SO_ERROR:
+        if (*value_size < sizeof(int))
+            return KResult(-EINVAL);
+        *(int*)value = pending_error();
+        *value_size = sizeof(int);
+        return KSuccess;
     default:
         kprintf("%s(%u): getsockopt() at SOL_SOCKET with unimplemented option %d\n", option);
         return KResult(-ENOPROTOOPT);
@@ -7,8 +7,12 @@
 #include <AK/Vector.h>
 #include <Kernel/UnixTypes.h>
 #include <Kernel/KResult.h>
+#include <Kernel/WaitQueue.h>
+
+class Process;
 
 enum class SocketRole { None, Listener, Accepted, Connected, Connecting };
+enum class ShouldBlock { No = 0, Yes = 1 };
 
 class Socket : public Retainable<Socket> {
 public:
@@ -22,38 +26,56 @@ public:
     bool can_accept() const { return !m_pending.is_empty(); }
     RetainPtr<Socket> accept();
     bool is_connected() const { return m_connected; }
-    KResult listen(int backlog);
+    // Lets a connect() that's waiting for the connection give up.
+    virtual bool has_failed_to_connect() const { return false; }
+    virtual KResult listen(int backlog);
+    int backlog() const { return m_backlog; }
 
     virtual KResult bind(const sockaddr*, socklen_t) = 0;
-    virtual KResult connect(const sockaddr*, socklen_t) = 0;
+    // Without blocking, a connection that can't be made right away fails with EINPROGRESS, and carries on.
+    // The socket becomes writable once it's done, and SO_ERROR says how it went.
+    virtual KResult connect(const sockaddr*, socklen_t, ShouldBlock) = 0;
     virtual bool get_address(sockaddr*, socklen_t*) = 0;
     virtual bool is_local() const { return false; }
     virtual bool is_ipv4() const { return false; }
+    virtual int ioctl(Process&, unsigned request, unsigned arg) { (void)request; (void)arg; return -ENOTTY; }
     virtual void attach_fd(SocketRole) = 0;
     virtual void detach_fd(SocketRole) = 0;
     virtual bool can_read(SocketRole) const = 0;
-    virtual ssize_t read(SocketRole, byte*, ssize_t) = 0;
-    virtual ssize_t write(SocketRole, const byte*, ssize_t) = 0;
+    // |flags| are the MSG_* ones, MSG_DONTWAIT for descriptors that don't block.
+    virtual ssize_t read(SocketRole, byte*, ssize_t, int flags) = 0;
+    virtual ssize_t write(SocketRole, const byte*, ssize_t, int flags) = 0;
     virtual bool can_write(SocketRole) const = 0;
     virtual ssize_t sendto(const void*, size_t, int flags, const sockaddr*, socklen_t) = 0;
     virtual ssize_t recvfrom(void*, size_t, int flags, sockaddr*, socklen_t*) = 0;
+    // Fills in up to |count| messages, whose buffers have been validated, and returns how many there were.
+    virtual int recvmmsg(SocketRole, mmsghdr*, int count, int flags) { (void)count; (void)flags; return -EOPNOTSUPP; }
 
     KResult setsockopt(int level, int option, const void*, socklen_t);
     KResult getsockopt(int level, int option, void*, socklen_t*);
 
     pid_t origin_pid() const { return m_origin_pid; }
 
+    // How many bytes of received datagrams can wait to be read, as set with SO_RCVBUF.
+    int receive_buffer_size() const { return m_receive_buffer_size; }
+    virtual dword receive_drops() const { return 0; }
+    // What SO_ERROR reads, the errno a connection failed with.
+    virtual int pending_error() const { return 0; }
+
     timeval receive_deadline() const { return m_receive_deadline; }
     timeval send_deadline() const { return m_send_deadline; }
 
-    void set_connected(bool connected) { m_connected = connected; }
+    void set_connected(bool);
 
     Lock& lock() { return m_lock; }
+    WaitQueue& wait_queue() { return m_wait_queue; }
 
 protected:
     Socket(int domain, int type, int protocol);
 
     KResult queue_connection_from(Socket&);
+    // For a listener that's going away, to get rid of the connections nobody accepted.
+    Vector<RetainPtr<Socket>> take_pending_connections();
 
     void load_receive_deadline();
     void load_send_deadline();
@@ -66,6 +88,7 @@ private:
     int m_protocol { 0 };
     int m_backlog { 0 };
     bool m_connected { false };
+    int m_receive_buffer_size { 64 * KB };
 
     timeval m_receive_timeout { 0, 0 };
     timeval m_send_timeout { 0, 0 };
@@ -74,6 +97,7 @@ private:
     timeval m_send_deadline { 0, 0 };
 
     Vector<RetainPtr<Socket>> m_pending;
+    WaitQueue m_wait_queue;
 };
 
 class SocketHandle {
@@ -4,32 +4,82 @@
 #include <AK/StdLibExtras.h>
 #include <AK/Types.h>
 
+class Thread;
+extern Thread* current;
+
+// The xmm registers are whichever thread's last used the FPU, quite possibly someone in userspace,
+// so the kernel puts back what it borrows.
+class SSERegisterSaver {
+public:
+    SSERegisterSaver()
+    {
+        asm volatile(
+            "movdqu %%xmm0, 0(%0)\n"
+            "movdqu %%xmm1, 16(%0)\n"
+            "movdqu %%xmm2, 32(%0)\n"
+            "movdqu %%xmm3, 48(%0)\n"
+            :: "r"(m_registers) : "memory");
+    }
+    ~SSERegisterSaver()
+    {
+        asm volatile(
+            "movdqu 0(%0), %%xmm0\n"
+            "movdqu 16(%0), %%xmm1\n"
+            "movdqu 32(%0), %%xmm2\n"
+            "movdqu 48(%0), %%xmm3\n"
+            :: "r"(m_registers) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    }
+
+private:
+    byte m_registers[64];
+};
+
+// Touching the FPU with CR0.TS set traps to have the registers switched over, which only pays off for big jobs.
+// Before there's a current thread, there's nobody to switch them over to.
+static inline bool should_use_sse(size_t n)
+{
+    if (!g_cpu_has_sse2 || !current)
+        return false;
+    if (n >= 1024)
+        return true;
+    dword cr0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    return !(cr0 & (1 << 3));
+}
+
 extern "C" {
 
 void* memcpy(void* dest_ptr, const void* src_ptr, size_t n)
 {
-    if (n >= 1024) {
-        return mmx_memcpy(dest_ptr, src_ptr, n);
+    if (n >= 64 && should_use_sse(n)) {
+        SSERegisterSaver saver;
+        return sse2_memcpy(dest_ptr, src_ptr, n);
     }
+    if (n >= 1024)
+        return mmx_memcpy(dest_ptr, src_ptr, n);
 
     size_t dest = (size_t)dest_ptr;
     size_t src = (size_t)src_ptr;
-    // FIXME: Support starting at an unaligned address.
-    if (!(dest & 0x3) && !(src & 0x3) && n >= 12) {
-        size_t size_ts = n / sizeof(size_t);
+    if (n >= 12) {
+        // Get the destination aligned, the source can be wherever it wants.
+        size_t prologue = (4 - (dest & 0x3)) & 0x3;
+        size_t size_ts = (n - prologue) / sizeof(size_t);
+        n -= prologue + size_ts * sizeof(size_t);
         asm volatile(
+            "rep movsb\n"
+            "movl %%edx, %%ecx\n"
             "rep movsl\n"
-            : "=S"(src), "=D"(dest)
-            : "S"(src), "D"(dest), "c"(size_ts)
+            : "=S"(src), "=D"(dest), "=c"(prologue), "=d"(size_ts)
+            : "0"(src), "1"(dest), "2"(prologue), "3"(size_ts)
             : "memory"
         );
-        n -= size_ts * sizeof(size_t);
         if (n == 0)
             return dest_ptr;
     }
     asm volatile(
         "rep movsb\n"
-        :: "S"(src), "D"(dest), "c"(n)
+        : "=S"(src), "=D"(dest), "=c"(n)
+        : "0"(src), "1"(dest), "2"(n)
         : "memory"
     );
     return dest_ptr;
@@ -68,19 +118,21 @@ char* strncpy(char* dest, const char* src, size_t n)
 void* memset(void* dest_ptr, int c, size_t n)
 {
     size_t dest = (size_t)dest_ptr;
-    // FIXME: Support starting at an unaligned address.
-    if (!(dest & 0x3) && n >= 12) {
-        size_t size_ts = n / sizeof(size_t);
+    if (n >= 12) {
+        size_t prologue = (4 - (dest & 0x3)) & 0x3;
+        size_t size_ts = (n - prologue) / sizeof(size_t);
+        n -= prologue + size_ts * sizeof(size_t);
         size_t expanded_c = (byte)c;
         expanded_c |= expanded_c << 8;
         expanded_c |= expanded_c << 16;
         asm volatile(
+            "rep stosb\n"
+            "movl %%edx, %%ecx\n"
             "rep stosl\n"
-            : "=D"(dest)
-            : "D"(dest), "c"(size_ts), "a"(expanded_c)
+            : "=D"(dest), "=c"(prologue), "=d"(size_ts)
+            : "0"(dest), "1"(prologue), "2"(size_ts), "a"(expanded_c)
             : "memory"
         );
-        n -= size_ts * sizeof(size_t);
         if (n == 0)
             return dest_ptr;
     }
@@ -106,6 +158,10 @@ char* strrchr(const char* str, int ch)
 
 size_t strlen(const char* str)
 {
+    if (should_use_sse(0)) {
+        SSERegisterSaver saver;
+        return sse2_strlen(str);
+    }
     size_t len = 0;
     while (*(str++))
         ++len;
@@ -114,6 +170,11 @@ size_t strlen(const char* str)
 
 int strcmp(const char *s1, const char *s2)
 {
+    if (should_use_sse(0)) {
+        SSERegisterSaver saver;
+        int result = sse2_strcmp(s1, s2);
+        return result < 0 ? -1 : result > 0;
+    }
     for (; *s1 == *s2; ++s1, ++s2) {
         if (*s1 == 0)
             return 0;
@@ -131,6 +192,10 @@ char* strdup(const char *str)
 
 int memcmp(const void* v1, const void* v2, size_t n)
 {
+    if (n >= 32 && should_use_sse(n)) {
+        SSERegisterSaver saver;
+        return sse2_memcmp(v1, v2, n);
+    }
     auto* s1 = (const byte*)v1;
     auto* s2 = (const byte*)v2;
     while (n-- > 0) {
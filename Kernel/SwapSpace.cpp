@@ -0,0 +1,92 @@
+#include <Kernel/SwapSpace.h>
+#include <Kernel/DiskBackedFileSystem.h>
+#include <Kernel/FileDescriptor.h>
+#include <Kernel/VirtualFileSystem.h>
+#include <Kernel/i386.h>
+#include <LibC/errno_numbers.h>
+
+SwapSpace* SwapSpace::s_the;
+
+KResult SwapSpace::activate(const String& path)
+{
+    if (s_the)
+        return KResult(-EBUSY);
+    auto descriptor_or_error = VFS::the().open(path, O_RDWR, 0, *VFS::the().root_inode());
+    if (descriptor_or_error.is_error())
+        return descriptor_or_error.error();
+    RetainPtr<Inode> inode = descriptor_or_error.value()->inode();
+    if (!inode || !inode->metadata().is_regular_file())
+        return KResult(-EINVAL);
+    if (!inode->fs().is_disk_backed())
+        return KResult(-ENOTIMPL);
+
+    // Anything still headed for those blocks through the block cache would land on top of swapped pages later.
+    DiskBackedFS::flush_dirty_blocks(DiskBackedFS::FlushMode::All);
+
+    auto offsets = inode->page_offsets_on_disk();
+    Vector<DiskOffset> slot_offsets;
+    for (auto offset : offsets) {
+        // Pages that aren't one contiguous run on disk are no use to us.
+        if (offset)
+            slot_offsets.append(offset);
+    }
+    if (slot_offsets.is_empty())
+        return KResult(-ENOSPC);
+
+    auto& device = static_cast<DiskBackedFS&>(inode->fs()).device();
+    s_the = new SwapSpace(device, move(inode), move(slot_offsets));
+    kprintf("SwapSpace: Swapping to %s, %u kB\n", path.characters(), s_the->slot_count() * PAGE_SIZE / 1024);
+    return KSuccess;
+}
+
+SwapSpace::SwapSpace(Retained<DiskDevice>&& device, RetainPtr<Inode>&& inode, Vector<DiskOffset>&& slot_offsets)
+    : m_device(move(device))
+    , m_inode(move(inode))
+    , m_slot_offsets(move(slot_offsets))
+{
+    m_slot_retain_counts.resize(m_slot_offsets.size());
+    m_free_slots.ensure_capacity(m_slot_offsets.size());
+    // Hand out the low slots first, they sit closer together on disk.
+    for (dword slot = m_slot_offsets.size(); slot >= 1; --slot)
+        m_free_slots.append(slot);
+}
+
+dword SwapSpace::allocate_slot()
+{
+    InterruptDisabler disabler;
+    if (m_free_slots.is_empty())
+        return 0;
+    dword slot = m_free_slots.take_last();
+    ASSERT(!m_slot_retain_counts[slot - 1]);
+    m_slot_retain_counts[slot - 1] = 1;
+    return slot;
+}
+
+void SwapSpace::retain_slot(dword slot)
+{
+    InterruptDisabler disabler;
+    ASSERT(slot && slot <= slot_count());
+    ASSERT(m_slot_retain_counts[slot - 1]);
+    ++m_slot_retain_counts[slot - 1];
+}
+
+void SwapSpace::release_slot(dword slot)
+{
+    InterruptDisabler disabler;
+    ASSERT(slot && slot <= slot_count());
+    ASSERT(m_slot_retain_counts[slot - 1]);
+    if (!--m_slot_retain_counts[slot - 1])
+        m_free_slots.append(slot);
+}
+
+bool SwapSpace::write_page(dword slot, const byte* buffer)
+{
+    ASSERT(slot && slot <= slot_count());
+    return m_device->write(m_slot_offsets[slot - 1], PAGE_SIZE, buffer);
+}
+
+bool SwapSpace::read_page(dword slot, byte* buffer)
+{
+    ASSERT(slot && slot <= slot_count());
+    return m_device->read(m_slot_offsets[slot - 1], PAGE_SIZE, buffer);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <AK/AKString.h>
+#include <AK/RetainPtr.h>
+#include <AK/Vector.h>
+#include <Kernel/DiskDevice.h>
+#include <Kernel/KResult.h>
+
+class Inode;
+
+// Somewhere to put anonymous pages that haven't been touched in a while.
+// The backing file's blocks are accessed directly on the disk, bypassing the file system and its caches,
+// so the file must be fully allocated up front (e.g made with fallocate() or dd from /dev/zero) and left alone afterwards.
+// Each page sized slot is retained by every VMObject page that refers to it, so forked processes can share them.
+class SwapSpace {
+public:
+    static SwapSpace* the() { return s_the; }
+    static KResult activate(const String& path);
+
+    // Slot 0 means "not swapped", so real slots start at 1. allocate_slot() returns 0 if swap is full.
+    dword allocate_slot();
+    void retain_slot(dword);
+    void release_slot(dword);
+
+    // These do disk I/O, so they need interrupts enabled. buffer is one page.
+    bool write_page(dword slot, const byte* buffer);
+    bool read_page(dword slot, byte* buffer);
+
+    size_t slot_count() const { return m_slot_offsets.size(); }
+    size_t free_slot_count() const { return m_free_slots.size(); }
+
+private:
+    SwapSpace(Retained<DiskDevice>&&, RetainPtr<Inode>&&, Vector<DiskOffset>&&);
+
+    static SwapSpace* s_the;
+
+    Retained<DiskDevice> m_device;
+    RetainPtr<Inode> m_inode;
+    Vector<DiskOffset> m_slot_offsets;
+    Vector<word> m_slot_retain_counts;
+    Vector<dword> m_free_slots;
+};
@@ -211,15 +211,16 @@ ssize_t SynthFSInode::read_bytes(off_t offset, ssize_t count, byte* buffer, File
         }
     }
 
+    // Like ProcFS, kept on the descriptor until it's closed or seeked back to the start.
     auto* data = generated_data ? &generated_data : &m_data;
+    if (offset >= data->size())
+        return 0;
     ssize_t nread = min(static_cast<off_t>(data->size() - offset), static_cast<off_t>(count));
     memcpy(buffer, data->pointer() + offset, nread);
-    if (nread == 0 && descriptor && descriptor->generator_cache())
-        descriptor->generator_cache().clear();
     return nread;
 }
 
-bool SynthFSInode::traverse_as_directory(Function<bool(const FS::DirectoryEntry&)> callback) const
+bool SynthFSInode::traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)> callback) const
 {
     LOCKER(m_lock);
 #ifdef SYNTHFS_DEBUG
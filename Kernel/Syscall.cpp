@@ -3,6 +3,8 @@
 #include "Syscall.h"
 #include "Console.h"
 #include "Scheduler.h"
+#include <Kernel/Tracing.h>
+#include <AK/StdLibExtras.h>
 
 extern "C" void syscall_trap_entry(RegisterDump&);
 extern "C" void syscall_trap_handler();
@@ -36,12 +38,90 @@ asm(
     "    iret\n"
 );
 
+extern "C" void sysenter_trap_handler();
+extern "C" dword sysenter_kernel_stack_top();
+
+// sysenter arrives with interrupts off, on the stack in the SYSENTER_ESP MSR, and with nothing saved.
+// It's the same stack for everyone, so it's only used long enough to find the current thread's kernel stack.
+// There the frame int 0x82 would have pushed is made by hand, with the return address LibC left in %esi
+// and the stack it left in %ebp, and the rest goes just like syscall_trap_handler.
+// sysexit takes the way back out in %edx and %ecx, which LibC knows to give up.
+static dword s_sysenter_stack[64];
+
+asm(
+    ".globl sysenter_trap_handler \n"
+    "sysenter_trap_handler:\n"
+    "    pushl %eax\n"
+    "    pushl %ecx\n"
+    "    pushl %edx\n"
+    "    call sysenter_kernel_stack_top\n"
+    "    popl %edx\n"
+    "    popl %ecx\n"
+    "    xchgl %eax, (%esp)\n"
+    "    movl (%esp), %esp\n"
+    "    pushl $0x23\n"
+    "    pushl %ebp\n"
+    "    pushfl\n"
+    "    orl $0x200, (%esp)\n"
+    "    pushl $0x1b\n"
+    "    pushl %esi\n"
+    "    pusha\n"
+    "    pushw %ds\n"
+    "    pushw %es\n"
+    "    pushw %fs\n"
+    "    pushw %gs\n"
+    "    pushw %ss\n"
+    "    pushw %ss\n"
+    "    pushw %ss\n"
+    "    pushw %ss\n"
+    "    pushw %ss\n"
+    "    popw %ds\n"
+    "    popw %es\n"
+    "    popw %fs\n"
+    "    popw %gs\n"
+    "    sti\n"
+    "    mov %esp, %eax\n"
+    "    call syscall_trap_entry\n"
+    "    cli\n"
+    "    popw %gs\n"
+    "    popw %gs\n"
+    "    popw %fs\n"
+    "    popw %es\n"
+    "    popw %ds\n"
+    "    popa\n"
+    // Left: eip, cs, eflags, esp, ss. The flags go back with interrupts still off,
+    // and sti only lets them in after the next instruction, by which time we're gone.
+    "    movl (%esp), %edx\n"
+    "    movl 12(%esp), %ecx\n"
+    "    andl $~0x200, 8(%esp)\n"
+    "    addl $8, %esp\n"
+    "    popfl\n"
+    "    sti\n"
+    "    sysexit\n"
+);
+
+dword sysenter_kernel_stack_top()
+{
+    return current->tss().esp0;
+}
+
 namespace Syscall {
 
+static const dword MSR_SYSENTER_CS = 0x174;
+static const dword MSR_SYSENTER_ESP = 0x175;
+static const dword MSR_SYSENTER_EIP = 0x176;
+
 void initialize()
 {
     register_user_callable_interrupt_handler(0x82, syscall_trap_handler);
     kprintf("Syscall: int 0x82 handler installed\n");
+    if (g_cpu_has_sep) {
+        // CS and SS for both directions are taken from here: 0x08 and 0x10 going in, 0x1b and 0x23 coming out.
+        write_msr(MSR_SYSENTER_CS, 0x08);
+        write_msr(MSR_SYSENTER_ESP, (dword)&s_sysenter_stack[64]);
+        write_msr(MSR_SYSENTER_EIP, (dword)sysenter_trap_handler);
+        kprintf("Syscall: sysenter handler installed\n");
+    }
 }
 
 int sync()
@@ -108,6 +188,8 @@ static dword handle(RegisterDump& regs, dword function, dword arg1, dword arg2,
         return current->process().sys$poll((pollfd*)arg1, (int)arg2, (int)arg3);
     case Syscall::SC_munmap:
         return current->process().sys$munmap((void*)arg1, (size_t)arg2);
+    case Syscall::SC_mremap:
+        return (dword)current->process().sys$mremap((const SC_mremap_params*)arg1);
     case Syscall::SC_gethostname:
         return current->process().sys$gethostname((char*)arg1, (size_t)arg2);
     case Syscall::SC_exit:
@@ -121,6 +203,8 @@ static dword handle(RegisterDump& regs, dword function, dword arg1, dword arg2,
         return current->process().sys$uname((utsname*)arg1);
     case Syscall::SC_set_mmap_name:
         return current->process().sys$set_mmap_name((void*)arg1, (size_t)arg2, (const char*)arg3);
+    case Syscall::SC_madvise:
+        return current->process().sys$madvise((void*)arg1, (size_t)arg2, (int)arg3);
     case Syscall::SC_readlink:
         return current->process().sys$readlink((const char*)arg1, (char*)arg2, (size_t)arg3);
     case Syscall::SC_ttyname_r:
@@ -149,6 +233,8 @@ static dword handle(RegisterDump& regs, dword function, dword arg1, dword arg2,
         return current->process().sys$isatty((int)arg1);
     case Syscall::SC_getdtablesize:
         return current->process().sys$getdtablesize();
+    case Syscall::SC_sysconf:
+        return current->process().sys$sysconf((int)arg1);
     case Syscall::SC_dup:
         return current->process().sys$dup((int)arg1);
     case Syscall::SC_dup2:
@@ -231,6 +317,10 @@ static dword handle(RegisterDump& regs, dword function, dword arg1, dword arg2,
         return current->process().sys$seal_shared_buffer((int)arg1);
     case Syscall::SC_get_shared_buffer_size:
         return current->process().sys$get_shared_buffer_size((int)arg1);
+    case Syscall::SC_create_sealed_shared_buffer:
+        return current->process().sys$create_sealed_shared_buffer((const SC_create_sealed_shared_buffer_params*)arg1);
+    case Syscall::SC_share_buffer_with:
+        return current->process().sys$share_buffer_with((int)arg1, (pid_t)arg2);
     case Syscall::SC_sendto:
         return current->process().sys$sendto((const SC_sendto_params*)arg1);
     case Syscall::SC_recvfrom:
@@ -241,6 +331,52 @@ static dword handle(RegisterDump& regs, dword function, dword arg1, dword arg2,
         return current->process().sys$setsockopt((const SC_setsockopt_params*)arg1);
     case Syscall::SC_create_thread:
         return current->process().sys$create_thread((int(*)(void*))arg1, (void*)arg2);
+    case Syscall::SC_readv:
+        return current->process().sys$readv((int)arg1, (const iovec*)arg2, (int)arg3);
+    case Syscall::SC_writev:
+        return current->process().sys$writev((int)arg1, (const iovec*)arg2, (int)arg3);
+    case Syscall::SC_pread:
+        return current->process().sys$pread((const SC_pread_params*)arg1);
+    case Syscall::SC_pwrite:
+        return current->process().sys$pwrite((const SC_pread_params*)arg1);
+    case Syscall::SC_posix_spawn:
+        return current->process().sys$posix_spawn((const SC_posix_spawn_params*)arg1);
+    case Syscall::SC_futex:
+        return current->process().sys$futex((int*)arg1, (int)arg2, (int)arg3);
+    case Syscall::SC_exit_thread:
+        current->process().sys$exit_thread((int)arg1);
+        ASSERT_NOT_REACHED();
+        return 0;
+    case Syscall::SC_set_thread_pointer:
+        return current->process().sys$set_thread_pointer(regs, (void*)arg1);
+    case Syscall::SC_epoll_create:
+        return current->process().sys$epoll_create((int)arg1);
+    case Syscall::SC_epoll_ctl:
+        return current->process().sys$epoll_ctl((const SC_epoll_ctl_params*)arg1);
+    case Syscall::SC_epoll_wait:
+        return current->process().sys$epoll_wait((const SC_epoll_wait_params*)arg1);
+    case Syscall::SC_recvmmsg:
+        return current->process().sys$recvmmsg((const SC_recvmmsg_params*)arg1);
+    case Syscall::SC_sendmmsg:
+        return current->process().sys$sendmmsg((const SC_sendmmsg_params*)arg1);
+    case Syscall::SC_sendfile:
+        return current->process().sys$sendfile((const SC_sendfile_params*)arg1);
+    case Syscall::SC_get_dir_entries_with_stat:
+        return current->process().sys$get_dir_entries_with_stat((int)arg1, (void*)arg2, (size_t)arg3);
+    case Syscall::SC_profiling_enable:
+        return current->process().sys$profiling_enable((pid_t)arg1);
+    case Syscall::SC_profiling_disable:
+        return current->process().sys$profiling_disable((pid_t)arg1);
+    case Syscall::SC_fsync:
+        return current->process().sys$fsync((int)arg1);
+    case Syscall::SC_fdatasync:
+        return current->process().sys$fdatasync((int)arg1);
+    case Syscall::SC_fallocate:
+        return current->process().sys$fallocate((const SC_fallocate_params*)arg1);
+    case Syscall::SC_sched_setaffinity:
+        return current->process().sys$sched_setaffinity((pid_t)arg1, (size_t)arg2, (const cpu_set_t*)arg3);
+    case Syscall::SC_sched_getaffinity:
+        return current->process().sys$sched_getaffinity((pid_t)arg1, (size_t)arg2, (cpu_set_t*)arg3);
     default:
         kprintf("<%u> int0x82: Unknown function %u requested {%x, %x, %x}\n", current->process().pid(), function, arg1, arg2, arg3);
         break;
@@ -256,6 +392,12 @@ void syscall_trap_entry(RegisterDump& regs)
     dword arg1 = regs.edx;
     dword arg2 = regs.ecx;
     dword arg3 = regs.ebx;
+    TRACE(SyscallEntry, function, arg1, arg2);
+    current->did_enter_kernel();
+    if (function < (dword)Syscall::function_count)
+        ++current->statistics().syscalls[function];
     regs.eax = Syscall::handle(regs, function, arg1, arg2, arg3);
+    current->did_leave_kernel();
+    TRACE(SyscallExit, function, regs.eax);
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <AK/StdLibExtras.h>
 #include <AK/Types.h>
 #include <LibC/fd_set.h>
 
@@ -95,6 +96,33 @@
     __ENUMERATE_SYSCALL(create_thread) \
     __ENUMERATE_SYSCALL(gettid) \
     __ENUMERATE_SYSCALL(donate) \
+    __ENUMERATE_SYSCALL(get_dir_entries_with_stat) \
+    __ENUMERATE_SYSCALL(sendfile) \
+    __ENUMERATE_SYSCALL(readv) \
+    __ENUMERATE_SYSCALL(writev) \
+    __ENUMERATE_SYSCALL(pread) \
+    __ENUMERATE_SYSCALL(pwrite) \
+    __ENUMERATE_SYSCALL(posix_spawn) \
+    __ENUMERATE_SYSCALL(futex) \
+    __ENUMERATE_SYSCALL(exit_thread) \
+    __ENUMERATE_SYSCALL(set_thread_pointer) \
+    __ENUMERATE_SYSCALL(epoll_create) \
+    __ENUMERATE_SYSCALL(epoll_ctl) \
+    __ENUMERATE_SYSCALL(epoll_wait) \
+    __ENUMERATE_SYSCALL(recvmmsg) \
+    __ENUMERATE_SYSCALL(sendmmsg) \
+    __ENUMERATE_SYSCALL(mremap) \
+    __ENUMERATE_SYSCALL(sysconf) \
+    __ENUMERATE_SYSCALL(profiling_enable) \
+    __ENUMERATE_SYSCALL(profiling_disable) \
+    __ENUMERATE_SYSCALL(fsync) \
+    __ENUMERATE_SYSCALL(fdatasync) \
+    __ENUMERATE_SYSCALL(create_sealed_shared_buffer) \
+    __ENUMERATE_SYSCALL(share_buffer_with) \
+    __ENUMERATE_SYSCALL(madvise) \
+    __ENUMERATE_SYSCALL(fallocate) \
+    __ENUMERATE_SYSCALL(sched_setaffinity) \
+    __ENUMERATE_SYSCALL(sched_getaffinity) \
 
 
 namespace Syscall {
@@ -117,6 +145,11 @@ inline constexpr const char* to_string(Function function)
     return "Unknown";
 }
 
+#undef __ENUMERATE_SYSCALL
+#define __ENUMERATE_SYSCALL(x) + 1
+static const int function_count = 0 ENUMERATE_SYSCALLS;
+#undef __ENUMERATE_SYSCALL
+
 #ifdef SERENITY
 struct SC_mmap_params {
     uint32_t addr;
@@ -127,6 +160,13 @@ struct SC_mmap_params {
     int32_t offset; // FIXME: 64-bit off_t?
 };
 
+struct SC_mremap_params {
+    uint32_t old_address;
+    uint32_t old_size;
+    uint32_t new_size;
+    int32_t flags;
+};
+
 struct SC_select_params {
     int nfds;
     fd_set* readfds;
@@ -135,6 +175,20 @@ struct SC_select_params {
     struct timeval* timeout;
 };
 
+struct SC_epoll_ctl_params {
+    int epfd;
+    int op;
+    int fd;
+    struct epoll_event* event;
+};
+
+struct SC_epoll_wait_params {
+    int epfd;
+    struct epoll_event* events;
+    int max_events;
+    int timeout;
+};
+
 struct SC_sendto_params {
     int sockfd;
     const void* data;
@@ -153,6 +207,21 @@ struct SC_recvfrom_params {
     void* addr_length; // socklen_t*
 };
 
+struct SC_recvmmsg_params {
+    int sockfd;
+    void* messages; // mmsghdr*
+    unsigned count;
+    int flags;
+    const void* timeout; // const timespec*
+};
+
+struct SC_sendmmsg_params {
+    int sockfd;
+    void* messages; // mmsghdr*
+    unsigned count;
+    int flags;
+};
+
 struct SC_getsockopt_params {
     int sockfd;
     int level;
@@ -161,6 +230,53 @@ struct SC_getsockopt_params {
     void* value_size; // socklen_t*
 };
 
+struct SC_sendfile_params {
+    int out_fd;
+    int in_fd;
+    void* offset; // off_t*
+    size_t count;
+};
+
+struct SC_fallocate_params {
+    int fd;
+    int mode;
+    int32_t offset; // off_t
+    int32_t length; // off_t
+};
+
+struct SC_pread_params {
+    int fd;
+    void* buffer;
+    ssize_t size;
+    int32_t offset; // FIXME: 64-bit off_t?
+};
+
+enum class SpawnFileActionType : int {
+    Open,
+    Close,
+    Dup2,
+};
+
+struct SC_posix_spawn_file_action {
+    SpawnFileActionType type;
+    int fd;
+    int new_fd; // Dup2
+    const char* path; // Open
+    int options; // Open
+    uint32_t mode; // Open, mode_t
+};
+
+struct SC_posix_spawn_params {
+    const char* path;
+    const char* const* argv;
+    const char* const* envp;
+    const SC_posix_spawn_file_action* file_actions;
+    int file_action_count;
+    int flags;
+    int32_t pgroup; // pid_t
+    uint32_t sigmask; // sigset_t
+};
+
 struct SC_setsockopt_params {
     int sockfd;
     int level;
@@ -169,11 +285,41 @@ struct SC_setsockopt_params {
     size_t value_size; // socklen_t
 };
 
+struct SC_create_sealed_shared_buffer_params {
+    int32_t peer_pid; // pid_t
+    const void* data;
+    int size;
+    void** buffer;
+};
+
 void initialize();
 int sync();
 
+// The kernel comes back out of sysenter to the address in %esi, with the stack in %ebp,
+// and with %ecx and %edx used up for the way back.
+inline dword invoke_with_sysenter(Function function, dword arg1, dword arg2, dword arg3)
+{
+    dword result;
+    asm volatile(
+        "push %%ebp\n"
+        "push %%esi\n"
+        "mov %%esp, %%ebp\n"
+        "call 1f\n"
+        "1: pop %%esi\n"
+        "add $(2f - 1b), %%esi\n"
+        "sysenter\n"
+        "2: pop %%esi\n"
+        "pop %%ebp\n"
+        : "=a"(result), "+d"(arg1), "+c"(arg2)
+        : "a"(function), "b"(arg3)
+        : "memory", "cc");
+    return result;
+}
+
 inline dword invoke(Function function)
 {
+    if (g_cpu_has_sep)
+        return invoke_with_sysenter(function, 0, 0, 0);
     dword result;
     asm volatile("int $0x82":"=a"(result):"a"(function):"memory");
     return result;
@@ -182,6 +328,8 @@ inline dword invoke(Function function)
 template<typename T1>
 inline dword invoke(Function function, T1 arg1)
 {
+    if (g_cpu_has_sep)
+        return invoke_with_sysenter(function, (dword)arg1, 0, 0);
     dword result;
     asm volatile("int $0x82":"=a"(result):"a"(function),"d"((dword)arg1):"memory");
     return result;
@@ -190,6 +338,8 @@ inline dword invoke(Function function, T1 arg1)
 template<typename T1, typename T2>
 inline dword invoke(Function function, T1 arg1, T2 arg2)
 {
+    if (g_cpu_has_sep)
+        return invoke_with_sysenter(function, (dword)arg1, (dword)arg2, 0);
     dword result;
     asm volatile("int $0x82":"=a"(result):"a"(function),"d"((dword)arg1),"c"((dword)arg2):"memory");
     return result;
@@ -198,6 +348,8 @@ inline dword invoke(Function function, T1 arg1, T2 arg2)
 template<typename T1, typename T2, typename T3>
 inline dword invoke(Function function, T1 arg1, T2 arg2, T3 arg3)
 {
+    if (g_cpu_has_sep)
+        return invoke_with_sysenter(function, (dword)arg1, (dword)arg2, (dword)arg3);
     dword result;
     asm volatile("int $0x82":"=a"(result):"a"(function),"d"((dword)arg1),"c"((dword)arg2),"b"((dword)arg3):"memory");
     return result;
@@ -13,6 +13,15 @@ enum : word {
 };
 };
 
+struct TCPOption {
+enum : byte {
+    End         = 0,
+    NoOperation = 1,
+    MSS         = 2,
+    WindowScale = 3,
+};
+};
+
 class [[gnu::packed]] TCPPacket {
 public:
     TCPPacket() { }
@@ -38,6 +47,7 @@ public:
     bool has_syn() const { return flags() & TCPFlags::SYN; }
     bool has_ack() const { return flags() & TCPFlags::ACK; }
     bool has_fin() const { return flags() & TCPFlags::FIN; }
+    bool has_rst() const { return flags() & TCPFlags::RST; }
 
     byte data_offset() const { return (m_flags_and_data_offset & 0xf000) >> 12; }
     void set_data_offset(word data_offset) { m_flags_and_data_offset = (m_flags_and_data_offset & ~0xf000) | data_offset << 12; }
@@ -47,10 +57,16 @@ public:
 
     word checksum() const { return m_checksum; }
     void set_checksum(word checksum) { m_checksum = checksum; }
+    // Where the checksum is in the header, for an adapter that fills it in.
+    static const int checksum_offset = 16;
 
     word urgent() const { return m_urgent; }
     void set_urgent(word urgent) { m_urgent = urgent; }
 
+    const byte* options() const { return (const byte*)(this + 1); }
+    byte* options() { return (byte*)(this + 1); }
+    size_t options_size() const { return header_size() - sizeof(TCPPacket); }
+
     const void* payload() const { return ((const byte*)this) + header_size(); }
     void* payload() { return ((byte*)this) + header_size(); }
 
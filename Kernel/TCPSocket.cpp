@@ -1,41 +1,82 @@
 #include <Kernel/TCPSocket.h>
 #include <Kernel/TCP.h>
+#include <Kernel/InternetChecksum.h>
 #include <Kernel/NetworkAdapter.h>
 #include <Kernel/Process.h>
 #include <Kernel/RandomDevice.h>
+#include <Kernel/i8253.h>
+#include <Kernel/system.h>
+#include <LibC/errno_numbers.h>
 
-Lockable<HashMap<word, TCPSocket*>>& TCPSocket::sockets_by_port()
+//#define TCP_SOCKET_DEBUG
+
+static const size_t buffer_size = 128 * KB;
+// The peer gets the minimum everyone has to take until it says otherwise.
+static const int default_mss = 536;
+// Enough to advertise all of the receive buffer.
+static const byte receive_window_scale = 2;
+static const byte max_window_scale = 14;
+static const int max_out_of_order_segments = 64;
+
+// All in ticks.
+static const dword initial_retransmission_timeout = TICKS_PER_SECOND;
+static const dword min_retransmission_timeout = TICKS_PER_SECOND / 5;
+static const dword max_retransmission_timeout = 60 * TICKS_PER_SECOND;
+static const dword delayed_ack_timeout = TICKS_PER_SECOND / 10;
+static const dword time_wait_timeout = 2 * 30 * TICKS_PER_SECOND;
+// How often the timer task looks at the sockets while any of their timers are armed.
+static const dword timer_granularity = TICKS_PER_SECOND / 100;
+
+static const int max_syn_retransmissions = 5;
+static const int max_backlog = 128;
+static const int max_retransmissions = 10;
+
+// Sequence numbers wrap around, so they're compared by which way around is shorter.
+static inline bool sequence_before(dword a, dword b)
 {
-    static Lockable<HashMap<word, TCPSocket*>>* s_map;
-    if (!s_map)
-        s_map = new Lockable<HashMap<word, TCPSocket*>>;
-    return *s_map;
+    return (signed_dword)(a - b) < 0;
 }
 
-TCPSocketHandle TCPSocket::from_port(word port)
+static bool s_timers_armed;
+
+class TCPTimerAlarm final : public Alarm {
+public:
+    virtual bool is_ringing() const override { return s_timers_armed; }
+};
+
+static TCPTimerAlarm& timer_alarm()
 {
-    RetainPtr<TCPSocket> socket;
-    {
-        LOCKER(sockets_by_port().lock());
-        auto it = sockets_by_port().resource().find(port);
-        if (it == sockets_by_port().resource().end())
-            return { };
-        socket = (*it).value;
-        ASSERT(socket);
-    }
-    return { move(socket) };
+    static TCPTimerAlarm* s_alarm;
+    if (!s_alarm)
+        s_alarm = new TCPTimerAlarm;
+    return *s_alarm;
 }
 
+IPv4SocketTable<TCPSocket>& TCPSocket::table()
+{
+    static IPv4SocketTable<TCPSocket>* s_table;
+    if (!s_table)
+        s_table = new IPv4SocketTable<TCPSocket>;
+    return *s_table;
+}
+
+TCPSocketHandle TCPSocket::from_tuple(const IPv4SocketTuple& tuple)
+{
+    return { table().find(tuple) };
+}
 
 TCPSocket::TCPSocket(int protocol)
     : IPv4Socket(SOCK_STREAM, protocol)
+    , m_send_buffer(buffer_size)
+    , m_receive_buffer(buffer_size)
 {
+    m_receive_buffer.set_wait_queue(wait_queue());
 }
 
 TCPSocket::~TCPSocket()
 {
-    LOCKER(sockets_by_port().lock());
-    sockets_by_port().resource().remove(source_port());
+    // The connections a listener made have its port too, so it's only taken out if it's ours.
+    table().remove(source_port(), tuple(), *this);
 }
 
 Retained<TCPSocket> TCPSocket::create(int protocol)
@@ -43,161 +84,976 @@ Retained<TCPSocket> TCPSocket::create(int protocol)
     return adopt(*new TCPSocket(protocol));
 }
 
-int TCPSocket::protocol_receive(const ByteBuffer& packet_buffer, void* buffer, size_t buffer_size, int flags, sockaddr* addr, socklen_t* addr_length)
+KResult TCPSocket::listen(int backlog)
 {
-    (void)flags;
-    (void)addr_length;
-    ASSERT(!packet_buffer.is_null());
-    auto& ipv4_packet = *(const IPv4Packet*)(packet_buffer.pointer());
-    auto& tcp_packet = *static_cast<const TCPPacket*>(ipv4_packet.payload());
-    size_t payload_size = packet_buffer.size() - sizeof(IPv4Packet) - tcp_packet.header_size();
-    kprintf("payload_size %u, will it fit in %u?\n", payload_size, buffer_size);
-    ASSERT(buffer_size >= payload_size);
-    if (addr) {
-        auto& ia = *(sockaddr_in*)addr;
-        ia.sin_port = htons(tcp_packet.destination_port());
+    int rc = allocate_source_port_if_needed();
+    if (rc < 0)
+        return KResult(rc);
+    LOCKER(lock());
+    if (m_state != State::Closed && m_state != State::Listen)
+        return KResult(-EINVAL);
+    auto result = Socket::listen(max(1, min(backlog, max_backlog)));
+    if (result.is_error())
+        return result;
+    m_error = 0;
+    m_state = State::Listen;
+    return KSuccess;
+}
+
+bool TCPSocket::can_read(SocketRole role) const
+{
+    // For a listener that's a connection to accept.
+    if (role == SocketRole::Listener)
+        return can_accept() || m_state != State::Listen;
+    return !m_receive_buffer.is_empty() || m_received_fin || m_state == State::Closed;
+}
+
+bool TCPSocket::can_write(SocketRole) const
+{
+    // A connection that's still being made is neither, so waiting for writability waits for it to be done.
+    if (m_state == State::SynSent)
+        return false;
+    // Once nothing more can be sent, writing fails right away.
+    return !can_send_data() || m_send_buffer.space_for_writing();
+}
+
+void TCPSocket::detach_fd(SocketRole role)
+{
+    IPv4Socket::detach_fd(role);
+    {
+        LOCKER(lock());
+        if (attached_fds())
+            return;
+        if (m_state != State::Listen) {
+            close();
+            return;
+        }
     }
-    memcpy(buffer, tcp_packet.payload(), payload_size);
-    return payload_size;
+    stop_listening();
 }
 
-int TCPSocket::protocol_send(const void* data, int data_length)
+ssize_t TCPSocket::recvfrom(void* buffer, size_t buffer_length, int flags, sockaddr* addr, socklen_t* addr_length)
 {
-    // FIXME: Figure out the adapter somehow differently.
-    auto* adapter = NetworkAdapter::from_ipv4_address(IPv4Address(192, 168, 5, 2));
-    if (!adapter)
-        ASSERT_NOT_REACHED();
-    send_tcp_packet(TCPFlags::PUSH | TCPFlags::ACK, data, data_length);
-    return data_length;
+    if (addr_length && *addr_length < sizeof(sockaddr_in))
+        return -EINVAL;
+
+    for (bool did_block = false;; did_block = true) {
+        {
+            LOCKER(lock());
+            if (!m_receive_buffer.is_empty()) {
+                ssize_t nread = m_receive_buffer.read((byte*)buffer, buffer_length);
+                if (addr) {
+                    auto& ia = *(sockaddr_in*)addr;
+                    memcpy(&ia.sin_addr, &destination_address(), sizeof(IPv4Address));
+                    ia.sin_port = htons(destination_port());
+                    ia.sin_family = AF_INET;
+                    ASSERT(addr_length);
+                    *addr_length = sizeof(sockaddr_in);
+                }
+                send_window_update_if_worthwhile();
+                return nread;
+            }
+            if (m_error)
+                return -m_error;
+            if (m_received_fin || m_state == State::Closed)
+                return 0;
+        }
+        // Only a timeout wakes us up with nothing to show for it.
+        if (did_block || (flags & MSG_DONTWAIT))
+            return -EAGAIN;
+        current->set_blocked_socket(this);
+        load_receive_deadline();
+        current->block(Thread::BlockedReceive);
+    }
 }
 
-void TCPSocket::send_tcp_packet(word flags, const void* payload, int payload_size)
+int TCPSocket::protocol_send(const void* data, int data_length, int flags)
 {
-    // FIXME: Figure out the adapter somehow differently.
-    auto& adapter = *NetworkAdapter::from_ipv4_address(IPv4Address(192, 168, 5, 2));
+    int nsent = 0;
+    for (;;) {
+        {
+            LOCKER(lock());
+            if (!can_send_data()) {
+                if (nsent)
+                    return nsent;
+                if (m_error)
+                    return -m_error;
+                return m_state == State::Closed || m_state == State::Listen ? -ENOTCONN : -EPIPE;
+            }
+            ssize_t nwritten = m_send_buffer.write((const byte*)data + nsent, data_length - nsent);
+            if (nwritten < 0)
+                return nsent ? nsent : nwritten;
+            nsent += nwritten;
+            send_pending_segments();
+            if (nsent == data_length)
+                return nsent;
+            if (flags & MSG_DONTWAIT)
+                return nsent ? nsent : -EAGAIN;
+        }
+        current->snooze_until(m_send_buffer_alarm);
+    }
+}
+
+word TCPSocket::advertised_window() const
+{
+    size_t window = min(m_receive_buffer.space_for_writing(), (size_t)0xffff << m_receive_window_scale);
+    return window >> m_receive_window_scale;
+}
+
+void TCPSocket::send_segment(dword sequence, word flags, int data_offset, int data_size)
+{
+    if (!m_route.is_valid()) {
+        // There was no way there when it was last looked. Retransmitting tries again.
+        m_route = route_to(destination_address());
+        if (!m_route.is_valid())
+            return;
+    }
+    auto& adapter = *m_route.adapter;
+    auto source = source_address_for(m_route);
+
+    auto packet = PacketBuffer::create(data_size);
+    if (data_size) {
+        ssize_t npeeked = m_send_buffer.peek(data_offset, packet->data(), data_size);
+        ASSERT(npeeked == data_size);
+    }
 
-    auto buffer = ByteBuffer::create_zeroed(sizeof(TCPPacket) + payload_size);
-    auto& tcp_packet = *(TCPPacket*)(buffer.pointer());
+    byte options[8];
+    int options_size = 0;
+    if (flags & TCPFlags::SYN) {
+        options[0] = TCPOption::MSS;
+        options[1] = 4;
+        int mss = route_mss();
+        options[2] = mss >> 8;
+        options[3] = mss & 0xff;
+        options_size = 4;
+        // A SYN-ACK can only offer to scale if the SYN did.
+        if (!(flags & TCPFlags::ACK) || m_receive_window_scale) {
+            options[4] = TCPOption::NoOperation;
+            options[5] = TCPOption::WindowScale;
+            options[6] = 3;
+            options[7] = receive_window_scale;
+            options_size = 8;
+        }
+    }
+
+    auto& tcp_packet = *(TCPPacket*)packet->prepend(sizeof(TCPPacket) + options_size);
+    memcpy(tcp_packet.options(), options, options_size);
     ASSERT(source_port());
     tcp_packet.set_source_port(source_port());
     tcp_packet.set_destination_port(destination_port());
-    tcp_packet.set_window_size(1024);
-    tcp_packet.set_sequence_number(m_sequence_number);
-    tcp_packet.set_data_offset(sizeof(TCPPacket) / sizeof(dword));
+    tcp_packet.set_sequence_number(sequence);
+    tcp_packet.set_data_offset((sizeof(TCPPacket) + options_size) / sizeof(dword));
     tcp_packet.set_flags(flags);
-
-    if (flags & TCPFlags::ACK)
-        tcp_packet.set_ack_number(m_ack_number);
-
-    if (flags == TCPFlags::SYN) {
-        ++m_sequence_number;
+    if (flags & TCPFlags::SYN) {
+        // The window in a SYN is never scaled.
+        tcp_packet.set_window_size(min(m_receive_buffer.space_for_writing(), (size_t)0xffff));
+    } else {
+        tcp_packet.set_window_size(advertised_window());
+    }
+    if (flags & TCPFlags::ACK) {
+        tcp_packet.set_ack_number(m_receive_next);
+        // Anything that was waiting for an ACK of its own goes with this one.
+        m_advertised_window = (dword)tcp_packet.window_size() << ((flags & TCPFlags::SYN) ? 0 : m_receive_window_scale);
+        m_segments_since_ack = 0;
+        m_delayed_ack_deadline = 0;
+    }
+    if (adapter.can_offload_checksums()) {
+        InternetChecksum checksum;
+        checksum.add_pseudo_header(source, destination_address(), IPv4Protocol::TCP, tcp_packet.header_size() + data_size);
+        tcp_packet.set_checksum(checksum.sum());
+        packet->offload_checksum(0, TCPPacket::checksum_offset);
     } else {
-        m_sequence_number += payload_size;
+        tcp_packet.set_checksum(compute_tcp_checksum(source, destination_address(), tcp_packet, data_size));
     }
 
-    memcpy(tcp_packet.payload(), payload, payload_size);
-    tcp_packet.set_checksum(compute_tcp_checksum(adapter.ipv4_address(), destination_address(), tcp_packet, payload_size));
-    kprintf("sending tcp packet from %s:%u to %s:%u with (%s %s) seq_no=%u, ack_no=%u\n",
-        adapter.ipv4_address().to_string().characters(),
-        source_port(),
+#ifdef TCP_SOCKET_DEBUG
+    kprintf("TCPSocket{%p}: Sending to %s:%u, flags=%w, seq_no=%u, ack_no=%u, size=%d, window=%u\n",
+        this,
         destination_address().to_string().characters(),
         destination_port(),
-        tcp_packet.has_syn() ? "SYN" : "",
-        tcp_packet.has_ack() ? "ACK" : "",
-        tcp_packet.sequence_number(),
-        tcp_packet.ack_number()
+        flags,
+        sequence,
+        tcp_packet.ack_number(),
+        data_size,
+        tcp_packet.window_size()
     );
-    adapter.send_ipv4(MACAddress(), destination_address(), IPv4Protocol::TCP, move(buffer));
+#endif
+    adapter.send_ipv4(source, m_route.next_hop, destination_address(), IPv4Protocol::TCP, move(packet));
 }
 
-NetworkOrdered<word> TCPSocket::compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, word payload_size)
+void TCPSocket::send_ack()
+{
+    send_segment(m_send_next, TCPFlags::ACK);
+}
+
+void TCPSocket::send_pending_segments()
+{
+    switch (m_state) {
+    case State::Established:
+    case State::CloseWait:
+    case State::FinWait1:
+    case State::Closing:
+    case State::LastAck:
+        break;
+    default:
+        return;
+    }
+
+    dword window = min(m_send_window, m_congestion_window);
+    for (;;) {
+        size_t offset = m_send_next - m_send_unacknowledged;
+        // Past the data there's only the FIN.
+        if (offset > m_send_buffer.used_bytes())
+            break;
+        size_t unsent = m_send_buffer.used_bytes() - offset;
+        if (!unsent) {
+            if (m_fin_queued && !m_fin_sent) {
+                send_segment(m_send_next, TCPFlags::FIN | TCPFlags::ACK);
+                ++m_send_next;
+                m_fin_sent = true;
+            }
+            break;
+        }
+        if (bytes_in_flight() >= window)
+            break;
+        size_t size = min(unsent, min((size_t)m_mss, window - bytes_in_flight()));
+        bool is_last = size == unsent;
+        bool with_fin = is_last && m_fin_queued;
+        if (!m_timing_segment && !sequence_before(m_send_next, m_send_max)) {
+            m_timing_segment = true;
+            m_timed_sequence = m_send_next;
+            m_timed_segment_sent_at = system.uptime;
+        }
+        send_segment(m_send_next, TCPFlags::ACK | (is_last ? TCPFlags::PUSH : 0) | (with_fin ? TCPFlags::FIN : 0), offset, size);
+        m_send_next += size + with_fin;
+        if (with_fin)
+            m_fin_sent = true;
+    }
+    if (sequence_before(m_send_max, m_send_next))
+        m_send_max = m_send_next;
+
+    // With nothing in flight and the peer's window shut, the same timer makes us probe it.
+    bool window_is_shut = !m_send_window && m_send_buffer.used_bytes() > bytes_in_flight();
+    if ((bytes_in_flight() || window_is_shut) && !m_retransmit_deadline)
+        arm_timer(m_retransmit_deadline, m_retransmission_timeout);
+}
+
+void TCPSocket::retransmit_first_segment()
 {
-    struct [[gnu::packed]] PseudoHeader {
-        IPv4Address source;
-        IPv4Address destination;
-        byte zero;
-        byte protocol;
-        NetworkOrdered<word> payload_size;
-    };
+    size_t size = min(m_send_buffer.used_bytes(), (size_t)m_mss);
+    dword data_end = m_send_unacknowledged + m_send_buffer.used_bytes();
+    bool with_fin = m_fin_queued && size == m_send_buffer.used_bytes() && sequence_before(data_end, m_send_max);
+    if (!size && !with_fin)
+        return;
+    send_segment(m_send_unacknowledged, TCPFlags::ACK | (with_fin ? TCPFlags::FIN : 0), 0, size);
+    m_timing_segment = false;
+}
 
-    PseudoHeader pseudo_header { source, destination, 0, (byte)IPv4Protocol::TCP, sizeof(TCPPacket) + payload_size };
+void TCPSocket::send_window_update_if_worthwhile()
+{
+    if (m_state != State::Established && m_state != State::FinWait1 && m_state != State::FinWait2)
+        return;
+    // Telling the peer about every few bytes of room would have it send segments that small.
+    dword window = (dword)advertised_window() << m_receive_window_scale;
+    if (window >= m_advertised_window + min(buffer_size / 2, (size_t)2 * m_mss))
+        send_ack();
+}
 
-    dword checksum = 0;
-    auto* w = (const NetworkOrdered<word>*)&pseudo_header;
-    for (size_t i = 0; i < sizeof(pseudo_header) / sizeof(word); ++i) {
-        checksum += w[i];
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
+static void parse_syn_options(const TCPPacket& packet, int& mss, int& window_scale)
+{
+    const byte* options = packet.options();
+    size_t size = packet.options_size();
+    for (size_t i = 0; i < size;) {
+        byte kind = options[i];
+        if (kind == TCPOption::End)
+            return;
+        if (kind == TCPOption::NoOperation) {
+            ++i;
+            continue;
+        }
+        if (i + 1 >= size)
+            return;
+        byte length = options[i + 1];
+        if (length < 2 || i + length > size)
+            return;
+        if (kind == TCPOption::MSS && length == 4)
+            mss = options[i + 2] << 8 | options[i + 3];
+        else if (kind == TCPOption::WindowScale && length == 3)
+            window_scale = min(options[i + 2], max_window_scale);
+        i += length;
     }
-    w = (const NetworkOrdered<word>*)&packet;
-    for (size_t i = 0; i < sizeof(packet) / sizeof(word); ++i) {
-        checksum += w[i];
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
+}
+
+void TCPSocket::receive_segment(const IPv4Packet& ipv4_packet, const TCPPacket& tcp_packet, PacketBuffer& packet)
+{
+    int payload_offset = sizeof(IPv4Packet) + tcp_packet.header_size();
+    int payload_size = ipv4_packet.payload_size() - tcp_packet.header_size();
+
+    if (m_state == State::Closed)
+        return;
+
+    if (m_state == State::Listen) {
+        // FIXME: Answer a stray ACK with a reset, so the peer knows there's no such connection.
+        if (!tcp_packet.has_rst() && !tcp_packet.has_ack() && tcp_packet.has_syn())
+            receive_syn(ipv4_packet, tcp_packet);
+        return;
+    }
+
+    if (m_state == State::SynSent) {
+        if (tcp_packet.has_ack() && tcp_packet.ack_number() != m_initial_sequence + 1)
+            return;
+        if (tcp_packet.has_rst()) {
+            if (tcp_packet.has_ack())
+                abort(ECONNREFUSED, false);
+            return;
+        }
+        // FIXME: Handle a simultaneous open, a SYN without an ACK.
+        if (tcp_packet.has_syn() && tcp_packet.has_ack())
+            receive_syn_ack(tcp_packet);
+        return;
     }
-    ASSERT(packet.data_offset() * 4 == sizeof(TCPPacket));
-    w = (const NetworkOrdered<word>*)packet.payload();
-    for (size_t i = 0; i < payload_size / sizeof(word); ++i) {
-        checksum += w[i];
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
+
+    dword sequence = tcp_packet.sequence_number();
+    if (tcp_packet.has_rst()) {
+        // Anyone can make up a segment, but not easily one that lands in the window.
+        if (!sequence_before(sequence, m_receive_next) && sequence_before(sequence, m_receive_next + max(m_advertised_window, (dword)1)))
+            abort(ECONNRESET, false);
+        return;
+    }
+    if (m_state == State::SynReceived) {
+        // Our SYN-ACK got lost, and the peer sent its SYN again.
+        if (tcp_packet.has_syn()) {
+            send_segment(m_initial_sequence, TCPFlags::SYN | TCPFlags::ACK);
+            return;
+        }
+        if (!tcp_packet.has_ack() || tcp_packet.ack_number() != m_initial_sequence + 1)
+            return;
+        receive_ack_of_syn_ack(tcp_packet);
+        if (m_state != State::Established)
+            return;
+        // The rest of the segment can already have data in it.
     }
-    if (payload_size & 1) {
-        word expanded_byte = ((const byte*)packet.payload())[payload_size - 1] << 8;
-        checksum += expanded_byte;
-        if (checksum > 0xffff)
-            checksum = (checksum >> 16) + (checksum & 0xffff);
+
+    // Our ACK for the SYN got lost, and the peer sent it again.
+    if (tcp_packet.has_syn()) {
+        send_ack();
+        return;
     }
-    return ~(checksum & 0xffff);
+    if (!tcp_packet.has_ack())
+        return;
+
+    if (!receive_ack(tcp_packet, payload_size))
+        return;
+    if (m_state == State::Closed)
+        return;
+    if (payload_size || tcp_packet.has_fin())
+        receive_data(tcp_packet, packet, payload_offset, payload_size);
+    send_pending_segments();
 }
 
-KResult TCPSocket::protocol_connect()
+void TCPSocket::receive_syn(const IPv4Packet& ipv4_packet, const TCPPacket& tcp_packet)
 {
-    // FIXME: Figure out the adapter somehow differently.
-    auto* adapter = NetworkAdapter::from_ipv4_address(IPv4Address(192, 168, 5, 2));
-    if (!adapter)
-        ASSERT_NOT_REACHED();
+    // The peer sends it again if it hears nothing, and there may be room by then.
+    if (m_syn_queue.size() >= backlog())
+        return;
+    auto route = route_to(ipv4_packet.source());
+    if (!route.is_valid())
+        return;
 
-    allocate_source_port_if_needed();
+    auto connection = TCPSocket::create(protocol());
+    LOCKER(connection->lock());
+    connection->set_source_address(ipv4_packet.destination());
+    connection->set_source_port(source_port());
+    connection->set_destination_address(ipv4_packet.source());
+    connection->set_destination_port(tcp_packet.source_port());
+    connection->m_listener = this;
+    connection->m_route = route;
+
+    int peer_mss = default_mss;
+    int peer_window_scale = -1;
+    parse_syn_options(tcp_packet, peer_mss, peer_window_scale);
+    connection->m_mss = max(64, min(peer_mss, connection->route_mss()));
+    if (peer_window_scale >= 0) {
+        connection->m_send_window_scale = peer_window_scale;
+        connection->m_receive_window_scale = receive_window_scale;
+    }
 
-    m_sequence_number = 0;
-    m_ack_number = 0;
+    connection->m_receive_next = tcp_packet.sequence_number() + 1;
+    connection->m_initial_sequence = RandomDevice::random_value();
+    connection->m_send_unacknowledged = connection->m_initial_sequence;
+    connection->m_send_next = connection->m_initial_sequence + 1;
+    connection->m_send_max = connection->m_send_next;
+    // The window in a SYN is never scaled.
+    connection->m_send_window = tcp_packet.window_size();
+    connection->m_window_update_sequence = tcp_packet.sequence_number();
+    connection->m_window_update_ack = connection->m_initial_sequence;
+    connection->m_retransmission_timeout = initial_retransmission_timeout;
+    connection->m_timing_segment = true;
+    connection->m_timed_sequence = connection->m_initial_sequence;
+    connection->m_timed_segment_sent_at = system.uptime;
+    connection->m_state = State::SynReceived;
 
-    send_tcp_packet(TCPFlags::SYN);
-    m_state = State::Connecting;
+    table().add_connection(connection->tuple(), *connection);
+    connection->send_segment(connection->m_initial_sequence, TCPFlags::SYN | TCPFlags::ACK);
+    connection->arm_timer(connection->m_retransmit_deadline, connection->m_retransmission_timeout);
+    m_syn_queue.append(connection.ptr());
+}
+
+void TCPSocket::receive_ack_of_syn_ack(const TCPPacket& tcp_packet)
+{
+    m_send_unacknowledged = tcp_packet.ack_number();
+    m_send_next = m_send_unacknowledged;
+    m_send_max = m_send_unacknowledged;
+    m_congestion_window = 10 * m_mss;
+
+    if (m_timing_segment) {
+        m_timing_segment = false;
+        update_round_trip_time(system.uptime - m_timed_segment_sent_at);
+    }
+    m_retransmissions = 0;
+    m_retransmit_deadline = 0;
+    m_state = State::Established;
+
+    auto* listener = m_listener;
+    m_listener = nullptr;
+    if (!listener || !listener->did_establish_connection(*this))
+        abort(ECONNREFUSED, true);
+}
+
+// Moves |connection| on from the SYN queue to the accept queue, if there's room.
+// It's locked, like it is whenever it locks us. So we only ever lock our own connections when nobody else can have them yet.
+bool TCPSocket::did_establish_connection(TCPSocket& connection)
+{
+    LOCKER(lock());
+    if (m_state != State::Listen)
+        return false;
+    auto result = queue_connection_from(connection);
+    forget_connection(connection);
+    return !result.is_error();
+}
+
+void TCPSocket::forget_connection(TCPSocket& connection)
+{
+    LOCKER(lock());
+    for (int i = 0; i < m_syn_queue.size(); ++i) {
+        if (m_syn_queue[i].ptr() == &connection) {
+            m_syn_queue.remove(i);
+            return;
+        }
+    }
+}
+
+void TCPSocket::stop_listening()
+{
+    Vector<RetainPtr<TCPSocket>> half_open;
+    Vector<RetainPtr<Socket>> unaccepted;
+    {
+        LOCKER(lock());
+        m_state = State::Closed;
+        half_open = move(m_syn_queue);
+        unaccepted = take_pending_connections();
+    }
+    // The connections lock us on their way into the accept queue, so they're only locked once we're not.
+    for (auto& connection : half_open) {
+        LOCKER(connection->lock());
+        connection->m_listener = nullptr;
+        if (connection->m_state != State::Closed)
+            connection->abort(ECONNRESET, true);
+    }
+    for (auto& socket : unaccepted) {
+        auto& connection = static_cast<TCPSocket&>(*socket);
+        LOCKER(connection.lock());
+        if (connection.m_state != State::Closed)
+            connection.abort(ECONNRESET, true);
+    }
+    wait_queue().wake_all();
+}
+
+void TCPSocket::receive_syn_ack(const TCPPacket& tcp_packet)
+{
+    int peer_mss = default_mss;
+    int peer_window_scale = -1;
+    parse_syn_options(tcp_packet, peer_mss, peer_window_scale);
+    m_mss = max(64, min(peer_mss, route_mss()));
+    // Windows are only scaled if both ends want to.
+    if (peer_window_scale >= 0) {
+        m_send_window_scale = peer_window_scale;
+        m_receive_window_scale = receive_window_scale;
+    }
+
+    m_receive_next = tcp_packet.sequence_number() + 1;
+    m_send_unacknowledged = tcp_packet.ack_number();
+    m_send_next = m_send_unacknowledged;
+    m_send_max = m_send_unacknowledged;
+    m_send_window = tcp_packet.window_size();
+    m_window_update_sequence = tcp_packet.sequence_number();
+    m_window_update_ack = tcp_packet.ack_number();
+    // RFC 6928's initial window.
+    m_congestion_window = 10 * m_mss;
+
+    if (m_timing_segment) {
+        m_timing_segment = false;
+        update_round_trip_time(system.uptime - m_timed_segment_sent_at);
+    }
+    m_retransmissions = 0;
+    m_retransmit_deadline = 0;
+
+    m_state = State::Established;
+    set_connected(true);
+    send_ack();
+}
+
+// Returns false if the segment should be dropped.
+bool TCPSocket::receive_ack(const TCPPacket& tcp_packet, int payload_size)
+{
+    dword sequence = tcp_packet.sequence_number();
+    dword ack = tcp_packet.ack_number();
+    if (sequence_before(m_send_max, ack)) {
+        // That's something we never sent.
+        send_ack();
+        return false;
+    }
+
+    bool window_changed = false;
+    bool is_newer = sequence_before(m_window_update_sequence, sequence) || (m_window_update_sequence == sequence && !sequence_before(ack, m_window_update_ack));
+    if (is_newer && !sequence_before(ack, m_send_unacknowledged)) {
+        dword window = (dword)tcp_packet.window_size() << m_send_window_scale;
+        window_changed = window != m_send_window;
+        m_send_window = window;
+        m_window_update_sequence = sequence;
+        m_window_update_ack = ack;
+    }
+
+    if (!sequence_before(m_send_unacknowledged, ack)) {
+        if (ack == m_send_unacknowledged && !payload_size && !tcp_packet.has_fin() && !window_changed && bytes_in_flight())
+            receive_duplicate_ack();
+        return true;
+    }
+
+    dword acknowledged = ack - m_send_unacknowledged;
+    dword data_end = m_send_unacknowledged + m_send_buffer.used_bytes();
+    bool fin_acknowledged = m_fin_queued && sequence_before(data_end, ack);
+    m_send_buffer.discard(acknowledged - fin_acknowledged);
+    m_send_unacknowledged = ack;
+    if (sequence_before(m_send_next, ack))
+        m_send_next = ack;
+    m_retransmissions = 0;
+
+    if (m_timing_segment && sequence_before(m_timed_sequence, ack)) {
+        m_timing_segment = false;
+        update_round_trip_time(system.uptime - m_timed_segment_sent_at);
+    }
+
+    if (m_in_fast_recovery) {
+        if (!sequence_before(ack, m_recover)) {
+            // Everything that was in flight when the loss was noticed has arrived.
+            m_congestion_window = min(m_slow_start_threshold, max((dword)bytes_in_flight(), (dword)m_mss) + m_mss);
+            m_in_fast_recovery = false;
+            m_duplicate_acks = 0;
+        } else {
+            // Only some of it has, so the next hole starts right here (RFC 6582).
+            retransmit_first_segment();
+            m_congestion_window -= min(m_congestion_window, acknowledged);
+            if (acknowledged >= (dword)m_mss)
+                m_congestion_window += m_mss;
+            m_congestion_window = max(m_congestion_window, (dword)m_mss);
+        }
+    } else {
+        m_duplicate_acks = 0;
+        open_congestion_window(acknowledged);
+    }
+
+    m_retransmit_deadline = 0;
+    if (bytes_in_flight())
+        arm_timer(m_retransmit_deadline, m_retransmission_timeout);
+    m_send_buffer_alarm.wait_queue().wake_all();
+
+    if (fin_acknowledged)
+        did_acknowledge_fin();
+    return true;
+}
+
+void TCPSocket::receive_duplicate_ack()
+{
+    if (m_in_fast_recovery) {
+        // Another segment has left the network.
+        m_congestion_window += m_mss;
+        return;
+    }
+    if (++m_duplicate_acks < 3)
+        return;
+    // Three in a row mean the segment after what's acknowledged was lost, but the ones after that weren't.
+    m_slow_start_threshold = max((dword)bytes_in_flight() / 2, (dword)2 * m_mss);
+    m_recover = m_send_max;
+    m_in_fast_recovery = true;
+    retransmit_first_segment();
+    m_congestion_window = m_slow_start_threshold + 3 * m_mss;
+}
+
+void TCPSocket::open_congestion_window(dword acknowledged)
+{
+    if (m_congestion_window < m_slow_start_threshold)
+        m_congestion_window += min(acknowledged, (dword)m_mss);
+    else
+        m_congestion_window += max((dword)1, (dword)m_mss * m_mss / m_congestion_window);
+    // There's no use in a window bigger than what there is to send.
+    m_congestion_window = min(m_congestion_window, (dword)buffer_size);
+}
+
+void TCPSocket::receive_data(const TCPPacket& tcp_packet, PacketBuffer& packet, int payload_offset, int payload_size)
+{
+    // Everything after the FIN has to be something we've had before.
+    if (m_received_fin) {
+        if (m_state == State::TimeWait)
+            enter_time_wait();
+        send_ack();
+        return;
+    }
+
+    dword sequence = tcp_packet.sequence_number();
+    const byte* payload = packet.data() + payload_offset;
+    bool has_fin = tcp_packet.has_fin();
+    if (sequence_before(sequence, m_receive_next)) {
+        dword already_have = m_receive_next - sequence;
+        if (already_have >= (dword)payload_size && !has_fin) {
+            send_ack();
+            return;
+        }
+        already_have = min(already_have, (dword)payload_size);
+        payload += already_have;
+        payload_size -= already_have;
+        sequence = m_receive_next;
+    }
+
+    if (sequence == m_receive_next) {
+        bool filled_gap = !m_out_of_order_segments.is_empty();
+        deliver(payload, payload_size, has_fin);
+        while (!m_out_of_order_segments.is_empty() && !m_received_fin) {
+            auto& segment = m_out_of_order_segments[0];
+            if (sequence_before(m_receive_next, segment.sequence))
+                break;
+            dword already_have = m_receive_next - segment.sequence;
+            if (already_have < (dword)segment.payload_size || (already_have == (dword)segment.payload_size && segment.has_fin))
+                deliver(segment.packet->data() + segment.payload_offset + already_have, segment.payload_size - already_have, segment.has_fin);
+            m_out_of_order_segments.remove(0);
+        }
+        // The peer wants to hear right away when a gap is filled, or that we're done.
+        if (filled_gap || m_received_fin || ++m_segments_since_ack >= 2)
+            send_ack();
+        else if (!m_delayed_ack_deadline)
+            arm_timer(m_delayed_ack_deadline, delayed_ack_timeout);
+        return;
+    }
+
+    // It's ahead of what's missing. Keep it for when the gap is filled, if it's in the window.
+    if (sequence_before(sequence, m_receive_next + m_advertised_window) && m_out_of_order_segments.size() < max_out_of_order_segments) {
+        int index = 0;
+        while (index < m_out_of_order_segments.size() && sequence_before(m_out_of_order_segments[index].sequence, sequence))
+            ++index;
+        if (index == m_out_of_order_segments.size() || m_out_of_order_segments[index].sequence != sequence) {
+            OutOfOrderSegment segment;
+            segment.packet = packet;
+            segment.sequence = sequence;
+            segment.payload_offset = payload - packet.data();
+            segment.payload_size = payload_size;
+            segment.has_fin = has_fin;
+            m_out_of_order_segments.insert(index, move(segment));
+        }
+    }
+    // A duplicate ACK tells the peer what's missing.
+    send_ack();
+}
+
+void TCPSocket::deliver(const byte* data, int size, bool has_fin)
+{
+    if (size) {
+        ssize_t nwritten = m_receive_buffer.write(data, size);
+        if (nwritten < 0)
+            nwritten = 0;
+        m_receive_next += nwritten;
+        // The rest goes unacknowledged, so the peer sends it again.
+        if (nwritten < size)
+            return;
+    }
+    if (has_fin)
+        receive_fin();
+}
+
+void TCPSocket::receive_fin()
+{
+    ++m_receive_next;
+    m_received_fin = true;
+    switch (m_state) {
+    case State::Established:
+        m_state = State::CloseWait;
+        break;
+    case State::FinWait1:
+        m_state = State::Closing;
+        break;
+    case State::FinWait2:
+        enter_time_wait();
+        break;
+    default:
+        break;
+    }
+    // Readers get to see the end of the stream.
+    wait_queue().wake_all();
+}
+
+void TCPSocket::did_acknowledge_fin()
+{
+    switch (m_state) {
+    case State::FinWait1:
+        m_state = State::FinWait2;
+        // Don't wait forever for a peer that never closes its end.
+        if (!attached_fds())
+            arm_timer(m_time_wait_deadline, time_wait_timeout);
+        break;
+    case State::Closing:
+        enter_time_wait();
+        break;
+    case State::LastAck:
+        did_close();
+        break;
+    default:
+        break;
+    }
+}
+
+void TCPSocket::update_round_trip_time(dword sample)
+{
+    // RFC 6298.
+    if (!m_has_round_trip_time) {
+        m_smoothed_round_trip_time = sample;
+        m_round_trip_time_variation = sample / 2;
+        m_has_round_trip_time = true;
+    } else {
+        dword difference = m_smoothed_round_trip_time > sample ? m_smoothed_round_trip_time - sample : sample - m_smoothed_round_trip_time;
+        m_round_trip_time_variation = (3 * m_round_trip_time_variation + difference) / 4;
+        m_smoothed_round_trip_time = (7 * m_smoothed_round_trip_time + sample) / 8;
+    }
+    dword timeout = m_smoothed_round_trip_time + max(timer_granularity, 4 * m_round_trip_time_variation);
+    m_retransmission_timeout = min(max(timeout, min_retransmission_timeout), max_retransmission_timeout);
+}
+
+void TCPSocket::arm_timer(dword& deadline, dword ticks)
+{
+    deadline = system.uptime + ticks;
+    // 0 means it's not armed.
+    if (!deadline)
+        deadline = 1;
+    s_timers_armed = true;
+    timer_alarm().wait_queue().wake_all();
+}
+
+void TCPSocket::run_timers()
+{
+    dword now = system.uptime;
+    if (m_time_wait_deadline && !sequence_before(now, m_time_wait_deadline)) {
+        m_time_wait_deadline = 0;
+        did_close();
+        return;
+    }
+    if (m_delayed_ack_deadline && !sequence_before(now, m_delayed_ack_deadline))
+        send_ack();
+    if (m_retransmit_deadline && !sequence_before(now, m_retransmit_deadline)) {
+        m_retransmit_deadline = 0;
+        retransmission_timed_out();
+    }
+}
+
+void TCPSocket::retransmission_timed_out()
+{
+    m_retransmission_timeout = min(m_retransmission_timeout * 2, max_retransmission_timeout);
+    m_timing_segment = false;
+
+    if (m_state == State::SynSent) {
+        if (++m_retransmissions > max_syn_retransmissions) {
+            abort(ETIMEDOUT, false);
+            return;
+        }
+        send_segment(m_initial_sequence, TCPFlags::SYN);
+        arm_timer(m_retransmit_deadline, m_retransmission_timeout);
+        return;
+    }
+
+    if (m_state == State::SynReceived) {
+        if (++m_retransmissions > max_syn_retransmissions) {
+            abort(ETIMEDOUT, false);
+            return;
+        }
+        send_segment(m_initial_sequence, TCPFlags::SYN | TCPFlags::ACK);
+        arm_timer(m_retransmit_deadline, m_retransmission_timeout);
+        return;
+    }
+
+    if (!bytes_in_flight()) {
+        // The peer's window is shut. A byte past it gets us an ACK saying whether it's open again.
+        if (!m_send_window && m_send_buffer.used_bytes()) {
+            send_segment(m_send_next, TCPFlags::ACK, m_send_next - m_send_unacknowledged, 1);
+            ++m_send_next;
+            if (sequence_before(m_send_max, m_send_next))
+                m_send_max = m_send_next;
+            arm_timer(m_retransmit_deadline, m_retransmission_timeout);
+        }
+        return;
+    }
+
+    // A peer that keeps answering probes of its shut window hasn't gone anywhere.
+    if (m_send_window && ++m_retransmissions > max_retransmissions) {
+        abort(ETIMEDOUT, true);
+        return;
+    }
+
+    // Whatever was in flight is taken to be lost, and sending starts over from one segment (RFC 5681).
+    m_slow_start_threshold = max((dword)bytes_in_flight() / 2, (dword)2 * m_mss);
+    m_congestion_window = m_mss;
+    m_in_fast_recovery = false;
+    m_duplicate_acks = 0;
+    m_send_next = m_send_unacknowledged;
+    m_fin_sent = false;
+    send_pending_segments();
+}
+
+void TCPSocket::close()
+{
+    switch (m_state) {
+    case State::SynSent:
+        did_close();
+        return;
+    case State::Established:
+        m_state = State::FinWait1;
+        break;
+    case State::CloseWait:
+        m_state = State::LastAck;
+        break;
+    default:
+        return;
+    }
+    // Whatever's still in the send buffer goes first.
+    m_fin_queued = true;
+    m_keep_alive = this;
+    m_send_buffer_alarm.wait_queue().wake_all();
+    send_pending_segments();
+}
+
+void TCPSocket::enter_time_wait()
+{
+    m_state = State::TimeWait;
+    m_retransmit_deadline = 0;
+    arm_timer(m_time_wait_deadline, time_wait_timeout);
+}
+
+void TCPSocket::abort(int error, bool send_reset)
+{
+    if (send_reset)
+        send_segment(m_send_next, TCPFlags::RST | TCPFlags::ACK);
+    m_error = error;
+    did_close();
+}
+
+void TCPSocket::did_close()
+{
+    m_state = State::Closed;
+    m_retransmit_deadline = 0;
+    m_delayed_ack_deadline = 0;
+    m_time_wait_deadline = 0;
+    m_out_of_order_segments.clear();
+    set_connected(false);
+    m_send_buffer_alarm.wait_queue().wake_all();
+    // A connection that never made it to the accept queue leaves the SYN queue.
+    if (auto* listener = m_listener) {
+        m_listener = nullptr;
+        listener->forget_connection(*this);
+    }
+    // Whoever got us here still has us retained.
+    m_keep_alive = nullptr;
+}
+
+void TCPSocket::timer_task_main()
+{
+    for (;;) {
+        if (!s_timers_armed) {
+            current->snooze_until(timer_alarm());
+            continue;
+        }
+        current->sleep(timer_granularity);
+        // Any socket with a timer left, or one armed meanwhile, keeps us going.
+        s_timers_armed = false;
+        auto sockets = table().all();
+        for (auto& socket : sockets) {
+            LOCKER(socket->lock());
+            socket->run_timers();
+            if (socket->has_armed_timers())
+                s_timers_armed = true;
+        }
+    }
+}
+
+NetworkOrdered<word> TCPSocket::compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket& packet, word payload_size)
+{
+    word segment_size = packet.header_size() + payload_size;
+    InternetChecksum checksum;
+    checksum.add_pseudo_header(source, destination, IPv4Protocol::TCP, segment_size);
+    checksum.add(&packet, segment_size);
+    return checksum.finish();
+}
+
+KResult TCPSocket::protocol_connect(ShouldBlock should_block)
+{
+    auto route = route_to(destination_address());
+    if (!route.is_valid())
+        return KResult(-ENETUNREACH);
+
+    int rc = allocate_source_port_if_needed();
+    if (rc < 0)
+        return KResult(rc);
+
+    {
+        LOCKER(lock());
+        if (m_state != State::Closed)
+            return KResult(-EISCONN);
+        m_error = 0;
+        m_route = route;
+        m_initial_sequence = RandomDevice::random_value();
+        m_send_unacknowledged = m_initial_sequence;
+        m_send_next = m_initial_sequence + 1;
+        m_send_max = m_send_next;
+        m_retransmission_timeout = initial_retransmission_timeout;
+        m_retransmissions = 0;
+        m_timing_segment = true;
+        m_timed_sequence = m_initial_sequence;
+        m_timed_segment_sent_at = system.uptime;
+        m_state = State::SynSent;
+        table().add_connection(tuple(), *this);
+        send_segment(m_initial_sequence, TCPFlags::SYN);
+        arm_timer(m_retransmit_deadline, m_retransmission_timeout);
+    }
+
+    if (should_block == ShouldBlock::No)
+        return KResult(-EINPROGRESS);
 
     current->set_blocked_socket(this);
     current->block(Thread::BlockedConnect);
 
-    ASSERT(is_connected());
+    if (!is_connected())
+        return KResult(m_error ? -m_error : -ECONNREFUSED);
+    return KSuccess;
+}
+
+KResult TCPSocket::protocol_bind(word port)
+{
+    if (!table().claim_port(port, *this))
+        return KResult(-EADDRINUSE);
     return KSuccess;
 }
 
 int TCPSocket::protocol_allocate_source_port()
 {
-    static const word first_ephemeral_port = 32768;
-    static const word last_ephemeral_port = 60999;
-    static const word ephemeral_port_range_size = last_ephemeral_port - first_ephemeral_port;
-    word first_scan_port = first_ephemeral_port + (word)(RandomDevice::random_percentage() * ephemeral_port_range_size);
-
-    LOCKER(sockets_by_port().lock());
-    for (word port = first_scan_port;;) {
-        auto it = sockets_by_port().resource().find(port);
-        if (it == sockets_by_port().resource().end()) {
-            set_source_port(port);
-            sockets_by_port().resource().set(port, this);
-            return port;
-        }
-        ++port;
-        if (port > last_ephemeral_port)
-            port = first_ephemeral_port;
-        if (port == first_scan_port)
-            break;
-    }
-    return -EADDRINUSE;
+    return table().claim_ephemeral_port(*this);
 }
 
 bool TCPSocket::protocol_is_disconnected() const
 {
-    return m_state == State::Disconnecting || m_state == State::Disconnected;
+    return m_state == State::Closed || m_received_fin;
 }
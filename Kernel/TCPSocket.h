@@ -1,46 +1,184 @@
 #pragma once
 
 #include <Kernel/IPv4Socket.h>
-
+#include <Kernel/Alarm.h>
+#include <Kernel/RingBuffer.h>
+#include <Kernel/TCP.h>
+
+// A TCP connection, either end of it.
+// A listening socket makes one of these for every SYN it gets, up to its backlog. They answer with a SYN-ACK
+// and wait for the ACK of it in the SYN queue, then move on to the queue accept() takes them from.
+// Segments go to the connection they're on, or to whoever has the port if there's none.
+// Outgoing data goes into the send buffer, and stays there until it's acknowledged. It's sent in segments of
+// up to the peer's MSS, as far as both the peer's window and the congestion window let it (NewReno).
+// Lost segments are sent again after a retransmission timeout estimated from the round-trip time, or right away
+// after three duplicate ACKs. Incoming data goes into the receive buffer, and segments that arrive ahead of
+// what's missing wait in order until the gap is filled. ACKs for in-order data are delayed, up to one per two segments.
+// Everything but send() and recv() runs on the network task and the TCP timer task, with the socket locked.
 class TCPSocket final : public IPv4Socket {
 public:
     static Retained<TCPSocket> create(int protocol);
     virtual ~TCPSocket() override;
 
     enum class State {
-        Disconnected,
-        Connecting,
-        Connected,
-        Disconnecting,
+        Closed,
+        Listen,
+        SynSent,
+        SynReceived,
+        Established,
+        FinWait1,
+        FinWait2,
+        CloseWait,
+        Closing,
+        LastAck,
+        TimeWait,
     };
 
     State state() const { return m_state; }
-    void set_state(State state) { m_state = state; }
 
-    void set_ack_number(dword n) { m_ack_number = n; }
-    void set_sequence_number(dword n) { m_sequence_number = n; }
-    dword ack_number() const { return m_ack_number; }
-    dword sequence_number() const { return m_sequence_number; }
+    // |packet| starts with the IPv4 header, and the segment in it has been checked to be whole.
+    void receive_segment(const IPv4Packet&, const TCPPacket&, PacketBuffer& packet);
+
+    static IPv4SocketTable<TCPSocket>& table();
+    // The connection with the local end first, as a segment that's for it has them the other way around.
+    static TCPSocketHandle from_tuple(const IPv4SocketTuple&);
+
+    // Covers the header, options and all. Comes out as 0 for a segment that has the right checksum in it.
+    static NetworkOrdered<word> compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket&, word payload_size);
 
-    void send_tcp_packet(word flags, const void* = nullptr, int = 0);
+    // Runs the timers of every TCP socket.
+    static void timer_task_main();
 
-    static Lockable<HashMap<word, TCPSocket*>>& sockets_by_port();
-    static TCPSocketHandle from_port(word);
+    virtual KResult listen(int backlog) override;
+    virtual bool can_read(SocketRole) const override;
+    virtual bool can_write(SocketRole) const override;
+    virtual void detach_fd(SocketRole) override;
+    virtual ssize_t recvfrom(void*, size_t, int flags, sockaddr*, socklen_t*) override;
+    virtual bool has_failed_to_connect() const override { return m_state == State::Closed && m_error; }
+    virtual int pending_error() const override { return m_error; }
 
 private:
     explicit TCPSocket(int protocol);
 
-    NetworkOrdered<word> compute_tcp_checksum(const IPv4Address& source, const IPv4Address& destination, const TCPPacket&, word payload_size);
+    // Rings for senders waiting on a full send buffer, once there's room, or once there's no point anymore.
+    class SendBufferAlarm final : public Alarm {
+    public:
+        explicit SendBufferAlarm(TCPSocket& socket) : m_socket(socket) { }
+        virtual bool is_ringing() const override { return m_socket.m_send_buffer.space_for_writing() || !m_socket.can_send_data(); }
+    private:
+        TCPSocket& m_socket;
+    };
+
+    struct OutOfOrderSegment {
+        RetainPtr<PacketBuffer> packet;
+        dword sequence { 0 };
+        int payload_offset { 0 };
+        int payload_size { 0 };
+        bool has_fin { false };
+    };
 
-    virtual int protocol_receive(const ByteBuffer&, void* buffer, size_t buffer_size, int flags, sockaddr* addr, socklen_t* addr_length) override;
-    virtual int protocol_send(const void*, int) override;
-    virtual KResult protocol_connect() override;
+    virtual int protocol_send(const void*, int, int flags) override;
+    virtual KResult protocol_connect(ShouldBlock) override;
+    virtual KResult protocol_bind(word) override;
     virtual int protocol_allocate_source_port() override;
     virtual bool protocol_is_disconnected() const override;
 
-    dword m_sequence_number { 0 };
-    dword m_ack_number { 0 };
-    State m_state { State::Disconnected };
+    bool can_send_data() const { return (m_state == State::Established || m_state == State::CloseWait) && !m_fin_queued; }
+    size_t bytes_in_flight() const { return m_send_next - m_send_unacknowledged; }
+    word advertised_window() const;
+    // What we can take in one segment, by the MTU of the way back to the peer.
+    int route_mss() const { return m_route.mtu - sizeof(IPv4Packet) - sizeof(TCPPacket); }
+
+    void send_segment(dword sequence, word flags, int data_offset = 0, int data_size = 0);
+    void send_ack();
+    void send_pending_segments();
+    void retransmit_first_segment();
+    void send_window_update_if_worthwhile();
+
+    void receive_syn(const IPv4Packet&, const TCPPacket&);
+    void receive_syn_ack(const TCPPacket&);
+    void receive_ack_of_syn_ack(const TCPPacket&);
+    bool did_establish_connection(TCPSocket&);
+    void forget_connection(TCPSocket&);
+    void stop_listening();
+    bool receive_ack(const TCPPacket&, int payload_size);
+    void receive_duplicate_ack();
+    void receive_data(const TCPPacket&, PacketBuffer&, int payload_offset, int payload_size);
+    void deliver(const byte*, int size, bool has_fin);
+    void receive_fin();
+    void did_acknowledge_fin();
+
+    void update_round_trip_time(dword sample);
+    void open_congestion_window(dword acknowledged);
+    void arm_timer(dword& deadline, dword ticks);
+    bool has_armed_timers() const { return m_retransmit_deadline || m_delayed_ack_deadline || m_time_wait_deadline; }
+    void run_timers();
+    void retransmission_timed_out();
+
+    void close();
+    void enter_time_wait();
+    void abort(int error, bool send_reset);
+    void did_close();
+
+    State m_state { State::Closed };
+    // What the connection died of, for the calls that come after.
+    int m_error { 0 };
+    int m_mss { 536 };
+    // How to get to the peer, decided when the connection is first made.
+    RoutingDecision m_route;
+
+    // Holds everything from m_send_unacknowledged on, except SYN and FIN.
+    RingBuffer m_send_buffer;
+    RingBuffer m_receive_buffer;
+    Vector<OutOfOrderSegment> m_out_of_order_segments;
+    SendBufferAlarm m_send_buffer_alarm { *this };
+
+    dword m_initial_sequence { 0 };
+    dword m_send_unacknowledged { 0 };
+    dword m_send_next { 0 };
+    // After a timeout m_send_next goes back to m_send_unacknowledged, but what was sent before can still be acknowledged.
+    dword m_send_max { 0 };
+    dword m_send_window { 0 };
+    dword m_window_update_sequence { 0 };
+    dword m_window_update_ack { 0 };
+    byte m_send_window_scale { 0 };
+    byte m_receive_window_scale { 0 };
+    bool m_fin_queued { false };
+    bool m_fin_sent { false };
+
+    dword m_receive_next { 0 };
+    bool m_received_fin { false };
+    dword m_advertised_window { 0 };
+    int m_segments_since_ack { 0 };
+
+    dword m_congestion_window { 0 };
+    dword m_slow_start_threshold { 0xffffffff };
+    int m_duplicate_acks { 0 };
+    bool m_in_fast_recovery { false };
+    dword m_recover { 0 };
+
+    // In ticks. Only segments sent once are timed, since the ACK for a resent one could be for either.
+    bool m_has_round_trip_time { false };
+    dword m_smoothed_round_trip_time { 0 };
+    dword m_round_trip_time_variation { 0 };
+    dword m_retransmission_timeout { 0 };
+    bool m_timing_segment { false };
+    dword m_timed_sequence { 0 };
+    dword m_timed_segment_sent_at { 0 };
+    int m_retransmissions { 0 };
+
+    // In uptime ticks, 0 while not armed.
+    dword m_retransmit_deadline { 0 };
+    dword m_delayed_ack_deadline { 0 };
+    dword m_time_wait_deadline { 0 };
+
+    // Once there are no file descriptors left, the socket keeps itself around until the connection is closed.
+    RetainPtr<TCPSocket> m_keep_alive;
+
+    // For a listener, the connections still waiting for the ACK of their SYN-ACK.
+    Vector<RetainPtr<TCPSocket>> m_syn_queue;
+    // For one of those, the listener that holds on to it.
+    TCPSocket* m_listener { nullptr };
 };
 
 class TCPSocketHandle : public SocketHandle {
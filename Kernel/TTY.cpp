@@ -9,6 +9,7 @@
 TTY::TTY(unsigned major, unsigned minor)
     : CharacterDevice(major, minor)
 {
+    m_buffer.set_wait_queue(wait_queue());
     set_default_termios();
 }
 
@@ -38,8 +39,9 @@ ssize_t TTY::write(Process&, const byte* buffer, ssize_t size)
     }
     dbgprintf("\n");
 #endif
-    on_tty_write(buffer, size);
-    return size;
+    // Implementations may take less than all of it, like a PTY whose master isn't keeping up.
+    // The rest gets written once there's room again.
+    return on_tty_write(buffer, size);
 }
 
 bool TTY::can_read(Process&) const
@@ -66,9 +68,30 @@ void TTY::emit(byte ch)
             return;
         }
     }
+    // Like a real terminal, input that nobody reads gets dropped once the buffer is full.
     m_buffer.write(&ch, 1);
 }
 
+void TTY::emit(const byte* data, ssize_t size)
+{
+    if (!should_generate_signals()) {
+        m_buffer.write(data, size);
+        return;
+    }
+    // Everything between the characters that raise signals goes in with a single write.
+    byte intr = m_termios.c_cc[VINTR];
+    byte quit = m_termios.c_cc[VQUIT];
+    ssize_t span_start = 0;
+    for (ssize_t i = 0; i < size; ++i) {
+        if (data[i] != intr && data[i] != quit)
+            continue;
+        m_buffer.write(data + span_start, i - span_start);
+        emit(data[i]);
+        span_start = i + 1;
+    }
+    m_buffer.write(data + span_start, size - span_start);
+}
+
 void TTY::generate_signal(int signal)
 {
     if (!pgid())
@@ -180,4 +203,5 @@ void TTY::set_size(unsigned short columns, unsigned short rows)
 void TTY::hang_up()
 {
     generate_signal(SIGHUP);
+    wait_queue().wake_all();
 }
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "DoubleBuffer.h"
+#include "RingBuffer.h"
 #include <Kernel/CharacterDevice.h>
 #include <Kernel/UnixTypes.h>
 
@@ -38,6 +38,8 @@ protected:
 
     TTY(unsigned major, unsigned minor);
     void emit(byte);
+    // Feeds a whole span of input through at once, so readers are woken once for all of it.
+    void emit(const byte*, ssize_t);
 
     void generate_signal(int signal);
 
@@ -45,7 +47,7 @@ private:
     // ^CharacterDevice
     virtual bool is_tty() const final override { return true; }
 
-    DoubleBuffer m_buffer;
+    RingBuffer m_buffer { 16 * KB };
     pid_t m_pgid { 0 };
     termios m_termios;
     unsigned short m_rows { 0 };
@@ -3,19 +3,67 @@
 #include <Kernel/system.h>
 #include <Kernel/Process.h>
 #include <Kernel/MemoryManager.h>
+#include <Kernel/Alarm.h>
+#include <Kernel/FileDescriptor.h>
+#include <Kernel/Socket.h>
+#include <Kernel/WaitQueue.h>
 #include <LibC/signal_numbers.h>
 
-InlineLinkedList<Thread>* g_threads;
-static const dword default_kernel_stack_size = 16384;
+InlineLinkedList<Thread>* Thread::s_queues[(int)Thread::Queue::__Count];
 static const dword default_userspace_stack_size = 65536;
 
+// Every fork and spawn makes a thread, so freed ones (and their FPU state) are kept for the next one,
+// instead of going through the kmalloc() heap each time.
+static const int max_recycled_threads = 32;
+static void* s_recycled_threads[max_recycled_threads];
+static int s_recycled_thread_count;
+static FPUState* s_recycled_fpu_states[max_recycled_threads];
+static int s_recycled_fpu_state_count;
+
+void* Thread::operator new(size_t size)
+{
+    ASSERT(size == sizeof(Thread));
+    InterruptDisabler disabler;
+    if (s_recycled_thread_count)
+        return s_recycled_threads[--s_recycled_thread_count];
+    return kmalloc(size);
+}
+
+void Thread::operator delete(void* ptr)
+{
+    InterruptDisabler disabler;
+    if (s_recycled_thread_count < max_recycled_threads) {
+        s_recycled_threads[s_recycled_thread_count++] = ptr;
+        return;
+    }
+    kfree(ptr);
+}
+
+static FPUState* allocate_fpu_state()
+{
+    InterruptDisabler disabler;
+    if (s_recycled_fpu_state_count)
+        return s_recycled_fpu_states[--s_recycled_fpu_state_count];
+    return (FPUState*)kmalloc_aligned(sizeof(FPUState), 16);
+}
+
+static void deallocate_fpu_state(FPUState* fpu_state)
+{
+    InterruptDisabler disabler;
+    if (s_recycled_fpu_state_count < max_recycled_threads) {
+        s_recycled_fpu_states[s_recycled_fpu_state_count++] = fpu_state;
+        return;
+    }
+    kfree_aligned(fpu_state);
+}
+
 Thread::Thread(Process& process)
     : m_process(process)
     , m_tid(process.m_next_tid++)
 {
     dbgprintf("Thread: New thread TID=%u in %s(%u)\n", m_tid, process.name().characters(), process.pid());
     set_default_signal_dispositions();
-    m_fpu_state = (FPUState*)kmalloc_aligned(sizeof(FPUState), 16);
+    m_fpu_state = allocate_fpu_state();
     memset(&m_tss, 0, sizeof(m_tss));
 
     // Only IF is set when a process boots.
@@ -41,16 +89,12 @@ Thread::Thread(Process& process)
 
     m_tss.cr3 = m_process.page_directory().cr3();
 
+    // Ring0 threads run on this stack, ring3 ones need it to enter the kernel.
+    m_kernel_stack = MM.allocate_kernel_stack();
+    m_stack_top0 = ((dword)m_kernel_stack + kernel_stack_size) & 0xfffffff8;
     if (m_process.is_ring0()) {
-        // FIXME: This memory is leaked.
-        // But uh, there's also no kernel process termination, so I guess it's not technically leaked...
-        dword stack_bottom = (dword)kmalloc_eternal(default_kernel_stack_size);
-        m_stack_top0 = (stack_bottom + default_kernel_stack_size) & 0xffffff8;
         m_tss.esp = m_stack_top0;
     } else {
-        // Ring3 processes need a separate stack for Ring0.
-        m_kernel_stack = kmalloc(default_kernel_stack_size);
-        m_stack_top0 = ((dword)m_kernel_stack + default_kernel_stack_size) & 0xffffff8;
         m_tss.ss0 = 0x10;
         m_tss.esp0 = m_stack_top0;
     }
@@ -59,19 +103,25 @@ Thread::Thread(Process& process)
     m_tss.ss2 = m_process.pid();
     m_far_ptr.offset = 0x98765432;
 
+    // NOTE: The colonel isn't on any queue, the scheduler falls back to it when nobody else wants to run.
     if (m_process.pid() != 0) {
         InterruptDisabler disabler;
-        g_threads->prepend(this);
+        m_queue = &queue(queue_for_state(m_state));
+        m_queue->prepend(this);
     }
 }
 
 Thread::~Thread()
 {
     dbgprintf("~Thread{%p}\n", this);
-    kfree_aligned(m_fpu_state);
+    deallocate_fpu_state(m_fpu_state);
     {
         InterruptDisabler disabler;
-        g_threads->remove(this);
+        if (m_queue)
+            m_queue->remove(this);
+        detach_from_wait_queues();
+        if (m_blocked_lock)
+            m_blocked_lock->remove_waiter(*this);
     }
 
     if (g_last_fpu_thread == this)
@@ -79,28 +129,200 @@ Thread::~Thread()
 
     if (selector())
         gdt_free_entry(selector());
+    clear_thread_pointer();
 
     if (m_kernel_stack) {
-        kfree(m_kernel_stack);
+        MM.deallocate_kernel_stack(m_kernel_stack);
         m_kernel_stack = nullptr;
     }
 
     if (m_kernel_stack_for_signal_handler) {
-        kfree(m_kernel_stack_for_signal_handler);
+        MM.deallocate_kernel_stack(m_kernel_stack_for_signal_handler);
         m_kernel_stack_for_signal_handler = nullptr;
     }
 }
 
+static bool is_blocked_on_io(Thread::State state)
+{
+    switch (state) {
+    case Thread::BlockedRead:
+    case Thread::BlockedWrite:
+    case Thread::BlockedSelect:
+    case Thread::BlockedConnect:
+    case Thread::BlockedReceive:
+    case Thread::BlockedSnoozing:
+    case Thread::BlockedFutex:
+        return true;
+    default:
+        return false;
+    }
+}
+
 void Thread::unblock()
 {
+    // Threads waking up from waiting on input or IPC get to respond ahead of the CPU hogs.
+    if (is_blocked_on_io(m_state)) {
+        m_priority_boost = 1;
+        ++m_times_boosted;
+    }
     if (current == this) {
         system.nblocked--;
-        m_state = Thread::Running;
+        set_state(Thread::Running);
         return;
     }
     ASSERT(m_state != Thread::Runnable && m_state != Thread::Running);
     system.nblocked--;
-    m_state = Thread::Runnable;
+    set_state(Thread::Runnable);
+}
+
+int Thread::effective_priority() const
+{
+    int priority = m_process.priority() + m_priority_boost;
+    return max((int)Process::LowPriority, min(priority, (int)Process::HighPriority));
+}
+
+void Thread::did_use_whole_time_slice()
+{
+    InterruptDisabler disabler;
+    ++m_times_preempted;
+    if (m_priority_boost > -1) {
+        --m_priority_boost;
+        priority_did_change();
+    }
+}
+
+auto Thread::queue_for_state(State state) const -> Queue
+{
+    switch (state) {
+    case Runnable:
+    case Running:
+        switch (effective_priority()) {
+        case Process::LowPriority:
+            return Queue::RunnableLow;
+        case Process::NormalPriority:
+            return Queue::RunnableNormal;
+        case Process::HighPriority:
+            return Queue::RunnableHigh;
+        }
+        ASSERT_NOT_REACHED();
+    case Skip1SchedulerPass:
+    case Skip0SchedulerPasses:
+    case Dying:
+        return Queue::Polled;
+    case BlockedSleep:
+        return Queue::Sleeping;
+    case BlockedWait:
+        return Queue::Waiting;
+    case BlockedRead:
+    case BlockedWrite:
+    case BlockedSelect:
+    case BlockedConnect:
+    case BlockedReceive:
+    case BlockedSnoozing:
+    case BlockedFutex:
+        return m_has_pending_wakeup ? Queue::WokenOnIO : Queue::BlockedOnIO;
+    case Invalid:
+    case Dead:
+    case Stopped:
+    case BlockedLurking:
+    case BlockedSignal:
+    case BlockedLock:
+        return Queue::Inactive;
+    }
+    ASSERT_NOT_REACHED();
+}
+
+void Thread::set_state(State new_state)
+{
+    InterruptDisabler disabler;
+    m_state = new_state;
+    if (new_state == BlockedSleep)
+        Scheduler::note_wakeup_time(m_wakeup_time);
+    if (!is_blocked_on_io(new_state)) {
+        detach_from_wait_queues();
+        m_has_pending_wakeup = false;
+    }
+    // Someone else (e.g Process::die()) moved us along while we were waiting for a lock.
+    if (m_blocked_lock && new_state != BlockedLock)
+        m_blocked_lock->remove_waiter(*this);
+    if (!m_queue)
+        return;
+    auto& new_queue = queue(queue_for_state(new_state));
+    if (m_queue == &new_queue)
+        return;
+    m_queue->remove(this);
+    new_queue.append(this);
+    m_queue = &new_queue;
+}
+
+void Thread::priority_did_change()
+{
+    set_state(m_state);
+}
+
+void Thread::wake_from_wait_queue()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (m_has_pending_wakeup)
+        return;
+    m_has_pending_wakeup = true;
+    set_state(m_state);
+}
+
+void Thread::attach_to_wait_queues()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    auto attach = [this] (WaitQueue* wait_queue) {
+        if (!wait_queue)
+            return;
+        wait_queue->add(*this);
+        m_wait_queues.append(wait_queue);
+    };
+    auto attach_to_fd = [&] (int fd) {
+        if (auto* descriptor = m_process.file_descriptor(fd))
+            attach(descriptor->wait_queue());
+    };
+    switch (m_state) {
+    case BlockedRead:
+    case BlockedWrite:
+        attach_to_fd(m_blocked_fd);
+        break;
+    case BlockedSelect:
+        for (int fd : m_select_read_fds)
+            attach_to_fd(fd);
+        for (int fd : m_select_write_fds)
+            attach_to_fd(fd);
+        break;
+    case BlockedConnect:
+    case BlockedReceive:
+        ASSERT(m_blocked_socket);
+        attach(&m_blocked_socket->wait_queue());
+        break;
+    case BlockedSnoozing:
+        ASSERT(m_snoozing_alarm);
+        attach(&m_snoozing_alarm->wait_queue());
+        break;
+    case BlockedFutex:
+        ASSERT(m_futex_queue);
+        attach(m_futex_queue);
+        break;
+    default:
+        ASSERT_NOT_REACHED();
+    }
+}
+
+void Thread::detach_from_wait_queues()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    for (auto* wait_queue : m_wait_queues)
+        wait_queue->remove(*this);
+    m_wait_queues.clear_with_capacity();
+}
+
+void Thread::did_leave_wait_queue(WaitQueue& wait_queue)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_wait_queues.remove_first_matching([&] (auto* entry) { return entry == &wait_queue; });
 }
 
 void Thread::snooze_until(Alarm& alarm)
@@ -118,7 +340,16 @@ void Thread::block(Thread::State new_state)
     ASSERT(state() == Thread::Running);
     system.nblocked++;
     m_was_interrupted_while_blocked = false;
-    set_state(new_state);
+    {
+        InterruptDisabler disabler;
+        // Start out woken, so the scheduler checks us at least once after we're on the wait queues.
+        // Otherwise we'd sleep through anything that happened between our caller's check and now.
+        bool blocked_on_io = is_blocked_on_io(new_state);
+        m_has_pending_wakeup = blocked_on_io;
+        set_state(new_state);
+        if (blocked_on_io)
+            attach_to_wait_queues();
+    }
     Scheduler::yield();
 }
 
@@ -150,6 +381,8 @@ const char* to_string(Thread::State state)
     case Thread::BlockedConnect: return "Connect";
     case Thread::BlockedReceive: return "Receive";
     case Thread::BlockedSnoozing: return "Snoozing";
+    case Thread::BlockedLock: return "Lock";
+    case Thread::BlockedFutex: return "Futex";
     }
     kprintf("to_string(Thread::State): Invalid state: %u\n", state);
     ASSERT_NOT_REACHED();
@@ -162,8 +395,12 @@ void Thread::finalize()
     m_blocked_socket = nullptr;
     set_state(Thread::State::Dead);
 
-    if (this == &m_process.main_thread())
+    if (this == &m_process.main_thread()) {
         m_process.finalize();
+        return;
+    }
+    // Secondary threads have nothing left to report, their process lives on without them.
+    delete this;
 }
 
 void Thread::finalize_dying_threads()
@@ -179,6 +416,29 @@ void Thread::finalize_dying_threads()
         thread->finalize();
 }
 
+void Thread::bill_cycles_until(qword now)
+{
+    if (m_is_billing_kernel || m_process.is_ring0())
+        m_statistics.kernel_cycles += now - m_cycles_billed_until;
+    else
+        m_statistics.user_cycles += now - m_cycles_billed_until;
+    m_cycles_billed_until = now;
+}
+
+void Thread::did_enter_kernel()
+{
+    InterruptDisabler disabler;
+    bill_cycles_until(read_tsc());
+    m_is_billing_kernel = true;
+}
+
+void Thread::did_leave_kernel()
+{
+    InterruptDisabler disabler;
+    bill_cycles_until(read_tsc());
+    m_is_billing_kernel = false;
+}
+
 bool Thread::tick()
 {
     ++m_ticks;
@@ -200,6 +460,7 @@ void Thread::send_signal(byte signal, Process* sender)
 
     InterruptDisabler disabler;
     m_pending_signals |= 1 << signal;
+    Scheduler::note_pending_signals();
 }
 
 bool Thread::has_unmasked_pending_signals() const
@@ -358,13 +619,13 @@ ShouldUnblockThread Thread::dispatch_signal(byte signal)
             ASSERT(m_signal_stack_user_region);
         }
         if (!m_kernel_stack_for_signal_handler) {
-            m_kernel_stack_for_signal_handler = kmalloc(default_kernel_stack_size);
+            m_kernel_stack_for_signal_handler = MM.allocate_kernel_stack();
             ASSERT(m_kernel_stack_for_signal_handler);
         }
         m_tss.ss = 0x23;
         m_tss.esp = m_signal_stack_user_region->laddr().offset(default_userspace_stack_size).get();
         m_tss.ss0 = 0x10;
-        m_tss.esp0 = (dword)m_kernel_stack_for_signal_handler + default_kernel_stack_size;
+        m_tss.esp0 = (dword)m_kernel_stack_for_signal_handler + kernel_stack_size;
 
         push_value_on_stack(0);
     } else {
@@ -430,7 +691,7 @@ void Thread::push_value_on_stack(dword value)
     *stack_ptr = value;
 }
 
-void Thread::make_userspace_stack_for_main_thread(Vector<String> arguments, Vector<String> environment)
+void Thread::make_userspace_stack_for_main_thread(Vector<String> arguments, Vector<String> environment, const Vector<Elf32_auxv_t>& auxiliary_values)
 {
     auto* region = m_process.allocate_region(LinearAddress(), default_userspace_stack_size, "stack");
     ASSERT(region);
@@ -441,7 +702,9 @@ void Thread::make_userspace_stack_for_main_thread(Vector<String> arguments, Vect
     int argc = arguments.size();
     char** argv = (char**)stack_base;
     char** env = argv + arguments.size() + 1;
-    char* bufptr = stack_base + (sizeof(char*) * (arguments.size() + 1)) + (sizeof(char*) * (environment.size() + 1));
+    // The auxiliary vector (for the dynamic loader) goes right after the environment's terminating null.
+    auto* auxv = (Elf32_auxv_t*)(env + environment.size() + 1);
+    char* bufptr = (char*)(auxv + auxiliary_values.size());
 
     size_t total_blob_size = 0;
     for (auto& a : arguments)
@@ -449,7 +712,7 @@ void Thread::make_userspace_stack_for_main_thread(Vector<String> arguments, Vect
     for (auto& e : environment)
         total_blob_size += e.length() + 1;
 
-    size_t total_meta_size = sizeof(char*) * (arguments.size() + 1) + sizeof(char*) * (environment.size() + 1);
+    size_t total_meta_size = sizeof(char*) * (arguments.size() + 1) + sizeof(char*) * (environment.size() + 1) + sizeof(Elf32_auxv_t) * auxiliary_values.size();
 
     // FIXME: It would be better if this didn't make us panic.
     ASSERT((total_blob_size + total_meta_size) < default_userspace_stack_size);
@@ -470,6 +733,9 @@ void Thread::make_userspace_stack_for_main_thread(Vector<String> arguments, Vect
     }
     env[environment.size()] = nullptr;
 
+    for (int i = 0; i < auxiliary_values.size(); ++i)
+        auxv[i] = auxiliary_values[i];
+
     // NOTE: The stack needs to be 16-byte aligned.
     push_value_on_stack((dword)env);
     push_value_on_stack((dword)argv);
@@ -489,17 +755,59 @@ void Thread::make_userspace_stack_for_secondary_thread(void *argument)
     push_value_on_stack(0);
 }
 
+void Thread::deallocate_userspace_stack()
+{
+    auto stack_bottom = LinearAddress(m_stack_top3 - default_userspace_stack_size);
+    if (auto* region = m_process.region_from_range(stack_bottom, default_userspace_stack_size))
+        m_process.deallocate_region(*region);
+    m_stack_top3 = 0;
+}
+
 Thread* Thread::clone(Process& process)
 {
     auto* clone = new Thread(process);
     memcpy(clone->m_signal_action_data, m_signal_action_data, sizeof(m_signal_action_data));
     clone->m_signal_mask = m_signal_mask;
-    clone->m_fpu_state = (FPUState*)kmalloc_aligned(sizeof(FPUState), 16);
     memcpy(clone->m_fpu_state, m_fpu_state, sizeof(FPUState));
     clone->m_has_used_fpu = m_has_used_fpu;
+    if (m_thread_pointer_selector)
+        clone->set_thread_pointer(m_thread_pointer);
     return clone;
 }
 
+void Thread::set_thread_pointer(dword pointer)
+{
+    // Ring 3 reaches its thread pointer through %gs, a data segment based at it.
+    InterruptDisabler disabler;
+    if (!m_thread_pointer_selector)
+        m_thread_pointer_selector = gdt_alloc_entry() | 3;
+    m_thread_pointer = pointer;
+    auto& descriptor = get_gdt_entry(m_thread_pointer_selector);
+    descriptor.set_base((void*)pointer);
+    descriptor.set_limit(0xfffff);
+    descriptor.type = 2; // Read/write data
+    descriptor.descriptor_type = 1;
+    descriptor.dpl = 3;
+    descriptor.segment_present = 1;
+    descriptor.granularity = 1;
+    descriptor.zero = 0;
+    descriptor.operation_size = 1;
+    flush_gdt();
+    m_tss.gs = m_thread_pointer_selector;
+}
+
+void Thread::clear_thread_pointer()
+{
+    if (!m_thread_pointer_selector)
+        return;
+    InterruptDisabler disabler;
+    if (m_tss.gs == m_thread_pointer_selector)
+        m_tss.gs = 0x23;
+    gdt_free_entry(m_thread_pointer_selector & ~3);
+    m_thread_pointer_selector = 0;
+    m_thread_pointer = 0;
+}
+
 KResult Thread::wait_for_connect(Socket& socket)
 {
     if (socket.is_connected())
@@ -515,7 +823,8 @@ KResult Thread::wait_for_connect(Socket& socket)
 
 void Thread::initialize()
 {
-    g_threads = new InlineLinkedList<Thread>;
+    for (auto*& queue : s_queues)
+        queue = new InlineLinkedList<Thread>;
     Scheduler::initialize();
 }
 
@@ -523,7 +832,9 @@ Vector<Thread*> Thread::all_threads()
 {
     Vector<Thread*> threads;
     InterruptDisabler disabler;
-    for (auto* thread = g_threads->head(); thread; thread = thread->next())
-        threads.append(thread);
+    for_each([&] (Thread& thread) {
+        threads.append(&thread);
+        return IterationDecision::Continue;
+    });
     return threads;
 }
@@ -3,15 +3,19 @@
 #include <Kernel/i386.h>
 #include <Kernel/TSS.h>
 #include <Kernel/KResult.h>
+#include <Kernel/Syscall.h>
+#include <Kernel/elf.h>
 #include <AK/AKString.h>
 #include <AK/InlineLinkedList.h>
 #include <AK/RetainPtr.h>
 #include <AK/Vector.h>
 
 class Alarm;
+class Lock;
 class Process;
 class Region;
 class Socket;
+class WaitQueue;
 
 enum class ShouldUnblockThread { No = 0, Yes };
 
@@ -22,13 +26,35 @@ struct SignalActionData {
     LinearAddress restorer;
 };
 
+// Everything a thread has used, read out through /proc/<pid>/stats and /proc/<pid>/stats.bin.
+struct ThreadStatistics {
+    // TSC cycles, with the time spent handling syscalls and page faults counted as kernel time.
+    qword user_cycles { 0 };
+    qword kernel_cycles { 0 };
+    // Switched away from while blocking, or while still runnable.
+    dword voluntary_switches { 0 };
+    dword involuntary_switches { 0 };
+    dword zero_faults { 0 };
+    dword cow_faults { 0 };
+    dword inode_faults { 0 };
+    qword disk_bytes_read { 0 };
+    qword disk_bytes_written { 0 };
+    dword syscalls[Syscall::function_count] { };
+};
+
 class Thread : public InlineLinkedListNode<Thread> {
     friend class Process;
     friend class Scheduler;
+    friend class WaitQueue;
+    friend class Lock;
 public:
     explicit Thread(Process&);
     ~Thread();
 
+    // Freed threads are recycled, see Thread.cpp.
+    static void* operator new(size_t);
+    static void operator delete(void*);
+
     static void initialize();
     static void finalize_dying_threads();
 
@@ -61,6 +87,8 @@ public:
         BlockedConnect,
         BlockedReceive,
         BlockedSnoozing,
+        BlockedLock,
+        BlockedFutex,
     };
 
     void did_schedule() { ++m_times_scheduled; }
@@ -69,7 +97,7 @@ public:
     bool is_stopped() const { return m_state == Stopped; }
     bool is_blocked() const
     {
-        return m_state == BlockedSleep || m_state == BlockedWait || m_state == BlockedRead || m_state == BlockedWrite || m_state == BlockedSignal || m_state == BlockedSelect;
+        return m_state == BlockedSleep || m_state == BlockedWait || m_state == BlockedRead || m_state == BlockedWrite || m_state == BlockedSignal || m_state == BlockedSelect || m_state == BlockedFutex;
     }
     bool in_kernel() const { return (m_tss.cs & 0x03) == 0; }
 
@@ -78,6 +106,7 @@ public:
     dword stack_top() const { return m_tss.ss == 0x10 ? m_stack_top0 : m_stack_top3; }
 
     word selector() const { return m_far_ptr.selector; }
+    word thread_pointer_selector() const { return m_thread_pointer_selector; }
     TSS32& tss() { return m_tss; }
     State state() const { return m_state; }
     dword ticks() const { return m_ticks; }
@@ -102,7 +131,27 @@ public:
     dword kernel_stack_for_signal_handler_base() const { return (dword)m_kernel_stack_for_signal_handler; }
 
     void set_selector(word s) { m_far_ptr.selector = s; }
-    void set_state(State s) { m_state = s; }
+    void set_thread_pointer(dword);
+    void clear_thread_pointer();
+    void set_state(State);
+    void priority_did_change();
+
+    // The process priority, adjusted by how interactive the thread has been lately:
+    // Waking up from an I/O wait boosts it one level, using up a whole time slice takes one away.
+    int effective_priority() const;
+    int priority_boost() const { return m_priority_boost; }
+    void did_use_whole_time_slice();
+    dword times_boosted() const { return m_times_boosted; }
+    dword times_preempted() const { return m_times_preempted; }
+
+    ThreadStatistics& statistics() { return m_statistics; }
+    const ThreadStatistics& statistics() const { return m_statistics; }
+    // Around every syscall and page fault that came from userspace, so its time is billed as kernel time.
+    void did_enter_kernel();
+    void did_leave_kernel();
+    void bill_cycles_until(qword now);
+
+    void wake_from_wait_queue();
 
     void send_signal(byte signal, Process* sender);
 
@@ -119,8 +168,9 @@ public:
 
     void set_default_signal_dispositions();
     void push_value_on_stack(dword);
-    void make_userspace_stack_for_main_thread(Vector<String> arguments, Vector<String> environment);
+    void make_userspace_stack_for_main_thread(Vector<String> arguments, Vector<String> environment, const Vector<Elf32_auxv_t>& auxiliary_values = { });
     void make_userspace_stack_for_secondary_thread(void* argument);
+    void deallocate_userspace_stack();
 
     Thread* clone(Process&);
 
@@ -132,7 +182,34 @@ public:
     template<typename Callback> static void for_each_living(Callback);
     template<typename Callback> static void for_each(Callback);
 
+    // Every thread but the colonel's is on exactly one scheduler queue, picked by its state (and priority).
+    // This lets Scheduler::pick_next() only look at the threads that could possibly be affected.
+    enum class Queue {
+        // Indexed by Process::Priority.
+        RunnableLow,
+        RunnableNormal,
+        RunnableHigh,
+        // Transient states that need looking at on every pass.
+        Polled,
+        WokenOnIO,
+        Sleeping,
+        Waiting,
+        BlockedOnIO,
+        // Threads that only something outside the scheduler will move along.
+        Inactive,
+        __Count
+    };
+    static InlineLinkedList<Thread>& queue(Queue queue) { return *s_queues[(int)queue]; }
+    template<typename Callback> static void for_each_in_queue(Queue, Callback);
+
 private:
+    Queue queue_for_state(State) const;
+    void attach_to_wait_queues();
+    void detach_from_wait_queues();
+    void did_leave_wait_queue(WaitQueue&);
+
+    static InlineLinkedList<Thread>* s_queues[(int)Queue::__Count];
+
     Process& m_process;
     int m_tid { -1 };
     TSS32 m_tss;
@@ -142,8 +219,17 @@ private:
     dword m_ticks_left { 0 };
     dword m_stack_top0 { 0 };
     dword m_stack_top3 { 0 };
+    dword m_thread_pointer { 0 };
+    word m_thread_pointer_selector { 0 };
     dword m_wakeup_time { 0 };
     dword m_times_scheduled { 0 };
+    dword m_times_boosted { 0 };
+    dword m_times_preempted { 0 };
+    ThreadStatistics m_statistics;
+    // When the time since was last billed, and whether it goes to kernel time.
+    qword m_cycles_billed_until { 0 };
+    bool m_is_billing_kernel { false };
+    int m_priority_boost { 0 };
     dword m_pending_signals { 0 };
     dword m_signal_mask { 0 };
     void* m_kernel_stack { nullptr };
@@ -155,53 +241,68 @@ private:
     RetainPtr<Socket> m_blocked_socket;
     Region* m_signal_stack_user_region { nullptr };
     Alarm* m_snoozing_alarm { nullptr };
+    Lock* m_blocked_lock { nullptr };
+    WaitQueue* m_futex_queue { nullptr };
+    Thread* m_next_lock_waiter { nullptr };
     Vector<int> m_select_read_fds;
     Vector<int> m_select_write_fds;
     Vector<int> m_select_exceptional_fds;
+    Vector<WaitQueue*> m_wait_queues;
     State m_state { Invalid };
+    InlineLinkedList<Thread>* m_queue { nullptr };
     FPUState* m_fpu_state { nullptr };
     bool m_select_has_timeout { false };
     bool m_has_used_fpu { false };
     bool m_was_interrupted_while_blocked { false };
+    bool m_has_pending_wakeup { false };
 };
 
-extern InlineLinkedList<Thread>* g_threads;
-
 const char* to_string(Thread::State);
 
 template<typename Callback>
-inline void Thread::for_each_in_state(State state, Callback callback)
+inline void Thread::for_each_in_queue(Queue queue, Callback callback)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    for (auto* thread = g_threads->head(); thread;) {
+    for (auto* thread = Thread::queue(queue).head(); thread;) {
         auto* next_thread = thread->next();
-        if (thread->state() == state)
-            callback(*thread);
+        if (callback(*thread) == IterationDecision::Abort)
+            return;
         thread = next_thread;
     }
 }
 
+template<typename Callback>
+inline void Thread::for_each_in_state(State state, Callback callback)
+{
+    for_each([&] (Thread& thread) {
+        if (thread.state() == state)
+            callback(thread);
+        return IterationDecision::Continue;
+    });
+}
+
 template<typename Callback>
 inline void Thread::for_each_living(Callback callback)
 {
-    ASSERT_INTERRUPTS_DISABLED();
-    for (auto* thread = g_threads->head(); thread;) {
-        auto* next_thread = thread->next();
-        if (thread->state() != Thread::State::Dead && thread->state() != Thread::State::Dying)
-            callback(*thread);
-        thread = next_thread;
-    }
+    for_each([&] (Thread& thread) {
+        if (thread.state() != Thread::State::Dead && thread.state() != Thread::State::Dying)
+            callback(thread);
+        return IterationDecision::Continue;
+    });
 }
 
+// NOTE: A thread whose state changes during the iteration may move to a queue that's visited later, and so be visited twice.
 template<typename Callback>
 inline void Thread::for_each(Callback callback)
 {
     ASSERT_INTERRUPTS_DISABLED();
-    for (auto* thread = g_threads->head(); thread;) {
-        auto* next_thread = thread->next();
-        if (callback(*thread) == IterationDecision::Abort)
-            return;
-        thread = next_thread;
+    for (int i = 0; i < (int)Queue::__Count; ++i) {
+        for (auto* thread = s_queues[i]->head(); thread;) {
+            auto* next_thread = thread->next();
+            if (callback(*thread) == IterationDecision::Abort)
+                return;
+            thread = next_thread;
+        }
     }
 }
 
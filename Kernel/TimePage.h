@@ -0,0 +1,53 @@
+#pragma once
+
+#include <AK/Types.h>
+
+// The time page is a page the kernel rewrites on every tick and maps read-only into every process
+// (its address is the AT_TIME_PAGE auxiliary value), so reading the clock doesn't take a syscall.
+// While the kernel is writing it, |sequence| is odd. A reader that sees it odd, or sees it change
+// while it's reading, reads again.
+
+struct TimePage {
+    volatile dword sequence;
+    // In ticks, like system.uptime.
+    dword uptime;
+    // The wall clock as of the last tick.
+    dword seconds;
+    dword microseconds;
+    // Where the TSC was at the last tick, and how to turn cycles since then into microseconds:
+    // (cycles * tsc_to_microseconds) >> 32. That stays 0 until the kernel has measured the TSC.
+    qword tsc;
+    dword tsc_cycles_per_tick;
+    dword tsc_to_microseconds;
+};
+
+// The wall clock right now, from the last tick plus however far the TSC has gone since.
+// It never goes more than a tick past it, in case the page hasn't been kept up (the kernel stops ticking when idle.)
+// Returns false if the TSC isn't calibrated yet, and it has to be asked for instead.
+inline bool read_time_page(const TimePage& page, dword& seconds, dword& microseconds)
+{
+    for (;;) {
+        dword sequence = page.sequence;
+        asm volatile("" ::: "memory");
+        dword tsc_cycles_per_tick = page.tsc_cycles_per_tick;
+        dword tsc_to_microseconds = page.tsc_to_microseconds;
+        if (!tsc_to_microseconds)
+            return false;
+        dword page_seconds = page.seconds;
+        dword page_microseconds = page.microseconds;
+        qword page_tsc = page.tsc;
+        dword tsc_low;
+        dword tsc_high;
+        asm volatile("rdtsc" : "=a"(tsc_low), "=d"(tsc_high));
+        asm volatile("" ::: "memory");
+        if ((sequence & 1) || page.sequence != sequence)
+            continue;
+        qword cycles = (((qword)tsc_high << 32) | tsc_low) - page_tsc;
+        if (cycles > tsc_cycles_per_tick)
+            cycles = tsc_cycles_per_tick;
+        page_microseconds += (cycles * tsc_to_microseconds) >> 32;
+        seconds = page_seconds + page_microseconds / 1000000;
+        microseconds = page_microseconds % 1000000;
+        return true;
+    }
+}
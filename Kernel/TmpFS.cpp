@@ -0,0 +1,425 @@
+#include "TmpFS.h"
+#include "MemoryManager.h"
+#include "Process.h"
+#include <AK/StdLibExtras.h>
+#include <LibC/errno_numbers.h>
+
+//#define TMPFS_DEBUG
+
+Retained<TmpFS> TmpFS::create()
+{
+    return adopt(*new TmpFS);
+}
+
+TmpFS::TmpFS()
+{
+}
+
+TmpFS::~TmpFS()
+{
+}
+
+bool TmpFS::initialize()
+{
+    auto root = create_inode_with_mode(0041777);
+    ASSERT(root->index() == RootInodeIndex);
+    root->m_parent = root->identifier();
+    // "." and ".." are both the root itself.
+    root->m_metadata.link_count = 2;
+    m_inodes.set(RootInodeIndex, move(root));
+    return true;
+}
+
+const char* TmpFS::class_name() const
+{
+    return "tmpfs";
+}
+
+InodeIdentifier TmpFS::root_inode() const
+{
+    return { fsid(), RootInodeIndex };
+}
+
+Retained<TmpFSInode> TmpFS::create_inode_with_mode(mode_t mode)
+{
+    LOCKER(m_lock);
+    auto inode = adopt(*new TmpFSInode(*this, m_next_inode_index++));
+    struct timeval now;
+    kgettimeofday(now);
+    inode->m_metadata.mode = mode;
+    if (current) {
+        inode->m_metadata.uid = current->process().euid();
+        inode->m_metadata.gid = current->process().egid();
+    }
+    inode->m_metadata.atime = now.tv_sec;
+    inode->m_metadata.ctime = now.tv_sec;
+    inode->m_metadata.mtime = now.tv_sec;
+    return inode;
+}
+
+RetainPtr<Inode> TmpFS::create_inode(InodeIdentifier parent_id, const String& name, mode_t mode, unsigned size, int& error)
+{
+    LOCKER(m_lock);
+    ASSERT(parent_id.fsid() == fsid());
+    auto parent_inode = get_inode(parent_id);
+    if (!parent_inode) {
+        error = -ENOENT;
+        return nullptr;
+    }
+
+    auto inode = create_inode_with_mode(mode);
+    if (::is_directory(mode))
+        inode->m_metadata.link_count = 1;
+    m_inodes.set(inode->index(), inode.copy_ref());
+
+    // Adding the name counts the new inode's first link.
+    auto result = parent_inode->add_child(inode->identifier(), name, 0);
+    if (result.is_error()) {
+        m_inodes.remove(inode->index());
+        error = result;
+        return nullptr;
+    }
+    if (size)
+        inode->set_size(size);
+#ifdef TMPFS_DEBUG
+    dbgprintf("TmpFS: Created inode %u named '%s' (mode %o) in directory %u\n", inode->index(), name.characters(), mode, parent_id.index());
+#endif
+    error = 0;
+    return inode;
+}
+
+RetainPtr<Inode> TmpFS::create_directory(InodeIdentifier parent_id, const String& name, mode_t mode, int& error)
+{
+    LOCKER(m_lock);
+    mode &= ~0170000;
+    mode |= 0040000;
+
+    auto inode = create_inode(parent_id, name, mode, 0, error);
+    if (!inode)
+        return nullptr;
+    static_cast<TmpFSInode&>(*inode).m_parent = parent_id;
+
+    // For the new directory's "..".
+    auto parent_inode = get_inode(parent_id);
+    error = parent_inode->increment_link_count();
+    if (error < 0)
+        return nullptr;
+    error = 0;
+    return inode;
+}
+
+RetainPtr<Inode> TmpFS::get_inode(InodeIdentifier inode_id) const
+{
+    LOCKER(m_lock);
+    ASSERT(inode_id.fsid() == fsid());
+    auto it = m_inodes.find(inode_id.index());
+    if (it == m_inodes.end())
+        return nullptr;
+    return (*it).value;
+}
+
+void TmpFS::remove_inode(InodeIndex index)
+{
+    LOCKER(m_lock);
+#ifdef TMPFS_DEBUG
+    dbgprintf("TmpFS: Inode %u has no links left\n", index);
+#endif
+    m_inodes.remove(index);
+}
+
+TmpFSInode::TmpFSInode(TmpFS& fs, unsigned index)
+    : Inode(fs, index)
+{
+    m_metadata.inode = { fs.fsid(), index };
+    m_metadata.block_size = PAGE_SIZE;
+    set_page_cache_pinned();
+}
+
+TmpFSInode::~TmpFSInode()
+{
+}
+
+InodeMetadata TmpFSInode::metadata() const
+{
+    // No lock, like Ext2FSInode::metadata(). This gets called with interrupts disabled, e.g by mmap().
+    InodeMetadata metadata = m_metadata;
+    // FIXME: This doesn't leave out holes.
+    metadata.block_count = ceil_div((size_t)m_metadata.size, (size_t)PAGE_SIZE) * (PAGE_SIZE / 512);
+    return metadata;
+}
+
+ssize_t TmpFSInode::read_bytes(off_t offset, ssize_t count, byte* buffer, FileDescriptor*) const
+{
+    LOCKER(m_lock);
+    ASSERT(offset >= 0);
+    ASSERT(buffer);
+    if (is_directory())
+        return -EISDIR;
+    if (offset >= m_metadata.size)
+        return 0;
+    ssize_t nread = min((off_t)count, m_metadata.size - offset);
+    ssize_t remaining_count = nread;
+    while (remaining_count) {
+        size_t offset_in_page = offset % PAGE_SIZE;
+        ssize_t bytes_from_page = min((ssize_t)(PAGE_SIZE - offset_in_page), remaining_count);
+        // Holes read as zeroes without putting pages in for them.
+        auto page = cached_page_if_present(offset / PAGE_SIZE);
+        if (page)
+            memcpy(buffer, MM.physmap(*page) + offset_in_page, bytes_from_page);
+        else
+            memset(buffer, 0, bytes_from_page);
+        buffer += bytes_from_page;
+        offset += bytes_from_page;
+        remaining_count -= bytes_from_page;
+    }
+    return nread;
+}
+
+ssize_t TmpFSInode::write_bytes(off_t offset, ssize_t count, const byte* data, FileDescriptor*)
+{
+    LOCKER(m_lock);
+    ASSERT(offset >= 0);
+    ASSERT(!is_directory());
+    if (!count)
+        return 0;
+
+    ssize_t nwritten = 0;
+    while (nwritten < count) {
+        off_t current_offset = offset + nwritten;
+        size_t offset_in_page = current_offset % PAGE_SIZE;
+        ssize_t bytes_to_page = min((ssize_t)(PAGE_SIZE - offset_in_page), count - nwritten);
+        auto page = pinned_page(current_offset / PAGE_SIZE);
+        if (!page)
+            break;
+        // Anyone who has this page mapped sees the write right away, it's the same page.
+        memcpy(MM.physmap(*page) + offset_in_page, data + nwritten, bytes_to_page);
+        nwritten += bytes_to_page;
+    }
+    if (!nwritten)
+        return -ENOSPC;
+
+    if (offset + nwritten > m_metadata.size)
+        set_size(offset + nwritten);
+    struct timeval now;
+    kgettimeofday(now);
+    m_metadata.mtime = now.tv_sec;
+    return nwritten;
+}
+
+void TmpFSInode::set_size(size_t new_size)
+{
+    size_t old_size = m_metadata.size;
+    if (new_size < old_size) {
+        remove_pinned_pages(ceil_div(new_size, (size_t)PAGE_SIZE));
+        // Whatever is past the end of the last page must read as zeroes if the file grows again.
+        size_t offset_in_page = new_size % PAGE_SIZE;
+        if (offset_in_page) {
+            auto page = cached_page_if_present(new_size / PAGE_SIZE);
+            if (page)
+                memset(MM.physmap(*page) + offset_in_page, 0, PAGE_SIZE - offset_in_page);
+        }
+    }
+    m_metadata.size = new_size;
+    inode_size_changed(old_size, new_size);
+}
+
+KResult TmpFSInode::truncate(int size)
+{
+    LOCKER(m_lock);
+    if (size < 0)
+        return KResult(-EINVAL);
+    if (is_directory())
+        return KResult(-EISDIR);
+    if ((size_t)size == (size_t)m_metadata.size)
+        return KSuccess;
+    set_size(size);
+    return KSuccess;
+}
+
+static byte file_type_for_mode(mode_t mode)
+{
+    // These are the same numbers ext2 uses.
+    if (is_regular_file(mode))
+        return 1;
+    if (is_directory(mode))
+        return 2;
+    if (is_character_device(mode))
+        return 3;
+    if (is_block_device(mode))
+        return 4;
+    if (is_fifo(mode))
+        return 5;
+    if (is_socket(mode))
+        return 6;
+    if (is_symlink(mode))
+        return 7;
+    return 0;
+}
+
+bool TmpFSInode::traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)> callback) const
+{
+    LOCKER(m_lock);
+    if (!is_directory())
+        return false;
+
+    if (!callback({ ".", 1, identifier(), 2 }))
+        return true;
+    if (!callback({ "..", 2, m_parent, 2 }))
+        return true;
+    for (auto& it : m_children) {
+        InodeIdentifier child_id { fsid(), it.value };
+        auto child = fs().get_inode(child_id);
+        byte file_type = child ? file_type_for_mode(child->mode()) : 0;
+        if (!callback({ it.key.characters(), (size_t)it.key.length(), child_id, file_type }))
+            break;
+    }
+    return true;
+}
+
+InodeIdentifier TmpFSInode::lookup(const String& name)
+{
+    LOCKER(m_lock);
+    ASSERT(is_directory());
+    if (name == ".")
+        return identifier();
+    if (name == "..")
+        return m_parent;
+    auto it = m_children.find(name);
+    if (it == m_children.end())
+        return { };
+    return { fsid(), (*it).value };
+}
+
+String TmpFSInode::reverse_lookup(InodeIdentifier child_id)
+{
+    LOCKER(m_lock);
+    ASSERT(is_directory());
+    for (auto& it : m_children) {
+        if (it.value == child_id.index())
+            return it.key;
+    }
+    return { };
+}
+
+KResult TmpFSInode::add_child(InodeIdentifier child_id, const String& name, byte)
+{
+    LOCKER(m_lock);
+    ASSERT(is_directory());
+    ASSERT(child_id.fsid() == fsid());
+    if (name == "." || name == ".." || m_children.contains(name))
+        return KResult(-EEXIST);
+    auto child_inode = fs().get_inode(child_id);
+    if (!child_inode)
+        return KResult(-ENOENT);
+    m_children.set(name, child_id.index());
+    child_inode->increment_link_count();
+    struct timeval now;
+    kgettimeofday(now);
+    m_metadata.mtime = now.tv_sec;
+    return KSuccess;
+}
+
+KResult TmpFSInode::remove_child(const String& name)
+{
+    LOCKER(m_lock);
+    ASSERT(is_directory());
+#ifdef TMPFS_DEBUG
+    dbgprintf("TmpFS: Removing '%s' in directory %u\n", name.characters(), index());
+#endif
+
+    // VFS::rmdir() takes the directory's own "." and ".." out before its name.
+    if (name == ".") {
+        decrement_link_count();
+        return KSuccess;
+    }
+    if (name == "..") {
+        auto parent_inode = fs().get_inode(m_parent);
+        if (parent_inode)
+            parent_inode->decrement_link_count();
+        return KSuccess;
+    }
+
+    auto it = m_children.find(name);
+    if (it == m_children.end())
+        return KResult(-ENOENT);
+    auto child_inode = fs().get_inode({ fsid(), (*it).value });
+    m_children.remove(it);
+    if (child_inode)
+        child_inode->decrement_link_count();
+    struct timeval now;
+    kgettimeofday(now);
+    m_metadata.mtime = now.tv_sec;
+    return KSuccess;
+}
+
+RetainPtr<Inode> TmpFSInode::parent() const
+{
+    LOCKER(m_lock);
+    return fs().get_inode(m_parent);
+}
+
+size_t TmpFSInode::directory_entry_count() const
+{
+    LOCKER(m_lock);
+    ASSERT(is_directory());
+    // NOTE: The 2 is for '.' and '..'
+    return m_children.size() + 2;
+}
+
+void TmpFSInode::flush_metadata()
+{
+    // There's nowhere to flush to.
+    set_metadata_dirty(false);
+}
+
+KResult TmpFSInode::chmod(mode_t mode)
+{
+    LOCKER(m_lock);
+    m_metadata.mode = mode;
+    return KSuccess;
+}
+
+KResult TmpFSInode::chown(uid_t uid, gid_t gid)
+{
+    LOCKER(m_lock);
+    m_metadata.uid = uid;
+    m_metadata.gid = gid;
+    return KSuccess;
+}
+
+int TmpFSInode::set_atime(time_t t)
+{
+    LOCKER(m_lock);
+    m_metadata.atime = t;
+    return 0;
+}
+
+int TmpFSInode::set_ctime(time_t t)
+{
+    LOCKER(m_lock);
+    m_metadata.ctime = t;
+    return 0;
+}
+
+int TmpFSInode::set_mtime(time_t t)
+{
+    LOCKER(m_lock);
+    m_metadata.mtime = t;
+    return 0;
+}
+
+int TmpFSInode::increment_link_count()
+{
+    LOCKER(m_lock);
+    ++m_metadata.link_count;
+    return 0;
+}
+
+int TmpFSInode::decrement_link_count()
+{
+    LOCKER(m_lock);
+    ASSERT(m_metadata.link_count);
+    if (!--m_metadata.link_count)
+        fs().remove_inode(index());
+    return 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "FileSystem.h"
+#include "UnixTypes.h"
+#include <AK/HashMap.h>
+
+class TmpFSInode;
+
+// A file system that lives in memory. File contents are kept in the inodes' (pinned) page caches,
+// so reads copy straight out of them and mmap() maps the very same pages.
+class TmpFS final : public FS {
+    friend class TmpFSInode;
+public:
+    virtual ~TmpFS() override;
+    static Retained<TmpFS> create();
+
+    virtual bool initialize() override;
+    virtual const char* class_name() const override;
+    virtual InodeIdentifier root_inode() const override;
+    virtual RetainPtr<Inode> create_inode(InodeIdentifier parent_id, const String& name, mode_t, unsigned size, int& error) override;
+    virtual RetainPtr<Inode> create_directory(InodeIdentifier parent_id, const String& name, mode_t, int& error) override;
+    virtual RetainPtr<Inode> get_inode(InodeIdentifier) const override;
+
+private:
+    typedef unsigned InodeIndex;
+    static constexpr InodeIndex RootInodeIndex = 1;
+
+    TmpFS();
+
+    Retained<TmpFSInode> create_inode_with_mode(mode_t);
+    void remove_inode(InodeIndex);
+
+    InodeIndex m_next_inode_index { RootInodeIndex + 1 };
+    // An inode stays here for as long as it has links, open descriptors keep it alive after that.
+    HashMap<InodeIndex, RetainPtr<TmpFSInode>> m_inodes;
+};
+
+class TmpFSInode final : public Inode {
+    friend class TmpFS;
+public:
+    virtual ~TmpFSInode() override;
+
+private:
+    // ^Inode
+    virtual ssize_t read_bytes(off_t, ssize_t, byte* buffer, FileDescriptor*) const override;
+    virtual InodeMetadata metadata() const override;
+    virtual bool traverse_as_directory(FunctionRef<bool(const FS::DirectoryEntry&)>) const override;
+    virtual InodeIdentifier lookup(const String& name) override;
+    virtual String reverse_lookup(InodeIdentifier) override;
+    virtual void flush_metadata() override;
+    virtual ssize_t write_bytes(off_t, ssize_t, const byte* buffer, FileDescriptor*) override;
+    virtual KResult add_child(InodeIdentifier child_id, const String& name, byte file_type) override;
+    virtual KResult remove_child(const String& name) override;
+    virtual RetainPtr<Inode> parent() const override;
+    virtual size_t directory_entry_count() const override;
+    virtual KResult chmod(mode_t) override;
+    virtual KResult chown(uid_t, gid_t) override;
+    virtual KResult truncate(int) override;
+    virtual int set_atime(time_t) override;
+    virtual int set_ctime(time_t) override;
+    virtual int set_mtime(time_t) override;
+    virtual int increment_link_count() override;
+    virtual int decrement_link_count() override;
+
+    TmpFS& fs();
+    const TmpFS& fs() const;
+    TmpFSInode(TmpFS&, unsigned index);
+
+    void set_size(size_t);
+
+    InodeMetadata m_metadata;
+    InodeIdentifier m_parent;
+    // Name to inode index, not counting "." and "..".
+    HashMap<String, unsigned> m_children;
+};
+
+inline TmpFS& TmpFSInode::fs()
+{
+    return static_cast<TmpFS&>(Inode::fs());
+}
+
+inline const TmpFS& TmpFSInode::fs() const
+{
+    return static_cast<const TmpFS&>(Inode::fs());
+}
@@ -0,0 +1,67 @@
+#include <Kernel/Tracing.h>
+#include <Kernel/Lock.h>
+#include <Kernel/ProcFS.h>
+#include <Kernel/Process.h>
+#include <Kernel/i386.h>
+
+namespace Tracing {
+
+// 28 KB of records, the kernel heap is small. A power of two so the count can wrap around.
+static const dword ring_capacity = 1024;
+
+volatile dword g_enabled_events;
+
+static Lockable<unsigned>* s_enabled_events;
+
+// Only ever touched with interrupts disabled, since tracepoints fire from interrupt handlers too.
+struct Ring {
+    Record records[ring_capacity];
+    // Counts every record ever written, the oldest one still there is at (count - size) % capacity.
+    dword count { 0 };
+};
+static Ring* s_ring;
+
+static void apply_enabled_events()
+{
+    dword events = s_enabled_events->lock_and_copy() & ((1u << (dword)Event::__Count) - 1);
+    // The ring stays once it's there, so what was traced can still be read after tracing is off.
+    if (events && !s_ring)
+        s_ring = new Ring;
+    g_enabled_events = events;
+}
+
+void initialize()
+{
+    s_enabled_events = new Lockable<unsigned>(0);
+    ProcFS::the().add_sys_unsigned("trace_events", *s_enabled_events, apply_enabled_events);
+}
+
+void record(Event event, dword arg1, dword arg2, dword arg3)
+{
+    InterruptDisabler disabler;
+    if (!s_ring)
+        return;
+    auto& record = s_ring->records[s_ring->count++ % ring_capacity];
+    read_tsc(record.tsc_low, record.tsc_high);
+    record.tid = current ? current->tid() : 0;
+    record.event = (word)event;
+    record.cpu = 0;
+    record.arg1 = arg1;
+    record.arg2 = arg2;
+    record.arg3 = arg3;
+}
+
+ByteBuffer records()
+{
+    InterruptDisabler disabler;
+    if (!s_ring)
+        return { };
+    dword size = min(s_ring->count, ring_capacity);
+    auto buffer = ByteBuffer::create_uninitialized(size * sizeof(Record));
+    auto* out = (Record*)buffer.pointer();
+    for (dword i = s_ring->count - size; i != s_ring->count; ++i)
+        *(out++) = s_ring->records[i % ring_capacity];
+    return buffer;
+}
+
+}
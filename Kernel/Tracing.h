@@ -0,0 +1,54 @@
+#pragma once
+
+#include <AK/ByteBuffer.h>
+#include <AK/Types.h>
+
+// Static tracepoints that can stay compiled in: until an event is switched on through
+// /proc/sys/trace_events (a bitmask of Events), hitting its tracepoint is one test of a bit.
+// Once it's on, every hit writes a fixed-size Record into a ring that /proc/trace reads out.
+namespace Tracing {
+
+enum class Event : word {
+    SyscallEntry = 0, // function, arg1, arg2
+    SyscallExit,      // function, return value
+    ContextSwitch,    // tid switched to, its pid
+    PageFault,        // faulting address, error code
+    DiskSubmit,       // first block, block count, is_write
+    DiskComplete,     // first block, block count, success
+    PacketReceived,   // length
+    PacketSent,       // length
+    LockContended,    // lock address, ms waited
+    __Count
+};
+
+// What /proc/trace is an array of, oldest first.
+struct Record {
+    dword tsc_low;
+    dword tsc_high;
+    dword tid;
+    word event;
+    // There's a ring for each processor, and only the bootstrap processor runs anything yet.
+    word cpu;
+    dword arg1;
+    dword arg2;
+    dword arg3;
+};
+
+extern volatile dword g_enabled_events;
+
+inline bool is_enabled(Event event) { return g_enabled_events & (1u << (dword)event); }
+
+void record(Event, dword arg1 = 0, dword arg2 = 0, dword arg3 = 0);
+
+// Puts trace_events into /proc/sys.
+void initialize();
+
+ByteBuffer records();
+
+}
+
+#define TRACE(event, ...) \
+    do { \
+        if (Tracing::is_enabled(Tracing::Event::event)) \
+            Tracing::record(Tracing::Event::event, ##__VA_ARGS__); \
+    } while (0)
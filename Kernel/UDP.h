@@ -18,6 +18,8 @@ public:
 
     word checksum() const { return m_checksum; }
     void set_checksum(word checksum) { m_checksum = checksum; }
+    // Where the checksum is in the header, for an adapter that fills it in.
+    static const int checksum_offset = 6;
 
     const void* payload() const { return this + 1; }
     void* payload() { return this + 1; }
@@ -1,32 +1,22 @@
 #include <Kernel/UDPSocket.h>
 #include <Kernel/UDP.h>
+#include <Kernel/InternetChecksum.h>
 #include <Kernel/NetworkAdapter.h>
 #include <Kernel/Process.h>
-#include <Kernel/RandomDevice.h>
 
-Lockable<HashMap<word, UDPSocket*>>& UDPSocket::sockets_by_port()
+IPv4SocketTable<UDPSocket>& UDPSocket::table()
 {
-    static Lockable<HashMap<word, UDPSocket*>>* s_map;
-    if (!s_map)
-        s_map = new Lockable<HashMap<word, UDPSocket*>>;
-    return *s_map;
+    static IPv4SocketTable<UDPSocket>* s_table;
+    if (!s_table)
+        s_table = new IPv4SocketTable<UDPSocket>;
+    return *s_table;
 }
 
-UDPSocketHandle UDPSocket::from_port(word port)
+UDPSocketHandle UDPSocket::from_tuple(const IPv4SocketTuple& tuple)
 {
-    RetainPtr<UDPSocket> socket;
-    {
-        LOCKER(sockets_by_port().lock());
-        auto it = sockets_by_port().resource().find(port);
-        if (it == sockets_by_port().resource().end())
-            return { };
-        socket = (*it).value;
-        ASSERT(socket);
-    }
-    return { move(socket) };
+    return { table().find(tuple) };
 }
 
-
 UDPSocket::UDPSocket(int protocol)
     : IPv4Socket(SOCK_DGRAM, protocol)
 {
@@ -34,8 +24,7 @@ UDPSocket::UDPSocket(int protocol)
 
 UDPSocket::~UDPSocket()
 {
-    LOCKER(sockets_by_port().lock());
-    sockets_by_port().resource().remove(source_port());
+    table().remove(source_port(), tuple(), *this);
 }
 
 Retained<UDPSocket> UDPSocket::create(int protocol)
@@ -43,67 +32,77 @@ Retained<UDPSocket> UDPSocket::create(int protocol)
     return adopt(*new UDPSocket(protocol));
 }
 
-int UDPSocket::protocol_receive(const ByteBuffer& packet_buffer, void* buffer, size_t buffer_size, int flags, sockaddr* addr, socklen_t* addr_length)
+bool UDPSocket::protocol_payload(const PacketBuffer& packet_buffer, const byte*& payload, size_t& payload_size, word& source_port) const
 {
-    (void)flags;
-    (void)addr_length;
-    ASSERT(!packet_buffer.is_null());
-    auto& ipv4_packet = *(const IPv4Packet*)(packet_buffer.pointer());
+    auto& ipv4_packet = *(const IPv4Packet*)(packet_buffer.data());
     auto& udp_packet = *static_cast<const UDPPacket*>(ipv4_packet.payload());
-    ASSERT(udp_packet.length() >= sizeof(UDPPacket)); // FIXME: This should be rejected earlier.
-    ASSERT(buffer_size >= (udp_packet.length() - sizeof(UDPPacket)));
-    if (addr) {
-        auto& ia = *(sockaddr_in*)addr;
-        ia.sin_port = htons(udp_packet.destination_port());
-    }
-    memcpy(buffer, udp_packet.payload(), udp_packet.length() - sizeof(UDPPacket));
-    return udp_packet.length() - sizeof(UDPPacket);
+    // The network task only lets through datagrams whose length fits the IPv4 packet.
+    ASSERT(udp_packet.length() >= sizeof(UDPPacket));
+    payload = (const byte*)udp_packet.payload();
+    payload_size = udp_packet.length() - sizeof(UDPPacket);
+    source_port = udp_packet.source_port();
+    return true;
 }
 
-int UDPSocket::protocol_send(const void* data, int data_length)
+int UDPSocket::protocol_send(const void* data, int data_length, int)
 {
-    // FIXME: Figure out the adapter somehow differently.
-    auto& adapter = *NetworkAdapter::from_ipv4_address(IPv4Address(192, 168, 5, 2));
-    auto buffer = ByteBuffer::create_zeroed(sizeof(UDPPacket) + data_length);
-    auto& udp_packet = *(UDPPacket*)(buffer.pointer());
+    auto route = route_to(destination_address());
+    if (!route.is_valid())
+        return -ENETUNREACH;
+    // FIXME: Fragment what doesn't fit, instead of refusing it.
+    if (sizeof(IPv4Packet) + sizeof(UDPPacket) + data_length > (size_t)route.mtu)
+        return -EMSGSIZE;
+    auto& adapter = *route.adapter;
+    auto source = source_address_for(route);
+    auto packet = PacketBuffer::create(data_length);
+    word segment_size = sizeof(UDPPacket) + data_length;
+    InternetChecksum checksum;
+    checksum.add_pseudo_header(source, destination_address(), IPv4Protocol::UDP, segment_size);
+    // The payload is summed as it's copied in, unless the adapter does the summing.
+    if (adapter.can_offload_checksums())
+        memcpy(packet->data(), data, data_length);
+    else
+        checksum.add_copy(packet->data(), data, data_length);
+    auto& udp_packet = *(UDPPacket*)packet->prepend(sizeof(UDPPacket));
     udp_packet.set_source_port(source_port());
     udp_packet.set_destination_port(destination_port());
-    udp_packet.set_length(sizeof(UDPPacket) + data_length);
-    memcpy(udp_packet.payload(), data, data_length);
+    udp_packet.set_length(segment_size);
+    if (adapter.can_offload_checksums()) {
+        udp_packet.set_checksum(checksum.sum());
+        packet->offload_checksum(0, UDPPacket::checksum_offset);
+    } else {
+        checksum.add(&udp_packet, sizeof(UDPPacket));
+        // 0 means there's no checksum, so a sum that comes out as that goes as its other form.
+        word value = checksum.finish();
+        udp_packet.set_checksum(value ? value : 0xffff);
+    }
     kprintf("sending as udp packet from %s:%u to %s:%u!\n",
-        adapter.ipv4_address().to_string().characters(),
+        source.to_string().characters(),
         source_port(),
         destination_address().to_string().characters(),
         destination_port());
-    adapter.send_ipv4(MACAddress(), destination_address(), IPv4Protocol::UDP, move(buffer));
+    adapter.send_ipv4(source, route.next_hop, destination_address(), IPv4Protocol::UDP, move(packet));
     return data_length;
 }
 
-KResult UDPSocket::protocol_connect()
+KResult UDPSocket::protocol_connect(ShouldBlock)
 {
+    int rc = allocate_source_port_if_needed();
+    if (rc < 0)
+        return KResult(rc);
+    // Datagrams from the peer come here, even if someone else is listening on the port too.
+    table().add_connection(tuple(), *this);
     return KSuccess;
 }
 
-int UDPSocket::protocol_allocate_source_port()
+KResult UDPSocket::protocol_bind(word port)
 {
-    static const word first_ephemeral_port = 32768;
-    static const word last_ephemeral_port = 60999;
-    static const word ephemeral_port_range_size = last_ephemeral_port - first_ephemeral_port;
-    word first_scan_port = first_ephemeral_port + (word)(RandomDevice::random_percentage() * ephemeral_port_range_size);
+    if (!table().claim_port(port, *this))
+        return KResult(-EADDRINUSE);
+    return KSuccess;
+}
 
-    LOCKER(sockets_by_port().lock());
-    for (word port = first_scan_port;;) {
-        auto it = sockets_by_port().resource().find(port);
-        if (it == sockets_by_port().resource().end()) {
-            set_source_port(port);
-            sockets_by_port().resource().set(port, this);
-            return port;
-        }
-        ++port;
-        if (port > last_ephemeral_port)
-            port = first_ephemeral_port;
-        if (port == first_scan_port)
-            break;
-    }
-    return -EADDRINUSE;
+int UDPSocket::protocol_allocate_source_port()
+{
+    return table().claim_ephemeral_port(*this);
 }
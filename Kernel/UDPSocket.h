@@ -9,15 +9,16 @@ public:
     static Retained<UDPSocket> create(int protocol);
     virtual ~UDPSocket() override;
 
-    static Lockable<HashMap<word, UDPSocket*>>& sockets_by_port();
-    static UDPSocketHandle from_port(word);
+    static IPv4SocketTable<UDPSocket>& table();
+    static UDPSocketHandle from_tuple(const IPv4SocketTuple&);
 
 private:
     explicit UDPSocket(int protocol);
 
-    virtual int protocol_receive(const ByteBuffer&, void* buffer, size_t buffer_size, int flags, sockaddr* addr, socklen_t* addr_length) override;
-    virtual int protocol_send(const void*, int) override;
-    virtual KResult protocol_connect() override;
+    virtual bool protocol_payload(const PacketBuffer&, const byte*& payload, size_t& payload_size, word& source_port) const override;
+    virtual int protocol_send(const void*, int, int flags) override;
+    virtual KResult protocol_connect(ShouldBlock) override;
+    virtual KResult protocol_bind(word) override;
     virtual int protocol_allocate_source_port() override;
 };
 
@@ -20,12 +20,31 @@
 #define MAP_FIXED 0x10
 #define MAP_ANONYMOUS 0x20
 #define MAP_ANON MAP_ANONYMOUS
+#define MAP_POPULATE 0x8000
+
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED 3
+
+#define MREMAP_MAYMOVE 0x1
+
+#define _SC_NPROCESSORS_CONF 0
+#define _SC_NPROCESSORS_ONLN 1
+#define _SC_PAGESIZE 2
 
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
 #define PROT_EXEC 0x4
 #define PROT_NONE 0x0
 
+#define POSIX_SPAWN_SETPGROUP 0x1
+#define POSIX_SPAWN_SETSIGDEF 0x2
+#define POSIX_SPAWN_SETSIGMASK 0x4
+
+#define FUTEX_WAIT 1
+#define FUTEX_WAKE 2
+
 #define F_DUPFD 0
 #define F_GETFD 1
 #define F_SETFD 2
@@ -283,6 +302,17 @@ struct termios {
     speed_t  c_ospeed;
 };
 
+// A set of processors, bit N for processor N.
+#define CPU_SETSIZE 32
+typedef struct {
+    dword bits;
+} cpu_set_t;
+
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+
 struct stat {
     dev_t     st_dev;     /* ID of device containing file */
     ino_t     st_ino;     /* inode number */
@@ -312,6 +342,31 @@ struct pollfd {
     short revents;
 };
 
+#define EPOLLIN      (1u << 0)
+#define EPOLLOUT     (1u << 2)
+#define EPOLLERR     (1u << 3)
+#define EPOLLHUP     (1u << 4)
+#define EPOLLONESHOT (1u << 30)
+#define EPOLLET      (1u << 31)
+
+#define EPOLL_CLOEXEC 02000000
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+typedef union epoll_data {
+    void* ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+struct epoll_event {
+    uint32_t events;
+    epoll_data_t data;
+};
+
 #define AF_MASK 0xff
 #define AF_UNSPEC 0
 #define AF_LOCAL 1
@@ -323,6 +378,7 @@ struct pollfd {
 #define SOCK_STREAM 1
 #define SOCK_RAW 3
 #define SOCK_DGRAM 2
+#define SOCK_SEQPACKET 5
 #define SOCK_NONBLOCK 04000
 #define SOCK_CLOEXEC 02000000
 
@@ -330,6 +386,12 @@ struct pollfd {
 
 #define SO_RCVTIMEO 1
 #define SO_SNDTIMEO 2
+#define SO_RCVBUF 3
+#define SO_RCVDROPS 4
+#define SO_ERROR 5
+
+#define MSG_TRUNC 0x20
+#define MSG_DONTWAIT 0x40
 
 #define IPPROTO_ICMP 1
 #define IPPROTO_TCP 6
@@ -358,3 +420,47 @@ struct sockaddr_in {
     struct in_addr sin_addr;
     char sin_zero[8];
 };
+
+struct msghdr {
+    void* msg_name;
+    socklen_t msg_namelen;
+    struct iovec* msg_iov;
+    int msg_iovlen;
+    void* msg_control;
+    socklen_t msg_controllen;
+    int msg_flags;
+};
+
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+#define IFNAMSIZ 16
+
+struct ifreq {
+    char ifr_name[IFNAMSIZ];
+    union {
+        struct sockaddr ifru_addr;
+        struct sockaddr ifru_netmask;
+        int ifru_mtu;
+    } ifr_ifru;
+};
+
+#define ifr_addr ifr_ifru.ifru_addr
+#define ifr_netmask ifr_ifru.ifru_netmask
+#define ifr_mtu ifr_ifru.ifru_mtu
+
+#define RTF_UP 0x1
+#define RTF_GATEWAY 0x2
+#define RTF_MTU 0x40
+
+struct rtentry {
+    struct sockaddr rt_dst;
+    struct sockaddr rt_gateway;
+    struct sockaddr rt_genmask;
+    unsigned short rt_flags;
+    unsigned long rt_mtu;
+    // The adapter's name, or null to go through whichever has the gateway on its link.
+    char* rt_dev;
+};
@@ -0,0 +1,90 @@
+#include "UserCopy.h"
+#include "MemoryManager.h"
+#include "Process.h"
+
+// Kernel memory is the identity-mapped first 4 MB, and the physmap.
+static const dword user_space_base = 4 * MB;
+static const dword user_space_end = physmap_base;
+
+// Returns how many bytes it didn't get to. The page fault handler sends a fault in one of the
+// rep's to where it would have gone next, with %ecx saying how far along it was.
+extern "C" size_t copy_user_bytes(void* dest, const void* src, size_t);
+extern "C" void copy_user_dwords_may_fault();
+extern "C" void copy_user_dwords_fixup();
+extern "C" void copy_user_bytes_may_fault();
+extern "C" void copy_user_bytes_done();
+
+asm(
+    ".globl copy_user_bytes \n"
+    "copy_user_bytes: \n"
+    "    pushl %edi\n"
+    "    pushl %esi\n"
+    "    movl %eax, %edi\n"
+    "    movl %edx, %esi\n"
+    "    movl %ecx, %edx\n"
+    "    shrl $2, %ecx\n"
+    "    andl $3, %edx\n"
+    ".globl copy_user_dwords_may_fault \n"
+    "copy_user_dwords_may_fault: \n"
+    "    rep movsl\n"
+    "    movl %edx, %ecx\n"
+    ".globl copy_user_bytes_may_fault \n"
+    "copy_user_bytes_may_fault: \n"
+    "    rep movsb\n"
+    ".globl copy_user_bytes_done \n"
+    "copy_user_bytes_done: \n"
+    "    movl %ecx, %eax\n"
+    "    popl %esi\n"
+    "    popl %edi\n"
+    "    ret\n"
+    ".globl copy_user_dwords_fixup \n"
+    "copy_user_dwords_fixup: \n"
+    "    leal (%edx, %ecx, 4), %ecx\n"
+    "    jmp copy_user_bytes_done\n"
+);
+
+struct UserCopyFixup {
+    void (*may_fault)();
+    void (*fixup)();
+};
+
+static const UserCopyFixup s_fixups[] = {
+    { copy_user_dwords_may_fault, copy_user_dwords_fixup },
+    { copy_user_bytes_may_fault, copy_user_bytes_done },
+};
+
+static bool is_user_range(const void* address, size_t size)
+{
+    if (!size)
+        return true;
+    // Kernel processes hand us kernel memory, it's all theirs anyway.
+    if (current->process().is_ring0())
+        return true;
+    dword first = (dword)address;
+    if (first + size < first)
+        return false;
+    return first >= user_space_base && first + size <= user_space_end;
+}
+
+bool copy_from_user(void* dest, const void* user_src, size_t size)
+{
+    if (!is_user_range(user_src, size))
+        return false;
+    return !copy_user_bytes(dest, user_src, size);
+}
+
+bool copy_to_user(void* user_dest, const void* src, size_t size)
+{
+    if (!is_user_range(user_dest, size))
+        return false;
+    return !copy_user_bytes(user_dest, src, size);
+}
+
+dword user_copy_fixup_for(dword eip)
+{
+    for (auto& fixup : s_fixups) {
+        if (eip == (dword)fixup.may_fault)
+            return (dword)fixup.fixup;
+    }
+    return 0;
+}
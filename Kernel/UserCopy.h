@@ -0,0 +1,20 @@
+#pragma once
+
+#include <AK/Types.h>
+
+// Copying to and from userspace without looking the regions up first. All that's checked up front is that
+// the range is below the kernel's own (so it's the same cost for any size.) Anything in it that isn't mapped
+// the right way faults, and instead of crashing, the page fault handler makes the copy stop there.
+// They return false if any of it couldn't be copied.
+bool copy_from_user(void* dest, const void* user_src, size_t);
+bool copy_to_user(void* user_dest, const void* src, size_t);
+
+template<typename T>
+inline bool copy_from_user(T& dest, const T* user_src) { return copy_from_user(&dest, user_src, sizeof(T)); }
+
+template<typename T>
+inline bool copy_to_user(T* user_dest, const T& src) { return copy_to_user(user_dest, &src, sizeof(T)); }
+
+// For the page fault handler: if a fault in the kernel at |eip| was one of the copies above,
+// where it should go on from. Otherwise 0.
+dword user_copy_fixup_for(dword eip);
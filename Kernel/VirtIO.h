@@ -0,0 +1,25 @@
+#pragma once
+
+// The registers of a legacy virtio PCI device, from the I/O port in its BAR0.
+#define VIRTIO_PCI_HOST_FEATURES        0x00
+#define VIRTIO_PCI_GUEST_FEATURES       0x04
+#define VIRTIO_PCI_QUEUE_PFN            0x08
+#define VIRTIO_PCI_QUEUE_NUM            0x0C
+#define VIRTIO_PCI_QUEUE_SEL            0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY         0x10
+#define VIRTIO_PCI_STATUS               0x12
+#define VIRTIO_PCI_ISR                  0x13 // Reading it acknowledges the interrupt
+#define VIRTIO_PCI_CONFIG               0x14 // The device's own config, without MSI-X
+
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT     12
+#define VIRTIO_PCI_VRING_ALIGN          4096
+
+#define VIRTIO_STATUS_ACKNOWLEDGE       (1 << 0)
+#define VIRTIO_STATUS_DRIVER            (1 << 1)
+#define VIRTIO_STATUS_DRIVER_OK         (1 << 2)
+#define VIRTIO_STATUS_FAILED            (1 << 7)
+
+#define VIRTIO_ISR_QUEUE                (1 << 0)
+#define VIRTIO_ISR_CONFIG               (1 << 1)
+
+#define VIRTIO_RING_F_EVENT_IDX         (1u << 29)
@@ -0,0 +1,200 @@
+#include <Kernel/VirtIODiskDevice.h>
+#include <Kernel/VirtIO.h>
+#include <Kernel/IO.h>
+#include <Kernel/Scheduler.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/i386.h>
+#include <Kernel/kmalloc.h>
+#include <AK/ByteBuffer.h>
+
+//#define VIRTIO_DISK_DEBUG
+
+#define VIRTIO_BLK_F_RO                 (1u << 5)
+
+#define VIRTIO_BLK_CONFIG_CAPACITY      0   // In 512-byte sectors, whatever the block size
+
+#define VIRTIO_BLK_T_IN                 0
+#define VIRTIO_BLK_T_OUT                1
+
+#define VIRTIO_BLK_S_OK                 0
+#define VIRTIO_BLK_S_IOERR              1
+#define VIRTIO_BLK_S_UNSUPP             2
+
+#define REQUEST_QUEUE                   0
+
+RetainPtr<VirtIODiskDevice> VirtIODiskDevice::autodetect()
+{
+    // The transitional block device, which still has the legacy interface.
+    static const PCI::ID virtio_blk_id = { 0x1af4, 0x1001 };
+    PCI::Address found_address;
+    PCI::enumerate_all([&] (const PCI::Address& address, PCI::ID id) {
+        if (id == virtio_blk_id) {
+            found_address = address;
+            return;
+        }
+    });
+    if (found_address.is_null())
+        return nullptr;
+    byte irq = PCI::get_interrupt_line(found_address);
+    return adopt(*new VirtIODiskDevice(found_address, irq));
+}
+
+VirtIODiskDevice::VirtIODiskDevice(PCI::Address pci_address, byte irq)
+    : IRQHandler(irq)
+    , m_pci_address(pci_address)
+{
+    kprintf("VirtIODisk: Found at PCI address %b:%b:%b\n", pci_address.bus(), pci_address.slot(), pci_address.function());
+
+    enable_bus_mastering(m_pci_address);
+    m_io_base = PCI::get_BAR0(m_pci_address) & ~3;
+    kprintf("VirtIODisk: IO port base: %w\n", m_io_base);
+    kprintf("VirtIODisk: Interrupt line: %u\n", irq);
+
+    IO::out8(m_io_base + VIRTIO_PCI_STATUS, 0);
+    IO::out8(m_io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    dword device_features = IO::in32(m_io_base + VIRTIO_PCI_HOST_FEATURES);
+    m_features = device_features & (VIRTIO_BLK_F_RO | VIRTIO_RING_F_EVENT_IDX);
+    IO::out32(m_io_base + VIRTIO_PCI_GUEST_FEATURES, m_features);
+    m_is_read_only = m_features & VIRTIO_BLK_F_RO;
+
+    dword capacity_low = IO::in32(m_io_base + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_CAPACITY);
+    dword capacity_high = IO::in32(m_io_base + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_CAPACITY + 4);
+    m_capacity = ((qword)capacity_high << 32) | capacity_low;
+
+    m_queue = make<VirtQueue>(m_io_base, REQUEST_QUEUE, m_features & VIRTIO_RING_F_EVENT_IDX);
+    ASSERT(m_queue->is_valid());
+
+    // Each request takes three descriptors: the header, the data and the status.
+    m_request_count = m_queue->size() / 3;
+    for (int i = 0; i < m_request_count; ++i)
+        m_free_requests.append(new Request);
+
+    IO::out8(m_io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    kprintf("VirtIODisk: %u sectors%s, up to %d requests at once, event index %s\n",
+        capacity_low,
+        m_is_read_only ? " (read-only)" : "",
+        m_request_count,
+        (m_features & VIRTIO_RING_F_EVENT_IDX) ? "on" : "off");
+
+    enable_irq();
+}
+
+VirtIODiskDevice::~VirtIODiskDevice()
+{
+}
+
+const char* VirtIODiskDevice::class_name() const
+{
+    return "VirtIODiskDevice";
+}
+
+unsigned VirtIODiskDevice::block_size() const
+{
+    return 512;
+}
+
+void VirtIODiskDevice::handle_irq()
+{
+    byte status = IO::in8(m_io_base + VIRTIO_PCI_ISR);
+    if (!(status & VIRTIO_ISR_QUEUE))
+        return;
+    dword written_size;
+    while (auto* request = (Request*)m_queue->take_used(written_size)) {
+        memory_barrier();
+        request->completed = true;
+    }
+}
+
+VirtIODiskDevice::Request& VirtIODiskDevice::take_free_request() const
+{
+    for (;;) {
+        {
+            InterruptDisabler disabler;
+            if (!m_free_requests.is_empty())
+                return *m_free_requests.take_last();
+        }
+        // Only while more threads are transferring than it was said could be.
+        Scheduler::yield();
+    }
+}
+
+bool VirtIODiskDevice::transfer(dword index, dword count, byte* buffer, bool is_write) const
+{
+    if (!count)
+        return true;
+    if (is_write && m_is_read_only)
+        return false;
+    if ((qword)index + count > m_capacity)
+        return false;
+
+    dword size = count * block_size();
+    // The device goes right to memory by physical address, which is only where it looks to be for the kernel heap.
+    ByteBuffer bounce_buffer;
+    byte* data = buffer;
+    if (!is_kmalloc_address(buffer)) {
+        bounce_buffer = ByteBuffer::create_uninitialized(size);
+        data = bounce_buffer.pointer();
+        if (is_write)
+            memcpy(data, buffer, size);
+    }
+
+    auto& request = take_free_request();
+    request.header.type = is_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    request.header.reserved = 0;
+    request.header.sector = index;
+    request.status = 0xff;
+    request.completed = false;
+
+    VirtQueue::Buffer buffers[3];
+    buffers[0] = { &request.header, sizeof(RequestHeader), false };
+    buffers[1] = { data, size, !is_write };
+    buffers[2] = { &request.status, sizeof(byte), true };
+    {
+        InterruptDisabler disabler;
+        // There are only as many requests as there's room for.
+        bool added = m_queue->add(buffers, 3, &request);
+        ASSERT(added);
+        m_queue->kick();
+    }
+#ifdef VIRTIO_DISK_DEBUG
+    kprintf("VirtIODisk: %s %u sectors @ %u\n", is_write ? "Writing" : "Reading", count, index);
+#endif
+
+    // FIXME: Block the thread instead of polling.
+    while (!request.completed)
+        Scheduler::yield();
+    memory_barrier();
+
+    bool success = request.status == VIRTIO_BLK_S_OK;
+    if (!success)
+        kprintf("VirtIODisk: %s %u sectors @ %u failed with status %b\n", is_write ? "Writing" : "Reading", count, index, request.status);
+    {
+        InterruptDisabler disabler;
+        m_free_requests.append(&request);
+    }
+
+    if (success && !is_write && data != buffer)
+        memcpy(buffer, data, size);
+    return success;
+}
+
+bool VirtIODiskDevice::read_block(unsigned index, byte* out) const
+{
+    return transfer(index, 1, out, false);
+}
+
+bool VirtIODiskDevice::write_block(unsigned index, const byte* data)
+{
+    return transfer(index, 1, const_cast<byte*>(data), true);
+}
+
+bool VirtIODiskDevice::read_blocks(unsigned index, unsigned count, byte* out) const
+{
+    return transfer(index, count, out, false);
+}
+
+bool VirtIODiskDevice::write_blocks(unsigned index, unsigned count, const byte* data)
+{
+    return transfer(index, count, const_cast<byte*>(data), true);
+}
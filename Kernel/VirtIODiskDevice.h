@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Kernel/DiskDevice.h>
+#include <Kernel/IRQHandler.h>
+#include <Kernel/PCI.h>
+#include <Kernel/VirtQueue.h>
+#include <AK/OwnPtr.h>
+#include <AK/RetainPtr.h>
+#include <AK/Vector.h>
+
+// The paravirtualized block device, as QEMU's virtio-blk-pci, in its legacy interface.
+// Every transfer is one request in the queue, and as many as there's room for can be in flight at once,
+// each waiting for the interrupt that says it's done.
+class VirtIODiskDevice final : public IRQHandler, public DiskDevice {
+public:
+    static RetainPtr<VirtIODiskDevice> autodetect();
+    virtual ~VirtIODiskDevice() override;
+
+    // ^DiskDevice
+    virtual unsigned block_size() const override;
+    virtual bool read_block(unsigned index, byte*) const override;
+    virtual bool write_block(unsigned index, const byte*) override;
+    virtual bool read_blocks(unsigned index, unsigned count, byte*) const override;
+    virtual bool write_blocks(unsigned index, unsigned count, const byte*) override;
+
+protected:
+    VirtIODiskDevice(PCI::Address, byte irq);
+
+    // ^DiskDevice
+    virtual int max_concurrent_transfers() const override { return m_request_count; }
+
+private:
+    // ^IRQHandler
+    virtual void handle_irq() override;
+
+    // ^DiskDevice
+    virtual const char* class_name() const override;
+
+    // What goes in front of the data, in a buffer of its own.
+    struct [[gnu::packed]] RequestHeader {
+        dword type { 0 };
+        dword reserved { 0 };
+        qword sector { 0 };
+    };
+
+    struct Request {
+        RequestHeader header;
+        // Written by the device last, once it's done with the data.
+        byte status { 0 };
+        volatile bool completed { false };
+    };
+
+    bool transfer(dword index, dword count, byte* buffer, bool is_write) const;
+    Request& take_free_request() const;
+
+    PCI::Address m_pci_address;
+    word m_io_base { 0 };
+    dword m_features { 0 };
+    qword m_capacity { 0 };
+    bool m_is_read_only { false };
+    mutable OwnPtr<VirtQueue> m_queue;
+    int m_request_count { 0 };
+    mutable Vector<Request*> m_free_requests;
+};
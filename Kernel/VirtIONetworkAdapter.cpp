@@ -0,0 +1,239 @@
+#include <Kernel/VirtIONetworkAdapter.h>
+#include <Kernel/VirtIO.h>
+#include <Kernel/IO.h>
+#include <Kernel/Process.h>
+
+//#define VIRTIO_NET_DEBUG
+
+#define VIRTIO_NET_F_CSUM               (1u << 0)   // It finishes the checksums of what we send
+#define VIRTIO_NET_F_GUEST_CSUM         (1u << 1)   // It says which of what it gives us needs no checking
+#define VIRTIO_NET_F_MAC                (1u << 5)
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM     (1 << 0)
+#define VIRTIO_NET_HDR_F_DATA_VALID     (1 << 1)
+
+#define VIRTIO_NET_CONFIG_MAC           0
+
+#define RX_QUEUE                        0
+#define TX_QUEUE                        1
+
+OwnPtr<VirtIONetworkAdapter> VirtIONetworkAdapter::autodetect()
+{
+    // The transitional network device, which still has the legacy interface.
+    static const PCI::ID virtio_net_id = { 0x1af4, 0x1000 };
+    PCI::Address found_address;
+    PCI::enumerate_all([&] (const PCI::Address& address, PCI::ID id) {
+        if (id == virtio_net_id) {
+            found_address = address;
+            return;
+        }
+    });
+    if (found_address.is_null())
+        return nullptr;
+    byte irq = PCI::get_interrupt_line(found_address);
+    return make<VirtIONetworkAdapter>(found_address, irq);
+}
+
+VirtIONetworkAdapter::VirtIONetworkAdapter(PCI::Address pci_address, byte irq)
+    : NetworkAdapter("virtio")
+    , IRQHandler(irq)
+    , m_pci_address(pci_address)
+{
+    kprintf("VirtIONet: Found at PCI address %b:%b:%b\n", pci_address.bus(), pci_address.slot(), pci_address.function());
+
+    enable_bus_mastering(m_pci_address);
+    m_io_base = PCI::get_BAR0(m_pci_address) & ~3;
+    kprintf("VirtIONet: IO port base: %w\n", m_io_base);
+    kprintf("VirtIONet: Interrupt line: %u\n", irq);
+
+    // Start over, and say there's a driver for it.
+    IO::out8(m_io_base + VIRTIO_PCI_STATUS, 0);
+    IO::out8(m_io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    dword device_features = IO::in32(m_io_base + VIRTIO_PCI_HOST_FEATURES);
+    m_features = device_features & (VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MAC | VIRTIO_RING_F_EVENT_IDX);
+    IO::out32(m_io_base + VIRTIO_PCI_GUEST_FEATURES, m_features);
+    m_has_checksum_offload = m_features & VIRTIO_NET_F_CSUM;
+    kprintf("VirtIONet: Features: %x, using %x\n", device_features, m_features);
+
+    // QEMU always gives it one.
+    ASSERT(m_features & VIRTIO_NET_F_MAC);
+    byte mac[6];
+    for (int i = 0; i < 6; ++i)
+        mac[i] = IO::in8(m_io_base + VIRTIO_PCI_CONFIG + VIRTIO_NET_CONFIG_MAC + i);
+    set_mac_address(mac);
+    kprintf("VirtIONet: MAC address: %s\n", mac_address().to_string().characters());
+
+    bool uses_event_index = m_features & VIRTIO_RING_F_EVENT_IDX;
+    m_rx_queue = make<VirtQueue>(m_io_base, RX_QUEUE, uses_event_index);
+    m_tx_queue = make<VirtQueue>(m_io_base, TX_QUEUE, uses_event_index);
+    ASSERT(m_rx_queue->is_valid() && m_tx_queue->is_valid());
+
+    // Each packet takes two descriptors, one for the header and one for the frame.
+    int rx_buffer_count = m_rx_queue->size() / 2;
+    for (int i = 0; i < rx_buffer_count; ++i)
+        add_receive_buffer(*new ReceiveBuffer);
+    m_rx_queue->kick();
+
+    int tx_slot_count = m_tx_queue->size() / 2;
+    for (int i = 0; i < tx_slot_count; ++i)
+        m_free_tx_slots.append(new TransmitSlot);
+    // What's been sent is taken back as more is sent, so there's no need to hear about it.
+    m_tx_queue->disable_interrupts();
+
+    IO::out8(m_io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    kprintf("VirtIONet: %d rx buffers and %d tx slots, event index %s, checksum offload %s\n",
+        rx_buffer_count,
+        tx_slot_count,
+        uses_event_index ? "on" : "off",
+        m_has_checksum_offload ? "on" : "off");
+
+    enable_irq();
+}
+
+VirtIONetworkAdapter::~VirtIONetworkAdapter()
+{
+}
+
+void VirtIONetworkAdapter::handle_irq()
+{
+    byte status = IO::in8(m_io_base + VIRTIO_PCI_ISR);
+    if (status & VIRTIO_ISR_CONFIG)
+        kprintf("VirtIONet: Configuration changed\n");
+    if (!(status & VIRTIO_ISR_QUEUE))
+        return;
+    reclaim_tx_slots();
+    if (m_rx_queue->has_used() && !wants_poll()) {
+        // Stay quiet about received packets until the network task has caught up with them.
+        m_rx_queue->disable_interrupts();
+        schedule_poll();
+    }
+}
+
+void VirtIONetworkAdapter::add_receive_buffer(ReceiveBuffer& buffer)
+{
+    VirtQueue::Buffer buffers[2];
+    buffers[0] = { &buffer.header, sizeof(Header), true };
+    buffers[1] = { buffer.frame, rx_frame_size, true };
+    bool added = m_rx_queue->add(buffers, 2, &buffer);
+    ASSERT(added);
+}
+
+bool VirtIONetworkAdapter::transmit(PacketBuffer& packet)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (m_free_tx_slots.is_empty())
+        return false;
+    auto* slot = m_free_tx_slots.take_last();
+    slot->header = Header();
+    if (packet.has_offloaded_checksum()) {
+        ASSERT(m_has_checksum_offload);
+        slot->header.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        slot->header.checksum_start = packet.checksum_start();
+        slot->header.checksum_offset = packet.checksum_field() - packet.checksum_start();
+    }
+    slot->packet = packet;
+
+    VirtQueue::Buffer buffers[2];
+    buffers[0] = { &slot->header, sizeof(Header), false };
+    buffers[1] = { packet.data(), (dword)packet.size(), false };
+    // There are only as many slots as there's room for.
+    bool added = m_tx_queue->add(buffers, 2, slot);
+    ASSERT(added);
+    return true;
+}
+
+// Takes back the slots the device is done sending, and fills them with whatever was queued up.
+void VirtIONetworkAdapter::reclaim_tx_slots()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    bool dequeued_any = false;
+    for (;;) {
+        dword written_size;
+        while (auto* slot = (TransmitSlot*)m_tx_queue->take_used(written_size)) {
+            slot->packet = nullptr;
+            m_free_tx_slots.append(slot);
+        }
+        while (!m_tx_backlog.is_empty() && !m_free_tx_slots.is_empty()) {
+            auto packet = m_tx_backlog.take_first();
+            --m_tx_backlog_size;
+            transmit(*packet);
+            dequeued_any = true;
+        }
+        // Only while something is waiting does the device have to say when there's room.
+        if (m_tx_backlog.is_empty()) {
+            m_tx_queue->disable_interrupts();
+            break;
+        }
+        if (m_tx_queue->enable_interrupts())
+            break;
+    }
+    if (dequeued_any) {
+        m_tx_queue->kick();
+        m_tx_queue_alarm.wait_queue().wake_all();
+    }
+}
+
+void VirtIONetworkAdapter::send_raw(PacketBuffer& packet)
+{
+#ifdef VIRTIO_NET_DEBUG
+    kprintf("VirtIONet: Sending packet (%d bytes)\n", packet.size());
+#endif
+    for (;;) {
+        {
+            InterruptDisabler disabler;
+            reclaim_tx_slots();
+            // Going around the backlog would send packets out of order.
+            if (m_tx_backlog.is_empty() && transmit(packet)) {
+                m_tx_queue->kick();
+                return;
+            }
+            if (m_tx_backlog_size < max_queued_tx_packets) {
+                m_tx_backlog.append(packet);
+                ++m_tx_backlog_size;
+                // Has it interrupt once there's room.
+                reclaim_tx_slots();
+                return;
+            }
+        }
+        // Throttle whoever's sending this fast until the device has caught up some.
+        current->snooze_until(m_tx_queue_alarm);
+    }
+}
+
+int VirtIONetworkAdapter::receive_packets(int budget)
+{
+    // The interrupt handler looks at the queue too.
+    InterruptDisabler disabler;
+    int received = 0;
+    while (received < budget) {
+        dword written_size;
+        auto* buffer = (ReceiveBuffer*)m_rx_queue->take_used(written_size);
+        if (!buffer)
+            break;
+        if (written_size > sizeof(Header)) {
+            // It either checked the checksum, or the packet comes from the host itself and never had one to check.
+            bool checksum_verified = buffer->header.flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM);
+#ifdef VIRTIO_NET_DEBUG
+            kprintf("VirtIONet: Received 1 packet @ %p (%u) bytes!\n", buffer->frame, written_size - sizeof(Header));
+#endif
+            did_receive(buffer->frame, written_size - sizeof(Header), checksum_verified);
+        }
+        add_receive_buffer(*buffer);
+        ++received;
+    }
+    // All of them go back to the device at once.
+    if (received)
+        m_rx_queue->kick();
+    return received;
+}
+
+void VirtIONetworkAdapter::enable_receive_interrupts()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (!m_rx_queue->enable_interrupts()) {
+        // Some came in before it could ask, which it won't interrupt about.
+        m_rx_queue->disable_interrupts();
+        schedule_poll();
+    }
+}
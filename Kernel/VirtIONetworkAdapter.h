@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Kernel/NetworkAdapter.h>
+#include <Kernel/PCI.h>
+#include <Kernel/IRQHandler.h>
+#include <Kernel/VirtQueue.h>
+#include <AK/OwnPtr.h>
+#include <AK/SinglyLinkedList.h>
+#include <AK/Vector.h>
+
+// The paravirtualized network device, as QEMU's virtio-net-pci, in its legacy interface.
+// Unlike with an emulated NIC, there's no register to touch for each packet: sending one is filling in
+// descriptors in memory, and the device only needs telling when it's asked to be, see VirtQueue.
+class VirtIONetworkAdapter final : public NetworkAdapter, public IRQHandler {
+public:
+    static OwnPtr<VirtIONetworkAdapter> autodetect();
+
+    VirtIONetworkAdapter(PCI::Address, byte irq);
+    virtual ~VirtIONetworkAdapter() override;
+
+    virtual void send_raw(PacketBuffer&) override;
+    virtual bool can_offload_checksums() const override { return m_has_checksum_offload; }
+
+private:
+    // Rings for senders waiting on a full transmit queue, once there's room again.
+    class TransmitQueueAlarm final : public Alarm {
+    public:
+        explicit TransmitQueueAlarm(VirtIONetworkAdapter& adapter) : m_adapter(adapter) { }
+        virtual bool is_ringing() const override { return m_adapter.m_tx_backlog_size < max_queued_tx_packets; }
+    private:
+        VirtIONetworkAdapter& m_adapter;
+    };
+
+    // What goes in front of every packet, in a buffer of its own.
+    struct [[gnu::packed]] Header {
+        byte flags { 0 };
+        byte gso_type { 0 };
+        word header_length { 0 };
+        word gso_size { 0 };
+        word checksum_start { 0 };
+        word checksum_offset { 0 };
+    };
+
+    // Without mergeable buffers, each has to take the biggest frame there is.
+    static const int rx_frame_size = 1536;
+    static const int max_queued_tx_packets = 64;
+
+    struct ReceiveBuffer {
+        Header header;
+        byte frame[rx_frame_size];
+    };
+
+    // The device reads the packet right out of its buffer, so it's kept alive until the device is done.
+    struct TransmitSlot {
+        Header header;
+        RetainPtr<PacketBuffer> packet;
+    };
+
+    virtual void handle_irq() override;
+    virtual const char* class_name() const override { return "VirtIONetworkAdapter"; }
+    virtual int receive_packets(int budget) override;
+    virtual void enable_receive_interrupts() override;
+
+    void add_receive_buffer(ReceiveBuffer&);
+    bool transmit(PacketBuffer&);
+    void reclaim_tx_slots();
+
+    PCI::Address m_pci_address;
+    word m_io_base { 0 };
+    dword m_features { 0 };
+    bool m_has_checksum_offload { false };
+
+    OwnPtr<VirtQueue> m_rx_queue;
+    OwnPtr<VirtQueue> m_tx_queue;
+    Vector<TransmitSlot*> m_free_tx_slots;
+    // Packets waiting for room in the transmit queue, handed over as the device finishes with the ones before.
+    SinglyLinkedList<Retained<PacketBuffer>> m_tx_backlog;
+    int m_tx_backlog_size { 0 };
+    TransmitQueueAlarm m_tx_queue_alarm { *this };
+};
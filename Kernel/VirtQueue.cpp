@@ -0,0 +1,169 @@
+#include <Kernel/VirtQueue.h>
+#include <Kernel/VirtIO.h>
+#include <Kernel/IO.h>
+#include <Kernel/StdLib.h>
+#include <Kernel/i386.h>
+#include <Kernel/kmalloc.h>
+
+#define VIRTQ_DESC_F_NEXT               (1 << 0)
+#define VIRTQ_DESC_F_WRITE              (1 << 1)
+#define VIRTQ_AVAIL_F_NO_INTERRUPT      (1 << 0)
+#define VIRTQ_USED_F_NO_NOTIFY          (1 << 0)
+
+// The device works on the rings from another CPU. x86 keeps stores in order, and loads, but a load can still
+// go ahead of a store before it, which matters when we say something and then look at what the device said.
+static inline void full_memory_barrier()
+{
+    asm volatile("lock; addl $0, 0(%%esp)" ::: "memory");
+}
+
+static dword align_to_ring(dword size)
+{
+    return (size + VIRTIO_PCI_VRING_ALIGN - 1) & ~(VIRTIO_PCI_VRING_ALIGN - 1);
+}
+
+VirtQueue::VirtQueue(word io_base, word index, bool uses_event_index)
+    : m_io_base(io_base)
+    , m_index(index)
+    , m_uses_event_index(uses_event_index)
+{
+    IO::out16(m_io_base + VIRTIO_PCI_QUEUE_SEL, m_index);
+    m_size = IO::in16(m_io_base + VIRTIO_PCI_QUEUE_NUM);
+    if (!m_size)
+        return;
+
+    // The descriptors and the available ring, then the used ring on a page of its own, all of them one after the other.
+    dword descriptors_size = m_size * sizeof(Descriptor);
+    dword available_size = sizeof(word) * (3 + m_size);
+    dword used_size = sizeof(word) * 3 + m_size * sizeof(UsedElement);
+    dword used_offset = align_to_ring(descriptors_size + available_size);
+    dword memory_size = used_offset + align_to_ring(used_size);
+    m_memory = (byte*)kmalloc_page_aligned(memory_size);
+    memset(m_memory, 0, memory_size);
+    m_descriptors = (volatile Descriptor*)m_memory;
+    m_available = m_memory + descriptors_size;
+    m_used = m_memory + used_offset;
+
+    for (word i = 0; i < m_size; ++i)
+        m_descriptors[i].next = i + 1;
+    m_free_head = 0;
+    m_free_count = m_size;
+    m_tokens.resize(m_size);
+    for (word i = 0; i < m_size; ++i)
+        m_tokens[i] = nullptr;
+
+    IO::out32(m_io_base + VIRTIO_PCI_QUEUE_PFN, (dword)m_memory >> VIRTIO_PCI_QUEUE_ADDR_SHIFT);
+}
+
+VirtQueue::~VirtQueue()
+{
+}
+
+bool VirtQueue::add(const Buffer* buffers, int count, void* token)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(count > 0 && token);
+    if (count > m_free_count)
+        return false;
+
+    word head = m_free_head;
+    word index = head;
+    for (int i = 0;; ++i) {
+        auto& descriptor = m_descriptors[index];
+        descriptor.address = (qword)(dword)buffers[i].data;
+        descriptor.size = buffers[i].size;
+        bool is_last = i == count - 1;
+        descriptor.flags = (buffers[i].is_device_writable ? VIRTQ_DESC_F_WRITE : 0) | (is_last ? 0 : VIRTQ_DESC_F_NEXT);
+        // The free ones are chained together the same way, so the chain is already linked up.
+        if (is_last)
+            break;
+        index = descriptor.next;
+    }
+    m_free_head = m_descriptors[index].next;
+    m_free_count -= count;
+    m_tokens[head] = token;
+
+    // The device won't look at it until kick() moves the index past it.
+    available_ring()[m_available_index % m_size] = head;
+    ++m_available_index;
+    return true;
+}
+
+void VirtQueue::kick()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (m_available_index == m_kicked_index)
+        return;
+    word old_index = m_kicked_index;
+    memory_barrier();
+    available_index() = m_available_index;
+    m_kicked_index = m_available_index;
+    full_memory_barrier();
+
+    bool should_notify;
+    if (m_uses_event_index) {
+        // Only if the index went past the one it asked to hear about.
+        should_notify = (word)(m_available_index - available_event() - 1) < (word)(m_available_index - old_index);
+    } else {
+        should_notify = !(used_flags() & VIRTQ_USED_F_NO_NOTIFY);
+    }
+    if (should_notify)
+        IO::out16(m_io_base + VIRTIO_PCI_QUEUE_NOTIFY, m_index);
+}
+
+bool VirtQueue::has_used() const
+{
+    return m_last_used_index != used_index();
+}
+
+void* VirtQueue::take_used(dword& written_size)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (!has_used())
+        return nullptr;
+    memory_barrier();
+    auto& element = used_ring()[m_last_used_index % m_size];
+    word head = element.id;
+    written_size = element.size;
+    ++m_last_used_index;
+    ASSERT(head < m_size && m_tokens[head]);
+
+    word tail = head;
+    int count = 1;
+    while (m_descriptors[tail].flags & VIRTQ_DESC_F_NEXT) {
+        tail = m_descriptors[tail].next;
+        ++count;
+    }
+    m_descriptors[tail].next = m_free_head;
+    m_free_head = head;
+    m_free_count += count;
+
+    void* token = m_tokens[head];
+    m_tokens[head] = nullptr;
+
+    // With the event index, interrupts stay on only as long as we keep saying how far we've got.
+    if (m_uses_event_index && m_interrupts_enabled) {
+        used_event() = m_last_used_index;
+        full_memory_barrier();
+    }
+    return token;
+}
+
+void VirtQueue::disable_interrupts()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_interrupts_enabled = false;
+    // With the event index the flag means nothing, and the device stops at the used index it was last told.
+    available_flags() = VIRTQ_AVAIL_F_NO_INTERRUPT;
+}
+
+bool VirtQueue::enable_interrupts()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_interrupts_enabled = true;
+    available_flags() = 0;
+    if (m_uses_event_index)
+        used_event() = m_last_used_index;
+    full_memory_barrier();
+    return !has_used();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <AK/Types.h>
+#include <AK/Vector.h>
+
+// A split virtqueue of a legacy virtio PCI device over I/O ports: the descriptor table, the ring of what's
+// available to the device and the ring of what it's done with, in memory the device reads directly.
+// The kernel heap is identity mapped, so buffers are given by their addresses as they are.
+// Everyone touching a queue does so with interrupts disabled.
+class VirtQueue {
+public:
+    struct Buffer {
+        const void* data { nullptr };
+        dword size { 0 };
+        // Whether the device fills it, rather than reading it.
+        bool is_device_writable { false };
+    };
+
+    // Sets up queue |index| of the device at |io_base|, as big as the device says.
+    // |uses_event_index| is whether VIRTIO_RING_F_EVENT_IDX was negotiated.
+    VirtQueue(word io_base, word index, bool uses_event_index);
+    ~VirtQueue();
+
+    bool is_valid() const { return m_size; }
+    word size() const { return m_size; }
+    int free_descriptor_count() const { return m_free_count; }
+
+    // Chains |buffers| together and makes them available to the device, to come back out of take_used()
+    // with |token|, which can't be null. The device isn't told until kick(). Returns false if there's no room.
+    bool add(const Buffer* buffers, int count, void* token);
+    // Lets the device know about everything added since the last time, unless it said it doesn't need to hear.
+    void kick();
+
+    // Takes the next chain the device is done with back, returning its token and how much it wrote to it.
+    void* take_used(dword& written_size);
+    bool has_used() const;
+
+    // Asks the device not to interrupt for chains it's done with, which it can still do now and then.
+    void disable_interrupts();
+    // Asks for an interrupt on the next chain it's done with. Returns false if there already are some
+    // that came in before it could ask, which nobody will be interrupted about.
+    bool enable_interrupts();
+
+private:
+    struct [[gnu::packed]] Descriptor {
+        qword address;
+        dword size;
+        word flags;
+        word next;
+    };
+
+    struct [[gnu::packed]] UsedElement {
+        dword id;
+        dword size;
+    };
+
+    volatile word& available_flags() { return *(volatile word*)m_available; }
+    volatile word& available_index() { return *(volatile word*)(m_available + 2); }
+    volatile word* available_ring() { return (volatile word*)(m_available + 4); }
+    // Where we say which used index to interrupt after, with the event index.
+    volatile word& used_event() { return available_ring()[m_size]; }
+    volatile word& used_flags() { return *(volatile word*)m_used; }
+    const volatile word& used_index() const { return *(const volatile word*)(m_used + 2); }
+    volatile UsedElement* used_ring() { return (volatile UsedElement*)(m_used + 4); }
+    // Where the device says which available index to notify it after, with the event index.
+    volatile word& available_event() { return *(volatile word*)(m_used + 4 + m_size * sizeof(UsedElement)); }
+
+    word m_io_base { 0 };
+    word m_index { 0 };
+    word m_size { 0 };
+    bool m_uses_event_index { false };
+    bool m_interrupts_enabled { true };
+    byte* m_memory { nullptr };
+    volatile Descriptor* m_descriptors { nullptr };
+    byte* m_available { nullptr };
+    byte* m_used { nullptr };
+
+    word m_free_head { 0 };
+    int m_free_count { 0 };
+    // Where we've put up to in the available ring, and where that was when the device was last told.
+    word m_available_index { 0 };
+    word m_kicked_index { 0 };
+    // Where we've taken up to in the used ring.
+    word m_last_used_index { 0 };
+    // By the head descriptor of each chain.
+    Vector<void*> m_tokens;
+};
@@ -7,6 +7,8 @@
 #include <AK/AKString.h>
 
 static byte* s_vga_buffer;
+// The 32 KB of color text memory, which the visible window can be moved around in.
+static const word vga_buffer_rows = 32768 / 160;
 static VirtualConsole* s_consoles[6];
 static int s_active_console;
 
@@ -24,6 +26,9 @@ void VirtualConsole::get_vga_cursor(byte& row, byte& column)
 void VirtualConsole::flush_vga_cursor()
 {
     word value = m_current_vga_start_address + (m_cursor_row * columns() + m_cursor_column);
+    if (value == m_flushed_vga_cursor)
+        return;
+    m_flushed_vga_cursor = value;
     IO::out8(0x3d4, 0x0e);
     IO::out8(0x3d5, MSB(value));
     IO::out8(0x3d4, 0x0f);
@@ -48,6 +53,9 @@ VirtualConsole::VirtualConsole(unsigned index, InitialContents initial_contents)
     // Rightmost column is always last tab on line.
     m_horizontal_tabs[columns() - 1] = 1;
 
+    m_dirty_spans = static_cast<DirtySpan*>(kmalloc(rows() * sizeof(DirtySpan)));
+    memset(m_dirty_spans, 0, rows() * sizeof(DirtySpan));
+
     s_consoles[index] = this;
     m_buffer = (byte*)kmalloc_eternal(rows() * columns() * 2);
     if (initial_contents == AdoptCurrentVGABuffer) {
@@ -64,13 +72,54 @@ VirtualConsole::~VirtualConsole()
 {
     kfree(m_horizontal_tabs);
     m_horizontal_tabs = nullptr;
+    kfree(m_dirty_spans);
+    m_dirty_spans = nullptr;
 }
 
-void VirtualConsole::clear()
+void VirtualConsole::mark_dirty(unsigned row, unsigned start_column, unsigned end_column)
+{
+    auto& span = m_dirty_spans[row];
+    if (span.start >= span.end) {
+        span.start = start_column;
+        span.end = end_column;
+        return;
+    }
+    span.start = min(span.start, (byte)start_column);
+    span.end = max(span.end, (byte)end_column);
+}
+
+void VirtualConsole::mark_all_dirty()
+{
+    for (unsigned row = 0; row < rows(); ++row)
+        m_dirty_spans[row] = { 0, (byte)columns() };
+}
+
+void VirtualConsole::flush_to_vga()
 {
-    word* linemem = m_active ? (word*)s_vga_buffer : (word*)m_buffer;
-    for (word i = 0; i < rows() * columns(); ++i)
+    if (!m_active)
+        return;
+    for (unsigned row = 0; row < rows(); ++row) {
+        auto& span = m_dirty_spans[row];
+        if (span.start >= span.end)
+            continue;
+        memcpy(m_current_vga_window + row * 160 + span.start * 2, buffer_row(row) + span.start * 2, (span.end - span.start) * 2);
+        span = { };
+    }
+    flush_vga_cursor();
+}
+
+void VirtualConsole::clear_row(unsigned row)
+{
+    word* linemem = (word*)buffer_row(row);
+    for (word i = 0; i < columns(); ++i)
         linemem[i] = 0x0720;
+    mark_dirty(row, 0, columns());
+}
+
+void VirtualConsole::clear()
+{
+    for (unsigned row = 0; row < rows(); ++row)
+        clear_row(row);
     if (m_active)
         set_vga_start_row(0);
     set_cursor(0, 0);
@@ -98,15 +147,15 @@ void VirtualConsole::set_active(bool b)
 
     InterruptDisabler disabler;
 
+    // m_buffer always has the contents, so there's nothing to save when going away.
     m_active = b;
-    if (!m_active) {
-        memcpy(m_buffer, m_current_vga_window, rows() * columns() * 2);
+    if (!m_active)
         return;
-    }
 
-    memcpy(s_vga_buffer, m_buffer, rows() * columns() * 2);
     set_vga_start_row(0);
-    flush_vga_cursor();
+    mark_all_dirty();
+    m_flushed_vga_cursor = -1;
+    flush_to_vga();
 
 #if 0
     Keyboard::the().set_client(this);
@@ -346,31 +395,30 @@ void VirtualConsole::execute_escape_sequence(byte final)
     m_intermediates.clear();
 }
 
-void VirtualConsole::clear_vga_row(word row)
+// Moves the visible window down a row in VGA memory, so what's on screen scrolls without being copied.
+void VirtualConsole::scroll_vga_window()
 {
-    word* linemem = (word*)&m_current_vga_window[row * 160];
-    for (word i = 0; i < columns(); ++i)
-        linemem[i] = 0x0720;
+    if (m_vga_start_row + rows() >= vga_buffer_rows) {
+        // Out of room below, start over at the top and copy everything there once.
+        set_vga_start_row(0);
+        mark_all_dirty();
+        return;
+    }
+    set_vga_start_row(m_vga_start_row + 1);
+    // What was dirty moves up along with everything else.
+    for (unsigned row = 0; row < rows() - 1u; ++row)
+        m_dirty_spans[row] = m_dirty_spans[row + 1];
+    m_dirty_spans[rows() - 1] = { };
 }
 
 void VirtualConsole::scroll_up()
 {
     if (m_cursor_row == (rows() - 1)) {
-        if (m_active) {
-            if (m_vga_start_row >= 160) {
-                memcpy(s_vga_buffer, m_current_vga_window + 160, (rows() - 1) * columns() * 2);
-                set_vga_start_row(0);
-                clear_vga_row(24);
-            } else {
-                set_vga_start_row(m_vga_start_row + 1);
-                clear_vga_row(24);
-            }
-        } else {
-            memcpy(m_buffer, m_buffer + 160, 160 * 24);
-            word* linemem = (word*)&m_buffer[24 * 160];
-            for (word i = 0; i < columns(); ++i)
-                linemem[i] = 0x0720;
-        }
+        // The row that goes off the top comes back as the new bottom one.
+        m_buffer_first_row = (m_buffer_first_row + 1) % rows();
+        if (m_active)
+            scroll_vga_window();
+        clear_row(rows() - 1);
     } else {
         ++m_cursor_row;
     }
@@ -383,23 +431,16 @@ void VirtualConsole::set_cursor(unsigned row, unsigned column)
     ASSERT(column < columns());
     m_cursor_row = row;
     m_cursor_column = column;
-    if (m_active)
-        flush_vga_cursor();
 }
 
 void VirtualConsole::put_character_at(unsigned row, unsigned column, byte ch)
 {
     ASSERT(row < rows());
     ASSERT(column < columns());
-    word cur = (row * 160) + (column * 2);
-    if (m_active) {
-        word cur = (row * 160) + (column * 2);
-        m_current_vga_window[cur] = ch;
-        m_current_vga_window[cur + 1] = m_current_attribute;
-    } else {
-        m_buffer[cur] = ch;
-        m_buffer[cur + 1] = m_current_attribute;
-    }
+    byte* cell = buffer_row(row) + column * 2;
+    cell[0] = ch;
+    cell[1] = m_current_attribute;
+    mark_dirty(row, column, column + 1);
 }
 
 void VirtualConsole::on_char(byte ch)
@@ -490,13 +531,15 @@ void VirtualConsole::on_key_pressed(KeyboardDevice::Event key)
     emit(key.character);
 }
 
-void VirtualConsole::on_sysconsole_receive(byte ch)
+void VirtualConsole::on_sysconsole_receive(const byte* data, ssize_t size)
 {
     InterruptDisabler disabler;
     auto old_attribute = m_current_attribute;
     m_current_attribute = 0x03;
-    on_char(ch);
+    for (ssize_t i = 0; i < size; ++i)
+        on_char(data[i]);
     m_current_attribute = old_attribute;
+    flush_to_vga();
 }
 
 ssize_t VirtualConsole::on_tty_write(const byte* data, ssize_t size)
@@ -504,6 +547,7 @@ ssize_t VirtualConsole::on_tty_write(const byte* data, ssize_t size)
     InterruptDisabler disabler;
     for (ssize_t i = 0; i < size; ++i)
         on_char(data[i]);
+    flush_to_vga();
     return size;
 }
 
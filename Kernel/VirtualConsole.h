@@ -20,7 +20,7 @@ private:
     virtual void on_key_pressed(KeyboardDevice::Event) override;
 
     // ^ConsoleImplementation
-    virtual void on_sysconsole_receive(byte) override;
+    virtual void on_sysconsole_receive(const byte*, ssize_t) override;
 
     // ^TTY
     virtual ssize_t on_tty_write(const byte*, ssize_t) override;
@@ -35,13 +35,30 @@ private:
     void get_vga_cursor(byte& row, byte& column);
     void flush_vga_cursor();
 
+    // The screen's contents, whether it's showing or not. The rows are a ring starting at
+    // m_buffer_first_row, so scrolling doesn't move any of them.
     byte* m_buffer;
+    word m_buffer_first_row { 0 };
+    byte* buffer_row(unsigned row) { return m_buffer + ((m_buffer_first_row + row) % rows()) * columns() * 2; }
     unsigned m_index;
     bool m_active { false };
 
+    // What's changed in each row since it was last copied to the (slow) VGA memory, in columns.
+    // Only kept up while active, and copied out at the end of each write.
+    struct DirtySpan {
+        byte start { 0 };
+        byte end { 0 };
+    };
+    DirtySpan* m_dirty_spans { nullptr };
+    void mark_dirty(unsigned row, unsigned start_column, unsigned end_column);
+    void mark_all_dirty();
+    void flush_to_vga();
+
     void scroll_up();
+    void scroll_vga_window();
     void set_cursor(unsigned row, unsigned column);
     void put_character_at(unsigned row, unsigned column, byte ch);
+    void clear_row(unsigned row);
 
     void escape$A(const Vector<unsigned>&);
     void escape$D(const Vector<unsigned>&);
@@ -59,11 +76,12 @@ private:
     byte m_saved_cursor_column { 0 };
     byte m_current_attribute { 0x07 };
 
-    void clear_vga_row(word row);
     void set_vga_start_row(word row);
     word m_vga_start_row { 0 };
     word m_current_vga_start_address { 0 };
     byte* m_current_vga_window { nullptr };
+    // What the VGA cursor was last set to, so it isn't set again for nothing. -1 if unknown.
+    int m_flushed_vga_cursor { -1 };
 
     void execute_escape_sequence(byte final);
 
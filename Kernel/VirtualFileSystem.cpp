@@ -1,7 +1,10 @@
 #include "VirtualFileSystem.h"
 #include "FileDescriptor.h"
 #include "FileSystem.h"
+#include "DiskBackedFileSystem.h"
 #include <AK/FileSystemPath.h>
+#include <AK/FlyString.h>
+#include <AK/InlineLRUCache.h>
 #include <AK/StringBuilder.h>
 #include <AK/kmalloc.h>
 #include <AK/kstdio.h>
@@ -14,6 +17,58 @@
 
 static VFS* s_the;
 
+// The dentry cache remembers Inode::lookup() results, including misses, keyed by (directory, name).
+// Entries are dropped by the VFS operations that change a directory, so it's only used for
+// filesystems that opt in with FS::supports_lookup_caching().
+// Names are interned, so telling keys apart doesn't compare characters.
+struct DentryKey {
+    InodeIdentifier directory;
+    FlyString name;
+
+    bool operator==(const DentryKey& other) const { return directory == other.directory && name == other.name; }
+};
+
+namespace AK {
+
+template<>
+struct Traits<DentryKey> {
+    static unsigned hash(const DentryKey& key) { return pair_int_hash(Traits<InodeIdentifier>::hash(key.directory), key.name.impl() ? key.name.impl()->hash() : 0); }
+    static void dump(const DentryKey& key) { kprintf("[dentry %02u:%08u '%s']", key.directory.fsid(), key.directory.index(), key.name.characters()); }
+};
+
+}
+
+class CachedDentry : public InlineLinkedListNode<CachedDentry> {
+public:
+    CachedDentry(const DentryKey& key, InodeIdentifier inode)
+        : m_key(key)
+        , m_inode(inode)
+    {
+    }
+
+    DentryKey m_key;
+    CachedDentry* m_next { nullptr };
+    CachedDentry* m_prev { nullptr };
+
+    // An invalid identifier records that the name doesn't exist.
+    InodeIdentifier m_inode;
+};
+
+static const unsigned dentry_cache_capacity = 1024;
+
+static Lockable<InlineLRUCache<DentryKey, CachedDentry>>& dentry_cache()
+{
+    static Lockable<InlineLRUCache<DentryKey, CachedDentry>>* s_cache;
+    if (!s_cache) {
+        s_cache = new Lockable<InlineLRUCache<DentryKey, CachedDentry>>;
+        s_cache->resource().set_capacity(dentry_cache_capacity);
+    }
+    return *s_cache;
+}
+
+// Bumped on every invalidation, so a lookup that raced with one doesn't cache what it found.
+static dword s_dentry_cache_generation;
+
 VFS& VFS::the()
 {
     ASSERT(s_the);
@@ -50,8 +105,7 @@ bool VFS::mount(RetainPtr<FS>&& file_system, const String& path)
 
     kprintf("VFS: mounting %s{%p} at %s (inode: %u)\n", file_system->class_name(), file_system.ptr(), path.characters(), inode.index());
     // FIXME: check that this is not already a mount point
-    auto mount = make<Mount>(inode, move(file_system));
-    m_mounts.append(move(mount));
+    add_mount(make<Mount>(inode, move(file_system)));
     return true;
 }
 
@@ -77,26 +131,78 @@ bool VFS::mount_root(RetainPtr<FS>&& file_system)
         m_root_inode->fs().class_name(),
         &m_root_inode->fs());
 
-    m_mounts.append(move(mount));
+    add_mount(move(mount));
     return true;
 }
 
+void VFS::add_mount(OwnPtr<Mount>&& mount)
+{
+    // Keep the first mount over a given host or guest, like the linear scan this replaced.
+    if (!m_mounts_by_host.contains(mount->host()))
+        m_mounts_by_host.set(mount->host(), mount.ptr());
+    if (!m_mounts_by_guest.contains(mount->guest()))
+        m_mounts_by_guest.set(mount->guest(), mount.ptr());
+    m_mounts.append(move(mount));
+
+    // A mount changes what names resolve to in ways the dentry cache can't see, so start over.
+    LOCKER(dentry_cache().lock());
+    dentry_cache().resource().clear();
+    ++s_dentry_cache_generation;
+}
+
 auto VFS::find_mount_for_host(InodeIdentifier inode) -> Mount*
 {
-    for (auto& mount : m_mounts) {
-        if (mount->host() == inode)
-            return mount.ptr();
-    }
-    return nullptr;
+    auto it = m_mounts_by_host.find(inode);
+    if (it == m_mounts_by_host.end())
+        return nullptr;
+    return (*it).value;
 }
 
 auto VFS::find_mount_for_guest(InodeIdentifier inode) -> Mount*
 {
-    for (auto& mount : m_mounts) {
-        if (mount->guest() == inode)
-            return mount.ptr();
+    auto it = m_mounts_by_guest.find(inode);
+    if (it == m_mounts_by_guest.end())
+        return nullptr;
+    return (*it).value;
+}
+
+InodeIdentifier VFS::cached_lookup(Inode& directory, const StringView& name)
+{
+    if (!directory.fs().supports_lookup_caching())
+        return directory.lookup(String(name));
+
+    // Once a name is in the cache, a lookup finds it without making a String.
+    DentryKey key { directory.identifier(), FlyString(name) };
+    dword generation;
+    {
+        LOCKER(dentry_cache().lock());
+        if (auto* dentry = dentry_cache().resource().get(key))
+            return dentry->m_inode;
+        generation = s_dentry_cache_generation;
     }
-    return nullptr;
+
+    auto inode = directory.lookup(key.name.string());
+
+    LOCKER(dentry_cache().lock());
+    if (generation == s_dentry_cache_generation)
+        dentry_cache().resource().put(DentryKey(key), CachedDentry(key, inode));
+    return inode;
+}
+
+void VFS::invalidate_lookup(InodeIdentifier directory, const String& name)
+{
+    LOCKER(dentry_cache().lock());
+    dentry_cache().resource().remove({ directory, name });
+    ++s_dentry_cache_generation;
+}
+
+void VFS::invalidate_lookups_in(InodeIdentifier directory)
+{
+    LOCKER(dentry_cache().lock());
+    dentry_cache().resource().remove_all_matching([directory] (auto& dentry) {
+        return dentry.m_key.directory == directory;
+    });
+    ++s_dentry_cache_generation;
 }
 
 bool VFS::is_vfs_root(InodeIdentifier inode) const
@@ -104,7 +210,7 @@ bool VFS::is_vfs_root(InodeIdentifier inode) const
     return inode == root_inode_id();
 }
 
-void VFS::traverse_directory_inode(Inode& dir_inode, Function<bool(const FS::DirectoryEntry&)> callback)
+void VFS::traverse_directory_inode(Inode& dir_inode, FunctionRef<bool(const FS::DirectoryEntry&)> callback)
 {
     dir_inode.traverse_as_directory([&] (const FS::DirectoryEntry& entry) {
         InodeIdentifier resolved_inode;
@@ -229,6 +335,7 @@ KResultOr<Retained<FileDescriptor>> VFS::create(const String& path, int options,
     dbgprintf("VFS::create_file: '%s' in %u:%u\n", p.basename().characters(), parent_inode->fsid(), parent_inode->index());
     int error;
     auto new_file = parent_inode->fs().create_inode(parent_inode->identifier(), p.basename(), mode, 0, error);
+    invalidate_lookup(parent_inode->identifier(), p.basename());
     if (!new_file)
         return KResult(error);
 
@@ -253,6 +360,7 @@ KResult VFS::mkdir(const String& path, mode_t mode, Inode& base)
     dbgprintf("VFS::mkdir: '%s' in %u:%u\n", p.basename().characters(), parent_inode->fsid(), parent_inode->index());
     int error;
     auto new_dir = parent_inode->fs().create_directory(parent_inode->identifier(), p.basename(), mode, error);
+    invalidate_lookup(parent_inode->identifier(), p.basename());
     if (new_dir)
         return KSuccess;
     return KResult(error);
@@ -385,7 +493,10 @@ KResult VFS::link(const String& old_path, const String& new_path, Inode& base)
     if (!parent_inode->metadata().may_write(current->process()))
         return KResult(-EACCES);
 
-    return parent_inode->add_child(old_inode->identifier(), FileSystemPath(new_path).basename(), 0);
+    auto new_name = FileSystemPath(new_path).basename();
+    auto result = parent_inode->add_child(old_inode->identifier(), new_name, 0);
+    invalidate_lookup(parent_inode->identifier(), new_name);
+    return result;
 }
 
 KResult VFS::unlink(const String& path, Inode& base)
@@ -402,7 +513,10 @@ KResult VFS::unlink(const String& path, Inode& base)
     if (!parent_inode->metadata().may_write(current->process()))
         return KResult(-EACCES);
 
-    return parent_inode->remove_child(FileSystemPath(path).basename());
+    auto name = FileSystemPath(path).basename();
+    auto result = parent_inode->remove_child(name);
+    invalidate_lookup(parent_inode->identifier(), name);
+    return result;
 }
 
 KResult VFS::symlink(const String& target, const String& linkpath, Inode& base)
@@ -422,6 +536,7 @@ KResult VFS::symlink(const String& target, const String& linkpath, Inode& base)
     dbgprintf("VFS::symlink: '%s' (-> '%s') in %u:%u\n", p.basename().characters(), target.characters(), parent_inode->fsid(), parent_inode->index());
     int error;
     auto new_file = parent_inode->fs().create_inode(parent_inode->identifier(), p.basename(), 0120644, 0, error);
+    invalidate_lookup(parent_inode->identifier(), p.basename());
     if (!new_file)
         return KResult(error);
     ssize_t nwritten = new_file->write_bytes(0, target.length(), (const byte*)target.characters(), nullptr);
@@ -453,6 +568,8 @@ KResult VFS::rmdir(const String& path, Inode& base)
     if (inode->directory_entry_count() != 2)
         return KResult(-ENOTEMPTY);
 
+    invalidate_lookups_in(inode->identifier());
+
     auto result = inode->remove_child(".");
     if (result.is_error())
         return result;
@@ -462,7 +579,10 @@ KResult VFS::rmdir(const String& path, Inode& base)
         return result;
 
     // FIXME: The reverse_lookup here can definitely be avoided.
-    return parent_inode->remove_child(parent_inode->reverse_lookup(inode->identifier()));
+    auto name = parent_inode->reverse_lookup(inode->identifier());
+    result = parent_inode->remove_child(name);
+    invalidate_lookup(parent_inode->identifier(), name);
+    return result;
 }
 
 KResultOr<InodeIdentifier> VFS::resolve_symbolic_link(InodeIdentifier base, Inode& symlink_inode)
@@ -536,7 +656,7 @@ KResultOr<InodeIdentifier> VFS::resolve_path(const String& path, InodeIdentifier
     if (path.is_empty())
         return KResult(-EINVAL);
 
-    auto parts = path.split('/');
+    auto parts = path.view().split_view<16>('/');
     InodeIdentifier crumb_id;
 
     if (path[0] == '/')
@@ -562,22 +682,22 @@ KResultOr<InodeIdentifier> VFS::resolve_path(const String& path, InodeIdentifier
         auto metadata = crumb_inode->metadata();
         if (!metadata.is_directory()) {
 #ifdef VFS_DEBUG
-            kprintf("parent of <%s> not directory, it's inode %u:%u / %u:%u, mode: %u, size: %u\n", part.characters(), crumb_id.fsid(), crumb_id.index(), metadata.inode.fsid(), metadata.inode.index(), metadata.mode, metadata.size);
+            kprintf("parent of <%s> not directory, it's inode %u:%u / %u:%u, mode: %u, size: %u\n", String(part).characters(), crumb_id.fsid(), crumb_id.index(), metadata.inode.fsid(), metadata.inode.index(), metadata.mode, metadata.size);
 #endif
             return KResult(-ENOTDIR);
         }
         if (!metadata.may_execute(current->process()))
             return KResult(-EACCES);
         auto parent = crumb_id;
-        crumb_id = crumb_inode->lookup(part);
+        crumb_id = cached_lookup(*crumb_inode, part);
         if (!crumb_id.is_valid()) {
 #ifdef VFS_DEBUG
-            kprintf("child <%s>(%u) not found in directory, %02u:%08u\n", part.characters(), part.length(), parent.fsid(), parent.index());
+            kprintf("child <%s>(%u) not found in directory, %02u:%08u\n", String(part).characters(), part.length(), parent.fsid(), parent.index());
 #endif
             return KResult(-ENOENT);
         }
 #ifdef VFS_DEBUG
-        kprintf("<%s> %u:%u\n", part.characters(), crumb_id.fsid(), crumb_id.index());
+        kprintf("<%s> %u:%u\n", String(part).characters(), crumb_id.fsid(), crumb_id.index());
 #endif
         if (auto mount = find_mount_for_host(crumb_id)) {
 #ifdef VFS_DEBUG
@@ -592,7 +712,7 @@ KResultOr<InodeIdentifier> VFS::resolve_path(const String& path, InodeIdentifier
             auto mount = find_mount_for_guest(crumb_id);
             auto dir_inode = get_inode(mount->host());
             ASSERT(dir_inode);
-            crumb_id = dir_inode->lookup("..");
+            crumb_id = cached_lookup(*dir_inode, "..");
         }
         crumb_inode = get_inode(crumb_id);
         ASSERT(crumb_inode);
@@ -655,7 +775,7 @@ Device* VFS::get_device(unsigned major, unsigned minor)
     return (*it).value;
 }
 
-void VFS::for_each_mount(Function<void(const Mount&)> callback) const
+void VFS::for_each_mount(FunctionRef<void(const Mount&)> callback) const
 {
     for (auto& mount : m_mounts) {
         callback(*mount);
@@ -665,4 +785,5 @@ void VFS::for_each_mount(Function<void(const Mount&)> callback) const
 void VFS::sync()
 {
     FS::sync();
+    DiskBackedFS::flush_dirty_blocks(DiskBackedFS::FlushMode::All);
 }
@@ -21,11 +21,15 @@
 #define O_TRUNC 01000
 #define O_APPEND 02000
 #define O_NONBLOCK 04000
+#define O_DIRECT 040000
 #define O_DIRECTORY 00200000
 #define O_NOFOLLOW 00400000
 #define O_CLOEXEC 02000000
 #define O_NOFOLLOW_NOERROR 0x4000000
 
+#define FALLOC_FL_KEEP_SIZE 0x01
+#define FALLOC_FL_PUNCH_HOLE 0x02
+
 class Device;
 class FileDescriptor;
 
@@ -82,7 +86,7 @@ public:
     void unregister_device(Device&);
 
     size_t mount_count() const { return m_mounts.size(); }
-    void for_each_mount(Function<void(const Mount&)>) const;
+    void for_each_mount(FunctionRef<void(const Mount&)>) const;
 
     KResultOr<String> absolute_path(Inode&);
     KResultOr<String> absolute_path(InodeIdentifier);
@@ -102,7 +106,7 @@ private:
 
     bool is_vfs_root(InodeIdentifier) const;
 
-    void traverse_directory_inode(Inode&, Function<bool(const FS::DirectoryEntry&)>);
+    void traverse_directory_inode(Inode&, FunctionRef<bool(const FS::DirectoryEntry&)>);
     InodeIdentifier old_resolve_path(const String& path, InodeIdentifier base, int& error, int options = 0, InodeIdentifier* parent_id = nullptr);
     KResultOr<InodeIdentifier> resolve_path(const String& path, InodeIdentifier base, int options = 0, InodeIdentifier* parent_id = nullptr);
     KResultOr<Retained<Inode>> resolve_path_to_inode(const String& path, Inode& base, RetainPtr<Inode>* parent_id = nullptr, int options = 0);
@@ -110,9 +114,16 @@ private:
 
     Mount* find_mount_for_host(InodeIdentifier);
     Mount* find_mount_for_guest(InodeIdentifier);
+    void add_mount(OwnPtr<Mount>&&);
+
+    InodeIdentifier cached_lookup(Inode& directory, const StringView& name);
+    void invalidate_lookup(InodeIdentifier directory, const String& name);
+    void invalidate_lookups_in(InodeIdentifier directory);
 
     RetainPtr<Inode> m_root_inode;
     Vector<OwnPtr<Mount>> m_mounts;
+    HashMap<InodeIdentifier, Mount*> m_mounts_by_host;
+    HashMap<InodeIdentifier, Mount*> m_mounts_by_guest;
     HashMap<dword, Device*> m_devices;
 };
 
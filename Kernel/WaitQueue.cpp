@@ -0,0 +1,55 @@
+#include <Kernel/WaitQueue.h>
+#include <Kernel/Process.h>
+
+WaitQueue::~WaitQueue()
+{
+    InterruptDisabler disabler;
+    for (auto* thread : m_threads)
+        thread->did_leave_wait_queue(*this);
+    for (auto* watcher : m_watchers)
+        watcher->wait_queue_did_go_away(*this);
+}
+
+void WaitQueue::add(Thread& thread)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_threads.append(&thread);
+}
+
+void WaitQueue::remove(Thread& thread)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    m_threads.remove_first_matching([&] (auto* entry) { return entry == &thread; });
+}
+
+void WaitQueue::add_watcher(WaitQueueWatcher& watcher)
+{
+    InterruptDisabler disabler;
+    m_watchers.append(&watcher);
+}
+
+void WaitQueue::remove_watcher(WaitQueueWatcher& watcher)
+{
+    InterruptDisabler disabler;
+    m_watchers.remove_first_matching([&] (auto* entry) { return entry == &watcher; });
+}
+
+bool WaitQueue::wake_one()
+{
+    InterruptDisabler disabler;
+    if (m_threads.is_empty())
+        return false;
+    auto* thread = m_threads.take_first();
+    thread->did_leave_wait_queue(*this);
+    thread->wake_from_wait_queue();
+    return true;
+}
+
+void WaitQueue::wake_all()
+{
+    InterruptDisabler disabler;
+    for (auto* thread : m_threads)
+        thread->wake_from_wait_queue();
+    for (auto* watcher : m_watchers)
+        watcher->wait_queue_did_wake(*this);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <AK/Vector.h>
+
+class Thread;
+class WaitQueue;
+
+// Something that wants to hear about a WaitQueue waking up, without a thread sleeping on it (e.g an epoll interest.)
+// Notifications may come from IRQ handlers, so they should be quick.
+class WaitQueueWatcher {
+public:
+    virtual ~WaitQueueWatcher() { }
+    virtual void wait_queue_did_wake(WaitQueue&) = 0;
+    virtual void wait_queue_did_go_away(WaitQueue&) = 0;
+};
+
+// A WaitQueue is owned by something threads can block on (a device, a socket, a FIFO...)
+// Whoever changes its state calls wake_all(), and the scheduler then re-checks only the threads waiting on it.
+class WaitQueue {
+public:
+    WaitQueue() { }
+    ~WaitQueue();
+
+    void add(Thread&);
+    void remove(Thread&);
+    bool is_empty() const { return m_threads.is_empty(); }
+
+    void add_watcher(WaitQueueWatcher&);
+    void remove_watcher(WaitQueueWatcher&);
+
+    // Safe to call from IRQ handlers.
+    void wake_all();
+
+    // Takes the longest waiting thread off the queue and wakes it. Returns false if there was nobody.
+    bool wake_one();
+
+private:
+    WaitQueue(const WaitQueue&) = delete;
+    WaitQueue& operator=(const WaitQueue&) = delete;
+
+    Vector<Thread*> m_threads;
+    Vector<WaitQueueWatcher*> m_watchers;
+};
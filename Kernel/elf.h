@@ -972,6 +972,9 @@ typedef struct
 #define AT_L2_CACHESHAPE	36
 #define AT_L3_CACHESHAPE	37
 
+/* Serenity: Address of the page the kernel keeps the clock in, see Kernel/TimePage.h.  */
+#define AT_TIME_PAGE	0x1000
+
 /* Note section contents.  Each entry in the note section begins with
    a header of a fixed form.  */
 
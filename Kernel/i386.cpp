@@ -5,8 +5,10 @@
 #include "Process.h"
 #include "MemoryManager.h"
 #include "IRQHandler.h"
+#include <Kernel/APIC.h>
 #include "PIC.h"
 #include "Scheduler.h"
+#include "UserCopy.h"
 
 //#define PAGE_FAULT_DEBUG
 
@@ -58,6 +60,53 @@ asm(
     "    iret\n"
 );
 
+// One entry per MSI vector, so the handler knows which it was without asking anything.
+extern "C" void handle_msi(dword index);
+
+#define MSI_ENTRY(index) \
+extern "C" void msi_ ## index ## _entry(); \
+asm( \
+    ".globl msi_" # index "_entry\n" \
+    "msi_" # index "_entry: \n" \
+    "    pusha\n" \
+    "    pushw %ds\n" \
+    "    pushw %es\n" \
+    "    pushw %ss\n" \
+    "    pushw %ss\n" \
+    "    popw %ds\n" \
+    "    popw %es\n" \
+    "    pushl $" # index "\n" \
+    "    call handle_msi\n" \
+    "    addl $4, %esp\n" \
+    "    popw %es\n" \
+    "    popw %ds\n" \
+    "    popa\n" \
+    "    iret\n" \
+);
+
+MSI_ENTRY(0)
+MSI_ENTRY(1)
+MSI_ENTRY(2)
+MSI_ENTRY(3)
+MSI_ENTRY(4)
+MSI_ENTRY(5)
+MSI_ENTRY(6)
+MSI_ENTRY(7)
+MSI_ENTRY(8)
+MSI_ENTRY(9)
+MSI_ENTRY(10)
+MSI_ENTRY(11)
+MSI_ENTRY(12)
+MSI_ENTRY(13)
+MSI_ENTRY(14)
+MSI_ENTRY(15)
+
+static void (*s_msi_entries[MSI_VECTOR_COUNT])() = {
+    msi_0_entry, msi_1_entry, msi_2_entry, msi_3_entry, msi_4_entry, msi_5_entry, msi_6_entry, msi_7_entry,
+    msi_8_entry, msi_9_entry, msi_10_entry, msi_11_entry, msi_12_entry, msi_13_entry, msi_14_entry, msi_15_entry,
+};
+static IRQHandler* s_msi_handlers[MSI_VECTOR_COUNT];
+
 #define EH_ENTRY(ec) \
 extern "C" void exception_ ## ec ## _handler(RegisterDumpWithExceptionCode&); \
 extern "C" void exception_ ## ec ## _entry(); \
@@ -270,8 +319,20 @@ void exception_14_handler(RegisterDumpWithExceptionCode& regs)
     dump(regs);
 #endif
 
+    bool from_userspace = regs.cs & 3;
+    if (from_userspace)
+        current->did_enter_kernel();
+
     auto response = MM.handle_page_fault(PageFault(regs.exception_code, LinearAddress(faultAddress)));
 
+    if (response == PageFaultResponse::ShouldCrash && !from_userspace) {
+        // copy_from_user() and copy_to_user() are allowed to fault, they just stop copying.
+        if (dword fixup = user_copy_fixup_for(regs.eip)) {
+            regs.eip = fixup;
+            return;
+        }
+    }
+
     if (response == PageFaultResponse::ShouldCrash) {
         kprintf("%s(%u:%u) unrecoverable page fault, %s laddr=%p\n",
             current->process().name().characters(),
@@ -285,9 +346,15 @@ void exception_14_handler(RegisterDumpWithExceptionCode& regs)
 #ifdef PAGE_FAULT_DEBUG
         dbgprintf("Continuing after resolved page fault\n");
 #endif
+    } else if (response == PageFaultResponse::OutOfMemory) {
+        // Let the OOM victim die, then the access faults again and hopefully finds some memory.
+        Scheduler::yield();
     } else {
         ASSERT_NOT_REACHED();
     }
+
+    if (from_userspace)
+        current->did_leave_kernel();
 }
 
 #define EH(i, msg) \
@@ -387,6 +454,28 @@ void unregister_irq_handler(byte irq, IRQHandler& handler)
     s_irq_handler[irq] = nullptr;
 }
 
+byte register_msi_handler(IRQHandler& handler)
+{
+    InterruptDisabler disabler;
+    for (int i = 0; i < MSI_VECTOR_COUNT; ++i) {
+        if (s_msi_handlers[i])
+            continue;
+        s_msi_handlers[i] = &handler;
+        register_interrupt_handler(MSI_VECTOR_BASE + i, s_msi_entries[i]);
+        return MSI_VECTOR_BASE + i;
+    }
+    return 0;
+}
+
+void unregister_msi_handler(byte vector, IRQHandler& handler)
+{
+    InterruptDisabler disabler;
+    ASSERT(vector >= MSI_VECTOR_BASE && vector < MSI_VECTOR_BASE + MSI_VECTOR_COUNT);
+    ASSERT(s_msi_handlers[vector - MSI_VECTOR_BASE] == &handler);
+    s_msi_handlers[vector - MSI_VECTOR_BASE] = nullptr;
+    register_interrupt_handler(vector, unimp_trap);
+}
+
 void register_interrupt_handler(byte index, void (*f)())
 {
     s_idt[index].low = 0x00080000 | LSW((f));
@@ -484,6 +573,14 @@ void handle_irq()
     PIC::eoi(irq);
 }
 
+void handle_msi(dword index)
+{
+    // Nobody else can be behind this vector, and there's no PIC to ask or tell.
+    if (auto* handler = s_msi_handlers[index])
+        handler->handle_irq();
+    APIC::eoi();
+}
+
 void __assertion_failed(const char* msg, const char* file, unsigned line, const char* func)
 {
     asm volatile("cli");
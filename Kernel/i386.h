@@ -66,6 +66,10 @@ void register_interrupt_handler(byte number, void (*f)());
 void register_user_callable_interrupt_handler(byte number, void (*f)());
 void register_irq_handler(byte number, IRQHandler&);
 void unregister_irq_handler(byte number, IRQHandler&);
+// Message signaled interrupts each get a vector of their own, there's no sharing and nothing to look up.
+// Returns the vector, or 0 if they're all taken.
+byte register_msi_handler(IRQHandler&);
+void unregister_msi_handler(byte vector, IRQHandler&);
 void flush_idt();
 void flush_gdt();
 void load_task_register(word selector);
@@ -151,6 +155,9 @@ private:
 
 /* Map IRQ0-15 @ ISR 0x50-0x5F */
 #define IRQ_VECTOR_BASE 0x50
+/* And MSIs @ ISR 0x60-0x6F */
+#define MSI_VECTOR_BASE 0x60
+#define MSI_VECTOR_COUNT 16
 
 struct PageFaultFlags {
 enum Flags {
@@ -262,6 +269,27 @@ inline void read_tsc(dword& lsw, dword& msw)
     asm volatile("rdtsc":"=d"(msw),"=a"(lsw));
 }
 
+inline void write_msr(dword msr, dword low, dword high = 0)
+{
+    asm volatile("wrmsr" :: "c"(msr), "a"(low), "d"(high));
+}
+
+inline qword read_msr(dword msr)
+{
+    dword low;
+    dword high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((qword)high << 32) | low;
+}
+
+inline qword read_tsc()
+{
+    dword lsw;
+    dword msw;
+    read_tsc(lsw, msw);
+    return ((qword)msw << 32) | lsw;
+}
+
 struct Stopwatch {
     union SplitQword {
         struct {
@@ -3,6 +3,11 @@
 #include "IO.h"
 #include "PIC.h"
 #include "Scheduler.h"
+#include "system.h"
+#include "MemoryManager.h"
+#include "RTC.h"
+#include <AK/StdLibExtras.h>
+#include <Kernel/TimePage.h>
 
 #define IRQ_TIMER 0
 
@@ -57,16 +62,121 @@ asm(
 
 #define BASE_FREQUENCY     1193182
 
+#define LATCH_COUNT        0x00
+#define READ_BACK_COUNTER0 0xc2
+
+#define STATUS_OUTPUT      0x80
+
+static const word ticks_reload = BASE_FREQUENCY / TICKS_PER_SECOND;
+static const dword max_one_shot_ticks = 0xffff / ticks_reload;
+
 static dword s_ticks_this_second;
 static dword s_seconds_since_boot;
 
-void timer_interrupt_handler(RegisterDump& regs)
+// While tickless, counter 0 counts down once from s_one_shot_counts, and interrupts when it reaches 0.
+static bool s_one_shot;
+static dword s_one_shot_counts;
+// Counts that didn't add up to a whole tick when we last left one-shot mode early.
+static dword s_leftover_counts;
+
+// The page itself is kept retained here as well as by the VMObject, which keeps it from being swapped out.
+static RetainPtr<PhysicalPage> s_time_page_physical_page;
+static RetainPtr<VMObject> s_time_page_vmo;
+static TimePage* s_time_page;
+// Where the TSC was at the last periodic tick, or 0 if the last tick wasn't one.
+static qword s_tsc_at_last_periodic_tick;
+
+static void update_time_page()
 {
-    IRQHandlerScope scope(IRQ_TIMER);
-    if (++s_ticks_this_second >= TICKS_PER_SECOND) {
+    if (!s_time_page)
+        return;
+    auto& page = *s_time_page;
+    ++page.sequence;
+    asm volatile("" ::: "memory");
+    page.uptime = system.uptime;
+    page.seconds = RTC::boot_time() + s_seconds_since_boot;
+    page.microseconds = s_ticks_this_second * (1000000 / TICKS_PER_SECOND);
+    page.tsc = read_tsc();
+    asm volatile("" ::: "memory");
+    ++page.sequence;
+}
+
+// Each periodic tick is a measurement of the TSC's speed. Interrupts can come in late,
+// so each one only moves the estimate an eighth of the way, and the wildly off ones not at all.
+static void calibrate_tsc(qword cycles)
+{
+    auto& page = *s_time_page;
+    dword calibrated = page.tsc_cycles_per_tick;
+    if (calibrated && (cycles > calibrated * 2 || cycles < calibrated / 2))
+        return;
+    calibrated = calibrated ? (calibrated * 7 + (dword)cycles) / 8 : (dword)cycles;
+    if (!calibrated)
+        return;
+    ++page.sequence;
+    asm volatile("" ::: "memory");
+    page.tsc_cycles_per_tick = calibrated;
+    page.tsc_to_microseconds = ((qword)(1000000 / TICKS_PER_SECOND) << 32) / calibrated;
+    asm volatile("" ::: "memory");
+    ++page.sequence;
+}
+
+static void advance(dword ticks)
+{
+    system.uptime += ticks;
+    s_ticks_this_second += ticks;
+    while (s_ticks_this_second >= TICKS_PER_SECOND) {
         // FIXME: Synchronize with the RTC somehow to prevent drifting apart.
         ++s_seconds_since_boot;
-        s_ticks_this_second = 0;
+        s_ticks_this_second -= TICKS_PER_SECOND;
+    }
+    update_time_page();
+}
+
+static void program_counter0(byte mode, word reload)
+{
+    IO::out8(PIT_CTL, TIMER0_SELECT | WRITE_WORD | mode);
+    IO::out8(TIMER0_CTL, LSB(reload));
+    IO::out8(TIMER0_CTL, MSB(reload));
+}
+
+static word read_counter0()
+{
+    IO::out8(PIT_CTL, TIMER0_SELECT | LATCH_COUNT);
+    byte lsb = IO::in8(TIMER0_CTL);
+    byte msb = IO::in8(TIMER0_CTL);
+    return (msb << 8) | lsb;
+}
+
+// How far into the one-shot interval we are. The counter keeps going after it reaches 0,
+// so we ask for the output pin, which stays high from then on, to tell whether it has.
+static dword one_shot_counts_elapsed()
+{
+    IO::out8(PIT_CTL, READ_BACK_COUNTER0);
+    byte status = IO::in8(TIMER0_CTL);
+    byte lsb = IO::in8(TIMER0_CTL);
+    byte msb = IO::in8(TIMER0_CTL);
+    word count = (msb << 8) | lsb;
+    if ((status & STATUS_OUTPUT) || count > s_one_shot_counts)
+        return s_one_shot_counts;
+    return s_one_shot_counts - count;
+}
+
+void timer_interrupt_handler(RegisterDump& regs)
+{
+    IRQHandlerScope scope(IRQ_TIMER);
+    if (s_one_shot) {
+        // NOTE: leave_tickless() accounts for the time spent in one-shot mode.
+        //       We may also get here early, for a periodic tick that was already pending, which it won't know about.
+        if (one_shot_counts_elapsed() < s_one_shot_counts)
+            advance(1);
+        PIT::leave_tickless();
+    } else {
+        advance(1);
+        if (s_time_page) {
+            if (s_tsc_at_last_periodic_tick)
+                calibrate_tsc(s_time_page->tsc - s_tsc_at_last_periodic_tick);
+            s_tsc_at_last_periodic_tick = s_time_page->tsc;
+        }
     }
     Scheduler::timer_tick(regs);
 }
@@ -83,22 +193,76 @@ dword seconds_since_boot()
     return s_seconds_since_boot;
 }
 
-void initialize()
+dword microseconds_since_last_tick()
 {
-    word timer_reload;
+    ASSERT_INTERRUPTS_DISABLED();
+    dword counts;
+    if (s_one_shot)
+        counts = one_shot_counts_elapsed() + s_leftover_counts;
+    else
+        counts = ticks_reload - min(read_counter0(), ticks_reload);
+    return counts * 1000 / ticks_reload;
+}
 
-    IO::out8(PIT_CTL, TIMER0_SELECT | WRITE_WORD | MODE_SQUARE_WAVE);
+bool is_tickless()
+{
+    return s_one_shot;
+}
 
-    timer_reload = (BASE_FREQUENCY / TICKS_PER_SECOND);
+void enter_tickless(dword ticks)
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    ASSERT(!s_one_shot);
+    ticks = min(ticks, max_one_shot_ticks);
+    if (ticks <= 1)
+        return;
+    s_one_shot = true;
+    s_one_shot_counts = ticks * ticks_reload;
+    s_tsc_at_last_periodic_tick = 0;
+    program_counter0(MODE_COUNTDOWN, s_one_shot_counts);
+}
 
-    kprintf("PIT: %u Hz, square wave (%x)\n", TICKS_PER_SECOND, timer_reload);
+void leave_tickless()
+{
+    ASSERT_INTERRUPTS_DISABLED();
+    if (!s_one_shot)
+        return;
+    dword counts = one_shot_counts_elapsed() + s_leftover_counts;
+    s_one_shot = false;
+    program_counter0(MODE_RATE, ticks_reload);
+    s_leftover_counts = counts % ticks_reload;
+    // FIXME: If the one-shot interrupt is already pending, we'll also count it as a periodic tick.
+    advance(counts / ticks_reload);
+}
+
+void initialize()
+{
+    kprintf("PIT: %u Hz, rate generator (%x), tickless idle up to %u ms\n", TICKS_PER_SECOND, ticks_reload, max_one_shot_ticks);
 
-    IO::out8(TIMER0_CTL, LSB(timer_reload));
-    IO::out8(TIMER0_CTL, MSB(timer_reload));
+    program_counter0(MODE_RATE, ticks_reload);
 
     register_interrupt_handler(IRQ_VECTOR_BASE + IRQ_TIMER, timer_interrupt_entry);
 
     PIC::enable(IRQ_TIMER);
+
+    s_time_page_physical_page = MM.allocate_physical_page(MemoryManager::ShouldZeroFill::Yes);
+    ASSERT(s_time_page_physical_page);
+    s_time_page_vmo = VMObject::create_anonymous(PAGE_SIZE);
+    s_time_page_vmo->set_name("TimePage");
+    s_time_page_vmo->physical_pages()[0] = s_time_page_physical_page.copy_ref();
+    InterruptDisabler disabler;
+    s_time_page = (TimePage*)MM.physmap(*s_time_page_physical_page);
+    update_time_page();
+}
+
+VMObject& time_page_vmo()
+{
+    return *s_time_page_vmo;
+}
+
+const TimePage* time_page()
+{
+    return s_time_page;
 }
 
 }
@@ -4,10 +4,25 @@
 
 #define TICKS_PER_SECOND          1000
 
+class VMObject;
+struct TimePage;
+
 namespace PIT {
 
 void initialize();
 dword ticks_this_second();
 dword seconds_since_boot();
+dword microseconds_since_last_tick();
+
+// Tickless idle: instead of ticking, interrupt once after the given number of ticks (or sooner, the PIT can only count so far.)
+// Whoever wakes up first calls leave_tickless(), which catches the clock up and goes back to ticking.
+bool is_tickless();
+void enter_tickless(dword ticks);
+void leave_tickless();
+
+// The page every process gets mapped read-only to read the clock from, see TimePage.h.
+// It's only up to date while ticking periodically.
+VMObject& time_page_vmo();
+const TimePage* time_page();
 
 }
@@ -7,6 +7,8 @@
 #include "system.h"
 #include "PIC.h"
 #include "IDEDiskDevice.h"
+#include <Kernel/VirtIODiskDevice.h>
+#include <Kernel/SwapSpace.h>
 #include "KSyms.h"
 #include <Kernel/NullDevice.h>
 #include <Kernel/ZeroDevice.h>
@@ -22,9 +24,16 @@
 #include "PS2MouseDevice.h"
 #include "PTYMultiplexer.h"
 #include "DevPtsFS.h"
+#include "TmpFS.h"
 #include "BXVGADevice.h"
-#include "E1000NetworkAdapter.h"
 #include <Kernel/NetworkTask.h>
+#include <Kernel/LoopbackAdapter.h>
+#include <Kernel/TCPSocket.h>
+#include <Kernel/MultiProcessor.h>
+#include <Kernel/APIC.h>
+#include <Kernel/Tracing.h>
+#include <Kernel/BootProfile.h>
+#include <AK/StdLibExtras.h>
 
 //#define SPAWN_LAUNCHER
 //#define SPAWN_GUITEST2
@@ -64,6 +73,22 @@ VFS* vfs;
 }
 #endif
 
+// What userland can do without for its first moments. It's done here, alongside starting it, rather than before.
+[[noreturn]] static void init_deferred()
+{
+    // Swap to /swapfile if there is one. It has to be fully allocated, e.g made with dd from /dev/zero.
+    auto swap_result = SwapSpace::activate("/swapfile");
+    if (swap_result.is_error() && swap_result != -ENOENT)
+        kprintf("init_deferred: Couldn't activate /swapfile: %d\n", (int)swap_result);
+    BootProfile::mark("swap");
+
+    load_ksyms();
+    BootProfile::mark("ksyms");
+
+    current->process().sys$exit(0);
+    ASSERT_NOT_REACHED();
+}
+
 [[noreturn]] static void init_stage2()
 {
     Syscall::initialize();
@@ -72,33 +97,44 @@ VFS* vfs;
     auto dev_full = make<FullDevice>();
     auto dev_random = make<RandomDevice>();
     auto dev_ptmx = make<PTYMultiplexer>();
-    auto dev_hd0 = IDEDiskDevice::create();
-    auto e2fs = Ext2FS::create(dev_hd0.copy_ref());
+    // The root file system goes on a virtio disk if the machine was started with one, the IDE disk otherwise.
+    RetainPtr<DiskDevice> dev_hd0 = VirtIODiskDevice::autodetect();
+    if (!dev_hd0)
+        dev_hd0 = IDEDiskDevice::create();
+    BootProfile::mark("disk");
+    auto e2fs = Ext2FS::create(*dev_hd0);
     e2fs->initialize();
 
     vfs->mount_root(e2fs.copy_ref());
+    BootProfile::mark("root file system");
 
-    dbgprintf("Load ksyms\n");
-    load_ksyms();
-    dbgprintf("Loaded ksyms\n");
+    Process::create_kernel_process("init_deferred", init_deferred);
 
+    // These are all in memory and cost next to nothing. WindowServer wants /tmp and /proc right away.
     vfs->mount(ProcFS::the(), "/proc");
     vfs->mount(DevPtsFS::the(), "/dev/pts");
 
+    auto tmpfs = TmpFS::create();
+    tmpfs->initialize();
+    vfs->mount(move(tmpfs), "/tmp");
+    BootProfile::mark("mounts");
+
     int error;
 
-    auto* dns_lookup_server_process = Process::create_user_process("/bin/LookupServer", (uid_t)100, (gid_t)100, (pid_t)0, error, { }, { }, tty0);
+    // WindowServer first, everything else can start while it's getting the screen ready.
+    auto* window_server_process = Process::create_user_process("/bin/WindowServer", (uid_t)100, (gid_t)100, (pid_t)0, error, { }, { }, tty0);
     if (error != 0) {
-        dbgprintf("error spawning LookupServer: %d\n", error);
+        dbgprintf("error spawning WindowServer: %d\n", error);
         hang();
     }
+    window_server_process->set_priority(Process::HighPriority);
+    BootProfile::mark("spawn WindowServer");
 
-    auto* window_server_process = Process::create_user_process("/bin/WindowServer", (uid_t)100, (gid_t)100, (pid_t)0, error, { }, { }, tty0);
+    Process::create_user_process("/bin/LookupServer", (uid_t)100, (gid_t)100, (pid_t)0, error, { }, { }, tty0);
     if (error != 0) {
-        dbgprintf("error spawning WindowServer: %d\n", error);
+        dbgprintf("error spawning LookupServer: %d\n", error);
         hang();
     }
-    window_server_process->set_priority(Process::HighPriority);
     //Process::create_user_process("/bin/sh", (uid_t)100, (gid_t)100, (pid_t)0, error, { }, move(environment), tty0);
     Process::create_user_process("/bin/Terminal", (uid_t)100, (gid_t)100, (pid_t)0, error, { }, { }, tty0);
 #ifdef SPAWN_GUITEST2
@@ -131,6 +167,7 @@ VFS* vfs;
 #ifdef STRESS_TEST_SPAWNING
     Process::create_kernel_process("spawn_stress", spawn_stress);
 #endif
+    BootProfile::mark("spawn userland");
 
     current->process().sys$exit(0);
     ASSERT_NOT_REACHED();
@@ -141,6 +178,7 @@ VFS* vfs;
     cli();
 
     sse_init();
+    detect_cpu_features();
 
     kmalloc_init();
     init_ksyms();
@@ -168,24 +206,41 @@ VFS* vfs;
     kprintf("Starting Serenity Operating System...\n");
 
     MemoryManager::initialize();
+    MultiProcessor::detect();
+    APIC::initialize();
     PIT::initialize();
+    BootProfile::mark("memory and timer");
 
     new BXVGADevice;
 
-    auto e1000 = E1000NetworkAdapter::autodetect();
+    // The network adapters are looked for by NetworkTask, off the way of everything else.
+    LoopbackAdapter::the();
 
     Retained<ProcFS> new_procfs = ProcFS::create();
     new_procfs->initialize();
+    Tracing::initialize();
 
     auto devptsfs = DevPtsFS::create();
     devptsfs->initialize();
 
+    BootProfile::mark("devices");
+
     Process::initialize();
     Thread::initialize();
     Process::create_kernel_process("init_stage2", init_stage2);
     Process::create_kernel_process("syncd", [] {
         for (;;) {
-            Syscall::sync();
+            // Write back inode metadata and allocation state, and any cached blocks that have been dirty for a while.
+            FS::sync();
+            DiskBackedFS::flush_dirty_blocks(DiskBackedFS::FlushMode::Expired);
+            current->sleep(1 * TICKS_PER_SECOND);
+        }
+    });
+    Process::create_kernel_process("reclaimd", [] {
+        MM.set_reclaimer(*current);
+        for (;;) {
+            // Shrink the caches while there's still room to breathe, rather than on the allocation path.
+            MM.reclaim_to_watermarks();
             current->sleep(1 * TICKS_PER_SECOND);
         }
     });
@@ -199,6 +254,7 @@ VFS* vfs;
         }
     });
     Process::create_kernel_process("NetworkTask", NetworkTask_main);
+    Process::create_kernel_process("TCPTimerTask", TCPSocket::timer_task_main);
 
     Scheduler::pick_next();
 
@@ -206,6 +262,15 @@ VFS* vfs;
 
     // This now becomes the idle process :^)
     for (;;) {
+        // Nobody else wants the CPU, get some pages zeroed ahead of the page faults that will want them.
+        if (MM.prezero_one_page()) {
+            if (Scheduler::has_woken_threads())
+                Scheduler::yield();
+            continue;
+        }
         asm("hlt");
+        // An IRQ may have woken someone up, let them run now instead of on the next timer tick.
+        if (Scheduler::has_woken_threads())
+            Scheduler::yield();
     }
 }
@@ -10,7 +10,9 @@
 #include "system.h"
 #include "Process.h"
 #include "Scheduler.h"
+#include "MemoryManager.h"
 #include <AK/Assertions.h>
+#include <AK/Bitmap.h>
 
 #define SANITIZE_KMALLOC
 
@@ -28,7 +30,37 @@ struct [[gnu::packed]] allocation_t {
 #define BASE_PHYSICAL 0x200000
 #define RANGE_SIZE 0x100000
 
-static byte alloc_map[POOL_SIZE / CHUNK_SIZE / 8];
+// The top of the pool is handed out page by page to the slab size classes,
+// the rest is managed by the chunk bitmap and serves larger allocations.
+#define SLAB_PAGE_SIZE 4096
+#define SLAB_POOL_SIZE (256 * 1024)
+#define CHUNK_POOL_SIZE (POOL_SIZE - SLAB_POOL_SIZE)
+#define SLAB_BASE_PHYSICAL (BASE_PHYSICAL + CHUNK_POOL_SIZE)
+
+static byte alloc_map[CHUNK_POOL_SIZE / CHUNK_SIZE / 8];
+
+static Bitmap alloc_bitmap()
+{
+    return Bitmap::wrap(alloc_map, CHUNK_POOL_SIZE / CHUNK_SIZE);
+}
+
+struct SlabFreeEntry {
+    SlabFreeEntry* next;
+};
+
+struct SlabClass {
+    size_t object_size;
+    SlabFreeEntry* freelist { nullptr };
+    size_t page_count { 0 };
+    size_t objects_in_use { 0 };
+};
+
+static SlabClass s_slab_classes[] = { { 16 }, { 32 }, { 64 }, { 128 }, { 256 }, { 512 } };
+static const size_t s_slab_class_count = sizeof(s_slab_classes) / sizeof(SlabClass);
+
+// Size class index + 1 for every page in the slab pool, 0 if the page hasn't been handed out yet.
+static byte s_slab_page_class[SLAB_POOL_SIZE / SLAB_PAGE_SIZE];
+static size_t s_next_free_slab_page;
 
 volatile size_t sum_alloc = 0;
 volatile size_t sum_free = POOL_SIZE;
@@ -44,10 +76,91 @@ bool is_kmalloc_address(const void* ptr)
     return (size_t)ptr >= BASE_PHYSICAL && (size_t)ptr <= (BASE_PHYSICAL + POOL_SIZE);
 }
 
+static inline bool is_slab_address(const void* ptr)
+{
+    return (size_t)ptr >= SLAB_BASE_PHYSICAL && (size_t)ptr < (SLAB_BASE_PHYSICAL + SLAB_POOL_SIZE);
+}
+
+static inline SlabClass* slab_class_for_size(size_t size)
+{
+    for (size_t i = 0; i < s_slab_class_count; ++i) {
+        if (size <= s_slab_classes[i].object_size)
+            return &s_slab_classes[i];
+    }
+    return nullptr;
+}
+
+static bool grow_slab_class(SlabClass& slab_class)
+{
+    if (s_next_free_slab_page >= SLAB_POOL_SIZE / SLAB_PAGE_SIZE)
+        return false;
+    size_t page_index = s_next_free_slab_page++;
+    s_slab_page_class[page_index] = (&slab_class - s_slab_classes) + 1;
+    ++slab_class.page_count;
+
+    byte* page = (byte*)(SLAB_BASE_PHYSICAL + page_index * SLAB_PAGE_SIZE);
+    for (size_t offset = 0; offset + slab_class.object_size <= SLAB_PAGE_SIZE; offset += slab_class.object_size) {
+        auto* entry = (SlabFreeEntry*)(page + offset);
+        entry->next = slab_class.freelist;
+        slab_class.freelist = entry;
+    }
+    return true;
+}
+
+static void* slab_alloc(SlabClass& slab_class)
+{
+    if (!slab_class.freelist && !grow_slab_class(slab_class))
+        return nullptr;
+    auto* entry = slab_class.freelist;
+    slab_class.freelist = entry->next;
+    ++slab_class.objects_in_use;
+    sum_alloc += slab_class.object_size;
+    sum_free -= slab_class.object_size;
+#ifdef SANITIZE_KMALLOC
+    memset(entry, 0xbb, slab_class.object_size);
+#endif
+    return entry;
+}
+
+static void slab_dealloc(void* ptr)
+{
+    size_t page_index = ((size_t)ptr - SLAB_BASE_PHYSICAL) / SLAB_PAGE_SIZE;
+    ASSERT(s_slab_page_class[page_index]);
+    auto& slab_class = s_slab_classes[s_slab_page_class[page_index] - 1];
+#ifdef SANITIZE_KMALLOC
+    memset(ptr, 0xaa, slab_class.object_size);
+#endif
+    auto* entry = (SlabFreeEntry*)ptr;
+    entry->next = slab_class.freelist;
+    slab_class.freelist = entry;
+    --slab_class.objects_in_use;
+    sum_alloc -= slab_class.object_size;
+    sum_free += slab_class.object_size;
+}
+
+bool kmalloc_slab_stats(size_t index, KmallocSlabStats& stats)
+{
+    if (index >= s_slab_class_count)
+        return false;
+    InterruptDisabler disabler;
+    auto& slab_class = s_slab_classes[index];
+    stats.object_size = slab_class.object_size;
+    stats.page_count = slab_class.page_count;
+    stats.objects_in_use = slab_class.objects_in_use;
+    return true;
+}
+
 void kmalloc_init()
 {
     memset(&alloc_map, 0, sizeof(alloc_map));
     memset((void *)BASE_PHYSICAL, 0, POOL_SIZE);
+    memset(&s_slab_page_class, 0, sizeof(s_slab_page_class));
+    for (size_t i = 0; i < s_slab_class_count; ++i) {
+        s_slab_classes[i].freelist = nullptr;
+        s_slab_classes[i].page_count = 0;
+        s_slab_classes[i].objects_in_use = 0;
+    }
+    s_next_free_slab_page = 0;
 
     kmalloc_sum_eternal = 0;
     sum_alloc = 0;
@@ -93,13 +206,21 @@ void* kmalloc_impl(size_t size)
 {
     InterruptDisabler disabler;
 
-    size_t chunks_needed, chunks_here, first_chunk;
+    if (auto* slab_class = slab_class_for_size(size)) {
+        if (auto* ptr = slab_alloc(*slab_class))
+            return ptr;
+        // The slab pool is exhausted, fall back to the chunk pool.
+    }
+
+    size_t chunks_needed;
     size_t real_size;
-    size_t i, j, k;
 
     /* We need space for the allocation_t structure at the head of the block. */
     real_size = size + sizeof(allocation_t);
 
+    if (sum_free < POOL_SIZE / 8)
+        MemoryManager::kmalloc_is_running_low();
+
     if (sum_free < real_size) {
         kprintf("%s<%u> kmalloc(): PANIC! Out of memory (sucks, dude)\nsum_free=%u, real_size=%u\n", current->process().name().characters(), current->pid(), sum_free, real_size);
         hang();
@@ -109,56 +230,23 @@ void* kmalloc_impl(size_t size)
     if( real_size % CHUNK_SIZE )
         chunks_needed++;
 
-    chunks_here = 0;
-    first_chunk = 0;
-
-    for( i = 0; i < (POOL_SIZE / CHUNK_SIZE / 8); ++i )
-    {
-        if (alloc_map[i] == 0xff) {
-            // Skip over completely full bucket.
-            chunks_here = 0;
-            continue;
-        }
-        // FIXME: This scan can be optimized further with LZCNT.
-        for( j = 0; j < 8; ++j )
-        {
-            if( !(alloc_map[i] & (1<<j)) )
-            {
-                if( chunks_here == 0 )
-                {
-                    /* Mark where potential allocation starts. */
-                    first_chunk = i * 8 + j;
-                }
-
-                chunks_here++;
-
-                if( chunks_here == chunks_needed )
-                {
-                    auto* a = (allocation_t *)(BASE_PHYSICAL + (first_chunk * CHUNK_SIZE));
-                    byte *ptr = (byte *)a;
-                    ptr += sizeof(allocation_t);
-                    a->nchunk = chunks_needed;
-                    a->start = first_chunk;
-
-                    for( k = first_chunk; k < (first_chunk + chunks_needed); ++k )
-                    {
-                        alloc_map[k / 8] |= 1 << (k % 8);
-                    }
-
-                    sum_alloc += a->nchunk * CHUNK_SIZE;
-                    sum_free  -= a->nchunk * CHUNK_SIZE;
+    auto bitmap = alloc_bitmap();
+    int first_chunk = bitmap.find_first_unset_run(chunks_needed);
+    if (first_chunk >= 0) {
+        auto* a = (allocation_t *)(BASE_PHYSICAL + (first_chunk * CHUNK_SIZE));
+        byte *ptr = (byte *)a;
+        ptr += sizeof(allocation_t);
+        a->nchunk = chunks_needed;
+        a->start = first_chunk;
+
+        bitmap.set_range(first_chunk, chunks_needed, true);
+
+        sum_alloc += a->nchunk * CHUNK_SIZE;
+        sum_free  -= a->nchunk * CHUNK_SIZE;
 #ifdef SANITIZE_KMALLOC
-                    memset(ptr, 0xbb, (a->nchunk * CHUNK_SIZE) - sizeof(allocation_t));
+        memset(ptr, 0xbb, (a->nchunk * CHUNK_SIZE) - sizeof(allocation_t));
 #endif
-                    return ptr;
-                }
-            }
-            else
-            {
-                /* This is in use, so restart chunks_here counter. */
-                chunks_here = 0;
-            }
-        }
+        return ptr;
     }
 
     kprintf("%s<%u> kmalloc(): PANIC! Out of memory (no suitable block for size %u)\n", current->process().name().characters(), current->pid(), size);
@@ -172,10 +260,14 @@ void kfree(void *ptr)
 
     InterruptDisabler disabler;
 
+    if (is_slab_address(ptr)) {
+        slab_dealloc(ptr);
+        return;
+    }
+
     allocation_t *a = (allocation_t *)((((byte *)ptr) - sizeof(allocation_t)));
 
-    for (size_t k = a->start; k < (a->start + a->nchunk); ++k)
-        alloc_map[k / 8] &= ~(1 << (k % 8));
+    alloc_bitmap().set_range(a->start, a->nchunk, false);
 
     sum_alloc -= a->nchunk * CHUNK_SIZE;
     sum_free  += a->nchunk * CHUNK_SIZE;
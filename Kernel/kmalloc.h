@@ -14,6 +14,13 @@ void kfree_aligned(void*);
 
 bool is_kmalloc_address(const void*);
 
+struct KmallocSlabStats {
+    size_t object_size;
+    size_t page_count;
+    size_t objects_in_use;
+};
+bool kmalloc_slab_stats(size_t index, KmallocSlabStats&);
+
 extern volatile size_t sum_alloc;
 extern volatile size_t sum_free;
 extern volatile size_t kmalloc_sum_eternal;
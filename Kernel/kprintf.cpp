@@ -6,49 +6,53 @@
 #include <AK/Types.h>
 #include <AK/printf.cpp>
 
-static void console_putch(char*&, char ch)
+static void debugger_write(const char* characters, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+        IO::out8(0xe9, characters[i]);
+}
+
+static void console_write(char*&, const char* characters, size_t length)
 {
     if (!current) {
-        IO::out8(0xe9, ch);
+        debugger_write(characters, length);
         return;
     }
-    Console::the().write(current->process(), (byte*)&ch, 1);
+    Console::the().write(current->process(), (const byte*)characters, length);
 }
 
 int kprintf(const char* fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    int ret = printf_internal(console_putch, nullptr, fmt, ap);
+    int ret = printf_chunked(console_write, nullptr, fmt, ap);
     va_end(ap);
     return ret;
 }
 
-static void buffer_putch(char*& bufptr, char ch)
+static void buffer_write(char*& bufptr, const char* characters, size_t length)
 {
-    *bufptr++ = ch;
+    memcpy(bufptr, characters, length);
+    bufptr += length;
 }
 
 int ksprintf(char* buffer, const char* fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    int ret = printf_internal(buffer_putch, buffer, fmt, ap);
+    int ret = printf_chunked(buffer_write, buffer, fmt, ap);
     buffer[ret] = '\0';
     va_end(ap);
     return ret;
 }
 
-static void debugger_putch(char*&, char ch)
-{
-    IO::out8(0xe9, ch);
-}
-
 extern "C" int dbgprintf(const char* fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    int ret = printf_internal(debugger_putch, nullptr, fmt, ap);
+    int ret = printf_chunked([] (char*&, const char* characters, size_t length) {
+        debugger_write(characters, length);
+    }, nullptr, fmt, ap);
     va_end(ap);
     return ret;
 }
@@ -1,6 +1,39 @@
 #!/bin/sh
-tmp=$(mktemp)
-nm -nC kernel | uniq > $tmp
-printf "%08x\n" $(wc -l $tmp | cut -f1 -d' ') > kernel.map
-cat $tmp >> kernel.map
-rm -f $tmp
+# kernel.map is laid out so the kernel can use it as it is, without parsing anything (all little-endian):
+#     dword count
+#     count * { dword address, dword offset of the name from the end of this array }, sorted by address
+#     the names, each followed by a NUL
+# nm -n already sorts by address. awk spells every byte out as an escape, and printf %b turns them into bytes.
+nm -nC kernel | uniq | LC_ALL=C awk '
+function hex_byte(text, position) {
+    return digits[substr(text, position, 1)] * 16 + digits[substr(text, position + 1, 1)]
+}
+function address_bytes(address) {
+    return sprintf("\\0%03o\\0%03o\\0%03o\\0%03o", hex_byte(address, 7), hex_byte(address, 5), hex_byte(address, 3), hex_byte(address, 1))
+}
+function dword_bytes(value) {
+    return sprintf("\\0%03o\\0%03o\\0%03o\\0%03o", value % 256, int(value / 256) % 256, int(value / 65536) % 256, int(value / 16777216))
+}
+BEGIN {
+    for (i = 0; i < 16; ++i)
+        digits[substr("0123456789abcdef", i + 1, 1)] = i
+}
+# Undefined weak symbols have no address, skip them.
+/^[0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f][0-9a-f] / {
+    name = substr($0, 12)
+    addresses[count] = substr($0, 1, 8)
+    offsets[count] = names_size
+    names_size += length(name) + 1
+    gsub(/\\/, "\\\\", name)
+    names[count] = name
+    ++count
+}
+END {
+    printf "%s", dword_bytes(count)
+    for (i = 0; i < count; ++i)
+        printf "%s%s", address_bytes(addresses[i]), dword_bytes(offsets[i])
+    for (i = 0; i < count; ++i)
+        printf "%s\\0000", names[i]
+}' > kernel.map.escaped
+printf '%b' "$(cat kernel.map.escaped)" > kernel.map
+rm -f kernel.map.escaped
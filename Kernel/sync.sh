@@ -35,6 +35,7 @@ cp -vR ../Base/* mnt/
 cp -vR ../Root/* mnt/
 mkdir mnt/home/anon
 mkdir mnt/home/nona
+cp -v ../LibGUI/shared/libgui.so mnt/usr/lib/
 cp ../ReadMe.md mnt/home/anon/
 chown -vR 100:100 mnt/home/anon
 chown -vR 200:200 mnt/home/nona
@@ -79,6 +80,7 @@ cp -v ../Userland/uc mnt/bin/uc
 cp -v ../Userland/tc mnt/bin/tc
 cp -v ../Userland/host mnt/bin/host
 cp -v ../Userland/qs mnt/bin/qs
+cp -v ../Userland/taskset mnt/bin/taskset
 chmod 4755 mnt/bin/su
 cp -v ../Applications/Terminal/Terminal mnt/bin/Terminal
 cp -v ../Applications/FontEditor/FontEditor mnt/bin/FontEditor
@@ -14,6 +14,17 @@ RetainPtr<SharedBuffer> SharedBuffer::create(pid_t peer, int size)
     return adopt(*new SharedBuffer(shared_buffer_id, size, data));
 }
 
+RetainPtr<SharedBuffer> SharedBuffer::create_sealed(pid_t peer, const void* data, int size)
+{
+    void* buffer;
+    int shared_buffer_id = create_sealed_shared_buffer(peer, data, size, &buffer);
+    if (shared_buffer_id < 0) {
+        perror("create_sealed_shared_buffer");
+        return nullptr;
+    }
+    return adopt(*new SharedBuffer(shared_buffer_id, size, buffer));
+}
+
 RetainPtr<SharedBuffer> SharedBuffer::create_from_shared_buffer_id(int shared_buffer_id)
 {
     void* data = get_shared_buffer(shared_buffer_id);
@@ -54,3 +65,13 @@ void SharedBuffer::seal()
         exit(1);
     }
 }
+
+bool SharedBuffer::share_with(pid_t peer)
+{
+    int rc = share_buffer_with(m_shared_buffer_id, peer);
+    if (rc < 0) {
+        perror("share_buffer_with");
+        return false;
+    }
+    return true;
+}
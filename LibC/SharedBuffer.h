@@ -6,11 +6,15 @@
 class SharedBuffer : public Retainable<SharedBuffer> {
 public:
     static RetainPtr<SharedBuffer> create(pid_t peer, int);
+    // Creates it already filled in with a copy of the data, and sealed, all in one system call.
+    static RetainPtr<SharedBuffer> create_sealed(pid_t peer, const void* data, int size);
     static RetainPtr<SharedBuffer> create_from_shared_buffer_id(int);
     ~SharedBuffer();
 
     int shared_buffer_id() const { return m_shared_buffer_id; }
     void seal();
+    // Lets another process get at it too (read-only), from the same ID.
+    bool share_with(pid_t peer);
     int size() const { return m_size; }
     void* data() { return m_data; }
     const void* data() const { return m_data; }
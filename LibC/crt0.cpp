@@ -1,6 +1,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <AK/StdLibExtras.h>
+#include <Kernel/elf.h>
+#include <Kernel/TimePage.h>
 
 extern "C" {
 
@@ -12,6 +15,9 @@ char** environ;
 
 void __libc_init()
 {
+    // Before anything has a chance to call memcpy().
+    detect_cpu_features();
+
     void __malloc_init();
     __malloc_init();
 
@@ -22,6 +28,16 @@ void __libc_init()
 int _start(int argc, char** argv, char** env)
 {
     environ = env;
+
+    // The kernel puts the auxiliary vector right after the environment.
+    extern const TimePage* __time_page;
+    char** env_end = env;
+    while (*env_end)
+        ++env_end;
+    for (auto* auxv = (const Elf32_auxv_t*)(env_end + 1); auxv->a_type != AT_NULL; ++auxv) {
+        if (auxv->a_type == AT_TIME_PAGE)
+            __time_page = (const TimePage*)auxv->a_un.a_val;
+    }
     //__environ_is_malloced = false;
 
     __libc_init();
@@ -22,6 +22,7 @@ DIR* opendir(const char* name)
     dirp->buffer = nullptr;
     dirp->buffer_size = 0;
     dirp->nextptr = nullptr;
+    dirp->buffer_has_stat = 0;
     return dirp;
 }
 
@@ -56,6 +57,11 @@ dirent* readdir(DIR* dirp)
     if (dirp->fd == -1)
         return nullptr;
 
+    if (dirp->buffer_has_stat) {
+        struct stat st;
+        return readdir_with_stat(dirp, &st);
+    }
+
     if (!dirp->buffer) {
         struct stat st;
         int rc = fstat(dirp->fd, &st);
@@ -85,5 +91,63 @@ dirent* readdir(DIR* dirp)
     return &dirp->cur_ent;
 }
 
+struct [[gnu::packed]] sys_dirent_with_stat {
+    struct stat st;
+    byte file_type;
+    size_t namelen;
+    char name[];
+    size_t total_size()
+    {
+        return sizeof(struct stat) + sizeof(byte) + sizeof(size_t) + sizeof(char) * namelen;
+    }
+};
+
+static const size_t dir_entries_with_stat_buffer_size = 16384;
+
+dirent* readdir_with_stat(DIR* dirp, struct stat* statbuf)
+{
+    if (!dirp || dirp->fd == -1) {
+        errno = EBADF;
+        return nullptr;
+    }
+
+    if (dirp->buffer && !dirp->buffer_has_stat) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    if (!dirp->buffer) {
+        dirp->buffer = (char*)malloc(dir_entries_with_stat_buffer_size);
+        dirp->buffer_has_stat = 1;
+        dirp->buffer_size = 0;
+        dirp->nextptr = dirp->buffer;
+    }
+
+    if (dirp->nextptr >= (dirp->buffer + dirp->buffer_size)) {
+        int nread = syscall(SC_get_dir_entries_with_stat, dirp->fd, dirp->buffer, dir_entries_with_stat_buffer_size);
+        if (nread < 0) {
+            errno = -nread;
+            return nullptr;
+        }
+        dirp->buffer_size = nread;
+        dirp->nextptr = dirp->buffer;
+        if (!nread)
+            return nullptr;
+    }
+
+    auto* sys_ent = (sys_dirent_with_stat*)dirp->nextptr;
+    memcpy(statbuf, &sys_ent->st, sizeof(struct stat));
+    dirp->cur_ent.d_ino = sys_ent->st.st_ino;
+    dirp->cur_ent.d_type = sys_ent->file_type;
+    dirp->cur_ent.d_off = 0;
+    dirp->cur_ent.d_reclen = sys_ent->total_size();
+    for (size_t i = 0; i < sys_ent->namelen; ++i)
+        dirp->cur_ent.d_name[i] = sys_ent->name[i];
+    dirp->cur_ent.d_name[sys_ent->namelen] = '\0';
+
+    dirp->nextptr += sys_ent->total_size();
+    return &dirp->cur_ent;
+}
+
 }
 
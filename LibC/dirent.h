@@ -19,12 +19,19 @@ struct __DIR {
     char* buffer;
     size_t buffer_size;
     char* nextptr;
+    int buffer_has_stat;
 };
 typedef struct __DIR DIR;
 
+struct stat;
+
 DIR* opendir(const char* name);
 int closedir(DIR*);
 struct dirent* readdir(DIR*);
 
+// Like readdir(), but also fills in what lstat() would say about the entry,
+// fetching entries and their metadata in batches. Don't mix with readdir() on the same DIR.
+struct dirent* readdir_with_stat(DIR*, struct stat*);
+
 __END_DECLS
 
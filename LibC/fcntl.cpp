@@ -15,4 +15,18 @@ int fcntl(int fd, int cmd, ...)
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
+int fallocate(int fd, int mode, off_t offset, off_t length)
+{
+    Syscall::SC_fallocate_params params { fd, mode, offset, length };
+    int rc = syscall(SC_fallocate, &params);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int posix_fallocate(int fd, off_t offset, off_t length)
+{
+    Syscall::SC_fallocate_params params { fd, 0, offset, length };
+    int rc = syscall(SC_fallocate, &params);
+    return rc < 0 ? -rc : 0;
+}
+
 }
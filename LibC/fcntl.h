@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sys/cdefs.h>
+#include <sys/types.h>
 
 __BEGIN_DECLS
 
@@ -21,10 +22,14 @@ __BEGIN_DECLS
 #define O_TRUNC 01000
 #define O_APPEND 02000
 #define O_NONBLOCK 04000
+#define O_DIRECT 040000
 #define O_DIRECTORY 00200000
 #define O_NOFOLLOW 00400000
 #define O_CLOEXEC 02000000
 
+#define FALLOC_FL_KEEP_SIZE 0x01
+#define FALLOC_FL_PUNCH_HOLE 0x02
+
 #define	S_IFMT 0170000
 #define	S_IFDIR 0040000
 #define	S_IFCHR 0020000
@@ -53,5 +58,10 @@ __BEGIN_DECLS
 #define S_IRWXO (S_IRWXG >> 3)
 
 int fcntl(int fd, int cmd, ...);
+// With mode 0, allocates the blocks for [offset, offset + length) up front, growing the file if it ends past it.
+// FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE frees them instead, and the range reads as zeroes.
+int fallocate(int fd, int mode, off_t offset, off_t length);
+// Like fallocate() with mode 0, but returns the error instead of setting errno.
+int posix_fallocate(int fd, off_t offset, off_t length);
 
 __END_DECLS
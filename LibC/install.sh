@@ -2,13 +2,17 @@
 
 mkdir -p ../Root/usr/include/sys/
 mkdir -p ../Root/usr/include/netinet/
+mkdir -p ../Root/usr/include/net/
 mkdir -p ../Root/usr/include/arpa/
 mkdir -p ../Root/usr/lib/
 cp *.h ../Root/usr/include/
 cp sys/*.h ../Root/usr/include/sys/
 cp arpa/*.h ../Root/usr/include/arpa/
 cp netinet/*.h ../Root/usr/include/netinet/
+cp net/*.h ../Root/usr/include/net/
 cp libc.a ../Root/usr/lib/
 cp crt0.o ../Root/usr/lib/
 cp crti.ao ../Root/usr/lib/crti.o
 cp crtn.ao ../Root/usr/lib/crtn.o
+cp shared/libc.so ../Root/usr/lib/
+cp ld.so ../Root/usr/lib/
@@ -0,0 +1,363 @@
+#include <Kernel/elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// This is the dynamic loader (/usr/lib/ld.so). It's statically linked at a fixed address well away from
+// everything else, and the kernel maps it into dynamically linked programs as their ELF interpreter.
+// It loads the DT_NEEDED shared libraries, binds every relocation up front and then jumps to the program.
+
+//#define DYNAMIC_LOADER_DEBUG
+
+extern "C" {
+// We don't link crt0.o, so these have to live here for the statically linked LibC we use.
+int errno;
+char** environ;
+}
+
+static const dword library_base = 0x50000000;
+static const int max_loaded_objects = 16;
+static const size_t max_program_headers = 32;
+
+struct LoadedObject {
+    char path[256];
+    dword base { 0 };
+    const Elf32_Dyn* dynamic { nullptr };
+    const Elf32_Sym* symbol_table { nullptr };
+    const char* string_table { nullptr };
+    const dword* hash_table { nullptr };
+};
+
+static LoadedObject s_objects[max_loaded_objects];
+static int s_object_count;
+static dword s_next_library_base = library_base;
+
+[[noreturn]] static void fail(const char* message, const char* detail)
+{
+    // LibC's stdio is never initialized in here, so format into a local buffer instead.
+    char buffer[512];
+    int length = snprintf(buffer, sizeof(buffer), "ld.so: %s: %s\n", message, detail);
+    dbgprintf("%s", buffer);
+    write(STDERR_FILENO, buffer, length);
+    _exit(127);
+}
+
+static inline dword page_round_down(dword value)
+{
+    return value & ~(PAGE_SIZE - 1);
+}
+
+static inline dword page_round_up(dword value)
+{
+    return (value + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+static int prot_for_segment(const Elf32_Phdr& program_header)
+{
+    int prot = 0;
+    if (program_header.p_flags & PF_R)
+        prot |= PROT_READ;
+    if (program_header.p_flags & PF_W)
+        prot |= PROT_WRITE;
+    if (program_header.p_flags & PF_X)
+        prot |= PROT_EXEC;
+    return prot;
+}
+
+static void parse_dynamic(LoadedObject& object)
+{
+    for (auto* entry = object.dynamic; entry->d_tag != DT_NULL; ++entry) {
+        switch (entry->d_tag) {
+        case DT_SYMTAB:
+            object.symbol_table = (const Elf32_Sym*)(object.base + entry->d_un.d_ptr);
+            break;
+        case DT_STRTAB:
+            object.string_table = (const char*)(object.base + entry->d_un.d_ptr);
+            break;
+        case DT_HASH:
+            object.hash_table = (const dword*)(object.base + entry->d_un.d_ptr);
+            break;
+        }
+    }
+}
+
+static dword elf_hash(const char* name)
+{
+    dword hash = 0;
+    while (*name) {
+        hash = (hash << 4) + (byte)*name++;
+        dword high = hash & 0xf0000000;
+        if (high)
+            hash ^= high >> 24;
+        hash &= ~high;
+    }
+    return hash;
+}
+
+static const Elf32_Sym* find_symbol_in(const LoadedObject& object, const char* name, dword hash)
+{
+    if (!object.hash_table || !object.symbol_table || !object.string_table)
+        return nullptr;
+    dword bucket_count = object.hash_table[0];
+    const dword* buckets = object.hash_table + 2;
+    const dword* chains = buckets + bucket_count;
+    for (dword index = buckets[hash % bucket_count]; index != STN_UNDEF; index = chains[index]) {
+        auto& symbol = object.symbol_table[index];
+        if (symbol.st_shndx == SHN_UNDEF)
+            continue;
+        if (ELF32_ST_BIND(symbol.st_info) != STB_GLOBAL && ELF32_ST_BIND(symbol.st_info) != STB_WEAK)
+            continue;
+        if (!strcmp(object.string_table + symbol.st_name, name))
+            return &symbol;
+    }
+    return nullptr;
+}
+
+// Symbols are looked up in load order: the program first, then its libraries breadth-first.
+static dword resolve_symbol(const LoadedObject& requester, dword symbol_index, bool skip_program)
+{
+    auto& symbol = requester.symbol_table[symbol_index];
+    const char* name = requester.string_table + symbol.st_name;
+    dword hash = elf_hash(name);
+    for (int i = skip_program ? 1 : 0; i < s_object_count; ++i) {
+        if (auto* definition = find_symbol_in(s_objects[i], name, hash))
+            return s_objects[i].base + definition->st_value;
+    }
+    if (ELF32_ST_BIND(symbol.st_info) == STB_WEAK)
+        return 0;
+    fail("Undefined symbol", name);
+}
+
+static void load_library(const char* name)
+{
+    for (int i = 1; i < s_object_count; ++i) {
+        const char* loaded_name = strrchr(s_objects[i].path, '/');
+        if (!strcmp(loaded_name ? loaded_name + 1 : s_objects[i].path, name))
+            return;
+    }
+    if (s_object_count == max_loaded_objects)
+        fail("Too many shared libraries", name);
+
+    auto& object = s_objects[s_object_count];
+    if (strchr(name, '/'))
+        snprintf(object.path, sizeof(object.path), "%s", name);
+    else
+        snprintf(object.path, sizeof(object.path), "/usr/lib/%s", name);
+
+    int fd = open(object.path, O_RDONLY);
+    if (fd < 0)
+        fail("Unable to open", object.path);
+
+    Elf32_Ehdr header;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.e_ident, ELFMAG, SELFMAG) || header.e_type != ET_DYN)
+        fail("Not a shared library", object.path);
+    if (header.e_phnum > max_program_headers || header.e_phentsize != sizeof(Elf32_Phdr))
+        fail("Bad program headers", object.path);
+
+    Elf32_Phdr program_headers[max_program_headers];
+    ssize_t program_headers_size = header.e_phnum * sizeof(Elf32_Phdr);
+    if (pread(fd, program_headers, program_headers_size, header.e_phoff) != program_headers_size)
+        fail("Bad program headers", object.path);
+
+    object.base = s_next_library_base;
+    dword end_of_image = 0;
+    for (int i = 0; i < header.e_phnum; ++i) {
+        auto& program_header = program_headers[i];
+        if (program_header.p_type == PT_DYNAMIC)
+            object.dynamic = (const Elf32_Dyn*)(object.base + program_header.p_vaddr);
+        if (program_header.p_type != PT_LOAD || !program_header.p_memsz)
+            continue;
+
+        // Map the file-backed part of the segment, then zero the tail of its last page and map
+        // anonymous memory for whatever .bss is left.
+        dword segment_start = object.base + program_header.p_vaddr;
+        dword mapping_start = page_round_down(segment_start);
+        dword file_end = segment_start + program_header.p_filesz;
+        dword memory_end = segment_start + program_header.p_memsz;
+        int prot = prot_for_segment(program_header);
+        if (program_header.p_filesz) {
+            void* mapping = mmap((void*)mapping_start, file_end - mapping_start, prot, MAP_PRIVATE | MAP_FIXED, fd, page_round_down(program_header.p_offset));
+            if (mapping != (void*)mapping_start)
+                fail("Unable to map segment of", object.path);
+            if ((prot & PROT_WRITE) && (file_end & (PAGE_SIZE - 1)))
+                memset((void*)file_end, 0, page_round_up(file_end) - file_end);
+        }
+        dword anonymous_start = program_header.p_filesz ? page_round_up(file_end) : mapping_start;
+        if (memory_end > anonymous_start) {
+            void* mapping = mmap((void*)anonymous_start, memory_end - anonymous_start, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, 0, 0);
+            if (mapping != (void*)anonymous_start)
+                fail("Unable to map .bss of", object.path);
+        }
+        if (memory_end > end_of_image)
+            end_of_image = memory_end;
+    }
+    close(fd);
+
+    if (!object.dynamic)
+        fail("No dynamic section in", object.path);
+    s_next_library_base = page_round_up(end_of_image) + PAGE_SIZE;
+    parse_dynamic(object);
+    ++s_object_count;
+#ifdef DYNAMIC_LOADER_DEBUG
+    dbgprintf("ld.so: Loaded %s at %x\n", object.path, object.base);
+#endif
+}
+
+static void load_dependencies_of(const LoadedObject& object)
+{
+    for (auto* entry = object.dynamic; entry->d_tag != DT_NULL; ++entry) {
+        if (entry->d_tag == DT_NEEDED)
+            load_library(object.string_table + entry->d_un.d_val);
+    }
+}
+
+static void relocate(const LoadedObject& object, const Elf32_Rel* relocations, size_t size)
+{
+    bool is_program = &object == &s_objects[0];
+    for (size_t i = 0; i < size / sizeof(Elf32_Rel); ++i) {
+        auto& relocation = relocations[i];
+        auto* patch = (dword*)(object.base + relocation.r_offset);
+        dword symbol_index = ELF32_R_SYM(relocation.r_info);
+        switch (ELF32_R_TYPE(relocation.r_info)) {
+        case R_386_NONE:
+            break;
+        case R_386_32:
+            *patch += resolve_symbol(object, symbol_index, false);
+            break;
+        case R_386_PC32:
+            *patch += resolve_symbol(object, symbol_index, false) - (dword)patch;
+            break;
+        case R_386_GLOB_DAT:
+        case R_386_JMP_SLOT:
+            *patch = resolve_symbol(object, symbol_index, false);
+            break;
+        case R_386_RELATIVE:
+            *patch += object.base;
+            break;
+        case R_386_COPY: {
+            // The program has its own copy of a library's data object; the library's definition is the initializer.
+            if (!is_program)
+                fail("Copy relocation outside the program in", object.path);
+            auto& symbol = object.symbol_table[symbol_index];
+            memcpy(patch, (const void*)resolve_symbol(object, symbol_index, true), symbol.st_size);
+            break;
+        }
+        default:
+            fail("Unsupported relocation type in", object.path);
+        }
+    }
+}
+
+static void relocate_object(const LoadedObject& object)
+{
+    const Elf32_Rel* relocations = nullptr;
+    size_t relocations_size = 0;
+    const Elf32_Rel* plt_relocations = nullptr;
+    size_t plt_relocations_size = 0;
+    for (auto* entry = object.dynamic; entry->d_tag != DT_NULL; ++entry) {
+        switch (entry->d_tag) {
+        case DT_REL:
+            relocations = (const Elf32_Rel*)(object.base + entry->d_un.d_ptr);
+            break;
+        case DT_RELSZ:
+            relocations_size = entry->d_un.d_val;
+            break;
+        case DT_JMPREL:
+            plt_relocations = (const Elf32_Rel*)(object.base + entry->d_un.d_ptr);
+            break;
+        case DT_PLTRELSZ:
+            plt_relocations_size = entry->d_un.d_val;
+            break;
+        case DT_RELA:
+            fail("RELA relocations are not supported in", object.path);
+        }
+    }
+    if (relocations)
+        relocate(object, relocations, relocations_size);
+    // We bind lazily-bindable PLT slots right away as well, so there's no need for a resolver trampoline.
+    if (plt_relocations)
+        relocate(object, plt_relocations, plt_relocations_size);
+}
+
+static void initialize_object(const LoadedObject& object, int argc, char** argv, char** envp)
+{
+    typedef void (*InitFunction)(int, char**, char**);
+    InitFunction init = nullptr;
+    InitFunction* init_array = nullptr;
+    size_t init_array_size = 0;
+    for (auto* entry = object.dynamic; entry->d_tag != DT_NULL; ++entry) {
+        switch (entry->d_tag) {
+        case DT_INIT:
+            init = (InitFunction)(object.base + entry->d_un.d_ptr);
+            break;
+        case DT_INIT_ARRAY:
+            init_array = (InitFunction*)(object.base + entry->d_un.d_ptr);
+            break;
+        case DT_INIT_ARRAYSZ:
+            init_array_size = entry->d_un.d_val;
+            break;
+        }
+    }
+    if (init)
+        init(argc, argv, envp);
+    for (size_t i = 0; i < init_array_size / sizeof(InitFunction); ++i)
+        init_array[i](argc, argv, envp);
+}
+
+extern "C" int _start(int argc, char** argv, char** envp)
+{
+    environ = envp;
+
+    char** env_end = envp;
+    while (*env_end)
+        ++env_end;
+    auto* auxiliary_values = (const Elf32_auxv_t*)(env_end + 1);
+
+    const Elf32_Phdr* program_headers = nullptr;
+    dword program_header_count = 0;
+    dword program_entry = 0;
+    for (auto* auxv = auxiliary_values; auxv->a_type != AT_NULL; ++auxv) {
+        switch (auxv->a_type) {
+        case AT_PHDR:
+            program_headers = (const Elf32_Phdr*)auxv->a_un.a_val;
+            break;
+        case AT_PHNUM:
+            program_header_count = auxv->a_un.a_val;
+            break;
+        case AT_ENTRY:
+            program_entry = auxv->a_un.a_val;
+            break;
+        }
+    }
+    if (!program_headers || !program_entry)
+        fail("Missing auxiliary vector for", argv[0]);
+
+    // The program itself is an ET_EXEC, already loaded by the kernel at its link-time address.
+    auto& program = s_objects[s_object_count++];
+    snprintf(program.path, sizeof(program.path), "%s", argv[0]);
+    for (dword i = 0; i < program_header_count; ++i) {
+        if (program_headers[i].p_type == PT_DYNAMIC)
+            program.dynamic = (const Elf32_Dyn*)program_headers[i].p_vaddr;
+    }
+    if (!program.dynamic)
+        fail("No dynamic section in", argv[0]);
+    parse_dynamic(program);
+
+    // load_library() appends to s_objects, so this walks the dependency tree breadth-first.
+    for (int i = 0; i < s_object_count; ++i)
+        load_dependencies_of(s_objects[i]);
+
+    for (int i = s_object_count - 1; i >= 0; --i)
+        relocate_object(s_objects[i]);
+
+    // Dependencies are initialized before whoever needs them. The program's own constructors are run by its crt0.
+    for (int i = s_object_count - 1; i >= 1; --i)
+        initialize_object(s_objects[i], argc, argv, envp);
+
+    typedef int (*EntryFunction)(int, char**, char**);
+    return ((EntryFunction)program_entry)(argc, argv, envp);
+}
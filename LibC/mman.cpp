@@ -22,10 +22,27 @@ int munmap(void* addr, size_t size)
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
+void* mremap(void* old_address, size_t old_size, size_t new_size, int flags)
+{
+    Syscall::SC_mremap_params params { (dword)old_address, old_size, new_size, flags };
+    int rc = syscall(SC_mremap, &params);
+    if (rc < 0 && -rc < EMAXERRNO) {
+        errno = -rc;
+        return MAP_FAILED;
+    }
+    return (void*)rc;
+}
+
 int set_mmap_name(void* addr, size_t size, const char* name)
 {
     int rc = syscall(SC_set_mmap_name, addr, size, name);
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
+int madvise(void* addr, size_t size, int advice)
+{
+    int rc = syscall(SC_madvise, addr, size, advice);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
 }
@@ -8,6 +8,12 @@
 #define MAP_FIXED 0x10
 #define MAP_ANONYMOUS 0x20
 #define MAP_ANON MAP_ANONYMOUS
+#define MAP_POPULATE 0x8000
+
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED 3
 
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
@@ -16,11 +22,17 @@
 
 #define MAP_FAILED ((void*)-1)
 
+#define MREMAP_MAYMOVE 0x1
+
 __BEGIN_DECLS
 
 void* mmap(void* addr, size_t, int prot, int flags, int fd, off_t);
 int munmap(void*, size_t);
+// Only moves anonymous private memory, taking its pages along, since nothing can grow where it is.
+void* mremap(void* old_address, size_t old_size, size_t new_size, int flags);
 int set_mmap_name(void*, size_t, const char*);
+// Takes a whole mapping, like set_mmap_name().
+int madvise(void*, size_t, int advice);
 
 __END_DECLS
 
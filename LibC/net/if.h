@@ -0,0 +1,24 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <sys/socket.h>
+
+__BEGIN_DECLS
+
+#define IFNAMSIZ 16
+
+// For the SIOC*IF* ioctls on any AF_INET socket, which get and set how an adapter is configured.
+struct ifreq {
+    char ifr_name[IFNAMSIZ];
+    union {
+        struct sockaddr ifru_addr;
+        struct sockaddr ifru_netmask;
+        int ifru_mtu;
+    } ifr_ifru;
+};
+
+#define ifr_addr ifr_ifru.ifru_addr
+#define ifr_netmask ifr_ifru.ifru_netmask
+#define ifr_mtu ifr_ifru.ifru_mtu
+
+__END_DECLS
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <sys/socket.h>
+
+__BEGIN_DECLS
+
+#define RTF_UP 0x1
+#define RTF_GATEWAY 0x2
+#define RTF_MTU 0x40
+
+// For SIOCADDRT and SIOCDELRT on any AF_INET socket.
+struct rtentry {
+    struct sockaddr rt_dst;
+    struct sockaddr rt_gateway;
+    struct sockaddr rt_genmask;
+    unsigned short rt_flags;
+    unsigned long rt_mtu;
+    // The adapter's name, or null to go through whichever has the gateway on its link.
+    char* rt_dev;
+};
+
+__END_DECLS
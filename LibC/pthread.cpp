@@ -0,0 +1,335 @@
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <Kernel/Syscall.h>
+
+extern "C" {
+
+// Every thread made by pthread_create() has one of these, %gs is based at it.
+struct PthreadControlBlock {
+    // %gs:0 points back at the block itself, so finding it is a single load.
+    PthreadControlBlock* self;
+    int tid;
+    // Running, Exited or Detached. pthread_join() sleeps on it with futex().
+    int state;
+    void* (*start_routine)(void*);
+    int (*legacy_entry)(void*);
+    void* argument;
+    void* return_value;
+    const void* specific[PTHREAD_KEYS_MAX];
+};
+
+enum { Running = 0, Exited = 1, Detached = 2 };
+
+static PthreadControlBlock s_main_thread_block;
+
+// Until someone starts a second thread, the main thread doesn't even need a thread pointer.
+static bool s_has_threads;
+
+static void (*s_key_destructors[PTHREAD_KEYS_MAX])(void*);
+static bool s_key_in_use[PTHREAD_KEYS_MAX];
+static pthread_mutex_t s_keys_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static PthreadControlBlock* current_block()
+{
+    if (!s_has_threads)
+        return &s_main_thread_block;
+    PthreadControlBlock* block;
+    asm volatile("movl %%gs:0, %0" : "=r"(block));
+    return block;
+}
+
+static int set_thread_pointer(void* pointer)
+{
+    return syscall(SC_set_thread_pointer, pointer);
+}
+
+static void run_key_destructors(PthreadControlBlock& block)
+{
+    for (int iteration = 0; iteration < PTHREAD_DESTRUCTOR_ITERATIONS; ++iteration) {
+        bool ran_any = false;
+        for (int key = 0; key < PTHREAD_KEYS_MAX; ++key) {
+            auto* value = const_cast<void*>(block.specific[key]);
+            if (!value || !s_key_destructors[key])
+                continue;
+            block.specific[key] = nullptr;
+            s_key_destructors[key](value);
+            ran_any = true;
+        }
+        if (!ran_any)
+            break;
+    }
+}
+
+static int thread_trampoline(void* argument)
+{
+    auto* block = (PthreadControlBlock*)argument;
+    set_thread_pointer(block);
+    block->tid = gettid();
+    if (block->legacy_entry)
+        pthread_exit((void*)block->legacy_entry(block->argument));
+    pthread_exit(block->start_routine(block->argument));
+}
+
+// Returns the new thread's tid. Once it's running, a detached thread owns its block, don't touch it again.
+static int spawn_thread(PthreadControlBlock* block)
+{
+    if (!s_has_threads) {
+        s_main_thread_block.self = &s_main_thread_block;
+        s_main_thread_block.tid = gettid();
+        int rc = set_thread_pointer(&s_main_thread_block);
+        if (rc < 0) {
+            free(block);
+            return rc;
+        }
+        s_has_threads = true;
+    }
+    int tid = syscall(SC_create_thread, thread_trampoline, block);
+    if (tid < 0)
+        free(block);
+    return tid;
+}
+
+static PthreadControlBlock* make_block(void* argument)
+{
+    auto* block = (PthreadControlBlock*)calloc(1, sizeof(PthreadControlBlock));
+    block->self = block;
+    block->state = Running;
+    block->argument = argument;
+    return block;
+}
+
+int pthread_create(pthread_t* thread, const pthread_attr_t* attributes, void* (*start_routine)(void*), void* argument)
+{
+    auto* block = make_block(argument);
+    block->start_routine = start_routine;
+    if (attributes && attributes->__detach_state == PTHREAD_CREATE_DETACHED)
+        block->state = Detached;
+    if (thread)
+        *thread = (pthread_t)block;
+    int rc = spawn_thread(block);
+    if (rc < 0)
+        return -rc;
+    return 0;
+}
+
+int create_thread(int (*entry)(void*), void* argument)
+{
+    auto* block = make_block(argument);
+    block->legacy_entry = entry;
+    block->state = Detached;
+    int rc = spawn_thread(block);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+void pthread_exit(void* return_value)
+{
+    auto* block = current_block();
+    run_key_destructors(*block);
+    if (block == &s_main_thread_block)
+        exit(0);
+    block->return_value = return_value;
+    int old_state = __atomic_exchange_n(&block->state, Exited, __ATOMIC_ACQ_REL);
+    if (old_state == Detached) {
+        // Nobody is going to join us, clean up after ourselves. We're done touching the block.
+        free(block);
+    } else {
+        // The joiner may free the block before this wakes it, a stray wakeup on a dead address is harmless.
+        futex(&block->state, FUTEX_WAKE, INT_MAX);
+    }
+    exit_thread(0);
+}
+
+int pthread_join(pthread_t thread, void** return_value)
+{
+    auto* block = (PthreadControlBlock*)thread;
+    if (block == current_block() || block == &s_main_thread_block)
+        return EDEADLK;
+    for (;;) {
+        int state = __atomic_load_n(&block->state, __ATOMIC_ACQUIRE);
+        if (state == Exited)
+            break;
+        if (state == Detached)
+            return EINVAL;
+        futex(&block->state, FUTEX_WAIT, state);
+    }
+    if (return_value)
+        *return_value = block->return_value;
+    free(block);
+    return 0;
+}
+
+int pthread_detach(pthread_t thread)
+{
+    auto* block = (PthreadControlBlock*)thread;
+    if (block == &s_main_thread_block)
+        return EINVAL;
+    int old_state = __atomic_exchange_n(&block->state, Detached, __ATOMIC_ACQ_REL);
+    if (old_state == Detached)
+        return EINVAL;
+    // Too late to leave it running on its own, it's already gone.
+    if (old_state == Exited)
+        free(block);
+    return 0;
+}
+
+pthread_t pthread_self()
+{
+    return (pthread_t)current_block();
+}
+
+int pthread_equal(pthread_t a, pthread_t b)
+{
+    return a == b;
+}
+
+int pthread_attr_init(pthread_attr_t* attributes)
+{
+    attributes->__detach_state = PTHREAD_CREATE_JOINABLE;
+    return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t*)
+{
+    return 0;
+}
+
+int pthread_attr_setdetachstate(pthread_attr_t* attributes, int detach_state)
+{
+    if (detach_state != PTHREAD_CREATE_JOINABLE && detach_state != PTHREAD_CREATE_DETACHED)
+        return EINVAL;
+    attributes->__detach_state = detach_state;
+    return 0;
+}
+
+int pthread_attr_getdetachstate(const pthread_attr_t* attributes, int* detach_state)
+{
+    *detach_state = attributes->__detach_state;
+    return 0;
+}
+
+int pthread_key_create(pthread_key_t* key, void (*destructor)(void*))
+{
+    pthread_mutex_lock(&s_keys_lock);
+    for (int i = 0; i < PTHREAD_KEYS_MAX; ++i) {
+        if (s_key_in_use[i])
+            continue;
+        s_key_in_use[i] = true;
+        s_key_destructors[i] = destructor;
+        pthread_mutex_unlock(&s_keys_lock);
+        *key = i;
+        return 0;
+    }
+    pthread_mutex_unlock(&s_keys_lock);
+    return EAGAIN;
+}
+
+int pthread_key_delete(pthread_key_t key)
+{
+    if (key < 0 || key >= PTHREAD_KEYS_MAX)
+        return EINVAL;
+    pthread_mutex_lock(&s_keys_lock);
+    s_key_in_use[key] = false;
+    s_key_destructors[key] = nullptr;
+    pthread_mutex_unlock(&s_keys_lock);
+    return 0;
+}
+
+void* pthread_getspecific(pthread_key_t key)
+{
+    if (key < 0 || key >= PTHREAD_KEYS_MAX)
+        return nullptr;
+    return const_cast<void*>(current_block()->specific[key]);
+}
+
+int pthread_setspecific(pthread_key_t key, const void* value)
+{
+    if (key < 0 || key >= PTHREAD_KEYS_MAX)
+        return EINVAL;
+    current_block()->specific[key] = value;
+    return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t*)
+{
+    mutex->__state = 0;
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t* mutex)
+{
+    if (mutex->__state)
+        return EBUSY;
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    int state = 0;
+    if (__atomic_compare_exchange_n(&mutex->__state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    // Contended. Mark it so the holder knows to wake someone, and sleep until it's free.
+    if (state != 2)
+        state = __atomic_exchange_n(&mutex->__state, 2, __ATOMIC_ACQUIRE);
+    while (state != 0) {
+        futex(&mutex->__state, FUTEX_WAIT, 2);
+        state = __atomic_exchange_n(&mutex->__state, 2, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex)
+{
+    int state = 0;
+    if (__atomic_compare_exchange_n(&mutex->__state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    return EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t* mutex)
+{
+    if (__atomic_fetch_sub(&mutex->__state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&mutex->__state, 0, __ATOMIC_RELEASE);
+        futex(&mutex->__state, FUTEX_WAKE, 1);
+    }
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t* cond, const pthread_condattr_t*)
+{
+    cond->__sequence = 0;
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t*)
+{
+    return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    // If anyone signals after we've let go of the mutex, the sequence number will have moved on and futex() won't sleep.
+    int sequence = __atomic_load_n(&cond->__sequence, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(mutex);
+    futex(&cond->__sequence, FUTEX_WAIT, sequence);
+    return pthread_mutex_lock(mutex);
+}
+
+int pthread_cond_signal(pthread_cond_t* cond)
+{
+    __atomic_fetch_add(&cond->__sequence, 1, __ATOMIC_RELEASE);
+    futex(&cond->__sequence, FUTEX_WAKE, 1);
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t* cond)
+{
+    __atomic_fetch_add(&cond->__sequence, 1, __ATOMIC_RELEASE);
+    futex(&cond->__sequence, FUTEX_WAKE, INT_MAX);
+    return 0;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+#define PTHREAD_COND_INITIALIZER { 0 }
+
+#define PTHREAD_CREATE_JOINABLE 0
+#define PTHREAD_CREATE_DETACHED 1
+
+#define PTHREAD_KEYS_MAX 64
+#define PTHREAD_DESTRUCTOR_ITERATIONS 4
+
+int pthread_create(pthread_t*, const pthread_attr_t*, void* (*start_routine)(void*), void* argument);
+int pthread_join(pthread_t, void** return_value);
+int pthread_detach(pthread_t);
+__attribute__((noreturn)) void pthread_exit(void* return_value);
+pthread_t pthread_self();
+int pthread_equal(pthread_t, pthread_t);
+
+int pthread_attr_init(pthread_attr_t*);
+int pthread_attr_destroy(pthread_attr_t*);
+int pthread_attr_setdetachstate(pthread_attr_t*, int);
+int pthread_attr_getdetachstate(const pthread_attr_t*, int*);
+
+int pthread_key_create(pthread_key_t*, void (*destructor)(void*));
+int pthread_key_delete(pthread_key_t);
+void* pthread_getspecific(pthread_key_t);
+int pthread_setspecific(pthread_key_t, const void*);
+
+int pthread_mutex_init(pthread_mutex_t*, const pthread_mutexattr_t*);
+int pthread_mutex_destroy(pthread_mutex_t*);
+int pthread_mutex_lock(pthread_mutex_t*);
+int pthread_mutex_trylock(pthread_mutex_t*);
+int pthread_mutex_unlock(pthread_mutex_t*);
+
+int pthread_cond_init(pthread_cond_t*, const pthread_condattr_t*);
+int pthread_cond_destroy(pthread_cond_t*);
+int pthread_cond_wait(pthread_cond_t*, pthread_mutex_t*);
+int pthread_cond_signal(pthread_cond_t*);
+int pthread_cond_broadcast(pthread_cond_t*);
+
+__END_DECLS
@@ -0,0 +1,19 @@
+#include <sched.h>
+#include <errno.h>
+#include <Kernel/Syscall.h>
+
+extern "C" {
+
+int sched_setaffinity(pid_t pid, size_t cpuset_size, const cpu_set_t* cpuset)
+{
+    int rc = syscall(SC_sched_setaffinity, (dword)pid, (dword)cpuset_size, (dword)cpuset);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int sched_getaffinity(pid_t pid, size_t cpuset_size, cpu_set_t* cpuset)
+{
+    int rc = syscall(SC_sched_getaffinity, (dword)pid, (dword)cpuset_size, (dword)cpuset);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+// A set of processors, bit N for processor N.
+#define CPU_SETSIZE 32
+
+typedef struct {
+    unsigned int bits;
+} cpu_set_t;
+
+#define CPU_ZERO(set) ((set)->bits = 0)
+#define CPU_SET(cpu, set) ((set)->bits |= (1u << (cpu)))
+#define CPU_CLR(cpu, set) ((set)->bits &= ~(1u << (cpu)))
+#define CPU_ISSET(cpu, set) (((set)->bits >> (cpu)) & 1)
+
+// A pid of 0 means the calling process. Processes that were never pinned stay off the processors in /proc/sys/isolated_cpus.
+int sched_setaffinity(pid_t, size_t cpuset_size, const cpu_set_t*);
+int sched_getaffinity(pid_t, size_t cpuset_size, cpu_set_t*);
+
+__END_DECLS
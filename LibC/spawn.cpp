@@ -0,0 +1,203 @@
+#include <spawn.h>
+#include <Kernel/Syscall.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C" {
+
+typedef Syscall::SC_posix_spawn_file_action FileAction;
+
+int posix_spawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char* const argv[], char* const envp[])
+{
+    Syscall::SC_posix_spawn_params params {
+        path,
+        argv,
+        envp,
+        file_actions ? (const FileAction*)file_actions->__actions : nullptr,
+        file_actions ? file_actions->__count : 0,
+        attr ? attr->__flags : 0,
+        attr ? attr->__pgroup : 0,
+        attr ? attr->__sigmask : 0
+    };
+    int rc = syscall(SC_posix_spawn, &params);
+    // Unlike most of LibC, posix_spawn() reports errors through its return value.
+    if (rc < 0)
+        return -rc;
+    if (pid)
+        *pid = rc;
+    return 0;
+}
+
+int posix_spawnp(pid_t* pid, const char* file, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char* const argv[], char* const envp[])
+{
+    if (strchr(file, '/'))
+        return posix_spawn(pid, file, file_actions, attr, argv, envp);
+
+    const char* search_path = getenv("PATH");
+    if (!search_path)
+        search_path = "/bin:/usr/bin";
+
+    int error = ENOENT;
+    for (const char* directory = search_path; *directory;) {
+        const char* end = strchr(directory, ':');
+        size_t directory_length = end ? (size_t)(end - directory) : strlen(directory);
+        char path[256];
+        if (directory_length + strlen(file) + 2 <= sizeof(path)) {
+            memcpy(path, directory, directory_length);
+            path[directory_length] = '/';
+            strcpy(path + directory_length + 1, file);
+            error = posix_spawn(pid, path, file_actions, attr, argv, envp);
+            if (error != ENOENT)
+                return error;
+        }
+        if (!end)
+            break;
+        directory = end + 1;
+    }
+    return error;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t* file_actions)
+{
+    file_actions->__actions = nullptr;
+    file_actions->__count = 0;
+    file_actions->__capacity = 0;
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t* file_actions)
+{
+    auto* actions = (FileAction*)file_actions->__actions;
+    for (int i = 0; i < file_actions->__count; ++i)
+        free(const_cast<char*>(actions[i].path));
+    free(actions);
+    return posix_spawn_file_actions_init(file_actions);
+}
+
+static FileAction* append_file_action(posix_spawn_file_actions_t* file_actions)
+{
+    if (file_actions->__count == file_actions->__capacity) {
+        int new_capacity = file_actions->__capacity ? file_actions->__capacity * 2 : 4;
+        auto* new_actions = (FileAction*)realloc(file_actions->__actions, new_capacity * sizeof(FileAction));
+        if (!new_actions)
+            return nullptr;
+        file_actions->__actions = new_actions;
+        file_actions->__capacity = new_capacity;
+    }
+    auto* action = &((FileAction*)file_actions->__actions)[file_actions->__count++];
+    memset(action, 0, sizeof(FileAction));
+    return action;
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t* file_actions, int fd, const char* path, int options, mode_t mode)
+{
+    if (fd < 0)
+        return EBADF;
+    char* path_copy = strdup(path);
+    if (!path_copy)
+        return ENOMEM;
+    auto* action = append_file_action(file_actions);
+    if (!action) {
+        free(path_copy);
+        return ENOMEM;
+    }
+    action->type = Syscall::SpawnFileActionType::Open;
+    action->fd = fd;
+    action->path = path_copy;
+    action->options = options;
+    action->mode = mode;
+    return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t* file_actions, int fd)
+{
+    if (fd < 0)
+        return EBADF;
+    auto* action = append_file_action(file_actions);
+    if (!action)
+        return ENOMEM;
+    action->type = Syscall::SpawnFileActionType::Close;
+    action->fd = fd;
+    return 0;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t* file_actions, int fd, int new_fd)
+{
+    if (fd < 0 || new_fd < 0)
+        return EBADF;
+    auto* action = append_file_action(file_actions);
+    if (!action)
+        return ENOMEM;
+    action->type = Syscall::SpawnFileActionType::Dup2;
+    action->fd = fd;
+    action->new_fd = new_fd;
+    return 0;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t* attr)
+{
+    attr->__flags = 0;
+    attr->__pgroup = 0;
+    attr->__sigdefault = 0;
+    attr->__sigmask = 0;
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t*)
+{
+    return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t* attr, short* flags)
+{
+    *flags = attr->__flags;
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t* attr, short flags)
+{
+    if (flags & ~(POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK))
+        return EINVAL;
+    attr->__flags = flags;
+    return 0;
+}
+
+int posix_spawnattr_getpgroup(const posix_spawnattr_t* attr, pid_t* pgroup)
+{
+    *pgroup = attr->__pgroup;
+    return 0;
+}
+
+int posix_spawnattr_setpgroup(posix_spawnattr_t* attr, pid_t pgroup)
+{
+    attr->__pgroup = pgroup;
+    return 0;
+}
+
+int posix_spawnattr_getsigdefault(const posix_spawnattr_t* attr, sigset_t* sigdefault)
+{
+    *sigdefault = attr->__sigdefault;
+    return 0;
+}
+
+int posix_spawnattr_setsigdefault(posix_spawnattr_t* attr, const sigset_t* sigdefault)
+{
+    attr->__sigdefault = *sigdefault;
+    return 0;
+}
+
+int posix_spawnattr_getsigmask(const posix_spawnattr_t* attr, sigset_t* sigmask)
+{
+    *sigmask = attr->__sigmask;
+    return 0;
+}
+
+int posix_spawnattr_setsigmask(posix_spawnattr_t* attr, const sigset_t* sigmask)
+{
+    attr->__sigmask = *sigmask;
+    return 0;
+}
+
+}
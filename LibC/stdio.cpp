@@ -8,7 +8,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <AK/printf.cpp>
+#include <AK/StdLibExtras.h>
 #include <Kernel/Syscall.h>
 
 extern "C" {
@@ -18,38 +22,138 @@ FILE* stdin;
 FILE* stdout;
 FILE* stderr;
 
+// What regular files get, since nobody's waiting to see a file's contents as they're written.
+static const size_t regular_file_buffer_size = 4 * BUFSIZ;
+
+static FILE* s_open_streams;
+static pthread_mutex_t s_open_streams_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_buffer(FILE& fp)
+{
+    if (fp.buffer_is_allocated)
+        free(fp.buffer);
+    fp.buffer_is_allocated = false;
+}
+
+// Only a terminal has someone reading along line by line. Everything else gets filled up first,
+// in a page for pipes and sockets, and in more than that for files.
 void init_FILE(FILE& fp, int fd, int mode)
 {
     fp.fd = fd;
     fp.buffer = fp.default_buffer;
     fp.buffer_size = BUFSIZ;
-    fp.mode = mode;
+    if (mode == _IONBF) {
+        fp.mode = mode;
+        return;
+    }
+    if (isatty(fd)) {
+        fp.mode = _IOLBF;
+        return;
+    }
+    fp.mode = _IOFBF;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t size = max(regular_file_buffer_size, (size_t)st.st_blksize);
+        if (auto* buffer = (char*)malloc(size)) {
+            fp.buffer = buffer;
+            fp.buffer_size = size;
+            fp.buffer_is_allocated = true;
+        }
+    }
 }
 
 static FILE* make_FILE(int fd)
 {
     auto* fp = (FILE*)malloc(sizeof(FILE));
     memset(fp, 0, sizeof(FILE));
-    init_FILE(*fp, fd, isatty(fd));
+    init_FILE(*fp, fd, _IOFBF);
+    pthread_mutex_lock(&s_open_streams_lock);
+    fp->next_open = s_open_streams;
+    if (s_open_streams)
+        s_open_streams->previous_open = fp;
+    s_open_streams = fp;
+    pthread_mutex_unlock(&s_open_streams_lock);
     return fp;
 }
 
+static void forget_FILE(FILE* fp)
+{
+    pthread_mutex_lock(&s_open_streams_lock);
+    if (fp->previous_open)
+        fp->previous_open->next_open = fp->next_open;
+    else
+        s_open_streams = fp->next_open;
+    if (fp->next_open)
+        fp->next_open->previous_open = fp->previous_open;
+    pthread_mutex_unlock(&s_open_streams_lock);
+}
+
 void __stdio_init()
 {
     stdin = &__default_streams[0];
     stdout = &__default_streams[1];
     stderr = &__default_streams[2];
-    init_FILE(*stdin, 0, isatty(0) ? _IOLBF : _IOFBF);
-    init_FILE(*stdout, 1, isatty(1) ? _IOLBF : _IOFBF);
+    init_FILE(*stdin, 0, _IOFBF);
+    init_FILE(*stdout, 1, _IOFBF);
     init_FILE(*stderr, 2, _IONBF);
 }
 
+void flockfile(FILE* stream)
+{
+    auto self = pthread_self();
+    if (stream->lock_level && stream->lock_owner == self) {
+        ++stream->lock_level;
+        return;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->lock_owner = self;
+    stream->lock_level = 1;
+}
+
+int ftrylockfile(FILE* stream)
+{
+    auto self = pthread_self();
+    if (stream->lock_level && stream->lock_owner == self) {
+        ++stream->lock_level;
+        return 0;
+    }
+    if (pthread_mutex_trylock(&stream->lock))
+        return -1;
+    stream->lock_owner = self;
+    stream->lock_level = 1;
+    return 0;
+}
+
+void funlockfile(FILE* stream)
+{
+    ASSERT(stream->lock_level);
+    if (--stream->lock_level)
+        return;
+    pthread_mutex_unlock(&stream->lock);
+}
+
+class StreamLocker {
+public:
+    explicit StreamLocker(FILE* stream)
+        : m_stream(stream)
+    {
+        flockfile(m_stream);
+    }
+    ~StreamLocker() { funlockfile(m_stream); }
+
+private:
+    FILE* m_stream;
+};
+
 int setvbuf(FILE* stream, char* buf, int mode, size_t size)
 {
     if (mode != _IONBF && mode != _IOLBF && mode != _IOFBF) {
         errno = EINVAL;
         return -1;
     }
+    StreamLocker locker(stream);
+    fflush(stream);
+    free_buffer(*stream);
     stream->mode = mode;
     if (buf) {
         stream->buffer = buf;
@@ -84,21 +188,73 @@ int feof(FILE* stream)
     return stream->eof;
 }
 
+// Writes all of |iov|, however many goes it takes. Returns how much of it got written before any error.
+static size_t write_fully(int fd, iovec* iov, int iov_count, bool& failed)
+{
+    size_t total_written = 0;
+    failed = false;
+    while (iov_count) {
+        if (!iov->iov_len) {
+            ++iov;
+            --iov_count;
+            continue;
+        }
+        ssize_t nwritten = iov_count == 1 ? write(fd, iov->iov_base, iov->iov_len) : writev(fd, iov, iov_count);
+        if (nwritten < 0) {
+            if (errno == EINTR)
+                continue;
+            failed = true;
+            return total_written;
+        }
+        total_written += nwritten;
+        for (size_t remaining = nwritten; remaining;) {
+            size_t taken = min(remaining, iov->iov_len);
+            iov->iov_base = (char*)iov->iov_base + taken;
+            iov->iov_len -= taken;
+            remaining -= taken;
+            if (!iov->iov_len) {
+                ++iov;
+                --iov_count;
+            }
+        }
+    }
+    return total_written;
+}
+
 int fflush(FILE* stream)
 {
-    // FIXME: Implement buffered streams, duh.
-    if (!stream)
-        return -EBADF;
+    if (!stream) {
+        int rc = 0;
+        if (fflush(stdout) < 0)
+            rc = EOF;
+        if (fflush(stderr) < 0)
+            rc = EOF;
+        pthread_mutex_lock(&s_open_streams_lock);
+        for (auto* fp = s_open_streams; fp; fp = fp->next_open) {
+            if (fflush(fp) < 0)
+                rc = EOF;
+        }
+        pthread_mutex_unlock(&s_open_streams_lock);
+        return rc;
+    }
+    StreamLocker locker(stream);
     if (!stream->buffer_index)
         return 0;
-    int rc = write(stream->fd, stream->buffer, stream->buffer_index);
+    iovec iov = { stream->buffer, stream->buffer_index };
+    bool failed;
+    write_fully(stream->fd, &iov, 1, failed);
     stream->buffer_index = 0;
-    return rc;
+    if (failed) {
+        stream->error = errno;
+        return EOF;
+    }
+    return 0;
 }
 
 char* fgets(char* buffer, int size, FILE* stream)
 {
     assert(stream);
+    StreamLocker locker(stream);
     ssize_t nread = 0;
     for (;;) {
         if (nread >= size)
@@ -121,6 +277,7 @@ char* fgets(char* buffer, int size, FILE* stream)
 int fgetc(FILE* stream)
 {
     assert(stream);
+    StreamLocker locker(stream);
     char ch;
     size_t nread = fread(&ch, sizeof(char), 1, stream);
     if (nread <= 0) {
@@ -144,6 +301,7 @@ int getchar()
 int ungetc(int c, FILE* stream)
 {
     ASSERT(stream);
+    StreamLocker locker(stream);
     stream->have_ungotten = true;
     stream->ungotten = c;
     stream->eof = false;
@@ -153,6 +311,7 @@ int ungetc(int c, FILE* stream)
 int fputc(int ch, FILE* stream)
 {
     assert(stream);
+    StreamLocker locker(stream);
     assert(stream->buffer_index < stream->buffer_size);
     stream->buffer[stream->buffer_index++] = ch;
     if (stream->buffer_index >= stream->buffer_size)
@@ -176,16 +335,15 @@ int putchar(int ch)
 
 int fputs(const char* s, FILE* stream)
 {
-    for (; *s; ++s) {
-        int rc = putc(*s, stream);
-        if (rc == EOF)
-            return EOF;
-    }
+    size_t length = strlen(s);
+    if (fwrite(s, 1, length, stream) < length)
+        return EOF;
     return 0;
 }
 
 int puts(const char* s)
 {
+    StreamLocker locker(stdout);
     int rc = fputs(s, stdout);
     if (rc < 0)
         return rc;
@@ -207,6 +365,7 @@ int ferror(FILE* stream)
 size_t fread(void* ptr, size_t size, size_t nmemb, FILE* stream)
 {
     assert(stream);
+    StreamLocker locker(stream);
     if (!size)
         return 0;
 
@@ -236,11 +395,32 @@ size_t fread(void* ptr, size_t size, size_t nmemb, FILE* stream)
 size_t fwrite(const void* ptr, size_t size, size_t nmemb, FILE* stream)
 {
     assert(stream);
-    fflush(stream);
-    ssize_t nwritten = write(stream->fd, ptr, nmemb * size);
-    if (nwritten < 0)
+    StreamLocker locker(stream);
+    size_t total = size * nmemb;
+    if (!total)
+        return 0;
+
+    if (stream->mode != _IONBF && stream->buffer_index + total < stream->buffer_size) {
+        memcpy(stream->buffer + stream->buffer_index, ptr, total);
+        stream->buffer_index += total;
+        if (stream->mode == _IOLBF && memchr(ptr, '\n', total)) {
+            if (fflush(stream) < 0)
+                return 0;
+        }
+        return nmemb;
+    }
+
+    // It doesn't fit, so it goes straight out, along with whatever is buffered in front of it in one go.
+    size_t buffered = stream->buffer_index;
+    iovec iov[2] = { { stream->buffer, buffered }, { const_cast<void*>(ptr), total } };
+    stream->buffer_index = 0;
+    bool failed;
+    size_t nwritten = write_fully(stream->fd, iov, 2, failed);
+    if (failed)
+        stream->error = errno;
+    if (nwritten < buffered)
         return 0;
-    return nwritten;
+    return (nwritten - buffered) / size;
 }
 
 int fseek(FILE* stream, long offset, int whence)
@@ -277,21 +457,23 @@ int dbgprintf(const char* fmt, ...)
     return ret;
 }
 
-static void stdout_putch(char*&, char ch)
-{
-    putchar(ch);
-}
-
-static FILE* __current_stream = nullptr;
-static void stream_putch(char*&, char ch)
+// The stream rides along in printf_chunked()'s buffer pointer, so concurrent vfprintf() calls don't trip over each other.
+static void stream_write(char*& stream, const char* characters, size_t length)
 {
-    fputc(ch, __current_stream);
+    fwrite(characters, 1, length, (FILE*)stream);
 }
 
 int vfprintf(FILE* stream, const char* fmt, va_list ap)
 {
-    __current_stream = stream;
-    return printf_internal(stream_putch, nullptr, fmt, ap);
+    StreamLocker locker(stream);
+    if (stream->mode != _IONBF)
+        return printf_chunked(stream_write, (char*)stream, fmt, ap);
+    // Even an unbuffered stream gets the whole message in one write, not one per chunk.
+    stream->mode = _IOFBF;
+    int ret = printf_chunked(stream_write, (char*)stream, fmt, ap);
+    stream->mode = _IONBF;
+    fflush(stream);
+    return ret;
 }
 
 int fprintf(FILE* stream, const char* fmt, ...)
@@ -305,7 +487,7 @@ int fprintf(FILE* stream, const char* fmt, ...)
 
 int vprintf(const char* fmt, va_list ap)
 {
-    return printf_internal(stdout_putch, nullptr, fmt, ap);
+    return vfprintf(stdout, fmt, ap);
 }
 
 int printf(const char* fmt, ...)
@@ -317,14 +499,15 @@ int printf(const char* fmt, ...)
     return ret;
 }
 
-static void buffer_putch(char*& bufptr, char ch)
+static void buffer_write(char*& bufptr, const char* characters, size_t length)
 {
-    *bufptr++ = ch;
+    memcpy(bufptr, characters, length);
+    bufptr += length;
 }
 
 int vsprintf(char* buffer, const char* fmt, va_list ap)
 {
-    int ret = printf_internal(buffer_putch, buffer, fmt, ap);
+    int ret = printf_chunked(buffer_write, buffer, fmt, ap);
     buffer[ret] = '\0';
     return ret;
 }
@@ -339,20 +522,18 @@ int sprintf(char* buffer, const char* fmt, ...)
     return ret;
 }
 
-static size_t __vsnprintf_space_remaining;
-static void sized_buffer_putch(char*& bufptr, char ch)
-{
-    if (__vsnprintf_space_remaining) {
-        *bufptr++ = ch;
-        --__vsnprintf_space_remaining;
-    }
-}
-
 int vsnprintf(char* buffer, size_t size, const char* fmt, va_list ap)
 {
-    __vsnprintf_space_remaining = size;
-    int ret = printf_internal(sized_buffer_putch, buffer, fmt, ap);
-    buffer[ret] = '\0';
+    // Whatever doesn't fit, with room left for the terminator, is counted but not written.
+    size_t space_remaining = size ? size - 1 : 0;
+    int ret = printf_chunked([&space_remaining] (char*& bufptr, const char* characters, size_t length) {
+        size_t count = min(length, space_remaining);
+        memcpy(bufptr, characters, count);
+        bufptr += count;
+        space_remaining -= count;
+    }, buffer, fmt, ap);
+    if (size)
+        buffer[min((size_t)ret, size - 1)] = '\0';
     return ret;
 }
 
@@ -361,7 +542,6 @@ int snprintf(char* buffer, size_t size, const char* fmt, ...)
     va_list ap;
     va_start(ap, fmt);
     int ret = vsnprintf(buffer, size, fmt, ap);
-    buffer[ret] = '\0';
     va_end(ap);
     return ret;
 }
@@ -411,7 +591,9 @@ FILE* fdopen(int fd, const char* mode)
 int fclose(FILE* stream)
 {
     fflush(stream);
+    forget_FILE(stream);
     int rc = close(stream->fd);
+    free_buffer(*stream);
     free(stream);
     return rc;
 }
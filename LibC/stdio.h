@@ -7,7 +7,7 @@
 #include <stdarg.h>
 #include <limits.h>
 
-#define BUFSIZ 1024
+#define BUFSIZ 4096
 
 __BEGIN_DECLS
  #ifndef EOF
@@ -32,6 +32,15 @@ struct __STDIO_FILE {
     size_t buffer_index;
     int have_ungotten;
     char ungotten;
+    // Held by one thread at a time, recursively. See flockfile().
+    pthread_mutex_t lock;
+    pthread_t lock_owner;
+    int lock_level;
+    // Whether |buffer| came from malloc() and is ours to free.
+    int buffer_is_allocated;
+    // All streams made by fopen() and friends, for fflush(nullptr) and exit().
+    struct __STDIO_FILE* next_open;
+    struct __STDIO_FILE* previous_open;
     char default_buffer[BUFSIZ];
 };
 
@@ -63,6 +72,9 @@ void clearerr(FILE*);
 int ferror(FILE*);
 int feof(FILE*);
 int fflush(FILE*);
+void flockfile(FILE*);
+int ftrylockfile(FILE*);
+void funlockfile(FILE*);
 size_t fread(void* ptr, size_t size, size_t nmemb, FILE*);
 size_t fwrite(const void* ptr, size_t size, size_t nmemb, FILE*);
 int vprintf(const char* fmt, va_list);
@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <AK/Assertions.h>
 #include <AK/Types.h>
 #include <Kernel/Syscall.h>
@@ -19,105 +20,355 @@ extern "C" {
 #define MALLOC_SCRUB_BYTE 0x85
 #define FREE_SCRUB_BYTE 0x82
 
+// In front of every block malloc() hands out.
 struct MallocHeader {
-    uint16_t first_chunk_index;
-    uint16_t chunk_count : 15;
-    bool is_mmap : 1;
     size_t size;
+    union {
+        uint16_t size_class;
+        // How many pages an mmap()'d block has, which can be more than it needs. 0 if too many to say here.
+        uint16_t page_count;
+    };
+    bool is_mmap;
+    byte unused;
 };
+static_assert(sizeof(MallocHeader) == 8);
 
-#define CHUNK_SIZE  32
-#define POOL_SIZE   4 * 1048576
+// While a block is free, its first word links it to the next free one of its class.
+struct FreeBlock {
+    FreeBlock* next;
+};
 
-static const size_t malloc_budget = POOL_SIZE;
-static byte s_malloc_map[POOL_SIZE / CHUNK_SIZE / 8];
-static byte* s_malloc_pool;
+// Blocks come in these sizes, header included. Anything bigger gets mmap()'d on its own.
+static const size_t s_size_classes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+    1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384,
+};
+static const int size_class_count = sizeof(s_size_classes) / sizeof(s_size_classes[0]);
+static const size_t max_class_size = 16384;
+static const size_t size_class_granularity = 16;
 
-static uint32_t s_malloc_sum_alloc = 0;
-static uint32_t s_malloc_sum_free = POOL_SIZE;
+// Which class each size goes in, in steps of the granularity, so finding it never needs a search.
+static byte s_class_for_size[max_class_size / size_class_granularity + 1];
 
-void* malloc(size_t size)
+// Blocks are carved out of chunks this big, one class to a chunk. Chunks stay around, their blocks just go back on the free lists.
+static const size_t chunk_size = 65536;
+
+// Shared by every thread, and only touched when a thread's own cache runs out or has too much.
+static FreeBlock* s_free_lists[size_class_count];
+static pthread_mutex_t s_malloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+class MallocLocker {
+public:
+    MallocLocker() { pthread_mutex_lock(&s_malloc_lock); }
+    ~MallocLocker() { pthread_mutex_unlock(&s_malloc_lock); }
+};
+
+// Each thread keeps some free blocks of every class for itself, so most calls don't lock anything.
+struct ThreadCache {
+    FreeBlock* free_lists[size_class_count];
+    int counts[size_class_count];
+};
+
+static pthread_key_t s_thread_cache_key = -1;
+
+// Big blocks that were freed are kept around a while, so the next one that size doesn't cost an mmap(),
+// page faults on every page and an munmap() again. They're bucketed by the power of two their page count is in.
+struct CachedLargeBlock {
+    void* address;
+    size_t page_count;
+};
+static const int large_block_bucket_count = 16;
+static const int max_cached_large_blocks_per_bucket = 8;
+static const size_t max_cached_large_block_size = 4 * 1048576;
+static const size_t max_large_block_cache_size = 16 * 1048576;
+static CachedLargeBlock s_large_block_cache[large_block_bucket_count][max_cached_large_blocks_per_bucket];
+static int s_large_block_cache_counts[large_block_bucket_count];
+static size_t s_large_block_cache_size;
+
+static inline int class_for_size(size_t real_size)
 {
-    if (size == 0)
+    return s_class_for_size[(real_size + size_class_granularity - 1) / size_class_granularity];
+}
+
+// How many blocks a thread cache takes from the shared lists at once, and gives back when it has twice that.
+static inline int batch_size(int size_class)
+{
+    return max(2, min(32, (int)(16384 / s_size_classes[size_class])));
+}
+
+static bool carve_chunk(int size_class)
+{
+    auto* chunk = (byte*)mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+    if (chunk == MAP_FAILED)
+        return false;
+    set_mmap_name(chunk, chunk_size, "malloc chunk");
+    size_t block_size = s_size_classes[size_class];
+    for (size_t offset = chunk_size / block_size * block_size; offset;) {
+        offset -= block_size;
+        auto* block = (FreeBlock*)(chunk + offset);
+        block->next = s_free_lists[size_class];
+        s_free_lists[size_class] = block;
+    }
+    return true;
+}
+
+// Moves up to |count| blocks of |size_class| from the shared lists onto |list|. Call with the lock held.
+static int take_from_shared_list(int size_class, int count, FreeBlock*& list)
+{
+    int taken = 0;
+    while (taken < count) {
+        auto* block = s_free_lists[size_class];
+        if (!block) {
+            if (!carve_chunk(size_class))
+                break;
+            continue;
+        }
+        s_free_lists[size_class] = block->next;
+        block->next = list;
+        list = block;
+        ++taken;
+    }
+    return taken;
+}
+
+// Moves |count| blocks off the front of |list| to the shared lists. Call with the lock held.
+static void give_to_shared_list(int size_class, int count, FreeBlock*& list)
+{
+    for (int i = 0; i < count && list; ++i) {
+        auto* block = list;
+        list = block->next;
+        block->next = s_free_lists[size_class];
+        s_free_lists[size_class] = block;
+    }
+}
+
+static void destroy_thread_cache(void* value)
+{
+    auto* cache = (ThreadCache*)value;
+    MallocLocker locker;
+    for (int i = 0; i < size_class_count; ++i)
+        give_to_shared_list(i, cache->counts[i], cache->free_lists[i]);
+    FreeBlock* cache_block = (FreeBlock*)cache;
+    give_to_shared_list(class_for_size(sizeof(ThreadCache)), 1, cache_block);
+}
+
+// The cache itself is a bare block, not a malloc() one, so making it doesn't come back in here.
+static ThreadCache* thread_cache()
+{
+    if (s_thread_cache_key < 0)
         return nullptr;
+    auto* cache = (ThreadCache*)pthread_getspecific(s_thread_cache_key);
+    if (cache)
+        return cache;
+    FreeBlock* block = nullptr;
+    {
+        MallocLocker locker;
+        if (!take_from_shared_list(class_for_size(sizeof(ThreadCache)), 1, block))
+            return nullptr;
+    }
+    cache = (ThreadCache*)block;
+    memset(cache, 0, sizeof(ThreadCache));
+    pthread_setspecific(s_thread_cache_key, cache);
+    return cache;
+}
 
-    // We need space for the MallocHeader structure at the head of the block.
-    size_t real_size = size + sizeof(MallocHeader);
+static FreeBlock* take_block(int size_class)
+{
+    auto* cache = thread_cache();
+    if (!cache) {
+        MallocLocker locker;
+        FreeBlock* block = nullptr;
+        take_from_shared_list(size_class, 1, block);
+        return block;
+    }
+    if (!cache->free_lists[size_class]) {
+        MallocLocker locker;
+        cache->counts[size_class] += take_from_shared_list(size_class, batch_size(size_class), cache->free_lists[size_class]);
+    }
+    auto* block = cache->free_lists[size_class];
+    if (!block)
+        return nullptr;
+    cache->free_lists[size_class] = block->next;
+    --cache->counts[size_class];
+    return block;
+}
+
+static void give_block(int size_class, FreeBlock* block)
+{
+    auto* cache = thread_cache();
+    if (!cache) {
+        MallocLocker locker;
+        block->next = nullptr;
+        give_to_shared_list(size_class, 1, block);
+        return;
+    }
+    block->next = cache->free_lists[size_class];
+    cache->free_lists[size_class] = block;
+    if (++cache->counts[size_class] >= 2 * batch_size(size_class)) {
+        int count = batch_size(size_class);
+        MallocLocker locker;
+        give_to_shared_list(size_class, count, cache->free_lists[size_class]);
+        cache->counts[size_class] -= count;
+    }
+}
+
+static inline size_t round_up_to_page(size_t size)
+{
+    return (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
 
-    if (real_size >= PAGE_SIZE) {
-        auto* memory = mmap(nullptr, real_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+static inline int large_block_bucket(size_t page_count)
+{
+    return 31 - __builtin_clz(page_count);
+}
+
+static inline size_t mapped_size(const MallocHeader& header)
+{
+    if (header.page_count)
+        return header.page_count * PAGE_SIZE;
+    return round_up_to_page(header.size + sizeof(MallocHeader));
+}
+
+// Takes a cached block with at least |page_count| pages, and fewer than twice that. Call with the lock held.
+static void* take_cached_large_block(size_t page_count, size_t& taken_page_count)
+{
+    int bucket = large_block_bucket(page_count);
+    for (int b = bucket; b <= bucket + 1 && b < large_block_bucket_count; ++b) {
+        auto* blocks = s_large_block_cache[b];
+        int& count = s_large_block_cache_counts[b];
+        // The most recently freed ones are at the end, and likeliest to still be in the TLB and caches.
+        for (int i = count - 1; i >= 0; --i) {
+            if (blocks[i].page_count < page_count || blocks[i].page_count >= 2 * page_count)
+                continue;
+            void* address = blocks[i].address;
+            taken_page_count = blocks[i].page_count;
+            for (int j = i; j < count - 1; ++j)
+                blocks[j] = blocks[j + 1];
+            --count;
+            s_large_block_cache_size -= taken_page_count * PAGE_SIZE;
+            return address;
+        }
+    }
+    return nullptr;
+}
+
+static void release_large_block(void* address, size_t size)
+{
+    int rc = munmap(address, size);
+    if (rc < 0)
+        fprintf(stderr, "free(): munmap(%p) with size %u failed: %s\n", address, size, strerror(errno));
+}
+
+static void give_large_block(MallocHeader* header)
+{
+    size_t size = mapped_size(*header);
+    size_t page_count = size / PAGE_SIZE;
+    if (size > max_cached_large_block_size) {
+        release_large_block(header, size);
+        return;
+    }
+    void* evicted_address = nullptr;
+    size_t evicted_size = 0;
+    bool cached = false;
+    {
+        MallocLocker locker;
+        int bucket = large_block_bucket(page_count);
+        auto* blocks = s_large_block_cache[bucket];
+        int& count = s_large_block_cache_counts[bucket];
+        if (count == max_cached_large_blocks_per_bucket) {
+            // The one freed longest ago makes room.
+            evicted_address = blocks[0].address;
+            evicted_size = blocks[0].page_count * PAGE_SIZE;
+            for (int i = 0; i < count - 1; ++i)
+                blocks[i] = blocks[i + 1];
+            --count;
+            s_large_block_cache_size -= evicted_size;
+        }
+        if (s_large_block_cache_size + size <= max_large_block_cache_size) {
+            blocks[count++] = { header, page_count };
+            s_large_block_cache_size += size;
+            cached = true;
+        }
+    }
+    if (evicted_address)
+        release_large_block(evicted_address, evicted_size);
+    if (!cached)
+        release_large_block(header, size);
+}
+
+static void* allocate_large_block(size_t size)
+{
+    size_t real_size = round_up_to_page(size + sizeof(MallocHeader));
+    size_t page_count = real_size / PAGE_SIZE;
+    void* memory = nullptr;
+    if (real_size <= max_cached_large_block_size) {
+        MallocLocker locker;
+        memory = take_cached_large_block(page_count, page_count);
+    }
+    if (!memory) {
+        memory = mmap(nullptr, real_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
         if (memory == MAP_FAILED) {
             fprintf(stderr, "malloc() failed to mmap() for a %u-byte allocation: %s", size, strerror(errno));
             volatile char* crashme = (char*)0xf007d00d;
             *crashme = 0;
             return nullptr;
         }
-        auto* header = (MallocHeader*)(memory);
-        byte* ptr = ((byte*)header) + sizeof(MallocHeader);
-        header->chunk_count = 0;
-        header->first_chunk_index = 0;
-        header->size = real_size;
-        header->is_mmap = true;
-        return ptr;
     }
+    auto* header = (MallocHeader*)(memory);
+    header->size = size;
+    header->page_count = page_count <= 0xffff ? page_count : 0;
+    header->is_mmap = true;
+    return ((byte*)header) + sizeof(MallocHeader);
+}
 
-    if (s_malloc_sum_free < real_size) {
-        fprintf(stderr, "malloc(): Out of memory\ns_malloc_sum_free=%u, real_size=%u\n", s_malloc_sum_free, real_size);
-        assert(false);
+// Makes a big block |size| without copying it, if it can: by using what it already has to spare,
+// or by having the kernel move its pages somewhere with room for more.
+static void* resize_large_block(MallocHeader* header, size_t size)
+{
+    size_t old_mapped_size = mapped_size(*header);
+    size_t new_mapped_size = round_up_to_page(size + sizeof(MallocHeader));
+    // Shrinking a lot gives the rest back, otherwise it's just less of the block being used.
+    if (new_mapped_size <= old_mapped_size && new_mapped_size * 2 > old_mapped_size) {
+        header->size = size;
+        return ((byte*)header) + sizeof(MallocHeader);
     }
+    auto* memory = mremap(header, old_mapped_size, new_mapped_size, MREMAP_MAYMOVE);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    header = (MallocHeader*)memory;
+    size_t page_count = new_mapped_size / PAGE_SIZE;
+    header->size = size;
+    header->page_count = page_count <= 0xffff ? page_count : 0;
+    return ((byte*)header) + sizeof(MallocHeader);
+}
 
-    size_t chunks_needed = real_size / CHUNK_SIZE;
-    if (real_size % CHUNK_SIZE)
-        chunks_needed++;
+void* malloc(size_t size)
+{
+    if (size == 0)
+        return nullptr;
 
-    size_t chunks_here = 0;
-    size_t first_chunk = 0;
+    // We need space for the MallocHeader structure at the head of the block.
+    size_t real_size = size + sizeof(MallocHeader);
 
-    for (unsigned i = 0; i < (POOL_SIZE / CHUNK_SIZE / 8); ++i) {
-        if (s_malloc_map[i] == 0xff) {
-            // Skip over completely full bucket.
-            chunks_here = 0;
-            continue;
-        }
+    if (real_size > max_class_size)
+        return allocate_large_block(size);
 
-        // FIXME: This scan can be optimized further with TZCNT.
-        for (unsigned j = 0; j < 8; ++j) {
-            if ((s_malloc_map[i] & (1<<j))) {
-                // This is in use, so restart chunks_here counter.
-                chunks_here = 0;
-                continue;
-            }
-            if (chunks_here == 0) {
-                // Mark where potential allocation starts.
-                first_chunk = i * 8 + j;
-            }
-
-            ++chunks_here;
-
-            if (chunks_here == chunks_needed) {
-                auto* header = (MallocHeader*)(s_malloc_pool + (first_chunk * CHUNK_SIZE));
-                byte* ptr = ((byte*)header) + sizeof(MallocHeader);
-                header->chunk_count = chunks_needed;
-                header->first_chunk_index = first_chunk;
-                header->is_mmap = false;
-                header->size = size;
-
-                for (size_t k = first_chunk; k < (first_chunk + chunks_needed); ++k)
-                    s_malloc_map[k / 8] |= 1 << (k % 8);
-
-                s_malloc_sum_alloc += header->chunk_count * CHUNK_SIZE;
-                s_malloc_sum_free  -= header->chunk_count * CHUNK_SIZE;
-
-                memset(ptr, MALLOC_SCRUB_BYTE, (header->chunk_count * CHUNK_SIZE) - sizeof(MallocHeader));
-                return ptr;
-            }
-        }
+    int size_class = class_for_size(real_size);
+    auto* block = take_block(size_class);
+    if (!block) {
+        fprintf(stderr, "malloc(): Out of memory (couldn't get a chunk for size %u)\n", size);
+        volatile char* crashme = (char*)0xc007d00d;
+        *crashme = 0;
+        return nullptr;
     }
 
-    fprintf(stderr, "malloc(): Out of memory (no consecutive chunks found for size %u)\n", size);
-    volatile char* crashme = (char*)0xc007d00d;
-    *crashme = 0;
-    return nullptr;
+    auto* header = (MallocHeader*)block;
+    byte* ptr = ((byte*)header) + sizeof(MallocHeader);
+    header->size = size;
+    header->size_class = size_class;
+    header->is_mmap = false;
+    memset(ptr, MALLOC_SCRUB_BYTE, s_size_classes[size_class] - sizeof(MallocHeader));
+    return ptr;
 }
 
 void free(void* ptr)
@@ -127,27 +378,28 @@ void free(void* ptr)
 
     auto* header = (MallocHeader*)((((byte*)ptr) - sizeof(MallocHeader)));
     if (header->is_mmap) {
-        int rc = munmap(header, header->size);
-        if (rc < 0)
-            fprintf(stderr, "free(): munmap(%p) for allocation %p with size %u failed: %s\n", header, ptr, header->size, strerror(errno));
+        give_large_block(header);
         return;
     }
 
-    for (unsigned i = header->first_chunk_index; i < (header->first_chunk_index + header->chunk_count); ++i)
-        s_malloc_map[i / 8] &= ~(1 << (i % 8));
-
-    s_malloc_sum_alloc -= header->chunk_count * CHUNK_SIZE;
-    s_malloc_sum_free += header->chunk_count * CHUNK_SIZE;
-
-    memset(header, FREE_SCRUB_BYTE, header->chunk_count * CHUNK_SIZE);
+    int size_class = header->size_class;
+    memset(header, FREE_SCRUB_BYTE, s_size_classes[size_class]);
+    give_block(size_class, (FreeBlock*)header);
 }
 
 void __malloc_init()
 {
-    s_malloc_pool = (byte*)mmap(nullptr, malloc_budget, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
-    int rc = set_mmap_name(s_malloc_pool, malloc_budget, "malloc pool");
-    if (rc < 0)
-        perror("set_mmap_name failed");
+    int size_class = 0;
+    for (size_t i = 0; i < sizeof(s_class_for_size); ++i) {
+        while (s_size_classes[size_class] < i * size_class_granularity)
+            ++size_class;
+        s_class_for_size[i] = size_class;
+    }
+    int rc = pthread_key_create(&s_thread_cache_key, destroy_thread_cache);
+    if (rc != 0) {
+        // Everyone shares the lists then, which is slower but works.
+        s_thread_cache_key = -1;
+    }
 }
 
 void* calloc(size_t count, size_t size)
@@ -166,6 +418,16 @@ void* realloc(void *ptr, size_t size)
     size_t old_size = header->size;
     if (size == old_size)
         return ptr;
+    // Staying in the same class, the block it has is already the right one.
+    size_t real_size = size + sizeof(MallocHeader);
+    if (size && !header->is_mmap && real_size <= max_class_size && class_for_size(real_size) == header->size_class) {
+        header->size = size;
+        return ptr;
+    }
+    if (header->is_mmap && real_size > max_class_size) {
+        if (auto* resized_ptr = resize_large_block(header, size))
+            return resized_ptr;
+    }
     auto* new_ptr = malloc(size);
     memcpy(new_ptr, ptr, min(old_size, size));
     free(ptr);
@@ -182,6 +444,7 @@ void exit(int status)
         __atexit_handlers[i]();
     extern void _fini();
     _fini();
+    fflush(nullptr);
     _exit(status);
     assert(false);
 }
@@ -47,6 +47,8 @@ size_t strcspn(const char* s, const char* reject)
 
 size_t strlen(const char* str)
 {
+    if (g_cpu_has_sse2)
+        return sse2_strlen(str);
     size_t len = 0;
     while (*(str++))
         ++len;
@@ -72,6 +74,8 @@ char* strndup(const char* str, size_t maxlen)
 
 int strcmp(const char* s1, const char* s2)
 {
+    if (g_cpu_has_sse2)
+        return sse2_strcmp(s1, s2);
     while (*s1 == *s2++)
         if (*s1++ == 0)
             return 0;
@@ -93,6 +97,8 @@ int strncmp(const char* s1, const char* s2, size_t n)
 
 int memcmp(const void* v1, const void* v2, size_t n)
 {
+    if (n >= 16 && g_cpu_has_sse2)
+        return sse2_memcmp(v1, v2, n);
     auto* s1 = (const uint8_t*)v1;
     auto* s2 = (const uint8_t*)v2;
     while (n-- > 0) {
@@ -104,27 +110,33 @@ int memcmp(const void* v1, const void* v2, size_t n)
 
 void* memcpy(void* dest_ptr, const void* src_ptr, size_t n)
 {
+    if (n >= 64 && g_cpu_has_sse2)
+        return sse2_memcpy(dest_ptr, src_ptr, n);
     if (n >= 1024)
         return mmx_memcpy(dest_ptr, src_ptr, n);
 
     dword dest = (dword)dest_ptr;
     dword src = (dword)src_ptr;
-    // FIXME: Support starting at an unaligned address.
-    if (!(dest & 0x3) && !(src & 0x3) && n >= 12) {
-        size_t dwords = n / sizeof(dword);
+    if (n >= 12) {
+        // Get the destination aligned, the source can be wherever it wants.
+        size_t prologue = (4 - (dest & 0x3)) & 0x3;
+        size_t dwords = (n - prologue) / sizeof(dword);
+        n -= prologue + dwords * sizeof(dword);
         asm volatile(
+            "rep movsb\n"
+            "movl %%edx, %%ecx\n"
             "rep movsl\n"
-            : "=S"(src), "=D"(dest)
-            : "S"(src), "D"(dest), "c"(dwords)
+            : "=S"(src), "=D"(dest), "=c"(prologue), "=d"(dwords)
+            : "0"(src), "1"(dest), "2"(prologue), "3"(dwords)
             : "memory"
         );
-        n -= dwords * sizeof(dword);
         if (n == 0)
             return dest_ptr;
     }
     asm volatile(
         "rep movsb\n"
-        :: "S"(src), "D"(dest), "c"(n)
+        : "=S"(src), "=D"(dest), "=c"(n)
+        : "0"(src), "1"(dest), "2"(n)
         : "memory"
     );
     return dest_ptr;
@@ -133,19 +145,21 @@ void* memcpy(void* dest_ptr, const void* src_ptr, size_t n)
 void* memset(void* dest_ptr, int c, size_t n)
 {
     dword dest = (dword)dest_ptr;
-    // FIXME: Support starting at an unaligned address.
-    if (!(dest & 0x3) && n >= 12) {
-        size_t dwords = n / sizeof(dword);
+    if (n >= 12) {
+        size_t prologue = (4 - (dest & 0x3)) & 0x3;
+        size_t dwords = (n - prologue) / sizeof(dword);
+        n -= prologue + dwords * sizeof(dword);
         dword expanded_c = (byte)c;
         expanded_c |= expanded_c << 8;
         expanded_c |= expanded_c << 16;
         asm volatile(
+            "rep stosb\n"
+            "movl %%edx, %%ecx\n"
             "rep stosl\n"
-            : "=D"(dest)
-            : "D"(dest), "c"(dwords), "a"(expanded_c)
+            : "=D"(dest), "=c"(prologue), "=d"(dwords)
+            : "0"(dest), "1"(prologue), "2"(dwords), "a"(expanded_c)
             : "memory"
         );
-        n -= dwords * sizeof(dword);
         if (n == 0)
             return dest_ptr;
     }
@@ -190,6 +204,8 @@ char* strncpy(char* dest, const char* src, size_t n)
 
 char* strchr(const char* str, int c)
 {
+    if (g_cpu_has_sse2)
+        return const_cast<char*>(sse2_strchr(str, c));
     char ch = c;
     for (;; ++str) {
         if (*str == ch)
@@ -201,6 +217,8 @@ char* strchr(const char* str, int c)
 
 void* memchr(const void* ptr, int c, size_t size)
 {
+    if (size >= 16 && g_cpu_has_sse2)
+        return const_cast<void*>(sse2_memchr(ptr, c, size));
     char ch = c;
     char* cptr = (char*)ptr;
     for (size_t i = 0; i < size; ++i) {
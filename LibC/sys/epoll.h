@@ -0,0 +1,39 @@
+#pragma once
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+#define EPOLLIN      (1u << 0)
+#define EPOLLOUT     (1u << 2)
+#define EPOLLERR     (1u << 3)
+#define EPOLLHUP     (1u << 4)
+#define EPOLLONESHOT (1u << 30)
+#define EPOLLET      (1u << 31)
+
+#define EPOLL_CLOEXEC 02000000
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+typedef union epoll_data {
+    void* ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+
+struct epoll_event {
+    uint32_t events;
+    epoll_data_t data;
+};
+
+int epoll_create(int size);
+int epoll_create1(int flags);
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event*);
+// timeout is in milliseconds, -1 waits forever.
+int epoll_wait(int epfd, struct epoll_event* events, int max_events, int timeout);
+
+__END_DECLS
@@ -11,5 +11,13 @@ enum IOCtlNumber {
     TIOCSCTTY,
     TIOCNOTTY,
     TIOCSWINSZ,
+    SIOCGIFADDR,
+    SIOCSIFADDR,
+    SIOCGIFNETMASK,
+    SIOCSIFNETMASK,
+    SIOCGIFMTU,
+    SIOCSIFMTU,
+    SIOCADDRT,
+    SIOCDELRT,
 };
 
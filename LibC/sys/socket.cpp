@@ -58,6 +58,20 @@ ssize_t recv(int sockfd, void* buffer, size_t buffer_length, int flags)
     return recvfrom(sockfd, buffer, buffer_length, flags, nullptr, nullptr);
 }
 
+int recvmmsg(int sockfd, struct mmsghdr* messages, unsigned int count, int flags, struct timespec* timeout)
+{
+    Syscall::SC_recvmmsg_params params { sockfd, messages, count, flags, timeout };
+    int rc = syscall(SC_recvmmsg, &params);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int sendmmsg(int sockfd, struct mmsghdr* messages, unsigned int count, int flags)
+{
+    Syscall::SC_sendmmsg_params params { sockfd, messages, count, flags };
+    int rc = syscall(SC_sendmmsg, &params);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
 int getsockopt(int sockfd, int level, int option, void* value, socklen_t* value_size)
 {
     Syscall::SC_getsockopt_params params { sockfd, level, option, value, value_size };
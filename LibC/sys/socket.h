@@ -3,6 +3,7 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 __BEGIN_DECLS
 
@@ -17,6 +18,7 @@ __BEGIN_DECLS
 #define SOCK_STREAM 1
 #define SOCK_DGRAM 2
 #define SOCK_RAW 3
+#define SOCK_SEQPACKET 5
 #define SOCK_NONBLOCK 04000
 #define SOCK_CLOEXEC 02000000
 
@@ -50,6 +52,29 @@ struct sockaddr_in {
 
 #define SO_RCVTIMEO 1
 #define SO_SNDTIMEO 2
+#define SO_RCVBUF 3
+// How many datagrams were dropped for lack of room in the receive buffer. Can only be read.
+#define SO_RCVDROPS 4
+// The errno a non-blocking connect() failed with, or 0. Can only be read.
+#define SO_ERROR 5
+
+#define MSG_TRUNC 0x20
+#define MSG_DONTWAIT 0x40
+
+struct msghdr {
+    void* msg_name;
+    socklen_t msg_namelen;
+    struct iovec* msg_iov;
+    int msg_iovlen;
+    void* msg_control;
+    socklen_t msg_controllen;
+    int msg_flags;
+};
+
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
 
 int socket(int domain, int type, int protocol);
 int bind(int sockfd, const struct sockaddr* addr, socklen_t);
@@ -60,6 +85,13 @@ ssize_t send(int sockfd, const void*, size_t, int flags);
 ssize_t sendto(int sockfd, const void*, size_t, int flags, const struct sockaddr*, socklen_t);
 ssize_t recv(int sockfd, void*, size_t, int flags);
 ssize_t recvfrom(int sockfd, void*, size_t, int flags, struct sockaddr*, socklen_t*);
+struct timespec;
+
+// Waits for the first datagram unless MSG_DONTWAIT is given, then takes as many more as are already there,
+// up to |vlen|. Returns how many there were. There's no timeout other than SO_RCVTIMEO, so |timeout| must be null.
+int recvmmsg(int sockfd, struct mmsghdr*, unsigned int vlen, int flags, struct timespec* timeout);
+// Sends up to |vlen| datagrams, and returns how many were sent before any error.
+int sendmmsg(int sockfd, struct mmsghdr*, unsigned int vlen, int flags);
 int getsockopt(int sockfd, int level, int option, void*, socklen_t*);
 int setsockopt(int sockfd, int level, int option, const void*, socklen_t);
 
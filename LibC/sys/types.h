@@ -37,6 +37,27 @@ typedef uint32_t clock_t;
 #define __socklen_t uint32_t
 typedef __socklen_t socklen_t;
 
+// The address of the thread's control block, see pthread.cpp.
+typedef uint32_t pthread_t;
+typedef int pthread_key_t;
+
+// Both are built on futex(). Locking an uncontended mutex doesn't enter the kernel.
+typedef struct {
+    // 0: unlocked, 1: locked, 2: locked and someone may be waiting.
+    int __state;
+} pthread_mutex_t;
+
+typedef struct {
+    int __sequence;
+} pthread_cond_t;
+
+typedef struct {
+    int __detach_state;
+} pthread_attr_t;
+
+typedef int pthread_mutexattr_t;
+typedef int pthread_condattr_t;
+
 struct timeval {
     time_t tv_sec;
     suseconds_t tv_usec;
@@ -170,6 +170,20 @@ ssize_t write(int fd, const void* buf, size_t count)
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
+ssize_t pread(int fd, void* buf, size_t count, off_t offset)
+{
+    Syscall::SC_pread_params params { fd, buf, (ssize_t)count, offset };
+    int rc = syscall(SC_pread, &params);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset)
+{
+    Syscall::SC_pread_params params { fd, const_cast<void*>(buf), (ssize_t)count, offset };
+    int rc = syscall(SC_pwrite, &params);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
 int ttyname_r(int fd, char* buffer, size_t size)
 {
     int rc = syscall(SC_ttyname_r, fd, buffer, size);
@@ -366,6 +380,12 @@ long fpathconf(int fd, int name)
     assert(false);
 }
 
+long sysconf(int name)
+{
+    int rc = syscall(SC_sysconf, name);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
 long pathconf(const char* path, int name)
 {
     (void) path;
@@ -424,6 +444,19 @@ int seal_shared_buffer(int shared_buffer_id)
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
+int create_sealed_shared_buffer(pid_t peer_pid, const void* data, int size, void** buffer)
+{
+    Syscall::SC_create_sealed_shared_buffer_params params { peer_pid, data, size, buffer };
+    int rc = syscall(SC_create_sealed_shared_buffer, &params);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int share_buffer_with(int shared_buffer_id, pid_t peer_pid)
+{
+    int rc = syscall(SC_share_buffer_with, shared_buffer_id, peer_pid);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
 char* getlogin()
 {
     static char __getlogin_buffer[256];
@@ -434,10 +467,10 @@ char* getlogin()
     return nullptr;
 }
 
-int create_thread(int(*entry)(void*), void* argument)
+void exit_thread(int code)
 {
-    int rc = syscall(SC_create_thread, entry, argument);
-    __RETURN_WITH_ERRNO(rc, rc, -1);
+    syscall(SC_exit_thread, code);
+    ASSERT_NOT_REACHED();
 }
 
 int ftruncate(int fd, off_t length)
@@ -445,6 +478,18 @@ int ftruncate(int fd, off_t length)
     ASSERT_NOT_REACHED();
 }
 
+int fsync(int fd)
+{
+    int rc = syscall(SC_fsync, fd);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int fdatasync(int fd)
+{
+    int rc = syscall(SC_fdatasync, fd);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
 int gettid()
 {
     int rc = syscall(SC_gettid);
@@ -457,4 +502,22 @@ int donate(int tid)
     __RETURN_WITH_ERRNO(rc, rc, -1);
 }
 
+int profiling_enable(pid_t pid)
+{
+    int rc = syscall(SC_profiling_enable, pid);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int profiling_disable(pid_t pid)
+{
+    int rc = syscall(SC_profiling_disable, pid);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
+int futex(int* userspace_address, int futex_op, int value)
+{
+    int rc = syscall(SC_futex, userspace_address, futex_op, value);
+    __RETURN_WITH_ERRNO(rc, rc, -1);
+}
+
 }
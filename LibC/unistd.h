@@ -14,14 +14,25 @@ __BEGIN_DECLS
 
 extern char** environ;
 
+#define FUTEX_WAIT 1
+#define FUTEX_WAKE 2
+
 int gettid();
 int donate(int tid);
+// Samples where |pid| is on every timer tick, for reading out of /proc/<pid>/profile.
+int profiling_enable(pid_t);
+int profiling_disable(pid_t);
+// FUTEX_WAIT: Sleep until woken, if *userspace_address is still value. FUTEX_WAKE: Wake up to value waiters.
+int futex(int* userspace_address, int futex_op, int value);
 int create_thread(int(*)(void*), void*);
+__attribute__((noreturn)) void exit_thread(int);
 int create_shared_buffer(pid_t peer_pid, int, void** buffer);
 void* get_shared_buffer(int shared_buffer_id);
 int release_shared_buffer(int shared_buffer_id);
 int seal_shared_buffer(int shared_buffer_id);
 int get_shared_buffer_size(int shared_buffer_id);
+int create_sealed_shared_buffer(pid_t peer_pid, const void* data, int size, void** buffer);
+int share_buffer_with(int shared_buffer_id, pid_t peer_pid);
 int read_tsc(unsigned* lsw, unsigned* msw);
 inline int getpagesize() { return 4096; }
 pid_t fork();
@@ -52,6 +63,8 @@ int creat(const char* path, mode_t);
 int open(const char* path, int options, ...);
 ssize_t read(int fd, void* buf, size_t count);
 ssize_t write(int fd, const void* buf, size_t count);
+ssize_t pread(int fd, void* buf, size_t count, off_t);
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t);
 int close(int fd);
 pid_t waitpid(pid_t, int* wstatus, int options);
 int chdir(const char* path);
@@ -84,11 +97,19 @@ long pathconf(const char *path, int name);
 char* getlogin();
 int chown(const char* pathname, uid_t, gid_t);
 int ftruncate(int fd, off_t length);
+int fsync(int fd);
+int fdatasync(int fd);
 
 enum {
     _PC_NAME_MAX,
 };
 
+#define _SC_NPROCESSORS_CONF 0
+#define _SC_NPROCESSORS_ONLN 1
+#define _SC_PAGESIZE 2
+
+long sysconf(int name);
+
 #define WEXITSTATUS(status) (((status) & 0xff00) >> 8)
 #define WTERMSIG(status) ((status) & 0x7f)
 #define WIFEXITED(status) (WTERMSIG(status) == 0)
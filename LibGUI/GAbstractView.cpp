@@ -36,6 +36,11 @@ void GAbstractView::did_update_model()
     model_notification(GModelNotification(GModelNotification::ModelUpdated));
 }
 
+void GAbstractView::did_update_model_rows(const GModelNotification&)
+{
+    did_update_model();
+}
+
 void GAbstractView::did_update_selection()
 {
 }
@@ -16,6 +16,8 @@ public:
 
     virtual bool accepts_focus() const override { return true; }
     virtual void did_update_model();
+    // Views that can repaint just the rows in question override this; the rest redo everything.
+    virtual void did_update_model_rows(const GModelNotification&);
     virtual void did_update_selection();
 
     Function<void(const GModelNotification&)> on_model_notification;
@@ -7,7 +7,7 @@
 #include <SharedGraphics/GraphicsBitmap.h>
 #include <LibGUI/GShortcut.h>
 
-class GAction : public Retainable<GAction> {
+class GAction : public SingleThreadedRetainable<GAction> {
 public:
     static Retained<GAction> create(const String& text, Function<void(const GAction&)> callback)
     {
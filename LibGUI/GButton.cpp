@@ -7,6 +7,7 @@
 GButton::GButton(GWidget* parent)
     : GWidget(parent)
 {
+    set_layer_caching_enabled(true);
 }
 
 GButton::~GButton()
@@ -38,16 +38,11 @@ void GClipboard::set_data(const String& data)
 {
     WSAPI_ClientMessage request;
     request.type = WSAPI_ClientMessage::Type::SetClipboardContents;
-    auto shared_buffer = SharedBuffer::create(GEventLoop::current().server_pid(), data.length() + 1);
+    auto shared_buffer = SharedBuffer::create_sealed(GEventLoop::current().server_pid(), data.is_empty() ? "" : data.characters(), data.length() + 1);
     if (!shared_buffer) {
         dbgprintf("GClipboard::set_data() failed to create a shared buffer\n");
         return;
     }
-    if (!data.is_empty())
-        memcpy(shared_buffer->data(), data.characters(), data.length() + 1);
-    else
-        ((byte*)shared_buffer->data())[0] = '\0';
-    shared_buffer->seal();
     request.clipboard.shared_buffer_id = shared_buffer->shared_buffer_id();
     request.clipboard.contents_size = data.length();
     auto response = GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidSetClipboardContents);
@@ -4,6 +4,7 @@
 #include <SharedGraphics/Rect.h>
 #include <AK/AKString.h>
 #include <AK/Types.h>
+#include <AK/Vector.h>
 #include <AK/WeakPtr.h>
 #include <Kernel/KeyCode.h>
 
@@ -36,6 +37,7 @@ public:
         WindowCloseRequest,
         ChildAdded,
         ChildRemoved,
+        MultiPaint,
     };
 
     GEvent() { }
@@ -77,6 +79,31 @@ private:
     Size m_window_size;
 };
 
+// What a window gets from the server: everything that needs repainting in one go.
+class GMultiPaintEvent final : public GEvent {
+public:
+    GMultiPaintEvent(Vector<Rect>&& rects, const Size& window_size)
+        : GEvent(GEvent::MultiPaint)
+        , m_rects(move(rects))
+        , m_window_size(window_size)
+    {
+    }
+
+    const Vector<Rect>& rects() const { return m_rects; }
+    Size window_size() const { return m_window_size; }
+
+    // For folding a later paint of the same window into this one.
+    void set_rects(Vector<Rect>&& rects, const Size& window_size)
+    {
+        m_rects = move(rects);
+        m_window_size = window_size;
+    }
+
+private:
+    Vector<Rect> m_rects;
+    Size m_window_size;
+};
+
 class GResizeEvent final : public GEvent {
 public:
     explicit GResizeEvent(const Size& old_size, const Size& size)
@@ -88,6 +115,7 @@ public:
 
     const Size& old_size() const { return m_old_size; }
     const Size& size() const { return m_size; }
+    void set_size(const Size& size) { m_size = size; }
 private:
     Size m_old_size;
     Size m_size;
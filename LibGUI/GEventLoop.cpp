@@ -5,12 +5,17 @@
 #include <LibGUI/GApplication.h>
 #include <LibGUI/GAction.h>
 #include <LibGUI/GNotifier.h>
+#include <LibGUI/GWidget.h>
 #include <LibGUI/GMenu.h>
+#include <SharedGraphics/ImageDecoder.h>
+#include <WindowServer/WSAPIMessageRing.h>
+#include <LibC/SharedBuffer.h>
 #include <LibC/unistd.h>
 #include <LibC/stdio.h>
 #include <LibC/fcntl.h>
 #include <LibC/string.h>
 #include <LibC/time.h>
+#include <LibC/sys/epoll.h>
 #include <LibC/sys/select.h>
 #include <LibC/sys/socket.h>
 #include <LibC/sys/time.h>
@@ -25,14 +30,26 @@ static GEventLoop* s_main_event_loop;
 static Vector<GEventLoop*>* s_event_loop_stack;
 int GEventLoop::s_event_fd = -1;
 pid_t GEventLoop::s_server_pid = -1;
+SharedBuffer* GEventLoop::s_message_rings_buffer;
+WSAPI_MessageRings* GEventLoop::s_message_rings;
+Vector<WSAPI_ClientMessage>* GEventLoop::s_overflow_messages;
 HashMap<int, OwnPtr<GEventLoop::EventLoopTimer>>* GEventLoop::s_timers;
-HashTable<GNotifier*>* GEventLoop::s_notifiers;
+BinaryHeap<qword, int>* GEventLoop::s_timer_queue;
+HashMap<int, Vector<GNotifier*>>* GEventLoop::s_notifiers;
+int GEventLoop::s_epoll_fd = -1;
 int GEventLoop::s_next_timer_id = 1;
 
+static qword now_in_microseconds()
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return (qword)now.tv_sec * 1000000 + now.tv_usec;
+}
+
 void GEventLoop::connect_to_server()
 {
     ASSERT(s_event_fd == -1);
-    s_event_fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    s_event_fd = socket(AF_LOCAL, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (s_event_fd < 0) {
         perror("socket");
         ASSERT_NOT_REACHED();
@@ -58,11 +75,31 @@ void GEventLoop::connect_to_server()
         ASSERT_NOT_REACHED();
     }
 
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = s_event_fd;
+    rc = epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, s_event_fd, &event);
+    ASSERT(rc == 0);
+
     WSAPI_ClientMessage request;
     request.type = WSAPI_ClientMessage::Type::Greeting;
     request.greeting.client_pid = getpid();
     auto response = sync_request(request, WSAPI_ServerMessage::Type::Greeting);
     s_server_pid = response.greeting.server_pid;
+
+    // The server follows up with the rings we'll use from now on. If it couldn't make any, we stay on the socket.
+    // It may have come in along with the greeting.
+    bool success = wait_for_specific_event(WSAPI_ServerMessage::Type::DidCreateMessageRings, response);
+    ASSERT(success);
+    if (response.message_rings.shared_buffer_id < 0)
+        return;
+    auto buffer = SharedBuffer::create_from_shared_buffer_id(response.message_rings.shared_buffer_id);
+    if (!buffer)
+        return;
+    ASSERT(buffer->size() >= (int)sizeof(WSAPI_MessageRings));
+    s_message_rings_buffer = buffer.leak_ref();
+    s_message_rings = (WSAPI_MessageRings*)s_message_rings_buffer->data();
+    s_overflow_messages = new Vector<WSAPI_ClientMessage>;
 }
 
 GEventLoop::GEventLoop()
@@ -70,7 +107,10 @@ GEventLoop::GEventLoop()
     if (!s_event_loop_stack) {
         s_event_loop_stack = new Vector<GEventLoop*>;
         s_timers = new HashMap<int, OwnPtr<GEventLoop::EventLoopTimer>>;
-        s_notifiers = new HashTable<GNotifier*>;
+        s_timer_queue = new BinaryHeap<qword, int>;
+        s_notifiers = new HashMap<int, Vector<GNotifier*>>;
+        s_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        ASSERT(s_epoll_fd >= 0);
     }
 
     if (!s_main_event_loop) {
@@ -137,11 +177,16 @@ int GEventLoop::exec()
         if (m_exit_requested)
             return m_exit_code;
         process_unprocessed_messages();
+        // Layout goes first, since it can have more to repaint.
+        GWidget::do_pending_layouts();
+        // Everything widgets asked to have repainted since last time goes out together.
+        GWindow::send_pending_invalidations_to_server();
         if (m_queued_events.is_empty()) {
             wait_for_event();
             process_unprocessed_messages();
         }
-        Vector<QueuedEvent> events = move(m_queued_events);
+        // Whatever gets posted while these are delivered waits for the next iteration, so each window paints at most once per iteration.
+        Vector<QueuedEvent> events = take_queued_events();
         for (auto& queued_event : events) {
             auto* receiver = queued_event.receiver.ptr();
             auto& event = *queued_event.event;
@@ -171,20 +216,132 @@ int GEventLoop::exec()
     ASSERT_NOT_REACHED();
 }
 
+void GEventLoop::load_image_async(const String& path, const Size& size, Function<void(RetainPtr<GraphicsBitmap>&&)>&& callback)
+{
+    static GNotifier* s_notifier;
+    if (!s_notifier) {
+        s_notifier = new GNotifier(ImageDecoder::the().completion_fd(), GNotifier::Read);
+        s_notifier->on_ready_to_read = [] (GNotifier&) {
+            ImageDecoder::the().dispatch_finished_decodes();
+        };
+    }
+    ImageDecoder::the().load_async(path, size, move(callback));
+}
+
 void GEventLoop::post_event(GObject& receiver, OwnPtr<GEvent>&& event)
 {
 #ifdef GEVENTLOOP_DEBUG
     dbgprintf("GEventLoop::post_event: {%u} << receiver=%p, event=%p\n", m_queued_events.size(), &receiver, event.ptr());
 #endif
-    m_queued_events.append({ receiver.make_weak_ptr(), move(event) });
+    if (coalesce_with_queued_event(receiver, *event))
+        return;
+    auto priority = priority_of(*event);
+    m_queued_events.append({ receiver.make_weak_ptr(), move(event), priority });
+}
+
+GEventLoop::EventPriority GEventLoop::priority_of(const GEvent& event)
+{
+    switch (event.type()) {
+    case GEvent::Timer:
+        return EventPriority::Timer;
+    case GEvent::MultiPaint:
+        return EventPriority::Paint;
+    default:
+        return EventPriority::Input;
+    }
+}
+
+// Folds a paint into the window's queued paint, and a resize into a resize that's the last thing queued for the window.
+// Returns true if |event| was folded in and needn't be queued itself.
+bool GEventLoop::coalesce_with_queued_event(GObject& receiver, GEvent& event)
+{
+    if (event.type() == GEvent::MultiPaint) {
+        for (int i = m_queued_events.size() - 1; i >= 0; --i) {
+            auto& queued_event = m_queued_events[i];
+            if (queued_event.receiver.ptr() != &receiver || queued_event.event->type() != GEvent::MultiPaint)
+                continue;
+            auto& queued_paint = static_cast<GMultiPaintEvent&>(*queued_event.event);
+            auto& paint = static_cast<GMultiPaintEvent&>(event);
+            Vector<Rect> rects;
+            DisjointRectSet region;
+            const Vector<Rect>* paint_rects[] = { &queued_paint.rects(), &paint.rects() };
+            for (auto* rects_to_add : paint_rects) {
+                // No rects, or an empty one, means the whole window.
+                if (rects_to_add->is_empty())
+                    rects.append(Rect());
+                for (auto& rect : *rects_to_add) {
+                    if (rect.is_empty()) {
+                        rects.append(rect);
+                        break;
+                    }
+                    region.add(rect);
+                }
+            }
+            if (rects.is_empty()) {
+                // What gets painted goes back to the server in one message.
+                if (region.rects().size() > WSAPI_MAX_RECTS_PER_MESSAGE)
+                    rects.append(region.bounding_rect());
+                else
+                    rects = region.take_rects();
+            } else {
+                rects.resize(1);
+            }
+            queued_paint.set_rects(move(rects), paint.window_size());
+            return true;
+        }
+        return false;
+    }
+    if (event.type() == GEvent::Resize) {
+        // Paints are delivered after everything else anyway, so they don't get in the way.
+        for (int i = m_queued_events.size() - 1; i >= 0; --i) {
+            auto& queued_event = m_queued_events[i];
+            if (queued_event.receiver.ptr() != &receiver || queued_event.event->type() == GEvent::MultiPaint)
+                continue;
+            if (queued_event.event->type() != GEvent::Resize)
+                return false;
+            static_cast<GResizeEvent&>(*queued_event.event).set_size(static_cast<GResizeEvent&>(event).size());
+            return true;
+        }
+    }
+    return false;
+}
+
+Vector<GEventLoop::QueuedEvent> GEventLoop::take_queued_events()
+{
+    auto queued_events = move(m_queued_events);
+    bool is_in_order = true;
+    for (int i = 1; i < queued_events.size(); ++i) {
+        if (queued_events[i].priority < queued_events[i - 1].priority) {
+            is_in_order = false;
+            break;
+        }
+    }
+    if (is_in_order)
+        return queued_events;
+    // Keep the posting order within each priority.
+    Vector<QueuedEvent> events;
+    events.ensure_capacity(queued_events.size());
+    EventPriority priorities[] = { EventPriority::Input, EventPriority::Timer, EventPriority::Paint };
+    for (auto priority : priorities) {
+        for (auto& queued_event : queued_events) {
+            if (queued_event.priority == priority)
+                events.append(move(queued_event));
+        }
+    }
+    return events;
 }
 
 void GEventLoop::handle_paint_event(const WSAPI_ServerMessage& event, GWindow& window)
 {
 #ifdef GEVENTLOOP_DEBUG
-    dbgprintf("WID=%x Paint [%d,%d %dx%d]\n", event.window_id, event.paint.rect.location.x, event.paint.rect.location.y, event.paint.rect.size.width, event.paint.rect.size.height);
+    dbgprintf("WID=%x Paint (%d rects)\n", event.window_id, event.rect_count);
 #endif
-    post_event(window, make<GPaintEvent>(event.paint.rect, event.paint.window_size));
+    ASSERT(event.rect_count >= 0 && event.rect_count <= WSAPI_MAX_RECTS_PER_MESSAGE);
+    Vector<Rect> rects;
+    rects.ensure_capacity(event.rect_count);
+    for (int i = 0; i < event.rect_count; ++i)
+        rects.append(event.rects[i]);
+    post_event(window, make<GMultiPaintEvent>(move(rects), event.paint.window_size));
 }
 
 void GEventLoop::handle_resize_event(const WSAPI_ServerMessage& event, GWindow& window)
@@ -268,75 +425,99 @@ void GEventLoop::handle_menu_event(const WSAPI_ServerMessage& event)
 
 void GEventLoop::wait_for_event()
 {
-    fd_set rfds;
-    fd_set wfds;
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-
-    int max_fd = 0;
-    auto add_fd_to_set = [&max_fd] (int fd, fd_set& set){
-        FD_SET(fd, &set);
-        if (fd > max_fd)
-            max_fd = fd;
-    };
-
-    add_fd_to_set(s_event_fd, rfds);
-    for (auto& notifier : *s_notifiers) {
-        if (notifier->event_mask() & GNotifier::Read)
-            add_fd_to_set(notifier->fd(), rfds);
-        if (notifier->event_mask() & GNotifier::Write)
-            add_fd_to_set(notifier->fd(), wfds);
-        if (notifier->event_mask() & GNotifier::Exceptional)
-            ASSERT_NOT_REACHED();
-    }
-
-    struct timeval timeout = { 0, 0 };
-    if (!s_timers->is_empty() && m_queued_events.is_empty())
-        get_next_timer_expiration(timeout);
+    int timeout_ms = -1;
+    if (!m_queued_events.is_empty())
+        timeout_ms = 0;
+    else if (!s_timer_queue->is_empty())
+        timeout_ms = milliseconds_until_next_timer();
     ASSERT(m_unprocessed_messages.is_empty());
-    int rc = select(max_fd + 1, &rfds, &wfds, nullptr, (m_queued_events.is_empty() && s_timers->is_empty()) ? nullptr : &timeout);
-    if (rc < 0) {
-        ASSERT_NOT_REACHED();
+    // Let the server know it has to ring if it sends anything, unless it already has.
+    if (s_message_rings && !s_message_rings->to_client.prepare_to_sleep())
+        timeout_ms = 0;
+
+    epoll_event events[32];
+    int event_count = epoll_wait(s_epoll_fd, events, 32, timeout_ms);
+    if (event_count < 0) {
+        ASSERT(errno == EINTR);
+        event_count = 0;
     }
 
-    for (auto& it : *s_timers) {
-        auto& timer = *it.value;
-        if (!timer.has_expired())
-            continue;
-#ifdef GEVENTLOOP_DEBUG
-        dbgprintf("GEventLoop: Timer %d has expired, sending GTimerEvent to %p\n", timer.timer_id, timer.owner);
-#endif
-        post_event(*timer.owner, make<GTimerEvent>(timer.timer_id));
-        if (timer.should_reload) {
-            timer.reload();
-        } else {
-            // FIXME: Support removing expired timers that don't want to reload.
-            ASSERT_NOT_REACHED();
-        }
-    }
+    fire_expired_timers();
 
-    for (auto& notifier : *s_notifiers) {
-        if (FD_ISSET(notifier->fd(), &rfds)) {
-            if (notifier->on_ready_to_read)
-                notifier->on_ready_to_read(*notifier);
-        }
-        if (FD_ISSET(notifier->fd(), &wfds)) {
-            if (notifier->on_ready_to_write)
-                notifier->on_ready_to_write(*notifier);
+    bool server_fd_is_ready = false;
+    for (int i = 0; i < event_count; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == s_event_fd) {
+            server_fd_is_ready = true;
+            continue;
         }
+        unsigned ready_mask = 0;
+        // Errors and hangups are reported to readers, the read() is what tells them which it was.
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            ready_mask |= GNotifier::Read;
+        if (events[i].events & EPOLLOUT)
+            ready_mask |= GNotifier::Write;
+        dispatch_notifiers(fd, ready_mask);
     }
 
-    if (!FD_ISSET(s_event_fd, &rfds))
+    if (!server_fd_is_ready) {
+        if (s_message_rings)
+            drain_message_ring();
         return;
+    }
 
     bool success = drain_messages_from_server();
     ASSERT(success);
 }
 
+void GEventLoop::dispatch_notifiers(int fd, unsigned ready_mask)
+{
+    auto it = s_notifiers->find(fd);
+    if (it == s_notifiers->end())
+        return;
+    // A callback may delete notifiers (even itself), so work off a copy and check each one is still around.
+    auto notifiers = (*it).value;
+    auto is_registered = [fd] (GNotifier* notifier) {
+        auto it = s_notifiers->find(fd);
+        return it != s_notifiers->end() && (*it).value.contains_slow(notifier);
+    };
+    for (auto* notifier : notifiers) {
+        if ((ready_mask & GNotifier::Read) && is_registered(notifier) && (notifier->event_mask() & GNotifier::Read) && notifier->on_ready_to_read)
+            notifier->on_ready_to_read(*notifier);
+        if ((ready_mask & GNotifier::Write) && is_registered(notifier) && (notifier->event_mask() & GNotifier::Write) && notifier->on_ready_to_write)
+            notifier->on_ready_to_write(*notifier);
+    }
+}
+
+// A MouseMove is pointless if the next thing its window hears is another MouseMove with the same buttons held.
+static bool is_superseded_mouse_move(const Vector<WSAPI_ServerMessage>& messages, int index)
+{
+    auto& message = messages[index];
+    if (message.type != WSAPI_ServerMessage::Type::MouseMove)
+        return false;
+    for (int i = index + 1; i < messages.size(); ++i) {
+        auto& later_message = messages[i];
+        if (later_message.window_id != message.window_id)
+            continue;
+        return later_message.type == WSAPI_ServerMessage::Type::MouseMove
+            && later_message.mouse.buttons == message.mouse.buttons
+            && later_message.mouse.modifiers == message.mouse.modifiers;
+    }
+    return false;
+}
+
 void GEventLoop::process_unprocessed_messages()
 {
     auto unprocessed_events = move(m_unprocessed_messages);
-    for (auto& event : unprocessed_events) {
+    for (int i = 0; i < unprocessed_events.size(); ++i) {
+        auto& event = unprocessed_events[i];
+        if (is_superseded_mouse_move(unprocessed_events, i)) {
+#ifdef GEVENTLOOP_DEBUG
+            dbgprintf("WID=%x Dropping superseded MouseMove\n", event.window_id);
+#endif
+            continue;
+        }
+
         if (event.type == WSAPI_ServerMessage::Type::Greeting) {
             s_server_pid = event.greeting.server_pid;
             continue;
@@ -353,6 +534,17 @@ void GEventLoop::process_unprocessed_messages()
         case WSAPI_ServerMessage::MenuItemActivated:
             handle_menu_event(event);
             continue;
+        case WSAPI_ServerMessage::DidSetWindowBackingStore:
+            // Flips aren't waited for, so these can trail in after their window is gone.
+            if (auto* window = GWindow::from_window_id(event.window_id))
+                window->did_flip({ }, event.backing.flip_sequence);
+            continue;
+        case WSAPI_ServerMessage::DidAddMenuItem:
+        case WSAPI_ServerMessage::DidAddMenuSeparator:
+        case WSAPI_ServerMessage::DidAddMenuToMenubar:
+        case WSAPI_ServerMessage::DidSetApplicationMenubar:
+            // Building menus isn't waited for either, see GMenu and GMenuBar.
+            continue;
         default:
             break;
         }
@@ -398,18 +590,86 @@ void GEventLoop::process_unprocessed_messages()
         process_unprocessed_messages();
 }
 
+void GEventLoop::drain_message_ring()
+{
+    bool producer_was_blocked = s_message_rings->to_client.drain([this] (const WSAPI_ServerMessage& message) {
+        m_unprocessed_messages.append(message);
+    });
+    if (producer_was_blocked)
+        ring_doorbell();
+}
+
+void GEventLoop::ring_doorbell()
+{
+    byte doorbell = 0;
+    int nwritten = write(s_event_fd, &doorbell, sizeof(doorbell));
+    // A full socket has rings in it the server hasn't gotten to yet, so this one isn't needed.
+    if (nwritten < 0 && errno != EAGAIN)
+        perror("GEventLoop::ring_doorbell write");
+}
+
+// How many packets are taken off the socket with each call.
+static const int max_packets_per_receive = 32;
+
+// Every write from the server arrives on |fd| as a packet of its own, so this takes up to |count| of them in one call,
+// each into its own |size| bytes of |buffers|, and puts their lengths in |lengths|. Returns what recvmmsg() does.
+static int receive_packets(int fd, byte* buffers, size_t size, int count, int* lengths)
+{
+    ASSERT(count <= max_packets_per_receive);
+    mmsghdr headers[max_packets_per_receive];
+    iovec iovecs[max_packets_per_receive];
+    for (int i = 0; i < count; ++i) {
+        iovecs[i] = { buffers + i * size, size };
+        headers[i] = { };
+        headers[i].msg_hdr.msg_iov = &iovecs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    int received = recvmmsg(fd, headers, count, 0, nullptr);
+    for (int i = 0; i < received; ++i) {
+        ASSERT(!(headers[i].msg_hdr.msg_flags & MSG_TRUNC));
+        lengths[i] = headers[i].msg_len;
+    }
+    return received;
+}
+
 bool GEventLoop::drain_messages_from_server()
 {
+    int lengths[max_packets_per_receive];
+    if (s_message_rings) {
+        // With rings in place, the socket only carries doorbell rings.
+        byte doorbells[max_packets_per_receive];
+        int count = receive_packets(s_event_fd, doorbells, 1, max_packets_per_receive, lengths);
+        if (count < 0 && errno == EAGAIN)
+            return true;
+        if (count < 0) {
+            perror("recvmmsg");
+            quit(1);
+            return false;
+        }
+        if (count == 0) {
+            fprintf(stderr, "EOF on WindowServer fd\n");
+            quit(1);
+            return false;
+        }
+        // The server may have drained a ring we found full.
+        if (s_message_rings->to_server.flush(*s_overflow_messages))
+            ring_doorbell();
+        drain_message_ring();
+        return true;
+    }
+
+    static WSAPI_ServerMessage messages[max_packets_per_receive];
     bool is_first_pass = true;
     for (;;) {
-        WSAPI_ServerMessage message;
-        ssize_t nread = read(s_event_fd, &message, sizeof(WSAPI_ServerMessage));
-        if (nread < 0) {
-            perror("read");
+        int count = receive_packets(s_event_fd, (byte*)messages, sizeof(WSAPI_ServerMessage), max_packets_per_receive, lengths);
+        if (count < 0 && errno == EAGAIN)
+            return true;
+        if (count < 0) {
+            perror("recvmmsg");
             quit(1);
             return false;
         }
-        if (nread == 0) {
+        if (count == 0) {
             if (is_first_pass) {
                 fprintf(stderr, "EOF on WindowServer fd\n");
                 quit(1);
@@ -417,35 +677,52 @@ bool GEventLoop::drain_messages_from_server()
             }
             return true;
         }
-        assert(nread == sizeof(message));
-        m_unprocessed_messages.append(move(message));
+        for (int i = 0; i < count; ++i) {
+            // The server only sends the part of a message that's in use, the rest reads as zeroes.
+            memset((byte*)&messages[i] + lengths[i], 0, sizeof(WSAPI_ServerMessage) - lengths[i]);
+            m_unprocessed_messages.append(move(messages[i]));
+        }
         is_first_pass = false;
     }
 }
 
-bool GEventLoop::EventLoopTimer::has_expired() const
+void GEventLoop::EventLoopTimer::reload()
 {
-    timeval now;
-    gettimeofday(&now, nullptr);
-    return now.tv_sec > fire_time.tv_sec || (now.tv_sec == fire_time.tv_sec && now.tv_usec >= fire_time.tv_usec);
+    fire_time = now_in_microseconds() + (qword)interval * 1000;
 }
 
-void GEventLoop::EventLoopTimer::reload()
+int GEventLoop::milliseconds_until_next_timer() const
 {
-    gettimeofday(&fire_time, nullptr);
-    fire_time.tv_sec += interval / 1000;
-    fire_time.tv_usec += (interval % 1000) * 1000;
+    ASSERT(!s_timer_queue->is_empty());
+    qword now = now_in_microseconds();
+    qword soonest = s_timer_queue->peek_min_key();
+    if (soonest <= now)
+        return 0;
+    // Round up, waking a little late beats waking up early for nothing.
+    return (int)(min(soonest - now + 999, (qword)0x7fffffff) / 1000);
 }
 
-void GEventLoop::get_next_timer_expiration(timeval& soonest)
+void GEventLoop::fire_expired_timers()
 {
-    ASSERT(!s_timers->is_empty());
-    bool has_checked_any = false;
-    for (auto& it : *s_timers) {
-        auto& fire_time = it.value->fire_time;
-        if (!has_checked_any || fire_time.tv_sec < soonest.tv_sec || (fire_time.tv_sec == soonest.tv_sec && fire_time.tv_usec < soonest.tv_usec))
-            soonest = fire_time;
-        has_checked_any = true;
+    qword now = now_in_microseconds();
+    while (!s_timer_queue->is_empty() && s_timer_queue->peek_min_key() <= now) {
+        int timer_id = s_timer_queue->pop_min();
+        auto it = s_timers->find(timer_id);
+        if (it == s_timers->end())
+            continue;
+        auto& timer = *(*it).value;
+#ifdef GEVENTLOOP_DEBUG
+        dbgprintf("GEventLoop: Timer %d has expired, sending GTimerEvent to %p\n", timer.timer_id, timer.owner.ptr());
+#endif
+        post_event(*timer.owner, make<GTimerEvent>(timer.timer_id));
+        if (timer.should_reload) {
+            // From now rather than from when it was due, so a loop that fell behind doesn't get a burst of catch-up events.
+            timer.reload();
+            s_timer_queue->insert(timer.fire_time, timer.timer_id);
+        } else {
+            // FIXME: Support removing expired timers that don't want to reload.
+            ASSERT_NOT_REACHED();
+        }
     }
 }
 
@@ -460,6 +737,7 @@ int GEventLoop::register_timer(GObject& object, int milliseconds, bool should_re
     int timer_id = ++s_next_timer_id;  // FIXME: This will eventually wrap around.
     ASSERT(timer_id); // FIXME: Aforementioned wraparound.
     timer->timer_id = timer_id;
+    s_timer_queue->insert(timer->fire_time, timer_id);
     s_timers->set(timer->timer_id, move(timer));
     return timer_id;
 }
@@ -470,45 +748,112 @@ bool GEventLoop::unregister_timer(int timer_id)
     if (it == s_timers->end())
         return false;
     s_timers->remove(it);
+    // Its entry stays in the queue until it comes up. Rebuild the queue if those pile up, like when
+    // lots of long timers get started and stopped again.
+    if (s_timer_queue->size() > 2 * (int)s_timers->size() + 16) {
+        s_timer_queue->clear();
+        for (auto& it : *s_timers)
+            s_timer_queue->insert(it.value->fire_time, it.key);
+    }
     return true;
 }
 
+void GEventLoop::update_epoll_registration(int fd)
+{
+    auto it = s_notifiers->find(fd);
+    if (it == s_notifiers->end()) {
+        // This fails harmlessly if the fd has already been closed, which also took it out of the set.
+        epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        return;
+    }
+    epoll_event event;
+    event.events = 0;
+    for (auto* notifier : (*it).value) {
+        if (notifier->event_mask() & GNotifier::Read)
+            event.events |= EPOLLIN;
+        if (notifier->event_mask() & GNotifier::Write)
+            event.events |= EPOLLOUT;
+        if (notifier->event_mask() & GNotifier::Exceptional)
+            ASSERT_NOT_REACHED();
+    }
+    event.data.fd = fd;
+    if (epoll_ctl(s_epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+        int rc = epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        if (rc < 0)
+            perror("GEventLoop: epoll_ctl");
+    }
+}
+
 void GEventLoop::register_notifier(Badge<GNotifier>, GNotifier& notifier)
 {
-    s_notifiers->set(&notifier);
+    int fd = notifier.fd();
+    auto it = s_notifiers->find(fd);
+    if (it == s_notifiers->end()) {
+        Vector<GNotifier*> notifiers;
+        notifiers.append(&notifier);
+        s_notifiers->set(fd, move(notifiers));
+    } else {
+        (*it).value.append(&notifier);
+    }
+    update_epoll_registration(fd);
 }
 
 void GEventLoop::unregister_notifier(Badge<GNotifier>, GNotifier& notifier)
 {
-    s_notifiers->remove(&notifier);
+    int fd = notifier.fd();
+    auto it = s_notifiers->find(fd);
+    if (it == s_notifiers->end())
+        return;
+    auto& notifiers = (*it).value;
+    notifiers.remove_first_matching([&notifier] (GNotifier* entry) { return entry == &notifier; });
+    if (notifiers.is_empty())
+        s_notifiers->remove(it);
+    update_epoll_registration(fd);
 }
 
 bool GEventLoop::post_message_to_server(const WSAPI_ClientMessage& message)
 {
-    int nwritten = write(s_event_fd, &message, sizeof(WSAPI_ClientMessage));
-    return nwritten == sizeof(WSAPI_ClientMessage);
+    if (s_message_rings) {
+        if (s_message_rings->to_server.post(message, *s_overflow_messages))
+            ring_doorbell();
+        return true;
+    }
+    // Each message is a packet of its own, so only the part of it that's in use needs to go.
+    int size = WSAPI_wire_size(message);
+    int nwritten = write(s_event_fd, &message, size);
+    return nwritten == size;
 }
 
 bool GEventLoop::wait_for_specific_event(WSAPI_ServerMessage::Type type, WSAPI_ServerMessage& event)
 {
+    return wait_for_specific_window_event(type, -1, event);
+}
 
+// A window_id of -1 matches a message for any window. A matching message that's already queued is taken right away.
+bool GEventLoop::wait_for_specific_window_event(WSAPI_ServerMessage::Type type, int window_id, WSAPI_ServerMessage& event)
+{
     for (;;) {
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(s_event_fd, &rfds);
-        int rc = select(s_event_fd + 1, &rfds, nullptr, nullptr, nullptr);
-        ASSERT(rc > 0);
-        ASSERT(FD_ISSET(s_event_fd, &rfds));
-        bool success = drain_messages_from_server();
-        if (!success)
-            return false;
         for (ssize_t i = 0; i < m_unprocessed_messages.size(); ++i) {
-            if (m_unprocessed_messages[i].type == type) {
-                event = move(m_unprocessed_messages[i]);
+            auto& message = m_unprocessed_messages[i];
+            if (message.type == type && (window_id == -1 || message.window_id == window_id)) {
+                event = move(message);
                 m_unprocessed_messages.remove(i);
                 return true;
             }
         }
+        if (s_message_rings && !s_message_rings->to_client.prepare_to_sleep()) {
+            drain_message_ring();
+        } else {
+            fd_set rfds;
+            FD_ZERO(&rfds);
+            FD_SET(s_event_fd, &rfds);
+            int rc = select(s_event_fd + 1, &rfds, nullptr, nullptr, nullptr);
+            ASSERT(rc > 0);
+            ASSERT(FD_ISSET(s_event_fd, &rfds));
+            bool success = drain_messages_from_server();
+            if (!success)
+                return false;
+        }
     }
 }
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <AK/Badge.h>
+#include <AK/BinaryHeap.h>
+#include <AK/Function.h>
 #include <AK/HashMap.h>
 #include <AK/OwnPtr.h>
 #include <AK/Vector.h>
@@ -12,6 +14,9 @@ class GAction;
 class GObject;
 class GNotifier;
 class GWindow;
+class GraphicsBitmap;
+class SharedBuffer;
+struct WSAPI_MessageRings;
 
 class GEventLoop {
 public:
@@ -35,8 +40,13 @@ public:
 
     void quit(int);
 
+    // Decodes the image on ImageDecoder's worker thread, then calls |callback| from the main loop.
+    // An empty |size| means the image's own size.
+    static void load_image_async(const String& path, const Size&, Function<void(RetainPtr<GraphicsBitmap>&&)>&& callback);
+
     static bool post_message_to_server(const WSAPI_ClientMessage&);
     bool wait_for_specific_event(WSAPI_ServerMessage::Type, WSAPI_ServerMessage&);
+    bool wait_for_specific_window_event(WSAPI_ServerMessage::Type, int window_id, WSAPI_ServerMessage&);
 
     WSAPI_ServerMessage sync_request(const WSAPI_ClientMessage& request, WSAPI_ServerMessage::Type response_type);
 
@@ -51,6 +61,8 @@ public:
 private:
     void wait_for_event();
     bool drain_messages_from_server();
+    void drain_message_ring();
+    static void ring_doorbell();
     void process_unprocessed_messages();
     void handle_paint_event(const WSAPI_ServerMessage&, GWindow&);
     void handle_resize_event(const WSAPI_ServerMessage&, GWindow&);
@@ -60,13 +72,24 @@ private:
     void handle_window_close_request_event(const WSAPI_ServerMessage&, GWindow&);
     void handle_menu_event(const WSAPI_ServerMessage&);
     void handle_window_entered_or_left_event(const WSAPI_ServerMessage&, GWindow&);
-    void get_next_timer_expiration(timeval&);
+    int milliseconds_until_next_timer() const;
+    void fire_expired_timers();
+    void dispatch_notifiers(int fd, unsigned ready_mask);
+    static void update_epoll_registration(int fd);
     void connect_to_server();
 
+    // Input (and everything else that comes from the server) goes first, then timers, then paints,
+    // so a window that's busy repainting still reacts to the user right away.
+    enum class EventPriority { Input, Timer, Paint };
+
     struct QueuedEvent {
         WeakPtr<GObject> receiver;
         OwnPtr<GEvent> event;
+        EventPriority priority { EventPriority::Input };
     };
+    static EventPriority priority_of(const GEvent&);
+    bool coalesce_with_queued_event(GObject& receiver, GEvent&);
+    Vector<QueuedEvent> take_queued_events();
     Vector<QueuedEvent> m_queued_events;
 
     Vector<WSAPI_ServerMessage> m_unprocessed_messages;
@@ -78,19 +101,27 @@ private:
     static pid_t s_server_pid;
     static pid_t s_event_fd;
 
+    static SharedBuffer* s_message_rings_buffer;
+    static WSAPI_MessageRings* s_message_rings;
+    static Vector<WSAPI_ClientMessage>* s_overflow_messages;
+
     struct EventLoopTimer {
         int timer_id { 0 };
         int interval { 0 };
-        timeval fire_time;
+        // In microseconds since the epoch.
+        qword fire_time { 0 };
         bool should_reload { false };
         WeakPtr<GObject> owner;
 
         void reload();
-        bool has_expired() const;
     };
 
     static HashMap<int, OwnPtr<EventLoopTimer>>* s_timers;
+    // Timer IDs by fire time, soonest first. Unregistered timers are left in and skipped when they come up.
+    static BinaryHeap<qword, int>* s_timer_queue;
     static int s_next_timer_id;
 
-    static HashTable<GNotifier*>* s_notifiers;
+    // All the notifiers on each fd. The fd is in the epoll set for the union of their event masks.
+    static HashMap<int, Vector<GNotifier*>>* s_notifiers;
+    static int s_epoll_fd;
 };
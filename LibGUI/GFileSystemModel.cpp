@@ -9,6 +9,8 @@
 struct GFileSystemModel::Node {
     String name;
     Node* parent { nullptr };
+    // Where it is among its parent's children.
+    int row { 0 };
     Vector<Node*> children;
     enum Type { Unknown, Directory, File };
     Type type { Unknown };
@@ -17,13 +19,15 @@ struct GFileSystemModel::Node {
 
     GModelIndex index(const GFileSystemModel& model) const
     {
-        if (!parent)
-            return model.create_index(0, 0, (void*)this);
-        for (int row = 0; row < parent->children.size(); ++row) {
-            if (parent->children[row] == this)
-                return model.create_index(row, 0, (void*)this);
-        }
-        ASSERT_NOT_REACHED();
+        return model.create_index(row, 0, (void*)this);
+    }
+
+    // Whether expanding it could turn up anything, without reading the directory to find out.
+    bool may_have_children() const
+    {
+        if (type != Node::Directory)
+            return false;
+        return !has_traversed || !children.is_empty();
     }
 
     void traverse_if_needed(const GFileSystemModel& model)
@@ -37,30 +41,27 @@ struct GFileSystemModel::Node {
         if (!dirp)
             return;
 
-        while (auto* de = readdir(dirp)) {
+        // readdir_with_stat() hands out a buffer of entries with their metadata per syscall, instead of an lstat() for each.
+        struct stat st;
+        while (auto* de = readdir_with_stat(dirp, &st)) {
             if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
                 continue;
-            struct stat st;
-            int rc = lstat(String::format("%s/%s", full_path.characters(), de->d_name).characters(), &st);
-            if (rc < 0) {
-                perror("lstat");
-                continue;
-            }
             if (model.m_mode == DirectoriesOnly && !S_ISDIR(st.st_mode))
                 continue;
             auto* child = new Node;
             child->name = de->d_name;
             child->type = S_ISDIR(st.st_mode) ? Node::Type::Directory : Node::Type::File;
             child->parent = this;
+            child->row = children.size();
             children.append(child);
         }
 
         closedir(dirp);
     }
 
+    // Only the root's type isn't known from its parent's listing.
     void reify_if_needed(const GFileSystemModel& model)
     {
-        traverse_if_needed(model);
         if (type != Node::Type::Unknown)
             return;
         struct stat st;
@@ -101,6 +102,7 @@ GModelIndex GFileSystemModel::index(const String& path) const
     for (int i = 0; i < canonical_path.parts().size(); ++i) {
         auto& part = canonical_path.parts()[i];
         bool found = false;
+        const_cast<Node*>(node)->traverse_if_needed(*this);
         for (auto& child : node->children) {
             if (child->name == part) {
                 node = child;
@@ -156,11 +158,21 @@ int GFileSystemModel::row_count(const GModelIndex& index) const
         return 1;
     auto& node = *(Node*)index.internal_data();
     node.reify_if_needed(*this);
+    node.traverse_if_needed(*this);
     if (node.type == Node::Type::Directory)
         return node.children.size();
     return 0;
 }
 
+bool GFileSystemModel::may_have_children(const GModelIndex& index) const
+{
+    if (!index.is_valid())
+        return true;
+    auto& node = *(Node*)index.internal_data();
+    node.reify_if_needed(*this);
+    return node.may_have_children();
+}
+
 GModelIndex GFileSystemModel::index(int row, int column, const GModelIndex& parent) const
 {
     if (!parent.is_valid())
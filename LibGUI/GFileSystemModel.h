@@ -18,6 +18,7 @@ public:
     GModelIndex index(const String& path) const;
 
     virtual int row_count(const GModelIndex& = GModelIndex()) const override;
+    virtual bool may_have_children(const GModelIndex&) const override;
     virtual int column_count(const GModelIndex& = GModelIndex()) const override;
     virtual GVariant data(const GModelIndex&, Role = Role::Display) const override;
     virtual void update() override;
@@ -1,8 +1,38 @@
 #include <LibGUI/GFontDatabase.h>
 #include <SharedGraphics/Font.h>
+#include <AK/ByteBuffer.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//#define FONT_INDEX_DEBUG
+
+static const char* fonts_directory = "/res/fonts";
+
+// What's in the fonts directory, so each program doesn't have to open every font file to find out.
+// It's only trusted for as long as the directory's mtime hasn't changed. All of it is little-endian:
+//     FontIndexHeader
+//     count * { FontIndexEntry, the file name, the font name }
+static const char* font_index_path = "/tmp/font-index";
+static const dword font_index_version = 1;
+
+struct [[gnu::packed]] FontIndexHeader {
+    char magic[4];
+    dword version;
+    dword directory_mtime;
+    dword count;
+};
+
+struct [[gnu::packed]] FontIndexEntry {
+    byte glyph_height;
+    byte is_fixed_width;
+    byte file_name_length;
+    byte name_length;
+};
 
 static GFontDatabase* s_the;
 
@@ -15,7 +45,29 @@ GFontDatabase& GFontDatabase::the()
 
 GFontDatabase::GFontDatabase()
 {
-    DIR* dirp = opendir("/res/fonts");
+    struct stat st;
+    if (stat(fonts_directory, &st) < 0) {
+        perror("stat");
+        exit(1);
+    }
+    if (load_index((dword)st.st_mtime))
+        return;
+    scan_fonts_directory();
+    save_index((dword)st.st_mtime);
+}
+
+GFontDatabase::~GFontDatabase()
+{
+}
+
+void GFontDatabase::did_change_font_files()
+{
+    unlink(font_index_path);
+}
+
+void GFontDatabase::scan_fonts_directory()
+{
+    DIR* dirp = opendir(fonts_directory);
     if (!dirp) {
         perror("opendir");
         exit(1);
@@ -23,26 +75,110 @@ GFontDatabase::GFontDatabase()
     while (auto* de = readdir(dirp)) {
         if (de->d_name[0] == '.')
             continue;
-        auto path = String::format("/res/fonts/%s", de->d_name);
-        if (auto font = Font::load_from_file(path)) {
+        auto path = String::format("%s/%s", fonts_directory, de->d_name);
+        Font::FileInfo info;
+        if (Font::read_file_info(path, info)) {
             Metadata metadata;
             metadata.path = path;
-            metadata.glyph_height = font->glyph_height();
-            metadata.is_fixed_width = font->is_fixed_width();
-            m_name_to_metadata.set(font->name(), move(metadata));
+            metadata.glyph_height = info.glyph_height;
+            metadata.is_fixed_width = info.is_fixed_width;
+            m_name_to_metadata.set(info.name, move(metadata));
         }
     }
     closedir(dirp);
 }
 
-GFontDatabase::~GFontDatabase()
+bool GFontDatabase::load_index(dword directory_mtime)
+{
+    int fd = open(font_index_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(FontIndexHeader)) {
+        close(fd);
+        return false;
+    }
+    auto buffer = ByteBuffer::create_uninitialized(st.st_size);
+    ssize_t nread = read(fd, buffer.pointer(), buffer.size());
+    close(fd);
+    if (nread != buffer.size())
+        return false;
+
+    auto& header = *(const FontIndexHeader*)buffer.pointer();
+    if (memcmp(header.magic, "!FIx", 4) || header.version != font_index_version || header.directory_mtime != directory_mtime) {
+#ifdef FONT_INDEX_DEBUG
+        dbgprintf("GFontDatabase: %s is out of date\n", font_index_path);
+#endif
+        return false;
+    }
+
+    const byte* data = buffer.pointer();
+    int offset = sizeof(FontIndexHeader);
+    for (dword i = 0; i < header.count; ++i) {
+        if (offset + (int)sizeof(FontIndexEntry) > buffer.size())
+            return false;
+        auto& entry = *(const FontIndexEntry*)(data + offset);
+        offset += sizeof(FontIndexEntry);
+        if (offset + entry.file_name_length + entry.name_length > buffer.size())
+            return false;
+        String file_name((const char*)data + offset, entry.file_name_length);
+        offset += entry.file_name_length;
+        String name((const char*)data + offset, entry.name_length);
+        offset += entry.name_length;
+
+        Metadata metadata;
+        metadata.path = String::format("%s/%s", fonts_directory, file_name.characters());
+        metadata.glyph_height = entry.glyph_height;
+        metadata.is_fixed_width = entry.is_fixed_width;
+        m_name_to_metadata.set(name, move(metadata));
+    }
+    return true;
+}
+
+void GFontDatabase::save_index(dword directory_mtime)
 {
+    FontIndexHeader header;
+    memcpy(header.magic, "!FIx", 4);
+    header.version = font_index_version;
+    header.directory_mtime = directory_mtime;
+    header.count = 0;
+
+    Vector<byte> data;
+    data.append((const byte*)&header, sizeof(header));
+    int prefix_length = strlen(fonts_directory) + 1;
+    for (auto& it : m_name_to_metadata) {
+        auto& name = it.key.string();
+        auto& metadata = it.value;
+        int file_name_length = metadata.path.length() - prefix_length;
+        if (file_name_length > 255 || name.length() > 255)
+            continue;
+        FontIndexEntry entry;
+        entry.glyph_height = metadata.glyph_height;
+        entry.is_fixed_width = metadata.is_fixed_width;
+        entry.file_name_length = file_name_length;
+        entry.name_length = name.length();
+        data.append((const byte*)&entry, sizeof(entry));
+        data.append((const byte*)metadata.path.characters() + prefix_length, file_name_length);
+        data.append((const byte*)name.characters(), name.length());
+        ++header.count;
+    }
+    memcpy(data.data(), &header, sizeof(header));
+
+    // Written off to the side and renamed into place, so nobody ever reads half of one.
+    auto temporary_path = String::format("%s.%d", font_index_path, getpid());
+    int fd = open(temporary_path.characters(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    ssize_t nwritten = write(fd, data.data(), data.size());
+    close(fd);
+    if (nwritten != data.size() || rename(temporary_path.characters(), font_index_path) < 0)
+        unlink(temporary_path.characters());
 }
 
 void GFontDatabase::for_each_font(Function<void(const String&)> callback)
 {
     for (auto& it : m_name_to_metadata) {
-        callback(it.key);
+        callback(it.key.string());
     }
 }
 
@@ -50,7 +186,7 @@ void GFontDatabase::for_each_fixed_width_font(Function<void(const String&)> call
 {
     for (auto& it : m_name_to_metadata) {
         if (it.value.is_fixed_width)
-            callback(it.key);
+            callback(it.key.string());
     }
 }
 
@@ -59,5 +195,8 @@ RetainPtr<Font> GFontDatabase::get_by_name(const String& name)
     auto it = m_name_to_metadata.find(name);
     if (it == m_name_to_metadata.end())
         return nullptr;
-    return Font::load_from_file((*it).value.path);
+    auto& metadata = (*it).value;
+    if (!metadata.font)
+        metadata.font = Font::load_from_file(metadata.path);
+    return metadata.font.copy_ref();
 }
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <AK/AKString.h>
+#include <AK/FlyString.h>
 #include <AK/HashMap.h>
 #include <AK/Function.h>
+#include <AK/Types.h>
 
 class Font;
 
@@ -14,15 +16,24 @@ public:
     void for_each_font(Function<void(const String&)>);
     void for_each_fixed_width_font(Function<void(const String&)>);
 
+    // For whoever changes a font file in place, which the directory's mtime doesn't show.
+    static void did_change_font_files();
+
 private:
     GFontDatabase();
     ~GFontDatabase();
 
+    void scan_fonts_directory();
+    bool load_index(dword directory_mtime);
+    void save_index(dword directory_mtime);
+
     struct Metadata {
         String path;
         bool is_fixed_width;
         int glyph_height;
+        // Mapped the first time it's asked for, and then shared.
+        RetainPtr<Font> font;
     };
 
-    HashMap<String, Metadata> m_name_to_metadata;
+    HashMap<FlyString, Metadata> m_name_to_metadata;
 };
@@ -17,6 +17,36 @@ const char* GIODevice::error_string() const
     return strerror(m_error);
 }
 
+// What populate_read_buffer() asks for at least. It asks for as much as is already buffered when that's more,
+// so reading in something big takes a logarithmic number of reads.
+static const int min_read_size = 16 * KB;
+
+void GIODevice::consume_buffered_data(int size)
+{
+    ASSERT(size <= buffered_size());
+    m_buffered_data_offset += size;
+    if (m_buffered_data_offset == m_buffered_data.size()) {
+        m_buffered_data.clear_with_capacity();
+        m_buffered_data_offset = 0;
+        m_newline_search_offset = 0;
+        return;
+    }
+    m_newline_search_offset = max(m_newline_search_offset, m_buffered_data_offset);
+}
+
+// Returns the index of the first newline in m_buffered_data after the offset, or -1.
+int GIODevice::find_buffered_newline()
+{
+    int search_start = max(m_newline_search_offset, m_buffered_data_offset);
+    auto* newline = (const byte*)memchr(m_buffered_data.data() + search_start, '\n', m_buffered_data.size() - search_start);
+    if (!newline) {
+        m_newline_search_offset = m_buffered_data.size();
+        return -1;
+    }
+    m_newline_search_offset = newline - m_buffered_data.data();
+    return m_newline_search_offset;
+}
+
 ByteBuffer GIODevice::read(int max_size)
 {
     if (m_fd < 0)
@@ -26,12 +56,10 @@ ByteBuffer GIODevice::read(int max_size)
     auto buffer = ByteBuffer::create_uninitialized(max_size);
     auto* buffer_ptr = (char*)buffer.pointer();
     int remaining_buffer_space = buffer.size();
-    if (!m_buffered_data.is_empty()) {
-        int taken_from_buffered = min(remaining_buffer_space, m_buffered_data.size());
-        memcpy(buffer_ptr, m_buffered_data.data(), taken_from_buffered);
-        Vector<byte> new_buffered_data;
-        new_buffered_data.append(m_buffered_data.data() + taken_from_buffered, m_buffered_data.size() - taken_from_buffered);
-        m_buffered_data = move(new_buffered_data);
+    if (buffered_size()) {
+        int taken_from_buffered = min(remaining_buffer_space, buffered_size());
+        memcpy(buffer_ptr, buffered_data(), taken_from_buffered);
+        consume_buffered_data(taken_from_buffered);
         remaining_buffer_space -= taken_from_buffered;
         buffer_ptr += taken_from_buffered;
     }
@@ -39,10 +67,15 @@ ByteBuffer GIODevice::read(int max_size)
         return buffer;
     int nread = ::read(m_fd, buffer_ptr, remaining_buffer_space);
     if (nread < 0) {
+        // Nothing more has come in on a non-blocking fd yet, that's no error.
+        if (errno == EAGAIN) {
+            buffer.trim(max_size - remaining_buffer_space);
+            return buffer;
+        }
         set_error(errno);
         return { };
     }
-    buffer.trim(nread);
+    buffer.trim(max_size - remaining_buffer_space + nread);
     return buffer;
 }
 
@@ -64,42 +97,31 @@ bool GIODevice::can_read_from_fd() const
 
 bool GIODevice::can_read_line()
 {
-    if (m_eof && !m_buffered_data.is_empty())
+    if (m_eof && buffered_size())
         return true;
-    if (m_buffered_data.contains_slow('\n'))
+    if (find_buffered_newline() >= 0)
         return true;
     if (!can_read_from_fd())
         return false;
     populate_read_buffer();
-    return m_buffered_data.contains_slow('\n');
+    return find_buffered_newline() >= 0;
 }
 
 bool GIODevice::can_read() const
 {
-    return !m_buffered_data.is_empty() || can_read_from_fd();
+    return m_buffered_data_offset < m_buffered_data.size() || can_read_from_fd();
 }
 
 ByteBuffer GIODevice::read_all()
 {
-    ByteBuffer buffer;
-    if (!m_buffered_data.is_empty()) {
-        buffer = ByteBuffer::copy(m_buffered_data.data(), m_buffered_data.size());
-        m_buffered_data.clear();
-    }
-
     while (can_read_from_fd()) {
-        char read_buffer[4096];
-        int nread = ::read(m_fd, read_buffer, sizeof(read_buffer));
-        if (nread < 0) {
-            set_error(nread);
-            return buffer;
-        }
-        if (nread == 0) {
-            set_eof(true);
+        if (!populate_read_buffer())
             break;
-        }
-        buffer.append(read_buffer, nread);
     }
+    if (!buffered_size())
+        return { };
+    auto buffer = ByteBuffer::copy(buffered_data(), buffered_size());
+    consume_buffered_data(buffered_size());
     return buffer;
 }
 
@@ -111,48 +133,68 @@ ByteBuffer GIODevice::read_line(int max_size)
         return { };
     if (!can_read_line())
         return { };
-    if (m_eof) {
-        if (m_buffered_data.size() > max_size) {
+    int newline = find_buffered_newline();
+    if (newline < 0) {
+        // At EOF, the last line doesn't need a newline.
+        if (buffered_size() > max_size) {
             dbgprintf("GIODevice::read_line: At EOF but there's more than max_size(%d) buffered\n", max_size);
             return { };
         }
-        auto buffer = ByteBuffer::copy(m_buffered_data.data(), m_buffered_data.size());
-        m_buffered_data.clear();
+        auto buffer = ByteBuffer::copy(buffered_data(), buffered_size());
+        consume_buffered_data(buffered_size());
         return buffer;
     }
-    auto line = ByteBuffer::create_uninitialized(max_size + 1);
-    int line_index = 0;
-    while (line_index < max_size) {
-        byte ch = m_buffered_data[line_index];
-        line[line_index++] = ch;
-        if (ch == '\n') {
-            Vector<byte> new_buffered_data;
-            new_buffered_data.append(m_buffered_data.data() + line_index, m_buffered_data.size() - line_index);
-            m_buffered_data = move(new_buffered_data);
-            line[line_index] = '\0';
-            line.trim(line_index + 1);
-            return line;
-        }
-    }
-    return { };
+    int line_length = newline - m_buffered_data_offset + 1;
+    if (line_length > max_size)
+        return { };
+    auto line = ByteBuffer::create_uninitialized(line_length + 1);
+    memcpy(line.pointer(), buffered_data(), line_length);
+    line[line_length] = '\0';
+    consume_buffered_data(line_length);
+    return line;
+}
+
+ByteBuffer GIODevice::peek(int max_size)
+{
+    if (m_fd < 0 || max_size <= 0)
+        return { };
+    if (!buffered_size() && can_read_from_fd())
+        populate_read_buffer();
+    if (!buffered_size())
+        return { };
+    return ByteBuffer::wrap(buffered_data(), min(max_size, buffered_size()));
+}
+
+void GIODevice::discard(int size)
+{
+    consume_buffered_data(min(max(size, 0), buffered_size()));
 }
 
 bool GIODevice::populate_read_buffer()
 {
     if (m_fd < 0)
         return false;
-    auto buffer = ByteBuffer::create_uninitialized(1024);
-    int nread = ::read(m_fd, buffer.pointer(), buffer.size());
+    if (m_buffered_data_offset && m_buffered_data_offset >= m_buffered_data.size() / 2) {
+        int remaining = buffered_size();
+        memmove(m_buffered_data.data(), buffered_data(), remaining);
+        m_newline_search_offset -= m_buffered_data_offset;
+        m_buffered_data_offset = 0;
+        m_buffered_data.resize(remaining);
+    }
+    int old_size = m_buffered_data.size();
+    int read_size = max(min_read_size, buffered_size());
+    m_buffered_data.resize(old_size + read_size);
+    int nread = ::read(m_fd, m_buffered_data.data() + old_size, read_size);
+    m_buffered_data.resize(old_size + max(nread, 0));
     if (nread < 0) {
-        set_error(errno);
+        if (errno != EAGAIN)
+            set_error(errno);
         return false;
     }
     if (nread == 0) {
         set_eof(true);
         return false;
     }
-    buffer.trim(nread);
-    m_buffered_data.append(buffer.pointer(), buffer.size());
     return true;
 }
 
@@ -30,6 +30,12 @@ public:
     ByteBuffer read_line(int max_size);
     ByteBuffer read_all();
 
+    // Up to max_size bytes of what's buffered (reading some in first if there's nothing), without consuming them.
+    // It points straight into the buffer, so it's only good until the next read.
+    ByteBuffer peek(int max_size);
+    // Consumes up to size bytes of what's buffered, say after looking at them with peek().
+    void discard(int size);
+
     // FIXME: I would like this to be const but currently it needs to call populate_read_buffer().
     bool can_read_line();
 
@@ -52,9 +58,18 @@ private:
     bool populate_read_buffer();
     bool can_read_from_fd() const;
 
+    int buffered_size() const { return m_buffered_data.size() - m_buffered_data_offset; }
+    byte* buffered_data() { return m_buffered_data.data() + m_buffered_data_offset; }
+    void consume_buffered_data(int size);
+    int find_buffered_newline();
+
     int m_fd { -1 };
     int m_error { 0 };
     bool m_eof { false };
     OpenMode m_mode { NotOpen };
+    // Consumed data isn't moved out of the way right away, only once it's taking up half of the buffer.
     Vector<byte> m_buffered_data;
+    int m_buffered_data_offset { 0 };
+    // Everything buffered before this has been searched for a newline already, and didn't have one.
+    int m_newline_search_offset { 0 };
 };
@@ -1,4 +1,5 @@
 #include <LibGUI/GIcon.h>
+#include <SharedGraphics/ImageDecoder.h>
 
 GIcon::GIcon()
     : m_impl(GIconImpl::create())
@@ -62,9 +63,13 @@ void GIconImpl::set_bitmap_for_size(int size, RetainPtr<GraphicsBitmap>&& bitmap
     m_bitmaps.set(size, move(bitmap));
 }
 
+// Every window wants the same handful of icons, so they come out of ImageDecoder's cache.
+static RetainPtr<GraphicsBitmap> load_icon_bitmap(const String& name, int size)
+{
+    return ImageDecoder::the().load(String::format("/res/icons/%dx%d/%s.png", size, size, name.characters()));
+}
+
 GIcon GIcon::default_icon(const String& name)
 {
-    auto bitmap16 = GraphicsBitmap::load_from_file(String::format("/res/icons/16x16/%s.png", name.characters()));
-    auto bitmap32 = GraphicsBitmap::load_from_file(String::format("/res/icons/32x32/%s.png", name.characters()));
-    return GIcon(move(bitmap16), move(bitmap32));
+    return GIcon(load_icon_bitmap(name, 16), load_icon_bitmap(name, 32));
 }
@@ -3,6 +3,7 @@
 #include <LibGUI/GScrollBar.h>
 #include <LibGUI/GPainter.h>
 #include <Kernel/KeyCode.h>
+#include <AK/StringBuilder.h>
 
 GItemView::GItemView(GWidget* parent)
     : GAbstractView(parent)
@@ -31,10 +32,30 @@ void GItemView::resize_event(GResizeEvent& event)
 void GItemView::did_update_model()
 {
     GAbstractView::did_update_model();
+    invalidate_item_layouts();
     update_content_size();
     update();
 }
 
+void GItemView::did_update_model_rows(const GModelNotification& notification)
+{
+    if (notification.type() != GModelNotification::RowsUpdated)
+        return did_update_model();
+    model_notification(notification);
+    int first_row = notification.first_row();
+    int last_row = min(first_row + notification.row_count(), m_item_layouts.size()) - 1;
+    for (int i = first_row; i <= last_row; ++i) {
+        m_item_layouts[i].is_valid = false;
+        update(item_rect(i).translated(0, -vertical_scrollbar().value()));
+    }
+}
+
+void GItemView::invalidate_item_layouts()
+{
+    m_item_layouts.clear();
+    m_item_layouts.resize(item_count());
+}
+
 void GItemView::update_content_size()
 {
     if (!model())
@@ -52,6 +73,19 @@ void GItemView::update_content_size()
     set_content_size({ content_width, content_height });
 }
 
+int GItemView::item_at(const Point& position) const
+{
+    if (!m_visual_column_count || position.x() < 0 || position.y() < 0)
+        return -1;
+    int visual_column_index = position.x() / effective_item_size().width();
+    if (visual_column_index >= m_visual_column_count)
+        return -1;
+    int item_index = (position.y() / effective_item_size().height()) * m_visual_column_count + visual_column_index;
+    if (item_index >= item_count())
+        return -1;
+    return item_index;
+}
+
 Rect GItemView::item_rect(int item_index) const
 {
     if (!m_visual_row_count || !m_visual_column_count)
@@ -69,17 +103,12 @@ Rect GItemView::item_rect(int item_index) const
 void GItemView::mousedown_event(GMouseEvent& event)
 {
     if (event.button() == GMouseButton::Left) {
-        // FIXME: Since all items are the same size, just compute the clicked item index
-        //        instead of iterating over everything.
         auto adjusted_position = event.position().translated(0, vertical_scrollbar().value());
-        for (int i = 0; i < item_count(); ++i) {
-            if (item_rect(i).contains(adjusted_position)) {
-                model()->set_selected_index(model()->index(i, 0));
-                update();
-                return;
-            }
-        }
-        model()->set_selected_index({ });
+        int item_index = item_at(adjusted_position);
+        if (item_index >= 0 && item_rect(item_index).contains(adjusted_position))
+            model()->set_selected_index(model()->index(item_index, 0));
+        else
+            model()->set_selected_index({ });
         update();
     }
 }
@@ -106,9 +135,23 @@ void GItemView::paint_event(GPaintEvent& event)
 
     auto column_metadata = model()->column_metadata(m_model_column);
     const Font& font = column_metadata.font ? *column_metadata.font : this->font();
+    if (&font != m_item_layout_font) {
+        invalidate_item_layouts();
+        m_item_layout_font = &font;
+    }
+    if (!m_visual_column_count || !effective_item_size().height())
+        return;
+
+    // Only the rows that the paint rect touches, worked out from where it is in the content.
+    Rect content_rect = event.rect().translated(horizontal_scrollbar().value(), vertical_scrollbar().value());
+    int first_visual_row = max(0, content_rect.top() / effective_item_size().height());
+    int last_visual_row = min(m_visual_row_count - 1, content_rect.bottom() / effective_item_size().height());
+    int first_item_index = first_visual_row * m_visual_column_count;
+    int last_item_index = min(item_count() - 1, (last_visual_row + 1) * m_visual_column_count - 1);
+    int selected_row = model()->selected_index().row();
 
-    for (int item_index = 0; item_index < model()->row_count(); ++item_index) {
-        bool is_selected_item = item_index == model()->selected_index().row();
+    for (int item_index = first_item_index; item_index <= last_item_index; ++item_index) {
+        bool is_selected_item = item_index == selected_row;
         Color background_color;
         if (is_selected_item) {
             background_color = is_focused() ? Color::from_rgb(0x84351a) : Color::from_rgb(0x606060);
@@ -117,34 +160,68 @@ void GItemView::paint_event(GPaintEvent& event)
         }
 
         Rect item_rect = this->item_rect(item_index);
-        auto model_index = model()->index(item_index, m_model_column);
-
-        auto icon = model()->data(model_index, GModel::Role::Icon);
-        auto item_text = model()->data(model_index, GModel::Role::Display);
+        auto& layout = layout_for_item(item_index, font);
 
         Rect icon_rect = { 0, 0, 32, 32 };
         icon_rect.center_within(item_rect);
         icon_rect.move_by(0, -font.glyph_height() - 6);
 
-        if (icon.is_icon()) {
-            if (auto bitmap = icon.as_icon().bitmap_for_size(icon_rect.width()))
+        if (layout.icon) {
+            if (auto bitmap = layout.icon->bitmap_for_size(icon_rect.width()))
                 painter.draw_scaled_bitmap(icon_rect, *bitmap, bitmap->rect());
         }
 
-        Rect text_rect { 0, icon_rect.bottom() + 6 + 1, font.width(item_text.to_string()), font.glyph_height() };
+        Rect text_rect { 0, icon_rect.bottom() + 6 + 1, layout.text_width, font.glyph_height() };
         text_rect.center_horizontally_within(item_rect);
         text_rect.inflate(6, 4);
 
-        Color text_color;
-        if (is_selected_item)
-            text_color = Color::White;
-        else
-            text_color = model()->data(model_index, GModel::Role::ForegroundColor).to_color(Color::Black);
+        Color text_color = is_selected_item ? Color::White : layout.text_color;
         painter.fill_rect(text_rect, background_color);
-        painter.draw_text(text_rect, item_text.to_string(), font, TextAlignment::Center, text_color);
+        painter.draw_text(text_rect, layout.text, font, TextAlignment::Center, text_color);
     };
 }
 
+const GItemView::ItemLayout& GItemView::layout_for_item(int item_index, const Font& font)
+{
+    if (m_item_layouts.size() != item_count())
+        invalidate_item_layouts();
+    auto& layout = m_item_layouts[item_index];
+    if (layout.is_valid)
+        return layout;
+
+    auto model_index = model()->index(item_index, m_model_column);
+    auto icon = model()->data(model_index, GModel::Role::Icon);
+    layout.icon = icon.is_icon() ? RetainPtr<GIconImpl>(&icon.as_icon().impl()) : nullptr;
+    layout.text_color = model()->data(model_index, GModel::Role::ForegroundColor).to_color(Color::Black);
+
+    // The text gets the item's width, less the room around it when it's highlighted.
+    String text = model()->data(model_index, GModel::Role::Display).to_string();
+    int max_width = effective_item_size().width() - 12;
+    int width = font.width(text);
+    if (width > max_width) {
+        static const char ellipsis[] = "...";
+        int ellipsis_width = font.width(ellipsis, 3);
+        int length = 0;
+        int prefix_width = 0;
+        while (length < text.length()) {
+            int glyph_width = font.glyph_width(text[length]) + font.glyph_spacing();
+            if (prefix_width + glyph_width + ellipsis_width > max_width)
+                break;
+            prefix_width += glyph_width;
+            ++length;
+        }
+        StringBuilder builder;
+        builder.append(text.characters(), length);
+        builder.append(ellipsis);
+        text = builder.to_string();
+        width = font.width(text);
+    }
+    layout.text = move(text);
+    layout.text_width = width;
+    layout.is_valid = true;
+    return layout;
+}
+
 int GItemView::item_count() const
 {
     if (!model())
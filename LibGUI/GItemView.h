@@ -2,6 +2,7 @@
 
 #include <LibGUI/GModel.h>
 #include <LibGUI/GAbstractView.h>
+#include <LibGUI/GIcon.h>
 #include <AK/Function.h>
 #include <AK/HashMap.h>
 
@@ -26,6 +27,7 @@ public:
 
 private:
     virtual void did_update_model() override;
+    virtual void did_update_model_rows(const GModelNotification&) override;
     virtual void paint_event(GPaintEvent&) override;
     virtual void resize_event(GResizeEvent&) override;
     virtual void mousedown_event(GMouseEvent&) override;
@@ -34,12 +36,31 @@ private:
 
     int item_count() const;
     Rect item_rect(int item_index) const;
+    // The item under |position| in content coordinates, or -1.
+    int item_at(const Point& position) const;
     void update_content_size();
 
+    // What painting an item needs from the model, worked out the first time it's painted.
+    struct ItemLayout {
+        bool is_valid { false };
+        // Not a GIcon, which would make an empty one for every item that hasn't been painted yet.
+        RetainPtr<GIconImpl> icon;
+        // Cut short with "..." if it's wider than the item.
+        String text;
+        int text_width { 0 };
+        Color text_color;
+    };
+    const ItemLayout& layout_for_item(int item_index, const Font&);
+    void invalidate_item_layouts();
+
     int m_horizontal_padding { 5 };
     int m_model_column { 0 };
     int m_visual_column_count { 0 };
     int m_visual_row_count { 0 };
 
     Size m_effective_item_size { 80, 80 };
+
+    Vector<ItemLayout> m_item_layouts;
+    // The font the layouts were made with.
+    const Font* m_item_layout_font { nullptr };
 };
@@ -5,12 +5,14 @@
 GLabel::GLabel(GWidget* parent)
     : GFrame(parent)
 {
+    set_layer_caching_enabled(true);
 }
 
 GLabel::GLabel(const String& text, GWidget* parent)
     : GFrame(parent)
     , m_text(text)
 {
+    set_layer_caching_enabled(true);
 }
 
 GLabel::~GLabel()
@@ -20,6 +22,7 @@ GLabel::~GLabel()
 void GLabel::set_icon(RetainPtr<GraphicsBitmap>&& icon)
 {
     m_icon = move(icon);
+    update();
 }
 
 void GLabel::set_text(const String& text)
@@ -4,19 +4,7 @@
 #include <AK/Types.h>
 #include <unistd.h>
 
-#define memory_barrier() asm volatile ("" ::: "memory")
-
-static inline dword CAS(volatile dword* mem, dword newval, dword oldval)
-{
-    dword ret;
-    asm volatile(
-        "cmpxchgl %2, %1"
-        :"=a"(ret), "+m"(*mem)
-        :"r"(newval), "0"(oldval)
-        :"cc", "memory");
-    return ret;
-}
-
+// A recursive lock for threads made with create_thread(). Contended lockers sleep in futex() instead of spinning.
 class GLock {
 public:
     GLock() { }
@@ -26,7 +14,8 @@ public:
     void unlock();
 
 private:
-    volatile dword m_lock { 0 };
+    // 0: unlocked, 1: locked, 2: locked and someone may be waiting.
+    int m_state { 0 };
     dword m_level { 0 };
     int m_holder { -1 };
 };
@@ -44,39 +33,34 @@ private:
 
 [[gnu::always_inline]] inline void GLock::lock()
 {
-    for (;;) {
-        if (CAS(&m_lock, 1, 0) == 0) {
-            if (m_holder == -1 || m_holder == gettid()) {
-                m_holder = gettid();
-                ++m_level;
-                memory_barrier();
-                m_lock = 0;
-                return;
-            }
-            m_lock = 0;
+    int tid = gettid();
+    if (m_holder == tid) {
+        ++m_level;
+        return;
+    }
+    int state = 0;
+    if (!__atomic_compare_exchange_n(&m_state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (state != 2)
+            state = __atomic_exchange_n(&m_state, 2, __ATOMIC_ACQUIRE);
+        while (state != 0) {
+            futex(&m_state, FUTEX_WAIT, 2);
+            state = __atomic_exchange_n(&m_state, 2, __ATOMIC_ACQUIRE);
         }
-        donate(m_holder);
     }
+    m_holder = tid;
+    m_level = 1;
 }
 
 inline void GLock::unlock()
 {
-    for (;;) {
-        if (CAS(&m_lock, 1, 0) == 0) {
-            ASSERT(m_holder == gettid());
-            ASSERT(m_level);
-            --m_level;
-            if (m_level) {
-                memory_barrier();
-                m_lock = 0;
-                return;
-            }
-            m_holder = -1;
-            memory_barrier();
-            m_lock = 0;
-            return;
-        }
-        donate(m_holder);
+    ASSERT(m_holder == gettid());
+    ASSERT(m_level);
+    if (--m_level)
+        return;
+    m_holder = -1;
+    if (__atomic_fetch_sub(&m_state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m_state, 0, __ATOMIC_RELEASE);
+        futex(&m_state, FUTEX_WAKE, 1);
     }
 }
 
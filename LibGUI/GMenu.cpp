@@ -46,17 +46,19 @@ int GMenu::realize_menu()
     ASSERT(m_name.length() < (ssize_t)sizeof(request.text));
     strcpy(request.text, m_name.characters());
     request.text_length = m_name.length();
-    auto response = GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidCreateMenu);
-    m_menu_id = response.menu.menu_id;
+    static int s_next_menu_id;
+    m_menu_id = ++s_next_menu_id;
+    request.menu.menu_id = m_menu_id;
+    // None of this is waited for: we pick the ID, and there's nothing in the other replies we need.
+    GEventLoop::current().post_message_to_server(request);
 
-    ASSERT(m_menu_id > 0);
     for (int i = 0; i < m_items.size(); ++i) {
         auto& item = *m_items[i];
         if (item.type() == GMenuItem::Separator) {
             WSAPI_ClientMessage request;
             request.type = WSAPI_ClientMessage::Type::AddMenuSeparator;
             request.menu.menu_id = m_menu_id;
-            GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidAddMenuSeparator);
+            GEventLoop::current().post_message_to_server(request);
             continue;
         }
         if (item.type() == GMenuItem::Action) {
@@ -78,7 +80,7 @@ int GMenu::realize_menu()
                 request.menu.shortcut_text_length = 0;
             }
 
-            GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidAddMenuItem);
+            GEventLoop::current().post_message_to_server(request);
         }
     }
     all_menus().set(m_menu_id, this);
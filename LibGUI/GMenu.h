@@ -2,6 +2,7 @@
 
 #include <LibGUI/GMenuItem.h>
 #include <AK/Function.h>
+#include <AK/OwnPtr.h>
 #include <AK/Vector.h>
 
 class GAction;
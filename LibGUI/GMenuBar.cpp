@@ -19,8 +19,11 @@ int GMenuBar::realize_menubar()
 {
     WSAPI_ClientMessage request;
     request.type = WSAPI_ClientMessage::Type::CreateMenubar;
-    WSAPI_ServerMessage response = GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidCreateMenubar);
-    return response.menu.menubar_id;
+    // We pick the IDs, so creating things doesn't have to wait for WindowServer either.
+    static int s_next_menubar_id;
+    request.menu.menubar_id = ++s_next_menubar_id;
+    GEventLoop::current().post_message_to_server(request);
+    return request.menu.menubar_id;
 }
 
 void GMenuBar::unrealize_menubar()
@@ -39,6 +42,7 @@ void GMenuBar::notify_added_to_application(Badge<GApplication>)
     ASSERT(!m_menubar_id);
     m_menubar_id = realize_menubar();
     ASSERT(m_menubar_id > 0);
+    // None of this is waited for. It all goes in order, so it gets there before anything that depends on it.
     for (auto& menu : m_menus) {
         ASSERT(menu);
         int menu_id = menu->realize_menu();
@@ -47,12 +51,12 @@ void GMenuBar::notify_added_to_application(Badge<GApplication>)
         request.type = WSAPI_ClientMessage::Type::AddMenuToMenubar;
         request.menu.menubar_id = m_menubar_id;
         request.menu.menu_id = menu_id;
-        GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidAddMenuToMenubar);
+        GEventLoop::current().post_message_to_server(request);
     }
     WSAPI_ClientMessage request;
     request.type = WSAPI_ClientMessage::Type::SetApplicationMenubar;
     request.menu.menubar_id = m_menubar_id;
-    GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidSetApplicationMenubar);
+    GEventLoop::current().post_message_to_server(request);
 }
 
 void GMenuBar::notify_removed_from_application(Badge<GApplication>)
@@ -34,6 +34,47 @@ void GModel::did_update()
     });
 }
 
+void GModel::did_change_rows(const GModelNotification& notification)
+{
+    if (!notification.row_count())
+        return;
+
+    // Keep the selection on the same row when others come and go above it.
+    if (m_selected_index.is_valid() && !m_selected_index.parent().is_valid()) {
+        int row = m_selected_index.row();
+        int column = m_selected_index.column();
+        if (notification.type() == GModelNotification::RowsInserted && notification.first_row() <= row) {
+            m_selected_index = index(row + notification.row_count(), column);
+        } else if (notification.type() == GModelNotification::RowsRemoved && notification.first_row() <= row) {
+            if (notification.first_row() + notification.row_count() <= row)
+                m_selected_index = index(row - notification.row_count(), column);
+            else
+                set_selected_index({ });
+        }
+    }
+
+    if (on_rows_change)
+        on_rows_change(*this, notification);
+    for_each_view([&] (auto& view) {
+        view.did_update_model_rows(notification);
+    });
+}
+
+void GModel::did_insert_rows(int first_row, int row_count)
+{
+    did_change_rows(GModelNotification(GModelNotification::RowsInserted, first_row, row_count));
+}
+
+void GModel::did_remove_rows(int first_row, int row_count)
+{
+    did_change_rows(GModelNotification(GModelNotification::RowsRemoved, first_row, row_count));
+}
+
+void GModel::did_update_rows(int first_row, int row_count)
+{
+    did_change_rows(GModelNotification(GModelNotification::RowsUpdated, first_row, row_count));
+}
+
 void GModel::set_selected_index(const GModelIndex& index)
 {
     if (m_selected_index == index)
@@ -53,6 +94,14 @@ GModelIndex GModel::create_index(int row, int column, void* data) const
     return GModelIndex(*this, row, column, data);
 }
 
+void GModel::fetch_row(int row, Role role, Vector<GVariant>& values) const
+{
+    values.clear_with_capacity();
+    int column_count = this->column_count();
+    for (int column = 0; column < column_count; ++column)
+        values.append(data(index(row, column), role));
+}
+
 GModelIndex GModel::sibling(int row, int column, const GModelIndex& parent) const
 {
     if (!parent.is_valid())
@@ -4,6 +4,7 @@
 #include <AK/Badge.h>
 #include <AK/Function.h>
 #include <AK/HashTable.h>
+#include <AK/Vector.h>
 #include <LibGUI/GModelIndex.h>
 #include <LibGUI/GVariant.h>
 #include <SharedGraphics/TextAlignment.h>
@@ -18,6 +19,9 @@ public:
     enum Type {
         Invalid = 0,
         ModelUpdated,
+        RowsInserted,
+        RowsRemoved,
+        RowsUpdated,
     };
 
     explicit GModelNotification(Type type, const GModelIndex& index = GModelIndex())
@@ -26,12 +30,24 @@ public:
     {
     }
 
+    // For the Rows* types: the affected rows, numbered as they were before a removal and after an insertion.
+    GModelNotification(Type type, int first_row, int row_count)
+        : m_type(type)
+        , m_first_row(first_row)
+        , m_row_count(row_count)
+    {
+    }
+
     Type type() const { return m_type; }
     GModelIndex index() const { return m_index; }
+    int first_row() const { return m_first_row; }
+    int row_count() const { return m_row_count; }
 
 private:
     Type m_type { Invalid };
     GModelIndex m_index;
+    int m_first_row { 0 };
+    int m_row_count { 0 };
 };
 
 class GModel : public Retainable<GModel> {
@@ -47,11 +63,18 @@ public:
     virtual ~GModel();
 
     virtual int row_count(const GModelIndex& = GModelIndex()) const = 0;
+    // For models where counting the rows means loading them (like a directory's), so views can hold off
+    // on that until they need the rows themselves. It's fine to say yes and then have none.
+    virtual bool may_have_children(const GModelIndex& index) const { return row_count(index) > 0; }
     virtual int column_count(const GModelIndex& = GModelIndex()) const = 0;
     virtual String row_name(int) const { return { }; }
     virtual String column_name(int) const { return { }; }
     virtual ColumnMetadata column_metadata(int) const { return { }; }
     virtual GVariant data(const GModelIndex&, Role = Role::Display) const = 0;
+    // The data of every column in a top-level row, for views that paint a row at a time. Passing the same
+    // vector for each row means nothing gets allocated after the first. Models that look the row up for
+    // every cell in data() can override this to do it once.
+    virtual void fetch_row(int row, Role, Vector<GVariant>& values) const;
     virtual void update() = 0;
     virtual GModelIndex parent_index(const GModelIndex&) const { return { }; }
     virtual GModelIndex index(int row, int column = 0, const GModelIndex& = GModelIndex()) const { return create_index(row, column); }
@@ -77,6 +100,7 @@ public:
     void unregister_view(Badge<GAbstractView>, GAbstractView&);
 
     Function<void(GModel&)> on_model_update;
+    Function<void(GModel&, const GModelNotification&)> on_rows_change;
     Function<void(const GModelIndex&)> on_selection_changed;
 
 protected:
@@ -84,10 +108,16 @@ protected:
 
     void for_each_view(Function<void(GAbstractView&)>);
     void did_update();
+    // Cheaper for views than did_update() when only some rows are affected.
+    void did_insert_rows(int first_row, int row_count);
+    void did_remove_rows(int first_row, int row_count);
+    void did_update_rows(int first_row, int row_count);
 
     GModelIndex create_index(int row, int column, void* data = nullptr) const;
 
 private:
+    void did_change_rows(const GModelNotification&);
+
     HashTable<GAbstractView*> m_views;
     GModelIndex m_selected_index;
     bool m_activates_on_selection { false };
@@ -2,7 +2,9 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 GSocket::GSocket(Type type, GObject* parent)
     : GIODevice(parent)
@@ -17,6 +19,7 @@ GSocket::~GSocket()
 bool GSocket::connect(const GSocketAddress& address, int port)
 {
     ASSERT(!is_connected());
+    ASSERT(!is_connecting());
     ASSERT(address.type() == GSocketAddress::Type::IPv4);
     ASSERT(port > 0 && port <= 65535);
 
@@ -27,19 +30,43 @@ bool GSocket::connect(const GSocketAddress& address, int port)
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
 
-    printf("Connecting to %s...", address.to_string().characters());
-    fflush(stdout);
+    m_destination_address = address;
+    m_destination_port = port;
+
+    dbgprintf("GSocket{%p}: Connecting to %s:%d\n", this, address.to_string().characters(), port);
     int rc = ::connect(fd(), (struct sockaddr*)&addr, sizeof(addr));
-    if (rc < 0) {
-        perror("connect");
-        exit(1);
+    if (rc < 0 && errno != EINPROGRESS) {
+        set_error(errno);
+        return false;
     }
-    printf("ok!\n");
+    // The socket turns writable once the connection is made, or once it has failed.
+    m_connect_notifier = make<GNotifier>(fd(), GNotifier::Write);
+    m_connect_notifier->on_ready_to_write = [this] (GNotifier&) { did_finish_connecting(); };
+    return true;
+}
 
-    m_destination_address = address;
-    m_destination_port = port;
+void GSocket::did_finish_connecting()
+{
+    // This is called from the notifier, which can go now that it's done its job.
+    m_connect_notifier = nullptr;
+    int error = 0;
+    socklen_t error_size = sizeof(error);
+    if (getsockopt(fd(), SOL_SOCKET, SO_ERROR, &error, &error_size) < 0)
+        error = errno;
+    if (error) {
+        dbgprintf("GSocket{%p}: Connecting failed: %s\n", this, strerror(error));
+        set_error(error);
+        m_send_queue.clear();
+        m_send_queue_offset = 0;
+        if (on_connection_failed)
+            on_connection_failed(error);
+        return;
+    }
     m_connected = true;
-    return true;
+    if (on_connected)
+        on_connected();
+    if (queued_size())
+        flush_send_queue();
 }
 
 ByteBuffer GSocket::receive(int max_size)
@@ -54,11 +81,59 @@ ByteBuffer GSocket::receive(int max_size)
 
 bool GSocket::send(const ByteBuffer& data)
 {
-    int nsent = ::send(fd(), data.pointer(), data.size(), 0);
-    if (nsent < 0) {
-        set_error(nsent);
+    if (!is_connected() && !is_connecting())
         return false;
+    int offset = 0;
+    // Only go straight to the socket when nothing's waiting, so everything keeps its order.
+    if (is_connected() && !queued_size()) {
+        int nsent = ::send(fd(), data.pointer(), data.size(), 0);
+        if (nsent < 0 && errno != EAGAIN) {
+            set_error(errno);
+            return false;
+        }
+        offset = max(nsent, 0);
+        if (offset == data.size())
+            return true;
+    }
+    m_send_queue.append((const byte*)data.pointer() + offset, data.size() - offset);
+    if (is_connected())
+        wait_to_flush_send_queue();
+    return true;
+}
+
+void GSocket::wait_to_flush_send_queue()
+{
+    if (m_send_notifier)
+        return;
+    m_send_notifier = make<GNotifier>(fd(), GNotifier::Write);
+    m_send_notifier->on_ready_to_write = [this] (GNotifier&) { flush_send_queue(); };
+}
+
+bool GSocket::flush_send_queue()
+{
+    while (queued_size()) {
+        int nsent = ::send(fd(), m_send_queue.data() + m_send_queue_offset, queued_size(), 0);
+        if (nsent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            set_error(errno);
+            m_send_queue.clear();
+            m_send_queue_offset = 0;
+            m_send_notifier = nullptr;
+            return false;
+        }
+        m_send_queue_offset += nsent;
+    }
+    if (queued_size()) {
+        wait_to_flush_send_queue();
+        return true;
     }
-    ASSERT(nsent == data.size());
+    m_send_queue.clear();
+    m_send_queue_offset = 0;
+    m_send_notifier = nullptr;
+    if (on_send_queue_drained)
+        on_send_queue_drained();
     return true;
 }
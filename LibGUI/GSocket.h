@@ -1,7 +1,10 @@
 #pragma once
 
 #include <LibGUI/GIODevice.h>
+#include <LibGUI/GNotifier.h>
 #include <AK/AKString.h>
+#include <AK/Function.h>
+#include <AK/OwnPtr.h>
 #include <Kernel/IPv4.h>
 
 class GSocketAddress {
@@ -37,12 +40,25 @@ public:
     enum class Type { Invalid, TCP, UDP };
     virtual ~GSocket() override;
 
+    // Starts connecting, without waiting for it. Returns false if that failed right away, otherwise
+    // on_connected or on_connection_failed gets called from the event loop once it's done.
     bool connect(const GSocketAddress&, int port);
 
     ByteBuffer receive(int max_size);
+    // Sends what it can right away, and queues the rest to go out whenever the socket has room.
+    // Anything sent while still connecting goes out once connected. Returns false on errors.
     bool send(const ByteBuffer&);
 
     bool is_connected() const { return m_connected; }
+    bool is_connecting() const { return m_connect_notifier; }
+
+    // How much send() has queued up that the socket didn't take yet.
+    int queued_size() const { return m_send_queue.size() - m_send_queue_offset; }
+
+    Function<void()> on_connected;
+    Function<void(int error)> on_connection_failed;
+    // Called once the send queue has gone out, so whoever's producing can hold off until then.
+    Function<void()> on_send_queue_drained;
 
     GSocketAddress source_address() const { return m_source_address; }
     int source_port() const { return m_source_port; }
@@ -63,6 +79,14 @@ protected:
 
 private:
     virtual bool open(GIODevice::OpenMode) override { ASSERT_NOT_REACHED(); }
-    Type m_type { Type::Invalid };
+    void did_finish_connecting();
+    bool flush_send_queue();
+    void wait_to_flush_send_queue();
 
+    Type m_type { Type::Invalid };
+    OwnPtr<GNotifier> m_connect_notifier;
+    OwnPtr<GNotifier> m_send_notifier;
+    // What's been sent off of it isn't moved out of the way until it has all gone.
+    Vector<byte> m_send_queue;
+    int m_send_queue_offset { 0 };
 };
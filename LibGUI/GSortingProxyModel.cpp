@@ -1,5 +1,5 @@
 #include <LibGUI/GSortingProxyModel.h>
-#include <AK/QuickSort.h>
+#include <AK/ThreadPool.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -10,6 +10,9 @@ GSortingProxyModel::GSortingProxyModel(Retained<GModel>&& target)
     m_target->on_model_update = [this] (GModel&) {
         resort();
     };
+    m_target->on_rows_change = [this] (GModel&, const GModelNotification& notification) {
+        target_rows_changed(notification);
+    };
 }
 
 GSortingProxyModel::~GSortingProxyModel()
@@ -55,6 +58,12 @@ GVariant GSortingProxyModel::data(const GModelIndex& index, Role role) const
     return target().data(map_to_target(index), role);
 }
 
+void GSortingProxyModel::fetch_row(int row, Role role, Vector<GVariant>& values) const
+{
+    ASSERT(row >= 0 && row < row_count());
+    target().fetch_row(m_row_mappings[row], role, values);
+}
+
 void GSortingProxyModel::activate(const GModelIndex& index)
 {
     target().activate(map_to_target(index));
@@ -78,30 +87,343 @@ void GSortingProxyModel::set_key_column_and_sort_order(int column, GSortOrder so
 
 void GSortingProxyModel::resort()
 {
-    int previously_selected_target_row = map_to_target(selected_index()).row();
+    fetch_sort_keys();
+    sort_row_mappings();
+    did_update();
+}
+
+void GSortingProxyModel::fetch_sort_keys()
+{
+    m_int_keys.clear();
+    m_float_keys.clear();
+    m_string_keys.clear();
+    if (m_key_column == -1)
+        return;
+    int row_count = target().row_count();
+    if (!row_count)
+        return;
+    auto first_key = target().data(target().index(0, m_key_column), GModel::Role::Sort);
+    if (first_key.is_int() || first_key.is_bool())
+        m_key_type = KeyType::Int;
+    else if (first_key.is_float())
+        m_key_type = KeyType::Float;
+    else
+        m_key_type = KeyType::String;
+    insert_sort_keys(0, row_count);
+    if (refetch_sort_keys(0, row_count))
+        return;
+    // A column of mixed types; GVariant compares those by their text, so do that for every row.
+    m_key_type = KeyType::String;
+    m_int_keys.clear();
+    m_float_keys.clear();
+    insert_sort_keys(0, row_count);
+    refetch_sort_keys(0, row_count);
+}
+
+bool GSortingProxyModel::set_sort_key(int target_row, const GVariant& data)
+{
+    switch (m_key_type) {
+    case KeyType::Int:
+        if (data.is_int())
+            m_int_keys[target_row] = data.as_int();
+        else if (data.is_bool())
+            m_int_keys[target_row] = data.as_bool();
+        else
+            return false;
+        return true;
+    case KeyType::Float:
+        if (!data.is_float())
+            return false;
+        m_float_keys[target_row] = data.as_float();
+        return true;
+    case KeyType::String:
+        m_string_keys[target_row] = data.is_string() ? data.as_string() : data.to_string();
+        return true;
+    }
+    ASSERT_NOT_REACHED();
+}
+
+// Returns false if some row's data doesn't fit the current key type.
+bool GSortingProxyModel::refetch_sort_keys(int first_target_row, int row_count)
+{
+    for (int row = first_target_row; row < first_target_row + row_count; ++row) {
+        if (!set_sort_key(row, target().data(target().index(row, m_key_column), GModel::Role::Sort)))
+            return false;
+    }
+    return true;
+}
+
+// Opens up |count| slots at |first|, moving what's there one pass up. The new slots get filled in by refetch_sort_keys().
+template<typename T>
+static void insert_slots(Vector<T>& keys, int first, int count)
+{
+    int old_size = keys.size();
+    keys.resize(old_size + count);
+    for (int i = old_size - 1; i >= first; --i)
+        keys[i + count] = move(keys[i]);
+}
+
+template<typename T>
+static void remove_slots(Vector<T>& keys, int first, int count)
+{
+    for (int i = first; i + count < keys.size(); ++i)
+        keys[i] = move(keys[i + count]);
+    keys.resize(keys.size() - count);
+}
+
+void GSortingProxyModel::insert_sort_keys(int first_target_row, int row_count)
+{
+    switch (m_key_type) {
+    case KeyType::Int:
+        insert_slots(m_int_keys, first_target_row, row_count);
+        break;
+    case KeyType::Float:
+        insert_slots(m_float_keys, first_target_row, row_count);
+        break;
+    case KeyType::String:
+        insert_slots(m_string_keys, first_target_row, row_count);
+        break;
+    }
+}
+
+void GSortingProxyModel::remove_sort_keys(int first_target_row, int row_count)
+{
+    switch (m_key_type) {
+    case KeyType::Int:
+        remove_slots(m_int_keys, first_target_row, row_count);
+        break;
+    case KeyType::Float:
+        remove_slots(m_float_keys, first_target_row, row_count);
+        break;
+    case KeyType::String:
+        remove_slots(m_string_keys, first_target_row, row_count);
+        break;
+    }
+}
+
+// Ties go by target row, so rows only move around when their keys do.
+template<typename Key>
+static inline bool is_row_less_than(const Key& key1, const Key& key2, int row1, int row2, GSortOrder sort_order)
+{
+    if (key1 == key2)
+        return row1 < row2;
+    return sort_order == GSortOrder::Ascending ? key1 < key2 : key2 < key1;
+}
+
+// Calls |callback| with a comparison of two target rows specialized for the key type,
+// so a sort never has to go through GVariant.
+template<typename Callback>
+void GSortingProxyModel::with_row_comparator(Callback callback) const
+{
+    auto sort_order = m_sort_order;
+    switch (m_key_type) {
+    case KeyType::Int: {
+        auto* keys = m_int_keys.data();
+        callback([keys, sort_order] (int row1, int row2) { return is_row_less_than(keys[row1], keys[row2], row1, row2, sort_order); });
+        break;
+    }
+    case KeyType::Float: {
+        auto* keys = m_float_keys.data();
+        callback([keys, sort_order] (int row1, int row2) { return is_row_less_than(keys[row1], keys[row2], row1, row2, sort_order); });
+        break;
+    }
+    case KeyType::String: {
+        auto* keys = m_string_keys.data();
+        callback([keys, sort_order] (int row1, int row2) { return is_row_less_than(keys[row1], keys[row2], row1, row2, sort_order); });
+        break;
+    }
+    }
+}
+
+bool GSortingProxyModel::is_in_order_at(int position) const
+{
+    bool in_order = true;
+    with_row_comparator([&] (auto less_than) {
+        int row = m_row_mappings[position];
+        if (position > 0 && !less_than(m_row_mappings[position - 1], row))
+            in_order = false;
+        else if (position < m_row_mappings.size() - 1 && !less_than(row, m_row_mappings[position + 1]))
+            in_order = false;
+    });
+    return in_order;
+}
+
+int GSortingProxyModel::insert_row_mapping(int target_row)
+{
+    int low = 0;
+    int high = m_row_mappings.size();
+    with_row_comparator([&] (auto less_than) {
+        while (low < high) {
+            int middle = low + (high - low) / 2;
+            if (less_than(m_row_mappings[middle], target_row))
+                low = middle + 1;
+            else
+                high = middle;
+        }
+    });
+    m_row_mappings.insert(low, move(target_row));
+    return low;
+}
+
+int GSortingProxyModel::selected_target_row() const
+{
+    return map_to_target(selected_index()).row();
+}
+
+void GSortingProxyModel::select_target_row(int target_row)
+{
+    if (target_row == -1)
+        return;
+    for (int i = 0; i < m_row_mappings.size(); ++i) {
+        if (m_row_mappings[i] == target_row) {
+            set_selected_index(index(i, 0));
+            return;
+        }
+    }
+}
+
+void GSortingProxyModel::sort_row_mappings()
+{
+    int previously_selected_target_row = selected_target_row();
     int row_count = target().row_count();
     m_row_mappings.resize(row_count);
     for (int i = 0; i < row_count; ++i)
         m_row_mappings[i] = i;
     if (m_key_column == -1)
         return;
-    quick_sort(m_row_mappings.begin(), m_row_mappings.end(), [&] (auto row1, auto row2) -> bool {
-        auto data1 = target().data(target().index(row1, m_key_column), GModel::Role::Sort);
-        auto data2 = target().data(target().index(row2, m_key_column), GModel::Role::Sort);
-        if (data1 == data2)
-            return 0;
-        bool is_less_than = data1 < data2;
-        return m_sort_order == GSortOrder::Ascending ? is_less_than : !is_less_than;
+    // Ties go by target row, so there's only one right order and it doesn't matter that the sort isn't stable.
+    with_row_comparator([&] (auto less_than) {
+        parallel_sort(m_row_mappings, less_than);
     });
-    if (previously_selected_target_row != -1) {
-        // Preserve selection.
-        for (int i = 0; i < row_count; ++i) {
-            if (m_row_mappings[i] == previously_selected_target_row) {
-                set_selected_index(index(i, 0));
-                break;
+    // Preserve selection.
+    select_target_row(previously_selected_target_row);
+}
+
+void GSortingProxyModel::target_rows_changed(const GModelNotification& notification)
+{
+    if (m_key_column != -1) {
+        sorted_target_rows_changed(notification);
+        return;
+    }
+    // Unsorted, so every row is where it is in the target.
+    sort_row_mappings();
+    if (notification.type() == GModelNotification::RowsInserted)
+        did_insert_rows(notification.first_row(), notification.row_count());
+    else if (notification.type() == GModelNotification::RowsRemoved)
+        did_remove_rows(notification.first_row(), notification.row_count());
+    else
+        did_update_rows(notification.first_row(), notification.row_count());
+}
+
+// Sorts |rows| and merges them into the mappings, which must not have them already.
+void GSortingProxyModel::merge_into_row_mappings(Vector<int>&& rows)
+{
+    with_row_comparator([&] (auto less_than) {
+        parallel_sort(rows, less_than);
+        Vector<int> merged;
+        merged.ensure_capacity(m_row_mappings.size() + rows.size());
+        int i = 0;
+        int j = 0;
+        while (i < m_row_mappings.size() && j < rows.size())
+            merged.unchecked_append(less_than(rows[j], m_row_mappings[i]) ? rows[j++] : m_row_mappings[i++]);
+        while (i < m_row_mappings.size())
+            merged.unchecked_append(m_row_mappings[i++]);
+        while (j < rows.size())
+            merged.unchecked_append(rows[j++]);
+        m_row_mappings = move(merged);
+    });
+}
+
+void GSortingProxyModel::sorted_target_rows_changed(const GModelNotification& notification)
+{
+    int first_target_row = notification.first_row();
+    int changed_row_count = notification.row_count();
+    int last_target_row = first_target_row + changed_row_count - 1;
+    int previously_selected_target_row = selected_target_row();
+
+    if (notification.type() == GModelNotification::RowsRemoved) {
+        int removed_at = -1;
+        int kept = 0;
+        for (int i = 0; i < m_row_mappings.size(); ++i) {
+            int row = m_row_mappings[i];
+            if (row >= first_target_row && row <= last_target_row) {
+                removed_at = i;
+                continue;
             }
+            m_row_mappings[kept++] = row > last_target_row ? row - changed_row_count : row;
+        }
+        m_row_mappings.resize(kept);
+        remove_sort_keys(first_target_row, changed_row_count);
+        if (changed_row_count == 1) {
+            did_remove_rows(removed_at, 1);
+            return;
         }
+        if (previously_selected_target_row > last_target_row)
+            select_target_row(previously_selected_target_row - changed_row_count);
+        else if (previously_selected_target_row >= first_target_row)
+            set_selected_index({ });
+        did_update();
+        return;
     }
 
+    if (notification.type() == GModelNotification::RowsInserted) {
+        for (int& row : m_row_mappings) {
+            if (row >= first_target_row)
+                row += changed_row_count;
+        }
+        insert_sort_keys(first_target_row, changed_row_count);
+        if (!refetch_sort_keys(first_target_row, changed_row_count)) {
+            resort();
+            return;
+        }
+        if (changed_row_count == 1) {
+            did_insert_rows(insert_row_mapping(first_target_row), 1);
+            return;
+        }
+        Vector<int> inserted_rows;
+        inserted_rows.ensure_capacity(changed_row_count);
+        for (int row = first_target_row; row <= last_target_row; ++row)
+            inserted_rows.unchecked_append(row);
+        merge_into_row_mappings(move(inserted_rows));
+        if (previously_selected_target_row >= first_target_row)
+            previously_selected_target_row += changed_row_count;
+        select_target_row(previously_selected_target_row);
+        did_update();
+        return;
+    }
+
+    if (!refetch_sort_keys(first_target_row, changed_row_count)) {
+        resort();
+        return;
+    }
+    bool all_in_order = true;
+    for (int i = 0; i < m_row_mappings.size() && all_in_order; ++i) {
+        int row = m_row_mappings[i];
+        if (row >= first_target_row && row <= last_target_row)
+            all_in_order = is_in_order_at(i);
+    }
+    if (all_in_order) {
+        // Nothing moved, so only the rows that changed need another look.
+        for (int i = 0; i < m_row_mappings.size(); ++i) {
+            int row = m_row_mappings[i];
+            if (row >= first_target_row && row <= last_target_row)
+                did_update_rows(i, 1);
+        }
+        return;
+    }
+    // Take the changed rows out and merge them back in where they now belong.
+    Vector<int> changed_rows;
+    changed_rows.ensure_capacity(changed_row_count);
+    int kept = 0;
+    for (int i = 0; i < m_row_mappings.size(); ++i) {
+        int row = m_row_mappings[i];
+        if (row >= first_target_row && row <= last_target_row)
+            changed_rows.unchecked_append(row);
+        else
+            m_row_mappings[kept++] = row;
+    }
+    m_row_mappings.resize(kept);
+    merge_into_row_mappings(move(changed_rows));
+    select_target_row(previously_selected_target_row);
     did_update();
 }
@@ -13,6 +13,7 @@ public:
     virtual String column_name(int) const override;
     virtual ColumnMetadata column_metadata(int) const override;
     virtual GVariant data(const GModelIndex&, Role = Role::Display) const override;
+    virtual void fetch_row(int row, Role, Vector<GVariant>&) const override;
     virtual void update() override;
     virtual void activate(const GModelIndex&) override;
 
@@ -28,10 +29,31 @@ private:
     GModel& target() { return *m_target; }
     const GModel& target() const { return *m_target; }
 
+    // The key column's sort data, fetched once per target row and kept as the narrowest type that holds all of it.
+    enum class KeyType { Int, Float, String };
+
     void resort();
+    void fetch_sort_keys();
+    bool set_sort_key(int target_row, const GVariant&);
+    bool refetch_sort_keys(int first_target_row, int row_count);
+    void insert_sort_keys(int first_target_row, int row_count);
+    void remove_sort_keys(int first_target_row, int row_count);
+    template<typename Callback> void with_row_comparator(Callback) const;
+    bool is_in_order_at(int) const;
+    int insert_row_mapping(int target_row);
+    void merge_into_row_mappings(Vector<int>&&);
+    void sort_row_mappings();
+    int selected_target_row() const;
+    void select_target_row(int);
+    void target_rows_changed(const GModelNotification&);
+    void sorted_target_rows_changed(const GModelNotification&);
 
     Retained<GModel> m_target;
     Vector<int> m_row_mappings;
+    KeyType m_key_type { KeyType::Int };
+    Vector<int> m_int_keys;
+    Vector<float> m_float_keys;
+    Vector<String> m_string_keys;
     int m_key_column { -1 };
     GSortOrder m_sort_order { GSortOrder::Ascending };
 };
@@ -1,5 +1,6 @@
 #include <LibGUI/GTCPSocket.h>
 #include <sys/socket.h>
+#include <fcntl.h>
 
 GTCPSocket::GTCPSocket(GObject* parent)
     : GSocket(GSocket::Type::TCP, parent)
@@ -8,6 +9,8 @@ GTCPSocket::GTCPSocket(GObject* parent)
     if (fd < 0) {
         set_error(fd);
     } else {
+        // Nothing on it waits, connect() and send() leave the rest to the event loop.
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
         set_fd(fd);
         set_mode(GIODevice::ReadWrite);
         set_error(0);
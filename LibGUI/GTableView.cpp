@@ -38,6 +38,47 @@ void GTableView::did_update_model()
     update();
 }
 
+void GTableView::did_update_model_rows(const GModelNotification& notification)
+{
+    model_notification(notification);
+    switch (notification.type()) {
+    case GModelNotification::RowsUpdated:
+        update_rows(notification.first_row(), notification.first_row() + notification.row_count() - 1);
+        return;
+    case GModelNotification::RowsInserted:
+    case GModelNotification::RowsRemoved:
+        // Everything further down moves.
+        update_content_size();
+        update_rows(notification.first_row(), INT32_MAX);
+        return;
+    default:
+        did_update_model();
+        return;
+    }
+}
+
+// The row under |y| in widget coordinates, which may well be out of range.
+int GTableView::row_at(int y) const
+{
+    int y_in_content = y + vertical_scrollbar().value() - header_height();
+    if (y_in_content < 0)
+        return -1;
+    return y_in_content / item_height();
+}
+
+void GTableView::update_rows(int first_row, int last_row)
+{
+    int top_visible_row = max(row_at(frame_inner_rect().top() + header_height()), 0);
+    int bottom_visible_row = row_at(frame_inner_rect().bottom());
+    first_row = max(first_row, top_visible_row);
+    last_row = min(last_row, bottom_visible_row);
+    if (first_row > last_row)
+        return;
+    int top = header_height() + first_row * item_height() - vertical_scrollbar().value();
+    int bottom = header_height() + (last_row + 1) * item_height() - vertical_scrollbar().value();
+    update(Rect::intersection({ 0, top, width(), bottom - top }, frame_inner_rect()));
+}
+
 Rect GTableView::row_rect(int item_index) const
 {
     return { 0, header_height() + (item_index * item_height()), max(content_size().width(), width()), item_height() };
@@ -83,15 +124,11 @@ void GTableView::mousedown_event(GMouseEvent& event)
     }
 
     if (event.button() == GMouseButton::Left) {
-        auto adjusted_position = event.position().translated(0, vertical_scrollbar().value());
-        for (int i = 0; i < item_count(); ++i) {
-            if (row_rect(i).contains(adjusted_position)) {
-                model()->set_selected_index(model()->index(i, 0));
-                update();
-                return;
-            }
-        }
-        model()->set_selected_index({ });
+        int row = row_at(event.y());
+        if (row >= 0 && row < item_count() && row_rect(row).contains(event.position().translated(0, vertical_scrollbar().value())))
+            model()->set_selected_index(model()->index(row, 0));
+        else
+            model()->set_selected_index({ });
         update();
     }
 }
@@ -107,12 +144,21 @@ void GTableView::paint_event(GPaintEvent& event)
     painter.translate(-horizontal_scrollbar().value(), -vertical_scrollbar().value());
 
     int exposed_width = max(content_size().width(), width());
-    int painted_item_index = 0;
     int y_offset = header_height();
+    int row_count = model()->row_count();
+
+    // Only the rows that intersect the paint rect are looked at, however many the model has.
+    int first_row = max(row_at(event.rect().top()), 0);
+    int last_row = min(row_at(event.rect().bottom()), row_count - 1);
 
-    for (int row_index = 0; row_index < model()->row_count(); ++row_index) {
-        bool is_selected_row = row_index == model()->selected_index().row();
-        int y = y_offset + painted_item_index * item_height();
+    // Each row's data comes in one go, into the same vectors every time.
+    Vector<GVariant> row_data;
+    Vector<GVariant> row_colors;
+    int selected_row = model()->selected_index().row();
+
+    for (int row_index = first_row; row_index <= last_row; ++row_index) {
+        bool is_selected_row = row_index == selected_row;
+        int y = y_offset + row_index * item_height();
 
         Color background_color;
         Color key_column_background_color;
@@ -120,7 +166,7 @@ void GTableView::paint_event(GPaintEvent& event)
             background_color = is_focused() ? Color::from_rgb(0x84351a) : Color::from_rgb(0x606060);
             key_column_background_color = is_focused() ? Color::from_rgb(0x84351a) : Color::from_rgb(0x606060);
         } else {
-            if (alternating_row_colors() && (painted_item_index % 2)) {
+            if (alternating_row_colors() && (row_index % 2)) {
                 background_color = Color(210, 210, 210);
                 key_column_background_color = Color(190, 190, 190);
             } else {
@@ -128,7 +174,11 @@ void GTableView::paint_event(GPaintEvent& event)
                 key_column_background_color = Color(235, 235, 235);
             }
         }
-        painter.fill_rect(row_rect(painted_item_index), background_color);
+        painter.fill_rect(row_rect(row_index), background_color);
+
+        model()->fetch_row(row_index, GModel::Role::Display, row_data);
+        if (!is_selected_row)
+            model()->fetch_row(row_index, GModel::Role::ForegroundColor, row_colors);
 
         int x_offset = 0;
         for (int column_index = 0; column_index < model()->column_count(); ++column_index) {
@@ -143,8 +193,7 @@ void GTableView::paint_event(GPaintEvent& event)
                 auto cell_rect_for_fill = cell_rect.inflated(horizontal_padding() * 2, 0);
                 painter.fill_rect(cell_rect_for_fill, key_column_background_color);
             }
-            auto cell_index = model()->index(row_index, column_index);
-            auto data = model()->data(cell_index);
+            auto& data = row_data[column_index];
             if (data.is_bitmap()) {
                 painter.blit(cell_rect.location(), data.as_bitmap(), data.as_bitmap().rect());
             } else if (data.is_icon()) {
@@ -155,15 +204,19 @@ void GTableView::paint_event(GPaintEvent& event)
                 if (is_selected_row)
                     text_color = Color::White;
                 else
-                    text_color = model()->data(cell_index, GModel::Role::ForegroundColor).to_color(Color::Black);
-                painter.draw_text(cell_rect, data.to_string(), font, column_metadata.text_alignment, text_color);
+                    text_color = row_colors[column_index].to_color(Color::Black);
+                if (data.is_string()) {
+                    auto text = data.as_string_view();
+                    painter.draw_text(cell_rect, text.characters(), text.length(), font, column_metadata.text_alignment, text_color);
+                } else {
+                    painter.draw_text(cell_rect, data.to_string(), font, column_metadata.text_alignment, text_color);
+                }
             }
             x_offset += column_width + horizontal_padding() * 2;
         }
-        ++painted_item_index;
     };
 
-    Rect unpainted_rect(0, header_height() + painted_item_index * item_height(), exposed_width, height());
+    Rect unpainted_rect(0, header_height() + row_count * item_height(), exposed_width, height());
     painter.fill_rect(unpainted_rect, Color::White);
 
     // Untranslate the painter vertically and do the column headers.
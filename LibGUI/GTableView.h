@@ -34,6 +34,7 @@ public:
 
 private:
     virtual void did_update_model() override;
+    virtual void did_update_model_rows(const GModelNotification&) override;
     virtual void paint_event(GPaintEvent&) override;
     virtual void mousedown_event(GMouseEvent&) override;
     virtual void doubleclick_event(GMouseEvent&) override;
@@ -42,6 +43,8 @@ private:
     void paint_headers(Painter&);
     int item_count() const;
     Rect row_rect(int item_index) const;
+    int row_at(int y) const;
+    void update_rows(int first_row, int last_row);
     Rect header_rect(int) const;
     int column_width(int) const;
     void update_content_size();
@@ -0,0 +1,175 @@
+#include <LibGUI/GTextDocument.h>
+#include <AK/StringBuilder.h>
+#include <string.h>
+
+// Room left for typing after the gap has to grow, as a share of the text but within bounds.
+static const int min_gap_size = 4096;
+static const int max_gap_size = 1024 * 1024;
+
+GTextDocument::GTextDocument()
+{
+    m_line_starts.append(0);
+}
+
+GTextDocument::~GTextDocument()
+{
+}
+
+void GTextDocument::set_text(const char* characters, int length)
+{
+    int gap = max(min_gap_size, min(max_gap_size, length / 16));
+    m_buffer.clear();
+    m_buffer.resize(length + gap);
+    if (length)
+        memcpy(m_buffer.data(), characters, length);
+    m_gap_start = length;
+    m_gap_end = length + gap;
+
+    m_line_starts.clear();
+    m_line_starts.append(0);
+    for (int i = 0; i < length; ++i) {
+        if (characters[i] == '\n')
+            m_line_starts.append(i + 1);
+    }
+}
+
+int GTextDocument::line_length(int line) const
+{
+    int end = line + 1 < line_count() ? line_start(line + 1) - 1 : length();
+    return end - line_start(line);
+}
+
+int GTextDocument::line_at_offset(int offset) const
+{
+    // The last line starting at or before |offset|.
+    int low = 0;
+    int high = line_count() - 1;
+    while (low < high) {
+        int middle = high - (high - low) / 2;
+        if (line_start(middle) <= offset)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+int GTextDocument::first_line_starting_after(int physical) const
+{
+    int low = 0;
+    int high = line_count();
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (m_line_starts[middle] <= physical)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void GTextDocument::shift_line_starts(int first_line, int end_line, int delta) const
+{
+    int* line_starts = m_line_starts.data();
+    for (int i = first_line; i < end_line; ++i)
+        line_starts[i] += delta;
+}
+
+void GTextDocument::move_gap_to(int offset) const
+{
+    if (offset == m_gap_start)
+        return;
+    int gap = gap_size();
+    if (offset < m_gap_start) {
+        // The text in [offset, gap start) moves to just before the gap's end, and so do the lines starting in there.
+        int count = m_gap_start - offset;
+        memmove(m_buffer.data() + m_gap_end - count, m_buffer.data() + offset, count);
+        shift_line_starts(first_line_starting_after(offset), first_line_starting_after(m_gap_start), gap);
+        m_gap_start -= count;
+        m_gap_end -= count;
+        return;
+    }
+    int count = offset - m_gap_start;
+    memmove(m_buffer.data() + m_gap_start, m_buffer.data() + m_gap_end, count);
+    shift_line_starts(first_line_starting_after(m_gap_end), first_line_starting_after(offset + gap), -gap);
+    m_gap_start += count;
+    m_gap_end += count;
+}
+
+void GTextDocument::ensure_gap(int size)
+{
+    if (gap_size() >= size)
+        return;
+    int new_gap = size + max(min_gap_size, min(max_gap_size, length() / 16));
+    int delta = new_gap - gap_size();
+    int after_gap = m_buffer.size() - m_gap_end;
+    Vector<char> new_buffer;
+    new_buffer.resize(m_buffer.size() + delta);
+    memcpy(new_buffer.data(), m_buffer.data(), m_gap_start);
+    memcpy(new_buffer.data() + m_gap_end + delta, m_buffer.data() + m_gap_end, after_gap);
+    m_buffer = move(new_buffer);
+    shift_line_starts(first_line_starting_after(m_gap_start), line_count(), delta);
+    m_gap_end += delta;
+}
+
+const char* GTextDocument::line_characters(int line) const
+{
+    int start = line_start(line);
+    int end = start + line_length(line);
+    if (start < m_gap_start && end > m_gap_start)
+        move_gap_to(start);
+    return m_buffer.data() + physical_offset(start) + (start == m_gap_start ? gap_size() : 0);
+}
+
+void GTextDocument::insert(int offset, const char* characters, int length)
+{
+    ASSERT(offset >= 0 && offset <= this->length());
+    if (!length)
+        return;
+    move_gap_to(offset);
+    ensure_gap(length);
+    memcpy(m_buffer.data() + m_gap_start, characters, length);
+
+    // New lines start right after each newline, and all of them end up before the gap.
+    Vector<int> new_line_starts;
+    for (int i = 0; i < length; ++i) {
+        if (characters[i] == '\n')
+            new_line_starts.append(offset + i + 1);
+    }
+    m_gap_start += length;
+    if (new_line_starts.is_empty())
+        return;
+    int first_new_line = line_at_offset(offset) + 1;
+    int old_line_count = line_count();
+    m_line_starts.resize(old_line_count + new_line_starts.size());
+    int* line_starts = m_line_starts.data();
+    memmove(line_starts + first_new_line + new_line_starts.size(), line_starts + first_new_line, (old_line_count - first_new_line) * sizeof(int));
+    memcpy(line_starts + first_new_line, new_line_starts.data(), new_line_starts.size() * sizeof(int));
+}
+
+void GTextDocument::remove(int offset, int length)
+{
+    ASSERT(offset >= 0 && offset + length <= this->length());
+    if (!length)
+        return;
+    move_gap_to(offset);
+    // The text to go is right after the gap. Lines starting inside it, or right after it, lose their newline.
+    int first_removed_line = first_line_starting_after(m_gap_end);
+    int end_removed_line = first_line_starting_after(m_gap_end + length);
+    int removed_lines = end_removed_line - first_removed_line;
+    if (removed_lines) {
+        int* line_starts = m_line_starts.data();
+        memmove(line_starts + first_removed_line, line_starts + end_removed_line, (line_count() - end_removed_line) * sizeof(int));
+        m_line_starts.resize(line_count() - removed_lines);
+    }
+    m_gap_end += length;
+}
+
+String GTextDocument::text(int offset, int length) const
+{
+    StringBuilder builder(length);
+    for_each_chunk(offset, length, [&] (const char* characters, int chunk_length) {
+        builder.append(characters, chunk_length);
+    });
+    return builder.to_string();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <AK/AKString.h>
+#include <AK/Vector.h>
+
+// The text of a GTextEditor, kept in one gap buffer: all the characters live in a single allocation,
+// with a hole at the last place something was edited. Typing fills the hole and moving on moves it,
+// so an edit only ever shifts the bytes between where the hole was and where it's needed.
+//
+// Lines are found through an index of where each one starts. Line starts are stored as offsets into
+// the buffer itself rather than into the text, so the ones past the gap stay put while it fills up
+// and only those the gap moves across need adjusting.
+class GTextDocument {
+public:
+    GTextDocument();
+    ~GTextDocument();
+
+    void set_text(const char*, int length);
+
+    int length() const { return m_buffer.size() - gap_size(); }
+    int line_count() const { return m_line_starts.size(); }
+    int line_start(int line) const { return logical_offset(m_line_starts[line]); }
+    int line_length(int line) const;
+    int line_at_offset(int) const;
+
+    // The characters of a line, in one piece. May have to move the gap out of the way.
+    const char* line_characters(int line) const;
+
+    void insert(int offset, const char*, int length);
+    void remove(int offset, int length);
+
+    String text(int offset, int length) const;
+
+    // Calls |callback| with the text from |offset| in at most two contiguous chunks.
+    template<typename Callback>
+    void for_each_chunk(int offset, int length, Callback callback) const
+    {
+        int before_gap = max(0, min(length, m_gap_start - offset));
+        if (before_gap)
+            callback(m_buffer.data() + offset, before_gap);
+        if (length > before_gap)
+            callback(m_buffer.data() + offset + before_gap + gap_size(), length - before_gap);
+    }
+
+private:
+    int gap_size() const { return m_gap_end - m_gap_start; }
+
+    // A line start at the gap belongs before it, so text typed there lands on that line.
+    int physical_offset(int offset) const { return offset <= m_gap_start ? offset : offset + gap_size(); }
+    int logical_offset(int physical) const { return physical <= m_gap_start ? physical : physical - gap_size(); }
+
+    int first_line_starting_after(int physical) const;
+    void shift_line_starts(int first_line, int end_line, int delta) const;
+    void move_gap_to(int offset) const;
+    void ensure_gap(int size);
+
+    mutable Vector<char> m_buffer;
+    mutable int m_gap_start { 0 };
+    mutable int m_gap_end { 0 };
+    mutable Vector<int> m_line_starts;
+};
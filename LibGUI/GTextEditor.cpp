@@ -20,7 +20,6 @@ GTextEditor::GTextEditor(Type type, GWidget* parent)
     set_scrollbars_enabled(is_multi_line());
     m_ruler_visible = is_multi_line();
     set_font(GFontDatabase::the().get_by_name("Csilla Thin"));
-    m_lines.append(make<Line>());
     m_cursor = { 0, 0 };
 }
 
@@ -30,29 +29,20 @@ GTextEditor::~GTextEditor()
 
 void GTextEditor::set_text(const String& text)
 {
-    if (is_single_line() && text.length() == m_lines[0]->length() && !memcmp(text.characters(), m_lines[0]->characters(), text.length()))
+    if (is_single_line() && text.length() == m_document.length() && text == this->text())
         return;
 
-    m_lines.clear();
-    int start_of_current_line = 0;
-
-    auto add_line = [&] (int current_position) {
-        int line_length = current_position - start_of_current_line;
-        auto line = make<Line>();
-        if (line_length)
-            line->set_text(text.substring(start_of_current_line, current_position - start_of_current_line));
-        m_lines.append(move(line));
-        start_of_current_line = current_position + 1;
-    };
-    int i = 0;
-    for (i = 0; i < text.length(); ++i) {
-        if (text[i] == '\n')
-            add_line(i);
-    }
-    add_line(i);
+    m_document.set_text(text.characters(), text.length());
+    m_undo_stack.clear();
+    m_undo_position = 0;
+    m_selection.clear();
+    m_line_length_counts.clear();
+    m_longest_line_length = 0;
+    for (int i = 0; i < line_count(); ++i)
+        add_line_length(line_length(i));
     update_content_size();
     if (is_single_line())
-        set_cursor(0, m_lines[0]->length());
+        set_cursor(0, line_length(0));
     else
         set_cursor(0, 0);
     update();
@@ -60,15 +50,19 @@ void GTextEditor::set_text(const String& text)
 
 void GTextEditor::update_content_size()
 {
-    int content_width = 0;
-    for (auto& line : m_lines)
-        content_width = max(line->width(font()), content_width);
+    int content_width = m_longest_line_length * glyph_width();
     content_width += m_horizontal_content_padding * 2;
     int content_height = line_count() * line_height();
     set_content_size({ content_width, content_height });
     set_size_occupied_by_fixed_elements({ ruler_width(), 0 });
 }
 
+GTextPosition GTextEditor::position_of(int offset) const
+{
+    int line = m_document.line_at_offset(offset);
+    return { line, offset - m_document.line_start(line) };
+}
+
 GTextPosition GTextEditor::text_position_at(const Point& a_position) const
 {
     auto position = a_position;
@@ -77,13 +71,14 @@ GTextPosition GTextEditor::text_position_at(const Point& a_position) const
     int line_index = position.y() / line_height();
     int column_index = position.x() / glyph_width();
     line_index = max(0, min(line_index, line_count() - 1));
-    column_index = max(0, min(column_index, m_lines[line_index]->length()));
+    column_index = max(0, min(column_index, line_length(line_index)));
     return { line_index, column_index };
 }
 
 void GTextEditor::mousedown_event(GMouseEvent& event)
 {
     if (event.button() == GMouseButton::Left) {
+        auto old_selection = normalized_selection();
         if (event.modifiers() & Mod_Shift) {
             if (!has_selection())
                 m_selection.set(m_cursor, { });
@@ -103,8 +98,8 @@ void GTextEditor::mousedown_event(GMouseEvent& event)
         if (m_selection.start().is_valid())
             m_selection.set_end(m_cursor);
 
-        // FIXME: Only update the relevant rects.
-        update();
+        if (old_selection.is_valid())
+            update_lines(old_selection.start().line(), old_selection.end().line());
         return;
     }
 }
@@ -122,9 +117,9 @@ void GTextEditor::mouseup_event(GMouseEvent& event)
 void GTextEditor::mousemove_event(GMouseEvent& event)
 {
     if (m_in_drag_select) {
+        // set_cursor() repaints the lines the selection grew or shrank over.
         set_cursor(text_position_at(event.position()));
         m_selection.set_end(m_cursor);
-        update();
         return;
     }
 }
@@ -193,21 +188,22 @@ void GTextEditor::paint_event(GPaintEvent& event)
     painter.add_clip_rect({ m_ruler_visible ? (ruler_rect.right() + 1) : 0, 0, width() - width_occupied_by_vertical_scrollbar() - ruler_width(), height() - height_occupied_by_horizontal_scrollbar() });
 
     for (int i = first_visible_line; i <= last_visible_line; ++i) {
-        auto& line = *m_lines[i];
+        int line_length = this->line_length(i);
+        const char* characters = m_document.line_characters(i);
         auto line_rect = line_content_rect(i);
         line_rect.set_width(exposed_width);
         if (is_multi_line() && i == m_cursor.line())
             painter.fill_rect(line_rect, Color(230, 230, 230));
-        painter.draw_text(line_rect, line.characters(), line.length(), TextAlignment::CenterLeft, Color::Black);
+        painter.draw_text(line_rect, characters, line_length, TextAlignment::CenterLeft, Color::Black);
         bool line_has_selection = has_selection && i >= selection.start().line() && i <= selection.end().line();
         if (line_has_selection) {
             int selection_start_column_on_line = selection.start().line() == i ? selection.start().column() : 0;
-            int selection_end_column_on_line = selection.end().line() == i ? selection.end().column() : line.length();
+            int selection_end_column_on_line = selection.end().line() == i ? selection.end().column() : line_length;
             int selection_left = m_horizontal_content_padding + selection_start_column_on_line * font().glyph_width('x');
             int selection_right = line_rect.left() + selection_end_column_on_line * font().glyph_width('x');
             Rect selection_rect { selection_left, line_rect.y(), selection_right - selection_left, line_rect.height() };
             painter.fill_rect(selection_rect, Color::from_rgb(0x955233));
-            painter.draw_text(selection_rect, line.characters() + selection_start_column_on_line, line.length() - selection_start_column_on_line - (line.length() - selection_end_column_on_line), TextAlignment::CenterLeft, Color::White);
+            painter.draw_text(selection_rect, characters + selection_start_column_on_line, selection_end_column_on_line - selection_start_column_on_line, TextAlignment::CenterLeft, Color::White);
         }
     }
 
@@ -219,12 +215,12 @@ void GTextEditor::toggle_selection_if_needed_for_event(const GKeyEvent& event)
 {
     if (event.shift() && !m_selection.is_valid()) {
         m_selection.set(m_cursor, { });
-        update();
         return;
     }
     if (!event.shift() && m_selection.is_valid()) {
+        auto selection = normalized_selection();
         m_selection.clear();
-        update();
+        update_lines(selection.start().line(), selection.end().line());
         return;
     }
 }
@@ -239,7 +235,7 @@ void GTextEditor::keydown_event(GKeyEvent& event)
     if (event.key() == KeyCode::Key_Up) {
         if (m_cursor.line() > 0) {
             int new_line = m_cursor.line() - 1;
-            int new_column = min(m_cursor.column(), m_lines[new_line]->length());
+            int new_column = min(m_cursor.column(), line_length(new_line));
             toggle_selection_if_needed_for_event(event);
             set_cursor(new_line, new_column);
             if (m_selection.start().is_valid())
@@ -248,9 +244,9 @@ void GTextEditor::keydown_event(GKeyEvent& event)
         return;
     }
     if (event.key() == KeyCode::Key_Down) {
-        if (m_cursor.line() < (m_lines.size() - 1)) {
+        if (m_cursor.line() < (line_count() - 1)) {
             int new_line = m_cursor.line() + 1;
-            int new_column = min(m_cursor.column(), m_lines[new_line]->length());
+            int new_column = min(m_cursor.column(), line_length(new_line));
             toggle_selection_if_needed_for_event(event);
             set_cursor(new_line, new_column);
             if (m_selection.start().is_valid())
@@ -261,7 +257,7 @@ void GTextEditor::keydown_event(GKeyEvent& event)
     if (event.key() == KeyCode::Key_PageUp) {
         if (m_cursor.line() > 0) {
             int new_line = max(0, m_cursor.line() - visible_content_rect().height() / line_height());
-            int new_column = min(m_cursor.column(), m_lines[new_line]->length());
+            int new_column = min(m_cursor.column(), line_length(new_line));
             toggle_selection_if_needed_for_event(event);
             set_cursor(new_line, new_column);
             if (m_selection.start().is_valid())
@@ -270,9 +266,9 @@ void GTextEditor::keydown_event(GKeyEvent& event)
         return;
     }
     if (event.key() == KeyCode::Key_PageDown) {
-        if (m_cursor.line() < (m_lines.size() - 1)) {
+        if (m_cursor.line() < (line_count() - 1)) {
             int new_line = min(line_count() - 1, m_cursor.line() + visible_content_rect().height() / line_height());
-            int new_column = min(m_cursor.column(), m_lines[new_line]->length());
+            int new_column = min(m_cursor.column(), line_length(new_line));
             toggle_selection_if_needed_for_event(event);
             set_cursor(new_line, new_column);
             if (m_selection.start().is_valid())
@@ -289,7 +285,7 @@ void GTextEditor::keydown_event(GKeyEvent& event)
                 m_selection.set_end(m_cursor);
         } else if (m_cursor.line() > 0) {
             int new_line = m_cursor.line() - 1;
-            int new_column = m_lines[new_line]->length();
+            int new_column = line_length(new_line);
             toggle_selection_if_needed_for_event(event);
             set_cursor(new_line, new_column);
             if (m_selection.start().is_valid())
@@ -298,7 +294,7 @@ void GTextEditor::keydown_event(GKeyEvent& event)
         return;
     }
     if (event.key() == KeyCode::Key_Right) {
-        if (m_cursor.column() < current_line().length()) {
+        if (m_cursor.column() < line_length(m_cursor.line())) {
             int new_column = m_cursor.column() + 1;
             toggle_selection_if_needed_for_event(event);
             set_cursor(m_cursor.line(), new_column);
@@ -323,7 +319,7 @@ void GTextEditor::keydown_event(GKeyEvent& event)
     }
     if (!event.ctrl() && event.key() == KeyCode::Key_End) {
         toggle_selection_if_needed_for_event(event);
-        set_cursor(m_cursor.line(), current_line().length());
+        set_cursor(m_cursor.line(), line_length(m_cursor.line()));
         if (m_selection.start().is_valid())
             m_selection.set_end(m_cursor);
         return;
@@ -337,14 +333,14 @@ void GTextEditor::keydown_event(GKeyEvent& event)
     }
     if (event.ctrl() && event.key() == KeyCode::Key_End) {
         toggle_selection_if_needed_for_event(event);
-        set_cursor(line_count() - 1, m_lines[line_count() - 1]->length());
+        set_cursor(line_count() - 1, line_length(line_count() - 1));
         if (m_selection.start().is_valid())
             m_selection.set_end(m_cursor);
         return;
     }
     if (event.modifiers() == Mod_Ctrl && event.key() == KeyCode::Key_A) {
         GTextPosition start_of_document { 0, 0 };
-        GTextPosition end_of_document { line_count() - 1, m_lines[line_count() - 1]->length() };
+        GTextPosition end_of_document { line_count() - 1, line_length(line_count() - 1) };
         m_selection.set(start_of_document, end_of_document);
         set_cursor(end_of_document);
         update();
@@ -356,23 +352,11 @@ void GTextEditor::keydown_event(GKeyEvent& event)
             delete_selection();
             return;
         }
-        if (m_cursor.column() > 0) {
-            // Backspace within line
-            current_line().remove(m_cursor.column() - 1);
-            update_content_size();
-            set_cursor(m_cursor.line(), m_cursor.column() - 1);
-            return;
-        }
-        if (m_cursor.column() == 0 && m_cursor.line() != 0) {
-            // Backspace at column 0; merge with previous line
-            auto& previous_line = *m_lines[m_cursor.line() - 1];
-            int previous_length = previous_line.length();
-            previous_line.append(current_line().characters(), current_line().length());
-            m_lines.remove(m_cursor.line());
-            update_content_size();
-            update();
-            set_cursor(m_cursor.line() - 1, previous_length);
-            return;
+        if (m_cursor.column() > 0 || m_cursor.line() > 0) {
+            // At column 0 this takes the newline, merging with the previous line.
+            int offset = offset_of(m_cursor) - 1;
+            remove_text(offset, 1);
+            set_cursor(position_of(offset));
         }
         return;
     }
@@ -398,12 +382,19 @@ void GTextEditor::delete_current_line()
     if (has_selection())
         return delete_selection();
 
-    m_lines.remove(m_cursor.line());
-    if (m_lines.is_empty())
-        m_lines.append(make<Line>());
+    // Take the line with one of the newlines around it, if it has any.
+    int line = m_cursor.line();
+    int start = m_document.line_start(line);
+    int length = line_length(line);
+    if (line < line_count() - 1)
+        remove_text(start, length + 1);
+    else if (line > 0)
+        remove_text(start - 1, length + 1);
+    else
+        remove_text(start, length);
 
-    update_content_size();
-    update();
+    line = min(line, line_count() - 1);
+    set_cursor(line, min(m_cursor.column(), line_length(line)));
 }
 
 void GTextEditor::do_delete()
@@ -411,83 +402,208 @@ void GTextEditor::do_delete()
     if (has_selection())
         return delete_selection();
 
-    if (m_cursor.column() < current_line().length()) {
-        // Delete within line
-        current_line().remove(m_cursor.column());
-        update_content_size();
-        update_cursor();
-        return;
-    }
-    if (m_cursor.column() == current_line().length() && m_cursor.line() != line_count() - 1) {
-        // Delete at end of line; merge with next line
-        auto& next_line = *m_lines[m_cursor.line() + 1];
-        int previous_length = current_line().length();
-        current_line().append(next_line.characters(), next_line.length());
-        m_lines.remove(m_cursor.line() + 1);
-        update_content_size();
-        update();
-        set_cursor(m_cursor.line(), previous_length);
-        return;
-    }
+    // At the end of a line this takes the newline, merging with the next line.
+    int offset = offset_of(m_cursor);
+    if (offset < m_document.length())
+        remove_text(offset, 1);
 }
 
 void GTextEditor::insert_at_cursor(const String& text)
 {
-    // FIXME: This should obviously not be implemented this way.
+    // Soft tabs turn into spaces up to the next tab stop, and a newline in a single line editor means "return".
+    Vector<char> pending;
+    int column = m_cursor.column();
+    auto flush = [&] {
+        if (pending.is_empty())
+            return;
+        int offset = offset_of(m_cursor);
+        insert_text(offset, pending.data(), pending.size());
+        set_cursor(position_of(offset + pending.size()));
+        pending.clear();
+    };
     for (int i = 0; i < text.length(); ++i) {
-        insert_at_cursor(text[i]);
-    }
-}
-
-void GTextEditor::insert_at_cursor(char ch)
-{
-    bool at_head = m_cursor.column() == 0;
-    bool at_tail = m_cursor.column() == current_line().length();
-    if (ch == '\n') {
-        if (is_single_line()) {
+        char ch = text[i];
+        if (ch == '\n' && is_single_line()) {
+            flush();
             if (on_return_pressed)
                 on_return_pressed(*this);
-            return;
+            column = m_cursor.column();
+            continue;
         }
-        if (at_tail || at_head) {
-            m_lines.insert(m_cursor.line() + (at_tail ? 1 : 0), make<Line>());
-            update_content_size();
-            update();
-            set_cursor(m_cursor.line() + 1, 0);
-            return;
+        if (ch == '\t') {
+            int next_soft_tab_stop = ((column + m_soft_tab_width) / m_soft_tab_width) * m_soft_tab_width;
+            for (; column < next_soft_tab_stop; ++column)
+                pending.append(' ');
+            continue;
         }
-        auto new_line = make<Line>();
-        new_line->append(current_line().characters() + m_cursor.column(), current_line().length() - m_cursor.column());
-        current_line().truncate(m_cursor.column());
-        m_lines.insert(m_cursor.line() + 1, move(new_line));
-        update_content_size();
+        pending.append(ch);
+        column = ch == '\n' ? 0 : column + 1;
+    }
+    flush();
+}
+
+void GTextEditor::insert_text(int offset, const char* characters, int length)
+{
+    if (!length)
+        return;
+    record_undo(UndoCommand::Insert, offset, characters, length);
+    edit_document(true, offset, characters, length);
+}
+
+void GTextEditor::remove_text(int offset, int length)
+{
+    if (!length)
+        return;
+    auto removed_text = m_document.text(offset, length);
+    record_undo(UndoCommand::Remove, offset, removed_text.characters(), length);
+    edit_document(false, offset, nullptr, length);
+}
+
+void GTextEditor::edit_document(bool is_insert, int offset, const char* characters, int length)
+{
+    int old_line_count = line_count();
+    int first_line = m_document.line_at_offset(offset);
+    int last_old_line = is_insert ? first_line : m_document.line_at_offset(offset + length);
+    for (int i = first_line; i <= last_old_line; ++i)
+        remove_line_length(line_length(i));
+
+    if (is_insert)
+        m_document.insert(offset, characters, length);
+    else
+        m_document.remove(offset, length);
+
+    int last_new_line = is_insert ? m_document.line_at_offset(offset + length) : first_line;
+    for (int i = first_line; i <= last_new_line; ++i)
+        add_line_length(line_length(i));
+    update_content_size();
+
+    // Lines only move when some come or go, and then everything below the edit needs painting again.
+    if (line_count() != old_line_count)
+        update_lines_from(first_line);
+    else
+        update_lines(first_line, last_new_line);
+}
+
+void GTextEditor::add_line_length(int length)
+{
+    auto it = m_line_length_counts.find(length);
+    if (it == m_line_length_counts.end())
+        m_line_length_counts.set(length, 1);
+    else
+        ++(*it).value;
+    m_longest_line_length = max(m_longest_line_length, length);
+}
+
+void GTextEditor::remove_line_length(int length)
+{
+    auto it = m_line_length_counts.find(length);
+    ASSERT(it != m_line_length_counts.end());
+    if (--(*it).value)
+        return;
+    m_line_length_counts.remove(it);
+    if (length != m_longest_line_length)
+        return;
+    // That was the last of the longest lines; the next longest is among the lengths still around.
+    m_longest_line_length = 0;
+    for (auto& it : m_line_length_counts)
+        m_longest_line_length = max(m_longest_line_length, it.key);
+}
+
+// Invalidates the rows of lines in a range, as much of it as is on screen.
+void GTextEditor::update_lines(int first_line, int last_line)
+{
+    if (is_single_line()) {
         update();
-        set_cursor(m_cursor.line() + 1, 0);
         return;
     }
-    if (ch == '\t') {
-        int next_soft_tab_stop = ((m_cursor.column() + m_soft_tab_width) / m_soft_tab_width) * m_soft_tab_width;
-        int spaces_to_insert = next_soft_tab_stop - m_cursor.column();
-        for (int i = 0; i < spaces_to_insert; ++i) {
-            current_line().insert(m_cursor.column(), ' ');
-        }
-        update_content_size();
-        set_cursor(m_cursor.line(), next_soft_tab_stop);
-        update_cursor();
+    if (first_line > last_line)
+        swap(first_line, last_line);
+    int first_visible_line = vertical_scrollbar().value() / line_height();
+    int last_visible_line = (vertical_scrollbar().value() + visible_content_rect().height()) / line_height();
+    first_line = max(first_line, first_visible_line);
+    last_line = min(last_line, last_visible_line);
+    if (first_line > last_line)
         return;
+    auto rect = line_widget_rect(first_line).united(line_widget_rect(last_line));
+    // The ruler next to them shows which line is current.
+    rect.set_left(0);
+    update(rect);
+}
+
+void GTextEditor::update_lines_from(int first_line)
+{
+    int last_visible_line = (vertical_scrollbar().value() + visible_content_rect().height()) / line_height();
+    update_lines(first_line, max(first_line, last_visible_line));
+}
+
+void GTextEditor::record_undo(UndoCommand::Type type, int offset, const char* characters, int length)
+{
+    // Whatever was undone is gone for good once something new happens.
+    m_undo_stack.resize(m_undo_position);
+
+    // Keystrokes carry on the last command while they're next to it, so undo goes a run of typing at a time.
+    bool is_keystroke = length == 1 && characters[0] != '\n';
+    if (is_keystroke && m_undo_position) {
+        auto& last = m_undo_stack[m_undo_position - 1];
+        int last_length = last.text.size();
+        bool last_ends_line = last_length && last.text[last_length - 1] == '\n';
+        if (last.type == type && !last_ends_line) {
+            if ((type == UndoCommand::Insert && offset == last.offset + last_length) || (type == UndoCommand::Remove && offset == last.offset)) {
+                last.text.append(characters[0]);
+                return;
+            }
+            if (type == UndoCommand::Remove && offset + 1 == last.offset) {
+                char ch = characters[0];
+                last.text.insert(0, move(ch));
+                last.offset = offset;
+                return;
+            }
+        }
     }
-    current_line().insert(m_cursor.column(), ch);
-    update_content_size();
-    set_cursor(m_cursor.line(), m_cursor.column() + 1);
-    update_cursor();
+
+    UndoCommand command;
+    command.type = type;
+    command.offset = offset;
+    command.text.ensure_capacity(length);
+    for (int i = 0; i < length; ++i)
+        command.text.unchecked_append(characters[i]);
+    m_undo_stack.append(move(command));
+    ++m_undo_position;
+}
+
+void GTextEditor::apply(const UndoCommand& command, bool reverse)
+{
+    bool is_insert = (command.type == UndoCommand::Insert) != reverse;
+    int length = command.text.size();
+    edit_document(is_insert, command.offset, command.text.data(), length);
+    if (m_selection.is_valid()) {
+        m_selection.clear();
+        update();
+    }
+    set_cursor(position_of(is_insert ? command.offset + length : command.offset));
+}
+
+void GTextEditor::undo()
+{
+    if (!can_undo())
+        return;
+    --m_undo_position;
+    apply(m_undo_stack[m_undo_position], true);
+}
+
+void GTextEditor::redo()
+{
+    if (!can_redo())
+        return;
+    ++m_undo_position;
+    apply(m_undo_stack[m_undo_position - 1], false);
 }
 
 Rect GTextEditor::cursor_content_rect() const
 {
     if (!m_cursor.is_valid())
         return { };
-    ASSERT(!m_lines.is_empty());
-    ASSERT(m_cursor.column() <= (current_line().length() + 1));
+    ASSERT(m_cursor.column() <= (line_length(m_cursor.line()) + 1));
     if (is_single_line()) {
         Rect cursor_rect = { m_horizontal_content_padding + m_cursor.column() * glyph_width(), 0, 1, font().glyph_height() + 2 };
         cursor_rect.center_vertically_within(rect());
@@ -514,8 +630,8 @@ void GTextEditor::scroll_cursor_into_view()
     auto rect = cursor_content_rect();
     if (m_cursor.column() == 0)
         rect.set_x(0);
-    else if (m_cursor.column() >= m_lines[m_cursor.line()]->length())
-        rect.set_x(m_lines[m_cursor.line()]->width(font()) + m_horizontal_content_padding * 2);
+    else if (m_cursor.column() >= line_length(m_cursor.line()))
+        rect.set_x(line_length(m_cursor.line()) * glyph_width() + m_horizontal_content_padding * 2);
     scroll_into_view(rect, true, true);
 }
 
@@ -548,16 +664,19 @@ void GTextEditor::set_cursor(int line, int column)
 
 void GTextEditor::set_cursor(const GTextPosition& position)
 {
-    ASSERT(!m_lines.is_empty());
-    ASSERT(position.line() < m_lines.size());
-    ASSERT(position.column() <= m_lines[position.line()]->length());
+    ASSERT(position.line() < line_count());
+    ASSERT(position.column() <= line_length(position.line()));
     if (m_cursor != position) {
         auto old_cursor_line_rect = line_widget_rect(m_cursor.line());
+        int old_cursor_line = m_cursor.line();
         m_cursor = position;
         m_cursor_state = true;
         scroll_cursor_into_view();
         update(old_cursor_line_rect);
         update_cursor();
+        // A selection follows the cursor, so every line in between changed.
+        if (m_selection.start().is_valid())
+            update_lines(old_cursor_line, m_cursor.line());
     }
     if (on_cursor_change)
         on_cursor_change(*this);
@@ -581,78 +700,6 @@ void GTextEditor::timer_event(GTimerEvent&)
         update_cursor();
 }
 
-GTextEditor::Line::Line()
-{
-    clear();
-}
-
-void GTextEditor::Line::clear()
-{
-    m_text.clear();
-    m_text.append(0);
-}
-
-void GTextEditor::Line::set_text(const String& text)
-{
-    if (text.length() == length() && !memcmp(text.characters(), characters(), length()))
-        return;
-    if (text.is_empty()) {
-        clear();
-        return;
-    }
-    m_text.resize(text.length() + 1);
-    memcpy(m_text.data(), text.characters(), text.length() + 1);
-}
-
-int GTextEditor::Line::width(const Font& font) const
-{
-    return font.glyph_width('x') * length();
-}
-
-void GTextEditor::Line::append(const char* characters, int length)
-{
-    int old_length = m_text.size() - 1;
-    m_text.resize(m_text.size() + length);
-    memcpy(m_text.data() + old_length, characters, length);
-    m_text.last() = 0;
-}
-
-void GTextEditor::Line::append(char ch)
-{
-    insert(length(), ch);
-}
-
-void GTextEditor::Line::prepend(char ch)
-{
-    insert(0, ch);
-}
-
-void GTextEditor::Line::insert(int index, char ch)
-{
-    if (index == length()) {
-        m_text.last() = ch;
-        m_text.append(0);
-    } else {
-        m_text.insert(index, move(ch));
-    }
-}
-
-void GTextEditor::Line::remove(int index)
-{
-    if (index == length()) {
-        m_text.take_last();
-        m_text.last() = 0;
-    } else {
-        m_text.remove(index);
-    }
-}
-
-void GTextEditor::Line::truncate(int length)
-{
-    m_text.resize(length + 1);
-    m_text.last() = 0;
-}
-
 bool GTextEditor::write_to_file(const String& path)
 {
     int fd = open(path.characters(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
@@ -660,25 +707,16 @@ bool GTextEditor::write_to_file(const String& path)
         perror("open");
         return false;
     }
-    for (int i = 0; i < m_lines.size(); ++i) {
-        auto& line = *m_lines[i];
-        if (line.length()) {
-            ssize_t nwritten = write(fd, line.characters(), line.length());
-            if (nwritten < 0) {
-                perror("write");
-                close(fd);
-                return false;
-            }
-        }
-        if (i != m_lines.size() - 1) {
-            char ch = '\n';
-            ssize_t nwritten = write(fd, &ch, 1);
-            if (nwritten != 1) {
-                perror("write");
-                close(fd);
-                return false;
-            }
+    bool ok = true;
+    m_document.for_each_chunk(0, m_document.length(), [&] (const char* characters, int length) {
+        if (ok && write(fd, characters, length) != length) {
+            perror("write");
+            ok = false;
         }
+    });
+    if (!ok) {
+        close(fd);
+        return false;
     }
 
     close(fd);
@@ -687,21 +725,19 @@ bool GTextEditor::write_to_file(const String& path)
 
 String GTextEditor::text() const
 {
-    StringBuilder builder;
-    for (int i = 0; i < line_count(); ++i) {
-        auto& line = *m_lines[i];
-        builder.append(line.characters(), line.length());
-        if (i != line_count() - 1)
-            builder.append('\n');
-    }
-    return builder.to_string();
+    return m_document.text(0, m_document.length());
 }
 
 void GTextEditor::clear()
 {
-    m_lines.clear();
-    m_lines.append(make<Line>());
+    m_document.set_text(nullptr, 0);
+    m_undo_stack.clear();
+    m_undo_position = 0;
+    m_line_length_counts.clear();
+    m_longest_line_length = 0;
+    add_line_length(0);
     m_selection.clear();
+    update_content_size();
     set_cursor(0, 0);
     update();
 }
@@ -712,17 +748,8 @@ String GTextEditor::selected_text() const
         return { };
 
     auto selection = normalized_selection();
-    StringBuilder builder;
-    for (int i = selection.start().line(); i <= selection.end().line(); ++i) {
-        auto& line = *m_lines[i];
-        int selection_start_column_on_line = selection.start().line() == i ? selection.start().column() : 0;
-        int selection_end_column_on_line = selection.end().line() == i ? selection.end().column() : line.length();
-        builder.append(line.characters() + selection_start_column_on_line, selection_end_column_on_line - selection_start_column_on_line);
-        if (i != selection.end().line())
-            builder.append('\n');
-    }
-
-    return builder.to_string();
+    int start = offset_of(selection.start());
+    return m_document.text(start, offset_of(selection.end()) - start);
 }
 
 void GTextEditor::delete_selection()
@@ -731,44 +758,8 @@ void GTextEditor::delete_selection()
         return;
 
     auto selection = normalized_selection();
-
-    // First delete all the lines in between the first and last one.
-    for (int i = selection.start().line() + 1; i < selection.end().line();) {
-        m_lines.remove(i);
-        selection.end().set_line(selection.end().line() - 1);
-    }
-
-    if (selection.start().line() == selection.end().line()) {
-        // Delete within same line.
-        auto& line = *m_lines[selection.start().line()];
-        bool whole_line_is_selected = selection.start().column() == 0 && selection.end().column() == line.length();
-        if (whole_line_is_selected) {
-            line.clear();
-        } else {
-            auto before_selection = String(line.characters(), line.length()).substring(0, selection.start().column());
-            auto after_selection = String(line.characters(), line.length()).substring(selection.end().column(), line.length() - selection.end().column());
-            StringBuilder builder(before_selection.length() + after_selection.length());
-            builder.append(before_selection);
-            builder.append(after_selection);
-            line.set_text(builder.to_string());
-        }
-    } else {
-        // Delete across a newline, merging lines.
-        ASSERT(selection.start().line() == selection.end().line() - 1);
-        auto& first_line = *m_lines[selection.start().line()];
-        auto& second_line = *m_lines[selection.end().line()];
-        auto before_selection = String(first_line.characters(), first_line.length()).substring(0, selection.start().column());
-        auto after_selection = String(second_line.characters(), second_line.length()).substring(selection.end().column(), second_line.length() - selection.end().column());
-        StringBuilder builder(before_selection.length() + after_selection.length());
-        builder.append(before_selection);
-        builder.append(after_selection);
-        first_line.set_text(builder.to_string());
-        m_lines.remove(selection.end().line());
-    }
-
-    if (m_lines.is_empty())
-        m_lines.append(make<Line>());
-
+    int start = offset_of(selection.start());
+    remove_text(start, offset_of(selection.end()) - start);
     m_selection.clear();
     set_cursor(selection.start());
     update();
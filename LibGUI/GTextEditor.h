@@ -1,6 +1,7 @@
 #pragma once
 
 #include <LibGUI/GScrollableWidget.h>
+#include <LibGUI/GTextDocument.h>
 #include <AK/Function.h>
 #include <AK/HashMap.h>
 
@@ -75,7 +76,7 @@ public:
 
     void set_text(const String&);
     void scroll_cursor_into_view();
-    int line_count() const { return m_lines.size(); }
+    int line_count() const { return m_document.line_count(); }
     int line_spacing() const { return m_line_spacing; }
     int line_height() const { return font().glyph_height() + m_line_spacing; }
     GTextPosition cursor() const { return m_cursor; }
@@ -96,6 +97,11 @@ public:
     void do_delete();
     void delete_current_line();
 
+    bool can_undo() const { return m_undo_position > 0; }
+    bool can_redo() const { return m_undo_position < m_undo_stack.size(); }
+    void undo();
+    void redo();
+
     Function<void(GTextEditor&)> on_return_pressed;
     Function<void(GTextEditor&)> on_escape_pressed;
 
@@ -117,27 +123,29 @@ private:
     void paint_ruler(Painter&);
     void update_content_size();
 
-    class Line {
-        friend class GTextEditor;
-    public:
-        Line();
-
-        const char* characters() const { return m_text.data(); }
-        int length() const { return m_text.size() - 1; }
-        int width(const Font&) const;
-        void set_text(const String&);
-        void append(char);
-        void prepend(char);
-        void insert(int index, char);
-        void remove(int index);
-        void append(const char*, int);
-        void truncate(int length);
-        void clear();
-
-    private:
-        // NOTE: This vector is null terminated.
-        Vector<char> m_text;
+    // Every edit goes through these two, which keep the undo stack.
+    void insert_text(int offset, const char*, int length);
+    void remove_text(int offset, int length);
+    void edit_document(bool is_insert, int offset, const char*, int length);
+    void update_lines(int first_line, int last_line);
+    void update_lines_from(int first_line);
+    void add_line_length(int);
+    void remove_line_length(int);
+
+    // An edit as the undo stack remembers it: the text that went in or came out at |offset|.
+    // Typing and deleting runs of characters keep growing the same command.
+    struct UndoCommand {
+        enum Type { Insert, Remove };
+        Type type { Insert };
+        int offset { 0 };
+        Vector<char> text;
     };
+    void record_undo(UndoCommand::Type, int offset, const char*, int length);
+    void apply(const UndoCommand&, bool reverse);
+
+    int offset_of(const GTextPosition& position) const { return m_document.line_start(position.line()) + position.column(); }
+    GTextPosition position_of(int offset) const;
+    int line_length(int line) const { return m_document.line_length(line); }
 
     Rect line_content_rect(int item_index) const;
     Rect line_widget_rect(int line_index) const;
@@ -145,10 +153,7 @@ private:
     void update_cursor();
     void set_cursor(int line, int column);
     void set_cursor(const GTextPosition&);
-    Line& current_line() { return *m_lines[m_cursor.line()]; }
-    const Line& current_line() const { return *m_lines[m_cursor.line()]; }
     GTextPosition text_position_at(const Point&) const;
-    void insert_at_cursor(char);
     void insert_at_cursor(const String&);
     int ruler_width() const;
     Rect ruler_content_rect(int line) const;
@@ -158,7 +163,12 @@ private:
 
     Type m_type { MultiLine };
 
-    Vector<OwnPtr<Line>> m_lines;
+    GTextDocument m_document;
+    // How many lines there are of each length, so the content width doesn't need a walk over every line.
+    HashMap<int, int> m_line_length_counts;
+    int m_longest_line_length { 0 };
+    Vector<UndoCommand> m_undo_stack;
+    int m_undo_position { 0 };
     GTextPosition m_cursor;
     bool m_cursor_state { true };
     bool m_in_drag_select { false };
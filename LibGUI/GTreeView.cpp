@@ -35,25 +35,40 @@ GTreeView::~GTreeView()
 {
 }
 
+Rect GTreeView::row_rect(int row) const
+{
+    auto& visible_row = m_visible_rows[row];
+    return { visible_row.indent_level * indent_width_in_pixels(), row * item_height(), visible_row.width, item_height() };
+}
+
+Rect GTreeView::toggle_rect(int row) const
+{
+    auto& visible_row = m_visible_rows[row];
+    if (!visible_row.has_toggle)
+        return { };
+    auto rect = row_rect(row);
+    int toggle_x = indent_width_in_pixels() * visible_row.indent_level - icon_size() / 2 - 4;
+    Rect toggle_rect = { toggle_x, rect.y(), toggle_size(), toggle_size() };
+    toggle_rect.center_vertically_within(rect);
+    return toggle_rect;
+}
+
 GModelIndex GTreeView::index_at_content_position(const Point& position, bool& is_toggle) const
 {
     is_toggle = false;
-    if (!model())
+    if (!model() || position.y() < 0)
         return { };
-    GModelIndex result;
-    traverse_in_paint_order([&] (const GModelIndex& index, const Rect& rect, const Rect& toggle_rect, int) {
-        if (rect.contains(position)) {
-            result = index;
-            return IterationDecision::Abort;
-        }
-        if (toggle_rect.contains(position)) {
-            result = index;
-            is_toggle = true;
-            return IterationDecision::Abort;
-        }
-        return IterationDecision::Continue;
-    });
-    return result;
+    // Every row is as high as the next, so there's only one it could be.
+    int row = position.y() / item_height();
+    if (row >= m_visible_rows.size())
+        return { };
+    if (row_rect(row).contains(position))
+        return m_visible_rows[row].index;
+    if (toggle_rect(row).contains(position)) {
+        is_toggle = true;
+        return m_visible_rows[row].index;
+    }
+    return { };
 }
 
 void GTreeView::mousedown_event(GMouseEvent& event)
@@ -72,7 +87,7 @@ void GTreeView::mousedown_event(GMouseEvent& event)
         update();
     }
 
-    if (is_toggle && model.row_count(index)) {
+    if (is_toggle) {
         auto& metadata = ensure_metadata_for_index(index);
         metadata.open = !metadata.open;
         update_content_size();
@@ -80,48 +95,31 @@ void GTreeView::mousedown_event(GMouseEvent& event)
     }
 }
 
-template<typename Callback>
-void GTreeView::traverse_in_paint_order(Callback callback) const
+void GTreeView::rebuild_visible_rows()
 {
-    ASSERT(model());
+    m_visible_rows.clear();
+    if (!model())
+        return;
     auto& model = *this->model();
-    int indent_level = 0;
-    int y_offset = 0;
-
-    Function<IterationDecision(const GModelIndex&)> traverse_index = [&] (const GModelIndex& index) {
-        int row_count_at_index = model.row_count(index);
-        if (index.is_valid()) {
-            auto& metadata = ensure_metadata_for_index(index);
-            int x_offset = indent_level * indent_width_in_pixels();
-            auto node_text = model.data(index, GModel::Role::Display).to_string();
-            Rect rect = {
-                x_offset, y_offset,
-                icon_size() + icon_spacing() + text_padding() + font().width(node_text) + text_padding(), item_height()
-            };
-            Rect toggle_rect;
-            if (row_count_at_index > 0) {
-                int toggle_x = indent_width_in_pixels() * indent_level - icon_size() / 2 - 4;
-                toggle_rect = { toggle_x, rect.y(), toggle_size(), toggle_size() };
-                toggle_rect.center_vertically_within(rect);
-            }
-            if (callback(index, rect, toggle_rect, indent_level) == IterationDecision::Abort)
-                return IterationDecision::Abort;
-            y_offset += item_height();
-            // NOTE: Skip traversing children if this index is closed!
-            if (!metadata.open)
-                return IterationDecision::Continue;
-        }
 
-        ++indent_level;
-        int row_count = model.row_count(index);
+    // Children are only asked for under open indices, so closed ones (and their directories, say) go unread.
+    Function<void(const GModelIndex&, int)> add_children = [&] (const GModelIndex& parent, int indent_level) {
+        int row_count = model.row_count(parent);
         for (int i = 0; i < row_count; ++i) {
-            if (traverse_index(model.index(i, 0, index)) == IterationDecision::Abort)
-                return IterationDecision::Abort;
+            auto index = model.index(i, 0, parent);
+            auto node_text = model.data(index, GModel::Role::Display).to_string();
+            VisibleRow visible_row;
+            visible_row.index = index;
+            visible_row.indent_level = indent_level;
+            visible_row.width = icon_size() + icon_spacing() + text_padding() + font().width(node_text) + text_padding();
+            visible_row.has_toggle = model.may_have_children(index);
+            bool is_open = visible_row.has_toggle && ensure_metadata_for_index(index).open;
+            m_visible_rows.append(move(visible_row));
+            if (is_open)
+                add_children(index, indent_level + 1);
         }
-        --indent_level;
-        return IterationDecision::Continue;
     };
-    traverse_index(model.index(0, 0, GModelIndex()));
+    add_children(GModelIndex(), 0);
 }
 
 void GTreeView::paint_event(GPaintEvent& event)
@@ -137,11 +135,16 @@ void GTreeView::paint_event(GPaintEvent& event)
     if (!model())
         return;
     auto& model = *this->model();
-    auto visible_content_rect = this->visible_content_rect();
-
-    traverse_in_paint_order([&] (const GModelIndex& index, const Rect& rect, const Rect& toggle_rect, int indent_level) {
-        if (!rect.intersects(visible_content_rect))
-            return IterationDecision::Continue;
+    // Only the rows that the paint rect touches.
+    auto content_rect = event.rect().translated(horizontal_scrollbar().value() - frame_thickness(), vertical_scrollbar().value() - frame_thickness());
+    int first_row = max(0, content_rect.top() / item_height());
+    int last_row = min(m_visible_rows.size() - 1, content_rect.bottom() / item_height());
+
+    for (int row = first_row; row <= last_row; ++row) {
+        auto& index = m_visible_rows[row].index;
+        int indent_level = m_visible_rows[row].indent_level;
+        auto rect = row_rect(row);
+        auto toggle_rect = this->toggle_rect(row);
 #ifdef DEBUG_ITEM_RECTS
         painter.fill_rect(rect, Color::LightGray);
 #endif
@@ -192,24 +195,17 @@ void GTreeView::paint_event(GPaintEvent& event)
             else
                 painter.blit(toggle_rect.location(), *m_expand_bitmap, m_expand_bitmap->rect());
         }
-
-        return IterationDecision::Continue;
-    });
+    }
 }
 
 void GTreeView::scroll_into_view(const GModelIndex& a_index, Orientation orientation)
 {
     if (!a_index.is_valid())
         return;
-    Rect found_rect;
-    traverse_in_paint_order([&] (const GModelIndex& index, const Rect& rect, const Rect&, int) {
-        if (index == a_index) {
-            found_rect = rect;
-            return IterationDecision::Abort;
-        }
-        return IterationDecision::Continue;
-    });
-    GScrollableWidget::scroll_into_view(found_rect, orientation);
+    for (int row = 0; row < m_visible_rows.size(); ++row) {
+        if (m_visible_rows[row].index == a_index)
+            return GScrollableWidget::scroll_into_view(row_rect(row), orientation);
+    }
 }
 
 void GTreeView::did_update_model()
@@ -246,12 +242,9 @@ void GTreeView::did_update_selection()
 
 void GTreeView::update_content_size()
 {
-    int height = 0;
+    rebuild_visible_rows();
     int width = 0;
-    traverse_in_paint_order([&] (const GModelIndex&, const Rect& rect, const Rect&, int) {
-        width = max(width, rect.right());
-        height += rect.height();
-        return IterationDecision::Continue;
-    });
-    set_content_size({ width, height });
+    for (int row = 0; row < m_visible_rows.size(); ++row)
+        width = max(width, row_rect(row).right());
+    set_content_size({ width, m_visible_rows.size() * item_height() });
 }
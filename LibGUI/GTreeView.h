@@ -27,14 +27,23 @@ private:
     int text_padding() const { return 2; }
     void update_content_size();
 
-    template<typename Callback>
-    void traverse_in_paint_order(Callback) const;
+    // Everything that's showing, top to bottom. Only rebuilt when something is expanded, collapsed or changed.
+    struct VisibleRow {
+        GModelIndex index;
+        int indent_level { 0 };
+        int width { 0 };
+        bool has_toggle { false };
+    };
+    void rebuild_visible_rows();
+    Rect row_rect(int row) const;
+    Rect toggle_rect(int row) const;
 
     struct MetadataForIndex;
 
     MetadataForIndex& ensure_metadata_for_index(const GModelIndex&) const;
 
     mutable HashMap<void*, OwnPtr<MetadataForIndex>> m_view_metadata;
+    Vector<VisibleRow> m_visible_rows;
 
     RetainPtr<GraphicsBitmap> m_expand_bitmap;
     RetainPtr<GraphicsBitmap> m_collapse_bitmap;
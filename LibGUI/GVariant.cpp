@@ -1,14 +1,20 @@
 #include <LibGUI/GVariant.h>
+#include <string.h>
 
 GVariant::GVariant()
 {
 }
 
 GVariant::~GVariant()
+{
+    clear();
+}
+
+void GVariant::clear()
 {
     switch (m_type) {
     case Type::String:
-        if (m_value.as_string)
+        if (!m_is_inline_string && m_value.as_string)
             m_value.as_string->release();
         break;
     case Type::Bitmap:
@@ -22,6 +28,67 @@ GVariant::~GVariant()
     default:
         break;
     }
+    m_type = Type::Invalid;
+    m_is_inline_string = false;
+}
+
+void GVariant::copy_from(const GVariant& other)
+{
+    ASSERT(m_type == Type::Invalid);
+    m_type = other.m_type;
+    m_is_inline_string = other.m_is_inline_string;
+    m_value = other.m_value;
+    switch (m_type) {
+    case Type::String:
+        if (!m_is_inline_string)
+            AK::retain_if_not_null(m_value.as_string);
+        break;
+    case Type::Bitmap:
+        AK::retain_if_not_null(m_value.as_bitmap);
+        break;
+    case Type::Icon:
+        AK::retain_if_not_null(m_value.as_icon);
+        break;
+    default:
+        break;
+    }
+}
+
+GVariant::GVariant(const GVariant& other)
+{
+    copy_from(other);
+}
+
+GVariant::GVariant(GVariant&& other)
+    : m_type(other.m_type)
+    , m_is_inline_string(other.m_is_inline_string)
+{
+    // What it holds a reference to changes hands as it is, the other one just forgets about it.
+    m_value = other.m_value;
+    other.m_type = Type::Invalid;
+    other.m_is_inline_string = false;
+}
+
+GVariant& GVariant::operator=(const GVariant& other)
+{
+    if (this == &other)
+        return *this;
+    clear();
+    copy_from(other);
+    return *this;
+}
+
+GVariant& GVariant::operator=(GVariant&& other)
+{
+    if (this == &other)
+        return *this;
+    clear();
+    m_type = other.m_type;
+    m_is_inline_string = other.m_is_inline_string;
+    m_value = other.m_value;
+    other.m_type = Type::Invalid;
+    other.m_is_inline_string = false;
+    return *this;
 }
 
 GVariant::GVariant(int value)
@@ -49,6 +116,25 @@ GVariant::GVariant(const String& value)
     AK::retain_if_not_null(m_value.as_string);
 }
 
+GVariant::GVariant(const StringView& value)
+    : m_type(Type::String)
+{
+    if (!value.is_null() && value.length() <= inline_string_capacity) {
+        m_is_inline_string = true;
+        memcpy(m_value.as_inline_string.characters, value.characters(), value.length());
+        m_value.as_inline_string.length = value.length();
+        return;
+    }
+    String string = value.is_null() ? String() : String(value.characters(), value.length());
+    m_value.as_string = const_cast<StringImpl*>(string.impl());
+    AK::retain_if_not_null(m_value.as_string);
+}
+
+GVariant::GVariant(const char* value)
+    : GVariant(StringView(value))
+{
+}
+
 GVariant::GVariant(const GraphicsBitmap& value)
     : m_type(Type::Bitmap)
 {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <AK/AKString.h>
+#include <AK/StringView.h>
 #include <LibGUI/GIcon.h>
 #include <SharedGraphics/GraphicsBitmap.h>
 
@@ -11,9 +12,16 @@ public:
     GVariant(float);
     GVariant(int);
     GVariant(const String&);
+    // Short ones are kept inside the variant, so making one doesn't allocate.
+    GVariant(const StringView&);
+    GVariant(const char*);
     GVariant(const GraphicsBitmap&);
     GVariant(const GIcon&);
     GVariant(Color);
+    GVariant(const GVariant&);
+    GVariant(GVariant&&);
+    GVariant& operator=(const GVariant&);
+    GVariant& operator=(GVariant&&);
     ~GVariant();
 
     enum class Type {
@@ -58,9 +66,22 @@ public:
     String as_string() const
     {
         ASSERT(type() == Type::String);
+        if (m_is_inline_string)
+            return String(m_value.as_inline_string.characters, m_value.as_inline_string.length);
         return *m_value.as_string;
     }
 
+    // Points into the variant (or its String), so it's only good for as long as the variant is.
+    StringView as_string_view() const
+    {
+        ASSERT(type() == Type::String);
+        if (m_is_inline_string)
+            return { m_value.as_inline_string.characters, m_value.as_inline_string.length };
+        if (!m_value.as_string)
+            return { };
+        return { m_value.as_string->characters(), m_value.as_string->length() };
+    }
+
     const GraphicsBitmap& as_bitmap() const
     {
         ASSERT(type() == Type::Bitmap);
@@ -92,15 +113,25 @@ public:
     bool operator<(const GVariant&) const;
 
 private:
+    void clear();
+    void copy_from(const GVariant&);
+
+    static constexpr int inline_string_capacity = 14;
+
     union {
         StringImpl* as_string;
+        struct {
+            char characters[inline_string_capacity];
+            byte length;
+        } as_inline_string;
         GraphicsBitmap* as_bitmap;
         GIconImpl* as_icon;
         bool as_bool;
         int as_int;
         float as_float;
         RGBA32 as_color;
-    } m_value; 
+    } m_value;
 
     Type m_type { Type::Invalid };
+    bool m_is_inline_string { false };
 };
@@ -4,11 +4,16 @@
 #include "GWindow.h"
 #include <LibGUI/GLayout.h>
 #include <AK/Assertions.h>
+#include <AK/HashTable.h>
+#include <AK/QuickSort.h>
 #include <SharedGraphics/GraphicsBitmap.h>
 #include <LibGUI/GPainter.h>
 
+#include <string.h>
 #include <unistd.h>
 
+static HashTable<GWidget*>* s_widgets_needing_layout;
+
 GWidget::GWidget(GWidget* parent)
     : GObject(parent)
 {
@@ -19,6 +24,8 @@ GWidget::GWidget(GWidget* parent)
 
 GWidget::~GWidget()
 {
+    if (m_needs_layout && s_widgets_needing_layout)
+        s_widgets_needing_layout->remove(this);
 }
 
 void GWidget::child_event(GChildEvent& event)
@@ -35,6 +42,9 @@ void GWidget::set_relative_rect(const Rect& rect)
     if (rect == m_relative_rect)
         return;
     bool size_changed = m_relative_rect.size() != rect.size();
+    // Whatever shows through where we were is news to any cached ancestor.
+    if (auto* parent = parent_widget())
+        parent->invalidate_layer_caches(m_relative_rect);
     m_relative_rect = rect;
 
     if (size_changed) {
@@ -81,9 +91,98 @@ void GWidget::event(GEvent& event)
     }
 }
 
+static void copy_pixels(GraphicsBitmap& destination, const Point& destination_position, const GraphicsBitmap& source, const Rect& source_rect)
+{
+    for (int y = 0; y < source_rect.height(); ++y) {
+        auto* dst = destination.scanline(destination_position.y() + y) + destination_position.x();
+        auto* src = source.scanline(source_rect.y() + y) + source_rect.x();
+        memcpy(dst, src, source_rect.width() * sizeof(RGBA32));
+    }
+}
+
+void GWidget::set_layer_caching_enabled(bool enabled)
+{
+    if (m_layer_caching_enabled == enabled)
+        return;
+    m_layer_caching_enabled = enabled;
+    m_layer_cache = nullptr;
+    m_layer_cache_valid_rects.clear();
+}
+
+// The part of |rect| that lies within the window's bitmap, in our own and in window coordinates.
+static bool rect_in_window_bitmap(GraphicsBitmap& bitmap, const Point& origin, const Rect& rect, Rect& local_rect, Rect& window_rect)
+{
+    window_rect = Rect::intersection(rect.translated(origin), bitmap.rect());
+    local_rect = window_rect.translated(-origin.x(), -origin.y());
+    return !window_rect.is_empty();
+}
+
+bool GWidget::paint_from_layer_cache(const Rect& rect)
+{
+    auto* bitmap = window()->back_bitmap();
+    if (!m_layer_cache || !bitmap || m_layer_cache->size() != size())
+        return false;
+    Rect local_rect;
+    Rect window_rect;
+    if (!rect_in_window_bitmap(*bitmap, window_relative_rect().location(), rect, local_rect, window_rect))
+        return true;
+    if (!m_layer_cache_valid_rects.contains(local_rect))
+        return false;
+    copy_pixels(*bitmap, window_rect.location(), *m_layer_cache, local_rect);
+    return true;
+}
+
+// Whatever was just painted in |rect| is exactly what we'd paint there again, children and all.
+void GWidget::store_in_layer_cache(const Rect& rect)
+{
+    auto* bitmap = window()->back_bitmap();
+    if (!bitmap || size().is_empty())
+        return;
+    Rect local_rect;
+    Rect window_rect;
+    if (!rect_in_window_bitmap(*bitmap, window_relative_rect().location(), rect, local_rect, window_rect))
+        return;
+    if (!m_layer_cache || m_layer_cache->size() != size() || m_layer_cache->format() != bitmap->format()) {
+        m_layer_cache = GraphicsBitmap::create(bitmap->format(), size());
+        m_layer_cache_valid_rects.clear();
+    }
+    copy_pixels(*m_layer_cache, local_rect.location(), *bitmap, window_rect);
+    m_layer_cache_valid_rects.add(local_rect);
+}
+
+void GWidget::invalidate_layer_caches(const Rect& rect)
+{
+    // Our pixels are part of every cached ancestor's, and what we paint under our children is part of theirs.
+    Rect rect_in_ancestor = rect;
+    for (auto* widget = this; widget; widget = widget->parent_widget()) {
+        if (widget->m_layer_cache)
+            widget->m_layer_cache_valid_rects.subtract(rect_in_ancestor);
+        rect_in_ancestor.move_by(widget->relative_position());
+    }
+    invalidate_descendant_layer_caches(rect);
+}
+
+void GWidget::invalidate_descendant_layer_caches(const Rect& rect)
+{
+    for (auto* ch : children()) {
+        if (!ch->is_widget())
+            continue;
+        auto& child = *(GWidget*)ch;
+        if (!child.relative_rect().intersects(rect))
+            continue;
+        auto local_rect = Rect::intersection(rect, child.relative_rect());
+        local_rect.move_by(-child.x(), -child.y());
+        if (child.m_layer_cache)
+            child.m_layer_cache_valid_rects.subtract(local_rect);
+        child.invalidate_descendant_layer_caches(local_rect);
+    }
+}
+
 void GWidget::handle_paint_event(GPaintEvent& event)
 {
     ASSERT(is_visible());
+    if (m_layer_caching_enabled && paint_from_layer_cache(event.rect()))
+        return;
     if (fill_with_background_color()) {
         GPainter painter(*this);
         painter.fill_rect(event.rect(), background_color());
@@ -108,6 +207,8 @@ void GWidget::handle_paint_event(GPaintEvent& event)
             child->event(local_event);
         }
     }
+    if (m_layer_caching_enabled)
+        store_in_layer_cache(event.rect());
 }
 
 void GWidget::set_layout(OwnPtr<GLayout>&& layout)
@@ -119,7 +220,7 @@ void GWidget::set_layout(OwnPtr<GLayout>&& layout)
     m_layout = move(layout);
     if (m_layout) {
         m_layout->notify_adopted(Badge<GWidget>(), *this);
-        do_layout();
+        schedule_layout();
     } else {
         update();
     }
@@ -127,21 +228,58 @@ void GWidget::set_layout(OwnPtr<GLayout>&& layout)
 
 void GWidget::do_layout()
 {
+    m_needs_layout = false;
     if (!m_layout)
         return;
     m_layout->run(*this);
     update();
 }
 
+void GWidget::schedule_layout()
+{
+    if (m_needs_layout || !m_layout)
+        return;
+    m_needs_layout = true;
+    if (!s_widgets_needing_layout)
+        s_widgets_needing_layout = new HashTable<GWidget*>;
+    s_widgets_needing_layout->set(this);
+}
+
+static int depth_of(const GWidget& widget)
+{
+    int depth = 0;
+    for (auto* parent = widget.parent_widget(); parent; parent = parent->parent_widget())
+        ++depth;
+    return depth;
+}
+
+void GWidget::do_pending_layouts()
+{
+    while (s_widgets_needing_layout && !s_widgets_needing_layout->is_empty()) {
+        Vector<GWidget*> widgets;
+        for (auto* widget : *s_widgets_needing_layout)
+            widgets.append(widget);
+        s_widgets_needing_layout->clear();
+        // Parents go first. Any child their layout resizes that's already in the list stays marked and
+        // is laid out once, at its final size, further down. Anyone else it resizes waits for the next round.
+        quick_sort(widgets.begin(), widgets.end(), [] (GWidget* a, GWidget* b) {
+            return depth_of(*a) < depth_of(*b);
+        });
+        for (auto* widget : widgets) {
+            if (widget->m_needs_layout)
+                widget->do_layout();
+        }
+    }
+}
+
 void GWidget::notify_layout_changed(Badge<GLayout>)
 {
-    do_layout();
+    schedule_layout();
 }
 
 void GWidget::handle_resize_event(GResizeEvent& event)
 {
-    if (layout())
-        do_layout();
+    schedule_layout();
     return resize_event(event);
 }
 
@@ -230,6 +368,7 @@ void GWidget::update(const Rect& rect)
 {
     if (!is_visible())
         return;
+    invalidate_layer_caches(rect);
     auto* w = window();
     if (!w)
         return;
@@ -332,15 +471,12 @@ void GWidget::set_size_policy(SizePolicy horizontal_policy, SizePolicy vertical_
     invalidate_layout();
 }
 
+// Our own layout needs another look, and so does the one we're part of.
 void GWidget::invalidate_layout()
 {
-    auto* w = window();
-    if (!w)
-        return;
-    if (!w->main_widget())
-        return;
-    do_layout();
-    w->main_widget()->do_layout();
+    schedule_layout();
+    if (auto* parent = parent_widget())
+        parent->schedule_layout();
 }
 
 void GWidget::set_visible(bool visible)
@@ -349,7 +485,7 @@ void GWidget::set_visible(bool visible)
         return;
     m_visible = visible;
     if (auto* parent = parent_widget())
-        parent->invalidate_layout();
+        parent->schedule_layout();
     if (m_visible)
         update();
 }
@@ -3,11 +3,13 @@
 #include <LibGUI/GElapsedTimer.h>
 #include <LibGUI/GEvent.h>
 #include <LibGUI/GObject.h>
+#include <SharedGraphics/DisjointRectSet.h>
 #include <SharedGraphics/Rect.h>
 #include <SharedGraphics/Color.h>
 #include <SharedGraphics/Font.h>
 #include <AK/Badge.h>
 #include <AK/AKString.h>
+#include <AK/OwnPtr.h>
 
 class GraphicsBitmap;
 class GLayout;
@@ -137,11 +139,19 @@ public:
     void notify_layout_changed(Badge<GLayout>);
     void invalidate_layout();
 
+    // Layout is only worked out once per event loop pass, right before anything gets painted.
+    static void do_pending_layouts();
+
     bool is_visible() const { return m_visible; }
     void set_visible(bool);
 
     bool spans_entire_window_horizontally() const;
 
+    // A widget whose pixels only change when it calls update() can keep a copy of them and skip painting itself
+    // and its children until then. Meant for widgets that don't overlap their siblings.
+    bool is_layer_caching_enabled() const { return m_layer_caching_enabled; }
+    void set_layer_caching_enabled(bool);
+
 private:
     virtual bool is_widget() const final { return true; }
 
@@ -149,6 +159,11 @@ private:
     void handle_resize_event(GResizeEvent&);
     void handle_mouseup_event(GMouseEvent&);
     void do_layout();
+    void schedule_layout();
+    bool paint_from_layer_cache(const Rect&);
+    void store_in_layer_cache(const Rect&);
+    void invalidate_layer_caches(const Rect&);
+    void invalidate_descendant_layer_caches(const Rect&);
 
     GWindow* m_window { nullptr };
     OwnPtr<GLayout> m_layout;
@@ -162,8 +177,13 @@ private:
     SizePolicy m_vertical_size_policy { SizePolicy::Fill };
     Size m_preferred_size;
 
+    RetainPtr<GraphicsBitmap> m_layer_cache;
+    DisjointRectSet m_layer_cache_valid_rects;
+
     bool m_fill_with_background_color { false };
     bool m_visible { true };
+    bool m_layer_caching_enabled { false };
+    bool m_needs_layout { false };
 
     GElapsedTimer m_click_clock;
 };
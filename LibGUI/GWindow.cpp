@@ -4,13 +4,18 @@
 #include "GWidget.h"
 #include <SharedGraphics/GraphicsBitmap.h>
 #include <LibGUI/GPainter.h>
+#include <LibC/limits.h>
 #include <LibC/stdio.h>
 #include <LibC/stdlib.h>
 #include <LibC/unistd.h>
 #include <AK/HashMap.h>
+#include <AK/HashTable.h>
 
 //#define UPDATE_COALESCING_DEBUG
 
+// Enough to cover the back and spare bitmaps going out of use at once, plus the one before them.
+static const int max_recycled_shared_buffers = 3;
+
 static HashMap<int, GWindow*>* s_windows;
 
 static HashMap<int, GWindow*>& windows()
@@ -20,6 +25,15 @@ static HashMap<int, GWindow*>& windows()
     return *s_windows;
 }
 
+static HashTable<GWindow*>* s_windows_with_unsent_invalidations;
+
+static HashTable<GWindow*>& windows_with_unsent_invalidations()
+{
+    if (!s_windows_with_unsent_invalidations)
+        s_windows_with_unsent_invalidations = new HashTable<GWindow*>;
+    return *s_windows_with_unsent_invalidations;
+}
+
 GWindow* GWindow::from_window_id(int window_id)
 {
     auto it = windows().find(window_id);
@@ -37,6 +51,8 @@ GWindow::GWindow(GObject* parent)
 
 GWindow::~GWindow()
 {
+    if (s_windows_with_unsent_invalidations)
+        s_windows_with_unsent_invalidations->remove(this);
     if (m_main_widget)
         delete m_main_widget;
     hide();
@@ -54,6 +70,10 @@ void GWindow::show()
     if (m_window_id)
         return;
 
+    // We pick the ID, so the window can be used right away, without waiting to hear back.
+    static int s_next_window_id;
+    m_window_id = ++s_next_window_id;
+
     WSAPI_ClientMessage request;
     request.type = WSAPI_ClientMessage::Type::CreateWindow;
     request.window_id = m_window_id;
@@ -67,8 +87,7 @@ void GWindow::show()
     ASSERT(m_title_when_windowless.length() < (ssize_t)sizeof(request.text));
     strcpy(request.text, m_title_when_windowless.characters());
     request.text_length = m_title_when_windowless.length();
-    auto response = GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidCreateWindow);
-    m_window_id = response.window_id;
+    GEventLoop::current().post_message_to_server(request);
 
     windows().set(m_window_id, this);
     update();
@@ -186,30 +205,44 @@ void GWindow::event(GEvent& event)
         return;
     }
 
-    if (event.is_paint_event()) {
+    if (event.type() == GEvent::MultiPaint) {
+        // A resize may have come in along with this paint.
+        GWidget::do_pending_layouts();
         m_pending_paint_event_rects.clear();
         if (!m_main_widget)
             return;
-        auto& paint_event = static_cast<GPaintEvent&>(event);
-        auto rect = paint_event.rect();
-        bool created_new_backing_store = !m_back_bitmap;
-        if (!m_back_bitmap)
-            m_back_bitmap = create_backing_bitmap(paint_event.window_size());
-        if (rect.is_empty() || created_new_backing_store)
-            rect = m_main_widget->rect();
+        auto& paint_event = static_cast<GMultiPaintEvent&>(event);
+        auto* old_back_bitmap = m_back.bitmap.ptr();
+        bool must_repaint_everything = prepare_back_bitmap(paint_event.window_size());
+        bool created_new_backing_store = m_back.bitmap.ptr() != old_back_bitmap;
+
+        Vector<Rect> rects;
+        for (auto& rect : paint_event.rects()) {
+            if (rect.is_empty() || must_repaint_everything) {
+                rects.clear();
+                rects.append(m_main_widget->rect());
+                break;
+            }
+            rects.append(rect);
+        }
+        if (rects.is_empty())
+            rects.append(m_main_widget->rect());
 
-        m_main_widget->event(*make<GPaintEvent>(rect));
+        for (auto& rect : rects)
+            m_main_widget->event(*make<GPaintEvent>(rect));
 
         if (m_double_buffering_enabled)
-            flip(rect);
+            flip(rects);
         else if (created_new_backing_store)
-            set_current_backing_bitmap(*m_back_bitmap, true);
+            set_current_backing_bitmap(*m_back.bitmap, true);
 
         if (m_window_id) {
             WSAPI_ClientMessage message;
             message.type = WSAPI_ClientMessage::Type::DidFinishPainting;
             message.window_id = m_window_id;
-            message.window.rect = rect;
+            message.rect_count = rects.size();
+            for (int i = 0; i < rects.size(); ++i)
+                message.rects[i] = rects[i];
             GEventLoop::current().post_message_to_server(message);
         }
         return;
@@ -244,8 +277,10 @@ void GWindow::event(GEvent& event)
 
     if (event.type() == GEvent::Resize) {
         auto new_size = static_cast<GResizeEvent&>(event).size();
-        if (m_back_bitmap && m_back_bitmap->size() != new_size)
-            m_back_bitmap = nullptr;
+        if (m_back.bitmap && m_back.bitmap->size() != new_size)
+            recycle_backing_bitmap(m_back);
+        if (m_spare.bitmap && m_spare.bitmap->size() != new_size)
+            recycle_backing_bitmap(m_spare);
         m_pending_paint_event_rects.clear();
         m_rect_when_windowless = { { }, new_size };
         m_main_widget->set_relative_rect({ { }, new_size });
@@ -274,13 +309,42 @@ void GWindow::update(const Rect& a_rect)
             return;
         }
     }
+    if (m_unsent_invalidation_rects.is_empty())
+        windows_with_unsent_invalidations().set(this);
     m_pending_paint_event_rects.append(a_rect);
+    m_unsent_invalidation_rects.append(a_rect);
+}
 
-    WSAPI_ClientMessage request;
-    request.type = WSAPI_ClientMessage::Type::InvalidateRect;
-    request.window_id = m_window_id;
-    request.window.rect = a_rect;
-    GEventLoop::current().post_message_to_server(request);
+void GWindow::send_pending_invalidations()
+{
+    // The server answers each message with one Paint carrying the same rects, so keep the batches small enough for that.
+    for (int i = 0; i < m_unsent_invalidation_rects.size(); i += WSAPI_MAX_RECTS_PER_MESSAGE) {
+        int count = min(m_unsent_invalidation_rects.size() - i, WSAPI_MAX_RECTS_PER_MESSAGE);
+        WSAPI_ClientMessage request;
+        request.type = WSAPI_ClientMessage::Type::InvalidateRect;
+        request.window_id = m_window_id;
+        request.rect_count = count;
+        for (int j = 0; j < count; ++j)
+            request.rects[j] = m_unsent_invalidation_rects[i + j];
+        GEventLoop::current().post_message_to_server(request);
+    }
+    m_unsent_invalidation_rects.clear();
+}
+
+void GWindow::send_pending_invalidations_to_server()
+{
+    if (!s_windows_with_unsent_invalidations || s_windows_with_unsent_invalidations->is_empty())
+        return;
+    Vector<GWindow*> windows;
+    for (auto* window : *s_windows_with_unsent_invalidations)
+        windows.append(window);
+    s_windows_with_unsent_invalidations->clear();
+    for (auto* window : windows) {
+        if (window->m_window_id)
+            window->send_pending_invalidations();
+        else
+            window->m_unsent_invalidation_rects.clear();
+    }
 }
 
 void GWindow::set_main_widget(GWidget* widget)
@@ -344,6 +408,13 @@ void GWindow::set_double_buffering_enabled(bool value)
     m_double_buffering_enabled = value;
 }
 
+void GWindow::set_triple_buffering_enabled(bool value)
+{
+    ASSERT(!m_window_id);
+    ASSERT(m_double_buffering_enabled || !value);
+    m_triple_buffering_enabled = value;
+}
+
 void GWindow::set_opacity(float opacity)
 {
     m_opacity_when_windowless = opacity;
@@ -371,7 +442,7 @@ void GWindow::set_hovered_widget(GWidget* widget)
         GEventLoop::current().post_event(*m_hovered_widget, make<GEvent>(GEvent::Enter));
 }
 
-void GWindow::set_current_backing_bitmap(GraphicsBitmap& bitmap, bool flush_immediately)
+int GWindow::set_current_backing_bitmap(GraphicsBitmap& bitmap, bool flush_immediately)
 {
     WSAPI_ClientMessage message;
     message.type = WSAPI_ClientMessage::Type::SetWindowBackingStore;
@@ -382,34 +453,128 @@ void GWindow::set_current_backing_bitmap(GraphicsBitmap& bitmap, bool flush_imme
     message.backing.has_alpha_channel = bitmap.has_alpha_channel();
     message.backing.size = bitmap.size();
     message.backing.flush_immediately = flush_immediately;
-    GEventLoop::current().sync_request(message, WSAPI_ServerMessage::Type::DidSetWindowBackingStore);
+    message.backing.flip_sequence = ++m_last_flip_sequence;
+    // No need to wait for the answer: it only matters once we want to draw into the bitmap this one replaces.
+    GEventLoop::current().post_message_to_server(message);
+    return m_last_flip_sequence;
 }
 
-void GWindow::flip(const Rect& dirty_rect)
+void GWindow::did_flip(Badge<GEventLoop>, int flip_sequence)
 {
-    swap(m_front_bitmap, m_back_bitmap);
+    m_acknowledged_flip_sequence = max(m_acknowledged_flip_sequence, flip_sequence);
+}
 
-    set_current_backing_bitmap(*m_front_bitmap);
+void GWindow::wait_for_flip(int flip_sequence)
+{
+    while (m_acknowledged_flip_sequence < flip_sequence) {
+        WSAPI_ServerMessage response;
+        bool success = GEventLoop::current().wait_for_specific_window_event(WSAPI_ServerMessage::Type::DidSetWindowBackingStore, m_window_id, response);
+        ASSERT(success);
+        m_acknowledged_flip_sequence = max(m_acknowledged_flip_sequence, response.backing.flip_sequence);
+    }
+}
 
-    if (!m_back_bitmap || m_back_bitmap->size() != m_front_bitmap->size()) {
-        m_back_bitmap = create_backing_bitmap(m_front_bitmap->size());
-        memcpy(m_back_bitmap->scanline(0), m_front_bitmap->scanline(0), m_front_bitmap->size().area() * sizeof(RGBA32));
-        return;
+// Returns true if the back bitmap has nothing worth keeping and the whole window has to be painted.
+bool GWindow::prepare_back_bitmap(const Size& size)
+{
+    bool front_is_usable = m_front.bitmap && m_front.bitmap->size() == size;
+    if (!m_back.bitmap || m_back.bitmap->size() != size) {
+        recycle_backing_bitmap(m_back);
+        m_back.bitmap = create_backing_bitmap(size);
+        m_back.released_by_flip = 0;
+        m_back.stale_rects.clear();
+        if (!front_is_usable)
+            return true;
+        memcpy(m_back.bitmap->scanline(0), m_front.bitmap->scanline(0), size.area() * sizeof(RGBA32));
+        return false;
+    }
+
+    // With a spare bitmap in the rotation this is normally acknowledged long ago; with two it's the last frame's flip.
+    wait_for_flip(m_back.released_by_flip);
+    if (m_back.stale_rects.is_empty())
+        return false;
+    if (!front_is_usable) {
+        m_back.stale_rects.clear();
+        return true;
+    }
+    // Copy whatever was painted while this bitmap was off screen over from the front.
+    Painter painter(*m_back.bitmap);
+    for (auto& rect : m_back.stale_rects.rects())
+        painter.blit(rect.location(), *m_front.bitmap, rect);
+    m_back.stale_rects.clear();
+    return false;
+}
+
+void GWindow::flip(const Vector<Rect>& dirty_rects)
+{
+    int flip_sequence = set_current_backing_bitmap(*m_back.bitmap);
+
+    // Everything that isn't going on screen now is missing this frame.
+    for (auto& rect : dirty_rects) {
+        m_front.stale_rects.add(rect);
+        if (m_spare.bitmap)
+            m_spare.stale_rects.add(rect);
     }
+    m_front.released_by_flip = flip_sequence;
+
+    swap(m_front, m_back);
+    if (m_triple_buffering_enabled)
+        swap(m_back, m_spare);
+}
 
-    // Copy whatever was painted from the front to the back.
-    Painter painter(*m_back_bitmap);
-    painter.blit(dirty_rect.location(), *m_front_bitmap, dirty_rect);
+void GWindow::recycle_backing_bitmap(BackingBitmap& backing)
+{
+    if (backing.bitmap && backing.bitmap->shared_buffer()) {
+        RecycledSharedBuffer recycled;
+        recycled.shared_buffer = backing.bitmap->shared_buffer();
+        // Without double buffering, the bitmap we're giving up is the one on screen until the next flip.
+        recycled.released_by_flip = m_double_buffering_enabled ? backing.released_by_flip : m_last_flip_sequence + 1;
+        m_recycled_shared_buffers.append(move(recycled));
+        if (m_recycled_shared_buffers.size() > max_recycled_shared_buffers)
+            m_recycled_shared_buffers.remove(0);
+    }
+    backing.bitmap = nullptr;
+    backing.released_by_flip = 0;
+    backing.stale_rects.clear();
 }
 
 Retained<GraphicsBitmap> GWindow::create_backing_bitmap(const Size& size)
 {
     ASSERT(GEventLoop::server_pid());
     ASSERT(!size.is_empty());
-    size_t size_in_bytes = size.area() * sizeof(RGBA32);
+    auto format = m_has_alpha_channel ? GraphicsBitmap::Format::RGBA32 : GraphicsBitmap::Format::RGB32;
+    int size_in_bytes = size.area() * sizeof(RGBA32);
+
+    // Any buffer with room for the pixels will do, but don't sit on one that's far too big after shrinking.
+    // Buffers released by a flip we haven't sent yet aren't ours to reuse.
+    int best_index = -1;
+    for (int i = 0; i < m_recycled_shared_buffers.size(); ++i) {
+        auto& recycled = m_recycled_shared_buffers[i];
+        int buffer_size = recycled.shared_buffer->size();
+        if (buffer_size < size_in_bytes || buffer_size / 4 > size_in_bytes || recycled.released_by_flip > m_last_flip_sequence)
+            continue;
+        if (best_index == -1 || buffer_size < m_recycled_shared_buffers[best_index].shared_buffer->size())
+            best_index = i;
+    }
+    if (best_index != -1) {
+        wait_for_flip(m_recycled_shared_buffers[best_index].released_by_flip);
+        auto shared_buffer = move(m_recycled_shared_buffers[best_index].shared_buffer);
+        m_recycled_shared_buffers.remove(best_index);
+        return GraphicsBitmap::create_with_shared_buffer(format, *shared_buffer, size);
+    }
+
+    // Having buffers on hand and none that fit usually means the window is growing, and it'll likely keep at it.
+    // Each new buffer is zero-filled and mapped on both sides, so leave some room to grow into.
+    if (!m_recycled_shared_buffers.is_empty()) {
+        size_in_bytes += size_in_bytes / 2;
+        for (int i = m_recycled_shared_buffers.size() - 1; i >= 0; --i) {
+            if (m_recycled_shared_buffers[i].shared_buffer->size() < size_in_bytes)
+                m_recycled_shared_buffers.remove(i);
+        }
+    }
+    size_in_bytes = (size_in_bytes + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
     auto shared_buffer = SharedBuffer::create(GEventLoop::server_pid(), size_in_bytes);
     ASSERT(shared_buffer);
-    auto format = m_has_alpha_channel ? GraphicsBitmap::Format::RGBA32 : GraphicsBitmap::Format::RGB32;
     return GraphicsBitmap::create_with_shared_buffer(format, *shared_buffer, size);
 }
 
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "GObject.h"
+#include <SharedGraphics/DisjointRectSet.h>
 #include <SharedGraphics/Rect.h>
 #include <SharedGraphics/GraphicsBitmap.h>
 #include <AK/AKString.h>
+#include <AK/Badge.h>
 #include <AK/WeakPtr.h>
 
+class GEventLoop;
 class GWidget;
 
 enum class GStandardCursor {
@@ -25,6 +28,8 @@ public:
     void set_modal(bool);
 
     void set_double_buffering_enabled(bool);
+    // Lets a window that repaints constantly start on its next frame while the server still holds the last two.
+    void set_triple_buffering_enabled(bool);
     void set_has_alpha_channel(bool);
     void set_opacity(float);
 
@@ -67,6 +72,9 @@ public:
 
     void update(const Rect& = Rect());
 
+    // GEventLoop calls this once per iteration, so all the update()s made while handling events share messages.
+    static void send_pending_invalidations_to_server();
+
     void set_global_cursor_tracking_widget(GWidget*);
     GWidget* global_cursor_tracking_widget() { return m_global_cursor_tracking_widget.ptr(); }
     const GWidget* global_cursor_tracking_widget() const { return m_global_cursor_tracking_widget.ptr(); }
@@ -82,8 +90,10 @@ public:
     const GWidget* hovered_widget() const { return m_hovered_widget.ptr(); }
     void set_hovered_widget(GWidget*);
 
-    GraphicsBitmap* front_bitmap() { return m_front_bitmap.ptr(); }
-    GraphicsBitmap* back_bitmap() { return m_back_bitmap.ptr(); }
+    GraphicsBitmap* front_bitmap() { return m_front.bitmap.ptr(); }
+    GraphicsBitmap* back_bitmap() { return m_back.bitmap.ptr(); }
+
+    void did_flip(Badge<GEventLoop>, int flip_sequence);
 
     Size size_increment() const { return m_size_increment; }
     void set_size_increment(const Size& increment) { m_size_increment = increment; }
@@ -98,11 +108,34 @@ private:
     virtual bool is_window() const override final { return true; }
 
     Retained<GraphicsBitmap> create_backing_bitmap(const Size&);
-    void set_current_backing_bitmap(GraphicsBitmap&, bool flush_immediately = false);
-    void flip(const Rect& dirty_rect);
-
-    RetainPtr<GraphicsBitmap> m_front_bitmap;
-    RetainPtr<GraphicsBitmap> m_back_bitmap;
+    int set_current_backing_bitmap(GraphicsBitmap&, bool flush_immediately = false);
+    bool prepare_back_bitmap(const Size&);
+    void wait_for_flip(int flip_sequence);
+    void flip(const Vector<Rect>& dirty_rects);
+    void send_pending_invalidations();
+
+    struct BackingBitmap {
+        RetainPtr<GraphicsBitmap> bitmap;
+        // The flip that took this bitmap off screen. The server may read it until it has acknowledged that flip.
+        int released_by_flip { 0 };
+        // What was painted since this bitmap was last on screen, to be copied over from the front before reusing it.
+        DisjointRectSet stale_rects;
+    };
+
+    void recycle_backing_bitmap(BackingBitmap&);
+
+    BackingBitmap m_front;
+    BackingBitmap m_back;
+    BackingBitmap m_spare;
+
+    // Shared buffers of bitmaps that went out of use at another size, kept around for create_backing_bitmap().
+    struct RecycledSharedBuffer {
+        RetainPtr<SharedBuffer> shared_buffer;
+        int released_by_flip { 0 };
+    };
+    Vector<RecycledSharedBuffer> m_recycled_shared_buffers;
+    int m_last_flip_sequence { 0 };
+    int m_acknowledged_flip_sequence { 0 };
     int m_window_id { 0 };
     float m_opacity_when_windowless { 1.0f };
     GWidget* m_main_widget { nullptr };
@@ -113,12 +146,14 @@ private:
     Rect m_rect_when_windowless;
     String m_title_when_windowless;
     Vector<Rect> m_pending_paint_event_rects;
+    Vector<Rect> m_unsent_invalidation_rects;
     Size m_size_increment;
     Size m_base_size;
     bool m_is_active { false };
     bool m_should_exit_app_on_close { false };
     bool m_has_alpha_channel { false };
     bool m_double_buffering_enabled { true };
+    bool m_triple_buffering_enabled { false };
     bool m_modal { false };
     bool m_resizable { true };
 };
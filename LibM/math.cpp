@@ -1,29 +1,522 @@
-#include <LibC/assert.h>
 #include <LibM/math.h>
 
+// Everything is computed on the x87 in extended precision and rounded to double at the end, which keeps
+// the results within an ulp or so without needing polynomial kernels of our own. The float versions
+// just call the double ones.
+
+static const long double log2_e = 1.4426950408889634073599246810018921L;
+
+static bool is_nan(long double x)
+{
+    return x != x;
+}
+
+static bool is_infinite(long double x)
+{
+    return x - x != 0 && !is_nan(x);
+}
+
+static long double fabs_ld(long double x)
+{
+    long double result;
+    asm("fabs" : "=t"(result) : "0"(x));
+    return result;
+}
+
+// Rounds to an integer (as a floating point value) in the given x87 rounding mode,
+// without touching the mode anything else sees.
+enum class RoundingMode : unsigned short {
+    ToNearest = 0x0000,
+    Down = 0x0400,
+    Up = 0x0800,
+    TowardZero = 0x0c00,
+};
+
+static long double round_to_integer(long double x, RoundingMode mode)
+{
+    unsigned short saved_control_word;
+    unsigned short control_word;
+    long double result;
+    asm("fnstcw %1\n"
+        "movw %1, %%dx\n"
+        "andw $0xf3ff, %%dx\n"
+        "orw %3, %%dx\n"
+        "movw %%dx, %2\n"
+        "fldcw %2\n"
+        "frndint\n"
+        "fldcw %1"
+        : "=t"(result), "=m"(saved_control_word), "=m"(control_word)
+        : "r"((unsigned short)mode), "0"(x)
+        : "dx");
+    return result;
+}
+
+// The remainder of x / y, with the quotient rounded toward zero (fprem) or to nearest (fprem1).
+// Either only makes partial progress when the exponents are far apart, so it loops until done.
+static long double remainder_ld(long double x, long double y, bool round_to_nearest)
+{
+    unsigned short status;
+    do {
+        if (round_to_nearest)
+            asm("fprem1\n"
+                "fnstsw %%ax"
+                : "=t"(x), "=a"(status)
+                : "0"(x), "u"(y));
+        else
+            asm("fprem\n"
+                "fnstsw %%ax"
+                : "=t"(x), "=a"(status)
+                : "0"(x), "u"(y));
+    } while (status & 0x400);
+    return x;
+}
+
+// pi / 2 in three parts, the first two with only 32 significant bits, so multiplying them by a quadrant
+// number below 2^32 is exact.
+static const long double two_over_pi = 0.6366197723675813430755350534900574481378L;
+static const long double pi_over_2_part1 = 0x6487ed51p-30L;
+static const long double pi_over_2_part2 = 0x85a308d3p-65L;
+static const long double pi_over_2_part3 = 0x98cc51701b839a25p-132L;
+
+// Returns x - quadrant * pi / 2, which is within [-pi / 4, pi / 4]. fsin and friends would take x as is,
+// but they reduce it with a pi that's only good to 66 bits, which is way off near multiples of it.
+static long double reduce_to_quadrant(long double x, int& quadrant)
+{
+    if (fabs_ld(x) >= 0x1p31L) {
+        // That far out there's nothing better than fprem1 and the x87's own pi at hand.
+        long double two_pi;
+        asm("fldpi\n"
+            "fadd %%st(0)"
+            : "=t"(two_pi));
+        x = remainder_ld(x, two_pi, true);
+    }
+    long double k = round_to_integer(x * two_over_pi, RoundingMode::ToNearest);
+    quadrant = (int)k & 3;
+    return ((x - k * pi_over_2_part1) - k * pi_over_2_part2) - k * pi_over_2_part3;
+}
+
+static long double sin_ld(long double x)
+{
+    long double result;
+    asm("fsin" : "=t"(result) : "0"(x));
+    return result;
+}
+
+static long double cos_ld(long double x)
+{
+    long double result;
+    asm("fcos" : "=t"(result) : "0"(x));
+    return result;
+}
+
+static long double scale_by_power_of_two(long double x, long double n)
+{
+    long double result;
+    asm("fscale" : "=t"(result) : "0"(x), "u"(n));
+    return result;
+}
+
+static long double exp2_ld(long double x)
+{
+    if (is_nan(x))
+        return x;
+    // Way past where any double over- or underflows, and small enough that fscale manages.
+    if (x > 20000)
+        return scale_by_power_of_two(1, 20000);
+    if (x < -20000)
+        return 0;
+    // f2xm1 takes the fractional part, fscale does the integer part exactly.
+    long double n = round_to_integer(x, RoundingMode::ToNearest);
+    long double fraction_minus_one;
+    asm("f2xm1" : "=t"(fraction_minus_one) : "0"(x - n));
+    return scale_by_power_of_two(fraction_minus_one + 1, n);
+}
+
+static long double exp_ld(long double x)
+{
+    return exp2_ld(x * log2_e);
+}
+
+// e^x - 1, without the cancellation that computing it from exp(x) has near 0.
+static long double expm1_ld(long double x)
+{
+    long double t = x * log2_e;
+    if (fabs_ld(t) >= 1)
+        return exp2_ld(t) - 1;
+    long double result;
+    asm("f2xm1" : "=t"(result) : "0"(t));
+    return result;
+}
+
+// y * log2(x)
+static long double y_log2_x(long double y, long double x)
+{
+    long double result;
+    asm("fyl2x" : "=t"(result) : "0"(x), "u"(y) : "st(1)");
+    return result;
+}
+
+static bool is_integer(double x)
+{
+    return round_to_integer(x, RoundingMode::TowardZero) == x;
+}
+
+static bool is_odd_integer(double x)
+{
+    return is_integer(x) && remainder_ld(x, 2, false) != 0;
+}
+
 extern "C" {
 
-double cos(double)
+double fabs(double x)
+{
+    return fabs_ld(x);
+}
+
+float fabsf(float x)
+{
+    return fabs_ld(x);
+}
+
+double sqrt(double x)
+{
+    double result;
+    asm("fsqrt" : "=t"(result) : "0"(x));
+    return result;
+}
+
+float sqrtf(float x)
+{
+    float result;
+    asm("fsqrt" : "=t"(result) : "0"(x));
+    return result;
+}
+
+double floor(double x)
+{
+    return round_to_integer(x, RoundingMode::Down);
+}
+
+float floorf(float x)
+{
+    return round_to_integer(x, RoundingMode::Down);
+}
+
+double ceil(double x)
+{
+    return round_to_integer(x, RoundingMode::Up);
+}
+
+float ceilf(float x)
+{
+    return round_to_integer(x, RoundingMode::Up);
+}
+
+double round(double x)
+{
+    // Halfway cases go away from zero, which isn't one of the x87's modes. x - truncated is exact.
+    long double truncated = round_to_integer(x, RoundingMode::TowardZero);
+    if (fabs_ld(x - truncated) >= 0.5)
+        truncated += x < 0 ? -1 : 1;
+    return truncated;
+}
+
+float roundf(float x)
+{
+    return round(x);
+}
+
+double modf(double x, double* integer_part)
+{
+    double truncated = round_to_integer(x, RoundingMode::TowardZero);
+    *integer_part = truncated;
+    if (is_infinite(x))
+        return x < 0 ? -0.0 : 0.0;
+    double fraction = x - truncated;
+    // The fraction of -3.0 is -0.0.
+    if (fraction == 0)
+        return x < 0 ? -0.0 : 0.0;
+    return fraction;
+}
+
+float modff(float x, float* integer_part)
+{
+    double integer;
+    float fraction = modf(x, &integer);
+    *integer_part = integer;
+    return fraction;
+}
+
+double fmod(double x, double y)
+{
+    return remainder_ld(x, y, false);
+}
+
+float fmodf(float x, float y)
 {
-    assert(false);
+    return remainder_ld(x, y, false);
 }
 
-double sin(double)
+double ldexp(double x, int exp)
 {
-    assert(false);
+    return scale_by_power_of_two(x, exp);
+}
+
+float ldexpf(float x, int exp)
+{
+    return scale_by_power_of_two(x, exp);
+}
+
+double frexp(double x, int* exp)
+{
+    if (x == 0 || is_nan(x) || is_infinite(x)) {
+        *exp = 0;
+        return x;
+    }
+    // fxtract splits x into a significand in [1, 2) and the exponent, we want [0.5, 1).
+    long double significand;
+    long double exponent;
+    asm("fxtract" : "=t"(significand), "=u"(exponent) : "0"((long double)x));
+    *exp = (int)exponent + 1;
+    return significand / 2;
+}
+
+float frexpf(float x, int* exp)
+{
+    return frexp(x, exp);
+}
+
+double exp(double x)
+{
+    return exp_ld(x);
+}
+
+float expf(float x)
+{
+    return exp_ld(x);
+}
+
+double log(double x)
+{
+    double result;
+    asm("fldln2\n"
+        "fxch\n"
+        "fyl2x"
+        : "=t"(result)
+        : "0"(x));
+    return result;
+}
+
+float logf(float x)
+{
+    return log(x);
+}
+
+double log10(double x)
+{
+    double result;
+    asm("fldlg2\n"
+        "fxch\n"
+        "fyl2x"
+        : "=t"(result)
+        : "0"(x));
+    return result;
+}
+
+float log10f(float x)
+{
+    return log10(x);
 }
 
 double pow(double x, double y)
 {
-    (void)x;
-    (void)y;
-    assert(false);
+    if (y == 0 || x == 1)
+        return 1;
+    if (is_nan(x) || is_nan(y))
+        return x + y;
+    if (is_infinite(y)) {
+        if (x == -1)
+            return 1;
+        bool grows = (fabs_ld(x) > 1) == (y > 0);
+        return grows ? y * y : 0;
+    }
+    if (x == 0 || is_infinite(x)) {
+        // 0 and infinity are each other's reciprocals here, and negative ones keep their sign for odd powers.
+        bool is_huge = (x == 0) == (y < 0);
+        double magnitude = is_huge ? HUGE_VAL : 0;
+        return __builtin_signbit(x) && is_odd_integer(y) ? -magnitude : magnitude;
+    }
+    if (x < 0) {
+        if (!is_integer(y))
+            return (x - x) / (x - x);
+        long double result = exp2_ld(y_log2_x(y, -(long double)x));
+        return is_odd_integer(y) ? -result : result;
+    }
+    return exp2_ld(y_log2_x(y, x));
+}
+
+float powf(float x, float y)
+{
+    return pow(x, y);
+}
+
+double sin(double x)
+{
+    if (is_infinite(x))
+        return x - x;
+    int quadrant;
+    long double r = reduce_to_quadrant(x, quadrant);
+    switch (quadrant) {
+    case 0:
+        return sin_ld(r);
+    case 1:
+        return cos_ld(r);
+    case 2:
+        return -sin_ld(r);
+    default:
+        return -cos_ld(r);
+    }
+}
+
+float sinf(float x)
+{
+    return sin(x);
+}
+
+double cos(double x)
+{
+    if (is_infinite(x))
+        return x - x;
+    int quadrant;
+    long double r = reduce_to_quadrant(x, quadrant);
+    switch (quadrant) {
+    case 0:
+        return cos_ld(r);
+    case 1:
+        return -sin_ld(r);
+    case 2:
+        return -cos_ld(r);
+    default:
+        return sin_ld(r);
+    }
+}
+
+float cosf(float x)
+{
+    return cos(x);
+}
+
+double tan(double x)
+{
+    if (is_infinite(x))
+        return x - x;
+    int quadrant;
+    long double r = reduce_to_quadrant(x, quadrant);
+    // fptan pushes a 1 on top of the result, for compatibility with the 8087.
+    long double result;
+    asm("fptan\n"
+        "fstp %%st(0)"
+        : "=t"(result)
+        : "0"(r));
+    return quadrant & 1 ? -1 / result : result;
+}
+
+float tanf(float x)
+{
+    return tan(x);
+}
+
+double atan2(double y, double x)
+{
+    // fpatan figures out the quadrant from the signs of both.
+    long double result;
+    asm("fpatan" : "=t"(result) : "0"((long double)x), "u"((long double)y) : "st(1)");
+    return result;
+}
+
+float atan2f(float y, float x)
+{
+    return atan2(y, x);
+}
+
+double atan(double x)
+{
+    return atan2(x, 1);
+}
+
+float atanf(float x)
+{
+    return atan2(x, 1);
+}
+
+// Outside [-1, 1], the square root is of a negative number and makes these NaN, as they should be.
+double asin(double x)
+{
+    long double cosine;
+    long double one_minus_x_squared = (1 - (long double)x) * (1 + (long double)x);
+    asm("fsqrt" : "=t"(cosine) : "0"(one_minus_x_squared));
+    return atan2(x, cosine);
+}
+
+float asinf(float x)
+{
+    return asin(x);
+}
+
+double acos(double x)
+{
+    long double sine;
+    long double one_minus_x_squared = (1 - (long double)x) * (1 + (long double)x);
+    asm("fsqrt" : "=t"(sine) : "0"(one_minus_x_squared));
+    return atan2(sine, x);
+}
+
+float acosf(float x)
+{
+    return acos(x);
+}
+
+double sinh(double x)
+{
+    // (e^x - e^-x) / 2, in terms of e^x - 1 so small arguments don't cancel out. Past 22, e^-x doesn't matter.
+    long double result;
+    if (fabs_ld(x) > 22) {
+        result = exp_ld(fabs_ld(x)) / 2;
+    } else {
+        long double e = expm1_ld(fabs_ld(x));
+        result = (e + e / (e + 1)) / 2;
+    }
+    return x < 0 ? -result : result;
+}
+
+float sinhf(float x)
+{
+    return sinh(x);
+}
+
+double cosh(double x)
+{
+    long double e = exp_ld(fabs_ld(x));
+    return (e + 1 / e) / 2;
+}
+
+float coshf(float x)
+{
+    return cosh(x);
+}
+
+double tanh(double x)
+{
+    // Past this, tanh(x) rounds to +-1, and e^2x - 1 may overflow on the way there.
+    if (fabs_ld(x) > 22)
+        return x < 0 ? -1 : 1;
+    long double e = expm1_ld(2 * (long double)x);
+    return e / (e + 2);
 }
 
-double ldexp(double, int exp)
+float tanhf(float x)
 {
-    (void)exp;
-    assert(false);
+    return tanh(x);
 }
 
 }
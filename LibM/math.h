@@ -4,7 +4,7 @@
 
 __BEGIN_DECLS
 
-#define HUGE_VAL 1e10000
+#define HUGE_VAL __builtin_huge_val()
 
 double acos(double);
 float acosf(float);
@@ -52,6 +52,7 @@ double ldexp(double, int exp);
 float ldexpf(float, int exp);
 
 double pow(double x, double y);
+float powf(float x, float y);
 
 __END_DECLS
 
@@ -3,11 +3,11 @@
 #include <AK/Types.h>
 #include <Kernel/NetworkOrdered.h>
 
+// What follows a resource record's name, which can be any length.
 class [[gnu::packed]] DNSRecord {
 public:
     DNSRecord() { }
 
-    word name() const { return m_name; }
     word type() const { return m_type; }
     word record_class() const { return m_class; }
     dword ttl() const { return m_ttl; }
@@ -17,11 +17,10 @@ public:
     const void* data() const { return this + 1; }
 
 private:
-    NetworkOrdered<word> m_name;
     NetworkOrdered<word> m_type;
     NetworkOrdered<word> m_class;
     NetworkOrdered<dword> m_ttl;
     NetworkOrdered<word> m_data_length;
 };
 
-static_assert(sizeof(DNSRecord) == 12);
+static_assert(sizeof(DNSRecord) == 10);
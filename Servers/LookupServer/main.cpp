@@ -1,19 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <unistd.h>
-#include <unistd.h>
 #include <Kernel/IPv4.h>
 #include <AK/AKString.h>
 #include <AK/HashMap.h>
 #include <AK/ByteBuffer.h>
 #include <AK/BufferStream.h>
+#include <AK/OwnPtr.h>
+#include <AK/StdLibExtras.h>
+#include <AK/StringBuilder.h>
 #include "DNSPacket.h"
 #include "DNSRecord.h"
 
+//#define LOOKUPSERVER_DEBUG
+
 #define T_A     1
 #define T_NS    2
 #define T_CNAME 5
@@ -23,128 +29,141 @@
 
 #define C_IN    1
 
-static Vector<IPv4Address> lookup(const String& hostname, bool& did_timeout);
-static String parse_dns_name(const byte*, int& offset, int max_offset);
-
-int main(int argc, char**argv)
-{
-    (void)argc;
-    (void)argv;
-
-    unlink("/tmp/.LookupServer-socket");
-
-    HashMap<String, IPv4Address> dns_cache;
-
-    int server_fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
-    if (server_fd < 0) {
-        perror("socket");
-        return 1;
-    }
-
-    sockaddr_un address;
-    address.sun_family = AF_LOCAL;
-    strcpy(address.sun_path, "/tmp/.LookupServer-socket");
-
-    int rc = bind(server_fd, (const sockaddr*)&address, sizeof(address));
-    if (rc < 0) {
-        perror("bind");
-        return 1;
-    }
-    rc = listen(server_fd, 5);
-    if (rc < 0) {
-        perror("listen");
-        return 1;
-    }
-
-    for (;;) {
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(server_fd, &rfds);
-        rc = select(server_fd + 1, &rfds, nullptr, nullptr, nullptr);
-        if (rc < 1) {
-            perror("select");
-            return 1;
-        }
+#define RCODE_NOERROR  0
+#define RCODE_NXDOMAIN 3
+
+// Everything happens on the one thread, around a select() on the clients and the DNS socket.
+// A client asks for a name, and gets its answer once it's in, while everyone else is getting theirs.
+// Answers are cached for as long as their TTL says, and so is the lack of one (RFC 2308).
+// Clients asking for a name that's already being looked up wait for that same query.
+
+static const char* dns_server = "172.20.10.1";
+static const int max_attempts = 3;
+static const int attempt_timeout_ms = 1000;
+// Nothing is trusted for longer than a day, or for not existing for longer than 5 minutes.
+static const dword max_ttl = 24 * 60 * 60;
+static const dword default_negative_ttl = 60;
+static const dword max_negative_ttl = 5 * 60;
+static const int max_cache_entries = 1024;
+static const int max_request_size = 1024;
+// The rest wait in the listen backlog, so everyone fits in an fd_set.
+static const int max_clients = 48;
+
+struct Client {
+    int fd { -1 };
+    Vector<char> request;
+    // The name of the query it's waiting for, if any.
+    String waiting_for;
+};
+
+struct Query {
+    String hostname;
+    word id { 0 };
+    int attempts { 0 };
+    qword deadline { 0 };
+    Vector<int> waiting_clients;
+};
+
+struct CacheEntry {
+    // Empty if the name doesn't have any.
+    Vector<IPv4Address> addresses;
+    qword expires_at { 0 };
+};
 
-        sockaddr_un client_address;
-        socklen_t client_address_size = sizeof(client_address);
-        int client_fd = accept(server_fd, (sockaddr*)&client_address, &client_address_size);
-        if (client_fd < 0) {
-            perror("accept");
-            continue;
-        }
+static HashMap<int, OwnPtr<Client>> s_clients;
+// By name, so everyone asking for the same one shares the query.
+static HashMap<String, OwnPtr<Query>> s_queries;
+static HashMap<String, CacheEntry> s_cache;
+static int s_dns_fd = -1;
+static sockaddr_in s_dns_server_address;
 
-        FD_ZERO(&rfds);
-        FD_SET(client_fd, &rfds);
-        rc = select(client_fd + 1, &rfds, nullptr, nullptr, nullptr);
-        if (rc < 1) {
-            perror("select");
-            return 1;
-        }
+static String parse_dns_name(const byte*, int& offset, int size);
 
-        char client_buffer[1024];
-        int nrecv = read(client_fd, client_buffer, sizeof(client_buffer) - 1);
-        if (nrecv < 0) {
-            perror("recv");
-            close(client_fd);
-            continue;
-        }
-
-        client_buffer[nrecv] = '\0';
-
-        auto hostname = String(client_buffer, nrecv, Chomp);
-        dbgprintf("LookupServer: Got request for '%s'\n", hostname.characters());
+static qword now_in_ms()
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return (qword)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
 
-        Vector<IPv4Address> addresses;
+static word get_next_id()
+{
+    static word s_next_id = 0;
+    return ++s_next_id;
+}
 
-        if (!hostname.is_empty()) {
-            bool did_timeout;
-            int retries = 3;
-            do {
-                did_timeout = false;
-                addresses = lookup(hostname, did_timeout);
-                if (!did_timeout)
+static void drop_client(int fd)
+{
+    auto it = s_clients.find(fd);
+    if (it == s_clients.end())
+        return;
+    auto& client = *(*it).value;
+    if (!client.waiting_for.is_null()) {
+        auto query_it = s_queries.find(client.waiting_for);
+        if (query_it != s_queries.end()) {
+            auto& waiting_clients = (*query_it).value->waiting_clients;
+            for (int i = 0; i < waiting_clients.size(); ++i) {
+                if (waiting_clients[i] == fd) {
+                    waiting_clients.remove(i);
                     break;
-            } while (--retries);
-            if (did_timeout) {
-                fprintf(stderr, "LookupServer: Out of retries :(\n");
-                close(client_fd);
-                continue;
+                }
             }
         }
-
-        if (addresses.is_empty()) {
-            int nsent = write(client_fd, "Not found.\n", sizeof("Not found.\n"));
-            if (nsent < 0)
-                perror("write");
-            close(client_fd);
-            continue;
-        }
-        for (auto& address : addresses) {
-            auto line = String::format("%s\n", address.to_string().characters());
-            int nsent = write(client_fd, line.characters(), line.length());
-            if (nsent < 0) {
-                perror("write");
-                break;
-            }
-        }
-        close(client_fd);
     }
-    return 0;
+    close(fd);
+    s_clients.remove(fd);
 }
 
-static word get_next_id()
+// Sends |addresses| to the client, all at once since it reads them with a single read(), and hangs up.
+static void answer(int client_fd, const Vector<IPv4Address>& addresses)
 {
-    static word s_next_id = 0;
-    return ++s_next_id;
+    StringBuilder builder;
+    if (addresses.is_empty())
+        builder.append("Not found.\n");
+    for (auto& address : addresses)
+        builder.appendf("%s\n", address.to_string().characters());
+    auto response = builder.to_string();
+    int nsent = write(client_fd, response.characters(), response.length());
+    if (nsent < 0)
+        perror("write");
+    auto it = s_clients.find(client_fd);
+    if (it != s_clients.end())
+        (*it).value->waiting_for = { };
+    drop_client(client_fd);
 }
 
-Vector<IPv4Address> lookup(const String& hostname, bool& did_timeout)
+static void remember(const String& hostname, const Vector<IPv4Address>& addresses, dword ttl)
 {
-    // FIXME: First check if it's an IP address in a string!
+    if (!ttl)
+        return;
+    if ((int)s_cache.size() >= max_cache_entries) {
+        qword now = now_in_ms();
+        Vector<String> expired;
+        String soonest;
+        qword soonest_expiry = 0;
+        for (auto& it : s_cache) {
+            if (it.value.expires_at <= now)
+                expired.append(it.key);
+            if (soonest.is_null() || it.value.expires_at < soonest_expiry) {
+                soonest = it.key;
+                soonest_expiry = it.value.expires_at;
+            }
+        }
+        if (expired.is_empty())
+            expired.append(soonest);
+        for (auto& key : expired)
+            s_cache.remove(key);
+    }
+    CacheEntry entry;
+    entry.addresses = addresses;
+    entry.expires_at = now_in_ms() + (qword)ttl * 1000;
+    s_cache.set(hostname, move(entry));
+}
 
+static void send_query(Query& query)
+{
     DNSPacket request_header;
-    request_header.set_id(get_next_id());
+    request_header.set_id(query.id);
     request_header.set_is_query();
     request_header.set_opcode(0);
     request_header.set_truncated(false);
@@ -156,7 +175,7 @@ Vector<IPv4Address> lookup(const String& hostname, bool& did_timeout)
         BufferStream stream(buffer);
 
         stream << ByteBuffer::wrap(&request_header, sizeof(request_header));
-        auto parts = hostname.split('.');
+        auto parts = query.hostname.split('.');
         for (auto& part : parts) {
             stream << (byte)part.length();
             stream << part;
@@ -167,117 +186,392 @@ Vector<IPv4Address> lookup(const String& hostname, bool& did_timeout)
         stream.snip();
     }
 
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        perror("socket");
-        return { };
+    ++query.attempts;
+    query.deadline = now_in_ms() + attempt_timeout_ms;
+    int nsent = sendto(s_dns_fd, buffer.pointer(), buffer.size(), 0, (const sockaddr*)&s_dns_server_address, sizeof(s_dns_server_address));
+    if (nsent < 0)
+        perror("sendto");
+}
+
+static void finish_query(const String& hostname, const Vector<IPv4Address>& addresses)
+{
+    auto it = s_queries.find(hostname);
+    ASSERT(it != s_queries.end());
+    auto query = move((*it).value);
+    s_queries.remove(hostname);
+    for (int client_fd : query->waiting_clients)
+        answer(client_fd, addresses);
+}
+
+// Labels and all, as it would go in a query.
+static bool is_valid_hostname(const String& hostname)
+{
+    if (hostname.is_empty() || hostname.length() > 253)
+        return false;
+    int label_length = 0;
+    for (int i = 0; i < hostname.length(); ++i) {
+        if (hostname[i] != '.') {
+            if (++label_length > 63)
+                return false;
+            continue;
+        }
+        // Only the last label can be empty, in a name ending with the root's dot.
+        if (!label_length)
+            return false;
+        label_length = 0;
     }
+    return true;
+}
 
-    struct timeval timeout { 1, 0 };
-    int rc = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    if (rc < 0) {
-        perror("setsockopt");
-        close(fd);
-        return { };
+static void resolve(Client& client, String hostname)
+{
+    int client_fd = client.fd;
+#ifdef LOOKUPSERVER_DEBUG
+    dbgprintf("LookupServer: Got request for '%s'\n", hostname.characters());
+#endif
+
+    IPv4Address literal;
+    if (inet_pton(AF_INET, hostname.characters(), &literal) == 1) {
+        Vector<IPv4Address> addresses;
+        addresses.append(literal);
+        answer(client_fd, addresses);
+        return;
+    }
+    if (hostname.ends_with("."))
+        hostname = hostname.substring(0, hostname.length() - 1);
+    if (!is_valid_hostname(hostname)) {
+        answer(client_fd, { });
+        return;
     }
 
-    struct sockaddr_in dst_addr;
-    memset(&dst_addr, 0, sizeof(dst_addr));
+    hostname = hostname.to_lowercase();
+    auto cached = s_cache.find(hostname);
+    if (cached != s_cache.end()) {
+        if ((*cached).value.expires_at > now_in_ms()) {
+            answer(client_fd, (*cached).value.addresses);
+            return;
+        }
+        s_cache.remove(hostname);
+    }
 
-    dst_addr.sin_family = AF_INET;
-    dst_addr.sin_port = htons(53);
-    rc = inet_pton(AF_INET, "172.20.10.1", &dst_addr.sin_addr);
+    client.waiting_for = hostname;
+    auto it = s_queries.find(hostname);
+    if (it != s_queries.end()) {
+        (*it).value->waiting_clients.append(client_fd);
+        return;
+    }
+    auto query = make<Query>();
+    query->hostname = hostname;
+    query->id = get_next_id();
+    query->waiting_clients.append(client_fd);
+    send_query(*query);
+    s_queries.set(hostname, move(query));
+}
 
-    int nsent = sendto(fd, buffer.pointer(), buffer.size(), 0,(const struct sockaddr *)&dst_addr, sizeof(dst_addr));
-    if (nsent < 0) {
-        perror("sendto");
-        return { };
+static void handle_client(Client& client)
+{
+    char buffer[256];
+    int nread = read(client.fd, buffer, sizeof(buffer));
+    if (nread <= 0) {
+        if (nread < 0)
+            perror("read");
+        drop_client(client.fd);
+        return;
     }
-    ASSERT(nsent == buffer.size());
+    if (!client.waiting_for.is_null())
+        return;
+    for (int i = 0; i < nread; ++i) {
+        if (buffer[i] == '\n') {
+            if (client.request.is_empty())
+                answer(client.fd, { });
+            else
+                resolve(client, String(client.request.data(), client.request.size()));
+            return;
+        }
+        client.request.append(buffer[i]);
+    }
+    if (client.request.size() > max_request_size)
+        answer(client.fd, { });
+}
 
-    struct sockaddr_in src_addr;
-    socklen_t src_addr_len = sizeof(src_addr);
-    byte response_buffer[4096];
-    ssize_t nrecv = recvfrom(fd, response_buffer, sizeof(response_buffer) - 1, 0, (struct sockaddr*)&src_addr, &src_addr_len);
-    if (nrecv < 0) {
-        if (errno == EAGAIN) {
-            did_timeout = true;
-        } else {
-            perror("recvfrom");
+static dword read_dword(const byte* data)
+{
+    return (dword)data[0] << 24 | (dword)data[1] << 16 | (dword)data[2] << 8 | data[3];
+}
+
+static const DNSRecord* next_record(const byte* packet, int& offset, int size)
+{
+    if (parse_dns_name(packet, offset, size).is_null())
+        return nullptr;
+    if (offset + (int)sizeof(DNSRecord) > size)
+        return nullptr;
+    auto& record = *(const DNSRecord*)&packet[offset];
+    offset += sizeof(DNSRecord);
+    if (offset + record.data_length() > size)
+        return nullptr;
+    offset += record.data_length();
+    return &record;
+}
+
+// Gets the addresses in the answers of the response in |packet|, and how many seconds they're good for.
+// Without any, it's how long the name is known not to have one, by the SOA that came with it.
+// |offset| is where the answers start. Returns false for a response that's no answer at all.
+static bool parse_response(const byte* packet, int offset, int size, Vector<IPv4Address>& addresses, dword& ttl)
+{
+    auto& header = *(const DNSPacket*)packet;
+    if (header.response_code() != RCODE_NOERROR && header.response_code() != RCODE_NXDOMAIN)
+        return false;
+
+    dword answer_ttl = max_ttl;
+    for (word i = 0; i < header.answer_count(); ++i) {
+        auto* record = next_record(packet, offset, size);
+        if (!record)
+            return false;
+        // Any CNAMEs come first, followed by what they lead to.
+        if (record->type() == T_A && record->record_class() == C_IN && record->data_length() == sizeof(IPv4Address)) {
+            addresses.append(IPv4Address((const byte*)record->data()));
+            answer_ttl = min(answer_ttl, record->ttl());
         }
-        close(fd);
-        return { };
     }
-    close(fd);
+    if (!addresses.is_empty()) {
+        ttl = answer_ttl;
+        return true;
+    }
 
-    response_buffer[nrecv] = '\0';
+    ttl = default_negative_ttl;
+    for (word i = 0; i < header.authority_count(); ++i) {
+        auto* record = next_record(packet, offset, size);
+        if (!record)
+            break;
+        if (record->type() != T_SOA)
+            continue;
+        // The primary server's name and the mailbox's go first, then five numbers, the last of which is the minimum.
+        int data_offset = (const byte*)record->data() - packet;
+        int data_end = data_offset + record->data_length();
+        if (parse_dns_name(packet, data_offset, data_end).is_null() || parse_dns_name(packet, data_offset, data_end).is_null())
+            break;
+        if (data_offset + 20 > data_end)
+            break;
+        ttl = min(record->ttl(), read_dword(&packet[data_offset + 16]));
+        break;
+    }
+    ttl = min(ttl, max_negative_ttl);
+    return true;
+}
 
+static void handle_dns_response()
+{
+    sockaddr_in source_address;
+    socklen_t source_address_size = sizeof(source_address);
+    byte buffer[4096];
+    ssize_t nrecv = recvfrom(s_dns_fd, buffer, sizeof(buffer), 0, (sockaddr*)&source_address, &source_address_size);
+    if (nrecv < 0) {
+        perror("recvfrom");
+        return;
+    }
+    if (source_address.sin_addr.s_addr != s_dns_server_address.sin_addr.s_addr || source_address.sin_port != s_dns_server_address.sin_port)
+        return;
     if (nrecv < (int)sizeof(DNSPacket)) {
         dbgprintf("LookupServer: Response not big enough (%d) to be a DNS packet :(\n", nrecv);
-        return { };
+        return;
     }
 
-    auto& response_header = *(DNSPacket*)(response_buffer);
-    printf("Got response (ID: %u)\n", response_header.id());
-    //printf("  Question count: %u\n", response_header.question_count());
-    printf("  Answer count: %u\n", response_header.answer_count());
-    //printf(" Authority count: %u\n", response_header.authority_count());
-    //printf("Additional count: %u\n", response_header.additional_count());
+    auto& response_header = *(const DNSPacket*)buffer;
+    if (!response_header.is_response() || response_header.question_count() != 1) {
+        dbgprintf("LookupServer: Question count (%u vs 1) :(\n", response_header.question_count());
+        return;
+    }
+    int offset = sizeof(DNSPacket);
+    auto question = parse_dns_name(buffer, offset, nrecv);
+    offset += 4;
+    if (question.is_null() || offset > nrecv)
+        return;
+    question = question.to_lowercase();
+
+    // Whatever doesn't match a query we sent is a late answer to one that's given up, or someone trying to fool us.
+    auto it = s_queries.find(question);
+    if (it == s_queries.end() || (*it).value->id != response_header.id()) {
+        dbgprintf("LookupServer: Unexpected response (ID: %u) for '%s'\n", response_header.id(), question.characters());
+        return;
+    }
 
-    if (response_header.id() != request_header.id()) {
-        dbgprintf("LookupServer: ID mismatch (%u vs %u) :(\n", response_header.id(), request_header.id());
-        return { };
+    Vector<IPv4Address> addresses;
+    dword ttl = 0;
+    if (!parse_response(buffer, offset, nrecv, addresses, ttl)) {
+        dbgprintf("LookupServer: Bad response (code %u) for '%s' :(\n", response_header.response_code(), question.characters());
+        finish_query(question, { });
+        return;
     }
-    if (response_header.question_count() != 1) {
-        dbgprintf("LookupServer: Question count (%u vs %u) :(\n", response_header.question_count(), request_header.question_count());
-        return { };
+#ifdef LOOKUPSERVER_DEBUG
+    dbgprintf("LookupServer: '%s' has %d addresses, for %u seconds\n", question.characters(), addresses.size(), ttl);
+#endif
+    remember(question, addresses, ttl);
+    finish_query(question, addresses);
+}
+
+static void handle_timeouts()
+{
+    qword now = now_in_ms();
+    Vector<String> timed_out;
+    for (auto& it : s_queries) {
+        if (it.value->deadline <= now)
+            timed_out.append(it.key);
     }
-    if (response_header.answer_count() < 1) {
-        dbgprintf("LookupServer: Not enough answers (%u) :(\n", response_header.answer_count());
-        return { };
+    for (auto& hostname : timed_out) {
+        auto& query = *(*s_queries.find(hostname)).value;
+        if (query.attempts < max_attempts) {
+            send_query(query);
+            continue;
+        }
+        fprintf(stderr, "LookupServer: Out of retries for '%s' :(\n", hostname.characters());
+        finish_query(hostname, { });
     }
+}
 
-    int offset = 0;
-    auto question = parse_dns_name((const byte*)response_header.payload(), offset, nrecv);
-    offset += 4;
+int main(int argc, char**argv)
+{
+    (void)argc;
+    (void)argv;
 
-    Vector<IPv4Address> addresses;
+    // A client that gave up shouldn't take us down with it when it's answered.
+    signal(SIGPIPE, SIG_IGN);
+
+    unlink("/tmp/.LookupServer-socket");
+
+    int server_fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    sockaddr_un address;
+    address.sun_family = AF_LOCAL;
+    strcpy(address.sun_path, "/tmp/.LookupServer-socket");
 
-    for (word i = 0; i < response_header.answer_count(); ++i) {
-        auto& record = *(const DNSRecord*)(&((const byte*)response_header.payload())[offset]);
-        auto ipv4_address = IPv4Address((const byte*)record.data());
-        dbgprintf("LookupServer:     Answer #%u: (question: %s), ttl=%u, length=%u, data=%s\n",
-            i,
-            question.characters(),
-            record.ttl(),
-            record.data_length(),
-            ipv4_address.to_string().characters());
-
-        offset += sizeof(DNSRecord) + record.data_length();
-        addresses.append(ipv4_address);
+    int rc = bind(server_fd, (const sockaddr*)&address, sizeof(address));
+    if (rc < 0) {
+        perror("bind");
+        return 1;
+    }
+    rc = listen(server_fd, 16);
+    if (rc < 0) {
+        perror("listen");
+        return 1;
     }
 
-    return addresses;
+    s_dns_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (s_dns_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    memset(&s_dns_server_address, 0, sizeof(s_dns_server_address));
+    s_dns_server_address.sin_family = AF_INET;
+    s_dns_server_address.sin_port = htons(53);
+    rc = inet_pton(AF_INET, dns_server, &s_dns_server_address.sin_addr);
+    ASSERT(rc == 1);
+
+    for (;;) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        int max_fd = s_dns_fd;
+        FD_SET(s_dns_fd, &rfds);
+        if ((int)s_clients.size() < max_clients) {
+            FD_SET(server_fd, &rfds);
+            max_fd = max(max_fd, server_fd);
+        }
+        for (auto& it : s_clients) {
+            FD_SET(it.key, &rfds);
+            max_fd = max(max_fd, it.key);
+        }
+
+        timeval timeout;
+        timeval* timeout_pointer = nullptr;
+        if (!s_queries.is_empty()) {
+            qword now = now_in_ms();
+            qword soonest = 0;
+            for (auto& it : s_queries) {
+                if (!soonest || it.value->deadline < soonest)
+                    soonest = it.value->deadline;
+            }
+            qword wait_ms = soonest > now ? soonest - now : 0;
+            timeout.tv_sec = wait_ms / 1000;
+            timeout.tv_usec = (wait_ms % 1000) * 1000;
+            timeout_pointer = &timeout;
+        }
+
+        rc = select(max_fd + 1, &rfds, nullptr, nullptr, timeout_pointer);
+        if (rc < 0) {
+            perror("select");
+            return 1;
+        }
+
+        if (FD_ISSET(s_dns_fd, &rfds))
+            handle_dns_response();
+
+        Vector<int> readable_clients;
+        for (auto& it : s_clients) {
+            if (FD_ISSET(it.key, &rfds))
+                readable_clients.append(it.key);
+        }
+        for (int client_fd : readable_clients) {
+            // An earlier one may have been answered and gone in the meantime, and its fd taken.
+            auto it = s_clients.find(client_fd);
+            if (it != s_clients.end())
+                handle_client(*(*it).value);
+        }
+
+        if (FD_ISSET(server_fd, &rfds)) {
+            sockaddr_un client_address;
+            socklen_t client_address_size = sizeof(client_address);
+            int client_fd = accept(server_fd, (sockaddr*)&client_address, &client_address_size);
+            if (client_fd < 0) {
+                perror("accept");
+            } else {
+                auto client = make<Client>();
+                client->fd = client_fd;
+                s_clients.set(client_fd, move(client));
+            }
+        }
+
+        handle_timeouts();
+    }
+    return 0;
 }
 
-static String parse_dns_name(const byte* data, int& offset, int max_offset)
+// Follows compression pointers, which count from the start of |data|. Returns a null string for a malformed name.
+static String parse_dns_name(const byte* data, int& offset, int size)
 {
-    Vector<char> buf;
-    while (offset < max_offset) {
-        byte ch = data[offset];
-        if (ch == '\0') {
-            ++offset;
-            break;
-        }
-        if ((ch & 0xc0) == 0xc0) {
-            // FIXME: Parse referential names.
-            offset += 2;
+    StringBuilder builder;
+    bool is_empty = true;
+    bool did_jump = false;
+    int jumps = 0;
+    int position = offset;
+    while (position < size) {
+        byte length = data[position];
+        if ((length & 0xc0) == 0xc0) {
+            if (position + 1 >= size || ++jumps > 16)
+                return { };
+            if (!did_jump)
+                offset = position + 2;
+            did_jump = true;
+            position = (length & 0x3f) << 8 | data[position + 1];
+            continue;
         }
-        for (int i = 0; i < ch; ++i) {
-            buf.append(data[offset + i + 1]);
+        ++position;
+        if (!length) {
+            if (!did_jump)
+                offset = position;
+            if (is_empty)
+                return String("");
+            return builder.to_string();
         }
-        buf.append('.');
-        offset += ch + 1;
+        if (position + length > size)
+            return { };
+        if (!is_empty)
+            builder.append('.');
+        builder.append((const char*)&data[position], length);
+        is_empty = false;
+        position += length;
     }
-    return String(buf.data(), buf.size());
+    return { };
 }
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <AK/Types.h>
+#include <AK/Vector.h>
+#include <WindowServer/WSAPITypes.h>
+#include <string.h>
+
+// A single-producer, single-consumer queue of messages living in a SharedBuffer.
+// Each message is stored as a dword length followed by its first WSAPI_wire_size() bytes, padded to a dword.
+// Once a client has its rings, the LocalSocket to the server only carries one-byte doorbell rings:
+// the producer rings when the consumer has announced it's going back to sleep,
+// and the consumer rings back when it drained a ring that the producer found full.
+// A stream of mouse moves or paints to a busy peer costs no syscalls at all.
+template<typename MessageType, dword capacity>
+struct WSAPI_MessageRing {
+    static_assert((capacity & (capacity - 1)) == 0, "Ring capacity must be a power of two");
+
+    dword head; // Byte offset of the next record to fill, only moved by the producer.
+    dword tail; // Byte offset of the next record to drain, only moved by the consumer.
+    dword consumer_is_sleeping;
+    dword producer_is_blocked;
+    byte data[capacity];
+
+    bool is_empty() const { return __atomic_load_n(&head, __ATOMIC_ACQUIRE) == __atomic_load_n(&tail, __ATOMIC_ACQUIRE); }
+
+    bool try_enqueue(const MessageType& message)
+    {
+        dword size = WSAPI_wire_size(message);
+        dword current_head = head;
+        if (capacity - (current_head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) < record_size(size))
+            return false;
+        copy_in(current_head, &size, sizeof(size));
+        copy_in(current_head + sizeof(size), &message, size);
+        __atomic_store_n(&head, current_head + record_size(size), __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // The other side is not trusted to get the lengths right, so anything odd just ends the conversation.
+    bool try_dequeue(MessageType& message)
+    {
+        dword current_tail = tail;
+        dword available = __atomic_load_n(&head, __ATOMIC_ACQUIRE) - current_tail;
+        if (!available)
+            return false;
+        dword size;
+        copy_out(current_tail, &size, sizeof(size));
+        ASSERT(size <= sizeof(MessageType) && record_size(size) <= available);
+        memset(&message, 0, sizeof(MessageType));
+        copy_out(current_tail + sizeof(size), &message, size);
+        __atomic_store_n(&tail, current_tail + record_size(size), __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Producer side. Messages that don't fit wait in |overflow| so ordering is kept.
+    // Returns true if the consumer needs its doorbell rung.
+    bool post(const MessageType& message, Vector<MessageType>& overflow)
+    {
+        if (overflow.is_empty() && try_enqueue(message))
+            return __atomic_exchange_n(&consumer_is_sleeping, 0, __ATOMIC_SEQ_CST);
+        overflow.append(message);
+        mark_producer_blocked(overflow);
+        return __atomic_exchange_n(&consumer_is_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    // Producer side, called when the consumer rings back. Returns true if the consumer needs its doorbell rung.
+    bool flush(Vector<MessageType>& overflow)
+    {
+        if (overflow.is_empty())
+            return false;
+        int sent = 0;
+        while (sent < overflow.size() && try_enqueue(overflow[sent]))
+            ++sent;
+        if (sent == overflow.size()) {
+            overflow.clear();
+        } else {
+            Vector<MessageType> remaining;
+            for (int i = sent; i < overflow.size(); ++i)
+                remaining.append(overflow[i]);
+            overflow = move(remaining);
+            mark_producer_blocked(overflow);
+        }
+        return sent && __atomic_exchange_n(&consumer_is_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    // Consumer side, takes up to |max_count| messages. Returns true if the producer was blocked and needs its doorbell rung.
+    template<typename Callback>
+    bool drain(Callback callback, int max_count = INT32_MAX)
+    {
+        bool drained_any = false;
+        MessageType message;
+        for (int count = 0; count < max_count && try_dequeue(message); ++count) {
+            callback(message);
+            drained_any = true;
+        }
+        return drained_any && __atomic_exchange_n(&producer_is_blocked, 0, __ATOMIC_SEQ_CST);
+    }
+
+    // Consumer side, called right before waiting on the socket. Returns false if there's already more to drain.
+    bool prepare_to_sleep()
+    {
+        __atomic_store_n(&consumer_is_sleeping, 1, __ATOMIC_SEQ_CST);
+        return is_empty();
+    }
+
+private:
+    static dword record_size(dword size) { return sizeof(dword) + ((size + 3) & ~3); }
+
+    void copy_in(dword offset, const void* source, dword size)
+    {
+        offset &= capacity - 1;
+        dword first_chunk = min(size, capacity - offset);
+        memcpy(data + offset, source, first_chunk);
+        memcpy(data, (const byte*)source + first_chunk, size - first_chunk);
+    }
+
+    void copy_out(dword offset, void* destination, dword size) const
+    {
+        offset &= capacity - 1;
+        dword first_chunk = min(size, capacity - offset);
+        memcpy(destination, data + offset, first_chunk);
+        memcpy((byte*)destination + first_chunk, data, size - first_chunk);
+    }
+
+    void mark_producer_blocked(Vector<MessageType>& overflow)
+    {
+        __atomic_store_n(&producer_is_blocked, 1, __ATOMIC_SEQ_CST);
+        // The consumer may have emptied the ring before it could see the flag, so look again.
+        if (!is_empty())
+            return;
+        __atomic_store_n(&producer_is_blocked, 0, __ATOMIC_SEQ_CST);
+        flush(overflow);
+    }
+};
+
+struct WSAPI_MessageRings {
+    WSAPI_MessageRing<WSAPI_ClientMessage, 32 * KB> to_server;
+    WSAPI_MessageRing<WSAPI_ServerMessage, 32 * KB> to_client;
+};
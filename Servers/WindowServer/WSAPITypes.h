@@ -5,6 +5,9 @@
 
 typedef unsigned WSAPI_Color;
 
+// How many rects an InvalidateRect, Paint or DidFinishPainting message can carry.
+#define WSAPI_MAX_RECTS_PER_MESSAGE 16
+
 struct WSAPI_Point {
     int x;
     int y;
@@ -70,15 +73,12 @@ struct WSAPI_ServerMessage {
         WindowResized,
         WindowCloseRequest,
         MenuItemActivated,
-        DidCreateMenubar,
         DidDestroyMenubar,
-        DidCreateMenu,
         DidDestroyMenu,
         DidAddMenuToMenubar,
         DidSetApplicationMenubar,
         DidAddMenuItem,
         DidAddMenuSeparator,
-        DidCreateWindow,
         DidDestroyWindow,
         DidGetWindowTitle,
         DidGetWindowRect,
@@ -89,23 +89,26 @@ struct WSAPI_ServerMessage {
         DidSetWindowBackingStore,
         DidSetWallpaper,
         DidGetWallpaper,
+        DidCreateMessageRings,
+        DidGetCompositorStats,
+        DidGetClientTrafficStats,
     };
     Type type { Invalid };
     int window_id { -1 };
-    int text_length { 0 };
-    char text[256];
     int value { 0 };
 
     union {
         struct {
             int server_pid;
         } greeting;
+        struct {
+            int shared_buffer_id;
+        } message_rings;
         struct {
             WSAPI_Rect rect;
             WSAPI_Rect old_rect;
         } window;
         struct {
-            WSAPI_Rect rect;
             WSAPI_Size window_size;
         } paint;
         struct {
@@ -133,11 +136,38 @@ struct WSAPI_ServerMessage {
             size_t pitch;
             int shared_buffer_id;
             bool has_alpha_channel;
+            int flip_sequence;
         } backing;
         struct {
             int shared_buffer_id;
             int contents_size;
         } clipboard;
+        struct {
+            unsigned compose_count;
+            int compose_time_us;
+            int flush_time_us;
+            int rect_count;
+            int pixels_blitted;
+            int pixels_blended;
+            int frames_per_second;
+            int client_count;
+        } compositor_stats;
+        // Per second, over the last whole second.
+        struct {
+            int client_pid;
+            int messages_received;
+            int bytes_received;
+            int messages_sent;
+            int bytes_sent;
+        } traffic;
+    };
+
+    // The variable-length tail: text or rects, never both. Keep it last, only the part in use goes over the wire.
+    int text_length { 0 };
+    int rect_count { 0 };
+    union {
+        char text[256];
+        WSAPI_Rect rects[WSAPI_MAX_RECTS_PER_MESSAGE];
     };
 };
 
@@ -170,11 +200,12 @@ struct WSAPI_ClientMessage {
         SetWallpaper,
         GetWallpaper,
         SetWindowOverrideCursor,
+        GetCompositorStats,
+        // |value| is which client, from 0 up to the client_count in the compositor stats.
+        GetClientTrafficStats,
     };
     Type type { Invalid };
     int window_id { -1 };
-    int text_length { 0 };
-    char text[256];
     int value { 0 };
 
     union {
@@ -204,6 +235,7 @@ struct WSAPI_ClientMessage {
             int shared_buffer_id;
             bool has_alpha_channel;
             bool flush_immediately;
+            int flip_sequence;
         } backing;
         struct {
             int shared_buffer_id;
@@ -213,8 +245,29 @@ struct WSAPI_ClientMessage {
             WSAPI_StandardCursor cursor;
         } cursor;
     };
+
+    // The variable-length tail: text or rects, never both. Keep it last, only the part in use goes over the wire.
+    int text_length { 0 };
+    int rect_count { 0 };
+    union {
+        char text[256];
+        WSAPI_Rect rects[WSAPI_MAX_RECTS_PER_MESSAGE];
+    };
 };
 
+// How many bytes of a message are worth sending: everything up to the tail, and as much of it as is in use.
+// This keeps a MouseMove at a few dozen bytes. Big payloads (clipboard contents, backing stores) go in shared buffers.
+template<typename MessageType>
+inline int WSAPI_wire_size(const MessageType& message)
+{
+    int tail_size;
+    if (message.rect_count > 0)
+        tail_size = min(message.rect_count, WSAPI_MAX_RECTS_PER_MESSAGE) * (int)sizeof(WSAPI_Rect);
+    else
+        tail_size = min(max(message.text_length, 0), (int)sizeof(message.text));
+    return (int)((const char*)message.text - (const char*)&message) + tail_size;
+}
+
 inline Rect::Rect(const WSAPI_Rect& r) : Rect(r.location, r.size) { }
 inline Point::Point(const WSAPI_Point& p) : Point(p.x, p.y) { }
 inline Size::Size(const WSAPI_Size& s) : Size(s.width, s.height) { }
@@ -6,6 +6,7 @@
 #include <WindowServer/WSWindow.h>
 #include <WindowServer/WSWindowManager.h>
 #include <WindowServer/WSAPITypes.h>
+#include <WindowServer/WSAPIMessageRing.h>
 #include <WindowServer/WSClipboard.h>
 #include <SharedBuffer.h>
 #include <sys/ioctl.h>
@@ -68,9 +69,62 @@ void WSClientConnection::post_error(const String& error_message)
     post_message(message);
 }
 
+void WSClientConnection::set_up_message_rings()
+{
+    ASSERT(!m_message_rings);
+    ASSERT(m_pid != -1);
+    WSAPI_ServerMessage message;
+    message.type = WSAPI_ServerMessage::Type::DidCreateMessageRings;
+    message.message_rings.shared_buffer_id = -1;
+    m_message_rings_buffer = SharedBuffer::create(m_pid, sizeof(WSAPI_MessageRings));
+    if (m_message_rings_buffer) {
+        memset(m_message_rings_buffer->data(), 0, sizeof(WSAPI_MessageRings));
+        message.message_rings.shared_buffer_id = m_message_rings_buffer->shared_buffer_id();
+    }
+    // This is the last message that goes over the socket, if we got a buffer. Otherwise we just stay on the socket.
+    post_message(message);
+    if (m_message_rings_buffer)
+        m_message_rings = (WSAPI_MessageRings*)m_message_rings_buffer->data();
+}
+
+void WSClientConnection::ring_doorbell()
+{
+    byte doorbell = 0;
+    int nwritten = write(m_fd, &doorbell, sizeof(doorbell));
+    // A full socket has rings in it the client hasn't gotten to yet, so this one isn't needed.
+    if (nwritten < 0 && errno != EPIPE && errno != EAGAIN) {
+        perror("WSClientConnection::ring_doorbell write");
+        ASSERT_NOT_REACHED();
+    }
+}
+
+void WSClientConnection::flush_overflow_messages()
+{
+    ASSERT(m_message_rings);
+    if (m_message_rings->to_client.flush(m_overflow_messages))
+        ring_doorbell();
+}
+
+void WSClientConnection::sample_traffic()
+{
+    m_traffic_per_second = m_traffic;
+    m_traffic = { };
+}
+
 void WSClientConnection::post_message(const WSAPI_ServerMessage& message)
 {
-    int nwritten = write(m_fd, &message, sizeof(message));
+    ++m_traffic.messages_sent;
+    m_traffic.bytes_sent += WSAPI_wire_size(message);
+
+    if (m_message_rings) {
+        if (m_message_rings->to_client.post(message, m_overflow_messages))
+            ring_doorbell();
+        return;
+    }
+
+    // Each message is a packet of its own, so only the part of it that's in use needs to go.
+    int size = WSAPI_wire_size(message);
+    int nwritten = write(m_fd, &message, size);
     if (nwritten < 0) {
         if (errno == EPIPE) {
             dbgprintf("WSClientConnection::post_message: Disconnected from peer.\n");
@@ -80,7 +134,7 @@ void WSClientConnection::post_message(const WSAPI_ServerMessage& message)
         ASSERT_NOT_REACHED();
     }
 
-    ASSERT(nwritten == sizeof(message));
+    ASSERT(nwritten == size);
 }
 
 void WSClientConnection::on_message(WSMessage& message)
@@ -98,15 +152,15 @@ void WSClientConnection::on_message(WSMessage& message)
     }
 }
 
-void WSClientConnection::handle_request(WSAPICreateMenubarRequest&)
+void WSClientConnection::handle_request(WSAPICreateMenubarRequest& request)
 {
-    int menubar_id = m_next_menubar_id++;
+    int menubar_id = request.menubar_id();
+    if (menubar_id <= 0 || m_menubars.contains(menubar_id)) {
+        post_error("Bad menubar ID");
+        return;
+    }
     auto menubar = make<WSMenuBar>(*this, menubar_id);
     m_menubars.set(menubar_id, move(menubar));
-    WSAPI_ServerMessage response;
-    response.type = WSAPI_ServerMessage::Type::DidCreateMenubar;
-    response.menu.menubar_id = menubar_id;
-    post_message(response);
 }
 
 void WSClientConnection::handle_request(WSAPIDestroyMenubarRequest& request)
@@ -128,13 +182,13 @@ void WSClientConnection::handle_request(WSAPIDestroyMenubarRequest& request)
 
 void WSClientConnection::handle_request(WSAPICreateMenuRequest& request)
 {
-    int menu_id = m_next_menu_id++;
+    int menu_id = request.menu_id();
+    if (menu_id <= 0 || m_menus.contains(menu_id)) {
+        post_error("Bad menu ID");
+        return;
+    }
     auto menu = make<WSMenu>(this, menu_id, request.text());
     m_menus.set(menu_id, move(menu));
-    WSAPI_ServerMessage response;
-    response.type = WSAPI_ServerMessage::Type::DidCreateMenu;
-    response.menu.menu_id = menu_id;
-    post_message(response);
 }
 
 void WSClientConnection::handle_request(WSAPIDestroyMenuRequest& request)
@@ -243,11 +297,17 @@ void WSClientConnection::handle_request(WSAPISetWindowOpacityRequest& request)
 
 void WSClientConnection::handle_request(WSAPISetWallpaperRequest& request)
 {
-    bool success = WSWindowManager::the().set_wallpaper(request.wallpaper());
-    WSAPI_ServerMessage response;
-    response.type = WSAPI_ServerMessage::Type::DidSetWallpaper;
-    response.value = success;
-    post_message(response);
+    int client_id = request.client_id();
+    WSWindowManager::the().set_wallpaper(request.wallpaper(), [client_id] (bool success) {
+        // The client may have gone away while the wallpaper was decoding.
+        auto* client = WSClientConnection::from_client_id(client_id);
+        if (!client)
+            return;
+        WSAPI_ServerMessage response;
+        response.type = WSAPI_ServerMessage::Type::DidSetWallpaper;
+        response.value = success;
+        client->post_message(response);
+    });
 }
 
 void WSClientConnection::handle_request(WSAPIGetWallpaperRequest& request)
@@ -261,6 +321,46 @@ void WSClientConnection::handle_request(WSAPIGetWallpaperRequest& request)
     post_message(response);
 }
 
+void WSClientConnection::handle_request(WSAPIGetCompositorStatsRequest&)
+{
+    auto& wm = WSWindowManager::the();
+    auto& stats = wm.last_frame_stats();
+    WSAPI_ServerMessage response;
+    response.type = WSAPI_ServerMessage::Type::DidGetCompositorStats;
+    response.compositor_stats.compose_count = stats.compose_count;
+    response.compositor_stats.compose_time_us = stats.compose_time_us;
+    response.compositor_stats.flush_time_us = stats.flush_time_us;
+    response.compositor_stats.rect_count = stats.rect_count;
+    response.compositor_stats.pixels_blitted = stats.pixels_blitted;
+    response.compositor_stats.pixels_blended = stats.pixels_blended;
+    response.compositor_stats.frames_per_second = wm.frames_per_second();
+    response.compositor_stats.client_count = s_connections ? s_connections->size() : 0;
+    post_message(response);
+}
+
+void WSClientConnection::handle_request(WSAPIGetClientTrafficStatsRequest& request)
+{
+    WSClientConnection* client = nullptr;
+    int index = 0;
+    for_each_client([&] (WSClientConnection& connection) {
+        if (index++ == request.client_index())
+            client = &connection;
+    });
+    WSAPI_ServerMessage response;
+    response.type = WSAPI_ServerMessage::Type::DidGetClientTrafficStats;
+    // Clients come and go, so asking for one past the end isn't an error. It just gets a 0 value.
+    response.value = client != nullptr;
+    if (client) {
+        auto& traffic = client->traffic_per_second();
+        response.traffic.client_pid = client->pid();
+        response.traffic.messages_received = traffic.messages_received;
+        response.traffic.bytes_received = traffic.bytes_received;
+        response.traffic.messages_sent = traffic.messages_sent;
+        response.traffic.bytes_sent = traffic.bytes_sent;
+    }
+    post_message(response);
+}
+
 void WSClientConnection::handle_request(WSAPISetWindowTitleRequest& request)
 {
     int window_id = request.window_id();
@@ -340,13 +440,12 @@ void WSClientConnection::handle_request(WSAPIGetClipboardContentsRequest&)
     response.clipboard.shared_buffer_id = -1;
     response.clipboard.contents_size = 0;
     if (WSClipboard::the().size()) {
-        // FIXME: Optimize case where an app is copy/pasting within itself.
-        //        We can just reuse the SharedBuffer then, since it will have the same peer PID.
-        //        It would be even nicer if a SharedBuffer could have an arbitrary number of clients..
-        RetainPtr<SharedBuffer> shared_buffer = SharedBuffer::create(m_pid, WSClipboard::the().size());
-        ASSERT(shared_buffer);
-        memcpy(shared_buffer->data(), WSClipboard::the().data(), WSClipboard::the().size());
-        shared_buffer->seal();
+        // The clipboard is already a sealed buffer, just let this client in on it too instead of copying it.
+        RetainPtr<SharedBuffer> shared_buffer = WSClipboard::the().shared_buffer();
+        if (!shared_buffer->share_with(m_pid)) {
+            post_message(response);
+            return;
+        }
         response.clipboard.shared_buffer_id = shared_buffer->shared_buffer_id();
         response.clipboard.contents_size = WSClipboard::the().size();
 
@@ -359,7 +458,11 @@ void WSClientConnection::handle_request(WSAPIGetClipboardContentsRequest&)
 
 void WSClientConnection::handle_request(WSAPICreateWindowRequest& request)
 {
-    int window_id = m_next_window_id++;
+    int window_id = request.window_id();
+    if (window_id <= 0 || m_windows.contains(window_id)) {
+        post_error("Bad window ID");
+        return;
+    }
     auto window = make<WSWindow>(*this, window_id, request.is_modal());
     window->set_has_alpha_channel(request.has_alpha_channel());
     window->set_resizable(request.is_resizable());
@@ -370,10 +473,6 @@ void WSClientConnection::handle_request(WSAPICreateWindowRequest& request)
     window->set_base_size(request.base_size());
     window->invalidate();
     m_windows.set(window_id, move(window));
-    WSAPI_ServerMessage response;
-    response.type = WSAPI_ServerMessage::Type::DidCreateWindow;
-    response.window_id = window_id;
-    post_message(response);
 }
 
 void WSClientConnection::handle_request(WSAPIDestroyWindowRequest& request)
@@ -398,11 +497,15 @@ void WSClientConnection::handle_request(WSAPIInvalidateRectRequest& request)
         return;
     }
     auto& window = *(*it).value;
+    // Answer the whole batch with one Paint, the client sent no more rects than fit in one.
+    ASSERT(request.rects().size() <= WSAPI_MAX_RECTS_PER_MESSAGE);
     WSAPI_ServerMessage response;
     response.type = WSAPI_ServerMessage::Type::Paint;
     response.window_id = window_id;
-    response.paint.rect = request.rect();
     response.paint.window_size = window.size();
+    response.rect_count = request.rects().size();
+    for (int i = 0; i < request.rects().size(); ++i)
+        response.rects[i] = request.rects()[i];
     post_message(response);
 }
 
@@ -416,13 +519,16 @@ void WSClientConnection::handle_request(WSAPIDidFinishPaintingNotification& requ
     }
     auto& window = *(*it).value;
 
-    if (!window.has_painted_since_last_resize()) {
-        if (window.last_lazy_resize_rect().size() == request.rect().size()) {
-            window.set_has_painted_since_last_resize(true);
-            WSMessageLoop::the().post_message(window, make<WSResizeEvent>(window.last_lazy_resize_rect(), window.rect()));
+    for (auto& rect : request.rects()) {
+        if (!window.has_painted_since_last_resize()) {
+            if (window.last_lazy_resize_rect().size() == rect.size()) {
+                window.set_has_painted_since_last_resize(true);
+                WSMessageLoop::the().post_message(window, make<WSResizeEvent>(window.last_lazy_resize_rect(), window.rect()));
+            }
         }
+        window.did_damage_contents(rect);
+        WSWindowManager::the().invalidate(window, rect);
     }
-    WSWindowManager::the().invalidate(window, request.rect());
 }
 
 void WSClientConnection::handle_request(WSAPIGetWindowBackingStoreRequest& request)
@@ -456,12 +562,16 @@ void WSClientConnection::handle_request(WSAPISetWindowBackingStoreRequest& reque
         return;
     }
     auto& window = *(*it).value;
-    if (window.last_backing_store() && window.last_backing_store()->shared_buffer_id() == request.shared_buffer_id()) {
-        window.swap_backing_stores();
-    } else {
-        auto shared_buffer = SharedBuffer::create_from_shared_buffer_id(request.shared_buffer_id());
+    if (!window.reuse_backing_store(request.shared_buffer_id(), request.size())) {
+        RetainPtr<SharedBuffer> shared_buffer = window.mapped_shared_buffer(request.shared_buffer_id());
         if (!shared_buffer)
+            shared_buffer = SharedBuffer::create_from_shared_buffer_id(request.shared_buffer_id());
+        if (!shared_buffer)
+            return;
+        if (shared_buffer->size() < request.size().area() * (int)sizeof(RGBA32)) {
+            post_error("Backing store too small");
             return;
+        }
         auto backing_store = GraphicsBitmap::create_with_shared_buffer(
             request.has_alpha_channel() ? GraphicsBitmap::Format::RGBA32 : GraphicsBitmap::Format::RGB32,
             *shared_buffer,
@@ -476,6 +586,8 @@ void WSClientConnection::handle_request(WSAPISetWindowBackingStoreRequest& reque
     response.type = WSAPI_ServerMessage::Type::DidSetWindowBackingStore;
     response.window_id = window_id;
     response.backing.shared_buffer_id = request.shared_buffer_id();
+    // Once a client sees this, we're done reading whatever it had up before, and it can draw there again.
+    response.backing.flip_sequence = request.flip_sequence();
     post_message(response);
 }
 
@@ -556,6 +668,10 @@ void WSClientConnection::on_request(WSAPIClientRequest& request)
         return handle_request(static_cast<WSAPIGetWallpaperRequest&>(request));
     case WSMessage::APISetWindowOverrideCursorRequest:
         return handle_request(static_cast<WSAPISetWindowOverrideCursorRequest&>(request));
+    case WSMessage::APIGetCompositorStatsRequest:
+        return handle_request(static_cast<WSAPIGetCompositorStatsRequest&>(request));
+    case WSMessage::APIGetClientTrafficStatsRequest:
+        return handle_request(static_cast<WSAPIGetClientTrafficStatsRequest&>(request));
     default:
         break;
     }
@@ -12,6 +12,7 @@ class WSWindow;
 class WSMenu;
 class WSMenuBar;
 struct WSAPI_ServerMessage;
+struct WSAPI_MessageRings;
 
 class WSClientConnection final : public WSMessageReceiver {
 public:
@@ -33,6 +34,27 @@ public:
 
     void set_client_pid(pid_t pid) { m_pid = pid; }
 
+    // Moves the conversation off the socket and into a pair of rings shared with the client.
+    void set_up_message_rings();
+    WSAPI_MessageRings* message_rings() { return m_message_rings; }
+    void ring_doorbell();
+    void flush_overflow_messages();
+
+    // IPC traffic, counted as it goes and turned into per second figures by sample_traffic(), once a second.
+    struct TrafficStats {
+        int messages_received { 0 };
+        int bytes_received { 0 };
+        int messages_sent { 0 };
+        int bytes_sent { 0 };
+    };
+    void did_receive_message(int bytes)
+    {
+        ++m_traffic.messages_received;
+        m_traffic.bytes_received += bytes;
+    }
+    void sample_traffic();
+    const TrafficStats& traffic_per_second() const { return m_traffic_per_second; }
+
     template<typename Matching, typename Callback> void for_each_window_matching(Matching, Callback);
     template<typename Callback> void for_each_window(Callback);
 
@@ -65,6 +87,8 @@ private:
     void handle_request(WSAPISetWallpaperRequest&);
     void handle_request(WSAPIGetWallpaperRequest&);
     void handle_request(WSAPISetWindowOverrideCursorRequest&);
+    void handle_request(WSAPIGetCompositorStatsRequest&);
+    void handle_request(WSAPIGetClientTrafficStatsRequest&);
 
     void post_error(const String&);
 
@@ -72,16 +96,20 @@ private:
     int m_fd { -1 };
     pid_t m_pid { -1 };
 
+    // The IDs of all three are picked by the client, so it doesn't have to wait to hear them.
     HashMap<int, OwnPtr<WSWindow>> m_windows;
     HashMap<int, OwnPtr<WSMenuBar>> m_menubars;
     HashMap<int, OwnPtr<WSMenu>> m_menus;
     WeakPtr<WSMenuBar> m_app_menubar;
 
-    int m_next_menubar_id { 10000 };
-    int m_next_menu_id { 20000 };
-    int m_next_window_id { 1982 };
-
     RetainPtr<SharedBuffer> m_last_sent_clipboard_content;
+
+    RetainPtr<SharedBuffer> m_message_rings_buffer;
+    WSAPI_MessageRings* m_message_rings { nullptr };
+    Vector<WSAPI_ServerMessage> m_overflow_messages;
+
+    TrafficStats m_traffic;
+    TrafficStats m_traffic_per_second;
 };
 
 template<typename Matching, typename Callback>
@@ -15,6 +15,7 @@ public:
     }
 
     const byte* data() const;
+    SharedBuffer* shared_buffer() { return m_shared_buffer.ptr(); }
     int size() const;
 
     void clear();
@@ -0,0 +1,112 @@
+#include <WindowServer/WSCompositorPool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//#define COMPOSITOR_POOL_DEBUG
+
+// The kernel reports "cpus: N (M in use)", only the M processors that are actually scheduling threads help.
+static int processors_in_use()
+{
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if (!fp)
+        return 1;
+    int count = 1;
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "cpus:", 5))
+            continue;
+        auto* in_use = strchr(line, '(');
+        if (in_use)
+            count = max(atoi(in_use + 1), 1);
+        break;
+    }
+    fclose(fp);
+    return count;
+}
+
+WSCompositorPool& WSCompositorPool::the()
+{
+    static WSCompositorPool* s_the;
+    if (!s_the)
+        s_the = new WSCompositorPool;
+    return *s_the;
+}
+
+WSCompositorPool::WSCompositorPool()
+{
+    pthread_mutex_init(&m_lock, nullptr);
+    pthread_cond_init(&m_work_available, nullptr);
+    pthread_cond_init(&m_jobs_finished, nullptr);
+
+    int worker_count = processors_in_use() - 1;
+    for (int i = 0; i < worker_count; ++i) {
+        pthread_t thread;
+        int rc = pthread_create(&thread, nullptr, worker_main, this);
+        if (rc) {
+            dbgprintf("WSCompositorPool: pthread_create failed: %s\n", strerror(rc));
+            break;
+        }
+        m_workers.append(thread);
+    }
+#ifdef COMPOSITOR_POOL_DEBUG
+    dbgprintf("WSCompositorPool: %d worker(s)\n", m_workers.size());
+#endif
+}
+
+void* WSCompositorPool::worker_main(void* argument)
+{
+    auto& pool = *(WSCompositorPool*)argument;
+    pthread_mutex_lock(&pool.m_lock);
+    dword seen_generation = pool.m_generation;
+    for (;;) {
+        while (pool.m_generation == seen_generation)
+            pthread_cond_wait(&pool.m_work_available, &pool.m_lock);
+        seen_generation = pool.m_generation;
+        pthread_mutex_unlock(&pool.m_lock);
+        pool.run_available_jobs();
+        pthread_mutex_lock(&pool.m_lock);
+    }
+}
+
+void WSCompositorPool::run_available_jobs()
+{
+    for (;;) {
+        int index = __atomic_fetch_add(&m_next_job, 1, __ATOMIC_ACQUIRE);
+        if (index >= m_job_count)
+            return;
+        m_job_function(m_job_context, index);
+        if (__atomic_sub_fetch(&m_unfinished_jobs, 1, __ATOMIC_ACQ_REL))
+            continue;
+        pthread_mutex_lock(&m_lock);
+        pthread_cond_broadcast(&m_jobs_finished);
+        pthread_mutex_unlock(&m_lock);
+    }
+}
+
+void WSCompositorPool::run_jobs(int job_count, JobFunction function, void* context)
+{
+    if (m_workers.is_empty() || job_count <= 1) {
+        for (int i = 0; i < job_count; ++i)
+            function(context, i);
+        return;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_job_function = function;
+    m_job_context = context;
+    m_job_count = job_count;
+    __atomic_store_n(&m_unfinished_jobs, job_count, __ATOMIC_RELAXED);
+    // A worker still on its way out of the last batch may grab a job as soon as this is reset, so it goes last.
+    __atomic_store_n(&m_next_job, 0, __ATOMIC_RELEASE);
+    ++m_generation;
+    pthread_cond_broadcast(&m_work_available);
+    pthread_mutex_unlock(&m_lock);
+
+    run_available_jobs();
+
+    pthread_mutex_lock(&m_lock);
+    while (__atomic_load_n(&m_unfinished_jobs, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&m_jobs_finished, &m_lock);
+    pthread_mutex_unlock(&m_lock);
+}
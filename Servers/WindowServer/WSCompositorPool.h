@@ -0,0 +1,43 @@
+#pragma once
+
+#include <AK/Vector.h>
+#include <pthread.h>
+
+// Worker threads that compose the screen in bands alongside the WindowServer thread.
+// There's one worker for each processor in use besides ours, so on a uniprocessor everything just runs inline.
+class WSCompositorPool {
+public:
+    static WSCompositorPool& the();
+
+    int thread_count() const { return m_workers.size() + 1; }
+
+    // Calls callback(index) once for each index in [0, job_count) and returns when they've all finished.
+    // The calling thread takes jobs too. Jobs may run in any order and at the same time.
+    template<typename Callback>
+    void run(int job_count, Callback& callback)
+    {
+        run_jobs(job_count, [] (void* context, int index) { (*(Callback*)context)(index); }, &callback);
+    }
+
+private:
+    typedef void (*JobFunction)(void* context, int index);
+
+    WSCompositorPool();
+
+    void run_jobs(int job_count, JobFunction, void* context);
+    void run_available_jobs();
+    static void* worker_main(void*);
+
+    Vector<pthread_t> m_workers;
+
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_work_available;
+    pthread_cond_t m_jobs_finished;
+    dword m_generation { 0 };
+
+    JobFunction m_job_function { nullptr };
+    void* m_job_context { nullptr };
+    int m_job_count { 0 };
+    int m_next_job { 0 };
+    int m_unfinished_jobs { 0 };
+};
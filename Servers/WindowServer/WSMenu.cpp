@@ -58,6 +58,8 @@ void WSMenu::redraw()
 WSWindow& WSMenu::ensure_menu_window()
 {
     if (!m_menu_window) {
+        // Measuring every item is the expensive part, so only do it once.
+        int menu_width = width();
         Point next_item_location(1, vertical_padding() / 2);
         for (auto& item : m_items) {
             int height = 0;
@@ -65,13 +67,13 @@ WSWindow& WSMenu::ensure_menu_window()
                 height = item_height();
             else if (item->type() == WSMenuItem::Separator)
                 height = 7;
-            item->set_rect({ next_item_location, { width() - 2, height } });
+            item->set_rect({ next_item_location, { menu_width - 2, height } });
             next_item_location.move_by(0, height);
         }
 
         auto window = make<WSWindow>(*this, WSWindowType::Menu);
         window->set_opacity(0.95f);
-        window->set_rect(0, 0, width(), height());
+        window->set_rect(0, 0, menu_width, height());
         m_menu_window = move(window);
         draw();
     }
@@ -101,7 +103,7 @@ void WSMenu::draw()
             }
         } else if (item->type() == WSMenuItem::Separator) {
             Point p1(1, item->rect().center().y());
-            Point p2(width() - 2, item->rect().center().y());
+            Point p2(rect.width() - 2, item->rect().center().y());
             painter.draw_line(p1, p2, Color::MidGray);
         }
     }
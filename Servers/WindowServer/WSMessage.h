@@ -4,6 +4,7 @@
 #include <SharedGraphics/Rect.h>
 #include <AK/AKString.h>
 #include <AK/Types.h>
+#include <AK/Vector.h>
 #include <Kernel/KeyCode.h>
 #include <WindowServer/WSCursor.h>
 
@@ -51,6 +52,8 @@ public:
         APISetWallpaperRequest,
         APIGetWallpaperRequest,
         APISetWindowOverrideCursorRequest,
+        APIGetCompositorStatsRequest,
+        APIGetClientTrafficStatsRequest,
         __End_API_Client_Requests,
     };
 
@@ -115,10 +118,16 @@ private:
 
 class WSAPICreateMenubarRequest : public WSAPIClientRequest {
 public:
-    WSAPICreateMenubarRequest(int client_id)
+    WSAPICreateMenubarRequest(int client_id, int menubar_id)
         : WSAPIClientRequest(WSMessage::APICreateMenubarRequest, client_id)
+        , m_menubar_id(menubar_id)
     {
     }
+
+    int menubar_id() const { return m_menubar_id; }
+
+private:
+    int m_menubar_id { 0 };
 };
 
 class WSAPIDestroyMenubarRequest : public WSAPIClientRequest {
@@ -168,15 +177,18 @@ private:
 
 class WSAPICreateMenuRequest : public WSAPIClientRequest {
 public:
-    WSAPICreateMenuRequest(int client_id, const String& text)
+    WSAPICreateMenuRequest(int client_id, int menu_id, const String& text)
         : WSAPIClientRequest(WSMessage::APICreateMenuRequest, client_id)
+        , m_menu_id(menu_id)
         , m_text(text)
     {
     }
 
+    int menu_id() const { return m_menu_id; }
     String text() const { return m_text; }
 
 private:
+    int m_menu_id { 0 };
     String m_text;
 };
 
@@ -279,6 +291,28 @@ private:
     int m_client_id { 0 };
 };
 
+class WSAPIGetCompositorStatsRequest final : public WSAPIClientRequest {
+public:
+    explicit WSAPIGetCompositorStatsRequest(int client_id)
+        : WSAPIClientRequest(WSMessage::APIGetCompositorStatsRequest, client_id)
+    {
+    }
+};
+
+class WSAPIGetClientTrafficStatsRequest final : public WSAPIClientRequest {
+public:
+    WSAPIGetClientTrafficStatsRequest(int client_id, int client_index)
+        : WSAPIClientRequest(WSMessage::APIGetClientTrafficStatsRequest, client_id)
+        , m_client_index(client_index)
+    {
+    }
+
+    int client_index() const { return m_client_index; }
+
+private:
+    int m_client_index { 0 };
+};
+
 class WSAPISetWindowTitleRequest final : public WSAPIClientRequest {
 public:
     explicit WSAPISetWindowTitleRequest(int client_id, int window_id, String&& title)
@@ -372,7 +406,7 @@ private:
 
 class WSAPISetWindowBackingStoreRequest final : public WSAPIClientRequest {
 public:
-    explicit WSAPISetWindowBackingStoreRequest(int client_id, int window_id, int shared_buffer_id, const Size& size, size_t bpp, size_t pitch, bool has_alpha_channel, bool flush_immediately)
+    explicit WSAPISetWindowBackingStoreRequest(int client_id, int window_id, int shared_buffer_id, const Size& size, size_t bpp, size_t pitch, bool has_alpha_channel, bool flush_immediately, int flip_sequence)
         : WSAPIClientRequest(WSMessage::APISetWindowBackingStoreRequest, client_id)
         , m_client_id(client_id)
         , m_window_id(window_id)
@@ -382,6 +416,7 @@ public:
         , m_pitch(pitch)
         , m_has_alpha_channel(has_alpha_channel)
         , m_flush_immediately(flush_immediately)
+        , m_flip_sequence(flip_sequence)
     {
     }
 
@@ -393,6 +428,7 @@ public:
     size_t pitch() const { return m_pitch; }
     bool has_alpha_channel() const { return m_has_alpha_channel; }
     bool flush_immediately() const { return m_flush_immediately; }
+    int flip_sequence() const { return m_flip_sequence; }
 
 private:
     int m_client_id { 0 };
@@ -403,6 +439,7 @@ private:
     size_t m_pitch;
     bool m_has_alpha_channel;
     bool m_flush_immediately;
+    int m_flip_sequence { 0 };
 };
 
 class WSAPISetWindowRectRequest final : public WSAPIClientRequest {
@@ -444,8 +481,9 @@ private:
 
 class WSAPICreateWindowRequest : public WSAPIClientRequest {
 public:
-    WSAPICreateWindowRequest(int client_id, const Rect& rect, const String& title, bool has_alpha_channel, bool modal, bool resizable, float opacity, const Size& base_size, const Size& size_increment)
+    WSAPICreateWindowRequest(int client_id, int window_id, const Rect& rect, const String& title, bool has_alpha_channel, bool modal, bool resizable, float opacity, const Size& base_size, const Size& size_increment)
         : WSAPIClientRequest(WSMessage::APICreateWindowRequest, client_id)
+        , m_window_id(window_id)
         , m_rect(rect)
         , m_title(title)
         , m_opacity(opacity)
@@ -457,6 +495,7 @@ public:
     {
     }
 
+    int window_id() const { return m_window_id; }
     Rect rect() const { return m_rect; }
     String title() const { return m_title; }
     bool has_alpha_channel() const { return m_has_alpha_channel; }
@@ -467,6 +506,7 @@ public:
     Size base_size() const { return m_base_size; }
 
 private:
+    int m_window_id { 0 };
     Rect m_rect;
     String m_title;
     float m_opacity { 0 };
@@ -493,19 +533,19 @@ private:
 
 class WSAPIInvalidateRectRequest final : public WSAPIClientRequest {
 public:
-    explicit WSAPIInvalidateRectRequest(int client_id, int window_id, const Rect& rect)
+    explicit WSAPIInvalidateRectRequest(int client_id, int window_id, Vector<Rect>&& rects)
         : WSAPIClientRequest(WSMessage::APIInvalidateRectRequest, client_id)
         , m_window_id(window_id)
-        , m_rect(rect)
+        , m_rects(move(rects))
     {
     }
 
     int window_id() const { return m_window_id; }
-    Rect rect() const { return m_rect; }
+    const Vector<Rect>& rects() const { return m_rects; }
 
 private:
     int m_window_id { 0 };
-    Rect m_rect;
+    Vector<Rect> m_rects;
 };
 
 class WSAPIGetWindowBackingStoreRequest final : public WSAPIClientRequest {
@@ -524,19 +564,19 @@ private:
 
 class WSAPIDidFinishPaintingNotification final : public WSAPIClientRequest {
 public:
-    explicit WSAPIDidFinishPaintingNotification(int client_id, int window_id, const Rect& rect)
+    explicit WSAPIDidFinishPaintingNotification(int client_id, int window_id, Vector<Rect>&& rects)
         : WSAPIClientRequest(WSMessage::APIDidFinishPaintingNotification, client_id)
         , m_window_id(window_id)
-        , m_rect(rect)
+        , m_rects(move(rects))
     {
     }
 
     int window_id() const { return m_window_id; }
-    Rect rect() const { return m_rect; }
+    const Vector<Rect>& rects() const { return m_rects; }
 
 private:
     int m_window_id { 0 };
-    Rect m_rect;
+    Vector<Rect> m_rects;
 };
 
 enum class MouseButton : byte {
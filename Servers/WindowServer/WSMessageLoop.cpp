@@ -5,11 +5,13 @@
 #include <WindowServer/WSScreen.h>
 #include <WindowServer/WSClientConnection.h>
 #include <WindowServer/WSAPITypes.h>
+#include <WindowServer/WSAPIMessageRing.h>
 #include <WindowServer/WSCursor.h>
+#include <SharedGraphics/ImageDecoder.h>
 #include <Kernel/KeyCode.h>
 #include <Kernel/MousePacket.h>
 #include <LibC/sys/socket.h>
-#include <LibC/sys/select.h>
+#include <LibC/sys/epoll.h>
 #include <LibC/sys/time.h>
 #include <LibC/time.h>
 #include <LibC/unistd.h>
@@ -21,6 +23,37 @@
 
 static WSMessageLoop* s_the;
 
+// The epoll data of each watched descriptor. Client connections use their client ID, which is never this large.
+static const dword keyboard_token = 0xffffffff;
+static const dword mouse_token = 0xfffffffe;
+static const dword server_token = 0xfffffffd;
+static const dword image_decoder_token = 0xfffffffc;
+
+// How many requests each client gets handled per trip around the loop. Whatever's left waits for the next one,
+// after input and everyone else have had their turn, so one client flooding us can't hold anything else up.
+static const int max_requests_per_client_per_iteration = 32;
+
+// Every write to a client socket arrives as a packet of its own, so this takes up to |count| of them in one call,
+// each into its own |size| bytes of |buffers|, and puts their lengths in |lengths|. Returns what recvmmsg() does.
+static int receive_packets(int fd, byte* buffers, size_t size, int count, int* lengths)
+{
+    ASSERT(count <= max_requests_per_client_per_iteration);
+    mmsghdr headers[max_requests_per_client_per_iteration];
+    iovec iovecs[max_requests_per_client_per_iteration];
+    for (int i = 0; i < count; ++i) {
+        iovecs[i] = { buffers + i * size, size };
+        headers[i] = { };
+        headers[i].msg_hdr.msg_iov = &iovecs[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    int received = recvmmsg(fd, headers, count, 0, nullptr);
+    for (int i = 0; i < received; ++i) {
+        ASSERT(!(headers[i].msg_hdr.msg_flags & MSG_TRUNC));
+        lengths[i] = headers[i].msg_len;
+    }
+    return received;
+}
+
 WSMessageLoop::WSMessageLoop()
 {
     if (!s_the)
@@ -44,7 +77,7 @@ int WSMessageLoop::exec()
 
     unlink("/tmp/wsportal");
 
-    m_server_fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    m_server_fd = socket(AF_LOCAL, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     ASSERT(m_server_fd >= 0);
     sockaddr_un address;
     address.sun_family = AF_LOCAL;
@@ -57,6 +90,13 @@ int WSMessageLoop::exec()
     ASSERT(m_keyboard_fd >= 0);
     ASSERT(m_mouse_fd >= 0);
 
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ASSERT(m_epoll_fd >= 0);
+    watch_fd(m_keyboard_fd, keyboard_token);
+    watch_fd(m_mouse_fd, mouse_token);
+    watch_fd(m_server_fd, server_token);
+    watch_fd(ImageDecoder::the().completion_fd(), image_decoder_token);
+
     m_running = true;
     for (;;) {
         wait_for_message();
@@ -79,9 +119,32 @@ void WSMessageLoop::post_message(WSMessageReceiver& receiver, OwnPtr<WSMessage>&
 #ifdef WSMESSAGELOOP_DEBUG
     dbgprintf("WSMessageLoop::post_message: {%u} << receiver=%p, message=%p (type=%u)\n", m_queued_messages.size(), &receiver, message.ptr(), message->type());
 #endif
+    if (message->type() == WSMessage::MouseMove)
+        drop_superseded_mouse_move(receiver, static_cast<const WSMouseEvent&>(*message));
     m_queued_messages.append({ receiver.make_weak_ptr(), move(message) });
 }
 
+void WSMessageLoop::drop_superseded_mouse_move(WSMessageReceiver& receiver, const WSMouseEvent& new_event)
+{
+    // If the last thing still queued for this receiver is a move with the same buttons, the new one replaces it.
+    // Anything else in between (a button going down, say) means both moves have to be delivered.
+    for (int i = m_queued_messages.size() - 1; i >= 0; --i) {
+        auto& queued_message = m_queued_messages[i];
+        if (queued_message.receiver.ptr() != &receiver)
+            continue;
+        if (queued_message.message->type() != WSMessage::MouseMove)
+            return;
+        auto& queued_event = static_cast<const WSMouseEvent&>(*queued_message.message);
+        if (queued_event.buttons() != new_event.buttons() || queued_event.modifiers() != new_event.modifiers())
+            return;
+#ifdef WSMESSAGELOOP_DEBUG
+        dbgprintf("WSMessageLoop: Coalescing MouseMove to receiver=%p\n", &receiver);
+#endif
+        m_queued_messages.remove(i);
+        return;
+    }
+}
+
 void WSMessageLoop::Timer::reload()
 {
     struct timeval now;
@@ -113,28 +176,22 @@ int WSMessageLoop::stop_timer(int timer_id)
     return 0;
 }
 
-void WSMessageLoop::wait_for_message()
+void WSMessageLoop::watch_fd(int fd, dword token)
 {
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    int max_fd = 0;
-    auto add_fd_to_set = [&max_fd] (int fd, auto& set) {
-        FD_SET(fd, &set);
-        if (fd > max_fd)
-            max_fd = fd;
-    };
-
-    add_fd_to_set(m_keyboard_fd, rfds);
-    add_fd_to_set(m_mouse_fd, rfds);
-    add_fd_to_set(m_server_fd, rfds);
-
-    WSClientConnection::for_each_client([&] (WSClientConnection& client) {
-        add_fd_to_set(client.fd(), rfds);
-    });
-
-    struct timeval timeout = { 0, 0 };
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = token;
+    int rc = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    ASSERT(rc == 0);
+}
 
-    if (m_queued_messages.is_empty()) {
+void WSMessageLoop::wait_for_message()
+{
+    int timeout_ms = -1;
+    if (!m_queued_messages.is_empty()) {
+        timeout_ms = 0;
+    } else if (!m_timers.is_empty()) {
+        struct timeval timeout = { 0, 0 };
         bool had_any_timer = false;
         for (auto& it : m_timers) {
             auto& timer = *it.value;
@@ -146,11 +203,25 @@ void WSMessageLoop::wait_for_message()
             if (timer.next_fire_time.tv_sec > timeout.tv_sec || (timer.next_fire_time.tv_sec == timeout.tv_sec && timer.next_fire_time.tv_usec > timeout.tv_usec))
                 timeout = timer.next_fire_time;
         }
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        timeout_ms = max(0, (int)(timeout.tv_sec - now.tv_sec) * 1000 + (int)(timeout.tv_usec - now.tv_usec) / 1000);
     }
 
-    int rc = select(max_fd + 1, &rfds, nullptr, nullptr, m_queued_messages.is_empty() && m_timers.is_empty() ? nullptr : &timeout);
-    if (rc < 0) {
-        ASSERT_NOT_REACHED();
+    // Tell every client with a ring that we're about to sleep, so they know to ring the doorbell.
+    // If something arrived in the meantime, don't sleep at all.
+    WSClientConnection::for_each_client([&timeout_ms] (WSClientConnection& client) {
+        if (auto* rings = client.message_rings()) {
+            if (!rings->to_server.prepare_to_sleep())
+                timeout_ms = 0;
+        }
+    });
+
+    epoll_event events[32];
+    int event_count = epoll_wait(m_epoll_fd, events, 32, timeout_ms);
+    if (event_count < 0) {
+        ASSERT(errno == EINTR);
+        event_count = 0;
     }
 
     struct timeval now;
@@ -163,41 +234,120 @@ void WSMessageLoop::wait_for_message()
         }
     }
 
-    if (FD_ISSET(m_keyboard_fd, &rfds))
-        drain_keyboard();
-    if (FD_ISSET(m_mouse_fd, &rfds))
-        drain_mouse();
-    if (FD_ISSET(m_server_fd, &rfds)) {
-        sockaddr_un address;
-        socklen_t address_size = sizeof(address);
-        int client_fd = accept(m_server_fd, (sockaddr*)&address, &address_size);
-        if (client_fd < 0) {
-            dbgprintf("WindowServer: accept() failed: %s\n", strerror(errno));
-        } else {
-            new WSClientConnection(client_fd);
-        }
+    // Input goes first, so what it causes is queued ahead of any client's requests.
+    for (int i = 0; i < event_count; ++i) {
+        dword token = events[i].data.u32;
+        if (token == keyboard_token)
+            drain_keyboard();
+        else if (token == mouse_token)
+            drain_mouse();
     }
-    WSClientConnection::for_each_client([&] (WSClientConnection& client) {
-        if (!FD_ISSET(client.fd(), &rfds))
-            return;
-        unsigned messages_received = 0;
-        for (;;) {
-            WSAPI_ClientMessage message;
-            // FIXME: Don't go one message at a time, that's so much context switching, oof.
-            ssize_t nread = read(client.fd(), &message, sizeof(WSAPI_ClientMessage));
-            if (nread == 0) {
-                if (!messages_received)
-                    notify_client_disconnected(client.client_id());
-                break;
-            }
-            if (nread < 0) {
-                perror("read");
-                ASSERT_NOT_REACHED();
+
+    Vector<int, 32> ready_client_ids;
+    for (int i = 0; i < event_count; ++i) {
+        dword token = events[i].data.u32;
+        if (token == image_decoder_token) {
+            ImageDecoder::the().dispatch_finished_decodes();
+        } else if (token == server_token) {
+            sockaddr_un address;
+            socklen_t address_size = sizeof(address);
+            int client_fd = accept(m_server_fd, (sockaddr*)&address, &address_size);
+            if (client_fd < 0) {
+                dbgprintf("WindowServer: accept() failed: %s\n", strerror(errno));
+            } else {
+                auto* client = new WSClientConnection(client_fd);
+                watch_fd(client_fd, client->client_id());
             }
-            on_receive_from_client(client.client_id(), message);
-            ++messages_received;
+        } else if (token != keyboard_token && token != mouse_token) {
+            ready_client_ids.append(token);
         }
+    }
+
+    // Clients that are already awake put messages in their ring without ringing, so look at all of them.
+    // Whoever went first last time goes last this time.
+    Vector<int, 32> client_ids;
+    WSClientConnection::for_each_client([&client_ids] (WSClientConnection& client) {
+        client_ids.append(client.client_id());
     });
+    int first = client_ids.is_empty() ? 0 : m_next_client_turn++ % client_ids.size();
+    for (int i = 0; i < client_ids.size(); ++i) {
+        int client_id = client_ids[(first + i) % client_ids.size()];
+        // Each of these can end up disconnecting it.
+        if (ready_client_ids.contains_slow(client_id)) {
+            if (auto* client = WSClientConnection::from_client_id(client_id))
+                drain_client(*client);
+        }
+        auto* client = WSClientConnection::from_client_id(client_id);
+        if (client && client->message_rings())
+            drain_message_ring(*client);
+    }
+}
+
+void WSMessageLoop::drain_message_ring(WSClientConnection& client)
+{
+    int client_id = client.client_id();
+    // If that leaves some in the ring, it isn't empty when we get ready to sleep, so we come right back for them.
+    bool producer_was_blocked = client.message_rings()->to_server.drain([this, client_id] (const WSAPI_ClientMessage& message) {
+        on_receive_from_client(client_id, message);
+    }, max_requests_per_client_per_iteration);
+    if (producer_was_blocked)
+        client.ring_doorbell();
+}
+
+void WSMessageLoop::drain_client(WSClientConnection& client)
+{
+    int lengths[max_requests_per_client_per_iteration];
+    if (client.message_rings()) {
+        // With rings in place, the socket only carries doorbell rings.
+        byte doorbells[max_requests_per_client_per_iteration];
+        int count = receive_packets(client.fd(), doorbells, 1, max_requests_per_client_per_iteration, lengths);
+        if (count == 0) {
+            notify_client_disconnected(client.client_id());
+            return;
+        }
+        if (count < 0) {
+            if (errno == EAGAIN)
+                return;
+            perror("recvmmsg");
+            ASSERT_NOT_REACHED();
+        }
+        // The client drained a ring we found full, so send what's been waiting.
+        client.flush_overflow_messages();
+        return;
+    }
+
+    // The socket stays readable with what's left over, so the next trip around picks it up.
+    static WSAPI_ClientMessage messages[max_requests_per_client_per_iteration];
+    int count = receive_packets(client.fd(), (byte*)messages, sizeof(WSAPI_ClientMessage), max_requests_per_client_per_iteration, lengths);
+    if (count == 0) {
+        notify_client_disconnected(client.client_id());
+        return;
+    }
+    if (count < 0) {
+        if (errno == EAGAIN)
+            return;
+        perror("recvmmsg");
+        ASSERT_NOT_REACHED();
+    }
+    for (int i = 0; i < count; ++i) {
+        // Clients only send the part of a message that's in use, the rest reads as zeroes.
+        memset((byte*)&messages[i] + lengths[i], 0, sizeof(WSAPI_ClientMessage) - lengths[i]);
+        on_receive_from_client(client.client_id(), messages[i]);
+        // Anything after the greeting is a doorbell ring, and the client doesn't ring before it's heard back.
+        if (client.message_rings())
+            break;
+    }
+}
+
+// How far behind the newest event in a batch we got to it, for the stats overlay.
+static void note_input_latency(qword timestamp)
+{
+    auto& wm = WSWindowManager::the();
+    if (!wm.is_showing_stats_overlay())
+        return;
+    timeval now;
+    gettimeofday(&now, nullptr);
+    wm.set_input_latency_us((qword)now.tv_sec * 1000000 + now.tv_usec - timestamp);
 }
 
 void WSMessageLoop::drain_mouse()
@@ -207,38 +357,57 @@ void WSMessageLoop::drain_mouse()
     int dx = 0;
     int dy = 0;
     unsigned buttons = prev_buttons;
+    qword newest_timestamp = 0;
+    // Everything that's pending comes in one read, unless there's more than fits.
+    MousePacket packets[32];
     for (;;) {
-        MousePacket packet;
-        ssize_t nread = read(m_mouse_fd, &packet, sizeof(MousePacket));
-        if (nread == 0)
+        ssize_t nread = read(m_mouse_fd, packets, sizeof(packets));
+        if (nread <= 0)
             break;
-        ASSERT(nread == sizeof(packet));
-        buttons = packet.buttons;
-
-        dx += packet.dx;
-        dy += -packet.dy;
-        if (buttons != prev_buttons) {
-            screen.on_receive_mouse_data(dx, dy, buttons);
-            dx = 0;
-            dy = 0;
-            prev_buttons = buttons;
+        ASSERT(nread % sizeof(MousePacket) == 0);
+        int packet_count = nread / sizeof(MousePacket);
+        // Motion in between button changes adds up to one move.
+        for (int i = 0; i < packet_count; ++i) {
+            auto& packet = packets[i];
+            buttons = packet.buttons;
+            dx += packet.dx;
+            dy += -packet.dy;
+            if (buttons != prev_buttons) {
+                screen.on_receive_mouse_data(dx, dy, buttons);
+                dx = 0;
+                dy = 0;
+                prev_buttons = buttons;
+            }
         }
+        newest_timestamp = packets[packet_count - 1].timestamp;
+        if (packet_count < (int)(sizeof(packets) / sizeof(MousePacket)))
+            break;
     }
     if (dx || dy)
         screen.on_receive_mouse_data(dx, dy, buttons);
+    if (newest_timestamp)
+        note_input_latency(newest_timestamp);
 }
 
 void WSMessageLoop::drain_keyboard()
 {
     auto& screen = WSScreen::the();
+    qword newest_timestamp = 0;
+    KeyEvent events[16];
     for (;;) {
-        KeyEvent event;
-        ssize_t nread = read(m_keyboard_fd, (byte*)&event, sizeof(KeyEvent));
-        if (nread == 0)
+        ssize_t nread = read(m_keyboard_fd, (byte*)events, sizeof(events));
+        if (nread <= 0)
+            break;
+        ASSERT(nread % sizeof(KeyEvent) == 0);
+        int event_count = nread / sizeof(KeyEvent);
+        for (int i = 0; i < event_count; ++i)
+            screen.on_receive_keyboard_data(events[i]);
+        newest_timestamp = events[event_count - 1].timestamp;
+        if (event_count < (int)(sizeof(events) / sizeof(KeyEvent)))
             break;
-        ASSERT(nread == sizeof(KeyEvent));
-        screen.on_receive_keyboard_data(event);
     }
+    if (newest_timestamp)
+        note_input_latency(newest_timestamp);
 }
 
 void WSMessageLoop::notify_client_disconnected(int client_id)
@@ -249,15 +418,27 @@ void WSMessageLoop::notify_client_disconnected(int client_id)
     post_message(*client, make<WSClientDisconnectedNotification>(client_id));
 }
 
+static Vector<Rect> rects_from_message(const WSAPI_ClientMessage& message)
+{
+    ASSERT(message.rect_count >= 0 && message.rect_count <= WSAPI_MAX_RECTS_PER_MESSAGE);
+    Vector<Rect> rects;
+    rects.ensure_capacity(message.rect_count);
+    for (int i = 0; i < message.rect_count; ++i)
+        rects.append(message.rects[i]);
+    return rects;
+}
+
 void WSMessageLoop::on_receive_from_client(int client_id, const WSAPI_ClientMessage& message)
 {
     WSClientConnection& client = *WSClientConnection::from_client_id(client_id);
+    client.did_receive_message(WSAPI_wire_size(message));
     switch (message.type) {
     case WSAPI_ClientMessage::Type::Greeting:
         client.set_client_pid(message.greeting.client_pid);
+        client.set_up_message_rings();
         break;
     case WSAPI_ClientMessage::Type::CreateMenubar:
-        post_message(client, make<WSAPICreateMenubarRequest>(client_id));
+        post_message(client, make<WSAPICreateMenubarRequest>(client_id, message.menu.menubar_id));
         break;
     case WSAPI_ClientMessage::Type::DestroyMenubar:
         post_message(client, make<WSAPIDestroyMenubarRequest>(client_id, message.menu.menubar_id));
@@ -270,7 +451,7 @@ void WSMessageLoop::on_receive_from_client(int client_id, const WSAPI_ClientMess
         break;
     case WSAPI_ClientMessage::Type::CreateMenu:
         ASSERT(message.text_length < (ssize_t)sizeof(message.text));
-        post_message(client, make<WSAPICreateMenuRequest>(client_id, String(message.text, message.text_length)));
+        post_message(client, make<WSAPICreateMenuRequest>(client_id, message.menu.menu_id, String(message.text, message.text_length)));
         break;
     case WSAPI_ClientMessage::Type::DestroyMenu:
         post_message(client, make<WSAPIDestroyMenuRequest>(client_id, message.menu.menu_id));
@@ -285,7 +466,7 @@ void WSMessageLoop::on_receive_from_client(int client_id, const WSAPI_ClientMess
         break;
     case WSAPI_ClientMessage::Type::CreateWindow:
         ASSERT(message.text_length < (ssize_t)sizeof(message.text));
-        post_message(client, make<WSAPICreateWindowRequest>(client_id, message.window.rect, String(message.text, message.text_length), message.window.has_alpha_channel, message.window.modal, message.window.resizable, message.window.opacity, message.window.base_size, message.window.size_increment));
+        post_message(client, make<WSAPICreateWindowRequest>(client_id, message.window_id, message.window.rect, String(message.text, message.text_length), message.window.has_alpha_channel, message.window.modal, message.window.resizable, message.window.opacity, message.window.base_size, message.window.size_increment));
         break;
     case WSAPI_ClientMessage::Type::DestroyWindow:
         post_message(client, make<WSAPIDestroyWindowRequest>(client_id, message.window_id));
@@ -311,16 +492,16 @@ void WSMessageLoop::on_receive_from_client(int client_id, const WSAPI_ClientMess
         post_message(client, make<WSAPIGetClipboardContentsRequest>(client_id));
         break;
     case WSAPI_ClientMessage::Type::InvalidateRect:
-        post_message(client, make<WSAPIInvalidateRectRequest>(client_id, message.window_id, message.window.rect));
+        post_message(client, make<WSAPIInvalidateRectRequest>(client_id, message.window_id, rects_from_message(message)));
         break;
     case WSAPI_ClientMessage::Type::DidFinishPainting:
-        post_message(client, make<WSAPIDidFinishPaintingNotification>(client_id, message.window_id, message.window.rect));
+        post_message(client, make<WSAPIDidFinishPaintingNotification>(client_id, message.window_id, rects_from_message(message)));
         break;
     case WSAPI_ClientMessage::Type::GetWindowBackingStore:
         post_message(client, make<WSAPIGetWindowBackingStoreRequest>(client_id, message.window_id));
         break;
     case WSAPI_ClientMessage::Type::SetWindowBackingStore:
-        post_message(client, make<WSAPISetWindowBackingStoreRequest>(client_id, message.window_id, message.backing.shared_buffer_id, message.backing.size, message.backing.bpp, message.backing.pitch, message.backing.has_alpha_channel, message.backing.flush_immediately));
+        post_message(client, make<WSAPISetWindowBackingStoreRequest>(client_id, message.window_id, message.backing.shared_buffer_id, message.backing.size, message.backing.bpp, message.backing.pitch, message.backing.has_alpha_channel, message.backing.flush_immediately, message.backing.flip_sequence));
         break;
     case WSAPI_ClientMessage::Type::SetGlobalCursorTracking:
         post_message(client, make<WSAPISetGlobalCursorTrackingRequest>(client_id, message.window_id, message.value));
@@ -334,6 +515,13 @@ void WSMessageLoop::on_receive_from_client(int client_id, const WSAPI_ClientMess
         break;
     case WSAPI_ClientMessage::Type::SetWindowOverrideCursor:
         post_message(client, make<WSAPISetWindowOverrideCursorRequest>(client_id, message.window_id, (WSStandardCursor)message.cursor.cursor));
+        break;
+    case WSAPI_ClientMessage::Type::GetCompositorStats:
+        post_message(client, make<WSAPIGetCompositorStatsRequest>(client_id));
+        break;
+    case WSAPI_ClientMessage::Type::GetClientTrafficStats:
+        post_message(client, make<WSAPIGetClientTrafficStatsRequest>(client_id, message.value));
+        break;
     default:
         break;
     }
@@ -8,6 +8,8 @@
 #include <AK/WeakPtr.h>
 
 class WSMessageReceiver;
+class WSClientConnection;
+class WSMouseEvent;
 struct WSAPI_ClientMessage;
 struct WSAPI_ServerMessage;
 
@@ -35,6 +37,10 @@ private:
     void wait_for_message();
     void drain_mouse();
     void drain_keyboard();
+    void drain_client(WSClientConnection&);
+    void drain_message_ring(WSClientConnection&);
+    void watch_fd(int fd, dword token);
+    void drop_superseded_mouse_move(WSMessageReceiver&, const WSMouseEvent&);
 
     struct QueuedMessage {
         WeakPtr<WSMessageReceiver> receiver;
@@ -47,6 +53,7 @@ private:
     int m_keyboard_fd { -1 };
     int m_mouse_fd { -1 };
     int m_server_fd { -1 };
+    int m_epoll_fd { -1 };
 
     struct Timer {
         void reload();
@@ -57,6 +64,9 @@ private:
         Function<void()> callback;
     };
 
+    // Where the round of clients starts, so they take turns going first.
+    unsigned m_next_client_turn { 0 };
+
     int m_next_timer_id { 1 };
     HashMap<int, OwnPtr<Timer>> m_timers;
 };
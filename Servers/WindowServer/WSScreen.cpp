@@ -2,6 +2,7 @@
 #include "WSMessageLoop.h"
 #include "WSMessage.h"
 #include "WSWindowManager.h"
+#include <SharedGraphics/GraphicsBitmap.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -15,10 +16,12 @@ WSScreen& WSScreen::the()
     return *s_the;
 }
 
-WSScreen::WSScreen(unsigned width, unsigned height)
+WSScreen::WSScreen(unsigned width, unsigned height, int bpp)
     : m_width(width)
     , m_height(height)
+    , m_bpp(bpp)
 {
+    ASSERT(bpp == 16 || bpp == 32);
     ASSERT(!s_the);
     s_the = this;
     m_cursor_location = rect().center();
@@ -37,24 +40,23 @@ void WSScreen::set_resolution(int width, int height)
     struct BXVGAResolution {
         int width;
         int height;
+        int bpp;
     };
-    BXVGAResolution resolution { (int)width, (int)height};
+    BXVGAResolution resolution { (int)width, (int)height, m_bpp };
     int rc = ioctl(m_framebuffer_fd, 1985, (int)&resolution);
     ASSERT(rc == 0);
 
     if (m_framebuffer) {
-        size_t previous_size_in_bytes = m_width * m_height * sizeof(RGBA32) * 2;
-        int rc = munmap(m_framebuffer, previous_size_in_bytes);
+        int rc = munmap(m_framebuffer, framebuffer_size_in_bytes());
         ASSERT(rc == 0);
     }
 
-    size_t framebuffer_size_in_bytes = width * height * sizeof(RGBA32) * 2;
-    m_framebuffer = (RGBA32*)mmap(nullptr, framebuffer_size_in_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_framebuffer_fd, 0);
-    ASSERT(m_framebuffer && m_framebuffer != (void*)-1);
-
     m_width = width;
     m_height = height;
 
+    m_framebuffer = mmap(nullptr, framebuffer_size_in_bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, m_framebuffer_fd, 0);
+    ASSERT(m_framebuffer && m_framebuffer != (void*)-1);
+
     m_cursor_location.constrain(rect());
 }
 
@@ -96,3 +98,65 @@ void WSScreen::set_y_offset(int offset)
     int rc = ioctl(m_framebuffer_fd, 1982, offset);
     ASSERT(rc == 0);
 }
+
+static bool has_sse2()
+{
+    static int s_has_sse2 = -1;
+    if (s_has_sse2 == -1) {
+        dword eax, ebx, ecx, edx;
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+        s_has_sse2 = (edx >> 26) & 1;
+    }
+    return s_has_sse2;
+}
+
+static inline word to_rgb565(dword pixel)
+{
+    return ((pixel >> 8) & 0xf800) | ((pixel >> 5) & 0x07e0) | ((pixel >> 3) & 0x001f);
+}
+
+typedef short v8hi_unaligned __attribute__((vector_size(16), aligned(1)));
+typedef int v4si __attribute__((vector_size(16)));
+typedef int v4si_unaligned __attribute__((vector_size(16), aligned(1)));
+
+// 8 pixels at a time. The packing saturates signed words, so the 16-bit values are biased into their range and back.
+[[gnu::target("sse2")]] static void sse2_convert_row_to_rgb565(word* dst, const dword* src, int count)
+{
+    const v4si red_mask = { 0xf800, 0xf800, 0xf800, 0xf800 };
+    const v4si green_mask = { 0x07e0, 0x07e0, 0x07e0, 0x07e0 };
+    const v4si blue_mask = { 0x001f, 0x001f, 0x001f, 0x001f };
+    const v4si bias = { 0x8000, 0x8000, 0x8000, 0x8000 };
+    const v8hi_unaligned unbias = { (short)0x8000, (short)0x8000, (short)0x8000, (short)0x8000, (short)0x8000, (short)0x8000, (short)0x8000, (short)0x8000 };
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        v4si lo = *(const v4si_unaligned*)(src + i);
+        v4si hi = *(const v4si_unaligned*)(src + i + 4);
+        lo = (((lo >> 8) & red_mask) | ((lo >> 5) & green_mask) | ((lo >> 3) & blue_mask)) - bias;
+        hi = (((hi >> 8) & red_mask) | ((hi >> 5) & green_mask) | ((hi >> 3) & blue_mask)) - bias;
+        *(v8hi_unaligned*)(dst + i) = (v8hi_unaligned)__builtin_ia32_packssdw128(lo, hi) ^ unbias;
+    }
+    for (; i < count; ++i)
+        dst[i] = to_rgb565(src[i]);
+}
+
+void WSScreen::flush(const GraphicsBitmap& source, const Rect& a_rect, int page)
+{
+    ASSERT(m_bpp == 16);
+    ASSERT(page == 0 || page == 1);
+    auto rect = Rect::intersection(a_rect, this->rect());
+    if (rect.is_empty())
+        return;
+    size_t pitch = sizeof(word) * m_width;
+    byte* page_bits = (byte*)m_framebuffer + page * m_height * pitch;
+    bool use_sse2 = has_sse2();
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        word* dst = (word*)(page_bits + y * pitch) + rect.x();
+        const dword* src = source.scanline(y) + rect.x();
+        if (use_sse2) {
+            sse2_convert_row_to_rgb565(dst, src, rect.width());
+            continue;
+        }
+        for (int x = 0; x < rect.width(); ++x)
+            dst[x] = to_rgb565(src[x]);
+    }
+}
@@ -5,17 +5,26 @@
 #include <SharedGraphics/Color.h>
 #include <Kernel/KeyCode.h>
 
+class GraphicsBitmap;
+
 class WSScreen {
 public:
-    WSScreen(unsigned width, unsigned height);
+    // With 16 bpp, the framebuffer pixels are RGB565 and everything is composed elsewhere and flush()ed in.
+    WSScreen(unsigned width, unsigned height, int bpp = 32);
     ~WSScreen();
 
     void set_resolution(int width, int height);
 
     int width() const { return m_width; }
     int height() const { return m_height; }
+    int bpp() const { return m_bpp; }
+
+    // Only for 32 bpp, where bitmaps can wrap the framebuffer directly.
     RGBA32* scanline(int y);
 
+    // Converts |rect| of |source| into the given one of the two pages of a 16 bpp framebuffer.
+    void flush(const GraphicsBitmap& source, const Rect&, int page);
+
     static WSScreen& the();
 
     Size size() const { return { width(), height() }; }
@@ -30,10 +39,13 @@ public:
     void on_receive_keyboard_data(KeyEvent);
 
 private:
-    RGBA32* m_framebuffer { nullptr };
+    size_t framebuffer_size_in_bytes() const { return m_width * m_height * (m_bpp / 8) * 2; }
+
+    void* m_framebuffer { nullptr };
 
     int m_width { 0 };
     int m_height { 0 };
+    int m_bpp { 32 };
     int m_framebuffer_fd { -1 };
 
     Point m_cursor_location;
@@ -43,6 +55,7 @@ private:
 
 inline RGBA32* WSScreen::scanline(int y)
 {
+    ASSERT(m_bpp == 32);
     size_t pitch = sizeof(RGBA32) * width();
     return reinterpret_cast<RGBA32*>(((byte*)m_framebuffer) + (y * pitch));
 }
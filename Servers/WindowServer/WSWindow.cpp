@@ -4,12 +4,14 @@
 #include "WSMessageLoop.h"
 #include <WindowServer/WSAPITypes.h>
 #include <WindowServer/WSClientConnection.h>
+#include <SharedGraphics/ImageDecoder.h>
+#include <SharedGraphics/Painter.h>
 
 static GraphicsBitmap& default_window_icon()
 {
     static GraphicsBitmap* s_icon;
     if (!s_icon)
-        s_icon = GraphicsBitmap::load_from_file("/res/icons/16x16/window.png").leak_ref();
+        s_icon = ImageDecoder::the().load("/res/icons/16x16/window.png").leak_ref();
     return *s_icon;
 }
 
@@ -57,6 +59,64 @@ void WSWindow::set_rect(const Rect& rect)
     WSWindowManager::the().notify_rect_changed(*this, old_rect, rect);
 }
 
+void WSWindow::did_damage_contents(const Rect& rect)
+{
+    if (m_has_thumbnail_damage && m_thumbnail_damage.is_null())
+        return;
+    if (rect.is_null())
+        m_thumbnail_damage = { };
+    else
+        m_thumbnail_damage = m_has_thumbnail_damage ? m_thumbnail_damage.united(rect) : rect;
+    m_has_thumbnail_damage = true;
+}
+
+const GraphicsBitmap* WSWindow::thumbnail()
+{
+    if (!m_backing_store || m_backing_store->size().is_empty())
+        return nullptr;
+    if (!m_has_thumbnail_damage)
+        return m_thumbnail.ptr();
+
+    // Keep the aspect ratio, and never scale up.
+    auto source_size = m_backing_store->size();
+    auto bounds = max_thumbnail_size();
+    int width = min(source_size.width(), bounds.width());
+    int height = min(source_size.height(), bounds.height());
+    if (source_size.width() * height > source_size.height() * width)
+        height = max(1, source_size.height() * width / source_size.width());
+    else
+        width = max(1, source_size.width() * height / source_size.height());
+
+    auto damage = m_thumbnail_damage;
+    if (!m_thumbnail || m_thumbnail->size() != Size(width, height)) {
+        m_thumbnail = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, { width, height });
+        damage = { };
+    }
+    Rect thumbnail_rect { { }, m_thumbnail->size() };
+    if (damage.is_null()) {
+        damage = thumbnail_rect;
+    } else {
+        // Bilinear samples reach one pixel past what they land on, so round outwards and take a pixel more on each side.
+        int left = damage.left() * width / source_size.width() - 1;
+        int top = damage.top() * height / source_size.height() - 1;
+        int right = (damage.right() + 1) * width / source_size.width() + 1;
+        int bottom = (damage.bottom() + 1) * height / source_size.height() + 1;
+        damage = Rect::intersection({ left, top, right - left + 1, bottom - top + 1 }, thumbnail_rect);
+    }
+    m_thumbnail_damage = { };
+    m_has_thumbnail_damage = false;
+    if (damage.is_empty())
+        return m_thumbnail.ptr();
+
+    // The painter's clip keeps the scaling to the damaged part, and every pixel comes out as a full rescale would have it.
+    Painter painter(*m_thumbnail);
+    painter.add_clip_rect(damage);
+    if (m_backing_store->has_alpha_channel())
+        painter.fill_rect(damage, Color::LightGray);
+    painter.draw_scaled_bitmap(thumbnail_rect, *m_backing_store, m_backing_store->rect(), Painter::ScalingMode::Bilinear);
+    return m_thumbnail.ptr();
+}
+
 // FIXME: Just use the same types.
 static WSAPI_MouseButton to_api(MouseButton button)
 {
@@ -158,9 +218,26 @@ void WSWindow::set_visible(bool b)
     if (m_visible == b)
         return;
     m_visible = b;
+    WSWindowManager::the().invalidate_occlusions();
     invalidate();
 }
 
+void WSWindow::set_opacity(float opacity)
+{
+    if (m_opacity == opacity)
+        return;
+    m_opacity = opacity;
+    WSWindowManager::the().invalidate_occlusions();
+}
+
+void WSWindow::set_has_alpha_channel(bool value)
+{
+    if (m_has_alpha_channel == value)
+        return;
+    m_has_alpha_channel = value;
+    WSWindowManager::the().invalidate_occlusions();
+}
+
 void WSWindow::set_resizable(bool resizable)
 {
     if (m_resizable == resizable)
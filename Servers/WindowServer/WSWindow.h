@@ -26,11 +26,11 @@ public:
     WSWindowType type() const { return m_type; }
     int window_id() const { return m_window_id; }
 
-    String title() const { return m_title; }
+    const String& title() const { return m_title; }
     void set_title(String&&);
 
     float opacity() const { return m_opacity; }
-    void set_opacity(float opacity) { m_opacity = opacity; }
+    void set_opacity(float);
 
     int x() const { return m_rect.x(); }
     int y() const { return m_rect.y(); }
@@ -69,22 +69,65 @@ public:
     GraphicsBitmap* backing_store() { return m_backing_store.ptr(); }
     void set_backing_store(RetainPtr<GraphicsBitmap>&& backing_store)
     {
+        m_older_backing_store = move(m_last_backing_store);
         m_last_backing_store = move(m_backing_store);
         m_backing_store = move(backing_store);
+        did_damage_contents({ });
     }
-    void swap_backing_stores()
+
+    // Clients cycle through two or three backing stores, so keep the last ones mapped instead of mapping them again.
+    bool reuse_backing_store(int shared_buffer_id, const Size& size)
+    {
+        if (m_last_backing_store && m_last_backing_store->shared_buffer_id() == shared_buffer_id && m_last_backing_store->size() == size) {
+            swap(m_backing_store, m_last_backing_store);
+            did_damage_contents({ });
+            return true;
+        }
+        if (m_older_backing_store && m_older_backing_store->shared_buffer_id() == shared_buffer_id && m_older_backing_store->size() == size) {
+            auto backing_store = move(m_older_backing_store);
+            set_backing_store(move(backing_store));
+            return true;
+        }
+        return false;
+    }
+
+    // While resizing, clients hand the same buffers back at new sizes.
+    SharedBuffer* mapped_shared_buffer(int shared_buffer_id)
     {
-        swap(m_backing_store, m_last_backing_store);
+        GraphicsBitmap* backing_stores[] = { m_backing_store.ptr(), m_last_backing_store.ptr(), m_older_backing_store.ptr() };
+        for (auto* backing_store : backing_stores) {
+            if (backing_store && backing_store->shared_buffer_id() == shared_buffer_id)
+                return backing_store->shared_buffer();
+        }
+        return nullptr;
     }
 
-    GraphicsBitmap* last_backing_store() { return m_last_backing_store.ptr(); }
+    // A small copy of the contents for the window switcher. Only what was damaged since the last call is scaled down again.
+    const GraphicsBitmap* thumbnail();
+    static Size max_thumbnail_size() { return { 64, 48 }; }
+    bool has_thumbnail_damage() const { return m_has_thumbnail_damage; }
+    // In backing store coordinates, a null rect is all of it.
+    void did_damage_contents(const Rect&);
 
     void set_global_cursor_tracking_enabled(bool);
     void set_automatic_cursor_tracking_enabled(bool enabled) { m_automatic_cursor_tracking_enabled = enabled; }
     bool global_cursor_tracking() const { return m_global_cursor_tracking_enabled || m_automatic_cursor_tracking_enabled; }
 
     bool has_alpha_channel() const { return m_has_alpha_channel; }
-    void set_has_alpha_channel(bool value) { m_has_alpha_channel = value; }
+    void set_has_alpha_channel(bool);
+
+    // The parts of the outer rect that no opaque window above covers. Kept up to date by WSWindowManager.
+    const Vector<Rect>& visible_rects() const { return m_visible_rects; }
+    void set_visible_rects(Vector<Rect>&& rects) { m_visible_rects = move(rects); }
+
+    // The title bar as WSWindowManager last painted it, and what the window looked like then.
+    struct TitleBarCache {
+        RetainPtr<GraphicsBitmap> bitmap;
+        String title;
+        const GraphicsBitmap* icon { nullptr };
+        int state { -1 };
+    };
+    TitleBarCache& title_bar_cache() { return m_title_bar_cache; }
 
     void set_last_lazy_resize_rect(const Rect& rect) { m_last_lazy_resize_rect = rect; }
     Rect last_lazy_resize_rect() const { return m_last_lazy_resize_rect; }
@@ -126,6 +169,7 @@ private:
     bool m_resizable { false };
     RetainPtr<GraphicsBitmap> m_backing_store;
     RetainPtr<GraphicsBitmap> m_last_backing_store;
+    RetainPtr<GraphicsBitmap> m_older_backing_store;
     int m_window_id { -1 };
     float m_opacity { 1 };
     Rect m_last_lazy_resize_rect;
@@ -133,4 +177,9 @@ private:
     Size m_base_size;
     Retained<GraphicsBitmap> m_icon;
     RetainPtr<WSCursor> m_override_cursor;
+    Vector<Rect> m_visible_rects;
+    TitleBarCache m_title_bar_cache;
+    RetainPtr<GraphicsBitmap> m_thumbnail;
+    Rect m_thumbnail_damage;
+    bool m_has_thumbnail_damage { true };
 };
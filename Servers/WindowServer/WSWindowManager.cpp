@@ -14,9 +14,14 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <time.h>
+#include <sys/time.h>
 #include <SharedGraphics/StylePainter.h>
-#include <SharedGraphics/PNGLoader.h>
+#include <SharedGraphics/ImageDecoder.h>
 #include "WSCursor.h"
+#include "WSCompositorPool.h"
+#include <AK/ByteBuffer.h>
+#include <Kernel/ProcessSnapshot.h>
+#include <fcntl.h>
 
 #ifdef KERNEL
 #include <Kernel/ProcFS.h>
@@ -29,6 +34,8 @@
 static void get_cpu_usage(unsigned& busy, unsigned& idle);
 
 static const int window_titlebar_height = 18;
+// Roughly what clipping to a dirty rect and walking every window over it costs, in pixels painted.
+static const int rect_overhead_in_pixels = 4096;
 
 static inline Rect menu_window_rect(const Rect& rect)
 {
@@ -110,16 +117,62 @@ static inline Rect outer_window_rect(const WSWindow& window)
 
 static WSWindowManager* s_the;
 
+static const char* s_close_button_bitmap_data = {
+    "##    ##"
+    "###  ###"
+    " ###### "
+    "  ####  "
+    "   ##   "
+    "  ####  "
+    " ###### "
+    "###  ###"
+    "##    ##"
+};
+
+static CharacterBitmap* s_close_button_bitmap;
+static const int s_close_button_bitmap_width = 8;
+static const int s_close_button_bitmap_height = 9;
+
 WSWindowManager& WSWindowManager::the()
 {
     ASSERT(s_the);
     return *s_the;
 }
 
+void WSWindowManager::create_screen_bitmaps()
+{
+    auto size = m_screen_rect.size();
+    if (m_screen.bpp() == 32) {
+        m_front_bitmap = GraphicsBitmap::create_wrapper(GraphicsBitmap::Format::RGB32, size, m_screen.scanline(0));
+        m_back_bitmap = GraphicsBitmap::create_wrapper(GraphicsBitmap::Format::RGB32, size, m_screen.scanline(size.height()));
+    } else {
+        // Composing stays in 32 bpp. Each bitmap is a copy of one framebuffer page, kept up to date with flush().
+        m_front_bitmap = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, size);
+        m_back_bitmap = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, size);
+    }
+
+    m_front_painter = make<Painter>(*m_front_bitmap);
+    m_back_painter = make<Painter>(*m_back_bitmap);
+
+    m_front_painter->set_font(font());
+    m_back_painter->set_font(font());
+}
+
+void WSWindowManager::flush(const GraphicsBitmap& bitmap, const Rect& rect)
+{
+    // With 32 bpp the bitmaps are the framebuffer.
+    if (m_screen.bpp() == 32)
+        return;
+    bool is_front = &bitmap == m_front_bitmap.ptr();
+    m_screen.flush(bitmap, rect, is_front == m_buffers_are_flipped ? 1 : 0);
+}
+
 void WSWindowManager::flip_buffers()
 {
     swap(m_front_bitmap, m_back_bitmap);
     swap(m_front_painter, m_back_painter);
+    swap(m_front_buffer_cursor_rect, m_back_buffer_cursor_rect);
+    swap(m_front_buffer_cursor_save_under, m_back_buffer_cursor_save_under);
     int new_y_offset = m_buffers_are_flipped ? 0 : m_screen_rect.height();
     WSScreen::the().set_y_offset(new_y_offset);
     m_buffers_are_flipped = !m_buffers_are_flipped;
@@ -132,19 +185,12 @@ WSWindowManager::WSWindowManager()
 {
     s_the = this;
 
-#ifndef DEBUG_COUNTERS
-    (void)m_compose_count;
-    (void)m_flush_count;
-#endif
-    auto size = m_screen_rect.size();
-    m_front_bitmap = GraphicsBitmap::create_wrapper(GraphicsBitmap::Format::RGB32, size, m_screen.scanline(0));
-    m_back_bitmap = GraphicsBitmap::create_wrapper(GraphicsBitmap::Format::RGB32, size, m_screen.scanline(size.height()));
-
-    m_front_painter = make<Painter>(*m_front_bitmap);
-    m_back_painter = make<Painter>(*m_back_bitmap);
+    create_screen_bitmaps();
 
-    m_front_painter->set_font(font());
-    m_back_painter->set_font(font());
+    // Get everything that's created on first use out of the way, compose_band() may run on several threads.
+    (void)window_title_font();
+    (void)StylePainter::the();
+    s_close_button_bitmap = &CharacterBitmap::create_from_ascii(s_close_button_bitmap_data, s_close_button_bitmap_width, s_close_button_bitmap_height).leak_ref();
 
     m_background_color = Color(50, 50, 50);
     m_active_window_border_color = Color(110, 34, 9);
@@ -160,17 +206,18 @@ WSWindowManager::WSWindowManager()
     m_highlight_window_border_color2 = Color::from_rgb(0xfabbbb);
     m_highlight_window_title_color = Color::White;
 
-    m_arrow_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/arrow.png"), { 2, 2 });
-    m_resize_horizontally_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/resize-horizontal.png"));
-    m_resize_vertically_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/resize-vertical.png"));
-    m_resize_diagonally_tlbr_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/resize-diagonal-tlbr.png"));
-    m_resize_diagonally_bltr_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/resize-diagonal-bltr.png"));
-    m_i_beam_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/i-beam.png"));
-    m_disallowed_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/disallowed.png"));
-    m_move_cursor = WSCursor::create(*GraphicsBitmap::load_from_file("/res/cursors/move.png"));
+    m_arrow_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/arrow.png"), { 2, 2 });
+    m_resize_horizontally_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/resize-horizontal.png"));
+    m_resize_vertically_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/resize-vertical.png"));
+    m_resize_diagonally_tlbr_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/resize-diagonal-tlbr.png"));
+    m_resize_diagonally_bltr_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/resize-diagonal-bltr.png"));
+    m_i_beam_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/i-beam.png"));
+    m_disallowed_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/disallowed.png"));
+    m_move_cursor = WSCursor::create(*ImageDecoder::the().load("/res/cursors/move.png"));
 
     m_wallpaper_path = "/res/wallpapers/retro.rgb";
-    m_wallpaper = GraphicsBitmap::load_from_file(GraphicsBitmap::Format::RGBA32, m_wallpaper_path, { 1024, 768 });
+    m_unscaled_wallpaper = GraphicsBitmap::load_from_file(GraphicsBitmap::Format::RGBA32, m_wallpaper_path, { 1024, 768 });
+    scale_wallpaper_to_screen();
 
     m_username = getlogin();
 
@@ -256,6 +303,10 @@ WSWindowManager::WSWindowManager()
         }
     });
 
+    WSMessageLoop::the().start_timer(1000, [this] {
+        sample_stats();
+    });
+
     invalidate();
     compose();
 }
@@ -289,64 +340,81 @@ void get_cpu_usage(unsigned& busy, unsigned& idle)
     busy = 0;
     idle = 0;
 
-    FILE* fp = fopen("/proc/all", "r");
-    if (!fp) {
-        perror("failed to open /proc/all");
+    int fd = open("/proc/all.bin", O_RDONLY);
+    if (fd < 0) {
+        perror("failed to open /proc/all.bin");
         exit(1);
     }
+    ByteBuffer buffer;
     for (;;) {
-        char buf[BUFSIZ];
-        char* ptr = fgets(buf, sizeof(buf), fp);
-        if (!ptr)
+        char chunk[4096];
+        ssize_t nread = read(fd, chunk, sizeof(chunk));
+        if (nread <= 0)
             break;
-        auto parts = String(buf, Chomp).split(',');
-        if (parts.size() < 17)
-            break;
-        bool ok;
-        pid_t pid = parts[0].to_uint(ok);
-        ASSERT(ok);
-        unsigned nsched = parts[1].to_uint(ok);
-        ASSERT(ok);
-
-        if (pid == 0)
-            idle += nsched;
-        else
-            busy += nsched;
+        buffer.append(chunk, nread);
     }
-    int rc = fclose(fp);
+    int rc = close(fd);
     ASSERT(rc == 0);
+
+    auto& header = *(const ProcessSnapshotHeader*)buffer.pointer();
+    ASSERT(buffer.size() >= (ssize_t)sizeof(header) && header.version == process_snapshot_version);
+    const byte* record = buffer.pointer() + sizeof(header);
+    for (dword i = 0; i < header.process_count; ++i, record += header.entry_size) {
+        auto& entry = *(const ProcessSnapshotEntry*)record;
+        if (entry.pid == 0)
+            idle += entry.times_scheduled;
+        else
+            busy += entry.times_scheduled;
+    }
 }
 
 void WSWindowManager::tick_clock()
 {
-    invalidate(menubar_rect());
+    invalidate_menubar();
 }
 
-bool WSWindowManager::set_wallpaper(const String& path)
+void WSWindowManager::set_wallpaper(const String& path, Function<void(bool)>&& callback)
 {
-    auto bitmap = load_png(path);
-    if (!bitmap)
-        return false;
+    m_requested_wallpaper_path = path;
+    ImageDecoder::the().load_async(path, m_screen_rect.size(), [this, path, callback = move(callback)] (RetainPtr<GraphicsBitmap>&& bitmap) {
+        // Only the last wallpaper asked for gets shown, however the decodes finish.
+        if (bitmap && path == m_requested_wallpaper_path) {
+            m_wallpaper_path = path;
+            m_unscaled_wallpaper = move(bitmap);
+            scale_wallpaper_to_screen();
+            invalidate();
+            callback(true);
+            return;
+        }
+        callback(false);
+    });
+}
 
-    m_wallpaper_path = path;
-    m_wallpaper = move(bitmap);
-    invalidate();
-    return true;
+// The wallpaper is stretched once up front, so composing it stays a plain blit.
+void WSWindowManager::scale_wallpaper_to_screen()
+{
+    if (!m_unscaled_wallpaper || m_unscaled_wallpaper->size() == m_screen_rect.size()) {
+        m_wallpaper = m_unscaled_wallpaper.copy_ref();
+        return;
+    }
+    m_wallpaper = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, m_screen_rect.size());
+    Painter painter(*m_wallpaper);
+    painter.fill_rect(m_wallpaper->rect(), m_background_color);
+    painter.draw_scaled_bitmap(m_wallpaper->rect(), *m_unscaled_wallpaper, m_unscaled_wallpaper->rect(), Painter::ScalingMode::Bilinear);
 }
 
 void WSWindowManager::set_resolution(int width, int height)
 {
     if (m_screen_rect.width() == width && m_screen_rect.height() == height)
         return;
-    m_wallpaper_path = { };
-    m_wallpaper = nullptr;
     m_screen.set_resolution(width, height);
     m_screen_rect = m_screen.rect();
-    m_front_bitmap = GraphicsBitmap::create_wrapper(GraphicsBitmap::Format::RGB32, { width, height }, m_screen.scanline(0));
-    m_back_bitmap = GraphicsBitmap::create_wrapper(GraphicsBitmap::Format::RGB32, { width, height }, m_screen.scanline(height));
-    m_front_painter = make<Painter>(*m_front_bitmap);
-    m_back_painter = make<Painter>(*m_back_bitmap);
+    scale_wallpaper_to_screen();
+    create_screen_bitmaps();
     m_buffers_are_flipped = false;
+    m_front_buffer_cursor_rect = { };
+    m_back_buffer_cursor_rect = { };
+    invalidate_occlusions();
     invalidate();
     compose();
 }
@@ -383,31 +451,69 @@ void WSWindowManager::set_current_menubar(WSMenuBar* menubar)
         ++index;
         return true;
     });
-    invalidate(menubar_rect());
+    invalidate_menubar();
 }
 
-static const char* s_close_button_bitmap_data = {
-    "##    ##"
-    "###  ###"
-    " ###### "
-    "  ####  "
-    "   ##   "
-    "  ####  "
-    " ###### "
-    "###  ###"
-    "##    ##"
-};
+WSWindowManager::FrameState WSWindowManager::frame_state(const WSWindow& window) const
+{
+    if (&window == m_highlight_window.ptr())
+        return FrameState::Highlighted;
+    if (&window == m_drag_window.ptr())
+        return FrameState::Dragging;
+    if (&window == m_active_window.ptr())
+        return FrameState::Active;
+    return FrameState::Inactive;
+}
 
-static CharacterBitmap* s_close_button_bitmap;
-static const int s_close_button_bitmap_width = 8;
-static const int s_close_button_bitmap_height = 9;
+// The top of the frame, from the outer border down to the line above the window. Everything costly in the frame is in here.
+static inline Rect title_bar_strip_rect(const WSWindow& window)
+{
+    auto outer_rect = outer_window_rect(window);
+    return { outer_rect.x(), outer_rect.y(), outer_rect.width(), window.y() - outer_rect.y() };
+}
+
+void WSWindowManager::update_title_bar_cache(WSWindow& window)
+{
+    auto strip_rect = title_bar_strip_rect(window);
+    auto& cache = window.title_bar_cache();
+    int state = (int)frame_state(window);
+    bool size_changed = !cache.bitmap || cache.bitmap->size() != strip_rect.size();
+    if (!size_changed && cache.state == state && cache.icon == &window.icon() && cache.title == window.title())
+        return;
+    if (size_changed)
+        cache.bitmap = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, strip_rect.size());
+    Painter painter(*cache.bitmap);
+    painter.translate(-strip_rect.location());
+    paint_window_frame(painter, window);
+    cache.title = window.title();
+    cache.icon = &window.icon();
+    cache.state = state;
+}
 
-void WSWindowManager::paint_window_frame(WSWindow& window)
+// Blits the cached title bar and draws the rest of the border, which is just a few lines.
+void WSWindowManager::paint_cached_window_frame(Painter& painter, WSWindow& window)
+{
+    if (window.type() != WSWindowType::Normal) {
+        paint_window_frame(painter, window);
+        return;
+    }
+    auto strip_rect = title_bar_strip_rect(window);
+    auto& cache = window.title_bar_cache();
+    ASSERT(cache.bitmap && cache.bitmap->size() == strip_rect.size());
+    painter.blit(strip_rect.location(), *cache.bitmap, cache.bitmap->rect());
+
+    auto outer_rect = outer_window_rect(window);
+    PainterStateSaver saver(painter);
+    painter.add_clip_rect({ outer_rect.x(), window.y(), outer_rect.width(), outer_rect.bottom() - window.y() + 1 });
+    paint_window_frame(painter, window);
+}
+
+void WSWindowManager::paint_window_frame(Painter& painter, WSWindow& window)
 {
     //printf("[WM] paint_window_frame {%p}, rect: %d,%d %dx%d\n", &window, window.rect().x(), window.rect().y(), window.rect().width(), window.rect().height());
 
     if (window.type() == WSWindowType::Menu) {
-        m_back_painter->draw_rect(menu_window_rect(window.rect()), Color::LightGray);
+        painter.draw_rect(menu_window_rect(window.rect()), Color::LightGray);
         return;
     }
 
@@ -436,17 +542,18 @@ void WSWindowManager::paint_window_frame(WSWindow& window)
     Color border_color2;
     Color middle_border_color;
 
-    if (&window == m_highlight_window.ptr()) {
+    auto state = frame_state(window);
+    if (state == FrameState::Highlighted) {
         border_color = m_highlight_window_border_color;
         border_color2 = m_highlight_window_border_color2;
         title_color = m_highlight_window_title_color;
         middle_border_color = Color::White;
-    } else if (&window == m_drag_window.ptr()) {
+    } else if (state == FrameState::Dragging) {
         border_color = m_dragging_window_border_color;
         border_color2 = m_dragging_window_border_color2;
         title_color = m_dragging_window_title_color;
         middle_border_color = Color::from_rgb(0xf9b36a);
-    } else if (&window == m_active_window.ptr()) {
+    } else if (state == FrameState::Active) {
         border_color = m_active_window_border_color;
         border_color2 = m_active_window_border_color2;
         title_color = m_active_window_title_color;
@@ -458,30 +565,27 @@ void WSWindowManager::paint_window_frame(WSWindow& window)
         middle_border_color = Color::MidGray;
     }
 
-    m_back_painter->fill_rect_with_gradient(titlebar_rect, border_color, border_color2);
+    painter.fill_rect_with_gradient(titlebar_rect, border_color, border_color2);
     for (int i = 2; i <= titlebar_inner_rect.height() - 4; i += 2) {
-        m_back_painter->draw_line({ titlebar_title_rect.right() + 4, titlebar_inner_rect.y() + i }, { close_button_rect.left() - 3, titlebar_inner_rect.y() + i }, border_color);
+        painter.draw_line({ titlebar_title_rect.right() + 4, titlebar_inner_rect.y() + i }, { close_button_rect.left() - 3, titlebar_inner_rect.y() + i }, border_color);
     }
-    m_back_painter->draw_rect(border_rect, middle_border_color);
-    m_back_painter->draw_rect(outer_rect, border_color);
-    m_back_painter->draw_rect(inner_border_rect, border_color);
-
-    m_back_painter->draw_text(titlebar_title_rect, window.title(), window_title_font(), TextAlignment::CenterLeft, title_color);
+    painter.draw_rect(border_rect, middle_border_color);
+    painter.draw_rect(outer_rect, border_color);
+    painter.draw_rect(inner_border_rect, border_color);
 
-    m_back_painter->blit(titlebar_icon_rect.location(), window.icon(), window.icon().rect());
+    painter.draw_text(titlebar_title_rect, window.title(), window_title_font(), TextAlignment::CenterLeft, title_color);
 
-    if (!s_close_button_bitmap)
-        s_close_button_bitmap = &CharacterBitmap::create_from_ascii(s_close_button_bitmap_data, s_close_button_bitmap_width, s_close_button_bitmap_height).leak_ref();
+    painter.blit(titlebar_icon_rect.location(), window.icon(), window.icon().rect());
 
-    StylePainter::the().paint_button(*m_back_painter, close_button_rect, ButtonStyle::Normal, false, false);
+    StylePainter::the().paint_button(painter, close_button_rect, ButtonStyle::Normal, false, false);
 
     auto x_location = close_button_rect.center();
     x_location.move_by(-(s_close_button_bitmap_width / 2), -(s_close_button_bitmap_height / 2));
-    m_back_painter->draw_bitmap(x_location, *s_close_button_bitmap, Color::Black);
+    painter.draw_bitmap(x_location, *s_close_button_bitmap, Color::Black);
 
 #ifdef DEBUG_WID_IN_TITLE_BAR
     Color metadata_color(96, 96, 96);
-    m_back_painter->draw_text(
+    painter.draw_text(
         titlebar_inner_rect,
         String::format("%d:%d", window.pid(), window.window_id()),
         TextAlignment::CenterRight,
@@ -494,6 +598,7 @@ void WSWindowManager::add_window(WSWindow& window)
 {
     m_windows.set(&window);
     m_windows_in_order.append(&window);
+    invalidate_occlusions();
     if (!active_window() || active_window()->client() == window.client())
         set_active_window(&window);
     if (m_switcher.is_visible() && window.type() != WSWindowType::WindowSwitcher)
@@ -509,6 +614,7 @@ void WSWindowManager::move_to_front_and_make_active(WSWindow& window)
         invalidate(window);
     m_windows_in_order.remove(&window);
     m_windows_in_order.append(&window);
+    invalidate_occlusions();
 
     set_active_window(&window);
 }
@@ -521,6 +627,7 @@ void WSWindowManager::remove_window(WSWindow& window)
     invalidate(window);
     m_windows.remove(&window);
     m_windows_in_order.remove(&window);
+    invalidate_occlusions();
     if (!active_window() && !m_windows.is_empty())
         set_active_window(*m_windows.begin());
     if (m_switcher.is_visible() && window.type() != WSWindowType::WindowSwitcher)
@@ -540,8 +647,23 @@ void WSWindowManager::notify_rect_changed(WSWindow& window, const Rect& old_rect
 #ifdef RESIZE_DEBUG
     dbgprintf("[WM] WSWindow %p rect changed (%d,%d %dx%d) -> (%d,%d %dx%d)\n", &window, old_rect.x(), old_rect.y(), old_rect.width(), old_rect.height(), new_rect.x(), new_rect.y(), new_rect.width(), new_rect.height());
 #endif
-    invalidate(outer_window_rect(old_rect));
-    invalidate(outer_window_rect(new_rect));
+    bool is_pure_move = old_rect.size() == new_rect.size()
+        && window.type() == WSWindowType::Normal
+        && !m_stacking_changed_since_last_compose
+        && (!m_pending_move_window || m_pending_move_window.ptr() == &window);
+    if (is_pure_move) {
+        if (!m_pending_move_window) {
+            m_pending_move_window = window.make_weak_ptr();
+            m_pending_move_from = outer_window_rect(old_rect);
+        }
+        m_pending_move_to = outer_window_rect(new_rect);
+        m_occlusions_dirty = true;
+        schedule_compose();
+    } else {
+        invalidate(outer_window_rect(old_rect));
+        invalidate(outer_window_rect(new_rect));
+        invalidate_occlusions();
+    }
     if (m_switcher.is_visible() && window.type() != WSWindowType::WindowSwitcher)
         m_switcher.refresh();
 }
@@ -562,6 +684,7 @@ void WSWindowManager::handle_menu_mouse_event(WSMenu& menu, WSMouseEvent& event)
             menu_window.set_visible(true);
         }
         m_current_menu = menu.make_weak_ptr();
+        invalidate_menubar();
         return;
     }
     if (event.type() == WSMouseEvent::MouseDown && event.button() == MouseButton::Left) {
@@ -574,6 +697,8 @@ void WSWindowManager::close_current_menu()
 {
     if (m_current_menu && m_current_menu->menu_window())
         m_current_menu->menu_window()->set_visible(false);
+    if (m_current_menu)
+        invalidate_menubar();
     m_current_menu = nullptr;
 }
 
@@ -844,114 +969,306 @@ void WSWindowManager::process_mouse_event(WSMouseEvent& event, WSWindow*& event_
     });
 }
 
-void WSWindowManager::compose()
+void WSWindowManager::invalidate_occlusions()
 {
-    auto dirty_rects = move(m_dirty_rects);
-    dirty_rects.add(m_last_cursor_rect);
-    dirty_rects.add(current_cursor_rect());
-#ifdef DEBUG_COUNTERS
-    dbgprintf("[WM] compose #%u (%u rects)\n", ++m_compose_count, dirty_rects.rects().size());
-#endif
+    m_occlusions_dirty = true;
+    m_stacking_changed_since_last_compose = true;
+    // The last frame no longer shows the moving window on top, so it can't be copied out of it.
+    cancel_pending_move();
+}
 
-    auto any_opaque_window_contains_rect = [this] (const Rect& r) {
-        for (auto* window = m_windows_in_order.head(); window; window = window->next()) {
-            if (!window->is_visible())
-                continue;
-            if (window->opacity() < 1.0f)
-                continue;
-            if (window->has_alpha_channel()) {
-                // FIXME: Just because the window has an alpha channel doesn't mean it's not opaque.
-                //        Maybe there's some way we could know this?
-                continue;
-            }
-            if (outer_window_rect(*window).contains(r))
-                return true;
-        }
+void WSWindowManager::cancel_pending_move()
+{
+    if (!m_pending_move_window)
+        return;
+    m_pending_move_window = nullptr;
+    invalidate(m_pending_move_from);
+    invalidate(m_pending_move_to);
+}
+
+bool WSWindowManager::can_copy_pending_move(WSWindow& window)
+{
+    if (m_flash_flush || !window.is_visible() || window.opacity() != 1.0f || window.has_alpha_channel())
         return false;
-    };
+    if (!(outer_window_rect(window) == m_pending_move_to))
+        return false;
+    bool is_covered = false;
+    for_each_visible_window_from_front_to_back([&] (WSWindow& other) {
+        if (&other == &window)
+            return IterationDecision::Abort;
+        auto other_rect = outer_window_rect(other);
+        if (other_rect.intersects(m_pending_move_from) || other_rect.intersects(m_pending_move_to)) {
+            is_covered = true;
+            return IterationDecision::Abort;
+        }
+        return IterationDecision::Continue;
+    });
+    return !is_covered;
+}
 
-    auto any_opaque_window_above_this_one_contains_rect = [this] (const WSWindow& a_window, const Rect& rect) -> bool {
-        bool found = false;
-        bool checking = false;
-        for_each_visible_window_from_back_to_front([&] (WSWindow& window) {
-            if (&window == &a_window) {
-                checking = true;
-                return IterationDecision::Continue;
-            }
-            if (!checking)
-                return IterationDecision::Continue;
-            if (!window.is_visible())
-                return IterationDecision::Continue;;
-            if (window.opacity() < 1.0f)
-                return IterationDecision::Continue;;
-            if (window.has_alpha_channel())
-                return IterationDecision::Continue;;
-            if (outer_window_rect(window).contains(rect)) {
-                found = true;
-                return IterationDecision::Abort;
-            }
-            return IterationDecision::Continue;
-        });
-        return found;
+// The front buffer still shows the last frame, where the moved window sat unobscured at its old position.
+// Copying those pixels over beats recomposing the window, and leaves only what it uncovered to paint.
+// Returns the part of the back buffer that is now up to date.
+Rect WSWindowManager::apply_pending_move(DisjointRectSet& dirty_rects)
+{
+    if (!m_pending_move_window)
+        return { };
+    auto window = move(m_pending_move_window);
+    auto from = m_pending_move_from;
+    auto to = m_pending_move_to;
+    auto add_dirty_rect = [&] (const Rect& rect) {
+        auto clipped_rect = Rect::intersection(rect, m_screen_rect);
+        if (!clipped_rect.is_empty())
+            dirty_rects.add(clipped_rect);
     };
+    if (!window || !can_copy_pending_move(*window)) {
+        add_dirty_rect(from);
+        add_dirty_rect(to);
+        return { };
+    }
 
-    auto any_dirty_rect_intersects_window = [&dirty_rects] (const WSWindow& window) {
-        auto window_rect = outer_window_rect(window);
-        for (auto& dirty_rect : dirty_rects.rects()) {
-            if (dirty_rect.intersects(window_rect))
-                return true;
-        }
-        return false;
+    auto delta = to.location() - from.location();
+    auto destination = Rect::intersection(Rect::intersection(from, m_screen_rect).translated(delta), m_screen_rect);
+    if (destination.is_empty()) {
+        add_dirty_rect(to);
+        return { };
+    }
+    m_back_painter->blit(destination.location(), *m_front_bitmap, destination.translated(-delta));
+
+    // Anything already dirty where the window was (stale window content, the cursor) got copied along with it.
+    Vector<Rect, 8> damage_to_follow;
+    auto follow = [&] (const Rect& rect) {
+        auto moved_rect = Rect::intersection(rect, from).translated(delta);
+        if (!moved_rect.is_empty())
+            damage_to_follow.append(moved_rect);
     };
+    for (auto& rect : dirty_rects.rects())
+        follow(rect);
+    follow(m_front_buffer_cursor_rect);
+    follow(menubar_rect());
+    if (m_showing_stats_overlay)
+        follow(stats_overlay_rect());
+    for (auto& rect : damage_to_follow)
+        add_dirty_rect(rect);
+    for (auto& rect : from.shatter(to))
+        add_dirty_rect(rect);
+    // Parts of the window that were off-screen had nothing to copy from.
+    for (auto& rect : to.shatter(destination))
+        add_dirty_rect(rect);
+    // And the menubar only gets drawn where something's dirty.
+    add_dirty_rect(Rect::intersection(destination, menubar_rect()));
+    return destination;
+}
 
+// Paints the background and windows in the dirty rects, but only inside the painter's clip rect.
+// This may run on several threads at once, so it must not touch anything but the painter's pixels.
+void WSWindowManager::compose_band(Painter& painter, const DisjointRectSet& dirty_rects, FrameStats& stats)
+{
+    auto band_rect = painter.clip_rect();
+    // Only the parts nobody opaque covers get painted, so every pixel is touched once plus once per translucent window above it.
     for (auto& dirty_rect : dirty_rects.rects()) {
-        if (any_opaque_window_contains_rect(dirty_rect))
+        if (!dirty_rect.intersects(band_rect))
             continue;
-        if (!m_wallpaper)
-            m_back_painter->fill_rect(dirty_rect, m_background_color);
-        else
-            m_back_painter->blit(dirty_rect.location(), *m_wallpaper, dirty_rect);
+        for (auto& visible_rect : m_visible_background_rects) {
+            auto rect = Rect::intersection(dirty_rect, visible_rect);
+            if (rect.is_empty())
+                continue;
+            if (!m_wallpaper)
+                painter.fill_rect(rect, m_background_color);
+            else
+                painter.blit(rect.location(), *m_wallpaper, rect);
+            stats.pixels_blitted += Rect::intersection(rect, band_rect).size().area();
+        }
     }
 
     for_each_visible_window_from_back_to_front([&] (WSWindow& window) {
-        RetainPtr<GraphicsBitmap> backing_store = window.backing_store();
-        if (!any_dirty_rect_intersects_window(window))
-            return IterationDecision::Continue;
-        PainterStateSaver saver(*m_back_painter);
-        m_back_painter->add_clip_rect(outer_window_rect(window));
+        // Nothing can drop a backing store while we compose, and retaining it from several threads would race.
+        auto* backing_store = window.backing_store();
         for (auto& dirty_rect : dirty_rects.rects()) {
-            if (any_opaque_window_above_this_one_contains_rect(window, dirty_rect))
-                continue;
-            PainterStateSaver saver(*m_back_painter);
-            m_back_painter->add_clip_rect(dirty_rect);
-            paint_window_frame(window);
-            if (!backing_store)
+            if (!dirty_rect.intersects(band_rect))
                 continue;
-            Rect dirty_rect_in_window_coordinates = Rect::intersection(dirty_rect, window.rect());
-            if (dirty_rect_in_window_coordinates.is_empty())
-                continue;
-            dirty_rect_in_window_coordinates.move_by(-window.position());
-            auto dst = window.position();
-            dst.move_by(dirty_rect_in_window_coordinates.location());
-            if (window.opacity() == 1.0f)
-                m_back_painter->blit(dst, *backing_store, dirty_rect_in_window_coordinates);
-            else
-                m_back_painter->blit_with_opacity(dst, *backing_store, dirty_rect_in_window_coordinates, window.opacity());
+            for (auto& visible_rect : window.visible_rects()) {
+                auto rect = Rect::intersection(dirty_rect, visible_rect);
+                if (rect.is_empty())
+                    continue;
+                PainterStateSaver saver(painter);
+                painter.add_clip_rect(rect);
+                paint_cached_window_frame(painter, window);
+                if (!backing_store)
+                    continue;
+                Rect dirty_rect_in_window_coordinates = Rect::intersection(rect, window.rect());
+                if (dirty_rect_in_window_coordinates.is_empty())
+                    continue;
+                dirty_rect_in_window_coordinates.move_by(-window.position());
+                auto dst = window.position();
+                dst.move_by(dirty_rect_in_window_coordinates.location());
+                int pixels = Rect::intersection({ dst, dirty_rect_in_window_coordinates.size() }, band_rect).size().area();
+                if (window.opacity() == 1.0f && !backing_store->has_alpha_channel())
+                    stats.pixels_blitted += pixels;
+                else
+                    stats.pixels_blended += pixels;
+                if (window.opacity() == 1.0f)
+                    painter.blit(dst, *backing_store, dirty_rect_in_window_coordinates);
+                else
+                    painter.blit_with_opacity(dst, *backing_store, dirty_rect_in_window_coordinates, window.opacity());
+            }
         }
         return IterationDecision::Continue;
     });
+}
+
+static int microseconds_since(const timeval& start)
+{
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_usec - start.tv_usec);
+}
+
+void WSWindowManager::compose()
+{
+    timeval compose_start;
+    gettimeofday(&compose_start, nullptr);
 
-    draw_menubar();
-    draw_cursor();
+    // The cursor never counts as damage: each buffer puts back what was under its own cursor and draws it again on top.
+    erase_cursor(*m_back_bitmap, m_back_buffer_cursor_rect, m_back_buffer_cursor_save_under.ptr());
+
+    auto dirty_rects = move(m_dirty_rects);
+
+    Rect copied_rect = apply_pending_move(dirty_rects);
+    m_stacking_changed_since_last_compose = false;
+
+    // The switcher shows what the windows look like now, the thumbnails only rescale what was just drawn.
+    if (m_switcher.is_visible() && m_switcher.redraw_if_thumbnails_changed())
+        dirty_rects.add(Rect::intersection(m_switcher.rect(), m_screen_rect));
+
+    // We draw into the buffer that was on screen before the last flip, so it's also missing everything the last frame changed.
+    // Repainting that is cheaper than copying every composed pixel over to the other buffer after each flip.
+    Vector<Rect> this_frame_damage = dirty_rects.rects();
+    if (!copied_rect.is_empty())
+        this_frame_damage.append(copied_rect);
+    if (!m_last_frame_damage.is_empty()) {
+        DisjointRectSet stale_rects;
+        for (auto& rect : m_last_frame_damage)
+            stale_rects.add(rect);
+        if (!copied_rect.is_empty())
+            stale_rects.subtract(copied_rect);
+        dirty_rects.add(stale_rects);
+    }
+    m_last_frame_damage = move(this_frame_damage);
+
+    // A scattering of small rects costs more in per-rect clipping and setup than the pixels between them.
+    dirty_rects.collapse_if_cheaper(rect_overhead_in_pixels);
+    ++m_compose_count;
+#ifdef DEBUG_COUNTERS
+    dbgprintf("[WM] compose #%u (%u rects)\n", m_compose_count, dirty_rects.rects().size());
+#endif
+
+    recompute_occlusions();
+
+    // Title bars are only repainted when they change, and that happens out here since the bands may run in parallel.
+    for_each_visible_window_from_back_to_front([&] (WSWindow& window) {
+        if (window.type() != WSWindowType::Normal)
+            return IterationDecision::Continue;
+        auto outer_rect = outer_window_rect(window);
+        for (auto& dirty_rect : dirty_rects.rects()) {
+            if (dirty_rect.intersects(outer_rect)) {
+                update_title_bar_cache(window);
+                break;
+            }
+        }
+        return IterationDecision::Continue;
+    });
+
+    // Horizontal bands keep each band's pixels in one part of the framebuffer, and let workers paint them side by side.
+    // Several bands per thread even out the load when the damage is bunched up in one spot.
+    FrameStats stats;
+    stats.rect_count = dirty_rects.rects().size();
+    auto& pool = WSCompositorPool::the();
+    if (pool.thread_count() == 1) {
+        compose_band(*m_back_painter, dirty_rects, stats);
+    } else {
+        int band_count = min(pool.thread_count() * 4, max(m_screen_rect.height() / 32, 1));
+        // Everything the bands need lives for this frame only, and comes out of the frame arena.
+        ArenaScope frame_scope(m_frame_arena);
+        auto* band_painters = m_frame_arena.allocate_array<Painter*>(band_count);
+        // The painters retain the back bitmap, so they're made and destroyed here rather than in the workers.
+        for (int i = 0; i < band_count; ++i) {
+            int top = m_screen_rect.height() * i / band_count;
+            int bottom = m_screen_rect.height() * (i + 1) / band_count;
+            auto* painter = m_frame_arena.make<Painter>(*m_back_bitmap);
+            painter->set_font(font());
+            painter->add_clip_rect({ 0, top, m_screen_rect.width(), bottom - top });
+            band_painters[i] = painter;
+        }
+        // Each band counts into its own stats, there's no sharing between threads.
+        auto* band_stats = m_frame_arena.make_array<FrameStats>(band_count);
+        auto compose_one_band = [&] (int index) {
+            compose_band(*band_painters[index], dirty_rects, band_stats[index]);
+        };
+        pool.run(band_count, compose_one_band);
+        for (int i = 0; i < band_count; ++i) {
+            stats.pixels_blitted += band_stats[i].pixels_blitted;
+            stats.pixels_blended += band_stats[i].pixels_blended;
+            band_painters[i]->~Painter();
+        }
+    }
+
+    draw_menubar(dirty_rects);
+    if (m_showing_stats_overlay)
+        draw_stats_overlay(*m_back_painter);
+    draw_cursor(*m_back_painter, *m_back_bitmap, m_back_buffer_cursor_rect, m_back_buffer_cursor_save_under);
+
+    timeval flush_start;
+    gettimeofday(&flush_start, nullptr);
+    for (auto& rect : dirty_rects.rects())
+        flush(*m_back_bitmap, rect);
+    flush(*m_back_bitmap, copied_rect);
+    if (m_showing_stats_overlay)
+        flush(*m_back_bitmap, stats_overlay_rect());
 
     if (m_flash_flush) {
-        for (auto& rect : dirty_rects.rects())
+        for (auto& rect : dirty_rects.rects()) {
             m_front_painter->fill_rect(rect, Color::Yellow);
+            flush(*m_front_bitmap, rect);
+        }
     }
 
+    stats.flush_time_us = microseconds_since(flush_start);
+    stats.compose_time_us = microseconds_since(compose_start);
+    stats.compose_count = m_compose_count;
+    m_last_frame_stats = stats;
+    ++m_frames_this_second;
+
     flip_buffers();
-    for (auto& r : dirty_rects.rects())
-        flush(r);
+}
+
+void WSWindowManager::recompute_occlusions()
+{
+    if (!m_occlusions_dirty)
+        return;
+    m_occlusions_dirty = false;
+
+    // Walk down from the top, carving out what each opaque window hides from everything beneath it.
+    Vector<Rect> opaque_rects;
+    for_each_visible_window_from_front_to_back([&] (WSWindow& window) {
+        auto window_rect = outer_window_rect(window);
+        DisjointRectSet visible_rects(Rect::intersection(window_rect, m_screen_rect));
+        for (auto& opaque_rect : opaque_rects) {
+            if (visible_rects.is_empty())
+                break;
+            visible_rects.subtract(opaque_rect);
+        }
+        window.set_visible_rects(visible_rects.take_rects());
+        // FIXME: Just because the window has an alpha channel doesn't mean it's not opaque.
+        if (window.opacity() == 1.0f && !window.has_alpha_channel())
+            opaque_rects.append(window_rect);
+        return IterationDecision::Continue;
+    });
+
+    DisjointRectSet background_rects(m_screen_rect);
+    for (auto& opaque_rect : opaque_rects)
+        background_rects.subtract(opaque_rect);
+    m_visible_background_rects = background_rects.take_rects();
 }
 
 Rect WSWindowManager::current_cursor_rect() const
@@ -961,7 +1278,11 @@ Rect WSWindowManager::current_cursor_rect() const
 
 void WSWindowManager::invalidate_cursor()
 {
-    invalidate(current_cursor_rect());
+    // With a compose on the way the cursor gets drawn there, otherwise move it right on the screen we're showing.
+    if (m_pending_compose_event || m_flash_flush)
+        return;
+    erase_cursor(*m_front_bitmap, m_front_buffer_cursor_rect, m_front_buffer_cursor_save_under.ptr());
+    draw_cursor(*m_front_painter, *m_front_bitmap, m_front_buffer_cursor_rect, m_front_buffer_cursor_save_under);
 }
 
 Rect WSWindowManager::menubar_rect() const
@@ -969,20 +1290,20 @@ Rect WSWindowManager::menubar_rect() const
     return { 0, 0, m_screen_rect.width(), 18 };
 }
 
-void WSWindowManager::draw_menubar()
+void WSWindowManager::paint_menubar(Painter& painter)
 {
     auto menubar_rect = this->menubar_rect();
 
-    m_back_painter->fill_rect(menubar_rect, Color::LightGray);
-    m_back_painter->draw_line({ 0, menubar_rect.bottom() }, { menubar_rect.right(), menubar_rect.bottom() }, Color::White);
+    painter.fill_rect(menubar_rect, Color::LightGray);
+    painter.draw_line({ 0, menubar_rect.bottom() }, { menubar_rect.right(), menubar_rect.bottom() }, Color::White);
     int index = 0;
     for_each_active_menubar_menu([&] (WSMenu& menu) {
         Color text_color = Color::Black;
         if (&menu == current_menu()) {
-            m_back_painter->fill_rect(menu.rect_in_menubar(), menu_selection_color());
+            painter.fill_rect(menu.rect_in_menubar(), menu_selection_color());
             text_color = Color::White;
         }
-        m_back_painter->draw_text(
+        painter.draw_text(
             menu.text_rect_in_menubar(),
             menu.name(),
             index == 1 ? app_menu_font() : menu_font(),
@@ -1000,7 +1321,7 @@ void WSWindowManager::draw_menubar()
         username_width,
         menubar_rect.height()
     };
-    m_back_painter->draw_text(username_rect, m_username, Font::default_bold_font(), TextAlignment::CenterRight, Color::Black);
+    painter.draw_text(username_rect, m_username, Font::default_bold_font(), TextAlignment::CenterRight, Color::Black);
 
     time_t now = time(nullptr);
     auto* tm = localtime(&now);
@@ -1019,13 +1340,13 @@ void WSWindowManager::draw_menubar()
         menubar_rect.height()
     };
 
-    m_back_painter->draw_text(time_rect, time_text, font(), TextAlignment::CenterRight, Color::Black);
+    painter.draw_text(time_rect, time_text, font(), TextAlignment::CenterRight, Color::Black);
 
     Rect cpu_rect { time_rect.right() - font().width(time_text) - (int)m_cpu_history.capacity() - 10, time_rect.y() + 1, (int)m_cpu_history.capacity(), time_rect.height() - 2 };
-    m_back_painter->fill_rect(cpu_rect, Color::Black);
+    painter.fill_rect(cpu_rect, Color::Black);
     int i = m_cpu_history.capacity() - m_cpu_history.size();
     for (auto cpu_usage : m_cpu_history) {
-        m_back_painter->draw_line(
+        painter.draw_line(
             { cpu_rect.x() + i, cpu_rect.bottom() },
             { cpu_rect.x() + i, (int)(cpu_rect.y() + (cpu_rect.height() - (cpu_usage * (float)cpu_rect.height()))) },
             Color::from_rgb(0xaa6d4b)
@@ -1034,21 +1355,138 @@ void WSWindowManager::draw_menubar()
     }
 }
 
+void WSWindowManager::draw_menubar(const DisjointRectSet& dirty_rects)
+{
+    auto menubar_rect = this->menubar_rect();
+    if (!m_menubar_cache || m_menubar_cache->size() != menubar_rect.size()) {
+        m_menubar_cache = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, menubar_rect.size());
+        m_menubar_cache_is_stale = true;
+    }
+    if (m_menubar_cache_is_stale) {
+        Painter painter(*m_menubar_cache);
+        painter.set_font(font());
+        painter.translate(-menubar_rect.location());
+        paint_menubar(painter);
+        m_menubar_cache_is_stale = false;
+    }
+    for (auto& dirty_rect : dirty_rects.rects()) {
+        auto rect = Rect::intersection(dirty_rect, menubar_rect);
+        if (!rect.is_empty())
+            m_back_painter->blit(rect.location(), *m_menubar_cache, rect.translated(-menubar_rect.location()));
+    }
+}
+
+void WSWindowManager::sample_stats()
+{
+    m_frames_per_second = m_frames_this_second;
+    m_frames_this_second = 0;
+    WSClientConnection::for_each_client([] (WSClientConnection& client) {
+        client.sample_traffic();
+    });
+    if (m_showing_stats_overlay)
+        invalidate(stats_overlay_rect());
+}
+
+void WSWindowManager::set_showing_stats_overlay(bool showing)
+{
+    if (m_showing_stats_overlay == showing)
+        return;
+    m_showing_stats_overlay = showing;
+    // Going away, this repaints what's underneath.
+    invalidate(stats_overlay_rect());
+}
+
+static const int stats_overlay_busiest_client_count = 4;
+
+Rect WSWindowManager::stats_overlay_rect() const
+{
+    int line_count = 4 + stats_overlay_busiest_client_count;
+    int width = 320;
+    int height = line_count * (font().glyph_height() + 2) + 6;
+    return { m_screen_rect.right() - width - 3, menubar_rect().bottom() + 4, width, height };
+}
+
+void WSWindowManager::draw_stats_overlay(Painter& painter)
+{
+    auto rect = stats_overlay_rect();
+    painter.fill_rect(rect, Color::Black);
+    painter.draw_rect(rect, Color::MidGray);
+
+    int line_height = font().glyph_height() + 2;
+    Rect line_rect { rect.x() + 5, rect.y() + 3, rect.width() - 10, line_height };
+    auto draw_text_line = [&] (const String& text, Color color) {
+        painter.draw_text(line_rect, text, font(), TextAlignment::CenterLeft, color);
+        line_rect.move_by(0, line_height);
+    };
+
+    auto& stats = m_last_frame_stats;
+    draw_text_line(String::format("compose: %d us (flush %d us), %d rects, %d fps", stats.compose_time_us, stats.flush_time_us, stats.rect_count, m_frames_per_second), Color::White);
+    draw_text_line(String::format("blitted: %d px", stats.pixels_blitted), Color::White);
+    draw_text_line(String::format("blended: %d px", stats.pixels_blended), Color::White);
+    draw_text_line(String::format("input: %d us late", m_input_latency_us), Color::White);
+
+    // The clients with the most traffic over the last second, busiest first.
+    Vector<WSClientConnection*> clients;
+    WSClientConnection::for_each_client([&] (WSClientConnection& client) {
+        clients.append(&client);
+    });
+    auto bytes_per_second = [] (const WSClientConnection& client) {
+        auto& traffic = client.traffic_per_second();
+        return traffic.bytes_received + traffic.bytes_sent;
+    };
+    for (int i = 0; i < stats_overlay_busiest_client_count && i < clients.size(); ++i) {
+        int busiest = i;
+        for (int j = i + 1; j < clients.size(); ++j) {
+            if (bytes_per_second(*clients[j]) > bytes_per_second(*clients[busiest]))
+                busiest = j;
+        }
+        swap(clients[i], clients[busiest]);
+        auto& traffic = clients[i]->traffic_per_second();
+        draw_text_line(String::format("pid %d: %d/%d msg/s, %d B/s",
+            clients[i]->pid(),
+            traffic.messages_received,
+            traffic.messages_sent,
+            bytes_per_second(*clients[i])), Color::from_rgb(0xaa6d4b));
+    }
+}
+
+void WSWindowManager::invalidate_menubar()
+{
+    m_menubar_cache_is_stale = true;
+    invalidate(menubar_rect());
+}
+
 void WSWindowManager::draw_window_switcher()
 {
     if (m_switcher.is_visible())
         m_switcher.draw();
 }
 
-void WSWindowManager::draw_cursor()
+static void copy_pixels(GraphicsBitmap& destination, const Point& destination_position, const GraphicsBitmap& source, const Rect& source_rect)
 {
-    Rect cursor_rect = current_cursor_rect();
-    Color inner_color = Color::White;
-    Color outer_color = Color::Black;
-    if (m_screen.mouse_button_state() & (unsigned)MouseButton::Left)
-        swap(inner_color, outer_color);
-    m_back_painter->blit(cursor_rect.location(), active_cursor().bitmap(), active_cursor().rect());
-    m_last_cursor_rect = cursor_rect;
+    for (int row = 0; row < source_rect.height(); ++row)
+        memcpy(destination.scanline(destination_position.y() + row) + destination_position.x(), source.scanline(source_rect.y() + row) + source_rect.x(), source_rect.width() * sizeof(RGBA32));
+}
+
+void WSWindowManager::erase_cursor(GraphicsBitmap& target, Rect& cursor_rect, const GraphicsBitmap* save_under)
+{
+    if (cursor_rect.is_empty())
+        return;
+    ASSERT(save_under);
+    copy_pixels(target, cursor_rect.location(), *save_under, { { }, cursor_rect.size() });
+    flush(target, cursor_rect);
+    cursor_rect = { };
+}
+
+void WSWindowManager::draw_cursor(Painter& painter, GraphicsBitmap& target, Rect& cursor_rect, RetainPtr<GraphicsBitmap>& save_under)
+{
+    auto location = current_cursor_rect().location();
+    cursor_rect = Rect::intersection(current_cursor_rect(), m_screen_rect);
+    if (!save_under || save_under->width() < cursor_rect.width() || save_under->height() < cursor_rect.height())
+        save_under = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, active_cursor().size());
+    copy_pixels(*save_under, { }, target, cursor_rect);
+    painter.blit(location, active_cursor().bitmap(), active_cursor().rect());
+    flush(target, cursor_rect);
 }
 
 void WSWindowManager::on_message(WSMessage& message)
@@ -1066,6 +1504,10 @@ void WSWindowManager::on_message(WSMessage& message)
 
         if (key_event.type() == WSMessage::KeyDown && key_event.modifiers() == Mod_Logo && key_event.key() == Key_Tab)
             m_switcher.show();
+        if (key_event.type() == WSMessage::KeyDown && key_event.modifiers() == Mod_Logo && key_event.key() == Key_F12) {
+            set_showing_stats_overlay(!m_showing_stats_overlay);
+            return;
+        }
         if (m_switcher.is_visible()) {
             m_switcher.on_key_event(key_event);
             return;
@@ -1089,6 +1531,7 @@ void WSWindowManager::set_highlight_window(WSWindow* window)
     if (auto* previous_highlight_window = m_highlight_window.ptr())
         invalidate(*previous_highlight_window);
     m_highlight_window = window ? window->make_weak_ptr() : nullptr;
+    invalidate_occlusions();
     if (m_highlight_window)
         invalidate(*m_highlight_window);
 }
@@ -1155,10 +1598,16 @@ void WSWindowManager::invalidate(const Rect& a_rect, bool should_schedule_compos
 
     m_dirty_rects.add(rect);
 
-    if (should_schedule_compose_event && !m_pending_compose_event) {
-        WSMessageLoop::the().post_message(*this, make<WSMessage>(WSMessage::WM_DeferredCompose));
-        m_pending_compose_event = true;
-    }
+    if (should_schedule_compose_event)
+        schedule_compose();
+}
+
+void WSWindowManager::schedule_compose()
+{
+    if (m_pending_compose_event)
+        return;
+    WSMessageLoop::the().post_message(*this, make<WSMessage>(WSMessage::WM_DeferredCompose));
+    m_pending_compose_event = true;
 }
 
 void WSWindowManager::invalidate(const WSWindow& window)
@@ -1192,25 +1641,6 @@ void WSWindowManager::invalidate(const WSWindow& window, const Rect& rect)
     invalidate(inner_rect);
 }
 
-void WSWindowManager::flush(const Rect& a_rect)
-{
-    auto rect = Rect::intersection(a_rect, m_screen_rect);
-
-#ifdef DEBUG_COUNTERS
-    dbgprintf("[WM] flush #%u (%d,%d %dx%d)\n", ++m_flush_count, rect.x(), rect.y(), rect.width(), rect.height());
-#endif
-
-    const RGBA32* front_ptr = m_front_bitmap->scanline(rect.y()) + rect.x();
-    RGBA32* back_ptr = m_back_bitmap->scanline(rect.y()) + rect.x();
-    size_t pitch = m_back_bitmap->pitch();
-
-    for (int y = 0; y < rect.height(); ++y) {
-        fast_dword_copy(back_ptr, front_ptr, rect.width());
-        front_ptr = (const RGBA32*)((const byte*)front_ptr + pitch);
-        back_ptr = (RGBA32*)((byte*)back_ptr + pitch);
-    }
-}
-
 void WSWindowManager::close_menu(WSMenu& menu)
 {
     if (current_menu() == &menu)
@@ -1234,7 +1664,7 @@ void WSWindowManager::notify_client_changed_app_menubar(WSClientConnection& clie
 {
     if (active_client() == &client)
         set_current_menubar(client.app_menubar());
-    invalidate(menubar_rect());
+    invalidate_menubar();
 }
 
 const WSCursor& WSWindowManager::active_cursor() const
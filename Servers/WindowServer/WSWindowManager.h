@@ -4,6 +4,7 @@
 #include <SharedGraphics/Color.h>
 #include <SharedGraphics/Painter.h>
 #include <SharedGraphics/DisjointRectSet.h>
+#include <AK/ArenaAllocator.h>
 #include <AK/HashTable.h>
 #include <AK/InlineLinkedList.h>
 #include <AK/WeakPtr.h>
@@ -52,8 +53,7 @@ public:
     void move_to_front_and_make_active(WSWindow&);
 
     void invalidate_cursor();
-    void draw_cursor();
-    void draw_menubar();
+    void invalidate_menubar();
     void draw_window_switcher();
 
     Rect menubar_rect() const;
@@ -66,8 +66,10 @@ public:
     void invalidate(const WSWindow&, const Rect&);
     void invalidate(const Rect&, bool should_schedule_compose_event = true);
     void invalidate();
+
+    // Something changed which windows cover which, recompute everyone's visible rects before the next compose.
+    void invalidate_occlusions();
     void recompose_immediately();
-    void flush(const Rect&);
 
     const Font& font() const;
     const Font& window_title_font() const;
@@ -81,12 +83,33 @@ public:
 
     void set_resolution(int width, int height);
 
-    bool set_wallpaper(const String& path);
+    // The image is decoded and scaled on ImageDecoder's worker, so composing goes on in the meantime.
+    void set_wallpaper(const String& path, Function<void(bool success)>&&);
     String wallpaper_path() const { return m_wallpaper_path; }
 
     const WSCursor& active_cursor() const;
     Rect current_cursor_rect() const;
 
+    // What the last compose cost. Pixels blended went through a translucent window or an alpha channel.
+    struct FrameStats {
+        // Which compose it was, they're counted from startup.
+        unsigned compose_count { 0 };
+        // All of the compose, flushing the dirty rects to the screen included.
+        int compose_time_us { 0 };
+        int flush_time_us { 0 };
+        int rect_count { 0 };
+        int pixels_blitted { 0 };
+        int pixels_blended { 0 };
+    };
+    const FrameStats& last_frame_stats() const { return m_last_frame_stats; }
+    int frames_per_second() const { return m_frames_per_second; }
+    // How long the last batch of keyboard or mouse input waited in the kernel, only kept up while the overlay shows.
+    void set_input_latency_us(int us) { m_input_latency_us = us; }
+
+    // Logo+F12 toggles an overlay with those, and which clients send and get the most messages.
+    bool is_showing_stats_overlay() const { return m_showing_stats_overlay; }
+    void set_showing_stats_overlay(bool);
+
 private:
     void process_mouse_event(WSMouseEvent&, WSWindow*& event_window);
     bool process_ongoing_window_resize(WSMouseEvent&, WSWindow*& event_window);
@@ -107,9 +130,29 @@ private:
     void close_current_menu();
     virtual void on_message(WSMessage&) override;
     void compose();
-    void paint_window_frame(WSWindow&);
+    void recompute_occlusions();
+    bool can_copy_pending_move(WSWindow&);
+    Rect apply_pending_move(DisjointRectSet& dirty_rects);
+    void cancel_pending_move();
+    void schedule_compose();
+    void compose_band(Painter&, const DisjointRectSet& dirty_rects, FrameStats&);
+    enum class FrameState { Inactive, Active, Dragging, Highlighted };
+    FrameState frame_state(const WSWindow&) const;
+    void update_title_bar_cache(WSWindow&);
+    void paint_cached_window_frame(Painter&, WSWindow&);
+    void paint_window_frame(Painter&, WSWindow&);
+    void create_screen_bitmaps();
+    void flush(const GraphicsBitmap&, const Rect&);
     void flip_buffers();
+    void scale_wallpaper_to_screen();
+    void draw_menubar(const DisjointRectSet& dirty_rects);
+    void paint_menubar(Painter&);
+    void draw_cursor(Painter&, GraphicsBitmap&, Rect& cursor_rect, RetainPtr<GraphicsBitmap>& save_under);
+    void erase_cursor(GraphicsBitmap&, Rect& cursor_rect, const GraphicsBitmap* save_under);
     void tick_clock();
+    void sample_stats();
+    Rect stats_overlay_rect() const;
+    void draw_stats_overlay(Painter&);
 
     WSScreen& m_screen;
     Rect m_screen_rect;
@@ -145,15 +188,33 @@ private:
     Point m_resize_origin;
     ResizeDirection m_resize_direction { ResizeDirection::None };
 
-    Rect m_last_cursor_rect;
+    // Each buffer keeps where its cursor is drawn and the pixels underneath, so the cursor can move without a compose.
+    Rect m_front_buffer_cursor_rect;
+    Rect m_back_buffer_cursor_rect;
+    RetainPtr<GraphicsBitmap> m_front_buffer_cursor_save_under;
+    RetainPtr<GraphicsBitmap> m_back_buffer_cursor_save_under;
 
     unsigned m_compose_count { 0 };
-    unsigned m_flush_count { 0 };
+
+    FrameStats m_last_frame_stats;
+    int m_frames_this_second { 0 };
+    int m_frames_per_second { 0 };
+    int m_input_latency_us { 0 };
+    bool m_showing_stats_overlay { false };
 
     RetainPtr<GraphicsBitmap> m_front_bitmap;
     RetainPtr<GraphicsBitmap> m_back_bitmap;
 
     DisjointRectSet m_dirty_rects;
+    Vector<Rect> m_last_frame_damage;
+    bool m_occlusions_dirty { true };
+    bool m_stacking_changed_since_last_compose { true };
+    Vector<Rect> m_visible_background_rects;
+
+    // An opaque window that only moved since the last compose, see apply_pending_move().
+    WeakPtr<WSWindow> m_pending_move_window;
+    Rect m_pending_move_from;
+    Rect m_pending_move_to;
 
     bool m_pending_compose_event { false };
 
@@ -169,7 +230,16 @@ private:
     OwnPtr<Painter> m_back_painter;
     OwnPtr<Painter> m_front_painter;
 
+    // Per-frame temporaries of compose(), taken back all at once at the end of it.
+    ArenaAllocator m_frame_arena;
+
+    // The menubar is only repainted when its menus, clock or CPU graph change, compose just blits it.
+    RetainPtr<GraphicsBitmap> m_menubar_cache;
+    bool m_menubar_cache_is_stale { true };
+
     String m_wallpaper_path;
+    String m_requested_wallpaper_path;
+    RetainPtr<GraphicsBitmap> m_unscaled_wallpaper;
     RetainPtr<GraphicsBitmap> m_wallpaper;
 
     bool m_flash_flush { false };
@@ -79,12 +79,37 @@ void WSWindowSwitcher::draw()
             text_color = Color::Black;
             rect_text_color = Color::MidGray;
         }
-        painter.blit(item_rect.location().translated(0, (item_rect.height() - window.icon().height()) / 2), window.icon(), window.icon().rect());
-        painter.draw_text(item_rect.translated(window.icon().width() + 4, 0), window.title(), WSWindowManager::the().window_title_font(), TextAlignment::CenterLeft, text_color);
+        auto thumbnail_bounds = WSWindow::max_thumbnail_size();
+        Rect thumbnail_rect { { }, thumbnail_bounds };
+        thumbnail_rect.center_within({ item_rect.x() + 4, item_rect.y(), thumbnail_bounds.width(), item_rect.height() });
+        if (auto* thumbnail = window.thumbnail()) {
+            Rect rect { { }, thumbnail->size() };
+            rect.center_within(thumbnail_rect);
+            painter.blit(rect.location(), *thumbnail, thumbnail->rect());
+            painter.draw_rect(rect.inflated(2, 2), Color::DarkGray);
+        }
+        int title_x = thumbnail_rect.right() + 8;
+        painter.blit({ title_x, item_rect.y() + (item_rect.height() - window.icon().height()) / 2 }, window.icon(), window.icon().rect());
+        Rect title_rect { title_x + window.icon().width() + 4, item_rect.y(), item_rect.right() - title_x - window.icon().width() - 4, item_rect.height() };
+        painter.draw_text(title_rect, window.title(), WSWindowManager::the().window_title_font(), TextAlignment::CenterLeft, text_color);
         painter.draw_text(item_rect, window.rect().to_string(), TextAlignment::CenterRight, rect_text_color);
     }
 }
 
+bool WSWindowSwitcher::redraw_if_thumbnails_changed()
+{
+    bool changed = false;
+    for (auto& window : m_windows) {
+        if (window && window->has_thumbnail_damage()) {
+            changed = true;
+            break;
+        }
+    }
+    if (changed)
+        draw();
+    return changed;
+}
+
 void WSWindowSwitcher::refresh()
 {
     WSWindow* selected_window = nullptr;
@@ -107,7 +132,8 @@ void WSWindowSwitcher::refresh()
         return;
     }
     int space_for_window_rect = 180;
-    m_rect.set_width(longest_title_width + space_for_window_rect + padding() * 2);
+    int space_for_thumbnail = WSWindow::max_thumbnail_size().width() + 12;
+    m_rect.set_width(space_for_thumbnail + longest_title_width + space_for_window_rect + padding() * 2);
     m_rect.set_height(window_count * item_height() + padding() * 2);
     m_rect.center_within(WSWindowManager::the().m_screen_rect);
     if (!m_switcher_window)
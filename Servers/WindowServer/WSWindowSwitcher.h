@@ -1,13 +1,14 @@
 #pragma once
 
 #include <SharedGraphics/Rect.h>
+#include <AK/OwnPtr.h>
 #include <AK/Vector.h>
 #include <AK/WeakPtr.h>
 #include <WindowServer/WSMessageReceiver.h>
+#include <WindowServer/WSWindow.h>
 
 class Painter;
 class WSKeyEvent;
-class WSWindow;
 
 class WSWindowSwitcher : public WSMessageReceiver {
 public:
@@ -24,8 +25,12 @@ public:
     void refresh();
 
     void draw();
+    // Repaints the switcher if any of the windows in it have drawn since, and returns whether it did.
+    bool redraw_if_thumbnails_changed();
 
-    int item_height() { return 20; }
+    Rect rect() const { return m_rect; }
+
+    int item_height() { return WSWindow::max_thumbnail_size().height() + 8; }
     int padding() { return 8; }
 
     WSWindow* selected_window();
@@ -2,9 +2,10 @@
 #include <WindowServer/WSWindowManager.h>
 #include <WindowServer/WSMessageLoop.h>
 #include <signal.h>
+#include <string.h>
 #include <stdio.h>
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
     struct sigaction act;
     memset(&act, 0, sizeof(act));
@@ -17,7 +18,9 @@ int main(int, char**)
     }
 
     WSMessageLoop loop;
-    WSScreen screen(1024, 768);
+    // 16 bpp halves the bytes going out to the framebuffer, for hardware where that's what limits us.
+    int bpp = argc > 1 && !strcmp(argv[1], "--16bpp") ? 16 : 32;
+    WSScreen screen(1024, 768, bpp);
     WSWindowManager window_manager;
 
     dbgprintf("Entering WindowServer main loop.\n");
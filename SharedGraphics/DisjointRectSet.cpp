@@ -1,45 +1,224 @@
 #include <SharedGraphics/DisjointRectSet.h>
+#include <AK/QuickSort.h>
 
-void DisjointRectSet::add(const Rect& new_rect)
+// A horizontal run [left, right) within a band.
+struct Span {
+    int left;
+    int right;
+};
+
+// A band rarely has more than a handful of spans, so these stay off the heap.
+typedef Vector<Span, 16> SpanVector;
+
+// Collects the spans of the band covering row |y|. |cursor| only moves forward, so a whole sweep costs one pass.
+static void spans_at(const Rect* rects, int rect_count, int& cursor, int y, SpanVector& spans)
 {
-    for (auto& rect : m_rects) {
-        if (rect.contains(new_rect))
-            return;
+    spans.clear_with_capacity();
+    while (cursor < rect_count && rects[cursor].bottom() < y)
+        ++cursor;
+    for (int i = cursor; i < rect_count && rects[i].top() <= y; ++i)
+        spans.append({ rects[i].left(), rects[i].right() + 1 });
+}
+
+static void append_span(SpanVector& spans, int left, int right)
+{
+    if (left >= right)
+        return;
+    if (!spans.is_empty() && spans.last().right >= left) {
+        spans.last().right = max(spans.last().right, right);
+        return;
     }
+    spans.append({ left, right });
+}
 
-    m_rects.append(new_rect);
-    if (m_rects.size() > 1)
-        shatter();
-}
-
-void DisjointRectSet::shatter()
-{
-    Vector<Rect> output;
-    output.ensure_capacity(m_rects.size());
-    bool pass_had_intersections = false;
-    do {
-        pass_had_intersections = false;
-        output.clear_with_capacity();
-        for (int i = 0; i < m_rects.size(); ++i) {
-            auto& r1 = m_rects[i];
-            for (int j = 0; j < m_rects.size(); ++j) {
-                if (i == j)
-                    continue;
-                auto& r2 = m_rects[j];
-                if (!r1.intersects(r2))
-                    continue;
-                pass_had_intersections = true;
-                auto pieces = r1.shatter(r2);
-                for (auto& piece : pieces)
-                    output.append(piece);
-                m_rects.remove(i);
-                for (; i < m_rects.size(); ++i)
-                    output.append(m_rects[i]);
-                goto next_pass;
+static void combine_spans(const SpanVector& a, const SpanVector& b, SpanVector& out, DisjointRectSet::Operation operation)
+{
+    out.clear_with_capacity();
+    int i = 0;
+    int j = 0;
+    if (operation == DisjointRectSet::Operation::Union) {
+        while (i < a.size() || j < b.size()) {
+            if (j >= b.size() || (i < a.size() && a[i].left <= b[j].left)) {
+                append_span(out, a[i].left, a[i].right);
+                ++i;
+            } else {
+                append_span(out, b[j].left, b[j].right);
+                ++j;
+            }
+        }
+        return;
+    }
+    if (operation == DisjointRectSet::Operation::Subtract) {
+        for (; i < a.size(); ++i) {
+            int left = a[i].left;
+            while (j < b.size() && b[j].right <= left)
+                ++j;
+            for (int k = j; k < b.size() && b[k].left < a[i].right; ++k) {
+                append_span(out, left, b[k].left);
+                left = max(left, b[k].right);
             }
-            output.append(r1);
+            append_span(out, left, a[i].right);
         }
-next_pass:
-        swap(output, m_rects);
-    } while(pass_had_intersections);
+        return;
+    }
+    ASSERT(operation == DisjointRectSet::Operation::Intersect);
+    while (i < a.size() && j < b.size()) {
+        append_span(out, max(a[i].left, b[j].left), min(a[i].right, b[j].right));
+        if (a[i].right < b[j].right)
+            ++i;
+        else
+            ++j;
+    }
+}
+
+static bool spans_equal(const SpanVector& a, const SpanVector& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (int i = 0; i < a.size(); ++i) {
+        if (a[i].left != b[i].left || a[i].right != b[i].right)
+            return false;
+    }
+    return true;
+}
+
+// Sweeps down through every row where either side starts or ends a band, combining their spans one band at a time.
+void DisjointRectSet::apply(Operation operation, const Rect* other, int other_count)
+{
+    Vector<int, 64> edges;
+    edges.ensure_capacity((m_rects.size() + other_count) * 2);
+    for (auto& rect : m_rects) {
+        edges.append(rect.top());
+        edges.append(rect.bottom() + 1);
+    }
+    for (int i = 0; i < other_count; ++i) {
+        edges.append(other[i].top());
+        edges.append(other[i].bottom() + 1);
+    }
+    quick_sort(edges.begin(), edges.end(), [] (int a, int b) { return a < b; });
+
+    Vector<Rect> result;
+    SpanVector spans_a;
+    SpanVector spans_b;
+    SpanVector spans;
+    SpanVector previous_spans;
+    int previous_band_start = 0;
+    int previous_bottom = 0;
+    int cursor_a = 0;
+    int cursor_b = 0;
+    for (int e = 0; e + 1 < edges.size(); ++e) {
+        int top = edges[e];
+        int bottom = edges[e + 1];
+        if (top == bottom)
+            continue;
+        spans_at(m_rects.data(), m_rects.size(), cursor_a, top, spans_a);
+        spans_at(other, other_count, cursor_b, top, spans_b);
+        combine_spans(spans_a, spans_b, spans, operation);
+        if (spans.is_empty())
+            continue;
+        // Stretch the band above instead of starting a new one when nothing changes between them.
+        if (previous_bottom == top && !result.is_empty() && spans_equal(spans, previous_spans)) {
+            for (int i = previous_band_start; i < result.size(); ++i)
+                result[i].set_height(bottom - result[i].top());
+        } else {
+            previous_band_start = result.size();
+            for (auto& span : spans)
+                result.append({ span.left, top, span.right - span.left, bottom - top });
+            swap(previous_spans, spans);
+        }
+        previous_bottom = bottom;
+    }
+    m_rects = move(result);
+}
+
+void DisjointRectSet::add(const Rect& rect)
+{
+    if (rect.is_empty())
+        return;
+    for (auto& existing_rect : m_rects) {
+        if (existing_rect.contains(rect))
+            return;
+    }
+    apply(Operation::Union, &rect, 1);
+}
+
+void DisjointRectSet::add(const DisjointRectSet& other)
+{
+    if (!other.is_empty())
+        apply(Operation::Union, other.m_rects.data(), other.m_rects.size());
+}
+
+void DisjointRectSet::subtract(const Rect& rect)
+{
+    if (rect.is_empty() || !intersects(rect))
+        return;
+    apply(Operation::Subtract, &rect, 1);
+}
+
+void DisjointRectSet::intersect(const Rect& rect)
+{
+    if (rect.is_empty()) {
+        m_rects.clear();
+        return;
+    }
+    apply(Operation::Intersect, &rect, 1);
+}
+
+bool DisjointRectSet::intersects(const Rect& rect) const
+{
+    for (auto& existing_rect : m_rects) {
+        if (existing_rect.intersects(rect))
+            return true;
+    }
+    return false;
+}
+
+bool DisjointRectSet::contains(const Rect& rect) const
+{
+    if (rect.is_empty())
+        return true;
+    DisjointRectSet remainder(rect);
+    for (auto& existing_rect : m_rects) {
+        if (!existing_rect.intersects(rect))
+            continue;
+        remainder.subtract(existing_rect);
+        if (remainder.is_empty())
+            return true;
+    }
+    return false;
+}
+
+Rect DisjointRectSet::bounding_rect() const
+{
+    if (m_rects.is_empty())
+        return { };
+    int left = m_rects.first().left();
+    int right = m_rects.first().right();
+    for (auto& rect : m_rects) {
+        left = min(left, rect.left());
+        right = max(right, rect.right());
+    }
+    int top = m_rects.first().top();
+    int bottom = m_rects.last().bottom();
+    return { left, top, right - left + 1, bottom - top + 1 };
+}
+
+int DisjointRectSet::area() const
+{
+    int area = 0;
+    for (auto& rect : m_rects)
+        area += rect.width() * rect.height();
+    return area;
+}
+
+void DisjointRectSet::collapse_if_cheaper(int cost_per_rect_in_pixels)
+{
+    if (m_rects.size() <= 1)
+        return;
+    auto bounding_rect = this->bounding_rect();
+    int wasted_pixels = bounding_rect.width() * bounding_rect.height() - area();
+    if (wasted_pixels > (m_rects.size() - 1) * cost_per_rect_in_pixels)
+        return;
+    m_rects.clear_with_capacity();
+    m_rects.append(bounding_rect);
 }
@@ -3,21 +3,47 @@
 #include <AK/Vector.h>
 #include <SharedGraphics/Rect.h>
 
+// A region of the plane, kept as disjoint rects in y-x bands like X11 regions:
+// rects are sorted top to bottom, every rect in a band has the same top and height,
+// a band's rects are sorted left to right and never touch, and no two touching bands have the same spans.
 class DisjointRectSet {
 public:
     DisjointRectSet() { }
     ~DisjointRectSet() { }
     DisjointRectSet(DisjointRectSet&& other) : m_rects(move(other.m_rects)) { }
+    explicit DisjointRectSet(const Rect& rect) { add(rect); }
+
+    DisjointRectSet& operator=(DisjointRectSet&& other)
+    {
+        if (this != &other)
+            m_rects = move(other.m_rects);
+        return *this;
+    }
 
     void add(const Rect&);
+    void add(const DisjointRectSet&);
+    void subtract(const Rect&);
+    void intersect(const Rect&);
+
+    bool is_empty() const { return m_rects.is_empty(); }
+    bool intersects(const Rect&) const;
+    bool contains(const Rect&) const;
+    Rect bounding_rect() const;
+    int area() const;
+
+    // Painting each rect has a fixed cost on top of its pixels. When the pieces cover so much of their
+    // bounding rect that the overhead outweighs the pixels in between, replace them with the bounding rect.
+    void collapse_if_cheaper(int cost_per_rect_in_pixels);
 
     void clear() { m_rects.clear(); }
     void clear_with_capacity() { m_rects.clear_with_capacity(); }
     const Vector<Rect>& rects() const { return m_rects; }
+    Vector<Rect> take_rects() { return move(m_rects); }
+
+    enum class Operation { Union, Subtract, Intersect };
 
 private:
-    void shatter();
+    void apply(Operation, const Rect* other, int other_count);
 
     Vector<Rect> m_rects;
 };
-
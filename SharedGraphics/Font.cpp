@@ -90,23 +90,34 @@ Font::Font(const String& name, unsigned* rows, byte* widths, bool is_fixed_width
 
 Font::~Font()
 {
-    if (m_mmap_ptr) {
-        int rc = munmap(m_mmap_ptr, 4096 * 3);
-        ASSERT(rc == 0);
-    }
 }
 
-RetainPtr<Font> Font::load_from_memory(const byte* data)
+static bool is_valid_header(const FontFileHeader& header)
 {
-    auto& header = *reinterpret_cast<const FontFileHeader*>(data);
     if (memcmp(header.magic, "!Fnt", 4)) {
         dbgprintf("header.magic != '!Fnt', instead it's '%c%c%c%c'\n", header.magic[0], header.magic[1], header.magic[2], header.magic[3]);
-        return nullptr;
+        return false;
     }
     if (header.name[63] != '\0') {
         dbgprintf("Font name not fully null-terminated\n");
-        return nullptr;
+        return false;
     }
+    return true;
+}
+
+static size_t file_size_for_header(const FontFileHeader& header)
+{
+    size_t size = sizeof(FontFileHeader) + 256 * sizeof(unsigned) * header.glyph_height;
+    if (header.is_variable_width)
+        size += 256;
+    return size;
+}
+
+RetainPtr<Font> Font::load_from_memory(const byte* data)
+{
+    auto& header = *reinterpret_cast<const FontFileHeader*>(data);
+    if (!is_valid_header(header))
+        return nullptr;
 
     size_t bytes_per_glyph = sizeof(unsigned) * header.glyph_height;
 
@@ -119,26 +130,37 @@ RetainPtr<Font> Font::load_from_memory(const byte* data)
 
 RetainPtr<Font> Font::load_from_file(const String& path)
 {
-    int fd = open(path.characters(), O_RDONLY, 0644);
-    if (fd < 0) {
-        dbgprintf("open(%s) got fd=%d, failed: %s\n", path.characters(), fd, strerror(errno));
-        perror("open");
+    // Every glyph is there to be drawn, and fonts are small, so just get it all in at once.
+    MappedFile mapped_file(path, MappedFile::AccessPattern::Normal, MappedFile::Populate::Yes);
+    if (!mapped_file.is_valid())
         return nullptr;
-    }
-
-    auto* mapped_file = (byte*)mmap(nullptr, 4096 * 3, PROT_READ, MAP_SHARED, fd, 0);
-    if (mapped_file == MAP_FAILED) {
-        int rc = close(fd);
-        ASSERT(rc == 0);
+    auto* data = (const byte*)mapped_file.pointer();
+    if (mapped_file.file_length() < sizeof(FontFileHeader) || mapped_file.file_length() < file_size_for_header(*(const FontFileHeader*)data)) {
+        dbgprintf("Font file %s is too short\n", path.characters());
         return nullptr;
     }
 
-    auto font = load_from_memory(mapped_file);
-    font->m_mmap_ptr = mapped_file;
+    auto font = load_from_memory(data);
+    if (font)
+        font->m_mapped_file = move(mapped_file);
+    return font;
+}
 
+bool Font::read_file_info(const String& path, FileInfo& info)
+{
+    int fd = open(path.characters(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    FontFileHeader header;
+    ssize_t nread = read(fd, &header, sizeof(header));
     int rc = close(fd);
     ASSERT(rc == 0);
-    return font;
+    if (nread != sizeof(header) || !is_valid_header(header))
+        return false;
+    info.name = header.name;
+    info.glyph_height = header.glyph_height;
+    info.is_fixed_width = !header.is_variable_width;
+    return true;
 }
 
 bool Font::write_to_file(const String& path)
@@ -177,15 +199,20 @@ bool Font::write_to_file(const String& path)
 
 int Font::width(const String& string) const
 {
-    if (string.is_empty())
+    return width(string.characters(), string.length());
+}
+
+int Font::width(const char* characters, int length) const
+{
+    if (!length)
         return 0;
 
     if (m_fixed_width)
-        return string.length() * m_glyph_width;
-
-    int width = 0;
-    for (int i = 0; i < string.length(); ++i)
-        width += glyph_width(string[i]) + 1;
+        return length * m_glyph_width;
 
-    return width - 1;
+    // Every glyph but the last is followed by a pixel of spacing.
+    int width = length - 1;
+    for (int i = 0; i < length; ++i)
+        width += m_glyph_widths[(byte)characters[i]];
+    return width;
 }
@@ -4,6 +4,7 @@
 #include <AK/Retainable.h>
 #include <AK/RetainPtr.h>
 #include <AK/AKString.h>
+#include <AK/MappedFile.h>
 #include <AK/Types.h>
 
 // FIXME: Make a MutableGlyphBitmap buddy class for FontEditor instead?
@@ -49,9 +50,18 @@ public:
 
     static RetainPtr<Font> load_from_memory(const byte*);
 
+    // The glyphs are used straight from the file's pages, shared with everyone else who has it open.
     static RetainPtr<Font> load_from_file(const String& path);
     bool write_to_file(const String& path);
 
+    // What a font file's header says, without mapping its glyphs.
+    struct FileInfo {
+        String name;
+        byte glyph_height { 0 };
+        bool is_fixed_width { false };
+    };
+    static bool read_file_info(const String& path, FileInfo&);
+
     ~Font();
 
     GlyphBitmap glyph_bitmap(char ch) const { return GlyphBitmap(&m_rows[(byte)ch * m_glyph_height], { glyph_width(ch), m_glyph_height }); }
@@ -62,6 +72,7 @@ public:
     byte max_glyph_width() const { return m_max_glyph_width; }
     byte glyph_spacing() const { return m_fixed_width ? 0 : 1; }
     int width(const String& string) const;
+    int width(const char*, int length) const;
 
     String name() const { return m_name; }
     void set_name(const String& name) { m_name = name; }
@@ -82,7 +93,7 @@ private:
 
     unsigned* m_rows { nullptr };
     byte* m_glyph_widths { nullptr };
-    void* m_mmap_ptr { nullptr };
+    MappedFile m_mapped_file;
 
     byte m_glyph_width { 0 };
     byte m_glyph_height { 0 };
@@ -1,5 +1,5 @@
 #include <SharedGraphics/GraphicsBitmap.h>
-#include <SharedGraphics/PNGLoader.h>
+#include <SharedGraphics/ImageDecoder.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -30,7 +30,8 @@ Retained<GraphicsBitmap> GraphicsBitmap::create_wrapper(Format format, const Siz
 
 RetainPtr<GraphicsBitmap> GraphicsBitmap::load_from_file(const String& path)
 {
-    return load_png(path);
+    // Decoded images are shared between processes, see ImageDecoder.
+    return ImageDecoder::decode(path);
 }
 
 RetainPtr<GraphicsBitmap> GraphicsBitmap::load_from_file(Format format, const String& path, const Size& size)
@@ -28,6 +28,7 @@ public:
     int height() const { return m_size.height(); }
     size_t pitch() const { return m_pitch; }
     int shared_buffer_id() const { return m_shared_buffer ? m_shared_buffer->shared_buffer_id() : -1; }
+    SharedBuffer* shared_buffer() { return m_shared_buffer.ptr(); }
 
     bool has_alpha_channel() const { return m_format == Format::RGBA32; }
     Format format() const { return m_format; }
@@ -0,0 +1,266 @@
+#include <SharedGraphics/ImageDecoder.h>
+#include <SharedGraphics/Font.h>
+#include <SharedGraphics/PNGLoader.h>
+#include <SharedGraphics/Painter.h>
+#include <AK/StringBuilder.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//#define IMAGE_DECODER_DEBUG
+
+ImageDecoder& ImageDecoder::the()
+{
+    static ImageDecoder* s_the;
+    if (!s_the)
+        s_the = new ImageDecoder;
+    return *s_the;
+}
+
+ImageDecoder::ImageDecoder()
+{
+    pthread_mutex_init(&m_lock, nullptr);
+    pthread_cond_init(&m_decode_available, nullptr);
+    int rc = pipe(m_completion_fds);
+    ASSERT(rc == 0);
+}
+
+String ImageDecoder::cache_key(const String& path, const Size& size)
+{
+    return String::format("%s@%dx%d", path.characters(), size.width(), size.height());
+}
+
+static const char* store_directory = "/tmp/decoded-images";
+// Bigger than the biggest wallpaper, so that one is stored too, but not much: the store lives in memory.
+static const int max_stored_image_bytes = 8 * MB;
+
+// A stored image is its pixels, then this. That way the pixels start the file and can be mapped as they are.
+struct StoredImageTrailer {
+    dword magic;
+    dword width;
+    dword height;
+    dword format;
+};
+static const dword stored_image_magic = 0x52474241;
+
+String ImageDecoder::stored_path(const String& path, const Size& size)
+{
+    // Escape the path into a single file name: '!' becomes "!!" and '/' becomes "!s".
+    StringBuilder builder;
+    builder.append(store_directory);
+    builder.append('/');
+    for (int i = 0; i < path.length(); ++i) {
+        if (path[i] == '!')
+            builder.append("!!");
+        else if (path[i] == '/')
+            builder.append("!s");
+        else
+            builder.append(path[i]);
+    }
+    builder.appendf("@%dx%d", size.width(), size.height());
+    auto result = builder.to_string();
+    if (result.length() - strlen(store_directory) > 250)
+        return { };
+    return result;
+}
+
+// A stored image is good for as long as the image hasn't been modified after it was written.
+RetainPtr<GraphicsBitmap> ImageDecoder::load_from_store(const String& path, const Size& size)
+{
+    auto store_path = stored_path(path, size);
+    if (store_path.is_null())
+        return nullptr;
+    struct stat image_stat;
+    struct stat stored_stat;
+    if (stat(path.characters(), &image_stat) < 0 || stat(store_path.characters(), &stored_stat) < 0)
+        return nullptr;
+    if (stored_stat.st_mtime < image_stat.st_mtime || stored_stat.st_size < (off_t)sizeof(StoredImageTrailer))
+        return nullptr;
+
+    int fd = open(store_path.characters(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    StoredImageTrailer trailer;
+    off_t pixels_size = stored_stat.st_size - sizeof(StoredImageTrailer);
+    ssize_t nread = pread(fd, &trailer, sizeof(trailer), pixels_size);
+    close(fd);
+    if (nread != sizeof(trailer) || trailer.magic != stored_image_magic)
+        return nullptr;
+    Size stored_size(trailer.width, trailer.height);
+    if (stored_size.is_empty() || pixels_size != stored_size.area() * (off_t)sizeof(RGBA32))
+        return nullptr;
+    auto format = trailer.format == (dword)GraphicsBitmap::Format::RGBA32 ? GraphicsBitmap::Format::RGBA32 : GraphicsBitmap::Format::RGB32;
+    return GraphicsBitmap::load_from_file(format, store_path, stored_size);
+}
+
+void ImageDecoder::save_to_store(const String& path, const Size& size, const GraphicsBitmap& bitmap)
+{
+    if (bitmap.size().area() * (int)sizeof(RGBA32) > max_stored_image_bytes)
+        return;
+    auto store_path = stored_path(path, size);
+    if (store_path.is_null())
+        return;
+    mkdir(store_directory, 0777);
+    // Write it next to where it goes and rename it into place, so nobody maps a half-written file.
+    auto temporary_path = String::format("%s.%d", store_path.characters(), getpid());
+    int fd = open(temporary_path.characters(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    bool ok = true;
+    for (int y = 0; y < bitmap.height() && ok; ++y) {
+        ssize_t scanline_size = bitmap.width() * sizeof(RGBA32);
+        ok = write(fd, bitmap.scanline(y), scanline_size) == scanline_size;
+    }
+    StoredImageTrailer trailer { stored_image_magic, (dword)bitmap.width(), (dword)bitmap.height(), (dword)bitmap.format() };
+    if (ok)
+        ok = write(fd, &trailer, sizeof(trailer)) == sizeof(trailer);
+    close(fd);
+    if (!ok || rename(temporary_path.characters(), store_path.characters()) < 0)
+        unlink(temporary_path.characters());
+}
+
+// Safe to call from any thread: everything it touches is its own.
+RetainPtr<GraphicsBitmap> ImageDecoder::decode(const String& path, const Size& size)
+{
+    if (auto bitmap = load_from_store(path, size))
+        return bitmap;
+    auto bitmap = load_png(path);
+    if (!bitmap)
+        return nullptr;
+    if (!size.is_empty() && bitmap->size() != size) {
+        auto scaled = GraphicsBitmap::create(bitmap->format(), size);
+        Painter painter(*scaled);
+        painter.draw_scaled_bitmap(scaled->rect(), *bitmap, bitmap->rect(), Painter::ScalingMode::Bilinear);
+        bitmap = move(scaled);
+    }
+    save_to_store(path, size, *bitmap);
+    return bitmap;
+}
+
+RetainPtr<GraphicsBitmap> ImageDecoder::cached(const String& key)
+{
+    auto it = m_cache.find(key);
+    if (it == m_cache.end())
+        return nullptr;
+    (*it).value.last_use = ++m_use_counter;
+    return (*it).value.bitmap.copy_ref();
+}
+
+void ImageDecoder::add_to_cache(const String& key, RetainPtr<GraphicsBitmap>&& bitmap)
+{
+    if (!bitmap || m_cache.contains(key))
+        return;
+    m_cache_size += bitmap->size().area() * sizeof(RGBA32);
+    CacheEntry entry;
+    entry.bitmap = move(bitmap);
+    entry.last_use = ++m_use_counter;
+    m_cache.set(key, move(entry));
+    set_cache_limit(m_cache_limit);
+}
+
+void ImageDecoder::set_cache_limit(int bytes)
+{
+    m_cache_limit = bytes;
+    while (m_cache_size > m_cache_limit) {
+        String oldest_key;
+        const CacheEntry* oldest = nullptr;
+        for (auto& it : m_cache) {
+            if (!oldest || it.value.last_use < oldest->last_use) {
+                oldest_key = it.key;
+                oldest = &it.value;
+            }
+        }
+#ifdef IMAGE_DECODER_DEBUG
+        dbgprintf("ImageDecoder: Dropping %s from the cache\n", oldest_key.characters());
+#endif
+        m_cache_size -= oldest->bitmap->size().area() * sizeof(RGBA32);
+        m_cache.remove(oldest_key);
+    }
+}
+
+RetainPtr<GraphicsBitmap> ImageDecoder::load(const String& path, const Size& size)
+{
+    auto key = cache_key(path, size);
+    if (auto bitmap = cached(key))
+        return bitmap;
+    auto bitmap = decode(path, size);
+    add_to_cache(key, bitmap.copy_ref());
+    return bitmap;
+}
+
+void ImageDecoder::load_async(const String& path, const Size& size, Callback&& callback)
+{
+    if (auto bitmap = cached(cache_key(path, size))) {
+        callback(move(bitmap));
+        return;
+    }
+    start_worker();
+    auto request = make<Decode>();
+    // The worker gets a path of its own, since retaining a shared one from two threads isn't safe.
+    request->path = String(path.characters(), path.length());
+    request->size = size;
+    request->callback = move(callback);
+    pthread_mutex_lock(&m_lock);
+    m_waiting_decodes.append(move(request));
+    pthread_cond_signal(&m_decode_available);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void ImageDecoder::dispatch_finished_decodes()
+{
+    byte doorbells[64];
+    read(m_completion_fds[0], doorbells, sizeof(doorbells));
+
+    pthread_mutex_lock(&m_lock);
+    auto decodes = move(m_finished_decodes);
+    pthread_mutex_unlock(&m_lock);
+
+    for (auto& request : decodes) {
+        // Someone may have loaded it synchronously in the meantime; then they share that one.
+        auto key = cache_key(request->path, request->size);
+        if (auto bitmap = cached(key))
+            request->bitmap = move(bitmap);
+        else
+            add_to_cache(key, request->bitmap.copy_ref());
+        request->callback(move(request->bitmap));
+    }
+}
+
+void ImageDecoder::start_worker()
+{
+    if (m_worker_started)
+        return;
+    m_worker_started = true;
+    // Painter picks up the default font, which has to be loaded before another thread can ask for it.
+    Font::default_font();
+    pthread_t thread;
+    int rc = pthread_create(&thread, nullptr, worker_main, this);
+    ASSERT(rc == 0);
+}
+
+void* ImageDecoder::worker_main(void* argument)
+{
+    auto& decoder = *(ImageDecoder*)argument;
+    pthread_mutex_lock(&decoder.m_lock);
+    for (;;) {
+        while (decoder.m_waiting_decodes.is_empty())
+            pthread_cond_wait(&decoder.m_decode_available, &decoder.m_lock);
+        auto request = move(decoder.m_waiting_decodes[0]);
+        decoder.m_waiting_decodes.remove(0);
+        pthread_mutex_unlock(&decoder.m_lock);
+
+#ifdef IMAGE_DECODER_DEBUG
+        dbgprintf("ImageDecoder: Decoding %s\n", request->path.characters());
+#endif
+        request->bitmap = decode(request->path, request->size);
+
+        pthread_mutex_lock(&decoder.m_lock);
+        decoder.m_finished_decodes.append(move(request));
+        pthread_mutex_unlock(&decoder.m_lock);
+        byte doorbell = 0;
+        write(decoder.m_completion_fds[1], &doorbell, 1);
+        pthread_mutex_lock(&decoder.m_lock);
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <AK/AKString.h>
+#include <AK/Function.h>
+#include <AK/HashMap.h>
+#include <AK/OwnPtr.h>
+#include <AK/Vector.h>
+#include <SharedGraphics/GraphicsBitmap.h>
+#include <pthread.h>
+
+// Decodes PNG images, at their own size or scaled to a given one, and keeps the decoded bitmaps around
+// so loading the same image again costs nothing. The cache holds up to cache_limit() bytes of pixels,
+// dropping the least recently used bitmaps first.
+//
+// Decoded images are also written out to /tmp/decoded-images as raw pixels, which every process maps straight
+// back in rather than decoding the image again. The kernel shares the pages of a file between everyone who maps it,
+// so the icons and the wallpaper are decoded once per boot and in memory once.
+//
+// Decoding can also happen on a worker thread. The event loop watches completion_fd() and calls
+// dispatch_finished_decodes() when it's readable, which runs the callbacks of the decodes that are done.
+// Retain counts aren't atomic, so the cache and the bitmaps it hands out belong to that one thread.
+class ImageDecoder {
+public:
+    static ImageDecoder& the();
+
+    typedef Function<void(RetainPtr<GraphicsBitmap>&&)> Callback;
+
+    // An empty |size| means the image's own size.
+    RetainPtr<GraphicsBitmap> load(const String& path, const Size& size = { });
+
+    // Calls |callback| from dispatch_finished_decodes() once the image is decoded,
+    // or right away if it already is. Gets null if it couldn't be.
+    void load_async(const String& path, const Size&, Callback&&);
+
+    int completion_fd() const { return m_completion_fds[0]; }
+    void dispatch_finished_decodes();
+
+    int cache_limit() const { return m_cache_limit; }
+    void set_cache_limit(int bytes);
+    int cache_size() const { return m_cache_size; }
+
+    // Decodes (or maps the already decoded pixels of) an image without going through this process's cache.
+    // Safe to call from any thread.
+    static RetainPtr<GraphicsBitmap> decode(const String& path, const Size& size = { });
+
+private:
+    ImageDecoder();
+
+    struct Decode {
+        String path;
+        Size size;
+        RetainPtr<GraphicsBitmap> bitmap;
+        Callback callback;
+    };
+
+    struct CacheEntry {
+        RetainPtr<GraphicsBitmap> bitmap;
+        dword last_use { 0 };
+    };
+
+    static String stored_path(const String& path, const Size&);
+    static RetainPtr<GraphicsBitmap> load_from_store(const String& path, const Size&);
+    static void save_to_store(const String& path, const Size&, const GraphicsBitmap&);
+    static String cache_key(const String& path, const Size&);
+    RetainPtr<GraphicsBitmap> cached(const String& key);
+    void add_to_cache(const String& key, RetainPtr<GraphicsBitmap>&&);
+    void start_worker();
+    static void* worker_main(void*);
+
+    HashMap<String, CacheEntry> m_cache;
+    int m_cache_size { 0 };
+    int m_cache_limit { 16 * MB };
+    dword m_use_counter { 0 };
+
+    // Guards the two queues, which are all the worker shares with everyone else.
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_decode_available;
+    Vector<OwnPtr<Decode>> m_waiting_decodes;
+    Vector<OwnPtr<Decode>> m_finished_decodes;
+    bool m_worker_started { false };
+    int m_completion_fds[2] { -1, -1 };
+};
@@ -0,0 +1,326 @@
+#include <SharedGraphics/Inflater.h>
+#include <AK/StdLibExtras.h>
+#include <string.h>
+
+//#define INFLATER_DEBUG
+
+static const word length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const byte length_extra_bits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const word distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const byte distance_extra_bits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// The order code lengths for the code length code come in.
+static const byte code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Codes are assigned most significant bit first, but the input is read least significant bit first.
+static word reverse_bits(word code, int length)
+{
+    word reversed = 0;
+    for (int i = 0; i < length; ++i) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// Sets up the canonical code for |lengths|. Codes may be incomplete, as a stream with one distance code has to be.
+static bool build_huffman(Inflater::Huffman& huffman, const byte* lengths, int symbol_count)
+{
+    memset(huffman.count, 0, sizeof(huffman.count));
+    for (int symbol = 0; symbol < symbol_count; ++symbol)
+        ++huffman.count[lengths[symbol]];
+    huffman.count[0] = 0;
+
+    int left = 1;
+    for (int length = 1; length <= Inflater::max_bits; ++length) {
+        left = (left << 1) - huffman.count[length];
+        if (left < 0)
+            return false;
+    }
+
+    word offsets[Inflater::max_bits + 1];
+    word next_code[Inflater::max_bits + 1];
+    offsets[1] = 0;
+    next_code[1] = 0;
+    for (int length = 1; length < Inflater::max_bits; ++length) {
+        offsets[length + 1] = offsets[length] + huffman.count[length];
+        next_code[length + 1] = (next_code[length] + huffman.count[length]) << 1;
+    }
+
+    memset(huffman.fast, 0, sizeof(huffman.fast));
+    for (int symbol = 0; symbol < symbol_count; ++symbol) {
+        int length = lengths[symbol];
+        if (!length)
+            continue;
+        huffman.symbols[offsets[length]++] = symbol;
+        word code = next_code[length]++;
+        if (length > Inflater::fast_bits)
+            continue;
+        word entry = (symbol << 4) | length;
+        for (int index = reverse_bits(code, length); index < (1 << Inflater::fast_bits); index += 1 << length)
+            huffman.fast[index] = entry;
+    }
+    return true;
+}
+
+static const Inflater::Huffman& fixed_literals()
+{
+    static Inflater::Huffman* huffman;
+    if (!huffman) {
+        byte lengths[288];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        huffman = new Inflater::Huffman;
+        build_huffman(*huffman, lengths, 288);
+    }
+    return *huffman;
+}
+
+static const Inflater::Huffman& fixed_distances()
+{
+    static Inflater::Huffman* huffman;
+    if (!huffman) {
+        byte lengths[30];
+        memset(lengths, 5, 30);
+        huffman = new Inflater::Huffman;
+        build_huffman(*huffman, lengths, 30);
+    }
+    return *huffman;
+}
+
+Inflater::Inflater()
+    : m_window(new byte[window_size])
+{
+}
+
+Inflater::~Inflater()
+{
+    delete [] m_window;
+}
+
+void Inflater::append_input(const byte* data, int length)
+{
+    if (length)
+        m_input.append({ data, length });
+}
+
+void Inflater::refill()
+{
+    while (m_input_index < m_input.size() && m_input_offset == m_input[m_input_index].length) {
+        ++m_input_index;
+        m_input_offset = 0;
+    }
+    byte next = 0;
+    if (m_input_index < m_input.size())
+        next = m_input[m_input_index].data[m_input_offset++];
+    else
+        m_padding_bits += 8;
+    m_bit_buffer |= (dword)next << m_bit_count;
+    m_bit_count += 8;
+}
+
+bool Inflater::read_zlib_header()
+{
+    dword cmf = take_bits(8);
+    dword flags = take_bits(8);
+    // Deflate with at most a 32 KB window, and no preset dictionary.
+    if ((cmf & 0xf) != 8 || (cmf >> 4) > 7 || (flags & 0x20) || ((cmf << 8) | flags) % 31) {
+        m_error = true;
+        return false;
+    }
+    return !m_error;
+}
+
+int Inflater::decode(const Huffman& huffman)
+{
+    ensure_bits(fast_bits);
+    word entry = huffman.fast[m_bit_buffer & ((1 << fast_bits) - 1)];
+    if (entry) {
+        drop_bits(entry & 0xf);
+        return entry >> 4;
+    }
+    return decode_slowly(huffman);
+}
+
+int Inflater::decode_slowly(const Huffman& huffman)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length <= max_bits; ++length) {
+        code |= take_bits(1);
+        int count = huffman.count[length];
+        if (code - count < first)
+            return huffman.symbols[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    m_error = true;
+    return -1;
+}
+
+bool Inflater::read_dynamic_tables()
+{
+    int literal_count = take_bits(5) + 257;
+    int distance_count = take_bits(5) + 1;
+    int code_length_count = take_bits(4) + 4;
+    if (literal_count > 286 || distance_count > 30)
+        return false;
+
+    byte lengths[286 + 30];
+    memset(lengths, 0, 19);
+    for (int i = 0; i < code_length_count; ++i)
+        lengths[code_length_order[i]] = take_bits(3);
+    Huffman code_lengths;
+    if (!build_huffman(code_lengths, lengths, 19))
+        return false;
+
+    int total = literal_count + distance_count;
+    for (int i = 0; i < total;) {
+        int symbol = decode(code_lengths);
+        if (symbol < 0 || m_error)
+            return false;
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+        byte length = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (!i)
+                return false;
+            length = lengths[i - 1];
+            repeat = 3 + take_bits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + take_bits(3);
+        } else {
+            repeat = 11 + take_bits(7);
+        }
+        if (i + repeat > total)
+            return false;
+        while (repeat--)
+            lengths[i++] = length;
+    }
+    // Without an end of block code the block could never end.
+    if (!lengths[256])
+        return false;
+    if (!build_huffman(m_dynamic_literals, lengths, literal_count))
+        return false;
+    if (!build_huffman(m_dynamic_distances, lengths + literal_count, distance_count))
+        return false;
+    m_literals = &m_dynamic_literals;
+    m_distances = &m_dynamic_distances;
+    return !m_error;
+}
+
+bool Inflater::read_block_header()
+{
+    if (m_last_block) {
+        m_state = State::Finished;
+        return true;
+    }
+    m_last_block = take_bits(1);
+    switch (take_bits(2)) {
+    case 0: {
+        drop_bits(m_bit_count & 7);
+        dword length = take_bits(16);
+        dword complement = take_bits(16);
+        if (length != (~complement & 0xffff))
+            return false;
+        m_stored_remaining = length;
+        m_state = State::Stored;
+        return !m_error;
+    }
+    case 1:
+        m_literals = &fixed_literals();
+        m_distances = &fixed_distances();
+        m_state = State::Compressed;
+        return !m_error;
+    case 2:
+        m_state = State::Compressed;
+        return read_dynamic_tables();
+    default:
+        return false;
+    }
+}
+
+int Inflater::read(byte* buffer, int length)
+{
+    int produced = 0;
+    while (produced < length && !m_error) {
+        switch (m_state) {
+        case State::Finished:
+            return produced;
+        case State::BlockHeader:
+            if (!read_block_header()) {
+#ifdef INFLATER_DEBUG
+                dbgprintf("Inflater: Bad block header\n");
+#endif
+                m_error = true;
+            }
+            break;
+        case State::Stored:
+            while (m_stored_remaining && produced < length && !m_error) {
+                byte value = take_bits(8);
+                emit(value);
+                buffer[produced++] = value;
+                --m_stored_remaining;
+            }
+            if (!m_stored_remaining)
+                m_state = State::BlockHeader;
+            break;
+        case State::Copy: {
+            int count = min(m_copy_length, length - produced);
+            for (int i = 0; i < count; ++i) {
+                byte value = m_window[(m_window_position - m_copy_distance) & (window_size - 1)];
+                emit(value);
+                buffer[produced++] = value;
+            }
+            m_copy_length -= count;
+            if (!m_copy_length)
+                m_state = State::Compressed;
+            break;
+        }
+        case State::Compressed:
+            while (produced < length && !m_error) {
+                int symbol = decode(*m_literals);
+                if (symbol < 256) {
+                    if (symbol < 0)
+                        break;
+                    emit(symbol);
+                    buffer[produced++] = symbol;
+                    continue;
+                }
+                if (symbol == 256) {
+                    m_state = State::BlockHeader;
+                    break;
+                }
+                symbol -= 257;
+                if (symbol >= 29) {
+                    m_error = true;
+                    break;
+                }
+                int copy_length = length_base[symbol] + take_bits(length_extra_bits[symbol]);
+                int distance_symbol = decode(*m_distances);
+                if (distance_symbol < 0 || distance_symbol >= 30) {
+                    m_error = true;
+                    break;
+                }
+                int distance = distance_base[distance_symbol] + take_bits(distance_extra_bits[distance_symbol]);
+                if ((dword)distance > min(m_window_position, (dword)window_size)) {
+                    m_error = true;
+                    break;
+                }
+                m_copy_length = copy_length;
+                m_copy_distance = distance;
+                m_state = State::Copy;
+                break;
+            }
+            break;
+        }
+    }
+    return produced;
+}
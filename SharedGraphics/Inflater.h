@@ -0,0 +1,100 @@
+#pragma once
+
+#include <AK/Types.h>
+#include <AK/Vector.h>
+
+// A decoder for DEFLATE data (RFC 1951), the compression inside zlib streams and PNG files.
+// All the compressed input is handed over first, in as many pieces as it comes in, and has to stay around
+// while decoding. The output is then pulled out as it's needed, so only the last 32 KB of it are ever kept.
+class Inflater {
+public:
+    Inflater();
+    ~Inflater();
+
+    void append_input(const byte*, int length);
+
+    // Checks and skips the two byte header of a zlib stream.
+    bool read_zlib_header();
+
+    // Decodes up to |length| more bytes into |buffer| and returns how many there were,
+    // which is fewer only at the end of the stream or on bad input.
+    int read(byte* buffer, int length);
+
+    bool has_error() const { return m_error; }
+    bool is_finished() const { return m_state == State::Finished; }
+
+    static const int fast_bits = 9;
+    static const int max_bits = 15;
+
+    // Codes up to fast_bits long are looked up directly with the next bits of input, as they come in.
+    // Each entry is the symbol << 4 | the code's length, or 0 for the longer codes, decoded a bit at a time.
+    struct Huffman {
+        word fast[1 << fast_bits];
+        word count[max_bits + 1];
+        word symbols[288];
+    };
+
+private:
+    enum class State { BlockHeader, Stored, Compressed, Copy, Finished };
+
+    bool read_block_header();
+    bool read_dynamic_tables();
+    int decode(const Huffman&);
+    int decode_slowly(const Huffman&);
+
+    void ensure_bits(int count)
+    {
+        while (m_bit_count < count)
+            refill();
+    }
+    void refill();
+    dword take_bits(int count)
+    {
+        ensure_bits(count);
+        dword bits = m_bit_buffer & ((1u << count) - 1);
+        drop_bits(count);
+        return bits;
+    }
+    void drop_bits(int count)
+    {
+        m_bit_buffer >>= count;
+        m_bit_count -= count;
+        // Past the end, the bit buffer is padded with zeros so it can always be peeked at, but not used.
+        if (m_bit_count < m_padding_bits)
+            m_error = true;
+    }
+
+    void emit(byte value)
+    {
+        m_window[m_window_position++ & (window_size - 1)] = value;
+    }
+
+    static const int window_size = 32768;
+
+    struct Span {
+        const byte* data { nullptr };
+        int length { 0 };
+    };
+    Vector<Span> m_input;
+    int m_input_index { 0 };
+    int m_input_offset { 0 };
+
+    dword m_bit_buffer { 0 };
+    int m_bit_count { 0 };
+    int m_padding_bits { 0 };
+
+    State m_state { State::BlockHeader };
+    bool m_error { false };
+    bool m_last_block { false };
+    int m_stored_remaining { 0 };
+    int m_copy_length { 0 };
+    int m_copy_distance { 0 };
+
+    const Huffman* m_literals { nullptr };
+    const Huffman* m_distances { nullptr };
+    Huffman m_dynamic_literals;
+    Huffman m_dynamic_distances;
+
+    byte* m_window { nullptr };
+    dword m_window_position { 0 };
+};
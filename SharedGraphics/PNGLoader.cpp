@@ -6,7 +6,8 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
-#include <SharedGraphics/puff.c>
+#include <SharedGraphics/Inflater.h>
+#include <AK/ThreadPool.h>
 #include <serenity.h>
 
 //#define PNG_STOPWATCH_DEBUG
@@ -23,11 +24,6 @@ struct PNG_IHDR {
 
 static_assert(sizeof(PNG_IHDR) == 13);
 
-struct Scanline {
-    byte filter { 0 };
-    ByteBuffer data;
-};
-
 struct PNGLoadingContext {
     int width { -1 };
     int height { -1 };
@@ -39,11 +35,9 @@ struct PNGLoadingContext {
     byte bytes_per_pixel { 0 };
     bool has_seen_zlib_header { false };
     bool has_alpha() const { return color_type & 4; }
-    Vector<Scanline> scanlines;
     RetainPtr<GraphicsBitmap> bitmap;
-    byte* decompression_buffer { nullptr };
-    int decompression_buffer_size { 0 };
-    Vector<byte> compressed_data;
+    // The IDAT chunks, straight from the mapped file.
+    Inflater inflater;
 };
 
 class Streamer {
@@ -152,174 +146,96 @@ RetainPtr<GraphicsBitmap> load_png(const String& path)
     return c;
 }
 
-union [[gnu::packed]] Pixel {
-    RGBA32 rgba { 0 };
-    byte v[4];
-    struct {
-        byte r;
-        byte g;
-        byte b;
-        byte a;
-    };
-};
-static_assert(sizeof(Pixel) == 4);
-
-template<bool has_alpha, byte filter_type>
-[[gnu::always_inline]] static inline void unfilter_impl(GraphicsBitmap& bitmap, int y, const void* dummy_scanline_data)
+// Undoes a scanline's filter in place, in the file's byte order. |previous| is the scanline above, already unfiltered.
+template<int bytes_per_pixel>
+static bool unfilter_impl(byte filter, byte* scanline, const byte* previous, int length)
 {
-    auto* dummy_scanline = (const Pixel*)dummy_scanline_data;
-    if constexpr (filter_type == 0) {
-        auto* pixels = (Pixel*)bitmap.scanline(y);
-        for (int i = 0; i < bitmap.width(); ++i) {
-            auto& x = pixels[i];
-            swap(x.r, x.b);
-        }
-    }
-
-    if constexpr (filter_type == 1) {
-        auto* pixels = (Pixel*)bitmap.scanline(y);
-        swap(pixels[0].r, pixels[0].b);
-        for (int i = 1; i < bitmap.width(); ++i) {
-            auto& x = pixels[i];
-            swap(x.r, x.b);
-            auto& a = (const Pixel&)pixels[i - 1];
-            x.v[0] += a.v[0];
-            x.v[1] += a.v[1];
-            x.v[2] += a.v[2];
-            if constexpr (has_alpha)
-                x.v[3] += a.v[3];
-        }
-        return;
-    }
-    if constexpr (filter_type == 2) {
-        auto* pixels = (Pixel*)bitmap.scanline(y);
-        auto* pixels_y_minus_1 = y == 0 ? dummy_scanline : (Pixel*)bitmap.scanline(y - 1);
-        for (int i = 0; i < bitmap.width(); ++i) {
-            auto& x = pixels[i];
-            swap(x.r, x.b);
-            const Pixel& b = pixels_y_minus_1[i];
-            x.v[0] += b.v[0];
-            x.v[1] += b.v[1];
-            x.v[2] += b.v[2];
-            if constexpr (has_alpha)
-                x.v[3] += b.v[3];
-        }
-        return;
-    }
-    if constexpr (filter_type == 3) {
-        auto* pixels = (Pixel*)bitmap.scanline(y);
-        auto* pixels_y_minus_1 = y == 0 ? dummy_scanline : (Pixel*)bitmap.scanline(y - 1);
-        for (int i = 0; i < bitmap.width(); ++i) {
-            auto& x = pixels[i];
-            swap(x.r, x.b);
-            Pixel a;
-            if (i != 0) a = pixels[i - 1];
-            const Pixel& b = pixels_y_minus_1[i];
-            x.v[0] = x.v[0] + ((a.v[0] + b.v[0]) / 2);
-            x.v[1] = x.v[1] + ((a.v[1] + b.v[1]) / 2);
-            x.v[2] = x.v[2] + ((a.v[2] + b.v[2]) / 2);
-            if constexpr (has_alpha)
-                x.v[3] = x.v[3] + ((a.v[3] + b.v[3]) / 2);
+    switch (filter) {
+    case 0:
+        return true;
+    case 1:
+        for (int i = bytes_per_pixel; i < length; ++i)
+            scanline[i] += scanline[i - bytes_per_pixel];
+        return true;
+    case 2: {
+        // Four bytes at a time, adding the low seven bits of each and putting the top ones back without carrying.
+        int i = 0;
+        for (; i + 4 <= length; i += 4) {
+            dword x = *(const dword*)(scanline + i);
+            dword b = *(const dword*)(previous + i);
+            *(dword*)(scanline + i) = ((x & 0x7f7f7f7f) + (b & 0x7f7f7f7f)) ^ ((x ^ b) & 0x80808080);
         }
-        return;
+        for (; i < length; ++i)
+            scanline[i] += previous[i];
+        return true;
     }
-    if constexpr (filter_type == 4) {
-        auto* pixels = (Pixel*)bitmap.scanline(y);
-        auto* pixels_y_minus_1 = y == 0 ? dummy_scanline : (Pixel*)bitmap.scanline(y - 1);
-        for (int i = 0; i < bitmap.width(); ++i) {
-            auto& x = pixels[i];
-            swap(x.r, x.b);
-            Pixel a;
-            const Pixel& b = pixels_y_minus_1[i];
-            Pixel c;
-            if (i != 0) {
-                a = pixels[i - 1];
-                c = pixels_y_minus_1[i - 1];
-            }
-            x.v[0] += paeth_predictor(a.v[0], b.v[0], c.v[0]);
-            x.v[1] += paeth_predictor(a.v[1], b.v[1], c.v[1]);
-            x.v[2] += paeth_predictor(a.v[2], b.v[2], c.v[2]);
-            if constexpr (has_alpha)
-                x.v[3] += paeth_predictor(a.v[3], b.v[3], c.v[3]);
-        }
+    case 3:
+        for (int i = 0; i < bytes_per_pixel; ++i)
+            scanline[i] += previous[i] / 2;
+        for (int i = bytes_per_pixel; i < length; ++i)
+            scanline[i] += (scanline[i - bytes_per_pixel] + previous[i]) / 2;
+        return true;
+    case 4:
+        for (int i = 0; i < bytes_per_pixel; ++i)
+            scanline[i] += previous[i];
+        for (int i = bytes_per_pixel; i < length; ++i)
+            scanline[i] += paeth_predictor(scanline[i - bytes_per_pixel], previous[i], previous[i - bytes_per_pixel]);
+        return true;
+    default:
+        return false;
     }
 }
 
-[[gnu::noinline]] static void unfilter(PNGLoadingContext& context)
+static void unpack_scanline(const PNGLoadingContext& context, const byte* scanline, RGBA32* pixels)
 {
-    {
-#ifdef PNG_STOPWATCH_DEBUG
-    Stopwatch sw("load_png_impl: unfilter: unpack");
-#endif
-    // First unpack the scanlines to RGBA:
-    switch (context.color_type) {
-    case 2:
-        for (int y = 0; y < context.height; ++y) {
-            struct [[gnu::packed]] Triplet { byte r; byte g; byte b; };
-            auto* triplets = (Triplet*)context.scanlines[y].data.pointer();
-            for (int i = 0; i < context.width; ++i) {
-                auto& pixel = (Pixel&)context.bitmap->scanline(y)[i];
-                pixel.r = triplets[i].r;
-                pixel.g = triplets[i].g;
-                pixel.b = triplets[i].b;
-                pixel.a = 0xff;
-            }
-        }
-        break;
-    case 6:
-        for (int y = 0; y < context.height; ++y) {
-            memcpy(context.bitmap->scanline(y), context.scanlines[y].data.pointer(), context.scanlines[y].data.size());
-        }
-        break;
-    default:
-        ASSERT_NOT_REACHED();
-        break;
-    }
+    if (context.color_type == 6) {
+        for (int i = 0; i < context.width; ++i, scanline += 4)
+            pixels[i] = (scanline[3] << 24) | (scanline[0] << 16) | (scanline[1] << 8) | scanline[2];
+        return;
     }
+    for (int i = 0; i < context.width; ++i, scanline += 3)
+        pixels[i] = 0xff000000 | (scanline[0] << 16) | (scanline[1] << 8) | scanline[2];
+}
 
-    auto dummy_scanline = ByteBuffer::create_zeroed(context.width * sizeof(RGBA32));
+// Inflating and unfiltering go one scanline at a time, each one depending on the one before, but turning them
+// into pixels doesn't, so with more than one thread that's done a band of scanlines at a time on all of them.
+static const int scanlines_per_band = 32;
 
+[[gnu::noinline]] static bool decode_scanlines(PNGLoadingContext& context)
+{
 #ifdef PNG_STOPWATCH_DEBUG
-    Stopwatch sw("load_png_impl: unfilter: process");
+    Stopwatch sw("load_png_impl: decode scanlines");
 #endif
-    for (int y = 0; y < context.height; ++y) {
-        auto filter = context.scanlines[y].filter;
-        if (filter == 0) {
-            if (context.has_alpha())
-                unfilter_impl<true, 0>(*context.bitmap, y, dummy_scanline.pointer());
-            else
-                unfilter_impl<false, 0>(*context.bitmap, y, dummy_scanline.pointer());
-            continue;
-        }
-        if (filter == 1) {
-            if (context.has_alpha())
-                unfilter_impl<true, 1>(*context.bitmap, y, dummy_scanline.pointer());
-            else
-                unfilter_impl<false, 1>(*context.bitmap, y, dummy_scanline.pointer());
-            continue;
-        }
-        if (filter == 2) {
-            if (context.has_alpha())
-                unfilter_impl<true, 2>(*context.bitmap, y, dummy_scanline.pointer());
-            else
-                unfilter_impl<false, 2>(*context.bitmap, y, dummy_scanline.pointer());
-            continue;
-        }
-        if (filter == 3) {
-            if (context.has_alpha())
-                unfilter_impl<true, 3>(*context.bitmap, y, dummy_scanline.pointer());
-            else
-                unfilter_impl<false, 3>(*context.bitmap, y, dummy_scanline.pointer());
-            continue;
-        }
-        if (filter == 4) {
-            if (context.has_alpha())
-                unfilter_impl<true, 4>(*context.bitmap, y, dummy_scanline.pointer());
-            else
-                unfilter_impl<false, 4>(*context.bitmap, y, dummy_scanline.pointer());
-            continue;
+    if (!context.inflater.read_zlib_header())
+        return false;
+
+    // The filter byte goes in front of each scanline. In front of the band is the last scanline of the one before,
+    // or zeros above the first.
+    int pitch = context.width * context.bytes_per_pixel;
+    int band_height = ThreadPool::the().concurrency() > 1 ? scanlines_per_band : 1;
+    auto buffers = ByteBuffer::create_zeroed((pitch + 1) * (band_height + 1));
+    auto scanline_in_band = [&] (int i) { return buffers.pointer() + (i + 1) * (pitch + 1); };
+
+    for (int band_y = 0; band_y < context.height; band_y += band_height) {
+        int band_scanlines = min(band_height, context.height - band_y);
+        for (int i = 0; i < band_scanlines; ++i) {
+            byte* scanline = scanline_in_band(i);
+            if (context.inflater.read(scanline, pitch + 1) != pitch + 1)
+                return false;
+            byte filter = scanline[0];
+            const byte* previous = scanline_in_band(i - 1);
+            bool ok = context.bytes_per_pixel == 4
+                ? unfilter_impl<4>(filter, scanline + 1, previous + 1, pitch)
+                : unfilter_impl<3>(filter, scanline + 1, previous + 1, pitch);
+            if (!ok)
+                return false;
         }
+        parallel_for(0, band_scanlines, [&] (int i) {
+            unpack_scanline(context, scanline_in_band(i) + 1, context.bitmap->scanline(band_y + i));
+        }, 4);
+        memcpy(scanline_in_band(-1), scanline_in_band(band_scanlines - 1), pitch + 1);
     }
+    return true;
 }
 
 static RetainPtr<GraphicsBitmap> load_png_impl(const byte* data, int data_size)
@@ -338,8 +254,6 @@ static RetainPtr<GraphicsBitmap> load_png_impl(const byte* data, int data_size)
 
     PNGLoadingContext context;
 
-    context.compressed_data.ensure_capacity(data_size);
-
     data_ptr += sizeof(png_header);
     data_remaining -= sizeof(png_header);
 
@@ -355,35 +269,8 @@ static RetainPtr<GraphicsBitmap> load_png_impl(const byte* data, int data_size)
         }
     }
 
-    {
-#ifdef PNG_STOPWATCH_DEBUG
-        Stopwatch sw("load_png_impl: uncompress");
-#endif
-        unsigned long srclen = context.compressed_data.size() - 6;
-        unsigned long destlen = context.decompression_buffer_size;
-        int ret = puff(context.decompression_buffer, &destlen, context.compressed_data.data() + 2, &srclen);
-        if (ret < 0)
-            return nullptr;
-        context.compressed_data.clear();
-    }
-
-    {
-#ifdef PNG_STOPWATCH_DEBUG
-        Stopwatch sw("load_png_impl: extract scanlines");
-#endif
-        context.scanlines.ensure_capacity(context.height);
-        Streamer streamer(context.decompression_buffer, context.decompression_buffer_size);
-        for (int y = 0; y < context.height; ++y) {
-            byte filter;
-            if (!streamer.read(filter))
-                return nullptr;
-
-            context.scanlines.append({ filter });
-            auto& scanline_buffer = context.scanlines.last().data;
-            if (!streamer.wrap_bytes(scanline_buffer, context.width * context.bytes_per_pixel))
-                return nullptr;
-        }
-    }
+    if (context.width <= 0 || context.height <= 0)
+        return nullptr;
 
     {
 #ifdef PNG_STOPWATCH_DEBUG
@@ -392,11 +279,10 @@ static RetainPtr<GraphicsBitmap> load_png_impl(const byte* data, int data_size)
         context.bitmap = GraphicsBitmap::create(context.has_alpha() ? GraphicsBitmap::Format::RGBA32 : GraphicsBitmap::Format::RGB32, { context.width, context.height });
     }
 
-    unfilter(context);
-
-    munmap(context.decompression_buffer, context.decompression_buffer_size);
-    context.decompression_buffer = nullptr;
-    context.decompression_buffer_size = 0;
+    if (!decode_scanlines(context)) {
+        dbgprintf("PNG: Bad image data\n");
+        return nullptr;
+    }
 
     return context.bitmap;
 }
@@ -428,15 +314,12 @@ static bool process_IHDR(const ByteBuffer& data, PNGLoadingContext& context)
     printf("PNG: %dx%d (%d bpp)\n", context.width, context.height, context.bit_depth);
     printf("     Color type: %b\n", context.color_type);
     printf(" Interlace type: %b\n", context.interlace_method);
-
-    context.decompression_buffer_size = (context.width * context.height * context.bytes_per_pixel + context.height);
-    context.decompression_buffer = (byte*)mmap(nullptr, context.decompression_buffer_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
     return true;
 }
 
 static bool process_IDAT(const ByteBuffer& data, PNGLoadingContext& context)
 {
-    context.compressed_data.append(data.pointer(), data.size());
+    context.inflater.append_input(data.pointer(), data.size());
     return true;
 }
 
@@ -4,8 +4,112 @@
 #include <SharedGraphics/CharacterBitmap.h>
 #include <AK/Assertions.h>
 #include <AK/StdLibExtras.h>
+#include <stdlib.h>
 #include <unistd.h>
 
+// SSE2 versions of the hot loops, picked at runtime. The kernel enables SSE in sse_init() and saves XMM state with fxsave.
+// Blending is only vectorized onto opaque targets, where Color::blend() boils down to (src * a + dst * (255 - a)) / 255.
+typedef char v16qi __attribute__((vector_size(16)));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef unsigned short v8hu __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+typedef int v4si_unaligned __attribute__((vector_size(16), aligned(1)));
+
+static bool has_sse2()
+{
+    static int s_has_sse2 = -1;
+    if (s_has_sse2 == -1) {
+        dword eax, ebx, ecx, edx;
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+        s_has_sse2 = (edx >> 26) & 1;
+    }
+    return s_has_sse2;
+}
+
+[[gnu::target("sse2")]] static void sse2_dword_fill(dword* dst, dword value, int count)
+{
+    int i = 0;
+    for (; i < count && ((dword)(dst + i) & 15); ++i)
+        dst[i] = value;
+    v4si values = { (int)value, (int)value, (int)value, (int)value };
+    for (; i + 4 <= count; i += 4)
+        *(v4si*)(dst + i) = values;
+    for (; i < count; ++i)
+        dst[i] = value;
+}
+
+[[gnu::target("sse2")]] static void sse2_dword_copy(dword* dst, const dword* src, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+        *(v4si_unaligned*)(dst + i) = *(const v4si_unaligned*)(src + i);
+    for (; i < count; ++i)
+        dst[i] = src[i];
+}
+
+// Exactly x / 255 for anything up to 255 * 255.
+[[gnu::target("sse2")]] static inline v8hu sse2_divide_by_255(v8hu x)
+{
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+// Blends 4 source pixels onto 4 opaque destination pixels. If |alpha| is null, each source pixel's own alpha is used.
+[[gnu::target("sse2")]] static inline v4si sse2_blend_4_pixels(v4si src, v4si dst, const v8hu* alpha)
+{
+    v16qi zero = { };
+    v8hu src_lo = (v8hu)__builtin_ia32_punpcklbw128((v16qi)src, zero);
+    v8hu src_hi = (v8hu)__builtin_ia32_punpckhbw128((v16qi)src, zero);
+    v8hu dst_lo = (v8hu)__builtin_ia32_punpcklbw128((v16qi)dst, zero);
+    v8hu dst_hi = (v8hu)__builtin_ia32_punpckhbw128((v16qi)dst, zero);
+    v8hu alpha_lo;
+    v8hu alpha_hi;
+    if (alpha) {
+        alpha_lo = *alpha;
+        alpha_hi = *alpha;
+    } else {
+        v8hu broadcast_alpha = { 3, 3, 3, 3, 7, 7, 7, 7 };
+        alpha_lo = __builtin_shuffle(src_lo, broadcast_alpha);
+        alpha_hi = __builtin_shuffle(src_hi, broadcast_alpha);
+    }
+    v8hu max = { 255, 255, 255, 255, 255, 255, 255, 255 };
+    v8hu lo = sse2_divide_by_255(src_lo * alpha_lo + dst_lo * (max - alpha_lo));
+    v8hu hi = sse2_divide_by_255(src_hi * alpha_hi + dst_hi * (max - alpha_hi));
+    v4si opaque = { (int)0xff000000, (int)0xff000000, (int)0xff000000, (int)0xff000000 };
+    return (v4si)__builtin_ia32_packuswb128((v8hi)lo, (v8hi)hi) | opaque;
+}
+
+[[gnu::target("sse2")]] static void sse2_blend_row(dword* dst, const dword* src, int count, int constant_alpha)
+{
+    v8hu alpha = { };
+    if (constant_alpha >= 0) {
+        short a = constant_alpha;
+        alpha = (v8hu) { (unsigned short)a, (unsigned short)a, (unsigned short)a, (unsigned short)a, (unsigned short)a, (unsigned short)a, (unsigned short)a, (unsigned short)a };
+    }
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        v4si source = *(const v4si_unaligned*)(src + i);
+        // Runs of fully opaque or fully transparent pixels are common in alpha bitmaps, don't blend those.
+        if (constant_alpha < 0) {
+            dword all_alpha = src[i] & src[i + 1] & src[i + 2] & src[i + 3];
+            dword any_alpha = src[i] | src[i + 1] | src[i + 2] | src[i + 3];
+            if ((all_alpha >> 24) == 0xff) {
+                *(v4si_unaligned*)(dst + i) = source;
+                continue;
+            }
+            if (!(any_alpha >> 24))
+                continue;
+        }
+        v4si destination = *(v4si_unaligned*)(dst + i);
+        *(v4si_unaligned*)(dst + i) = sse2_blend_4_pixels(source, destination, constant_alpha >= 0 ? &alpha : nullptr);
+    }
+    for (; i < count; ++i) {
+        Color src_color = Color::from_rgba(src[i]);
+        if (constant_alpha >= 0)
+            src_color.set_alpha(constant_alpha);
+        dst[i] = Color::from_rgb(dst[i]).blend(src_color).value();
+    }
+}
+
 Painter::Painter(GraphicsBitmap& bitmap)
     : m_target(bitmap)
 {
@@ -57,8 +161,12 @@ void Painter::fill_rect(const Rect& a_rect, Color color)
     RGBA32* dst = m_target->scanline(rect.top()) + rect.left();
     const unsigned dst_skip = m_target->width();
 
+    bool use_sse2 = has_sse2();
     for (int i = rect.height() - 1; i >= 0; --i) {
-        fast_dword_fill(dst, color.value(), rect.width());
+        if (use_sse2)
+            sse2_dword_fill(dst, color.value(), rect.width());
+        else
+            fast_dword_fill(dst, color.value(), rect.width());
         dst += dst_skip;
     }
 }
@@ -88,17 +196,25 @@ void Painter::fill_rect_with_gradient(const Rect& a_rect, Color gradient_start,
     int g1 = gradient_end.green();
     int b1 = gradient_end.blue();
 
-    for (int i = clipped_rect.height() - 1; i >= 0; --i) {
-        float c = x_offset * increment;
-        for (int j = 0; j < clipped_rect.width(); ++j) {
-            dst[j] = Color(
-                r1 / 255.0 * c + r2 / 255.0 * (255 - c),
-                g1 / 255.0 * c + g2 / 255.0 * (255 - c),
-                b1 / 255.0 * c + b2 / 255.0 * (255 - c)
-            ).value();
-            c += increment;
-        }
+    // The gradient is horizontal, so every row is the same. Work out the first one and copy it down.
+    float c = x_offset * increment;
+    for (int j = 0; j < clipped_rect.width(); ++j) {
+        dst[j] = Color(
+            r1 / 255.0 * c + r2 / 255.0 * (255 - c),
+            g1 / 255.0 * c + g2 / 255.0 * (255 - c),
+            b1 / 255.0 * c + b2 / 255.0 * (255 - c)
+        ).value();
+        c += increment;
+    }
+
+    bool use_sse2 = has_sse2();
+    const RGBA32* first_row = dst;
+    for (int i = clipped_rect.height() - 2; i >= 0; --i) {
         dst += dst_skip;
+        if (use_sse2)
+            sse2_dword_copy(dst, first_row, clipped_rect.width());
+        else
+            fast_dword_copy(dst, first_row, clipped_rect.width());
     }
 }
 
@@ -175,6 +291,7 @@ void Painter::draw_bitmap(const Point& p, const CharacterBitmap& bitmap, Color c
     }
 }
 
+// Glyph rows are bit masks, so instead of testing each bit, find the runs of set bits and fill them a run at a time.
 void Painter::draw_bitmap(const Point& p, const GlyphBitmap& bitmap, Color color)
 {
     Rect dst_rect { p, bitmap.size() };
@@ -186,13 +303,22 @@ void Painter::draw_bitmap(const Point& p, const GlyphBitmap& bitmap, Color color
     const int last_row = clipped_rect.bottom() - dst_rect.top();
     const int first_column = clipped_rect.left() - dst_rect.left();
     const int last_column = clipped_rect.right() - dst_rect.left();
-    RGBA32* dst = m_target->scanline(clipped_rect.y()) + clipped_rect.x();
+    RGBA32* dst = m_target->scanline(clipped_rect.y()) + clipped_rect.x() - first_column;
     const size_t dst_skip = m_target->width();
+    const RGBA32 value = color.value();
+
+    unsigned column_mask = last_column >= 31 ? ~0u : (1u << (last_column + 1)) - 1;
+    column_mask &= ~0u << first_column;
 
     for (int row = first_row; row <= last_row; ++row) {
-        for (int j = 0; j <= (last_column - first_column); ++j) {
-            if (bitmap.bit_at(j + first_column, row))
-                dst[j] = color.value();
+        unsigned bits = bitmap.row(row) & column_mask;
+        while (bits) {
+            int start = __builtin_ctz(bits);
+            unsigned unset_after_start = ~(bits >> start);
+            int end = unset_after_start ? start + __builtin_ctz(unset_after_start) : 32;
+            for (int x = start; x < end; ++x)
+                dst[x] = value;
+            bits = end >= 32 ? 0 : bits & (~0u << end);
         }
         dst += dst_skip;
     }
@@ -224,6 +350,15 @@ void Painter::blit_with_opacity(const Point& position, const GraphicsBitmap& sou
     const size_t dst_skip = m_target->width();
     const unsigned src_skip = source.width();
 
+    if (has_sse2()) {
+        for (int row = first_row; row <= last_row; ++row) {
+            sse2_blend_row(dst, src, clipped_rect.width(), alpha);
+            dst += dst_skip;
+            src += src_skip;
+        }
+        return;
+    }
+
     for (int row = first_row; row <= last_row; ++row) {
         for (int x = 0; x <= (last_column - first_column); ++x) {
             Color src_color_with_alpha = Color::from_rgb(src[x]);
@@ -254,6 +389,15 @@ void Painter::blit_with_alpha(const Point& position, const GraphicsBitmap& sourc
     const size_t dst_skip = m_target->width();
     const unsigned src_skip = source.width();
 
+    if (!m_target->has_alpha_channel() && has_sse2()) {
+        for (int row = first_row; row <= last_row; ++row) {
+            sse2_blend_row(dst, src, clipped_rect.width(), -1);
+            dst += dst_skip;
+            src += src_skip;
+        }
+        return;
+    }
+
     for (int row = first_row; row <= last_row; ++row) {
         for (int x = 0; x <= (last_column - first_column); ++x) {
             byte alpha = Color::from_rgba(src[x]).alpha();
@@ -288,48 +432,155 @@ void Painter::blit(const Point& position, const GraphicsBitmap& source, const Re
     const size_t dst_skip = m_target->width();
     const unsigned src_skip = source.width();
 
+    bool use_sse2 = has_sse2();
     for (int row = first_row; row <= last_row; ++row) {
-        fast_dword_copy(dst, src, clipped_rect.width());
+        if (use_sse2)
+            sse2_dword_copy(dst, src, clipped_rect.width());
+        else
+            fast_dword_copy(dst, src, clipped_rect.width());
         dst += dst_skip;
         src += src_skip;
     }
 }
 
-void Painter::draw_scaled_bitmap(const Rect& a_dst_rect, const GraphicsBitmap& source, const Rect& src_rect)
+// Lerps each channel of |a| towards |b| by weight/256, two channels at a time.
+static inline dword lerp_pixel(dword a, dword b, int weight)
 {
-    auto dst_rect = a_dst_rect;
-    if (dst_rect.size() == src_rect.size())
-        return blit(dst_rect.location(), source, src_rect);
+    dword red_blue = ((a & 0xff00ff) * (256 - weight) + (b & 0xff00ff) * weight) >> 8;
+    dword alpha_green = ((a >> 8) & 0xff00ff) * (256 - weight) + ((b >> 8) & 0xff00ff) * weight;
+    return (red_blue & 0xff00ff) | (alpha_green & 0xff00ff00);
+}
 
-    auto safe_src_rect = Rect::intersection(src_rect, source.rect());
-    ASSERT(source.rect().contains(safe_src_rect));
-    dst_rect.move_by(state().translation);
-    auto clipped_rect = Rect::intersection(dst_rect, clip_rect());
-    if (clipped_rect.is_empty())
+[[gnu::target("sse2")]] static void sse2_lerp_rows(dword* dst, const dword* a, const dword* b, int count, int weight)
+{
+    v16qi zero = { };
+    unsigned short wa = 256 - weight;
+    unsigned short wb = weight;
+    v8hu weight_a = { wa, wa, wa, wa, wa, wa, wa, wa };
+    v8hu weight_b = { wb, wb, wb, wb, wb, wb, wb, wb };
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        v16qi pixels_a = (v16qi)*(const v4si_unaligned*)(a + i);
+        v16qi pixels_b = (v16qi)*(const v4si_unaligned*)(b + i);
+        v8hu lo = ((v8hu)__builtin_ia32_punpcklbw128(pixels_a, zero) * weight_a + (v8hu)__builtin_ia32_punpcklbw128(pixels_b, zero) * weight_b) >> 8;
+        v8hu hi = ((v8hu)__builtin_ia32_punpckhbw128(pixels_a, zero) * weight_a + (v8hu)__builtin_ia32_punpckhbw128(pixels_b, zero) * weight_b) >> 8;
+        *(v4si_unaligned*)(dst + i) = (v4si)__builtin_ia32_packuswb128((v8hi)lo, (v8hi)hi);
+    }
+    for (; i < count; ++i)
+        dst[i] = lerp_pixel(a[i], b[i], weight);
+}
+
+static void lerp_rows(dword* dst, const dword* a, const dword* b, int count, int weight)
+{
+    if (has_sse2())
+        return sse2_lerp_rows(dst, a, b, count, weight);
+    for (int i = 0; i < count; ++i)
+        dst[i] = lerp_pixel(a[i], b[i], weight);
+}
+
+// Blends one row of scaled pixels from a source with an alpha channel into the target.
+void Painter::blend_scaled_row(RGBA32* dst, const RGBA32* src, int count)
+{
+    if (!m_target->has_alpha_channel() && has_sse2()) {
+        sse2_blend_row(dst, src, count, -1);
         return;
+    }
+    for (int x = 0; x < count; ++x) {
+        byte alpha = Color::from_rgba(src[x]).alpha();
+        if (alpha == 0xff)
+            dst[x] = src[x];
+        else if (alpha)
+            dst[x] = Color::from_rgba(dst[x]).blend(Color::from_rgba(src[x])).value();
+    }
+}
 
-    float hscale = (float)src_rect.width() / (float)dst_rect.width();
-    float vscale = (float)src_rect.height() / (float)dst_rect.height();
+// Where destination pixel |index| samples the source along one axis, in 16.16 fixed point.
+// Both modes sample at pixel centers, so scaling doesn't shift the image by half a pixel.
+static inline int scaled_coordinate(int index, int step)
+{
+    return ((long long)index * step + step / 2);
+}
 
-    for (int y = dst_rect.top(); y <= dst_rect.bottom(); ++y) {
-        if (y < clipped_rect.top() || y > clipped_rect.bottom())
-            continue;
-        auto* scanline = (Color*)m_target->scanline(y);
-        for (int x = dst_rect.left(); x <= dst_rect.right(); ++x) {
-            if (x < clipped_rect.left() || x >= clipped_rect.right())
-                continue;
+void Painter::draw_scaled_bitmap(const Rect& a_dst_rect, const GraphicsBitmap& source, const Rect& a_src_rect, ScalingMode mode)
+{
+    if (a_dst_rect.size() == a_src_rect.size())
+        return blit(a_dst_rect.location(), source, a_src_rect);
 
-            auto scaled_x = (float)(x - dst_rect.x()) * hscale;
-            auto scaled_y = (float)(y - dst_rect.y()) * vscale;
-            auto src_pixel = Color::from_rgba(source.scanline((int)scaled_y)[(int)scaled_x]);
+    auto src_rect = Rect::intersection(a_src_rect, source.rect());
+    auto dst_rect = a_dst_rect.translated(state().translation);
+    auto clipped_rect = Rect::intersection(dst_rect, clip_rect());
+    if (clipped_rect.is_empty() || src_rect.is_empty())
+        return;
 
-            if (!src_pixel.alpha())
-                continue;
-            if (src_pixel.alpha() == 0xff)
-                scanline[x] = src_pixel;
-            else
-                scanline[x] = scanline[x].blend(scanline[x]);
+    int hstep = ((long long)src_rect.width() << 16) / dst_rect.width();
+    int vstep = ((long long)src_rect.height() << 16) / dst_rect.height();
+    int width = clipped_rect.width();
+    int first_column = clipped_rect.left() - dst_rect.left();
+    int first_row = clipped_rect.top() - dst_rect.top();
+    bool source_has_alpha = source.has_alpha_channel();
+
+    Vector<RGBA32> scaled_row;
+    if (source_has_alpha)
+        scaled_row.resize(width);
+
+    if (mode == ScalingMode::NearestNeighbor) {
+        Vector<int> source_columns;
+        source_columns.ensure_capacity(width);
+        for (int x = 0; x < width; ++x)
+            source_columns.unchecked_append(src_rect.x() + (scaled_coordinate(first_column + x, hstep) >> 16));
+
+        for (int y = 0; y < clipped_rect.height(); ++y) {
+            const RGBA32* src = source.scanline(src_rect.y() + (scaled_coordinate(first_row + y, vstep) >> 16));
+            RGBA32* dst = m_target->scanline(clipped_rect.y() + y) + clipped_rect.x();
+            RGBA32* row = source_has_alpha ? scaled_row.data() : dst;
+            for (int x = 0; x < width; ++x)
+                row[x] = src[source_columns[x]];
+            if (source_has_alpha)
+                blend_scaled_row(dst, row, width);
+        }
+        return;
+    }
+
+    ASSERT(mode == ScalingMode::Bilinear);
+    // Each destination pixel mixes the 2x2 source pixels around where it lands.
+    // The columns are worked out once, then every row is a vertical lerp of two source rows (done 4 pixels at a time)
+    // followed by a horizontal lerp through the column table.
+    struct Column {
+        int left;
+        int right;
+        int weight;
+    };
+    auto clamp_sample = [] (int coordinate, int size) {
+        return min(max(coordinate - 0x8000, 0), (size - 1) << 16);
+    };
+    Vector<Column> columns;
+    columns.ensure_capacity(width);
+    for (int x = 0; x < width; ++x) {
+        int sample = clamp_sample(scaled_coordinate(first_column + x, hstep), src_rect.width());
+        int left = sample >> 16;
+        columns.unchecked_append({ left, min(left + 1, src_rect.width() - 1), (sample >> 8) & 0xff });
+    }
+    int span_start = columns.first().left;
+    int span_length = columns.last().right - span_start + 1;
+    Vector<RGBA32> lerped_rows;
+    lerped_rows.resize(span_length);
+
+    for (int y = 0; y < clipped_rect.height(); ++y) {
+        int sample = clamp_sample(scaled_coordinate(first_row + y, vstep), src_rect.height());
+        int top = sample >> 16;
+        int bottom = min(top + 1, src_rect.height() - 1);
+        const RGBA32* top_row = source.scanline(src_rect.y() + top) + src_rect.x() + span_start;
+        const RGBA32* bottom_row = source.scanline(src_rect.y() + bottom) + src_rect.x() + span_start;
+        lerp_rows(lerped_rows.data(), top_row, bottom_row, span_length, (sample >> 8) & 0xff);
+
+        RGBA32* dst = m_target->scanline(clipped_rect.y() + y) + clipped_rect.x();
+        RGBA32* row = source_has_alpha ? scaled_row.data() : dst;
+        for (int x = 0; x < width; ++x) {
+            auto& column = columns[x];
+            row[x] = lerp_pixel(lerped_rows[column.left - span_start], lerped_rows[column.right - span_start], column.weight);
         }
+        if (source_has_alpha)
+            blend_scaled_row(dst, row, width);
     }
 }
 
@@ -352,25 +603,34 @@ void Painter::draw_text(const Rect& rect, const char* text, int length, const Fo
     } else if (alignment == TextAlignment::CenterLeft) {
         point = { rect.x(), rect.center().y() - (font.glyph_height() / 2) };
     } else if (alignment == TextAlignment::CenterRight) {
-        int text_width = font.width(text);
+        int text_width = font.width(text, length);
         point = { rect.right() - text_width, rect.center().y() - (font.glyph_height() / 2) };
     } else if (alignment == TextAlignment::Center) {
-        int text_width = font.width(text);
+        int text_width = font.width(text, length);
         point = rect.center();
         point.move_by(-(text_width / 2), -(font.glyph_height() / 2));
     } else {
         ASSERT_NOT_REACHED();
     }
 
+    // Long lines are often mostly clipped away (scrolled table cells, the Terminal), so only walk the glyphs that show.
+    auto clip = clip_rect().translated(-state().translation);
+    if (point.y() > clip.bottom() || point.y() + font.glyph_height() <= clip.top())
+        return;
+
     int space_width = font.glyph_width(' ') + font.glyph_spacing();
     for (ssize_t i = 0; i < length; ++i) {
+        if (point.x() > clip.right())
+            break;
         char ch = text[i];
         if (ch == ' ') {
             point.move_by(space_width, 0);
             continue;
         }
-        draw_glyph(point, ch, font, color);
-        point.move_by(font.glyph_width(ch) + font.glyph_spacing(), 0);
+        int glyph_width = font.glyph_width(ch);
+        if (point.x() + glyph_width > clip.left())
+            draw_glyph(point, ch, font, color);
+        point.move_by(glyph_width + font.glyph_spacing(), 0);
     }
 }
 
@@ -408,76 +668,125 @@ void Painter::set_pixel(const Point& p, Color color)
 
 void Painter::draw_line(const Point& p1, const Point& p2, Color color)
 {
-    auto point1 = p1;
-    point1.move_by(state().translation);
+    draw_translated_line(p1.translated(state().translation), p2.translated(state().translation), color);
+}
+
+void Painter::draw_polyline(const Point* points, int count, Color color)
+{
+    auto translation = state().translation;
+    for (int i = 1; i < count; ++i)
+        draw_translated_line(points[i - 1].translated(translation), points[i].translated(translation), color);
+}
 
-    auto point2 = p2;
-    point2.move_by(state().translation);
+void Painter::draw_translated_line(Point point1, Point point2, Color color)
+{
+    auto clip_rect = this->clip_rect();
+    const int pitch = m_target->pitch() / sizeof(RGBA32);
+    const bool use_xor = draw_op() == DrawOp::Xor;
 
     // Special case: vertical line.
     if (point1.x() == point2.x()) {
         const int x = point1.x();
-        if (x < clip_rect().left() || x > clip_rect().right())
+        if (x < clip_rect.left() || x > clip_rect.right())
             return;
         if (point1.y() > point2.y())
             swap(point1, point2);
-        if (point1.y() > clip_rect().bottom())
+        if (point1.y() > clip_rect.bottom())
             return;
-        if (point2.y() < clip_rect().top())
+        if (point2.y() < clip_rect.top())
             return;
-        int min_y = max(point1.y(), clip_rect().top());
-        int max_y = min(point2.y(), clip_rect().bottom());
-        for (int y = min_y; y <= max_y; ++y)
-            set_pixel_with_draw_op(m_target->scanline(y)[x], color);
+        int min_y = max(point1.y(), clip_rect.top());
+        int max_y = min(point2.y(), clip_rect.bottom());
+        RGBA32* pixel = m_target->scanline(min_y) + x;
+        if (use_xor) {
+            for (int y = min_y; y <= max_y; ++y, pixel += pitch)
+                *pixel ^= color.value();
+        } else {
+            for (int y = min_y; y <= max_y; ++y, pixel += pitch)
+                *pixel = color.value();
+        }
         return;
     }
 
-    if (point1.x() > point2.x())
-        swap(point1, point2);
-
     // Special case: horizontal line.
     if (point1.y() == point2.y()) {
         const int y = point1.y();
-        if (y < clip_rect().top() || y > clip_rect().bottom())
+        if (y < clip_rect.top() || y > clip_rect.bottom())
             return;
         if (point1.x() > point2.x())
             swap(point1, point2);
-        if (point1.x() > clip_rect().right())
+        if (point1.x() > clip_rect.right())
             return;
-        if (point2.x() < clip_rect().left())
+        if (point2.x() < clip_rect.left())
             return;
-        int min_x = max(point1.x(), clip_rect().left());
-        int max_x = min(point2.x(), clip_rect().right());
-        auto* pixels = m_target->scanline(point1.y());
-        if (draw_op() == DrawOp::Copy) {
-            fast_dword_fill(pixels + min_x, color.value(), max_x - min_x + 1);
-        } else {
+        int min_x = max(point1.x(), clip_rect.left());
+        int max_x = min(point2.x(), clip_rect.right());
+        auto* pixels = m_target->scanline(y);
+        if (use_xor) {
             for (int x = min_x; x <= max_x; ++x)
-                set_pixel_with_draw_op(pixels[x], color);
+                pixels[x] ^= color.value();
+        } else {
+            fast_dword_fill(pixels + min_x, color.value(), max_x - min_x + 1);
         }
         return;
     }
 
-    // FIXME: Implement clipping below.
-    ASSERT_NOT_REACHED();
-
-#if 0
-    const double dx = point2.x() - point1.x();
-    const double dy = point2.y() - point1.y();
-    const double delta_error = fabs(dy / dx);
-    double error = 0;
-    const double y_step = dy == 0 ? 0 : (dy > 0 ? 1 : -1);
-
-    int y = point1.y();
-    for (int x = point1.x(); x <= point2.x(); ++x) {
-        m_target->scanline(y)[x] = color.value();
-        error += delta_error;
-        if (error >= 0.5) {
-            y = (double)y + y_step;
-            error -= 1.0;
+    // Everything else is walked along its major axis, a from a1 to a2, moving one pixel along the minor axis, b,
+    // whenever the error crosses over. The pixel at a is at b = b1 + b_sign * k(a), where
+    // k(a) = floor((2 * db * (a - a1) + da) / (2 * da)), so both the first and the last pixel inside the clip rect
+    // can be worked out up front, and the loop itself doesn't have to check anything.
+    bool x_major = abs(point2.x() - point1.x()) >= abs(point2.y() - point1.y());
+    if (x_major ? point1.x() > point2.x() : point1.y() > point2.y())
+        swap(point1, point2);
+
+    int a1 = x_major ? point1.x() : point1.y();
+    int a2 = x_major ? point2.x() : point2.y();
+    int b1 = x_major ? point1.y() : point1.x();
+    int b2 = x_major ? point2.y() : point2.x();
+    int a_min = x_major ? clip_rect.left() : clip_rect.top();
+    int a_max = x_major ? clip_rect.right() : clip_rect.bottom();
+    int b_min = x_major ? clip_rect.top() : clip_rect.left();
+    int b_max = x_major ? clip_rect.bottom() : clip_rect.right();
+
+    int da = a2 - a1;
+    int db = abs(b2 - b1);
+    int b_sign = b2 > b1 ? 1 : -1;
+
+    // The range of k that keeps b inside the clip rect.
+    int k_min = b_sign > 0 ? b_min - b1 : b1 - b_max;
+    int k_max = b_sign > 0 ? b_max - b1 : b1 - b_min;
+    if (k_max < 0 || k_min > db)
+        return;
+
+    int first = max(a1, a_min);
+    int last = min(a2, a_max);
+    if (k_min > 0)
+        first = max(first, a1 + (int)(((signed_qword)2 * da * k_min - da + 2 * db - 1) / (2 * db)));
+    last = min(last, a1 + (int)(((signed_qword)2 * da * (k_max + 1) - da - 1) / (2 * db)));
+    if (first > last)
+        return;
+
+    signed_qword numerator = (signed_qword)2 * db * (first - a1) + da;
+    int k = numerator / (2 * da);
+    int error = numerator % (2 * da);
+
+    int b = b1 + b_sign * k;
+    RGBA32* pixel = x_major ? m_target->scanline(b) + first : m_target->scanline(first) + b;
+    const int major_step = x_major ? 1 : pitch;
+    const int minor_step = x_major ? b_sign * pitch : b_sign;
+
+    for (int a = first; a <= last; ++a) {
+        if (use_xor)
+            *pixel ^= color.value();
+        else
+            *pixel = color.value();
+        error += 2 * db;
+        if (error >= 2 * da) {
+            error -= 2 * da;
+            pixel += minor_step;
         }
+        pixel += major_step;
     }
-#endif
 }
 
 void Painter::draw_focus_rect(const Rect& rect)
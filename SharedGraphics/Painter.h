@@ -23,8 +23,11 @@ public:
     void draw_bitmap(const Point&, const GlyphBitmap&, Color = Color());
     void set_pixel(const Point&, Color);
     void draw_line(const Point&, const Point&, Color);
+    // Joins each point to the next one. With DrawOp::Xor the points in between cancel out, being drawn twice.
+    void draw_polyline(const Point*, int count, Color);
     void draw_focus_rect(const Rect&);
-    void draw_scaled_bitmap(const Rect& dst_rect, const GraphicsBitmap&, const Rect& src_rect);
+    enum class ScalingMode { NearestNeighbor, Bilinear };
+    void draw_scaled_bitmap(const Rect& dst_rect, const GraphicsBitmap&, const Rect& src_rect, ScalingMode = ScalingMode::NearestNeighbor);
     void blit(const Point&, const GraphicsBitmap&, const Rect& src_rect);
     void blit_with_opacity(const Point&, const GraphicsBitmap&, const Rect& src_rect, float opacity);
 
@@ -59,7 +62,9 @@ public:
 protected:
     void set_pixel_with_draw_op(dword& pixel, const Color&);
     void fill_rect_with_draw_op(const Rect&, Color);
+    void draw_translated_line(Point, Point, Color);
     void blit_with_alpha(const Point&, const GraphicsBitmap&, const Rect& src_rect);
+    void blend_scaled_row(RGBA32* dst, const RGBA32* src, int count);
 
     struct State {
         const Font* font;
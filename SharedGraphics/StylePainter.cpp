@@ -14,6 +14,27 @@ StylePainter::StylePainter()
 {
 }
 
+// The bevels are all one pixel wide runs of a single color, so they're filled as such.
+// That clips each run once and fills it a scanline at a time, which draw_line only does for horizontal lines.
+static inline void fill_row(Painter& painter, int x1, int x2, int y, Color color)
+{
+    if (x1 > x2)
+        swap(x1, x2);
+    painter.fill_rect({ x1, y, x2 - x1 + 1, 1 }, color);
+}
+
+static inline void fill_column(Painter& painter, int x, int y1, int y2, Color color)
+{
+    if (y1 > y2)
+        swap(y1, y2);
+    painter.fill_rect({ x, y1, 1, y2 - y1 + 1 }, color);
+}
+
+static inline bool is_damaged(const Painter& painter, const Rect& rect)
+{
+    return rect.translated(painter.translation()).intersects(painter.clip_rect());
+}
+
 static void paint_button_new(Painter& painter, const Rect& rect, bool pressed)
 {
     Color button_color = Color::from_rgb(0xc0c0c0);
@@ -21,45 +42,50 @@ static void paint_button_new(Painter& painter, const Rect& rect, bool pressed)
     Color shadow_color1 = Color::from_rgb(0x808080);
     Color shadow_color2 = Color::from_rgb(0x404040);
 
-    PainterStateSaver saver(painter);
-    painter.translate(rect.location());
+    int left = rect.left();
+    int top = rect.top();
+    int right = rect.right();
+    int bottom = rect.bottom();
 
     if (pressed) {
-        // Base
-        painter.fill_rect({ 1, 1, rect.width() - 2, rect.height() - 2 }, button_color);
-
         painter.draw_rect(rect, shadow_color2);
 
         // Sunken shadow
-        painter.draw_line({ 1, 1 }, { rect.width() - 2, 1 }, shadow_color1);
-        painter.draw_line({ 1, 2 }, {1, rect.height() - 2 }, shadow_color1);
+        fill_row(painter, left + 1, right - 1, top + 1, shadow_color1);
+        fill_column(painter, left + 1, top + 2, bottom - 1, shadow_color1);
+
+        // Base
+        painter.fill_rect({ left + 2, top + 2, rect.width() - 3, rect.height() - 3 }, button_color);
     } else {
         // Base
-        painter.fill_rect({ 1, 1, rect.width() - 3, rect.height() - 3 }, button_color);
+        painter.fill_rect({ left + 1, top + 1, rect.width() - 3, rect.height() - 3 }, button_color);
 
         // Outer highlight
-        painter.draw_line({ 0, 0 }, { rect.width() - 2, 0 }, highlight_color2);
-        painter.draw_line({ 0, 1 }, { 0, rect.height() - 2 }, highlight_color2);
+        fill_row(painter, left, right - 1, top, highlight_color2);
+        fill_column(painter, left, top + 1, bottom - 1, highlight_color2);
 
 #if 0
         // Inner highlight (this looks "too thick" to me right now..)
         Color highlight_color1 = Color::from_rgb(0xffffff);
-        painter.draw_line({ 1, 1 }, { rect.width() - 3, 1 }, highlight_color1);
-        painter.draw_line({ 1, 2 }, { 1, rect.height() - 3 }, highlight_color1);
+        fill_row(painter, left + 1, right - 2, top + 1, highlight_color1);
+        fill_column(painter, left + 1, top + 2, bottom - 2, highlight_color1);
 #endif
 
         // Outer shadow
-        painter.draw_line({ 0, rect.height() - 1 }, { rect.width() - 1, rect.height() - 1 }, shadow_color2);
-        painter.draw_line({ rect.width() - 1, 0 }, { rect.width() - 1, rect.height() - 2 }, shadow_color2);
+        fill_row(painter, left, right, bottom, shadow_color2);
+        fill_column(painter, right, top, bottom - 1, shadow_color2);
 
         // Inner shadow
-        painter.draw_line({ 1, rect.height() - 2 }, { rect.width() - 2, rect.height() - 2 }, shadow_color1);
-        painter.draw_line({ rect.width() - 2, 1 }, { rect.width() - 2, rect.height() - 3 }, shadow_color1);
+        fill_row(painter, left + 1, right - 1, bottom - 1, shadow_color1);
+        fill_column(painter, right - 1, top + 1, bottom - 2, shadow_color1);
     }
 }
 
 void StylePainter::paint_button(Painter& painter, const Rect& rect, ButtonStyle button_style, bool pressed, bool hovered)
 {
+    if (!is_damaged(painter, rect))
+        return;
+
     if (button_style == ButtonStyle::Normal)
         return paint_button_new(painter, rect, pressed);
 
@@ -70,41 +96,47 @@ void StylePainter::paint_button(Painter& painter, const Rect& rect, ButtonStyle
     if (button_style == ButtonStyle::OldNormal)
         painter.draw_rect(rect, Color::Black);
 
-    PainterStateSaver saver(painter);
-    painter.translate(rect.location());
+    int left = rect.left();
+    int top = rect.top();
+    int right = rect.right();
+    int bottom = rect.bottom();
+
+    // The bevel covers the outermost ring inside the rect, so the base only has to fill what's inside that.
+    Rect base_rect { left + 2, top + 2, rect.width() - 4, rect.height() - 4 };
 
     if (pressed) {
-        // Base
-        painter.fill_rect({ 1, 1, rect.width() - 2, rect.height() - 2 }, button_color);
+        painter.fill_rect(base_rect, button_color);
 
         // Sunken shadow
-        painter.draw_line({ 1, 1 }, { rect.width() - 2, 1 }, shadow_color);
-        painter.draw_line({ 1, 2 }, {1, rect.height() - 2 }, shadow_color);
+        fill_row(painter, left + 1, right - 1, top + 1, shadow_color);
+        fill_column(painter, left + 1, top + 2, bottom - 1, shadow_color);
 
         // Bottom highlight
-        painter.draw_line({ rect.width() - 2, 1 }, { rect.width() - 2, rect.height() - 3 }, highlight_color);
-        painter.draw_line({ 1, rect.height() - 2 }, { rect.width() - 2, rect.height() - 2 }, highlight_color);
+        fill_column(painter, right - 1, top + 1, bottom - 2, highlight_color);
+        fill_row(painter, left + 1, right - 1, bottom - 1, highlight_color);
     } else if (button_style == ButtonStyle::OldNormal || (button_style == ButtonStyle::CoolBar && hovered)) {
-        // Base
-        painter.fill_rect({ 1, 1, rect.width() - 2, rect.height() - 2 }, button_color);
+        painter.fill_rect(base_rect, button_color);
 
         // White highlight
-        painter.draw_line({ 1, 1 }, { rect.width() - 2, 1 }, highlight_color);
-        painter.draw_line({ 1, 2 }, { 1, rect.height() - 2 }, highlight_color);
+        fill_row(painter, left + 1, right - 1, top + 1, highlight_color);
+        fill_column(painter, left + 1, top + 2, bottom - 1, highlight_color);
 
         // Gray shadow
-        painter.draw_line({ rect.width() - 2, 1 }, { rect.width() - 2, rect.height() - 3 }, shadow_color);
-        painter.draw_line({ 1, rect.height() - 2 }, { rect.width() - 2, rect.height() - 2 }, shadow_color);
+        fill_column(painter, right - 1, top + 1, bottom - 2, shadow_color);
+        fill_row(painter, left + 1, right - 1, bottom - 1, shadow_color);
     }
 }
 
 void StylePainter::paint_surface(Painter& painter, const Rect& rect, bool paint_vertical_lines)
 {
+    if (!is_damaged(painter, rect))
+        return;
+
     painter.fill_rect({ rect.x(), rect.y() + 1, rect.width(), rect.height() - 2 }, Color::LightGray);
-    painter.draw_line(rect.top_left(), rect.top_right(), Color::White);
-    painter.draw_line(rect.bottom_left(), rect.bottom_right(), Color::MidGray);
+    fill_row(painter, rect.left(), rect.right(), rect.top(), Color::White);
+    fill_row(painter, rect.left(), rect.right(), rect.bottom(), Color::MidGray);
     if (paint_vertical_lines) {
-        painter.draw_line(rect.top_left().translated(0, 1), rect.bottom_left().translated(0, -1), Color::White);
-        painter.draw_line(rect.top_right(), rect.bottom_right().translated(0, -1), Color::MidGray);
+        fill_column(painter, rect.left(), rect.top() + 1, rect.bottom() - 1, Color::White);
+        fill_column(painter, rect.right(), rect.top(), rect.bottom() - 1, Color::MidGray);
     }
 }
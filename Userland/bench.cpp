@@ -0,0 +1,587 @@
+#include <AK/StdLibExtras.h>
+#include <AK/Types.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mman.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Usage: bench [name...]
+// Runs the microbenchmarks whose names start with any of the given ones (all of them if none are given),
+// and prints one "<name>\t<value>\t<unit>" line per result, so runs on different commits can be diffed and charted.
+// Every benchmark does a fixed amount of work, and the random ones always use the same seed.
+
+static qword now_us()
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (qword)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static qword elapsed_since(qword start)
+{
+    return max(now_us() - start, (qword)1);
+}
+
+static void report(const char* name, qword value, const char* unit)
+{
+    printf("%s\t%Q\t%s\n", name, value, unit);
+    fflush(stdout);
+}
+
+static void report_per_op(const char* name, qword elapsed_us, int ops)
+{
+    report(name, elapsed_us * 1000 / ops, "ns/op");
+}
+
+static void report_throughput(const char* name, qword elapsed_us, qword bytes)
+{
+    report(name, bytes * 1000000 / elapsed_us / KB, "KB/s");
+}
+
+static void fail(const char* what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void wait_for(pid_t pid)
+{
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        perror("waitpid");
+}
+
+static const size_t chunk_size = 4 * KB;
+static byte s_chunk[chunk_size];
+
+static void bench_syscall()
+{
+    static const int iterations = 100000;
+    qword start = now_us();
+    for (int i = 0; i < iterations; ++i)
+        getuid();
+    report_per_op("syscall_roundtrip", elapsed_since(start), iterations);
+}
+
+static void bench_fork()
+{
+    static const int iterations = 100;
+    qword start = now_us();
+    for (int i = 0; i < iterations; ++i) {
+        pid_t pid = fork();
+        if (pid < 0)
+            fail("fork");
+        if (!pid)
+            _exit(0);
+        wait_for(pid);
+    }
+    report_per_op("fork_exit_wait", elapsed_since(start), iterations);
+
+    start = now_us();
+    for (int i = 0; i < iterations; ++i) {
+        pid_t pid = fork();
+        if (pid < 0)
+            fail("fork");
+        if (!pid) {
+            execl("/bin/true", "true", nullptr);
+            _exit(127);
+        }
+        wait_for(pid);
+    }
+    report_per_op("fork_exec_wait", elapsed_since(start), iterations);
+}
+
+// The child writes |bytes| into |write_fd| and goes away, the parent reads them all out of |read_fd|.
+static void stream_throughput(const char* name, int read_fd, int write_fd, qword bytes)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (!pid) {
+        close(read_fd);
+        for (qword written = 0; written < bytes;) {
+            ssize_t nwritten = write(write_fd, s_chunk, chunk_size);
+            if (nwritten <= 0)
+                _exit(1);
+            written += nwritten;
+        }
+        _exit(0);
+    }
+    close(write_fd);
+    qword start = now_us();
+    qword received = 0;
+    byte buffer[chunk_size];
+    for (;;) {
+        ssize_t nread = read(read_fd, buffer, sizeof(buffer));
+        if (nread <= 0)
+            break;
+        received += nread;
+    }
+    qword elapsed = elapsed_since(start);
+    close(read_fd);
+    wait_for(pid);
+    if (received != bytes)
+        fprintf(stderr, "%s: only got %Q of %Q bytes\n", name, received, bytes);
+    report_throughput(name, elapsed, received);
+}
+
+// One byte back and forth: the parent writes it to |parent_write_fd|, the child echoes it back.
+static void stream_latency(const char* name, int parent_read_fd, int parent_write_fd, int child_read_fd, int child_write_fd)
+{
+    static const int iterations = 5000;
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (!pid) {
+        char c;
+        while (read(child_read_fd, &c, 1) == 1) {
+            if (write(child_write_fd, &c, 1) != 1)
+                break;
+        }
+        _exit(0);
+    }
+    qword start = now_us();
+    for (int i = 0; i < iterations; ++i) {
+        char c = 'x';
+        if (write(parent_write_fd, &c, 1) != 1 || read(parent_read_fd, &c, 1) != 1) {
+            perror(name);
+            break;
+        }
+    }
+    report_per_op(name, elapsed_since(start), iterations);
+    kill(pid, SIGKILL);
+    wait_for(pid);
+}
+
+static const qword stream_bytes = 16 * MB;
+
+static void bench_pipe()
+{
+    int fds[2];
+    if (pipe(fds) < 0)
+        fail("pipe");
+    stream_throughput("pipe_throughput", fds[0], fds[1], stream_bytes);
+
+    int to_child[2];
+    int to_parent[2];
+    if (pipe(to_child) < 0 || pipe(to_parent) < 0)
+        fail("pipe");
+    stream_latency("pipe_roundtrip", to_parent[0], to_child[1], to_child[0], to_parent[1]);
+    close(to_child[0]);
+    close(to_child[1]);
+    close(to_parent[0]);
+    close(to_parent[1]);
+}
+
+// connect() waits for the listener to accept, so for sockets the child connects and the parent accepts.
+struct Listener {
+    int fd { -1 };
+    sockaddr_un local_address;
+    sockaddr_in inet_address;
+    bool is_local { false };
+};
+
+static Listener listen_local()
+{
+    Listener listener;
+    listener.is_local = true;
+    memset(&listener.local_address, 0, sizeof(listener.local_address));
+    listener.local_address.sun_family = AF_LOCAL;
+    strcpy(listener.local_address.sun_path, "/tmp/bench.socket");
+    unlink(listener.local_address.sun_path);
+    listener.fd = socket(AF_LOCAL, SOCK_STREAM, 0);
+    if (listener.fd < 0)
+        fail("socket");
+    if (bind(listener.fd, (const sockaddr*)&listener.local_address, sizeof(listener.local_address)) < 0)
+        fail("bind");
+    if (listen(listener.fd, 5) < 0)
+        fail("listen");
+    return listener;
+}
+
+static Listener listen_tcp()
+{
+    Listener listener;
+    memset(&listener.inet_address, 0, sizeof(listener.inet_address));
+    listener.inet_address.sin_family = AF_INET;
+    listener.inet_address.sin_port = htons(8765);
+    inet_pton(AF_INET, "127.0.0.1", &listener.inet_address.sin_addr);
+    listener.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener.fd < 0)
+        fail("socket");
+    if (bind(listener.fd, (const sockaddr*)&listener.inet_address, sizeof(listener.inet_address)) < 0)
+        fail("bind");
+    if (listen(listener.fd, 5) < 0)
+        fail("listen");
+    return listener;
+}
+
+static int connect_to(const Listener& listener)
+{
+    int fd = socket(listener.is_local ? AF_LOCAL : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int rc;
+    if (listener.is_local)
+        rc = connect(fd, (const sockaddr*)&listener.local_address, sizeof(listener.local_address));
+    else
+        rc = connect(fd, (const sockaddr*)&listener.inet_address, sizeof(listener.inet_address));
+    if (rc < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void socket_throughput(const char* name, const Listener& listener)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (!pid) {
+        int fd = connect_to(listener);
+        if (fd < 0)
+            _exit(1);
+        for (qword written = 0; written < stream_bytes;) {
+            ssize_t nwritten = write(fd, s_chunk, chunk_size);
+            if (nwritten <= 0)
+                _exit(1);
+            written += nwritten;
+        }
+        _exit(0);
+    }
+    int fd = accept(listener.fd, nullptr, nullptr);
+    if (fd < 0)
+        fail("accept");
+    qword start = now_us();
+    qword received = 0;
+    byte buffer[chunk_size];
+    for (;;) {
+        ssize_t nread = read(fd, buffer, sizeof(buffer));
+        if (nread <= 0)
+            break;
+        received += nread;
+    }
+    qword elapsed = elapsed_since(start);
+    close(fd);
+    wait_for(pid);
+    report_throughput(name, elapsed, received);
+}
+
+static void socket_latency(const char* name, const Listener& listener)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (!pid) {
+        int fd = connect_to(listener);
+        if (fd < 0)
+            _exit(1);
+        char c;
+        while (read(fd, &c, 1) == 1) {
+            if (write(fd, &c, 1) != 1)
+                break;
+        }
+        _exit(0);
+    }
+    int fd = accept(listener.fd, nullptr, nullptr);
+    if (fd < 0)
+        fail("accept");
+    static const int iterations = 5000;
+    qword start = now_us();
+    for (int i = 0; i < iterations; ++i) {
+        char c = 'x';
+        if (write(fd, &c, 1) != 1 || read(fd, &c, 1) != 1) {
+            perror(name);
+            break;
+        }
+    }
+    report_per_op(name, elapsed_since(start), iterations);
+    close(fd);
+    wait_for(pid);
+}
+
+static void bench_local_socket()
+{
+    auto listener = listen_local();
+    socket_throughput("local_socket_throughput", listener);
+    socket_latency("local_socket_roundtrip", listener);
+    close(listener.fd);
+    unlink(listener.local_address.sun_path);
+}
+
+static void bench_tcp()
+{
+    auto listener = listen_tcp();
+    socket_throughput("tcp_loopback_throughput", listener);
+    socket_latency("tcp_loopback_roundtrip", listener);
+    close(listener.fd);
+}
+
+static void bench_udp()
+{
+    static const int datagram_count = 4096;
+    static const size_t datagram_size = 1 * KB;
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(8766);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        fail("socket");
+    if (bind(fd, (const sockaddr*)&address, sizeof(address)) < 0)
+        fail("bind");
+    // Whatever got dropped never comes, so stop waiting a while after the last one.
+    timeval timeout { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (!pid) {
+        int send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        for (int i = 0; i < datagram_count; ++i)
+            sendto(send_fd, s_chunk, datagram_size, 0, (const sockaddr*)&address, sizeof(address));
+        _exit(0);
+    }
+    qword start = 0;
+    qword last = 0;
+    int received = 0;
+    byte buffer[datagram_size];
+    while (received < datagram_count) {
+        if (recv(fd, buffer, sizeof(buffer), 0) < 0)
+            break;
+        last = now_us();
+        if (!received)
+            start = last;
+        ++received;
+    }
+    close(fd);
+    wait_for(pid);
+    report_throughput("udp_loopback_throughput", max(last - start, (qword)1), (qword)received * datagram_size);
+    report("udp_loopback_delivered", (qword)received * 100 / datagram_count, "%");
+}
+
+static const int fault_page_count = 1024;
+
+static byte* map_anonymous(size_t size)
+{
+    auto* data = (byte*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+    if (data == MAP_FAILED)
+        fail("mmap");
+    return data;
+}
+
+static void bench_page_fault()
+{
+    size_t size = fault_page_count * PAGE_SIZE;
+
+    auto* data = map_anonymous(size);
+    qword start = now_us();
+    for (int i = 0; i < fault_page_count; ++i)
+        data[i * PAGE_SIZE] = 1;
+    report_per_op("page_fault_zero", elapsed_since(start), fault_page_count);
+
+    // While the child is around, every page it shares with us takes a copy on the first write.
+    int fds[2];
+    if (pipe(fds) < 0)
+        fail("pipe");
+    pid_t pid = fork();
+    if (pid < 0)
+        fail("fork");
+    if (!pid) {
+        close(fds[1]);
+        char c;
+        read(fds[0], &c, 1);
+        _exit(0);
+    }
+    close(fds[0]);
+    start = now_us();
+    for (int i = 0; i < fault_page_count; ++i)
+        data[i * PAGE_SIZE] = 2;
+    report_per_op("page_fault_cow", elapsed_since(start), fault_page_count);
+    close(fds[1]);
+    wait_for(pid);
+    munmap(data, size);
+
+    const char* path = "/tmp/bench.faults";
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        fail("open");
+    for (size_t written = 0; written < size; written += chunk_size)
+        write(fd, s_chunk, chunk_size);
+    auto* file_data = (byte*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file_data == MAP_FAILED)
+        fail("mmap");
+    start = now_us();
+    for (int i = 0; i < fault_page_count; ++i)
+        (void)*(volatile byte*)&file_data[i * PAGE_SIZE];
+    // The file was just written, so this is faulting in from the page cache, not from the disk.
+    report_per_op("page_fault_file", elapsed_since(start), fault_page_count);
+    munmap(file_data, size);
+    close(fd);
+    unlink(path);
+}
+
+static void bench_ext2()
+{
+    static const size_t file_size = 4 * MB;
+    static const int chunk_count = file_size / chunk_size;
+    static const int random_ops = 1024;
+    const char* path = "/tmp/bench.ext2";
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        fail("open");
+    qword start = now_us();
+    for (int i = 0; i < chunk_count; ++i) {
+        if (write(fd, s_chunk, chunk_size) != (ssize_t)chunk_size)
+            fail("write");
+    }
+    sync();
+    report_throughput("ext2_sequential_write", elapsed_since(start), file_size);
+
+    byte buffer[chunk_size];
+    lseek(fd, 0, SEEK_SET);
+    start = now_us();
+    for (int i = 0; i < chunk_count; ++i) {
+        if (read(fd, buffer, chunk_size) != (ssize_t)chunk_size)
+            fail("read");
+    }
+    report_throughput("ext2_sequential_read", elapsed_since(start), file_size);
+
+    srand(1);
+    start = now_us();
+    for (int i = 0; i < random_ops; ++i) {
+        if (pread(fd, buffer, chunk_size, (rand() % chunk_count) * chunk_size) != (ssize_t)chunk_size)
+            fail("pread");
+    }
+    report_per_op("ext2_random_read", elapsed_since(start), random_ops);
+
+    start = now_us();
+    for (int i = 0; i < random_ops; ++i) {
+        if (pwrite(fd, s_chunk, chunk_size, (rand() % chunk_count) * chunk_size) != (ssize_t)chunk_size)
+            fail("pwrite");
+    }
+    sync();
+    report_per_op("ext2_random_write", elapsed_since(start), random_ops);
+
+    close(fd);
+    unlink(path);
+}
+
+static void bench_directory()
+{
+    static const int file_count = 1000;
+    const char* directory = "/tmp/bench.dir";
+    if (mkdir(directory, 0755) < 0)
+        fail("mkdir");
+    char path[64];
+
+    qword start = now_us();
+    for (int i = 0; i < file_count; ++i) {
+        sprintf(path, "%s/%d", directory, i);
+        int fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            fail("open");
+        close(fd);
+    }
+    report_per_op("directory_create", elapsed_since(start), file_count);
+
+    start = now_us();
+    for (int i = 0; i < file_count; ++i) {
+        sprintf(path, "%s/%d", directory, (i * 7919) % file_count);
+        struct stat st;
+        if (stat(path, &st) < 0)
+            fail("stat");
+    }
+    report_per_op("directory_lookup", elapsed_since(start), file_count);
+
+    start = now_us();
+    for (int i = 0; i < file_count; ++i) {
+        sprintf(path, "%s/%d", directory, i);
+        if (unlink(path) < 0)
+            fail("unlink");
+    }
+    report_per_op("directory_unlink", elapsed_since(start), file_count);
+    rmdir(directory);
+}
+
+static void bench_malloc()
+{
+    static const int iterations = 100000;
+    qword start = now_us();
+    for (int i = 0; i < iterations; ++i)
+        free(malloc(32));
+    report_per_op("malloc_free_small", elapsed_since(start), iterations);
+
+    // A bunch of them alive at once, in mixed sizes.
+    static const int live_count = 256;
+    void* live[live_count];
+    memset(live, 0, sizeof(live));
+    srand(1);
+    start = now_us();
+    for (int i = 0; i < iterations; ++i) {
+        int slot = rand() % live_count;
+        free(live[slot]);
+        live[slot] = malloc(16 + rand() % 2048);
+    }
+    report_per_op("malloc_free_mixed", elapsed_since(start), iterations);
+    for (int i = 0; i < live_count; ++i)
+        free(live[i]);
+
+    // There's no way to get at kmalloc() on its own from here. Opening a descriptor kmallocs one,
+    // and closing it kfrees it, so this follows it as closely as anything does.
+    start = now_us();
+    for (int i = 0; i < iterations / 10; ++i) {
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd < 0)
+            fail("open");
+        close(fd);
+    }
+    report_per_op("kmalloc_open_close", elapsed_since(start), iterations / 10);
+}
+
+struct Benchmark {
+    const char* name;
+    void (*function)();
+};
+
+static const Benchmark s_benchmarks[] = {
+    { "syscall", bench_syscall },
+    { "fork", bench_fork },
+    { "pipe", bench_pipe },
+    { "local_socket", bench_local_socket },
+    { "tcp", bench_tcp },
+    { "udp", bench_udp },
+    { "page_fault", bench_page_fault },
+    { "ext2", bench_ext2 },
+    { "directory", bench_directory },
+    { "malloc", bench_malloc },
+};
+
+int main(int argc, char** argv)
+{
+    memset(s_chunk, 'x', sizeof(s_chunk));
+    for (auto& benchmark : s_benchmarks) {
+        bool wanted = argc < 2;
+        for (int i = 1; i < argc; ++i) {
+            if (!strncmp(benchmark.name, argv[i], strlen(argv[i])))
+                wanted = true;
+        }
+        if (wanted)
+            benchmark.function();
+    }
+    return 0;
+}
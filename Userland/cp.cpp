@@ -1,89 +1,212 @@
 #include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <assert.h>
+#include <getopt.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <AK/AKString.h>
 #include <AK/StringBuilder.h>
 #include <AK/FileSystemPath.h>
 
-int main(int argc, char** argv)
+// Usage: cp [-R] <source>... <destination>
+// With more than one source, or when the destination is a directory, everything goes inside it.
+// -R (or -r) copies directories with everything in them.
+
+static bool s_recursive = false;
+static mode_t s_umask = 0;
+
+// Big enough that each system call moves a good chunk of the file, and page aligned so the kernel can copy it in whole pages.
+static const size_t copy_buffer_size = 256 * 1024;
+static char s_copy_buffer[copy_buffer_size] __attribute__((aligned(4096)));
+
+static bool write_all(int fd, const char* data, ssize_t size, const String& path)
 {
-    if (argc != 3) {
-        printf("usage: cp <source> <destination>\n");
-        return 0;
+    while (size) {
+        ssize_t nwritten = write(fd, data, size);
+        if (nwritten < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "cp: write %s: %s\n", path.characters(), strerror(errno));
+            return false;
+        }
+        data += nwritten;
+        size -= nwritten;
     }
-    String src_path = argv[1];
-    String dst_path = argv[2];
+    return true;
+}
+
+static bool copy_contents(int src_fd, int dst_fd, const String& src_path, const String& dst_path)
+{
+    // Let the kernel move the data when it can, so it never comes out to us. Fall back to copying through a buffer.
+    for (;;) {
+        ssize_t nsent = sendfile(dst_fd, src_fd, nullptr, copy_buffer_size * 4);
+        if (nsent > 0)
+            continue;
+        if (nsent == 0)
+            return true;
+        if (errno == EINTR)
+            continue;
+        if (errno != EINVAL) {
+            fprintf(stderr, "cp: %s: %s\n", src_path.characters(), strerror(errno));
+            return false;
+        }
+        break;
+    }
+    for (;;) {
+        ssize_t nread = read(src_fd, s_copy_buffer, copy_buffer_size);
+        if (nread < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "cp: read %s: %s\n", src_path.characters(), strerror(errno));
+            return false;
+        }
+        if (nread == 0)
+            return true;
+        if (!write_all(dst_fd, s_copy_buffer, nread, dst_path))
+            return false;
+    }
+}
 
+static bool copy_file(const String& src_path, const String& dst_path, const struct stat& src_stat)
+{
     int src_fd = open(src_path.characters(), O_RDONLY);
     if (src_fd < 0) {
-        perror("open src");
-        return 1;
+        fprintf(stderr, "cp: %s: %s\n", src_path.characters(), strerror(errno));
+        return false;
+    }
+    int dst_fd = creat(dst_path.characters(), 0666);
+    if (dst_fd < 0) {
+        fprintf(stderr, "cp: %s: %s\n", dst_path.characters(), strerror(errno));
+        close(src_fd);
+        return false;
     }
 
-    struct stat src_stat;
-    int rc = fstat(src_fd, &src_stat);
-    if (rc < 0) {
-        perror("stat src");
-        return 1;
+    bool success = copy_contents(src_fd, dst_fd, src_path, dst_path);
+    if (success && fchmod(dst_fd, src_stat.st_mode & ~s_umask) < 0) {
+        fprintf(stderr, "cp: fchmod %s: %s\n", dst_path.characters(), strerror(errno));
+        success = false;
     }
+    close(src_fd);
+    close(dst_fd);
+    return success;
+}
 
-    if (S_ISDIR(src_stat.st_mode)) {
-        fprintf(stderr, "cp: FIXME: Copying directories is not yet supported\n");
-        return 1;
+static bool copy_symlink(const String& src_path, const String& dst_path)
+{
+    char target[1024];
+    ssize_t length = readlink(src_path.characters(), target, sizeof(target) - 1);
+    if (length < 0) {
+        fprintf(stderr, "cp: readlink %s: %s\n", src_path.characters(), strerror(errno));
+        return false;
     }
+    target[length] = '\0';
+    if (symlink(target, dst_path.characters()) < 0) {
+        fprintf(stderr, "cp: symlink %s: %s\n", dst_path.characters(), strerror(errno));
+        return false;
+    }
+    return true;
+}
 
-    int dst_fd = creat(dst_path.characters(), 0666);
-    if (dst_fd < 0) {
-        if (errno != EISDIR) {
-            perror("open dst");
-            return 1;
-        }
-        StringBuilder builder;
-        builder.append(dst_path);
-        builder.append('/');
-        builder.append(FileSystemPath(src_path).basename());
-        dst_path = builder.to_string();
-        dst_fd = creat(dst_path.characters(), 0666);
-        if (dst_fd < 0) {
-            perror("open dst");
-            return 1;
-        }
+static bool copy(const String& src_path, const String& dst_path, const struct stat& src_stat);
+
+static bool copy_directory(const String& src_path, const String& dst_path, const struct stat& src_stat)
+{
+    if (mkdir(dst_path.characters(), (src_stat.st_mode & 07777) | 0700) < 0 && errno != EEXIST) {
+        fprintf(stderr, "cp: mkdir %s: %s\n", dst_path.characters(), strerror(errno));
+        return false;
+    }
+    DIR* dir = opendir(src_path.characters());
+    if (!dir) {
+        fprintf(stderr, "cp: %s: %s\n", src_path.characters(), strerror(errno));
+        return false;
+    }
+    // The entries come with their metadata, a batch at a time, instead of costing an lstat() each.
+    bool success = true;
+    struct stat entry_stat;
+    while (auto* entry = readdir_with_stat(dir, &entry_stat)) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+        if (!copy(String::format("%s/%s", src_path.characters(), entry->d_name), String::format("%s/%s", dst_path.characters(), entry->d_name), entry_stat))
+            success = false;
     }
+    closedir(dir);
+    // Only now, so a read-only directory can still be filled in.
+    chmod(dst_path.characters(), src_stat.st_mode & 07777 & ~s_umask);
+    return success;
+}
 
-    for (;;) {
-        char buffer[BUFSIZ];
-        ssize_t nread = read(src_fd, buffer, sizeof(buffer));
-        if (nread < 0) {
-            perror("read src");
-            return 1;
+static bool copy(const String& src_path, const String& dst_path, const struct stat& src_stat)
+{
+    if (S_ISDIR(src_stat.st_mode)) {
+        if (!s_recursive) {
+            fprintf(stderr, "cp: %s is a directory (not copied without -R)\n", src_path.characters());
+            return false;
         }
-        if (nread == 0)
+        return copy_directory(src_path, dst_path, src_stat);
+    }
+    if (S_ISLNK(src_stat.st_mode))
+        return copy_symlink(src_path, dst_path);
+    return copy_file(src_path, dst_path, src_stat);
+}
+
+static bool is_directory(const String& path)
+{
+    struct stat st;
+    return stat(path.characters(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "Rr")) != -1) {
+        switch (opt) {
+        case 'R':
+        case 'r':
+            s_recursive = true;
             break;
-        ssize_t remaining_to_write = nread;
-        char* bufptr = buffer;
-        while (remaining_to_write) {
-            ssize_t nwritten = write(dst_fd, bufptr, remaining_to_write);
-            if (nwritten < 0) {
-                perror("write dst");
-                return 1;
-            }
-            assert(nwritten > 0);
-            remaining_to_write -= nwritten;
-            bufptr += nwritten;
+        default:
+            fprintf(stderr, "usage: cp [-R] <source>... <destination>\n");
+            return 1;
         }
     }
+    if (argc - optind < 2) {
+        fprintf(stderr, "usage: cp [-R] <source>... <destination>\n");
+        return 1;
+    }
 
-    auto my_umask = umask(0);
-    umask(my_umask);
-    rc = fchmod(dst_fd, src_stat.st_mode & ~my_umask);
-    if (rc < 0) {
-        perror("fchmod dst");
+    s_umask = umask(0);
+    umask(s_umask);
+
+    String destination = argv[argc - 1];
+    int source_count = argc - optind - 1;
+    bool into_directory = is_directory(destination);
+    if (source_count > 1 && !into_directory) {
+        fprintf(stderr, "cp: %s is not a directory\n", destination.characters());
         return 1;
     }
 
-    close(src_fd);
-    close(dst_fd);
-    return 0;
+    int status = 0;
+    for (int i = optind; i < argc - 1; ++i) {
+        String src_path = argv[i];
+        struct stat src_stat;
+        if (lstat(src_path.characters(), &src_stat) < 0) {
+            fprintf(stderr, "cp: %s: %s\n", src_path.characters(), strerror(errno));
+            status = 1;
+            continue;
+        }
+        String dst_path = destination;
+        if (into_directory) {
+            StringBuilder builder;
+            builder.append(destination);
+            builder.append('/');
+            builder.append(FileSystemPath(src_path).basename());
+            dst_path = builder.to_string();
+        }
+        if (!copy(src_path, dst_path, src_stat))
+            status = 1;
+    }
+    return status;
 }
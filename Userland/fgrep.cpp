@@ -1,20 +1,396 @@
+#include <AK/AKString.h>
+#include <AK/StringBuilder.h>
+#include <AK/ThreadPool.h>
+#include <AK/Vector.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-int main(int argc, char** argv)
+// Usage: fgrep [-c] [-l] [-e pattern]... [pattern] [file...]
+// Prints the lines that contain any of the patterns. With -c, only how many lines matched, with -l only the names of
+// the files that had any. Files are mapped in whole where possible, everything else is read in big blocks, and each
+// buffer is searched in one go instead of line by line.
+
+// Boyer-Moore-Horspool, for a single pattern.
+class HorspoolSearcher {
+public:
+    explicit HorspoolSearcher(const String& needle)
+        : m_needle(needle)
+    {
+        int length = m_needle.length();
+        for (int i = 0; i < 256; ++i)
+            m_skip[i] = max(length, 1);
+        for (int i = 0; i < length - 1; ++i)
+            m_skip[(byte)m_needle[i]] = length - 1 - i;
+    }
+
+    // Returns where the first match in [begin, end) starts, or null.
+    const char* find(const char* begin, const char* end) const
+    {
+        size_t length = m_needle.length();
+        if (!length)
+            return begin;
+        if ((size_t)(end - begin) < length)
+            return nullptr;
+        const char* needle = m_needle.characters();
+        const char* last_start = end - length;
+
+        // The skips are too short to pay for themselves, let memchr() find candidates for the first byte instead.
+        if (length < 4) {
+            for (const char* p = begin; p <= last_start;) {
+                p = (const char*)memchr(p, needle[0], last_start - p + 1);
+                if (!p)
+                    return nullptr;
+                if (!memcmp(p, needle, length))
+                    return p;
+                ++p;
+            }
+            return nullptr;
+        }
+
+        char last = needle[length - 1];
+        for (const char* p = begin; p <= last_start;) {
+            char ch = p[length - 1];
+            if (ch == last && !memcmp(p, needle, length - 1))
+                return p;
+            p += m_skip[(byte)ch];
+        }
+        return nullptr;
+    }
+
+private:
+    String m_needle;
+    int m_skip[256];
+};
+
+// Aho-Corasick, for any number of patterns in one pass. The automaton is a full table with a row of 256 transitions
+// per state, so scanning is a single lookup per byte.
+class AhoCorasickSearcher {
+public:
+    explicit AhoCorasickSearcher(const Vector<String>& patterns)
+    {
+        add_state();
+        for (auto& pattern : patterns) {
+            int state = 0;
+            for (int i = 0; i < pattern.length(); ++i) {
+                int index = state * 256 + (byte)pattern[i];
+                if (m_transitions[index] < 0) {
+                    // add_state() grows the table, so don't hold on to a reference into it across the call.
+                    int new_state = add_state();
+                    m_transitions[index] = new_state;
+                }
+                state = m_transitions[index];
+            }
+            m_accepting[state] = true;
+        }
+
+        // Breadth first, so every state's failure state is done before it. Missing transitions become the failure state's.
+        Vector<int> failure;
+        failure.resize(m_accepting.size());
+        Vector<int> queue;
+        for (int ch = 0; ch < 256; ++ch) {
+            int& next = m_transitions[ch];
+            if (next > 0) {
+                failure[next] = 0;
+                queue.append(next);
+            } else {
+                next = 0;
+            }
+        }
+        for (int i = 0; i < queue.size(); ++i) {
+            int state = queue[i];
+            if (m_accepting[failure[state]])
+                m_accepting[state] = true;
+            for (int ch = 0; ch < 256; ++ch) {
+                int& next = m_transitions[state * 256 + ch];
+                int fallback = m_transitions[failure[state] * 256 + ch];
+                if (next > 0) {
+                    failure[next] = fallback;
+                    queue.append(next);
+                } else {
+                    next = fallback;
+                }
+            }
+        }
+    }
+
+    // Returns where the first match in [begin, end) ends (its last byte), or null.
+    const char* find(const char* begin, const char* end) const
+    {
+        int state = 0;
+        for (const char* p = begin; p < end; ++p) {
+            state = m_transitions[state * 256 + (byte)*p];
+            if (m_accepting[state])
+                return p;
+        }
+        return nullptr;
+    }
+
+private:
+    int add_state()
+    {
+        int state = m_accepting.size();
+        m_accepting.append(false);
+        // -1 is "no transition yet" while building, the root's children are the only ones that can be 0 after.
+        for (int i = 0; i < 256; ++i)
+            m_transitions.append(-1);
+        return state;
+    }
+
+    Vector<int> m_transitions;
+    Vector<bool> m_accepting;
+};
+
+struct Options {
+    bool count_only { false };
+    bool list_files { false };
+};
+
+class Matcher {
+public:
+    explicit Matcher(const Vector<String>& patterns)
+    {
+        for (auto& pattern : patterns) {
+            if (pattern.is_empty())
+                m_matches_everything = true;
+        }
+        if (m_matches_everything)
+            return;
+        if (patterns.size() == 1)
+            m_horspool = new HorspoolSearcher(patterns[0]);
+        else
+            m_aho_corasick = new AhoCorasickSearcher(patterns);
+    }
+
+    ~Matcher()
+    {
+        delete m_horspool;
+        delete m_aho_corasick;
+    }
+
+    // Returns somewhere inside the first match in [begin, end), or null. None of the patterns have a newline,
+    // so a match never spans lines.
+    const char* find(const char* begin, const char* end) const
+    {
+        if (m_matches_everything)
+            return begin < end ? begin : nullptr;
+        if (m_horspool)
+            return m_horspool->find(begin, end);
+        return m_aho_corasick->find(begin, end);
+    }
+
+private:
+    bool m_matches_everything { false };
+    HorspoolSearcher* m_horspool { nullptr };
+    AhoCorasickSearcher* m_aho_corasick { nullptr };
+};
+
+// What a search has found so far.
+struct Search {
+    StringBuilder output;
+    int match_count { 0 };
+};
+
+// What it found in the end, to be printed.
+struct Result {
+    ByteBuffer output;
+    int match_count { 0 };
+};
+
+// Searches a buffer of whole lines (the last one may lack its newline). Returns false once there's no point going on.
+static bool search_lines(const char* data, size_t size, const Matcher& matcher, const Options& options, const char* prefix, Search& search)
 {
-    if (argc < 2) {
-        printf("usage: fgrep <str>\n");
-        return 0;
+    const char* end = data + size;
+    for (const char* p = data; p < end;) {
+        const char* match = matcher.find(p, end);
+        if (!match)
+            break;
+        const char* line_start = match;
+        while (line_start > p && line_start[-1] != '\n')
+            --line_start;
+        auto* newline = (const char*)memchr(match, '\n', end - match);
+        const char* line_end = newline ? newline : end;
+
+        ++search.match_count;
+        if (options.list_files)
+            return false;
+        if (!options.count_only) {
+            if (prefix) {
+                search.output.append(prefix);
+                search.output.append(':');
+            }
+            search.output.append(line_start, line_end - line_start);
+            search.output.append('\n');
+        }
+        p = line_end + 1;
     }
+    return true;
+}
+
+// For what can't be mapped, like pipes and synthetic files: reads big blocks, and searches all the complete lines in each.
+static int search_stream(int fd, const Matcher& matcher, const Options& options, const char* prefix, Search& search)
+{
+    static const int block_size = 64 * 1024;
+    Vector<char> buffer;
+    buffer.resize(block_size);
+    int used = 0;
     for (;;) {
-        char buf[4096];
-        fgets(buf, sizeof(buf), stdin);
-        if (strstr(buf, argv[1]))
-            write(1, buf, strlen(buf));
-        if (feof(stdin))
+        if (buffer.size() - used < block_size / 2)
+            buffer.resize(buffer.size() * 2);
+        ssize_t nread = read(fd, buffer.data() + used, buffer.size() - used);
+        if (nread < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (nread == 0)
+            break;
+        int search_start = used;
+        used += nread;
+
+        // Only search up to the last newline, the rest of the line is still to come.
+        int complete = used;
+        while (complete > search_start && buffer[complete - 1] != '\n')
+            --complete;
+        if (complete == search_start)
+            continue;
+        if (!search_lines(buffer.data(), complete, matcher, options, prefix, search))
             return 0;
+        memmove(buffer.data(), buffer.data() + complete, used - complete);
+        used -= complete;
     }
+    if (used)
+        search_lines(buffer.data(), used, matcher, options, prefix, search);
     return 0;
 }
+
+// Returns 0 or an errno.
+static int search_file(const char* path, const Matcher& matcher, const Options& options, const char* prefix, Search& search)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return errno;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int error = errno;
+        close(fd);
+        return error;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        return EISDIR;
+    }
+    // Empty files might be synthetic ones that only know their size once read, like the ones in /proc.
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            close(fd);
+            search_lines((const char*)map, st.st_size, matcher, options, prefix, search);
+            munmap(map, st.st_size);
+            return 0;
+        }
+    }
+    int error = search_stream(fd, matcher, options, prefix, search);
+    close(fd);
+    return error;
+}
+
+static void print_result(const char* name, const Result& result, const Options& options, bool show_file_names)
+{
+    if (options.list_files) {
+        if (result.match_count)
+            printf("%s\n", name);
+        return;
+    }
+    if (options.count_only) {
+        if (show_file_names)
+            printf("%s:%d\n", name, result.match_count);
+        else
+            printf("%d\n", result.match_count);
+        return;
+    }
+    fwrite(result.output.pointer(), 1, result.output.size(), stdout);
+}
+
+static void add_patterns(Vector<String>& patterns, const char* text)
+{
+    // A pattern with newlines in it is one pattern per line, like grep does it.
+    for (;;) {
+        const char* newline = strchr(text, '\n');
+        if (!newline) {
+            patterns.append(text);
+            return;
+        }
+        patterns.append(String(text, newline - text));
+        text = newline + 1;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    Vector<String> patterns;
+    int opt;
+    while ((opt = getopt(argc, argv, "cle:")) != -1) {
+        switch (opt) {
+        case 'c':
+            options.count_only = true;
+            break;
+        case 'l':
+            options.list_files = true;
+            break;
+        case 'e':
+            add_patterns(patterns, optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: fgrep [-c] [-l] [-e pattern]... [pattern] [file...]\n");
+            return 2;
+        }
+    }
+    if (patterns.is_empty()) {
+        if (optind >= argc) {
+            fprintf(stderr, "usage: fgrep [-c] [-l] [-e pattern]... [pattern] [file...]\n");
+            return 2;
+        }
+        add_patterns(patterns, argv[optind++]);
+    }
+    Matcher matcher(patterns);
+
+    if (optind >= argc) {
+        Search search;
+        search_stream(STDIN_FILENO, matcher, options, nullptr, search);
+        print_result("(standard input)", { search.output.to_byte_buffer(), search.match_count }, options, false);
+        return 0;
+    }
+
+    // Each file is searched on whichever thread gets to it, and what it found is printed in order afterwards.
+    int file_count = argc - optind;
+    bool show_file_names = file_count > 1;
+    Vector<Result> results;
+    // The errno each file failed with, if it did.
+    Vector<int> errors;
+    results.resize(file_count);
+    errors.resize(file_count);
+    parallel_for(0, file_count, [&] (int i) {
+        const char* path = argv[optind + i];
+        Search search;
+        errors[i] = search_file(path, matcher, options, show_file_names ? path : nullptr, search);
+        results[i] = { search.output.to_byte_buffer(), search.match_count };
+    });
+
+    int status = 0;
+    for (int i = 0; i < file_count; ++i) {
+        if (errors[i]) {
+            fprintf(stderr, "fgrep: %s: %s\n", argv[optind + i], strerror(errors[i]));
+            status = 1;
+            continue;
+        }
+        print_result(argv[optind + i], results[i], options, show_file_names);
+    }
+    return status;
+}
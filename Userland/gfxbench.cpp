@@ -0,0 +1,135 @@
+#include <AK/AKString.h>
+#include <AK/StdLibExtras.h>
+#include <SharedGraphics/Font.h>
+#include <SharedGraphics/GraphicsBitmap.h>
+#include <SharedGraphics/PNGLoader.h>
+#include <SharedGraphics/Painter.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Usage: gfxbench [name...]
+// Runs Painter and the PNG decoder over square bitmaps of a few standard sizes, without a WindowServer,
+// and prints one "<name>\t<value>\t<unit>" line per result like bench does. Only what's named is run, if anything is.
+// Every size does about the same number of pixels, so each result is a fixed amount of work.
+
+static const int pixels_per_run = 32 * 1024 * 1024;
+static const int sizes[] = { 16, 64, 256, 768 };
+
+static qword now_us()
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (qword)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void report(const String& name, qword pixels, qword elapsed_us)
+{
+    // Pixels per microsecond are megapixels per second.
+    printf("%s\t%Q\tMpx/s\n", name.characters(), pixels / max(elapsed_us, (qword)1));
+}
+
+static Retained<GraphicsBitmap> make_source(GraphicsBitmap::Format format, int size)
+{
+    auto bitmap = GraphicsBitmap::create(format, { size, size });
+    for (int y = 0; y < size; ++y) {
+        RGBA32* scanline = bitmap->scanline(y);
+        for (int x = 0; x < size; ++x) {
+            byte alpha = format == GraphicsBitmap::Format::RGBA32 ? (byte)(x * 255 / size) : 0xff;
+            scanline[x] = Color(x & 0xff, y & 0xff, (x ^ y) & 0xff, alpha).value();
+        }
+    }
+    return bitmap;
+}
+
+// Runs |draw| over and over on a |size| square, and reports how fast it went.
+template<typename Callback>
+static void run(const char* name, int size, Painter& painter, Callback draw)
+{
+    int iterations = max(1, pixels_per_run / (size * size));
+    Rect rect { 0, 0, size, size };
+    qword start = now_us();
+    for (int i = 0; i < iterations; ++i)
+        draw(painter, rect);
+    report(String::format("%s_%d", name, size), (qword)iterations * size * size, now_us() - start);
+}
+
+static bool is_wanted(const char* name, int argc, char** argv)
+{
+    if (argc < 2)
+        return true;
+    for (int i = 1; i < argc; ++i) {
+        if (!strncmp(name, argv[i], strlen(argv[i])))
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    int largest_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    auto target = GraphicsBitmap::create(GraphicsBitmap::Format::RGB32, { largest_size, largest_size });
+    Painter painter(*target);
+
+    for (int size : sizes) {
+        auto opaque = make_source(GraphicsBitmap::Format::RGB32, size);
+        auto translucent = make_source(GraphicsBitmap::Format::RGBA32, size);
+        auto half_size = make_source(GraphicsBitmap::Format::RGB32, max(1, size / 2));
+
+        if (is_wanted("fill_rect", argc, argv)) {
+            run("fill_rect", size, painter, [] (Painter& painter, const Rect& rect) {
+                painter.fill_rect(rect, Color::from_rgb(0x336699));
+            });
+        }
+        if (is_wanted("blit", argc, argv)) {
+            run("blit", size, painter, [&] (Painter& painter, const Rect& rect) {
+                painter.blit(rect.location(), *opaque, opaque->rect());
+            });
+            run("blit_with_opacity", size, painter, [&] (Painter& painter, const Rect& rect) {
+                painter.blit_with_opacity(rect.location(), *opaque, opaque->rect(), 0.5f);
+            });
+            // blit() goes through blit_with_alpha() for anything with an alpha channel.
+            run("blit_with_alpha", size, painter, [&] (Painter& painter, const Rect& rect) {
+                painter.blit(rect.location(), *translucent, translucent->rect());
+            });
+        }
+        if (is_wanted("draw_scaled_bitmap", argc, argv)) {
+            run("draw_scaled_bitmap", size, painter, [&] (Painter& painter, const Rect& rect) {
+                painter.draw_scaled_bitmap(rect, *half_size, half_size->rect());
+            });
+            run("draw_scaled_bitmap_bilinear", size, painter, [&] (Painter& painter, const Rect& rect) {
+                painter.draw_scaled_bitmap(rect, *half_size, half_size->rect(), Painter::ScalingMode::Bilinear);
+            });
+        }
+    }
+
+    if (is_wanted("draw_text", argc, argv)) {
+        // Counted in the pixels of the glyph cells drawn.
+        auto& font = Font::default_font();
+        String line = "The quick brown fox jumps over the lazy dog. 0123456789";
+        Rect rect { 0, 0, font.width(line), font.glyph_height() };
+        qword pixels_per_line = rect.size().area();
+        int iterations = max(1, pixels_per_run / 4 / (int)pixels_per_line);
+        qword start = now_us();
+        for (int i = 0; i < iterations; ++i)
+            painter.draw_text(rect.translated(0, (i % 32) * rect.height()), line, font, TextAlignment::TopLeft, Color::Black);
+        report("draw_text", iterations * pixels_per_line, now_us() - start);
+    }
+
+    if (is_wanted("png_decode", argc, argv)) {
+        static const int iterations = 3;
+        const char* path = "/res/wallpapers/sunset-retro.png";
+        qword pixels = 0;
+        qword start = now_us();
+        for (int i = 0; i < iterations; ++i) {
+            auto bitmap = load_png(path);
+            if (!bitmap) {
+                fprintf(stderr, "Couldn't decode %s\n", path);
+                return 1;
+            }
+            pixels += bitmap->size().area();
+        }
+        report("png_decode", pixels, now_us() - start);
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int usage()
+{
+    printf("usage: ifconfig [<adapter> [address <address>] [netmask <netmask>] [mtu <mtu>]]\n");
+    return 1;
+}
+
+static bool set_address(int fd, const char* name, unsigned request, const char* address_string)
+{
+    ifreq request_data;
+    memset(&request_data, 0, sizeof(request_data));
+    strncpy(request_data.ifr_name, name, IFNAMSIZ);
+    auto& address = (sockaddr_in&)request_data.ifr_addr;
+    address.sin_family = AF_INET;
+    if (inet_pton(AF_INET, address_string, &address.sin_addr) <= 0) {
+        fprintf(stderr, "ifconfig: Bad address '%s'\n", address_string);
+        return false;
+    }
+    if (ioctl(fd, request, &request_data) < 0) {
+        perror("ioctl");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 1) {
+        FILE* fp = fopen("/proc/netadapters", "r");
+        if (!fp) {
+            perror("fopen");
+            return 1;
+        }
+        char buffer[256];
+        while (fgets(buffer, sizeof(buffer), fp))
+            fputs(buffer, stdout);
+        fclose(fp);
+        return 0;
+    }
+    if (argc % 2 != 0)
+        return usage();
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    const char* name = argv[1];
+    for (int i = 2; i < argc; i += 2) {
+        if (!strcmp(argv[i], "address")) {
+            if (!set_address(fd, name, SIOCSIFADDR, argv[i + 1]))
+                return 1;
+        } else if (!strcmp(argv[i], "netmask")) {
+            if (!set_address(fd, name, SIOCSIFNETMASK, argv[i + 1]))
+                return 1;
+        } else if (!strcmp(argv[i], "mtu")) {
+            ifreq request_data;
+            memset(&request_data, 0, sizeof(request_data));
+            strncpy(request_data.ifr_name, name, IFNAMSIZ);
+            request_data.ifr_mtu = atoi(argv[i + 1]);
+            if (ioctl(fd, SIOCSIFMTU, &request_data) < 0) {
+                perror("ioctl");
+                return 1;
+            }
+        } else {
+            return usage();
+        }
+    }
+    close(fd);
+    return 0;
+}
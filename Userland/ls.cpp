@@ -9,6 +9,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <AK/AKString.h>
+#include <AK/QuickSort.h>
 #include <AK/Vector.h>
 
 static int do_dir(const char* path);
@@ -18,10 +19,14 @@ static bool flag_colorize = true;
 static bool flag_long = false;
 static bool flag_show_dotfiles = false;
 static bool flag_show_inode = false;
+static bool flag_sort = true;
+
+// Everything goes out through this, in big writes instead of one per entry or field.
+static char s_output_buffer[64 * 1024];
 
 int main(int argc, char** argv)
 {
-    static const char* valid_option_characters = "laiG";
+    static const char* valid_option_characters = "laiGU";
     int opt;
     while ((opt = getopt(argc, argv, valid_option_characters)) != -1) {
         switch (opt) {
@@ -37,6 +42,9 @@ int main(int argc, char** argv)
         case 'i':
             flag_show_inode = true;
             break;
+        case 'U':
+            flag_sort = false;
+            break;
         default:
             fprintf(stderr, "usage: ls [-%s] [path]\n", valid_option_characters);
             return 1;
@@ -50,9 +58,10 @@ int main(int argc, char** argv)
     else
         path = argv[optind];
 
-    if (flag_long)
-        return do_dir(path);
-    return do_dir_short(path);
+    setvbuf(stdout, s_output_buffer, _IOFBF, sizeof(s_output_buffer));
+    int status = flag_long ? do_dir(path) : do_dir_short(path);
+    fflush(stdout);
+    return status;
 }
 
 void get_geometry(int& rows, int& columns)
@@ -87,10 +96,11 @@ int print_name(struct stat& st, const char* name, const char* path_for_link_reso
     if (S_ISLNK(st.st_mode)) {
         if (path_for_link_resolution) {
             char linkbuf[256];
-            ssize_t nread = readlink(path_for_link_resolution, linkbuf, sizeof(linkbuf));
+            ssize_t nread = readlink(path_for_link_resolution, linkbuf, sizeof(linkbuf) - 1);
             if (nread < 0) {
                 perror("readlink failed");
             } else {
+                linkbuf[nread] = '\0';
                 nprinted += printf(" -> %s", linkbuf);
             }
         } else {
@@ -104,84 +114,149 @@ int print_name(struct stat& st, const char* name, const char* path_for_link_reso
     return nprinted;
 }
 
-int do_dir(const char* path)
+// Entries are kept with their names packed into one buffer, so a big directory doesn't cost an allocation per entry.
+struct Entry {
+    int name_offset;
+    ino_t inode;
+    struct stat st;
+};
+
+struct Listing {
+    Vector<Entry> entries;
+    Vector<char> names;
+
+    const char* name(const Entry& entry) const { return names.data() + entry.name_offset; }
+};
+
+static void print_long(const char* dir_path, const char* name, ino_t inode, struct stat& st)
+{
+    char line[128];
+    char* p = line;
+    if (flag_show_inode)
+        p += sprintf(p, "%08u ", inode);
+
+    if (S_ISDIR(st.st_mode))
+        *p++ = 'd';
+    else if (S_ISLNK(st.st_mode))
+        *p++ = 'l';
+    else if (S_ISBLK(st.st_mode))
+        *p++ = 'b';
+    else if (S_ISCHR(st.st_mode))
+        *p++ = 'c';
+    else if (S_ISFIFO(st.st_mode))
+        *p++ = 'f';
+    else if (S_ISSOCK(st.st_mode))
+        *p++ = 's';
+    else if (S_ISREG(st.st_mode))
+        *p++ = '-';
+    else
+        *p++ = '?';
+
+    *p++ = st.st_mode & S_IRUSR ? 'r' : '-';
+    *p++ = st.st_mode & S_IWUSR ? 'w' : '-';
+    *p++ = st.st_mode & S_ISUID ? 's' : (st.st_mode & S_IXUSR ? 'x' : '-');
+    *p++ = st.st_mode & S_IRGRP ? 'r' : '-';
+    *p++ = st.st_mode & S_IWGRP ? 'w' : '-';
+    *p++ = st.st_mode & S_ISGID ? 's' : (st.st_mode & S_IXGRP ? 'x' : '-');
+    *p++ = st.st_mode & S_IROTH ? 'r' : '-';
+    *p++ = st.st_mode & S_IWOTH ? 'w' : '-';
+    *p++ = st.st_mode & S_ISVTX ? 't' : (st.st_mode & S_IXOTH ? 'x' : '-');
+
+    p += sprintf(p, " %4u %4u", st.st_uid, st.st_gid);
+
+    if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode))
+        p += sprintf(p, "  %4u,%4u ", major(st.st_rdev), minor(st.st_rdev));
+    else
+        p += sprintf(p, " %10u ", st.st_size);
+
+    // Most entries in a directory share a handful of timestamps, so don't break down the same one over and over.
+    static time_t last_time = -1;
+    static struct tm last_tm;
+    if (st.st_mtime != last_time) {
+        last_tm = *localtime(&st.st_mtime);
+        last_time = st.st_mtime;
+    }
+    p += sprintf(p, "  %4u-%02u-%02u %02u:%02u:%02u  ",
+        last_tm.tm_year + 1900,
+        last_tm.tm_mon + 1,
+        last_tm.tm_mday,
+        last_tm.tm_hour,
+        last_tm.tm_min,
+        last_tm.tm_sec);
+    fwrite(line, 1, p - line, stdout);
+
+    if (S_ISLNK(st.st_mode)) {
+        char pathbuf[PATH_MAX];
+        sprintf(pathbuf, "%s/%s", dir_path, name);
+        print_name(st, name, pathbuf);
+    } else {
+        print_name(st, name);
+    }
+    putchar('\n');
+}
+
+static bool read_listing(const char* path, Listing& listing)
 {
     DIR* dirp = opendir(path);
     if (!dirp) {
         perror("opendir");
-        return 1;
+        return false;
     }
-    char pathbuf[PATH_MAX];
-
-    while (auto* de = readdir(dirp)) {
+    struct stat st;
+    while (auto* de = readdir_with_stat(dirp, &st)) {
         if (de->d_name[0] == '.' && !flag_show_dotfiles)
             continue;
-        sprintf(pathbuf, "%s/%s", path, de->d_name);
+        int name_length = strlen(de->d_name);
+        int name_offset = listing.names.size();
+        listing.names.resize(name_offset + name_length + 1);
+        memcpy(listing.names.data() + name_offset, de->d_name, name_length + 1);
+        listing.entries.append({ name_offset, de->d_ino, st });
+    }
+    closedir(dirp);
+    return true;
+}
+
+// Returns the order to print the entries in: by name, unless -U said not to bother.
+static Vector<int> listing_order(const Listing& listing)
+{
+    Vector<int> order;
+    order.ensure_capacity(listing.entries.size());
+    for (int i = 0; i < listing.entries.size(); ++i)
+        order.unchecked_append(i);
+    if (flag_sort) {
+        quick_sort(order.begin(), order.end(), [&] (int a, int b) {
+            return strcmp(listing.name(listing.entries[a]), listing.name(listing.entries[b])) < 0;
+        });
+    }
+    return order;
+}
 
+int do_dir(const char* path)
+{
+    if (!flag_sort) {
+        // Nothing to sort, so each entry can go out as soon as it's read.
+        DIR* dirp = opendir(path);
+        if (!dirp) {
+            perror("opendir");
+            return 1;
+        }
         struct stat st;
-        int rc = lstat(pathbuf, &st);
-        if (rc == -1) {
-            printf("lstat(%s) failed: %s\n", pathbuf, strerror(errno));
-            return 2;
+        while (auto* de = readdir_with_stat(dirp, &st)) {
+            if (de->d_name[0] == '.' && !flag_show_dotfiles)
+                continue;
+            print_long(path, de->d_name, de->d_ino, st);
         }
+        closedir(dirp);
+        return 0;
+    }
 
-        if (flag_show_inode)
-            printf("%08u ", de->d_ino);
-
-        if (S_ISDIR(st.st_mode))
-            printf("d");
-        else if (S_ISLNK(st.st_mode))
-            printf("l");
-        else if (S_ISBLK(st.st_mode))
-            printf("b");
-        else if (S_ISCHR(st.st_mode))
-            printf("c");
-        else if (S_ISFIFO(st.st_mode))
-            printf("f");
-        else if (S_ISSOCK(st.st_mode))
-            printf("s");
-        else if (S_ISREG(st.st_mode))
-            printf("-");
-        else
-            printf("?");
-
-        printf("%c%c%c%c%c%c%c%c",
-            st.st_mode & S_IRUSR ? 'r' : '-',
-            st.st_mode & S_IWUSR ? 'w' : '-',
-            st.st_mode & S_ISUID ? 's' : (st.st_mode & S_IXUSR ? 'x' : '-'),
-            st.st_mode & S_IRGRP ? 'r' : '-',
-            st.st_mode & S_IWGRP ? 'w' : '-',
-            st.st_mode & S_ISGID ? 's' : (st.st_mode & S_IXGRP ? 'x' : '-'),
-            st.st_mode & S_IROTH ? 'r' : '-',
-            st.st_mode & S_IWOTH ? 'w' : '-'
-        );
-
-        if (st.st_mode & S_ISVTX)
-            printf("t");
-        else
-            printf("%c", st.st_mode & S_IXOTH ? 'x' : '-');
-
-        printf(" %4u %4u", st.st_uid, st.st_gid);
-
-        if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode))
-            printf("  %4u,%4u ", major(st.st_rdev), minor(st.st_rdev));
-        else
-            printf(" %10u ", st.st_size);
-
-        auto* tm = localtime(&st.st_mtime);
-        printf("  %4u-%02u-%02u %02u:%02u:%02u  ",
-            tm->tm_year + 1900,
-            tm->tm_mon + 1,
-            tm->tm_mday,
-            tm->tm_hour,
-            tm->tm_min,
-            tm->tm_sec);
-
-        print_name(st, de->d_name, pathbuf);
-
-        printf("\n");
+    Listing listing;
+    if (!read_listing(path, listing))
+        return 1;
+    for (int index : listing_order(listing)) {
+        auto& entry = listing.entries[index];
+        print_long(path, listing.name(entry), entry.inode, entry.st);
     }
-    closedir(dirp);
     return 0;
 }
 
@@ -191,49 +266,29 @@ int do_dir_short(const char* path)
     int columns;
     get_geometry(rows, columns);
 
-    DIR* dirp = opendir(path);
-    if (!dirp) {
-        perror("opendir");
+    Listing listing;
+    if (!read_listing(path, listing))
         return 1;
-    }
-
-    Vector<String> names;
-    int longest_name = 0;
-    while (auto* de = readdir(dirp)) {
-        if (de->d_name[0] == '.' && !flag_show_dotfiles)
-            continue;
-        names.append(de->d_name);
-        if (names.last().length() > longest_name)
-            longest_name = names.last().length();
-    }
-    closedir(dirp);
+    auto order = listing_order(listing);
 
     int printed_on_row = 0;
 
-    for (int i = 0; i < names.size(); ++i) {
-        auto& name = names[i];
-        struct stat st;
-        char pathbuf[256];
-        sprintf(pathbuf, "%s/%s", path, name.characters());
-        int rc = lstat(pathbuf, &st);
-        if (rc == -1) {
-            printf("lstat(%s) failed: %s\n", pathbuf, strerror(errno));
-            return 2;
-        }
+    for (int i = 0; i < order.size(); ++i) {
+        auto& entry = listing.entries[order[i]];
 
-        int nprinted = print_name(st, name.characters());
+        int nprinted = print_name(entry.st, listing.name(entry));
         int column_width = 14;
         printed_on_row += column_width;
 
         for (int i = nprinted; i < column_width; ++i)
-            printf(" ");
+            putchar(' ');
         if ((printed_on_row + column_width) >= columns) {
-            if (i != names.size() - 1)
-                printf("\n");
+            if (i != order.size() - 1)
+                putchar('\n');
             printed_on_row = 0;
         }
     }
-    printf("\n");
+    putchar('\n');
 
     return 0;
 }
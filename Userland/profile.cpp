@@ -0,0 +1,212 @@
+#include <AK/AKString.h>
+#include <AK/HashMap.h>
+#include <AK/MappedFile.h>
+#include <AK/QuickSort.h>
+#include <AK/Vector.h>
+#include <Kernel/ELFImage.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Usage: profile <pid> [seconds]
+// Samples a process for a while (5 seconds unless told otherwise), then lists the functions it was in most,
+// both right in them (self) and anywhere down the stack from them (total).
+
+struct Symbol {
+    dword address;
+    String name;
+};
+
+// Kernel symbols come from /kernel.map, the program's own from its ELF symbol table.
+static Vector<Symbol> s_symbols;
+
+static void load_kernel_symbols()
+{
+    MappedFile file("/kernel.map", MappedFile::AccessPattern::Sequential, MappedFile::Populate::Yes);
+    if (!file.is_valid() || file.file_length() < sizeof(dword)) {
+        fprintf(stderr, "failed to map /kernel.map\n");
+        return;
+    }
+    // A count, then that many address and name offset pairs sorted by address, then the names (see Kernel/mkmap.sh).
+    auto* data = (const dword*)file.pointer();
+    dword count = data[0];
+    auto* entries = data + 1;
+    auto* names = (const char*)(entries + count * 2);
+    if ((const char*)names > (const char*)file.pointer() + file.file_length()) {
+        fprintf(stderr, "/kernel.map is truncated\n");
+        return;
+    }
+    s_symbols.ensure_capacity(s_symbols.size() + count);
+    for (dword i = 0; i < count; ++i)
+        s_symbols.append({ entries[i * 2], names + entries[i * 2 + 1] });
+}
+
+static bool load_executable_symbols(pid_t pid)
+{
+    char path[PATH_MAX];
+    sprintf(path, "/proc/%d/exe", pid);
+    char executable_path[PATH_MAX];
+    ssize_t length = readlink(path, executable_path, sizeof(executable_path) - 1);
+    if (length < 0) {
+        perror("readlink");
+        return false;
+    }
+    executable_path[length] = '\0';
+    // Only the headers and the symbol and string tables get looked at, reading around them would be for nothing.
+    MappedFile file(executable_path, MappedFile::AccessPattern::Random);
+    if (!file.is_valid()) {
+        fprintf(stderr, "Couldn't map %s\n", executable_path);
+        return false;
+    }
+    ELFImage image((const byte*)file.pointer());
+    if (!image.is_valid()) {
+        fprintf(stderr, "%s is not a valid ELF image\n", executable_path);
+        return false;
+    }
+    image.for_each_symbol([&] (const ELFImage::Symbol symbol) {
+        if (symbol.type() == STT_FUNC && symbol.value())
+            s_symbols.append({ symbol.value(), symbol.name() });
+        return true;
+    });
+    return true;
+}
+
+static const Symbol* symbolicate(dword address)
+{
+    // The last one starting at or before the address.
+    int low = 0;
+    int high = s_symbols.size();
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (s_symbols[middle].address <= address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low ? &s_symbols[low - 1] : nullptr;
+}
+
+struct Sample {
+    dword timestamp;
+    int tid;
+    Vector<dword, 16> frames;
+};
+
+// Reads what the kernel has, keeping only what's newer than what was read the last time.
+static void read_samples(pid_t pid, Vector<Sample>& samples, dword& last_timestamp)
+{
+    char path[PATH_MAX];
+    sprintf(path, "/proc/%d/profile", pid);
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        perror("failed to open profile");
+        return;
+    }
+    dword newest_timestamp = last_timestamp;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char* cursor = line;
+        Sample sample;
+        sample.timestamp = strtoul(cursor, &cursor, 16);
+        sample.tid = strtoul(cursor, &cursor, 16);
+        // There's at most one sample a tick, so the tick says whether it's been seen.
+        if (sample.timestamp <= last_timestamp)
+            continue;
+        for (;;) {
+            char* end;
+            dword frame = strtoul(cursor, &end, 16);
+            if (end == cursor)
+                break;
+            sample.frames.append(frame);
+            cursor = end;
+        }
+        if (sample.timestamp > newest_timestamp)
+            newest_timestamp = sample.timestamp;
+        samples.append(move(sample));
+    }
+    fclose(fp);
+    last_timestamp = newest_timestamp;
+}
+
+struct Entry {
+    String name;
+    int self { 0 };
+    int total { 0 };
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: profile <pid> [seconds]\n");
+        return 1;
+    }
+    pid_t pid = atoi(argv[1]);
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+
+    if (profiling_enable(pid) < 0) {
+        perror("profiling_enable");
+        return 1;
+    }
+    // The kernel only keeps the last half second or so, so it's gathered up as it goes.
+    Vector<Sample> samples;
+    dword last_timestamp = 0;
+    for (int i = 0; i < seconds * 4; ++i) {
+        usleep(250000);
+        read_samples(pid, samples, last_timestamp);
+    }
+    if (profiling_disable(pid) < 0)
+        perror("profiling_disable");
+    read_samples(pid, samples, last_timestamp);
+
+    load_kernel_symbols();
+    load_executable_symbols(pid);
+    quick_sort(s_symbols.begin(), s_symbols.end(), [] (auto& a, auto& b) { return a.address < b.address; });
+
+    HashMap<String, Entry> entries;
+    for (auto& sample : samples) {
+        // A function that recursed only counts once towards its total for the sample.
+        Vector<String, 16> seen;
+        for (int i = 0; i < sample.frames.size(); ++i) {
+            auto* symbol = symbolicate(sample.frames[i]);
+            String name = symbol ? symbol->name : String::format("%x", sample.frames[i]);
+            auto it = entries.find(name);
+            if (it == entries.end()) {
+                entries.set(name, { name, 0, 0 });
+                it = entries.find(name);
+            }
+            auto& entry = (*it).value;
+            if (!i)
+                ++entry.self;
+            bool already_seen = false;
+            for (auto& seen_name : seen) {
+                if (seen_name == name) {
+                    already_seen = true;
+                    break;
+                }
+            }
+            if (!already_seen) {
+                ++entry.total;
+                seen.append(name);
+            }
+        }
+    }
+
+    Vector<Entry*> sorted_entries;
+    for (auto& it : entries)
+        sorted_entries.append(&it.value);
+    quick_sort(sorted_entries.begin(), sorted_entries.end(), [] (auto* a, auto* b) {
+        return a->self > b->self || (a->self == b->self && a->total > b->total);
+    });
+
+    printf("%d samples\n", samples.size());
+    printf("  Self   Total  Function\n");
+    int sample_count = max(samples.size(), 1);
+    static const int max_entries_shown = 40;
+    for (int i = 0; i < min(sorted_entries.size(), max_entries_shown); ++i) {
+        auto* entry = sorted_entries[i];
+        printf("%5d%% %6d%%  %s\n", entry->self * 100 / sample_count, entry->total * 100 / sample_count, entry->name.characters());
+    }
+    return 0;
+}
@@ -1,28 +1,58 @@
+#include <AK/ByteBuffer.h>
+#include <Kernel/ProcessSnapshot.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
 
 int main(int argc, char** argv)
 {
     (void) argc;
     (void) argv;
-    int fd = open("/proc/summary", O_RDONLY);
+    int fd = open("/proc/all.bin", O_RDONLY);
     if (fd == -1) {
-        perror("failed to open /proc/summary");
+        perror("failed to open /proc/all.bin");
         return 1;
     }
+    ByteBuffer buffer;
     for (;;) {
-        char buf[128];
-        ssize_t nread = read(fd, buf, sizeof(buf));
+        char chunk[4096];
+        ssize_t nread = read(fd, chunk, sizeof(chunk));
         if (nread == 0)
             break;
         if (nread < 0) {
             perror("failed to read");
             return 2;
         }
-        for (ssize_t i = 0; i < nread; ++i) {
-            putchar(buf[i]);
-        }
+        buffer.append(chunk, nread);
+    }
+    close(fd);
+
+    auto& header = *(const ProcessSnapshotHeader*)buffer.pointer();
+    if (buffer.size() < (ssize_t)sizeof(header) || header.version != process_snapshot_version) {
+        fprintf(stderr, "/proc/all.bin is not in a format I know\n");
+        return 1;
+    }
+    printf("PID TPG PGP SID  OWNER  STATE      PPID NSCHED     FDS  TTY  NAME\n");
+    const byte* record = buffer.pointer() + sizeof(header);
+    for (dword i = 0; i < header.process_count; ++i, record += header.entry_size) {
+        auto& entry = *(const ProcessSnapshotEntry*)record;
+        // The colonel isn't a process anyone started.
+        if (!entry.pid)
+            continue;
+        const char* tty = strrchr(entry.tty, '/');
+        printf("% 3u % 3u % 3u % 3u  % 4u   % 8s   % 3u  % 9u  % 3u  % 4s  %s\n",
+            entry.pid,
+            entry.tty_pgid,
+            entry.pgid,
+            entry.sid,
+            entry.uid,
+            entry.state,
+            entry.ppid,
+            entry.times_scheduled,
+            entry.open_file_descriptors,
+            tty ? tty + 1 : "n/a",
+            entry.name);
     }
     return 0;
 }
@@ -1,6 +1,7 @@
 #include <errno.h>
 #include <pwd.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -119,28 +120,61 @@ static bool handle_builtin(int argc, char** argv, int& retval)
     return false;
 }
 
-static int try_exec(const char* path, char** argv)
+static int try_spawn(pid_t* child, const char* path, const posix_spawn_file_actions_t* file_actions, const posix_spawnattr_t* attr, char** argv)
 {
-    int ret = execve(path, argv, environ);
-    assert(ret < 0);
+    int error = posix_spawn(child, path, file_actions, attr, argv, environ);
+    if (error != ENOENT || strchr(argv[0], '/'))
+        return error;
 
-    {
-    const char* search_path = "/bin";
-    char pathbuf[128];
-    sprintf(pathbuf, "%s/%s", search_path, argv[0]);
-    ret = execve(pathbuf, argv, environ);
-    assert(ret < 0);
+    const char* search_paths[] = { "/bin", "/usr/bin" };
+    for (auto* search_path : search_paths) {
+        char pathbuf[128];
+        sprintf(pathbuf, "%s/%s", search_path, argv[0]);
+        error = posix_spawn(child, pathbuf, file_actions, attr, argv, environ);
+        if (error != ENOENT)
+            return error;
     }
+    return error;
+}
 
-    {
-    const char* search_path = "/usr/bin";
-    char pathbuf[128];
-    sprintf(pathbuf, "%s/%s", search_path, argv[0]);
-    ret = execve(pathbuf, argv, environ);
+// Splits a command on spaces, in place. Runs of spaces don't make empty arguments.
+static int split_arguments(char* command, char** argv, int max_arguments)
+{
+    int argc = 0;
+    for (char* ch = command; *ch;) {
+        while (*ch == ' ')
+            *ch++ = '\0';
+        if (!*ch)
+            break;
+        if (argc == max_arguments)
+            return -1;
+        argv[argc++] = ch;
+        while (*ch && *ch != ' ')
+            ++ch;
+    }
+    argv[argc] = nullptr;
+    return argc;
+}
+
+static void print_wait_status(int wstatus)
+{
+    if (WIFEXITED(wstatus)) {
+        if (WEXITSTATUS(wstatus) != 0)
+            printf("Exited with status %d\n", WEXITSTATUS(wstatus));
+    } else {
+        if (WIFSIGNALED(wstatus)) {
+            switch (WTERMSIG(wstatus)) {
+            case SIGINT:
+                printf("Interrupted\n");
+                break;
+            default:
+                printf("Terminated by signal %d\n", WTERMSIG(wstatus));
+                break;
+            }
+        } else {
+            printf("Exited abnormally\n");
+        }
     }
-    if (ret == -1)
-        return -1;
-    return ret;
 }
 
 static int runcmd(char* cmd)
@@ -150,48 +184,117 @@ static int runcmd(char* cmd)
     char buf[128];
     memcpy(buf, cmd, 128);
 
-    char* argv[32];
-    size_t argc = 1;
-    argv[0] = &buf[0];
-    size_t buflen = strlen(buf);
-    for (size_t i = 0; i < buflen; ++i) {
-        if (buf[i] == ' ') {
-            buf[i] = '\0';
-            argv[argc++] = &buf[i + 1];
+    // A pipeline: commands separated by '|', each one reading what the one before it writes.
+    static const int max_commands = 8;
+    static const int max_arguments = 31;
+    char* argvs[max_commands][max_arguments + 1];
+    int command_count = 0;
+    for (char* command = buf; command;) {
+        char* next = strchr(command, '|');
+        if (next)
+            *next++ = '\0';
+        if (command_count == max_commands) {
+            printf("Too many commands in pipeline (max %d)\n", max_commands);
+            return 1;
         }
+        int argc = split_arguments(command, argvs[command_count], max_arguments);
+        if (argc < 0) {
+            printf("Too many arguments (max %d)\n", max_arguments);
+            return 1;
+        }
+        if (argc == 0) {
+            if (next || command_count)
+                printf("Missing command in pipeline\n");
+            return 1;
+        }
+        ++command_count;
+        command = next;
     }
-    argv[argc] = nullptr;
 
     int retval = 0;
-    if (handle_builtin(argc, argv, retval)) {
-        return 0;
+    if (command_count == 1) {
+        int argc = 0;
+        while (argvs[0][argc])
+            ++argc;
+        if (handle_builtin(argc, argvs[0], retval))
+            return 0;
     }
 
     struct termios trm;
     tcgetattr(0, &trm);
 
-    pid_t child = fork();
-    if (!child) {
-        setpgid(0, 0);
-        tcsetpgrp(0, getpid());
-        int ret = try_exec(argv[0], argv);
-        if (ret < 0) {
-            printf("exec failed: %s (%s)\n", cmd, strerror(errno));
-            exit(1);
+    int pipe_fds[max_commands - 1][2];
+    for (int i = 0; i < command_count - 1; ++i) {
+        if (pipe(pipe_fds[i]) < 0) {
+            perror("pipe");
+            for (int j = 0; j < i; ++j) {
+                close(pipe_fds[j][0]);
+                close(pipe_fds[j][1]);
+            }
+            return 1;
         }
-        // We should never get here!
-        assert(false);
     }
 
-    int wstatus = 0;
-    int rc;
-    do {
-        rc = waitpid(child, &wstatus, 0);
-        if (rc < 0 && errno != EINTR) {
-            perror("waitpid");
-            break;
+    // Spawn the commands straight into one process group of their own, there's no point in copying our address space just to exec().
+    // They start out with no signals blocked, whatever we happen to be blocking.
+    pid_t children[max_commands];
+    int spawned_count = 0;
+    pid_t pgid = 0;
+    for (int i = 0; i < command_count; ++i) {
+        posix_spawn_file_actions_t file_actions;
+        posix_spawn_file_actions_init(&file_actions);
+        if (i > 0)
+            posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[i - 1][0], 0);
+        if (i < command_count - 1)
+            posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[i][1], 1);
+        for (int j = 0; j < command_count - 1; ++j) {
+            posix_spawn_file_actions_addclose(&file_actions, pipe_fds[j][0]);
+            posix_spawn_file_actions_addclose(&file_actions, pipe_fds[j][1]);
+        }
+
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+        posix_spawnattr_setpgroup(&attr, pgid);
+        sigset_t no_signals;
+        sigemptyset(&no_signals);
+        posix_spawnattr_setsigmask(&attr, &no_signals);
+
+        int error = try_spawn(&children[spawned_count], argvs[i][0], &file_actions, &attr, argvs[i]);
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&file_actions);
+        if (error) {
+            printf("exec failed: %s (%s)\n", argvs[i][0], strerror(error));
+            retval = 1;
+            continue;
         }
-    } while(errno == EINTR);
+        if (!pgid) {
+            pgid = children[spawned_count];
+            tcsetpgrp(0, pgid);
+        }
+        ++spawned_count;
+    }
+
+    // Only the children should have the pipes open, or the readers never see the end of their input.
+    for (int i = 0; i < command_count - 1; ++i) {
+        close(pipe_fds[i][0]);
+        close(pipe_fds[i][1]);
+    }
+
+    int last_wstatus = 0;
+    for (int i = 0; i < spawned_count; ++i) {
+        int wstatus = 0;
+        int rc;
+        do {
+            rc = waitpid(children[i], &wstatus, 0);
+            if (rc < 0 && errno != EINTR) {
+                perror("waitpid");
+                break;
+            }
+        } while (rc < 0 && errno == EINTR);
+        if (i == spawned_count - 1)
+            last_wstatus = wstatus;
+    }
 
     // FIXME: Should I really have to tcsetpgrp() after my child has exited?
     //        Is the terminal controlling pgrp really still the PGID of the dead process?
@@ -199,23 +302,8 @@ static int runcmd(char* cmd)
 
     tcsetattr(0, TCSANOW, &trm);
 
-    if (WIFEXITED(wstatus)) {
-        if (WEXITSTATUS(wstatus) != 0)
-            printf("Exited with status %d\n", WEXITSTATUS(wstatus));
-    } else {
-        if (WIFSIGNALED(wstatus)) {
-            switch (WTERMSIG(wstatus)) {
-            case SIGINT:
-                printf("Interrupted\n");
-                break;
-            default:
-                printf("Terminated by signal %d\n", WTERMSIG(wstatus));
-                break;
-            }
-        } else {
-            printf("Exited abnormally\n");
-        }
-    }
+    if (spawned_count)
+        print_wait_status(last_wstatus);
     return retval;
 }
 
@@ -0,0 +1,69 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Usage: taskset <mask> <command> [arguments...]
+//        taskset -p [mask] <pid>
+// Masks are in hex, bit N for processor N. With -p and no mask, the pid's current mask is shown.
+
+static void usage()
+{
+    fprintf(stderr, "usage: taskset <mask> <command> [arguments...]\n");
+    fprintf(stderr, "       taskset -p [mask] <pid>\n");
+}
+
+static bool parse_mask(const char* text, cpu_set_t& cpuset)
+{
+    char* end;
+    cpuset.bits = strtoul(text, &end, 16);
+    if (!*text || *end || !cpuset.bits) {
+        fprintf(stderr, "taskset: invalid mask: %s\n", text);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 3 && !strcmp(argv[1], "-p")) {
+        if (argc > 4) {
+            usage();
+            return 1;
+        }
+        pid_t pid = atoi(argv[argc - 1]);
+        cpu_set_t cpuset;
+        if (argc == 4) {
+            if (!parse_mask(argv[2], cpuset))
+                return 1;
+            if (sched_setaffinity(pid, sizeof(cpuset), &cpuset) < 0) {
+                fprintf(stderr, "taskset: %d: %s\n", pid, strerror(errno));
+                return 1;
+            }
+        }
+        if (sched_getaffinity(pid, sizeof(cpuset), &cpuset) < 0) {
+            fprintf(stderr, "taskset: %d: %s\n", pid, strerror(errno));
+            return 1;
+        }
+        printf("pid %d's affinity mask: %x\n", pid, cpuset.bits);
+        return 0;
+    }
+
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+    cpu_set_t cpuset;
+    if (!parse_mask(argv[1], cpuset))
+        return 1;
+    // The mask is kept across exec(), so the command starts out pinned.
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0) {
+        perror("taskset: sched_setaffinity");
+        return 1;
+    }
+    execvp(argv[2], &argv[2]);
+    fprintf(stderr, "taskset: %s: %s\n", argv[2], strerror(errno));
+    return 1;
+}
@@ -1,77 +1,171 @@
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <pwd.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 #include <AK/HashMap.h>
 #include <AK/AKString.h>
 #include <AK/Vector.h>
 #include <AK/QuickSort.h>
+#include <Kernel/ProcessSnapshot.h>
+
+// Each frame reads /proc/all.bin through the same descriptor, and only what changed on the screen since the
+// previous frame is sent to the terminal, cell runs addressed with cursor escapes. Between frames we keep what
+// each process looked like last time, so a frame is a diff against that rather than a rebuild.
 
 static HashMap<unsigned, String>* s_usernames;
 
-struct Process {
-    pid_t pid;
-    unsigned nsched;
-    String name;
-    String state;
-    String user;
-    String priority;
-    unsigned linear;
-    unsigned committed;
-    unsigned nsched_since_prev;
-    unsigned cpu_percent;
-    unsigned cpu_percent_decimal;
+struct ProcessState {
+    dword times_scheduled;
+    // The frame this process was last seen in, so processes that are gone can be dropped.
+    unsigned last_seen_frame;
 };
 
-struct Snapshot {
-    HashMap<unsigned, Process> map;
-    dword sum_nsched { 0 };
+struct Row {
+    const ProcessSnapshotEntry* entry;
+    dword nsched_since_prev;
 };
 
-static Snapshot get_snapshot()
-{
-    Snapshot snapshot;
+static int s_snapshot_fd = -1;
+static Vector<byte> s_snapshot;
 
-    FILE* fp = fopen("/proc/all", "r");
-    if (!fp) {
-        perror("failed to open /proc/all");
+static const ProcessSnapshotHeader& read_process_snapshot()
+{
+    // Seeking back to the start is how ProcFS is asked for fresh contents, so the file only gets opened once.
+    if (s_snapshot_fd < 0) {
+        s_snapshot_fd = open("/proc/all.bin", O_RDONLY);
+        if (s_snapshot_fd < 0) {
+            perror("failed to open /proc/all.bin");
+            exit(1);
+        }
+    } else if (lseek(s_snapshot_fd, 0, SEEK_SET) < 0) {
+        perror("failed to rewind /proc/all.bin");
         exit(1);
     }
+    if (s_snapshot.is_empty())
+        s_snapshot.resize(16384);
+    int size = 0;
     for (;;) {
-        char buf[4096];
-        char* ptr = fgets(buf, sizeof(buf), fp);
-        if (!ptr)
-            break;
-        auto parts = String(buf, Chomp).split(',');
-        if (parts.size() < 17)
+        if (size == s_snapshot.size())
+            s_snapshot.resize(s_snapshot.size() * 2);
+        ssize_t nread = read(s_snapshot_fd, s_snapshot.data() + size, s_snapshot.size() - size);
+        if (nread < 0) {
+            perror("failed to read /proc/all.bin");
+            exit(1);
+        }
+        if (!nread)
             break;
-        bool ok;
-        pid_t pid = parts[0].to_uint(ok);
-        ASSERT(ok);
-        unsigned nsched = parts[1].to_uint(ok);
-        ASSERT(ok);
-        snapshot.sum_nsched += nsched;
-        Process process;
-        process.pid = pid;
-        process.nsched = nsched;
-        unsigned uid = parts[5].to_uint(ok);
-        ASSERT(ok);
-        process.user = s_usernames->get(uid);
-        process.priority = parts[16];
-        process.state = parts[7];
-        process.name = parts[11];
-        process.linear = parts[12].to_uint(ok);
-        ASSERT(ok);
-        process.committed = parts[13].to_uint(ok);
-        ASSERT(ok);
-        snapshot.map.set(pid, move(process));
+        size += nread;
     }
-    int rc = fclose(fp);
-    ASSERT(rc == 0);
-    return snapshot;
+    auto& header = *(const ProcessSnapshotHeader*)s_snapshot.data();
+    ASSERT(size >= (int)sizeof(header) && header.version == process_snapshot_version);
+    ASSERT(size >= (int)(sizeof(header) + header.process_count * header.entry_size));
+    return header;
 }
 
+// What's on the terminal right now, one line per row, each padded to the width.
+class Screen {
+public:
+    void begin_frame(int rows, int columns)
+    {
+        m_output.clear_with_capacity();
+        if (rows == m_rows && columns == m_columns)
+            return;
+        // Resized, so nothing we know about the terminal holds anymore.
+        m_rows = rows;
+        m_columns = columns;
+        m_lines.clear();
+        m_lines.resize(rows * columns);
+        for (auto& ch : m_lines)
+            ch = ' ';
+        m_scratch.resize(columns);
+        append("\033[3J\033[H\033[2J");
+        m_needs_header = true;
+    }
+
+    int rows() const { return m_rows; }
+
+    void set_header(const char* text)
+    {
+        if (!m_needs_header)
+            return;
+        // The header is drawn in its own colors, and never changes after that.
+        append("\033[H\033[47;30m");
+        append(text, min((int)strlen(text), m_columns));
+        append("\033[K\033[0m");
+        m_needs_header = false;
+    }
+
+    // Sends the parts of the row that differ from what the terminal shows.
+    void set_line(int row, const char* text)
+    {
+        char* line = &m_lines[row * m_columns];
+        int length = min((int)strlen(text), m_columns);
+        char* new_line = m_scratch.data();
+        memcpy(new_line, text, length);
+        memset(new_line + length, ' ', m_columns - length);
+
+        int column = 0;
+        while (column < m_columns) {
+            if (line[column] == new_line[column]) {
+                ++column;
+                continue;
+            }
+            // Short runs of unchanged cells cost less to send along than another escape.
+            int end = column + 1;
+            for (int same = 0; end < m_columns && same < 8; ++end) {
+                if (line[end] == new_line[end])
+                    ++same;
+                else
+                    same = 0;
+            }
+            while (end > column && line[end - 1] == new_line[end - 1])
+                --end;
+            char escape[16];
+            snprintf(escape, sizeof(escape), "\033[%d;%dH", row + 1, column + 1);
+            append(escape);
+            append(new_line + column, end - column);
+            memcpy(line + column, new_line + column, end - column);
+            column = end;
+        }
+    }
+
+    void flush()
+    {
+        if (m_output.is_empty())
+            return;
+        // Park the cursor in the bottom row, which is never drawn in, so it doesn't sit in the middle of the table.
+        char escape[16];
+        snprintf(escape, sizeof(escape), "\033[%d;1H", m_rows + 1);
+        append(escape);
+        for (int offset = 0; offset < m_output.size();) {
+            ssize_t nwritten = write(STDOUT_FILENO, m_output.data() + offset, m_output.size() - offset);
+            if (nwritten < 0) {
+                perror("write");
+                exit(1);
+            }
+            offset += nwritten;
+        }
+    }
+
+private:
+    void append(const char* text) { append(text, strlen(text)); }
+    void append(const char* text, int length)
+    {
+        for (int i = 0; i < length; ++i)
+            m_output.append(text[i]);
+    }
+
+    int m_rows { 0 };
+    int m_columns { 0 };
+    bool m_needs_header { true };
+    Vector<char> m_lines;
+    Vector<char> m_scratch;
+    Vector<char> m_output;
+};
+
 int main(int, char**)
 {
     s_usernames = new HashMap<unsigned, String>();
@@ -80,59 +174,89 @@ int main(int, char**)
         s_usernames->set(passwd->pw_uid, passwd->pw_name);
     endpwent();
 
-    Vector<Process*> processes;
-    auto prev = get_snapshot();
-    usleep(10000);
-    for (;;) {
-        auto current = get_snapshot();
-        auto sum_diff = current.sum_nsched - prev.sum_nsched;
-
-        printf("\033[3J\033[H\033[2J");
-        printf("\033[47;30m%6s  %3s  % 8s  % 8s  %6s  %6s  %4s  %s\033[K\033[0m\n",
-               "PID",
-               "PRI",
-               "USER",
-               "STATE",
-               "LINEAR",
-               "COMMIT",
-               "%CPU",
-               "NAME");
-        for (auto& it : current.map) {
-            pid_t pid = it.key;
-            if (pid == 0)
+    HashMap<pid_t, ProcessState> states;
+    Vector<Row> rows;
+    Vector<pid_t> gone;
+    Screen screen;
+    dword prev_sum_nsched = 0;
+    char line[256];
+    for (unsigned frame = 1;; ++frame) {
+        auto& header = read_process_snapshot();
+        const byte* records = s_snapshot.data() + sizeof(header);
+
+        dword sum_nsched = 0;
+        rows.clear_with_capacity();
+        for (dword i = 0; i < header.process_count; ++i) {
+            auto& entry = *(const ProcessSnapshotEntry*)(records + i * header.entry_size);
+            sum_nsched += entry.times_scheduled;
+            auto it = states.find(entry.pid);
+            if (it == states.end()) {
+                // Nothing to compare a new process with yet, it shows up from the next frame on.
+                states.set(entry.pid, { entry.times_scheduled, frame });
                 continue;
-            dword nsched_now = it.value.nsched;
-            auto jt = prev.map.find(pid);
-            if (jt == prev.map.end())
+            }
+            auto& state = (*it).value;
+            dword nsched_since_prev = entry.times_scheduled - state.times_scheduled;
+            state.times_scheduled = entry.times_scheduled;
+            state.last_seen_frame = frame;
+            if (entry.pid == 0)
                 continue;
-            dword nsched_before = (*jt).value.nsched;
-            dword nsched_diff = nsched_now - nsched_before;
-            it.value.nsched_since_prev = nsched_diff;
-            it.value.cpu_percent = ((nsched_diff * 100)/ sum_diff);
-            it.value.cpu_percent_decimal = (((nsched_diff * 1000)/ sum_diff) % 10);
-            processes.append(&it.value);
+            rows.append({ &entry, nsched_since_prev });
         }
+        for (auto& it : states) {
+            if (it.value.last_seen_frame != frame)
+                gone.append(it.key);
+        }
+        for (auto pid : gone)
+            states.remove(pid);
+        gone.clear_with_capacity();
 
+        dword sum_diff = sum_nsched - prev_sum_nsched;
+        prev_sum_nsched = sum_nsched;
+        if (frame == 1) {
+            usleep(10000);
+            continue;
+        }
 
-        quick_sort(processes.begin(), processes.end(), [] (auto* p1, auto* p2) {
-            return p2->nsched_since_prev < p1->nsched_since_prev;
+        // Ties go by pid, so rows with the same load don't trade places every frame.
+        quick_sort(rows.begin(), rows.end(), [] (const Row& a, const Row& b) {
+            if (a.nsched_since_prev != b.nsched_since_prev)
+                return b.nsched_since_prev < a.nsched_since_prev;
+            return a.entry->pid < b.entry->pid;
         });
 
-        for (auto* process : processes) {
-            printf("%6d  %c    % 8s  % 8s  %6u  %6u  %2u.%1u  %s\n",
-                process->pid,
-                process->priority[0],
-                process->user.characters(),
-                process->state.characters(),
-                process->linear / 1024,
-                process->committed / 1024,
-                process->cpu_percent,
-                process->cpu_percent_decimal,
-                process->name.characters()
-            );
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || !ws.ws_row || !ws.ws_col) {
+            ws.ws_row = 25;
+            ws.ws_col = 80;
+        }
+        // The bottom row is left alone, so writing the last cell of the table can't scroll the screen.
+        screen.begin_frame(ws.ws_row - 1, min((int)ws.ws_col, (int)sizeof(line) - 1));
+        snprintf(line, sizeof(line), "%6s  %3s  % 8s  % 8s  %6s  %6s  %4s  %s", "PID", "PRI", "USER", "STATE", "LINEAR", "COMMIT", "%CPU", "NAME");
+        screen.set_header(line);
+
+        for (int row = 1; row < screen.rows(); ++row) {
+            if (row - 1 >= rows.size()) {
+                screen.set_line(row, "");
+                continue;
+            }
+            auto& process = rows[row - 1];
+            auto& entry = *process.entry;
+            unsigned cpu_permille = sum_diff ? (process.nsched_since_prev * 1000) / sum_diff : 0;
+            auto user = s_usernames->get(entry.uid);
+            snprintf(line, sizeof(line), "%6d  %c    % 8s  % 8.8s  %6u  %6u  %2u.%1u  %.32s",
+                entry.pid,
+                entry.priority[0],
+                user.characters(),
+                entry.state,
+                entry.amount_virtual / 1024,
+                entry.amount_resident / 1024,
+                cpu_permille / 10,
+                cpu_permille % 10,
+                entry.name);
+            screen.set_line(row, line);
         }
-        processes.clear_with_capacity();
-        prev = move(current);
+        screen.flush();
         sleep(1);
     }
     return 0;
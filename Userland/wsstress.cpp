@@ -0,0 +1,151 @@
+#include <AK/QuickSort.h>
+#include <AK/StdLibExtras.h>
+#include <LibGUI/GApplication.h>
+#include <LibGUI/GEventLoop.h>
+#include <LibGUI/GPainter.h>
+#include <LibGUI/GTimer.h>
+#include <LibGUI/GWidget.h>
+#include <LibGUI/GWindow.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Usage: wsstress [window count] [seconds] [translucent]
+// Opens a bunch of windows (8 unless told otherwise), repaints and moves each of them on every tick for a while
+// (10 seconds), and samples the WindowServer's compositor stats as it goes. At the end it prints the frame times
+// as "<name>\t<value>\t<unit>" lines like bench does. With "translucent", the windows are half see-through.
+
+class AnimatedWidget final : public GWidget {
+public:
+    explicit AnimatedWidget(int index)
+        : m_index(index)
+    {
+    }
+
+    void advance()
+    {
+        ++m_frame;
+        update();
+    }
+
+private:
+    virtual void paint_event(GPaintEvent& event) override
+    {
+        GPainter painter(*this);
+        painter.add_clip_rect(event.rect());
+        // A band that moves across, over a background that changes colour, so every frame paints everything.
+        byte shade = (m_frame * 4 + m_index * 32) & 0xff;
+        painter.fill_rect(rect(), Color(shade, 255 - shade, (m_index * 64) & 0xff));
+        int band_width = max(1, width() / 4);
+        int band_x = (m_frame * 3) % max(1, width());
+        painter.fill_rect({ band_x, 0, band_width, height() }, Color::White);
+        painter.draw_text(rect(), String::format("window %d frame %d", m_index, m_frame), TextAlignment::Center, Color::Black);
+    }
+
+    int m_index { 0 };
+    int m_frame { 0 };
+};
+
+struct Sample {
+    int compose_time_us;
+    int flush_time_us;
+    int rect_count;
+};
+
+static bool get_compositor_stats(WSAPI_ServerMessage& response)
+{
+    WSAPI_ClientMessage request;
+    request.type = WSAPI_ClientMessage::Type::GetCompositorStats;
+    response = GEventLoop::current().sync_request(request, WSAPI_ServerMessage::Type::DidGetCompositorStats);
+    return response.type == WSAPI_ServerMessage::Type::DidGetCompositorStats;
+}
+
+static int percentile(Vector<int>& values, int percent)
+{
+    if (values.is_empty())
+        return 0;
+    quick_sort(values.begin(), values.end(), [] (int a, int b) { return a < b; });
+    return values[min(values.size() - 1, values.size() * percent / 100)];
+}
+
+static void report(const char* name, int value, const char* unit)
+{
+    printf("%s\t%d\t%s\n", name, value, unit);
+}
+
+int main(int argc, char** argv)
+{
+    GApplication app(argc, argv);
+
+    int window_count = argc > 1 ? atoi(argv[1]) : 8;
+    int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    bool translucent = argc > 3 && !strcmp(argv[3], "translucent");
+    static const int tick_interval_ms = 16;
+
+    Vector<GWindow*> windows;
+    Vector<AnimatedWidget*> widgets;
+    for (int i = 0; i < window_count; ++i) {
+        auto* window = new GWindow;
+        window->set_title(String::format("wsstress %d", i));
+        window->set_rect({ 40 + (i % 8) * 60, 60 + (i / 8) * 40 + (i % 8) * 30, 240, 160 });
+        if (translucent)
+            window->set_opacity(0.5f);
+        auto* widget = new AnimatedWidget(i);
+        window->set_main_widget(widget);
+        window->show();
+        windows.append(window);
+        widgets.append(widget);
+    }
+
+    Vector<Sample> samples;
+    unsigned last_compose_count = 0;
+    int ticks = 0;
+    int total_ticks = seconds * 1000 / tick_interval_ms;
+
+    GTimer timer;
+    timer.on_timeout = [&] {
+        for (int i = 0; i < windows.size(); ++i) {
+            widgets[i]->advance();
+            // Back and forth, so the window moves every tick without leaving the screen.
+            int offset = (ticks + i * 10) % 80;
+            int dx = offset < 40 ? 2 : -2;
+            windows[i]->move_to(windows[i]->rect().location().translated(dx, 0));
+        }
+
+        WSAPI_ServerMessage response;
+        if (get_compositor_stats(response) && response.compositor_stats.compose_count != last_compose_count) {
+            last_compose_count = response.compositor_stats.compose_count;
+            samples.append({ response.compositor_stats.compose_time_us, response.compositor_stats.flush_time_us, response.compositor_stats.rect_count });
+        }
+
+        if (++ticks < total_ticks)
+            return;
+        timer.stop();
+
+        Vector<int> compose_times;
+        Vector<int> flush_times;
+        qword total_compose = 0;
+        qword total_flush = 0;
+        qword total_rects = 0;
+        for (auto& sample : samples) {
+            compose_times.append(sample.compose_time_us);
+            flush_times.append(sample.flush_time_us);
+            total_compose += sample.compose_time_us;
+            total_flush += sample.flush_time_us;
+            total_rects += sample.rect_count;
+        }
+        int count = max(samples.size(), 1);
+        report("frames_sampled", samples.size(), "frames");
+        report("compose_average", total_compose / count, "us");
+        report("compose_p50", percentile(compose_times, 50), "us");
+        report("compose_p95", percentile(compose_times, 95), "us");
+        report("compose_max", percentile(compose_times, 100), "us");
+        report("flush_average", total_flush / count, "us");
+        report("flush_p95", percentile(flush_times, 95), "us");
+        report("rects_average", total_rects / count, "rects");
+        app.quit(0);
+    };
+    timer.start(tick_interval_ms);
+
+    return app.exec();
+}